@@ -35,10 +35,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sched.h>
 #include <string.h>
 #include <sys/ipc.h>
 #include <sys/param.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -47,14 +47,6 @@
 
 #include "config.h"
 
-#ifndef HAVE_SEMUN
-union semun {
-    int val;               // value for SETVAL
-    struct semid_ds *buf;  // buffer for IPC_STAT & IPC_SET
-    u_short *array;        // array for GETALL & SETALL
-};
-#endif
-
 #include "bookkeeper.h"
 #include "util.h"
 
@@ -64,10 +56,6 @@ static bookkeeper_list_t *bookkeeper_list = NULL;
 
 static key_t hash(char *str, int flag);
 
-static void sem_lock(int sem_set_id);
-
-static void sem_unlock(int sem_set_id);
-
 static inline bookkeeper_list_t *Get_bookkeeper_list_entry(bookkeeper_t *bookkeeper);
 
 /* Create shared memory object and set its size */
@@ -94,33 +82,76 @@ static key_t hash(char *str, int flag) {
 
 }  // End of hash
 
-// locks the semaphore, for exclusive access to the bookkeeping record
-static void sem_lock(int sem_set_id) {
-    struct sembuf sem_op;
+/*
+ * The bookkeeping record is shared between the collector and nfexpire.
+ * Access is synchronized by a seqlock on the sequence number: A writer makes
+ * the sequence odd, while it updates the record and even again, when done.
+ * Readers retry, if the sequence was odd or changed while reading the record.
+ * Updates are a few stores only, so no process blocks for long in the kernel.
+ */
 
-    /* wait on the semaphore, unless it's value is non-negative. */
-    sem_op.sem_num = 0;
-    sem_op.sem_op = -1;
-    sem_op.sem_flg = 0;
-    if (semop(sem_set_id, &sem_op, 1) == 0) return;
+// max number of spins, if a writer died while holding the record
+#define MAXBOOKSPIN 100000
 
-    LogError("semop() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+// get exclusive write access to the bookkeeping record - returns the odd sequence
+static uint64_t books_lock(bookkeeper_t *bookkeeper) {
+    uint64_t seq = __atomic_load_n(&bookkeeper->sequence, __ATOMIC_RELAXED);
+    uint64_t staleSeq = seq;
+    uint32_t spin = 0;
 
-}  // End of sem_lock
+    while (1) {
+        if ((seq & 1) == 0) {
+            if (__atomic_compare_exchange_n(&bookkeeper->sequence, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return seq + 1;
+            // seq reloaded by failed CAS
+            continue;
+        }
 
-// sem_unlock. un-locks the semaphore.
-static void sem_unlock(int sem_set_id) {
-    struct sembuf sem_op;
+        if (seq != staleSeq) {
+            staleSeq = seq;
+            spin = 0;
+        } else if (++spin > MAXBOOKSPIN) {
+            // odd sequence unchanged for too long - a writer died while updating. Take over
+            LogError("Recover stale lock of bookkeeping record");
+            if (__atomic_compare_exchange_n(&bookkeeper->sequence, &seq, seq + 2, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return seq + 2;
+            spin = 0;
+            continue;
+        }
+        sched_yield();
+        seq = __atomic_load_n(&bookkeeper->sequence, __ATOMIC_RELAXED);
+    }
 
-    /* signal the semaphore - increase its value by one. */
-    sem_op.sem_num = 0;
-    sem_op.sem_op = 1;
-    sem_op.sem_flg = 0;
-    if (semop(sem_set_id, &sem_op, 1) == 0) return;
+}  // End of books_lock
 
-    LogError("semop() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+static inline void books_unlock(bookkeeper_t *bookkeeper, uint64_t seq) {
+    __atomic_store_n(&bookkeeper->sequence, seq + 1, __ATOMIC_RELEASE);
+}  // End of books_unlock
 
-}  // End of sem_unlock
+#define BOOKSTORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define BOOKLOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+// consistent copy of the bookkeeping record without blocking any writer
+static void books_read(bookkeeper_t *bookkeeper, bookkeeper_t *books) {
+    uint64_t seq;
+
+    while (1) {
+        seq = __atomic_load_n(&bookkeeper->sequence, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        books->nfcapd_pid = BOOKLOAD(bookkeeper->nfcapd_pid);
+        books->first = BOOKLOAD(bookkeeper->first);
+        books->last = BOOKLOAD(bookkeeper->last);
+        books->numfiles = BOOKLOAD(bookkeeper->numfiles);
+        books->filesize = BOOKLOAD(bookkeeper->filesize);
+        books->max_filesize = BOOKLOAD(bookkeeper->max_filesize);
+        books->max_lifetime = BOOKLOAD(bookkeeper->max_lifetime);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&bookkeeper->sequence, __ATOMIC_RELAXED) == seq) break;
+    }
+    books->sequence = seq;
+
+}  // End of books_read
 
 static inline bookkeeper_list_t *Get_bookkeeper_list_entry(bookkeeper_t *bookkeeper) {
     bookkeeper_list_t *bookkeeper_list_entry;
@@ -135,8 +166,7 @@ static inline bookkeeper_list_t *Get_bookkeeper_list_entry(bookkeeper_t *bookkee
 }  // End of Get_bookkeeper_list_entry
 
 int InitBookkeeper(bookkeeper_t **bookkeeper, char *path, pid_t nfcapd_pid) {
-    int sem_key, shm_key, shm_id, sem_id;
-    union semun sem_val;
+    int shm_key, shm_id;
     bookkeeper_list_t **bookkeeper_list_entry;
 
     *bookkeeper = NULL;
@@ -220,48 +250,9 @@ int InitBookkeeper(bookkeeper_t **bookkeeper, char *path, pid_t nfcapd_pid) {
         memset((void *)(*bookkeeper), 0, sizeof(bookkeeper_t));
     }
     // at this point we now have a valid record and can proceed
+    // no other process uses this record yet - the sequence stays even
     (*bookkeeper)->nfcapd_pid = nfcapd_pid;
-    (*bookkeeper)->sequence++;
-
-    // create semaphore
-
-    sem_key = hash(path, 1);
-    // this should never fail, as we already got a key for the shared memory
-    if (sem_key == -1) {
-        // .. but catch it anyway .. and release shared memory. something is fishy
-        struct shmid_ds buf;
-        shmdt((void *)(*bookkeeper));
-        shmctl(shm_id, IPC_RMID, &buf);
-        return ERR_FAILED;
-    }
-
-    // get the semaphore
-    sem_id = semget(sem_key, 1, IPC_CREAT | 0600);
-    if (sem_id == -1) {
-        struct shmid_ds buf;
-
-        // this should not have failed
-        LogError("semget() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-
-        // release shared memory
-        shmdt((void *)(*bookkeeper));
-        shmctl(shm_id, IPC_RMID, &buf);
-        return ERR_FAILED;
-    }
-
-    // initialize the semaphore
-    sem_val.val = 1;
-    if (semctl(sem_id, 0, SETVAL, sem_val) == -1) {
-        struct shmid_ds buf;
-
-        // this should not have failed
-        LogError("semctl() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-
-        // release shared memory
-        shmdt((void *)(*bookkeeper));
-        shmctl(shm_id, IPC_RMID, &buf);
-        return ERR_FAILED;
-    }
+    (*bookkeeper)->sequence += 2;
 
     bookkeeper_list_entry = &bookkeeper_list;
     while (*bookkeeper_list_entry != NULL) bookkeeper_list_entry = &((*bookkeeper_list_entry)->next);
@@ -273,13 +264,11 @@ int InitBookkeeper(bookkeeper_t **bookkeeper, char *path, pid_t nfcapd_pid) {
         LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         shmdt((void *)(*bookkeeper));
         shmctl(shm_id, IPC_RMID, &buf);
-        semctl(sem_id, 0, IPC_RMID);
         return ERR_FAILED;
     }
     memset((void *)*bookkeeper_list_entry, 0, sizeof(bookkeeper_list_t));
 
     (*bookkeeper_list_entry)->shm_id = shm_id;
-    (*bookkeeper_list_entry)->sem_id = sem_id;
     (*bookkeeper_list_entry)->bookkeeper = *bookkeeper;
     (*bookkeeper_list_entry)->next = NULL;
 
@@ -290,7 +279,7 @@ int InitBookkeeper(bookkeeper_t **bookkeeper, char *path, pid_t nfcapd_pid) {
 
 int AccessBookkeeper(bookkeeper_t **bookkeeper, char *path) {
     bookkeeper_list_t **bookkeeper_list_entry;
-    int sem_key, shm_key, shm_id, sem_id;
+    int shm_key, shm_id;
 
     *bookkeeper = NULL;
 
@@ -323,23 +312,6 @@ int AccessBookkeeper(bookkeeper_t **bookkeeper, char *path) {
     }
     // at this point we now have a valid record and can proceed
 
-    // create semaphore
-    sem_key = hash(path, 1);
-    // this should never fail, as we already got a key for the shared memory
-    if (sem_key == -1) {
-        // .. but catch it anyway .. and release shared memory. something is fishy
-        return ERR_FAILED;
-    }
-
-    // get the semaphore
-    sem_id = semget(sem_key, 1, 0600);
-    if (sem_id == -1) {
-        // this should not have failed
-        LogError("semget() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-
-        return ERR_FAILED;
-    }
-
     // map the shared segment
     *bookkeeper = (bookkeeper_t *)shmat(shm_id, NULL, 0);
     if (*bookkeeper == (bookkeeper_t *)-1) {
@@ -361,7 +333,6 @@ int AccessBookkeeper(bookkeeper_t **bookkeeper, char *path) {
     }
 
     (*bookkeeper_list_entry)->shm_id = shm_id;
-    (*bookkeeper_list_entry)->sem_id = sem_id;
     (*bookkeeper_list_entry)->bookkeeper = *bookkeeper;
     (*bookkeeper_list_entry)->next = NULL;
 
@@ -393,159 +364,71 @@ void ReleaseBookkeeper(bookkeeper_t *bookkeeper, int destroy) {
         // Entry no longer valid
         bookkeeper_list_entry->bookkeeper = NULL;
         bookkeeper_list_entry->shm_id = 0;
-        bookkeeper_list_entry->sem_id = 0;
         return;
     }
 
-    // prevent other proceeses to access the share memory, while we are removing it
-    // try to clean up.
-    sem_lock(bookkeeper_list_entry->sem_id);
+    // the segment is removed, once the last process detached
     if (shmctl(bookkeeper_list_entry->shm_id, IPC_RMID, &buf)) {
         // ups ..
         LogError("shmctl() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
     }
-    sem_unlock(bookkeeper_list_entry->sem_id);
-
-    if (semctl(bookkeeper_list_entry->sem_id, 0, IPC_RMID) == -1) {
-        // ups ..
-        LogError("semctl() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-    }
 
     // Entry no longer valid
     bookkeeper_list_entry->bookkeeper = NULL;
     bookkeeper_list_entry->shm_id = 0;
-    bookkeeper_list_entry->sem_id = 0;
 
 }  // End of ReleaseBookkeeper
 
-int LookBooks(bookkeeper_t *bookkeeper) {
-    bookkeeper_list_t *bookkeeper_list_entry;
-
-    if (!bookkeeper) return 0;
-
-    bookkeeper_list_entry = Get_bookkeeper_list_entry(bookkeeper);
-    if (!bookkeeper_list_entry) {
-        // this should never happen
-        LogError("Software error in %s line %d: %s", __FILE__, __LINE__, "Entry not found in list");
-        return 1;
-    }
-
-    sem_lock(bookkeeper_list_entry->sem_id);
-
-    return 0;
-
-}  // End of LookBooks
-
-int UnlookBooks(bookkeeper_t *bookkeeper) {
-    bookkeeper_list_t *bookkeeper_list_entry;
-
-    if (!bookkeeper) return 0;
-
-    bookkeeper_list_entry = Get_bookkeeper_list_entry(bookkeeper);
-    if (!bookkeeper_list_entry) {
-        // this should never happen
-        LogError("Software error in %s line %d: %s", __FILE__, __LINE__, "Entry not found in list");
-        return 1;
-    }
-
-    sem_unlock(bookkeeper_list_entry->sem_id);
-
-    return 0;
-
-}  // End of UnlookBooks
-
 void ClearBooks(bookkeeper_t *bookkeeper, bookkeeper_t *tmp_books) {
-    bookkeeper_list_t *bookkeeper_list_entry;
-
     if (!bookkeeper) return;
 
-    bookkeeper_list_entry = Get_bookkeeper_list_entry(bookkeeper);
-    if (!bookkeeper_list_entry) {
-        // this should never happen
-        LogError("Software error in %s line %d: %s", __FILE__, __LINE__, "Entry not found in list");
-        return;
-    }
-
-    sem_lock(bookkeeper_list_entry->sem_id);
+    uint64_t seq = books_lock(bookkeeper);
     // backup copy
     if (tmp_books != NULL) {
         memcpy((void *)tmp_books, (void *)bookkeeper, sizeof(bookkeeper_t));
+        tmp_books->sequence = seq + 1;
     }
-    bookkeeper->first = 0;
-    bookkeeper->last = 0;
-    bookkeeper->numfiles = 0;
-    bookkeeper->filesize = 0;
-    bookkeeper->sequence++;
-    sem_unlock(bookkeeper_list_entry->sem_id);
+    BOOKSTORE(bookkeeper->first, 0);
+    BOOKSTORE(bookkeeper->last, 0);
+    BOOKSTORE(bookkeeper->numfiles, 0);
+    BOOKSTORE(bookkeeper->filesize, 0);
+    books_unlock(bookkeeper, seq);
 
 }  // End of ClearBooks
 
 uint64_t BookSequence(bookkeeper_t *bookkeeper) {
-    bookkeeper_list_t *bookkeeper_list_entry;
-    uint64_t seq;
-
     if (!bookkeeper) return 0;
 
-    bookkeeper_list_entry = Get_bookkeeper_list_entry(bookkeeper);
-    if (!bookkeeper_list_entry) {
-        // this should never happen
-        LogError("Software error in %s line %d: %s", __FILE__, __LINE__, "Entry not found in list");
-        return 0;
-    }
-
-    sem_lock(bookkeeper_list_entry->sem_id);
-    seq = bookkeeper->sequence;
-    sem_unlock(bookkeeper_list_entry->sem_id);
-
-    return seq;
+    // an odd sequence differs from the final one, so a concurrent update is detected as well
+    return __atomic_load_n(&bookkeeper->sequence, __ATOMIC_ACQUIRE);
 
 }  // End of BookSequence
 
 void UpdateBooks(bookkeeper_t *bookkeeper, time_t when, uint64_t size) {
-    bookkeeper_list_t *bookkeeper_list_entry;
-
     if (!bookkeeper) return;
 
-    bookkeeper_list_entry = Get_bookkeeper_list_entry(bookkeeper);
-    if (!bookkeeper_list_entry) {
-        // this should never happen
-        LogError("Software error in %s line %d: %s", __FILE__, __LINE__, "Entry not found in list");
-        return;
-    }
-
-    sem_lock(bookkeeper_list_entry->sem_id);
-    if (bookkeeper->first == 0) bookkeeper->first = when;
+    uint64_t seq = books_lock(bookkeeper);
+    if (bookkeeper->first == 0) BOOKSTORE(bookkeeper->first, when);
 
-    bookkeeper->last = when;
-    bookkeeper->numfiles++;
-    bookkeeper->filesize += size;
-    bookkeeper->sequence++;
-    sem_unlock(bookkeeper_list_entry->sem_id);
+    BOOKSTORE(bookkeeper->last, when);
+    BOOKSTORE(bookkeeper->numfiles, bookkeeper->numfiles + 1);
+    BOOKSTORE(bookkeeper->filesize, bookkeeper->filesize + size);
+    books_unlock(bookkeeper, seq);
 
 }  // End of UpdateBooks
 
 void UpdateBooksParam(bookkeeper_t *bookkeeper, time_t lifetime, uint64_t maxsize) {
-    bookkeeper_list_t *bookkeeper_list_entry;
-
     if (!bookkeeper) return;
 
-    bookkeeper_list_entry = Get_bookkeeper_list_entry(bookkeeper);
-    if (!bookkeeper_list_entry) {
-        // this should never happen
-        LogError("Software error in %s line %d: %s", __FILE__, __LINE__, "Entry not found in list");
-        return;
-    }
-
-    sem_lock(bookkeeper_list_entry->sem_id);
-    bookkeeper->max_lifetime = lifetime;
-    bookkeeper->max_filesize = maxsize;
-    bookkeeper->sequence++;
-    sem_unlock(bookkeeper_list_entry->sem_id);
+    uint64_t seq = books_lock(bookkeeper);
+    BOOKSTORE(bookkeeper->max_lifetime, lifetime);
+    BOOKSTORE(bookkeeper->max_filesize, maxsize);
+    books_unlock(bookkeeper, seq);
 
 }  // End of UpdateBooksParam
 
 void PrintBooks(bookkeeper_t *bookkeeper) {
-    bookkeeper_list_t *bookkeeper_list_entry;
+    bookkeeper_t books;
     struct tm *ts;
     time_t t;
     char string[32];
@@ -555,32 +438,24 @@ void PrintBooks(bookkeeper_t *bookkeeper) {
         return;
     }
 
-    bookkeeper_list_entry = Get_bookkeeper_list_entry(bookkeeper);
-    if (!bookkeeper_list_entry) {
-        // this should never happen
-        LogError("Software error in %s line %d: %s", __FILE__, __LINE__, "Entry not found in list");
-        return;
-    }
-
-    sem_lock(bookkeeper_list_entry->sem_id);
-    printf("Collector process: %lu\n", (unsigned long)bookkeeper->nfcapd_pid);
-    printf("Record sequence  : %llu\n", (unsigned long long)bookkeeper->sequence);
+    books_read(bookkeeper, &books);
+    printf("Collector process: %lu\n", (unsigned long)books.nfcapd_pid);
+    printf("Record sequence  : %llu\n", (unsigned long long)books.sequence);
 
-    t = bookkeeper->first;
+    t = books.first;
     ts = localtime(&t);
     strftime(string, 31, "%Y-%m-%d %H:%M:%S", ts);
     string[31] = '\0';
-    printf("First           : %s\n", bookkeeper->first ? string : "<not set>");
+    printf("First           : %s\n", books.first ? string : "<not set>");
 
-    t = bookkeeper->last;
+    t = books.last;
     ts = localtime(&t);
     strftime(string, 31, "%Y-%m-%d %H:%M:%S", ts);
     string[31] = '\0';
-    printf("Last            : %s\n", bookkeeper->last ? string : "<not set>");
-    printf("Number of files : %llu\n", (unsigned long long)bookkeeper->numfiles);
-    printf("Total file size : %llu\n", (unsigned long long)bookkeeper->filesize);
-    printf("Max file size   : %llu\n", (unsigned long long)bookkeeper->max_filesize);
-    printf("Max life time   : %llu\n", (unsigned long long)bookkeeper->max_lifetime);
-    sem_unlock(bookkeeper_list_entry->sem_id);
+    printf("Last            : %s\n", books.last ? string : "<not set>");
+    printf("Number of files : %llu\n", (unsigned long long)books.numfiles);
+    printf("Total file size : %llu\n", (unsigned long long)books.filesize);
+    printf("Max file size   : %llu\n", (unsigned long long)books.max_filesize);
+    printf("Max life time   : %llu\n", (unsigned long long)books.max_lifetime);
 
 }  // End of PrintBooks
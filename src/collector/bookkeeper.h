@@ -48,7 +48,7 @@ typedef struct bookkeeper_s {
     // collector infos
     pid_t nfcapd_pid;
 
-    // track info
+    // track info - seqlock: odd while the record gets updated
     uint64_t sequence;
 
     // file infos
@@ -61,14 +61,13 @@ typedef struct bookkeeper_s {
 
 } bookkeeper_t;
 
-// All bookkeepers are put into a linked list, to have all the shm_id,sem_id
+// All bookkeepers are put into a linked list, to have all the shm_id
 typedef struct bookkeeper_list_s {
     struct bookkeeper_list_s *next;
 
     bookkeeper_t *bookkeeper;
 
     // shared parameters
-    int sem_id;
     int shm_id;
 
 } bookkeeper_list_t;
@@ -82,10 +81,6 @@ void ReleaseBookkeeper(bookkeeper_t *bookkeeper, int destroy);
 
 void ClearBooks(bookkeeper_t *bookkeeper, bookkeeper_t *tmp_books);
 
-int LookBooks(bookkeeper_t *bookkeeper);
-
-int UnlookBooks(bookkeeper_t *bookkeeper);
-
 uint64_t BookSequence(bookkeeper_t *bookkeeper);
 
 void UpdateBooks(bookkeeper_t *bookkeeper, time_t when, uint64_t size);
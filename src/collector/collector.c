@@ -35,7 +35,9 @@
 #include <ctype.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,36 +50,145 @@
 #include <unistd.h>
 
 #include "bookkeeper.h"
+#include "catalog.h"
 #include "conf/nfconf.h"
 #include "flist.h"
 #include "launch.h"
+#include "metric.h"
 #include "nfdump.h"
 #include "nffile.h"
+#include "nfstatfile.h"
 #include "nfxV3.h"
+#include "profiler.h"
+#include "publish.h"
+#include "queue.h"
+#include "rollup.h"
 #include "util.h"
 
+/*
+ * Rotated files are finalized by a background thread, so the receive loop does
+ * not wait for the writer to drain, the appendix and the rename. Jobs are
+ * processed in order, so launcher messages are sent after the files of the
+ * time slot are in place.
+ */
+enum { FINALIZE_FILE = 1, FINALIZE_LAUNCH };
+
+typedef struct finalizeJob_s {
+    int type;
+    time_t t_start;
+    char *datadir;
+    char ident[IDENTLEN];
+    // FINALIZE_FILE
+    nffile_t *nffile;
+    bookkeeper_t *bookkeeper;
+    char closing[MAXPATHLEN];  // temporary name of the rotated file
+    char filename[MAXPATHLEN];
+    char rollupFile[MAXPATHLEN];  // rollup file of the rotated file, if any
+    void *profileFile;            // profiler tap of the rotated file, if any
+    // FINALIZE_LAUNCH
+    int pfd;
+    char fmt[32];
+    char subdir[MAXPATHLEN];
+} finalizeJob_t;
+
+#define FINALIZEQUEUESIZE 1024
+
+static queue_t *finalizeQueue = NULL;
+static pthread_t finalizeTID;
+static pthread_once_t finalizeOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t finalizeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t finalizeCond = PTHREAD_COND_INITIALIZER;
+static uint32_t finalizePending = 0;
+static _Atomic int launcherFailed = 0;
+
 /* local variables */
-static uint32_t exporter_sysid = 0;
+// exporter IDs are unique across all receive workers
+static _Atomic uint32_t exporter_sysid = 0;
 static char *DynamicSourcesDir = NULL;
 
+// rollup files are written to <rollupDir>/<ident>/<subdir>/nfcapd.<time>
+static char *rollupDir = NULL;
+static char *rollupSpec = NULL;
+
+// blocks of all collector files are published to live subscribers
+static int livePublisher = 0;
+
 /* local prototypes */
 static uint32_t AssignExporterID(void);
 
+static void FinalizeFile(finalizeJob_t *job);
+
+static void WriteRollupFile(finalizeJob_t *job);
+
 #include "nffile_inline.c"
 
 /* local functions */
 static uint32_t AssignExporterID(void) {
-    if (exporter_sysid >= 0xFFFF) {
+    uint32_t sysid = atomic_fetch_add(&exporter_sysid, 1) + 1;
+    if (sysid > 0xFFFF) {
         LogError("Too many exporters (id > 65535). Flow records collected but without reference to exporter");
         return 0;
     }
 
-    return ++exporter_sysid;
+    return sysid;
 
 }  // End of AssignExporterID
 
+// write the aggregated flows of the rotated file. If another receive worker already
+// wrote the rollup of this slot, the file gets appended - the flows are still mergeable
+static void WriteRollupFile(finalizeJob_t *job) {
+    nffile_t *nffile = job->nffile;
+    char tmpFile[MAXPATHLEN];
+    int len = snprintf(tmpFile, MAXPATHLEN, "%s.%d", job->rollupFile, (int)getpid());
+    if (len < 0 || len >= MAXPATHLEN) {
+        LogError("Ident: %s, rollup file name too long: %s", job->ident, job->rollupFile);
+        return;
+    }
+
+    int compress = nffile->file_header->compression | (nffile->compression_level << 16);
+    if (!RollupWrite(nffile->rollup, tmpFile, job->ident, compress, nffile->stat_record)) return;
+    if (RenameAppend(tmpFile, job->rollupFile) < 0) {
+        LogError("Ident: %s, Can't rename rollup file: %s", job->ident, strerror(errno));
+        unlink(tmpFile);
+    }
+
+}  // End of WriteRollupFile
+
 /* global functions */
 
+int SetRollup(char *dir, char *aggregation) {
+    if (!aggregation) aggregation = ROLLUPDEFAULT;
+    if (!RollupCheck(aggregation)) return 0;
+
+    rollupDir = dir;
+    rollupSpec = aggregation;
+    return 1;
+
+}  // End of SetRollup
+
+// publish the blocks of all collector files on the live socket
+int SetLivePublisher(char *socketPath) {
+    if (!StartPublisher(socketPath)) return 0;
+    livePublisher = 1;
+    return 1;
+
+}  // End of SetLivePublisher
+
+// tap of the collector files - hand the blocks to the live subscribers and the profiler
+static void CollectorTap(void *arg, const dataBlock_t *dataBlock) {
+    if (livePublisher) PublishBlock(NULL, dataBlock);
+    if (arg) ProfileBlock(arg, dataBlock);
+}  // End of CollectorTap
+
+// aggregate the flows of a new file for its rollup file and tap its blocks for live subscribers
+// and the profiler
+void PrepareNewFile(nffile_t *nffile) {
+    if (!nffile) return;
+    if (rollupSpec) nffile->rollup = RollupNew(rollupSpec);
+    void *profileFile = ProfileAttach(nffile->ident);
+    if (livePublisher || profileFile) SetBlockTap(nffile, CollectorTap, profileFile);
+}  // End of PrepareNewFile
+
 int SetDynamicSourcesDir(FlowSource_t **FlowSource, char *dir) {
     if (*FlowSource) {
         LogError("Can not mix IP specific and any IP sources");
@@ -356,7 +467,153 @@ FlowSource_t *AddDynamicSource(FlowSource_t **FlowSource, struct sockaddr_storag
 
 }  // End of AddDynamicSource
 
+// clone all static flow sources for a receive worker. The clones share the bookkeeper
+// and the data dir with the original sources, but write their own current file
+FlowSource_t *CloneFlowSources(FlowSource_t *FlowSource, uint32_t worker) {
+    FlowSource_t *clones = NULL;
+    FlowSource_t **clone = &clones;
+
+    for (FlowSource_t *fs = FlowSource; fs; fs = fs->next) {
+        *clone = (FlowSource_t *)calloc(1, sizeof(FlowSource_t));
+        if (!*clone) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return NULL;
+        }
+
+        memcpy((*clone)->Ident, fs->Ident, IDENTLEN);
+        (*clone)->ip = fs->ip;
+        (*clone)->sa_family = fs->sa_family;
+        (*clone)->any_source = fs->any_source;
+        (*clone)->bookkeeper = fs->bookkeeper;
+        (*clone)->datadir = fs->datadir;
+        (*clone)->subdir = fs->subdir;
+
+        char s[MAXPATHLEN];
+        if (snprintf(s, MAXPATHLEN - 1, "%s.%u", fs->current, worker) >= (MAXPATHLEN - 1)) {
+            LogError("Path too long: %s", fs->current);
+            return NULL;
+        }
+        (*clone)->current = strdup(s);
+        if (!(*clone)->current) {
+            LogError("strdup() error: %s", strerror(errno));
+            return NULL;
+        }
+
+        clone = &((*clone)->next);
+    }
+
+    return clones;
+
+}  // End of CloneFlowSources
+
+void FreeFlowSourceClones(FlowSource_t *clones) {
+    if (clones && clones->sourceCache) {
+        free(clones->sourceCache->table);
+        free(clones->sourceCache);
+    }
+    while (clones) {
+        FlowSource_t *fs = clones;
+        clones = clones->next;
+        free(fs->current);
+        free(fs);
+    }
+
+}  // End of FreeFlowSourceClones
+
+static void FinalizeFile(finalizeJob_t *job) {
+    uint64_t finalizeStart = MetricNsec();
+    // Close file
+    CloseUpdateFile(job->nffile);
+    if (job->nffile->rollup && job->rollupFile[0]) WriteRollupFile(job);
+    DisposeFile(job->nffile);
+
+    // if another receive worker already wrote this slot, the file gets appended
+    // only account the additional size in the books
+    struct stat fstat;
+    blkcnt_t blocks = stat(job->filename, &fstat) == 0 ? fstat.st_blocks : 0;
+
+    // if rename fails, we are in big trouble, as we need to get rid of the old .current
+    // file otherwise, we will loose flows and can not continue collecting new flows
+    if (RenameAppend(job->closing, job->filename) < 0) {
+        LogError("Ident: %s, Can't rename dump file: %s", job->ident, strerror(errno));
+
+        // we do not update the books here, as the file failed to rename properly
+        // otherwise the books may be wrong
+    } else {
+        // Update books
+        stat(job->filename, &fstat);
+        UpdateBooks(job->bookkeeper, job->t_start, 512 * (fstat.st_blocks - blocks));
+        // a new file gets added to the file index for expire
+        if (blocks == 0) AppendFileIndex(job->datadir, job->filename, 512 * fstat.st_blocks);
+        // appended files get a new catalog entry, which replaces the previous one
+        AppendCatalog(job->datadir, job->filename);
+    }
+    // all blocks of the file are profiled - the last file of the time slot writes the channels
+    ProfileDone(job->profileFile, job->datadir, job->filename, job->t_start);
+    MetricDuration(METRIC_FINALIZE, MetricNsec() - finalizeStart);
+
+}  // End of FinalizeFile
+
+static void *finalizeThread(void *arg) {
+    finalizeJob_t *job;
+    while ((job = queue_pop(finalizeQueue)) != QUEUE_CLOSED) {
+        if (job->type == FINALIZE_FILE) {
+            FinalizeFile(job);
+        } else if (!launcherFailed) {
+            // Send launcher message
+            if (SendLauncherMessage(job->pfd, job->t_start, job->subdir[0] ? job->subdir : NULL, job->fmt, job->datadir, job->ident) < 0) {
+                launcherFailed = 1;
+            } else {
+                LogVerbose("Send launcher message");
+            }
+        }
+        free(job);
+
+        pthread_mutex_lock(&finalizeMutex);
+        if (--finalizePending == 0) pthread_cond_broadcast(&finalizeCond);
+        pthread_mutex_unlock(&finalizeMutex);
+    }
+
+    return NULL;
+
+}  // End of finalizeThread
+
+static void StartFinalizer(void) {
+    finalizeQueue = queue_init(FINALIZEQUEUESIZE);
+    if (!finalizeQueue) return;
+    int err = pthread_create(&finalizeTID, NULL, finalizeThread, NULL);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        queue_free(finalizeQueue);
+        finalizeQueue = NULL;
+    }
+
+}  // End of StartFinalizer
+
+// hand over a job to the finalizer thread - returns 0, if it needs to be processed inline
+static int QueueFinalizeJob(finalizeJob_t *job) {
+    pthread_once(&finalizeOnce, StartFinalizer);
+    if (!finalizeQueue) return 0;
+
+    pthread_mutex_lock(&finalizeMutex);
+    finalizePending++;
+    pthread_mutex_unlock(&finalizeMutex);
+    queue_push(finalizeQueue, job);
+
+    return 1;
+
+}  // End of QueueFinalizeJob
+
+// wait until all rotated files are finalized and all launcher messages are sent
+void FlushFinalizer(void) {
+    pthread_mutex_lock(&finalizeMutex);
+    while (finalizePending) pthread_cond_wait(&finalizeCond, &finalizeMutex);
+    pthread_mutex_unlock(&finalizeMutex);
+
+}  // End of FlushFinalizer
+
 int RotateFlowFiles(time_t t_start, char *time_extension, FlowSource_t *fs, int done) {
+    uint64_t rotateStart = MetricNsec();
     // periodic file rotation
     struct tm *now = localtime(&t_start);
     char fmt[32];
@@ -407,50 +664,93 @@ int RotateFlowFiles(time_t t_start, char *time_extension, FlowSource_t *fs, int
         FlushExporterStats(fs);
         // Flush open datablock
         fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
-        // Close file
-        CloseUpdateFile(nffile);
-
-        // if rename fails, we are in big trouble, as we need to get rid of the old .current
-        // file otherwise, we will loose flows and can not continue collecting new flows
-        if (RenameAppend(fs->current, nfcapd_filename) < 0) {
-            LogError("Ident: %s, Can't rename dump file: %s", fs->Ident, strerror(errno));
-
-            // we do not update the books here, as the file failed to rename properly
-            // otherwise the books may be wrong
-        } else {
-            struct stat fstat;
-
-            // Update books
-            stat(nfcapd_filename, &fstat);
-            UpdateBooks(fs->bookkeeper, t_start, 512 * fstat.st_blocks);
-        }
 
         // log stats
         LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Sequence Errors: %u, Bad Packets: %u, Blocks: %u", fs->Ident,
                 (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets,
                 (unsigned long long)nffile->stat_record->numbytes, nffile->stat_record->sequence_failure, fs->bad_packets, ReportBlocks());
 
+        finalizeJob_t *job = calloc(1, sizeof(finalizeJob_t));
+        if (!job) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        job->type = FINALIZE_FILE;
+        job->t_start = t_start;
+        job->datadir = fs->datadir;
+        strcpy(job->ident, fs->Ident);
+        job->nffile = nffile;
+        job->bookkeeper = fs->bookkeeper;
+        strcpy(job->filename, nfcapd_filename);
+        // the next file of this source starts a new profile slot
+        job->profileFile = nffile->tapArg;
+        ProfileRotate(job->profileFile);
+        if (nffile->rollup) {
+            char rollupSub[MAXPATHLEN];
+            if (subdir)
+                snprintf(rollupSub, MAXPATHLEN - 1, "%s/%s", fs->Ident, subdir);
+            else
+                snprintf(rollupSub, MAXPATHLEN - 1, "%s", fs->Ident);
+            rollupSub[MAXPATHLEN - 1] = '\0';
+            if (SetupSubDir(rollupDir, rollupSub, error, 255)) {
+                int len = snprintf(job->rollupFile, MAXPATHLEN, "%s/%s/nfcapd.%s", rollupDir, rollupSub, fmt);
+                if (len < 0 || len >= MAXPATHLEN) {
+                    // no rollup of this slot
+                    LogError("Ident: %s, rollup file name too long: %s/%s", fs->Ident, rollupDir, rollupSub);
+                    job->rollupFile[0] = '\0';
+                }
+            } else {
+                LogError("Ident: %s, Failed to create rollup directory: %s", fs->Ident, error);
+            }
+        }
+
+        // move the rotated file out of the way, so the next file can be opened right away
+        snprintf(job->closing, MAXPATHLEN - 1, "%s.%lld", fs->current, (long long)t_start);
+        int queued = 0;
+        if (rename(fs->current, job->closing) == 0) {
+            queued = QueueFinalizeJob(job);
+        } else {
+            LogError("rename() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            strcpy(job->closing, fs->current);
+        }
+        if (!queued) {
+            FinalizeFile(job);
+            free(job);
+        }
+
         // reset stats
         fs->bad_packets = 0;
         fs->msecFirst = 0xffffffffffffLL;
         fs->msecLast = 0;
 
         if (!done) {
-            fs->nffile = OpenNewFile(fs->current, fs->nffile, CREATOR_NFCAPD, INHERIT, INHERIT);
+            // continue with the compression and encryption of the rotated file
+            int compress = nffile->file_header->compression | (nffile->compression_level << 16);
+            fs->nffile = OpenNewFile(fs->current, NULL, CREATOR_NFCAPD, compress, nffile->file_header->encryption);
             if (!fs->nffile) {
                 LogError("killed due to fatal error: ident: %s", fs->Ident);
                 return 0;
             }
             SetIdent(fs->nffile, fs->Ident);
+            PrepareNewFile(fs->nffile);
+
+            // the new file starts again with small blocks - the current block is empty
+            if (smallBlockSize) {
+                FreeDataBlock(fs->dataBlock);
+                fs->dataBlock = WriteBlock(fs->nffile, NULL);
+            }
 
             // Dump all exporters/samplers to the buffer
             FlushStdRecords(fs);
+        } else {
+            fs->nffile = NULL;
         }
 
         // next flow source
         fs = fs->next;
 
     }  // end of while (fs)
+    MetricDuration(METRIC_ROTATE, MetricNsec() - rotateStart);
 
     return 1;
 
@@ -472,13 +772,34 @@ int TriggerLauncher(time_t t_start, char *time_extension, int pfd, FlowSource_t
         }
     }
 
-    // for each flow source update the stats, close the file and re-initialize the new file
+    // a previous launcher message failed
+    if (launcherFailed) return 0;
+
+    // for each flow source queue the launcher message behind the rotated files
     while (fs) {
-        // trigger launcher if required
-        // Send launcher message
-        if (SendLauncherMessage(pfd, t_start, subdir, fmt, fs->datadir, fs->Ident) < 0) {
+        finalizeJob_t *job = calloc(1, sizeof(finalizeJob_t));
+        if (!job) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            // the caller closes pfd - skip queued messages
+            launcherFailed = 1;
             return 0;
-        } else {
+        }
+        job->type = FINALIZE_LAUNCH;
+        job->t_start = t_start;
+        job->datadir = fs->datadir;
+        strcpy(job->ident, fs->Ident);
+        job->pfd = pfd;
+        snprintf(job->fmt, sizeof(job->fmt), "%s", fmt);
+        if (subdir) snprintf(job->subdir, sizeof(job->subdir), "%s", subdir);
+
+        if (!QueueFinalizeJob(job)) {
+            // trigger launcher inline
+            int ret = SendLauncherMessage(pfd, t_start, subdir, fmt, fs->datadir, fs->Ident);
+            free(job);
+            if (ret < 0) {
+                launcherFailed = 1;
+                return 0;
+            }
             LogVerbose("Send launcher message");
         }
 
@@ -96,8 +96,37 @@ typedef struct FlowSource_s {
     uint32_t exporter_count;
     struct timeval received;
 
+    // metric counters of this source - see metric.h
+    struct metric_slot_s *metric;
+
+    // sender lookup cache - only used in the first FlowSource of a list
+    struct sourceCache_s *sourceCache;
+
+    // ingest filter and projection of this source - see ingest.h
+    struct ingest_s *ingest;
+
 } FlowSource_t;
 
+/*
+ * Sender IP to FlowSource hash, to find the FlowSource of a packet
+ * without walking the FlowSource list. The list is only walked for senders
+ * not yet in the cache.
+ */
+typedef struct sourceCacheEntry_s {
+    ip_addr_t ip;
+    FlowSource_t *fs;
+} sourceCacheEntry_t;
+
+typedef struct sourceCache_s {
+    ip_addr_t lastIP;  // last sender
+    FlowSource_t *last;
+    uint32_t mask;
+    uint32_t count;
+    sourceCacheEntry_t *table;
+} sourceCache_t;
+
+#define SOURCECACHESIZE 256
+
 /* input buffer size, to read data from the network */
 #define NETWORK_INPUT_BUFF_SIZE 65535  // Maximum UDP message size
 
@@ -118,12 +147,24 @@ int AddFlowSourceString(FlowSource_t **FlowSource, char *argument);
 
 int SetDynamicSourcesDir(FlowSource_t **FlowSource, char *dir);
 
+int SetRollup(char *dir, char *aggregation);
+
+int SetLivePublisher(char *socketPath);
+
+void PrepareNewFile(nffile_t *nffile);
+
 FlowSource_t *AddDynamicSource(FlowSource_t **FlowSource, struct sockaddr_storage *ss);
 
+FlowSource_t *CloneFlowSources(FlowSource_t *FlowSource, uint32_t worker);
+
+void FreeFlowSourceClones(FlowSource_t *clones);
+
 int RotateFlowFiles(time_t t_start, char *time_extension, FlowSource_t *fs, int done);
 
 int TriggerLauncher(time_t t_start, char *time_extension, int pfd, FlowSource_t *fs);
 
+void FlushFinalizer(void);
+
 void FlushStdRecords(FlowSource_t *fs);
 
 void FlushExporterStats(FlowSource_t *fs);
@@ -29,7 +29,74 @@
  *
  */
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss) {
+static inline uint32_t SourceHash(ip_addr_t *ip, uint32_t mask) {
+    uint64_t h = (ip->V6[0] ^ ip->V6[1]) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 32) & mask;
+}  // End of SourceHash
+
+static inline FlowSource_t *SourceCacheLookup(sourceCache_t *sourceCache, ip_addr_t *ip) {
+    if (sourceCache->last && sourceCache->lastIP.V6[0] == ip->V6[0] && sourceCache->lastIP.V6[1] == ip->V6[1]) return sourceCache->last;
+
+    uint32_t index = SourceHash(ip, sourceCache->mask);
+    while (sourceCache->table[index].fs) {
+        sourceCacheEntry_t *entry = &sourceCache->table[index];
+        if (entry->ip.V6[0] == ip->V6[0] && entry->ip.V6[1] == ip->V6[1]) {
+            sourceCache->lastIP = *ip;
+            sourceCache->last = entry->fs;
+            return entry->fs;
+        }
+        index = (index + 1) & sourceCache->mask;
+    }
+
+    return NULL;
+
+}  // End of SourceCacheLookup
+
+static void SourceCacheInsert(sourceCache_t *sourceCache, ip_addr_t *ip, FlowSource_t *fs) {
+    if (2 * (sourceCache->count + 1) > sourceCache->mask + 1) {
+        // grow the table at 50% load
+        uint32_t oldSize = sourceCache->mask + 1;
+        sourceCacheEntry_t *oldTable = sourceCache->table;
+        sourceCacheEntry_t *table = calloc(2 * oldSize, sizeof(sourceCacheEntry_t));
+        if (!table) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return;
+        }
+        sourceCache->table = table;
+        sourceCache->mask = 2 * oldSize - 1;
+        for (uint32_t i = 0; i < oldSize; i++) {
+            if (oldTable[i].fs == NULL) continue;
+            uint32_t index = SourceHash(&oldTable[i].ip, sourceCache->mask);
+            while (table[index].fs) index = (index + 1) & sourceCache->mask;
+            table[index] = oldTable[i];
+        }
+        free(oldTable);
+    }
+
+    uint32_t index = SourceHash(ip, sourceCache->mask);
+    while (sourceCache->table[index].fs) index = (index + 1) & sourceCache->mask;
+    sourceCache->table[index].ip = *ip;
+    sourceCache->table[index].fs = fs;
+    sourceCache->count++;
+    sourceCache->lastIP = *ip;
+    sourceCache->last = fs;
+
+}  // End of SourceCacheInsert
+
+static sourceCache_t *NewSourceCache(void) {
+    sourceCache_t *sourceCache = calloc(1, sizeof(sourceCache_t));
+    if (!sourceCache) return NULL;
+    sourceCache->table = calloc(SOURCECACHESIZE, sizeof(sourceCacheEntry_t));
+    if (!sourceCache->table) {
+        free(sourceCache);
+        return NULL;
+    }
+    sourceCache->mask = SOURCECACHESIZE - 1;
+    return sourceCache;
+
+}  // End of NewSourceCache
+
+static inline FlowSource_t *GetFlowSource(FlowSource_t *FlowSource, struct sockaddr_storage *ss) {
     FlowSource_t *fs;
     void *ptr;
     ip_addr_t ip;
@@ -92,10 +159,25 @@ static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss) {
     printf("Flow Source IP: %s\n", as);
 #endif
 
+    if (!FlowSource) return NULL;
+    if (!FlowSource->sourceCache) FlowSource->sourceCache = NewSourceCache();
+    sourceCache_t *sourceCache = FlowSource->sourceCache;
+
+    // known sender
+    if (sourceCache && (fs = SourceCacheLookup(sourceCache, &ip)) != NULL) {
+        if (fs->any_source) {
+            fs->ip = ip;
+            fs->sa_family = ss->ss_family;
+        }
+        fs->port = port;
+        return fs;
+    }
+
     fs = FlowSource;
     while (fs) {
         if (ip.V6[0] == fs->ip.V6[0] && ip.V6[1] == fs->ip.V6[1]) {
             fs->port = port;
+            if (sourceCache) SourceCacheInsert(sourceCache, &ip, fs);
             return fs;
         }
 
@@ -105,6 +187,7 @@ static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss) {
             fs->ip = ip;
             fs->port = port;
             fs->sa_family = ss->ss_family;
+            if (sourceCache) SourceCacheInsert(sourceCache, &ip, fs);
             return fs;
         }
         fs = fs->next;
@@ -32,11 +32,13 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -57,16 +59,51 @@
 #endif
 
 #include "bookkeeper.h"
+#include "catalog.h"
 #include "expire.h"
+#include "nfdump.h"
 #include "nfstatfile.h"
+#include "queue.h"
 #include "util.h"
 
 static uint32_t timeout = 0;
 
+// number of threads, which unlink the expired files. 0: unlink in sequence
+static uint32_t expireWorkers = 0;
+
+// an expired file to unlink. The expire logic accounts the file in advance, as if the
+// unlink succeeded. Failed unlinks are corrected, once the pool is stopped
+typedef struct unlinkJob_s {
+    struct unlinkJob_s *next;
+    uint64_t size;
+    dirstat_t *dirstat[2];  // filesize and numfiles of these stats get restored
+    uint64_t *numExpired;   // or this counter gets decremented
+    char path[];
+} unlinkJob_t;
+
+// a directory to remove, once all files are unlinked
+typedef struct rmdirJob_s {
+    struct rmdirJob_s *next;
+    char *base;  // remove empty parent directories up to base
+    char path[];
+} rmdirJob_t;
+
+static struct unlinkPool_s {
+    queue_t *jobQueue;
+    pthread_t tid[MAXWORKERS];
+    uint32_t numWorkers;
+    pthread_mutex_t mutex;
+    unlinkJob_t *failedList;
+    rmdirJob_t *rmdirList;
+    rmdirJob_t *rmdirLast;
+} unlinkPool = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
 static void PrepareDirLists(channel_t *channel);
 
 static int compare(const FTSENT **f1, const FTSENT **f2);
 
+static void RemoveEmptyDirs(char *dir, char *subdir);
+
 static void IntHandler(int signal) {
     switch (signal) {
         case SIGALRM:
@@ -101,6 +138,142 @@ static void SetupSignalHandler(void) {
 
 }  // End of SetupSignalHandler
 
+void SetExpireWorkers(uint32_t workers) {
+    expireWorkers = workers > MAXWORKERS ? MAXWORKERS : workers;
+}  // End of SetExpireWorkers
+
+static void *unlinkWorker(void *arg) {
+    unlinkJob_t *job;
+    while ((job = queue_pop(unlinkPool.jobQueue)) != QUEUE_CLOSED) {
+        if (unlink(job->path) == 0) {
+            free(job);
+        } else {
+            LogError("unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            pthread_mutex_lock(&unlinkPool.mutex);
+            job->next = unlinkPool.failedList;
+            unlinkPool.failedList = job;
+            pthread_mutex_unlock(&unlinkPool.mutex);
+        }
+    }
+
+    return NULL;
+}  // End of unlinkWorker
+
+static void StartUnlinkPool(void) {
+    if (expireWorkers == 0) return;
+
+    unlinkPool.jobQueue = queue_init(1024);
+    if (!unlinkPool.jobQueue) return;
+    for (uint32_t i = 0; i < expireWorkers; i++) {
+        int err = pthread_create(&unlinkPool.tid[i], NULL, unlinkWorker, NULL);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            break;
+        }
+        unlinkPool.numWorkers++;
+    }
+    if (unlinkPool.numWorkers == 0) {
+        queue_free(unlinkPool.jobQueue);
+        unlinkPool.jobQueue = NULL;
+    }
+
+}  // End of StartUnlinkPool
+
+// wait for all pending unlinks, correct the stats of failed unlinks and remove
+// the empty directories in the order they were queued
+static void StopUnlinkPool(void) {
+    if (unlinkPool.numWorkers == 0) return;
+
+    queue_close(unlinkPool.jobQueue);
+    for (uint32_t i = 0; i < unlinkPool.numWorkers; i++) pthread_join(unlinkPool.tid[i], NULL);
+    queue_free(unlinkPool.jobQueue);
+    unlinkPool.jobQueue = NULL;
+    unlinkPool.numWorkers = 0;
+
+    unlinkJob_t *job = unlinkPool.failedList;
+    while (job) {
+        for (int i = 0; i < 2; i++) {
+            if (job->dirstat[i] == NULL) continue;
+            job->dirstat[i]->filesize += job->size;
+            if (job->numExpired == NULL) job->dirstat[i]->numfiles++;
+        }
+        if (job->numExpired) (*job->numExpired)--;
+        unlinkJob_t *next = job->next;
+        free(job);
+        job = next;
+    }
+    unlinkPool.failedList = NULL;
+
+    rmdirJob_t *rmdirJob = unlinkPool.rmdirList;
+    while (rmdirJob) {
+        if (rmdirJob->base) {
+            RemoveEmptyDirs(rmdirJob->base, rmdirJob->path);
+        } else if (rmdir(rmdirJob->path) != 0) {
+            LogError("rmdir() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        }
+        rmdirJob_t *next = rmdirJob->next;
+        free(rmdirJob);
+        rmdirJob = next;
+    }
+    unlinkPool.rmdirList = unlinkPool.rmdirLast = NULL;
+
+}  // End of StopUnlinkPool
+
+// unlink an expired file or queue it for the unlink pool. Returns 1, if the file
+// is accounted as expired
+static int UnlinkFile(char *path, uint64_t size, dirstat_t *dirstat0, dirstat_t *dirstat1, uint64_t *numExpired) {
+    if (unlinkPool.numWorkers == 0) {
+        if (unlink(path) == 0) return 1;
+        LogError("unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    size_t len = strlen(path) + 1;
+    unlinkJob_t *job = malloc(sizeof(unlinkJob_t) + len);
+    if (!job) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    job->size = size;
+    job->dirstat[0] = dirstat0;
+    job->dirstat[1] = dirstat1;
+    job->numExpired = numExpired;
+    memcpy(job->path, path, len);
+    queue_push(unlinkPool.jobQueue, job);
+
+    return 1;
+
+}  // End of UnlinkFile
+
+// remove an empty directory, and with base, its empty parent directories up to base.
+// With the unlink pool, the directory is removed after all files are unlinked
+static void RemoveDir(char *base, char *path) {
+    if (unlinkPool.numWorkers == 0) {
+        if (base) {
+            RemoveEmptyDirs(base, path);
+        } else if (rmdir(path) != 0) {
+            LogError("rmdir() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        }
+        return;
+    }
+
+    size_t len = strlen(path) + 1;
+    rmdirJob_t *rmdirJob = malloc(sizeof(rmdirJob_t) + len);
+    if (!rmdirJob) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+    rmdirJob->next = NULL;
+    rmdirJob->base = base;
+    memcpy(rmdirJob->path, path, len);
+    if (unlinkPool.rmdirLast)
+        unlinkPool.rmdirLast->next = rmdirJob;
+    else
+        unlinkPool.rmdirList = rmdirJob;
+    unlinkPool.rmdirLast = rmdirJob;
+
+}  // End of RemoveDir
+
 uint64_t ParseSizeDef(char *s, uint64_t *value) {
     char *p;
     uint64_t fac;
@@ -252,11 +425,12 @@ uint64_t ParseTimeDef(char *s, uint64_t *value) {
 
 static int compare(const FTSENT **f1, const FTSENT **f2) { return strcmp((*f1)->fts_name, (*f2)->fts_name); }  // End of compare
 
-void RescanDir(char *dir, dirstat_t *dirstat) {
+void RescanDir(char *dir, dirstat_t *dirstat, int buildIndex) {
     FTS *fts;
     FTSENT *ftsent;
     char *const path[] = {dir, NULL};
     char first_timestring[16], last_timestring[16];
+    fileIndex_t *fileIndex = NULL;
 
     dirstat->filesize = dirstat->numfiles = 0;
     dirstat->first = 0;
@@ -269,6 +443,8 @@ void RescanDir(char *dir, dirstat_t *dirstat) {
         LogError("fts_open() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
         return;
     }
+    // the files are visited in chronological order - rebuild the file index on the way
+    if (buildIndex) fileIndex = CreateFileIndex(dir);
     while ((ftsent = fts_read(fts)) != NULL) {
         if (ftsent->fts_info == FTS_F && ((ftsent->fts_namelen == 19) || (ftsent->fts_namelen == 21))) {
             // nfcapd.200604301200   strlen = 19
@@ -296,6 +472,15 @@ void RescanDir(char *dir, dirstat_t *dirstat) {
 
                 dirstat->filesize += 512 * ftsent->fts_statp->st_blocks;
                 dirstat->numfiles++;
+
+                if (fileIndex) {
+                    char *relative = ftsent->fts_path + strlen(dir);
+                    while (*relative == '/') relative++;
+                    if (AddFileIndex(fileIndex, relative, 512 * ftsent->fts_statp->st_blocks) != STATFILE_OK) {
+                        CommitFileIndex(fileIndex, 0);
+                        fileIndex = NULL;
+                    }
+                }
             }
         } else {
             switch (ftsent->fts_info) {
@@ -311,6 +496,7 @@ void RescanDir(char *dir, dirstat_t *dirstat) {
         }
     }
     fts_close(fts);
+    if (fileIndex) CommitFileIndex(fileIndex, 1);
 
     // no files means do rebuild next time, otherwise the stat record may not be accurate
     if (dirstat->numfiles == 0) {
@@ -325,6 +511,86 @@ void RescanDir(char *dir, dirstat_t *dirstat) {
 
 }  // End of RescanDir
 
+// remove subdir and its parent directories up to the data directory dir, as long as they are empty
+static void RemoveEmptyDirs(char *dir, char *subdir) {
+    size_t dirLen = strlen(dir);
+
+    while (strlen(subdir) > dirLen) {
+        dbg_printf("Will remove directory %s\n", subdir);
+        if (rmdir(subdir) != 0) {
+            if (errno != ENOTEMPTY && errno != EEXIST) {
+                LogError("rmdir() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            }
+            return;
+        }
+        char *slash = strrchr(subdir, '/');
+        if (!slash) return;
+        *slash = '\0';
+    }
+
+}  // End of RemoveEmptyDirs
+
+// expire files in the order of the file index. Same logic as the fts based expire in ExpireDir()
+static int ExpireDirIndex(fileIndex_t *fileIndex, char *dir, dirstat_t *dirstat, char *expire_timelimit, uint64_t sizelimit, int *size_done,
+                          int *lifetime_done, uint64_t *num_expired) {
+    char path[MAXPATHLEN], lastDir[MAXPATHLEN];
+    fileIndexEntry_t *entry;
+    int done = 0;
+
+    lastDir[0] = '\0';
+    while (!done && (entry = NextFileIndex(fileIndex)) != NULL) {
+        char *name = strrchr(entry->path, '/');
+        name = name ? name + 1 : entry->path;
+        char *p = &(name[7]);
+
+        struct stat fstat_buf;
+        snprintf(path, MAXPATHLEN, "%s/%s", dir, entry->path);
+        path[MAXPATHLEN - 1] = '\0';
+        if (strncmp(name, "nfcapd.", 7) != 0 || stat(path, &fstat_buf) != 0) {
+            // file no longer exists
+            PopFileIndex(fileIndex);
+            continue;
+        }
+
+        // expire size-wise if needed, then time-wise
+        int expire = 0;
+        if (!*size_done) {
+            if (dirstat->filesize > sizelimit) {
+                expire = 1;
+            } else {
+                dirstat->first = ISO2UNIX(p);  // time of first file not expired
+                *size_done = 1;
+            }
+        }
+        if (!expire && !*lifetime_done) {
+            if (expire_timelimit && strcmp(p, expire_timelimit) < 0) {
+                expire = 1;
+            } else {
+                dirstat->first = ISO2UNIX(p);  // time of first file not expired
+                *lifetime_done = 1;
+            }
+        }
+
+        if (expire) {
+            if (UnlinkFile(path, 512 * fstat_buf.st_blocks, dirstat, NULL, num_expired)) {
+                dirstat->filesize -= 512 * fstat_buf.st_blocks;
+                (*num_expired)++;
+
+                // remove the previous sub directory, once all its files are expired
+                *strrchr(path, '/') = '\0';
+                if (lastDir[0] && strcmp(lastDir, path) != 0) RemoveDir(dir, lastDir);
+                strcpy(lastDir, path);
+            }
+            PopFileIndex(fileIndex);
+        }
+        done = (*size_done && *lifetime_done) || timeout;
+    }
+    if (lastDir[0]) RemoveDir(dir, lastDir);
+
+    return done;
+
+}  // End of ExpireDirIndex
+
 void ExpireDir(char *dir, dirstat_t *dirstat, uint64_t maxsize, uint64_t maxlife, uint32_t runtime) {
     FTS *fts;
     FTSENT *ftsent;
@@ -389,86 +655,90 @@ void ExpireDir(char *dir, dirstat_t *dirstat, uint64_t maxsize, uint64_t maxlife
     lifetime_done = maxlife == 0 || (now - dirstat->first) < maxlife;
     sizelimit = (dirstat->low_water * maxsize) / 100;
     num_expired = 0;
-    fts = fts_open(path, FTS_LOGICAL, compare);
-    while (!done && ((ftsent = fts_read(fts)) != NULL)) {
-        if (ftsent->fts_info == FTS_F) {
-            dir_files++;  // count files in directories
-            if ((ftsent->fts_namelen == 19 || ftsent->fts_namelen == 21) && strncmp(ftsent->fts_name, "nfcapd.", 7) == 0) {
-                // nfcapd.200604301200   strlen = 19
-                // nfcapd.20190430120010 strlen = 21
-                char *s, *p = &(ftsent->fts_name[7]);
-
-                // process only nfcapd. files
-                // make sure it's really an nfcapd. file and we have
-                // only digits in the rest of the file name
-                s = p;
-                while (*s) {
-                    if (*s < '0' || *s > '9') break;
-                    s++;
-                }
-                // otherwise skip
-                if (*s) continue;
-
-                // expire size-wise if needed
-                if (!size_done) {
-                    if (dirstat->filesize > sizelimit) {
-                        if (unlink(ftsent->fts_path) == 0) {
-                            dirstat->filesize -= 512 * ftsent->fts_statp->st_blocks;
-                            num_expired++;
-                            dir_files--;
+    StartUnlinkPool();
+    fileIndex_t *fileIndex = OpenFileIndex(dir);
+    if (fileIndex) {
+        // no need to scan the directory tree - expire the oldest files from the index
+        done = ExpireDirIndex(fileIndex, dir, dirstat, expire_timelimit, sizelimit, &size_done, &lifetime_done, &num_expired);
+        CloseFileIndex(fileIndex);
+    } else {
+        fts = fts_open(path, FTS_LOGICAL, compare);
+        while (!done && ((ftsent = fts_read(fts)) != NULL)) {
+            if (ftsent->fts_info == FTS_F) {
+                dir_files++;  // count files in directories
+                if ((ftsent->fts_namelen == 19 || ftsent->fts_namelen == 21) && strncmp(ftsent->fts_name, "nfcapd.", 7) == 0) {
+                    // nfcapd.200604301200   strlen = 19
+                    // nfcapd.20190430120010 strlen = 21
+                    char *s, *p = &(ftsent->fts_name[7]);
+
+                    // process only nfcapd. files
+                    // make sure it's really an nfcapd. file and we have
+                    // only digits in the rest of the file name
+                    s = p;
+                    while (*s) {
+                        if (*s < '0' || *s > '9') break;
+                        s++;
+                    }
+                    // otherwise skip
+                    if (*s) continue;
+
+                    // expire size-wise if needed
+                    if (!size_done) {
+                        if (dirstat->filesize > sizelimit) {
+                            if (UnlinkFile(ftsent->fts_path, 512 * ftsent->fts_statp->st_blocks, dirstat, NULL, &num_expired)) {
+                                dirstat->filesize -= 512 * ftsent->fts_statp->st_blocks;
+                                num_expired++;
+                                dir_files--;
+                            }
+                            continue;  // next file if file was unlinked
                         } else {
-                            LogError("unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+                            dirstat->first = ISO2UNIX(p);  // time of first file not expired
+                            size_done = 1;
                         }
-                        continue;  // next file if file was unlinked
-                    } else {
-                        dirstat->first = ISO2UNIX(p);  // time of first file not expired
-                        size_done = 1;
                     }
-                }
 
-                // expire time-wise if needed
-                // this part of the code is executed only when size-wise is fulfilled
-                if (!lifetime_done) {
-                    if (expire_timelimit && strcmp(p, expire_timelimit) < 0) {
-                        if (unlink(ftsent->fts_path) == 0) {
-                            dirstat->filesize -= 512 * ftsent->fts_statp->st_blocks;
-                            num_expired++;
-                            dir_files--;
+                    // expire time-wise if needed
+                    // this part of the code is executed only when size-wise is fulfilled
+                    if (!lifetime_done) {
+                        if (expire_timelimit && strcmp(p, expire_timelimit) < 0) {
+                            if (UnlinkFile(ftsent->fts_path, 512 * ftsent->fts_statp->st_blocks, dirstat, NULL, &num_expired)) {
+                                dirstat->filesize -= 512 * ftsent->fts_statp->st_blocks;
+                                num_expired++;
+                                dir_files--;
+                            }
+                            lifetime_done = 0;
                         } else {
-                            LogError("unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+                            dirstat->first = ISO2UNIX(p);  // time of first file not expired
+                            lifetime_done = 1;
                         }
-                        lifetime_done = 0;
-                    } else {
-                        dirstat->first = ISO2UNIX(p);  // time of first file not expired
-                        lifetime_done = 1;
                     }
+                    done = (size_done && lifetime_done) || timeout;
                 }
-                done = (size_done && lifetime_done) || timeout;
-            }
-        } else {
-            switch (ftsent->fts_info) {
-                case FTS_D:
-                    // set pre-order flag
-                    dir_files = 0;
-                    // skip all '.' entries as well as hidden directories
-                    if (ftsent->fts_level > 0 && ftsent->fts_name[0] == '.') fts_set(fts, ftsent, FTS_SKIP);
-                    // any valid directory needs to start with a digit ( %Y -> year )
-                    if (ftsent->fts_level > 0 && !isdigit(ftsent->fts_name[0])) fts_set(fts, ftsent, FTS_SKIP);
-                    break;
-                case FTS_DP:
-                    // do not delete base data directory ( level == 0 )
-                    if (dir_files == 0 && ftsent->fts_level > 0) {
-                        // directory is empty and can be deleted
-                        dbg_printf("Will remove directory %s\n", ftsent->fts_path);
-                        if (rmdir(ftsent->fts_path) != 0) {
-                            LogError("rmdir() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            } else {
+                switch (ftsent->fts_info) {
+                    case FTS_D:
+                        // set pre-order flag
+                        dir_files = 0;
+                        // skip all '.' entries as well as hidden directories
+                        if (ftsent->fts_level > 0 && ftsent->fts_name[0] == '.') fts_set(fts, ftsent, FTS_SKIP);
+                        // any valid directory needs to start with a digit ( %Y -> year )
+                        if (ftsent->fts_level > 0 && !isdigit(ftsent->fts_name[0])) fts_set(fts, ftsent, FTS_SKIP);
+                        break;
+                    case FTS_DP:
+                        // do not delete base data directory ( level == 0 )
+                        if (dir_files == 0 && ftsent->fts_level > 0) {
+                            // directory is empty and can be deleted
+                            dbg_printf("Will remove directory %s\n", ftsent->fts_path);
+                            RemoveDir(NULL, ftsent->fts_path);
                         }
-                    }
-                    break;
+                        break;
+                }
             }
         }
+        fts_close(fts);
     }
-    fts_close(fts);
+    StopUnlinkPool();
+    if (num_expired) PruneCatalog(dir);
     if (!done) {
         // all files expired and limits not reached
         // this may be possible, when files get time-wise expired and
@@ -565,6 +835,7 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
     lifetime_done = maxlife == 0 || (now - current_stat->first) < maxlife;
 
     PrepareDirLists(channel);
+    StartUnlinkPool();
     if (runtime) alarm(runtime);
     while (!done) {
         char *p;
@@ -607,7 +878,8 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
             dbg_printf("	Size expire %llu %llu\n", current_stat->filesize, sizelimit);
             if (current_stat->filesize > sizelimit) {
                 // need to delete this file
-                if (unlink(expire_channel->ftsent->fts_path) == 0) {
+                if (UnlinkFile(expire_channel->ftsent->fts_path, 512 * expire_channel->ftsent->fts_statp->st_blocks, current_stat,
+                               expire_channel->dirstat, NULL)) {
                     // Update profile stat
                     current_stat->filesize -= 512 * expire_channel->ftsent->fts_statp->st_blocks;
                     current_stat->numfiles--;
@@ -618,9 +890,6 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
 
                     // decrement number of files seen in this directory
                     expire_channel->ftsent->fts_number--;
-
-                } else {
-                    LogError("unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
                 }
                 file_removed = 1;
             } else {
@@ -635,7 +904,8 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
             // this part of the code is executed only when size-wise is already fulfilled
             if (strcmp(p, expire_timelimit) < 0) {
                 // need to delete this file
-                if (unlink(expire_channel->ftsent->fts_path) == 0) {
+                if (UnlinkFile(expire_channel->ftsent->fts_path, 512 * expire_channel->ftsent->fts_statp->st_blocks, current_stat,
+                               expire_channel->dirstat, NULL)) {
                     // Update profile stat
                     current_stat->filesize -= 512 * expire_channel->ftsent->fts_statp->st_blocks;
                     current_stat->numfiles--;
@@ -646,9 +916,6 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
 
                     // decrement number of files seen in this directory
                     expire_channel->ftsent->fts_number--;
-
-                } else {
-                    LogError("unlink() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
                 }
                 file_removed = 1;
             } else {
@@ -693,9 +960,7 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
                             if (expire_channel->ftsent->fts_number == 0 && expire_channel->ftsent->fts_level > 0) {
                                 // directory is empty and can be deleted
                                 dbg_printf("Will remove directory %s\n", expire_channel->ftsent->fts_path);
-                                if (rmdir(expire_channel->ftsent->fts_path) != 0) {
-                                    LogError("rmdir() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
-                                }
+                                RemoveDir(NULL, expire_channel->ftsent->fts_path);
                             }
                             break;
                     }
@@ -718,6 +983,7 @@ void ExpireProfile(channel_t *channel, dirstat_t *current_stat, uint64_t maxsize
             expire_channel->dirstat->status = FORCE_REBUILD;
         }
     }  // while ( !done )
+    StopUnlinkPool();
 
     if (runtime) alarm(0);
     if (timeout) {
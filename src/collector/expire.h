@@ -66,7 +66,9 @@ uint64_t ParseSizeDef(char *s, uint64_t *value);
 
 uint64_t ParseTimeDef(char *s, uint64_t *value);
 
-void RescanDir(char *dir, dirstat_t *dirstat);
+void RescanDir(char *dir, dirstat_t *dirstat, int buildIndex);
+
+void SetExpireWorkers(uint32_t workers);
 
 void ExpireDir(char *dir, dirstat_t *dirstat, uint64_t maxsize, uint64_t maxlife, uint32_t runtime);
 
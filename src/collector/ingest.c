@@ -0,0 +1,404 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "ingest.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conf/nfconf.h"
+#include "filter/filter.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfxV3.h"
+#include "util.h"
+
+// ingest state of a flow source. Only accessed by the receive worker of the source
+typedef struct ingest_s {
+    struct ingest_s *next;
+    void *engine;          // filter engine of this source or NULL
+    uint64_t projectMask;  // extensions to keep, 0 - keep all
+    int shed;              // low value source - all records are dropped in overload
+    recordHandle_t handle;
+} ingest_t;
+
+static int ingestActive = 0;
+static void *ingestEngine = NULL;
+static uint64_t defaultMask = 0;
+
+// all ingest states, to free them at the end
+static ingest_t *ingestList = NULL;
+static pthread_mutex_t ingestLock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic uint64_t droppedRecords = 0;
+
+// load shedding - see SetOverload()
+static uint32_t overloadSampling = 0;  // keep 1 of overloadSampling flows
+static char *overloadShed = NULL;      // comma separated list of low value idents
+static _Thread_local int overloaded = 0;
+static _Thread_local uint64_t shedRecords = 0;
+
+#include "nffile_inline.c"
+
+// parse a comma separated extension list into an extension mask
+static uint64_t ParseProjection(char *list) {
+    uint64_t mask = 0;
+    char *s = list;
+    while (s && *s) {
+        char *end;
+        long extID = strtol(s, &end, 10);
+        if (end == s || extID <= 0 || extID >= MAXEXTENSIONS) {
+            LogError("Invalid extension in ingest projection: %s", list);
+            return 0;
+        }
+        mask |= 1ULL << extID;
+        while (*end == ' ' || *end == '\t') end++;
+        if (*end == ',') end++;
+        s = end;
+    }
+
+    // the generic flow extension is always kept
+    return mask ? mask | (1ULL << EXgenericFlowID) : 0;
+
+}  // End of ParseProjection
+
+// returns 1, if ident is an element of the comma separated list
+static int InList(char *list, char *ident) {
+    size_t len = strlen(ident);
+    char *s = list;
+    while (*s) {
+        while (*s == ' ' || *s == '\t') s++;
+        char *end = strchr(s, ',');
+        size_t elementLen = end ? (size_t)(end - s) : strlen(s);
+        while (elementLen && (s[elementLen - 1] == ' ' || s[elementLen - 1] == '\t')) elementLen--;
+        if (elementLen == len && strncmp(s, ident, len) == 0) return 1;
+        if (!end) break;
+        s = end + 1;
+    }
+    return 0;
+
+}  // End of InList
+
+// extension mask of a source from the config
+static uint64_t SourceProjection(char *ident, int *error) {
+    char key[sizeof("ingest.project.") + IDENTLEN];
+    int len = snprintf(key, sizeof(key), "ingest.project.%s", ident);
+    if (len < 0 || (size_t)len >= sizeof(key)) return defaultMask;
+    char *list = ConfGetString(key);
+    if (!list) return defaultMask;
+
+    uint64_t mask = ParseProjection(list);
+    if (mask == 0) *error = 1;
+    free(list);
+    return mask;
+
+}  // End of SourceProjection
+
+static ingest_t *NewIngest(FlowSource_t *fs) {
+    ingest_t *ingest = (ingest_t *)calloc(1, sizeof(ingest_t));
+    if (!ingest) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (ingestEngine) {
+        ingest->engine = FilterCloneEngine(ingestEngine);
+        FilterSetParam(ingest->engine, fs->Ident, 0);
+    }
+    int error = 0;
+    ingest->projectMask = SourceProjection(fs->Ident, &error);
+    ingest->shed = overloadShed && InList(overloadShed, fs->Ident);
+
+    pthread_mutex_lock(&ingestLock);
+    ingest->next = ingestList;
+    ingestList = ingest;
+    pthread_mutex_unlock(&ingestLock);
+
+    return ingest;
+
+}  // End of NewIngest
+
+// remove all extensions, not in mask from the record
+static void ProjectRecord(recordHeaderV3_t *recordHeaderV3, uint64_t mask) {
+    elementHeader_t *elementHeader = (elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+    void *out = (void *)elementHeader;
+    uint32_t numElements = 0;
+    for (int i = 0; i < recordHeaderV3->numElements; i++) {
+        uint16_t length = elementHeader->length;
+        if (elementHeader->type < MAXEXTENSIONS && (mask & (1ULL << elementHeader->type))) {
+            if (out != (void *)elementHeader) memmove(out, (void *)elementHeader, length);
+            out += length;
+            numElements++;
+        }
+        elementHeader = (elementHeader_t *)((void *)elementHeader + length);
+    }
+    recordHeaderV3->numElements = numElements;
+    recordHeaderV3->size = out - (void *)recordHeaderV3;
+
+}  // End of ProjectRecord
+
+// remove the counters of a dropped record, the decoder already accounted
+static void DropRecordStat(stat_record_t *stat, recordHandle_t *handle) {
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)handle->extensionList[EXgenericFlowID];
+    if (genericFlow) {
+        switch (genericFlow->proto) {
+            case IPPROTO_ICMPV6:
+            case IPPROTO_ICMP:
+                stat->numflows_icmp--;
+                stat->numpackets_icmp -= genericFlow->inPackets;
+                stat->numbytes_icmp -= genericFlow->inBytes;
+                break;
+            case IPPROTO_TCP:
+                stat->numflows_tcp--;
+                stat->numpackets_tcp -= genericFlow->inPackets;
+                stat->numbytes_tcp -= genericFlow->inBytes;
+                break;
+            case IPPROTO_UDP:
+                stat->numflows_udp--;
+                stat->numpackets_udp -= genericFlow->inPackets;
+                stat->numbytes_udp -= genericFlow->inBytes;
+                break;
+            default:
+                stat->numflows_other--;
+                stat->numpackets_other -= genericFlow->inPackets;
+                stat->numbytes_other -= genericFlow->inBytes;
+        }
+        stat->numflows--;
+        stat->numpackets -= genericFlow->inPackets;
+        stat->numbytes -= genericFlow->inBytes;
+    }
+
+    EXcntFlow_t *cntFlow = (EXcntFlow_t *)handle->extensionList[EXcntFlowID];
+    if (cntFlow) {
+        stat->numpackets -= cntFlow->outPackets;
+        stat->numbytes -= cntFlow->outBytes;
+    }
+
+}  // End of DropRecordStat
+
+// hash of the flow key, so all records of a flow are sampled alike
+static uint64_t FlowKeyHash(recordHandle_t *handle) {
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)handle->extensionList[EXgenericFlowID];
+    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)handle->extensionList[EXipv4FlowID];
+    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)handle->extensionList[EXipv6FlowID];
+
+    uint64_t hash = genericFlow ? ((uint64_t)genericFlow->proto << 32) | ((uint64_t)genericFlow->srcPort << 16) | genericFlow->dstPort : 0;
+    if (ipv4Flow) {
+        hash ^= ((uint64_t)ipv4Flow->srcAddr << 32 | ipv4Flow->dstAddr) * 0x9E3779B97F4A7C15ULL;
+    } else if (ipv6Flow) {
+        hash ^= (ipv6Flow->srcAddr[0] ^ ipv6Flow->srcAddr[1]) * 0x9E3779B97F4A7C15ULL;
+        hash ^= (ipv6Flow->dstAddr[0] ^ ipv6Flow->dstAddr[1]) * 0xC2B2AE3D27D4EB4FULL;
+    }
+
+    // murmur3 finalizer
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB2F9A7FE1A85ULL;
+    hash ^= hash >> 33;
+    return hash;
+
+}  // End of FlowKeyHash
+
+// scale the counters of a sampled record. If stat is given, the decoder already
+// accounted the unscaled counters
+static void ScaleRecord(recordHeaderV3_t *recordHeaderV3, recordHandle_t *handle, uint32_t rate, stat_record_t *stat) {
+    SetFlag(recordHeaderV3->flags, V3_FLAG_SAMPLED);
+
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)handle->extensionList[EXgenericFlowID];
+    if (genericFlow) {
+        uint64_t packets = genericFlow->inPackets * (rate - 1);
+        uint64_t bytes = genericFlow->inBytes * (rate - 1);
+        genericFlow->inPackets += packets;
+        genericFlow->inBytes += bytes;
+        if (stat) {
+            switch (genericFlow->proto) {
+                case IPPROTO_ICMPV6:
+                case IPPROTO_ICMP:
+                    stat->numpackets_icmp += packets;
+                    stat->numbytes_icmp += bytes;
+                    break;
+                case IPPROTO_TCP:
+                    stat->numpackets_tcp += packets;
+                    stat->numbytes_tcp += bytes;
+                    break;
+                case IPPROTO_UDP:
+                    stat->numpackets_udp += packets;
+                    stat->numbytes_udp += bytes;
+                    break;
+                default:
+                    stat->numpackets_other += packets;
+                    stat->numbytes_other += bytes;
+            }
+            stat->numpackets += packets;
+            stat->numbytes += bytes;
+        }
+    }
+
+    EXcntFlow_t *cntFlow = (EXcntFlow_t *)handle->extensionList[EXcntFlowID];
+    if (cntFlow) {
+        uint64_t packets = cntFlow->outPackets * (rate - 1);
+        uint64_t bytes = cntFlow->outBytes * (rate - 1);
+        cntFlow->outPackets += packets;
+        cntFlow->outBytes += bytes;
+        if (stat) {
+            stat->numpackets += packets;
+            stat->numbytes += bytes;
+        }
+    }
+
+}  // End of ScaleRecord
+
+// load shedding of an overloaded decoder. Returns 1, if the record is kept
+static int ShedRecord(ingest_t *ingest, recordHeaderV3_t *recordHeaderV3, stat_record_t *stat) {
+    MapRecordHandle(&(ingest->handle), recordHeaderV3, 0);
+    if (!ingest->shed) {
+        if (overloadSampling <= 1) return 1;
+        if ((FlowKeyHash(&(ingest->handle)) % overloadSampling) == 0) {
+            ScaleRecord(recordHeaderV3, &(ingest->handle), overloadSampling, stat);
+            return 1;
+        }
+    }
+
+    if (stat) DropRecordStat(stat, &(ingest->handle));
+    shedRecords++;
+    return 0;
+
+}  // End of ShedRecord
+
+int SetupIngest(FlowSource_t *FlowSource, char *filter) {
+    if (!filter) filter = ConfGetString("ingest.filter");
+    if (filter && strlen(filter)) {
+        ingestEngine = CompileFilter(filter);
+        if (!ingestEngine) {
+            LogError("Failed to compile ingest filter: %s", filter);
+            return 0;
+        }
+        ingestActive = 1;
+        LogInfo("Ingest filter: %s", filter);
+    }
+
+    char *list = ConfGetString("ingest.project.default");
+    if (list) {
+        defaultMask = ParseProjection(list);
+        free(list);
+        if (defaultMask == 0) return 0;
+        ingestActive = 1;
+    }
+
+    int sampling = ConfGetValue("overload.sampling");
+    overloadSampling = sampling > 1 ? sampling : 10;
+    overloadShed = ConfGetString("overload.shed");
+
+    // validate the projection of the configured sources
+    for (FlowSource_t *fs = FlowSource; fs; fs = fs->next) {
+        int error = 0;
+        uint64_t mask = SourceProjection(fs->Ident, &error);
+        if (error) return 0;
+        if (mask) {
+            LogInfo("Ident: %s, ingest projection mask: 0x%llx", fs->Ident, (unsigned long long)mask);
+            ingestActive = 1;
+        }
+    }
+
+    return 1;
+
+}  // End of SetupIngest
+
+/*
+ * called by the decoders for each decoded record at the cursor of the data block
+ * returns 1, if the record is committed, 0 if the record is dropped.
+ * If stat is given, the counters of a dropped record are removed from stat
+ */
+int IngestRecord(FlowSource_t *fs, recordHeaderV3_t *recordHeaderV3, stat_record_t *stat) {
+    if (!ingestActive && !overloaded) return 1;
+
+    ingest_t *ingest = fs->ingest;
+    if (!ingest) ingest = fs->ingest = NewIngest(fs);
+
+    if (overloaded && !ShedRecord(ingest, recordHeaderV3, stat)) return 0;
+
+    if (ingest->engine) {
+        MapRecordHandle(&(ingest->handle), recordHeaderV3, 0);
+        if (FilterRecord(ingest->engine, &(ingest->handle)) == 0) {
+            if (stat) DropRecordStat(stat, &(ingest->handle));
+            atomic_fetch_add_explicit(&droppedRecords, 1, memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    if (ingest->projectMask) ProjectRecord(recordHeaderV3, ingest->projectMask);
+
+    return 1;
+
+}  // End of IngestRecord
+
+/*
+ * Load shedding of the decoder of the calling thread. While overloaded, the records
+ * of the low value sources in overload.shed are dropped, and of all other sources
+ * only 1 of overload.sampling flows is kept, selected by the hash of the flow key.
+ * The counters of kept records are scaled by the sampling rate and the records are
+ * flagged sampled. Templates are processed by the decoders as usual.
+ */
+void SetOverload(int overload) {
+    //
+    overloaded = overload;
+}  // End of SetOverload
+
+// records dropped by the load shedding of the calling thread since the last call
+uint64_t OverloadShedRecords(void) {
+    uint64_t records = shedRecords;
+    shedRecords = 0;
+    return records;
+}  // End of OverloadShedRecords
+
+void StopIngest(void) {
+    free(overloadShed);
+    overloadShed = NULL;
+    if (!ingestActive) return;
+
+    if (ingestEngine) LogInfo("Ingest filter dropped %llu records", (unsigned long long)atomic_load(&droppedRecords));
+
+    pthread_mutex_lock(&ingestLock);
+    while (ingestList) {
+        ingest_t *ingest = ingestList;
+        ingestList = ingest->next;
+        if (ingest->engine) DisposeFilter(ingest->engine);
+        free(ingest);
+    }
+    pthread_mutex_unlock(&ingestLock);
+
+}  // End of StopIngest
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _INGEST_H
+#define _INGEST_H 1
+
+#include <stdint.h>
+
+#include "collector.h"
+#include "nffileV2.h"
+#include "nfxV3.h"
+
+/*
+ * Ingest filter and extension projection.
+ * Each decoded flow record is checked against the ingest filter -F or
+ * ingest.filter in nfcapd.conf, before it is committed to the data block.
+ * Records, which do not match, are not stored. Stored records are reduced to
+ * the extensions listed in ingest.project.<ident> or ingest.project.default,
+ * a comma separated list of extension IDs as for -X.
+ * Each flow source evaluates its own copy of the filter, with the source
+ * ident for the ident filter primitive.
+ */
+
+int SetupIngest(FlowSource_t *FlowSource, char *filter);
+
+int IngestRecord(FlowSource_t *fs, recordHeaderV3_t *recordHeaderV3, stat_record_t *stat);
+
+void SetOverload(int overload);
+
+uint64_t OverloadShedRecords(void);
+
+void StopIngest(void);
+
+#endif  // _INGEST_H
@@ -60,6 +60,7 @@
 #endif
 
 #include "collector.h"
+#include "conf/nfconf.h"
 #include "expire.h"
 #include "launch.h"
 #include "nfdump.h"
@@ -84,6 +85,41 @@ typedef struct launcher_args_s {
     char *ident;
 } launcher_args_t;
 
+// a command to run for a time slot
+typedef struct launcherJob_s {
+    struct launcherJob_s *next;
+    char *cmd;
+    time_t timeslot;
+    pid_t pid;
+    uint64_t queued;   // usec
+    uint64_t started;  // usec
+} launcherJob_t;
+
+// jobs and stats of an ident
+typedef struct launcherChannel_s {
+    struct launcherChannel_s *next;
+    char *ident;
+
+    uint32_t numRunning;
+    uint32_t numPending;
+    launcherJob_t *running;
+    launcherJob_t *pendingHead;
+    launcherJob_t *pendingTail;
+
+    // stats
+    uint64_t numJobs;
+    uint64_t numSkipped;
+    uint64_t waitTime;    // usec
+    uint64_t runTime;     // usec
+    uint64_t maxRunTime;  // usec
+} launcherChannel_t;
+
+// default limits, may be changed in the config file
+#define MAXJOBS 4
+#define MAXBACKLOG 8
+
+static launcherChannel_t *launcherChannels = NULL;
+
 static int done = 0;
 static int child_exit = 0;
 static pthread_t killtid = 0;
@@ -94,11 +130,11 @@ static char *cmd_expand(char *launch_process, launcher_args_t *launcher_args);
 
 static void cmd_parse(char *buf, char **args);
 
-static void cmd_execute(char **args);
+static pid_t cmd_execute(char **args);
 
 static void processMessage(message_t *message, launcher_args_t *launcher_args);
 
-static void launcher(messageQueue_t *messageQueue, char *launch_process, int expire);
+static void launcher(messageQueue_t *messageQueue, char *launch_process, int expire, uint32_t maxJobs, uint32_t maxBacklog);
 
 static void do_expire(char *datadir);
 
@@ -219,13 +255,13 @@ static void cmd_parse(char *buf, char **args) {
  * cmd_execute
  * spawn a child process and execute the program.
  */
-static void cmd_execute(char **args) {
-    int pid;
+static pid_t cmd_execute(char **args) {
+    pid_t pid;
 
     // Get a child process.
     if ((pid = fork()) < 0) {
         LogError("Can't fork: %s", strerror(errno));
-        return;
+        return 0;
     }
 
     if (pid == 0) {
@@ -236,9 +272,130 @@ static void cmd_execute(char **args) {
     }
 
     // parent process
+    return pid;
 
 }  // End of cmd_execute
 
+static uint64_t usecNow(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000LL + (uint64_t)tv.tv_usec;
+}  // End of usecNow
+
+static launcherChannel_t *GetChannel(char *ident) {
+    launcherChannel_t *channel = launcherChannels;
+    while (channel && strcmp(channel->ident, ident) != 0) channel = channel->next;
+    if (channel) return channel;
+
+    channel = calloc(1, sizeof(launcherChannel_t));
+    if (!channel || (channel->ident = strdup(ident)) == NULL) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(channel);
+        return NULL;
+    }
+    channel->next = launcherChannels;
+    launcherChannels = channel;
+
+    return channel;
+
+}  // End of GetChannel
+
+// queue the command of a time slot. If the backlog is too long, the oldest
+// pending time slots are skipped, to catch up with the current time slot
+static void QueueJob(launcherChannel_t *channel, char *cmd, time_t timeslot, uint32_t maxBacklog) {
+    launcherJob_t *job = calloc(1, sizeof(launcherJob_t));
+    if (!job) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(cmd);
+        return;
+    }
+    job->cmd = cmd;
+    job->timeslot = timeslot;
+    job->queued = usecNow();
+
+    if (channel->pendingTail)
+        channel->pendingTail->next = job;
+    else
+        channel->pendingHead = job;
+    channel->pendingTail = job;
+    channel->numPending++;
+
+    while (channel->numPending > maxBacklog) {
+        launcherJob_t *skipped = channel->pendingHead;
+        channel->pendingHead = skipped->next;
+        channel->numPending--;
+        channel->numSkipped++;
+        LogError("Launcher: ident: %s, backlog of %u time slots - skip slot %lld", channel->ident, maxBacklog, (long long)skipped->timeslot);
+        free(skipped->cmd);
+        free(skipped);
+    }
+
+}  // End of QueueJob
+
+// start pending jobs of all channels up to maxJobs per channel
+static void RunJobs(uint32_t maxJobs) {
+    for (launcherChannel_t *channel = launcherChannels; channel; channel = channel->next) {
+        while (channel->pendingHead && channel->numRunning < maxJobs) {
+            launcherJob_t *job = channel->pendingHead;
+            channel->pendingHead = job->next;
+            if (channel->pendingHead == NULL) channel->pendingTail = NULL;
+            channel->numPending--;
+
+            LogVerbose("Launcher: ident: %s run command: '%s'", channel->ident, job->cmd);
+
+            // prepare args array - cmd_parse modifies the command string
+            char *args[MAXARGS];
+            cmd_parse(job->cmd, args);
+            job->pid = args[0] ? cmd_execute(args) : 0;
+            free(job->cmd);
+            job->cmd = NULL;
+            if (job->pid <= 0) {
+                free(job);
+                continue;
+            }
+
+            job->started = usecNow();
+            channel->waitTime += job->started - job->queued;
+            job->next = channel->running;
+            channel->running = job;
+            channel->numRunning++;
+        }
+    }
+
+}  // End of RunJobs
+
+// account a terminated child process
+static void JobDone(pid_t pid) {
+    for (launcherChannel_t *channel = launcherChannels; channel; channel = channel->next) {
+        launcherJob_t **job = &channel->running;
+        while (*job && (*job)->pid != pid) job = &((*job)->next);
+        if (*job == NULL) continue;
+
+        launcherJob_t *finished = *job;
+        *job = finished->next;
+        channel->numRunning--;
+
+        uint64_t runTime = usecNow() - finished->started;
+        channel->numJobs++;
+        channel->runTime += runTime;
+        if (runTime > channel->maxRunTime) channel->maxRunTime = runTime;
+        LogVerbose("Launcher: ident: %s, slot %lld done - run time: %.3fs, running: %u, pending: %u", channel->ident, (long long)finished->timeslot,
+                   (double)runTime / 1000000.0, channel->numRunning, channel->numPending);
+        free(finished);
+        return;
+    }
+
+}  // End of JobDone
+
+static void LauncherStat(void) {
+    for (launcherChannel_t *channel = launcherChannels; channel; channel = channel->next) {
+        uint64_t numJobs = channel->numJobs ? channel->numJobs : 1;
+        LogInfo("Launcher: ident: %s, jobs: %llu, skipped: %llu, avg wait: %.3fs, avg run: %.3fs, max run: %.3fs", channel->ident,
+                (unsigned long long)channel->numJobs, (unsigned long long)channel->numSkipped, (double)channel->waitTime / (1000000.0 * numJobs),
+                (double)channel->runTime / (1000000.0 * numJobs), (double)channel->maxRunTime / 1000000.0);
+    }
+}  // End of LauncherStat
+
 static void do_expire(char *datadir) {
     bookkeeper_t *books;
     dirstat_t *dirstat, oldstat;
@@ -268,9 +425,15 @@ static void do_expire(char *datadir) {
             /* not reached */
     }
 
+    // the collector maintains the file index of its data directory - build it once
+    if (!FileIndexExists(datadir)) {
+        LogInfo("Build file index");
+        do_rescan = 1;
+    }
+
     bookkeeper_stat = AccessBookkeeper(&books, datadir);
     if (do_rescan) {
-        RescanDir(datadir, dirstat);
+        RescanDir(datadir, dirstat, 1);
         if (bookkeeper_stat == BOOKKEEPER_OK) {
             ClearBooks(books, NULL);
             // release the books below
@@ -346,42 +509,44 @@ void processMessage(message_t *message, launcher_args_t *launcher_args) {
 
 }  // End of processMessage
 
-static void launcher(messageQueue_t *messageQueue, char *launch_process, int expire) {
+static void launcher(messageQueue_t *messageQueue, char *launch_process, int expire, uint32_t maxJobs, uint32_t maxBacklog) {
     while (!done) {
-        message_t *message = getMessage(messageQueue);
+        // wake up regularly, to start pending jobs of terminated children
+        message_t *message = getMessageTimed(messageQueue, 250);
         if (message == (message_t *)-1) {
             done = 1;
-            return;
+            break;
         }
 
-        LogVerbose("Launcher: process next message");
-        launcher_args_t launcher_args;
-        processMessage(message, &launcher_args);
-
-        // may be NULL, if we only expire data files
-        if (launch_process) {
-            char *cmd = NULL;
+        if (message) {
+            LogVerbose("Launcher: process next message");
+            launcher_args_t launcher_args;
+            processMessage(message, &launcher_args);
+
+            // may be NULL, if we only expire data files
+            if (launch_process) {
+                // check valid command expansion
+                char *cmd = cmd_expand(launch_process, &launcher_args);
+                if (cmd == NULL) {
+                    LogError("Launcher: ident: %s, Unable to expand command: '%s'", launcher_args.ident, launch_process);
+                    done = 1;
+                    free(message);
+                    break;
+                }
 
-            // check valid command expansion
-            cmd = cmd_expand(launch_process, &launcher_args);
-            if (cmd == NULL) {
-                LogError("Launcher: ident: %s, Unable to expand command: '%s'", launcher_args.ident, launch_process);
-                done = 1;
-                return;
+                launcherChannel_t *channel = GetChannel(launcher_args.ident);
+                if (channel)
+                    QueueJob(channel, cmd, launcher_args.timeslot, maxBacklog);
+                else
+                    free(cmd);
             }
-            LogVerbose("Launcher: ident: %s run command: '%s'", launcher_args.ident, cmd);
-
-            // prepare args array
-            char *args[MAXARGS];
-            cmd_parse(cmd, args);
-            if (args[0]) cmd_execute(args);
-
-            free(cmd);
+            if (expire) do_expire(launcher_args.flowdir);
+            free(message);
         }
-        if (expire) do_expire(launcher_args.flowdir);
 
         if (child_exit) {
             LogVerbose("%d child process(es) terminated", child_exit);
+            child_exit = 0;
             int stat;
             pid_t pid;
             while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
@@ -391,14 +556,15 @@ static void launcher(messageQueue_t *messageQueue, char *launch_process, int exp
                 if (WIFSIGNALED(stat)) {
                     LogError("launcher child %i died due to signal %i", pid, WTERMSIG(stat));
                 }
-
-                child_exit--;
+                JobDone(pid);
             }
-            child_exit = 0;
         }
+
+        RunJobs(maxJobs);
     }
 
     // we are done
+    LauncherStat();
     LogInfo("Launcher: Terminating.");
 
 }  // End of launcher
@@ -472,7 +638,12 @@ int SendLauncherMessage(int pfd, time_t t_start, char *subdir, char *fmt, char *
 }
 
 int StartupLauncher(char *launch_process, int expire) {
-    LogInfo("StartupLauncher(): %s, expire: %d", launch_process, expire);
+    int maxJobs = ConfGetValue("launcher.maxjobs");
+    if (maxJobs <= 0) maxJobs = MAXJOBS;
+    int maxBacklog = ConfGetValue("launcher.maxbacklog");
+    if (maxBacklog <= 0) maxBacklog = MAXBACKLOG;
+
+    LogInfo("StartupLauncher(): %s, expire: %d, max jobs: %d, max backlog: %d", launch_process, expire, maxJobs, maxBacklog);
 
     messageQueue_t *messageQueue = NewMessageQueue();
     if (!messageQueue) return 0;
@@ -497,7 +668,7 @@ int StartupLauncher(char *launch_process, int expire) {
     }
     tid = killtid;
 
-    launcher(messageQueue, launch_process, expire);
+    launcher(messageQueue, launch_process, expire, maxJobs, maxBacklog);
     err = pthread_join(tid, NULL);
     if (err) {
         LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
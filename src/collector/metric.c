@@ -30,9 +30,12 @@
 
 #include "metric.h"
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <math.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
@@ -40,12 +43,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "conf/nfconf.h"
 #include "config.h"
 #include "nffile.h"
 #include "nfxV3.h"
@@ -56,14 +61,51 @@ static _Atomic unsigned tstart = 0;
 
 // list of chained metric records
 static metric_chain_t *metric_list = NULL;
-
-// cache last metric record
-static metric_record_t *metricCache = NULL;
 static uint32_t numMetrics = 0;
 
+// list of metric slots of all FlowSources
+static metric_slot_t *slot_list = NULL;
+
+// list of exporter metrics of all FlowSources
+static exporter_metric_t *exporter_list = NULL;
+static uint32_t numExporterMetrics = 0;
+static int exporterMetric = 0;  // collect exporter metrics
+static int sendExporter = 0;    // send exporter metrics to the metric socket
+
+// protects the metric and slot lists. Not used for updating counters
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t tid = 0;
 
+// OpenMetrics HTTP endpoint - see OpenMetricHTTP()
+static _Atomic int httpActive = 0;
+static int httpSocket = -1;
+static pthread_t httpTid = 0;
+static uint64_t httpStart = 0;
+
+// queues and receive sockets exposed by the OpenMetrics endpoint. Protected by mutex
+#define MAXMETRICQUEUES 16
+static struct {
+    char name[32];
+    queue_t *queue;
+} metricQueue[MAXMETRICQUEUES];
+static unsigned numMetricQueues = 0;
+
+#define MAXMETRICSOCKETS 64
+static ino_t socketInode[MAXMETRICSOCKETS];
+static unsigned numMetricSockets = 0;
+
+// count, sum and last duration in nsec of collector tasks
+static _Atomic uint64_t durationCounter[NUMMETRICDURATIONS][3];
+
+// counter index in a metric slot
+#define FLOWS 0
+#define BYTES 4
+#define PACKETS 8
+
+// single writer counters - the MetricThread may read concurrently
+#define AddCounter(slot, index, value) \
+    __atomic_store_n(&((slot)->counter[index]), (slot)->counter[index] + (value), __ATOMIC_RELAXED)
+
 static int OpenSocket(void) {
     struct sockaddr_un addr;
 
@@ -85,7 +127,7 @@ static int OpenSocket(void) {
     return fd;
 }
 
-static inline metric_record_t *GetMetric(char *ident, uint32_t exporterID) {
+static metric_record_t *GetMetric(char *ident, uint32_t exporterID) {
     metric_chain_t *metric_chain = metric_list;
     while (metric_chain && strncmp(metric_chain->record->ident, ident, 128)) metric_chain = metric_chain->next;
 
@@ -99,10 +141,12 @@ static inline metric_record_t *GetMetric(char *ident, uint32_t exporterID) {
     metric_record_t *metric_record = (metric_record_t *)calloc(1, sizeof(metric_record_t));
     if (!metric_chain || !metric_record) {
         LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(metric_chain);
+        free(metric_record);
         return NULL;
     }
     numMetrics++;
-    strncpy(metric_record->ident, ident, 127);
+    snprintf(metric_record->ident, sizeof(metric_record->ident), "%s", ident);
     metric_record->exporterID = exporterID;
     metric_chain->record = metric_record;
     metric_chain->next = metric_list;
@@ -111,8 +155,34 @@ static inline metric_record_t *GetMetric(char *ident, uint32_t exporterID) {
 
 }  // End of GetMetric
 
+// resolve the metric slot of a FlowSource once. Later updates use fs->metric
+static metric_slot_t *GetMetricSlot(FlowSource_t *fs, uint32_t exporterID) {
+    metric_slot_t *slot = (metric_slot_t *)calloc(1, sizeof(metric_slot_t));
+    if (!slot) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    pthread_mutex_lock(&mutex);
+    slot->record = GetMetric(fs->Ident, exporterID);
+    if (!slot->record) {
+        pthread_mutex_unlock(&mutex);
+        free(slot);
+        return NULL;
+    }
+    slot->next = slot_list;
+    slot_list = slot;
+    pthread_mutex_unlock(&mutex);
+
+    fs->metric = slot;
+    return slot;
+
+}  // End of GetMetricSlot
+
 int OpenMetric(char *path, int interval) {
     socket_path = path;
+    sendExporter = ConfGetValue("metric.exporter") > 0;
+    if (sendExporter) exporterMetric = 1;
     int fd = OpenSocket();
     if (fd == 0) {
         LogError("metric socket unreachable");
@@ -134,16 +204,30 @@ int OpenMetric(char *path, int interval) {
 int CloseMetric(void) {
     dbg_printf("Close metric\n");
 
-    // if no MetricThread is running
-    if (atomic_load(&tstart) == 0) return 0;
+    int running = 0;
+    if (atomic_load(&httpActive)) {
+        // the HTTP thread polls the listen socket with a timeout and terminates
+        atomic_store(&httpActive, 0);
+        int status = pthread_join(httpTid, NULL);
+        if (status) LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(status));
+        close(httpSocket);
+        httpSocket = -1;
+        running = 1;
+    }
+
+    if (atomic_load(&tstart) != 0) {
+        // signal MetricThread too terminate
+        atomic_init(&tstart, 0);
+        int status = pthread_kill(tid, SIGINT);
+        if (status < 0) LogError("pthread_kill() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
 
-    // signal MetricThread too terminate
-    atomic_init(&tstart, 0);
-    int status = pthread_kill(tid, SIGINT);
-    if (status < 0) LogError("pthread_kill() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        status = pthread_join(tid, NULL);
+        if (status < 0) LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        running = 1;
+    }
 
-    status = pthread_join(tid, NULL);
-    if (status < 0) LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+    // if no metric thread was running
+    if (running == 0) return 0;
 
     pthread_mutex_lock(&mutex);
     metric_chain_t *metric_chain = metric_list;
@@ -154,62 +238,221 @@ int CloseMetric(void) {
         free(elem);
     }
     metric_list = NULL;
+    numMetrics = 0;
+
+    metric_slot_t *slot = slot_list;
+    while (slot) {
+        metric_slot_t *elem = slot;
+        slot = slot->next;
+        free(elem);
+    }
+    slot_list = NULL;
+
+    exporter_metric_t *exporter_metric = exporter_list;
+    while (exporter_metric) {
+        exporter_metric_t *elem = exporter_metric;
+        exporter_metric = exporter_metric->next;
+        free(elem);
+    }
+    exporter_list = NULL;
+    numExporterMetrics = 0;
+    exporterMetric = 0;
+    sendExporter = 0;
+    numMetricQueues = 0;
+    numMetricSockets = 0;
     pthread_mutex_unlock(&mutex);
 
     return 0;
 
 }  // End of CloseMetric
 
-void UpdateMetric(char *ident, uint32_t exporterID, EXgenericFlow_t *genericFlow) {
+void UpdateMetric(FlowSource_t *fs, uint32_t exporterID, EXgenericFlow_t *genericFlow) {
     dbg_printf("Update metric: exporter ID: %x\n", exporterID);
 
-    // if no MetricThread is running
-    if (atomic_load(&tstart) == 0) return;
+    // if no metric thread is running
+    if (atomic_load(&tstart) == 0 && atomic_load(&httpActive) == 0) return;
 
-    dbg_printf("Update metric\n");
-    pthread_mutex_lock(&mutex);
-    metric_record_t *metric_record = metricCache;
-    if (metric_record == NULL || strncmp(metric_record->ident, ident, 128) != 0) {
-        dbg_printf("Get metric\n");
-        metric_record = GetMetric(ident, exporterID);
-        if (!metric_record) {
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
-        metricCache = metric_record;
-    }
-#ifdef DEVEL
-    else {
-        printf("Cached metric\n");
+    metric_slot_t *slot = fs->metric;
+    if (slot == NULL) {
+        slot = GetMetricSlot(fs, exporterID);
+        if (!slot) return;
     }
-#endif
+
     // fill metric
+    int proto;
     switch (genericFlow->proto) {
         case IPPROTO_ICMPV6:
         case IPPROTO_ICMP:
-            metric_record->numflows_icmp++;
-            metric_record->numpackets_icmp += genericFlow->inPackets;
-            metric_record->numbytes_icmp += genericFlow->inBytes;
+            proto = 2;
             break;
         case IPPROTO_TCP:
-            metric_record->numflows_tcp++;
-            metric_record->numpackets_tcp += genericFlow->inPackets;
-            metric_record->numbytes_tcp += genericFlow->inBytes;
+            proto = 0;
             break;
         case IPPROTO_UDP:
-            metric_record->numflows_udp++;
-            metric_record->numpackets_udp += genericFlow->inPackets;
-            metric_record->numbytes_udp += genericFlow->inBytes;
+            proto = 1;
             break;
         default:
-            metric_record->numflows_other++;
-            metric_record->numpackets_other += genericFlow->inPackets;
-            metric_record->numbytes_other += genericFlow->inBytes;
+            proto = 3;
     }
-    pthread_mutex_unlock(&mutex);
+    AddCounter(slot, FLOWS + proto, 1);
+    AddCounter(slot, PACKETS + proto, genericFlow->inPackets);
+    AddCounter(slot, BYTES + proto, genericFlow->inBytes);
 
 }  // End of UpdateMetric
 
+// add the accumulated counters of several flows at once
+void UpdateMetricRecord(FlowSource_t *fs, uint32_t exporterID, metric_record_t *counter) {
+    dbg_printf("Update metric record: exporter ID: %x\n", exporterID);
+
+    // if no metric thread is running
+    if (atomic_load(&tstart) == 0 && atomic_load(&httpActive) == 0) return;
+
+    metric_slot_t *slot = fs->metric;
+    if (slot == NULL) {
+        slot = GetMetricSlot(fs, exporterID);
+        if (!slot) return;
+    }
+
+    uint64_t *value = &(counter->numflows_tcp);
+    for (int i = 0; i < NUMMETRICCOUNTERS; i++) {
+        if (value[i]) AddCounter(slot, i, value[i]);
+    }
+
+}  // End of UpdateMetricRecord
+
+// returns the metric of a new exporter or NULL, if no exporter metric is sent
+exporter_metric_t *GetExporterMetric(FlowSource_t *fs, exporter_info_record_t *info) {
+    if (exporterMetric == 0) return NULL;
+
+    exporter_metric_t *exporter_metric = NULL;
+    if (posix_memalign((void **)&exporter_metric, 64, sizeof(exporter_metric_t)) != 0) {
+        LogError("posix_memalign() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    memset((void *)exporter_metric, 0, sizeof(exporter_metric_t));
+    snprintf(exporter_metric->record.ident, sizeof(exporter_metric->record.ident), "%s", fs->Ident);
+    exporter_metric->record.ip = info->ip;
+    exporter_metric->record.exporterID = info->id;
+    exporter_metric->record.version = info->version;
+    if (info->sa_family == PF_INET6) {
+        uint64_t ip[2] = {htonll(info->ip.V6[0]), htonll(info->ip.V6[1])};
+        inet_ntop(AF_INET6, ip, exporter_metric->ipstr, sizeof(exporter_metric->ipstr));
+    } else {
+        uint32_t ip = htonl(info->ip.V4);
+        inet_ntop(AF_INET, &ip, exporter_metric->ipstr, sizeof(exporter_metric->ipstr));
+    }
+
+    pthread_mutex_lock(&mutex);
+    exporter_metric->next = exporter_list;
+    exporter_list = exporter_metric;
+    numExporterMetrics++;
+    pthread_mutex_unlock(&mutex);
+
+    return exporter_metric;
+
+}  // End of GetExporterMetric
+
+uint64_t MetricNsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}  // End of MetricNsec
+
+// expose the depth of a queue by the OpenMetrics endpoint
+void MetricQueue(char *name, queue_t *queue) {
+    pthread_mutex_lock(&mutex);
+    if (numMetricQueues < MAXMETRICQUEUES) {
+        strncpy(metricQueue[numMetricQueues].name, name, sizeof(metricQueue[0].name) - 1);
+        metricQueue[numMetricQueues].queue = queue;
+        numMetricQueues++;
+    }
+    pthread_mutex_unlock(&mutex);
+
+}  // End of MetricQueue
+
+// remove a queue, before it is freed
+void MetricUnregisterQueue(queue_t *queue) {
+    pthread_mutex_lock(&mutex);
+    for (unsigned i = 0; i < numMetricQueues; i++) {
+        if (metricQueue[i].queue == queue) {
+            numMetricQueues--;
+            metricQueue[i] = metricQueue[numMetricQueues];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+
+}  // End of MetricUnregisterQueue
+
+// expose the receive drops of an UDP socket by the OpenMetrics endpoint
+void MetricSocket(int sock) {
+    struct stat stat_buf;
+    if (fstat(sock, &stat_buf) < 0) return;
+
+    pthread_mutex_lock(&mutex);
+    if (numMetricSockets < MAXMETRICSOCKETS) socketInode[numMetricSockets++] = stat_buf.st_ino;
+    pthread_mutex_unlock(&mutex);
+
+}  // End of MetricSocket
+
+void MetricDuration(int which, uint64_t nsec) {
+    if (which < 0 || which >= NUMMETRICDURATIONS) return;
+    atomic_fetch_add_explicit(&durationCounter[which][0], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&durationCounter[which][1], nsec, memory_order_relaxed);
+    atomic_store_explicit(&durationCounter[which][2], nsec, memory_order_relaxed);
+}  // End of MetricDuration
+
+// send the counter differences since the last interval of all exporters
+static void SendExporterMetric(message_header_t *metric_header) {
+    size_t size = sizeof(message_header_t) + numExporterMetrics * sizeof(exporter_metric_record_t);
+    void *message = malloc(size);
+    if (!message) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    message_header_t *message_header = (message_header_t *)message;
+    *message_header = *metric_header;
+    message_header->version = 2;
+    message_header->size = numExporterMetrics * sizeof(exporter_metric_record_t);
+    message_header->numMetrics = numExporterMetrics;
+
+    exporter_metric_record_t *record = (exporter_metric_record_t *)(message + sizeof(message_header_t));
+    for (exporter_metric_t *exporter_metric = exporter_list; exporter_metric; exporter_metric = exporter_metric->next) {
+        *record = exporter_metric->record;
+        for (int i = 0; i < NUMEXPORTERCOUNTERS; i++) {
+            uint64_t counter = __atomic_load_n(&(exporter_metric->counter[i]), __ATOMIC_RELAXED);
+            record->counter[i] = counter - exporter_metric->reported[i];
+            exporter_metric->reported[i] = counter;
+        }
+        record++;
+    }
+
+    int fd = OpenSocket();
+    if (fd) {
+        ssize_t ret = write(fd, message, size);
+        if (ret < 0) {
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        }
+        close(fd);
+    }
+    free(message);
+
+}  // End of SendExporterMetric
+
+// add the counter differences since the last interval of all slots to their metric records
+static void CollectMetricSlots(void) {
+    for (metric_slot_t *slot = slot_list; slot; slot = slot->next) {
+        uint64_t *value = &(slot->record->numflows_tcp);
+        for (int i = 0; i < NUMMETRICCOUNTERS; i++) {
+            uint64_t counter = __atomic_load_n(&(slot->counter[i]), __ATOMIC_RELAXED);
+            value[i] += counter - slot->reported[i];
+            slot->reported[i] = counter;
+        }
+    }
+
+}  // End of CollectMetricSlots
+
 __attribute__((noreturn)) void *MetricThread(void *arg) {
     dbg_printf("Started MetricThread\n");
     void *message = malloc(sizeof(message_header_t) + sizeof(metric_record_t));
@@ -271,6 +514,8 @@ __attribute__((noreturn)) void *MetricThread(void *arg) {
             message_header->numMetrics = cnt;
         }
 
+        CollectMetricSlots();
+
         // update uptime
         message_header->uptime = te.tv_sec - _tstart;
         // update timestamp rounded correctly to the interval slot
@@ -306,6 +551,7 @@ __attribute__((noreturn)) void *MetricThread(void *arg) {
         } else {
             LogError("metric socket unreachable");
         }
+        if (numExporterMetrics && sendExporter) SendExporterMetric(message_header);
         pthread_mutex_unlock(&mutex);
 
         gettimeofday(&te, NULL);
@@ -316,3 +562,298 @@ __attribute__((noreturn)) void *MetricThread(void *arg) {
     pthread_exit(NULL);
 
 }  // End of SendMetric
+
+// copy a label value and escape backslash, double quote and newline
+static char *EscapeLabel(char *dst, size_t size, const char *src) {
+    size_t i = 0;
+    while (*src && i < size - 2) {
+        if (*src == '\\' || *src == '"') {
+            dst[i++] = '\\';
+            dst[i++] = *src;
+        } else if (*src == '\n') {
+            dst[i++] = '\\';
+            dst[i++] = 'n';
+        } else {
+            dst[i++] = *src;
+        }
+        src++;
+    }
+    dst[i] = '\0';
+    return dst;
+
+}  // End of EscapeLabel
+
+static void MetricHeader(FILE *out, char *name, char *type, char *help) {
+    fprintf(out, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}  // End of MetricHeader
+
+#ifdef __linux__
+// print the receive drops of the registered sockets. The kernel counts the same
+// drops as reported by SO_RXQ_OVFL in the drops column of /proc/net/udp[6]
+static void SocketDrops(FILE *out) {
+    char *procFile[] = {"/proc/net/udp", "/proc/net/udp6"};
+    for (int i = 0; i < 2; i++) {
+        FILE *fp = fopen(procFile[i], "r");
+        if (!fp) continue;
+        char line[512];
+        while (fgets(line, sizeof(line), fp)) {
+            unsigned long long inode, drops;
+            if (sscanf(line, " %*d: %*s %*s %*s %*s %*s %*s %*s %*s %llu %*s %*s %llu", &inode, &drops) != 2) continue;
+            for (unsigned j = 0; j < numMetricSockets; j++) {
+                if (socketInode[j] == (ino_t)inode) fprintf(out, "nfdump_receive_drops_total{socket=\"%u\"} %llu\n", j, drops);
+            }
+        }
+        fclose(fp);
+    }
+
+}  // End of SocketDrops
+#endif
+
+// print all metrics in the OpenMetrics text format
+static void WriteOpenMetrics(FILE *out) {
+    static const char *protoName[] = {"tcp", "udp", "icmp", "other"};
+    static const char *codecName[NUMCODECS] = {"none", "lzo", "bz2", "lz4", "zstd", "zstd-dict"};
+    static const char *durationName[NUMMETRICDURATIONS] = {"rotate", "finalize"};
+    char ident[256];
+
+    MetricHeader(out, "nfdump_start_time_seconds", "gauge", "Start time of the collector.");
+    fprintf(out, "nfdump_start_time_seconds %llu\n", (unsigned long long)httpStart);
+
+    pthread_mutex_lock(&mutex);
+
+    // flows, packets and bytes per ident of all slots
+    char *counterName[] = {"nfdump_flows", "nfdump_bytes", "nfdump_packets"};
+    char *counterHelp[] = {"Flows collected.", "Bytes of the flows collected.", "Packets of the flows collected."};
+    for (int c = 0; c < 3; c++) {
+        MetricHeader(out, counterName[c], "counter", counterHelp[c]);
+        for (metric_chain_t *metric_chain = metric_list; metric_chain; metric_chain = metric_chain->next) {
+            uint64_t sum[4] = {0};
+            for (metric_slot_t *slot = slot_list; slot; slot = slot->next) {
+                if (slot->record != metric_chain->record) continue;
+                for (int p = 0; p < 4; p++) sum[p] += __atomic_load_n(&(slot->counter[4 * c + p]), __ATOMIC_RELAXED);
+            }
+            EscapeLabel(ident, sizeof(ident), metric_chain->record->ident);
+            for (int p = 0; p < 4; p++)
+                fprintf(out, "%s_total{ident=\"%s\",proto=\"%s\"} %llu\n", counterName[c], ident, protoName[p], (unsigned long long)sum[p]);
+        }
+    }
+
+    // exporter counters
+    char *exporterName[] = {"nfdump_exporter_packets",         "nfdump_exporter_bytes",         "nfdump_exporter_flows",
+                            "nfdump_exporter_sequence_failures", "nfdump_exporter_decode_errors", "nfdump_exporter_template_misses"};
+    char *exporterHelp[] = {"Packets received.",   "Bytes received.", "Flows decoded.", "Sequence failures.",
+                            "Malformed packets.", "Data flowsets without template."};
+    for (int c = 0; c < EXPORTER_DECODENSEC; c++) {
+        MetricHeader(out, exporterName[c], "counter", exporterHelp[c]);
+        for (exporter_metric_t *exporter_metric = exporter_list; exporter_metric; exporter_metric = exporter_metric->next) {
+            exporter_metric_record_t *record = &(exporter_metric->record);
+            fprintf(out, "%s_total{ident=\"%s\",exporter=\"%s\",id=\"%u\",version=\"%u\"} %llu\n", exporterName[c],
+                    EscapeLabel(ident, sizeof(ident), record->ident), exporter_metric->ipstr, record->exporterID, record->version,
+                    (unsigned long long)__atomic_load_n(&(exporter_metric->counter[c]), __ATOMIC_RELAXED));
+        }
+    }
+
+    // decode time histogram
+    MetricHeader(out, "nfdump_exporter_decode_seconds", "histogram", "Decode time of a packet.");
+    for (exporter_metric_t *exporter_metric = exporter_list; exporter_metric; exporter_metric = exporter_metric->next) {
+        exporter_metric_record_t *record = &(exporter_metric->record);
+        char labels[512];
+        snprintf(labels, sizeof(labels), "ident=\"%s\",exporter=\"%s\",id=\"%u\",version=\"%u\"",
+                 EscapeLabel(ident, sizeof(ident), record->ident), exporter_metric->ipstr, record->exporterID, record->version);
+        uint64_t count = 0;
+        for (int i = 0; i < NUMDECODEBUCKETS; i++) {
+            count += __atomic_load_n(&(exporter_metric->decodeHist[i]), __ATOMIC_RELAXED);
+            if (i < NUMDECODEBUCKETS - 1)
+                fprintf(out, "nfdump_exporter_decode_seconds_bucket{%s,le=\"%g\"} %llu\n", labels, (double)decodeBucket[i] / 1e9,
+                        (unsigned long long)count);
+            else
+                fprintf(out, "nfdump_exporter_decode_seconds_bucket{%s,le=\"+Inf\"} %llu\n", labels, (unsigned long long)count);
+        }
+        fprintf(out, "nfdump_exporter_decode_seconds_count{%s} %llu\n", labels, (unsigned long long)count);
+        fprintf(out, "nfdump_exporter_decode_seconds_sum{%s} %.9f\n", labels,
+                (double)__atomic_load_n(&(exporter_metric->counter[EXPORTER_DECODENSEC]), __ATOMIC_RELAXED) / 1e9);
+    }
+
+    MetricHeader(out, "nfdump_queue_depth", "gauge", "Elements waiting in a queue.");
+    for (unsigned i = 0; i < numMetricQueues; i++)
+        fprintf(out, "nfdump_queue_depth{queue=\"%s\"} %zu\n", metricQueue[i].name, queue_length(metricQueue[i].queue));
+
+#ifdef __linux__
+    MetricHeader(out, "nfdump_receive_drops", "counter", "Datagrams dropped by the socket receive buffer.");
+    SocketDrops(out);
+#endif
+
+    pthread_mutex_unlock(&mutex);
+
+    MetricHeader(out, "nfdump_writer_backlog_blocks", "gauge", "Blocks queued for the file writers.");
+    fprintf(out, "nfdump_writer_backlog_blocks %llu\n", (unsigned long long)WriterBacklog());
+
+    codecStat_t codecStat[NUMCODECS];
+    GetCompressStat(codecStat);
+    MetricHeader(out, "nfdump_compress_blocks", "counter", "Blocks compressed.");
+    for (int i = 1; i < NUMCODECS; i++)
+        fprintf(out, "nfdump_compress_blocks_total{codec=\"%s\"} %llu\n", codecName[i], (unsigned long long)codecStat[i].blocks);
+    MetricHeader(out, "nfdump_compress_seconds", "counter", "Time spent compressing blocks.");
+    for (int i = 1; i < NUMCODECS; i++)
+        fprintf(out, "nfdump_compress_seconds_total{codec=\"%s\"} %.9f\n", codecName[i], (double)codecStat[i].nsec / 1e9);
+    MetricHeader(out, "nfdump_compress_output_bytes", "counter", "Compressed bytes written.");
+    for (int i = 1; i < NUMCODECS; i++)
+        fprintf(out, "nfdump_compress_output_bytes_total{codec=\"%s\"} %llu\n", codecName[i], (unsigned long long)codecStat[i].outBytes);
+
+    MetricHeader(out, "nfdump_duration_seconds", "summary", "Duration of collector tasks.");
+    for (int i = 0; i < NUMMETRICDURATIONS; i++) {
+        fprintf(out, "nfdump_duration_seconds_count{task=\"%s\"} %llu\n", durationName[i],
+                (unsigned long long)atomic_load_explicit(&durationCounter[i][0], memory_order_relaxed));
+        fprintf(out, "nfdump_duration_seconds_sum{task=\"%s\"} %.9f\n", durationName[i],
+                (double)atomic_load_explicit(&durationCounter[i][1], memory_order_relaxed) / 1e9);
+    }
+    MetricHeader(out, "nfdump_last_duration_seconds", "gauge", "Duration of the last run of a collector task.");
+    for (int i = 0; i < NUMMETRICDURATIONS; i++)
+        fprintf(out, "nfdump_last_duration_seconds{task=\"%s\"} %.9f\n", durationName[i],
+                (double)atomic_load_explicit(&durationCounter[i][2], memory_order_relaxed) / 1e9);
+
+    fprintf(out, "# EOF\n");
+
+}  // End of WriteOpenMetrics
+
+// answer a single HTTP request and close the connection
+static void ServeHTTP(int fd) {
+    struct timeval tv = {.tv_sec = 2, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char request[1024];
+    ssize_t len = recv(fd, request, sizeof(request) - 1, 0);
+    if (len <= 0) return;
+    request[len] = '\0';
+
+    char *body = NULL;
+    size_t bodySize = 0;
+    FILE *out = open_memstream(&body, &bodySize);
+    if (!out) {
+        LogError("open_memstream() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    char *status = "200 OK";
+    char *contentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+    if (strncmp(request, "GET ", 4) != 0) {
+        status = "405 Method Not Allowed";
+        contentType = "text/plain";
+        fprintf(out, "Method not allowed\n");
+    } else if (strncmp(request + 4, "/metrics", 8) != 0 || (request[12] != ' ' && request[12] != '?')) {
+        status = "404 Not Found";
+        contentType = "text/plain";
+        fprintf(out, "Not found\n");
+    } else {
+        WriteOpenMetrics(out);
+    }
+    fclose(out);
+
+    char header[256];
+    int headerSize = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                              status, contentType, bodySize);
+    if (write(fd, header, headerSize) < 0 || write(fd, body, bodySize) < 0) {
+        LogVerbose("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+    }
+    free(body);
+
+}  // End of ServeHTTP
+
+static void *MetricHTTPThread(void *arg) {
+    dbg_printf("Started MetricHTTPThread\n");
+
+    // signals are handled by the main thread
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    struct pollfd pfd = {.fd = httpSocket, .events = POLLIN};
+    while (atomic_load(&httpActive)) {
+        // poll with a timeout to check the end condition
+        int ret = poll(&pfd, 1, 1000);
+        if (ret <= 0) continue;
+
+        int fd = accept(httpSocket, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != EAGAIN) LogError("accept() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            continue;
+        }
+        ServeHTTP(fd);
+        close(fd);
+    }
+
+    dbg_printf("End MetricHTTPThread\n");
+    return NULL;
+
+}  // End of MetricHTTPThread
+
+/*
+ * Start an OpenMetrics endpoint, if metric.http = "[host]:port" is set in the
+ * collector config. A scrape of /metrics reads the lock free counters of the
+ * collector threads, therefore the endpoint does not add to the per record cost.
+ * Returns 1 if no endpoint is configured or the endpoint is running, 0 on error.
+ */
+int OpenMetricHTTP(void) {
+    char *listenAddr = ConfGetString("metric.http");
+    if (listenAddr == NULL) return 1;
+
+    // split host and port - an IPv6 host is enclosed in []
+    char *host = listenAddr;
+    char *port = strrchr(listenAddr, ':');
+    if (port == NULL) {
+        LogError("metric.http: expected [host]:port, got: %s", listenAddr);
+        free(listenAddr);
+        return 0;
+    }
+    *port++ = '\0';
+    if (*host == '[') {
+        host++;
+        char *p = strchr(host, ']');
+        if (p) *p = '\0';
+    }
+    if (*host == '\0') host = NULL;
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE};
+    struct addrinfo *res = NULL;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err) {
+        LogError("getaddrinfo() error for metric.http: %s", gai_strerror(err));
+        free(listenAddr);
+        return 0;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 8) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        LogError("Can not listen on metric.http port %s: %s", port, strerror(errno));
+        free(listenAddr);
+        return 0;
+    }
+    free(listenAddr);
+
+    httpSocket = fd;
+    httpStart = (uint64_t)time(NULL);
+    exporterMetric = 1;
+    atomic_store(&httpActive, 1);
+    err = pthread_create(&httpTid, NULL, MetricHTTPThread, NULL);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        atomic_store(&httpActive, 0);
+        close(httpSocket);
+        httpSocket = -1;
+        return 0;
+    }
+    LogInfo("OpenMetrics endpoint initialized");
+
+    return 1;
+
+}  // End of OpenMetricHTTP
@@ -31,8 +31,12 @@
 #ifndef _METRIC_H
 #define _METRIC_H 1
 
+#include <netinet/in.h>
+
+#include "collector.h"
 #include "nffile.h"
 #include "nfxV3.h"
+#include "queue.h"
 
 typedef struct message_header_s {
     char prefix;
@@ -71,11 +75,110 @@ typedef struct metric_chain_s {
     metric_record_t *record;
 } metric_chain_t;
 
+// number of uint64_t counters in a metric record, starting at numflows_tcp
+#define NUMMETRICCOUNTERS 12
+
+/*
+ * Each FlowSource owns a metric slot. The slot counters are only written by
+ * the thread processing the FlowSource, therefore no lock is needed. The
+ * MetricThread sums up the counter differences of all slots of the same ident
+ * into the metric record sent at each interval.
+ */
+typedef struct metric_slot_s {
+    struct metric_slot_s *next;
+    metric_record_t *record;  // metric record of the ident of this slot
+    uint64_t counter[NUMMETRICCOUNTERS];
+    uint64_t reported[NUMMETRICCOUNTERS];  // counters already added to the record
+} metric_slot_t;
+
+/*
+ * Per exporter statistics. Each exporter of a FlowSource owns an exporter
+ * metric, which is only written by the thread processing the exporter's
+ * packets. The MetricThread sends the counter differences of each interval
+ * as exporter metric records in a message with version 2.
+ * Enabled with metric.exporter = 1 in the collector config.
+ */
+enum {
+    EXPORTER_PACKETS = 0,   // packets received
+    EXPORTER_BYTES,         // bytes received
+    EXPORTER_FLOWS,         // flow records decoded
+    EXPORTER_SEQFAILURE,    // sequence failures
+    EXPORTER_DECODEERROR,   // malformed packets or flowsets
+    EXPORTER_TEMPLATEMISS,  // data flowsets without template
+    EXPORTER_DECODENSEC,    // time spent decoding in nsec
+    NUMEXPORTERCOUNTERS
+};
+
+typedef struct exporter_metric_record_s {
+    // Ident
+    char ident[128];
+    ip_addr_t ip;         // exporter IP address
+    uint32_t exporterID;  // exporter id/observation domain
+    uint16_t version;     // netflow version
+    uint16_t fill;
+
+    uint64_t counter[NUMEXPORTERCOUNTERS];
+} exporter_metric_record_t;
+
+// upper bounds in nsec of the decode time histogram buckets. The last bucket is +Inf
+#define NUMDECODEBUCKETS 8
+static const uint64_t decodeBucket[NUMDECODEBUCKETS - 1] = {2000, 5000, 10000, 20000, 50000, 100000, 500000};
+
+typedef struct exporter_metric_s {
+    // written by the collector thread - keep in its own cache lines
+    uint64_t counter[NUMEXPORTERCOUNTERS];
+    uint64_t fill;
+    uint64_t decodeHist[NUMDECODEBUCKETS];  // packets per decode time bucket
+
+    struct exporter_metric_s *next;
+    uint64_t reported[NUMEXPORTERCOUNTERS];  // counters already sent
+    char ipstr[INET6_ADDRSTRLEN];
+    exporter_metric_record_t record;
+} __attribute__((aligned(64))) exporter_metric_t;
+
+// single writer counter - the MetricThread may read concurrently. metric may be NULL
+#define ExporterCounter(metric, index, value)                                                                            \
+    do {                                                                                                                 \
+        if (metric) __atomic_store_n(&((metric)->counter[index]), (metric)->counter[index] + (value), __ATOMIC_RELAXED); \
+    } while (0)
+
+// add the decode time of a packet to the counters and the histogram. metric may be NULL
+static inline void ExporterDecodeTime(exporter_metric_t *metric, uint64_t nsec) {
+    if (metric == NULL) return;
+    int i = 0;
+    while (i < NUMDECODEBUCKETS - 1 && nsec > decodeBucket[i]) i++;
+    __atomic_store_n(&(metric->decodeHist[i]), metric->decodeHist[i] + 1, __ATOMIC_RELAXED);
+    ExporterCounter(metric, EXPORTER_DECODENSEC, nsec);
+}  // End of ExporterDecodeTime
+
+// durations of collector tasks exposed by the OpenMetrics endpoint
+enum {
+    METRIC_ROTATE = 0,  // file rotation of all flow sources
+    METRIC_FINALIZE,    // closing and renaming a rotated file
+    NUMMETRICDURATIONS
+};
+
 int OpenMetric(char *path, int interval);
 
+int OpenMetricHTTP(void);
+
+void MetricQueue(char *name, queue_t *queue);
+
+void MetricUnregisterQueue(queue_t *queue);
+
+void MetricSocket(int sock);
+
+void MetricDuration(int which, uint64_t nsec);
+
 int CloseMetric(void);
 
-void UpdateMetric(char *ident, uint32_t exporterID, EXgenericFlow_t *genericFlow);
+void UpdateMetric(FlowSource_t *fs, uint32_t exporterID, EXgenericFlow_t *genericFlow);
+
+void UpdateMetricRecord(FlowSource_t *fs, uint32_t exporterID, metric_record_t *counter);
+
+exporter_metric_t *GetExporterMetric(FlowSource_t *fs, exporter_info_record_t *info);
+
+uint64_t MetricNsec(void);
 
 void *MetricThread(void *arg);
 
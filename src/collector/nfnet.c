@@ -29,6 +29,9 @@
  *
  */
 
+// recvmmsg() needs _GNU_SOURCE on Linux
+#define _GNU_SOURCE
+
 #include "nfnet.h"
 
 #include <errno.h>
@@ -41,6 +44,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -52,6 +56,33 @@
 
 const int LISTEN_QUEUE = 128;
 
+// number of datagrams received with one recvmmsg() call
+#ifdef HAVE_RECVMMSG
+#define RECV_BATCHSIZE 32
+#else
+#define RECV_BATCHSIZE 1
+#endif
+
+struct recvBatch_s {
+    int socket;
+    uint32_t numPackets;  // datagrams received with last call
+    uint32_t next;        // next datagram to dispatch
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[RECV_BATCHSIZE];
+    struct iovec iovecs[RECV_BATCHSIZE];
+#endif
+    size_t buffSize;
+    void *buff[RECV_BATCHSIZE];
+    struct sockaddr_storage sender[RECV_BATCHSIZE];
+    socklen_t senderSize[RECV_BATCHSIZE];
+    ssize_t size[RECV_BATCHSIZE];
+#ifdef SO_RXQ_OVFL
+    // control messages with the kernel drop counter
+    char control[RECV_BATCHSIZE][CMSG_SPACE(sizeof(uint32_t))];
+#endif
+    uint32_t drops;  // datagrams dropped by the kernel, as last reported
+};
+
 /* local function prototypes */
 static int isMulticast(struct sockaddr_storage *addr);
 
@@ -59,7 +90,17 @@ static int joinGroup(int sockfd, int loopBack, int mcastTTL, struct sockaddr_sto
 
 /* function definitions */
 
-int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen) {
+// let the kernel report the number of dropped datagrams with each datagram received
+static void EnableDropCounter(int sockfd) {
+#ifdef SO_RXQ_OVFL
+    int on = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) != 0) {
+        LogError("setsockopt(SO_RXQ_OVFL) error: %s", strerror(errno));
+    }
+#endif
+}  // End of EnableDropCounter
+
+int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen, int reusePort) {
     struct addrinfo hints, *res, *ressave;
     socklen_t optlen;
     int error, p, sockfd;
@@ -107,6 +148,24 @@ int Unicast_receive_socket(const char *bindhost, const char *listenport, int fam
         if (!(sockfd < 0)) {
             // socket call was successful
 
+            // multiple sockets share the same port - the kernel distributes the datagrams by sender
+            if (reusePort) {
+#ifdef SO_REUSEPORT
+                int on = 1;
+                if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+                    LogError("setsockopt(SO_REUSEPORT) error: %s", strerror(errno));
+                    close(sockfd);
+                    freeaddrinfo(ressave);
+                    return -1;
+                }
+#else
+                LogError("SO_REUSEPORT not supported on this system");
+                close(sockfd);
+                freeaddrinfo(ressave);
+                return -1;
+#endif
+            }
+
             if (bind(sockfd, res->ai_addr, res->ai_addrlen) == 0) {
                 if (res->ai_family == AF_INET) LogInfo("Bound to IPv4 host/IP: %s, Port: %s", bindhost == NULL ? "any" : bindhost, listenport);
                 if (res->ai_family == AF_INET6) LogInfo("Bound to IPv6 host/IP: %s, Port: %s", bindhost == NULL ? "any" : bindhost, listenport);
@@ -149,11 +208,106 @@ int Unicast_receive_socket(const char *bindhost, const char *listenport, int fam
             LogInfo("System set setsockopt, SO_RCVBUF to %d bytes", p);
         }
     }
+    EnableDropCounter(sockfd);
 
     return sockfd;
 
 } /* End of Unicast_receive_socket */
 
+// listening socket for flow streams over TCP or SCTP - protocol IPPROTO_TCP or IPPROTO_SCTP
+int Stream_receive_socket(const char *bindhost, const char *listenport, int family, int protocol) {
+    if (!listenport) {
+        LogError("listen port required!");
+        return -1;
+    }
+
+    // if nothing specified on command line, prefer IPv4 over IPv6, for compatibility
+    if (bindhost == NULL && family == AF_UNSPEC) family = AF_INET;
+
+    struct addrinfo hints = {
+        .ai_flags = AI_PASSIVE,
+        .ai_family = family,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    int error = getaddrinfo(bindhost, listenport, &hints, &res);
+    if (error) {
+        LogError("getaddrinfo error: [%s]", gai_strerror(error));
+        return -1;
+    }
+
+    const char *protoName = protocol == IPPROTO_TCP ? "TCP" : "SCTP";
+    int sockfd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        // we listen only on IPv4 or IPv6
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) continue;
+
+        sockfd = socket(ai->ai_family, SOCK_STREAM, protocol);
+        if (sockfd < 0) continue;
+
+        int on = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) {
+            LogError("setsockopt(SO_REUSEADDR) error: %s", strerror(errno));
+        }
+        if (bind(sockfd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(sockfd, LISTEN_QUEUE) == 0) {
+            LogInfo("Listen on %s %s host/IP: %s, Port: %s", protoName, ai->ai_family == AF_INET ? "IPv4" : "IPv6",
+                    bindhost == NULL ? "any" : bindhost, listenport);
+            break;
+        }
+
+        close(sockfd);
+        sockfd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (sockfd < 0) {
+        LogError("%s listen socket error: could not open the requested socket: %s", protoName, strerror(errno));
+        return -1;
+    }
+
+    return sockfd;
+
+}  // End of Stream_receive_socket
+
+int Stream_send_socket(const char *hostname, const char *sendport, int family, unsigned int wmem_size) {
+    if (!hostname || !sendport) {
+        LogError("hostname and send port required!");
+        return -1;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = family,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    int error = getaddrinfo(hostname, sendport, &hints, &res);
+    if (error) {
+        LogError("getaddrinfo() error: %s", gai_strerror(error));
+        return -1;
+    }
+
+    int sockfd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sockfd < 0) continue;
+
+        if (wmem_size > 0) setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &wmem_size, sizeof(wmem_size));
+        if (connect(sockfd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+
+        close(sockfd);
+        sockfd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (sockfd < 0) {
+        LogError("connect() error: could not connect to %s port %s: %s", hostname, sendport, strerror(errno));
+        return -1;
+    }
+
+    return sockfd;
+
+}  // End of Stream_send_socket
+
 int Unicast_send_socket(const char *hostname, const char *sendport, int family, unsigned int wmem_size, struct sockaddr_storage *addr, int *addrlen) {
     struct addrinfo hints, *res, *ressave;
     int error, sockfd;
@@ -321,6 +475,8 @@ int Multicast_receive_socket(const char *hostname, const char *listenport, int f
         }
     }
 
+    EnableDropCounter(sockfd);
+
     return sockfd;
 
 } /* End of Multicast_receive_socket */
@@ -505,3 +661,142 @@ int LookupHost(char *hostname, char *port, struct sockaddr_in *addr) {
     }
     return res ? 0 : -1;
 }  // End of LookupHost
+
+recvBatch_t *NewRecvBatch(int socket, size_t buffSize) {
+    recvBatch_t *recvBatch = calloc(1, sizeof(recvBatch_t));
+    if (!recvBatch) {
+        LogError("calloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    recvBatch->socket = socket;
+    recvBatch->buffSize = buffSize;
+    for (int i = 0; i < RECV_BATCHSIZE; i++) {
+        recvBatch->buff[i] = malloc(buffSize);
+        if (!recvBatch->buff[i]) {
+            LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            FreeRecvBatch(recvBatch);
+            return NULL;
+        }
+#ifdef HAVE_RECVMMSG
+        recvBatch->iovecs[i].iov_base = recvBatch->buff[i];
+        recvBatch->iovecs[i].iov_len = buffSize;
+        recvBatch->msgs[i].msg_hdr.msg_iov = &recvBatch->iovecs[i];
+        recvBatch->msgs[i].msg_hdr.msg_iovlen = 1;
+        recvBatch->msgs[i].msg_hdr.msg_name = &recvBatch->sender[i];
+#ifdef SO_RXQ_OVFL
+        recvBatch->msgs[i].msg_hdr.msg_control = recvBatch->control[i];
+#endif
+#endif
+    }
+
+    return recvBatch;
+
+}  // End of NewRecvBatch
+
+void FreeRecvBatch(recvBatch_t *recvBatch) {
+    if (!recvBatch) return;
+
+    for (int i = 0; i < RECV_BATCHSIZE; i++) {
+        if (recvBatch->buff[i]) free(recvBatch->buff[i]);
+    }
+    free(recvBatch);
+
+}  // End of FreeRecvBatch
+
+#ifdef SO_RXQ_OVFL
+// update the drop counter from the control message of a received datagram
+static inline void UpdateDrops(recvBatch_t *recvBatch, struct msghdr *msg) {
+    if (msg->msg_controllen == 0) return;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(&recvBatch->drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+        }
+    }
+}  // End of UpdateDrops
+#endif
+
+/*
+ * returns the number of datagrams dropped by the kernel for this socket since it was
+ * opened, as reported with the last datagram received. The counter wraps at 2^32.
+ * Always 0, if the system does not support SO_RXQ_OVFL.
+ */
+uint32_t RecvBatchDrops(recvBatch_t *recvBatch) {
+    return recvBatch->drops;
+}  // End of RecvBatchDrops
+
+/*
+ * double the receive buffer of a socket, up to maxSize bytes.
+ * returns the new size of the buffer or 0, if the buffer could not be grown.
+ */
+int GrowReceiveBuffer(int sockfd, int maxSize) {
+    int size = 0;
+    socklen_t optlen = sizeof(size);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, &optlen) != 0 || size >= maxSize) return 0;
+
+    int newSize = size > maxSize / 2 ? maxSize : 2 * size;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &newSize, sizeof(newSize)) != 0) {
+        LogError("setsockopt(SO_RCVBUF,%d): %s", newSize, strerror(errno));
+        return 0;
+    }
+
+    int setSize = 0;
+    getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &setSize, &optlen);
+    return setSize > size ? setSize : 0;
+
+}  // End of GrowReceiveBuffer
+
+/*
+ * returns the next datagram of the current batch in *buff and the sender in *sender.
+ * If all datagrams of the batch are dispatched, the next batch is received from the socket.
+ * The call blocks until at least one datagram is available and returns all datagrams
+ * already queued in the socket buffer, up to RECV_BATCHSIZE.
+ * returns the size of the datagram or -1 on error with errno set
+ */
+ssize_t RecvBatchPacket(recvBatch_t *recvBatch, void **buff, struct sockaddr_storage *sender, socklen_t *senderSize) {
+    if (recvBatch->next == recvBatch->numPackets) {
+        recvBatch->next = 0;
+        recvBatch->numPackets = 0;
+#ifdef HAVE_RECVMMSG
+        for (int i = 0; i < RECV_BATCHSIZE; i++) {
+            recvBatch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+#ifdef SO_RXQ_OVFL
+            recvBatch->msgs[i].msg_hdr.msg_controllen = sizeof(recvBatch->control[i]);
+#endif
+        }
+        int ret = recvmmsg(recvBatch->socket, recvBatch->msgs, RECV_BATCHSIZE, MSG_WAITFORONE, NULL);
+        if (ret < 0) return -1;
+        for (int i = 0; i < ret; i++) {
+            recvBatch->size[i] = recvBatch->msgs[i].msg_len;
+            recvBatch->senderSize[i] = recvBatch->msgs[i].msg_hdr.msg_namelen;
+#ifdef SO_RXQ_OVFL
+            UpdateDrops(recvBatch, &recvBatch->msgs[i].msg_hdr);
+#endif
+        }
+        recvBatch->numPackets = ret;
+#else
+        struct iovec iov = {.iov_base = recvBatch->buff[0], .iov_len = recvBatch->buffSize};
+        struct msghdr msg = {.msg_name = &recvBatch->sender[0], .msg_namelen = sizeof(struct sockaddr_storage), .msg_iov = &iov, .msg_iovlen = 1};
+#ifdef SO_RXQ_OVFL
+        msg.msg_control = recvBatch->control[0];
+        msg.msg_controllen = sizeof(recvBatch->control[0]);
+#endif
+        ssize_t ret = recvmsg(recvBatch->socket, &msg, 0);
+        if (ret < 0) return -1;
+        recvBatch->senderSize[0] = msg.msg_namelen;
+#ifdef SO_RXQ_OVFL
+        UpdateDrops(recvBatch, &msg);
+#endif
+        recvBatch->size[0] = ret;
+        recvBatch->numPackets = 1;
+#endif
+    }
+
+    uint32_t i = recvBatch->next++;
+    *buff = recvBatch->buff[i];
+    memcpy((void *)sender, (void *)&recvBatch->sender[i], recvBatch->senderSize[i]);
+    *senderSize = recvBatch->senderSize[i];
+
+    return recvBatch->size[i];
+
+}  // End of RecvBatchPacket
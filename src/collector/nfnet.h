@@ -41,18 +41,26 @@
 #endif
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <stdint.h>
 #include <sys/socket.h>
 
 /* Definitions */
 
 #define UDP_PACKET_SIZE 1472
 
+// batch of received datagrams
+typedef struct recvBatch_s recvBatch_t;
+
 /* Function prototypes */
 
-int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen);
+int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen, int reusePort);
 
 int Multicast_receive_socket(const char *hostname, const char *listenport, int family, int sockbuflen);
 
+int Stream_receive_socket(const char *bindhost, const char *listenport, int family, int protocol);
+
+int Stream_send_socket(const char *hostname, const char *sendport, int family, unsigned int wmem_size);
+
 int Unicast_send_socket(const char *hostname, const char *listenport, int family, unsigned int wmem_size, struct sockaddr_storage *addr,
                         int *addrlen);
 
@@ -63,4 +71,14 @@ int Raw_send_socket(int sockbuflen);
 
 int LookupHost(char *hostname, char *port, struct sockaddr_in *addr);
 
+recvBatch_t *NewRecvBatch(int socket, size_t buffSize);
+
+void FreeRecvBatch(recvBatch_t *recvBatch);
+
+ssize_t RecvBatchPacket(recvBatch_t *recvBatch, void **buff, struct sockaddr_storage *sender, socklen_t *senderSize);
+
+uint32_t RecvBatchDrops(recvBatch_t *recvBatch);
+
+int GrowReceiveBuffer(int sockfd, int maxSize);
+
 #endif  //_NFNET_H
@@ -35,6 +35,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -504,6 +505,337 @@ int ReleaseStatInfo(dirstat_t *dirstat) {
 
 }  // End of ReleaseStatInfo
 
+int FileIndexExists(char *dirname) {
+    char path[MAXPATHLEN];
+    struct stat fstat;
+
+    snprintf(path, MAXPATHLEN, "%s/%s", dirname, index_filename);
+    path[MAXPATHLEN - 1] = '\0';
+    return stat(path, &fstat) == 0;
+
+}  // End of FileIndexExists
+
+static fileIndex_t *NewFileIndex(char *dirname, char *filename, int fd) {
+    fileIndex_t *fileIndex = calloc(1, sizeof(fileIndex_t));
+    if (!fileIndex) {
+        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    fileIndex->buffer = malloc(FILEINDEXBUFFER * sizeof(fileIndexEntry_t));
+    fileIndex->dirname = strdup(dirname);
+    fileIndex->filename = strdup(filename);
+    if (!fileIndex->buffer || !fileIndex->dirname || !fileIndex->filename) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        free(fileIndex->buffer);
+        free(fileIndex->dirname);
+        free(fileIndex->filename);
+        free(fileIndex);
+        return NULL;
+    }
+    fileIndex->fd = fd;
+
+    return fileIndex;
+
+}  // End of NewFileIndex
+
+static void FreeFileIndex(fileIndex_t *fileIndex) {
+    free(fileIndex->buffer);
+    free(fileIndex->dirname);
+    free(fileIndex->filename);
+    free(fileIndex);
+
+}  // End of FreeFileIndex
+
+static int WriteIndexEntries(int fd, fileIndexEntry_t *entries, uint32_t count) {
+    char *p = (char *)entries;
+    size_t len = count * sizeof(fileIndexEntry_t);
+
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LogError("write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            return ERR_FAIL;
+        }
+        p += ret;
+        len -= ret;
+    }
+
+    return STATFILE_OK;
+
+}  // End of WriteIndexEntries
+
+// create a new index, which replaces the current one with CommitFileIndex()
+fileIndex_t *CreateFileIndex(char *dirname) {
+    char path[MAXPATHLEN];
+
+    snprintf(path, MAXPATHLEN, "%s/%s.tmp", dirname, index_filename);
+    path[MAXPATHLEN - 1] = '\0';
+
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        LogError("open() error for %s in %s line %d: %s\n", path, __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    fileIndexHeader_t header = {.magic = FILEINDEXMAGIC, .version = FILEINDEXVERSION, .head = 0};
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        LogError("write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    fileIndex_t *fileIndex = NewFileIndex(dirname, path, fd);
+    if (!fileIndex) {
+        close(fd);
+        unlink(path);
+    }
+
+    return fileIndex;
+
+}  // End of CreateFileIndex
+
+int AddFileIndex(fileIndex_t *fileIndex, char *path, uint64_t size) {
+    if (strlen(path) >= sizeof(fileIndex->buffer->path)) {
+        LogError("AddFileIndex() path too long: %s\n", path);
+        return ERR_FAIL;
+    }
+
+    fileIndexEntry_t *entry = &fileIndex->buffer[fileIndex->bufferCount++];
+    memset((void *)entry, 0, sizeof(fileIndexEntry_t));
+    entry->size = size;
+    strcpy(entry->path, path);
+    fileIndex->numEntries++;
+
+    if (fileIndex->bufferCount == FILEINDEXBUFFER) {
+        fileIndex->bufferCount = 0;
+        return WriteIndexEntries(fileIndex->fd, fileIndex->buffer, FILEINDEXBUFFER);
+    }
+
+    return STATFILE_OK;
+
+}  // End of AddFileIndex
+
+// flush and rename the new index to its final name, if commit is set, otherwise discard it
+int CommitFileIndex(fileIndex_t *fileIndex, int commit) {
+    char path[MAXPATHLEN];
+    int ret = STATFILE_OK;
+
+    if (commit && fileIndex->bufferCount) ret = WriteIndexEntries(fileIndex->fd, fileIndex->buffer, fileIndex->bufferCount);
+    close(fileIndex->fd);
+
+    if (!commit || ret != STATFILE_OK) {
+        unlink(fileIndex->filename);
+        FreeFileIndex(fileIndex);
+        return commit ? ERR_FAIL : STATFILE_OK;
+    }
+
+    snprintf(path, MAXPATHLEN, "%s/%s", fileIndex->dirname, index_filename);
+    path[MAXPATHLEN - 1] = '\0';
+
+    // hold the lock of the current index, while it gets replaced
+    // a collector, waiting for the lock, reopens the new index
+    int fd = open(path, O_RDWR);
+    if (fd >= 0 && SetFileLock(fd) != 0) {
+        LogError("ioctl(F_WRLCK) error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+    }
+    if (rename(fileIndex->filename, path) != 0) {
+        LogError("rename() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        unlink(fileIndex->filename);
+        ret = ERR_FAIL;
+    }
+    if (fd >= 0) {
+        ReleaseFileLock(fd);
+        close(fd);
+    }
+
+    FreeFileIndex(fileIndex);
+    return ret;
+
+}  // End of CommitFileIndex
+
+fileIndex_t *OpenFileIndex(char *dirname) {
+    char path[MAXPATHLEN];
+    struct stat fstat_buf;
+    fileIndexHeader_t header;
+
+    snprintf(path, MAXPATHLEN, "%s/%s", dirname, index_filename);
+    path[MAXPATHLEN - 1] = '\0';
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        if (errno != ENOENT) LogError("open() error for %s in %s line %d: %s\n", path, __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || header.magic != FILEINDEXMAGIC || header.version != FILEINDEXVERSION ||
+        fstat(fd, &fstat_buf) != 0) {
+        LogError("Invalid file index %s - ignored\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    uint64_t numEntries = (fstat_buf.st_size - sizeof(header)) / sizeof(fileIndexEntry_t);
+    if (header.head > numEntries) {
+        LogError("Corrupt file index %s - ignored\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    fileIndex_t *fileIndex = NewFileIndex(dirname, path, fd);
+    if (!fileIndex) {
+        close(fd);
+        return NULL;
+    }
+    fileIndex->head = header.head;
+    fileIndex->numEntries = numEntries;
+
+    return fileIndex;
+
+}  // End of OpenFileIndex
+
+// return the oldest entry of the index, or NULL if no more entries are available
+fileIndexEntry_t *NextFileIndex(fileIndex_t *fileIndex) {
+    if (fileIndex->head >= fileIndex->numEntries) {
+        // collectors may have appended new files meanwhile
+        struct stat fstat_buf;
+        if (fstat(fileIndex->fd, &fstat_buf) != 0) return NULL;
+        fileIndex->numEntries = (fstat_buf.st_size - sizeof(fileIndexHeader_t)) / sizeof(fileIndexEntry_t);
+        if (fileIndex->head >= fileIndex->numEntries) return NULL;
+    }
+
+    if (fileIndex->head < fileIndex->bufferStart || fileIndex->head >= (fileIndex->bufferStart + fileIndex->bufferCount)) {
+        off_t offset = sizeof(fileIndexHeader_t) + fileIndex->head * sizeof(fileIndexEntry_t);
+        ssize_t ret = pread(fileIndex->fd, fileIndex->buffer, FILEINDEXBUFFER * sizeof(fileIndexEntry_t), offset);
+        if (ret < (ssize_t)sizeof(fileIndexEntry_t)) {
+            if (ret < 0) LogError("pread() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            fileIndex->bufferCount = 0;
+            return NULL;
+        }
+        fileIndex->bufferStart = fileIndex->head;
+        fileIndex->bufferCount = ret / sizeof(fileIndexEntry_t);
+    }
+
+    fileIndexEntry_t *entry = &fileIndex->buffer[fileIndex->head - fileIndex->bufferStart];
+    entry->path[sizeof(entry->path) - 1] = '\0';
+    return entry;
+
+}  // End of NextFileIndex
+
+void PopFileIndex(fileIndex_t *fileIndex) { fileIndex->head++; }  // End of PopFileIndex
+
+// rewrite the index without the expired entries
+static void CompactFileIndex(fileIndex_t *fileIndex) {
+    char path[MAXPATHLEN];
+    struct stat fstat_buf;
+
+    // block collectors while compacting
+    if (SetFileLock(fileIndex->fd) != 0) {
+        LogError("ioctl(F_WRLCK) error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+    if (fstat(fileIndex->fd, &fstat_buf) != 0) {
+        ReleaseFileLock(fileIndex->fd);
+        return;
+    }
+    fileIndex->numEntries = (fstat_buf.st_size - sizeof(fileIndexHeader_t)) / sizeof(fileIndexEntry_t);
+
+    snprintf(path, MAXPATHLEN, "%s/%s.tmp", fileIndex->dirname, index_filename);
+    path[MAXPATHLEN - 1] = '\0';
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        LogError("open() error for %s in %s line %d: %s\n", path, __FILE__, __LINE__, strerror(errno));
+        ReleaseFileLock(fileIndex->fd);
+        return;
+    }
+
+    fileIndexHeader_t header = {.magic = FILEINDEXMAGIC, .version = FILEINDEXVERSION, .head = 0};
+    int ret = write(fd, &header, sizeof(header)) == sizeof(header) ? STATFILE_OK : ERR_FAIL;
+    uint64_t index = fileIndex->head;
+    while (ret == STATFILE_OK && index < fileIndex->numEntries) {
+        off_t offset = sizeof(fileIndexHeader_t) + index * sizeof(fileIndexEntry_t);
+        ssize_t len = pread(fileIndex->fd, fileIndex->buffer, FILEINDEXBUFFER * sizeof(fileIndexEntry_t), offset);
+        uint32_t count = len > 0 ? len / sizeof(fileIndexEntry_t) : 0;
+        if (count == 0) break;
+        ret = WriteIndexEntries(fd, fileIndex->buffer, count);
+        index += count;
+    }
+    close(fd);
+
+    if (ret == STATFILE_OK && rename(path, fileIndex->filename) == 0) {
+        dbg_printf("Compacted file index: %llu entries removed\n", (unsigned long long)fileIndex->head);
+    } else {
+        LogError("Failed to compact file index %s\n", fileIndex->filename);
+        unlink(path);
+    }
+    fileIndex->bufferCount = 0;
+    ReleaseFileLock(fileIndex->fd);
+
+}  // End of CompactFileIndex
+
+void CloseFileIndex(fileIndex_t *fileIndex) {
+    if (pwrite(fileIndex->fd, &fileIndex->head, sizeof(uint64_t), offsetof(fileIndexHeader_t, head)) != sizeof(uint64_t)) {
+        LogError("pwrite() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+    } else if (fileIndex->head >= FILEINDEXBUFFER && fileIndex->head > (fileIndex->numEntries >> 1)) {
+        CompactFileIndex(fileIndex);
+    }
+
+    close(fileIndex->fd);
+    FreeFileIndex(fileIndex);
+
+}  // End of CloseFileIndex
+
+// append a new file to the index of dirname. filename is the full path of the file
+// Nothing is done, if the directory has no index
+int AppendFileIndex(char *dirname, char *filename, uint64_t size) {
+    char path[MAXPATHLEN];
+    fileIndexEntry_t entry;
+
+    size_t len = strlen(dirname);
+    char *relative = strncmp(filename, dirname, len) == 0 ? filename + len : filename;
+    while (*relative == '/') relative++;
+    if (strlen(relative) >= sizeof(entry.path)) {
+        LogError("AppendFileIndex() path too long: %s\n", relative);
+        return ERR_FAIL;
+    }
+    memset((void *)&entry, 0, sizeof(entry));
+    entry.size = size;
+    strcpy(entry.path, relative);
+
+    snprintf(path, MAXPATHLEN, "%s/%s", dirname, index_filename);
+    path[MAXPATHLEN - 1] = '\0';
+
+    // the index may get replaced by a rebuild or compaction, while waiting for the lock
+    for (int retry = 0; retry < 3; retry++) {
+        struct stat fstat_buf;
+        int fd = open(path, O_WRONLY | O_APPEND);
+        if (fd < 0) {
+            if (errno == ENOENT) return ERR_NOSTATFILE;
+            LogError("open() error for %s in %s line %d: %s\n", path, __FILE__, __LINE__, strerror(errno));
+            return ERR_FAIL;
+        }
+        if (SetFileLock(fd) != 0) {
+            LogError("ioctl(F_WRLCK) error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            close(fd);
+            return ERR_FAIL;
+        }
+        if (fstat(fd, &fstat_buf) == 0 && fstat_buf.st_nlink == 0) {
+            // replaced meanwhile
+            close(fd);
+            continue;
+        }
+        int ret = WriteIndexEntries(fd, &entry, 1);
+        ReleaseFileLock(fd);
+        close(fd);
+        return ret;
+    }
+
+    LogError("AppendFileIndex() failed to lock index %s\n", path);
+    return ERR_FAIL;
+
+}  // End of AppendFileIndex
+
 void PrintDirStat(dirstat_t *dirstat) {
     struct tm *ts;
     time_t t;
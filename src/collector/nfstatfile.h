@@ -67,6 +67,47 @@ enum { STATFILE_OK = 0, ERR_FAIL, ERR_NOSTATFILE, FORCE_REBUILD };
 
 #define stat_filename ".nfstat"
 
+/*
+ * File index - an append only list of all nfcapd files of a data directory
+ * in chronological order. Collectors append each new file at rotation time,
+ * expire removes files from the head of the list, so no directory scan is
+ * required to find the oldest files. The index is created by RescanDir().
+ *
+ *   +--------------------+---------+---------+-----+
+ *   | fileIndexHeader_t  | entry 0 | entry 1 | ... |
+ *   +--------------------+---------+---------+-----+
+ *
+ * head counts the already expired entries at the beginning of the index.
+ */
+#define index_filename ".nfindex"
+
+#define FILEINDEXMAGIC 0x4E464958
+#define FILEINDEXVERSION 1
+
+typedef struct fileIndexHeader_s {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t head;  // number of expired entries
+} fileIndexHeader_t;
+
+typedef struct fileIndexEntry_s {
+    uint64_t size;   // disk usage of the file in bytes
+    char path[120];  // file path relative to the data directory
+} fileIndexEntry_t;
+
+#define FILEINDEXBUFFER 1024
+
+typedef struct fileIndex_s {
+    int fd;
+    char *dirname;
+    char *filename;
+    uint64_t head;
+    uint64_t numEntries;
+    uint64_t bufferStart;
+    uint32_t bufferCount;
+    fileIndexEntry_t *buffer;
+} fileIndex_t;
+
 char *ScaleValue(uint64_t v);
 
 char *ScaleTime(uint64_t v);
@@ -79,4 +120,22 @@ int WriteStatInfo(dirstat_t *dirstat);
 
 int ReleaseStatInfo(dirstat_t *dirstat);
 
+int FileIndexExists(char *dirname);
+
+fileIndex_t *CreateFileIndex(char *dirname);
+
+int AddFileIndex(fileIndex_t *fileIndex, char *path, uint64_t size);
+
+int CommitFileIndex(fileIndex_t *fileIndex, int commit);
+
+fileIndex_t *OpenFileIndex(char *dirname);
+
+fileIndexEntry_t *NextFileIndex(fileIndex_t *fileIndex);
+
+void PopFileIndex(fileIndex_t *fileIndex);
+
+void CloseFileIndex(fileIndex_t *fileIndex);
+
+int AppendFileIndex(char *dirname, char *filename, uint64_t size);
+
 #endif  //_NFSTATFILE_H
@@ -133,6 +133,44 @@ message_t *getMessage(messageQueue_t *messageQueue) {
 
 }  // End of getMessage
 
+// same as getMessage, but returns NULL, if no message arrived within msec
+message_t *getMessageTimed(messageQueue_t *messageQueue, uint32_t msec) {
+    struct timespec abstime;
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    uint64_t nsec = (uint64_t)now.tv_usec * 1000LL + (uint64_t)(msec % 1000) * 1000000LL;
+    abstime.tv_sec = now.tv_sec + msec / 1000 + nsec / 1000000000LL;
+    abstime.tv_nsec = nsec % 1000000000LL;
+
+    pthread_mutex_lock(&(messageQueue->mutex));
+    while (messageQueue->head == NULL && done == 0) {
+        // messageQ ist empty
+        if (pthread_cond_timedwait(&(messageQueue->cond), &(messageQueue->mutex), &abstime) == ETIMEDOUT) break;
+    }
+
+    if (done) {
+        pthread_mutex_unlock(&(messageQueue->mutex));
+        return (message_t *)-1;
+    }
+
+    messageList_t *listElement = messageQueue->head;
+    if (listElement == NULL) {
+        pthread_mutex_unlock(&(messageQueue->mutex));
+        return NULL;
+    }
+    message_t *message = listElement->message;
+
+    messageQueue->head = listElement->next;
+    messageQueue->length--;
+    if (messageQueue->head == NULL) messageQueue->tail = NULL;
+    pthread_mutex_unlock(&(messageQueue->mutex));
+
+    free(listElement);
+    return message;
+
+}  // End of getMessageTimed
+
 void pushMessageFunc(message_t *message, void *extraArg) {
     // simple wrapper for pushMessage
     pushMessage((messageQueue_t *)extraArg, message);
@@ -170,31 +208,21 @@ __attribute__((noreturn)) void *pipeReader(void *arg) {
                 // check for full message header
                 if (nbytes < sizeof(message_t)) {
                     dbg_printf("Short read: available: %zu\n", nbytes);
-                    // shift the partly message header at the beginning of the buffer and continue reading data
-                    if ((void *)buffer != p) memmove(buffer, p, nbytes);
-                    bufferOffset = nbytes;
-                    p = eod;
-                    continue;
-                    // short read
+                    break;
                 }
 
                 // check for valid message length
                 message_t *message = (message_t *)p;
                 if (message->length == 0) {
                     LogError("Zero size pipe message: flush all data: %zu", nbytes);
-                    p = eod;
-                    continue;
+                    nbytes = 0;
+                    break;
                 }
 
                 // check for enough message data
                 if (nbytes < message->length) {
                     dbg_printf("Short read: message size: %u, available: %zu\n", message->length, nbytes);
-                    // shift the partly message at the beginning of the buffer and continue reading data
-                    if ((void *)buffer != p) memmove(buffer, p, nbytes);
-                    bufferOffset = nbytes;
-                    p = eod;
-                    continue;
-                    // short read
+                    break;
                 }
 
                 dbg_printf("%d, Message type: %d, length: %u\n", mcnt, message->type, message->length);
@@ -204,6 +232,7 @@ __attribute__((noreturn)) void *pipeReader(void *arg) {
                         break;
                     case PRIVMSG_LAUNCH:
                     case PRIVMSG_REPEAT:
+                    case PRIVMSG_RING:
                         thread_arg->messageFunc(message, thread_arg->extraArg);
                         break;
                     case PRIVMSG_EXIT:
@@ -220,6 +249,16 @@ __attribute__((noreturn)) void *pipeReader(void *arg) {
                 nbytes -= message->length;
                 p += message->length;
             }
+
+            // messages may still reference the buffer - flush them, before
+            // the buffer gets modified
+            if (thread_arg->flushFunc) thread_arg->flushFunc(thread_arg->extraArg);
+
+            if (nbytes > 0) {
+                // shift the partly message at the beginning of the buffer and continue reading data
+                if ((void *)buffer != p) memmove(buffer, p, nbytes);
+                bufferOffset = nbytes;
+            }
         } else {
             bufferOffset = 0;
             if (nbytes == 0) {
@@ -238,6 +277,11 @@ __attribute__((noreturn)) void *pipeReader(void *arg) {
 }  // End of pipereader
 
 int PrivsepFork(int argc, char **argv, pid_t *child_pid, char *privname) {
+    return PrivsepForkShared(argc, argv, child_pid, privname, -1, -1);
+}  // End of PrivsepFork
+
+// same as PrivsepFork, but passes sharedFD on to the child as childFD
+int PrivsepForkShared(int argc, char **argv, pid_t *child_pid, char *privname, int sharedFD, int childFD) {
     *child_pid = 0;
 
     int pfd[2] = {0};
@@ -257,6 +301,10 @@ int PrivsepFork(int argc, char **argv, pid_t *child_pid, char *privname) {
         close(pfd[1]);
         close(0);
         dup(pfd[0]);
+        if (sharedFD >= 0 && dup2(sharedFD, childFD) < 0) {
+            LogError("PrivsepFork: dup2() error: %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            _exit(255);
+        }
         int i;
         char **privargv = (char **)calloc(argc + 3, sizeof(char *));
         if (!privargv) {
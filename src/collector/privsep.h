@@ -56,13 +56,18 @@ typedef struct messageQueue_s {
 #define PRIVMSG_NULL 0
 #define PRIVMSG_LAUNCH 1
 #define PRIVMSG_REPEAT 2
+// wakeup - new packets in the shared memory ring
+#define PRIVMSG_RING 3
 #define PRIVMSG_EXIT 0xFFFF
 #define PRIVMSG_FLUSH 0xFFFE
 
 typedef void (*messageFunc_t)(message_t *, void *);
+typedef void (*flushFunc_t)(void *);
 
 typedef struct thread_arg_s {
     messageFunc_t messageFunc;
+    // optional - called after all complete messages of a pipe read are processed
+    flushFunc_t flushFunc;
     void *extraArg;
 } thread_arg_t;
 
@@ -76,6 +81,10 @@ void pushMessageFunc(message_t *message, void *extraArg);
 
 message_t *getMessage(messageQueue_t *messageQueue);
 
+message_t *getMessageTimed(messageQueue_t *messageQueue, uint32_t msec);
+
 int PrivsepFork(int argc, char **argv, pid_t *child_pid, char *privname);
 
+int PrivsepForkShared(int argc, char **argv, pid_t *child_pid, char *privname, int sharedFD, int childFD);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,806 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "profiler.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_LIBRRD
+#include <rrd.h>
+#endif
+
+#include "barrier.h"
+#include "conf/nfconf.h"
+#include "filter/filter.h"
+#include "flist.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfstatfile.h"
+#include "nfxV3.h"
+#include "util.h"
+
+#if HAVE_RRDVERSION > 8
+#define rrdchar const char
+#else
+#define rrdchar char
+#endif
+
+// default number of profile workers
+#define PROFILEWORKERS 4
+
+// a profile channel as defined in the channel file
+typedef struct profileChannel_s {
+    void *engine;
+    char *group;
+    char *profile;
+    char *channel;
+    int type;  // NfSen profile type - 4: shadow profile, 8: alert
+    char *channelDir;
+    char *rrdFile;
+} profileChannel_t;
+
+struct profileConfig_s;
+struct profileBlock_s;
+
+// each worker filters its subset of the channels with one filter set.
+// The block list is unbounded, as the tap must not block the writers of the
+// collector files - the channel files may be written by the same writer pool
+typedef struct profileWorker_s {
+    pthread_t tid;
+    uint32_t self;
+    struct profileConfig_s *config;
+    void *filterSet;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct profileBlock_s *head;
+    struct profileBlock_s *tail;
+    int closed;
+} profileWorker_t;
+
+// channels and workers of a loaded channel file. Shared by the slots, which
+// were started with it
+typedef struct profileConfig_s {
+    uint32_t numChannels;
+    profileChannel_t *channel;
+    uint32_t numWorkers;
+    profileWorker_t *worker;
+    uint32_t refCnt;  // current config and slots using it - guarded by profiler.mutex
+} profileConfig_t;
+
+// output of a channel in a time slot. Only accessed by the worker of the channel
+// until the slot is finalized
+typedef struct channelOutput_s {
+    nffile_t *nffile;
+    dataBlock_t *dataBlock;
+    char *ofile;
+    stat_record_t stat_record;
+} channelOutput_t;
+
+struct profileSlot_s;
+
+// a collector file attached to a slot
+typedef struct profileFile_s {
+    struct profileFile_s *next;
+    struct profileSlot_s *slot;
+    char *ident;
+} profileFile_t;
+
+// channel outputs of all collector files of a time slot
+typedef struct profileSlot_s {
+    profileConfig_t *config;
+    channelOutput_t *output;
+    uint32_t seq;
+    uint32_t numFiles;        // attached files not yet done - guarded by profiler.mutex
+    profileFile_t *fileList;  // guarded by profiler.mutex
+    time_t t_start;
+    char *fileName;  // collector file name relative to its datadir: [subdir/]nfcapd.<time>
+
+    pthread_mutex_t syncMutex;
+    pthread_cond_t syncCond;
+    uint32_t syncPending;  // workers, which did not yet reach the sync marker
+} profileSlot_t;
+
+// a data block shared by all workers - the last worker frees it.
+// A block without dataBlock is the sync marker of its slot
+typedef struct profileBlock_s {
+    dataBlock_t *dataBlock;
+    profileFile_t *file;
+    profileSlot_t *slot;
+    _Atomic uint32_t refCnt;
+    struct profileBlock_s *next[];  // block list of each worker
+} profileBlock_t;
+
+static struct profiler_s {
+    char *channelFile;  // NULL: profiler disabled
+    char *datadir;
+    char *statdir;
+    char *filterFile;
+    int compress;
+    uint32_t numWorkers;
+
+    pthread_mutex_t mutex;
+    time_t mtime;              // of the loaded channel file
+    profileConfig_t *config;   // current config
+    profileSlot_t *slot;       // current slot - new files are attached to it
+    uint32_t slotSeq;
+} profiler = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+#include "nfdump_inline.c"
+#include "nffile_inline.c"
+
+// append a block to the block list of a worker
+static void PushBlock(profileWorker_t *worker, profileBlock_t *profileBlock) {
+    pthread_mutex_lock(&worker->mutex);
+    profileBlock->next[worker->self] = NULL;
+    if (worker->tail)
+        worker->tail->next[worker->self] = profileBlock;
+    else
+        worker->head = profileBlock;
+    worker->tail = profileBlock;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+}  // End of PushBlock
+
+// take the next block of a worker - returns NULL, if the list is closed and empty
+static profileBlock_t *PopBlock(profileWorker_t *worker) {
+    pthread_mutex_lock(&worker->mutex);
+    while (worker->head == NULL && !worker->closed) pthread_cond_wait(&worker->cond, &worker->mutex);
+    profileBlock_t *profileBlock = worker->head;
+    if (profileBlock) {
+        worker->head = profileBlock->next[worker->self];
+        if (worker->head == NULL) worker->tail = NULL;
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return profileBlock;
+}  // End of PopBlock
+
+// allocate a block for all workers of config
+static profileBlock_t *NewProfileBlock(profileConfig_t *config) {
+    profileBlock_t *profileBlock = calloc(1, sizeof(profileBlock_t) + config->numWorkers * sizeof(profileBlock_t *));
+    if (!profileBlock) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    atomic_init(&profileBlock->refCnt, config->numWorkers);
+    return profileBlock;
+}  // End of NewProfileBlock
+
+// compile the filter of a channel: '(ident src1 or ident src2) and (filter)' or '(filter)'
+static void *CompileChannelFilter(char *path, char *sourceList) {
+    if (TestPath(path, S_IFREG) != PATH_OK) {
+        LogError("No profile filter found: %s", path);
+        return NULL;
+    }
+    char *filterText = ReadFilter(path);
+
+    size_t len = strlen(filterText) + (sourceList ? 2 * strlen(sourceList) + 32 : 0) + 8;
+    char *filter = malloc(len);
+    if (!filter) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(filterText);
+        return NULL;
+    }
+
+    filter[0] = '\0';
+    if (sourceList) {
+        // sourceList: source1|source2|source3
+        char *list = strdup(sourceList);
+        strcat(filter, "(");
+        char *source = strtok(list, "|");
+        while (source) {
+            strcat(filter, "ident ");
+            strcat(filter, source);
+            source = strtok(NULL, "|");
+            if (source) strcat(filter, " or ");
+        }
+        strcat(filter, ") and ");
+        free(list);
+    }
+    strcat(filter, "(");
+    strcat(filter, filterText);
+    strcat(filter, ")");
+    free(filterText);
+
+    void *engine = CompileFilter(filter);
+    if (!engine) LogError("Failed to compile profile filter %s: %s", path, filter);
+    free(filter);
+    return engine;
+
+}  // End of CompileChannelFilter
+
+/*
+ * parse a channel line in the format of nfprofile -I:
+ * <profilegroup>#<profilename>#<profiletype>#<channelname>#<channel_sourcelist>
+ */
+static int ParseChannel(char *line, profileChannel_t *channel) {
+    char *field[5] = {0};
+    int numFields = 0;
+    char *s = line;
+    while (numFields < 5) {
+        field[numFields++] = s;
+        s = strchr(s, '#');
+        if (!s) break;
+        *s++ = '\0';
+    }
+    if (numFields < 4 || strlen(field[0]) == 0 || strlen(field[1]) == 0 || strlen(field[3]) == 0) {
+        LogError("Incomplete profile channel line - channel skipped");
+        return 0;
+    }
+    for (char *p = field[2]; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            LogError("Not a valid profile type: %s - channel skipped", field[2]);
+            return 0;
+        }
+    }
+
+    // source list: skip empty names. '*' is any source
+    char *sourceList = NULL;
+    if (numFields == 5) {
+        char *q = field[4];
+        while (*q == '|') q++;
+        size_t len = strlen(q);
+        while (len && q[len - 1] == '|') q[--len] = '\0';
+        if (len && strcmp(q, "*") != 0) {
+            sourceList = q;
+            char *d = q;
+            for (char *p = q; *p; p++) {
+                if (p[0] == '|' && p[1] == '|') continue;
+                *d++ = *p;
+            }
+            *d = '\0';
+        }
+    }
+
+    char path[MAXPATHLEN];
+    snprintf(path, MAXPATHLEN, "%s/%s/%s/%s", profiler.datadir, field[0], field[1], field[3]);
+    if (TestPath(path, S_IFDIR) != PATH_OK) {
+        LogError("Channel '%s' in profile '%s' not found - channel skipped", field[3], field[1]);
+        return 0;
+    }
+    channel->channelDir = strdup(path);
+
+    snprintf(path, MAXPATHLEN, "%s/%s/%s/%s-%s", profiler.statdir, field[0], field[1], field[3], profiler.filterFile);
+    channel->engine = CompileChannelFilter(path, sourceList);
+    if (!channel->engine) {
+        free(channel->channelDir);
+        return 0;
+    }
+
+    snprintf(path, MAXPATHLEN, "%s/%s/%s/%s.rrd", profiler.statdir, field[0], field[1], field[3]);
+    channel->rrdFile = strdup(path);
+    channel->group = strdup(field[0]);
+    channel->profile = strdup(field[1]);
+    channel->channel = strdup(field[3]);
+    channel->type = atoi(field[2]);
+    return 1;
+
+}  // End of ParseChannel
+
+static void *profileWorker(void *arg);
+
+// load the channel file and start the workers of its channels
+static profileConfig_t *LoadConfig(void) {
+    FILE *fp = fopen(profiler.channelFile, "r");
+    if (!fp) {
+        LogError("fopen() error '%s': %s", profiler.channelFile, strerror(errno));
+        return NULL;
+    }
+
+    profileConfig_t *config = calloc(1, sizeof(profileConfig_t));
+    if (!config) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        fclose(fp);
+        return NULL;
+    }
+
+    char line[1024];
+    uint32_t maxChannels = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p = strchr(line, '\n');
+        if (p) *p = '\0';
+        if (line[0] == '\0' || line[0] == ';') continue;
+
+        if (config->numChannels == maxChannels) {
+            maxChannels += 64;
+            profileChannel_t *channel = realloc(config->channel, maxChannels * sizeof(profileChannel_t));
+            if (!channel) {
+                LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                break;
+            }
+            config->channel = channel;
+        }
+        memset((void *)&config->channel[config->numChannels], 0, sizeof(profileChannel_t));
+        if (ParseChannel(line, &config->channel[config->numChannels])) config->numChannels++;
+    }
+    fclose(fp);
+    LogInfo("Profiler: %u channels loaded from %s", config->numChannels, profiler.channelFile);
+
+    // no worker without channels
+    config->numWorkers = profiler.numWorkers < config->numChannels ? profiler.numWorkers : config->numChannels;
+    if (config->numWorkers) {
+        config->worker = calloc(config->numWorkers, sizeof(profileWorker_t));
+        void **engines = malloc((config->numChannels / config->numWorkers + 1) * sizeof(void *));
+        if (!config->worker || !engines) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        for (uint32_t i = 0; i < config->numWorkers; i++) {
+            profileWorker_t *worker = &config->worker[i];
+            worker->self = i;
+            worker->config = config;
+            pthread_mutex_init(&worker->mutex, NULL);
+            pthread_cond_init(&worker->cond, NULL);
+
+            // merge the filters of all channels of this worker
+            uint32_t numFilters = 0;
+            for (uint32_t j = i; j < config->numChannels; j += config->numWorkers) engines[numFilters++] = config->channel[j].engine;
+            worker->filterSet = CompileFilterSet(engines, numFilters);
+
+            int err = pthread_create(&worker->tid, NULL, profileWorker, (void *)worker);
+            if (err) {
+                LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+                exit(EXIT_FAILURE);
+            }
+        }
+        free(engines);
+    }
+    config->refCnt = 1;
+
+    return config;
+
+}  // End of LoadConfig
+
+// drop a reference of a config - the last one stops its workers. Called with profiler.mutex locked
+static void ReleaseConfig(profileConfig_t *config) {
+    if (--config->refCnt) return;
+
+    for (uint32_t i = 0; i < config->numWorkers; i++) {
+        profileWorker_t *worker = &config->worker[i];
+        pthread_mutex_lock(&worker->mutex);
+        worker->closed = 1;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+        pthread_join(worker->tid, NULL);
+        pthread_mutex_destroy(&worker->mutex);
+        pthread_cond_destroy(&worker->cond);
+        DisposeFilterSet(worker->filterSet);
+    }
+    for (uint32_t j = 0; j < config->numChannels; j++) {
+        profileChannel_t *channel = &config->channel[j];
+        DisposeFilter(channel->engine);
+        free(channel->group);
+        free(channel->profile);
+        free(channel->channel);
+        free(channel->channelDir);
+        free(channel->rrdFile);
+    }
+    free(config->channel);
+    free(config->worker);
+    free(config);
+
+}  // End of ReleaseConfig
+
+// start a new slot with the current config. The channel file is reloaded, if it changed.
+// Called with profiler.mutex locked
+static profileSlot_t *NewSlot(void) {
+    struct stat stat_buf;
+    if (stat(profiler.channelFile, &stat_buf) == 0 && stat_buf.st_mtime != profiler.mtime) {
+        profileConfig_t *config = LoadConfig();
+        if (config) {
+            if (profiler.config) ReleaseConfig(profiler.config);
+            profiler.config = config;
+            profiler.mtime = stat_buf.st_mtime;
+        }
+    }
+    if (!profiler.config || profiler.config->numChannels == 0) return NULL;
+
+    profileSlot_t *slot = calloc(1, sizeof(profileSlot_t));
+    if (!slot) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    slot->output = calloc(profiler.config->numChannels, sizeof(channelOutput_t));
+    if (!slot->output) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(slot);
+        return NULL;
+    }
+    for (uint32_t j = 0; j < profiler.config->numChannels; j++) {
+        slot->output[j].stat_record.firstseen = 0x7fffffffffffffffLL;
+        slot->output[j].stat_record.lastseen = 0;
+    }
+    slot->config = profiler.config;
+    slot->config->refCnt++;
+    slot->seq = profiler.slotSeq++;
+    pthread_mutex_init(&slot->syncMutex, NULL);
+    pthread_cond_init(&slot->syncCond, NULL);
+
+    return slot;
+
+}  // End of NewSlot
+
+// open the temporary output file of a channel, while profiling
+static void OpenOutput(profileSlot_t *slot, uint32_t j) {
+    profileChannel_t *channel = &slot->config->channel[j];
+    channelOutput_t *output = &slot->output[j];
+
+    char path[MAXPATHLEN];
+    snprintf(path, MAXPATHLEN, "%s/nfprofile.%d.%u", channel->channelDir, (int)getpid(), slot->seq);
+    output->ofile = strdup(path);
+    output->nffile = OpenNewFile(path, NULL, CREATOR_NFPROFILE, profiler.compress, NOT_ENCRYPTED);
+    if (!output->nffile) return;
+    SetIdent(output->nffile, channel->channel);
+    output->dataBlock = WriteBlock(output->nffile, NULL);
+
+}  // End of OpenOutput
+
+static void *profileWorker(void *arg) {
+    profileWorker_t *worker = (profileWorker_t *)arg;
+    profileConfig_t *config = worker->config;
+    uint32_t self = worker->self;
+    uint32_t numWorkers = config->numWorkers;
+    uint32_t numChannels = config->numChannels;
+    profileFile_t *file = NULL;
+
+    recordHandle_t *recordHandle = calloc(1, sizeof(recordHandle_t));
+    // match bitmap of the channel filters of this worker
+    uint64_t *channelMatch = calloc((numChannels / numWorkers + 64) >> 6, sizeof(uint64_t));
+    if (!recordHandle || !channelMatch) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    profileBlock_t *profileBlock;
+    while ((profileBlock = PopBlock(worker)) != NULL) {
+        dataBlock_t *dataBlock = profileBlock->dataBlock;
+        profileSlot_t *slot = profileBlock->slot;
+
+        if (dataBlock == NULL) {
+            // sync marker - all blocks of this slot are processed. The files of the slot
+            // get released, so the ident of the next block is always set again
+            file = NULL;
+            pthread_mutex_lock(&slot->syncMutex);
+            if (--slot->syncPending == 0) pthread_cond_signal(&slot->syncCond);
+            pthread_mutex_unlock(&slot->syncMutex);
+            if (atomic_fetch_sub(&profileBlock->refCnt, 1) == 1) free(profileBlock);
+            continue;
+        }
+
+        // new file - set its ident to the engines of this worker
+        if (profileBlock->file != file) {
+            file = profileBlock->file;
+            for (uint32_t j = self; j < numChannels; j += numWorkers) FilterSetParam(config->channel[j].engine, file->ident, 0);
+        }
+
+        record_header_t *record_ptr = GetCursor(dataBlock);
+        uint32_t sumSize = 0;
+        for (uint32_t i = 0; i < dataBlock->NumRecords; i++) {
+            if ((sumSize + record_ptr->size) > dataBlock->size || (record_ptr->size < sizeof(record_header_t))) {
+                LogError("Profiler: corrupt data block in %s line %d", __FILE__, __LINE__);
+                break;
+            }
+            sumSize += record_ptr->size;
+
+            switch (record_ptr->type) {
+                case V3Record:
+                    MapRecordHandle(recordHandle, (recordHeaderV3_t *)record_ptr, i + 1);
+                    // apply all channel filters at once
+                    FilterRecordSet(worker->filterSet, recordHandle, channelMatch);
+                    for (uint32_t j = self, k = 0; j < numChannels; j += numWorkers, k++) {
+                        if ((channelMatch[k >> 6] & (1ULL << (k & 0x3F))) == 0) continue;
+                        channelOutput_t *output = &slot->output[j];
+                        UpdateStatRecord(&output->stat_record, recordHandle);
+                        // shadow profiles do not have files
+                        if (config->channel[j].type & 4) continue;
+                        if (!output->ofile) OpenOutput(slot, j);
+                        if (output->nffile)
+                            output->dataBlock = AppendToBuffer(output->nffile, output->dataBlock, (void *)record_ptr, record_ptr->size);
+                    }
+                    break;
+                case ExporterInfoRecordType:
+                case SamplerLegacyRecordType:
+                case SamplerRecordType:
+                case NbarRecordType:
+                case IfNameRecordType:
+                case VrfNameRecordType:
+                    // the channel files need the exporter and sampler info of their flows
+                    for (uint32_t j = self; j < numChannels; j += numWorkers) {
+                        if (config->channel[j].type & 4) continue;
+                        channelOutput_t *output = &slot->output[j];
+                        if (!output->ofile) OpenOutput(slot, j);
+                        if (output->nffile)
+                            output->dataBlock = AppendToBuffer(output->nffile, output->dataBlock, (void *)record_ptr, record_ptr->size);
+                    }
+                    break;
+                default:
+                    // exporter stat records are not profiled
+                    break;
+            }
+            record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+        }
+
+        // the last worker frees the block
+        if (atomic_fetch_sub(&profileBlock->refCnt, 1) == 1) {
+            FreeDataBlock(dataBlock);
+            free(profileBlock);
+        }
+    }
+
+    free(recordHandle);
+    free(channelMatch);
+    return NULL;
+
+}  // End of profileWorker
+
+#ifdef HAVE_LIBRRD
+// update the rrd of a channel as nfprofile -t does
+static void UpdateRRD(time_t tslot, profileChannel_t *channel, stat_record_t *stat_record) {
+    static char rrdTemplate[] =
+        "flows:flows_tcp:flows_udp:flows_icmp:flows_other:packets:packets_tcp:packets_udp:packets_icmp:packets_other:traffic:traffic_tcp:"
+        "traffic_udp:traffic_icmp:traffic_other";
+    char buff[1024];
+    snprintf(buff, sizeof(buff), "%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu", (long long unsigned)tslot,
+             (long long unsigned)stat_record->numflows, (long long unsigned)stat_record->numflows_tcp,
+             (long long unsigned)stat_record->numflows_udp, (long long unsigned)stat_record->numflows_icmp,
+             (long long unsigned)stat_record->numflows_other, (long long unsigned)stat_record->numpackets,
+             (long long unsigned)stat_record->numpackets_tcp, (long long unsigned)stat_record->numpackets_udp,
+             (long long unsigned)stat_record->numpackets_icmp, (long long unsigned)stat_record->numpackets_other,
+             (long long unsigned)stat_record->numbytes, (long long unsigned)stat_record->numbytes_tcp,
+             (long long unsigned)stat_record->numbytes_udp, (long long unsigned)stat_record->numbytes_icmp,
+             (long long unsigned)stat_record->numbytes_other);
+
+    char *rrd_arg[] = {"update", channel->rrdFile, "--template", rrdTemplate, buff, NULL};
+    optind = 0;
+    opterr = 0;
+    rrd_clear_error();
+    int i = rrd_update(5, (rrdchar **)rrd_arg);
+    if (i != 0) LogError("RRD: %s Insert Error: %d %s", channel->rrdFile, i, rrd_get_error());
+
+}  // End of UpdateRRD
+#endif
+
+// move the channel file of a slot into place and update the channel stat
+static void WriteOutput(profileSlot_t *slot, uint32_t j) {
+    profileChannel_t *channel = &slot->config->channel[j];
+    channelOutput_t *output = &slot->output[j];
+
+    // empty channels get an empty file of the slot as well
+    if (!output->ofile) OpenOutput(slot, j);
+    if (!output->nffile) return;
+
+    FlushBlock(output->nffile, output->dataBlock);
+    output->dataBlock = NULL;
+    *output->nffile->stat_record = output->stat_record;
+    CloseUpdateFile(output->nffile);
+    DisposeFile(output->nffile);
+    output->nffile = NULL;
+
+    // alert channels have no sub directories
+    char *name = slot->fileName;
+    char *sub = strrchr(name, '/');
+    char path[MAXPATHLEN];
+    if (sub && (channel->type & 8) == 0) {
+        char error[255];
+        *sub = '\0';
+        int ok = SetupSubDir(channel->channelDir, name, error, sizeof(error));
+        *sub = '/';
+        if (!ok) {
+            LogError("Failed to create subdir path: '%s'", error);
+            name = sub + 1;
+        }
+    } else if (sub) {
+        name = sub + 1;
+    }
+    snprintf(path, MAXPATHLEN, "%s/%s", channel->channelDir, name);
+
+    struct stat fstat;
+    blkcnt_t blocks = stat(path, &fstat) == 0 ? fstat.st_blocks : 0;
+    dirstat_t *dirstat = NULL;
+    ReadStatInfo(channel->channelDir, &dirstat, CREATE_AND_LOCK);
+    if (RenameAppend(output->ofile, path) < 0) {
+        LogError("Failed to rename file %s to %s: %s", output->ofile, path, strerror(errno));
+    } else if (dirstat && stat(path, &fstat) == 0) {
+        // a file of a previous run of this slot is appended
+        dirstat->filesize += 512 * (fstat.st_blocks - blocks);
+        if (blocks == 0) dirstat->numfiles++;
+        if (slot->t_start > dirstat->last) dirstat->last = slot->t_start;
+    }
+    if (dirstat) WriteStatInfo(dirstat);
+
+}  // End of WriteOutput
+
+// wait for the workers to process all blocks of the slot, write the channel files
+// and statistics and release the slot
+static void FinalizeSlot(profileSlot_t *slot) {
+    profileConfig_t *config = slot->config;
+
+    profileBlock_t *marker = NewProfileBlock(config);
+    if (!marker) return;
+    marker->slot = slot;
+    slot->syncPending = config->numWorkers;
+    for (uint32_t i = 0; i < config->numWorkers; i++) PushBlock(&config->worker[i], marker);
+
+    pthread_mutex_lock(&slot->syncMutex);
+    while (slot->syncPending) pthread_cond_wait(&slot->syncCond, &slot->syncMutex);
+    pthread_mutex_unlock(&slot->syncMutex);
+
+    for (uint32_t j = 0; j < config->numChannels; j++) {
+        profileChannel_t *channel = &config->channel[j];
+        if ((channel->type & 4) == 0 && slot->fileName) WriteOutput(slot, j);
+#ifdef HAVE_LIBRRD
+        if ((channel->type & 8) == 0) UpdateRRD(slot->t_start, channel, &slot->output[j].stat_record);
+#endif
+        free(slot->output[j].ofile);
+    }
+    dbg_printf("Profiler: slot %u finalized\n", slot->seq);
+
+    pthread_mutex_lock(&profiler.mutex);
+    profileFile_t *file = slot->fileList;
+    while (file) {
+        profileFile_t *next = file->next;
+        free(file->ident);
+        free(file);
+        file = next;
+    }
+    ReleaseConfig(config);
+    pthread_mutex_unlock(&profiler.mutex);
+
+    pthread_mutex_destroy(&slot->syncMutex);
+    pthread_cond_destroy(&slot->syncCond);
+    free(slot->fileName);
+    free(slot->output);
+    free(slot);
+
+}  // End of FinalizeSlot
+
+/*
+ * setup the profiler from the profile keys in nfcapd.conf. Returns 1, if the profiler
+ * is disabled or set up, 0 on error
+ */
+int SetupProfiler(int compress) {
+    profiler.channelFile = ConfGetString("profile.channels");
+    if (!profiler.channelFile || strlen(profiler.channelFile) == 0) {
+        profiler.channelFile = NULL;
+        return 1;
+    }
+    profiler.datadir = ConfGetString("profile.datadir");
+    if (!profiler.datadir || TestPath(profiler.datadir, S_IFDIR) != PATH_OK) {
+        LogError("Profiler: profile.datadir is not a directory");
+        return 0;
+    }
+    profiler.statdir = ConfGetString("profile.statdir");
+    if (!profiler.statdir) profiler.statdir = strdup(profiler.datadir);
+    profiler.filterFile = ConfGetString("profile.filter");
+    if (!profiler.filterFile) profiler.filterFile = strdup("filter.txt");
+    int numWorkers = ConfGetValue("profile.workers");
+    profiler.numWorkers = GetNumWorkers(numWorkers > 0 ? numWorkers : PROFILEWORKERS);
+    profiler.compress = compress;
+
+    struct stat stat_buf;
+    if (stat(profiler.channelFile, &stat_buf)) {
+        LogError("stat() error '%s': %s", profiler.channelFile, strerror(errno));
+        return 0;
+    }
+    profiler.config = LoadConfig();
+    if (!profiler.config) return 0;
+    profiler.mtime = stat_buf.st_mtime;
+
+    return 1;
+
+}  // End of SetupProfiler
+
+// attach a new collector file to the current slot. Returns the tap argument of the file
+void *ProfileAttach(char *ident) {
+    if (!profiler.channelFile) return NULL;
+
+    pthread_mutex_lock(&profiler.mutex);
+    if (!profiler.slot) profiler.slot = NewSlot();
+    profileFile_t *file = NULL;
+    if (profiler.slot) {
+        file = calloc(1, sizeof(profileFile_t));
+        if (file) {
+            file->slot = profiler.slot;
+            file->ident = strdup(ident ? ident : "none");
+            file->next = profiler.slot->fileList;
+            profiler.slot->fileList = file;
+            profiler.slot->numFiles++;
+        }
+    }
+    pthread_mutex_unlock(&profiler.mutex);
+
+    return file;
+
+}  // End of ProfileAttach
+
+// block tap of a collector file - hand a copy of the block to all workers
+void ProfileBlock(void *arg, const dataBlock_t *dataBlock) {
+    profileFile_t *file = (profileFile_t *)arg;
+    if (dataBlock->type != DATA_BLOCK_TYPE_3 || dataBlock->NumRecords == 0) return;
+    profileConfig_t *config = file->slot->config;
+
+    profileBlock_t *profileBlock = NewProfileBlock(config);
+    if (!profileBlock) return;
+    profileBlock->dataBlock = NewDataBlock();
+    memcpy((void *)profileBlock->dataBlock, (void *)dataBlock, sizeof(dataBlock_t) + dataBlock->size);
+    profileBlock->dataBlock->flags &= ~(FLAG_BLOCK_MAPPED | FLAG_BLOCK_SMALL);
+    profileBlock->file = file;
+    profileBlock->slot = file->slot;
+
+    for (uint32_t i = 0; i < config->numWorkers; i++) PushBlock(&config->worker[i], profileBlock);
+
+}  // End of ProfileBlock
+
+// a collector file is rotated - new files go into a new slot
+void ProfileRotate(void *arg) {
+    profileFile_t *file = (profileFile_t *)arg;
+    if (!file) return;
+
+    pthread_mutex_lock(&profiler.mutex);
+    if (file->slot == profiler.slot) profiler.slot = NULL;
+    pthread_mutex_unlock(&profiler.mutex);
+
+}  // End of ProfileRotate
+
+// a rotated collector file is closed - all its blocks are tapped. The slot is
+// finalized with its last file
+void ProfileDone(void *arg, char *datadir, char *filename, time_t t_start) {
+    profileFile_t *file = (profileFile_t *)arg;
+    if (!file) return;
+
+    pthread_mutex_lock(&profiler.mutex);
+    profileSlot_t *slot = file->slot;
+    if (!slot->fileName) {
+        size_t len = strlen(datadir);
+        char *name = strncmp(filename, datadir, len) == 0 && filename[len] == '/' ? filename + len + 1 : filename;
+        slot->fileName = strdup(name);
+        slot->t_start = t_start;
+    }
+    int finalize = --slot->numFiles == 0 && slot != profiler.slot;
+    pthread_mutex_unlock(&profiler.mutex);
+
+    if (finalize) FinalizeSlot(slot);
+
+}  // End of ProfileDone
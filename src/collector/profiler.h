@@ -0,0 +1,58 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _PROFILER_H
+#define _PROFILER_H 1
+
+#include <stdint.h>
+#include <time.h>
+
+#include "nffileV2.h"
+
+/*
+ * In-collector profiling.
+ * nfcapd loads the NfSen profile channels listed in profile.channels of nfcapd.conf
+ * and filters the written data blocks of all collector files while they are still
+ * in memory. At rotation, the channel files and statistics of the time slot are
+ * written as nfprofile would do it, so NfSen does not need to re-read the slot.
+ * The channel file is reloaded at the next time slot, if it changes.
+ */
+
+int SetupProfiler(int compress);
+
+void *ProfileAttach(char *ident);
+
+void ProfileBlock(void *arg, const dataBlock_t *dataBlock);
+
+void ProfileRotate(void *arg);
+
+void ProfileDone(void *arg, char *datadir, char *filename, time_t t_start);
+
+#endif  // _PROFILER_H
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "publish.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nffile.h"
+#include "queue.h"
+#include "util.h"
+
+static struct publisher_s {
+    char *socketPath;
+    int listenFD;
+    queue_t *blockQueue;
+    pthread_t acceptTID;
+    pthread_t sendTID;
+    pthread_mutex_t lock;  // protects subscriber list
+    int subscriber[MAXSUBSCRIBER];
+    _Atomic uint32_t numSubscriber;
+    _Atomic uint64_t dropped;
+} publisher = {.listenFD = -1, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void *acceptThread(void *arg);
+
+static void *sendThread(void *arg);
+
+static int SendBlock(int fd, const dataBlock_t *dataBlock);
+
+static void *acceptThread(void *arg) {
+    while (1) {
+        int fd = accept(publisher.listenFD, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            // listen socket closed by StopPublisher()
+            break;
+        }
+
+        struct timeval tv = {.tv_sec = SUBSCRIBERTIMEOUT, .tv_usec = 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        pthread_mutex_lock(&publisher.lock);
+        int slot = 0;
+        while (slot < MAXSUBSCRIBER && publisher.subscriber[slot] >= 0) slot++;
+        if (slot < MAXSUBSCRIBER) {
+            publisher.subscriber[slot] = fd;
+            atomic_fetch_add(&publisher.numSubscriber, 1);
+            LogInfo("Live subscriber %d connected", slot);
+        } else {
+            LogError("Live subscriber rejected - max %d subscribers", MAXSUBSCRIBER);
+            close(fd);
+        }
+        pthread_mutex_unlock(&publisher.lock);
+    }
+
+    return NULL;
+
+}  // End of acceptThread
+
+static int SendBlock(int fd, const dataBlock_t *dataBlock) {
+    const void *p = (const void *)dataBlock;
+    size_t len = sizeof(dataBlock_t) + dataBlock->size;
+    while (len) {
+        ssize_t ret = send(fd, p, len, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return 0;
+        p += ret;
+        len -= ret;
+    }
+    return 1;
+
+}  // End of SendBlock
+
+static void *sendThread(void *arg) {
+    while (1) {
+        dataBlock_t *dataBlock = queue_pop(publisher.blockQueue);
+        if (dataBlock == QUEUE_CLOSED) break;
+
+        pthread_mutex_lock(&publisher.lock);
+        for (int i = 0; i < MAXSUBSCRIBER; i++) {
+            int fd = publisher.subscriber[i];
+            if (fd < 0 || SendBlock(fd, dataBlock)) continue;
+            // subscriber gone or too slow
+            LogInfo("Live subscriber %d disconnected", i);
+            close(fd);
+            publisher.subscriber[i] = -1;
+            atomic_fetch_sub(&publisher.numSubscriber, 1);
+        }
+        pthread_mutex_unlock(&publisher.lock);
+        free(dataBlock);
+    }
+
+    return NULL;
+
+}  // End of sendThread
+
+int StartPublisher(char *socketPath) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        LogError("Live socket path too long: %s", socketPath);
+        return 0;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    // remove a stale socket of a previous run
+    struct stat stat_buf;
+    if (stat(socketPath, &stat_buf) == 0 && S_ISSOCK(stat_buf.st_mode)) unlink(socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LogError("socket() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, MAXSUBSCRIBER) < 0) {
+        LogError("bind() to live socket %s failed: %s", socketPath, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    for (int i = 0; i < MAXSUBSCRIBER; i++) publisher.subscriber[i] = -1;
+    publisher.blockQueue = queue_init(PUBLISHQUEUE);
+    if (!publisher.blockQueue) {
+        close(fd);
+        return 0;
+    }
+    publisher.listenFD = fd;
+    publisher.socketPath = strdup(socketPath);
+
+    int err = pthread_create(&publisher.sendTID, NULL, sendThread, NULL);
+    if (!err) err = pthread_create(&publisher.acceptTID, NULL, acceptThread, NULL);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        return 0;
+    }
+    LogInfo("Publish live blocks on %s", socketPath);
+
+    return 1;
+
+}  // End of StartPublisher
+
+void StopPublisher(void) {
+    if (publisher.listenFD < 0) return;
+
+    shutdown(publisher.listenFD, SHUT_RDWR);
+    close(publisher.listenFD);
+    pthread_join(publisher.acceptTID, NULL);
+
+    queue_close(publisher.blockQueue);
+    pthread_join(publisher.sendTID, NULL);
+    queue_free(publisher.blockQueue);
+
+    for (int i = 0; i < MAXSUBSCRIBER; i++) {
+        if (publisher.subscriber[i] >= 0) close(publisher.subscriber[i]);
+        publisher.subscriber[i] = -1;
+    }
+    unlink(publisher.socketPath);
+    free(publisher.socketPath);
+    publisher.listenFD = -1;
+
+    uint64_t dropped = atomic_load(&publisher.dropped);
+    if (dropped) LogInfo("Live publisher dropped %llu blocks", (unsigned long long)dropped);
+
+}  // End of StopPublisher
+
+// block tap of the collector files - called by the writer threads
+void PublishBlock(void *arg, const dataBlock_t *dataBlock) {
+    if (atomic_load(&publisher.numSubscriber) == 0 || dataBlock->size == 0) return;
+
+    // never block the writers - leave some slack for concurrent writers
+    if (queue_length(publisher.blockQueue) >= (PUBLISHQUEUE - 8)) {
+        atomic_fetch_add(&publisher.dropped, 1);
+        return;
+    }
+
+    size_t size = sizeof(dataBlock_t) + dataBlock->size;
+    dataBlock_t *copy = malloc(size);
+    if (!copy) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+    memcpy((void *)copy, (void *)dataBlock, size);
+    copy->flags &= ~FLAG_BLOCK_MAPPED;
+    queue_push(publisher.blockQueue, copy);
+
+}  // End of PublishBlock
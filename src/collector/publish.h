@@ -0,0 +1,57 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _PUBLISH_H
+#define _PUBLISH_H 1
+
+#include "nffileV2.h"
+
+/*
+ * Live publisher. Subscribers connect to a unix socket and receive all blocks
+ * written by the collector, uncompressed, as dataBlock_t header followed by the
+ * records. Blocks are sent by a publisher thread. The receive workers never wait
+ * for subscribers: blocks are dropped, if the publisher queue is full, and a
+ * subscriber, which does not read for a while, is disconnected.
+ */
+
+// max number of blocks waiting to be sent
+#define PUBLISHQUEUE 64
+// max number of subscribers
+#define MAXSUBSCRIBER 16
+// a subscriber is disconnected, if a block can not be sent within this time in s
+#define SUBSCRIBERTIMEOUT 2
+
+int StartPublisher(char *socketPath);
+
+void StopPublisher(void);
+
+void PublishBlock(void *arg, const dataBlock_t *dataBlock);
+
+#endif  // _PUBLISH_H
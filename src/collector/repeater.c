@@ -28,6 +28,9 @@
  *
  */
 
+// sendmmsg() needs _GNU_SOURCE on Linux
+#define _GNU_SOURCE
+
 #include "repeater.h"
 
 #include <errno.h>
@@ -40,26 +43,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 
+#include "config.h"
 #include "daemon.h"
 #include "nfnet.h"
 #include "privsep.h"
+#include "shmring.h"
 #include "util.h"
 
 #define IP_HDR_LEN 5
 #define UDP_HDR_SIZE 8
 #define MAXTLL 255
 
+// number of datagrams per target sent with one system call
+#ifdef HAVE_SENDMMSG
+#define REPEAT_BATCHSIZE 64
+#else
+#define REPEAT_BATCHSIZE 1
+#endif
+
+/*
+ * Datagrams are collected per target and sent with one sendmmsg() call.
+ * The payload is not copied, but referenced in the pipe buffer. The batch
+ * is therefore flushed by the pipeReader, before the buffer is reused.
+ * For spoofed packets, the IP and UDP header are prepared in the batch.
+ * If the collector passed on a shared memory ring, the datagrams are read
+ * from the ring and the pipe only carries the wakeup messages.
+ */
+typedef struct repeatBatch_s {
+    uint32_t numPackets;
+    uint32_t dstSum;  // checksum part of the target address and port
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[REPEAT_BATCHSIZE];
+#else
+    struct msghdr msgs[REPEAT_BATCHSIZE];
+#endif
+    struct iovec iov[REPEAT_BATCHSIZE][3];
+    struct ip ipHeader[REPEAT_BATCHSIZE];
+    struct udphdr udpHeader[REPEAT_BATCHSIZE];
+} repeatBatch_t;
+
 static int done = 1;
 static int child_exit = 0;
 static pthread_t reader_tid;
+static repeatBatch_t *repeatBatch = NULL;
+static shmRing_t *shmRing = NULL;
 
 static unsigned ip_header_checksum(struct ip *header);
 
-static uint16_t udp_sum_calc(uint16_t len_udp, uint32_t src_addr, uint16_t src_port, uint32_t dest_addr, uint16_t dest_port, const void *buff);
-
-int raw_send_to(int sock, void *msg, size_t msglen, struct sockaddr_in *src_addr, struct sockaddr_in *dst_addr, int ttl, int flags);
-
 static void SignalHandler(int signal) {
     switch (signal) {
         case SIGTERM:
@@ -87,130 +119,248 @@ static unsigned ip_header_checksum(struct ip *header) {
     return ~csum & 0xffff;
 }
 
-// calculate UDP checksum for IP spoofing raw socket
-static uint16_t udp_sum_calc(uint16_t len_udp, uint32_t src_addr, uint16_t src_port, uint32_t dest_addr, uint16_t dest_port, const void *buff) {
-    uint16_t prot_udp = IPPROTO_UDP;
-    uint16_t chksum_init = 0;
-    uint16_t udp_len_total = 0;
-    uint32_t sum = 0;
-    uint16_t pad = 0;
+/*
+ * UDP checksum for IP spoofing raw socket. The one's complement sum is byte order
+ * independent, if all 16bit words are added in the same byte order. Therefore the
+ * network ordered data is summed up in host order, and the folded sum is again
+ * valid in network order. This allows to sum up the payload once per packet and
+ * the target address and port once per target, and to combine the parts.
+ */
 
-    /* if we have an odd number of bytes in the data payload, then set the pad to 1
-     * for special processing
-     */
-    if (len_udp % 2 != 0) {
-        pad = 1;
+// fold a 64bit partial sum into 16 bits
+static inline uint32_t csum_fold(uint64_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint32_t)sum;
+}  // End of csum_fold
+
+// partial sum of a network ordered buffer
+static uint32_t csum_partial(const void *buff, size_t len) {
+    const uint8_t *p = (const uint8_t *)buff;
+    uint64_t sum = 0;
+
+    while (len >= 8) {
+        uint32_t w[2];
+        memcpy(w, p, 8);
+        sum += (uint64_t)w[0] + w[1];
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        sum += w;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t w;
+        memcpy(&w, p, 2);
+        sum += w;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        // odd byte is padded with a zero byte
+        uint8_t w[2] = {*p, 0};
+        uint16_t w16;
+        memcpy(&w16, w, 2);
+        sum += w16;
     }
-    /* do the source and destination addresses, first, we have to split them
-     * into 2 shorts instead of the 32 long as sent.  Sorry, that's just how they
-     * calculate
-     */
-    uint16_t low = src_addr;
-    uint16_t high = (src_addr >> 16);
-    sum += ((uint32_t)high + (uint32_t)low);
 
-    /* now do the same with the destination address */
-    low = dest_addr;
-    high = (dest_addr >> 16);
-    sum += ((uint32_t)high + (uint32_t)low);
+    return csum_fold(sum);
+}  // End of csum_partial
+
+// partial sum of a network ordered IPv4 address and port
+static inline uint32_t csum_addr(const struct sockaddr_in *addr) {
+    return csum_fold((uint64_t)addr->sin_addr.s_addr + addr->sin_port);
+}  // End of csum_addr
+
+// final UDP checksum from the partial sums of payload, source and destination
+static inline uint16_t udp_checksum(uint32_t payloadSum, uint32_t srcSum, uint32_t dstSum, uint16_t udpLen) {
+    // pseudo header protocol and UDP length + UDP header length
+    uint16_t netLen = htons(udpLen);
+    uint16_t prot = htons(IPPROTO_UDP);
+    uint64_t sum = (uint64_t)payloadSum + srcSum + dstSum + prot + netLen + netLen;
+    uint16_t csum = ~csum_fold(sum) & 0xFFFF;
+    // a zero checksum is transmitted as all ones
+    return csum ? csum : 0xFFFF;
+}  // End of udp_checksum
+
+// send all pending datagrams of target i
+static void FlushTarget(repeater_t *repeater, int i) {
+    repeatBatch_t *batch = &repeatBatch[i];
+    uint32_t sent = 0;
+
+    while (sent < batch->numPackets) {
+#ifdef HAVE_SENDMMSG
+        int ret = sendmmsg(repeater[i].sockfd, &batch->msgs[sent], batch->numPackets - sent, 0);
+#else
+        int ret = sendmsg(repeater[i].sockfd, &batch->msgs[sent], 0) < 0 ? -1 : 1;
+#endif
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LogError("sendmmsg(): %d: %s %s", i, repeater[i].hostname, strerror(errno));
+            // skip the failed datagram
+            ret = 1;
+        }
+        sent += ret;
+    }
+    dbg_printf("Repeated: %u datagrams to %s\n", batch->numPackets, repeater[i].hostname);
+    batch->numPackets = 0;
 
-    /* the protocol and the number and the length of the UDP packet */
-    udp_len_total = len_udp + 8; /* length sent is length of data, need to add 8 */
-    sum += ((uint32_t)prot_udp + (uint32_t)udp_len_total);
+}  // End of FlushTarget
 
-    /* next comes the source and destination ports */
-    sum += ((uint32_t)src_port + (uint32_t)dest_port);
+static void RepeaterFlushFunc(void *extraArg) {
+    repeater_t *repeater = (repeater_t *)extraArg;
 
-    /* Now add the UDP length and checksum=0 bits
-     * The Length will always be 8 bytes plus the length of the udp data sent
-     * and the checksum will always be zero
-     */
-    sum += ((uint32_t)udp_len_total + (uint32_t)chksum_init);
-
-    /* Add all 16 bit words to the sum, if pad is set (ie, odd data length) this will just read up
-     * to the last full 16 bit word.
-     * */
-    for (int i = 0; i < (len_udp - pad); i += 2) {
-        high = ntohs(*(uint16_t *)buff);
-        buff += 2;
-        sum += (uint32_t)high;
+    for (int i = 0; i < MAX_REPEATERS && repeater[i].hostname; i++) {
+        if (repeatBatch[i].numPackets) FlushTarget(repeater, i);
     }
 
-    /* ok, if pad is true, then the pointer is now  right before the last single byte in
-     * the payload.  We only need to add till the end of the string (1-byte) , not the next 2 bytes
-     * as above.
-     */
-    if (pad) {
-        sum += ntohs(*(unsigned char *)buff);
-    }
+}  // End of RepeaterFlushFunc
 
-    /* keep only the last 16 bits of the 32 bit calculated sum and add the carry overs */
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
+// add a datagram to the batch of target i
+static void QueueDatagram(repeater_t *repeater, int i, void *payload, size_t len) {
+    repeatBatch_t *batch = &repeatBatch[i];
+    uint32_t n = batch->numPackets;
 
-    /* one's compliment the sum */
-    sum = ~sum;
-
-    /* finally, return the 16bit network formatted checksum */
-    return ((uint16_t)htons(sum));
-};
-
-int raw_send_to(int sock, void *msg, size_t msglen, struct sockaddr_in *src_addr, struct sockaddr_in *dst_addr, int ttl, int flags) {
-    struct udphdr udp;
-    udp.uh_sport = src_addr->sin_port;
-    udp.uh_dport = dst_addr->sin_port;
-    udp.uh_ulen = htons(msglen + sizeof(struct udphdr));
-    udp.uh_sum = udp_sum_calc(msglen, ntohl(src_addr->sin_addr.s_addr), ntohs(src_addr->sin_port), ntohl(dst_addr->sin_addr.s_addr),
-                              ntohs(dst_addr->sin_port), msg);
-
-    struct ip iphdr = {0};
-    iphdr.ip_hl = IP_HDR_LEN;
-    iphdr.ip_v = 4;
-    iphdr.ip_tos = 0;
-    uint16_t iplen = 4 * IP_HDR_LEN + UDP_HDR_SIZE + msglen;
-    iphdr.ip_len = htons(iplen);
-    iphdr.ip_off = 0;
-    iphdr.ip_id = 0;
-    iphdr.ip_ttl = ttl;
-    iphdr.ip_p = IPPROTO_UDP;
-    iphdr.ip_src.s_addr = src_addr->sin_addr.s_addr;
-    iphdr.ip_dst.s_addr = dst_addr->sin_addr.s_addr;
-    iphdr.ip_sum = 0;
-    iphdr.ip_sum = ip_header_checksum(&iphdr);
+    struct iovec *iov = batch->iov[n];
+    iov[0].iov_base = payload;
+    iov[0].iov_len = len;
+
+#ifdef HAVE_SENDMMSG
+    struct msghdr *mh = &batch->msgs[n].msg_hdr;
+    batch->msgs[n].msg_len = 0;
+#else
+    struct msghdr *mh = &batch->msgs[n];
+#endif
+    memset((void *)mh, 0, sizeof(struct msghdr));
+    mh->msg_name = (void *)&repeater[i].addr;
+    mh->msg_namelen = repeater[i].addrlen;
+    mh->msg_iov = iov;
+    mh->msg_iovlen = 1;
+
+    batch->numPackets++;
+    if (batch->numPackets == REPEAT_BATCHSIZE) FlushTarget(repeater, i);
+
+}  // End of QueueDatagram
+
+// add a datagram with spoofed source address to the batch of target i
+static void QueueRawDatagram(repeater_t *repeater, int i, void *payload, size_t len, struct sockaddr_in *src_addr, uint32_t payloadSum,
+                             uint32_t srcSum) {
+    repeatBatch_t *batch = &repeatBatch[i];
+    uint32_t n = batch->numPackets;
+    struct sockaddr_in *dst_addr = (struct sockaddr_in *)&repeater[i].addr;
+
+    uint16_t udpLen = len + sizeof(struct udphdr);
+    struct udphdr *udp = &batch->udpHeader[n];
+    udp->uh_sport = src_addr->sin_port;
+    udp->uh_dport = dst_addr->sin_port;
+    udp->uh_ulen = htons(udpLen);
+    udp->uh_sum = udp_checksum(payloadSum, srcSum, batch->dstSum, udpLen);
+
+    struct ip *iphdr = &batch->ipHeader[n];
+    memset((void *)iphdr, 0, sizeof(struct ip));
+    iphdr->ip_hl = IP_HDR_LEN;
+    iphdr->ip_v = 4;
+    iphdr->ip_tos = 0;
+    uint16_t iplen = 4 * IP_HDR_LEN + UDP_HDR_SIZE + len;
+    iphdr->ip_len = htons(iplen);
+    iphdr->ip_off = 0;
+    iphdr->ip_id = 0;
+    iphdr->ip_ttl = MAXTTL;
+    iphdr->ip_p = IPPROTO_UDP;
+    iphdr->ip_src.s_addr = src_addr->sin_addr.s_addr;
+    iphdr->ip_dst.s_addr = dst_addr->sin_addr.s_addr;
+    iphdr->ip_sum = 0;
+    iphdr->ip_sum = ip_header_checksum(iphdr);
 
 #ifdef __APPLE__
     /*
      * For some reason, the IP header's length field needs to be in host byte order
      * in OS X - set checksum to 0.
      */
-    iphdr.ip_len = iplen;
-    iphdr.ip_sum = 0;
+    iphdr->ip_len = iplen;
+    iphdr->ip_sum = 0;
 #endif
 
-    struct iovec iov[3];
-    iov[0].iov_base = (void *)&iphdr;
+    struct iovec *iov = batch->iov[n];
+    iov[0].iov_base = (void *)iphdr;
     iov[0].iov_len = sizeof(struct ip);
-    iov[1].iov_base = (void *)&udp;
+    iov[1].iov_base = (void *)udp;
     iov[1].iov_len = sizeof(struct udphdr);
-    iov[2].iov_base = msg;
-    iov[2].iov_len = msglen;
-
-    struct msghdr mh = {0};
-    mh.msg_name = (void *)dst_addr;
-    mh.msg_namelen = sizeof(struct sockaddr_in);
-    mh.msg_iov = iov;
-    mh.msg_iovlen = 3;
-
-    int ret = sendmsg(sock, &mh, 0);
-    if (ret == -1) {
-        LogError("sendmsg() error: %s", strerror(errno));
-    } else {
-        dbg_printf("sendmsg() ok\n");
+    iov[2].iov_base = payload;
+    iov[2].iov_len = len;
+
+#ifdef HAVE_SENDMMSG
+    struct msghdr *mh = &batch->msgs[n].msg_hdr;
+    batch->msgs[n].msg_len = 0;
+#else
+    struct msghdr *mh = &batch->msgs[n];
+#endif
+    memset((void *)mh, 0, sizeof(struct msghdr));
+    mh->msg_name = (void *)dst_addr;
+    mh->msg_namelen = sizeof(struct sockaddr_in);
+    mh->msg_iov = iov;
+    mh->msg_iovlen = 3;
+
+    batch->numPackets++;
+    if (batch->numPackets == REPEAT_BATCHSIZE) FlushTarget(repeater, i);
+
+}  // End of QueueRawDatagram
+
+// queue a datagram for all targets
+static void RepeatDatagram(repeater_t *repeater, void *in_buff, size_t cnt, struct sockaddr_storage *addr) {
+    // checksum parts of spoofed packets are calculated once for all targets
+    int haveSum = 0;
+    uint32_t payloadSum = 0;
+    uint32_t srcSum = 0;
+    int i = 0;
+    while (repeater[i].hostname && (i < MAX_REPEATERS)) {
+        if (repeater[i].addrlen == 0) {
+            // packet spoofing
+            struct sockaddr_in *src_addr = (struct sockaddr_in *)addr;
+            if (src_addr->sin_family == PF_INET) {
+                // Only IPv4 spoofing supported
+                if (!haveSum) {
+                    payloadSum = csum_partial(in_buff, cnt);
+                    srcSum = csum_addr(src_addr);
+                    haveSum = 1;
+                }
+                QueueRawDatagram(repeater, i, in_buff, cnt, src_addr, payloadSum, srcSum);
+            }
+        } else {
+            // normal packet repeating
+            QueueDatagram(repeater, i, in_buff, cnt);
+        }
+        i++;
     }
 
-    return ret;
-}
+}  // End of RepeatDatagram
+
+/*
+ * Repeat all datagrams of the shared memory ring. The batches reference the
+ * payload in the ring, so the slots are released after the batches are flushed.
+ */
+static void DrainRing(repeater_t *repeater) {
+    do {
+        uint32_t numSlots = 0;
+        shmSlot_t *slot;
+        while ((slot = ShmRingNext(shmRing)) != NULL) {
+            RepeatDatagram(repeater, slot->data, slot->packetSize, &slot->addr);
+            if (++numSlots == REPEAT_BATCHSIZE) {
+                RepeaterFlushFunc(repeater);
+                ShmRingRelease(shmRing);
+                numSlots = 0;
+            }
+        }
+        RepeaterFlushFunc(repeater);
+        ShmRingRelease(shmRing);
+    } while (ShmRingSleep(shmRing) == 0);
+
+}  // End of DrainRing
 
 static void RepeaterMessageFunc(message_t *message, void *extraArg) {
     repeater_t *repeater = (repeater_t *)extraArg;
@@ -229,27 +379,11 @@ static void RepeaterMessageFunc(message_t *message, void *extraArg) {
         if (message->length < (sizeof(message_t) + sizeof(repeater_message_t) + cnt)) {
             LogError("Repeater message size check error: %u", message->length);
         }
-        int i = 0;
-        while (repeater[i].hostname && (i < MAX_REPEATERS)) {
-            if (repeater[i].addrlen == 0) {
-                // packet spoofing
-                struct sockaddr_in *src_addr = (struct sockaddr_in *)&repeater_message->addr;
-                struct sockaddr_in *dst_addr = (struct sockaddr_in *)&repeater[i].addr;
-                if (src_addr->sin_family == PF_INET) {
-                    // Only IPv4 spoofing supported
-                    raw_send_to(repeater[i].sockfd, in_buff, cnt, src_addr, dst_addr, MAXTTL, 0);
-                }
-            } else {
-                // normal packet repeating
-                ssize_t len = sendto(repeater[i].sockfd, in_buff, cnt, 0, (struct sockaddr *)&(repeater[i].addr), repeater[i].addrlen);
-                if (len < 0) {
-                    LogError("sendto(): %d: %s %s", i, repeater[i].hostname, strerror(errno));
-                } else {
-                    dbg_printf("Repeated: %zd\n", len);
-                }
-            }
-            i++;
-        }
+
+        RepeatDatagram(repeater, in_buff, cnt, &repeater_message->addr);
+    } else if ((message->type == PRIVMSG_RING || message->type == PRIVMSG_EXIT) && shmRing) {
+        // repeat the pending datagrams also before exit
+        DrainRing(repeater);
     }
 }
 
@@ -288,6 +422,18 @@ int StartupRepeater(repeater_t *repeater, int bufflen, int srcSpoofing, char *us
         }
     }
 
+    repeatBatch = (repeatBatch_t *)calloc(MAX_REPEATERS, sizeof(repeatBatch_t));
+    if (!repeatBatch) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 255;
+    }
+    for (int i = 0; i < MAX_REPEATERS && repeater[i].hostname; i++) {
+        if (repeater[i].addrlen == 0) repeatBatch[i].dstSum = csum_addr((struct sockaddr_in *)&repeater[i].addr);
+    }
+
+    shmRing = AttachShmRing(SHMRINGFD);
+    if (shmRing) LogVerbose("Repeater reads datagrams from shared memory ring");
+
     /* Signal handling */
     struct sigaction act;
     memset((void *)&act, 0, sizeof(struct sigaction));
@@ -299,6 +445,7 @@ int StartupRepeater(repeater_t *repeater, int bufflen, int srcSpoofing, char *us
 
     thread_arg_t thread_arg = {0};
     thread_arg.messageFunc = RepeaterMessageFunc;
+    thread_arg.flushFunc = RepeaterFlushFunc;
     thread_arg.extraArg = repeater;
     pthread_t tid;
     int err = pthread_create(&reader_tid, NULL, pipeReader, (void *)&thread_arg);
@@ -313,6 +460,11 @@ int StartupRepeater(repeater_t *repeater, int bufflen, int srcSpoofing, char *us
         LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
     }
 
+    free(repeatBatch);
+    repeatBatch = NULL;
+    FreeShmRing(shmRing);
+    shmRing = NULL;
+
     LogVerbose("End StartupRepeater()");
     return 0;
 
@@ -0,0 +1,274 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// memfd_create() needs _GNU_SOURCE on Linux
+#define _GNU_SOURCE
+
+#include "shmring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "util.h"
+
+#define SHMRINGMAGIC 0x52494E47
+#define ALIGN8(x) (((x) + 7) & ~((size_t)7))
+
+/*
+ * Shared part of the ring. head and tail are monotonic byte counters on
+ * separate cache lines. A slot, which does not fit at the end of the data
+ * area, is preceded by a pad slot with packetSize 0 and wraps to the start.
+ */
+typedef struct shmHeader_s {
+    uint32_t magic;
+    uint32_t fill;
+    uint64_t size;  // size of the data area - power of 2
+    _Atomic uint64_t head __attribute__((aligned(64)));
+    _Atomic uint64_t tail __attribute__((aligned(64)));
+    // consumer sleeps and needs a wakeup
+    _Atomic uint32_t waiting;
+} shmHeader_t;
+
+#define DATAOFFSET ALIGN8(sizeof(shmHeader_t))
+
+struct shmRing_s {
+    int fd;
+    size_t mapSize;
+    shmHeader_t *header;
+    uint8_t *data;
+    uint64_t mask;
+    uint64_t position;   // producer: head, consumer: read position
+    uint64_t peerCache;  // producer: last seen tail, consumer: last seen head
+};
+
+static shmRing_t *MapShmRing(int fd, size_t mapSize) {
+    shmRing_t *shmRing = (shmRing_t *)calloc(1, sizeof(shmRing_t));
+    if (!shmRing) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    void *map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        LogError("mmap() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(shmRing);
+        return NULL;
+    }
+
+    shmRing->fd = fd;
+    shmRing->mapSize = mapSize;
+    shmRing->header = (shmHeader_t *)map;
+    shmRing->data = (uint8_t *)map + DATAOFFSET;
+    return shmRing;
+
+}  // End of MapShmRing
+
+shmRing_t *NewShmRing(size_t size) {
+    if (size < 65536 || (size & (size - 1)) != 0) {
+        LogError("NewShmRing(): size %zu not a power of 2 >= 65536", size);
+        return NULL;
+    }
+
+#ifdef HAVE_MEMFD_CREATE
+    int fd = memfd_create("nfcapd-ring", 0);
+    if (fd < 0) {
+        LogError("memfd_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/nfcapd-ring.%d", (int)getpid());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        LogError("shm_open() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    // the descriptor keeps the memory
+    shm_unlink(name);
+#endif
+
+    size_t mapSize = DATAOFFSET + size;
+    if (ftruncate(fd, mapSize) < 0) {
+        LogError("ftruncate() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    shmRing_t *shmRing = MapShmRing(fd, mapSize);
+    if (!shmRing) {
+        close(fd);
+        return NULL;
+    }
+
+    shmHeader_t *header = shmRing->header;
+    header->magic = SHMRINGMAGIC;
+    header->size = size;
+    atomic_init(&header->head, 0);
+    atomic_init(&header->tail, 0);
+    // no consumer yet - wakeup the first one
+    atomic_init(&header->waiting, 1);
+    shmRing->mask = size - 1;
+
+    return shmRing;
+
+}  // End of NewShmRing
+
+shmRing_t *AttachShmRing(int fd) {
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0) {
+        // no ring passed on
+        if (errno != EBADF) LogError("fstat() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    if (stat_buf.st_size <= (off_t)DATAOFFSET) return NULL;
+
+    shmRing_t *shmRing = MapShmRing(fd, stat_buf.st_size);
+    if (!shmRing) return NULL;
+
+    shmHeader_t *header = shmRing->header;
+    if (header->magic != SHMRINGMAGIC || (DATAOFFSET + header->size) != shmRing->mapSize) {
+        LogError("AttachShmRing(): fd %d is not a packet ring", fd);
+        munmap((void *)header, shmRing->mapSize);
+        free(shmRing);
+        return NULL;
+    }
+    shmRing->mask = header->size - 1;
+    shmRing->position = atomic_load_explicit(&header->tail, memory_order_acquire);
+    shmRing->peerCache = shmRing->position;
+
+    return shmRing;
+
+}  // End of AttachShmRing
+
+int ShmRingFD(shmRing_t *shmRing) { return shmRing->fd; }  // End of ShmRingFD
+
+int ShmRingPush(shmRing_t *shmRing, void *data, size_t len, struct sockaddr_storage *addr, socklen_t addrLen) {
+    shmHeader_t *header = shmRing->header;
+    uint64_t size = header->size;
+    uint64_t head = shmRing->position;
+
+    size_t need = ALIGN8(sizeof(shmSlot_t) + len);
+    uint64_t offset = head & shmRing->mask;
+    uint64_t contiguous = size - offset;
+    uint64_t total = contiguous < need ? contiguous + need : need;
+
+    if ((head + total - shmRing->peerCache) > size) {
+        shmRing->peerCache = atomic_load_explicit(&header->tail, memory_order_acquire);
+        if ((head + total - shmRing->peerCache) > size) return SHMRING_FULL;
+    }
+
+    if (contiguous < need) {
+        shmSlot_t *pad = (shmSlot_t *)(shmRing->data + offset);
+        pad->length = contiguous;
+        pad->packetSize = 0;
+        head += contiguous;
+        offset = 0;
+    }
+
+    shmSlot_t *slot = (shmSlot_t *)(shmRing->data + offset);
+    slot->length = need;
+    slot->packetSize = len;
+    slot->storageSize = addrLen;
+    slot->addr = *addr;
+    memcpy(slot->data, data, len);
+    head += need;
+    shmRing->position = head;
+
+    // publish the slot, then check for a sleeping consumer - pairs with ShmRingSleep()
+    atomic_store_explicit(&header->head, head, memory_order_seq_cst);
+    if (atomic_load_explicit(&header->waiting, memory_order_seq_cst) && atomic_exchange(&header->waiting, 0)) return SHMRING_WAKEUP;
+
+    return SHMRING_OK;
+
+}  // End of ShmRingPush
+
+shmSlot_t *ShmRingNext(shmRing_t *shmRing) {
+    shmHeader_t *header = shmRing->header;
+    uint64_t size = header->size;
+
+    while (1) {
+        if (shmRing->position == shmRing->peerCache) {
+            shmRing->peerCache = atomic_load_explicit(&header->head, memory_order_acquire);
+            if (shmRing->position == shmRing->peerCache) return NULL;
+        }
+
+        uint64_t offset = shmRing->position & shmRing->mask;
+        shmSlot_t *slot = (shmSlot_t *)(shmRing->data + offset);
+        uint32_t length = slot->length;
+        if (length < 8 || (length & 7) || length > (size - offset) ||
+            (slot->packetSize && (sizeof(shmSlot_t) + slot->packetSize) > length)) {
+            LogError("ShmRingNext(): corrupt slot at %llu - skip %llu bytes", (unsigned long long)shmRing->position,
+                     (unsigned long long)(shmRing->peerCache - shmRing->position));
+            shmRing->position = shmRing->peerCache;
+            return NULL;
+        }
+
+        shmRing->position += length;
+        // skip pad slots
+        if (slot->packetSize) return slot;
+    }
+
+    // UNREACHED
+}  // End of ShmRingNext
+
+void ShmRingRelease(shmRing_t *shmRing) {
+    atomic_store_explicit(&shmRing->header->tail, shmRing->position, memory_order_release);
+}  // End of ShmRingRelease
+
+int ShmRingSleep(shmRing_t *shmRing) {
+    shmHeader_t *header = shmRing->header;
+
+    // announce sleep, then recheck for data - pairs with ShmRingPush()
+    atomic_store_explicit(&header->waiting, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&header->head, memory_order_seq_cst) == shmRing->position) return 1;
+
+    // more data arrived - a possible wakeup is harmless
+    atomic_store_explicit(&header->waiting, 0, memory_order_relaxed);
+    return 0;
+
+}  // End of ShmRingSleep
+
+void FreeShmRing(shmRing_t *shmRing) {
+    if (!shmRing) return;
+    munmap((void *)shmRing->header, shmRing->mapSize);
+    close(shmRing->fd);
+    free(shmRing);
+}  // End of FreeShmRing
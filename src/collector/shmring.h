@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _SHMRING_H
+#define _SHMRING_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// size of the packet ring between the collector and the repeater
+#define SHMRINGSIZE (4 * 1024 * 1024)
+
+// file descriptor, the ring is passed on to the privsep child
+#define SHMRINGFD 3
+
+/*
+ * Single producer, single consumer ring of datagrams in shared memory.
+ * The ring is created before the privsep fork and inherited by the repeater
+ * as file descriptor SHMRINGFD. The producer only needs to wakeup the consumer,
+ * if it sleeps - ShmRingPush() returns SHMRING_WAKEUP in this case.
+ * The consumer reads slots with ShmRingNext(). The slots remain valid until
+ * ShmRingRelease() returns them to the producer. Before the consumer sleeps,
+ * ShmRingSleep() announces it and returns 0, if more data arrived meanwhile.
+ * Several producer threads must be serialized by the caller.
+ */
+typedef struct shmSlot_s {
+    uint32_t length;  // slot size including header, 8 byte aligned
+    uint32_t packetSize;
+    socklen_t storageSize;
+    uint32_t fill;
+    struct sockaddr_storage addr;
+    uint8_t data[];
+} shmSlot_t;
+
+#define SHMRING_FULL -1
+#define SHMRING_OK 0
+#define SHMRING_WAKEUP 1
+
+typedef struct shmRing_s shmRing_t;
+
+shmRing_t *NewShmRing(size_t size);
+
+shmRing_t *AttachShmRing(int fd);
+
+int ShmRingFD(shmRing_t *shmRing);
+
+int ShmRingPush(shmRing_t *shmRing, void *data, size_t len, struct sockaddr_storage *addr, socklen_t addrLen);
+
+shmSlot_t *ShmRingNext(shmRing_t *shmRing);
+
+void ShmRingRelease(shmRing_t *shmRing);
+
+int ShmRingSleep(shmRing_t *shmRing);
+
+void FreeShmRing(shmRing_t *shmRing);
+
+#endif  // _SHMRING_H
@@ -0,0 +1,363 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Receiver for IPFIX over TCP and SCTP streams (RFC 7011 section 10)
+ * All connections are served by one thread with an edge triggered epoll
+ * or kqueue event loop. The IPFIX messages of a connection are reassembled
+ * from the message length of the IPFIX header. Each message is received
+ * directly into its own buffer, which is passed to the deliver callback
+ * without any further copy. nfpcapd record batches share the version and
+ * length layout of the IPFIX header and are accepted as well.
+ */
+
+#include "streamrecv.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "util.h"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#elif defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__APPLE__)
+#include <sys/event.h>
+#include <sys/time.h>
+#define USE_KQUEUE 1
+#endif
+
+#define IPFIX_VERSION 10
+// size of the IPFIX message header
+#define IPFIX_HEADERSIZE 16
+// version and length of the message header
+#define IPFIX_PEEKSIZE 4
+// nfpcapd record packets and batches - see nfd_raw.h
+#define NFD_VERSION 250
+#define NFD_LZ4_VERSION 251
+
+// max events processed with one call
+#define MAXEVENTS 64
+
+typedef struct streamConn_s {
+    struct streamConn_s *prev;
+    struct streamConn_s *next;
+    int fd;
+    int listener;  // listening socket
+    struct sockaddr_storage peer;
+    socklen_t peerSize;
+    // version and length of the next message
+    uint8_t header[IPFIX_PEEKSIZE];
+    uint32_t headerFill;
+    // message buffer: headroom + message
+    uint8_t *buff;
+    uint32_t msgSize;
+    uint32_t msgFill;
+} streamConn_t;
+
+struct streamReceiver_s {
+    int eventfd;  // epoll or kqueue descriptor
+    size_t headroom;
+    streamDeliver_t deliver;
+    void *arg;
+    uint32_t numListeners;
+    streamConn_t listener[MAXSTREAMSOCKETS];
+    streamConn_t *connections;  // list of open connections
+    uint32_t numConnections;
+};
+
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+
+static int SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LogError("fcntl() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    return 1;
+}  // End of SetNonBlocking
+
+// watch a socket for input - edge triggered
+static int WatchSocket(streamReceiver_t *streamReceiver, streamConn_t *conn) {
+#ifdef USE_EPOLL
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+    if (epoll_ctl(streamReceiver->eventfd, EPOLL_CTL_ADD, conn->fd, &event) < 0) {
+        LogError("epoll_ctl() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+#else
+    struct kevent event;
+    EV_SET(&event, conn->fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, conn);
+    if (kevent(streamReceiver->eventfd, &event, 1, NULL, 0, NULL) < 0) {
+        LogError("kevent() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+#endif
+    return 1;
+}  // End of WatchSocket
+
+static char *PeerString(streamConn_t *conn, char *s, size_t len) {
+    s[0] = '\0';
+    if (conn->peer.ss_family == AF_INET) {
+        struct sockaddr_in *sa = (struct sockaddr_in *)&conn->peer;
+        inet_ntop(AF_INET, &sa->sin_addr, s, len);
+    } else if (conn->peer.ss_family == AF_INET6) {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)&conn->peer;
+        inet_ntop(AF_INET6, &sa6->sin6_addr, s, len);
+    }
+    return s;
+}  // End of PeerString
+
+static void CloseConnection(streamReceiver_t *streamReceiver, streamConn_t *conn) {
+    char peer[INET6_ADDRSTRLEN];
+    LogVerbose("Stream connection from %s closed", PeerString(conn, peer, sizeof(peer)));
+
+    // closing the socket removes it from the event set
+    close(conn->fd);
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        streamReceiver->connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    streamReceiver->numConnections--;
+
+    free(conn->buff);
+    free(conn);
+}  // End of CloseConnection
+
+static void AcceptConnections(streamReceiver_t *streamReceiver, streamConn_t *listener) {
+    while (1) {
+        struct sockaddr_storage peer;
+        socklen_t peerSize = sizeof(peer);
+        int fd = accept(listener->fd, (struct sockaddr *)&peer, &peerSize);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LogError("accept() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            }
+            return;
+        }
+
+        streamConn_t *conn = calloc(1, sizeof(streamConn_t));
+        if (!conn || !SetNonBlocking(fd)) {
+            if (!conn) LogError("calloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->peer = peer;
+        conn->peerSize = peerSize;
+
+        conn->next = streamReceiver->connections;
+        if (conn->next) conn->next->prev = conn;
+        streamReceiver->connections = conn;
+        streamReceiver->numConnections++;
+
+        char peerString[INET6_ADDRSTRLEN];
+        LogVerbose("Stream connection from %s accepted. Connections: %u", PeerString(conn, peerString, sizeof(peerString)),
+                streamReceiver->numConnections);
+
+        if (!WatchSocket(streamReceiver, conn)) CloseConnection(streamReceiver, conn);
+    }
+}  // End of AcceptConnections
+
+// read all available data of a connection - returns 0, if the connection is closed
+static int ReadConnection(streamReceiver_t *streamReceiver, streamConn_t *conn) {
+    while (1) {
+        void *dst;
+        size_t len;
+        if (conn->buff == NULL) {
+            dst = conn->header + conn->headerFill;
+            len = IPFIX_PEEKSIZE - conn->headerFill;
+        } else {
+            dst = conn->buff + streamReceiver->headroom + conn->msgFill;
+            len = conn->msgSize - conn->msgFill;
+        }
+
+        ssize_t cnt = recv(conn->fd, dst, len, 0);
+        if (cnt == 0) return 0;
+        if (cnt < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            LogError("recv() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+
+        if (conn->buff == NULL) {
+            conn->headerFill += cnt;
+            if (conn->headerFill < IPFIX_PEEKSIZE) continue;
+
+            // the message length is known - allocate the message buffer
+            uint16_t version = ntohs(*((uint16_t *)conn->header));
+            uint16_t length = ntohs(*((uint16_t *)(conn->header + 2)));
+            int knownVersion = version == IPFIX_VERSION || version == NFD_VERSION || version == NFD_LZ4_VERSION;
+            if (!knownVersion || length < IPFIX_HEADERSIZE) {
+                char peer[INET6_ADDRSTRLEN];
+                LogError("Stream from %s out of sync: version: %u, length: %u", PeerString(conn, peer, sizeof(peer)), version, length);
+                return 0;
+            }
+            conn->buff = malloc(streamReceiver->headroom + length);
+            if (!conn->buff) {
+                LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                return 0;
+            }
+            memcpy(conn->buff + streamReceiver->headroom, conn->header, IPFIX_PEEKSIZE);
+            conn->msgSize = length;
+            conn->msgFill = IPFIX_PEEKSIZE;
+            conn->headerFill = 0;
+        } else {
+            conn->msgFill += cnt;
+        }
+
+        if (conn->msgFill == conn->msgSize) {
+            // complete message - the callback owns the buffer
+            streamReceiver->deliver(conn->buff, conn->msgSize, &conn->peer, conn->peerSize, streamReceiver->arg);
+            conn->buff = NULL;
+            conn->msgSize = 0;
+            conn->msgFill = 0;
+        }
+    }
+
+    // not reached
+    return 1;
+}  // End of ReadConnection
+
+streamReceiver_t *NewStreamReceiver(int *sockets, uint32_t numSockets, size_t headroom, streamDeliver_t deliver, void *arg) {
+    if (numSockets == 0 || numSockets > MAXSTREAMSOCKETS) {
+        LogError("Invalid number of stream sockets: %u", numSockets);
+        return NULL;
+    }
+
+    streamReceiver_t *streamReceiver = calloc(1, sizeof(streamReceiver_t));
+    if (!streamReceiver) {
+        LogError("calloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    streamReceiver->headroom = headroom;
+    streamReceiver->deliver = deliver;
+    streamReceiver->arg = arg;
+
+#ifdef USE_EPOLL
+    streamReceiver->eventfd = epoll_create1(0);
+#else
+    streamReceiver->eventfd = kqueue();
+#endif
+    if (streamReceiver->eventfd < 0) {
+        LogError("event queue error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(streamReceiver);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < numSockets; i++) {
+        streamConn_t *listener = &(streamReceiver->listener[i]);
+        listener->fd = sockets[i];
+        listener->listener = 1;
+        if (!SetNonBlocking(listener->fd) || !WatchSocket(streamReceiver, listener)) {
+            close(streamReceiver->eventfd);
+            free(streamReceiver);
+            return NULL;
+        }
+        streamReceiver->numListeners++;
+    }
+
+    return streamReceiver;
+}  // End of NewStreamReceiver
+
+void RunStreamReceiver(streamReceiver_t *streamReceiver, _Atomic int *stop) {
+#ifdef USE_EPOLL
+    struct epoll_event events[MAXEVENTS];
+#else
+    struct kevent events[MAXEVENTS];
+    // wake up at least once a second, to check the stop flag
+    struct timespec timeout = {.tv_sec = 1, .tv_nsec = 0};
+#endif
+
+    while (!atomic_load(stop)) {
+#ifdef USE_EPOLL
+        int numEvents = epoll_wait(streamReceiver->eventfd, events, MAXEVENTS, 1000);
+#else
+        int numEvents = kevent(streamReceiver->eventfd, NULL, 0, events, MAXEVENTS, &timeout);
+#endif
+        if (numEvents < 0) {
+            if (errno == EINTR) continue;
+            LogError("event wait error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < numEvents; i++) {
+#ifdef USE_EPOLL
+            streamConn_t *conn = (streamConn_t *)events[i].data.ptr;
+#else
+            streamConn_t *conn = (streamConn_t *)events[i].udata;
+#endif
+            if (conn->listener) {
+                AcceptConnections(streamReceiver, conn);
+            } else if (!ReadConnection(streamReceiver, conn)) {
+                CloseConnection(streamReceiver, conn);
+            }
+        }
+    }
+
+}  // End of RunStreamReceiver
+
+void FreeStreamReceiver(streamReceiver_t *streamReceiver) {
+    if (!streamReceiver) return;
+
+    while (streamReceiver->connections) CloseConnection(streamReceiver, streamReceiver->connections);
+    for (uint32_t i = 0; i < streamReceiver->numListeners; i++) close(streamReceiver->listener[i].fd);
+    close(streamReceiver->eventfd);
+    free(streamReceiver);
+
+}  // End of FreeStreamReceiver
+
+#else
+
+streamReceiver_t *NewStreamReceiver(int *sockets, uint32_t numSockets, size_t headroom, streamDeliver_t deliver, void *arg) {
+    LogError("IPFIX streams are not supported on this system");
+    return NULL;
+}  // End of NewStreamReceiver
+
+void RunStreamReceiver(streamReceiver_t *streamReceiver, _Atomic int *stop) {}
+
+void FreeStreamReceiver(streamReceiver_t *streamReceiver) {}
+
+#endif
@@ -36,11 +36,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -48,11 +51,28 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "config.h"
+
+#ifdef HAVE_FTS_H
+#include <fts.h>
+#else
+#include "fts_compat.h"
+#define fts_children fts_children_compat
+#define fts_close fts_close_compat
+#define fts_open fts_open_compat
+#define fts_read fts_read_compat
+#define fts_set fts_set_compat
+#endif
+
+#include "barrier.h"
+#include "cpufeature.h"
+#include "flist.h"
 #include "ftlib.h"
 #include "nfdump.h"
 #include "nffile.h"
 #include "nfxV3.h"
 #include "output_short.h"
+#include "queue.h"
 #include "util.h"
 #include "version.h"
 
@@ -69,13 +89,36 @@ typedef struct v5_block_s {
     uint8_t data[4];  // link to next record
 } v5_block_t;
 
+// max number of concurrent file converters
+#define MAXCONVERTERS 64
+
+/*
+ * Parameters of the file converters. Each converter pops the next flow-tools
+ * file from the file queue and writes an nfdump file into outDir, named
+ * and placed like the files of nfcapd.
+ */
+typedef struct convertParam_s {
+    queue_t *fileQueue;
+    char *outDir;
+    int subdirs;
+    int compress;
+    uint32_t limitflows;
+    _Atomic uint32_t numFiles;
+    _Atomic uint32_t failed;
+    _Atomic uint64_t numFlows;
+} convertParam_t;
+
+// GetSubDir() returns a static buffer and SetupSubDir() is not safe
+// for concurrent mkdir() of the same directory
+static pthread_mutex_t subdirMutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* externals */
 extern uint32_t Max_num_extensions;
 
 /* prototypes */
 void usage(char *name);
 
-static int flows2nfdump(struct ftio *ftio, char *wfile, int compress, int extended, uint32_t limitflows);
+static int flows2nfdump(struct ftio *ftio, char *wfile, int compress, int extended, uint32_t limitflows, uint64_t *numFlows);
 
 #include "nffile_inline.c"
 
@@ -87,13 +130,19 @@ void usage(char *name) {
         "-c\t\tLimit number of records to convert.\n"
         "-V\t\tPrint version and exit.\n"
         "-r <file>\tread flow-tools records from file\n"
+        "-R <dir>\tconvert all flow-tools files in directory <dir> recursively\n"
         "-w <file>\twrite nfdump records to file\n"
+        "\t\twith -R or multiple files: nfdump base directory for the converted files\n"
+        "-S <num>\tsub directory format of the nfdump base directory. See nfcapd(1)\n"
+        "-W <num>\tnumber of files converted concurrently\n"
         "-z=lzo\t\tLZO compress flows in output file.\n"
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
         "Convert flow-tools format to nfdump format:\n"
-        "ft2nfdump -r <flow-tools-data-file> -w <nfdump-file> [-z]\n",
+        "ft2nfdump -r <flow-tools-data-file> -w <nfdump-file> [-z]\n"
+        "ft2nfdump -R <flow-tools-dir> -w <nfdump-dir> [-S <num>] [-W <num>] [-z]\n"
+        "ft2nfdump -w <nfdump-dir> [-S <num>] [-W <num>] [-z] <flow-tools-file> ..\n",
         name);
 
 }  // End of usage
@@ -152,7 +201,7 @@ static uint16_t *GenExtensionList(struct ftio *ftio, uint32_t *extensionSize, ui
 
 }  // End of GenExtensionList
 
-static int flows2nfdump(struct ftio *ftio, char *wfile, int compress, int extended, uint32_t limitflows) {
+static int flows2nfdump(struct ftio *ftio, char *wfile, int compress, int extended, uint32_t limitflows, uint64_t *numFlows) {
     // required flow tools variables
     struct fttime ftt;
     struct fts3rec_offsets fo;
@@ -179,20 +228,32 @@ static int flows2nfdump(struct ftio *ftio, char *wfile, int compress, int extend
     dbg_printf("GenExtensionList: numElements: %u, recordSize: %u\n", numElements, recordSize);
     if (numElements == 0) {
         LogError("No usable fields found it flowtools file");
+        free(extensionInfo);
+        DisposeFile(nffile);
         return 1;
     }
     recordSize += sizeof(recordHeaderV3_t);
 
-    int cnt = 0;
+    // all records of a flow-tools file have the same size. Fill a block with as
+    // many records as fit, and update the block header only once per block.
+    uint32_t room = (WRITE_BUFFSIZE - 1 - dataBlock->size) / recordSize;
+    uint32_t blockRecords = 0;
+    void *buffPtr = GetCurrentCursor(dataBlock);
+
+    uint32_t cnt = 0;
     while ((rec = ftio_read(ftio))) {
         int i, exID;
         dbg_printf("FT record %u\n", cnt);
-        if (!IsAvailable(dataBlock, recordSize)) {
+        if (room == 0) {
             // flush block - get an empty one
+            dataBlock->NumRecords += blockRecords;
+            dataBlock->size += blockRecords * recordSize;
             dataBlock = WriteBlock(nffile, dataBlock);
+            room = (WRITE_BUFFSIZE - 1 - dataBlock->size) / recordSize;
+            blockRecords = 0;
+            buffPtr = GetCurrentCursor(dataBlock);
         }
 
-        void *buffPtr = GetCurrentCursor(dataBlock);
         AddV3Header(buffPtr, recordHeader);
 
         // header data
@@ -258,9 +319,10 @@ static int flows2nfdump(struct ftio *ftio, char *wfile, int compress, int extend
             i++;
         }
 
-        // update file record size ( -> output buffer size )
-        dataBlock->NumRecords++;
-        dataBlock->size += recordSize;
+        // advance to the next record
+        buffPtr += recordSize;
+        blockRecords++;
+        room--;
 
         dbg_assert(recordHeader->size == recordSize);
 
@@ -273,20 +335,201 @@ static int flows2nfdump(struct ftio *ftio, char *wfile, int compress, int extend
 
     } /* while */
 
+    dataBlock->NumRecords += blockRecords;
+    dataBlock->size += blockRecords * recordSize;
+    free(extensionInfo);
+
     SetIdent(nffile, ident);
     FlushBlock(nffile, dataBlock);
     CloseUpdateFile(nffile);
+    if (numFlows) *numFlows = cnt;
     return 0;
 
 }  // End of flows2nfdump
 
+// build the nfcapd style file name for a flow-tools file, starting at tStart
+static int OutputFileName(convertParam_t *param, time_t tStart, char *wfile, size_t len) {
+    struct tm now;
+    localtime_r(&tStart, &now);
+    char fmt[32];
+    strftime(fmt, sizeof(fmt), "%Y%m%d%H%M", &now);
+
+    int ok = 1;
+    pthread_mutex_lock(&subdirMutex);
+    char *subdir = param->subdirs ? GetSubDir(&now) : NULL;
+    if (subdir) {
+        char error[256];
+        if (SetupSubDir(param->outDir, subdir, error, sizeof(error))) {
+            snprintf(wfile, len, "%s/%s/nfcapd.%s", param->outDir, subdir, fmt);
+        } else {
+            LogError("Failed to create sub hierarchy directories: %s", error);
+            ok = 0;
+        }
+    } else {
+        snprintf(wfile, len, "%s/nfcapd.%s", param->outDir, fmt);
+    }
+
+    // do not overwrite an existing file. It may be from another flow-tools file of the same minute
+    struct stat stat_buf;
+    if (ok && stat(wfile, &stat_buf) == 0) {
+        LogError("Output file '%s' exists. Skip conversion", wfile);
+        ok = 0;
+    }
+    // reserve the name for this converter
+    if (ok) {
+        int fd = open(wfile, O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd < 0) {
+            LogError("open() '%s' failed: %s", wfile, strerror(errno));
+            ok = 0;
+        } else {
+            close(fd);
+        }
+    }
+    pthread_mutex_unlock(&subdirMutex);
+
+    return ok;
+
+}  // End of OutputFileName
+
+static int ConvertFile(convertParam_t *param, char *ftfile) {
+    int fd = open(ftfile, O_RDONLY, 0);
+    if (fd < 0) {
+        LogError("Can't open file '%s': %s", ftfile, strerror(errno));
+        return 0;
+    }
+
+    struct ftio ftio;
+    if (ftio_init(&ftio, fd, FT_IO_FLAG_READ) < 0) {
+        LogError("ftio_init() failed for file '%s'", ftfile);
+        close(fd);
+        return 0;
+    }
+
+    // name the file after the capture start of flow-tools, else after the file modification time
+    time_t tStart;
+    if (ftio.fth.fields & FT_FIELD_CAP_START) {
+        tStart = ftio.fth.cap_start;
+    } else {
+        struct stat stat_buf;
+        tStart = fstat(fd, &stat_buf) == 0 ? stat_buf.st_mtime : time(NULL);
+    }
+
+    char wfile[MAXPATHLEN];
+    int ok = OutputFileName(param, tStart, wfile, sizeof(wfile));
+    if (ok) {
+        uint64_t numFlows = 0;
+        ok = flows2nfdump(&ftio, wfile, param->compress, 0, param->limitflows, &numFlows) == 0;
+        if (ok) {
+            atomic_fetch_add(&param->numFlows, numFlows);
+            printf("%s -> %s: %llu flows\n", ftfile, wfile, (unsigned long long)numFlows);
+        } else {
+            unlink(wfile);
+        }
+    }
+
+    ftio_close(&ftio);
+    close(fd);
+    return ok;
+
+}  // End of ConvertFile
+
+__attribute__((noreturn)) static void *convertThread(void *arg) {
+    convertParam_t *param = (convertParam_t *)arg;
+
+    char *ftfile;
+    while ((ftfile = queue_pop(param->fileQueue)) != QUEUE_CLOSED) {
+        if (ConvertFile(param, ftfile))
+            atomic_fetch_add(&param->numFiles, 1);
+        else
+            atomic_fetch_add(&param->failed, 1);
+        free(ftfile);
+    }
+
+    pthread_exit(NULL);
+
+}  // End of convertThread
+
+static int compare(const FTSENT **f1, const FTSENT **f2) {
+    return strcmp((*f1)->fts_name, (*f2)->fts_name);
+}  // End of compare
+
+// push all flow-tools files of the directory tree into the file queue
+static int QueueSourceDir(queue_t *fileQueue, char *sourceDir) {
+    char *const roots[2] = {sourceDir, NULL};
+    FTS *fts = fts_open(roots, FTS_LOGICAL, compare);
+    if (!fts) {
+        LogError("fts_open() error '%s': %s", sourceDir, strerror(errno));
+        return 0;
+    }
+
+    FTSENT *ftsent;
+    while ((ftsent = fts_read(fts)) != NULL) {
+        // flow-capture names its files ft-*, unfinished files tmp-*
+        if (ftsent->fts_info == FTS_F && strncmp(ftsent->fts_name, "ft-", 3) == 0) {
+            queue_push(fileQueue, strdup(ftsent->fts_path));
+        }
+    }
+    fts_close(fts);
+
+    return 1;
+
+}  // End of QueueSourceDir
+
+static int ConvertFiles(char *sourceDir, char **files, int numFiles, char *outDir, int subdirs, int compress, uint32_t limitflows,
+                        int workers) {
+    struct stat stat_buf;
+    if (stat(outDir, &stat_buf) < 0 || !S_ISDIR(stat_buf.st_mode)) {
+        LogError("No such directory: '%s'", outDir);
+        return 1;
+    }
+    if (subdirs && !InitHierPath(subdirs)) return 1;
+
+    convertParam_t param = {
+        .fileQueue = queue_init(1024),
+        .outDir = outDir,
+        .subdirs = subdirs,
+        .compress = compress,
+        .limitflows = limitflows,
+    };
+    if (!param.fileQueue) return 1;
+
+    int numThreads = GetNumWorkers(workers);
+    if (numThreads > MAXCONVERTERS) numThreads = MAXCONVERTERS;
+
+    pthread_t tid[MAXCONVERTERS];
+    for (int i = 0; i < numThreads; i++) {
+        int err = pthread_create(&tid[i], NULL, convertThread, (void *)&param);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            exit(255);
+        }
+    }
+
+    int ok = 1;
+    if (sourceDir) ok = QueueSourceDir(param.fileQueue, sourceDir);
+    for (int i = 0; i < numFiles; i++) {
+        queue_push(param.fileQueue, strdup(files[i]));
+    }
+    queue_close(param.fileQueue);
+
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    queue_free(param.fileQueue);
+
+    printf("Converted %u files, %llu flows, %u failed\n", atomic_load(&param.numFiles), (unsigned long long)atomic_load(&param.numFlows),
+           atomic_load(&param.failed));
+
+    return ok && atomic_load(&param.failed) == 0 ? 0 : 1;
+
+}  // End of ConvertFiles
+
 int main(int argc, char **argv) {
     struct ftio ftio;
     struct stat statbuf;
     uint32_t limitflows;
-    int i, extended, ret, fd, compress;
-    ;
-    char *ftfile, *wfile;
+    int i, extended, ret, fd, compress, subdirs, workers;
+    char *ftfile, *wfile, *ftdir;
 
     /* init fterr */
     fterr_setid(argv[0]);
@@ -294,10 +537,13 @@ int main(int argc, char **argv) {
     extended = 0;
     limitflows = 0;
     ftfile = NULL;
+    ftdir = NULL;
     wfile = "-";
     compress = LZ4_COMPRESSED;
+    subdirs = 0;
+    workers = 0;
 
-    while ((i = getopt(argc, argv, "jyzEVc:hr:w:?")) != -1) switch (i) {
+    while ((i = getopt(argc, argv, "jyzEVc:hr:w:R:S:W:?")) != -1) switch (i) {
             case 'h': /* help */
             case '?':
                 usage(argv[0]);
@@ -305,6 +551,7 @@ int main(int argc, char **argv) {
                 break;
             case 'V':
                 printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
                 exit(0);
                 break;
             case 'E':
@@ -353,9 +600,27 @@ int main(int argc, char **argv) {
                     exit(255);
                 }
                 break;
+            case 'R':
+                ftdir = optarg;
+                if ((stat(ftdir, &statbuf) < 0) || !S_ISDIR(statbuf.st_mode)) {
+                    fprintf(stderr, "No such directory: '%s'\n", ftdir);
+                    exit(255);
+                }
+                break;
             case 'w':
                 wfile = optarg;
                 break;
+            case 'S':
+                subdirs = atoi(optarg);
+                break;
+            case 'W':
+                CheckArgLen(optarg, 16);
+                workers = atoi(optarg);
+                if (workers < 0 || workers > MAXCONVERTERS) {
+                    LogError("Number of workers out of range 1..%d", MAXCONVERTERS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
 
             default:
                 usage(argv[0]);
@@ -365,7 +630,17 @@ int main(int argc, char **argv) {
         } /* switch */
     // End while
 
-    if (argc - optind) fterr_errx(1, "Extra arguments starting with %s.", argv[optind]);
+    if (ftdir || (argc - optind) > 0) {
+        // convert multiple files into an nfcapd style directory
+        if (ftfile) fterr_errx(1, "Use either -r or -R and multiple files.");
+        if (extended) fterr_errx(1, "Option -E can only be used with a single file.");
+        if (strcmp(wfile, "-") == 0) fterr_errx(1, "Multiple files need an output directory -w <dir>.");
+
+        if (!Init_nffile(0, NULL)) exit(254);
+
+        ret = ConvertFiles(ftdir, argv + optind, argc - optind, wfile, subdirs, compress, limitflows, workers);
+        return ret;
+    }
 
     if (ftfile) {
         fd = open(ftfile, O_RDONLY, 0);
@@ -382,7 +657,7 @@ int main(int argc, char **argv) {
     /* read from fd */
     if (ftio_init(&ftio, fd, FT_IO_FLAG_READ) < 0) fterr_errx(1, "ftio_init(): failed");
 
-    ret = flows2nfdump(&ftio, wfile, compress, extended, limitflows);
+    ret = flows2nfdump(&ftio, wfile, compress, extended, limitflows, NULL);
 
     return ret;
 
@@ -98,6 +98,27 @@ typedef struct recordHandle_s {
 #define OFFflowCount offsetof(recordHandle_t, flowCount)
 #define SIZEflowCount MemberSize(recordHandle_t, flowCount)
     uint32_t numElements;
+    // values derived from the record are computed once on first use - reset by MapRecordHandle()
+    uint32_t derived;
+#define DERIVED_SSL 0x01
+#define DERIVED_JA3 0x02
+#define DERIVED_JA4 0x04
+#define DERIVED_SRCTOR 0x08
+#define DERIVED_DSTTOR 0x10
+// ssl, ja3 and ja4 are owned by the ssl cache - not freed by MapRecordHandle()
+#define CACHED_SSL 0x20
+#define CACHED_JA3 0x40
+#define CACHED_JA4 0x80
+#define DERIVED_SRCLABEL 0x100
+#define DERIVED_DSTLABEL 0x200
+    char torInfo[2][4];
+    // prefix labels of src and dst address - see label.h
+    uint32_t label[2];
+#define OFFsrcLabel offsetof(recordHandle_t, label)
+#define OFFdstLabel offsetof(recordHandle_t, label) + 4
+#define SIZElabel 4
+    // quantile histograms of an aggregated flow, indexed by HISTO_* in loghisto.h
+    struct logHisto_s *histo[3];
     // local slack space
     uint32_t localStack[2];
 } recordHandle_t;
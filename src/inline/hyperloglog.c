@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * HyperLogLog cardinality sketch
+ * A sketch estimates the number of distinct keys with HLLREGISTERS one byte
+ * registers. The standard error is 1.04 / sqrt(HLLREGISTERS), about 0.8%.
+ * Sketches of the same size are merged by the max of each register, therefore
+ * per thread sketches are merged without loss of accuracy.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HLLBITS 14
+#define HLLREGISTERS (1 << HLLBITS)
+
+typedef struct hllSketch_s {
+    uint8_t registers[HLLREGISTERS];
+} hllSketch_t;
+
+// 64bit finalizer of murmur3
+static inline uint64_t hllMix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}  // End of hllMix
+
+// hash of a key of two 64bit values
+static inline uint64_t hllHash(uint64_t v0, uint64_t v1) {
+    //
+    return hllMix(v0 ^ hllMix(v1 + 0x9e3779b97f4a7c15ULL));
+}  // End of hllHash
+
+// hash of a key of variable length
+static inline uint64_t hllHashBytes(const void *ptr, size_t length) {
+    const uint8_t *p = (const uint8_t *)ptr;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return hllMix(h);
+}  // End of hllHashBytes
+
+static inline hllSketch_t *hllNew(void) {
+    //
+    return (hllSketch_t *)calloc(1, sizeof(hllSketch_t));
+}  // End of hllNew
+
+static inline void hllAdd(hllSketch_t *sketch, uint64_t hash) {
+    uint32_t index = hash >> (64 - HLLBITS);
+    // guard bit limits the rank to 64 - HLLBITS + 1
+    uint64_t w = (hash << HLLBITS) | (1ULL << (HLLBITS - 1));
+    uint8_t rank = __builtin_clzll(w) + 1;
+    if (rank > sketch->registers[index]) sketch->registers[index] = rank;
+}  // End of hllAdd
+
+static inline void hllMerge(hllSketch_t *sketch, const hllSketch_t *other) {
+    for (int i = 0; i < HLLREGISTERS; i++) {
+        if (other->registers[i] > sketch->registers[i]) sketch->registers[i] = other->registers[i];
+    }
+}  // End of hllMerge
+
+static inline uint64_t hllEstimate(const hllSketch_t *sketch) {
+    double m = HLLREGISTERS;
+    double sum = 0;
+    uint32_t zeros = 0;
+    for (int i = 0; i < HLLREGISTERS; i++) {
+        sum += 1.0 / (double)(1ULL << sketch->registers[i]);
+        if (sketch->registers[i] == 0) zeros++;
+    }
+
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    // linear counting for small cardinalities
+    if (estimate <= 2.5 * m && zeros) estimate = m * log(m / zeros);
+
+    return (uint64_t)(estimate + 0.5);
+}  // End of hllEstimate
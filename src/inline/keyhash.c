@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * key hashes of the aggregation and element statistic hash tables
+ * Keys of up to 16 bytes are hashed as two 64bit values by the CRC32C instruction,
+ * if supported by the CPU, otherwise by a multiply/xorshift mix. Longer keys of
+ * variable size are hashed by metrohash. The CRC32C support is detected once by
+ * KeyHashInit(), before a hash table is used.
+ */
+
+#include <stdint.h>
+
+#include "metrohash.c"
+
+#include "cpufeature.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define KEYHASH_X86 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#define KEYHASH_ARM 1
+#endif
+
+// -1: not yet detected, 0: mix hash, 1: CRC32C instruction
+static int keyHashCRC = -1;
+
+static void KeyHashInit(void) {
+    if (keyHashCRC >= 0) return;
+    keyHashCRC = 0;
+#if defined(KEYHASH_X86) || defined(KEYHASH_ARM)
+    keyHashCRC = CPUKernel(KERNEL_KEYHASH);
+#endif
+}  // End of KeyHashInit
+
+#ifdef KEYHASH_X86
+__attribute__((target("sse4.2"))) static uint32_t KeyHashCRC(uint64_t v0, uint64_t v1) {
+    //
+    return (uint32_t)_mm_crc32_u64(_mm_crc32_u64(0xFFFFFFFF, v0), v1);
+}  // End of KeyHashCRC
+#endif
+
+#ifdef KEYHASH_ARM
+__attribute__((target("+crc"))) static uint32_t KeyHashCRC(uint64_t v0, uint64_t v1) {
+    //
+    return __crc32cd(__crc32cd(0xFFFFFFFF, v0), v1);
+}  // End of KeyHashCRC
+#endif
+
+// hash of a 16 byte key
+static inline uint32_t KeyHash16(uint64_t v0, uint64_t v1) {
+#if defined(KEYHASH_X86) || defined(KEYHASH_ARM)
+    if (keyHashCRC > 0) return KeyHashCRC(v0, v1);
+#endif
+    uint64_t h = (v0 ^ 0x9e3779b97f4a7c15ULL) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 31) ^ v1) * 0x94d049bb133111ebULL;
+    return (uint32_t)(h ^ (h >> 32));
+}  // End of KeyHash16
+
+// hash of a key of variable size
+static inline uint32_t KeyHashBytes(const void *key, uint32_t len) {
+    //
+    return (uint32_t)metrohash64_1((const uint8_t *)key, len, 0);
+}  // End of KeyHashBytes
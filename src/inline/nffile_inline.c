@@ -33,20 +33,25 @@
 
 static inline int MapRecordHandle(recordHandle_t *handle, recordHeaderV3_t *recordHeaderV3, uint64_t flowCount);
 
+static inline int MapRecordExtensions(recordHandle_t *handle, recordHeaderV3_t *recordHeaderV3, uint64_t flowCount, uint64_t extMask);
+
 static inline dataBlock_t *AppendToBuffer(nffile_t *nffile, dataBlock_t *dataBlock, void *record, size_t required);
 
-static inline int MapRecordHandle(recordHandle_t *handle, recordHeaderV3_t *recordHeaderV3, uint64_t flowCount) {
-    if (handle->extensionList[SSLindex]) free(handle->extensionList[SSLindex]);
-    if (handle->extensionList[JA3index]) free(handle->extensionList[JA3index]);
-    if (handle->extensionList[JA4index]) free(handle->extensionList[JA4index]);
+// map only the extensions in extMask - all other extension slots remain NULL
+// the extensions needed to fix msecFirst of the record are always mapped
+static inline int MapRecordExtensions(recordHandle_t *handle, recordHeaderV3_t *recordHeaderV3, uint64_t flowCount, uint64_t extMask) {
+    if (handle->extensionList[SSLindex] && (handle->derived & CACHED_SSL) == 0) free(handle->extensionList[SSLindex]);
+    if (handle->extensionList[JA3index] && (handle->derived & CACHED_JA3) == 0) free(handle->extensionList[JA3index]);
+    if (handle->extensionList[JA4index] && (handle->derived & CACHED_JA4) == 0) free(handle->extensionList[JA4index]);
 
     memset((void *)handle, 0, sizeof(recordHandle_t));
     handle->recordHeaderV3 = recordHeaderV3;
 
     void *eor = (void *)recordHeaderV3 + recordHeaderV3->size;
+    extMask |= ExtensionBit(EXgenericFlowID) | ExtensionBit(EXnselCommonID) | ExtensionBit(EXnatCommonID);
 
     elementHeader_t *elementHeader = (elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
-    // map all extensions
+    // map the requested extensions
     for (int i = 0; i < recordHeaderV3->numElements; i++) {
         if ((void *)elementHeader > eor) {
             LogError("Mapping record: %" PRIu64 "  - Error - element %d out of bounds", flowCount, i);
@@ -57,7 +62,8 @@ static inline int MapRecordHandle(recordHandle_t *handle, recordHeaderV3_t *reco
             return 0;
         }
         if (elementHeader->type < MAXEXTENSIONS) {
-            handle->extensionList[elementHeader->type] = (void *)elementHeader + sizeof(elementHeader_t);
+            if (extMask & ExtensionBit(elementHeader->type))
+                handle->extensionList[elementHeader->type] = (void *)elementHeader + sizeof(elementHeader_t);
         } else {
             LogInfo("Mapping record: %" PRIu64 " - Skip unknown extension %d Type: %u, Length: %u", flowCount, i, elementHeader->type,
                     elementHeader->length);
@@ -81,7 +87,11 @@ static inline int MapRecordHandle(recordHandle_t *handle, recordHeaderV3_t *reco
         }
     }
     return 1;
-}
+}  // End of MapRecordExtensions
+
+static inline int MapRecordHandle(recordHandle_t *handle, recordHeaderV3_t *recordHeaderV3, uint64_t flowCount) {
+    return MapRecordExtensions(handle, recordHeaderV3, flowCount, ALLEXTENSIONS);
+}  // End of MapRecordHandle
 
 static inline dataBlock_t *AppendToBuffer(nffile_t *nffile, dataBlock_t *dataBlock, void *record, size_t required) {
     if (!IsAvailable(dataBlock, required)) {
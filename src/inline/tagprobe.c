@@ -0,0 +1,89 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Tag probing for linear probing hash tables with a separate 1 byte tag array.
+ * A tag value of 0 marks a free cell, a used cell has the tag 0x80 | (hash & 0x7F).
+ * tagMatch() compares a group of TAGGROUP tags at once and returns a bit mask
+ * of all tags matching 'tag'. 'empty' is set to the bit mask of all free cells.
+ * Bit i corresponds to tags[i]. The caller must make sure, TAGGROUP tags are readable.
+ */
+
+#include <stdint.h>
+
+#define TAGGROUP 16
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+static inline uint32_t tagMatch(const uint8_t *tags, uint8_t tag, uint32_t *empty) {
+    __m128i group = _mm_loadu_si128((const __m128i *)tags);
+    *empty = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_setzero_si128()));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+}  // End of tagMatch
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+#include <arm_neon.h>
+
+// NEON has no movemask - weight every lane with its bit and sum up each half
+static inline uint32_t neonMask(uint8x16_t cmp) {
+    static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t masked = vandq_u8(cmp, vld1q_u8(bits));
+    return (uint32_t)vaddv_u8(vget_low_u8(masked)) | ((uint32_t)vaddv_u8(vget_high_u8(masked)) << 8);
+}  // End of neonMask
+
+static inline uint32_t tagMatch(const uint8_t *tags, uint8_t tag, uint32_t *empty) {
+    uint8x16_t group = vld1q_u8(tags);
+    *empty = neonMask(vceqq_u8(group, vdupq_n_u8(0)));
+    return neonMask(vceqq_u8(group, vdupq_n_u8(tag)));
+}  // End of tagMatch
+
+#else
+
+static inline uint32_t tagMatch(const uint8_t *tags, uint8_t tag, uint32_t *empty) {
+    uint32_t match = 0;
+    uint32_t free = 0;
+    for (int i = 0; i < TAGGROUP; i++) {
+        match |= (uint32_t)(tags[i] == tag) << i;
+        free |= (uint32_t)(tags[i] == 0) << i;
+    }
+    *empty = free;
+    return match;
+}  // End of tagMatch
+
+#endif
+
+// index of lowest set bit of a non zero mask
+#define tagFirst(mask) __builtin_ctz(mask)
+
+// mask of all bits below the lowest set bit of 'empty' - all of 'mask', if 'empty' is 0
+#define tagBefore(mask, empty) ((empty) ? (mask) & (((empty) & -(empty)) - 1) : (mask))
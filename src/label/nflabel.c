@@ -0,0 +1,123 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "label/label.h"
+#include "util.h"
+
+static void usage(char *name) {
+    printf(
+        "usage %s [options] [ip ...]\n"
+        "-h\t\tthis text you see right here.\n"
+        "-l <labelDB>\tprefix label table or nflabel DB to lookup IP addresses.\n"
+        "-w <file>\tcompile the label table of -l into the binary nflabel DB <file>.\n",
+        name);
+}  // End of usage
+
+static void LookupIP(char *ipString) {
+    uint32_t addr[4];
+    uint32_t label = 0;
+    if (inet_pton(PF_INET, ipString, addr) == 1) {
+        label = LookupV4Label(ntohl(addr[0]));
+    } else if (inet_pton(PF_INET6, ipString, addr) == 1) {
+        uint64_t *v6 = (uint64_t *)addr;
+        uint64_t ip[2] = {ntohll(v6[0]), ntohll(v6[1])};
+        label = LookupV6Label(ip);
+    } else {
+        LogError("Not a valid IPv4 or IPv6: %s", ipString);
+        return;
+    }
+    const char *name = LabelName(label);
+    printf("%-40s %s\n", ipString, name ? name : "-");
+}  // End of LookupIP
+
+int main(int argc, char **argv) {
+    char *labelFile = getenv("NFLABELDB");
+    char *wfile = NULL;
+    int c;
+    while ((c = getopt(argc, argv, "hl:w:")) != EOF) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'l':
+                if (!CheckPath(optarg, S_IFREG)) exit(EXIT_FAILURE);
+                labelFile = strdup(optarg);
+                break;
+            case 'w':
+                wfile = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(0);
+        }
+    }
+
+    if (labelFile == NULL) {
+        LogError("Missing label table. -l or NFLABELDB env required");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!LoadLabelDB(labelFile)) {
+        LogError("Failed to load label table %s", labelFile);
+        exit(EXIT_FAILURE);
+    }
+
+    if (wfile) {
+        if (!SaveLabelDB(wfile)) exit(EXIT_FAILURE);
+        printf("Label DB %s: %u labels\n", wfile, NumLabels());
+        exit(EXIT_SUCCESS);
+    }
+
+    if (argc - optind > 0) {
+        while (argc - optind > 0) LookupIP(argv[optind++]);
+    } else {
+        char line[1024];
+        // one IP address per line
+        while (fgets(line, sizeof(line), stdin)) {
+            char *eol = strpbrk(line, "\r\n");
+            if (eol) *eol = '\0';
+            if (*line) LookupIP(line);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,341 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "nfbatch.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter/filter.h"
+#include "nfcolumn.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfxV3.h"
+#include "queue.h"
+#include "util.h"
+
+#include "nffile_inline.c"
+
+#define MAXBATCHWORKERS 64
+#define BATCHQUEUESIZE 64
+
+struct batchReader_s {
+    void *engine;      // compiled filter or NULL
+    uint64_t msecFirst;  // time window of the records
+    uint64_t msecLast;
+    int timeWindow;
+    uint64_t mapMask;  // extensions to map
+
+    queue_t *blockQueue;  // blocks read - reader -> workers
+    queue_t *batchQueue;  // filtered blocks - workers -> caller
+
+    pthread_t readerTID;
+    uint32_t numWorkers;
+    pthread_t workerTID[MAXBATCHWORKERS];
+
+    _Atomic int abort;
+    _Atomic int warnType2;
+
+    // released batches for reuse
+    pthread_mutex_t mutex;
+    recordBatch_t *freeList;
+};
+
+static recordBatch_t *GetBatch(batchReader_t *reader) {
+    pthread_mutex_lock(&reader->mutex);
+    recordBatch_t *batch = reader->freeList;
+    if (batch) reader->freeList = batch->next;
+    pthread_mutex_unlock(&reader->mutex);
+
+    if (batch == NULL) {
+        batch = calloc(1, sizeof(recordBatch_t));
+        if (batch == NULL) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    batch->next = NULL;
+    batch->numRecords = 0;
+    return batch;
+}  // End of GetBatch
+
+static void PutBatch(batchReader_t *reader, recordBatch_t *batch) {
+    if (batch->dataBlock) FreeDataBlock(batch->dataBlock);
+    batch->dataBlock = NULL;
+    if (batch->ident) free(batch->ident);
+    batch->ident = NULL;
+    batch->numRecords = 0;
+
+    pthread_mutex_lock(&reader->mutex);
+    batch->next = reader->freeList;
+    reader->freeList = batch;
+    pthread_mutex_unlock(&reader->mutex);
+}  // End of PutBatch
+
+static void FreeBatch(recordBatch_t *batch) {
+    for (uint32_t i = 0; i < batch->maxRecords; i++) {
+        recordHandle_t *handle = &batch->handles[i];
+        if (handle->extensionList[SSLindex] && (handle->derived & CACHED_SSL) == 0) free(handle->extensionList[SSLindex]);
+        if (handle->extensionList[JA3index] && (handle->derived & CACHED_JA3) == 0) free(handle->extensionList[JA3index]);
+        if (handle->extensionList[JA4index] && (handle->derived & CACHED_JA4) == 0) free(handle->extensionList[JA4index]);
+    }
+    free(batch->handles);
+    if (batch->dataBlock) FreeDataBlock(batch->dataBlock);
+    if (batch->ident) free(batch->ident);
+    free(batch);
+}  // End of FreeBatch
+
+// grow the handle array - new handles must be zero for MapRecordExtensions()
+static void BatchCapacity(recordBatch_t *batch, uint32_t numRecords) {
+    if (numRecords <= batch->maxRecords) return;
+
+    recordHandle_t *handles = realloc(batch->handles, numRecords * sizeof(recordHandle_t));
+    if (handles == NULL) {
+        LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memset((void *)&handles[batch->maxRecords], 0, (numRecords - batch->maxRecords) * sizeof(recordHandle_t));
+    batch->handles = handles;
+    batch->maxRecords = numRecords;
+}  // End of BatchCapacity
+
+static __attribute__((noreturn)) void *BatchReaderThread(void *arg) {
+    batchReader_t *reader = (batchReader_t *)arg;
+
+    uint64_t recordCount = 0;
+    nffile_t *nffile = GetNextFile(NULL);
+    while (nffile) {
+        if (atomic_load(&reader->abort)) {
+            CloseFile(nffile);
+            break;
+        }
+        dataBlock_t *dataBlock = ReadBlock(nffile, NULL);
+        if (dataBlock == NULL) {
+            // EOF - continue with next file
+            if (GetNextFile(nffile) == NULL) break;
+            continue;
+        }
+
+        recordBatch_t *batch = GetBatch(reader);
+        batch->dataBlock = dataBlock;
+        batch->ident = nffile->ident ? strdup(nffile->ident) : NULL;
+        batch->recordCount = recordCount;
+        recordCount += dataBlock->NumRecords;
+        queue_push(reader->blockQueue, batch);
+    }
+
+    if (nffile) DisposeFile(nffile);
+    queue_close(reader->blockQueue);
+
+    pthread_exit(NULL);
+}  // End of BatchReaderThread
+
+// map and filter all records of the block of a batch
+static void FilterBatch(batchReader_t *reader, void *engine, recordBatch_t *batch) {
+    batch->numRecords = 0;
+
+    // expand the required columns of a columnar block
+    if (batch->dataBlock->type == DATA_BLOCK_TYPE_5) {
+        dataBlock_t *v3DataBlock = NewDataBlock();
+        if (!ExpandColumnarBlock(batch->dataBlock, v3DataBlock, reader->mapMask)) {
+            LogError("Corrupt columnar data block. Skip block");
+            v3DataBlock->type = DATA_BLOCK_TYPE_3;
+            v3DataBlock->NumRecords = 0;
+            v3DataBlock->size = 0;
+        }
+        FreeDataBlock(batch->dataBlock);
+        batch->dataBlock = v3DataBlock;
+    }
+
+    dataBlock_t *dataBlock = batch->dataBlock;
+    if (dataBlock->type != DATA_BLOCK_TYPE_3) {
+        if (dataBlock->type == DATA_BLOCK_TYPE_2 && atomic_exchange(&reader->warnType2, 1) == 0)
+            LogError("Batch reader: skip nfdump 1.6.x data blocks - convert the files with nfdump -J");
+        return;
+    }
+
+    BatchCapacity(batch, dataBlock->NumRecords);
+    if (engine) FilterSetParam(engine, batch->ident, NOGEODB);
+
+    uint64_t recordCounter = batch->recordCount;
+    record_header_t *record_ptr = GetCursor(dataBlock);
+    uint32_t sumSize = 0;
+    for (int i = 0; i < dataBlock->NumRecords; i++) {
+        if ((sumSize + record_ptr->size) > dataBlock->size || (record_ptr->size < sizeof(record_header_t))) {
+            LogError("Corrupt data file. Inconsistent block size in %s line %d\n", __FILE__, __LINE__);
+            LogError("DataBlock: count: %u, size: %u. Found: %u, size: %u", dataBlock->NumRecords, dataBlock->size, i, sumSize);
+            break;
+        }
+        sumSize += record_ptr->size;
+        recordCounter++;
+
+        if (record_ptr->type == V3Record) {
+            recordHandle_t *handle = &batch->handles[batch->numRecords];
+            int match = MapRecordExtensions(handle, (recordHeaderV3_t *)record_ptr, recordCounter, reader->mapMask);
+            if (match && reader->timeWindow) {
+                EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)handle->extensionList[EXgenericFlowID];
+                match = genericFlow && genericFlow->msecFirst >= reader->msecFirst && genericFlow->msecLast <= reader->msecLast;
+            }
+            if (match && engine) match = FilterRecord(engine, handle);
+            if (match) batch->numRecords++;
+        }
+
+        // Advance pointer by number of bytes for netflow record
+        record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+    }
+
+}  // End of FilterBatch
+
+static __attribute__((noreturn)) void *BatchWorkerThread(void *arg) {
+    batchReader_t *reader = (batchReader_t *)arg;
+
+    void *engine = reader->engine ? FilterCloneEngine(reader->engine) : NULL;
+    while (1) {
+        recordBatch_t *batch = queue_pop(reader->blockQueue);
+        if (batch == QUEUE_CLOSED) break;
+
+        if (atomic_load(&reader->abort)) {
+            PutBatch(reader, batch);
+            continue;
+        }
+        FilterBatch(reader, engine, batch);
+        queue_push(reader->batchQueue, batch);
+    }
+
+    if (engine) free(engine);
+    queue_close(reader->batchQueue);
+
+    pthread_exit(NULL);
+}  // End of BatchWorkerThread
+
+batchReader_t *OpenBatchReader(char *filter, uint64_t msecFirst, uint64_t msecLast, uint64_t extMask, uint32_t workers) {
+    batchReader_t *reader = calloc(1, sizeof(batchReader_t));
+    if (reader == NULL) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    if (filter && filter[0]) {
+        reader->engine = CompileFilter(filter);
+        if (reader->engine == NULL) {
+            free(reader);
+            return NULL;
+        }
+    }
+
+    // map only the requested extensions and those required by the filter
+    reader->mapMask = extMask ? extMask | ExtensionBit(EXgenericFlowID) : ALLEXTENSIONS;
+    if (extMask && reader->engine) reader->mapMask |= FilterExtensions(reader->engine);
+
+    if (msecFirst || msecLast) {
+        reader->timeWindow = 1;
+        reader->msecFirst = msecFirst;
+        reader->msecLast = msecLast ? msecLast : 0x7FFFFFFFFFFFFFFFLL;
+        SetBlockTimeWindow(reader->msecFirst, reader->msecLast);
+    }
+
+    // skip blocks, which can not match the filter
+    if (reader->engine) {
+        ipKey_t *ipKeys = NULL;
+        uint32_t numIPKeys = FilterIPKeys(reader->engine, &ipKeys);
+        if (numIPKeys) SetBlockIPFilter(ipKeys, numIPKeys);
+        if (FilterSummaryCapable(reader->engine)) SetBlockSummaryFilter(FilterBlockSummary, reader->engine);
+    }
+
+    if (workers == 0) workers = 1;
+    if (workers > MAXBATCHWORKERS) workers = MAXBATCHWORKERS;
+    reader->numWorkers = workers;
+
+    pthread_mutex_init(&reader->mutex, NULL);
+    reader->blockQueue = queue_init(BATCHQUEUESIZE);
+    reader->batchQueue = queue_init(BATCHQUEUESIZE);
+    queue_producers(reader->batchQueue, workers);
+
+    int err = pthread_create(&reader->readerTID, NULL, BatchReaderThread, (void *)reader);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < workers; i++) {
+        err = pthread_create(&reader->workerTID[i], NULL, BatchWorkerThread, (void *)reader);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return reader;
+}  // End of OpenBatchReader
+
+recordBatch_t *NextBatch(batchReader_t *reader) {
+    while (1) {
+        recordBatch_t *batch = queue_pop(reader->batchQueue);
+        if (batch == QUEUE_CLOSED) return NULL;
+        if (batch->numRecords) return batch;
+        // nothing matched in this block
+        PutBatch(reader, batch);
+    }
+
+    // unreached
+}  // End of NextBatch
+
+void ReleaseBatch(batchReader_t *reader, recordBatch_t *batch) {
+    if (batch) PutBatch(reader, batch);
+}  // End of ReleaseBatch
+
+void CloseBatchReader(batchReader_t *reader) {
+    if (reader == NULL) return;
+
+    // stop reading and drain all pending batches
+    atomic_store(&reader->abort, 1);
+    recordBatch_t *batch;
+    while ((batch = queue_pop(reader->batchQueue)) != QUEUE_CLOSED) PutBatch(reader, batch);
+
+    pthread_join(reader->readerTID, NULL);
+    for (uint32_t i = 0; i < reader->numWorkers; i++) pthread_join(reader->workerTID[i], NULL);
+
+    while (reader->freeList) {
+        batch = reader->freeList;
+        reader->freeList = batch->next;
+        FreeBatch(batch);
+    }
+
+    queue_free(reader->blockQueue);
+    queue_free(reader->batchQueue);
+    pthread_mutex_destroy(&reader->mutex);
+
+    if (reader->engine) DisposeFilter(reader->engine);
+    free(reader);
+}  // End of CloseBatchReader
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NFBATCH_H
+#define _NFBATCH_H 1
+
+#include <stdint.h>
+
+#include "nfdump.h"
+#include "nffile.h"
+
+/*
+ * Batch reader API for programs linking libnfdump and libnffile.
+ * The batch reader reads the files of the file list set by Init_nffile() and
+ * returns the matching records block wise as an array of mapped record handles.
+ * Files are read and decompressed by the parallel nffile readers, records are
+ * mapped and filtered by the batch workers. Columnar blocks are expanded, blocks
+ * outside the time window or not matching the filter summary are skipped unread.
+ *
+ *   Init_nffile(workers, SetupInputFileSequence(&flist));
+ *   batchReader_t *reader = OpenBatchReader("proto tcp", 0, 0, 0, 4);
+ *   recordBatch_t *batch;
+ *   while ((batch = NextBatch(reader)) != NULL) {
+ *       for (uint32_t i = 0; i < batch->numRecords; i++) process(&batch->handles[i]);
+ *       ReleaseBatch(reader, batch);
+ *   }
+ *   CloseBatchReader(reader);
+ *
+ * With more than one worker, batches may be returned out of file order.
+ */
+typedef struct recordBatch_s {
+    uint32_t numRecords;      // number of matching records in handles
+    recordHandle_t *handles;  // mapped records - valid until ReleaseBatch()
+    char *ident;              // ident of the source file
+    uint64_t recordCount;     // sequence number of the first record of the block
+
+    // internal
+    dataBlock_t *dataBlock;
+    uint32_t maxRecords;
+    struct recordBatch_s *next;
+} recordBatch_t;
+
+typedef struct batchReader_s batchReader_t;
+
+batchReader_t *OpenBatchReader(char *filter, uint64_t msecFirst, uint64_t msecLast, uint64_t extMask, uint32_t workers);
+
+recordBatch_t *NextBatch(batchReader_t *reader);
+
+void ReleaseBatch(batchReader_t *reader, recordBatch_t *batch);
+
+void CloseBatchReader(batchReader_t *reader);
+
+#endif  // _NFBATCH_H
@@ -36,6 +36,16 @@
 
 #include <string.h>
 
+#include "cpufeature.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHANI 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_neon.h>
+#define ARMSHA2 1
+#endif
+
 #define SHA256_DIGEST_SIZE (256 / 8)
 #define SHA256_BLOCK_SIZE (512 / 8)
 
@@ -131,6 +141,100 @@ static void sha256_transf(sha256_ctx *ctx, const unsigned char *message, unsigne
     }
 }
 
+#ifdef SHANI
+
+// SHA extensions - the state is kept as ABEF/CDGH, 4 rounds per message word group
+__attribute__((target("sha,sse4.1"))) static void sha256_transf_hw(sha256_ctx *ctx, const unsigned char *message, unsigned int block_nb) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&ctx->h[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&ctx->h[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (unsigned int i = 0; i < block_nb; i++) {
+        const unsigned char *sub_block = message + (i << 6);
+        __m128i abefSave = state0;
+        __m128i cdghSave = state1;
+
+        __m128i w[16];
+        for (int j = 0; j < 16; j++) {
+            if (j < 4)
+                w[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(sub_block + 16 * j)), MASK);
+            else
+                w[j] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[j - 4], w[j - 3]), _mm_alignr_epi8(w[j - 1], w[j - 2], 4)),
+                                            w[j - 1]);
+            __m128i msg = _mm_add_epi32(w[j], _mm_loadu_si128((const __m128i *)&sha256_k[4 * j]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)&ctx->h[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *)&ctx->h[4], _mm_alignr_epi8(state1, tmp, 8));
+
+}  // End of sha256_transf_hw
+
+#endif
+
+#ifdef ARMSHA2
+
+__attribute__((target("+crypto"))) static void sha256_transf_hw(sha256_ctx *ctx, const unsigned char *message, unsigned int block_nb) {
+    uint32x4_t state0 = vld1q_u32(&ctx->h[0]);
+    uint32x4_t state1 = vld1q_u32(&ctx->h[4]);
+
+    for (unsigned int i = 0; i < block_nb; i++) {
+        const unsigned char *sub_block = message + (i << 6);
+        uint32x4_t abcdSave = state0;
+        uint32x4_t efghSave = state1;
+
+        uint32x4_t w[16];
+        for (int j = 0; j < 16; j++) {
+            if (j < 4)
+                w[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(sub_block + 16 * j)));
+            else
+                w[j] = vsha256su1q_u32(vsha256su0q_u32(w[j - 4], w[j - 3]), w[j - 2], w[j - 1]);
+            uint32x4_t msg = vaddq_u32(w[j], vld1q_u32(&sha256_k[4 * j]));
+            uint32x4_t abcd = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, abcd, msg);
+        }
+
+        state0 = vaddq_u32(state0, abcdSave);
+        state1 = vaddq_u32(state1, efghSave);
+    }
+
+    vst1q_u32(&ctx->h[0], state0);
+    vst1q_u32(&ctx->h[4], state1);
+
+}  // End of sha256_transf_hw
+
+#endif
+
+#if defined(SHANI) || defined(ARMSHA2)
+// use the SHA instructions of the CPU, if available. -1: not yet checked
+static int hwSHA = -1;
+#endif
+
+static void sha256_block(sha256_ctx *ctx, const unsigned char *message, unsigned int block_nb) {
+    if (block_nb == 0) return;
+#if defined(SHANI) || defined(ARMSHA2)
+    // a concurrent first check stores the same value
+    if (hwSHA < 0) hwSHA = CPUKernel(KERNEL_SHA256);
+    if (hwSHA) {
+        sha256_transf_hw(ctx, message, block_nb);
+        return;
+    }
+#endif
+    sha256_transf(ctx, message, block_nb);
+
+}  // End of sha256_block
+
 static void sha256_init(sha256_ctx *ctx) {
     int i;
     for (i = 0; i < 8; i++) {
@@ -161,8 +265,8 @@ static void sha256_update(sha256_ctx *ctx, const unsigned char *message, unsigne
 
     shifted_message = message + rem_len;
 
-    sha256_transf(ctx, ctx->block, 1);
-    sha256_transf(ctx, shifted_message, block_nb);
+    sha256_block(ctx, ctx->block, 1);
+    sha256_block(ctx, shifted_message, block_nb);
 
     rem_len = new_len % SHA256_BLOCK_SIZE;
 
@@ -188,7 +292,7 @@ static void sha256_final(sha256_ctx *ctx, unsigned char *digest) {
     ctx->block[ctx->len] = 0x80;
     UNPACK32(len_b, ctx->block + pm_len - 4);
 
-    sha256_transf(ctx, ctx->block, block_nb);
+    sha256_block(ctx, ctx->block, block_nb);
 
     for (i = 0; i < 8; i++) {
         UNPACK32(ctx->h[i], &digest[i << 2]);
@@ -38,6 +38,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -46,7 +47,10 @@
 #include "filter.h"
 #include "ja3/ja3.h"
 #include "ja4/ja4.h"
+#include "label/label.h"
 #include "maxmind/maxmind.h"
+#include "patternset.h"
+#include "prefixtrie.h"
 #include "sgregex.h"
 #include "tor/tor.h"
 #include "util.h"
@@ -85,10 +89,18 @@ typedef struct filterElement {
     data_t data;              /* any additional data for this block */
 } filterElement_t;
 
+struct filterProgram_s;
+
 typedef struct FilterEngine_s {
     filterElement_t *filter;
+    struct filterProgram_s *program;  // compiled filter tree
     uint32_t StartNode;
     uint16_t Extended;
+    uint64_t extMask;  // extensions referenced by the filter
+    ipKey_t *ipKeys;   // IP addresses of which any must be in a matching flow
+    uint32_t numIPKeys;
+    uint32_t numBlocks;     // number of filter elements
+    uint32_t summaryNodes;  // number of elements, testable by a block summary
     int hasGeoDB;
     const char *ident;
     char *label;
@@ -111,6 +123,7 @@ static uint64_t mpls_any_function(void *dataPtr, uint32_t length, data_t data, r
 static uint64_t pblock_function(void *dataPtr, uint32_t length, data_t data, recordHandle_t *handle);
 static uint64_t mmASLookup_function(void *dataPtr, uint32_t length, data_t data, recordHandle_t *handle);
 static uint64_t torLookup_function(void *dataPtr, uint32_t length, data_t data, recordHandle_t *handle);
+static uint64_t labelLookup_function(void *dataPtr, uint32_t length, data_t data, recordHandle_t *handle);
 
 /* flow pre-processing functions */
 static void *ssl_preproc(uint32_t length, data_t data, recordHandle_t *handle);
@@ -137,6 +150,7 @@ static struct flow_procs_map_s {
                             [FUNC_PBLOCK] = {"pblock", pblock_function},
                             [FUNC_MMAS_LOOKUP] = {"AS Lookup", mmASLookup_function},
                             [FUNC_TOR_LOOKUP] = {"TOR Lookup", torLookup_function},
+                            [FUNC_LABEL_LOOKUP] = {"Label Lookup", labelLookup_function},
                             {NULL, NULL}};
 
 static struct preprocess_s {
@@ -301,69 +315,25 @@ static uint64_t mmASLookup_function(void *dataPtr, uint32_t length, data_t data,
 }  // End of mmASLookup_function
 
 static uint64_t torLookup_function(void *dataPtr, uint32_t length, data_t data, recordHandle_t *recordHandle) {
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-    if (!genericFlow) return 0;
-
-    uint64_t isTor = 0;
-    char info[4];
-    if (length == 4) {  // IPv4
-        uint32_t IPv4 = *((uint32_t *)dataPtr);
-        isTor = LookupV4Tor(IPv4, genericFlow->msecFirst, genericFlow->msecLast, info);
-    } else if (length == 16) {  // IPv6
-        isTor = LookupV6Tor((uint64_t *)dataPtr, genericFlow->msecFirst, genericFlow->msecLast, info);
-    }
-
-    return isTor;
+    // data holds the direction - 0 = src, 1 = dst
+    return GetRecordTor(recordHandle, data.dataVal, NULL);
 }  // End of torLookup_function
 
-static void *ssl_preproc(uint32_t length, data_t data, recordHandle_t *handle) {
-    const uint8_t *payload = (uint8_t *)(handle->extensionList[EXinPayloadID]);
-    if (payload == NULL) return NULL;
-
-    ssl_t *ssl = handle->extensionList[SSLindex];
-    if (ssl) return (void *)ssl;
-
-    uint32_t payloadLength = ExtensionLength(payload);
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)(handle->extensionList[EXgenericFlowID]);
-    if (genericFlow->proto == IPPROTO_TCP) ssl = sslProcess(payload, payloadLength);
-    handle->extensionList[SSLindex] = ssl;
-    return ssl;
+static uint64_t labelLookup_function(void *dataPtr, uint32_t length, data_t data, recordHandle_t *recordHandle) {
+    // data holds the direction - 0 = src, 1 = dst
+    return GetRecordLabel(recordHandle, data.dataVal);
+}  // End of labelLookup_function
 
+static void *ssl_preproc(uint32_t length, data_t data, recordHandle_t *handle) {
+    return GetRecordSSL(handle);
 }  // End of ssl_preproc
 
 static void *ja3_preproc(uint32_t length, data_t data, recordHandle_t *handle) {
-    const uint8_t *payload = (const uint8_t *)handle->extensionList[EXinPayloadID];
-    if (payload == NULL) return NULL;
-
-    // return ja3 string if it already exists
-    if (handle->extensionList[JA3index]) return handle->extensionList[JA3index];
-
-    ssl_t *ssl = handle->extensionList[SSLindex];
-    if (ssl == NULL) ssl = ssl_preproc(length, data, handle);
-    if (!ssl) return NULL;
-
-    handle->extensionList[SSLindex] = (void *)ssl;
-    handle->extensionList[JA3index] = ja3Process(ssl, NULL);
-
-    return handle->extensionList[JA3index];
-
+    return GetRecordJA3(handle);
 }  // End of ja3_preproc
 
 static void *ja4_preproc(uint32_t length, data_t data, recordHandle_t *handle) {
-    const uint8_t *payload = (uint8_t *)(handle->extensionList[EXinPayloadID]);
-    if (payload == NULL) return NULL;
-
-    // return ja4 struct if it already exists
-    if (handle->extensionList[JA4index]) return handle->extensionList[JA4index];
-
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)(handle->extensionList[EXgenericFlowID]);
-
-    ssl_t *ssl = ssl_preproc(length, data, handle);
-    if (ssl == NULL || ssl->type != CLIENTssl) return NULL;
-
-    handle->extensionList[JA4index] = (void *)ja4Process(ssl, genericFlow->proto);
-    return handle->extensionList[JA4index];
-
+    return GetRecordJA4(handle);
 }  // End of ja4_preproc
 
 static void *as_preproc(uint32_t length, data_t data, recordHandle_t *handle) {
@@ -489,20 +459,66 @@ uint32_t Invert(uint32_t a) {
 
 } /* End of Invert */
 
+/*
+ * Static cost estimate for evaluating a single node
+ * plain field compare < string compare < IP/value list < AS/geo/tor/label lookup < payload parsing < regex
+ */
+static uint32_t NodeCost(const filterElement_t *node) {
+    if (node->comp == CMP_REGEX) return 64;
+    if (node->comp == CMP_PAYLOAD || node->extID >= MAXEXTENSIONS) return 32;
+    if (node->comp == CMP_GEO || node->function == mmASLookup_function || node->function == torLookup_function ||
+        node->function == labelLookup_function)
+        return 16;
+    if (node->comp == CMP_IPLIST || node->comp == CMP_U64LIST) return 4;
+    if (node->function != NULL) return 2;
+    if (node->comp == CMP_STRING || node->comp == CMP_SUBSTRING || node->comp == CMP_BINARY || node->comp == CMP_IDENT) return 2;
+    return 1;
+}  // End of NodeCost
+
+/*
+ * Worst case cost of evaluating all nodes of superblock a
+ */
+static uint32_t BlockCost(uint32_t a) {
+    uint32_t cost = 0;
+    for (int i = 0; i < FilterTree[a].numblocks; i++) {
+        cost += NodeCost(&FilterTree[FilterTree[a].blocklist[i]]);
+    }
+    return cost;
+}  // End of BlockCost
+
+/*
+ * Select the evaluation order of the operands b1 and b2 of AND/OR
+ * AND and OR are commutative, so the cheaper block is evaluated first and
+ * short cuts the more expensive one. On equal costs, the block with less
+ * children becomes the superblock. Block 'any' appended as last element
+ * is not reordered, for all prepending blocks to be evaluated.
+ */
+static void OrderBlocks(uint32_t b1, uint32_t b2, uint32_t *a, uint32_t *b) {
+    int first = 1;
+    if (FilterTree[b2].data.dataVal != -1) {
+        uint32_t cost1 = BlockCost(b1);
+        uint32_t cost2 = BlockCost(b2);
+        if (cost1 != cost2)
+            first = cost1 < cost2;
+        else
+            first = FilterTree[b1].numblocks <= FilterTree[b2].numblocks;
+    }
+    if (first) {
+        *a = b1;
+        *b = b2;
+    } else {
+        *a = b2;
+        *b = b1;
+    }
+}  // End of OrderBlocks
+
 /*
  * Connects the two blocks b1 and b2 ( AND ) and returns index of superblock
  */
 uint32_t Connect_AND(uint32_t b1, uint32_t b2) {
     uint32_t a, b, i, j;
 
-    // do not optimise blocks if block 'any' is appended
-    if ((FilterTree[b2].data.dataVal == -1) || (FilterTree[b1].numblocks <= FilterTree[b2].numblocks)) {
-        a = b1;
-        b = b2;
-    } else {
-        a = b2;
-        b = b1;
-    }
+    OrderBlocks(b1, b2, &a, &b);
     /* a points to block with less children and becomes the superblock
      * connect b to a
      */
@@ -529,15 +545,7 @@ uint32_t Connect_AND(uint32_t b1, uint32_t b2) {
 uint32_t Connect_OR(uint32_t b1, uint32_t b2) {
     uint32_t a, b, i, j;
 
-    // do not optimise block 'any' if appended as lastelement
-    // for all prepending blocks to be evaluated.
-    if ((FilterTree[b2].data.dataVal == -1) || (FilterTree[b1].numblocks <= FilterTree[b2].numblocks)) {
-        a = b1;
-        b = b2;
-    } else {
-        a = b2;
-        b = b1;
-    }
+    OrderBlocks(b1, b2, &a, &b);
     /* a points to block with less children and becomes the superblock
      * connect b to a
      */
@@ -632,26 +640,78 @@ int FilterRecord(const void *engine, recordHandle_t *handle) {
     return filterEngine->filterFunction(filterEngine, handle);
 }  // End of FilterRecord
 
+// evaluate a single node of a fast filter tree
+static inline int EvalFastNode(const FilterEngine_t *engine, uint32_t index, recordHandle_t *handle) {
+    void *inPtr = handle->extensionList[engine->filter[index].extID];
+    if (inPtr == NULL) return 0;
+    inPtr += engine->filter[index].offset;
+
+    uint64_t inVal = 0;
+    dbg_assert(engine->filter[index].length <= 8);
+    switch (engine->filter[index].length) {
+        case 0:
+            break;
+        case 1:
+            inVal = *((uint8_t *)inPtr);
+            break;
+        case 2:
+            inVal = *((uint16_t *)inPtr);
+            break;
+        case 4:
+            inVal = *((uint32_t *)inPtr);
+            break;
+        case 8:
+            inVal = *((uint64_t *)inPtr);
+            break;
+        default:
+            memcpy((void *)&inVal, inPtr, engine->filter[index].length);
+    }
+
+    // printf("Value: %.16llx, : %.16llx\n", (long long unsigned)inVal, engine->filter[index].value);
+    return inVal == engine->filter[index].value;
+
+}  // End of EvalFastNode
+
 static int RunFilterFast(const FilterEngine_t *engine, recordHandle_t *handle) {
     uint32_t index = engine->StartNode;
     int invert = 0;
     int evaluate = 0;
     while (index) {
-        size_t offset = engine->filter[index].offset;
-        uint32_t extID = engine->filter[index].extID;
         invert = engine->filter[index].invert;
+        evaluate = EvalFastNode(engine, index, handle);
+        index = evaluate ? engine->filter[index].OnTrue : engine->filter[index].OnFalse;
+    }
+    return invert ? !evaluate : evaluate;
 
-        void *inPtr = handle->extensionList[extID];
+}  // End of RunFilter
+
+// evaluate a single node of the filter tree
+static int EvalNode(const FilterEngine_t *engine, uint32_t index, recordHandle_t *handle) {
+    int evaluate = 0;
+    uint32_t extID = engine->filter[index].extID;
+    size_t offset = engine->filter[index].offset;
+
+    void *inPtr = handle->extensionList[extID];
+    if (inPtr == NULL) {
+        if (preprocess_map[extID].function == NULL) {
+            return 0;
+        }
+        data_t data = engine->filter[index].data;
+        uint32_t length = engine->filter[index].length;
+        inPtr = preprocess_map[extID].function(length, data, handle);
         if (inPtr == NULL) {
-            evaluate = 0;
-            index = engine->filter[index].OnFalse;
-            continue;
+            return 0;
         }
-        inPtr += offset;
+    }
+    inPtr += offset;
 
-        uint64_t inVal = 0;
-        dbg_assert(engine->filter[index].length <= 8);
-        switch (engine->filter[index].length) {
+    data_t data = engine->filter[index].data;
+    uint32_t length = engine->filter[index].length;
+    uint64_t inVal = 0;
+    if (engine->filter[index].function != NULL) {
+        inVal = engine->filter[index].function(inPtr, length, data, handle);
+    } else {
+        switch (length) {
             case 0:
                 break;
             case 1:
@@ -665,169 +725,1163 @@ static int RunFilterFast(const FilterEngine_t *engine, recordHandle_t *handle) {
                 break;
             case 8:
                 inVal = *((uint64_t *)inPtr);
+            case 3:
+            case 5:
+            case 7:
+                memcpy((void *)&inVal, inPtr, length);
                 break;
-            default:
-                memcpy((void *)&inVal, inPtr, engine->filter[index].length);
         }
+    }
 
-        // printf("Value: %.16llx, : %.16llx\n", (long long unsigned)inVal, engine->filter[index].value);
-        evaluate = inVal == engine->filter[index].value;
-        index = evaluate ? engine->filter[index].OnTrue : engine->filter[index].OnFalse;
+    switch (engine->filter[index].comp) {
+        case CMP_EQ:
+            evaluate = inVal == engine->filter[index].value;
+            break;
+        case CMP_GT:
+            evaluate = inVal > engine->filter[index].value;
+            break;
+        case CMP_LT:
+            evaluate = inVal < engine->filter[index].value;
+            break;
+        case CMP_GE:
+            evaluate = inVal >= engine->filter[index].value;
+            break;
+        case CMP_LE:
+            evaluate = inVal <= engine->filter[index].value;
+            break;
+        case CMP_FLAGS: {
+            evaluate = (inVal & engine->filter[index].value) == engine->filter[index].value;
+        } break;
+        case CMP_IDENT: {
+            char *str = (char *)data.dataPtr;
+            evaluate = str != NULL && (strcmp(engine->ident, str) == 0 ? 1 : 0);
+        } break;
+        case CMP_STRING: {
+            char *str = (char *)data.dataPtr;
+            evaluate = str != NULL && (strcmp(inPtr, str) == 0 ? 1 : 0);
+        } break;
+        case CMP_SUBSTRING: {
+            char *str = (char *)data.dataPtr;
+            evaluate = str != NULL && (strstr(inPtr, str) != NULL ? 1 : 0);
+        } break;
+        case CMP_BINARY: {
+            void *dataPtr = data.dataPtr;
+            evaluate = dataPtr != NULL && memcmp(inPtr, dataPtr, length) == 0;
+        } break;
+        case CMP_NET: {
+            uint64_t mask = data.dataVal;
+            evaluate = (inVal & mask) == engine->filter[index].value;
+        } break;
+        case CMP_IPLIST: {
+            if (length == 4) {
+                struct IPListNode find = {.ip[0] = 0, .ip[1] = inVal, .mask[0] = 0xffffffffffffffffLL, .mask[1] = 0xffffffffffffffffLL};
+                evaluate = RB_FIND(IPtree, data.dataPtr, &find) != NULL;
+            } else if (length == 16) {
+                struct IPListNode find = {.ip[0] = *((uint64_t *)inPtr),
+                                          .ip[1] = *((uint64_t *)(inPtr + 8)),
+                                          .mask[0] = 0xffffffffffffffffLL,
+                                          .mask[1] = 0xffffffffffffffffLL};
+                evaluate = RB_FIND(IPtree, data.dataPtr, &find) != NULL;
+            } else {
+                evaluate = 0;
+            }
+        } break;
+        case CMP_U64LIST: {
+            struct U64ListNode find = {.value = inVal};
+            evaluate = RB_FIND(U64tree, data.dataPtr, &find) != NULL;
+        } break;
+        case CMP_PAYLOAD: {
+            char *payload = (char *)(handle->extensionList[extID]);
+            char *string = (char *)engine->filter[index].data.dataPtr;
+            uint32_t len = ExtensionLength(payload);
+            evaluate = 0;
+            if (string != NULL) {
+                // find any string str in payload data inPtr, even beyond '\0' bytes
+                int m = 0;
+                for (int i = 0; i < len; i++) {
+                    if (payload[i] == string[m]) {
+                        m++;
+                        if (string[m] == '\0') {
+                            evaluate = 1;
+                            break;
+                        }
+                    } else {
+                        m = 0;
+                    }
+                }
+            }
+        } break;
+        case CMP_REGEX: {
+            srx_Context *program = (srx_Context *)data.dataPtr;
+            char *payload = (char *)(handle->extensionList[extID]);
+            uint32_t len = ExtensionLength(payload);
+
+            evaluate = program != NULL && srx_MatchExt(program, payload, len, 0);
+        } break;
+        case CMP_GEO: {
+            char *geoChar = (char *)inPtr;
+            if (engine->hasGeoDB && geoChar[0] == '\0') inVal = geoLookup(geoChar, data.dataVal, handle);
+            evaluate = inVal == engine->filter[index].value;
+        } break;
     }
-    return invert ? !evaluate : evaluate;
+    return evaluate;
 
-}  // End of RunFilter
+}  // End of EvalNode
 
 static int RunExtendedFilter(const FilterEngine_t *engine, recordHandle_t *handle) {
     uint32_t index = engine->StartNode;
     int evaluate = 0;
     int invert = 0;
     while (index) {
-        uint32_t extID = engine->filter[index].extID;
-        size_t offset = engine->filter[index].offset;
         invert = engine->filter[index].invert;
+        evaluate = EvalNode(engine, index, handle);
+        index = evaluate ? engine->filter[index].OnTrue : engine->filter[index].OnFalse;
+    }
+    return invert ? !evaluate : evaluate;
+}  // End of RunFilter
 
-        void *inPtr = handle->extensionList[extID];
-        if (inPtr == NULL) {
-            if (preprocess_map[extID].function == NULL) {
-                evaluate = 0;
-                index = engine->filter[index].OnFalse;
-                continue;
+/*
+ * Compiled filter program
+ * CompileFilter() lowers the filter tree into a flat array of instructions. Only nodes
+ * reachable from the StartNode are compiled, jump targets are resolved to program
+ * indices and the common compare operations are specialized by value size with the
+ * compare value embedded. All other nodes call the tree node evaluation. The program
+ * is executed as threaded code with computed gotos, if the compiler supports it.
+ * String compares of the same field are collected into a multi pattern set, which
+ * answers all compares of the field with a single scan per record.
+ */
+
+// minimum number of string compares on a field to build a pattern set
+#define MINPATTERNS 4
+// max number of pattern sets and pattern bits of all sets in a program
+#define MAXPATTERNSCANS 32
+#define MAXPATTERNWORDS 64
+
+// specialized compare operations - order must match the dispatch table
+enum {
+    OP_GENERIC = 0,
+    OP_EQ_8,
+    OP_EQ_16,
+    OP_EQ_32,
+    OP_EQ_64,
+    OP_GT_8,
+    OP_GT_16,
+    OP_GT_32,
+    OP_GT_64,
+    OP_LT_8,
+    OP_LT_16,
+    OP_LT_32,
+    OP_LT_64,
+    OP_GE_8,
+    OP_GE_16,
+    OP_GE_32,
+    OP_GE_64,
+    OP_LE_8,
+    OP_LE_16,
+    OP_LE_32,
+    OP_LE_64,
+    OP_FLAGS_8,
+    OP_FLAGS_16,
+    OP_FLAGS_32,
+    OP_FLAGS_64,
+    OP_NET_8,
+    OP_NET_16,
+    OP_NET_32,
+    OP_NET_64,
+    OP_IPLIST4,
+    OP_IPLIST6,
+    OP_STRING,
+    OP_SUBSTRING,
+    OP_MAX
+};
+
+typedef struct filterInstr_s {
+    uint16_t op;      // opcode
+    uint16_t invert;  // invert result of test
+    uint32_t extID;   // extension to test
+    uint32_t offset;  // offset of value in extension
+    uint32_t node;    // index of node in filter tree
+    uint32_t OnTrue;  // program index, 0 = end of program
+    uint32_t OnFalse;
+    uint64_t value;  // compare value
+    union {
+        uint64_t mask;             // CMP_NET mask, pattern bit of OP_STRING/OP_SUBSTRING
+                                   // the value of OP_STRING/OP_SUBSTRING holds the pattern set
+                                   // and the last instruction of the same set in the OnFalse chain
+        const prefixTrie_t *trie;  // CMP_IPLIST prefix set
+    };
+} filterInstr_t;
+
+// field scanned by a pattern set
+typedef struct patternScan_s {
+    uint32_t extID;
+    uint32_t offset;
+    uint32_t length;   // size of string field, 0 = unknown
+    uint32_t payload;  // scan entire extension as binary data
+    uint32_t bitBase;  // first word of the pattern bits
+    patternSet_t *set;
+} patternScan_t;
+
+struct blockPlan_s;
+
+typedef struct filterProgram_s {
+    uint32_t numScans;
+    patternScan_t scan[MAXPATTERNSCANS];
+    struct blockPlan_s *blockPlan;  // block evaluation plan, NULL if the program does not qualify
+    uint32_t numInstr;
+    filterInstr_t instr[];  // instr[0] unused - index 0 terminates the program
+} filterProgram_t;
+
+// IP lists are compiled into prefix tries - one for IPv4 and IPv6 for each list
+typedef struct trieCache_s {
+    IPlist_t *list;
+    prefixTrie_t *trie[2];
+} trieCache_t;
+
+static prefixTrie_t *BuildIPTrie(IPlist_t *list, int af) {
+    prefixTrie_t *trie = NewPrefixTrie(af);
+    if (!trie) return NULL;
+
+    struct IPListNode *node;
+    RB_FOREACH(node, IPtree, list) {
+        if (node->af != af) continue;
+        uint32_t prefixLen = af == PF_INET6 ? __builtin_popcountll(node->mask[0]) + __builtin_popcountll(node->mask[1])
+                                            : __builtin_popcountll(node->mask[1] & 0xFFFFFFFFULL);
+        if (!PrefixTrieInsert(trie, node->ip, prefixLen, 1)) {
+            FreePrefixTrie(trie);
+            return NULL;
+        }
+    }
+    if (!PrefixTrieBuild(trie)) {
+        FreePrefixTrie(trie);
+        return NULL;
+    }
+    return trie;
+
+}  // End of BuildIPTrie
+
+static const prefixTrie_t *GetIPTrie(trieCache_t *cache, uint32_t *numCache, IPlist_t *list, int af) {
+    uint32_t i = 0;
+    while (i < *numCache && cache[i].list != list) i++;
+    if (i == *numCache) {
+        cache[i] = (trieCache_t){.list = list};
+        (*numCache)++;
+    }
+    int index = af == PF_INET6 ? 1 : 0;
+    if (cache[i].trie[index] == NULL) cache[i].trie[index] = BuildIPTrie(list, af);
+
+    return cache[i].trie[index];
+
+}  // End of GetIPTrie
+
+static int IsPatternNode(const FilterEngine_t *engine, const filterElement_t *node) {
+    if (!engine->Extended || node->function != NULL || node->extID >= MAXLISTSIZE) return 0;
+    if (node->comp != CMP_STRING && node->comp != CMP_SUBSTRING && node->comp != CMP_PAYLOAD) return 0;
+    return node->data.dataPtr != NULL && ((char *)node->data.dataPtr)[0] != '\0';
+
+}  // End of IsPatternNode
+
+static int SameField(const filterElement_t *a, const filterElement_t *b) {
+    if (a->extID != b->extID) return 0;
+    if (a->comp == CMP_PAYLOAD || b->comp == CMP_PAYLOAD) return a->comp == b->comp;
+    return a->offset == b->offset;
+
+}  // End of SameField
+
+// collect string compares of the same field into pattern sets
+static void CompilePatterns(const FilterEngine_t *engine, filterProgram_t *program) {
+    uint8_t *done = calloc(program->numInstr, sizeof(uint8_t));
+    if (!done) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    uint32_t numWords = 0;
+    for (uint32_t i = 1; i < program->numInstr && program->numScans < MAXPATTERNSCANS; i++) {
+        const filterElement_t *node = &(engine->filter[program->instr[i].node]);
+        if (done[i] || !IsPatternNode(engine, node)) continue;
+
+        uint32_t count = 0;
+        for (uint32_t j = i; j < program->numInstr; j++) {
+            const filterElement_t *n = &(engine->filter[program->instr[j].node]);
+            if (!done[j] && IsPatternNode(engine, n) && SameField(node, n)) {
+                done[j] = 1;
+                count++;
             }
-            data_t data = engine->filter[index].data;
-            uint32_t length = engine->filter[index].length;
-            inPtr = preprocess_map[extID].function(length, data, handle);
-            if (inPtr == NULL) {
-                evaluate = 0;
-                index = engine->filter[index].OnFalse;
-                continue;
+        }
+        if (count < MINPATTERNS) continue;
+
+        patternSet_t *set = NewPatternSet();
+        if (!set) break;
+        int ok = 1;
+        for (uint32_t j = i; j < program->numInstr && ok; j++) {
+            filterInstr_t *instr = &(program->instr[j]);
+            const filterElement_t *n = &(engine->filter[instr->node]);
+            if (!IsPatternNode(engine, n) || !SameField(node, n)) continue;
+            int id = PatternSetAdd(set, n->data.dataPtr, strlen(n->data.dataPtr));
+            ok = id >= 0;
+            instr->mask = id;
+        }
+        ok = ok && PatternSetBuild(set);
+        uint32_t words = (PatternSetSize(set) + 63) >> 6;
+        if (!ok || (numWords + words) > MAXPATTERNWORDS) {
+            FreePatternSet(set);
+            continue;
+        }
+
+        uint32_t scan = program->numScans++;
+        program->scan[scan] = (patternScan_t){
+            .extID = node->extID,
+            .offset = node->offset,
+            .length = node->length,
+            .payload = node->comp == CMP_PAYLOAD,
+            .bitBase = numWords,
+            .set = set,
+        };
+        for (uint32_t j = i; j < program->numInstr; j++) {
+            filterInstr_t *instr = &(program->instr[j]);
+            const filterElement_t *n = &(engine->filter[instr->node]);
+            if (!IsPatternNode(engine, n) || !SameField(node, n)) continue;
+            instr->op = n->comp == CMP_STRING ? OP_STRING : OP_SUBSTRING;
+            instr->value = scan;
+            instr->mask += (uint64_t)numWords << 6;
+        }
+        numWords += words;
+    }
+
+    // if no pattern of a set is found, all compares of the set are false and
+    // the evaluation can skip along the OnFalse chain of the same set
+    for (uint32_t i = 1; i < program->numInstr; i++) {
+        filterInstr_t *instr = &(program->instr[i]);
+        if (instr->op != OP_STRING && instr->op != OP_SUBSTRING) continue;
+        uint32_t last = i;
+        uint32_t next = instr->OnFalse;
+        while (next && (program->instr[next].op == OP_STRING || program->instr[next].op == OP_SUBSTRING) &&
+               (uint32_t)program->instr[next].value == (uint32_t)instr->value) {
+            last = next;
+            next = program->instr[next].OnFalse;
+        }
+        instr->value |= (uint64_t)last << 32;
+    }
+
+    free(done);
+
+}  // End of CompilePatterns
+
+static uint16_t SelectOpcode(const FilterEngine_t *engine, const filterElement_t *node) {
+    // functions, preprocessed extensions and complex compares are not specialized
+    if (node->function != NULL || node->extID >= MAXEXTENSIONS) return OP_GENERIC;
+    if (engine->Extended && preprocess_map[node->extID].function != NULL) return OP_GENERIC;
+
+    if (engine->Extended && node->comp == CMP_IPLIST && node->data.dataPtr) {
+        if (node->length == 4) return OP_IPLIST4;
+        if (node->length == 16) return OP_IPLIST6;
+        return OP_GENERIC;
+    }
+
+    int sizeIndex;
+    switch (node->length) {
+        case 1:
+            sizeIndex = 0;
+            break;
+        case 2:
+            sizeIndex = 1;
+            break;
+        case 4:
+            sizeIndex = 2;
+            break;
+        case 8:
+            sizeIndex = 3;
+            break;
+        default:
+            return OP_GENERIC;
+    }
+
+    // a fast engine only knows CMP_EQ
+    comparator_t comp = engine->Extended ? node->comp : CMP_EQ;
+    switch (comp) {
+        case CMP_EQ:
+            return OP_EQ_8 + sizeIndex;
+        case CMP_GT:
+            return OP_GT_8 + sizeIndex;
+        case CMP_LT:
+            return OP_LT_8 + sizeIndex;
+        case CMP_GE:
+            return OP_GE_8 + sizeIndex;
+        case CMP_LE:
+            return OP_LE_8 + sizeIndex;
+        case CMP_FLAGS:
+            return OP_FLAGS_8 + sizeIndex;
+        case CMP_NET:
+            return OP_NET_8 + sizeIndex;
+        default:
+            return OP_GENERIC;
+    }
+
+}  // End of SelectOpcode
+
+static filterProgram_t *CompileProgram(const FilterEngine_t *engine, uint32_t numNodes) {
+    uint32_t *progIndex = calloc(numNodes, sizeof(uint32_t));
+    uint32_t *nodeList = malloc(numNodes * sizeof(uint32_t));
+    filterProgram_t *program = malloc(sizeof(filterProgram_t) + numNodes * sizeof(filterInstr_t));
+    trieCache_t *trieCache = calloc(numNodes, sizeof(trieCache_t));
+    uint32_t numCache = 0;
+    if (!progIndex || !nodeList || !program || !trieCache) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(progIndex);
+        free(nodeList);
+        free(program);
+        free(trieCache);
+        return NULL;
+    }
+
+    // assign program indices to all reachable nodes in breadth first order
+    uint32_t numInstr = 1;
+    uint32_t next = 0;
+    uint32_t last = 0;
+    if (engine->StartNode) {
+        progIndex[engine->StartNode] = numInstr++;
+        nodeList[last++] = engine->StartNode;
+    }
+    while (next < last) {
+        uint32_t index = nodeList[next++];
+        uint32_t target[2] = {engine->filter[index].OnTrue, engine->filter[index].OnFalse};
+        for (int i = 0; i < 2; i++) {
+            if (target[i] == 0 || progIndex[target[i]]) continue;
+            if (target[i] >= numNodes) {
+                LogError("Filter tree index %u out of range", target[i]);
+                free(progIndex);
+                free(nodeList);
+                free(program);
+                free(trieCache);
+                return NULL;
             }
+            progIndex[target[i]] = numInstr++;
+            nodeList[last++] = target[i];
         }
-        inPtr += offset;
+    }
 
-        data_t data = engine->filter[index].data;
-        uint32_t length = engine->filter[index].length;
-        uint64_t inVal = 0;
-        if (engine->filter[index].function != NULL) {
-            inVal = engine->filter[index].function(inPtr, length, data, handle);
+    program->instr[0] = (filterInstr_t){0};
+    for (uint32_t i = 0; i < last; i++) {
+        const filterElement_t *node = &(engine->filter[nodeList[i]]);
+        program->instr[i + 1] = (filterInstr_t){
+            .op = SelectOpcode(engine, node),
+            .invert = node->invert,
+            .extID = node->extID,
+            .offset = node->offset,
+            .node = nodeList[i],
+            .OnTrue = node->OnTrue ? progIndex[node->OnTrue] : 0,
+            .OnFalse = node->OnFalse ? progIndex[node->OnFalse] : 0,
+            .value = node->value,
+            .mask = (uint64_t)node->data.dataVal,
+        };
+        filterInstr_t *instr = &(program->instr[i + 1]);
+        if (instr->op == OP_IPLIST4 || instr->op == OP_IPLIST6) {
+            // the tries live as long as the program
+            instr->trie = GetIPTrie(trieCache, &numCache, node->data.dataPtr, instr->op == OP_IPLIST4 ? PF_INET : PF_INET6);
+            if (instr->trie == NULL) instr->op = OP_GENERIC;
+        }
+    }
+    program->numInstr = numInstr;
+    program->numScans = 0;
+    program->blockPlan = NULL;
+    CompilePatterns(engine, program);
+
+    free(progIndex);
+    free(nodeList);
+    free(trieCache);
+    return program;
+
+}  // End of CompileProgram
+
+#if defined(__GNUC__)
+// threaded code: jump directly to the code of the next instruction
+#define OP(op) L_##op:
+#define DISPATCH()                \
+    if (index == 0) goto END;     \
+    instr = &(program[index]);    \
+    invert = instr->invert;       \
+    goto *dispatch[instr->op]
+#else
+#define OP(op) case op:
+#define DISPATCH() continue
+#endif
+
+// test the value of size type with expression test at the offset of the instruction
+#define TEST(op, type, test)                                        \
+    OP(op) {                                                        \
+        void *inPtr = handle->extensionList[instr->extID];          \
+        if (inPtr == NULL) {                                        \
+            evaluate = 0;                                           \
+            index = instr->OnFalse;                                 \
+            DISPATCH();                                             \
+        }                                                           \
+        uint64_t inVal = *((type *)(inPtr + instr->offset));        \
+        evaluate = test;                                            \
+        index = evaluate ? instr->OnTrue : instr->OnFalse;          \
+        DISPATCH();                                                 \
+    }
+
+#define TESTSIZES(op, test)            \
+    TEST(op##_8, uint8_t, test)        \
+    TEST(op##_16, uint16_t, test)      \
+    TEST(op##_32, uint32_t, test)      \
+    TEST(op##_64, uint64_t, test)
+
+// scan the field of the pattern set once and mark all matching patterns
+static int ScanPatterns(const patternScan_t *scan, recordHandle_t *handle, uint64_t *anyMatch, uint64_t *fullMatch) {
+    uint32_t words = (PatternSetSize(scan->set) + 63) >> 6;
+    memset((void *)(anyMatch + scan->bitBase), 0, words * sizeof(uint64_t));
+    memset((void *)(fullMatch + scan->bitBase), 0, words * sizeof(uint64_t));
+
+    void *inPtr = handle->extensionList[scan->extID];
+    if (inPtr == NULL && preprocess_map[scan->extID].function != NULL) {
+        inPtr = preprocess_map[scan->extID].function(scan->length, (data_t){.dataPtr = NULL}, handle);
+    }
+    if (inPtr == NULL) return 0;
+
+    if (scan->payload) {
+        return PatternSetScan(scan->set, inPtr, ExtensionLength(inPtr), anyMatch + scan->bitBase, fullMatch + scan->bitBase);
+    } else {
+        char *str = (char *)(inPtr + scan->offset);
+        size_t len = scan->length ? strnlen(str, scan->length) : strlen(str);
+        return PatternSetScan(scan->set, str, len, anyMatch + scan->bitBase, fullMatch + scan->bitBase);
+    }
+
+}  // End of ScanPatterns
+
+// test the pattern bit of the instruction - scan the field first, if not yet done for this record
+// if no pattern of the set was found, continue with the last compare of the set in the OnFalse chain
+// branches instead of a conditional move let the CPU speculate along the OnFalse chain
+#define PATTERN(op, bits)                                                                                        \
+    OP(op) {                                                                                                     \
+        uint32_t scan = (uint32_t)instr->value;                                                                  \
+        if ((scanned & (1U << scan)) == 0) {                                                                     \
+            if (ScanPatterns(&(engine->program->scan[scan]), handle, anyMatch, fullMatch)) found |= 1U << scan;  \
+            scanned |= 1U << scan;                                                                               \
+        }                                                                                                        \
+        if ((found & (1U << scan)) == 0) {                                                                       \
+            instr = &(program[instr->value >> 32]);                                                              \
+            invert = instr->invert;                                                                              \
+            evaluate = 0;                                                                                        \
+            index = instr->OnFalse;                                                                              \
+            DISPATCH();                                                                                          \
+        }                                                                                                        \
+        evaluate = (bits[instr->mask >> 6] >> (instr->mask & 0x3F)) & 1;                                         \
+        if (evaluate) {                                                                                          \
+            index = instr->OnTrue;                                                                               \
+            DISPATCH();                                                                                          \
+        }                                                                                                        \
+        index = instr->OnFalse;                                                                                  \
+        DISPATCH();                                                                                              \
+    }
+
+static int RunProgram(const FilterEngine_t *engine, recordHandle_t *handle) {
+    const filterInstr_t *program = engine->program->instr;
+    const filterInstr_t *instr = NULL;
+    uint32_t index = engine->program->numInstr > 1 ? 1 : 0;
+    int evaluate = 0;
+    int invert = 0;
+
+    // pattern bits are valid for the pattern sets scanned for this record
+    uint32_t scanned = 0;
+    uint32_t found = 0;
+    uint64_t anyMatch[MAXPATTERNWORDS];
+    uint64_t fullMatch[MAXPATTERNWORDS];
+
+#if defined(__GNUC__)
+#define LABEL(op) [op] = &&L_##op
+#define LABELS(op) LABEL(op##_8), LABEL(op##_16), LABEL(op##_32), LABEL(op##_64)
+    static const void *dispatch[OP_MAX] = {LABEL(OP_GENERIC), LABELS(OP_EQ),      LABELS(OP_GT),     LABELS(OP_LT),    LABELS(OP_GE),
+                                           LABELS(OP_LE),     LABELS(OP_FLAGS),   LABELS(OP_NET),    LABEL(OP_IPLIST4), LABEL(OP_IPLIST6),
+                                           LABEL(OP_STRING),  LABEL(OP_SUBSTRING)};
+#undef LABELS
+#undef LABEL
+    DISPATCH();
+#else
+    while (index) {
+        instr = &(program[index]);
+        invert = instr->invert;
+        switch (instr->op) {
+#endif
+
+    OP(OP_GENERIC) {
+        evaluate = engine->Extended ? EvalNode(engine, instr->node, handle) : EvalFastNode(engine, instr->node, handle);
+        index = evaluate ? instr->OnTrue : instr->OnFalse;
+        DISPATCH();
+    }
+    TESTSIZES(OP_EQ, inVal == instr->value)
+    TESTSIZES(OP_GT, inVal > instr->value)
+    TESTSIZES(OP_LT, inVal < instr->value)
+    TESTSIZES(OP_GE, inVal >= instr->value)
+    TESTSIZES(OP_LE, inVal <= instr->value)
+    TESTSIZES(OP_FLAGS, (inVal & instr->value) == instr->value)
+    TESTSIZES(OP_NET, (inVal & instr->mask) == instr->value)
+    OP(OP_IPLIST4) {
+        void *inPtr = handle->extensionList[instr->extID];
+        evaluate = 0;
+        if (inPtr) {
+            uint64_t ip[2] = {0, *((uint32_t *)(inPtr + instr->offset))};
+            evaluate = PrefixTrieContains(instr->trie, ip);
+        }
+        index = evaluate ? instr->OnTrue : instr->OnFalse;
+        DISPATCH();
+    }
+    OP(OP_IPLIST6) {
+        void *inPtr = handle->extensionList[instr->extID];
+        evaluate = 0;
+        if (inPtr) {
+            uint64_t ip[2];
+            memcpy((void *)ip, inPtr + instr->offset, 16);
+            evaluate = PrefixTrieContains(instr->trie, ip);
+        }
+        index = evaluate ? instr->OnTrue : instr->OnFalse;
+        DISPATCH();
+    }
+    PATTERN(OP_STRING, fullMatch)
+    PATTERN(OP_SUBSTRING, anyMatch)
+
+#if defined(__GNUC__)
+END:
+#else
+        }
+    }
+#endif
+    return invert ? !evaluate : evaluate;
+
+}  // End of RunProgram
+
+#undef TESTSIZES
+#undef TEST
+#undef DISPATCH
+#undef OP
+
+/*
+ * Block filter
+ * Programs, which only compare fixed size fields of the flow extensions, are evaluated for
+ * all records of a data block at once. The fields of all records are gathered into columns
+ * and each compare is evaluated for a chunk of records with one vectorised loop. The result
+ * of each instruction is propagated as a selection vector along the jumps of the program in
+ * topological order. Records are not mapped into a record handle for filtering.
+ */
+
+// number of records evaluated in one chunk
+#define BLOCKLANES 256
+// max number of extensions and fields of a block plan
+#define MAXBLOCKEXT 8
+#define MAXBLOCKCOLUMNS 16
+
+typedef struct blockColumn_s {
+    uint32_t ext;  // extension slot of the plan
+    uint32_t offset;
+    uint32_t length;
+} blockColumn_t;
+
+typedef struct blockStep_s {
+    uint32_t instr;   // program index
+    uint32_t column;  // column of the compared field
+} blockStep_t;
+
+typedef struct blockPlan_s {
+    uint8_t extSlot[MAXEXTENSIONS];  // slot + 1 of an extension, 0 = not used
+    uint32_t numExt;
+    uint32_t numColumns;
+    blockColumn_t column[MAXBLOCKCOLUMNS];
+    uint32_t numSteps;
+    blockStep_t step[];  // instructions in topological order
+} blockPlan_t;
+
+// check if the instruction qualifies for block evaluation
+static int BlockInstr(const FilterEngine_t *engine, const filterInstr_t *instr) {
+    const filterElement_t *node = &(engine->filter[instr->node]);
+    if (instr->extID >= MAXEXTENSIONS || node->function != NULL) return 0;
+    // MapRecordHandle() may update msecFirst of the record
+    if (instr->extID == EXgenericFlowID && instr->offset < 8) return 0;
+    if (instr->op >= OP_EQ_8 && instr->op <= OP_NET_64) return 1;
+    // block 'any' and other presence tests of an extension
+    return instr->op == OP_GENERIC && node->length == 0 && (!engine->Extended || node->comp == CMP_EQ);
+}  // End of BlockInstr
+
+static blockPlan_t *CompileBlockPlan(const FilterEngine_t *engine) {
+    const filterProgram_t *program = engine->program;
+    uint32_t numInstr = program->numInstr;
+    if (numInstr <= 1 || program->numScans) return NULL;
+
+    for (uint32_t i = 1; i < numInstr; i++) {
+        if (!BlockInstr(engine, &(program->instr[i]))) return NULL;
+    }
+
+    blockPlan_t *plan = calloc(1, sizeof(blockPlan_t) + numInstr * sizeof(blockStep_t));
+    uint32_t *inDegree = calloc(numInstr, sizeof(uint32_t));
+    if (!plan || !inDegree) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(plan);
+        free(inDegree);
+        return NULL;
+    }
+
+    // order the instructions topologically
+    for (uint32_t i = 1; i < numInstr; i++) {
+        if (program->instr[i].OnTrue) inDegree[program->instr[i].OnTrue]++;
+        if (program->instr[i].OnFalse) inDegree[program->instr[i].OnFalse]++;
+    }
+    uint32_t numSteps = 0;
+    plan->step[numSteps++].instr = 1;
+    for (uint32_t next = 0; next < numSteps; next++) {
+        const filterInstr_t *instr = &(program->instr[plan->step[next].instr]);
+        uint32_t target[2] = {instr->OnTrue, instr->OnFalse};
+        for (int i = 0; i < 2; i++) {
+            if (target[i] && --inDegree[target[i]] == 0) plan->step[numSteps++].instr = target[i];
+        }
+    }
+    free(inDegree);
+    if (numSteps != numInstr - 1) {
+        // not a DAG - should never happen
+        free(plan);
+        return NULL;
+    }
+    plan->numSteps = numSteps;
+
+    // assign extension slots and columns
+    for (uint32_t i = 0; i < numSteps; i++) {
+        const filterInstr_t *instr = &(program->instr[plan->step[i].instr]);
+        uint32_t length = engine->filter[instr->node].length;
+        if (plan->extSlot[instr->extID] == 0) {
+            if (plan->numExt == MAXBLOCKEXT) {
+                free(plan);
+                return NULL;
+            }
+            plan->extSlot[instr->extID] = ++plan->numExt;
+        }
+        uint32_t ext = plan->extSlot[instr->extID] - 1;
+        uint32_t c = 0;
+        while (c < plan->numColumns &&
+               (plan->column[c].ext != ext || plan->column[c].offset != instr->offset || plan->column[c].length != length))
+            c++;
+        if (c == plan->numColumns) {
+            if (plan->numColumns == MAXBLOCKCOLUMNS) {
+                free(plan);
+                return NULL;
+            }
+            plan->column[c] = (blockColumn_t){.ext = ext, .offset = instr->offset, .length = length};
+            plan->numColumns++;
+        }
+        plan->step[i].column = c;
+    }
+
+    return plan;
+
+}  // End of CompileBlockPlan
+
+// map the extensions of the plan - returns 0 for an inconsistent record as MapRecordHandle() does
+static inline int GatherRecord(const blockPlan_t *plan, const recordHeaderV3_t *recordHeaderV3, const void **extPtr) {
+    for (uint32_t i = 0; i < plan->numExt; i++) extPtr[i] = NULL;
+    if (plan->extSlot[EXnull]) extPtr[plan->extSlot[EXnull] - 1] = recordHeaderV3;
+
+    const void *eor = (const void *)recordHeaderV3 + recordHeaderV3->size;
+    const elementHeader_t *elementHeader = (const elementHeader_t *)((const void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+    for (int i = 0; i < recordHeaderV3->numElements; i++) {
+        if ((const void *)elementHeader > eor || elementHeader->length == 0 || elementHeader->type == 0) return 0;
+        if (elementHeader->type < MAXEXTENSIONS && plan->extSlot[elementHeader->type])
+            extPtr[plan->extSlot[elementHeader->type] - 1] = (const void *)elementHeader + sizeof(elementHeader_t);
+        elementHeader = (const elementHeader_t *)((const void *)elementHeader + elementHeader->length);
+    }
+    return 1;
+
+}  // End of GatherRecord
+
+// evaluate the test for all lanes of a column
+#define BLOCKTEST(test)                            \
+    for (uint32_t l = 0; l < lanes; l++) {         \
+        uint64_t inVal = column[l];                \
+        evaluate[l] = present[l] & (test);         \
+    }
+
+// filter a chunk of up to BLOCKLANES records
+static void FilterChunk(const FilterEngine_t *engine, recordHeaderV3_t **records, uint32_t lanes, uint8_t *match, uint8_t *reach) {
+    const filterInstr_t *program = engine->program->instr;
+    const blockPlan_t *plan = engine->program->blockPlan;
+
+    uint64_t columns[MAXBLOCKCOLUMNS][BLOCKLANES];
+    uint8_t presence[MAXBLOCKEXT][BLOCKLANES];
+    uint8_t valid[BLOCKLANES];
+    uint8_t evaluate[BLOCKLANES];
+
+    // gather the fields of all records into the columns
+    for (uint32_t l = 0; l < lanes; l++) {
+        const void *extPtr[MAXBLOCKEXT];
+        valid[l] = GatherRecord(plan, records[l], extPtr);
+        for (uint32_t i = 0; i < plan->numExt; i++) presence[i][l] = valid[l] && extPtr[i] != NULL;
+        for (uint32_t c = 0; c < plan->numColumns; c++) {
+            const void *inPtr = extPtr[plan->column[c].ext];
+            uint64_t inVal = 0;
+            if (valid[l] && inPtr) {
+                inPtr += plan->column[c].offset;
+                switch (plan->column[c].length) {
+                    case 1:
+                        inVal = *((uint8_t *)inPtr);
+                        break;
+                    case 2:
+                        inVal = *((uint16_t *)inPtr);
+                        break;
+                    case 4:
+                        inVal = *((uint32_t *)inPtr);
+                        break;
+                    case 8:
+                        inVal = *((uint64_t *)inPtr);
+                        break;
+                }
+            }
+            columns[c][l] = inVal;
+        }
+    }
+
+    // the first instruction is reached by all records
+    memset((void *)reach, 0, (size_t)engine->program->numInstr * BLOCKLANES);
+    memset((void *)(reach + BLOCKLANES), 1, lanes);
+    memset((void *)match, 0, lanes);
+
+    for (uint32_t s = 0; s < plan->numSteps; s++) {
+        uint32_t index = plan->step[s].instr;
+        const filterInstr_t *instr = &(program[index]);
+        const uint8_t *inReach = reach + (size_t)index * BLOCKLANES;
+
+        uint8_t any = 0;
+        for (uint32_t l = 0; l < lanes; l++) any |= inReach[l];
+        if (any == 0) continue;
+
+        const uint64_t *column = columns[plan->step[s].column];
+        const uint8_t *present = presence[plan->column[plan->step[s].column].ext];
+        const uint64_t value = instr->value;
+        const uint64_t mask = instr->mask;
+        if (instr->op == OP_GENERIC) {
+            // field length 0 - test the presence of the extension
+            for (uint32_t l = 0; l < lanes; l++) evaluate[l] = present[l] & (value == 0);
         } else {
-            switch (length) {
+            switch ((instr->op - OP_EQ_8) >> 2) {
                 case 0:
+                    BLOCKTEST(inVal == value)
                     break;
                 case 1:
-                    inVal = *((uint8_t *)inPtr);
+                    BLOCKTEST(inVal > value)
                     break;
                 case 2:
-                    inVal = *((uint16_t *)inPtr);
+                    BLOCKTEST(inVal < value)
+                    break;
+                case 3:
+                    BLOCKTEST(inVal >= value)
                     break;
                 case 4:
-                    inVal = *((uint32_t *)inPtr);
+                    BLOCKTEST(inVal <= value)
                     break;
-                case 8:
-                    inVal = *((uint64_t *)inPtr);
-                case 3:
                 case 5:
-                case 7:
-                    memcpy((void *)&inVal, inPtr, length);
+                    BLOCKTEST((inVal & value) == value)
+                    break;
+                case 6:
+                    BLOCKTEST((inVal & mask) == value)
                     break;
             }
         }
 
-        switch (engine->filter[index].comp) {
-            case CMP_EQ:
-                evaluate = inVal == engine->filter[index].value;
-                break;
-            case CMP_GT:
-                evaluate = inVal > engine->filter[index].value;
-                break;
-            case CMP_LT:
-                evaluate = inVal < engine->filter[index].value;
-                break;
-            case CMP_GE:
-                evaluate = inVal >= engine->filter[index].value;
-                break;
-            case CMP_LE:
-                evaluate = inVal <= engine->filter[index].value;
-                break;
-            case CMP_FLAGS: {
-                evaluate = (inVal & engine->filter[index].value) == engine->filter[index].value;
-            } break;
-            case CMP_IDENT: {
-                char *str = (char *)data.dataPtr;
-                evaluate = str != NULL && (strcmp(engine->ident, str) == 0 ? 1 : 0);
-            } break;
-            case CMP_STRING: {
-                char *str = (char *)data.dataPtr;
-                evaluate = str != NULL && (strcmp(inPtr, str) == 0 ? 1 : 0);
-            } break;
-            case CMP_SUBSTRING: {
-                char *str = (char *)data.dataPtr;
-                evaluate = str != NULL && (strstr(inPtr, str) != NULL ? 1 : 0);
-            } break;
-            case CMP_BINARY: {
-                void *dataPtr = data.dataPtr;
-                evaluate = dataPtr != NULL && memcmp(inPtr, dataPtr, length) == 0;
-            } break;
-            case CMP_NET: {
-                uint64_t mask = data.dataVal;
-                evaluate = (inVal & mask) == engine->filter[index].value;
-            } break;
-            case CMP_IPLIST: {
-                if (length == 4) {
-                    struct IPListNode find = {.ip[0] = 0, .ip[1] = inVal, .mask[0] = 0xffffffffffffffffLL, .mask[1] = 0xffffffffffffffffLL};
-                    evaluate = RB_FIND(IPtree, data.dataPtr, &find) != NULL;
-                } else if (length == 16) {
-                    struct IPListNode find = {.ip[0] = *((uint64_t *)inPtr),
-                                              .ip[1] = *((uint64_t *)(inPtr + 8)),
-                                              .mask[0] = 0xffffffffffffffffLL,
-                                              .mask[1] = 0xffffffffffffffffLL};
-                    evaluate = RB_FIND(IPtree, data.dataPtr, &find) != NULL;
-                } else {
-                    evaluate = 0;
-                }
-            } break;
-            case CMP_U64LIST: {
-                struct U64ListNode find = {.value = inVal};
-                evaluate = RB_FIND(U64tree, data.dataPtr, &find) != NULL;
-            } break;
-            case CMP_PAYLOAD: {
-                char *payload = (char *)(handle->extensionList[extID]);
-                char *string = (char *)engine->filter[index].data.dataPtr;
-                uint32_t len = ExtensionLength(payload);
-                evaluate = 0;
-                if (string != NULL) {
-                    // find any string str in payload data inPtr, even beyond '\0' bytes
-                    int m = 0;
-                    for (int i = 0; i < len; i++) {
-                        if (payload[i] == string[m]) {
-                            m++;
-                            if (string[m] == '\0') {
-                                evaluate = 1;
-                                break;
-                            }
-                        } else {
-                            m = 0;
-                        }
-                    }
+        // follow the jumps - a terminal jump sets the result with the inversion of the last test
+        if (instr->OnTrue) {
+            uint8_t *outReach = reach + (size_t)instr->OnTrue * BLOCKLANES;
+            for (uint32_t l = 0; l < lanes; l++) outReach[l] |= inReach[l] & evaluate[l];
+        } else if (!instr->invert) {
+            for (uint32_t l = 0; l < lanes; l++) match[l] |= inReach[l] & evaluate[l];
+        }
+        if (instr->OnFalse) {
+            uint8_t *outReach = reach + (size_t)instr->OnFalse * BLOCKLANES;
+            for (uint32_t l = 0; l < lanes; l++) outReach[l] |= inReach[l] & (evaluate[l] ^ 1);
+        } else if (instr->invert) {
+            for (uint32_t l = 0; l < lanes; l++) match[l] |= inReach[l] & (evaluate[l] ^ 1);
+        }
+    }
+
+    // inconsistent records are left to MapRecordHandle() for reporting
+    for (uint32_t l = 0; l < lanes; l++) match[l] |= valid[l] ^ 1;
+
+}  // End of FilterChunk
+
+#undef BLOCKTEST
+
+uint64_t FilterExtensions(const void *engine) {
+    const FilterEngine_t *filterEngine = (const FilterEngine_t *)engine;
+    return filterEngine ? filterEngine->extMask : 0;
+}  // End of FilterExtensions
+
+// return the IP addresses, of which at least one is in any matching flow.
+// Returns 0, if the filter matches flows without a known IP address
+uint32_t FilterIPKeys(const void *engine, ipKey_t **keys) {
+    const FilterEngine_t *filterEngine = (const FilterEngine_t *)engine;
+    if (!filterEngine || filterEngine->numIPKeys == 0) return 0;
+    *keys = filterEngine->ipKeys;
+    return filterEngine->numIPKeys;
+}  // End of FilterIPKeys
+
+int FilterBlockCapable(const void *engine) {
+    const FilterEngine_t *filterEngine = (const FilterEngine_t *)engine;
+    return filterEngine->program != NULL && filterEngine->program->blockPlan != NULL;
+}  // End of FilterBlockCapable
+
+int FilterRecordBlock(const void *engine, recordHeaderV3_t **records, uint32_t numRecords, uint8_t *match) {
+    const FilterEngine_t *filterEngine = (const FilterEngine_t *)engine;
+    if (!FilterBlockCapable(engine)) return 0;
+
+    uint8_t *reach = malloc((size_t)filterEngine->program->numInstr * BLOCKLANES);
+    if (!reach) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    for (uint32_t i = 0; i < numRecords; i += BLOCKLANES) {
+        uint32_t lanes = numRecords - i < BLOCKLANES ? numRecords - i : BLOCKLANES;
+        FilterChunk(filterEngine, records + i, lanes, match + i, reach);
+    }
+    free(reach);
+    return 1;
+
+}  // End of FilterRecordBlock
+
+/*
+ * Filter sets
+ * A filter set evaluates many filters, such as the channel filters of nfprofile, for a record
+ * in one pass. Equal compares of all programs in the set are merged into shared nodes. Each
+ * shared node is evaluated at most once per record, and the result is reused by all programs,
+ * which walk their own jump graph. The result is a bitmap of the matching filters.
+ * All filters of a set must be set up with the same ident and geo DB parameters.
+ * A filter set holds per record state and must not be shared between threads.
+ */
+
+// buckets of the shared node hash
+#define SHAREDBUCKETS 4096
+
+typedef struct sharedNode_s {
+    const FilterEngine_t *engine;  // representative instruction of the node
+    const filterInstr_t *instr;
+    uint32_t next;  // next node in hash bucket
+} sharedNode_t;
+
+typedef struct filterSet_s {
+    uint32_t numEngines;
+    const FilterEngine_t **engine;
+    uint32_t **sharedIndex;  // shared node of each program instruction, NULL = no program
+    uint32_t numShared;
+    sharedNode_t *shared;
+    uint64_t epoch;       // record sequence
+    uint64_t *evaluated;  // epoch of the last evaluation of a shared node
+    uint8_t *result;      // result of the last evaluation
+} filterSet_t;
+
+static int SameIPList(IPlist_t *a, IPlist_t *b) {
+    struct IPListNode *na = RB_MIN(IPtree, a);
+    struct IPListNode *nb = RB_MIN(IPtree, b);
+    while (na && nb) {
+        if (na->ip[0] != nb->ip[0] || na->ip[1] != nb->ip[1] || na->mask[0] != nb->mask[0] || na->mask[1] != nb->mask[1]) return 0;
+        na = RB_NEXT(IPtree, a, na);
+        nb = RB_NEXT(IPtree, b, nb);
+    }
+    return na == nb;
+}  // End of SameIPList
+
+static int SameU64List(U64List_t *a, U64List_t *b) {
+    struct U64ListNode *na = RB_MIN(U64tree, a);
+    struct U64ListNode *nb = RB_MIN(U64tree, b);
+    while (na && nb) {
+        if (na->value != nb->value) return 0;
+        na = RB_NEXT(U64tree, a, na);
+        nb = RB_NEXT(U64tree, b, nb);
+    }
+    return na == nb;
+}  // End of SameU64List
+
+// check if two instructions of the programs of engine a and b always evaluate the same
+static int SameInstr(const FilterEngine_t *ea, const filterInstr_t *a, const FilterEngine_t *eb, const filterInstr_t *b) {
+    if (a->op != b->op || a->extID != b->extID || a->offset != b->offset || a->value != b->value) return 0;
+    if (a->op >= OP_EQ_8 && a->op <= OP_FLAGS_64) return 1;
+    if (a->op >= OP_NET_8 && a->op <= OP_NET_64) return a->mask == b->mask;
+
+    const filterElement_t *na = &(ea->filter[a->node]);
+    const filterElement_t *nb = &(eb->filter[b->node]);
+    if (ea->Extended != eb->Extended || na->length != nb->length || na->function != nb->function) return 0;
+    if (!ea->Extended) return 1;
+    if (na->comp != nb->comp) return 0;
+
+    const void *da = na->data.dataPtr;
+    const void *db = nb->data.dataPtr;
+    switch (na->comp) {
+        case CMP_IDENT:
+        case CMP_STRING:
+        case CMP_SUBSTRING:
+        case CMP_PAYLOAD:
+            return da == db || (da && db && strcmp(da, db) == 0);
+        case CMP_BINARY:
+            return da == db || (da && db && memcmp(da, db, na->length) == 0);
+        case CMP_IPLIST:
+            return da == db || (da && db && SameIPList((IPlist_t *)da, (IPlist_t *)db));
+        case CMP_U64LIST:
+            return da == db || (da && db && SameU64List((U64List_t *)da, (U64List_t *)db));
+        default:
+            return na->data.dataVal == nb->data.dataVal;
+    }
+
+}  // End of SameInstr
+
+// evaluate a single instruction without the program context
+static int EvalInstr(const FilterEngine_t *engine, const filterInstr_t *instr, recordHandle_t *handle) {
+    if (instr->op == OP_GENERIC || instr->op == OP_STRING || instr->op == OP_SUBSTRING)
+        return engine->Extended ? EvalNode(engine, instr->node, handle) : EvalFastNode(engine, instr->node, handle);
+
+    void *inPtr = handle->extensionList[instr->extID];
+    if (inPtr == NULL) return 0;
+    inPtr += instr->offset;
+
+    if (instr->op == OP_IPLIST4) {
+        uint64_t ip[2] = {0, *((uint32_t *)inPtr)};
+        return PrefixTrieContains(instr->trie, ip);
+    }
+    if (instr->op == OP_IPLIST6) {
+        uint64_t ip[2];
+        memcpy((void *)ip, inPtr, 16);
+        return PrefixTrieContains(instr->trie, ip);
+    }
+
+    uint64_t inVal = 0;
+    switch ((instr->op - OP_EQ_8) & 0x3) {
+        case 0:
+            inVal = *((uint8_t *)inPtr);
+            break;
+        case 1:
+            inVal = *((uint16_t *)inPtr);
+            break;
+        case 2:
+            inVal = *((uint32_t *)inPtr);
+            break;
+        case 3:
+            inVal = *((uint64_t *)inPtr);
+            break;
+    }
+    switch ((instr->op - OP_EQ_8) >> 2) {
+        case 0:
+            return inVal == instr->value;
+        case 1:
+            return inVal > instr->value;
+        case 2:
+            return inVal < instr->value;
+        case 3:
+            return inVal >= instr->value;
+        case 4:
+            return inVal <= instr->value;
+        case 5:
+            return (inVal & instr->value) == instr->value;
+        case 6:
+            return (inVal & instr->mask) == instr->value;
+    }
+    return 0;
+
+}  // End of EvalInstr
+
+void *CompileFilterSet(void **engines, uint32_t numEngines) {
+    filterSet_t *filterSet = calloc(1, sizeof(filterSet_t));
+    uint32_t numInstr = 0;
+    for (uint32_t i = 0; i < numEngines; i++) {
+        const FilterEngine_t *engine = (const FilterEngine_t *)engines[i];
+        if (engine->program) numInstr += engine->program->numInstr;
+    }
+    uint32_t *bucket = calloc(SHAREDBUCKETS, sizeof(uint32_t));
+    if (!filterSet || !bucket) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    filterSet->numEngines = numEngines;
+    filterSet->engine = calloc(numEngines, sizeof(FilterEngine_t *));
+    filterSet->sharedIndex = calloc(numEngines, sizeof(uint32_t *));
+    // shared node 0 is unused - terminates the hash chains
+    filterSet->shared = calloc(numInstr + 1, sizeof(sharedNode_t));
+    filterSet->evaluated = calloc(numInstr + 1, sizeof(uint64_t));
+    filterSet->result = calloc(numInstr + 1, sizeof(uint8_t));
+    if (!filterSet->engine || !filterSet->sharedIndex || !filterSet->shared || !filterSet->evaluated || !filterSet->result) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    uint32_t numShared = 1;
+    for (uint32_t i = 0; i < numEngines; i++) {
+        const FilterEngine_t *engine = (const FilterEngine_t *)engines[i];
+        filterSet->engine[i] = engine;
+        if (engine->program == NULL) continue;
+
+        const filterProgram_t *program = engine->program;
+        uint32_t *sharedIndex = calloc(program->numInstr, sizeof(uint32_t));
+        if (!sharedIndex) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+        for (uint32_t j = 1; j < program->numInstr; j++) {
+            const filterInstr_t *instr = &(program->instr[j]);
+            uint32_t hash = (instr->op * 31 + instr->extID * 17 + instr->offset + (uint32_t)(instr->value * 0x9E3779B97F4A7C15ULL >> 40)) %
+                            SHAREDBUCKETS;
+            uint32_t s = bucket[hash];
+            while (s && !SameInstr(filterSet->shared[s].engine, filterSet->shared[s].instr, engine, instr)) s = filterSet->shared[s].next;
+            if (s == 0) {
+                s = numShared++;
+                filterSet->shared[s] = (sharedNode_t){.engine = engine, .instr = instr, .next = bucket[hash]};
+                bucket[hash] = s;
+            }
+            sharedIndex[j] = s;
+        }
+        filterSet->sharedIndex[i] = sharedIndex;
+    }
+    filterSet->numShared = numShared;
+    free(bucket);
+
+    dbg_printf("Filter set: %u filters, %u instructions, %u shared nodes\n", numEngines, numInstr, numShared - 1);
+    return (void *)filterSet;
+
+}  // End of CompileFilterSet
+
+void FilterRecordSet(void *arg, recordHandle_t *handle, uint64_t *match) {
+    filterSet_t *filterSet = (filterSet_t *)arg;
+    uint64_t epoch = ++filterSet->epoch;
+
+    memset((void *)match, 0, ((filterSet->numEngines + 63) >> 6) * sizeof(uint64_t));
+    for (uint32_t i = 0; i < filterSet->numEngines; i++) {
+        const FilterEngine_t *engine = filterSet->engine[i];
+        const uint32_t *sharedIndex = filterSet->sharedIndex[i];
+        int evaluate = 0;
+        int invert = 0;
+        if (sharedIndex == NULL) {
+            evaluate = engine->filterFunction(engine, handle);
+        } else {
+            const filterInstr_t *program = engine->program->instr;
+            uint32_t index = engine->program->numInstr > 1 ? 1 : 0;
+            while (index) {
+                const filterInstr_t *instr = &(program[index]);
+                uint32_t s = sharedIndex[index];
+                if (filterSet->evaluated[s] != epoch) {
+                    filterSet->result[s] = EvalInstr(filterSet->shared[s].engine, filterSet->shared[s].instr, handle);
+                    filterSet->evaluated[s] = epoch;
                 }
-            } break;
-            case CMP_REGEX: {
-                srx_Context *program = (srx_Context *)data.dataPtr;
-                char *payload = (char *)(handle->extensionList[extID]);
-                uint32_t len = ExtensionLength(payload);
-
-                evaluate = program != NULL && srx_MatchExt(program, payload, len, 0);
-            } break;
-            case CMP_GEO: {
-                char *geoChar = (char *)inPtr;
-                if (engine->hasGeoDB && geoChar[0] == '\0') inVal = geoLookup(geoChar, data.dataVal, handle);
-                evaluate = inVal == engine->filter[index].value;
-            } break;
+                invert = instr->invert;
+                evaluate = filterSet->result[s];
+                index = evaluate ? instr->OnTrue : instr->OnFalse;
+            }
         }
-        index = evaluate ? engine->filter[index].OnTrue : engine->filter[index].OnFalse;
+        if (invert ? !evaluate : evaluate) match[i >> 6] |= 1ULL << (i & 0x3F);
     }
-    return invert ? !evaluate : evaluate;
-}  // End of RunFilter
+
+}  // End of FilterRecordSet
+
+void DisposeFilterSet(void *arg) {
+    filterSet_t *filterSet = (filterSet_t *)arg;
+    if (filterSet == NULL) return;
+    for (uint32_t i = 0; i < filterSet->numEngines; i++) free(filterSet->sharedIndex[i]);
+    free(filterSet->sharedIndex);
+    free(filterSet->engine);
+    free(filterSet->shared);
+    free(filterSet->evaluated);
+    free(filterSet->result);
+    free(filterSet);
+}  // End of DisposeFilterSet
 
 char *ReadFilter(char *filename) {
     struct stat stat_buff;
@@ -858,6 +1912,291 @@ char *ReadFilter(char *filename) {
 
 }  // End of ReadFilter
 
+// extensions tested by the filter tree. Lookups and preprocessed values may need
+// further extensions of the record - return all extensions for those filters
+static uint64_t FilterTreeExtensions(const filterElement_t *filter, uint32_t numBlocks) {
+    uint64_t extMask = ExtensionBit(EXnull);
+    for (uint32_t i = 1; i < numBlocks; i++) {
+        const filterElement_t *node = &filter[i];
+        if (node->extID >= MAXEXTENSIONS || node->function != NULL || node->comp == CMP_GEO || preprocess_map[node->extID].function != NULL)
+            return ALLEXTENSIONS;
+        extMask |= ExtensionBit(node->extID);
+    }
+    return extMask;
+
+}  // End of FilterTreeExtensions
+
+/*
+ * IP keys of a filter
+ * Collect the IP addresses, of which at least one is in any flow, matching the filter.
+ * For each node the keys are collected for both results of the node test: a host test,
+ * which is true, guarantees its IP address in the flow, otherwise the next node must
+ * guarantee one. A path, which accepts a flow without a host test, makes the keys
+ * unknown. The results are collected for each node once, as the tree is a DAG.
+ */
+
+// max number of keys of a filter - more keys are not useful to skip files
+#define MAXIPKEYS 1024
+
+typedef struct keySet_s {
+    int done;
+    int unknown;
+    uint32_t numKeys;
+    ipKey_t *keys;
+} keySet_t;
+
+static void AddKey(keySet_t *set, uint64_t addr, uint32_t af) {
+    if (set->unknown) return;
+    for (uint32_t i = 0; i < set->numKeys; i++) {
+        if (set->keys[i].addr == addr && set->keys[i].af == af) return;
+    }
+    if (set->numKeys == MAXIPKEYS) {
+        set->unknown = 1;
+        return;
+    }
+    if ((set->numKeys & 0x3F) == 0) {
+        ipKey_t *keys = realloc(set->keys, (set->numKeys + 64) * sizeof(ipKey_t));
+        if (!keys) {
+            set->unknown = 1;
+            return;
+        }
+        set->keys = keys;
+    }
+    set->keys[set->numKeys++] = (ipKey_t){.addr = addr, .af = af};
+}  // End of AddKey
+
+// add the keys of a host test node. Return 0, if the node is not a host test
+static int NodeKeys(const FilterEngine_t *engine, const filterElement_t *node, keySet_t *set) {
+    if (node->function != NULL || (engine->Extended && preprocess_map[node->extID].function != NULL)) return 0;
+
+    if (node->comp == CMP_EQ) {
+        if (node->extID == EXipv4FlowID && (node->offset == OFFsrc4Addr || node->offset == OFFdst4Addr) && node->length == 4) {
+            AddKey(set, node->value, PF_INET);
+            return 1;
+        }
+        // the upper 64 bits of an IPv6 host test
+        if (node->extID == EXipv6FlowID && (node->offset == OFFsrc6Addr || node->offset == OFFdst6Addr) && node->length == 8) {
+            AddKey(set, node->value, PF_INET6);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (node->comp == CMP_IPLIST && (node->extID == EXipv4FlowID || node->extID == EXipv6FlowID)) {
+        // a list of hosts only - networks can not be tested
+        struct IPListNode *ipNode;
+        RB_FOREACH(ipNode, IPtree, (IPlist_t *)node->data.dataPtr) {
+            if (ipNode->mask[0] != 0xffffffffffffffffLL || ipNode->mask[1] != 0xffffffffffffffffLL) return 0;
+        }
+        RB_FOREACH(ipNode, IPtree, (IPlist_t *)node->data.dataPtr) {
+            if (node->extID == EXipv4FlowID) {
+                if (ipNode->ip[0] == 0) AddKey(set, ipNode->ip[1], PF_INET);
+            } else {
+                AddKey(set, ipNode->ip[0], PF_INET6);
+            }
+        }
+        return 1;
+    }
+
+    return 0;
+
+}  // End of NodeKeys
+
+static void MergeKeys(keySet_t *set, const keySet_t *from) {
+    if (from->unknown) set->unknown = 1;
+    for (uint32_t i = 0; i < from->numKeys && !set->unknown; i++) AddKey(set, from->keys[i].addr, from->keys[i].af);
+}  // End of MergeKeys
+
+static keySet_t *CollectKeys(const FilterEngine_t *engine, keySet_t *sets, uint32_t index) {
+    keySet_t *set = &sets[index];
+    if (set->done) return set;
+    set->done = 1;
+
+    const filterElement_t *node = &(engine->filter[index]);
+    for (int evaluate = 0; evaluate <= 1 && !set->unknown; evaluate++) {
+        uint32_t next = evaluate ? node->OnTrue : node->OnFalse;
+        if (next == 0) {
+            // end of path - rejected flows need no keys
+            int accept = node->invert ? !evaluate : evaluate;
+            if (!accept) continue;
+            if (!evaluate || !NodeKeys(engine, node, set)) set->unknown = 1;
+        } else if (!evaluate || !NodeKeys(engine, node, set)) {
+            MergeKeys(set, CollectKeys(engine, sets, next));
+        }
+    }
+    return set;
+
+}  // End of CollectKeys
+
+static void FilterTreeIPKeys(FilterEngine_t *engine, uint32_t numBlocks) {
+    keySet_t *sets = calloc(numBlocks, sizeof(keySet_t));
+    if (!sets) return;
+
+    keySet_t *set = CollectKeys(engine, sets, engine->StartNode);
+    if (!set->unknown && set->numKeys) {
+        engine->ipKeys = set->keys;
+        engine->numIPKeys = set->numKeys;
+        set->keys = NULL;
+    }
+
+    for (uint32_t i = 0; i < numBlocks; i++) free(sets[i].keys);
+    free(sets);
+
+}  // End of FilterTreeIPKeys
+
+/*
+ * Block summary filter
+ * Node tests on the protocol, ports, bytes and packets are evaluated against the block
+ * summary, tests on the exporter sysID and router IP against the block bitmap, which
+ * tell, if the test can be true or false for any flow of the block.
+ * All other tests may be both. The block can be skipped, if no path of possible results
+ * through the filter tree accepts a flow.
+ */
+#define SUMMARY_TRUE 0x1
+#define SUMMARY_FALSE 0x2
+
+static int IsSummaryNode(const FilterEngine_t *engine, const filterElement_t *node) {
+    if (node->function != NULL) return 0;
+    if (node->extID != EXgenericFlowID && node->extID != EXnull && node->extID != EXipReceivedV4ID && node->extID != EXipReceivedV6ID)
+        return 0;
+    if (engine->Extended && preprocess_map[node->extID].function != NULL) return 0;
+
+    // bitmap nodes
+    if (node->extID == EXnull) return node->offset == OFFexporterID && node->length == SIZEexporterID && node->comp == CMP_EQ;
+    if (node->extID == EXipReceivedV4ID) return node->offset == OFFReceived4IP && node->length == SIZEReceived4IP && node->comp == CMP_EQ;
+    if (node->extID == EXipReceivedV6ID)
+        return (node->offset == OFFReceived6IP || node->offset == (OFFReceived6IP + sizeof(uint64_t))) && node->length == sizeof(uint64_t) &&
+               node->comp == CMP_EQ;
+
+    if (node->extID != EXgenericFlowID) return 0;
+
+    if (node->offset == OFFproto && node->length == SIZEproto) return node->comp == CMP_EQ;
+    if ((node->offset == OFFsrcPort || node->offset == OFFdstPort) && node->length == SIZEsrcPort) return node->comp == CMP_EQ;
+    if ((node->offset == OFFinBytes || node->offset == OFFinPackets) && node->length == sizeof(uint64_t))
+        return node->comp == CMP_EQ || node->comp == CMP_GT || node->comp == CMP_LT || node->comp == CMP_GE || node->comp == CMP_LE;
+    return 0;
+
+}  // End of IsSummaryNode
+
+// possible results of the node test for the flows of a block
+static int SummaryNode(const FilterEngine_t *engine, const filterElement_t *node, const blockSummary_t *blockSummary,
+                       const blockBitmap_t *blockBitmap) {
+    if (!IsSummaryNode(engine, node)) return SUMMARY_TRUE | SUMMARY_FALSE;
+
+    if (node->extID != EXgenericFlowID) {
+        // files without bitmaps may have any exporter or router
+        if (!blockBitmap) return SUMMARY_TRUE | SUMMARY_FALSE;
+        uint32_t bit;
+        const uint64_t *map;
+        if (node->extID == EXnull) {
+            bit = node->value % BITMAPEXPORTERBITS;
+            map = blockBitmap->exporterMap;
+        } else {
+            bit = BITMAPROUTERBIT(node->value);
+            map = blockBitmap->routerMap;
+        }
+        return ((map[bit >> 6] >> (bit & 0x3F)) & 1 ? SUMMARY_TRUE : 0) | SUMMARY_FALSE;
+    }
+
+    // flows without generic flow extension fail all tests
+    int canFalse = (blockSummary->flags & FLAG_SUMMARY_ALLFLOWS) == 0;
+    int canTrue = 0;
+    uint64_t value = node->value;
+    if (node->offset == OFFproto) {
+        canTrue = (blockSummary->protoMap[(value >> 6) & 0x3] >> (value & 0x3F)) & 1;
+        for (int i = 0; i < 4; i++) {
+            uint64_t others = i == ((value >> 6) & 0x3) ? ~(1ULL << (value & 0x3F)) : ~0ULL;
+            if (blockSummary->protoMap[i] & others) canFalse = 1;
+        }
+    } else if (node->offset == OFFsrcPort || node->offset == OFFdstPort) {
+        // hashed ports
+        uint32_t bit = value % SUMMARYPORTBITS;
+        canTrue = (blockSummary->portMap[bit >> 6] >> (bit & 0x3F)) & 1;
+        canFalse = 1;
+    } else {
+        uint64_t min = node->offset == OFFinBytes ? blockSummary->minBytes : blockSummary->minPackets;
+        uint64_t max = node->offset == OFFinBytes ? blockSummary->maxBytes : blockSummary->maxPackets;
+        switch (node->comp) {
+            case CMP_EQ:
+                canTrue = min <= value && value <= max;
+                canFalse |= min != value || max != value;
+                break;
+            case CMP_GT:
+                canTrue = max > value;
+                canFalse |= min <= value;
+                break;
+            case CMP_LT:
+                canTrue = min < value;
+                canFalse |= max >= value;
+                break;
+            case CMP_GE:
+                canTrue = max >= value;
+                canFalse |= min < value;
+                break;
+            case CMP_LE:
+                canTrue = min <= value;
+                canFalse |= max > value;
+                break;
+            default:
+                return SUMMARY_TRUE | SUMMARY_FALSE;
+        }
+    }
+    return (canTrue ? SUMMARY_TRUE : 0) | (canFalse ? SUMMARY_FALSE : 0);
+
+}  // End of SummaryNode
+
+int FilterSummaryCapable(const void *engine) {
+    const FilterEngine_t *filterEngine = (const FilterEngine_t *)engine;
+    return filterEngine && filterEngine->summaryNodes > 0;
+}  // End of FilterSummaryCapable
+
+// return 1, if the filter is the plain 'any' filter, which accepts every record
+int FilterMatchAll(const void *engine) {
+    const FilterEngine_t *filterEngine = (const FilterEngine_t *)engine;
+    if (filterEngine == NULL || filterEngine->numBlocks != 2 || filterEngine->StartNode != 1) return 0;
+    const filterElement_t *node = &(filterEngine->filter[1]);
+    return node->extID == EXnull && node->length == 0 && node->value == 0 && node->comp == CMP_EQ && node->function == NULL && !node->invert &&
+           node->OnTrue == 0 && node->OnFalse == 0;
+}  // End of FilterMatchAll
+
+// return 0, if no flow of a block with this summary can match the filter
+int FilterBlockSummary(const void *engine, const blockSummary_t *blockSummary, const blockBitmap_t *blockBitmap) {
+    const FilterEngine_t *filterEngine = (const FilterEngine_t *)engine;
+    if (!FilterSummaryCapable(engine)) return 1;
+
+    uint32_t numBlocks = filterEngine->numBlocks;
+    uint8_t *visited = calloc(numBlocks, sizeof(uint8_t));
+    uint32_t *stack = malloc(numBlocks * sizeof(uint32_t));
+    if (!visited || !stack) {
+        free(visited);
+        free(stack);
+        return 1;
+    }
+
+    int accept = 0;
+    uint32_t sp = 0;
+    stack[sp++] = filterEngine->StartNode;
+    visited[filterEngine->StartNode] = 1;
+    while (sp && !accept) {
+        const filterElement_t *node = &(filterEngine->filter[stack[--sp]]);
+        int results = SummaryNode(filterEngine, node, blockSummary, blockBitmap);
+        for (int evaluate = 0; evaluate <= 1; evaluate++) {
+            if ((results & (evaluate ? SUMMARY_TRUE : SUMMARY_FALSE)) == 0) continue;
+            uint32_t next = evaluate ? node->OnTrue : node->OnFalse;
+            if (next == 0) {
+                if (node->invert ? !evaluate : evaluate) accept = 1;
+            } else if (!visited[next]) {
+                visited[next] = 1;
+                stack[sp++] = next;
+            }
+        }
+    }
+    free(visited);
+    free(stack);
+    return accept;
+
+}  // End of FilterBlockSummary
+
 void *CompileFilter(char *FilterSyntax) {
     if (!FilterSyntax) return NULL;
 
@@ -878,11 +2217,27 @@ void *CompileFilter(char *FilterSyntax) {
         .label = NULL,
         .StartNode = StartNode,
         .Extended = Extended,
+        .extMask = FilterTreeExtensions(FilterTree, NumBlocks),
+        .ipKeys = NULL,
+        .numIPKeys = 0,
+        .numBlocks = NumBlocks,
+        .summaryNodes = 0,
         .filter = FilterTree,
         .hasGeoDB = 0,
         .filterFunction = Extended ? RunExtendedFilter : RunFilterFast,
     };
     FilterTree = NULL;
+    FilterTreeIPKeys(engine, NumBlocks);
+    for (uint32_t i = 1; i < NumBlocks; i++) {
+        if (IsSummaryNode(engine, &(engine->filter[i]))) engine->summaryNodes++;
+    }
+
+    // fall back to the tree interpreter, if the program can not be compiled
+    engine->program = CompileProgram(engine, NumBlocks);
+    if (engine->program) {
+        engine->filterFunction = RunProgram;
+        engine->program->blockPlan = CompileBlockPlan(engine);
+    }
 
     dbg_printf("Engine: %s\n", engine->Extended ? "extended" : "fast");
 
@@ -899,7 +2254,9 @@ void DumpEngine(void *arg) {
     if (arg == NULL) return;
     FilterEngine_t *engine = (FilterEngine_t *)arg;
 
-    printf("StartNode: %i Engine: %s\n", engine->StartNode, engine->Extended ? "Extended" : "Fast");
+    printf("StartNode: %i Engine: %s, compiled: %u instructions, %u pattern sets, block filter: %s\n", engine->StartNode,
+           engine->Extended ? "Extended" : "Fast", engine->program ? engine->program->numInstr - 1 : 0,
+           engine->program ? engine->program->numScans : 0, FilterBlockCapable(engine) ? "yes" : "no");
     for (int i = 1; i < NumBlocks; i++) {
         if (engine->filter[i].invert)
             printf(
@@ -938,3 +2295,50 @@ void DumpEngine(void *arg) {
     }
     printf("NumBlocks: %i\n", NumBlocks - 1);
 } /* End of DumpList */
+
+// cost class of a filter node, derived from the NodeCost() estimate
+static const char *CostClass(uint32_t cost) {
+    if (cost >= 32) return "very expensive";
+    if (cost >= 16) return "expensive";
+    if (cost >= 4) return "moderate";
+    return "cheap";
+}  // End of CostClass
+
+/*
+ * Print the optimized filter tree for the query plan. Each node is listed with its
+ * cost class in evaluation order of the tree, together with the block pruning
+ * capabilities of the filter
+ */
+void ExplainEngine(void *arg) {
+    if (arg == NULL) return;
+    FilterEngine_t *engine = (FilterEngine_t *)arg;
+
+    static const char *compName[] = {"==",  ">",      "<",   "ge",     "le",      "ident",   "flags", "string",
+                                     "sub", "binary", "net", "iplist", "u64list", "payload", "regex", "geo"};
+
+    printf("Filter engine   : %s, %s", engine->Extended ? "extended" : "fast",
+           engine->program ? "compiled" : "tree interpreter");
+    if (engine->program) printf(" %u instructions", engine->program->numInstr - 1);
+    printf("\n");
+    printf("Block filter    : %s\n", FilterBlockCapable(engine) ? "yes" : "no");
+    printf("IP keys         : %u%s\n", engine->numIPKeys, engine->numIPKeys ? " - files and blocks pruned by bloom filter" : "");
+    printf("Summary nodes   : %u%s\n", engine->summaryNodes, engine->summaryNodes ? " - blocks pruned by block summary" : "");
+
+    uint32_t totalCost = 0;
+    uint32_t numExpensive = 0;
+    printf("Filter tree     : start node %u\n", engine->StartNode);
+    for (uint32_t i = 1; i < engine->numBlocks; i++) {
+        filterElement_t *node = &(engine->filter[i]);
+        uint32_t cost = NodeCost(node);
+        totalCost += cost;
+        if (cost >= 16) numExpensive++;
+        const char *extName = node->extID < MAXEXTENSIONS ? extensionTable[node->extID].name : "preprocessed";
+        printf("  %3u: %s%s+%u/%u %s", i, node->invert ? "not " : "", extName, node->offset, node->length,
+               node->comp <= CMP_GEO ? compName[node->comp] : "?");
+        if (node->fname) printf(" %s()", node->fname);
+        if (node->label) printf(" label %s", node->label);
+        printf(", true: %u, false: %u, cost: %u %s\n", node->OnTrue, node->OnFalse, cost, CostClass(cost));
+    }
+    printf("Filter cost     : %u worst case per record, %u expensive node%s\n", totalCost, numExpensive, numExpensive == 1 ? "" : "s");
+
+}  // End of ExplainEngine
@@ -34,7 +34,9 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "ipbloom.h"
 #include "nfdump.h"
+#include "nffileV2.h"
 #include "nfxV3.h"
 #include "rbtree.h"
 
@@ -109,6 +111,7 @@ typedef enum {
     FUNC_PBLOCK,       // function code for matching ports against pblock start
     FUNC_MMAS_LOOKUP,  // function code for optional maxmind AS lookup
     FUNC_TOR_LOOKUP,   // function code for optional tor node  lookup
+    FUNC_LABEL_LOOKUP, // function code for optional prefix label lookup
     FUNC_JA3,          // function code for ja3 calc
 } filterFunction_t;
 
@@ -120,6 +123,7 @@ struct IPListNode {
     entry;
     uint64_t ip[2];
     uint64_t mask[2];
+    int af;  // PF_INET or PF_INET6
 };
 
 /* Definition of the uint64_t list node */
@@ -167,8 +171,27 @@ void FilterSetParam(void *engine, const char *ident, const int hasGeoDB);
 
 int FilterRecord(const void *engine, recordHandle_t *handle);
 
+uint64_t FilterExtensions(const void *engine);
+uint32_t FilterIPKeys(const void *engine, ipKey_t **keys);
+int FilterSummaryCapable(const void *engine);
+int FilterBlockSummary(const void *engine, const blockSummary_t *blockSummary, const blockBitmap_t *blockBitmap);
+
+int FilterMatchAll(const void *engine);
+
+int FilterBlockCapable(const void *engine);
+
+int FilterRecordBlock(const void *engine, recordHeaderV3_t **records, uint32_t numRecords, uint8_t *match);
+
+void *CompileFilterSet(void **engines, uint32_t numEngines);
+
+void FilterRecordSet(void *filterSet, recordHandle_t *handle, uint64_t *match);
+
+void DisposeFilterSet(void *filterSet);
+
 void DumpEngine(void *arg);
 
+void ExplainEngine(void *arg);
+
 void lex_init(char *buf);
 
 void lex_cleanup(void);
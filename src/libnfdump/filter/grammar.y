@@ -51,6 +51,7 @@
 #include "sgregex.h"
 #include "ja3/ja3.h"
 #include "ja4/ja4.h"
+#include "label/label.h"
 #include "nfdump.h"
 
 #define AnyMask 0xffffffffffffffffLL
@@ -144,6 +145,8 @@ static int AddPayload(char *type, char *arg, char *opt);
 
 static int AddGeo(direction_t direction, char *geo);
 
+static int AddLabel(direction_t direction, char *label);
+
 static int AddObservation(char *type, char *subType, uint16_t comp, uint64_t number);
 
 static int AddVRF(direction_t direction, uint16_t comp, uint64_t number);
@@ -183,7 +186,7 @@ static int AddASList(direction_t direction, void *U64List);
 %token DURATION PPS BPS BPP FLAGS
 %token PROTO PORT AS IF VLAN MPLS MAC ICMP ICMPTYPE ICMPCODE
 %token PACKETS BYTES FLOWS ETHERTYPE
-%token MASK FLOWDIR TOS FWDSTAT LATENCY ASA ACL PAYLOAD VRF
+%token MASK FLOWDIR TOS FWDSTAT LATENCY ASA ACL PAYLOAD VRF LABEL
 %token OBSERVATION PF
 %token <s> STRING
 %token <s> GEOSTRING
@@ -364,6 +367,10 @@ term:	ANY { /* this is an unconditionally true expression, as a filter applies i
 		$$.self = AddMPLS($2, $3.comp, $4); if ( $$.self < 0 ) YYABORT; 
 	}
 
+	| MPLS LABEL comp NUMBER {	
+		$$.self = AddMPLS("label", $3.comp, $4); if ( $$.self < 0 ) YYABORT; 
+	}
+
 	| MPLS ANY comp NUMBER {	
 		$$.self = AddMPLS("any", $3.comp, $4); if ( $$.self < 0 ) YYABORT; 
 	}
@@ -431,6 +438,10 @@ term:	ANY { /* this is an unconditionally true expression, as a filter applies i
 		$$.self = AddGeo($1.direction, $2); if ( $$.self < 0 ) YYABORT;
 	}
 
+	| dqual LABEL STRING {
+		$$.self = AddLabel($1.direction, $3); if ( $$.self < 0 ) YYABORT;
+	}
+
 	| OBSERVATION STRING STRING comp NUMBER {
 		$$.self = AddObservation($2, $3, $4.comp, $5); if ( $$.self < 0 ) YYABORT;
 	}
@@ -1412,6 +1423,51 @@ static int AddGeo(direction_t direction, char *geo) {
 	return ret;
 } // End of AddGeo
 
+static int AddLabel(direction_t direction, char *label) {
+
+	if ( !HasLabelDB() ) {
+		yyprintf("Label filter requires a label DB. Use -l <labelDB>");
+		return -1;
+	}
+
+	uint32_t labelID = LabelID(label);
+	if ( labelID == 0 ) {
+		yyprintf("Unknown label: %s", label);
+		return -1;
+	}
+
+	int ret = -1;
+	switch ( direction ) {
+		case DIR_SRC:
+			ret = Connect_OR(
+				NewElement(EXipv4FlowID, OFFsrc4Addr, SIZEsrc4Addr, labelID, CMP_EQ, FUNC_LABEL_LOOKUP, NULLPtr), 
+				NewElement(EXipv6FlowID, OFFsrc6Addr, SIZEsrc6Addr, labelID, CMP_EQ, FUNC_LABEL_LOOKUP, NULLPtr)
+			);
+			break;
+		case DIR_DST:
+			ret = Connect_OR(
+				NewElement(EXipv4FlowID, OFFdst4Addr, SIZEdst4Addr, labelID, CMP_EQ, FUNC_LABEL_LOOKUP, (data_t){.dataVal = 1}), 
+				NewElement(EXipv6FlowID, OFFdst6Addr, SIZEdst6Addr, labelID, CMP_EQ, FUNC_LABEL_LOOKUP, (data_t){.dataVal = 1})
+			);
+			break;
+		case DIR_UNSPEC: {
+			int src = Connect_OR(
+				NewElement(EXipv4FlowID, OFFsrc4Addr, SIZEsrc4Addr, labelID, CMP_EQ, FUNC_LABEL_LOOKUP, NULLPtr), 
+				NewElement(EXipv6FlowID, OFFsrc6Addr, SIZEsrc6Addr, labelID, CMP_EQ, FUNC_LABEL_LOOKUP, NULLPtr)
+			);
+			int dst = Connect_OR(
+				NewElement(EXipv4FlowID, OFFdst4Addr, SIZEdst4Addr, labelID, CMP_EQ, FUNC_LABEL_LOOKUP, (data_t){.dataVal = 1}), 
+				NewElement(EXipv6FlowID, OFFdst6Addr, SIZEdst6Addr, labelID, CMP_EQ, FUNC_LABEL_LOOKUP, (data_t){.dataVal = 1})
+			);
+			ret = Connect_OR(src,dst); 
+			} break;
+		default:
+			yyprintf("Invalid direction for label lookup");
+	}
+
+	return ret;
+} // End of AddLabel
+
 static int AddObservation(char *type, char *subType, uint16_t comp, uint64_t number) {
 
 	if (strcasecmp(subType, "id") != 0) {
@@ -1507,8 +1563,8 @@ static int AddIP(direction_t direction, char *IPstr) {
 			break;
 		case DIR_DST:
 			ret = Connect_OR(
-				NewElement(EXipv4FlowID, OFFdst4Addr, SIZEdst4Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, NULLPtr), 
-				NewElement(EXipv6FlowID, OFFdst6Addr, SIZEdst6Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, NULLPtr)
+				NewElement(EXipv4FlowID, OFFdst4Addr, SIZEdst4Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, (data_t){.dataVal = 1}), 
+				NewElement(EXipv6FlowID, OFFdst6Addr, SIZEdst6Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, (data_t){.dataVal = 1})
 			);
 			break;
 		case DIR_UNSPEC: {
@@ -1517,8 +1573,8 @@ static int AddIP(direction_t direction, char *IPstr) {
 				NewElement(EXipv6FlowID, OFFsrc6Addr, SIZEsrc6Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, NULLPtr)
 			);
 			int dst = Connect_OR(
-				NewElement(EXipv4FlowID, OFFdst4Addr, SIZEdst4Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, NULLPtr), 
-				NewElement(EXipv6FlowID, OFFdst6Addr, SIZEdst6Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, NULLPtr)
+				NewElement(EXipv4FlowID, OFFdst4Addr, SIZEdst4Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, (data_t){.dataVal = 1}), 
+				NewElement(EXipv6FlowID, OFFdst6Addr, SIZEdst6Addr, 1, CMP_EQ, FUNC_TOR_LOOKUP, (data_t){.dataVal = 1})
 			);
 			ret = Connect_OR(src,dst); 
 			} break;
@@ -1796,6 +1852,7 @@ static struct IPListNode *mkNode(ipStack_t ipStack, int64_t prefix) {
 		return NULL;
 	}
 
+	node->af = ipStack.af;
 	node->ip[0] = ipStack.ipaddr[0];
 	node->ip[1] = ipStack.ipaddr[1];
 	node->mask[0] = 0xffffffffffffffffLL;
@@ -1828,6 +1885,22 @@ static struct IPListNode *mkNode(ipStack_t ipStack, int64_t prefix) {
 	return node;
 }
 
+// insert node into the IP list. Overlapping prefixes compare equal in the tree,
+// so keep the covering, shorter prefix
+static void InsertIPNode(IPlist_t *root, struct IPListNode *node) {
+	struct IPListNode *exist = RB_INSERT(IPtree, root, node);
+	if ( exist == NULL ) return;
+
+	int covers = (node->mask[0] & exist->mask[0]) == node->mask[0] && (node->mask[1] & exist->mask[1]) == node->mask[1];
+	if ( covers && exist->af == node->af ) {
+		exist->ip[0] = node->ip[0] & node->mask[0];
+		exist->ip[1] = node->ip[1] & node->mask[1];
+		exist->mask[0] = node->mask[0];
+		exist->mask[1] = node->mask[1];
+	}
+	free(node);
+} // End of InsertIPNode
+
 static void *NewIplist(char *IPstr, int prefix) {
 	IPlist_t *root = malloc(sizeof(IPlist_t));
 	if (root == NULL) {
@@ -1846,7 +1919,7 @@ static void *NewIplist(char *IPstr, int prefix) {
 	for (int i=0; i<numIP; i++ ) {
 	  struct IPListNode *node = mkNode(ipStack[i], prefix);
 		if ( node ) {
-			RB_INSERT(IPtree, root, node);
+			InsertIPNode(root, node);
 		} else {
 			free(root);
 			return NULL;
@@ -1867,7 +1940,7 @@ static int InsertIPlist(void *IPlist, char *IPstr, int64_t prefix) {
 	for (int i=0; i<numIP; i++ ) {
 		struct IPListNode *node = mkNode(ipStack[i], prefix);
 		if ( node ) {
-			RB_INSERT(IPtree, (IPlist_t *)IPlist, node);
+			InsertIPNode((IPlist_t *)IPlist, node);
 		} else {
 			return 0;
 		}
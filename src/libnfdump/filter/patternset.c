@@ -0,0 +1,232 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "patternset.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+// automaton state - state 0 is the root
+typedef struct acState_s {
+    int32_t pattern;    // pattern ending in this state or -1
+    uint32_t depth;     // length of the string leading to this state
+    uint32_t output;    // first state with a pattern on the failure chain including this state
+    uint32_t dictNext;  // next state with a pattern on the failure chain
+} acState_t;
+
+struct patternSet_s {
+    // collected patterns
+    char **pattern;
+    uint32_t *length;
+    uint32_t numPatterns;
+    uint32_t maxPatterns;
+
+    // compiled automaton
+    uint8_t classMap[256];
+    uint32_t numClasses;
+    uint32_t numStates;
+    acState_t *state;
+    uint32_t *delta;  // numStates * numClasses transitions
+};
+
+patternSet_t *NewPatternSet(void) {
+    patternSet_t *set = calloc(1, sizeof(patternSet_t));
+    if (!set) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    return set;
+}  // End of NewPatternSet
+
+// add pattern to the set - returns the pattern id or -1 on error
+int PatternSetAdd(patternSet_t *set, const char *pattern, size_t len) {
+    if (len == 0 || set->delta) {
+        LogError("Can not add pattern to pattern set");
+        return -1;
+    }
+
+    // equal patterns share the id
+    for (uint32_t i = 0; i < set->numPatterns; i++) {
+        if (set->length[i] == len && memcmp(set->pattern[i], pattern, len) == 0) return i;
+    }
+
+    if (set->numPatterns == set->maxPatterns) {
+        set->maxPatterns += 256;
+        char **p = realloc(set->pattern, set->maxPatterns * sizeof(char *));
+        if (p) set->pattern = p;
+        uint32_t *l = realloc(set->length, set->maxPatterns * sizeof(uint32_t));
+        if (l) set->length = l;
+        if (!p || !l) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return -1;
+        }
+    }
+
+    char *s = malloc(len);
+    if (!s) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return -1;
+    }
+    memcpy(s, pattern, len);
+    set->pattern[set->numPatterns] = s;
+    set->length[set->numPatterns] = len;
+
+    return set->numPatterns++;
+
+}  // End of PatternSetAdd
+
+int PatternSetBuild(patternSet_t *set) {
+    if (set->numPatterns == 0 || set->delta) return 0;
+
+    // every byte used in a pattern gets its own class, all other bytes share class 0
+    memset(set->classMap, 0, sizeof(set->classMap));
+    set->numClasses = 1;
+    size_t maxStates = 1;
+    for (uint32_t i = 0; i < set->numPatterns; i++) {
+        const uint8_t *p = (uint8_t *)set->pattern[i];
+        for (uint32_t j = 0; j < set->length[i]; j++) {
+            if (set->classMap[p[j]] == 0) set->classMap[p[j]] = set->numClasses++;
+        }
+        maxStates += set->length[i];
+    }
+    // class index must fit into uint8_t
+    if (set->numClasses > 256) {
+        LogError("Too many byte classes in pattern set");
+        return 0;
+    }
+
+    set->state = malloc(maxStates * sizeof(acState_t));
+    set->delta = calloc(maxStates * set->numClasses, sizeof(uint32_t));
+    uint32_t *fail = malloc(maxStates * sizeof(uint32_t));
+    uint32_t *queue = malloc(maxStates * sizeof(uint32_t));
+    if (!set->state || !set->delta || !fail || !queue) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(set->state);
+        free(set->delta);
+        free(fail);
+        free(queue);
+        set->state = NULL;
+        set->delta = NULL;
+        return 0;
+    }
+
+    // build the trie of all patterns - transition 0 means no child, as the root is never a child
+    uint32_t numClasses = set->numClasses;
+    set->state[0] = (acState_t){.pattern = -1};
+    set->numStates = 1;
+    for (uint32_t i = 0; i < set->numPatterns; i++) {
+        const uint8_t *p = (uint8_t *)set->pattern[i];
+        uint32_t s = 0;
+        for (uint32_t j = 0; j < set->length[i]; j++) {
+            uint32_t *t = &(set->delta[s * numClasses + set->classMap[p[j]]]);
+            if (*t == 0) {
+                *t = set->numStates;
+                set->state[set->numStates++] = (acState_t){.pattern = -1, .depth = j + 1};
+            }
+            s = *t;
+        }
+        set->state[s].pattern = i;
+    }
+
+    // compute failure links in breadth first order and turn the trie into a DFA
+    uint32_t head = 0, tail = 0;
+    fail[0] = 0;
+    for (uint32_t c = 0; c < numClasses; c++) {
+        uint32_t t = set->delta[c];
+        if (t) {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+    while (head < tail) {
+        uint32_t s = queue[head++];
+        acState_t *state = &(set->state[s]);
+        state->output = state->pattern >= 0 ? s : set->state[fail[s]].output;
+        state->dictNext = set->state[fail[s]].output;
+        uint32_t *delta = &(set->delta[s * numClasses]);
+        uint32_t *failDelta = &(set->delta[fail[s] * numClasses]);
+        for (uint32_t c = 0; c < numClasses; c++) {
+            if (delta[c]) {
+                fail[delta[c]] = failDelta[c];
+                queue[tail++] = delta[c];
+            } else {
+                delta[c] = failDelta[c];
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return 1;
+
+}  // End of PatternSetBuild
+
+int PatternSetScan(const patternSet_t *set, const void *data, size_t len, uint64_t *anyMatch, uint64_t *fullMatch) {
+    const uint8_t *p = (const uint8_t *)data;
+    const acState_t *state = set->state;
+    uint32_t numClasses = set->numClasses;
+
+    int found = 0;
+    uint32_t s = 0;
+    for (size_t i = 0; i < len; i++) {
+        s = set->delta[s * numClasses + set->classMap[p[i]]];
+        for (uint32_t o = state[s].output; o; o = state[o].dictNext) {
+            uint32_t id = state[o].pattern;
+            anyMatch[id >> 6] |= 1ULL << (id & 0x3F);
+            found = 1;
+        }
+    }
+
+    // the whole data is a pattern, if the final state is reached by data alone
+    if (len && state[s].depth == len && state[s].pattern >= 0) {
+        uint32_t id = state[s].pattern;
+        fullMatch[id >> 6] |= 1ULL << (id & 0x3F);
+    }
+
+    return found;
+
+}  // End of PatternSetScan
+
+uint32_t PatternSetSize(const patternSet_t *set) { return set->numPatterns; }
+
+void FreePatternSet(patternSet_t *set) {
+    if (!set) return;
+    for (uint32_t i = 0; i < set->numPatterns; i++) free(set->pattern[i]);
+    free(set->pattern);
+    free(set->length);
+    free(set->state);
+    free(set->delta);
+    free(set);
+}  // End of FreePatternSet
@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _PATTERNSET_H
+#define _PATTERNSET_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Multi pattern matcher for sets of literal strings, based on an Aho-Corasick automaton.
+ * Patterns are collected with PatternSetAdd() and compiled once by PatternSetBuild() into
+ * a deterministic automaton over byte classes. PatternSetScan() scans the data once and
+ * sets the bit of each pattern found in anyMatch and of the pattern, which is equal to
+ * the entire data, in fullMatch. It returns 1, if any pattern was found. The bit arrays
+ * must hold PatternSetSize() bits and are cleared by the caller.
+ */
+
+typedef struct patternSet_s patternSet_t;
+
+patternSet_t *NewPatternSet(void);
+
+int PatternSetAdd(patternSet_t *set, const char *pattern, size_t len);
+
+int PatternSetBuild(patternSet_t *set);
+
+int PatternSetScan(const patternSet_t *set, const void *data, size_t len, uint64_t *anyMatch, uint64_t *fullMatch);
+
+uint32_t PatternSetSize(const patternSet_t *set);
+
+void FreePatternSet(patternSet_t *set);
+
+#endif  //_PATTERNSET_H
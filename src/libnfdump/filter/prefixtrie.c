@@ -0,0 +1,379 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "prefixtrie.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "util.h"
+
+#define STRIDE 6
+
+// prefix as inserted - the address is left aligned in 128 bits
+typedef struct prefix_s {
+    uint64_t hi;
+    uint64_t lo;
+    uint32_t len;
+    uint32_t value;
+} prefix_t;
+
+// compiled trie node
+// vector:  bit s is set, if slot s has a child node at base1 + popcount of lower bits
+// leafvec: bit s is set, if a new run of equal leaves starts at slot s, leaf at base0 + index of run
+typedef struct trieNode_s {
+    uint64_t vector;
+    uint64_t leafvec;
+    uint32_t base0;
+    uint32_t base1;
+} trieNode_t;
+
+struct prefixTrie_s {
+    int af;
+    uint32_t maxLen;  // 32 or 128 bits
+    int mapped;       // node and leaf arrays refer to an image
+
+    // collected prefixes
+    prefix_t *prefix;
+    uint32_t numPrefix;
+    uint32_t maxPrefix;
+
+    // compiled trie
+    trieNode_t *node;
+    uint32_t numNodes;
+    uint32_t maxNodes;
+    uint32_t *leaf;
+    uint32_t numLeaves;
+    uint32_t maxLeaves;
+};
+
+// extract STRIDE bits at bit position pos counted from the MSB of hi:lo
+static inline uint32_t TrieSlot(uint64_t hi, uint64_t lo, uint32_t pos) {
+    if (pos + STRIDE <= 64) return (hi >> (64 - STRIDE - pos)) & 0x3F;
+    if (pos >= 64) {
+        pos -= 64;
+        if (pos + STRIDE <= 64) return (lo >> (64 - STRIDE - pos)) & 0x3F;
+        return (lo << (pos - (64 - STRIDE))) & 0x3F;
+    }
+    // slot spans both words
+    return ((hi << (pos - (64 - STRIDE))) | (lo >> (128 - STRIDE - pos))) & 0x3F;
+}  // End of TrieSlot
+
+// number of bits set in vector at position <= slot
+static inline uint32_t PopCount(uint64_t vector, uint32_t slot) { return __builtin_popcountll(vector << (63 - slot)); }
+
+prefixTrie_t *NewPrefixTrie(int af) {
+    prefixTrie_t *trie = calloc(1, sizeof(prefixTrie_t));
+    if (!trie) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    trie->af = af;
+    trie->maxLen = af == PF_INET6 ? 128 : 32;
+
+    return trie;
+}  // End of NewPrefixTrie
+
+int PrefixTrieInsert(prefixTrie_t *trie, const uint64_t ip[2], uint32_t prefixLen, uint32_t value) {
+    if (prefixLen > trie->maxLen || value == 0) {
+        LogError("Invalid prefix length %u or value %u", prefixLen, value);
+        return 0;
+    }
+
+    if (trie->numPrefix == trie->maxPrefix) {
+        trie->maxPrefix += 1024;
+        prefix_t *p = realloc(trie->prefix, trie->maxPrefix * sizeof(prefix_t));
+        if (!p) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        trie->prefix = p;
+    }
+
+    prefix_t *prefix = &(trie->prefix[trie->numPrefix++]);
+    if (trie->af == PF_INET6) {
+        prefix->hi = ip[0];
+        prefix->lo = ip[1];
+    } else {
+        prefix->hi = ip[1] << 32;
+        prefix->lo = 0;
+    }
+    // clear host bits
+    if (prefixLen < 64) {
+        prefix->hi = prefixLen ? prefix->hi & (0xFFFFFFFFFFFFFFFFULL << (64 - prefixLen)) : 0;
+        prefix->lo = 0;
+    } else if (prefixLen < 128) {
+        prefix->lo = prefixLen > 64 ? prefix->lo & (0xFFFFFFFFFFFFFFFFULL << (128 - prefixLen)) : 0;
+    }
+    prefix->len = prefixLen;
+    prefix->value = value;
+
+    return 1;
+}  // End of PrefixTrieInsert
+
+// sort by address, shorter prefixes first
+static int PrefixCMP(const void *a, const void *b) {
+    const prefix_t *p1 = (const prefix_t *)a;
+    const prefix_t *p2 = (const prefix_t *)b;
+    if (p1->hi != p2->hi) return p1->hi < p2->hi ? -1 : 1;
+    if (p1->lo != p2->lo) return p1->lo < p2->lo ? -1 : 1;
+    if (p1->len != p2->len) return p1->len < p2->len ? -1 : 1;
+    return 0;
+}  // End of PrefixCMP
+
+static int AllocNodes(prefixTrie_t *trie, uint32_t num) {
+    if (trie->numNodes + num > trie->maxNodes) {
+        trie->maxNodes = 2 * (trie->numNodes + num);
+        trieNode_t *n = realloc(trie->node, trie->maxNodes * sizeof(trieNode_t));
+        if (!n) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        trie->node = n;
+    }
+    trie->numNodes += num;
+    return 1;
+}  // End of AllocNodes
+
+static int AllocLeaves(prefixTrie_t *trie, uint32_t num) {
+    if (trie->numLeaves + num > trie->maxLeaves) {
+        trie->maxLeaves = 2 * (trie->numLeaves + num);
+        uint32_t *l = realloc(trie->leaf, trie->maxLeaves * sizeof(uint32_t));
+        if (!l) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        trie->leaf = l;
+    }
+    trie->numLeaves += num;
+    return 1;
+}  // End of AllocLeaves
+
+// build node nodeIndex at bit depth from the sorted prefixes, which share the upper depth bits.
+// def is the value of the longest prefix covering this node
+static int BuildNode(prefixTrie_t *trie, uint32_t nodeIndex, uint32_t depth, prefix_t *prefix, uint32_t num, uint32_t def) {
+    uint32_t leaf[64];
+    for (int s = 0; s < 64; s++) leaf[s] = def;
+
+    // expand prefixes ending in this node - longer prefixes overwrite shorter ones
+    uint64_t vector = 0;
+    for (uint32_t len = depth; len < depth + STRIDE; len++) {
+        for (uint32_t i = 0; i < num; i++) {
+            if (prefix[i].len != len) continue;
+            uint32_t slot = TrieSlot(prefix[i].hi, prefix[i].lo, depth);
+            uint32_t span = 1 << (depth + STRIDE - len);
+            for (uint32_t s = slot; s < slot + span; s++) leaf[s] = prefix[i].value;
+        }
+    }
+    for (uint32_t i = 0; i < num; i++) {
+        if (prefix[i].len >= depth + STRIDE) vector |= 1ULL << TrieSlot(prefix[i].hi, prefix[i].lo, depth);
+    }
+
+    // run length compress the leaves of all slots without child
+    uint64_t leafvec = 0;
+    uint32_t numRuns = 0;
+    uint32_t runs[64];
+    for (int s = 0; s < 64; s++) {
+        if (vector & (1ULL << s)) continue;
+        if (s == 0 || (vector & (1ULL << (s - 1))) || leaf[s - 1] != leaf[s]) {
+            leafvec |= 1ULL << s;
+            runs[numRuns++] = leaf[s];
+        }
+    }
+
+    uint32_t base0 = trie->numLeaves;
+    if (!AllocLeaves(trie, numRuns)) return 0;
+    memcpy((void *)&(trie->leaf[base0]), (void *)runs, numRuns * sizeof(uint32_t));
+
+    uint32_t base1 = trie->numNodes;
+    if (!AllocNodes(trie, __builtin_popcountll(vector))) return 0;
+
+    trie->node[nodeIndex] = (trieNode_t){.vector = vector, .leafvec = leafvec, .base0 = base0, .base1 = base1};
+
+    // build the child nodes - the prefixes of a child are consecutive in the sorted list
+    uint32_t child = base1;
+    uint32_t i = 0;
+    while (i < num) {
+        if (prefix[i].len < depth + STRIDE) {
+            i++;
+            continue;
+        }
+        uint32_t slot = TrieSlot(prefix[i].hi, prefix[i].lo, depth);
+        uint32_t first = i;
+        while (i < num && (prefix[i].len < depth + STRIDE || TrieSlot(prefix[i].hi, prefix[i].lo, depth) == slot)) i++;
+        if (!BuildNode(trie, child, depth + STRIDE, &prefix[first], i - first, leaf[slot])) return 0;
+        child++;
+    }
+
+    return 1;
+}  // End of BuildNode
+
+int PrefixTrieBuild(prefixTrie_t *trie) {
+    if (trie->mapped) {
+        LogError("PrefixTrieBuild(): trie is mapped read only");
+        return 0;
+    }
+
+    // drop a previous build
+    free(trie->node);
+    free(trie->leaf);
+    trie->node = NULL;
+    trie->leaf = NULL;
+    trie->numNodes = trie->maxNodes = 0;
+    trie->numLeaves = trie->maxLeaves = 0;
+
+    if (trie->numPrefix) qsort(trie->prefix, trie->numPrefix, sizeof(prefix_t), PrefixCMP);
+
+    // duplicate prefixes keep the last inserted value
+    uint32_t num = 0;
+    for (uint32_t i = 0; i < trie->numPrefix; i++) {
+        if (num && trie->prefix[num - 1].hi == trie->prefix[i].hi && trie->prefix[num - 1].lo == trie->prefix[i].lo &&
+            trie->prefix[num - 1].len == trie->prefix[i].len) {
+            trie->prefix[num - 1].value = trie->prefix[i].value;
+        } else {
+            trie->prefix[num++] = trie->prefix[i];
+        }
+    }
+    trie->numPrefix = num;
+
+    if (!AllocNodes(trie, 1)) return 0;
+    return BuildNode(trie, 0, 0, trie->prefix, trie->numPrefix, 0);
+
+}  // End of PrefixTrieBuild
+
+uint32_t PrefixTrieLookup(const prefixTrie_t *trie, const uint64_t ip[2]) {
+    uint64_t hi, lo;
+    if (trie->af == PF_INET6) {
+        hi = ip[0];
+        lo = ip[1];
+    } else {
+        hi = ip[1] << 32;
+        lo = 0;
+    }
+
+    const trieNode_t *node = trie->node;
+    uint32_t depth = 0;
+    while (1) {
+        uint32_t slot = TrieSlot(hi, lo, depth);
+        if (node->vector & (1ULL << slot)) {
+            node = &(trie->node[node->base1 + PopCount(node->vector, slot) - 1]);
+            depth += STRIDE;
+        } else {
+            return trie->leaf[node->base0 + PopCount(node->leafvec, slot) - 1];
+        }
+    }
+
+    // unreached
+}  // End of PrefixTrieLookup
+
+uint32_t PrefixTrieSize(const prefixTrie_t *trie) { return trie->numPrefix; }
+
+/*
+ * Trie image
+ * The image starts with a trieImageHeader_t, followed by the node array and the leaf array.
+ * The nodes are 8 byte aligned, the image size is a multiple of 8 bytes.
+ */
+typedef struct trieImageHeader_s {
+    uint32_t numNodes;
+    uint32_t numLeaves;
+} trieImageHeader_t;
+
+size_t PrefixTrieImageSize(const prefixTrie_t *trie) {
+    size_t size = sizeof(trieImageHeader_t) + (size_t)trie->numNodes * sizeof(trieNode_t) + (size_t)trie->numLeaves * sizeof(uint32_t);
+    return (size + 7) & ~(size_t)7;
+}  // End of PrefixTrieImageSize
+
+// write the compiled trie into image, which holds PrefixTrieImageSize() bytes
+// returns the number of bytes written
+size_t PrefixTrieExport(const prefixTrie_t *trie, void *image) {
+    size_t imageSize = PrefixTrieImageSize(trie);
+    memset(image, 0, imageSize);
+
+    trieImageHeader_t *header = (trieImageHeader_t *)image;
+    header->numNodes = trie->numNodes;
+    header->numLeaves = trie->numLeaves;
+    void *node = image + sizeof(trieImageHeader_t);
+    memcpy(node, (void *)trie->node, (size_t)trie->numNodes * sizeof(trieNode_t));
+    memcpy(node + (size_t)trie->numNodes * sizeof(trieNode_t), (void *)trie->leaf, (size_t)trie->numLeaves * sizeof(uint32_t));
+
+    return imageSize;
+}  // End of PrefixTrieExport
+
+// map a trie from an image, written by PrefixTrieExport(). The image must stay valid
+// and 8 byte aligned for the lifetime of the trie
+prefixTrie_t *MapPrefixTrie(int af, const void *image, size_t imageSize) {
+    const trieImageHeader_t *header = (const trieImageHeader_t *)image;
+    if (imageSize < sizeof(trieImageHeader_t) || ((uintptr_t)image & 7) != 0 || header->numNodes == 0 ||
+        ((uint64_t)header->numNodes * sizeof(trieNode_t) + (uint64_t)header->numLeaves * sizeof(uint32_t)) >
+            (imageSize - sizeof(trieImageHeader_t))) {
+        LogError("MapPrefixTrie(): invalid trie image");
+        return NULL;
+    }
+
+    const trieNode_t *node = (const trieNode_t *)(image + sizeof(trieImageHeader_t));
+    // child nodes follow their parent, so each lookup terminates
+    for (uint32_t i = 0; i < header->numNodes; i++) {
+        uint32_t numChilds = __builtin_popcountll(node[i].vector);
+        uint32_t numRuns = __builtin_popcountll(node[i].leafvec);
+        // the first slot without child must be covered by a run
+        uint64_t noChild = ~node[i].vector;
+        uint64_t firstLeaf = noChild & -noChild;
+        if ((numChilds && (node[i].base1 <= i || ((uint64_t)node[i].base1 + numChilds) > header->numNodes)) ||
+            ((uint64_t)node[i].base0 + numRuns) > header->numLeaves || (noChild && (node[i].leafvec & ((firstLeaf << 1) - 1)) == 0)) {
+            LogError("MapPrefixTrie(): corrupt trie node %u", i);
+            return NULL;
+        }
+    }
+
+    prefixTrie_t *trie = NewPrefixTrie(af);
+    if (!trie) return NULL;
+    trie->mapped = 1;
+    trie->node = (trieNode_t *)node;
+    trie->numNodes = trie->maxNodes = header->numNodes;
+    trie->leaf = (uint32_t *)((void *)node + (size_t)header->numNodes * sizeof(trieNode_t));
+    trie->numLeaves = trie->maxLeaves = header->numLeaves;
+
+    return trie;
+}  // End of MapPrefixTrie
+
+void FreePrefixTrie(prefixTrie_t *trie) {
+    if (!trie) return;
+    free(trie->prefix);
+    if (!trie->mapped) {
+        free(trie->node);
+        free(trie->leaf);
+    }
+    free(trie);
+}  // End of FreePrefixTrie
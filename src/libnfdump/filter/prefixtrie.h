@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _PREFIXTRIE_H
+#define _PREFIXTRIE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compressed multibit prefix trie for IPv4 and IPv6 prefix sets, modelled after poptrie.
+ * Prefixes are collected with PrefixTrieInsert() and compiled once by PrefixTrieBuild().
+ * Each trie node covers 6 bits of the address, child nodes and leaves are indexed by the
+ * popcount of the node bitmaps. Lookups return the value of the longest matching prefix.
+ *
+ * Addresses are given as two 64bit words in host byte order, as stored in the flow records.
+ * IPv4 addresses are passed in ip[1].
+ *
+ * A compiled trie may be exported into a binary image and mapped again from it, e.g. from
+ * a file mapped with mmap(). A mapped trie is read only and refers to the image memory.
+ */
+
+typedef struct prefixTrie_s prefixTrie_t;
+
+prefixTrie_t *NewPrefixTrie(int af);
+
+int PrefixTrieInsert(prefixTrie_t *trie, const uint64_t ip[2], uint32_t prefixLen, uint32_t value);
+
+int PrefixTrieBuild(prefixTrie_t *trie);
+
+uint32_t PrefixTrieLookup(const prefixTrie_t *trie, const uint64_t ip[2]);
+
+#define PrefixTrieContains(trie, ip) (PrefixTrieLookup((trie), (ip)) != 0)
+
+uint32_t PrefixTrieSize(const prefixTrie_t *trie);
+
+size_t PrefixTrieImageSize(const prefixTrie_t *trie);
+
+size_t PrefixTrieExport(const prefixTrie_t *trie, void *image);
+
+prefixTrie_t *MapPrefixTrie(int af, const void *image, size_t imageSize);
+
+void FreePrefixTrie(prefixTrie_t *trie);
+
+#endif  //_PREFIXTRIE_H
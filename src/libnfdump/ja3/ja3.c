@@ -39,6 +39,7 @@
 #include <unistd.h>
 
 #include "digest/md5.h"
+#include "nfdump.h"
 #include "ssl/ssl.h"
 #include "util.h"
 
@@ -152,6 +153,32 @@ char *ja3Process(ssl_t *ssl, char *buff) {
 
 }  // End of ja3Process
 
+// compute the ja3 string once per record
+char *GetRecordJA3(recordHandle_t *handle) {
+    if (handle->extensionList[JA3index] || (handle->derived & DERIVED_JA3)) return handle->extensionList[JA3index];
+    handle->derived |= DERIVED_JA3;
+
+    ssl_t *ssl = GetRecordSSL(handle);
+    if (ssl == NULL) return NULL;
+
+    // the ja3 of a cached hello is computed once
+    sslCacheEntry_t *entry = GetRecordSSLEntry(handle);
+    if (entry == NULL) {
+        handle->extensionList[JA3index] = ja3Process(ssl, NULL);
+        return handle->extensionList[JA3index];
+    }
+    if ((entry->derived & DERIVED_JA3) == 0) {
+        entry->ja3 = ja3Process(ssl, NULL);
+        entry->derived |= DERIVED_JA3;
+    }
+    if (entry->ja3) {
+        handle->extensionList[JA3index] = entry->ja3;
+        handle->derived |= CACHED_JA3;
+    }
+    return entry->ja3;
+
+}  // End of GetRecordJA3
+
 #ifdef MAIN
 
 int main(int argc, char **argv) {
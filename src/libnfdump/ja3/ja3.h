@@ -43,4 +43,7 @@
 
 char *ja3Process(ssl_t *ssl, char *buff);
 
+struct recordHandle_s;
+char *GetRecordJA3(struct recordHandle_s *handle);
+
 #endif
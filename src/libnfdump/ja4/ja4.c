@@ -41,16 +41,18 @@
 #include <unistd.h>
 
 #include "digest/sha256.h"
+#include "nfdump.h"
 #include "ssl/ssl.h"
 #include "util.h"
 
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
-static void sort(uint16Array_t array) {
-    uint16_t *elements = array.array;
+// sort a copy of the array into elements - the ssl may be shared by the ssl cache
+static uint16_t *sortedCopy(uint16Array_t array, uint16_t *elements) {
     uint32_t numElements = LenArray(array);
+    if (numElements) memcpy(elements, array.array, numElements * sizeof(uint16_t));
 
-    for (int i = 0; i < numElements - 1; i++) {
+    for (int i = 0; i + 1 < numElements; i++) {
         for (int j = 0; j < numElements - i - 1; j++) {
             if (elements[j] > elements[j + 1]) {
                 uint16_t swap = elements[j];
@@ -59,7 +61,8 @@ static void sort(uint16Array_t array) {
             }
         }
     }
-}  // End of sort
+    return elements;
+}  // End of sortedCopy
 
 // ex. t13d1516h2_8daaf6152771_b186095e22bb
 // input validation  - is ja4String valid?
@@ -136,7 +139,14 @@ ja4_t *ja4Process(ssl_t *ssl, uint8_t proto) {
     buff[10] = '_';
 
     // create ja4_b
-    sort(ssl->cipherSuites);
+    uint32_t maxElements = MAX(LenArray(ssl->cipherSuites), LenArray(ssl->extensions));
+    uint16_t *sorted = malloc(maxElements * sizeof(uint16_t) + 1);
+    if (sorted == NULL) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        free(ja4);
+        return NULL;
+    }
+    sortedCopy(ssl->cipherSuites, sorted);
 
     // generate string to sha256
     // create a string big enough for ciphersuites and extensions
@@ -147,7 +157,7 @@ ja4_t *ja4Process(ssl_t *ssl, uint8_t proto) {
 
     int index = 0;
     for (int i = 0; i < LenArray(ssl->cipherSuites); i++) {
-        uint16_t val = ArrayElement(ssl->cipherSuites, i);
+        uint16_t val = sorted[i];
         Adduint16String(val, hashString + index);
         index += 4;
         hashString[index++] = ',';
@@ -168,12 +178,12 @@ ja4_t *ja4Process(ssl_t *ssl, uint8_t proto) {
     buff[23] = '_';
 
     // create ja4_c
-    sort(ssl->extensions);
+    sortedCopy(ssl->extensions, sorted);
 
     hashString[0] = '0';
     index = 0;
     for (int i = 0; i < LenArray(ssl->extensions); i++) {
-        uint16_t val = ArrayElement(ssl->extensions, i);
+        uint16_t val = sorted[i];
         // skip extensions 0000 and 0010
         if (val == 0 || val == 0x10) continue;
         Adduint16String(val, hashString + index);
@@ -203,10 +213,38 @@ ja4_t *ja4Process(ssl_t *ssl, uint8_t proto) {
     ja4->type = TYPE_JA4;
 
     free(hashString);
+    free(sorted);
     return ja4;
 
 }  // End of DecodeJA4
 
+// compute the ja4 of a client hello once per record
+ja4_t *GetRecordJA4(recordHandle_t *handle) {
+    if (handle->extensionList[JA4index] || (handle->derived & DERIVED_JA4)) return handle->extensionList[JA4index];
+    handle->derived |= DERIVED_JA4;
+
+    ssl_t *ssl = GetRecordSSL(handle);
+    if (ssl == NULL || ssl->type != CLIENTssl) return NULL;
+
+    // the ja4 of a cached hello is computed once
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)handle->extensionList[EXgenericFlowID];
+    sslCacheEntry_t *entry = GetRecordSSLEntry(handle);
+    if (entry == NULL) {
+        handle->extensionList[JA4index] = ja4Process(ssl, genericFlow->proto);
+        return handle->extensionList[JA4index];
+    }
+    if ((entry->derived & DERIVED_JA4) == 0) {
+        entry->ja4 = ja4Process(ssl, genericFlow->proto);
+        entry->derived |= DERIVED_JA4;
+    }
+    if (entry->ja4) {
+        handle->extensionList[JA4index] = entry->ja4;
+        handle->derived |= CACHED_JA4;
+    }
+    return entry->ja4;
+
+}  // End of GetRecordJA4
+
 #ifdef MAIN
 
 int main(int argc, char **argv) {
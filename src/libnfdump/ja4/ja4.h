@@ -71,6 +71,9 @@ int ja4Check(char *ja4String);
 
 ja4_t *ja4Process(ssl_t *ssl, uint8_t proto);
 
+struct recordHandle_s;
+ja4_t *GetRecordJA4(struct recordHandle_s *handle);
+
 /*
   JA4s:
   example fingerprint:
@@ -0,0 +1,538 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "label.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filter/prefixtrie.h"
+#include "nfdump.h"
+#include "nfxV3.h"
+#include "util.h"
+
+/*
+ * Label DB image
+ * ==============
+ * The label DB is a single binary image, which is written as is by SaveLabelDB() and
+ * mapped by nfdump with mmap(). A text table is compiled into the same image in memory.
+ * It contains:
+ * - the IPv4 and the IPv6 prefix trie images - see prefixtrie.h. The trie values are the label IDs.
+ * - the name offset array. Entry i is the offset of the name of label i+1 in the string table.
+ * - the string table with the '\0' terminated label names.
+ */
+#define LABELIMAGE_MAGIC 0x424C464E  // "NFLB"
+#define LABELIMAGE_VERSION 1
+#define LABELIMAGE_ALIGN 64
+
+typedef struct labelImageHeader_s {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;  // size of the entire image
+    uint32_t numLabels;
+    uint32_t numPrefixes;
+    uint64_t v4Offset;  // IPv4 trie image
+    uint64_t v4Size;
+    uint64_t v6Offset;  // IPv6 trie image
+    uint64_t v6Size;
+    uint64_t nameOffset;  // name offsets into the string table
+    uint64_t stringOffset;
+    uint64_t stringSize;
+} labelImageHeader_t;
+
+typedef struct labelDB_s {
+    void *image;
+    size_t imageSize;
+    int mapped;
+    uint32_t numLabels;
+    uint32_t numPrefixes;
+    prefixTrie_t *trie[2];  // IPv4, IPv6
+    const uint32_t *nameOffset;
+    const char *strings;
+} labelDB_t;
+
+static labelDB_t *labelDB = NULL;
+
+// generation of the loaded DB - invalidates the lookup caches
+static uint32_t labelGeneration = 0;
+
+// the loaded label DB file - a resident DB, such as in nfdumpd, is not loaded again
+static struct stat loadedDB = {0};
+
+/*
+ * Lookup cache
+ * Flows of the same hosts repeat, so each thread caches the labels of recently looked up
+ * addresses in a direct mapped cache, in front of the trie lookup.
+ */
+#define LABELCACHEBITS 12
+typedef struct labelCacheEntry_s {
+    uint64_t ip[2];
+    uint32_t tag;  // generation << 1 | IPv6, 0 = empty
+    uint32_t label;
+} labelCacheEntry_t;
+
+static _Thread_local labelCacheEntry_t *labelCache = NULL;
+
+// label names of a text table, while it is read
+typedef struct labelTable_s {
+    char **name;
+    uint32_t numLabels;
+    uint32_t maxLabels;
+    uint32_t *hash;  // label IDs - open addressing
+    uint32_t hashSize;
+} labelTable_t;
+
+static inline size_t AlignImage(size_t offset) { return (offset + LABELIMAGE_ALIGN - 1) & ~(size_t)(LABELIMAGE_ALIGN - 1); }
+
+// FNV-1a hash of a label name
+static uint32_t NameHash(const char *name) {
+    uint32_t hash = 2166136261U;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}  // End of NameHash
+
+static int GrowLabelHash(labelTable_t *table) {
+    uint32_t hashSize = table->hashSize ? 2 * table->hashSize : 1024;
+    uint32_t *hash = calloc(hashSize, sizeof(uint32_t));
+    if (!hash) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    for (uint32_t i = 0; i < table->numLabels; i++) {
+        uint32_t slot = NameHash(table->name[i]) & (hashSize - 1);
+        while (hash[slot]) slot = (slot + 1) & (hashSize - 1);
+        hash[slot] = i + 1;
+    }
+    free(table->hash);
+    table->hash = hash;
+    table->hashSize = hashSize;
+    return 1;
+}  // End of GrowLabelHash
+
+// return the ID of label name - add the name, if it is new
+static uint32_t AddLabelName(labelTable_t *table, const char *name) {
+    if (2 * (table->numLabels + 1) > table->hashSize && !GrowLabelHash(table)) return 0;
+
+    uint32_t slot = NameHash(name) & (table->hashSize - 1);
+    while (table->hash[slot]) {
+        if (strcmp(table->name[table->hash[slot] - 1], name) == 0) return table->hash[slot];
+        slot = (slot + 1) & (table->hashSize - 1);
+    }
+
+    if (table->numLabels == table->maxLabels) {
+        uint32_t maxLabels = table->maxLabels ? 2 * table->maxLabels : 1024;
+        char **p = realloc(table->name, maxLabels * sizeof(char *));
+        if (!p) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        table->name = p;
+        table->maxLabels = maxLabels;
+    }
+    char *s = strdup(name);
+    if (!s) {
+        LogError("strdup() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    table->name[table->numLabels++] = s;
+    table->hash[slot] = table->numLabels;
+    return table->numLabels;
+}  // End of AddLabelName
+
+static void FreeLabelTable(labelTable_t *table) {
+    for (uint32_t i = 0; i < table->numLabels; i++) free(table->name[i]);
+    free(table->name);
+    free(table->hash);
+}  // End of FreeLabelTable
+
+// parse a table line "prefix,label" or "prefix label"
+// returns 1 for a prefix, 0 for an empty line and -1 for an error
+static int ParseLabelLine(char *line, int *af, uint64_t ip[2], uint32_t *prefixLen, char **label) {
+    char *s = strchr(line, '#');
+    if (s) *s = '\0';
+    while (isspace((unsigned char)*line)) line++;
+    if (*line == '\0') return 0;
+
+    // prefix
+    s = line;
+    while (*s && *s != ',' && !isspace((unsigned char)*s)) s++;
+    if (*s == '\0') return -1;
+    *s++ = '\0';
+
+    // label - the rest of the line, optionally quoted
+    while (*s == ',' || isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    if ((end - s) >= 2 && *s == '"' && end[-1] == '"') {
+        s++;
+        end--;
+    }
+    *end = '\0';
+    if (*s == '\0' || strlen(s) >= MAXLABELLEN) return -1;
+    *label = s;
+
+    char *len = strchr(line, '/');
+    if (len) *len++ = '\0';
+    uint32_t addr[4];
+    if (inet_pton(PF_INET, line, addr) == 1) {
+        *af = PF_INET;
+        ip[0] = 0;
+        ip[1] = ntohl(addr[0]);
+        *prefixLen = 32;
+    } else if (inet_pton(PF_INET6, line, addr) == 1) {
+        *af = PF_INET6;
+        uint64_t *v6 = (uint64_t *)addr;
+        ip[0] = ntohll(v6[0]);
+        ip[1] = ntohll(v6[1]);
+        *prefixLen = 128;
+    } else {
+        return -1;
+    }
+    if (len) {
+        char *eptr;
+        long l = strtol(len, &eptr, 10);
+        if (*len == '\0' || *eptr != '\0' || l < 0 || l > *prefixLen) return -1;
+        *prefixLen = l;
+    }
+
+    return 1;
+}  // End of ParseLabelLine
+
+// build the label DB image from the compiled tries and the label names
+static void *BuildLabelImage(prefixTrie_t *trie[2], labelTable_t *table, uint32_t numPrefixes, size_t *imageSize) {
+    labelImageHeader_t header = {.magic = LABELIMAGE_MAGIC, .version = LABELIMAGE_VERSION, .numLabels = table->numLabels, .numPrefixes = numPrefixes};
+    header.stringSize = 0;
+    for (uint32_t i = 0; i < table->numLabels; i++) header.stringSize += strlen(table->name[i]) + 1;
+
+    header.v4Offset = AlignImage(sizeof(labelImageHeader_t));
+    header.v4Size = PrefixTrieImageSize(trie[0]);
+    header.v6Offset = AlignImage(header.v4Offset + header.v4Size);
+    header.v6Size = PrefixTrieImageSize(trie[1]);
+    header.nameOffset = AlignImage(header.v6Offset + header.v6Size);
+    header.stringOffset = AlignImage(header.nameOffset + (size_t)table->numLabels * sizeof(uint32_t));
+    header.size = AlignImage(header.stringOffset + header.stringSize);
+
+    void *image = calloc(1, header.size);
+    if (!image) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    memcpy(image, &header, sizeof(labelImageHeader_t));
+    PrefixTrieExport(trie[0], image + header.v4Offset);
+    PrefixTrieExport(trie[1], image + header.v6Offset);
+
+    uint32_t *nameOffset = (uint32_t *)(image + header.nameOffset);
+    char *strings = (char *)(image + header.stringOffset);
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < table->numLabels; i++) {
+        size_t len = strlen(table->name[i]) + 1;
+        memcpy(strings + offset, table->name[i], len);
+        nameOffset[i] = offset;
+        offset += len;
+    }
+
+    *imageSize = header.size;
+    return image;
+
+}  // End of BuildLabelImage
+
+static void FreeLabelDB(labelDB_t *db) {
+    if (!db) return;
+    FreePrefixTrie(db->trie[0]);
+    FreePrefixTrie(db->trie[1]);
+    if (db->mapped)
+        munmap(db->image, db->imageSize);
+    else
+        free(db->image);
+    free(db);
+}  // End of FreeLabelDB
+
+// validate the image and set up the lookup tries
+static int SetLabelImage(void *image, size_t imageSize, int mapped) {
+    labelImageHeader_t *header = (labelImageHeader_t *)image;
+    if (imageSize < sizeof(labelImageHeader_t) || header->magic != LABELIMAGE_MAGIC || header->version != LABELIMAGE_VERSION ||
+        header->size != imageSize || header->v4Offset > imageSize || header->v4Size > (imageSize - header->v4Offset) ||
+        header->v6Offset > imageSize || header->v6Size > (imageSize - header->v6Offset) || header->nameOffset > imageSize ||
+        ((uint64_t)header->numLabels * sizeof(uint32_t)) > (imageSize - header->nameOffset) || header->stringOffset > imageSize ||
+        header->stringSize > (imageSize - header->stringOffset) || (header->stringSize && ((char *)image)[header->stringOffset + header->stringSize - 1])) {
+        LogError("Invalid label DB image - rebuild label DB");
+        return 0;
+    }
+
+    const uint32_t *nameOffset = (const uint32_t *)(image + header->nameOffset);
+    for (uint32_t i = 0; i < header->numLabels; i++) {
+        if (nameOffset[i] >= header->stringSize) {
+            LogError("Corrupt label name in label DB - rebuild label DB");
+            return 0;
+        }
+    }
+
+    labelDB_t *db = calloc(1, sizeof(labelDB_t));
+    if (!db) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    db->trie[0] = MapPrefixTrie(PF_INET, image + header->v4Offset, header->v4Size);
+    db->trie[1] = MapPrefixTrie(PF_INET6, image + header->v6Offset, header->v6Size);
+    if (!db->trie[0] || !db->trie[1]) {
+        FreePrefixTrie(db->trie[0]);
+        FreePrefixTrie(db->trie[1]);
+        free(db);
+        return 0;
+    }
+    db->image = image;
+    db->imageSize = imageSize;
+    db->mapped = mapped;
+    db->numLabels = header->numLabels;
+    db->numPrefixes = header->numPrefixes;
+    db->nameOffset = nameOffset;
+    db->strings = (const char *)(image + header->stringOffset);
+
+    FreeLabelDB(labelDB);
+    labelDB = db;
+    labelGeneration++;
+
+    return 1;
+
+}  // End of SetLabelImage
+
+// read a text table and compile it into the image in memory
+static int LoadLabelTable(char *fileName) {
+    FILE *fp = fopen(fileName, "r");
+    if (!fp) {
+        LogError("fopen() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    labelTable_t table = {0};
+    prefixTrie_t *trie[2] = {NewPrefixTrie(PF_INET), NewPrefixTrie(PF_INET6)};
+    int ok = trie[0] != NULL && trie[1] != NULL;
+
+    char line[1024];
+    uint32_t lineNum = 0;
+    uint32_t numPrefixes = 0;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        lineNum++;
+        int af;
+        uint64_t ip[2];
+        uint32_t prefixLen;
+        char *label;
+        int ret = ParseLabelLine(line, &af, ip, &prefixLen, &label);
+        if (ret == 0) continue;
+        if (ret < 0) {
+            LogError("Label table %s line %u: invalid prefix or label - skipped", fileName, lineNum);
+            continue;
+        }
+        uint32_t id = AddLabelName(&table, label);
+        ok = id != 0 && PrefixTrieInsert(trie[af == PF_INET6 ? 1 : 0], ip, prefixLen, id);
+        numPrefixes++;
+    }
+    fclose(fp);
+
+    void *image = NULL;
+    size_t imageSize = 0;
+    if (ok && PrefixTrieBuild(trie[0]) && PrefixTrieBuild(trie[1])) image = BuildLabelImage(trie, &table, numPrefixes, &imageSize);
+    FreePrefixTrie(trie[0]);
+    FreePrefixTrie(trie[1]);
+    FreeLabelTable(&table);
+    if (!image) return 0;
+
+    if (!SetLabelImage(image, imageSize, 0)) {
+        free(image);
+        return 0;
+    }
+    LogVerbose("Label table %s: %u prefixes, %u labels", fileName, numPrefixes, labelDB->numLabels);
+
+    return 1;
+
+}  // End of LoadLabelTable
+
+int LoadLabelDB(char *fileName) {
+    dbg_printf("Load label DB file %s\n", fileName);
+
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        LogError("open() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    struct stat stat_buf;
+    uint32_t magic = 0;
+    if (fstat(fd, &stat_buf) < 0 || read(fd, &magic, sizeof(magic)) < 0) {
+        LogError("Failed to read label DB %s: %s", fileName, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    if (labelDB && loadedDB.st_ino == stat_buf.st_ino && loadedDB.st_dev == stat_buf.st_dev && loadedDB.st_size == stat_buf.st_size &&
+        loadedDB.st_mtime == stat_buf.st_mtime) {
+        dbg_printf("Label DB file %s already loaded\n", fileName);
+        close(fd);
+        return 1;
+    }
+
+    if (magic != LABELIMAGE_MAGIC) {
+        // text table
+        close(fd);
+        if (!LoadLabelTable(fileName)) return 0;
+        loadedDB = stat_buf;
+        return 1;
+    }
+
+    void *image = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        LogError("mmap() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    if (!SetLabelImage(image, stat_buf.st_size, 1)) {
+        munmap(image, stat_buf.st_size);
+        return 0;
+    }
+    loadedDB = stat_buf;
+
+    return 1;
+
+}  // End of LoadLabelDB
+
+int SaveLabelDB(char *fileName) {
+    if (!labelDB) {
+        LogError("No label DB loaded");
+        return 0;
+    }
+
+    int fd = open(fileName, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        LogError("open() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    void *p = labelDB->image;
+    size_t remaining = labelDB->imageSize;
+    while (remaining) {
+        ssize_t ret = write(fd, p, remaining);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            close(fd);
+            return 0;
+        }
+        p += ret;
+        remaining -= ret;
+    }
+
+    if (close(fd) < 0) {
+        LogError("close() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    return 1;
+
+}  // End of SaveLabelDB
+
+int HasLabelDB(void) { return labelDB != NULL; }
+
+uint32_t NumLabels(void) { return labelDB ? labelDB->numLabels : 0; }
+
+// cached trie lookup of ip
+static inline uint32_t LookupLabel(int v6, const uint64_t ip[2]) {
+    if (!labelDB) return 0;
+
+    if (labelCache == NULL) {
+        labelCache = calloc(1 << LABELCACHEBITS, sizeof(labelCacheEntry_t));
+        if (!labelCache) return PrefixTrieLookup(labelDB->trie[v6], ip);
+    }
+
+    uint32_t slot = (uint32_t)((((ip[0] * 0x9E3779B97F4A7C15ULL) ^ ip[1]) * 0x9E3779B97F4A7C15ULL) >> (64 - LABELCACHEBITS));
+    labelCacheEntry_t *entry = &labelCache[slot];
+    uint32_t tag = (labelGeneration << 1) | v6;
+    if (entry->tag == tag && entry->ip[0] == ip[0] && entry->ip[1] == ip[1]) return entry->label;
+
+    uint32_t label = PrefixTrieLookup(labelDB->trie[v6], ip);
+    *entry = (labelCacheEntry_t){.ip = {ip[0], ip[1]}, .tag = tag, .label = label};
+    return label;
+
+}  // End of LookupLabel
+
+uint32_t LookupV4Label(uint32_t ip) {
+    uint64_t v4[2] = {0, ip};
+    return LookupLabel(0, v4);
+}  // End of LookupV4Label
+
+uint32_t LookupV6Label(const uint64_t ip[2]) { return LookupLabel(1, ip); }
+
+// returns the name of label or NULL
+const char *LabelName(uint32_t label) {
+    if (!labelDB || label == 0 || label > labelDB->numLabels) return NULL;
+    return labelDB->strings + labelDB->nameOffset[label - 1];
+}  // End of LabelName
+
+// returns the ID of the label name or 0
+uint32_t LabelID(const char *name) {
+    if (!labelDB) return 0;
+    for (uint32_t i = 0; i < labelDB->numLabels; i++) {
+        if (strcmp(labelDB->strings + labelDB->nameOffset[i], name) == 0) return i + 1;
+    }
+    return 0;
+}  // End of LabelID
+
+// the label of the src or dst address of the record, computed once per record
+uint32_t GetRecordLabel(recordHandle_t *handle, int dst) {
+    uint32_t flag = dst ? DERIVED_DSTLABEL : DERIVED_SRCLABEL;
+    uint32_t *label = &(handle->label[dst ? 1 : 0]);
+    if ((handle->derived & flag) == 0) {
+        handle->derived |= flag;
+        EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)handle->extensionList[EXipv4FlowID];
+        EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)handle->extensionList[EXipv6FlowID];
+        *label = 0;
+        if (ipv4Flow) {
+            *label = LookupV4Label(dst ? ipv4Flow->dstAddr : ipv4Flow->srcAddr);
+        } else if (ipv6Flow) {
+            *label = LookupV6Label(dst ? ipv6Flow->dstAddr : ipv6Flow->srcAddr);
+        }
+    }
+
+    return *label;
+
+}  // End of GetRecordLabel
@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _LABEL_H
+#define _LABEL_H 1
+
+#include <stdint.h>
+
+/*
+ * Label DB
+ * Maps IP prefixes to labels such as customer IDs or site names. The prefixes are
+ * looked up with the longest prefix match of a compiled prefix trie. Labels are numbered
+ * 1..NumLabels(), label 0 is no label.
+ * The DB is either read from a text table with lines of a prefix and a label, separated
+ * by a comma, or mapped from a binary image, written by SaveLabelDB().
+ */
+
+#define MAXLABELLEN 64
+
+int LoadLabelDB(char *fileName);
+
+int SaveLabelDB(char *fileName);
+
+int HasLabelDB(void);
+
+uint32_t NumLabels(void);
+
+uint32_t LookupV4Label(uint32_t ip);
+
+uint32_t LookupV6Label(const uint64_t ip[2]);
+
+const char *LabelName(uint32_t label);
+
+uint32_t LabelID(const char *name);
+
+struct recordHandle_s;
+uint32_t GetRecordLabel(struct recordHandle_s *handle, int dst);
+
+#endif  //_LABEL_H
@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -51,218 +52,71 @@
 #include "nfxV3.h"
 #include "util.h"
 
+// the loaded geo DB file - a resident DB, such as in nfdumpd, is not loaded again
+static struct stat loadedDB = {0};
+
 #define arrayElementSizeCheck(type)                                          \
     if (arrayHeader->size != sizeof(type##_t)) {                             \
         LogError("Size check failed for %s - rebuild nfdump geo DB", #type); \
         return 0;                                                            \
     }
 
-#define PushArrayHeader(dataBlock, arrayType, arraySize)   \
-    (dataBlock)->type = DATA_BLOCK_TYPE_4;                 \
-    void *p = ((void *)(dataBlock) + sizeof(dataBlock_t)); \
-    recordHeader_t *arrayHeader = (recordHeader_t *)p;     \
-    arrayHeader->type = arrayType;                         \
-    arrayHeader->size = arraySize;                         \
-    (dataBlock)->size += sizeof(recordHeader_t);
-
-static void StoreLocalMap(nffile_t *nffile) {
-    // get new empty data block
-    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
-    dataBlock->type = DATA_BLOCK_TYPE_4;
-    void *outBuff = GetCursor(dataBlock);
-
-    // put array header on block
-    PushArrayHeader(dataBlock, LocalInfoElementID, sizeof(locationInfo_t));
-    outBuff = GetCurrentCursor(dataBlock);
-
-    for (locationInfo_t *locationInfo = NextLocation(FIRSTNODE); locationInfo != NULL; locationInfo = NextLocation(NEXTNODE)) {
-        if (!IsAvailable(dataBlock, sizeof(locationInfo_t))) {
-            // flush block - get an empty one
-            dataBlock = WriteBlock(nffile, dataBlock);
-
-            // put array header on block
-            PushArrayHeader(dataBlock, LocalInfoElementID, sizeof(locationInfo_t));
-            outBuff = GetCurrentCursor(dataBlock);
-        }
-
-        memcpy(outBuff, locationInfo, sizeof(locationInfo_t));
-        outBuff += sizeof(locationInfo_t);
-        dataBlock->size += sizeof(locationInfo_t);
-        dataBlock->NumRecords++;
-    }
-    // flush current datablock
-    FlushBlock(nffile, dataBlock);
-
-}  // End of StoreLocalMap
-
-static void StoreIPV4tree(nffile_t *nffile) {
-    // get new empty data block
-    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
-    dataBlock->type = DATA_BLOCK_TYPE_4;
-    void *outBuff = GetCursor(dataBlock);
-
-    // put array header on block
-    PushArrayHeader(dataBlock, IPV4treeElementID, sizeof(ipV4Node_t));
-    outBuff = GetCurrentCursor(dataBlock);
-
-    for (ipV4Node_t *ipv4Node = NextIPv4Node(FIRSTNODE); ipv4Node != NULL; ipv4Node = NextIPv4Node(NEXTNODE)) {
-        if (!IsAvailable(dataBlock, sizeof(ipV4Node_t))) {
-            // flush block - get an empty one
-            dataBlock = WriteBlock(nffile, dataBlock);
-
-            // put array header on block
-            PushArrayHeader(dataBlock, IPV4treeElementID, sizeof(ipV4Node_t));
-            outBuff = GetCurrentCursor(dataBlock);
-        }
-
-        memcpy(outBuff, ipv4Node, sizeof(ipV4Node_t));
-        outBuff += sizeof(ipV4Node_t);
-        dataBlock->size += sizeof(ipV4Node_t);
-        dataBlock->NumRecords++;
-    }
-    // flush current datablock
-    FlushBlock(nffile, dataBlock);
-
-}  // End of StoreIPtree
-
-static void StoreIPV6tree(nffile_t *nffile) {
-    // get new empty data block
-    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
-    dataBlock->type = DATA_BLOCK_TYPE_4;
-    void *outBuff = GetCursor(dataBlock);
-
-    // put array header on block
-    PushArrayHeader(dataBlock, IPV6treeElementID, sizeof(ipV6Node_t));
-    outBuff = GetCurrentCursor(dataBlock);
-
-    for (ipV6Node_t *ipv6Node = NextIPv6Node(FIRSTNODE); ipv6Node != NULL; ipv6Node = NextIPv6Node(NEXTNODE)) {
-        if (!IsAvailable(dataBlock, sizeof(ipV6Node_t))) {
-            // flush block - get an empty one
-            dataBlock = WriteBlock(nffile, dataBlock);
-
-            // put array header on block
-            PushArrayHeader(dataBlock, IPV6treeElementID, sizeof(ipV6Node_t));
-            outBuff = GetCurrentCursor(dataBlock);
-        }
-
-        memcpy(outBuff, ipv6Node, sizeof(ipV6Node_t));
-        outBuff += sizeof(ipV6Node_t);
-        dataBlock->size += sizeof(ipV6Node_t);
-        dataBlock->NumRecords++;
+int SaveMaxMind(char *fileName) {
+    size_t imageSize = 0;
+    void *image = BuildGeoImage(&imageSize);
+    if (!image) return 0;
+
+    int fd = open(fileName, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        LogError("open() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(image);
+        return 0;
     }
-    // flush current datablock
-    FlushBlock(nffile, dataBlock);
-
-}  // End of StoreIPtree
-
-static void StoreASV4tree(nffile_t *nffile) {
-    // get new empty data block
-    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
-    void *outBuff = GetCursor(dataBlock);
 
-    // put array header on block
-    PushArrayHeader(dataBlock, ASV4treeElementID, sizeof(asV4Node_t));
-    outBuff = GetCurrentCursor(dataBlock);
-
-    for (asV4Node_t *asV4Node = NextasV4Node(FIRSTNODE); asV4Node != NULL; asV4Node = NextasV4Node(NEXTNODE)) {
-        if (!IsAvailable(dataBlock, sizeof(asV4Node_t))) {
-            // flush block - get an empty one
-            dataBlock = WriteBlock(nffile, dataBlock);
-
-            // put array header on block
-            PushArrayHeader(dataBlock, ASV4treeElementID, sizeof(asV4Node_t));
-            outBuff = GetCurrentCursor(dataBlock);
+    void *p = image;
+    size_t remaining = imageSize;
+    while (remaining) {
+        ssize_t ret = write(fd, p, remaining);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            close(fd);
+            free(image);
+            return 0;
         }
-
-        memcpy(outBuff, asV4Node, sizeof(asV4Node_t));
-        outBuff += sizeof(asV4Node_t);
-        dataBlock->size += sizeof(asV4Node_t);
-        dataBlock->NumRecords++;
+        p += ret;
+        remaining -= ret;
     }
-    // flush current datablock
-    FlushBlock(nffile, dataBlock);
-
-}  // End of StoreASV4tree
+    free(image);
 
-static void StoreASV6tree(nffile_t *nffile) {
-    // get new empty data block
-    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
-    dataBlock->type = DATA_BLOCK_TYPE_4;
-    void *outBuff = GetCursor(dataBlock);
-
-    // put array header on block
-    PushArrayHeader(dataBlock, ASV6treeElementID, sizeof(asV6Node_t));
-    outBuff = GetCurrentCursor(dataBlock);
-
-    for (asV6Node_t *asV6Node = NextasV6Node(FIRSTNODE); asV6Node != NULL; asV6Node = NextasV6Node(NEXTNODE)) {
-        if (!IsAvailable(dataBlock, sizeof(asV6Node_t))) {
-            // flush block - get an empty one
-            dataBlock = WriteBlock(nffile, dataBlock);
-
-            // put array header on block
-            PushArrayHeader(dataBlock, ASV6treeElementID, sizeof(asV6Node_t));
-            outBuff = GetCurrentCursor(dataBlock);
-        }
-
-        memcpy(outBuff, asV6Node, sizeof(asV6Node_t));
-        outBuff += sizeof(asV6Node_t);
-        dataBlock->size += sizeof(asV6Node_t);
-        dataBlock->NumRecords++;
+    if (close(fd) < 0) {
+        LogError("close() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
     }
-    // flush current datablock
-    FlushBlock(nffile, dataBlock);
-
-}  // End of StoreASV6tree
-
-static void StoreASorgtree(nffile_t *nffile) {
-    // get new empty data block
-    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
-    void *outBuff = GetCursor(dataBlock);
-
-    // put array header on block
-    PushArrayHeader(dataBlock, ASOrgtreeElementID, sizeof(asOrgNode_t));
-    outBuff = GetCurrentCursor(dataBlock);
 
-    for (asOrgNode_t *asOrgNode = NextasOrgNode(FIRSTNODE); asOrgNode != NULL; asOrgNode = NextasOrgNode(NEXTNODE)) {
-        if (!IsAvailable(dataBlock, sizeof(asOrgNode_t))) {
-            // flush block - get an empty one
-            dataBlock = WriteBlock(nffile, dataBlock);
+    return 1;
 
-            // put array header on block
-            PushArrayHeader(dataBlock, ASOrgtreeElementID, sizeof(asOrgNode_t));
-            outBuff = GetCurrentCursor(dataBlock);
-        }
+}  // End of SaveMaxMind
 
-        memcpy(outBuff, asOrgNode, sizeof(asOrgNode_t));
-        outBuff += sizeof(asOrgNode_t);
-        dataBlock->size += sizeof(asOrgNode_t);
-        dataBlock->NumRecords++;
+// map a geo DB image file
+static int MapMaxMind(int fd, size_t size) {
+    void *image = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        LogError("mmap() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
     }
-    // flush current datablock
-    FlushBlock(nffile, dataBlock);
 
-}  // End of StoreASorgtree
-
-int SaveMaxMind(char *fileName) {
-    nffile_t *nffile = OpenNewFile(fileName, NULL, CREATOR_LOOKUP, LZ4_COMPRESSED, NOT_ENCRYPTED);
-    if (!nffile) {
-        LogError("OpenNewFile(%s) failed", fileName);
+    if (!SetGeoImage(image, size, GEOIMAGE_MAPPED)) {
+        munmap(image, size);
         return 0;
     }
-    // store all geo records
-    StoreLocalMap(nffile);
-    StoreIPV4tree(nffile);
-    StoreIPV6tree(nffile);
-    StoreASV4tree(nffile);
-    StoreASV6tree(nffile);
-    StoreASorgtree(nffile);
-    return CloseUpdateFile(nffile);
 
-}  // End of SaveMaxMind
+    return 1;
 
-int LoadMaxMind(char *fileName) {
-    dbg_printf("Load MaxMind file %s\n", fileName);
+}  // End of MapMaxMind
 
+// load a geo DB in nffile format and build the image in memory
+static int LoadLegacyMaxMind(char *fileName) {
     if (!Init_MaxMind()) return 0;
 
     nffile_t *nffile = OpenFile(fileName, NULL);
@@ -331,5 +185,53 @@ int LoadMaxMind(char *fileName) {
     FreeDataBlock(dataBlock);
     DisposeFile(nffile);
 
+    size_t imageSize = 0;
+    void *image = BuildGeoImage(&imageSize);
+    if (!image) return 0;
+    if (!SetGeoImage(image, imageSize, GEOIMAGE_ALLOCATED)) {
+        free(image);
+        return 0;
+    }
+
     return 1;
+
+}  // End of LoadLegacyMaxMind
+
+int LoadMaxMind(char *fileName) {
+    dbg_printf("Load MaxMind file %s\n", fileName);
+
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        LogError("open() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    struct stat stat_buf;
+    uint32_t magic = 0;
+    if (fstat(fd, &stat_buf) < 0 || read(fd, &magic, sizeof(magic)) != sizeof(magic)) {
+        LogError("Failed to read geo DB %s: %s", fileName, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    if (loadedDB.st_ino == stat_buf.st_ino && loadedDB.st_dev == stat_buf.st_dev && loadedDB.st_size == stat_buf.st_size &&
+        loadedDB.st_mtime == stat_buf.st_mtime) {
+        dbg_printf("MaxMind file %s already loaded\n", fileName);
+        close(fd);
+        return 1;
+    }
+
+    int ret;
+    if (magic == GEOIMAGE_MAGIC) {
+        ret = MapMaxMind(fd, stat_buf.st_size);
+        close(fd);
+    } else {
+        // geo DB in nffile format of older versions
+        close(fd);
+        ret = LoadLegacyMaxMind(fileName);
+    }
+    if (ret) loadedDB = stat_buf;
+
+    return ret;
+
 }  // End of LoadMaxMind
@@ -33,9 +33,10 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "kbtree.h"
 #include "khash.h"
 #include "maxmind.h"
 #include "mmhash.h"
@@ -46,96 +47,148 @@
 
 KHASH_INIT(localMap, locationKey_t, locationInfo_t, 1, kh_hash_func, kh_hash_equal)
 
-// ipV4Tree node compare function
-// nextmask = 0 => IP to search
-// mask IP to search with netmask and compare network
-static inline int ipV4Node_cmp(ipV4Node_t a, ipV4Node_t b) {
-    if (a.netmask == 0) {
-        uint32_t network = a.network & b.netmask;
-        if (network == b.network) return 0;
-        return network > b.network ? 1 : -1;
-    } else {
-        uint32_t network = b.network & a.netmask;
-        if (network == a.network) return 0;
-        return a.network > network ? 1 : -1;
-    }
-}
-
-static inline int ipV6Node_cmp(ipV6Node_t a, ipV6Node_t b) {
-    uint64_t network[2];
-    if (a.netmask[0] == 0 && a.netmask[1] == 0) {
-        network[0] = a.network[0] & b.netmask[0];
-        network[1] = a.network[1] & b.netmask[1];
-        if (network[0] == b.network[0] && network[1] == b.network[1]) return 0;
-        if (network[0] == b.network[0]) return network[1] > b.network[1] ? 1 : -1;
-        return (network[0] > b.network[0]) ? 1 : -1;
-    } else {
-        network[0] = b.network[0] & a.netmask[0];
-        network[1] = b.network[1] & a.netmask[1];
-        if (network[0] == a.network[0] && network[1] == a.network[1]) return 0;
-        if (a.network[0] == network[0]) return a.network[1] > network[1] ? 1 : -1;
-        return (a.network[0] > network[0]) ? 1 : -1;
-    }
-}
-
-KBTREE_INIT(ipV4Tree, ipV4Node_t, ipV4Node_cmp);
-
-KBTREE_INIT(ipV6Tree, ipV6Node_t, ipV6Node_cmp);
-
-// asV4Tree node compare function
-// nextmask = 0 => IP to search
-// mask IP to search with netmask and compare network
-static inline int asV4Node_cmp(asV4Node_t a, asV4Node_t b) {
-    if (a.netmask == 0) {
-        uint32_t network = a.network & b.netmask;
-        if (network == b.network) return 0;
-        return network > b.network ? 1 : -1;
-    } else {
-        uint32_t network = b.network & a.netmask;
-        if (network == a.network) return 0;
-        return a.network > network ? 1 : -1;
-    }
-}
-
-static inline int asV6Node_cmp(asV6Node_t a, asV6Node_t b) {
-    uint64_t network[2];
-    if (a.netmask[0] == 0 && a.netmask[1] == 0) {
-        network[0] = a.network[0] & b.netmask[0];
-        network[1] = a.network[1] & b.netmask[1];
-        if (network[0] == b.network[0] && network[1] == b.network[1]) return 0;
-        if (network[0] == b.network[0]) return network[1] > b.network[1] ? 1 : -1;
-        return (network[0] > b.network[0]) ? 1 : -1;
-    } else {
-        network[0] = b.network[0] & a.netmask[0];
-        network[1] = b.network[1] & a.netmask[1];
-        if (network[0] == a.network[0] && network[1] == a.network[1]) return 0;
-        if (a.network[0] == network[0]) return a.network[1] > network[1] ? 1 : -1;
-        return (a.network[0] > network[0]) ? 1 : -1;
+/*
+ * The geo DB records are collected in plain arrays, which are sorted once, when
+ * the image is built. This is much faster and uses less memory than inserting
+ * each record into a tree.
+ */
+typedef struct nodeArray_s {
+    void *nodes;
+    size_t numNodes;
+    size_t maxNodes;
+    size_t nodeSize;
+} nodeArray_t;
+
+#define NODEARRAYINIT (1024 * 1024)
+
+static int AppendNodes(nodeArray_t *array, const void *nodes, size_t numNodes) {
+    if ((array->numNodes + numNodes) > array->maxNodes) {
+        size_t maxNodes = array->maxNodes ? 2 * array->maxNodes : NODEARRAYINIT;
+        while (maxNodes < (array->numNodes + numNodes)) maxNodes *= 2;
+        void *p = realloc(array->nodes, maxNodes * array->nodeSize);
+        if (!p) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        array->nodes = p;
+        array->maxNodes = maxNodes;
     }
-}
+    memcpy(array->nodes + array->numNodes * array->nodeSize, nodes, numNodes * array->nodeSize);
+    array->numNodes += numNodes;
 
-static inline int asOrgNode_cmp(asOrgNode_t a, asOrgNode_t b) {
-    if (a.as == b.as) return 0;
-    return a.as > b.as ? 1 : -1;
-}  // End of asOrgNode_cmp
+    return 1;
 
-KBTREE_INIT(asV4Tree, asV4Node_t, asV4Node_cmp);
+}  // End of AppendNodes
+
+static void FreeNodeArray(nodeArray_t *array) {
+    free(array->nodes);
+    array->nodes = NULL;
+    array->numNodes = 0;
+    array->maxNodes = 0;
+}  // End of FreeNodeArray
+
+// qsort compare functions - sort networks by network address
+static int ipV4Node_cmp(const void *p1, const void *p2) {
+    const ipV4Node_t *a = (const ipV4Node_t *)p1;
+    const ipV4Node_t *b = (const ipV4Node_t *)p2;
+    if (a->network == b->network) return 0;
+    return a->network > b->network ? 1 : -1;
+}  // End of ipV4Node_cmp
+
+static int ipV6Node_cmp(const void *p1, const void *p2) {
+    const ipV6Node_t *a = (const ipV6Node_t *)p1;
+    const ipV6Node_t *b = (const ipV6Node_t *)p2;
+    if (a->network[0] != b->network[0]) return a->network[0] > b->network[0] ? 1 : -1;
+    if (a->network[1] == b->network[1]) return 0;
+    return a->network[1] > b->network[1] ? 1 : -1;
+}  // End of ipV6Node_cmp
+
+static int asV4Node_cmp(const void *p1, const void *p2) {
+    const asV4Node_t *a = (const asV4Node_t *)p1;
+    const asV4Node_t *b = (const asV4Node_t *)p2;
+    if (a->network == b->network) return 0;
+    return a->network > b->network ? 1 : -1;
+}  // End of asV4Node_cmp
+
+static int asV6Node_cmp(const void *p1, const void *p2) {
+    const asV6Node_t *a = (const asV6Node_t *)p1;
+    const asV6Node_t *b = (const asV6Node_t *)p2;
+    if (a->network[0] != b->network[0]) return a->network[0] > b->network[0] ? 1 : -1;
+    if (a->network[1] == b->network[1]) return 0;
+    return a->network[1] > b->network[1] ? 1 : -1;
+}  // End of asV6Node_cmp
+
+// sort by AS and name, so the result does not depend on the input order
+static int asOrgNode_cmp(const void *p1, const void *p2) {
+    const asOrgNode_t *a = (const asOrgNode_t *)p1;
+    const asOrgNode_t *b = (const asOrgNode_t *)p2;
+    if (a->as != b->as) return a->as > b->as ? 1 : -1;
+    return strcmp(a->orgName, b->orgName);
+}  // End of asOrgNode_cmp
 
-KBTREE_INIT(asV6Tree, asV6Node_t, asV6Node_cmp);
+KHASH_MAP_INIT_STR(stringMap, uint32_t)
 
-KBTREE_INIT(asOrgTree, asOrgNode_t, asOrgNode_cmp);
+KHASH_MAP_INIT_INT(locationIndex, uint32_t)
 
 typedef struct mmHandle_s {
+    // records to build the geo DB image
     khash_t(localMap) * localMap;
-    kbtree_t(ipV4Tree) * ipV4Tree;
-    kbtree_t(ipV6Tree) * ipV6Tree;
-    kbtree_t(asV4Tree) * asV4Tree;
-    kbtree_t(asV6Tree) * asV6Tree;
-    kbtree_t(asOrgTree) * asOrgTree;
+    nodeArray_t ipV4Nodes;
+    nodeArray_t ipV6Nodes;
+    nodeArray_t asV4Nodes;
+    nodeArray_t asV6Nodes;
+    nodeArray_t asOrgNodes;
+
+    // geo DB image for lookups
+    void *image;
+    size_t imageSize;
+    int mapped;
+    const geoLocation_t *location;
+    uint32_t numLocations;
+    const char *strings;
+    uint32_t stringSize;
+    const uint32_t *ipV4Index;
+    const geoIPv4_t *ipV4;
+    const geoInfo_t *ipV4Info;
+    const uint32_t *ipV6Index;
+    const geoIPv6_t *ipV6;
+    const geoInfo_t *ipV6Info;
+    const uint32_t *asV4Index;
+    const geoASv4_t *asV4;
+    const uint32_t *asV6Index;
+    const geoASv6_t *asV6;
+    const geoASorg_t *asOrg;
+    uint32_t numASorg;
 } mmHandle_t;
 
 static mmHandle_t *mmHandle = NULL;
 
+/*
+ * Per thread direct mapped lookup cache. Records often repeat the same hot IPs.
+ * The cache stores the range index of an IP. An entry is only valid for the
+ * image generation, it was created with. A new image invalidates all caches.
+ */
+#define GEOCACHEBITS 11
+#define GEOCACHESIZE (1 << GEOCACHEBITS)
+
+typedef struct v4CacheEntry_s {
+    uint32_t ip;
+    uint32_t generation;
+    int32_t index;
+} v4CacheEntry_t;
+
+typedef struct v6CacheEntry_s {
+    uint64_t ip[2];
+    uint32_t generation;
+    int32_t index;
+} v6CacheEntry_t;
+
+static uint32_t geoGeneration = 0;
+static _Thread_local v4CacheEntry_t ipV4Cache[GEOCACHESIZE];
+static _Thread_local v4CacheEntry_t asV4Cache[GEOCACHESIZE];
+static _Thread_local v6CacheEntry_t ipV6Cache[GEOCACHESIZE];
+static _Thread_local v6CacheEntry_t asV6Cache[GEOCACHESIZE];
+
 int Init_MaxMind(void) {
     mmHandle = calloc(1, sizeof(mmHandle_t));
     if (!mmHandle) {
@@ -144,13 +197,13 @@ int Init_MaxMind(void) {
     }
 
     mmHandle->localMap = kh_init(localMap);
-    mmHandle->ipV4Tree = kb_init(ipV4Tree, 10 * KB_DEFAULT_SIZE);
-    mmHandle->ipV6Tree = kb_init(ipV6Tree, 10 * KB_DEFAULT_SIZE);
-    mmHandle->asV4Tree = kb_init(asV4Tree, 10 * KB_DEFAULT_SIZE);
-    mmHandle->asV6Tree = kb_init(asV6Tree, 10 * KB_DEFAULT_SIZE);
-    mmHandle->asOrgTree = kb_init(asOrgTree, 10 * KB_DEFAULT_SIZE);
+    mmHandle->ipV4Nodes.nodeSize = sizeof(ipV4Node_t);
+    mmHandle->ipV6Nodes.nodeSize = sizeof(ipV6Node_t);
+    mmHandle->asV4Nodes.nodeSize = sizeof(asV4Node_t);
+    mmHandle->asV6Nodes.nodeSize = sizeof(asV6Node_t);
+    mmHandle->asOrgNodes.nodeSize = sizeof(asOrgNode_t);
 
-    if (!mmHandle->ipV4Tree || !mmHandle->ipV6Tree || !mmHandle->localMap || !mmHandle->asV4Tree || !mmHandle->asV6Tree || !mmHandle->asOrgTree) {
+    if (!mmHandle->localMap) {
         LogError("Initialization of MaxMind failed");
         return 0;
     }
@@ -158,6 +211,456 @@ int Init_MaxMind(void) {
 
 }  // End of Init_MaxMind
 
+static void FreeNodes(void) {
+    if (mmHandle->localMap) kh_destroy(localMap, mmHandle->localMap);
+    mmHandle->localMap = NULL;
+    FreeNodeArray(&mmHandle->ipV4Nodes);
+    FreeNodeArray(&mmHandle->ipV6Nodes);
+    FreeNodeArray(&mmHandle->asV4Nodes);
+    FreeNodeArray(&mmHandle->asV6Nodes);
+    FreeNodeArray(&mmHandle->asOrgNodes);
+
+}  // End of FreeNodes
+
+// string table of the image to build
+typedef struct stringTable_s {
+    khash_t(stringMap) * stringMap;
+    char *strings;
+    size_t size;
+    size_t maxSize;
+} stringTable_t;
+
+// intern string s and return its offset in the string table
+static uint32_t InternString(stringTable_t *stringTable, const char *s) {
+    if (s[0] == '\0') return 0;
+
+    khint_t k = kh_get(stringMap, stringTable->stringMap, s);
+    if (k != kh_end(stringTable->stringMap)) return kh_value(stringTable->stringMap, k);
+
+    size_t len = strlen(s) + 1;
+    if ((stringTable->size + len) > stringTable->maxSize) {
+        size_t maxSize = 2 * stringTable->maxSize + len;
+        char *strings = realloc(stringTable->strings, maxSize);
+        if (!strings) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        stringTable->strings = strings;
+        stringTable->maxSize = maxSize;
+    }
+
+    // the string of the caller is not stable - the map owns a copy of the key
+    char *key = strdup(s);
+    if (!key) {
+        LogError("strdup() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    int absent;
+    k = kh_put(stringMap, stringTable->stringMap, key, &absent);
+    uint32_t offset = stringTable->size;
+    memcpy(stringTable->strings + offset, s, len);
+    stringTable->size += len;
+    kh_value(stringTable->stringMap, k) = offset;
+
+    return offset;
+
+}  // End of InternString
+
+// fill the 16bit prefix index of a range array
+static void BuildRangeIndex(uint32_t *index, const void *ranges, size_t elementSize, uint32_t numRanges, int ipv6) {
+    uint32_t i = 0;
+    for (uint32_t prefix = 0; prefix < GEOINDEXSIZE; prefix++) {
+        while (i < numRanges) {
+            const void *range = ranges + (size_t)i * elementSize;
+            uint32_t rangePrefix = ipv6 ? (uint32_t)(((const uint64_t *)range)[0] >> 48) : (((const uint32_t *)range)[0] >> 16);
+            if (rangePrefix >= prefix) break;
+            i++;
+        }
+        index[prefix] = i;
+    }
+
+}  // End of BuildRangeIndex
+
+// true if IPv6 address a <= b
+static inline int LessEqualV6(const uint64_t a[2], const uint64_t b[2]) {
+    return a[0] < b[0] || (a[0] == b[0] && a[1] <= b[1]);
+}  // End of LessEqualV6
+
+static inline void SetSection(geoImageHeader_t *header, int section, size_t *offset, uint32_t numElements, uint32_t elementSize) {
+    header->section[section].offset = *offset;
+    header->section[section].numElements = numElements;
+    header->section[section].elementSize = elementSize;
+    *offset += ((size_t)numElements * elementSize + GEOIMAGE_ALIGN - 1) & ~(size_t)(GEOIMAGE_ALIGN - 1);
+}  // End of SetSection
+
+#define SectionPtr(image, header, id) ((void *)(image) + (header)->section[id].offset)
+
+// build the geo DB image from the collected records
+void *BuildGeoImage(size_t *imageSize) {
+    stringTable_t stringTable = {.stringMap = kh_init(stringMap), .strings = malloc(1024 * 1024), .size = 1, .maxSize = 1024 * 1024};
+    khash_t(locationIndex) *locationIndex = kh_init(locationIndex);
+    if (!stringTable.stringMap || !stringTable.strings || !locationIndex) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    // offset 0 is the empty string
+    stringTable.strings[0] = '\0';
+
+    khash_t(localMap) *localMap = mmHandle->localMap;
+    ipV4Node_t *ipV4Nodes = (ipV4Node_t *)mmHandle->ipV4Nodes.nodes;
+    ipV6Node_t *ipV6Nodes = (ipV6Node_t *)mmHandle->ipV6Nodes.nodes;
+    asV4Node_t *asV4Nodes = (asV4Node_t *)mmHandle->asV4Nodes.nodes;
+    asV6Node_t *asV6Nodes = (asV6Node_t *)mmHandle->asV6Nodes.nodes;
+    asOrgNode_t *asOrgNodes = (asOrgNode_t *)mmHandle->asOrgNodes.nodes;
+    uint32_t numLocations = kh_size(localMap);
+    uint32_t numIPv4 = mmHandle->ipV4Nodes.numNodes;
+    uint32_t numIPv6 = mmHandle->ipV6Nodes.numNodes;
+    uint32_t numASv4 = mmHandle->asV4Nodes.numNodes;
+    uint32_t numASv6 = mmHandle->asV6Nodes.numNodes;
+    uint32_t numASorg = mmHandle->asOrgNodes.numNodes;
+
+    // sort all records
+    if (numIPv4) qsort(ipV4Nodes, numIPv4, sizeof(ipV4Node_t), ipV4Node_cmp);
+    if (numIPv6) qsort(ipV6Nodes, numIPv6, sizeof(ipV6Node_t), ipV6Node_cmp);
+    if (numASv4) qsort(asV4Nodes, numASv4, sizeof(asV4Node_t), asV4Node_cmp);
+    if (numASv6) qsort(asV6Nodes, numASv6, sizeof(asV6Node_t), asV6Node_cmp);
+    if (numASorg) qsort(asOrgNodes, numASorg, sizeof(asOrgNode_t), asOrgNode_cmp);
+
+    // intern all strings first, as the final size of the string table is needed for the layout
+    for (khint_t k = kh_begin(localMap); k != kh_end(localMap); k++) {
+        if (kh_exist(localMap, k)) InternString(&stringTable, kh_value(localMap, k).city);
+    }
+    for (uint32_t i = 0; i < numASv4; i++) InternString(&stringTable, asV4Nodes[i].orgName);
+    for (uint32_t i = 0; i < numASv6; i++) InternString(&stringTable, asV6Nodes[i].orgName);
+    for (uint32_t i = 0; i < numASorg; i++) InternString(&stringTable, asOrgNodes[i].orgName);
+
+    // layout of the image
+    geoImageHeader_t header = {.magic = GEOIMAGE_MAGIC, .version = GEOIMAGE_VERSION};
+    size_t offset = (sizeof(geoImageHeader_t) + GEOIMAGE_ALIGN - 1) & ~(size_t)(GEOIMAGE_ALIGN - 1);
+    SetSection(&header, GeoLocationSection, &offset, numLocations, sizeof(geoLocation_t));
+    SetSection(&header, GeoStringSection, &offset, stringTable.size, 1);
+    SetSection(&header, GeoIPv4IndexSection, &offset, GEOINDEXSIZE, sizeof(uint32_t));
+    SetSection(&header, GeoIPv4Section, &offset, numIPv4, sizeof(geoIPv4_t));
+    SetSection(&header, GeoIPv4InfoSection, &offset, numIPv4, sizeof(geoInfo_t));
+    SetSection(&header, GeoIPv6IndexSection, &offset, GEOINDEXSIZE, sizeof(uint32_t));
+    SetSection(&header, GeoIPv6Section, &offset, numIPv6, sizeof(geoIPv6_t));
+    SetSection(&header, GeoIPv6InfoSection, &offset, numIPv6, sizeof(geoInfo_t));
+    SetSection(&header, GeoASv4IndexSection, &offset, GEOINDEXSIZE, sizeof(uint32_t));
+    SetSection(&header, GeoASv4Section, &offset, numASv4, sizeof(geoASv4_t));
+    SetSection(&header, GeoASv6IndexSection, &offset, GEOINDEXSIZE, sizeof(uint32_t));
+    SetSection(&header, GeoASv6Section, &offset, numASv6, sizeof(geoASv6_t));
+    SetSection(&header, GeoASorgSection, &offset, numASorg, sizeof(geoASorg_t));
+    header.size = offset;
+
+    void *image = calloc(1, header.size);
+    if (!image) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    // locations
+    geoLocation_t *location = (geoLocation_t *)SectionPtr(image, &header, GeoLocationSection);
+    uint32_t cnt = 0;
+    for (khint_t k = kh_begin(localMap); k != kh_end(localMap); k++) {
+        if (!kh_exist(localMap, k)) continue;
+        locationInfo_t *locationInfo = &kh_value(localMap, k);
+        int absent;
+        khint_t l = kh_put(locationIndex, locationIndex, locationInfo->localID, &absent);
+        kh_value(locationIndex, l) = cnt;
+        memcpy(location[cnt].continent, locationInfo->continent, sizeof(location[cnt].continent));
+        memcpy(location[cnt].country, locationInfo->country, sizeof(location[cnt].country));
+        location[cnt].city = InternString(&stringTable, locationInfo->city);
+        cnt++;
+    }
+
+    memcpy(SectionPtr(image, &header, GeoStringSection), stringTable.strings, stringTable.size);
+
+    // geo IPv4 ranges - records are sorted; ranges, which overlap with their predecessor are dropped
+    geoIPv4_t *ipV4 = (geoIPv4_t *)SectionPtr(image, &header, GeoIPv4Section);
+    geoInfo_t *ipV4Info = (geoInfo_t *)SectionPtr(image, &header, GeoIPv4InfoSection);
+    cnt = 0;
+    for (uint32_t i = 0; i < numIPv4; i++) {
+        ipV4Node_t *ipV4Node = &ipV4Nodes[i];
+        if (cnt && ipV4Node->network <= ipV4[cnt - 1].last) continue;
+        ipV4[cnt].first = ipV4Node->network;
+        ipV4[cnt].last = ipV4Node->network | ~ipV4Node->netmask;
+        khint_t k = kh_get(locationIndex, locationIndex, ipV4Node->info.localID);
+        ipV4Info[cnt] = (geoInfo_t){.location = k == kh_end(locationIndex) ? NOLOCATION : kh_value(locationIndex, k),
+                                    .accuracy = ipV4Node->info.accuracy,
+                                    .latitude = ipV4Node->info.latitude,
+                                    .longitude = ipV4Node->info.longitude,
+                                    .proxy = ipV4Node->info.proxy,
+                                    .sat = ipV4Node->info.sat};
+        cnt++;
+    }
+    if (cnt != numIPv4) LogError("Dropped %u duplicate or overlapping IPv4 networks", numIPv4 - cnt);
+    header.section[GeoIPv4Section].numElements = cnt;
+    header.section[GeoIPv4InfoSection].numElements = cnt;
+    BuildRangeIndex((uint32_t *)SectionPtr(image, &header, GeoIPv4IndexSection), ipV4, sizeof(geoIPv4_t), cnt, 0);
+
+    // geo IPv6 ranges
+    geoIPv6_t *ipV6 = (geoIPv6_t *)SectionPtr(image, &header, GeoIPv6Section);
+    geoInfo_t *ipV6Info = (geoInfo_t *)SectionPtr(image, &header, GeoIPv6InfoSection);
+    cnt = 0;
+    for (uint32_t i = 0; i < numIPv6; i++) {
+        ipV6Node_t *ipV6Node = &ipV6Nodes[i];
+        if (cnt && LessEqualV6(ipV6Node->network, ipV6[cnt - 1].last)) continue;
+        ipV6[cnt].first[0] = ipV6Node->network[0];
+        ipV6[cnt].first[1] = ipV6Node->network[1];
+        ipV6[cnt].last[0] = ipV6Node->network[0] | ~ipV6Node->netmask[0];
+        ipV6[cnt].last[1] = ipV6Node->network[1] | ~ipV6Node->netmask[1];
+        khint_t k = kh_get(locationIndex, locationIndex, ipV6Node->info.localID);
+        ipV6Info[cnt] = (geoInfo_t){.location = k == kh_end(locationIndex) ? NOLOCATION : kh_value(locationIndex, k),
+                                    .accuracy = ipV6Node->info.accuracy,
+                                    .latitude = ipV6Node->info.latitude,
+                                    .longitude = ipV6Node->info.longitude,
+                                    .proxy = ipV6Node->info.proxy,
+                                    .sat = ipV6Node->info.sat};
+        cnt++;
+    }
+    if (cnt != numIPv6) LogError("Dropped %u duplicate or overlapping IPv6 networks", numIPv6 - cnt);
+    header.section[GeoIPv6Section].numElements = cnt;
+    header.section[GeoIPv6InfoSection].numElements = cnt;
+    BuildRangeIndex((uint32_t *)SectionPtr(image, &header, GeoIPv6IndexSection), ipV6, sizeof(geoIPv6_t), cnt, 1);
+
+    // AS IPv4 ranges
+    geoASv4_t *asV4 = (geoASv4_t *)SectionPtr(image, &header, GeoASv4Section);
+    cnt = 0;
+    for (uint32_t i = 0; i < numASv4; i++) {
+        asV4Node_t *asV4Node = &asV4Nodes[i];
+        if (cnt && asV4Node->network <= asV4[cnt - 1].last) continue;
+        asV4[cnt] = (geoASv4_t){.first = asV4Node->network,
+                                .last = asV4Node->network | ~asV4Node->netmask,
+                                .as = asV4Node->as,
+                                .org = InternString(&stringTable, asV4Node->orgName)};
+        cnt++;
+    }
+    if (cnt != numASv4) LogError("Dropped %u duplicate or overlapping ASv4 networks", numASv4 - cnt);
+    header.section[GeoASv4Section].numElements = cnt;
+    BuildRangeIndex((uint32_t *)SectionPtr(image, &header, GeoASv4IndexSection), asV4, sizeof(geoASv4_t), cnt, 0);
+
+    // AS IPv6 ranges
+    geoASv6_t *asV6 = (geoASv6_t *)SectionPtr(image, &header, GeoASv6Section);
+    cnt = 0;
+    for (uint32_t i = 0; i < numASv6; i++) {
+        asV6Node_t *asV6Node = &asV6Nodes[i];
+        if (cnt && LessEqualV6(asV6Node->network, asV6[cnt - 1].last)) continue;
+        asV6[cnt].first[0] = asV6Node->network[0];
+        asV6[cnt].first[1] = asV6Node->network[1];
+        asV6[cnt].last[0] = asV6Node->network[0] | ~asV6Node->netmask[0];
+        asV6[cnt].last[1] = asV6Node->network[1] | ~asV6Node->netmask[1];
+        asV6[cnt].as = asV6Node->as;
+        asV6[cnt].org = InternString(&stringTable, asV6Node->orgName);
+        cnt++;
+    }
+    if (cnt != numASv6) LogError("Dropped %u duplicate or overlapping ASv6 networks", numASv6 - cnt);
+    header.section[GeoASv6Section].numElements = cnt;
+    BuildRangeIndex((uint32_t *)SectionPtr(image, &header, GeoASv6IndexSection), asV6, sizeof(geoASv6_t), cnt, 1);
+
+    // AS organisations - one entry per AS
+    geoASorg_t *asOrg = (geoASorg_t *)SectionPtr(image, &header, GeoASorgSection);
+    cnt = 0;
+    for (uint32_t i = 0; i < numASorg; i++) {
+        if (cnt && asOrgNodes[i].as == asOrg[cnt - 1].as) continue;
+        asOrg[cnt].as = asOrgNodes[i].as;
+        asOrg[cnt].org = InternString(&stringTable, asOrgNodes[i].orgName);
+        cnt++;
+    }
+    header.section[GeoASorgSection].numElements = cnt;
+
+    memcpy(image, &header, sizeof(geoImageHeader_t));
+
+    for (khint_t k = kh_begin(stringTable.stringMap); k != kh_end(stringTable.stringMap); k++) {
+        if (kh_exist(stringTable.stringMap, k)) free((void *)kh_key(stringTable.stringMap, k));
+    }
+    kh_destroy(stringMap, stringTable.stringMap);
+    kh_destroy(locationIndex, locationIndex);
+    free(stringTable.strings);
+
+    *imageSize = header.size;
+    return image;
+
+}  // End of BuildGeoImage
+
+// validate the image and set up the lookup arrays
+int SetGeoImage(void *image, size_t imageSize, int mapped) {
+    static const uint32_t elementSize[GeoMaxSection] = {
+        [GeoLocationSection] = sizeof(geoLocation_t), [GeoStringSection] = 1,
+        [GeoIPv4IndexSection] = sizeof(uint32_t),     [GeoIPv4Section] = sizeof(geoIPv4_t),
+        [GeoIPv4InfoSection] = sizeof(geoInfo_t),     [GeoIPv6IndexSection] = sizeof(uint32_t),
+        [GeoIPv6Section] = sizeof(geoIPv6_t),         [GeoIPv6InfoSection] = sizeof(geoInfo_t),
+        [GeoASv4IndexSection] = sizeof(uint32_t),     [GeoASv4Section] = sizeof(geoASv4_t),
+        [GeoASv6IndexSection] = sizeof(uint32_t),     [GeoASv6Section] = sizeof(geoASv6_t),
+        [GeoASorgSection] = sizeof(geoASorg_t),
+    };
+
+    geoImageHeader_t *header = (geoImageHeader_t *)image;
+    if (imageSize < sizeof(geoImageHeader_t) || header->magic != GEOIMAGE_MAGIC || header->version != GEOIMAGE_VERSION ||
+        header->size != imageSize) {
+        LogError("Invalid geo DB image - rebuild nfdump geo DB");
+        return 0;
+    }
+
+    for (int i = 0; i < GeoMaxSection; i++) {
+        geoSection_t *section = &header->section[i];
+        if (section->elementSize != elementSize[i] || section->offset > imageSize ||
+            ((uint64_t)section->numElements * section->elementSize) > (imageSize - section->offset)) {
+            LogError("Size check failed for geo DB section %d - rebuild nfdump geo DB", i);
+            return 0;
+        }
+    }
+
+    // range indices and string table must be consistent
+    uint32_t rangeSection[4][2] = {{GeoIPv4IndexSection, GeoIPv4Section},
+                                   {GeoIPv6IndexSection, GeoIPv6Section},
+                                   {GeoASv4IndexSection, GeoASv4Section},
+                                   {GeoASv6IndexSection, GeoASv6Section}};
+    for (int i = 0; i < 4; i++) {
+        uint32_t *index = (uint32_t *)SectionPtr(image, header, rangeSection[i][0]);
+        if (header->section[rangeSection[i][0]].numElements != GEOINDEXSIZE ||
+            index[GEOINDEXSIZE - 1] != header->section[rangeSection[i][1]].numElements) {
+            LogError("Corrupt range index in geo DB - rebuild nfdump geo DB");
+            return 0;
+        }
+    }
+    if (header->section[GeoIPv4InfoSection].numElements != header->section[GeoIPv4Section].numElements ||
+        header->section[GeoIPv6InfoSection].numElements != header->section[GeoIPv6Section].numElements) {
+        LogError("Corrupt geo info in geo DB - rebuild nfdump geo DB");
+        return 0;
+    }
+    const char *strings = (const char *)SectionPtr(image, header, GeoStringSection);
+    uint32_t stringSize = header->section[GeoStringSection].numElements;
+    if (stringSize == 0 || strings[stringSize - 1] != '\0') {
+        LogError("Corrupt string table in geo DB - rebuild nfdump geo DB");
+        return 0;
+    }
+
+    if (!mmHandle) {
+        mmHandle = calloc(1, sizeof(mmHandle_t));
+        if (!mmHandle) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+    }
+    // the records are no longer needed
+    FreeNodes();
+
+    // invalidate all lookup caches
+    geoGeneration++;
+
+    mmHandle->image = image;
+    mmHandle->imageSize = imageSize;
+    mmHandle->mapped = mapped;
+    mmHandle->location = (const geoLocation_t *)SectionPtr(image, header, GeoLocationSection);
+    mmHandle->numLocations = header->section[GeoLocationSection].numElements;
+    mmHandle->strings = strings;
+    mmHandle->stringSize = stringSize;
+    mmHandle->ipV4Index = (const uint32_t *)SectionPtr(image, header, GeoIPv4IndexSection);
+    mmHandle->ipV4 = (const geoIPv4_t *)SectionPtr(image, header, GeoIPv4Section);
+    mmHandle->ipV4Info = (const geoInfo_t *)SectionPtr(image, header, GeoIPv4InfoSection);
+    mmHandle->ipV6Index = (const uint32_t *)SectionPtr(image, header, GeoIPv6IndexSection);
+    mmHandle->ipV6 = (const geoIPv6_t *)SectionPtr(image, header, GeoIPv6Section);
+    mmHandle->ipV6Info = (const geoInfo_t *)SectionPtr(image, header, GeoIPv6InfoSection);
+    mmHandle->asV4Index = (const uint32_t *)SectionPtr(image, header, GeoASv4IndexSection);
+    mmHandle->asV4 = (const geoASv4_t *)SectionPtr(image, header, GeoASv4Section);
+    mmHandle->asV6Index = (const uint32_t *)SectionPtr(image, header, GeoASv6IndexSection);
+    mmHandle->asV6 = (const geoASv6_t *)SectionPtr(image, header, GeoASv6Section);
+    mmHandle->asOrg = (const geoASorg_t *)SectionPtr(image, header, GeoASorgSection);
+    mmHandle->numASorg = header->section[GeoASorgSection].numElements;
+
+    return 1;
+
+}  // End of SetGeoImage
+
+// return the index of the IPv4 range, which contains ip or -1
+static inline int32_t SearchV4(const uint32_t *index, const void *ranges, size_t elementSize, uint32_t ip) {
+    uint32_t prefix = ip >> 16;
+    uint32_t lo = index[prefix];
+    uint32_t hi = index[prefix + 1];
+    // find first range in prefix with first > ip
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        const uint32_t *range = (const uint32_t *)(ranges + (size_t)mid * elementSize);
+        if (range[0] <= ip)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    // the preceding range is the only candidate - it may start in an earlier prefix
+    if (lo == 0) return -1;
+    const uint32_t *range = (const uint32_t *)(ranges + (size_t)(lo - 1) * elementSize);
+    return ip <= range[1] ? (int32_t)(lo - 1) : -1;
+
+}  // End of SearchV4
+
+// return the index of the IPv6 range, which contains ip or -1
+static inline int32_t SearchV6(const uint32_t *index, const void *ranges, size_t elementSize, const uint64_t ip[2]) {
+    uint32_t prefix = ip[0] >> 48;
+    uint32_t lo = index[prefix];
+    uint32_t hi = index[prefix + 1];
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        const uint64_t *range = (const uint64_t *)(ranges + (size_t)mid * elementSize);
+        if (LessEqualV6(range, ip))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0) return -1;
+    const uint64_t *range = (const uint64_t *)(ranges + (size_t)(lo - 1) * elementSize);
+    return LessEqualV6(ip, range + 2) ? (int32_t)(lo - 1) : -1;
+
+}  // End of SearchV6
+
+static inline int32_t CachedSearchV4(v4CacheEntry_t *cache, const uint32_t *index, const void *ranges, size_t elementSize, uint32_t ip) {
+    v4CacheEntry_t *entry = &cache[(ip * 2654435761U) >> (32 - GEOCACHEBITS)];
+    if (entry->ip == ip && entry->generation == geoGeneration) return entry->index;
+
+    int32_t i = SearchV4(index, ranges, elementSize, ip);
+    *entry = (v4CacheEntry_t){.ip = ip, .generation = geoGeneration, .index = i};
+    return i;
+
+}  // End of CachedSearchV4
+
+static inline int32_t CachedSearchV6(v6CacheEntry_t *cache, const uint32_t *index, const void *ranges, size_t elementSize, const uint64_t ip[2]) {
+    v6CacheEntry_t *entry = &cache[((ip[0] ^ ip[1]) * 0x9E3779B97F4A7C15ULL) >> (64 - GEOCACHEBITS)];
+    if (entry->ip[0] == ip[0] && entry->ip[1] == ip[1] && entry->generation == geoGeneration) return entry->index;
+
+    int32_t i = SearchV6(index, ranges, elementSize, ip);
+    *entry = (v6CacheEntry_t){.ip = {ip[0], ip[1]}, .generation = geoGeneration, .index = i};
+    return i;
+
+}  // End of CachedSearchV6
+
+static inline const char *GeoString(uint32_t offset) {
+    return offset < mmHandle->stringSize ? mmHandle->strings + offset : "";
+}  // End of GeoString
+
+// return location of geo info or NULL
+static inline const geoLocation_t *GeoLocation(const geoInfo_t *info) {
+    return info->location < mmHandle->numLocations ? &mmHandle->location[info->location] : NULL;
+}  // End of GeoLocation
+
+static inline const geoInfo_t *LookupV4Info(uint32_t ip) {
+    int32_t i = CachedSearchV4(ipV4Cache, mmHandle->ipV4Index, mmHandle->ipV4, sizeof(geoIPv4_t), ip);
+    return i < 0 ? NULL : &mmHandle->ipV4Info[i];
+}  // End of LookupV4Info
+
+static inline const geoInfo_t *LookupV6Info(const uint64_t ip[2]) {
+    int32_t i = CachedSearchV6(ipV6Cache, mmHandle->ipV6Index, mmHandle->ipV6, sizeof(geoIPv6_t), ip);
+    return i < 0 ? NULL : &mmHandle->ipV6Info[i];
+}  // End of LookupV6Info
+
+static inline const geoASv4_t *LookupV4ASnode(uint32_t ip) {
+    int32_t i = CachedSearchV4(asV4Cache, mmHandle->asV4Index, mmHandle->asV4, sizeof(geoASv4_t), ip);
+    return i < 0 ? NULL : &mmHandle->asV4[i];
+}  // End of LookupV4ASnode
+
+static inline const geoASv6_t *LookupV6ASnode(const uint64_t ip[2]) {
+    int32_t i = CachedSearchV6(asV6Cache, mmHandle->asV6Index, mmHandle->asV6, sizeof(geoASv6_t), ip);
+    return i < 0 ? NULL : &mmHandle->asV6[i];
+}  // End of LookupV6ASnode
+
 void LoadLocalInfo(locationInfo_t *locationInfo, uint32_t NumRecords) {
     for (int i = 0; i < NumRecords; i++) {
         int absent;
@@ -174,73 +677,23 @@ void LoadLocalInfo(locationInfo_t *locationInfo, uint32_t NumRecords) {
 }  // End of LoadLocalInfo
 
 void LoadIPv4Tree(ipV4Node_t *ipV4Node, uint32_t NumRecords) {
-    kbtree_t(ipV4Tree) *ipV4Tree = mmHandle->ipV4Tree;
-    for (int i = 0; i < NumRecords; i++) {
-        ipV4Node_t *node = kb_getp(ipV4Tree, ipV4Tree, ipV4Node);
-        if (node) {
-            LogError("Duplicate IP node: ip: 0x%x, mask: 0x%x", ipV4Node->network, ipV4Node->netmask);
-        } else {
-            kb_putp(ipV4Tree, ipV4Tree, ipV4Node);
-        }
-        ipV4Node++;
-    }
-
+    AppendNodes(&mmHandle->ipV4Nodes, ipV4Node, NumRecords);
 }  // End of LoadIPv4Tree
 
 void LoadIPv6Tree(ipV6Node_t *ipV6Node, uint32_t NumRecords) {
-    kbtree_t(ipV6Tree) *ipV6Tree = mmHandle->ipV6Tree;
-    for (int i = 0; i < NumRecords; i++) {
-        ipV6Node_t *node = kb_getp(ipV6Tree, ipV6Tree, ipV6Node);
-        if (node) {
-            LogError("Duplicate IPV6 node: ip: 0x%x %x, mask: 0x%x %x", ipV6Node->network[0], ipV6Node->network[1], ipV6Node->netmask[0],
-                     ipV6Node->netmask[1]);
-        } else {
-            kb_putp(ipV6Tree, ipV6Tree, ipV6Node);
-        }
-        ipV6Node++;
-    }
-
+    AppendNodes(&mmHandle->ipV6Nodes, ipV6Node, NumRecords);
 }  // End of LoadIPv6Tree
 
 void LoadASV4Tree(asV4Node_t *asV4Node, uint32_t NumRecords) {
-    kbtree_t(asV4Tree) *asV4Tree = mmHandle->asV4Tree;
-    for (int i = 0; i < NumRecords; i++) {
-        asV4Node_t *node = kb_getp(asV4Tree, asV4Tree, asV4Node);
-        if (node) {
-            LogError("Insert: %d Duplicate ASv4 node: ip: 0x%x, mask: 0x%x", i, asV4Node->network, asV4Node->netmask);
-        } else {
-            kb_putp(asV4Tree, asV4Tree, asV4Node);
-        }
-        asV4Node++;
-    }
+    AppendNodes(&mmHandle->asV4Nodes, asV4Node, NumRecords);
 }  // End of LoadASV4Tree
 
 void LoadASV6Tree(asV6Node_t *asV6Node, uint32_t NumRecords) {
-    kbtree_t(asV6Tree) *asV6Tree = mmHandle->asV6Tree;
-    for (int i = 0; i < NumRecords; i++) {
-        asV6Node_t *node = kb_getp(asV6Tree, asV6Tree, asV6Node);
-        if (node) {
-            LogError("Insert: %d, Duplicate ASV6 node: ip: 0x%x %x, mask: 0x%x %x", i, asV6Node->network[0], asV6Node->network[1],
-                     asV6Node->netmask[0], asV6Node->netmask[1]);
-        } else {
-            kb_putp(asV6Tree, asV6Tree, asV6Node);
-        }
-        asV6Node++;
-    }
-
+    AppendNodes(&mmHandle->asV6Nodes, asV6Node, NumRecords);
 }  // End of LoadASV6Tree
 
 void LoadASorgTree(asOrgNode_t *asOrgNode, uint32_t NumRecords) {
-    kbtree_t(asOrgTree) *asOrgTree = mmHandle->asOrgTree;
-    for (int i = 0; i < NumRecords; i++) {
-        asOrgNode_t *node = kb_getp(asOrgTree, asOrgTree, asOrgNode);
-        if (node) {
-            LogError("Insert: %d Duplicate ASorg node: as: %d", i, asOrgNode->as);
-        } else {
-            kb_putp(asOrgTree, asOrgTree, asOrgNode);
-        }
-        asOrgNode++;
-    }
+    AppendNodes(&mmHandle->asOrgNodes, asOrgNode, NumRecords);
 }  // End of LoadASorgTree
 
 void PutLocation(locationInfo_t *locationInfo) {
@@ -257,220 +710,112 @@ void PutLocation(locationInfo_t *locationInfo) {
 
 }  // End of PutLocation
 
-void PutIPv4Node(ipV4Node_t *ipV4Node) {
-    kbtree_t(ipV4Tree) *ipV4Tree = mmHandle->ipV4Tree;
-
-    ipV4Node_t *node = kb_getp(ipV4Tree, ipV4Tree, ipV4Node);
-    if (node) {
-        uint32_t net = htonl(ipV4Node->network);
-        char s[32] = {0};
-        inet_ntop(AF_INET, &net, s, sizeof(s));
-        LogError("Duplicate IPV4 node: ip: %s", s);
-    } else {
-        kb_putp(ipV4Tree, ipV4Tree, ipV4Node);
-    }
-}  // End of PutIPv4Node
-
-void PutIPv6Node(ipV6Node_t *ipV6Node) {
-    kbtree_t(ipV6Tree) *ipV6Tree = mmHandle->ipV6Tree;
-    ipV6Node_t *node = kb_getp(ipV6Tree, ipV6Tree, ipV6Node);
-    if (node) {
-        uint64_t ipv6[2] = {htonll(ipV6Node->network[0]), htonll(ipV6Node->network[1])};
-        char s[128];
-        inet_ntop(AF_INET6, ipv6, s, sizeof(s));
-        LogError("Duplicate IPV6 node: ip: %s", s);
-    } else {
-        kb_putp(ipV6Tree, ipV6Tree, ipV6Node);
-    }
-}  // End of PutIPv6Node
+void PutIPv4Node(ipV4Node_t *ipV4Node) { AppendNodes(&mmHandle->ipV4Nodes, ipV4Node, 1); }  // End of PutIPv4Node
 
-void PutasV4Node(asV4Node_t *asV4Node) {
-    kbtree_t(asV4Tree) *asV4Tree = mmHandle->asV4Tree;
-    asV4Node_t *node = kb_getp(asV4Tree, asV4Tree, asV4Node);
-    if (node) {
-        LogError("Duplicate ASv4 node: AS%u %s", asV4Node->as, asV4Node->orgName);
-    } else {
-        kb_putp(asV4Tree, asV4Tree, asV4Node);
-    }
-}  // End of PutasV4Node
+void PutIPv6Node(ipV6Node_t *ipV6Node) { AppendNodes(&mmHandle->ipV6Nodes, ipV6Node, 1); }  // End of PutIPv6Node
 
-void PutasV6Node(asV6Node_t *asV6Node) {
-    kbtree_t(asV6Tree) *asV6Tree = mmHandle->asV6Tree;
+void PutasV4Node(asV4Node_t *asV4Node) { AppendNodes(&mmHandle->asV4Nodes, asV4Node, 1); }  // End of PutasV4Node
 
-    asV6Node_t *node = kb_getp(asV6Tree, asV6Tree, asV6Node);
-    if (node) {
-        LogError("Duplicate ASv6 node: AS%u %s", asV6Node->as, asV6Node->orgName);
-    } else {
-        kb_putp(asV6Tree, asV6Tree, asV6Node);
-    }
-}  // End of PutasV6Node
+void PutasV6Node(asV6Node_t *asV6Node) { AppendNodes(&mmHandle->asV6Nodes, asV6Node, 1); }  // End of PutasV6Node
 
-void PutASorgNode(asOrgNode_t *asOrgNode) {
-    kbtree_t(asOrgTree) *asOrgTree = mmHandle->asOrgTree;
-
-    asOrgNode_t *node = kb_getp(asOrgTree, asOrgTree, asOrgNode);
-    if (node == NULL) {
-        kb_putp(asOrgTree, asOrgTree, asOrgNode);
-    }
-}  // End of PutASorgNode
+void PutASorgNode(asOrgNode_t *asOrgNode) { AppendNodes(&mmHandle->asOrgNodes, asOrgNode, 1); }  // End of PutASorgNode
 
 void LookupV4Country(uint32_t ip, char *country) {
-    if (!mmHandle) {
-        country[0] = '.';
-        country[1] = '.';
-        return;
-    }
+    country[0] = '.';
+    country[1] = '.';
+    if (!mmHandle || !mmHandle->image) return;
 
-    ipLocationInfo_t info = {0};
-    ipV4Node_t ipSearch = {.network = ip, .netmask = 0};
-    ipV4Node_t *ipV4Node = kb_getp(ipV4Tree, mmHandle->ipV4Tree, &ipSearch);
-    if (!ipV4Node) {
-        country[0] = '.';
-        country[1] = '.';
-        return;
-    }
-    info = ipV4Node->info;
+    const geoInfo_t *info = LookupV4Info(ip);
+    if (!info) return;
 
-    locationKey_t locationKey = {.key = info.localID};
-    khint_t k = kh_get(localMap, mmHandle->localMap, locationKey);
-    if (k == kh_end(mmHandle->localMap)) {
-        country[0] = '.';
-        country[1] = '.';
-        return;
-    }
+    const geoLocation_t *location = GeoLocation(info);
+    if (!location) return;
 
-    locationInfo_t locationInfo = kh_value(mmHandle->localMap, k);
-    country[0] = locationInfo.country[0];
-    country[1] = locationInfo.country[1];
+    country[0] = location->country[0];
+    country[1] = location->country[1];
 
 }  // End of LookupV4Country
 
 void LookupV6Country(uint64_t ip[2], char *country) {
-    if (!mmHandle) {
-        country[0] = '.';
-        country[1] = '.';
-        return;
-    }
-
-    ipLocationInfo_t info = {0};
-    ipV6Node_t ipSearch = {0};
-    ipSearch.network[0] = ip[0];
-    ipSearch.network[1] = ip[1];
-    ipV6Node_t *ipV6Node = kb_getp(ipV6Tree, mmHandle->ipV6Tree, &ipSearch);
-    if (!ipV6Node) {
-        country[0] = '.';
-        country[1] = '.';
-        return;
-    }
-    info = ipV6Node->info;
-
-    locationKey_t locationKey = {.key = info.localID};
-    khint_t k = kh_get(localMap, mmHandle->localMap, locationKey);
-    if (k == kh_end(mmHandle->localMap)) {
-        country[0] = '.';
-        country[1] = '.';
-        return;
-    }
-
-    locationInfo_t locationInfo = kh_value(mmHandle->localMap, k);
-    country[0] = locationInfo.country[0];
-    country[1] = locationInfo.country[1];
-
-    /*
-            printf("localID: %d %s/%s/%s long/lat: %8.4f/%-8.4f, accuracy: %u, AS: %u\n",
-                    locationInfo.localID, locationInfo.continent, locationInfo.country, locationInfo.city,
-                    ipV4Node->longitude, ipV4Node->latitude, ipV4Node->accuracy, as);
-            }
-    */
+    country[0] = '.';
+    country[1] = '.';
+    if (!mmHandle || !mmHandle->image) return;
+
+    const geoInfo_t *info = LookupV6Info(ip);
+    if (!info) return;
+
+    const geoLocation_t *location = GeoLocation(info);
+    if (!location) return;
+
+    country[0] = location->country[0];
+    country[1] = location->country[1];
+
 }  // End of LookupV6Country
 
 void LookupV4Location(uint32_t ip, char *location, size_t len) {
     location[0] = '\0';
-    if (!mmHandle) {
-        return;
-    }
+    if (!mmHandle || !mmHandle->image) return;
 
-    ipLocationInfo_t info = {0};
-    ipV4Node_t ipSearch = {.network = ip, .netmask = 0};
-    ipV4Node_t *ipV4Node = kb_getp(ipV4Tree, mmHandle->ipV4Tree, &ipSearch);
-    if (!ipV4Node) {
-        return;
-    }
-    info = ipV4Node->info;
+    const geoInfo_t *info = LookupV4Info(ip);
+    if (!info) return;
 
-    locationKey_t locationKey = {.key = info.localID};
-    khint_t k = kh_get(localMap, mmHandle->localMap, locationKey);
-    if (k == kh_end(mmHandle->localMap)) {
-        return;
-    }
+    const geoLocation_t *geoLocation = GeoLocation(info);
+    if (!geoLocation) return;
 
-    locationInfo_t locationInfo = kh_value(mmHandle->localMap, k);
-    snprintf(location, len, "%s/%s/%s long/lat: %.4f/%-.4f", locationInfo.continent, locationInfo.country, locationInfo.city, info.longitude,
-             info.latitude);
+    snprintf(location, len, "%.4s/%.4s/%s long/lat: %.4f/%-.4f", geoLocation->continent, geoLocation->country, GeoString(geoLocation->city),
+             info->longitude, info->latitude);
 
 }  // End of LookupV4Location
 
 void LookupV6Location(uint64_t ip[2], char *location, size_t len) {
     location[0] = '\0';
-    if (!mmHandle) {
-        return;
-    }
+    if (!mmHandle || !mmHandle->image) return;
 
-    ipLocationInfo_t info = {0};
+    const geoInfo_t *info = LookupV6Info(ip);
+    if (!info) return;
 
-    ipV6Node_t ipSearch = {0};
-    ipSearch.network[0] = ip[0];
-    ipSearch.network[1] = ip[1];
-    ipV6Node_t *ipV6Node = kb_getp(ipV6Tree, mmHandle->ipV6Tree, &ipSearch);
-    if (!ipV6Node) {
-        return;
-    }
-    info = ipV6Node->info;
+    const geoLocation_t *geoLocation = GeoLocation(info);
+    if (!geoLocation) return;
 
-    locationKey_t locationKey = {.key = info.localID};
-    khint_t k = kh_get(localMap, mmHandle->localMap, locationKey);
-    if (k == kh_end(mmHandle->localMap)) {
-        return;
-    }
-
-    locationInfo_t locationInfo = kh_value(mmHandle->localMap, k);
-    snprintf(location, len, "%s/%s/%s long/lat: %.4f/%-.4f", locationInfo.continent, locationInfo.country, locationInfo.city, info.longitude,
-             info.latitude);
+    snprintf(location, len, "%.4s/%.4s/%s long/lat: %.4f/%-.4f", geoLocation->continent, geoLocation->country, GeoString(geoLocation->city),
+             info->longitude, info->latitude);
 
 }  // End of LookupV6Location
 
 uint32_t LookupV4AS(uint32_t ip) {
-    if (!mmHandle) {
-        return 0;
-    }
+    if (!mmHandle || !mmHandle->image) return 0;
 
-    asV4Node_t asSearch = {.network = ip, .netmask = 0};
-    asV4Node_t *asV4Node = kb_getp(asV4Tree, mmHandle->asV4Tree, &asSearch);
-    return asV4Node == NULL ? 0 : asV4Node->as;
+    const geoASv4_t *asV4 = LookupV4ASnode(ip);
+    return asV4 == NULL ? 0 : asV4->as;
 
 }  // End of LookupV4AS
 
 uint32_t LookupV6AS(uint64_t ip[2]) {
-    if (!mmHandle) {
-        return 0;
-    }
+    if (!mmHandle || !mmHandle->image) return 0;
 
-    asV6Node_t asV6Search = {0};
-    asV6Search.network[0] = ip[0];
-    asV6Search.network[1] = ip[1];
-    asV6Node_t *asV6Node = kb_getp(asV6Tree, mmHandle->asV6Tree, &asV6Search);
-    return asV6Node == NULL ? 0 : asV6Node->as;
+    const geoASv6_t *asV6 = LookupV6ASnode(ip);
+    return asV6 == NULL ? 0 : asV6->as;
 
 }  // End of LookupV6AS
 
 const char *LookupASorg(uint32_t as) {
-    if (!mmHandle) {
+    if (!mmHandle || !mmHandle->image) {
         return NULL;
     }
 
-    asOrgNode_t asSearch = {.as = as};
-    asOrgNode_t *asOrgNode = kb_getp(asOrgTree, mmHandle->asOrgTree, &asSearch);
-    return asOrgNode == NULL ? "not found" : asOrgNode->orgName;
+    // binary search in the sorted AS array
+    uint32_t lo = 0;
+    uint32_t hi = mmHandle->numASorg;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        if (mmHandle->asOrg[mid].as < as)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < mmHandle->numASorg && mmHandle->asOrg[lo].as == as) return GeoString(mmHandle->asOrg[lo].org);
+
+    return "not found";
 
 }  // End of LookupASorg
 
@@ -490,65 +835,52 @@ void LookupAS(char *asString) {
 }  // End of LookupAS
 
 const char *LookupV4ASorg(uint32_t ip) {
-    if (!mmHandle) {
+    if (!mmHandle || !mmHandle->image) {
         return "";
     }
 
-    asV4Node_t asSearch = {.network = ip, .netmask = 0};
-    asV4Node_t *asV4Node = kb_getp(asV4Tree, mmHandle->asV4Tree, &asSearch);
-    return asV4Node == NULL ? "" : asV4Node->orgName;
+    const geoASv4_t *asV4 = LookupV4ASnode(ip);
+    return asV4 == NULL ? "" : GeoString(asV4->org);
 }  // End of LookupV4ASorg
 
 const char *LookupV6ASorg(uint64_t ip[2]) {
-    if (!mmHandle) {
+    if (!mmHandle || !mmHandle->image) {
         return "";
     }
 
-    asV6Node_t asV6Search = {0};
-    asV6Search.network[0] = ip[0];
-    asV6Search.network[1] = ip[1];
-    asV6Node_t *asV6Node = kb_getp(asV6Tree, mmHandle->asV6Tree, &asV6Search);
-    return asV6Node == NULL ? "" : asV6Node->orgName;
+    const geoASv6_t *asV6 = LookupV6ASnode(ip);
+    return asV6 == NULL ? "" : GeoString(asV6->org);
 
 }  // End of LookupV6ASorg
 
 void LookupWhois(char *ip) {
+    if (!mmHandle || !mmHandle->image) return;
+
     uint32_t as = 0;
-    char *asOrg = NULL;
-    ipV4Node_t *ipV4Node;
-    ipV6Node_t *ipV6Node;
-    ipLocationInfo_t info = {0};
+    const char *asOrg = NULL;
+    const geoInfo_t *info = NULL;
     if (strchr(ip, ':') != NULL) {
         // IPv6
         uint64_t network[2];
-        ipV6Node_t ipSearch = {0};
-        asV6Node_t asSearch = {0};
         int ret = inet_pton(PF_INET6, ip, network);
         if (ret != 1) return;
-        ipSearch.network[0] = ntohll(network[0]);
-        asSearch.network[0] = ntohll(network[0]);
-        ipSearch.network[1] = ntohll(network[1]);
-        asSearch.network[1] = ntohll(network[1]);
-
-        uint64_t testv4v6 = ipSearch.network[1] & 0xFFFFFFFF00000000LL;
-        if (ipSearch.network[0] == 0 && (testv4v6 == 0LL || testv4v6 == 0x0000ffff00000000LL)) {
-            uint32_t net = ipSearch.network[1];
-            asV4Node_t asSearch = {.network = net, .netmask = 0};
-            asV4Node_t *asV4Node = kb_getp(asV4Tree, mmHandle->asV4Tree, &asSearch);
-            if (asV4Node) {
-                as = asV4Node->as;
-                asOrg = asV4Node->orgName;
+        uint64_t ipSearch[2] = {ntohll(network[0]), ntohll(network[1])};
+
+        uint64_t testv4v6 = ipSearch[1] & 0xFFFFFFFF00000000LL;
+        if (ipSearch[0] == 0 && (testv4v6 == 0LL || testv4v6 == 0x0000ffff00000000LL)) {
+            uint32_t net = ipSearch[1];
+            const geoASv4_t *asV4 = LookupV4ASnode(net);
+            if (asV4) {
+                as = asV4->as;
+                asOrg = GeoString(asV4->org);
             }
         } else {
-            ipV6Node = kb_getp(ipV6Tree, mmHandle->ipV6Tree, &ipSearch);
-            if (ipV6Node) {
-                info = ipV6Node->info;
-            }
+            info = LookupV6Info(ipSearch);
 
-            asV6Node_t *asV6Node = kb_getp(asV6Tree, mmHandle->asV6Tree, &asSearch);
-            if (asV6Node) {
-                as = asV6Node->as;
-                asOrg = asV6Node->orgName;
+            const geoASv6_t *asV6 = LookupV6ASnode(ipSearch);
+            if (asV6) {
+                as = asV6->as;
+                asOrg = GeoString(asV6->org);
             }
         }
 
@@ -557,132 +889,21 @@ void LookupWhois(char *ip) {
         uint32_t net;
         int ret = inet_pton(PF_INET, ip, &net);
         if (ret != 1) return;
-        ipV4Node_t ipSearch = {.network = ntohl(net), .netmask = 0};
-        ipV4Node = kb_getp(ipV4Tree, mmHandle->ipV4Tree, &ipSearch);
-        if (ipV4Node) {
-            info = ipV4Node->info;
-        }
+        info = LookupV4Info(ntohl(net));
 
-        asV4Node_t asSearch = {.network = ntohl(net), .netmask = 0};
-        asV4Node_t *asV4Node = kb_getp(asV4Tree, mmHandle->asV4Tree, &asSearch);
-        if (asV4Node) {
-            as = asV4Node->as;
-            asOrg = asV4Node->orgName;
+        const geoASv4_t *asV4 = LookupV4ASnode(ntohl(net));
+        if (asV4) {
+            as = asV4->as;
+            asOrg = GeoString(asV4->org);
         }
     }
 
-    locationKey_t locationKey = {.key = info.localID};
-    khint_t k = kh_get(localMap, mmHandle->localMap, locationKey);
-    if (k == kh_end(mmHandle->localMap)) {
-        printf("%-7u | %-24s | %-32s | no information | sat: %d\n", as, ip, asOrg == NULL ? "private" : asOrg, info.sat);
+    const geoLocation_t *location = info ? GeoLocation(info) : NULL;
+    if (location == NULL) {
+        printf("%-7u | %-24s | %-32s | no information | sat: %d\n", as, ip, asOrg == NULL ? "private" : asOrg, info ? info->sat : 0);
     } else {
-        locationInfo_t locationInfo = kh_value(mmHandle->localMap, k);
-        printf("%-7u | %-24s | %-32s | %s/%s/%s long/lat: %8.4f/%-8.4f | sat: %d\n", as, ip, asOrg == NULL ? "private" : asOrg,
-               locationInfo.continent, locationInfo.country, locationInfo.city, info.longitude, info.latitude, info.sat);
+        printf("%-7u | %-24s | %-32s | %.4s/%.4s/%s long/lat: %8.4f/%-8.4f | sat: %d\n", as, ip, asOrg == NULL ? "private" : asOrg,
+               location->continent, location->country, GeoString(location->city), info->longitude, info->latitude, info->sat);
     }
 
 }  // End of LookupWhois
-
-locationInfo_t *NextLocation(int start) {
-    static khint_t k = 0;
-    static locationInfo_t locationInfo;
-
-    khash_t(localMap) *localMap = mmHandle->localMap;
-    if (start == FIRSTNODE) k = kh_begin(localMap);
-
-    while (k != kh_end(localMap)) {
-        if (kh_exist(localMap, k)) {  // test if a bucket contains data
-            locationInfo = kh_value(localMap, k);
-            k++;
-            return &locationInfo;
-        }
-        k++;
-    }
-
-    return NULL;
-
-}  // End of NextLocation
-
-ipV4Node_t *NextIPv4Node(int start) {
-    static kbitr_t itr = {0};
-    static ipV4Node_t *ipV4Node = NULL;
-
-    kbtree_t(ipV4Tree) *ipV4Tree = mmHandle->ipV4Tree;
-    if (start == FIRSTNODE) kb_itr_first(ipV4Tree, ipV4Tree, &itr);  // get an iterator pointing to the first
-
-    if (kb_itr_valid(&itr)) {
-        ipV4Node = &kb_itr_key(ipV4Node_t, &itr);
-        kb_itr_next(ipV4Tree, ipV4Tree, &itr);  // move on
-        return ipV4Node;
-    } else {
-        return NULL;
-    }
-
-}  // End of NextIPv4Node
-
-ipV6Node_t *NextIPv6Node(int start) {
-    static kbitr_t itr = {0};
-    static ipV6Node_t *ipV6Node = NULL;
-
-    kbtree_t(ipV6Tree) *ipV6Tree = mmHandle->ipV6Tree;
-    if (start == FIRSTNODE) kb_itr_first(ipV6Tree, ipV6Tree, &itr);  // get an iterator pointing to the first
-
-    if (kb_itr_valid(&itr)) {
-        ipV6Node = &kb_itr_key(ipV6Node_t, &itr);
-        kb_itr_next(ipV6Tree, ipV6Tree, &itr);  // move on
-        return ipV6Node;
-    } else {
-        return NULL;
-    }
-
-}  // End of NextIPv6Node
-
-asV4Node_t *NextasV4Node(int start) {
-    static kbitr_t itr = {0};
-    static asV4Node_t *asV4Node = NULL;
-
-    kbtree_t(asV4Tree) *asV4Tree = mmHandle->asV4Tree;
-    if (start == FIRSTNODE) kb_itr_first(asV4Tree, asV4Tree, &itr);  // get an iterator pointing to the first
-
-    if (kb_itr_valid(&itr)) {
-        asV4Node = &kb_itr_key(asV4Node_t, &itr);
-        kb_itr_next(asV4Tree, asV4Tree, &itr);  // move on
-        return asV4Node;
-    } else {
-        return NULL;
-    }
-
-}  // End of NextasV4Node
-
-asV6Node_t *NextasV6Node(int start) {
-    static kbitr_t itr = {0};
-    static asV6Node_t *asV6Node = NULL;
-
-    kbtree_t(asV6Tree) *asV6Tree = mmHandle->asV6Tree;
-    if (start == FIRSTNODE) kb_itr_first(asV6Tree, asV6Tree, &itr);  // get an iterator pointing to the first
-
-    if (kb_itr_valid(&itr)) {
-        asV6Node = &kb_itr_key(asV6Node_t, &itr);
-        kb_itr_next(asV6Tree, asV6Tree, &itr);  // move on
-        return asV6Node;
-    } else {
-        return NULL;
-    }
-}  // End of NextasV6Node
-
-asOrgNode_t *NextasOrgNode(int start) {
-    static kbitr_t itr = {0};
-    static asOrgNode_t *asOrgNode = NULL;
-
-    kbtree_t(asOrgTree) *asOrgTree = mmHandle->asOrgTree;
-    if (start == FIRSTNODE) kb_itr_first(asOrgTree, asOrgTree, &itr);  // get an iterator pointing to the first
-
-    if (kb_itr_valid(&itr)) {
-        asOrgNode = &kb_itr_key(asOrgNode_t, &itr);
-        kb_itr_next(asOrgTree, asOrgTree, &itr);  // move on
-        return asOrgNode;
-    } else {
-        return NULL;
-    }
-
-}  // End of NextasOrgNode
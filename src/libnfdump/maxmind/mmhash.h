@@ -33,7 +33,6 @@
 
 #include <stdint.h>
 
-#include "kbtree.h"
 #include "khash.h"
 
 typedef struct locationKey_s {
@@ -107,8 +106,111 @@ typedef struct asOrgNode_s {
     char orgName[orgNameLength];
 } asOrgNode_t;
 
+/*
+ * Geo DB image
+ * ============
+ * The image is a single block of memory, which is written as is to the geo DB file
+ * and mapped by nfdump with mmap(). No data needs to be loaded or converted at startup.
+ * The image header is followed by sections, each aligned to GEOIMAGE_ALIGN bytes.
+ *
+ * - All IP ranges are sorted arrays of non overlapping [first, last] ranges in host byte order.
+ *   A range index of GEOINDEXSIZE elements per range array holds for each 16bit prefix the
+ *   number of ranges, starting below this prefix. A lookup therefore binary searches only the
+ *   ranges of the prefix of an address, which is mostly one or two cache lines.
+ * - geo ranges have a parallel info array with the same index, which references a location.
+ * - All strings are interned in the string section and referenced by their offset.
+ *   Offset 0 is the empty string.
+ */
+#define GEOIMAGE_MAGIC 0x4947464E  // "NFGI"
+#define GEOIMAGE_VERSION 1
+#define GEOIMAGE_ALIGN 64
+#define GEOINDEXSIZE (65536 + 1)
+#define NOLOCATION 0xFFFFFFFF
+
+enum {
+    GeoLocationSection = 0,
+    GeoStringSection,
+    GeoIPv4IndexSection,
+    GeoIPv4Section,
+    GeoIPv4InfoSection,
+    GeoIPv6IndexSection,
+    GeoIPv6Section,
+    GeoIPv6InfoSection,
+    GeoASv4IndexSection,
+    GeoASv4Section,
+    GeoASv6IndexSection,
+    GeoASv6Section,
+    GeoASorgSection,
+    GeoMaxSection
+};
+
+typedef struct geoSection_s {
+    uint64_t offset;  // offset from start of image
+    uint32_t numElements;
+    uint32_t elementSize;
+} geoSection_t;
+
+typedef struct geoImageHeader_s {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;  // size of the entire image
+    geoSection_t section[GeoMaxSection];
+} geoImageHeader_t;
+
+typedef struct geoLocation_s {
+    char continent[4];
+    char country[4];
+    uint32_t city;  // string offset
+} geoLocation_t;
+
+typedef struct geoInfo_s {
+    uint32_t location;  // index into location array or NOLOCATION
+    uint32_t accuracy;
+    double latitude;
+    double longitude;
+    uint8_t proxy;
+    uint8_t sat;
+    uint8_t fill[6];
+} geoInfo_t;
+
+typedef struct geoIPv4_s {
+    uint32_t first;
+    uint32_t last;
+} geoIPv4_t;
+
+typedef struct geoIPv6_s {
+    // [0] high 64bit, [1] low 64bit host representation
+    uint64_t first[2];
+    uint64_t last[2];
+} geoIPv6_t;
+
+typedef struct geoASv4_s {
+    uint32_t first;
+    uint32_t last;
+    uint32_t as;
+    uint32_t org;  // string offset
+} geoASv4_t;
+
+typedef struct geoASv6_s {
+    uint64_t first[2];
+    uint64_t last[2];
+    uint32_t as;
+    uint32_t org;  // string offset
+} geoASv6_t;
+
+typedef struct geoASorg_s {
+    uint32_t as;
+    uint32_t org;  // string offset
+} geoASorg_t;
+
 int Init_MaxMind(void);
 
+void *BuildGeoImage(size_t *imageSize);
+
+#define GEOIMAGE_ALLOCATED 0
+#define GEOIMAGE_MAPPED 1
+int SetGeoImage(void *image, size_t imageSize, int mapped);
+
 void LoadLocalInfo(locationInfo_t *locationInfo, uint32_t NumRecords);
 
 void LoadIPv4Tree(ipV4Node_t *ipV4Node, uint32_t NumRecords);
@@ -133,20 +235,6 @@ void PutasV6Node(asV6Node_t *asV6Node);
 
 void PutASorgNode(asOrgNode_t *asOrgNode);
 
-#define FIRSTNODE 1
-#define NEXTNODE 0
-locationInfo_t *NextLocation(int start);
-
-ipV4Node_t *NextIPv4Node(int start);
-
-ipV6Node_t *NextIPv6Node(int start);
-
-asV4Node_t *NextasV4Node(int start);
-
-asV6Node_t *NextasV6Node(int start);
-
-asOrgNode_t *NextasOrgNode(int start);
-
 int SaveMaxMind(char *fileName);
 
 #endif
\ No newline at end of file
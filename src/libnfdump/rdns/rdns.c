@@ -0,0 +1,347 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Asynchronous reverse DNS lookups for the output formats
+ * A pool of resolver threads resolves addresses with getnameinfo() into a shared
+ * LRU cache. Addresses are prefetched by the filter workers, while the output
+ * waits only for lookups, which are not yet resolved.
+ */
+
+#include "rdns.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "util.h"
+
+#define MAXRESOLVERS 64
+// max length of a host name
+#define HOSTNAMELEN 256
+
+#define NOENTRY 0xFFFFFFFF
+
+enum { RDNS_EMPTY = 0, RDNS_PENDING, RDNS_DONE };
+
+typedef struct rdnsEntry_s {
+    uint64_t ip[2];     // IPv4 in ip[1]
+    uint32_t isV6;      // address family
+    uint32_t state;     // RDNS_*
+    uint32_t hashNext;  // next entry in hash bucket
+    uint32_t lruPrev;   // LRU list - head is most recently used
+    uint32_t lruNext;
+    char name[HOSTNAMELEN];  // empty, if the address has no name
+} rdnsEntry_t;
+
+static struct rdnsCache_s {
+    pthread_mutex_t mutex;
+    pthread_cond_t requestCond;  // signals new requests to the resolvers
+    pthread_cond_t doneCond;     // signals resolved entries to the lookups
+    rdnsEntry_t *entries;
+    uint32_t *hashTable;
+    uint32_t hashMask;
+    uint32_t cacheSize;
+    uint32_t numEntries;
+    uint32_t lruHead;
+    uint32_t lruTail;
+    // ring of pending entries - at most cacheSize entries are pending
+    uint32_t *request;
+    uint32_t requestSize;
+    uint32_t requestHead;
+    uint32_t requestTail;
+    int done;
+    uint32_t numResolvers;
+    pthread_t tid[MAXRESOLVERS];
+} rdnsCache = {.mutex = PTHREAD_MUTEX_INITIALIZER, .requestCond = PTHREAD_COND_INITIALIZER, .doneCond = PTHREAD_COND_INITIALIZER};
+
+static inline uint32_t RDNSHash(const uint64_t ip[2], uint32_t isV6) {
+    uint64_t hash = (ip[0] ^ (ip[1] * 0x9E3779B97F4A7C15ULL)) + isV6;
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    return (uint32_t)(hash >> 32) & rdnsCache.hashMask;
+}  // End of RDNSHash
+
+static void LRUUnlink(uint32_t index) {
+    rdnsEntry_t *entry = &(rdnsCache.entries[index]);
+    if (entry->lruPrev != NOENTRY)
+        rdnsCache.entries[entry->lruPrev].lruNext = entry->lruNext;
+    else
+        rdnsCache.lruHead = entry->lruNext;
+    if (entry->lruNext != NOENTRY)
+        rdnsCache.entries[entry->lruNext].lruPrev = entry->lruPrev;
+    else
+        rdnsCache.lruTail = entry->lruPrev;
+}  // End of LRUUnlink
+
+static void LRUPush(uint32_t index) {
+    rdnsEntry_t *entry = &(rdnsCache.entries[index]);
+    entry->lruPrev = NOENTRY;
+    entry->lruNext = rdnsCache.lruHead;
+    if (rdnsCache.lruHead != NOENTRY) rdnsCache.entries[rdnsCache.lruHead].lruPrev = index;
+    rdnsCache.lruHead = index;
+    if (rdnsCache.lruTail == NOENTRY) rdnsCache.lruTail = index;
+}  // End of LRUPush
+
+static void HashUnlink(uint32_t index) {
+    rdnsEntry_t *entry = &(rdnsCache.entries[index]);
+    uint32_t *link = &(rdnsCache.hashTable[RDNSHash(entry->ip, entry->isV6)]);
+    while (*link != index) link = &(rdnsCache.entries[*link].hashNext);
+    *link = entry->hashNext;
+}  // End of HashUnlink
+
+// find the entry of an address and request its lookup, if not yet cached
+// returns NOENTRY, if all entries are pending - must be called locked
+static uint32_t RequestEntry(const uint64_t ip[2], uint32_t isV6) {
+    uint32_t hash = RDNSHash(ip, isV6);
+    uint32_t index = rdnsCache.hashTable[hash];
+    while (index != NOENTRY) {
+        rdnsEntry_t *entry = &(rdnsCache.entries[index]);
+        if (entry->ip[0] == ip[0] && entry->ip[1] == ip[1] && entry->isV6 == isV6) {
+            LRUUnlink(index);
+            LRUPush(index);
+            return index;
+        }
+        index = entry->hashNext;
+    }
+
+    if (rdnsCache.numEntries < rdnsCache.cacheSize) {
+        index = rdnsCache.numEntries++;
+    } else {
+        // evict the least recently used resolved entry
+        index = rdnsCache.lruTail;
+        while (index != NOENTRY && rdnsCache.entries[index].state == RDNS_PENDING) index = rdnsCache.entries[index].lruPrev;
+        if (index == NOENTRY) return NOENTRY;
+        LRUUnlink(index);
+        HashUnlink(index);
+    }
+
+    rdnsEntry_t *entry = &(rdnsCache.entries[index]);
+    entry->ip[0] = ip[0];
+    entry->ip[1] = ip[1];
+    entry->isV6 = isV6;
+    entry->state = RDNS_PENDING;
+    entry->name[0] = '\0';
+    entry->hashNext = rdnsCache.hashTable[hash];
+    rdnsCache.hashTable[hash] = index;
+    LRUPush(index);
+
+    rdnsCache.request[rdnsCache.requestHead] = index;
+    rdnsCache.requestHead = (rdnsCache.requestHead + 1) % rdnsCache.requestSize;
+    pthread_cond_signal(&rdnsCache.requestCond);
+
+    return index;
+}  // End of RequestEntry
+
+static void ResolveEntry(const uint64_t ip[2], uint32_t isV6, char *name) {
+    struct sockaddr_storage ss = {0};
+    socklen_t len;
+    if (isV6) {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)&ss;
+        sa6->sin6_family = AF_INET6;
+        for (int i = 0; i < 8; i++) {
+            sa6->sin6_addr.s6_addr[i] = (uint8_t)(ip[0] >> (56 - 8 * i));
+            sa6->sin6_addr.s6_addr[i + 8] = (uint8_t)(ip[1] >> (56 - 8 * i));
+        }
+        len = sizeof(struct sockaddr_in6);
+    } else {
+        struct sockaddr_in *sa = (struct sockaddr_in *)&ss;
+        sa->sin_family = AF_INET;
+        sa->sin_addr.s_addr = htonl((uint32_t)ip[1]);
+        len = sizeof(struct sockaddr_in);
+    }
+    if (getnameinfo((struct sockaddr *)&ss, len, name, HOSTNAMELEN, NULL, 0, NI_NAMEREQD) != 0) name[0] = '\0';
+}  // End of ResolveEntry
+
+static void *resolverThread(void *arg) {
+    char name[HOSTNAMELEN];
+
+    pthread_mutex_lock(&rdnsCache.mutex);
+    while (1) {
+        while (rdnsCache.requestHead == rdnsCache.requestTail && !rdnsCache.done)
+            pthread_cond_wait(&rdnsCache.requestCond, &rdnsCache.mutex);
+        if (rdnsCache.done) break;
+
+        uint32_t index = rdnsCache.request[rdnsCache.requestTail];
+        rdnsCache.requestTail = (rdnsCache.requestTail + 1) % rdnsCache.requestSize;
+        // pending entries are never evicted - the address is stable until resolved
+        rdnsEntry_t *entry = &(rdnsCache.entries[index]);
+        pthread_mutex_unlock(&rdnsCache.mutex);
+
+        ResolveEntry(entry->ip, entry->isV6, name);
+
+        pthread_mutex_lock(&rdnsCache.mutex);
+        strcpy(entry->name, name);
+        entry->state = RDNS_DONE;
+        pthread_cond_broadcast(&rdnsCache.doneCond);
+    }
+    pthread_mutex_unlock(&rdnsCache.mutex);
+
+    return NULL;
+}  // End of resolverThread
+
+int Init_RDNS(uint32_t numResolvers, uint32_t cacheSize) {
+    if (rdnsCache.entries) return 1;
+
+    if (numResolvers == 0) numResolvers = RDNSRESOLVERS;
+    if (numResolvers > MAXRESOLVERS) numResolvers = MAXRESOLVERS;
+    if (cacheSize == 0) cacheSize = RDNSCACHESIZE;
+
+    uint32_t hashSize = 1;
+    while (hashSize < cacheSize) hashSize <<= 1;
+
+    rdnsCache.entries = calloc(cacheSize, sizeof(rdnsEntry_t));
+    rdnsCache.request = calloc(cacheSize + 1, sizeof(uint32_t));
+    rdnsCache.hashTable = malloc(hashSize * sizeof(uint32_t));
+    if (!rdnsCache.entries || !rdnsCache.request || !rdnsCache.hashTable) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(rdnsCache.entries);
+        free(rdnsCache.request);
+        free(rdnsCache.hashTable);
+        rdnsCache.entries = NULL;
+        return 0;
+    }
+    memset((void *)rdnsCache.hashTable, 0xFF, hashSize * sizeof(uint32_t));
+    rdnsCache.hashMask = hashSize - 1;
+    rdnsCache.cacheSize = cacheSize;
+    rdnsCache.requestSize = cacheSize + 1;
+    rdnsCache.numEntries = 0;
+    rdnsCache.lruHead = rdnsCache.lruTail = NOENTRY;
+    rdnsCache.requestHead = rdnsCache.requestTail = 0;
+    rdnsCache.done = 0;
+
+    rdnsCache.numResolvers = 0;
+    for (uint32_t i = 0; i < numResolvers; i++) {
+        int err = pthread_create(&(rdnsCache.tid[i]), NULL, resolverThread, NULL);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            break;
+        }
+        rdnsCache.numResolvers++;
+    }
+    if (rdnsCache.numResolvers == 0) {
+        Dispose_RDNS();
+        return 0;
+    }
+
+    return 1;
+}  // End of Init_RDNS
+
+static void Prefetch(const uint64_t ip[2], uint32_t isV6) {
+    if (rdnsCache.entries == NULL) return;
+    pthread_mutex_lock(&rdnsCache.mutex);
+    RequestEntry(ip, isV6);
+    pthread_mutex_unlock(&rdnsCache.mutex);
+}  // End of Prefetch
+
+void RDNSPrefetchV4(uint32_t ip) {
+    uint64_t key[2] = {0, ip};
+    Prefetch(key, 0);
+}  // End of RDNSPrefetchV4
+
+void RDNSPrefetchV6(const uint64_t ip[2]) {
+    Prefetch(ip, 1);
+}  // End of RDNSPrefetchV6
+
+// copy the name of an address into name - returns 0, if the address has no name
+static int Lookup(const uint64_t ip[2], uint32_t isV6, char *name, size_t len) {
+    if (rdnsCache.entries == NULL || len == 0) return 0;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += RDNSWAIT / 1000;
+    deadline.tv_nsec += (RDNSWAIT % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int found = 0;
+    pthread_mutex_lock(&rdnsCache.mutex);
+    uint32_t index = RequestEntry(ip, isV6);
+    // all entries pending - wait for a resolved entry to be evicted
+    while (index == NOENTRY) {
+        if (pthread_cond_timedwait(&rdnsCache.doneCond, &rdnsCache.mutex, &deadline) == ETIMEDOUT) break;
+        index = RequestEntry(ip, isV6);
+    }
+    if (index != NOENTRY) {
+        rdnsEntry_t *entry = &(rdnsCache.entries[index]);
+        // a pending entry is not evicted - the index remains valid while waiting
+        while (entry->state == RDNS_PENDING) {
+            if (pthread_cond_timedwait(&rdnsCache.doneCond, &rdnsCache.mutex, &deadline) == ETIMEDOUT) break;
+        }
+        if (entry->state == RDNS_DONE && entry->name[0]) {
+            strncpy(name, entry->name, len - 1);
+            name[len - 1] = '\0';
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&rdnsCache.mutex);
+
+    return found;
+}  // End of Lookup
+
+int RDNSLookupV4(uint32_t ip, char *name, size_t len) {
+    uint64_t key[2] = {0, ip};
+    return Lookup(key, 0, name, len);
+}  // End of RDNSLookupV4
+
+int RDNSLookupV6(const uint64_t ip[2], char *name, size_t len) {
+    return Lookup(ip, 1, name, len);
+}  // End of RDNSLookupV6
+
+void Dispose_RDNS(void) {
+    if (rdnsCache.entries == NULL) return;
+
+    pthread_mutex_lock(&rdnsCache.mutex);
+    rdnsCache.done = 1;
+    pthread_cond_broadcast(&rdnsCache.requestCond);
+    pthread_mutex_unlock(&rdnsCache.mutex);
+
+    // resolvers in getnameinfo() finish their current lookup
+    for (uint32_t i = 0; i < rdnsCache.numResolvers; i++) pthread_join(rdnsCache.tid[i], NULL);
+    rdnsCache.numResolvers = 0;
+
+    free(rdnsCache.entries);
+    free(rdnsCache.request);
+    free(rdnsCache.hashTable);
+    rdnsCache.entries = NULL;
+    rdnsCache.request = NULL;
+    rdnsCache.hashTable = NULL;
+}  // End of Dispose_RDNS
@@ -31,16 +31,37 @@
 #include "ssl.h"
 
 #include <errno.h>
+#include <netinet/in.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "metrohash.c"
+#include "nfdump.h"
 #include "stream.h"
 #include "util.h"
 
+// entries of the per thread TLS hello cache - power of 2
+#define SSLCACHESIZE 1024
+
+static _Thread_local sslCacheEntry_t *sslCache = NULL;
+
 // array handling
+#define ARRAYCHUNK 32
+#define ArrayInPool(ssl, a) ((a)->array >= (ssl)->pool && (a)->array < (ssl)->pool + SSLARRAYPOOL)
+
+static void ReserveArray(ssl_t *ssl, uint16Array_t *a, uint32_t capacity);
+
+static inline void NewArray(ssl_t *ssl, uint16Array_t *a, uint32_t capacity);
+
+static inline void AppendArray(ssl_t *ssl, uint16Array_t *a, uint16_t v);
+
+static void FreeArray(ssl_t *ssl, uint16Array_t *a);
+
+static void sslReset(ssl_t *ssl);
 
 static int sslParseExtensions(ssl_t *ssl, BytesStream_t sslStream, uint16_t length);
 
@@ -56,6 +77,63 @@ static int checkGREASE(uint16_t val);
  *              0x8a8a, 0x9a9a, 0xaaaa, 0xbaba,
  *              0xcaca, 0xdada, 0xeaea, 0xfafa};
  */
+// make room for capacity elements. The last array of the pool grows in place,
+// otherwise the elements move to a new chunk of the pool or to the heap
+static void ReserveArray(ssl_t *ssl, uint16Array_t *a, uint32_t capacity) {
+    if (capacity <= a->capacity) return;
+
+    if (a->array && a->array + a->capacity == ssl->pool + ssl->poolUsed && (ssl->poolUsed + capacity - a->capacity) <= SSLARRAYPOOL) {
+        ssl->poolUsed += capacity - a->capacity;
+        a->capacity = capacity;
+        return;
+    }
+
+    uint16_t *array;
+    if ((ssl->poolUsed + capacity) <= SSLARRAYPOOL) {
+        array = ssl->pool + ssl->poolUsed;
+        ssl->poolUsed += capacity;
+    } else {
+        array = (uint16_t *)malloc(sizeof(uint16_t) * capacity);
+        if (!array) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+    if (a->numElements) memcpy(array, a->array, sizeof(uint16_t) * a->numElements);
+    if (a->array && !ArrayInPool(ssl, a)) free(a->array);
+    a->array = array;
+    a->capacity = capacity;
+
+}  // End of ReserveArray
+
+static inline void NewArray(ssl_t *ssl, uint16Array_t *a, uint32_t capacity) {
+    FreeArray(ssl, a);
+    ReserveArray(ssl, a, capacity);
+}  // End of NewArray
+
+static inline void AppendArray(ssl_t *ssl, uint16Array_t *a, uint16_t v) {
+    if (a->numElements == a->capacity) ReserveArray(ssl, a, a->capacity ? 2 * a->capacity : ARRAYCHUNK);
+    a->array[a->numElements++] = v;
+}  // End of AppendArray
+
+static void FreeArray(ssl_t *ssl, uint16Array_t *a) {
+    if (a->array && !ArrayInPool(ssl, a)) free(a->array);
+    a->numElements = 0;
+    a->capacity = 0;
+    a->array = NULL;
+}  // End of FreeArray
+
+// release the heap arrays and clear the record for the next hello
+static void sslReset(ssl_t *ssl) {
+    FreeArray(ssl, &ssl->cipherSuites);
+    FreeArray(ssl, &ssl->extensions);
+    FreeArray(ssl, &ssl->ellipticCurves);
+    FreeArray(ssl, &ssl->ellipticCurvesPF);
+    FreeArray(ssl, &ssl->signatures);
+    memset((void *)ssl, 0, offsetof(ssl_t, pool));
+
+}  // End of sslReset
+
 static int checkGREASE(uint16_t val) {
     if ((val & 0x0f0f) != 0x0a0a) {
         return 0;
@@ -106,7 +184,7 @@ static int ProcessExtElCurves(ssl_t *ssl, BytesStream_t *sslStream) {
     for (int i = 0; i < (ecsLen >> 1); i++) {
         uint16_t curve;
         ByteStream_GET_u16(*sslStream, curve);
-        AppendArray(ssl->ellipticCurves, curve);
+        AppendArray(ssl, &ssl->ellipticCurves, curve);
         dbg_printf("Found curve: 0x%x\n", curve);
     }
     return 1;
@@ -124,7 +202,7 @@ static int ProcessSignatures(ssl_t *ssl, BytesStream_t *sslStream) {
     for (int i = 0; i < sigLen >> 1; i++) {
         uint16_t signature;
         ByteStream_GET_u16(*sslStream, signature);
-        AppendArray(ssl->signatures, signature);
+        AppendArray(ssl, &ssl->signatures, signature);
         dbg_printf("Found signature: 0x%x\n", signature);
     }
     return 1;
@@ -142,7 +220,7 @@ static int ProcessExtElCurvesPoints(ssl_t *ssl, BytesStream_t *sslStream) {
     for (int i = 0; i < ecspLen; i++) {
         uint8_t curvePF;
         ByteStream_GET_u8(*sslStream, curvePF);
-        AppendArray(ssl->ellipticCurvesPF, curvePF);
+        AppendArray(ssl, &ssl->ellipticCurvesPF, curvePF);
         dbg_printf("Found curvePF: 0x%x\n", curvePF);
     }
     return 1;
@@ -186,9 +264,10 @@ static int sslParseExtensions(ssl_t *ssl, BytesStream_t sslStream, uint16_t leng
     }
 
     int extensionLength = length;
-    NewArray(ssl->extensions);
-    NewArray(ssl->ellipticCurves);
-    NewArray(ssl->ellipticCurvesPF);
+    NewArray(ssl, &ssl->extensions, ARRAYCHUNK);
+    NewArray(ssl, &ssl->ellipticCurves, 0);
+    NewArray(ssl, &ssl->ellipticCurvesPF, 0);
+    NewArray(ssl, &ssl->signatures, 0);
     while (extensionLength >= 4) {
         uint16_t exType, exLength;
         ByteStream_GET_u16(sslStream, exType);
@@ -206,7 +285,7 @@ static int sslParseExtensions(ssl_t *ssl, BytesStream_t sslStream, uint16_t leng
             return 0;
         }
 
-        AppendArray(ssl->extensions, exType);
+        AppendArray(ssl, &ssl->extensions, exType);
         int ret = 1;
         switch (exType) {
             case 0:  // sni name
@@ -311,13 +390,13 @@ static int sslParseClientHandshake(ssl_t *ssl, BytesStream_t sslStream, uint32_t
         return 0;
     }
 
-    NewArray(ssl->cipherSuites);
+    NewArray(ssl, &ssl->cipherSuites, numCiphers);
     for (int i = 0; i < numCiphers; i++) {
         uint16_t cipher;
         ByteStream_GET_u16(sslStream, cipher);  // get next cipher
 
         if (checkGREASE(cipher) == 0) {
-            AppendArray(ssl->cipherSuites, cipher);
+            AppendArray(ssl, &ssl->cipherSuites, cipher);
         }
     }
 
@@ -386,8 +465,8 @@ static int sslParseServerHandshake(ssl_t *ssl, BytesStream_t sslStream, uint32_t
     uint16_t cipherSuite;
     ByteStream_GET_u16(sslStream, cipherSuite);  // Cipher suite
 
-    NewArray(ssl->cipherSuites);
-    AppendArray(ssl->cipherSuites, cipherSuite);
+    NewArray(ssl, &ssl->cipherSuites, 1);
+    AppendArray(ssl, &ssl->cipherSuites, cipherSuite);
 
     // skip compression
     ByteStream_SKIP(sslStream, 1);
@@ -397,7 +476,7 @@ static int sslParseServerHandshake(ssl_t *ssl, BytesStream_t sslStream, uint32_t
 
     if (ByteStream_AVAILABLE(sslStream) < extensionLength) return 0;
 
-    NewArray(ssl->extensions);
+    NewArray(ssl, &ssl->extensions, ARRAYCHUNK);
 
     int sizeLeft = extensionLength;
     while (sizeLeft >= 4) {
@@ -412,7 +491,7 @@ static int sslParseServerHandshake(ssl_t *ssl, BytesStream_t sslStream, uint32_t
         }
 
         dbg_printf("Found extension type: %u, len: %u\n", exType, exLength);
-        AppendArray(ssl->extensions, exType);
+        AppendArray(ssl, &ssl->extensions, exType);
         if (exLength) ByteStream_SKIP(sslStream, exLength);
     }
     dbg_printf("End extension. size: %d\n", sizeLeft);
@@ -466,17 +545,16 @@ void sslPrint(ssl_t *ssl) {
 }  // End of sslPrint
 
 void sslFree(ssl_t *ssl) {
-    FreeArray(ssl->cipherSuites);
-    FreeArray(ssl->extensions);
-    FreeArray(ssl->ellipticCurves);
-    FreeArray(ssl->ellipticCurvesPF);
-
+    sslReset(ssl);
     free(ssl);
 
 }  // End of sslFree
 
-ssl_t *sslProcess(const uint8_t *data, size_t len) {
-    dbg_printf("\nsslProcess new packet. size: %zu\n", len);
+// parse the TLS hello of data into the caller provided ssl record, which is reset first.
+// Returns 1, if a client or server hello was parsed
+int sslParse(ssl_t *ssl, const uint8_t *data, size_t len) {
+    dbg_printf("\nsslParse new packet. size: %zu\n", len);
+    sslReset(ssl);
     // Check for ssl record
     // - TLS header length (5)
     // - message type/length (4)
@@ -507,7 +585,7 @@ ssl_t *sslProcess(const uint8_t *data, size_t len) {
     // - and handshake content type (22)
     if (len < 9 || data[0] != 0x16) {
         dbg_printf("Not a TLS handshake record: 0x%x\n", data[0]);
-        return NULL;
+        return 0;
     }
 
     ByteStream_INIT(sslStream, data, len);
@@ -524,7 +602,7 @@ ssl_t *sslProcess(const uint8_t *data, size_t len) {
             break;
         default:
             dbg_printf("SSL version: 0x%x not SSL 3.0 - TLS 1.3 connection\n", sslVersion);
-            return NULL;
+            return 0;
     }
 
     uint16_t contentLength;
@@ -532,7 +610,7 @@ ssl_t *sslProcess(const uint8_t *data, size_t len) {
 
     if (contentLength > ByteStream_AVAILABLE(sslStream)) {
         dbg_printf("Short ssl packet -  have: %zu, need contentLength: %u\n", len, contentLength);
-        return NULL;
+        return 0;
     }
 
     uint8_t messageType;
@@ -543,14 +621,9 @@ ssl_t *sslProcess(const uint8_t *data, size_t len) {
     dbg_printf("Message type: %u, length: %u\n", messageType, messageLength);
     if (messageLength > ByteStream_AVAILABLE(sslStream)) {
         dbg_printf("Message length error: %u > %zu\n", messageLength, len);
-        return NULL;
+        return 0;
     }
 
-    ssl_t *ssl = (ssl_t *)calloc(1, sizeof(ssl_t));
-    if (!ssl) {
-        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
-        return NULL;
-    }
     ssl->tlsVersion = sslVersion;
 
     int ok = 0;
@@ -575,22 +648,117 @@ ssl_t *sslProcess(const uint8_t *data, size_t len) {
             break;
         default:
             dbg_printf("ssl process: Message type not ClientHello or ServerHello: %u\n", messageType);
-            sslFree(ssl);
-            return NULL;
+            return 0;
     }
 
-    if (!ok) {
-        sslFree(ssl);
+    dbg_printf("ssl process message: %u, Length: %u\n", messageType, messageLength);
+    // sslPrint(ssl);
+
+    return ok;
+
+}  // End of sslParse
+
+ssl_t *sslProcess(const uint8_t *data, size_t len) {
+    // - and handshake content type (22)
+    if (len < 9 || data[0] != 0x16) return NULL;
+
+    ssl_t *ssl = (ssl_t *)calloc(1, sizeof(ssl_t));
+    if (!ssl) {
+        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
         return NULL;
     }
 
-    dbg_printf("ssl process message: %u, Length: %u\n", messageType, messageLength);
-    // sslPrint(ssl);
+    if (!sslParse(ssl, data, len)) {
+        sslFree(ssl);
+        return NULL;
+    }
 
     return ssl;
 
 }  // End of sslProcess
 
+// return the cache entry of the payload. Returns NULL, if the payload is not cached
+static sslCacheEntry_t *SSLCacheLookup(const uint8_t *payload, uint32_t length, uint64_t hash) {
+    if (sslCache == NULL) return NULL;
+    sslCacheEntry_t *entry = &sslCache[hash & (SSLCACHESIZE - 1)];
+    if (entry->hash == hash && entry->length == length && memcmp(entry->payload, payload, length) == 0) return entry;
+    return NULL;
+
+}  // End of SSLCacheLookup
+
+// parse the payload into the cache. Returns NULL, if the cache is not available
+static sslCacheEntry_t *SSLCacheInsert(const uint8_t *payload, uint32_t length, uint64_t hash) {
+    if (sslCache == NULL) {
+        sslCache = calloc(SSLCACHESIZE, sizeof(sslCacheEntry_t));
+        if (sslCache == NULL) return NULL;
+    }
+
+    // replace the entry in this slot
+    sslCacheEntry_t *entry = &sslCache[hash & (SSLCACHESIZE - 1)];
+    if (entry->ja3) free(entry->ja3);
+    if (entry->ja4) free(entry->ja4);
+    entry->ssl = entry->ja3 = entry->ja4 = NULL;
+    entry->length = 0;
+    entry->derived = 0;
+
+    if (length > entry->size) {
+        uint8_t *p = realloc(entry->payload, length);
+        if (p == NULL) return NULL;
+        entry->payload = p;
+        entry->size = length;
+    }
+    memcpy(entry->payload, payload, length);
+    if (entry->sslBuff == NULL) {
+        entry->sslBuff = calloc(1, sizeof(ssl_t));
+        if (entry->sslBuff == NULL) return NULL;
+    }
+
+    entry->hash = hash;
+    entry->length = length;
+    // the hello is parsed into the buffer of the entry - no allocation per payload
+    if (sslParse(entry->sslBuff, payload, length)) entry->ssl = entry->sslBuff;
+    return entry;
+
+}  // End of SSLCacheInsert
+
+// the cache entry of the TLS hello of the record, if the hello was cached by GetRecordSSL()
+sslCacheEntry_t *GetRecordSSLEntry(recordHandle_t *handle) {
+    if ((handle->derived & CACHED_SSL) == 0) return NULL;
+
+    const uint8_t *payload = (const uint8_t *)handle->extensionList[EXinPayloadID];
+    uint32_t length = ExtensionLength(payload);
+    sslCacheEntry_t *entry = SSLCacheLookup(payload, length, metrohash64_1(payload, length, 0));
+    return entry && entry->ssl == handle->extensionList[SSLindex] ? entry : NULL;
+
+}  // End of GetRecordSSLEntry
+
+// parse the TLS hello of the payload once per record - identical payloads are parsed once per thread
+ssl_t *GetRecordSSL(recordHandle_t *handle) {
+    if (handle->extensionList[SSLindex] || (handle->derived & DERIVED_SSL)) return handle->extensionList[SSLindex];
+    handle->derived |= DERIVED_SSL;
+
+    const uint8_t *payload = (const uint8_t *)handle->extensionList[EXinPayloadID];
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)handle->extensionList[EXgenericFlowID];
+    if (payload == NULL || genericFlow == NULL || genericFlow->proto != IPPROTO_TCP) return NULL;
+
+    uint32_t length = ExtensionLength(payload);
+    uint64_t hash = metrohash64_1(payload, length, 0);
+    sslCacheEntry_t *entry = SSLCacheLookup(payload, length, hash);
+    if (entry == NULL) entry = SSLCacheInsert(payload, length, hash);
+    if (entry == NULL) {
+        // no cache - the record owns the ssl
+        handle->extensionList[SSLindex] = sslProcess(payload, length);
+        return handle->extensionList[SSLindex];
+    }
+
+    if (entry->ssl) {
+        handle->extensionList[SSLindex] = entry->ssl;
+        handle->derived |= CACHED_SSL;
+    }
+    return entry->ssl;
+
+}  // End of GetRecordSSL
+
 #ifdef MAIN
 void sslTest(void) {
     const uint8_t clientHello2[] = {
@@ -36,34 +36,10 @@
 
 typedef struct uint16Array_s {
     uint32_t numElements;
-    uint16_t *array;
+    uint32_t capacity;
+    uint16_t *array;  // points into the pool of the ssl record or to the heap
 } uint16Array_t;
 
-#define arrayMask 0x1F
-
-#define NewArray(a)          \
-    {                        \
-        (a).numElements = 0; \
-        (a).array = NULL;    \
-    }
-
-#define AppendArray(a, v)                                                                                   \
-    if (((a).numElements & arrayMask) == 0) {                                                               \
-        (a).array = (uint16_t *)realloc((a).array, sizeof(uint16_t) * ((a).numElements + (arrayMask + 1))); \
-        if (!(a).array) {                                                                                   \
-            fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));     \
-            exit(255);                                                                                      \
-        }                                                                                                   \
-    }                                                                                                       \
-    (a).array[a.numElements++] = (v);
-
-#define FreeArray(a)                    \
-    if ((a).numElements && (a).array) { \
-        free((a).array);                \
-        (a).numElements = 0;            \
-        (a).array = NULL;               \
-    }
-
 #define LenArray(a) (a).numElements
 
 #define ArrayElement(a, n) (a).array[n]
@@ -100,16 +76,45 @@ typedef struct ssl_s {
     char sniName[256];
 #define OFFsslSNI offsetof(ssl_t, sniName)
 #define SIZEsslSNI MemberSize(ssl_t, sniName)
+
+    // the arrays take their elements from this pool. Only hellos with more
+    // elements allocate memory. The pool is reset with each parsed hello
+#define SSLARRAYPOOL 512
+    uint32_t poolUsed;
+    uint16_t pool[SSLARRAYPOOL];
 } ssl_t;
 
 void sslPrint(ssl_t *ssl);
 
 void sslFree(ssl_t *ssl);
 
-void sslPrint(ssl_t *ssl);
+int sslParse(ssl_t *ssl, const uint8_t *data, size_t len);
 
 ssl_t *sslProcess(const uint8_t *data, size_t len);
 
+/*
+ * Per thread cache of the TLS hellos of payloads. Identical payloads, such as the client
+ * hellos of the same client stack, are parsed once and their ja3/ja4 fingerprints are
+ * computed once. The cached objects are owned by the cache and stay valid, until the
+ * entry is replaced by the payload of a following record of the same thread.
+ */
+typedef struct sslCacheEntry_s {
+    uint64_t hash;     // metrohash of the payload
+    uint32_t length;   // payload length, 0: unused entry
+    uint32_t derived;  // DERIVED_JA3/DERIVED_JA4: fingerprint computed
+    uint8_t *payload;  // copy of the payload
+    uint32_t size;     // allocated size of payload
+    ssl_t *ssl;        // parsed hello, NULL: no TLS hello
+    ssl_t *sslBuff;    // parse buffer of the entry - reused for each payload
+    void *ja3;
+    void *ja4;
+} sslCacheEntry_t;
+
+struct recordHandle_s;
+ssl_t *GetRecordSSL(struct recordHandle_s *handle);
+
+sslCacheEntry_t *GetRecordSSLEntry(struct recordHandle_s *handle);
+
 void sslTest(void);
 
 #endif
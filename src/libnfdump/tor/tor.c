@@ -32,11 +32,16 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "nfdump.h"
 #include "nffile.h"
 #include "nffileV2.h"
 #include "nfxV3.h"
@@ -45,14 +50,6 @@
 // include after
 #include "kbtree.h"
 
-#define PushArrayHeader(dataBlock, arrayType, arraySize)   \
-    (dataBlock)->type = DATA_BLOCK_TYPE_4;                 \
-    void *p = ((void *)(dataBlock) + sizeof(dataBlock_t)); \
-    recordHeader_t *arrayHeader = (recordHeader_t *)p;     \
-    arrayHeader->type = arrayType;                         \
-    arrayHeader->size = arraySize;                         \
-    (dataBlock)->size += sizeof(recordHeader_t);
-
 static inline int torNodeCMP(torNode_t a, torNode_t b) {
     if (a.ipaddr == b.ipaddr) return 0;
     return a.ipaddr > b.ipaddr ? 1 : -1;
@@ -62,6 +59,65 @@ KBTREE_INIT(torTree, torNode_t, torNodeCMP);
 
 static kbtree_t(torTree) *torTree = NULL;
 
+/*
+ * Tor DB image
+ * ============
+ * The tor DB is a single binary image, which is written as is by torlookup and
+ * mapped by nfdump with mmap(). It contains:
+ * - the sorted array of all node IPs, searched with a binary search.
+ * - a parallel node array with the intervals of each node.
+ * - the interval array. The intervals of a node are sorted by firstSeen. coverEnd is the
+ *   maximum lastSeen + grace time of the interval and all preceding intervals of the node.
+ *   A time t is therefore covered by any interval, if t <= coverEnd of the last interval
+ *   with firstSeen <= t.
+ */
+#define TORIMAGE_MAGIC 0x4954464E  // "NFTI"
+#define TORIMAGE_VERSION 1
+#define TORIMAGE_ALIGN 64
+
+// allow 24h over last seen
+#define TORGRACETIME (24 * 3600)
+
+typedef struct torImageHeader_s {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;  // size of the entire image
+    uint32_t numNodes;
+    uint32_t numIntervals;
+    uint64_t keyOffset;
+    uint64_t nodeOffset;
+    uint64_t intervalOffset;
+} torImageHeader_t;
+
+typedef struct torImageNode_s {
+    int64_t lastPublished;
+    uint32_t interval;  // index of first interval
+    uint16_t numIntervals;
+    uint16_t gaps;
+} torImageNode_t;
+
+typedef struct torImageInterval_s {
+    int64_t firstSeen;
+    int64_t lastSeen;
+    int64_t coverEnd;
+} torImageInterval_t;
+
+typedef struct torDB_s {
+    void *image;
+    size_t imageSize;
+    int mapped;
+    uint32_t numNodes;
+    uint32_t numIntervals;
+    const uint32_t *key;
+    const torImageNode_t *node;
+    const torImageInterval_t *interval;
+} torDB_t;
+
+static torDB_t *torDB = NULL;
+
+// the loaded tor DB file - a resident DB, such as in nfdumpd, is not loaded again
+static struct stat loadedDB = {0};
+
 // returns ok
 int Init_TorLookup(void) {
     torTree = kb_init(torTree, KB_DEFAULT_SIZE);
@@ -76,6 +132,7 @@ static char *tmString(time_t time, char *buff, size_t len) {
     return buff;
 }
 
+#ifdef DEVEL
 static void printTorNode(torNode_t *node) {
     char first[64], last[64], published[64];
     char ip[32];
@@ -87,6 +144,7 @@ static void printTorNode(torNode_t *node) {
                tmString(node->interval[i].lastSeen, last, sizeof(last)));
     }
 }
+#endif
 
 /*
 
@@ -173,44 +231,156 @@ void UpdateTorNode(torNode_t *torNode) {
     }
 }
 
-int SaveTorTree(char *fileName) {
-    nffile_t *nffile = OpenNewFile(fileName, NULL, CREATOR_TORLOOKUP, LZ4_COMPRESSED, NOT_ENCRYPTED);
-
-    // get new empty data block
-    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
+static inline size_t AlignImage(size_t offset) { return (offset + TORIMAGE_ALIGN - 1) & ~(size_t)(TORIMAGE_ALIGN - 1); }
 
-    // push array header
-    PushArrayHeader(dataBlock, TorTreeElementID, sizeof(torNode_t));
-    void *outBuff = GetCurrentCursor(dataBlock);
+// build the tor DB image from the tree
+static void *BuildTorImage(size_t *imageSize) {
+    uint32_t numNodes = kb_size(torTree);
 
+    // count the valid intervals of all nodes
+    uint32_t numIntervals = 0;
     kbitr_t itr;
-    kb_itr_first(torTree, torTree, &itr);                              // get an iterator pointing to the first
-    for (; kb_itr_valid(&itr); kb_itr_next(torTree, torTree, &itr)) {  // move on
+    kb_itr_first(torTree, torTree, &itr);
+    for (; kb_itr_valid(&itr); kb_itr_next(torTree, torTree, &itr)) {
+        torNode_t *torNode = &kb_itr_key(torNode_t, &itr);
+        numIntervals += torNode->gaps < MAXINTERVALS ? torNode->gaps + 1 : MAXINTERVALS;
+    }
+
+    torImageHeader_t header = {.magic = TORIMAGE_MAGIC, .version = TORIMAGE_VERSION, .numNodes = numNodes, .numIntervals = numIntervals};
+    header.keyOffset = AlignImage(sizeof(torImageHeader_t));
+    header.nodeOffset = AlignImage(header.keyOffset + (size_t)numNodes * sizeof(uint32_t));
+    header.intervalOffset = AlignImage(header.nodeOffset + (size_t)numNodes * sizeof(torImageNode_t));
+    header.size = AlignImage(header.intervalOffset + (size_t)numIntervals * sizeof(torImageInterval_t));
+
+    void *image = calloc(1, header.size);
+    if (!image) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    memcpy(image, &header, sizeof(torImageHeader_t));
+    uint32_t *key = (uint32_t *)(image + header.keyOffset);
+    torImageNode_t *node = (torImageNode_t *)(image + header.nodeOffset);
+    torImageInterval_t *interval = (torImageInterval_t *)(image + header.intervalOffset);
+
+    // the tree is sorted by IP
+    uint32_t cnt = 0;
+    uint32_t intervalCnt = 0;
+    kb_itr_first(torTree, torTree, &itr);
+    for (; kb_itr_valid(&itr); kb_itr_next(torTree, torTree, &itr)) {
         torNode_t *torNode = &kb_itr_key(torNode_t, &itr);
         dbg_printf("ip: %u, first: %ld, last: %ld\n", torNode->ipaddr, torNode->interval[0].firstSeen, torNode->interval[0].lastSeen);
-        if (!IsAvailable(dataBlock, sizeof(torNode_t))) {
-            // flush block - get an empty one
-            dataBlock = WriteBlock(nffile, dataBlock);
+        key[cnt] = torNode->ipaddr;
+        node[cnt].lastPublished = torNode->lastPublished;
+        node[cnt].gaps = torNode->gaps;
+        node[cnt].interval = intervalCnt;
+
+        // the interval ring buffer is filled up to intervalIndex, until it wraps
+        int num = torNode->gaps < MAXINTERVALS ? torNode->gaps + 1 : MAXINTERVALS;
+        torImageInterval_t *nodeInterval = &interval[intervalCnt];
+        for (int i = 0; i < num; i++) {
+            // insertion sort by firstSeen
+            torImageInterval_t next = {.firstSeen = torNode->interval[i].firstSeen, .lastSeen = torNode->interval[i].lastSeen};
+            int j = i;
+            while (j > 0 && nodeInterval[j - 1].firstSeen > next.firstSeen) {
+                nodeInterval[j] = nodeInterval[j - 1];
+                j--;
+            }
+            nodeInterval[j] = next;
+        }
+        int64_t coverEnd = INT64_MIN;
+        for (int i = 0; i < num; i++) {
+            int64_t end = nodeInterval[i].lastSeen + TORGRACETIME;
+            if (end > coverEnd) coverEnd = end;
+            nodeInterval[i].coverEnd = coverEnd;
+        }
+        node[cnt].numIntervals = num;
+        intervalCnt += num;
+        cnt++;
+    }
+
+    *imageSize = header.size;
+    return image;
+
+}  // End of BuildTorImage
 
-            PushArrayHeader(dataBlock, TorTreeElementID, sizeof(torNode_t));
-            outBuff = GetCurrentCursor(dataBlock);
+// validate the image and set up the lookup arrays
+static int SetTorImage(void *image, size_t imageSize, int mapped) {
+    torImageHeader_t *header = (torImageHeader_t *)image;
+    if (imageSize < sizeof(torImageHeader_t) || header->magic != TORIMAGE_MAGIC || header->version != TORIMAGE_VERSION ||
+        header->size != imageSize || header->keyOffset > imageSize || header->nodeOffset > imageSize || header->intervalOffset > imageSize ||
+        ((uint64_t)header->numNodes * sizeof(uint32_t)) > (imageSize - header->keyOffset) ||
+        ((uint64_t)header->numNodes * sizeof(torImageNode_t)) > (imageSize - header->nodeOffset) ||
+        ((uint64_t)header->numIntervals * sizeof(torImageInterval_t)) > (imageSize - header->intervalOffset)) {
+        LogError("Invalid tor DB image - rebuild nfdump tor DB");
+        return 0;
+    }
+
+    const torImageNode_t *node = (const torImageNode_t *)(image + header->nodeOffset);
+    for (uint32_t i = 0; i < header->numNodes; i++) {
+        if (((uint64_t)node[i].interval + node[i].numIntervals) > header->numIntervals) {
+            LogError("Corrupt node in tor DB - rebuild nfdump tor DB");
+            return 0;
         }
+    }
 
-        memcpy(outBuff, torNode, sizeof(torNode_t));
-        outBuff += sizeof(torNode_t);
-        dataBlock->size += sizeof(torNode_t);
-        dataBlock->NumRecords++;
+    torDB_t *db = calloc(1, sizeof(torDB_t));
+    if (!db) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
     }
-    // flush current datablock
-    FlushBlock(nffile, dataBlock);
+    db->image = image;
+    db->imageSize = imageSize;
+    db->mapped = mapped;
+    db->numNodes = header->numNodes;
+    db->numIntervals = header->numIntervals;
+    db->key = (const uint32_t *)(image + header->keyOffset);
+    db->node = node;
+    db->interval = (const torImageInterval_t *)(image + header->intervalOffset);
+    torDB = db;
 
-    return CloseUpdateFile(nffile);
+    return 1;
 
-}  // End of SaveTorTree
+}  // End of SetTorImage
 
-int LoadTorTree(char *fileName) {
-    dbg_printf("Load TorNode DB file %s\n", fileName);
+int SaveTorTree(char *fileName) {
+    size_t imageSize = 0;
+    void *image = BuildTorImage(&imageSize);
+    if (!image) return 0;
+
+    int fd = open(fileName, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        LogError("open() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(image);
+        return 0;
+    }
+
+    void *p = image;
+    size_t remaining = imageSize;
+    while (remaining) {
+        ssize_t ret = write(fd, p, remaining);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            close(fd);
+            free(image);
+            return 0;
+        }
+        p += ret;
+        remaining -= ret;
+    }
+    free(image);
+
+    if (close(fd) < 0) {
+        LogError("close() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    return 1;
+
+}  // End of SaveTorTree
 
+// load a tor DB in nffile format and build the image in memory
+static int LoadLegacyTorTree(char *fileName) {
     Init_TorLookup();
     nffile_t *nffile = OpenFile(fileName, NULL);
     if (!nffile) {
@@ -261,32 +431,118 @@ int LoadTorTree(char *fileName) {
     FreeDataBlock(dataBlock);
     DisposeFile(nffile);
 
+    size_t imageSize = 0;
+    void *image = BuildTorImage(&imageSize);
+    kb_destroy(torTree, torTree);
+    torTree = NULL;
+    if (!image) return 0;
+
+    if (!SetTorImage(image, imageSize, 0)) {
+        free(image);
+        return 0;
+    }
+
     return 1;
+
+}  // End of LoadLegacyTorTree
+
+int LoadTorTree(char *fileName) {
+    dbg_printf("Load TorNode DB file %s\n", fileName);
+
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        LogError("open() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    struct stat stat_buf;
+    uint32_t magic = 0;
+    if (fstat(fd, &stat_buf) < 0 || read(fd, &magic, sizeof(magic)) != sizeof(magic)) {
+        LogError("Failed to read tor DB %s: %s", fileName, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    if (loadedDB.st_ino == stat_buf.st_ino && loadedDB.st_dev == stat_buf.st_dev && loadedDB.st_size == stat_buf.st_size &&
+        loadedDB.st_mtime == stat_buf.st_mtime) {
+        dbg_printf("TorNode DB file %s already loaded\n", fileName);
+        close(fd);
+        return 1;
+    }
+
+    if (magic != TORIMAGE_MAGIC) {
+        // tor DB in nffile format of older versions
+        close(fd);
+        if (!LoadLegacyTorTree(fileName)) return 0;
+        loadedDB = stat_buf;
+        return 1;
+    }
+
+    void *image = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        LogError("mmap() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    if (!SetTorImage(image, stat_buf.st_size, 1)) {
+        munmap(image, stat_buf.st_size);
+        return 0;
+    }
+    loadedDB = stat_buf;
+
+    return 1;
+
 }  // End of LoadTorTree
 
+// return node index of ip or -1
+static inline int64_t SearchTorNode(uint32_t ip) {
+    uint32_t lo = 0;
+    uint32_t hi = torDB->numNodes;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        if (torDB->key[mid] < ip)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < torDB->numNodes && torDB->key[lo] == ip) ? (int64_t)lo : -1;
+
+}  // End of SearchTorNode
+
+// return 1, if t is covered by any interval of node
+static inline int TorNodeActive(const torImageNode_t *node, int64_t t) {
+    const torImageInterval_t *interval = &torDB->interval[node->interval];
+    // find last interval with firstSeen <= t
+    int lo = 0;
+    int hi = node->numIntervals;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (interval[mid].firstSeen <= t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 && t <= interval[lo - 1].coverEnd;
+
+}  // End of TorNodeActive
+
 // return 1 - if IP is tor exit node
 // input nfdump IP addr, first/last in msec
 int LookupV4Tor(uint32_t ip, uint64_t first, uint64_t last, char *torInfo) {
-    if (!torTree) {
+    if (!torDB) {
         torInfo[0] = '\0';
         return 0;
     }
 
-    torNode_t searchNode = {.ipaddr = ip};
-    torNode_t *torNode = kb_getp(torTree, torTree, &searchNode);
-    if (torNode) {
-        first /= 1000;
-        last /= 1000;
-        for (int i = 0; i <= torNode->intervalIndex; i++) {
-            // allow 24h over last seen
-            time_t graceLastSeen = torNode->interval[i].lastSeen + 24 * 3600;
-            if ((first >= torNode->interval[i].firstSeen && first <= graceLastSeen) ||
-                (last >= torNode->interval[i].firstSeen && last <= graceLastSeen)) {
-                torInfo[0] = 'E';
-                torInfo[1] = 'X';
-                torInfo[2] = '\0';
-                return 1;
-            }
+    int64_t index = SearchTorNode(ip);
+    if (index >= 0) {
+        const torImageNode_t *node = &torDB->node[index];
+        if (TorNodeActive(node, first / 1000) || TorNodeActive(node, last / 1000)) {
+            torInfo[0] = 'E';
+            torInfo[1] = 'X';
+            torInfo[2] = '\0';
+            return 1;
         }
         torInfo[0] = 'e';
         torInfo[1] = 'x';
@@ -304,7 +560,7 @@ int LookupV4Tor(uint32_t ip, uint64_t first, uint64_t last, char *torInfo) {
 }  // End of LookupTor
 
 int LookupV6Tor(uint64_t ip[2], uint64_t first, uint64_t last, char *torInfo) {
-    if (!torTree) {
+    if (!torDB) {
         torInfo[0] = '\0';
         return 0;
     }
@@ -318,8 +574,30 @@ int LookupV6Tor(uint64_t ip[2], uint64_t first, uint64_t last, char *torInfo) {
 
 }  // End of LookupTor
 
+// lookup src or dst address of the record once - returns 1 if IP is tor exit node
+int GetRecordTor(recordHandle_t *handle, int dst, char **torInfo) {
+    uint32_t flag = dst ? DERIVED_DSTTOR : DERIVED_SRCTOR;
+    char *info = handle->torInfo[dst ? 1 : 0];
+    if ((handle->derived & flag) == 0) {
+        handle->derived |= flag;
+        EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)handle->extensionList[EXgenericFlowID];
+        EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)handle->extensionList[EXipv4FlowID];
+        EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)handle->extensionList[EXipv6FlowID];
+        info[0] = '\0';
+        if (genericFlow && ipv4Flow) {
+            LookupV4Tor(dst ? ipv4Flow->dstAddr : ipv4Flow->srcAddr, genericFlow->msecFirst, genericFlow->msecLast, info);
+        } else if (genericFlow && ipv6Flow) {
+            LookupV6Tor(dst ? ipv6Flow->dstAddr : ipv6Flow->srcAddr, genericFlow->msecFirst, genericFlow->msecLast, info);
+        }
+    }
+    if (torInfo) *torInfo = info;
+
+    return info[0] == 'E' || info[0] == 'e';
+
+}  // End of GetRecordTor
+
 void LookupIP(char *ipstring) {
-    if (!torTree) {
+    if (!torDB) {
         printf("No torDB available");
         return;
     }
@@ -327,10 +605,17 @@ void LookupIP(char *ipstring) {
     uint32_t ip;
     int ret = inet_pton(PF_INET, ipstring, &ip);
     if (ret != 1) return;
-    torNode_t searchNode = {.ipaddr = ntohl(ip)};
-    torNode_t *torNode = kb_getp(torTree, torTree, &searchNode);
-    if (torNode) {
-        printTorNode(torNode);
+    int64_t index = SearchTorNode(ntohl(ip));
+    if (index >= 0) {
+        const torImageNode_t *node = &torDB->node[index];
+        const torImageInterval_t *interval = &torDB->interval[node->interval];
+        char first[64], last[64], published[64];
+        printf("Node: %s, last published: %s, intervals: %d\n", ipstring, tmString(node->lastPublished, published, sizeof(published)),
+               node->gaps + 1);
+        for (int i = 0; i < node->numIntervals; i++) {
+            printf(" %d first: %s, last: %s\n", i, tmString(interval[i].firstSeen, first, sizeof(first)),
+                   tmString(interval[i].lastSeen, last, sizeof(last)));
+        }
     } else {
         printf("No tor exit node: %s\n", ipstring);
     }
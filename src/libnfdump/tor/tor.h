@@ -65,6 +65,9 @@ int LookupV4Tor(uint32_t ip, uint64_t first, uint64_t last, char *torInfo);
 
 int LookupV6Tor(uint64_t ip[2], uint64_t first, uint64_t last, char *torInfo);
 
+struct recordHandle_s;
+int GetRecordTor(struct recordHandle_s *handle, int dst, char **torInfo);
+
 void LookupIP(char *ipstring);
 
 #endif
\ No newline at end of file
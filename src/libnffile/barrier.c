@@ -28,10 +28,15 @@
  *
  */
 
+// pthread_setaffinity_np() needs _GNU_SOURCE on Linux
+#define _GNU_SOURCE
+
 #include "barrier.h"
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -42,10 +47,164 @@
 #include <unistd.h>
 
 #include "barrier.h"
+#include "config.h"
 #include "nfconf.h"
 #include "nfdump.h"
 #include "util.h"
 
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#define MAXAFFINITYCPUS 1024
+
+// cpus usable for workers, ordered node by node
+static struct {
+    int mode;
+    int numCPUs;
+    int homeNode;
+    uint32_t numHomeCPUs;
+    _Atomic uint32_t nextCPU;
+    int cpu[MAXAFFINITYCPUS];
+    int node[MAXAFFINITYCPUS];
+} affinity;
+
+static pthread_once_t affinityOnce = PTHREAD_ONCE_INIT;
+#endif
+
+// node of the pinned thread
+static __thread int threadNode = 0;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+// parse a sysfs cpu list such as 0-7,16-23 into cpuset
+static void ParseCPUList(char *list, cpu_set_t *cpuset) {
+    CPU_ZERO(cpuset);
+    char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p) break;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, cpuset);
+        if (*p != ',') break;
+        p++;
+    }
+}  // End of ParseCPUList
+
+// read the cpus of a NUMA node. returns 0, if the node does not exist
+static int NodeCPUs(int node, cpu_set_t *cpuset) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    char list[1024];
+    int ok = fgets(list, sizeof(list), fp) != NULL;
+    fclose(fp);
+    if (ok) ParseCPUList(list, cpuset);
+    return ok;
+}  // End of NodeCPUs
+
+static void AddNodeCPUs(int node, cpu_set_t *nodeSet, cpu_set_t *allowed) {
+    for (int cpu = 0; cpu < CPU_SETSIZE && affinity.numCPUs < MAXAFFINITYCPUS; cpu++) {
+        if (CPU_ISSET(cpu, nodeSet) && CPU_ISSET(cpu, allowed)) {
+            affinity.cpu[affinity.numCPUs] = cpu;
+            affinity.node[affinity.numCPUs] = node;
+            affinity.numCPUs++;
+            CPU_CLR(cpu, allowed);
+        }
+    }
+}  // End of AddNodeCPUs
+
+static void InitAffinity(void) {
+    affinity.mode = ConfGetValue("affinity");
+    if (affinity.mode <= 0) return;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        LogError("sched_getaffinity() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        affinity.mode = 0;
+        return;
+    }
+
+    // the node of the main thread comes first
+    int homeCPU = sched_getcpu();
+    cpu_set_t nodeSet;
+    for (int node = 0; node < MAXNUMANODES && NodeCPUs(node, &nodeSet); node++) {
+        if (homeCPU >= 0 && CPU_ISSET(homeCPU, &nodeSet)) affinity.homeNode = node;
+    }
+    if (NodeCPUs(affinity.homeNode, &nodeSet)) AddNodeCPUs(affinity.homeNode, &nodeSet, &allowed);
+    affinity.numHomeCPUs = affinity.numCPUs;
+
+    if (affinity.mode == 1) {
+        for (int node = 0; node < MAXNUMANODES && NodeCPUs(node, &nodeSet); node++) AddNodeCPUs(node, &nodeSet, &allowed);
+    }
+
+    // no NUMA information - all cpus are on the home node
+    if (affinity.numCPUs == 0) {
+        CPU_ZERO(&nodeSet);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &nodeSet);
+        AddNodeCPUs(0, &nodeSet, &allowed);
+        affinity.numHomeCPUs = affinity.numCPUs;
+    }
+
+    if (affinity.numCPUs == 0) {
+        affinity.mode = 0;
+        return;
+    }
+    threadNode = affinity.homeNode;
+    LogVerbose("Thread affinity: mode %d, %d cpus, home node %d with %u cpus", affinity.mode, affinity.numCPUs, affinity.homeNode,
+               affinity.numHomeCPUs);
+
+}  // End of InitAffinity
+#endif
+
+// pin the calling worker thread to the next cpu
+void PinWorker(void) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    pthread_once(&affinityOnce, InitAffinity);
+    if (affinity.mode <= 0) return;
+
+    uint32_t slot = atomic_fetch_add(&affinity.nextCPU, 1) % affinity.numCPUs;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(affinity.cpu[slot], &cpuset);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (err) {
+        LogError("pthread_setaffinity_np() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        return;
+    }
+    threadNode = affinity.node[slot];
+#endif
+}  // End of PinWorker
+
+// pin the calling thread to the cpus of the home node
+void PinNode(void) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    pthread_once(&affinityOnce, InitAffinity);
+    if (affinity.mode <= 0) return;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (uint32_t i = 0; i < affinity.numHomeCPUs; i++) CPU_SET(affinity.cpu[i], &cpuset);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (err) {
+        LogError("pthread_setaffinity_np() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        return;
+    }
+    threadNode = affinity.homeNode;
+#endif
+}  // End of PinNode
+
+// NUMA node of the calling thread. 0 for threads not pinned
+int ThreadNode(void) {
+    return threadNode % MAXNUMANODES;
+}  // End of ThreadNode
+
 // get decent number of workers depending
 // on the number of cores online
 uint32_t GetNumWorkers(uint32_t requested) {
@@ -59,6 +218,12 @@ uint32_t GetNumWorkers(uint32_t requested) {
         CoresOnline = 1;
     }
 
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    // workers stay on the cpus of the home node
+    pthread_once(&affinityOnce, InitAffinity);
+    if (affinity.mode == 2 && affinity.numHomeCPUs < CoresOnline) CoresOnline = affinity.numHomeCPUs;
+#endif
+
     // no more than cores online
     if (requested && (requested > CoresOnline)) {
         LogError("Number of workers should not be greater than number of cores online. %d is > %d", requested, CoresOnline);
@@ -42,10 +42,28 @@ typedef struct {
     int numWorkers;
 } pthread_control_barrier_t;
 
+/*
+ * NUMA aware thread placement, configured by the key 'affinity':
+ *   0: threads are not pinned - default
+ *   1: workers are pinned to a cpu each. cpus are assigned node by node,
+ *      starting with the node of the main thread
+ *   2: as 1, but all threads stay on the node of the main thread and the
+ *      number of workers is limited to the cpus of this node
+ * File reader and writer threads are pinned to the node of the main thread.
+ * Data blocks are recycled in a pool per node, see ThreadNode().
+ */
+#define MAXNUMANODES 8
+
 /* function prototypes */
 
 uint32_t GetNumWorkers(uint32_t requested);
 
+void PinWorker(void);
+
+void PinNode(void);
+
+int ThreadNode(void);
+
 pthread_control_barrier_t *pthread_control_barrier_init(uint32_t numWorkers);
 
 void pthread_control_barrier_destroy(pthread_control_barrier_t *barrier);
@@ -0,0 +1,393 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "catalog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "nffile.h"
+#include "util.h"
+
+// max number of sub dir levels between a catalog and its files
+#define CATALOGDEPTH 5
+// leading entries of expired files, before the catalog gets pruned
+#define CATALOGPRUNE 1024
+#define CATALOGBUFFER 1024
+
+// catalogs loaded for lookups, including dirs without catalog
+typedef struct catalogDir_s {
+    struct catalogDir_s *next;  // hash chain
+    char *dirname;
+    catalogEntry_t *entry;  // NULL: no catalog in this dir
+    uint32_t numEntries;
+    uint32_t tableMask;
+    uint32_t *table;  // index + 1 of the entry of a path, 0: empty slot
+} catalogDir_t;
+
+#define DIRCACHESIZE 1024
+
+static struct dirCache_s {
+    pthread_mutex_t mutex;
+    catalogDir_t *bucket[DIRCACHESIZE];
+} dirCache = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static uint32_t PathHash(const char *path) {
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    while (*path) {
+        hash ^= (uint8_t)*path++;
+        hash *= 16777619U;
+    }
+    return hash;
+
+}  // End of PathHash
+
+static int SetFileLock(int fd) {
+    struct flock fl = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+    return fcntl(fd, F_SETLKW, &fl);
+
+}  // End of SetFileLock
+
+static int ReleaseFileLock(int fd) {
+    struct flock fl = {.l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+    return fcntl(fd, F_SETLK, &fl);
+
+}  // End of ReleaseFileLock
+
+static int WriteCatalogEntries(int fd, void *data, size_t len) {
+    char *p = (char *)data;
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 1;
+
+}  // End of WriteCatalogEntries
+
+// append the rotated file filename to the catalog of dirname. filename is the full path
+// of the file. The catalog is created, if it does not exist
+int AppendCatalog(char *dirname, char *filename) {
+    char path[MAXPATHLEN];
+    catalogEntry_t entry;
+
+    size_t len = strlen(dirname);
+    char *relative = strncmp(filename, dirname, len) == 0 ? filename + len : filename;
+    while (*relative == '/') relative++;
+    if (strlen(relative) >= sizeof(entry.path)) {
+        LogError("AppendCatalog() path too long: %s", relative);
+        return 0;
+    }
+
+    memset((void *)&entry, 0, sizeof(entry));
+    struct stat fstat_buf;
+    if (stat(filename, &fstat_buf) != 0 || !CatalogEntry(filename, &entry)) {
+        LogError("AppendCatalog() failed to read %s", filename);
+        return 0;
+    }
+    entry.size = fstat_buf.st_size;
+    entry.mtime = fstat_buf.st_mtime;
+    strcpy(entry.path, relative);
+
+    snprintf(path, MAXPATHLEN, "%s/%s", dirname, catalog_filename);
+    path[MAXPATHLEN - 1] = '\0';
+
+    // the catalog may get replaced by PruneCatalog(), while waiting for the lock
+    for (int retry = 0; retry < 3; retry++) {
+        int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd < 0) {
+            LogError("open() error for %s in %s line %d: %s", path, __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        if (SetFileLock(fd) != 0) {
+            LogError("fcntl(F_WRLCK) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            close(fd);
+            return 0;
+        }
+        if (fstat(fd, &fstat_buf) == 0 && fstat_buf.st_nlink == 0) {
+            // replaced meanwhile
+            close(fd);
+            continue;
+        }
+        int ok = 1;
+        if (fstat_buf.st_size == 0) {
+            catalogHeader_t header = {.magic = CATALOGMAGIC, .version = CATALOGVERSION};
+            ok = WriteCatalogEntries(fd, &header, sizeof(header));
+        }
+        if (ok) ok = WriteCatalogEntries(fd, &entry, sizeof(entry));
+        ReleaseFileLock(fd);
+        close(fd);
+        return ok;
+    }
+
+    LogError("AppendCatalog() failed to lock catalog %s", path);
+    return 0;
+
+}  // End of AppendCatalog
+
+// load the catalog of dirname into a lookup table. Returns a dir without entries,
+// if dirname has no valid catalog
+static catalogDir_t *LoadCatalog(char *dirname) {
+    char path[MAXPATHLEN];
+    catalogDir_t *catalogDir = calloc(1, sizeof(catalogDir_t));
+    if (!catalogDir || !(catalogDir->dirname = strdup(dirname))) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(catalogDir);
+        return NULL;
+    }
+
+    snprintf(path, MAXPATHLEN, "%s/%s", dirname, catalog_filename);
+    path[MAXPATHLEN - 1] = '\0';
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return catalogDir;
+
+    struct stat fstat_buf;
+    catalogHeader_t header;
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || header.magic != CATALOGMAGIC || header.version != CATALOGVERSION ||
+        fstat(fd, &fstat_buf) != 0) {
+        LogError("Invalid file catalog %s - ignored", path);
+        close(fd);
+        return catalogDir;
+    }
+
+    uint32_t numEntries = (fstat_buf.st_size - sizeof(header)) / sizeof(catalogEntry_t);
+    uint32_t tableSize = 2;
+    while (tableSize < 2 * numEntries) tableSize <<= 1;
+    catalogDir->entry = malloc(numEntries ? numEntries * sizeof(catalogEntry_t) : 1);
+    catalogDir->table = calloc(tableSize, sizeof(uint32_t));
+    if (!catalogDir->entry || !catalogDir->table) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(catalogDir->entry);
+        free(catalogDir->table);
+        catalogDir->entry = NULL;
+        close(fd);
+        return catalogDir;
+    }
+
+    ssize_t ret = read(fd, catalogDir->entry, numEntries * sizeof(catalogEntry_t));
+    close(fd);
+    if (ret < 0) {
+        LogError("read() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        ret = 0;
+    }
+    numEntries = ret / sizeof(catalogEntry_t);
+
+    // later entries of the same path replace earlier ones
+    catalogDir->tableMask = tableSize - 1;
+    for (uint32_t i = 0; i < numEntries; i++) {
+        catalogEntry_t *entry = &catalogDir->entry[i];
+        entry->path[sizeof(entry->path) - 1] = '\0';
+        uint32_t slot = PathHash(entry->path) & catalogDir->tableMask;
+        while (catalogDir->table[slot] && strcmp(catalogDir->entry[catalogDir->table[slot] - 1].path, entry->path) != 0)
+            slot = (slot + 1) & catalogDir->tableMask;
+        catalogDir->table[slot] = i + 1;
+    }
+    catalogDir->numEntries = numEntries;
+    dbg_printf("Loaded catalog %s: %u entries\n", path, numEntries);
+
+    return catalogDir;
+
+}  // End of LoadCatalog
+
+// get the cached catalog of dirname. Must be called with the cache locked
+static catalogDir_t *GetCatalog(char *dirname) {
+    uint32_t bucket = PathHash(dirname) & (DIRCACHESIZE - 1);
+    for (catalogDir_t *catalogDir = dirCache.bucket[bucket]; catalogDir; catalogDir = catalogDir->next) {
+        if (strcmp(catalogDir->dirname, dirname) == 0) return catalogDir;
+    }
+
+    catalogDir_t *catalogDir = LoadCatalog(dirname);
+    if (!catalogDir) return NULL;
+    catalogDir->next = dirCache.bucket[bucket];
+    dirCache.bucket[bucket] = catalogDir;
+    return catalogDir;
+
+}  // End of GetCatalog
+
+static catalogEntry_t *LookupCatalog(catalogDir_t *catalogDir, char *path) {
+    uint32_t slot = PathHash(path) & catalogDir->tableMask;
+    while (catalogDir->table[slot]) {
+        catalogEntry_t *entry = &catalogDir->entry[catalogDir->table[slot] - 1];
+        if (strcmp(entry->path, path) == 0) return entry;
+        slot = (slot + 1) & catalogDir->tableMask;
+    }
+    return NULL;
+
+}  // End of LookupCatalog
+
+// get the stat record of filename from the catalog of its data directory, which is searched
+// up to CATALOGDEPTH levels above the file. Returns 0, if the file has no valid catalog entry
+int CatalogStatRecord(char *filename, stat_record_t *statRecord) {
+    char dirname[MAXPATHLEN];
+
+    struct stat fstat_buf;
+    if (strlen(filename) >= MAXPATHLEN || stat(filename, &fstat_buf) != 0) return 0;
+    strcpy(dirname, filename);
+
+    int found = 0;
+    pthread_mutex_lock(&dirCache.mutex);
+    for (int level = 0; level < CATALOGDEPTH; level++) {
+        char *relative;
+        char *slash = strrchr(dirname, '/');
+        if (slash == NULL) {
+            // relative path in the current directory
+            relative = filename;
+            strcpy(dirname, ".");
+        } else if (slash == dirname) {
+            relative = filename + 1;
+            dirname[1] = '\0';
+        } else {
+            relative = filename + (slash - dirname) + 1;
+            *slash = '\0';
+        }
+
+        catalogDir_t *catalogDir = GetCatalog(dirname);
+        if (catalogDir && catalogDir->entry) {
+            // the first catalog found is responsible for the file
+            catalogEntry_t *entry = LookupCatalog(catalogDir, relative);
+            if (entry && entry->size == (uint64_t)fstat_buf.st_size && entry->mtime == (int64_t)fstat_buf.st_mtime) {
+                memcpy((void *)statRecord, (void *)&entry->statRecord, sizeof(stat_record_t));
+                found = 1;
+            }
+            break;
+        }
+        if (slash == NULL || slash == dirname) break;
+    }
+    pthread_mutex_unlock(&dirCache.mutex);
+
+    return found;
+
+}  // End of CatalogStatRecord
+
+// remove the leading entries of expired files from the catalog of dirname. The catalog is
+// rewritten, once CATALOGPRUNE entries can be removed
+void PruneCatalog(char *dirname) {
+    char path[MAXPATHLEN];
+    char tmpPath[MAXPATHLEN];
+
+    snprintf(path, MAXPATHLEN, "%s/%s", dirname, catalog_filename);
+    path[MAXPATHLEN - 1] = '\0';
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return;
+
+    catalogEntry_t *buffer = malloc(CATALOGBUFFER * sizeof(catalogEntry_t));
+    if (!buffer) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    // block collectors while pruning
+    if (SetFileLock(fd) != 0) {
+        LogError("fcntl(F_WRLCK) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(buffer);
+        close(fd);
+        return;
+    }
+
+    catalogHeader_t header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != CATALOGMAGIC || header.version != CATALOGVERSION) {
+        LogError("Invalid file catalog %s - ignored", path);
+        ReleaseFileLock(fd);
+        free(buffer);
+        close(fd);
+        return;
+    }
+
+    // count the leading entries of files, which no longer exist
+    uint64_t head = 0;
+    int done = 0;
+    while (!done) {
+        off_t offset = sizeof(catalogHeader_t) + head * sizeof(catalogEntry_t);
+        ssize_t ret = pread(fd, buffer, CATALOGBUFFER * sizeof(catalogEntry_t), offset);
+        uint32_t count = ret > 0 ? ret / sizeof(catalogEntry_t) : 0;
+        if (count == 0) break;
+        for (uint32_t i = 0; i < count; i++) {
+            char filePath[MAXPATHLEN];
+            struct stat fstat_buf;
+            buffer[i].path[sizeof(buffer[i].path) - 1] = '\0';
+            snprintf(filePath, MAXPATHLEN, "%s/%s", dirname, buffer[i].path);
+            filePath[MAXPATHLEN - 1] = '\0';
+            if (stat(filePath, &fstat_buf) == 0 || errno != ENOENT) {
+                done = 1;
+                break;
+            }
+            head++;
+        }
+    }
+
+    if (head >= CATALOGPRUNE) {
+        snprintf(tmpPath, MAXPATHLEN, "%s/%s.tmp", dirname, catalog_filename);
+        tmpPath[MAXPATHLEN - 1] = '\0';
+        int tmpFd = open(tmpPath, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (tmpFd < 0) {
+            LogError("open() error for %s in %s line %d: %s", tmpPath, __FILE__, __LINE__, strerror(errno));
+        } else {
+            int ok = WriteCatalogEntries(tmpFd, &header, sizeof(header));
+            uint64_t index = head;
+            while (ok) {
+                off_t offset = sizeof(catalogHeader_t) + index * sizeof(catalogEntry_t);
+                ssize_t ret = pread(fd, buffer, CATALOGBUFFER * sizeof(catalogEntry_t), offset);
+                uint32_t count = ret > 0 ? ret / sizeof(catalogEntry_t) : 0;
+                if (count == 0) break;
+                ok = WriteCatalogEntries(tmpFd, buffer, count * sizeof(catalogEntry_t));
+                index += count;
+            }
+            close(tmpFd);
+            if (ok && rename(tmpPath, path) == 0) {
+                dbg_printf("Pruned catalog %s: %llu entries removed\n", path, (unsigned long long)head);
+            } else {
+                LogError("Failed to prune file catalog %s", path);
+                unlink(tmpPath);
+            }
+        }
+    }
+
+    ReleaseFileLock(fd);
+    free(buffer);
+    close(fd);
+
+}  // End of PruneCatalog
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _CATALOG_H
+#define _CATALOG_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "nfdump.h"
+
+/*
+ * File catalog - an append only list of the rotated files of a data directory
+ * with their stat record. Collectors append each file after the rotation, so
+ * file selection by time window and the stat summary -I need not open every file.
+ *
+ *   +-----------------+---------+---------+-----+
+ *   | catalogHeader_t | entry 0 | entry 1 | ... |
+ *   +-----------------+---------+---------+-----+
+ *
+ * An entry is valid as long as size and mtime match the file. Files, which are
+ * appended to at rotation, get a new entry, which replaces the previous one.
+ * Files without a valid entry are read as before.
+ */
+#define catalog_filename ".nfcatalog"
+
+#define CATALOGMAGIC 0x4E464341
+#define CATALOGVERSION 1
+
+typedef struct catalogHeader_s {
+    uint32_t magic;
+    uint32_t version;
+} catalogHeader_t;
+
+typedef struct catalogEntry_s {
+    uint64_t size;             // file size in bytes
+    int64_t mtime;             // modification time of the file
+    uint32_t compression;      // compression of the file
+    uint32_t numBlocks;        // number of data blocks
+    stat_record_t statRecord;  // stat record of the file
+    char path[120];            // file path relative to the data directory
+} catalogEntry_t;
+
+int AppendCatalog(char *dirname, char *filename);
+
+int CatalogStatRecord(char *filename, stat_record_t *statRecord);
+
+void PruneCatalog(char *dirname);
+
+#endif  // _CATALOG_H
@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "cpufeature.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define CPU_X86 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define CPU_ARM 1
+#endif
+
+static uint32_t cpuFeatures = 0;
+static pthread_once_t cpuOnce = PTHREAD_ONCE_INIT;
+
+static const struct featureName_s {
+    uint32_t feature;
+    char *name;
+} featureName[] = {
+#ifdef CPU_ARM
+    {CPU_SHUFFLE, "neon"}, {CPU_CRC32, "crc"}, {CPU_AES, "aes"}, {CPU_SHA, "sha2"},
+#else
+    {CPU_SHUFFLE, "ssse3"}, {CPU_CRC32, "sse4.2"}, {CPU_AES, "aes-ni"}, {CPU_SHA, "sha-ni"}, {CPU_AVX2, "avx2"}, {CPU_AVX512, "avx512"},
+#endif
+    {0, NULL}};
+
+// the feature, each kernel variant requires
+static const struct kernel_s {
+    char *name;
+    uint32_t feature;
+} kernelTable[KERNEL_MAX] = {
+    [KERNEL_CRC32C] = {"crc32c", CPU_CRC32}, [KERNEL_KEYHASH] = {"keyhash", CPU_CRC32}, [KERNEL_V5SWAP] = {"v5swap", CPU_SHUFFLE},
+    [KERNEL_AESPRF] = {"aesprf", CPU_AES},   [KERNEL_SHA256] = {"sha256", CPU_SHA},
+};
+
+static void DetectFeatures(void) {
+    uint32_t features = 0;
+#ifdef CPU_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) features |= CPU_SHUFFLE;
+    if (__builtin_cpu_supports("sse4.2")) features |= CPU_CRC32;
+    if (__builtin_cpu_supports("aes")) features |= CPU_AES;
+    if (__builtin_cpu_supports("avx2")) features |= CPU_AVX2;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) features |= CPU_AVX512;
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1) && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA))
+        features |= CPU_SHA;
+#endif
+#ifdef CPU_ARM
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    features |= CPU_SHUFFLE;
+    if (hwcap & HWCAP_CRC32) features |= CPU_CRC32;
+    if (hwcap & HWCAP_AES) features |= CPU_AES;
+    if (hwcap & HWCAP_SHA2) features |= CPU_SHA;
+#endif
+
+    char *env = getenv("NFDUMP_CPU");
+    if (env && strcmp(env, "generic") == 0) features = 0;
+
+    cpuFeatures = features;
+
+}  // End of DetectFeatures
+
+uint32_t CPUFeatures(void) {
+    pthread_once(&cpuOnce, DetectFeatures);
+    return cpuFeatures;
+
+}  // End of CPUFeatures
+
+// returns 1, if the cpu specific variant of the kernel is used
+int CPUKernel(uint32_t kernel) {
+    if (kernel >= KERNEL_MAX) return 0;
+    uint32_t feature = kernelTable[kernel].feature;
+    return (CPUFeatures() & feature) == feature;
+
+}  // End of CPUKernel
+
+// cpu features and selected kernel variants, such as: "CPU: ssse3 sse4.2 avx2, Kernels: crc32c:sse4.2 ..."
+char *CPUDispatchInfo(void) {
+    static char info[256];
+
+    uint32_t features = CPUFeatures();
+    size_t len = snprintf(info, sizeof(info), "CPU:");
+    for (int i = 0; featureName[i].name && len < sizeof(info); i++) {
+        if (features & featureName[i].feature) len += snprintf(info + len, sizeof(info) - len, " %s", featureName[i].name);
+    }
+    if (features == 0 && len < sizeof(info)) len += snprintf(info + len, sizeof(info) - len, " generic");
+
+    if (len < sizeof(info)) len += snprintf(info + len, sizeof(info) - len, ", Kernels:");
+    for (int i = 0; i < KERNEL_MAX && len < sizeof(info); i++) {
+        char *variant = "generic";
+        if (CPUKernel(i)) {
+            for (int j = 0; featureName[j].name; j++) {
+                if (featureName[j].feature == kernelTable[i].feature) variant = featureName[j].name;
+            }
+        }
+        len += snprintf(info + len, sizeof(info) - len, " %s:%s", kernelTable[i].name, variant);
+    }
+    info[sizeof(info) - 1] = '\0';
+
+    return info;
+
+}  // End of CPUDispatchInfo
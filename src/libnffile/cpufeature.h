@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _CPUFEATURE_H
+#define _CPUFEATURE_H 1
+
+#include <stdint.h>
+
+/*
+ * Runtime cpu feature detection. The kernels with cpu specific variants select
+ * their variant by CPUKernel() at init time, so one binary runs the best variant
+ * on every host. The environment variable NFDUMP_CPU=generic disables all cpu
+ * specific variants.
+ */
+
+// cpu features
+#define CPU_SHUFFLE 0x01  // x86 ssse3 or ARM neon byte shuffle
+#define CPU_CRC32 0x02    // x86 sse4.2 or ARMv8 crc32c instructions
+#define CPU_AES 0x04      // x86 aes-ni or ARMv8 aes instructions
+#define CPU_SHA 0x08      // x86 sha-ni or ARMv8 sha2 instructions
+#define CPU_AVX2 0x10
+#define CPU_AVX512 0x20  // avx512f and avx512bw
+
+// kernels with cpu specific variants
+enum { KERNEL_CRC32C = 0, KERNEL_KEYHASH, KERNEL_V5SWAP, KERNEL_AESPRF, KERNEL_SHA256, KERNEL_MAX };
+
+uint32_t CPUFeatures(void);
+
+int CPUKernel(uint32_t kernel);
+
+char *CPUDispatchInfo(void);
+
+#endif  // _CPUFEATURE_H
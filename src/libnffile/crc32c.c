@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "crc32c.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cpufeature.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HWCRC_X86 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#define HWCRC_ARM 1
+#endif
+
+// reflected Castagnoli polynomial
+#define POLY 0x82F63B78
+
+static uint32_t crcTable[256];
+static int hwCRC = 0;
+
+static uint32_t CRC32C_Table(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len--) crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+
+}  // End of CRC32C_Table
+
+#ifdef HWCRC_X86
+
+__attribute__((target("sse4.2"))) static uint32_t CRC32C_HW(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = (uint32_t)crc64;
+    while (len--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+
+}  // End of CRC32C_HW
+
+#endif
+
+#ifdef HWCRC_ARM
+
+__attribute__((target("+crc"))) static uint32_t CRC32C_HW(uint32_t crc, const uint8_t *p, size_t len) {
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    while (len--) crc = __crc32cb(crc, *p++);
+    return crc;
+
+}  // End of CRC32C_HW
+
+#endif
+
+int CRC32C_Init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) crc = (crc >> 1) ^ (crc & 1 ? POLY : 0);
+        crcTable[i] = crc;
+    }
+
+    hwCRC = 0;
+#if defined(HWCRC_X86) || defined(HWCRC_ARM)
+    hwCRC = CPUKernel(KERNEL_CRC32C);
+#endif
+    return hwCRC;
+
+}  // End of CRC32C_Init
+
+uint32_t CRC32C(const void *data, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+#if defined(HWCRC_X86) || defined(HWCRC_ARM)
+    if (hwCRC) return ~CRC32C_HW(crc, (const uint8_t *)data, len);
+#endif
+    return ~CRC32C_Table(crc, (const uint8_t *)data, len);
+
+}  // End of CRC32C
@@ -233,10 +233,52 @@ static void *FileLister_thr(void *arg);
 
 static int CheckTimeWindow(char *filename, timeWindow_t *searchWindow);
 
+static int CheckDirTimeWindow(char *subPath, timeWindow_t *searchWindow);
+
+// last archive lookup of ArchivedInterval()
+typedef struct archiveCache_s {
+    char prefix[MAXPATHLEN];
+    int found;
+} archiveCache_t;
+
+static int IsArchive(char *name);
+
+static int ArchivePath(char *path, char *archive, size_t len);
+
+static char *SelectArchive(char *archive, char *first, char *last, timeWindow_t *timeWindow);
+
+static int ArchivedInterval(char *path, archiveCache_t *archiveCache);
+
+static int ListSourceDir(char *sourceDir, int file_list_level, timeWindow_t *timeWindow, stringlist_t *fileList);
+
+static void *SourceLister_thr(void *arg);
+
+// slack in s for flows in a sub dir, which started or ended outside the sub dir time
+#define SUBDIRSLACK 3600
+
+// each additional source dir -M is listed by its own worker
+typedef struct sourceLister_s {
+    pthread_t tid;
+    char *sourceDir;
+    int file_list_level;
+    timeWindow_t *timeWindow;
+    stringlist_t fileList;
+    int ok;
+} sourceLister_t;
+
 /* Functions */
 
 static int compare(const FTSENT **f1, const FTSENT **f2) { return strcmp((*f1)->fts_name, (*f2)->fts_name); }  // End of compare
 
+// order source dirs the same as fts orders its root entries
+static int compareSource(const void *s1, const void *s2) {
+    const char *n1 = strrchr(*(char *const *)s1, '/');
+    const char *n2 = strrchr(*(char *const *)s2, '/');
+    n1 = n1 ? n1 + 1 : *(char *const *)s1;
+    n2 = n2 ? n2 + 1 : *(char *const *)s2;
+    return strcmp(n1, n2);
+}  // End of compareSource
+
 static void CleanPath(char *entry) {
     char *p, *q;
     size_t len;
@@ -447,10 +489,6 @@ static int GetFileList(char *path, timeWindow_t *timeWindow) {
     struct stat stat_buf;
     char *last_file_ptr, *first_path, *last_path;
     int levels_first_file, levels_last_file, file_list_level;
-    int sub_index;
-
-    FTS *fts;
-    FTSENT *ftsent;
 
     CleanPath(path);
 
@@ -504,8 +542,12 @@ static int GetFileList(char *path, timeWindow_t *timeWindow) {
         // path contains the path to a file/directory
         // stat this entry
         if (stat(path, &stat_buf)) {
-            LogError("stat() error '%s': %s", path, strerror(errno));
-            return 0;
+            if (errno != ENOENT || !ArchivePath(path, NULL, 0)) {
+                LogError("stat() error '%s': %s", path, strerror(errno));
+                return 0;
+            }
+            // interval file merged into an archive file by nfcompact
+            stat_buf.st_mode = S_IFREG;
         }
         if (!S_ISDIR(stat_buf.st_mode) && !S_ISREG(stat_buf.st_mode)) {
             LogError("Not a file or directory: '%s'", path);
@@ -666,7 +708,9 @@ static int GetFileList(char *path, timeWindow_t *timeWindow) {
 
             // pathbuff must point to a file
             if (stat(pathbuff, &stat_buf)) {
-                if (errno == ENOENT) {
+                if (errno == ENOENT && ArchivePath(pathbuff, NULL, 0)) {
+                    // interval file merged into an archive file by nfcompact
+                } else if (errno == ENOENT) {
                     // file not found - try to guess a possible subdir
                     char *sub_dir = GuessSubDir(source_dirs.list[0], path);
                     if (sub_dir) {  // subdir found
@@ -766,14 +810,79 @@ static int GetFileList(char *path, timeWindow_t *timeWindow) {
         return 0;
     }
 
-    // last entry must be NULL
-    InsertString(&source_dirs, NULL);
-    if (!source_dirs.list) {
+    if (source_dirs.num_strings == 0 || !source_dirs.list) {
         LogError("ERROR: No sourc dir at %s line %d", __FILE__, __LINE__);
         return 0;
     }
-    fts = fts_open(source_dirs.list, FTS_LOGICAL, compare);
-    sub_index = 0;
+    qsort(source_dirs.list, source_dirs.num_strings, sizeof(char *), compareSource);
+
+    // relative time windows are resolved by the first file found, so they are listed in sequence
+    int parallel = source_dirs.num_strings > 1 && !(timeWindow && ((timeWindow->first && timeWindow->first <= 604800) ||
+                                                                    (timeWindow->last && timeWindow->last <= 604800)));
+    if (!parallel) {
+        for (int i = 0; i < source_dirs.num_strings; i++) {
+            if (!ListSourceDir(source_dirs.list[i], file_list_level, timeWindow, NULL)) return 0;
+        }
+        return 1;
+    }
+
+    // list the first source dir directly into the file queue, all others in parallel
+    int numListers = source_dirs.num_strings - 1;
+    sourceLister_t *sourceLister = calloc(numListers, sizeof(sourceLister_t));
+    if (!sourceLister) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    for (int i = 0; i < numListers; i++) {
+        sourceLister_t *lister = &sourceLister[i];
+        lister->sourceDir = source_dirs.list[i + 1];
+        lister->file_list_level = file_list_level;
+        lister->timeWindow = timeWindow;
+        InitStringlist(&lister->fileList, 1024);
+        if (pthread_create(&lister->tid, NULL, SourceLister_thr, (void *)lister) != 0) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            // list it later in sequence
+            lister->tid = 0;
+        }
+    }
+
+    int ok = ListSourceDir(source_dirs.list[0], file_list_level, timeWindow, NULL);
+
+    // push the lists in source dir order
+    for (int i = 0; i < numListers; i++) {
+        sourceLister_t *lister = &sourceLister[i];
+        if (lister->tid) {
+            pthread_join(lister->tid, NULL);
+        } else if (ok) {
+            lister->ok = ListSourceDir(lister->sourceDir, file_list_level, timeWindow, NULL);
+        }
+        for (int j = 0; j < lister->fileList.num_strings; j++) {
+            if (ok)
+                queue_push(file_queue, lister->fileList.list[j]);
+            else
+                free(lister->fileList.list[j]);
+        }
+        free(lister->fileList.list);
+        if (!lister->ok) ok = 0;
+    }
+    free(sourceLister);
+
+    return ok;
+}  // End of GetFileList
+
+// list all files of a source dir, which match the dir entry filter and the time window.
+// The files are added to fileList, or pushed into the file queue, if fileList is NULL
+static int ListSourceDir(char *sourceDir, int file_list_level, timeWindow_t *timeWindow, stringlist_t *fileList) {
+    char *const roots[2] = {sourceDir, NULL};
+    FTS *fts = fts_open(roots, FTS_LOGICAL, compare);
+    if (!fts) {
+        LogError("fts_open() error '%s': %s", sourceDir, strerror(errno));
+        return 0;
+    }
+
+    FTSENT *ftsent;
+    int sub_index = 0;
+    archiveCache_t archiveCache = {0};
     while ((ftsent = fts_read(fts)) != NULL) {
         int fts_level = ftsent->fts_level;
         char *fts_path;
@@ -785,11 +894,13 @@ static int GetFileList(char *path, timeWindow_t *timeWindow) {
 
         if (dir_entry_filter && (fts_level > file_list_level)) {
             LogError("ERROR: fts_level error at %s line %d", __FILE__, __LINE__);
+            fts_close(fts);
             return 0;
         }
 
         if (ftsent->fts_pathlen < sub_index) {
             LogError("ERROR: fts_pathlen error at %s line %d", __FILE__, __LINE__);
+            fts_close(fts);
             return 0;
         }
         fts_path = &ftsent->fts_path[sub_index];
@@ -801,6 +912,9 @@ static int GetFileList(char *path, timeWindow_t *timeWindow) {
                     ((dir_entry_filter[fts_level].first_entry && (strcmp(fts_path, dir_entry_filter[fts_level].first_entry) < 0)) ||
                      (dir_entry_filter[fts_level].last_entry && (strcmp(fts_path, dir_entry_filter[fts_level].last_entry) > 0))))
                     fts_set(fts, ftsent, FTS_SKIP);
+                else if (!CheckDirTimeWindow(fts_path, timeWindow))
+                    // no file in this sub dir can match the time window
+                    fts_set(fts, ftsent, FTS_SKIP);
 
                 break;
             case FTS_DP:
@@ -808,22 +922,42 @@ static int GetFileList(char *path, timeWindow_t *timeWindow) {
             case FTS_F:
                 // file entry
 
-                // skip stat file
-                if (strcmp(ftsent->fts_name, ".nfstat") == 0 || strncmp(ftsent->fts_name, NF_DUMPFILE, strlen(NF_DUMPFILE)) == 0) continue;
+                // skip dot files - .nfstat, .nfcatalog, OSX .DS_Store etc.
+                if (ftsent->fts_name[0] == '.') continue;
+                // skip dump and stat files
+                if (strncmp(ftsent->fts_name, NF_DUMPFILE, strlen(NF_DUMPFILE)) == 0) continue;
                 if (strstr(ftsent->fts_name, ".stat") != NULL) continue;
-                // skip OSX DS_Store files
-                if (strstr(ftsent->fts_name, ".DS_Store") != NULL) continue;
                 // skip pcap file
                 if (strstr(ftsent->fts_name, "pcap") != NULL) continue;
 
+                if (IsArchive(ftsent->fts_name)) {
+                    // archive of interval files - the file filter selects its intervals by name
+                    if (file_list_level && fts_level != file_list_level) continue;
+                    char *entry = SelectArchive(ftsent->fts_path, file_list_level ? dir_entry_filter[fts_level].first_entry : NULL,
+                                                file_list_level ? dir_entry_filter[fts_level].last_entry : NULL, timeWindow);
+                    if (entry && fileList) {
+                        InsertString(fileList, entry);
+                        free(entry);
+                    } else if (entry) {
+                        queue_push(file_queue, entry);
+                    }
+                    continue;
+                }
+
                 if (file_list_level &&
                     ((fts_level != file_list_level) ||
                      (dir_entry_filter[fts_level].first_entry && (strcmp(ftsent->fts_name, dir_entry_filter[fts_level].first_entry) < 0)) ||
                      (dir_entry_filter[fts_level].last_entry && (strcmp(ftsent->fts_name, dir_entry_filter[fts_level].last_entry) > 0))))
                     continue;
 
+                // interval file kept by nfcompact -k - its flows are read from the archive
+                if (ArchivedInterval(ftsent->fts_path, &archiveCache)) continue;
+
                 if (CheckTimeWindow(ftsent->fts_path, timeWindow)) {
-                    queue_push(file_queue, strdup(ftsent->fts_path));
+                    if (fileList)
+                        InsertString(fileList, ftsent->fts_path);
+                    else
+                        queue_push(file_queue, strdup(ftsent->fts_path));
                 }
                 break;
         }
@@ -831,7 +965,17 @@ static int GetFileList(char *path, timeWindow_t *timeWindow) {
     fts_close(fts);
 
     return 1;
-}  // End of GetFileList
+
+}  // End of ListSourceDir
+
+static void *SourceLister_thr(void *arg) {
+    sourceLister_t *lister = (sourceLister_t *)arg;
+
+    lister->ok = ListSourceDir(lister->sourceDir, lister->file_list_level, lister->timeWindow, &lister->fileList);
+
+    pthread_exit(NULL);
+
+}  // End of SourceLister_thr
 
 /*
  * Get the list of directories
@@ -890,6 +1034,17 @@ void Getsource_dirs(char *dirs) {
 
 }  // End of Getsource_dirs
 
+// return the index of the source dir -M of a listed file, or -1, if not listed from a source dir.
+// Valid after the file queue of SetupInputFileSequence() is closed
+int FileSource(char *path) {
+    for (int i = 0; i < source_dirs.num_strings; i++) {
+        size_t len = strlen(source_dirs.list[i]);
+        if (strncmp(path, source_dirs.list[i], len) == 0 && path[len] == '/') return i;
+    }
+    return -1;
+
+}  // End of FileSource
+
 queue_t *SetupInputFileSequence(flist_t *flist) {
     if (flist->multiple_dirs == NULL && flist->single_file == NULL && flist->multiple_files == NULL) {
         LogError("Need an input source -r/-R/-M - <stdin> invalid");
@@ -908,10 +1063,12 @@ queue_t *SetupInputFileSequence(flist_t *flist) {
 
     if (flist->multiple_dirs == NULL && flist->single_file) {
         // if -r is directory use it for -R
-        if (TestPath(flist->single_file, S_IFDIR) == PATH_OK) {
+        if (LiveSource(flist->single_file) || StreamPath(flist->single_file)) {
+            // live socket of a collector, stdin or a pipe - read by GetNextFile()
+        } else if (TestPath(flist->single_file, S_IFDIR) == PATH_OK) {
             flist->multiple_files = flist->single_file;
             flist->single_file = NULL;
-        } else if (TestPath(flist->single_file, S_IFREG) < PATH_OK) {
+        } else if (TestPath(flist->single_file, S_IFREG) < PATH_OK && !ArchivePath(flist->single_file, NULL, 0)) {
             // not a regular file
             LogError("%s is not a file or directory", flist->single_file);
             return NULL;
@@ -952,8 +1109,17 @@ static void *FileLister_thr(void *arg) {
         CleanPath(single_file);
 
         if (source_dirs.num_strings == 0) {
-            // single file -r
-            if (CheckTimeWindow(single_file, flist->timeWindow)) {
+            // single file -r. A stream can be read only once
+            char archive[MAXPATHLEN];
+            if (StreamPath(single_file)) {
+                queue_push(file_queue, strdup(single_file));
+            } else if (TestPath(single_file, S_IFREG) < PATH_OK && ArchivePath(single_file, archive, sizeof(archive))) {
+                // interval file merged into an archive file by nfcompact
+                char *name = strrchr(single_file, '/');
+                name = name ? name + 1 : single_file;
+                char *entry = SelectArchive(archive, name, name, flist->timeWindow);
+                if (entry) queue_push(file_queue, entry);
+            } else if (CheckTimeWindow(single_file, flist->timeWindow)) {
                 queue_push(file_queue, strdup(single_file));
             }
         } else {
@@ -973,8 +1139,13 @@ static void *FileLister_thr(void *arg) {
                 dbg_printf("Src dir: %d, %s\n", i, source_dirs.list[i]);
                 snprintf(s, MAXPATHLEN - 1, "%s/%s", source_dirs.list[i], single_file);
                 s[MAXPATHLEN - 1] = '\0';
+                char archive[MAXPATHLEN];
                 if (stat(s, &stat_buf)) {
-                    if (errno == ENOENT) {
+                    if (errno == ENOENT && ArchivePath(s, archive, sizeof(archive))) {
+                        // interval file merged into an archive file by nfcompact
+                        char *entry = SelectArchive(archive, single_file, single_file, flist->timeWindow);
+                        if (entry) queue_push(file_queue, entry);
+                    } else if (errno == ENOENT) {
                         // file not found - try to guess subdir
                         char *sub_dir = GuessSubDir(source_dirs.list[i], single_file);
                         if (sub_dir) {  // subdir found
@@ -1232,3 +1403,184 @@ static int CheckTimeWindow(char *filename, timeWindow_t *searchWindow) {
     return 1;
 
 }  // End of CheckTimeWindow
+
+/*
+ * Check the time of a sub dir in the hierarchy against an absolute time window.
+ * Sub dirs of the form %Y, %Y/%m/%d[/%H] and %F[/%H] are recognized. All other
+ * sub dirs, such as %Y/%m, which is ambiguous with %Y/%W, are accepted.
+ * Returns 0, if no file in this sub dir can match the time window
+ */
+static int CheckDirTimeWindow(char *subPath, timeWindow_t *searchWindow) {
+    // no time window or a relative time window
+    if (!searchWindow) return 1;
+    if ((searchWindow->first && searchWindow->first <= 604800) || (searchWindow->last && searchWindow->last <= 604800)) return 1;
+
+    int num[4], len[4];
+    int numFields = 0;
+    char *p = subPath;
+    while (*p) {
+        if (numFields == 4) return 1;
+        num[numFields] = 0;
+        len[numFields] = 0;
+        while (isdigit((int)*p)) {
+            num[numFields] = 10 * num[numFields] + (*p - '0');
+            len[numFields]++;
+            p++;
+        }
+        if (len[numFields] == 0) return 1;
+        numFields++;
+        if (*p == '/' || *p == '-') {
+            p++;
+        } else if (*p) {
+            return 1;
+        }
+    }
+    // an empty sub path has no time
+    if (numFields == 0) return 1;
+
+    struct tm t_tm = {0};
+    t_tm.tm_mday = 1;
+    t_tm.tm_isdst = -1;
+    if (len[0] != 4) return 1;
+    t_tm.tm_year = num[0] - 1900;
+
+    // number of fields: 1 year, 3 day, 4 hour
+    int *field = NULL;
+    switch (numFields) {
+        case 1:
+            field = &t_tm.tm_year;
+            break;
+        case 4:
+            if (len[3] != 2) return 1;
+            t_tm.tm_hour = num[3];
+            field = &t_tm.tm_hour;
+            // fall through
+        case 3:
+            if (len[1] != 2 || len[2] != 2) return 1;
+            t_tm.tm_mon = num[1] - 1;
+            t_tm.tm_mday = num[2];
+            if (!field) field = &t_tm.tm_mday;
+            break;
+        default:
+            return 1;
+    }
+
+    // source listers run in parallel
+    static pthread_mutex_t tzMutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&tzMutex);
+    time_t start = mktime(&t_tm);
+    (*field)++;
+    t_tm.tm_isdst = -1;
+    time_t end = mktime(&t_tm);
+    pthread_mutex_unlock(&tzMutex);
+    if (start == -1 || end == -1) return 1;
+
+    if (searchWindow->first && (end + SUBDIRSLACK) <= searchWindow->first) return 0;
+    if (searchWindow->last && (start - SUBDIRSLACK) > searchWindow->last) return 0;
+
+    return 1;
+
+}  // End of CheckDirTimeWindow
+
+// returns 1, if name is the name of an archive file of nfcompact
+static int IsArchive(char *name) {
+    size_t len = strlen(NF_ARCHIVEFILE);
+    if (strncmp(name, NF_ARCHIVEFILE, len) != 0) return 0;
+
+    char *p = name + len;
+    while (isdigit((int)*p)) p++;
+    return *p == '\0' && ((p - name - len) == 8 || (p - name - len) == 10);
+
+}  // End of IsArchive
+
+// returns 1, if the hourly or daily archive file exists, into which nfcompact merges the
+// interval file path. The path of the archive is copied to archive, if not NULL
+static int ArchivePath(char *path, char *archive, size_t len) {
+    char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char *timeString = strrchr(name, '.');
+    if (!timeString) return 0;
+    timeString++;
+
+    size_t timeLen = 0;
+    while (isdigit((int)timeString[timeLen])) timeLen++;
+    if (timeString[timeLen] != '\0' || (timeLen != 12 && timeLen != 14)) return 0;
+
+    int savedErrno = errno;
+    char archivePath[MAXPATHLEN];
+    int found = 0;
+    for (int archiveLen = 10; !found && archiveLen >= 8; archiveLen -= 2) {
+        snprintf(archivePath, sizeof(archivePath), "%.*s%s%.*s", (int)(name - path), path, NF_ARCHIVEFILE, archiveLen, timeString);
+        found = TestPath(archivePath, S_IFREG) == PATH_OK;
+    }
+    errno = savedErrno;
+    if (found && archive) snprintf(archive, len, "%s", archivePath);
+
+    return found;
+
+}  // End of ArchivePath
+
+/*
+ * Select the intervals of an archive file with names in first .. last and flows
+ * inside the time window. first or last NULL do not limit the names. Returns the
+ * allocated queue entry of the archive or of its selected blocks - see ARCHIVESELECT.
+ * Returns NULL, if no interval matches
+ */
+static char *SelectArchive(char *archive, char *first, char *last, timeWindow_t *timeWindow) {
+    if (!CheckTimeWindow(archive, timeWindow)) return NULL;
+    if (!first && !last && !timeWindow) return strdup(archive);
+
+    archiveInterval_t *interval;
+    int numInterval = GetArchiveIntervals(archive, &interval);
+    if (numInterval <= 0) return numInterval == 0 ? strdup(archive) : NULL;
+
+    // the intervals are in name order and occupy consecutive blocks
+    int numSelected = 0;
+    uint32_t firstBlock = 0;
+    uint32_t lastBlock = 0;
+    for (int i = 0; i < numInterval; i++) {
+        intervalToc_t *toc = &(interval[i].toc);
+        stat_record_t *stat_record = &(interval[i].stat_record);
+        if ((first && strcmp(toc->name, first) < 0) || (last && strcmp(toc->name, last) > 0)) continue;
+        // a relative time window is resolved by CheckTimeWindow()
+        if (timeWindow && ((timeWindow->last && timeWindow->last < (stat_record->firstseen / 1000LL)) ||
+                           (timeWindow->first && timeWindow->first > (stat_record->lastseen / 1000LL))))
+            continue;
+
+        numSelected++;
+        if (toc->numBlocks == 0) continue;
+        if (lastBlock == 0) firstBlock = toc->firstBlock;
+        lastBlock = toc->firstBlock + toc->numBlocks;
+    }
+    free(interval);
+
+    if (numSelected == numInterval) return strdup(archive);
+    if (lastBlock == 0) return NULL;
+
+    char entry[MAXPATHLEN];
+    snprintf(entry, sizeof(entry), ARCHIVESELECT, archive, firstBlock, lastBlock);
+    return strdup(entry);
+
+}  // End of SelectArchive
+
+/*
+ * Returns 1, if an archive file exists for the interval file path. Files are listed in
+ * name order, so the result is cached for the directory and hour of the last lookup
+ */
+static int ArchivedInterval(char *path, archiveCache_t *archiveCache) {
+    char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char *timeString = strrchr(name, '.');
+    if (!timeString) return 0;
+
+    size_t prefixLen = (timeString - path) + 1 + 10;
+    if (strlen(path) < prefixLen || prefixLen >= sizeof(archiveCache->prefix)) return 0;
+    if (strncmp(archiveCache->prefix, path, prefixLen) == 0 && archiveCache->prefix[prefixLen] == '\0') return archiveCache->found;
+
+    archiveCache->found = ArchivePath(path, NULL, 0);
+    memcpy(archiveCache->prefix, path, prefixLen);
+    archiveCache->prefix[prefixLen] = '\0';
+
+    return archiveCache->found;
+
+}  // End of ArchivedInterval
@@ -52,4 +52,6 @@ int SetupSubDir(char *dir, char *subdir, char *error, size_t errlen);
 
 queue_t *SetupInputFileSequence(flist_t *flist);
 
+int FileSource(char *path);
+
 #endif  //_FLIST_H
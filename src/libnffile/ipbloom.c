@@ -0,0 +1,160 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "ipbloom.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "util.h"
+
+// max fill ratio of a folded filter in percent
+#define FOLDFILL 30
+// filters with a higher fill ratio do not skip enough to be stored
+#define MAXFILL 50
+
+ipBloom_t *NewIPBloom(uint32_t numBits, uint32_t numHashes) {
+    if (numBits < 64 || (numBits & (numBits - 1)) != 0) {
+        LogError("NewIPBloom(): invalid number of bits: %u", numBits);
+        return NULL;
+    }
+
+    ipBloom_t *ipBloom = calloc(1, sizeof(ipBloom_t));
+    if (!ipBloom) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    ipBloom->bits = calloc(numBits / 64, sizeof(uint64_t));
+    if (!ipBloom->bits) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(ipBloom);
+        return NULL;
+    }
+    ipBloom->numBits = numBits;
+    ipBloom->numHashes = numHashes;
+    return ipBloom;
+
+}  // End of NewIPBloom
+
+void FreeIPBloom(ipBloom_t *ipBloom) {
+    if (!ipBloom) return;
+    free((void *)ipBloom->bits);
+    free(ipBloom);
+
+}  // End of FreeIPBloom
+
+// 64bit finalizer of murmur3 - IPv4 and IPv6 keys hash differently
+static inline uint64_t HashKey(uint64_t addr, uint32_t af) {
+    uint64_t h = addr ^ (af == PF_INET6 ? 0x9E3779B97F4A7C15ULL : 0);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+
+}  // End of HashKey
+
+// bits are set by the writer threads in parallel
+void IPBloomAdd(ipBloom_t *ipBloom, uint64_t addr, uint32_t af) {
+    uint64_t h = HashKey(addr, af);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    uint32_t mask = ipBloom->numBits - 1;
+    for (uint32_t i = 0; i < ipBloom->numHashes; i++) {
+        uint32_t bit = (h1 + i * h2) & mask;
+        uint64_t word = 1ULL << (bit & 63);
+        // skip the atomic op, if the bit is already set
+        if ((atomic_load_explicit(&ipBloom->bits[bit >> 6], memory_order_relaxed) & word) == 0)
+            atomic_fetch_or_explicit(&ipBloom->bits[bit >> 6], word, memory_order_relaxed);
+    }
+
+}  // End of IPBloomAdd
+
+// returns 1, if addr may be in the filter, 0 if not
+int IPBloomCheck(const ipBloom_t *ipBloom, uint64_t addr, uint32_t af) {
+    uint64_t h = HashKey(addr, af);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    uint32_t mask = ipBloom->numBits - 1;
+    for (uint32_t i = 0; i < ipBloom->numHashes; i++) {
+        uint32_t bit = (h1 + i * h2) & mask;
+        if ((atomic_load_explicit(&ipBloom->bits[bit >> 6], memory_order_relaxed) & (1ULL << (bit & 63))) == 0) return 0;
+    }
+    return 1;
+
+}  // End of IPBloomCheck
+
+// returns 1, if any of the keys may be in the filter, 0 if none
+int IPBloomCheckKeys(const ipBloom_t *ipBloom, const ipKey_t *keys, uint32_t numKeys) {
+    for (uint32_t i = 0; i < numKeys; i++) {
+        if (IPBloomCheck(ipBloom, keys[i].addr, keys[i].af)) return 1;
+    }
+    return 0;
+
+}  // End of IPBloomCheckKeys
+
+// count the set bits of the filter, or of the filter folded once, if fold is set
+static uint64_t CountBits(const ipBloom_t *ipBloom, int fold) {
+    uint32_t numWords = fold ? ipBloom->numBits / 128 : ipBloom->numBits / 64;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < numWords; i++) {
+        uint64_t w = atomic_load_explicit(&ipBloom->bits[i], memory_order_relaxed);
+        if (fold) w |= atomic_load_explicit(&ipBloom->bits[i + numWords], memory_order_relaxed);
+        count += __builtin_popcountll(w);
+    }
+    return count;
+
+}  // End of CountBits
+
+/*
+ * Fold the filter to the smallest size with a fill ratio below FOLDFILL.
+ * Must be called, after all writers are done. Returns 1 if the filter is worth
+ * storing, 0 if the filter is too full to skip any file.
+ */
+int IPBloomFold(ipBloom_t *ipBloom) {
+    while (ipBloom->numBits > IPBLOOMMINBITS) {
+        uint32_t halfWords = ipBloom->numBits / 128;
+        if (CountBits(ipBloom, 1) * 100 > (uint64_t)(ipBloom->numBits / 2) * FOLDFILL) break;
+
+        for (uint32_t i = 0; i < halfWords; i++) {
+            uint64_t w = atomic_load_explicit(&ipBloom->bits[i + halfWords], memory_order_relaxed);
+            atomic_fetch_or_explicit(&ipBloom->bits[i], w, memory_order_relaxed);
+        }
+        ipBloom->numBits /= 2;
+    }
+
+    uint64_t count = CountBits(ipBloom, 0);
+    return count * 100 <= (uint64_t)ipBloom->numBits * MAXFILL;
+
+}  // End of IPBloomFold
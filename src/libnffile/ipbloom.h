@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _IPBLOOM_H
+#define _IPBLOOM_H 1
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+/*
+ * Bloom filter of all src/dst IP addresses of the flows in a file.
+ * IPv4 addresses are stored as is, IPv6 addresses by their upper 64 bits.
+ * A filter such as 'ip 1.2.3.4' can only match flows of a file, if the
+ * address is in the file's bloom filter. The filter never misses an address,
+ * but may report an address, not in the file (false positive).
+ *
+ * The number of bits is a power of 2. A filter with n bits is folded into
+ * a filter with n/2 bits by or-ing the upper half into the lower half, so the
+ * filter starts large and is folded to its optimal size, before it is stored.
+ */
+
+// bits of a new filter - 1MB
+#define IPBLOOMBITS (1 << 23)
+// smallest folded filter - 1KB
+#define IPBLOOMMINBITS (1 << 13)
+#define IPBLOOMHASHES 4
+
+typedef struct ipBloom_s {
+    uint32_t numBits;    // number of bits - power of 2
+    uint32_t numHashes;  // number of hash functions
+    uint32_t loaded;     // bytes loaded from appendix records
+    _Atomic uint32_t invalid;  // flows were written, which are not in the filter
+    _Atomic uint64_t *bits;
+} ipBloom_t;
+
+// IP address key - IPv4 address or upper 64 bits of IPv6 address
+typedef struct ipKey_s {
+    uint64_t addr;
+    uint32_t af;  // PF_INET or PF_INET6
+} ipKey_t;
+
+ipBloom_t *NewIPBloom(uint32_t numBits, uint32_t numHashes);
+
+void FreeIPBloom(ipBloom_t *ipBloom);
+
+void IPBloomAdd(ipBloom_t *ipBloom, uint64_t addr, uint32_t af);
+
+int IPBloomCheck(const ipBloom_t *ipBloom, uint64_t addr, uint32_t af);
+
+int IPBloomCheckKeys(const ipBloom_t *ipBloom, const ipKey_t *keys, uint32_t numKeys);
+
+int IPBloomFold(ipBloom_t *ipBloom);
+
+#endif  // _IPBLOOM_H
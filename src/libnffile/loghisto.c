@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "loghisto.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// bit mask of the metrics requested by the output format
+static uint32_t histoRequested = 0;
+
+void LogHistoMerge(logHisto_t *dst, const logHisto_t *src) {
+    for (int i = 0; i < HISTO_BINS; i++) dst->bin[i] += src->bin[i];
+    dst->count += src->count;
+}  // End of LogHistoMerge
+
+// return the value at quantile q (0.0 .. 1.0) - the middle of the selected bin
+uint64_t LogHistoQuantile(const logHisto_t *logHisto, double q) {
+    if (logHisto == NULL || logHisto->count == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * logHisto->count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t sum = 0;
+    int bin = 0;
+    for (; bin < HISTO_BINS - 1; bin++) {
+        sum += logHisto->bin[bin];
+        if (sum >= rank) break;
+    }
+
+    if (bin < HISTO_SUB) return bin;
+
+    uint32_t msb = (bin >> HISTO_SUBBITS) + HISTO_SUBBITS - 1;
+    uint32_t shift = msb - HISTO_SUBBITS;
+    uint64_t low = (1ULL << msb) + ((uint64_t)(bin & (HISTO_SUB - 1)) << shift);
+    return low + ((1ULL << shift) >> 1);
+
+}  // End of LogHistoQuantile
+
+void LogHistoRequest(int metric) {
+    if (metric >= 0 && metric < NUMHISTOS) histoRequested |= 1 << metric;
+}  // End of LogHistoRequest
+
+uint32_t LogHistoRequested(void) {
+    return histoRequested;
+}  // End of LogHistoRequested
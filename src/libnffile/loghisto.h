@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _LOGHISTO_H
+#define _LOGHISTO_H 1
+
+#include <stdint.h>
+
+/*
+ * Log histogram of a metric of aggregated flows, to report quantiles per aggregate.
+ * Each power of 2 is split into HISTO_SUB linear sub bins, which limits the relative
+ * error of a quantile to 1/(2*HISTO_SUB). Values up to 2^HISTO_MAXBIT are binned
+ * exactly, larger values end up in the last bin. Histograms are merged by adding bins.
+ */
+#define HISTO_SUBBITS 2
+#define HISTO_SUB (1 << HISTO_SUBBITS)
+#define HISTO_MAXBIT 41
+#define HISTO_BINS (((HISTO_MAXBIT - HISTO_SUBBITS + 1) << HISTO_SUBBITS) + HISTO_SUB)
+
+// metrics collected per aggregate
+enum { HISTO_DURATION = 0, HISTO_BPP, HISTO_LATENCY, NUMHISTOS };
+
+typedef struct logHisto_s {
+    uint64_t count;
+    uint32_t bin[HISTO_BINS];
+} logHisto_t;
+
+static inline void LogHistoAdd(logHisto_t *logHisto, uint64_t value) {
+    uint32_t bin;
+    if (value < HISTO_SUB) {
+        bin = value;
+    } else {
+        uint32_t msb = 63 - __builtin_clzll(value);
+        if (msb > HISTO_MAXBIT) {
+            bin = HISTO_BINS - 1;
+        } else {
+            uint32_t sub = (value >> (msb - HISTO_SUBBITS)) & (HISTO_SUB - 1);
+            bin = ((msb - HISTO_SUBBITS + 1) << HISTO_SUBBITS) + sub;
+        }
+    }
+    logHisto->bin[bin]++;
+    logHisto->count++;
+}  // End of LogHistoAdd
+
+void LogHistoMerge(logHisto_t *dst, const logHisto_t *src);
+
+uint64_t LogHistoQuantile(const logHisto_t *logHisto, double q);
+
+void LogHistoRequest(int metric);
+
+uint32_t LogHistoRequested(void);
+
+#endif  // _LOGHISTO_H
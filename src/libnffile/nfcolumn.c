@@ -0,0 +1,484 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "nfcolumn.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "id.h"
+#include "ipbloom.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "util.h"
+
+#define Align8(n) (((n) + 7) & ~7)
+#define BitmapSize(numRecords) (Align8(((numRecords) + 7) / 8))
+
+// parsed column of a columnar block
+typedef struct column_s {
+    uint32_t extID;
+    uint32_t elementSize;
+    uint32_t numElements;
+    uint32_t next;  // next element to expand
+    const uint64_t *bitmap;
+    const uint8_t *data;
+    // compact column - elements are decoded one by one
+    int compact;
+    uint64_t msecBase;
+    const uint8_t *end;
+    EXgenericFlow_t genericFlow;
+} column_t;
+
+#define ZigZag(v) (((v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define UnZigZag(v) (((v) >> 1) ^ (~((v) & 1) + 1))
+
+static inline uint8_t *PutVarint(uint8_t *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}  // End of PutVarint
+
+static inline int GetVarint(const uint8_t **cursor, const uint8_t *end, uint64_t *value) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*cursor == end) return 0;
+        uint8_t byte = *(*cursor)++;
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = v;
+            return 1;
+        }
+    }
+    return 0;
+}  // End of GetVarint
+
+/*
+ * Encode the EXgenericFlow column of a columnar block compact, if this saves space.
+ * The column directly follows the header column, as it has the lowest extension ID.
+ */
+static void CompactGenericColumn(dataBlock_t *columnBlock) {
+    uint8_t *base = GetCursor(columnBlock);
+    uint32_t numRecords = columnBlock->NumRecords;
+    uint32_t offset = sizeof(columnHeader_t) + Align8(numRecords * sizeof(recordHeaderV3_t));
+    if ((offset + sizeof(columnHeader_t)) > columnBlock->size) return;
+
+    columnHeader_t *columnHeader = (columnHeader_t *)(base + offset);
+    if (columnHeader->extID != EXgenericFlowID || columnHeader->elementSize != sizeof(EXgenericFlow_t)) return;
+    uint32_t numElements = columnHeader->numElements;
+    uint8_t *data = base + offset + sizeof(columnHeader_t) + BitmapSize(numRecords);
+    uint32_t rawSize = Align8(numElements * sizeof(EXgenericFlow_t));
+    uint32_t tailSize = sizeof(EXgenericFlow_t) - OFFsrcPort;
+
+    // 5 varints of max 10 bytes each and the raw tail of each element
+    uint8_t *encoded = malloc((size_t)numElements * (50 + tailSize));
+    if (!encoded) return;
+
+    uint64_t msecBase = 0;
+    uint8_t *out = encoded;
+    for (uint32_t i = 0; i < numElements; i++) {
+        EXgenericFlow_t genericFlow;
+        memcpy(&genericFlow, data + (size_t)i * sizeof(EXgenericFlow_t), sizeof(EXgenericFlow_t));
+        if (i == 0) msecBase = genericFlow.msecFirst;
+        out = PutVarint(out, ZigZag(genericFlow.msecFirst - msecBase));
+        out = PutVarint(out, ZigZag(genericFlow.msecLast - genericFlow.msecFirst));
+        out = PutVarint(out, ZigZag(genericFlow.msecReceived - genericFlow.msecFirst));
+        out = PutVarint(out, genericFlow.inPackets);
+        out = PutVarint(out, genericFlow.inBytes);
+        memcpy(out, (void *)&genericFlow + OFFsrcPort, tailSize);
+        out += tailSize;
+    }
+    uint32_t dataSize = out - encoded;
+    uint32_t compactSize = sizeof(compactHeader_t) + Align8(dataSize);
+    if (compactSize >= rawSize) {
+        free(encoded);
+        return;
+    }
+
+    // move the following columns and insert the compact data
+    uint8_t *rawEnd = data + rawSize;
+    uint32_t tail = (base + columnBlock->size) - rawEnd;
+    memmove(data + compactSize, rawEnd, tail);
+    compactHeader_t *compactHeader = (compactHeader_t *)data;
+    *compactHeader = (compactHeader_t){.msecBase = msecBase, .dataSize = dataSize};
+    memcpy(data + sizeof(compactHeader_t), encoded, dataSize);
+    memset(data + sizeof(compactHeader_t) + dataSize, 0, Align8(dataSize) - dataSize);
+    columnHeader->extID |= COLUMN_COMPACT;
+    columnBlock->size -= rawSize - compactSize;
+    free(encoded);
+
+}  // End of CompactGenericColumn
+
+/*
+ * Convert the V3 records of a type 3 block into a columnar type 5 block.
+ * If compact is set, the EXgenericFlow column is encoded compact.
+ * Returns 0, if the block can not be stored columnar, e.g. it contains
+ * other records than V3 records or variable length extensions.
+ */
+int ColumnarBlock(const dataBlock_t *v3Block, dataBlock_t *columnBlock, int compact) {
+    if (v3Block->type != DATA_BLOCK_TYPE_3 || v3Block->NumRecords == 0) return 0;
+
+    uint32_t numElements[MAXEXTENSIONS] = {0};
+    uint32_t numRecords = v3Block->NumRecords;
+
+    // verify all records and count the elements of each extension
+    const record_header_t *record = GetCursor(v3Block);
+    uint32_t sumSize = 0;
+    for (uint32_t i = 0; i < numRecords; i++) {
+        if (record->size < sizeof(recordHeaderV3_t) || (sumSize + record->size) > v3Block->size) return 0;
+        if (record->type != V3Record) return 0;
+        sumSize += record->size;
+
+        const recordHeaderV3_t *recordHeaderV3 = (const recordHeaderV3_t *)record;
+        uint64_t present = 0;
+        uint32_t size = sizeof(recordHeaderV3_t);
+        const elementHeader_t *elementHeader = (const elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+        for (int j = 0; j < recordHeaderV3->numElements; j++) {
+            if ((size + sizeof(elementHeader_t)) > record->size) return 0;
+            uint32_t extID = elementHeader->type;
+            if (extID == 0 || extID >= MAXEXTENSIONS || (present & ExtensionBit(extID))) return 0;
+            // only fixed size extensions
+            if (elementHeader->length != extensionTable[extID].size || elementHeader->length <= sizeof(elementHeader_t)) return 0;
+            size += elementHeader->length;
+            if (size > record->size) return 0;
+            present |= ExtensionBit(extID);
+            numElements[extID]++;
+            elementHeader = (const elementHeader_t *)((void *)elementHeader + elementHeader->length);
+        }
+        if (size != record->size) return 0;
+        record = (const record_header_t *)((void *)record + record->size);
+    }
+
+    // calculate column offsets
+    uint32_t offset[MAXEXTENSIONS];
+    uint32_t blockSize = sizeof(columnHeader_t) + Align8(numRecords * sizeof(recordHeaderV3_t));
+    for (int extID = 1; extID < MAXEXTENSIONS; extID++) {
+        if (numElements[extID] == 0) continue;
+        offset[extID] = blockSize;
+        uint32_t elementSize = extensionTable[extID].size - sizeof(elementHeader_t);
+        blockSize += sizeof(columnHeader_t) + BitmapSize(numRecords) + Align8(numElements[extID] * elementSize);
+    }
+    if (blockSize > (BUFFSIZE - sizeof(dataBlock_t))) return 0;
+
+    uint8_t *base = GetCursor(columnBlock);
+    memset(base, 0, blockSize);
+
+    // setup column headers
+    columnHeader_t *columnHeader = (columnHeader_t *)base;
+    *columnHeader = (columnHeader_t){.extID = 0, .elementSize = sizeof(recordHeaderV3_t), .numElements = numRecords};
+    recordHeaderV3_t *headerColumn = (recordHeaderV3_t *)(base + sizeof(columnHeader_t));
+
+    uint64_t *bitmap[MAXEXTENSIONS];
+    uint8_t *data[MAXEXTENSIONS];
+    for (int extID = 1; extID < MAXEXTENSIONS; extID++) {
+        if (numElements[extID] == 0) continue;
+        columnHeader = (columnHeader_t *)(base + offset[extID]);
+        *columnHeader = (columnHeader_t){
+            .extID = extID, .elementSize = extensionTable[extID].size - sizeof(elementHeader_t), .numElements = numElements[extID]};
+        bitmap[extID] = (uint64_t *)(base + offset[extID] + sizeof(columnHeader_t));
+        data[extID] = (uint8_t *)bitmap[extID] + BitmapSize(numRecords);
+    }
+
+    // distribute the records into the columns
+    record = GetCursor(v3Block);
+    for (uint32_t i = 0; i < numRecords; i++) {
+        const recordHeaderV3_t *recordHeaderV3 = (const recordHeaderV3_t *)record;
+        headerColumn[i] = *recordHeaderV3;
+
+        const elementHeader_t *elementHeader = (const elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+        for (int j = 0; j < recordHeaderV3->numElements; j++) {
+            uint32_t extID = elementHeader->type;
+            uint32_t elementSize = elementHeader->length - sizeof(elementHeader_t);
+            bitmap[extID][i >> 6] |= 1ULL << (i & 0x3F);
+            memcpy(data[extID], (void *)elementHeader + sizeof(elementHeader_t), elementSize);
+            data[extID] += elementSize;
+            elementHeader = (const elementHeader_t *)((void *)elementHeader + elementHeader->length);
+        }
+        record = (const record_header_t *)((void *)record + record->size);
+    }
+
+    columnBlock->NumRecords = numRecords;
+    columnBlock->size = blockSize;
+    columnBlock->type = DATA_BLOCK_TYPE_5;
+    columnBlock->flags = 0;
+
+    if (compact) CompactGenericColumn(columnBlock);
+
+    return 1;
+
+}  // End of ColumnarBlock
+
+// parse and verify the columns of a columnar block
+static int ParseColumns(const dataBlock_t *columnBlock, column_t *columns, uint32_t *numColumns) {
+    const uint8_t *base = GetCursor(columnBlock);
+    uint32_t numRecords = columnBlock->NumRecords;
+    uint32_t blockSize = columnBlock->size;
+
+    uint32_t offset = 0;
+    uint32_t num = 0;
+    uint32_t lastID = 0;
+    while (offset < blockSize) {
+        if ((offset + sizeof(columnHeader_t)) > blockSize || num == MAXEXTENSIONS) return 0;
+        const columnHeader_t *columnHeader = (const columnHeader_t *)(base + offset);
+        offset += sizeof(columnHeader_t);
+
+        column_t *column = &columns[num];
+        *column = (column_t){.extID = columnHeader->extID & ~COLUMN_COMPACT,
+                             .elementSize = columnHeader->elementSize,
+                             .numElements = columnHeader->numElements,
+                             .compact = (columnHeader->extID & COLUMN_COMPACT) != 0};
+        if (num == 0) {
+            // header column
+            if (column->extID != 0 || column->elementSize != sizeof(recordHeaderV3_t) || column->numElements != numRecords) return 0;
+        } else {
+            if (column->extID <= lastID || column->extID >= MAXEXTENSIONS || column->numElements > numRecords) return 0;
+            if ((column->elementSize + sizeof(elementHeader_t)) != extensionTable[column->extID].size) return 0;
+            if ((offset + BitmapSize(numRecords)) > blockSize) return 0;
+            column->bitmap = (const uint64_t *)(base + offset);
+            offset += BitmapSize(numRecords);
+        }
+        if (column->compact) {
+            if (column->extID != EXgenericFlowID || column->elementSize != sizeof(EXgenericFlow_t)) return 0;
+            if ((offset + sizeof(compactHeader_t)) > blockSize) return 0;
+            const compactHeader_t *compactHeader = (const compactHeader_t *)(base + offset);
+            offset += sizeof(compactHeader_t);
+            uint64_t dataSize = Align8((uint64_t)compactHeader->dataSize);
+            if ((offset + dataSize) > blockSize) return 0;
+            column->msecBase = compactHeader->msecBase;
+            column->data = base + offset;
+            column->end = column->data + compactHeader->dataSize;
+            offset += dataSize;
+            lastID = column->extID;
+            num++;
+            continue;
+        }
+        uint64_t dataSize = Align8((uint64_t)column->numElements * column->elementSize);
+        if ((offset + dataSize) > blockSize) return 0;
+        column->data = base + offset;
+        offset += dataSize;
+        lastID = column->extID;
+        num++;
+    }
+    if (num == 0) return 0;
+
+    *numColumns = num;
+    return 1;
+
+}  // End of ParseColumns
+
+// return the next element of a column, or NULL for a corrupt column
+static const uint8_t *NextElement(column_t *column) {
+    if (column->next == column->numElements) return NULL;
+    if (!column->compact) return column->data + (size_t)column->next++ * column->elementSize;
+
+    EXgenericFlow_t *genericFlow = &column->genericFlow;
+    uint64_t msecFirst, msecLast, msecReceived;
+    if (!GetVarint(&column->data, column->end, &msecFirst) || !GetVarint(&column->data, column->end, &msecLast) ||
+        !GetVarint(&column->data, column->end, &msecReceived) || !GetVarint(&column->data, column->end, &genericFlow->inPackets) ||
+        !GetVarint(&column->data, column->end, &genericFlow->inBytes))
+        return NULL;
+    genericFlow->msecFirst = column->msecBase + UnZigZag(msecFirst);
+    genericFlow->msecLast = genericFlow->msecFirst + UnZigZag(msecLast);
+    genericFlow->msecReceived = genericFlow->msecFirst + UnZigZag(msecReceived);
+
+    uint32_t tailSize = sizeof(EXgenericFlow_t) - OFFsrcPort;
+    if ((column->end - column->data) < tailSize) return NULL;
+    memcpy((void *)genericFlow + OFFsrcPort, column->data, tailSize);
+    column->data += tailSize;
+    column->next++;
+    return (const uint8_t *)genericFlow;
+
+}  // End of NextElement
+
+/*
+ * Expand a columnar type 5 block into V3 records of a type 3 block.
+ * Only the extensions in extMask are materialized. Returns 0 for a corrupt block.
+ */
+int ExpandColumnarBlock(const dataBlock_t *columnBlock, dataBlock_t *v3Block, uint64_t extMask) {
+    column_t columns[MAXEXTENSIONS];
+    uint32_t numColumns;
+    if (!ParseColumns(columnBlock, columns, &numColumns)) return 0;
+
+    const recordHeaderV3_t *headerColumn = (const recordHeaderV3_t *)columns[0].data;
+    uint32_t numRecords = columnBlock->NumRecords;
+    uint8_t *out = GetCursor(v3Block);
+    uint8_t *end = out + (BUFFSIZE - sizeof(dataBlock_t));
+    uint8_t *start = out;
+
+    for (uint32_t i = 0; i < numRecords; i++) {
+        if ((out + sizeof(recordHeaderV3_t)) > end) return 0;
+        recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)out;
+        *recordHeaderV3 = headerColumn[i];
+        recordHeaderV3->type = V3Record;
+        recordHeaderV3->numElements = 0;
+        uint32_t size = sizeof(recordHeaderV3_t);
+
+        for (uint32_t c = 1; c < numColumns; c++) {
+            column_t *column = &columns[c];
+            if ((column->bitmap[i >> 6] & (1ULL << (i & 0x3F))) == 0) continue;
+            const uint8_t *element = NextElement(column);
+            if (!element) return 0;
+            if ((extMask & ExtensionBit(column->extID)) == 0) continue;
+
+            uint32_t length = column->elementSize + sizeof(elementHeader_t);
+            if ((out + size + length) > end || (size + length) > 0xFFFF) return 0;
+            elementHeader_t *elementHeader = (elementHeader_t *)(out + size);
+            elementHeader->type = column->extID;
+            elementHeader->length = length;
+            memcpy(out + size + sizeof(elementHeader_t), element, column->elementSize);
+            size += length;
+            recordHeaderV3->numElements++;
+        }
+        recordHeaderV3->size = size;
+        out += size;
+    }
+
+    v3Block->NumRecords = numRecords;
+    v3Block->size = out - start;
+    v3Block->type = DATA_BLOCK_TYPE_3;
+    v3Block->flags = 0;
+
+    return 1;
+
+}  // End of ExpandColumnarBlock
+
+// time range of all flows in a columnar block. Returns 0 for a corrupt block
+int ColumnarTimeRange(const dataBlock_t *columnBlock, uint64_t *msecFirst, uint64_t *msecLast) {
+    column_t columns[MAXEXTENSIONS];
+    uint32_t numColumns;
+    if (!ParseColumns(columnBlock, columns, &numColumns)) return 0;
+
+    for (uint32_t c = 1; c < numColumns; c++) {
+        column_t *column = &columns[c];
+        if (column->extID != EXgenericFlowID) continue;
+        for (uint32_t i = 0; i < column->numElements; i++) {
+            const uint8_t *element = NextElement(column);
+            if (!element) return 0;
+            EXgenericFlow_t genericFlow;
+            memcpy(&genericFlow, element, sizeof(EXgenericFlow_t));
+            if (genericFlow.msecFirst < *msecFirst) *msecFirst = genericFlow.msecFirst;
+            if (genericFlow.msecLast > *msecLast) *msecLast = genericFlow.msecLast;
+        }
+    }
+    return 1;
+
+}  // End of ColumnarTimeRange
+
+// add all flows of the columnar block to the block summary
+int ColumnarSummary(const dataBlock_t *columnBlock, blockSummary_t *blockSummary) {
+    column_t columns[MAXEXTENSIONS];
+    uint32_t numColumns;
+    if (!ParseColumns(columnBlock, columns, &numColumns)) return 0;
+
+    uint32_t numFlows = 0;
+    for (uint32_t c = 1; c < numColumns; c++) {
+        column_t *column = &columns[c];
+        if (column->extID != EXgenericFlowID) continue;
+        for (uint32_t i = 0; i < column->numElements; i++) {
+            const uint8_t *element = NextElement(column);
+            if (!element) return 0;
+            EXgenericFlow_t genericFlow;
+            memcpy(&genericFlow, element, sizeof(EXgenericFlow_t));
+            BlockSummaryAdd(blockSummary, &genericFlow);
+        }
+        numFlows = column->numElements;
+    }
+    if (numFlows != columnBlock->NumRecords) blockSummary->flags &= ~FLAG_SUMMARY_ALLFLOWS;
+    return 1;
+
+}  // End of ColumnarSummary
+
+// add the exporters and routers of all records of the columnar block to the block bitmap
+int ColumnarBitmap(const dataBlock_t *columnBlock, blockBitmap_t *blockBitmap) {
+    column_t columns[MAXEXTENSIONS];
+    uint32_t numColumns;
+    if (!ParseColumns(columnBlock, columns, &numColumns)) return 0;
+
+    for (uint32_t i = 0; i < columns[0].numElements; i++) {
+        recordHeaderV3_t recordHeaderV3;
+        memcpy(&recordHeaderV3, columns[0].data + (size_t)i * columns[0].elementSize, sizeof(recordHeaderV3_t));
+        BlockBitmapAddExporter(blockBitmap, recordHeaderV3.exporterID);
+    }
+    for (uint32_t c = 1; c < numColumns; c++) {
+        column_t *column = &columns[c];
+        if (column->extID == EXipReceivedV4ID) {
+            for (uint32_t i = 0; i < column->numElements; i++) {
+                EXipReceivedV4_t ipReceivedV4;
+                memcpy(&ipReceivedV4, column->data + (size_t)i * column->elementSize, sizeof(EXipReceivedV4_t));
+                BlockBitmapAddRouter(blockBitmap, ipReceivedV4.ip);
+            }
+        } else if (column->extID == EXipReceivedV6ID) {
+            for (uint32_t i = 0; i < column->numElements; i++) {
+                EXipReceivedV6_t ipReceivedV6;
+                memcpy(&ipReceivedV6, column->data + (size_t)i * column->elementSize, sizeof(EXipReceivedV6_t));
+                BlockBitmapAddRouter(blockBitmap, ipReceivedV6.ip[0]);
+                BlockBitmapAddRouter(blockBitmap, ipReceivedV6.ip[1]);
+            }
+        }
+    }
+    return 1;
+
+}  // End of ColumnarBitmap
+
+// add the IP addresses of all flows in the columnar block to the bloom filter
+int ColumnarAddIPs(const dataBlock_t *columnBlock, ipBloom_t *ipBloom) {
+    column_t columns[MAXEXTENSIONS];
+    uint32_t numColumns;
+    if (!ParseColumns(columnBlock, columns, &numColumns)) return 0;
+
+    for (uint32_t c = 1; c < numColumns; c++) {
+        column_t *column = &columns[c];
+        if (column->extID == EXipv4FlowID) {
+            for (uint32_t i = 0; i < column->numElements; i++) {
+                EXipv4Flow_t ipv4Flow;
+                memcpy(&ipv4Flow, column->data + (size_t)i * column->elementSize, sizeof(EXipv4Flow_t));
+                IPBloomAdd(ipBloom, ipv4Flow.srcAddr, PF_INET);
+                IPBloomAdd(ipBloom, ipv4Flow.dstAddr, PF_INET);
+            }
+        } else if (column->extID == EXipv6FlowID) {
+            for (uint32_t i = 0; i < column->numElements; i++) {
+                EXipv6Flow_t ipv6Flow;
+                memcpy(&ipv6Flow, column->data + (size_t)i * column->elementSize, sizeof(EXipv6Flow_t));
+                IPBloomAdd(ipBloom, ipv6Flow.srcAddr[0], PF_INET6);
+                IPBloomAdd(ipBloom, ipv6Flow.dstAddr[0], PF_INET6);
+            }
+        }
+    }
+    return 1;
+
+}  // End of ColumnarAddIPs
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NFCOLUMN_H
+#define _NFCOLUMN_H 1
+
+#include <stdint.h>
+
+#include "nffileV2.h"
+#include "nfxV3.h"
+
+/*
+ * Columnar data block - DATA_BLOCK_TYPE_5
+ * =======================================
+ * A columnar block holds the same V3 records as a type 3 block, but stores the
+ * extensions column wise. Each column starts with a column header:
+ *
+ *   +---------------+-----------------+----------------------------+
+ *   | column header | presence bitmap | elements of all records    |
+ *   +---------------+-----------------+----------------------------+
+ *
+ * Column 0 is the header column with extID 0. It holds the recordHeaderV3_t
+ * of all NumRecords records and has no presence bitmap.
+ * Each further column holds one extension in ascending extID order. Bit i of
+ * the presence bitmap is set, if record i contains the extension. The bitmap
+ * has NumRecords bits in uint64_t words. The elements follow without element
+ * header in record order. Bitmap and elements are padded to 8 bytes.
+ *
+ * Only blocks with V3 records and fixed size extensions are stored columnar.
+ * Records are expanded into a type 3 block in ascending extension order.
+ *
+ * The EXgenericFlow column may be stored compact, flagged by COLUMN_COMPACT in
+ * the extID. The bitmap is followed by a compact header and the encoded elements:
+ * msecFirst as delta to msecBase, msecLast and msecReceived as delta to msecFirst,
+ * all zigzag encoded, and inPackets and inBytes as varints, followed by the
+ * remaining bytes of the element from srcPort on unchanged.
+ */
+typedef struct columnHeader_s {
+    uint16_t extID;        // extension ID, 0 for the header column
+#define COLUMN_COMPACT 0x8000
+    uint16_t elementSize;  // size of one element without element header
+    uint32_t numElements;  // number of elements in this column
+} columnHeader_t;
+
+typedef struct compactHeader_s {
+    uint64_t msecBase;  // msecFirst of the first element
+    uint32_t dataSize;  // size of the encoded elements
+    uint32_t fill;
+} compactHeader_t;
+
+int ColumnarBlock(const dataBlock_t *v3Block, dataBlock_t *columnBlock, int compact);
+
+int ExpandColumnarBlock(const dataBlock_t *columnBlock, dataBlock_t *v3Block, uint64_t extMask);
+
+int ColumnarTimeRange(const dataBlock_t *columnBlock, uint64_t *msecFirst, uint64_t *msecLast);
+
+int ColumnarSummary(const dataBlock_t *columnBlock, blockSummary_t *blockSummary);
+
+int ColumnarBitmap(const dataBlock_t *columnBlock, blockBitmap_t *blockBitmap);
+
+struct ipBloom_s;
+int ColumnarAddIPs(const dataBlock_t *columnBlock, struct ipBloom_s *ipBloom);
+
+#endif  // _NFCOLUMN_H
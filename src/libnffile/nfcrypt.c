@@ -0,0 +1,227 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "nfcrypt.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#endif
+
+#include "conf/nfconf.h"
+#include "util.h"
+
+#define KEYLEN 32
+
+static uint8_t cryptKey[KEYLEN];
+static int keyLoaded = 0;
+
+// read a key of 32 raw bytes or 64 hex digits
+static int LoadKey(char *keyFile) {
+    FILE *fp = fopen(keyFile, "r");
+    if (!fp) {
+        LogError("Open key file %s: %s", keyFile, strerror(errno));
+        return 0;
+    }
+    char buff[256];
+    size_t len = fread(buff, 1, sizeof(buff), fp);
+    fclose(fp);
+
+    if (len == KEYLEN) {
+        memcpy(cryptKey, buff, KEYLEN);
+        return 1;
+    }
+
+    int numDigits = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (isspace(buff[i])) continue;
+        if (!isxdigit(buff[i]) || numDigits == 2 * KEYLEN) {
+            LogError("Key file %s: expected %d raw bytes or %d hex digits", keyFile, KEYLEN, 2 * KEYLEN);
+            return 0;
+        }
+        int nibble = isdigit(buff[i]) ? buff[i] - '0' : tolower(buff[i]) - 'a' + 10;
+        if ((numDigits & 1) == 0)
+            cryptKey[numDigits >> 1] = nibble << 4;
+        else
+            cryptKey[numDigits >> 1] |= nibble;
+        numDigits++;
+    }
+    if (numDigits != 2 * KEYLEN) {
+        LogError("Key file %s: expected %d raw bytes or %d hex digits", keyFile, KEYLEN, 2 * KEYLEN);
+        return 0;
+    }
+    return 1;
+
+}  // End of LoadKey
+
+int CryptInit(void) {
+    if (keyLoaded) return 1;
+
+    char *keyFile = ConfGetString("encryption.keyfile");
+    if (!keyFile) return 1;
+
+#ifdef HAVE_OPENSSL
+    keyLoaded = LoadKey(keyFile);
+    free(keyFile);
+    return keyLoaded;
+#else
+    LogError("Encryption key %s set, but encryption not compiled in", keyFile);
+    free(keyFile);
+    return 0;
+#endif
+
+}  // End of CryptInit
+
+int CryptEnabled(void) { return keyLoaded; }
+
+#ifdef HAVE_OPENSSL
+// additional authenticated data - the block header fields, not changed on disk
+static void BlockAAD(const dataBlock_t *block, uint8_t *aad) {
+    memcpy(aad, &block->NumRecords, sizeof(uint32_t));
+    memcpy(aad + sizeof(uint32_t), &block->type, sizeof(uint16_t));
+}  // End of BlockAAD
+#endif
+
+int Encrypt_Block(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size) {
+#ifdef HAVE_OPENSSL
+    if (!keyLoaded) {
+        LogError("Encrypt_Block() no encryption key");
+        return -1;
+    }
+    if ((sizeof(dataBlock_t) + in_block->size + CRYPT_OVERHEAD) > block_size) {
+        LogError("Encrypt_Block() block size %u too large", in_block->size);
+        return -1;
+    }
+
+    const uint8_t *in = (const uint8_t *)((void *)in_block + sizeof(dataBlock_t));
+    uint8_t *out = (uint8_t *)((void *)out_block + sizeof(dataBlock_t));
+    uint8_t *iv = out + in_block->size;
+    uint8_t *tag = iv + CRYPT_IVLEN;
+    if (RAND_bytes(iv, CRYPT_IVLEN) != 1) {
+        LogError("RAND_bytes() failed in %s line %d", __FILE__, __LINE__);
+        return -1;
+    }
+
+    uint8_t aad[6];
+    BlockAAD(in_block, aad);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        LogError("EVP_CIPHER_CTX_new() failed in %s line %d", __FILE__, __LINE__);
+        return -1;
+    }
+    int len = 0, outLen = 0;
+    int ok = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+             EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, CRYPT_IVLEN, NULL) == 1 &&
+             EVP_EncryptInit_ex(ctx, NULL, NULL, cryptKey, iv) == 1 && EVP_EncryptUpdate(ctx, NULL, &len, aad, sizeof(aad)) == 1 &&
+             EVP_EncryptUpdate(ctx, out, &len, in, in_block->size) == 1;
+    outLen = len;
+    ok = ok && EVP_EncryptFinal_ex(ctx, out + outLen, &len) == 1;
+    outLen += len;
+    ok = ok && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, CRYPT_TAGLEN, tag) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+
+    if (!ok || outLen != (int)in_block->size) {
+        LogError("Encrypt_Block() encryption failed");
+        return -1;
+    }
+
+    // copy header
+    *out_block = *in_block;
+    out_block->size = in_block->size + CRYPT_OVERHEAD;
+
+    return 1;
+#else
+    LogError("Encrypt_Block() encryption not compiled in");
+    return -1;
+#endif
+
+}  // End of Encrypt_Block
+
+int Decrypt_Block(dataBlock_t *in_block, dataBlock_t *out_block) {
+#ifdef HAVE_OPENSSL
+    if (!keyLoaded) {
+        LogError("Decrypt_Block() no encryption key. Set encryption.keyfile");
+        return -1;
+    }
+    if (in_block->size < CRYPT_OVERHEAD) {
+        LogError("Decrypt_Block() block size %u too small", in_block->size);
+        return -1;
+    }
+
+    uint32_t size = in_block->size - CRYPT_OVERHEAD;
+    const uint8_t *in = (const uint8_t *)((void *)in_block + sizeof(dataBlock_t));
+    uint8_t *out = (uint8_t *)((void *)out_block + sizeof(dataBlock_t));
+    uint8_t *iv = (uint8_t *)in + size;
+    uint8_t *tag = iv + CRYPT_IVLEN;
+
+    uint8_t aad[6];
+    BlockAAD(in_block, aad);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        LogError("EVP_CIPHER_CTX_new() failed in %s line %d", __FILE__, __LINE__);
+        return -1;
+    }
+    int len = 0, outLen = 0;
+    int ok = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+             EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, CRYPT_IVLEN, NULL) == 1 &&
+             EVP_DecryptInit_ex(ctx, NULL, NULL, cryptKey, iv) == 1 && EVP_DecryptUpdate(ctx, NULL, &len, aad, sizeof(aad)) == 1 &&
+             EVP_DecryptUpdate(ctx, out, &len, in, size) == 1 && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, CRYPT_TAGLEN, tag) == 1;
+    outLen = len;
+    // verifies the tag
+    ok = ok && EVP_DecryptFinal_ex(ctx, out + outLen, &len) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+
+    if (!ok) {
+        LogError("Decrypt_Block() authentication failed - wrong key or corrupt block");
+        return -1;
+    }
+
+    // copy header
+    *out_block = *in_block;
+    out_block->size = size;
+
+    return 1;
+#else
+    LogError("Decrypt_Block() encryption not compiled in");
+    return -1;
+#endif
+
+}  // End of Decrypt_Block
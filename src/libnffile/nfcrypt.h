@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _NFCRYPT_H
+#define _NFCRYPT_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nffileV2.h"
+
+/*
+ * AES-256-GCM encryption of data blocks. A block is encrypted after compression.
+ * The encrypted data is followed by the random IV and the GCM tag:
+ *
+ *   +------------+-------------------+--------+---------+
+ *   |Blockheader | encrypted data    | IV 12b | tag 16b |
+ *   +------------+-------------------+--------+---------+
+ *
+ * NumRecords and type of the block header are authenticated with the data.
+ * The key is read from the file set by encryption.keyfile in the config file.
+ */
+
+#define CRYPT_IVLEN 12
+#define CRYPT_TAGLEN 16
+#define CRYPT_OVERHEAD (CRYPT_IVLEN + CRYPT_TAGLEN)
+
+int CryptInit(void);
+
+int CryptEnabled(void);
+
+int Encrypt_Block(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
+
+int Decrypt_Block(dataBlock_t *in_block, dataBlock_t *out_block);
+
+#endif  // _NFCRYPT_H
@@ -42,6 +42,7 @@
 #endif
 
 #ifdef HAVE_ZSTD
+#include <zdict.h>
 #include <zstd.h>
 #endif
 
@@ -50,11 +51,16 @@
 #include <lz4hc.h>
 #endif
 
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdatomic.h>
@@ -62,11 +68,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -76,9 +84,18 @@
 #include "lz4hc.h"
 #endif
 #include "barrier.h"
+#include "catalog.h"
+#include "crc32c.h"
+#include "nfcrypt.h"
+#include "ipbloom.h"
 #include "minilzo.h"
+#include "nfconf.h"
+#include "nfcolumn.h"
+#include "nfmerge.h"
 #include "nfdump.h"
 #include "nffileV2.h"
+#include "payload.h"
+#include "rollup.h"
 #include "util.h"
 
 // LZO params
@@ -92,12 +109,51 @@
 
 #define COMPRESSION_TYPE(c) ((c) & 0xFFFF)
 #define COMPRESSION_LEVEL(c) (((c) >> 16) & 0xFFFF)
+// level flag: adapt the level to the writer load, the level is the upper limit
+#define COMPRESSION_AUTO 0x80
+#define AUTOLEVEL_DEFAULT 9
 
 static const char *nf_creator[MAX_CREATOR] = {"unknown", "nfcapd",    "nfpcapd",   "sfcapd",    "nfdump",
-                                              "nfanon",  "nfprofile", "geolookup", "ft2nfdump", "torlookup"};
+                                              "nfanon",  "nfprofile", "geolookup", "ft2nfdump", "torlookup",
+                                              "nfcompact"};
 
 static unsigned NumWorkers = DEFAULTWORKERS;
 
+// zstd dictionary - must fit into a single appendix record
+#define MAXDICTSIZE (0xFFFF - sizeof(recordHeader_t) - 8)
+typedef struct zstdDict_s {
+    void *dict;
+    size_t size;
+    unsigned dictID;
+#ifdef HAVE_ZSTD
+    ZSTD_CDict *cdict;  // created for writing only
+    ZSTD_DDict *ddict;
+#endif
+} zstdDict_t;
+
+// dictionary for new ZSTDDICT_COMPRESSED files - config zstd.dict
+static zstdDict_t *writeDict = NULL;
+
+#ifdef HAVE_LIBURING
+// max number of blocks in flight
+#define URINGDEPTH 8
+
+typedef struct uringSlot_s {
+    dataBlock_t *block;  // block in flight - released after completion
+    off_t offset;        // file offset of the block
+    size_t size;         // number of bytes to write
+    uint16_t flags;      // original block flags
+} uringSlot_t;
+
+typedef struct nfUring_s {
+    struct io_uring ring;
+    off_t offset;  // file offset of the next block
+    uint32_t numFree;
+    uringSlot_t *freeSlot[URINGDEPTH];
+    uringSlot_t slot[URINGDEPTH];
+} nfUring_t;
+#endif
+
 /* function prototypes */
 static int LZO_initialize(void);
 
@@ -107,6 +163,14 @@ static int BZ2_initialize(void);
 
 static int ZSTD_initialize(void);
 
+static zstdDict_t *NewZstdDict(void *dict, size_t size);
+
+static int PrepareZstdDict(zstdDict_t *zstdDict, int level);
+
+static void FreeZstdDict(zstdDict_t *zstdDict);
+
+static zstdDict_t *LoadZstdDict(char *fileName);
+
 static int Compress_Block_LZO(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
 
 static int Uncompress_Block_LZO(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
@@ -117,15 +181,54 @@ static int Uncompress_Block_LZ4(dataBlock_t *in_block, dataBlock_t *out_block, s
 
 static int Compress_Block_BZ2(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
 
-static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, int level);
+static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, int level, zstdDict_t *zstdDict);
 
-static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
+static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, zstdDict_t *zstdDict);
 
 static int Uncompress_Block_BZ2(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
 
 static dataBlock_t *nfread(nffile_t *nffile);
 
-static int nfwrite(nffile_t *nffile, dataBlock_t *block_header);
+static dataBlock_t *nfreadMapped(nffile_t *nffile);
+
+static void MapFile(nffile_t *nffile);
+
+static int CachedFile(nffile_t *nffile);
+
+static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile);
+
+static nffile_t *StartReader(nffile_t *nffile);
+
+static nffile_t *OpenLiveFile(char *filename, nffile_t *nffile);
+
+static nffile_t *OpenFollowFile(char *filename, nffile_t *nffile);
+
+static void ReleaseMap(struct fileMap_s *fileMap);
+
+static int nfwrite(nffile_t *nffile, dataBlock_t *block_header, uint64_t seq);
+
+#ifdef HAVE_LIBURING
+static void UringOpen(nffile_t *nffile);
+
+static int UringWrite(nffile_t *nffile, dataBlock_t *block, uint16_t flags, size_t size, off_t *offset);
+
+static int UringReap(nffile_t *nffile, int wait);
+
+static void UringClose(nffile_t *nffile);
+#endif
+
+static int nfskip(nffile_t *nffile);
+
+static void IndexBlock(dataBlock_t *dataBlock, blockIndex_t *blockIndex, blockSummary_t *blockSummary, blockBitmap_t *blockBitmap,
+                       ipBloom_t *ipBloom);
+
+static void SortBlock(dataBlock_t *dataBlock);
+
+static int AddBlockIndex(nffile_t *nffile, blockIndex_t *blockIndex, uint32_t numEntries);
+
+static int AddBlockSummary(nffile_t *nffile, blockSummary_t *blockSummary, uint32_t numEntries);
+
+static int AddBlockBitmap(nffile_t *nffile, blockBitmap_t *blockBitmap, uint32_t numEntries);
 
 static int ReadAppendix(nffile_t *nffile);
 
@@ -139,16 +242,178 @@ static int QueryFileV1(int fd, fileHeaderV2_t *fileHeaderV2);
 
 static void UpdateStat(stat_record_t *s, stat_recordV1_t *sv1);
 
+__attribute__((noreturn)) static void *prefetchThread(void *arg);
+
 static queue_t *fileQueue = NULL;
 
+// files are prefetched by a helper thread, which stays PREFETCHFILES ahead of GetNextFile()
+#define PREFETCHFILES 4
+// number of bytes at the beginning of a file to read ahead
+#define PREFETCHSIZE (4 * 1024 * 1024)
+static queue_t *prefetchQueue = NULL;
+
+// time window in msec to skip blocks of files opened by GetNextFile()
+static uint64_t blockTwinFirst = 0;
+static uint64_t blockTwinLast = 0;
+
+// IP addresses of which at least one must be in a file, for any flow to match the filter
+// files with an IP bloom filter without any of them are skipped by GetNextFile()
+static ipKey_t *blockIPKeys = NULL;
+static uint32_t blockNumIPKeys = 0;
+
+// filter engine to test block summaries of files opened by GetNextFile()
+static summaryFilter_t blockSummaryFilter = NULL;
+static const void *blockSummaryEngine = NULL;
+
+// fraction of the data blocks read of files opened by GetNextFile(), scaled to 2^32. 0: all blocks
+static uint64_t blockSampleLimit = 0;
+
+// time window in seconds to read live sockets
+static uint32_t liveWindow = 0;
+
+// merge window in seconds to merge the sources -M in time order. 0: no merge
+static uint32_t mergeWindow = 0;
+
+// follow mode: files opened by GetNextFile() are read as they grow, across collector rotations
+static int followFile = 0;
+
+// mmap read mode: files opened by the reader are mapped and uncompressed blocks
+// are handed out as pointers into the mapping. Each block holds a reference on the
+// mapping, so it stays valid after the file is closed.
+typedef struct fileMap_s {
+    struct fileMap_s *next;
+    void *addr;
+    size_t size;
+    _Atomic uint32_t refCnt;
+    int cached;  // block cache image - see below
+} fileMap_t;
+
+static int useMapping = 0;
+static fileMap_t *fileMapList = NULL;
+static pthread_mutex_t fileMapMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// block cache: the uncompressed data blocks of entire files are kept in memory as an
+// image of 8 byte aligned blocks. A file opened by the reader, which matches a cached
+// file, is read from its image like a mapped file without read() and decompression.
+// The least recently used images are dropped, if the cache exceeds its max size.
+typedef struct cachedFile_s {
+    struct cachedFile_s *next;  // LRU list - most recently used first
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    fileMap_t *fileMap;
+} cachedFile_t;
+
+#define Align8(n) (((n) + 7) & ~7)
+
+static cachedFile_t *cachedFileList = NULL;
+static size_t blockCacheSize = 0;
+static size_t blockCacheMax = 0;
+
 /* function definitions */
 
+// initial depth of the file queues
 #define QueueSize 4
 
+// blocks read between two adaptions of the queue depth
+#define ADAPTBLOCKS 16
+
 static _Atomic unsigned blocksInUse;
 
+// pool of released data blocks, recycled by NewDataBlock
+#define MAXPOOLBLOCKS 16
+#define HUGEPAGESIZE (2 * 1024 * 1024)
+typedef struct nodePool_s {
+    pthread_mutex_t mutex;
+    unsigned numBlocks;
+    dataBlock_t *block[MAXPOOLBLOCKS];
+} nodePool_t;
+
+typedef struct blockPool_s {
+    int hugePages;
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    // blocks are recycled on the NUMA node of the calling thread
+    nodePool_t node[MAXNUMANODES];
+} blockPool_t;
+
+// decompression statistics - see GetCodecStat()
+static _Atomic uint64_t codecCounter[NUMCODECS][4];
+
+// compression statistics - see GetCompressStat()
+static _Atomic uint64_t compressCounter[NUMCODECS][4];
+
+// blocks queued for the nfwriter threads - see WriterBacklog()
+static _Atomic uint64_t writerBacklog = 0;
+
+// shared writer pool - see StartWriterPool(). Each block queued for a pooled file
+// puts one entry for its file into the pool queue. A pool writer pops the entry,
+// then the next block of the file with its write sequence, so the blocks of a file
+// are compressed in parallel, but written in order
+#define WRITERPOOLQUEUE 1024
+static struct writerPool_s {
+    queue_t *queue;       // files with a queued block
+    unsigned numThreads;  // 0: every file starts its own nfwriter threads
+} writerPool = {0};
+
+static blockPool_t blockPool = {.node[0 ... MAXNUMANODES - 1].mutex = PTHREAD_MUTEX_INITIALIZER};
+
+// memory budget of the data blocks queued in the read pipeline. The queue depths
+// adapt to the blocking of producers and consumers within this budget
+static struct pipelineBudget_s {
+    size_t budget;            // bytes
+    _Atomic unsigned queues;  // number of queues sharing the budget
+    unsigned poolBlocks;      // max released blocks kept per node pool
+} pipeline = {.budget = 256 * ONEMB, .queues = 1, .poolBlocks = MAXPOOLBLOCKS};
+
+// append a CRC32C to each written data block
+static int writeCRC = 0;
+
+// sort the flow records of each written data block - see SortBlock()
+static int sortBlocks = 0;
+
+// store blocks, which do not shrink by compression, uncompressed
+static int storeUncompressed = 0;
+
+// small write blocks - see blocksize.small. A file starts with small blocks and
+// is promoted to full size blocks, after it wrote smallPool.promote full small blocks.
+// Small blocks are allocated with some slack for the block checksum
+#define MAXSMALLBLOCKS 64
+#define SMALLBLOCKMIN (16 * 1024)
+#define SMALLBLOCKSLACK (64 * 1024)
+#define SMALLPROMOTE 4
+uint32_t smallBlockSize = 0;
+static struct smallPool_s {
+    pthread_mutex_t mutex;
+    uint32_t promote;
+    unsigned numBlocks;
+    dataBlock_t *block[MAXSMALLBLOCKS];
+} smallPool = {.mutex = PTHREAD_MUTEX_INITIALIZER, .promote = SMALLPROMOTE};
+
+// adaptive compression level of all files written with level auto
+// the level is adjusted once per second, to keep the writers within the cpu budget
+static struct autoLevel_s {
+    pthread_mutex_t mutex;
+    _Atomic int level;     // current level, -1 not yet set
+    int budget;            // max percent of writer cpu time used for compression
+    uint64_t windowStart;  // start of the current measurement window
+    uint64_t compressNsec; // compression time spent in the current window
+} autoLevel = {.mutex = PTHREAD_MUTEX_INITIALIZER, .level = -1, .budget = 50};
+
 int Init_nffile(int workers, queue_t *fileList) {
     fileQueue = fileList;
+    if (fileList && prefetchQueue == NULL) {
+        // GetNextFile() reads the files from the prefetch queue
+        prefetchQueue = queue_init(PREFETCHFILES);
+        pthread_t tid;
+        if (prefetchQueue && pthread_create(&tid, NULL, prefetchThread, (void *)fileList) == 0) {
+            pthread_detach(tid);
+            fileQueue = prefetchQueue;
+        } else {
+            LogError("Failed to start file prefetch thread - continue without");
+        }
+    }
     if (!LZO_initialize()) {
         LogError("Failed to initialize LZO");
         return 0;
@@ -167,12 +432,81 @@ int Init_nffile(int workers, queue_t *fileList) {
     }
 
     atomic_init(&blocksInUse, 0);
+    atomic_init(&blockPool.hits, 0);
+    atomic_init(&blockPool.misses, 0);
+#ifdef MADV_HUGEPAGE
+    blockPool.hugePages = ConfGetValue("hugepages") > 0;
+#endif
+
+    char *dictFile = ConfGetString("zstd.dict");
+    if (dictFile && writeDict == NULL) {
+        writeDict = LoadZstdDict(dictFile);
+        if (!writeDict) {
+            LogError("Failed to load zstd dictionary %s", dictFile);
+            free(dictFile);
+            return 0;
+        }
+    }
+    free(dictFile);
+
+    CRC32C_Init();
+    writeCRC = ConfGetValue("blockcrc") > 0;
+    if (ConfGetValue("blocksort") > 0) sortBlocks = 1;
+    storeUncompressed = ConfGetValue("compress.store") > 0;
+    if (!CryptInit()) return 0;
+
+    int budget = ConfGetValue("compress.budget");
+    if (budget > 0 && budget <= 100) autoLevel.budget = budget;
+
+    // small write block size in KB - default 0: full size blocks only
+    int smallSize = ConfGetValue("blocksize.small");
+    if (smallSize > 0) {
+        size_t size = (size_t)smallSize * 1024;
+        if (size < SMALLBLOCKMIN) size = SMALLBLOCKMIN;
+        smallBlockSize = size < WRITE_BUFFSIZE ? size : 0;
+        int promote = ConfGetValue("blocksize.promote");
+        if (promote > 0) smallPool.promote = promote;
+        dbg_printf("Small block size: %u, promote after %u blocks\n", smallBlockSize, smallPool.promote);
+    }
+
+    // pipeline memory budget in MB - default 1/16 of the physical memory, max 1GB
+    int memBudget = ConfGetValue("pipeline.memory");
+    if (memBudget > 0) {
+        pipeline.budget = (size_t)memBudget * ONEMB;
+    } else {
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long pageSize = sysconf(_SC_PAGESIZE);
+        if (pages > 0 && pageSize > 0) {
+            pipeline.budget = ((size_t)pages * (size_t)pageSize) >> 4;
+            if (pipeline.budget > 1024 * (size_t)ONEMB) pipeline.budget = 1024 * (size_t)ONEMB;
+        }
+    }
+    if (pipeline.budget < 4 * QueueSize * BUFFSIZE) pipeline.budget = 4 * QueueSize * BUFFSIZE;
+    // released blocks kept for reuse count against the budget as well
+    pipeline.poolBlocks = pipeline.budget / BUFFSIZE / 8;
+    if (pipeline.poolBlocks < 2) pipeline.poolBlocks = 2;
+    if (pipeline.poolBlocks > MAXPOOLBLOCKS) pipeline.poolBlocks = MAXPOOLBLOCKS;
+    dbg_printf("Pipeline memory budget: %zu MB, pool blocks: %u\n", pipeline.budget / ONEMB, pipeline.poolBlocks);
 
     NumWorkers = GetNumWorkers(workers);
     return 1;
 
 }  // End of Init_nffile
 
+// number of block queues of the running pipeline, which share the memory budget
+void PipelineQueues(unsigned numQueues) {
+    //
+    atomic_store(&pipeline.queues, numQueues ? numQueues : 1);
+}  // End of PipelineQueues
+
+// max depth of each queue within the pipeline memory budget
+unsigned QueueDepthMax(void) {
+    size_t depth = pipeline.budget / BUFFSIZE / atomic_load(&pipeline.queues);
+    if (depth < QueueSize) depth = QueueSize;
+    if (depth > QUEUEDEPTHMAX) depth = QUEUEDEPTHMAX;
+    return (unsigned)depth;
+}  // End of QueueDepthMax
+
 int ParseCompression(char *arg) {
     if (arg == NULL) {
         return LZO_COMPRESSED;
@@ -185,9 +519,16 @@ int ParseCompression(char *arg) {
     }
 
     int level = 0;
+    int autoLevel = 0;
     char *s = strchr(arg, ':');
     if (s) {
         *s++ = '\0';
+        // auto[:max level]
+        if (strncmp(s, "auto", 4) == 0) {
+            autoLevel = COMPRESSION_AUTO;
+            s += 4;
+            if (*s == ':') s++;
+        }
         while (*s && isdigit(*s)) {
             level = 10 * level + (*s++ - 0x30);
         }
@@ -205,11 +546,16 @@ int ParseCompression(char *arg) {
         arg[i] = tolower(arg[i]);
     }
 
+    if (autoLevel && strcmp(arg, "lz4") && strcmp(arg, "3") && strcmp(arg, "zstd") && strcmp(arg, "4")) {
+        LogError("Adaptive compression level requires lz4 or zstd");
+        return -1;
+    }
+
     if (strcmp(arg, "0") == 0) return NOT_COMPRESSED;
     if (strcmp(arg, "lzo") == 0 || strcmp(arg, "1") == 0) return LZO_COMPRESSED;
     if (strcmp(arg, "lz4") == 0 || strcmp(arg, "3") == 0) {
         if (level <= LZ4HC_CLEVEL_MAX) {
-            return (level << 16) | LZ4_COMPRESSED;
+            return ((level | autoLevel) << 16) | LZ4_COMPRESSED;
         } else {
             LogError("LZ4 max compression level is %d", LZ4HC_CLEVEL_MAX);
             return -1;
@@ -229,7 +575,22 @@ int ParseCompression(char *arg) {
     if (strcmp(arg, "zstd") == 0 || strcmp(arg, "4") == 0) {
 #ifdef HAVE_ZSTD
         if (level <= ZSTD_maxCLevel()) {
-            return (level << 16) | ZSTD_COMPRESSED;
+            return ((level | autoLevel) << 16) | ZSTD_COMPRESSED;
+        } else {
+            LogError("ZSTD max compression level is %d", ZSTD_maxCLevel());
+            return -1;
+        }
+    }
+#else
+        LogError("ZSTD compression not compiled in");
+        return -1;
+    }
+#endif
+
+    if (strcmp(arg, "zdict") == 0 || strcmp(arg, "5") == 0) {
+#ifdef HAVE_ZSTD
+        if (level <= ZSTD_maxCLevel()) {
+            return (level << 16) | ZSTDDICT_COMPRESSED;
         } else {
             LogError("ZSTD max compression level is %d", ZSTD_maxCLevel());
             return -1;
@@ -246,8 +607,115 @@ int ParseCompression(char *arg) {
 
 }  // End of ParseCompression
 
+void GetCodecStat(codecStat_t *codecStat) {
+    for (int i = 0; i < NUMCODECS; i++) {
+        codecStat[i].blocks = atomic_load_explicit(&codecCounter[i][0], memory_order_relaxed);
+        codecStat[i].inBytes = atomic_load_explicit(&codecCounter[i][1], memory_order_relaxed);
+        codecStat[i].outBytes = atomic_load_explicit(&codecCounter[i][2], memory_order_relaxed);
+        codecStat[i].nsec = atomic_load_explicit(&codecCounter[i][3], memory_order_relaxed);
+    }
+}  // End of GetCodecStat
+
+void GetCompressStat(codecStat_t *codecStat) {
+    for (int i = 0; i < NUMCODECS; i++) {
+        codecStat[i].blocks = atomic_load_explicit(&compressCounter[i][0], memory_order_relaxed);
+        codecStat[i].inBytes = atomic_load_explicit(&compressCounter[i][1], memory_order_relaxed);
+        codecStat[i].outBytes = atomic_load_explicit(&compressCounter[i][2], memory_order_relaxed);
+        codecStat[i].nsec = atomic_load_explicit(&compressCounter[i][3], memory_order_relaxed);
+    }
+}  // End of GetCompressStat
+
+uint64_t WriterBacklog(void) {
+    return atomic_load_explicit(&writerBacklog, memory_order_relaxed);
+}  // End of WriterBacklog
+
+static inline uint64_t codecNsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}  // End of codecNsec
+
+static inline void UpdateCodecStat(int compression, uint32_t inBytes, uint32_t outBytes, uint64_t nsec) {
+    if (compression < 0 || compression >= NUMCODECS) return;
+    atomic_fetch_add_explicit(&codecCounter[compression][0], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&codecCounter[compression][1], inBytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&codecCounter[compression][2], outBytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&codecCounter[compression][3], nsec, memory_order_relaxed);
+}  // End of UpdateCodecStat
+
+static inline void UpdateCompressStat(int compression, uint32_t inBytes, uint32_t outBytes, uint64_t nsec) {
+    if (compression < 0 || compression >= NUMCODECS) return;
+    atomic_fetch_add_explicit(&compressCounter[compression][0], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&compressCounter[compression][1], inBytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&compressCounter[compression][2], outBytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&compressCounter[compression][3], nsec, memory_order_relaxed);
+}  // End of UpdateCompressStat
+
+// returns the compression level for the next block of a file with adaptive level
+static inline int AutoLevel(nffile_t *nffile) {
+    int maxLevel = nffile->compression_level ? nffile->compression_level : AUTOLEVEL_DEFAULT;
+    // zstd level 0 is the default level, lz4 level 0 is the fast mode
+    int minLevel = nffile->file_header->compression == LZ4_COMPRESSED ? 0 : 1;
+    int level = atomic_load_explicit(&autoLevel.level, memory_order_relaxed);
+    if (level < 0 || level > maxLevel) return maxLevel;
+    return level < minLevel ? minLevel : level;
+
+}  // End of AutoLevel
+
+// account the compression time of a block and step the adaptive level down, if the
+// writers exceed the cpu budget or fall behind, and up again, if they are idle
+static void AdaptLevel(nffile_t *nffile, int level, uint64_t compressNsec) {
+    uint64_t now = codecNsec();
+    pthread_mutex_lock(&autoLevel.mutex);
+    if (autoLevel.windowStart == 0) autoLevel.windowStart = now;
+    autoLevel.compressNsec += compressNsec;
+
+    uint64_t window = now - autoLevel.windowStart;
+    if (window >= 1000000000LL) {
+        int maxLevel = nffile->compression_level ? nffile->compression_level : AUTOLEVEL_DEFAULT;
+        int minLevel = nffile->file_header->compression == LZ4_COMPRESSED ? 0 : 1;
+        // percent of the cpu time of all writers used for compression
+        unsigned numWriters = writerPool.numThreads ? writerPool.numThreads : NumWorkers;
+        uint64_t load = (100 * autoLevel.compressNsec) / (window * numWriters);
+        uint64_t backlog = WriterBacklog();
+        int newLevel = level;
+        if (load > (uint64_t)autoLevel.budget || backlog > 2 * numWriters) {
+            if (level > minLevel) newLevel = level - 1;
+        } else if (load < (uint64_t)(autoLevel.budget / 2) && backlog <= numWriters) {
+            if (level < maxLevel) newLevel = level + 1;
+        }
+        if (newLevel != level) {
+            dbg_printf("AdaptLevel - load: %llu%%, backlog: %llu, level: %d -> %d\n", (unsigned long long)load,
+                       (unsigned long long)backlog, level, newLevel);
+        }
+        atomic_store_explicit(&autoLevel.level, newLevel, memory_order_relaxed);
+        autoLevel.windowStart = now;
+        autoLevel.compressNsec = 0;
+    }
+    pthread_mutex_unlock(&autoLevel.mutex);
+
+}  // End of AdaptLevel
+
+// queue a block for the nfwriter threads or the writer pool
+static inline void QueueWriteBlock(nffile_t *nffile, dataBlock_t *dataBlock) {
+    atomic_fetch_add_explicit(&writerBacklog, 1, memory_order_relaxed);
+    if (nffile->pooled) {
+        pthread_mutex_lock(&nffile->wlock);
+        nffile->pending++;
+        pthread_mutex_unlock(&nffile->wlock);
+        queue_push(nffile->processQueue, dataBlock);
+        queue_push(writerPool.queue, nffile);
+    } else {
+        queue_push(nffile->processQueue, dataBlock);
+    }
+}  // End of QueueWriteBlock
+
 unsigned ReportBlocks(void) {
     unsigned inUse = atomic_load(&blocksInUse);
+    unsigned numBlocks = 0;
+    for (int i = 0; i < MAXNUMANODES; i++) numBlocks += blockPool.node[i].numBlocks;
+    LogVerbose("Block pool: %u free, %llu hits, %llu misses", numBlocks, (unsigned long long)atomic_load(&blockPool.hits),
+               (unsigned long long)atomic_load(&blockPool.misses));
     return inUse;
 }
 
@@ -464,14 +932,26 @@ static int Uncompress_Block_BZ2(dataBlock_t *in_block, dataBlock_t *out_block, s
 
 }  // End of Uncompress_Block_BZ2
 
-static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, int level) {
+static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, int level, zstdDict_t *zstdDict) {
 #ifdef HAVE_ZSTD
     const char *in = (const char *)((void *)in_block + sizeof(dataBlock_t));
     char *out = (char *)((void *)out_block + sizeof(dataBlock_t));
     int in_len = in_block->size;
 
-    if (level == 0) level = ZSTD_CLEVEL_DEFAULT;
-    int out_len = ZSTD_compress(out, block_size, in, in_len, level);
+    size_t out_len;
+    if (zstdDict && zstdDict->cdict) {
+        // the compression level is set by the dictionary
+        ZSTD_CCtx *cctx = ZSTD_createCCtx();
+        if (!cctx) {
+            LogError("ZSTD_createCCtx() error in %s line %d", __FILE__, __LINE__);
+            return -1;
+        }
+        out_len = ZSTD_compress_usingCDict(cctx, out, block_size, in, in_len, zstdDict->cdict);
+        ZSTD_freeCCtx(cctx);
+    } else {
+        if (level == 0) level = ZSTD_CLEVEL_DEFAULT;
+        out_len = ZSTD_compress(out, block_size, in, in_len, level);
+    }
 
     if (ZSTD_isError(out_len)) {
         LogError("Compress_Block_ZSTD() error compression aborted in %s line %d: LZ4 : buffer too small", __FILE__, __LINE__);
@@ -489,13 +969,29 @@ static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, si
 
 }  // End of Compress_Block_ZSTD
 
-static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size) {
+static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, zstdDict_t *zstdDict) {
 #ifdef HAVE_ZSTD
     const char *in = (const char *)((void *)in_block + sizeof(dataBlock_t));
     char *out = (char *)((void *)out_block + sizeof(dataBlock_t));
     int in_len = in_block->size;
 
-    size_t out_len = ZSTD_decompress(out, block_size, in, in_len);
+    size_t out_len;
+    unsigned dictID = ZSTD_getDictID_fromFrame(in, in_len);
+    if (dictID) {
+        if (!zstdDict || zstdDict->dictID != dictID) {
+            LogError("Uncompress_Block_ZSTD() error: zstd dictionary ID %u not available", dictID);
+            return -1;
+        }
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        if (!dctx) {
+            LogError("ZSTD_createDCtx() error in %s line %d", __FILE__, __LINE__);
+            return -1;
+        }
+        out_len = ZSTD_decompress_usingDDict(dctx, out, block_size, in, in_len, zstdDict->ddict);
+        ZSTD_freeDCtx(dctx);
+    } else {
+        out_len = ZSTD_decompress(out, block_size, in, in_len);
+    }
     if (ZSTD_isError(out_len)) {
         LogError("LZ4_decompress_safe() error compression aborted in %s line %d: LZ4 : buffer too small", __FILE__, __LINE__);
         return -1;
@@ -511,126 +1007,1018 @@ static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block,
 #endif
 }  // End of Uncompress_Block_ZSTD
 
-dataBlock_t *NewDataBlock(void) {
-    dataBlock_t *dataBlock = malloc(BUFFSIZE);
-    if (!dataBlock) {
+// create a zstd dictionary struct with a copy of dict
+static zstdDict_t *NewZstdDict(void *dict, size_t size) {
+#ifdef HAVE_ZSTD
+    unsigned dictID = ZSTD_getDictID_fromDict(dict, size);
+    if (dictID == 0 || size > MAXDICTSIZE) {
+        LogError("Invalid zstd dictionary - size: %zu, ID: %u", size, dictID);
+        return NULL;
+    }
+
+    zstdDict_t *zstdDict = calloc(1, sizeof(zstdDict_t));
+    if (!zstdDict) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    zstdDict->dict = malloc(size);
+    if (!zstdDict->dict) {
         LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(zstdDict);
+        return NULL;
+    }
+    memcpy(zstdDict->dict, dict, size);
+    zstdDict->size = size;
+    zstdDict->dictID = dictID;
+
+    zstdDict->ddict = ZSTD_createDDict(zstdDict->dict, size);
+    if (!zstdDict->ddict) {
+        LogError("ZSTD_createDDict() error in %s line %d", __FILE__, __LINE__);
+        FreeZstdDict(zstdDict);
+        return NULL;
+    }
+
+    return zstdDict;
+#else
+    LogError("ZSTD compression not compiled in");
+    return NULL;
+#endif
+
+}  // End of NewZstdDict
+
+// digest dictionary for compression with level
+static int PrepareZstdDict(zstdDict_t *zstdDict, int level) {
+#ifdef HAVE_ZSTD
+    if (zstdDict->cdict) return 1;
+
+    if (level == 0) level = ZSTD_CLEVEL_DEFAULT;
+    zstdDict->cdict = ZSTD_createCDict(zstdDict->dict, zstdDict->size, level);
+    if (!zstdDict->cdict) {
+        LogError("ZSTD_createCDict() error in %s line %d", __FILE__, __LINE__);
+        return 0;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+
+}  // End of PrepareZstdDict
+
+static void FreeZstdDict(zstdDict_t *zstdDict) {
+#ifdef HAVE_ZSTD
+    if (zstdDict->cdict) ZSTD_freeCDict(zstdDict->cdict);
+    if (zstdDict->ddict) ZSTD_freeDDict(zstdDict->ddict);
+#endif
+    free(zstdDict->dict);
+    free(zstdDict);
+
+}  // End of FreeZstdDict
+
+// load a zstd dictionary file, created by TrainZstdDictionary()
+static zstdDict_t *LoadZstdDict(char *fileName) {
+    struct stat stat_buf;
+    if (stat(fileName, &stat_buf)) {
+        LogError("stat() '%s': %s", fileName, strerror(errno));
+        return NULL;
+    }
+    if (stat_buf.st_size == 0 || stat_buf.st_size > MAXDICTSIZE) {
+        LogError("Invalid zstd dictionary size: %lld", (long long)stat_buf.st_size);
+        return NULL;
+    }
+
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        LogError("Error open file: %s", strerror(errno));
+        return NULL;
+    }
+
+    char dict[MAXDICTSIZE];
+    ssize_t ret = read(fd, dict, stat_buf.st_size);
+    close(fd);
+    if (ret != stat_buf.st_size) {
+        LogError("read() error in %s line %d: %s", __FILE__, __LINE__, ret < 0 ? strerror(errno) : "short read");
         return NULL;
     }
+
+    return NewZstdDict(dict, stat_buf.st_size);
+
+}  // End of LoadZstdDict
+
+dataBlock_t *NewDataBlock(void) {
+    dataBlock_t *dataBlock = NULL;
+    nodePool_t *nodePool = &blockPool.node[ThreadNode()];
+    pthread_mutex_lock(&nodePool->mutex);
+    if (nodePool->numBlocks) dataBlock = nodePool->block[--nodePool->numBlocks];
+    pthread_mutex_unlock(&nodePool->mutex);
+
+    if (dataBlock) {
+        atomic_fetch_add(&blockPool.hits, 1);
+    } else {
+        atomic_fetch_add(&blockPool.misses, 1);
+#ifdef MADV_HUGEPAGE
+        if (blockPool.hugePages) {
+            if (posix_memalign((void **)&dataBlock, HUGEPAGESIZE, BUFFSIZE) == 0) {
+                madvise((void *)dataBlock, BUFFSIZE, MADV_HUGEPAGE);
+            } else {
+                dataBlock = NULL;
+            }
+        } else
+#endif
+            dataBlock = malloc(BUFFSIZE);
+        if (!dataBlock) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return NULL;
+        }
+    }
     InitDataBlock(dataBlock);
     atomic_fetch_add(&blocksInUse, 1);
     return dataBlock;
 
 }  // End of NewDataBlock
 
+static dataBlock_t *NewSmallDataBlock(void) {
+    dataBlock_t *dataBlock = NULL;
+    pthread_mutex_lock(&smallPool.mutex);
+    if (smallPool.numBlocks) dataBlock = smallPool.block[--smallPool.numBlocks];
+    pthread_mutex_unlock(&smallPool.mutex);
+
+    if (!dataBlock) {
+        dataBlock = malloc(sizeof(dataBlock_t) + smallBlockSize + SMALLBLOCKSLACK);
+        if (!dataBlock) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return NULL;
+        }
+    }
+    InitDataBlock(dataBlock);
+    dataBlock->flags = FLAG_BLOCK_SMALL;
+    atomic_fetch_add(&blocksInUse, 1);
+    return dataBlock;
+
+}  // End of NewSmallDataBlock
+
+// next block to fill for nffile - small blocks until the file is promoted
+static dataBlock_t *NewWriteBlock(nffile_t *nffile) {
+    if (smallBlockSize && nffile->smallFlushed < smallPool.promote) return NewSmallDataBlock();
+    return NewDataBlock();
+}  // End of NewWriteBlock
+
+// release the reference of a mapped block. returns 0, if the block is not in any mapping
+static int ReleaseMappedBlock(dataBlock_t *dataBlock) {
+    pthread_mutex_lock(&fileMapMutex);
+    fileMap_t *fileMap = fileMapList;
+    while (fileMap && ((void *)dataBlock < fileMap->addr || (void *)dataBlock >= (fileMap->addr + fileMap->size))) fileMap = fileMap->next;
+    pthread_mutex_unlock(&fileMapMutex);
+
+    if (!fileMap) return 0;
+    ReleaseMap(fileMap);
+    return 1;
+
+}  // End of ReleaseMappedBlock
+
 void FreeDataBlock(dataBlock_t *dataBlock) {
     // Release block
     if (dataBlock) {
-        free((void *)dataBlock);
+        // small blocks are never mapped
+        if ((dataBlock->flags & (FLAG_BLOCK_SMALL | FLAG_BLOCK_MAPPED)) == FLAG_BLOCK_SMALL) {
+            pthread_mutex_lock(&smallPool.mutex);
+            if (smallPool.numBlocks < MAXSMALLBLOCKS) {
+                smallPool.block[smallPool.numBlocks++] = dataBlock;
+                dataBlock = NULL;
+            }
+            pthread_mutex_unlock(&smallPool.mutex);
+            if (dataBlock) free((void *)dataBlock);
+            atomic_fetch_sub(&blocksInUse, 1);
+            return;
+        }
+        // a copied header may carry the mapped flag - free it anyway
+        if ((dataBlock->flags & FLAG_BLOCK_MAPPED) == 0 || ReleaseMappedBlock(dataBlock) == 0) {
+            // keep the block for reuse, if the pool is not yet full
+            nodePool_t *nodePool = &blockPool.node[ThreadNode()];
+            pthread_mutex_lock(&nodePool->mutex);
+            if (nodePool->numBlocks < pipeline.poolBlocks) {
+                nodePool->block[nodePool->numBlocks++] = dataBlock;
+                dataBlock = NULL;
+            }
+            pthread_mutex_unlock(&nodePool->mutex);
+            if (dataBlock) free((void *)dataBlock);
+        }
         atomic_fetch_sub(&blocksInUse, 1);
     }
 }  // End of FreeDataBlock
 
-static int ReadAppendix(nffile_t *nffile) {
-    dbg_printf("Process appendix ..\n");
-    off_t currentPos = lseek(nffile->fd, 0, SEEK_CUR);
-    if (currentPos < 0) {
-        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return 0;
+// map the remaining file for the reader
+static void MapFile(nffile_t *nffile) {
+    struct stat stat_buf;
+    if (nffile->compat16 || fstat(nffile->fd, &stat_buf) < 0) return;
+
+    off_t offset = lseek(nffile->fd, 0, SEEK_CUR);
+    if (offset < 0 || stat_buf.st_size <= offset) return;
+
+    fileMap_t *fileMap = calloc(1, sizeof(fileMap_t));
+    if (!fileMap) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
     }
 
-    // seek to Appendix
-    if (lseek(nffile->fd, nffile->file_header->offAppendix, SEEK_SET) < 0) {
-        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return 0;
+    // private mapping - consumers may modify records of a block
+    void *addr = mmap(NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, nffile->fd, 0);
+    if (addr == MAP_FAILED) {
+        LogVerbose("mmap() failed for %s: %s - continue with read()", nffile->fileName, strerror(errno));
+        free(fileMap);
+        return;
     }
+#ifdef MADV_SEQUENTIAL
+    madvise(addr, stat_buf.st_size, MADV_SEQUENTIAL);
+#endif
 
-    dbg_printf("Num of appendix records: %u\n", nffile->file_header->appendixBlocks);
-    for (int i = 0; i < nffile->file_header->appendixBlocks; i++) {
-        size_t processed = 0;
-        dataBlock_t *block_header = nfread(nffile);
-        if (!block_header) {
-            LogError("Unable to read appendix block of file: %s", nffile->fileName);
-            lseek(nffile->fd, currentPos, SEEK_SET);
-            return 0;
+    fileMap->addr = addr;
+    fileMap->size = stat_buf.st_size;
+    atomic_init(&fileMap->refCnt, 1);
+
+    pthread_mutex_lock(&fileMapMutex);
+    fileMap->next = fileMapList;
+    fileMapList = fileMap;
+    pthread_mutex_unlock(&fileMapMutex);
+
+    nffile->fileMap = fileMap;
+    nffile->mapOffset = offset;
+
+}  // End of MapFile
+
+// drop a reference of the mapping and unmap it with the last one
+static void ReleaseMap(fileMap_t *fileMap) {
+    if (atomic_fetch_sub(&fileMap->refCnt, 1) != 1) return;
+
+    pthread_mutex_lock(&fileMapMutex);
+    fileMap_t **fm = &fileMapList;
+    while (*fm != fileMap) fm = &((*fm)->next);
+    *fm = fileMap->next;
+    pthread_mutex_unlock(&fileMapMutex);
+
+    if (fileMap->cached)
+        free(fileMap->addr);
+    else
+        munmap(fileMap->addr, fileMap->size);
+    free(fileMap);
+
+}  // End of ReleaseMap
+
+// return the cache entry of the file with this stat, if any. Needs fileMapMutex
+static cachedFile_t **FindCachedFile(struct stat *stat_buf) {
+    cachedFile_t **cf = &cachedFileList;
+    while (*cf && ((*cf)->dev != stat_buf->st_dev || (*cf)->ino != stat_buf->st_ino || (*cf)->size != stat_buf->st_size ||
+                   (*cf)->mtime != stat_buf->st_mtime))
+        cf = &((*cf)->next);
+    return *cf ? cf : NULL;
+
+}  // End of FindCachedFile
+
+// move a cache entry to the front of the LRU list. Needs fileMapMutex
+static cachedFile_t *TouchCachedFile(cachedFile_t **cf) {
+    cachedFile_t *cachedFile = *cf;
+    *cf = cachedFile->next;
+    cachedFile->next = cachedFileList;
+    cachedFileList = cachedFile;
+    return cachedFile;
+}  // End of TouchCachedFile
+
+// read the file from the block cache, if cached
+static int CachedFile(nffile_t *nffile) {
+    struct stat stat_buf;
+    if (blockCacheMax == 0 || nffile->compat16 || fstat(nffile->fd, &stat_buf) < 0) return 0;
+
+    pthread_mutex_lock(&fileMapMutex);
+    cachedFile_t **cf = FindCachedFile(&stat_buf);
+    if (cf) {
+        cachedFile_t *cachedFile = TouchCachedFile(cf);
+        atomic_fetch_add(&cachedFile->fileMap->refCnt, 1);
+        nffile->fileMap = cachedFile->fileMap;
+        nffile->mapOffset = 0;
+    }
+    pthread_mutex_unlock(&fileMapMutex);
+    return cf != NULL;
+
+}  // End of CachedFile
+
+// drop least recently used images, until size bytes fit into the cache
+static void EvictCachedFiles(size_t size) {
+    while (cachedFileList && (blockCacheSize + size) > blockCacheMax) {
+        pthread_mutex_lock(&fileMapMutex);
+        cachedFile_t **cf = &cachedFileList;
+        while ((*cf)->next) cf = &((*cf)->next);
+        cachedFile_t *cachedFile = *cf;
+        *cf = NULL;
+        blockCacheSize -= cachedFile->fileMap->size;
+        pthread_mutex_unlock(&fileMapMutex);
+
+        // blocks still in use keep the image
+        ReleaseMap(cachedFile->fileMap);
+        free(cachedFile);
+    }
+
+}  // End of EvictCachedFiles
+
+// set the max size of the block cache in bytes. 0 disables the cache
+void SetBlockCache(size_t maxSize) {
+    blockCacheMax = maxSize;
+    EvictCachedFiles(0);
+}  // End of SetBlockCache
+
+// load all data blocks of a file into the block cache. Returns 1, if the file is cached
+int CacheFile(char *fileName) {
+    struct stat stat_buf;
+    if (blockCacheMax == 0 || stat(fileName, &stat_buf) < 0) return 0;
+
+    // a cached file moves to the front of the LRU list
+    pthread_mutex_lock(&fileMapMutex);
+    cachedFile_t **cf = FindCachedFile(&stat_buf);
+    if (cf) TouchCachedFile(cf);
+    pthread_mutex_unlock(&fileMapMutex);
+    if (cf) return 1;
+
+    nffile_t *nffile = OpenFileStatic(fileName, NULL);
+    if (!nffile) return 0;
+    if (nffile->compat16) {
+        CloseFile(nffile);
+        DisposeFile(nffile);
+        return 0;
+    }
+    // the cached file must not be read from an older image
+    int useCache = blockCacheMax;
+    blockCacheMax = 0;
+    StartReader(nffile);
+    blockCacheMax = useCache;
+
+    size_t size = 0;
+    size_t maxSize = 0;
+    void *image = NULL;
+    uint32_t numBlocks = 0;
+    int ok = 1;
+    dataBlock_t *dataBlock = NULL;
+    while ((dataBlock = ReadBlock(nffile, dataBlock)) != NULL) {
+        size_t blockSize = Align8(sizeof(dataBlock_t) + dataBlock->size);
+        if ((size + blockSize) > blockCacheMax) {
+            ok = 0;
+            break;
         }
-        void *buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
-
-        for (int j = 0; j < block_header->NumRecords; j++) {
-            record_header_t *record_header = (record_header_t *)buff_ptr;
-            void *data = (void *)record_header + sizeof(record_header_t);
-            uint16_t dataSize = record_header->size - sizeof(record_header_t);
-            dbg_printf("appendix record: %u - type: %u, size: %u\n", j, record_header->type, record_header->size);
-            switch (record_header->type) {
-                case TYPE_IDENT:
-                    dbg_printf("Read ident from appendix block\n");
-                    if (nffile->ident) free(nffile->ident);
-                    if (record_header->size < IDENTLEN) {
-                        nffile->ident = strdup(data);
-                    } else {
-                        nffile->ident = NULL;
-                        LogError("Error processing appendix ident record");
-                    }
-                    break;
-                case TYPE_STAT:
-                    dbg_printf("Read stat record from appendix block\n");
-                    if (dataSize == sizeof(stat_record_t)) {
-                        memcpy(nffile->stat_record, data, sizeof(stat_record_t));
-                    } else {
-                        LogError("Error processing appendix stat record");
-                    }
-                    break;
-                default:
-                    LogError("Error process appendix record type: %u", record_header->type);
-            }
-            processed += record_header->size;
-            buff_ptr += record_header->size;
-            if (processed > block_header->size) {
-                LogError("Error processing appendix records: processed %u > block size %u", processed, block_header->size);
-                FreeDataBlock(block_header);
-                return 0;
+        if ((size + blockSize) > maxSize) {
+            maxSize = maxSize ? 2 * maxSize : BUFFSIZE;
+            while (maxSize < (size + blockSize)) maxSize <<= 1;
+            void *p = realloc(image, maxSize);
+            if (!p) {
+                LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                ok = 0;
+                break;
             }
+            image = p;
         }
-        FreeDataBlock(block_header);
+        memcpy(image + size, (void *)dataBlock, sizeof(dataBlock_t) + dataBlock->size);
+        ((dataBlock_t *)(image + size))->flags &= ~FLAG_BLOCK_MAPPED;
+        size += blockSize;
+        numBlocks++;
     }
+    FreeDataBlock(dataBlock);
+    if (numBlocks != nffile->file_header->NumBlocks) ok = 0;
+    CloseFile(nffile);
+    DisposeFile(nffile);
 
-    // seek back to currentPos
-    off_t backPosition = lseek(nffile->fd, currentPos, SEEK_SET);
-    dbg_printf("Reset position to %lld -> %lld\n", currentPos, backPosition);
-    if (backPosition < 0) {
-        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+    fileMap_t *fileMap = NULL;
+    cachedFile_t *cachedFile = NULL;
+    if (ok) {
+        fileMap = calloc(1, sizeof(fileMap_t));
+        cachedFile = calloc(1, sizeof(cachedFile_t));
+    }
+    if (!fileMap || !cachedFile) {
+        free(image);
+        free(fileMap);
+        free(cachedFile);
         return 0;
     }
+
+    if (size) {
+        void *p = realloc(image, size);
+        if (p) image = p;
+    }
+    *fileMap = (fileMap_t){.addr = image, .size = size, .cached = 1};
+    atomic_init(&fileMap->refCnt, 1);
+    *cachedFile = (cachedFile_t){
+        .dev = stat_buf.st_dev, .ino = stat_buf.st_ino, .size = stat_buf.st_size, .mtime = stat_buf.st_mtime, .fileMap = fileMap};
+
+    EvictCachedFiles(size);
+    pthread_mutex_lock(&fileMapMutex);
+    fileMap->next = fileMapList;
+    fileMapList = fileMap;
+    cachedFile->next = cachedFileList;
+    cachedFileList = cachedFile;
+    blockCacheSize += size;
+    pthread_mutex_unlock(&fileMapMutex);
+
     return 1;
 
-}  // End of ReadAppendix
+}  // End of CacheFile
 
-// Write appendix - assume current file pos is end of data blocks
-static int WriteAppendix(nffile_t *nffile) {
-    dbg_printf("Write Appendix\n");
-    // add appendix to end of data
-    off_t currentPos = lseek(nffile->fd, 0, SEEK_CUR);
-    if (currentPos < 0) {
-        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return 0;
+// append numEntries block index entries to the nffile index
+static int AddBlockIndex(nffile_t *nffile, blockIndex_t *blockIndex, uint32_t numEntries) {
+    if ((nffile->numIndex + numEntries) > nffile->maxIndex) {
+        uint32_t maxIndex = nffile->maxIndex ? nffile->maxIndex : 256;
+        while (maxIndex < (nffile->numIndex + numEntries)) maxIndex <<= 1;
+        blockIndex_t *p = realloc(nffile->blockIndex, maxIndex * sizeof(blockIndex_t));
+        if (!p) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        nffile->blockIndex = p;
+        nffile->maxIndex = maxIndex;
     }
+    memcpy((void *)&(nffile->blockIndex[nffile->numIndex]), (void *)blockIndex, numEntries * sizeof(blockIndex_t));
+    nffile->numIndex += numEntries;
+    return 1;
 
-    // set appendx info
-    nffile->file_header->offAppendix = currentPos;
-    nffile->file_header->appendixBlocks = 1;
-
-    // make sure ident is set
-    if (nffile->ident == NULL) nffile->ident = strdup("none");
+}  // End of AddBlockIndex
 
-    dataBlock_t *block_header = NewDataBlock();
-    void *buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
+// append numEntries block summaries to the nffile summaries
+static int AddBlockSummary(nffile_t *nffile, blockSummary_t *blockSummary, uint32_t numEntries) {
+    if ((nffile->numSummary + numEntries) > nffile->maxSummary) {
+        uint32_t maxSummary = nffile->maxSummary ? nffile->maxSummary : 256;
+        while (maxSummary < (nffile->numSummary + numEntries)) maxSummary <<= 1;
+        blockSummary_t *p = realloc(nffile->blockSummary, maxSummary * sizeof(blockSummary_t));
+        if (!p) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        nffile->blockSummary = p;
+        nffile->maxSummary = maxSummary;
+    }
+    memcpy((void *)&(nffile->blockSummary[nffile->numSummary]), (void *)blockSummary, numEntries * sizeof(blockSummary_t));
+    nffile->numSummary += numEntries;
+    return 1;
 
-    // write ident
-    recordHeader_t *recordHeader = (recordHeader_t *)buff_ptr;
-    void *data = (void *)recordHeader + sizeof(recordHeader_t);
+}  // End of AddBlockSummary
 
-    recordHeader->type = TYPE_IDENT;
-    recordHeader->size = sizeof(recordHeader_t) + strlen(nffile->ident) + 1;
+// append numEntries block bitmaps to the nffile bitmaps
+static int AddBlockBitmap(nffile_t *nffile, blockBitmap_t *blockBitmap, uint32_t numEntries) {
+    if ((nffile->numBitmap + numEntries) > nffile->maxBitmap) {
+        uint32_t maxBitmap = nffile->maxBitmap ? nffile->maxBitmap : 256;
+        while (maxBitmap < (nffile->numBitmap + numEntries)) maxBitmap <<= 1;
+        blockBitmap_t *p = realloc(nffile->blockBitmap, maxBitmap * sizeof(blockBitmap_t));
+        if (!p) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        nffile->blockBitmap = p;
+        nffile->maxBitmap = maxBitmap;
+    }
+    memcpy((void *)&(nffile->blockBitmap[nffile->numBitmap]), (void *)blockBitmap, numEntries * sizeof(blockBitmap_t));
+    nffile->numBitmap += numEntries;
+    return 1;
+
+}  // End of AddBlockBitmap
+
+// append an interval file to the table of contents of an archive file. The intervals
+// are written with the appendix and must be added in ascending name order
+int AddArchiveInterval(nffile_t *nffile, char *name, uint32_t firstBlock, uint32_t numBlocks, stat_record_t *stat_record) {
+    if (strlen(name) >= TOCNAMELEN) {
+        LogError("Interval file name too long: %s", name);
+        return 0;
+    }
+    if (nffile->numInterval == nffile->maxInterval) {
+        uint32_t maxInterval = nffile->maxInterval ? nffile->maxInterval << 1 : 64;
+        archiveInterval_t *p = realloc(nffile->interval, maxInterval * sizeof(archiveInterval_t));
+        if (!p) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        nffile->interval = p;
+        nffile->maxInterval = maxInterval;
+    }
+    archiveInterval_t *interval = &(nffile->interval[nffile->numInterval++]);
+    memset((void *)&interval->toc, 0, sizeof(intervalToc_t));
+    strcpy(interval->toc.name, name);
+    interval->toc.firstBlock = firstBlock;
+    interval->toc.numBlocks = numBlocks;
+    memcpy((void *)&interval->stat_record, (void *)stat_record, sizeof(stat_record_t));
+    return 1;
+
+}  // End of AddArchiveInterval
+
+// init an empty block summary
+void BlockSummaryInit(blockSummary_t *blockSummary) {
+    memset((void *)blockSummary, 0, sizeof(blockSummary_t));
+    blockSummary->minBytes = 0xFFFFFFFFFFFFFFFFLL;
+    blockSummary->minPackets = 0xFFFFFFFFFFFFFFFFLL;
+    blockSummary->flags = FLAG_SUMMARY_ALLFLOWS;
+}  // End of BlockSummaryInit
+
+// add a flow to the block summary
+void BlockSummaryAdd(blockSummary_t *blockSummary, const EXgenericFlow_t *genericFlow) {
+    blockSummary->protoMap[genericFlow->proto >> 6] |= 1ULL << (genericFlow->proto & 0x3F);
+    uint32_t srcBit = genericFlow->srcPort % SUMMARYPORTBITS;
+    uint32_t dstBit = genericFlow->dstPort % SUMMARYPORTBITS;
+    blockSummary->portMap[srcBit >> 6] |= 1ULL << (srcBit & 0x3F);
+    blockSummary->portMap[dstBit >> 6] |= 1ULL << (dstBit & 0x3F);
+    if (genericFlow->inBytes < blockSummary->minBytes) blockSummary->minBytes = genericFlow->inBytes;
+    if (genericFlow->inBytes > blockSummary->maxBytes) blockSummary->maxBytes = genericFlow->inBytes;
+    if (genericFlow->inPackets < blockSummary->minPackets) blockSummary->minPackets = genericFlow->inPackets;
+    if (genericFlow->inPackets > blockSummary->maxPackets) blockSummary->maxPackets = genericFlow->inPackets;
+}  // End of BlockSummaryAdd
+
+// a summary, which matches any flow
+static void BlockSummaryAny(blockSummary_t *blockSummary) {
+    memset((void *)blockSummary, 0xFF, sizeof(blockSummary_t));
+    blockSummary->minBytes = 0;
+    blockSummary->minPackets = 0;
+    blockSummary->flags = 0;
+    blockSummary->fill = 0;
+}  // End of BlockSummaryAny
+
+// add the exporter sysID of a record to the block bitmap
+void BlockBitmapAddExporter(blockBitmap_t *blockBitmap, uint16_t exporterID) {
+    uint32_t bit = exporterID % BITMAPEXPORTERBITS;
+    blockBitmap->exporterMap[bit >> 6] |= 1ULL << (bit & 0x3F);
+}  // End of BlockBitmapAddExporter
+
+// add an IPv4 router address or a 64bit half of an IPv6 router address to the block bitmap
+void BlockBitmapAddRouter(blockBitmap_t *blockBitmap, uint64_t key) {
+    uint32_t bit = BITMAPROUTERBIT(key);
+    blockBitmap->routerMap[bit >> 6] |= 1ULL << (bit & 0x3F);
+}  // End of BlockBitmapAddRouter
+
+// calculate time range and summary of all flow records in dataBlock and add their
+// IP addresses to the bloom filter, if given
+static void IndexBlock(dataBlock_t *dataBlock, blockIndex_t *blockIndex, blockSummary_t *blockSummary, blockBitmap_t *blockBitmap,
+                       ipBloom_t *ipBloom) {
+    blockIndex->NumRecords = dataBlock->NumRecords;
+    blockIndex->type = dataBlock->type;
+    blockIndex->flags = 0;
+    blockIndex->msecFirst = 0xFFFFFFFFFFFFFFFFLL;
+    blockIndex->msecLast = 0;
+    BlockSummaryInit(blockSummary);
+    memset((void *)blockBitmap, 0, sizeof(blockBitmap_t));
+
+    if (dataBlock->type == DATA_BLOCK_TYPE_5) {
+        // columnar blocks contain flow records only
+        if (!ColumnarTimeRange(dataBlock, &blockIndex->msecFirst, &blockIndex->msecLast)) blockIndex->flags = FLAG_INDEX_NOSKIP;
+        if (!ColumnarSummary(dataBlock, blockSummary)) BlockSummaryAny(blockSummary);
+        if (!ColumnarBitmap(dataBlock, blockBitmap)) memset((void *)blockBitmap, 0xFF, sizeof(blockBitmap_t));
+        if (ipBloom && !ColumnarAddIPs(dataBlock, ipBloom)) atomic_store(&ipBloom->invalid, 1);
+        return;
+    }
+
+    if (dataBlock->type != DATA_BLOCK_TYPE_3) {
+        blockIndex->flags = FLAG_INDEX_NOSKIP;
+        BlockSummaryAny(blockSummary);
+        memset((void *)blockBitmap, 0xFF, sizeof(blockBitmap_t));
+        // flows of other blocks are not in the bloom filter
+        if (ipBloom && dataBlock->NumRecords) atomic_store(&ipBloom->invalid, 1);
+        return;
+    }
+
+    record_header_t *record_ptr = GetCursor(dataBlock);
+    uint32_t sumSize = 0;
+    for (int i = 0; i < dataBlock->NumRecords; i++) {
+        if (record_ptr->size < sizeof(record_header_t) || (sumSize + record_ptr->size) > dataBlock->size) {
+            blockIndex->flags = FLAG_INDEX_NOSKIP;
+            BlockSummaryAny(blockSummary);
+            memset((void *)blockBitmap, 0xFF, sizeof(blockBitmap_t));
+            if (ipBloom) atomic_store(&ipBloom->invalid, 1);
+            return;
+        }
+        sumSize += record_ptr->size;
+        void *recordEnd = (void *)record_ptr + record_ptr->size;
+
+        if (record_ptr->type == V3Record) {
+            EXgenericFlow_t *genericFlow = NULL;
+            recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)record_ptr;
+            BlockBitmapAddExporter(blockBitmap, recordHeaderV3->exporterID);
+            elementHeader_t *elementHeader = (elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+            for (int j = 0; j < recordHeaderV3->numElements; j++) {
+                if (((void *)elementHeader + sizeof(elementHeader_t)) > recordEnd || elementHeader->length == 0) break;
+                void *element = (void *)elementHeader + sizeof(elementHeader_t);
+                if (elementHeader->type == EXgenericFlowID) {
+                    if ((element + sizeof(EXgenericFlow_t)) <= recordEnd) genericFlow = (EXgenericFlow_t *)element;
+                } else if (elementHeader->type == EXipReceivedV4ID && (element + sizeof(EXipReceivedV4_t)) <= recordEnd) {
+                    BlockBitmapAddRouter(blockBitmap, ((EXipReceivedV4_t *)element)->ip);
+                } else if (elementHeader->type == EXipReceivedV6ID && (element + sizeof(EXipReceivedV6_t)) <= recordEnd) {
+                    EXipReceivedV6_t *ipReceivedV6 = (EXipReceivedV6_t *)element;
+                    BlockBitmapAddRouter(blockBitmap, ipReceivedV6->ip[0]);
+                    BlockBitmapAddRouter(blockBitmap, ipReceivedV6->ip[1]);
+                } else if (ipBloom && elementHeader->type == EXipv4FlowID && (element + sizeof(EXipv4Flow_t)) <= recordEnd) {
+                    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)element;
+                    IPBloomAdd(ipBloom, ipv4Flow->srcAddr, PF_INET);
+                    IPBloomAdd(ipBloom, ipv4Flow->dstAddr, PF_INET);
+                } else if (ipBloom && elementHeader->type == EXipv6FlowID && (element + sizeof(EXipv6Flow_t)) <= recordEnd) {
+                    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)element;
+                    IPBloomAdd(ipBloom, ipv6Flow->srcAddr[0], PF_INET6);
+                    IPBloomAdd(ipBloom, ipv6Flow->dstAddr[0], PF_INET6);
+                }
+                elementHeader = (elementHeader_t *)((void *)elementHeader + elementHeader->length);
+            }
+            // flows without time info never match a time window
+            if (genericFlow) {
+                if (genericFlow->msecFirst < blockIndex->msecFirst) blockIndex->msecFirst = genericFlow->msecFirst;
+                if (genericFlow->msecLast > blockIndex->msecLast) blockIndex->msecLast = genericFlow->msecLast;
+                BlockSummaryAdd(blockSummary, genericFlow);
+            } else {
+                blockSummary->flags &= ~FLAG_SUMMARY_ALLFLOWS;
+            }
+        } else {
+            // exporter, sampler etc. records are needed by the reader
+            blockIndex->flags = FLAG_INDEX_NOSKIP;
+        }
+        record_ptr = (record_header_t *)recordEnd;
+    }
+
+}  // End of IndexBlock
+
+// sort key of a flow record - see SortBlock()
+typedef struct sortKey_s {
+    uint16_t exporterID;
+    uint8_t proto;
+    uint8_t family;
+    uint16_t dstPort;
+    uint16_t size;
+    uint64_t dstAddr[2];
+    uint32_t index;  // records with equal keys keep their order
+    uint32_t fill;
+    void *record;
+} sortKey_t;
+
+static int CompareSortKey(const void *p1, const void *p2) {
+    const sortKey_t *k1 = (const sortKey_t *)p1;
+    const sortKey_t *k2 = (const sortKey_t *)p2;
+    if (k1->exporterID != k2->exporterID) return k1->exporterID < k2->exporterID ? -1 : 1;
+    if (k1->proto != k2->proto) return k1->proto < k2->proto ? -1 : 1;
+    if (k1->family != k2->family) return k1->family < k2->family ? -1 : 1;
+    if (k1->dstAddr[0] != k2->dstAddr[0]) return k1->dstAddr[0] < k2->dstAddr[0] ? -1 : 1;
+    if (k1->dstAddr[1] != k2->dstAddr[1]) return k1->dstAddr[1] < k2->dstAddr[1] ? -1 : 1;
+    if (k1->dstPort != k2->dstPort) return k1->dstPort < k2->dstPort ? -1 : 1;
+    return k1->index < k2->index ? -1 : 1;
+}  // End of CompareSortKey
+
+// fill the sort key of a V3 flow record
+static void SortKey(sortKey_t *sortKey, recordHeaderV3_t *recordHeaderV3) {
+    memset((void *)sortKey, 0, sizeof(sortKey_t));
+    sortKey->exporterID = recordHeaderV3->exporterID;
+    sortKey->size = recordHeaderV3->size;
+    sortKey->record = (void *)recordHeaderV3;
+
+    void *recordEnd = (void *)recordHeaderV3 + recordHeaderV3->size;
+    elementHeader_t *elementHeader = (elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+    for (int i = 0; i < recordHeaderV3->numElements; i++) {
+        if (((void *)elementHeader + sizeof(elementHeader_t)) > recordEnd || elementHeader->length == 0) break;
+        void *element = (void *)elementHeader + sizeof(elementHeader_t);
+        if (elementHeader->type == EXgenericFlowID && (element + sizeof(EXgenericFlow_t)) <= recordEnd) {
+            sortKey->proto = ((EXgenericFlow_t *)element)->proto;
+            sortKey->dstPort = ((EXgenericFlow_t *)element)->dstPort;
+        } else if (elementHeader->type == EXipv4FlowID && (element + sizeof(EXipv4Flow_t)) <= recordEnd) {
+            sortKey->family = AF_INET;
+            sortKey->dstAddr[1] = ((EXipv4Flow_t *)element)->dstAddr;
+        } else if (elementHeader->type == EXipv6FlowID && (element + sizeof(EXipv6Flow_t)) <= recordEnd) {
+            sortKey->family = AF_INET6;
+            sortKey->dstAddr[0] = ((EXipv6Flow_t *)element)->dstAddr[0];
+            sortKey->dstAddr[1] = ((EXipv6Flow_t *)element)->dstAddr[1];
+        }
+        elementHeader = (elementHeader_t *)((void *)elementHeader + elementHeader->length);
+    }
+}  // End of SortKey
+
+/*
+ * Sort the V3 flow records of a block by exporter, protocol, destination address and
+ * port. Similar records next to each other compress better. Any other record, such as
+ * an exporter or sampler record, keeps its position and no flow record is moved across
+ * it, as the reader needs it before the flows, which follow it. The order of the flows
+ * within a block has no meaning. Corrupt blocks are left unchanged.
+ */
+static void SortBlock(dataBlock_t *dataBlock) {
+    if (dataBlock->type != DATA_BLOCK_TYPE_3 || dataBlock->NumRecords < 2) return;
+
+    sortKey_t *sortKey = malloc(dataBlock->NumRecords * sizeof(sortKey_t));
+    dataBlock_t *sortBlock = NewDataBlock();
+    if (!sortKey || !sortBlock) {
+        // the block is written unsorted
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(sortKey);
+        FreeDataBlock(sortBlock);
+        return;
+    }
+
+    record_header_t *record_ptr = GetCursor(dataBlock);
+    void *out = GetCursor(sortBlock);
+    uint32_t sumSize = 0;
+    uint32_t numKeys = 0;
+    int ok = 1;
+    for (int i = 0; i <= dataBlock->NumRecords; i++) {
+        int last = i == dataBlock->NumRecords;
+        if (!last && (record_ptr->size < sizeof(record_header_t) || (sumSize + record_ptr->size) > dataBlock->size)) {
+            ok = 0;
+            break;
+        }
+        if (!last && record_ptr->type == V3Record && record_ptr->size >= sizeof(recordHeaderV3_t)) {
+            SortKey(&sortKey[numKeys], (recordHeaderV3_t *)record_ptr);
+            sortKey[numKeys].index = numKeys;
+            numKeys++;
+        } else {
+            // a run of flow records ends
+            if (numKeys > 1) qsort((void *)sortKey, numKeys, sizeof(sortKey_t), CompareSortKey);
+            for (uint32_t j = 0; j < numKeys; j++) {
+                memcpy(out, sortKey[j].record, sortKey[j].size);
+                out += sortKey[j].size;
+            }
+            numKeys = 0;
+            if (!last) {
+                memcpy(out, (void *)record_ptr, record_ptr->size);
+                out += record_ptr->size;
+            }
+        }
+        if (last) break;
+        sumSize += record_ptr->size;
+        record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+    }
+
+    if (ok) memcpy(GetCursor(dataBlock), GetCursor(sortBlock), sumSize);
+    FreeDataBlock(sortBlock);
+    free(sortKey);
+
+}  // End of SortBlock
+
+// add the bits of an IP bloom filter record to the file's bloom filter
+static int ReadIPBloom(nffile_t *nffile, void *data, uint16_t dataSize) {
+    if (dataSize < sizeof(ipBloomRecord_t)) return 0;
+    ipBloomRecord_t *ipBloomRecord = (ipBloomRecord_t *)data;
+    if ((ipBloomRecord->numBits & (ipBloomRecord->numBits - 1)) != 0 || ipBloomRecord->numBits > IPBLOOMBITS ||
+        ipBloomRecord->size != (dataSize - sizeof(ipBloomRecord_t)) ||
+        ((uint64_t)ipBloomRecord->offset + ipBloomRecord->size) > ipBloomRecord->numBits / 8)
+        return 0;
+
+    if (nffile->ipBloom == NULL) {
+        nffile->ipBloom = NewIPBloom(ipBloomRecord->numBits, ipBloomRecord->numHashes);
+        if (!nffile->ipBloom) return 0;
+    } else if (nffile->ipBloom->numBits != ipBloomRecord->numBits) {
+        return 0;
+    }
+    memcpy((void *)nffile->ipBloom->bits + ipBloomRecord->offset, data + sizeof(ipBloomRecord_t), ipBloomRecord->size);
+    nffile->ipBloom->loaded += ipBloomRecord->size;
+    return 1;
+
+}  // End of ReadIPBloom
+
+// process the records of an appendix block. The ident of a stream is not changed,
+// after its data blocks were passed to the consumer
+static int ReadAppendixBlock(nffile_t *nffile, dataBlock_t *block_header, int dataRead, int *payloadError) {
+    size_t processed = 0;
+    void *buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
+
+    for (int j = 0; j < block_header->NumRecords; j++) {
+        record_header_t *record_header = (record_header_t *)buff_ptr;
+        void *data = (void *)record_header + sizeof(record_header_t);
+        uint16_t dataSize = record_header->size - sizeof(record_header_t);
+        dbg_printf("appendix record: %u - type: %u, size: %u\n", j, record_header->type, record_header->size);
+        switch (record_header->type) {
+            case TYPE_IDENT:
+                dbg_printf("Read ident from appendix block\n");
+                if (dataRead) break;
+                if (nffile->ident) free(nffile->ident);
+                if (record_header->size < IDENTLEN) {
+                    nffile->ident = strdup(data);
+                } else {
+                    nffile->ident = NULL;
+                    LogError("Error processing appendix ident record");
+                }
+                break;
+            case TYPE_AGGREGATION:
+                dbg_printf("Read aggregation from appendix block\n");
+                if (nffile->aggregation) free(nffile->aggregation);
+                if (dataSize > 0 && strnlen(data, dataSize) < dataSize) {
+                    nffile->aggregation = strdup(data);
+                } else {
+                    nffile->aggregation = NULL;
+                    LogError("Error processing appendix aggregation record");
+                }
+                break;
+            case TYPE_STAT:
+                dbg_printf("Read stat record from appendix block\n");
+                if (dataSize == sizeof(stat_record_t)) {
+                    memcpy(nffile->stat_record, data, sizeof(stat_record_t));
+                } else {
+                    LogError("Error processing appendix stat record");
+                }
+                break;
+            case TYPE_BLOCKINDEX:
+                dbg_printf("Read block index from appendix block\n");
+                if ((dataSize % sizeof(blockIndex_t)) == 0) {
+                    AddBlockIndex(nffile, (blockIndex_t *)data, dataSize / sizeof(blockIndex_t));
+                } else {
+                    LogError("Error processing appendix block index record");
+                }
+                break;
+            case TYPE_BLOCKSUMMARY:
+                dbg_printf("Read block summary from appendix block\n");
+                if ((dataSize % sizeof(blockSummary_t)) == 0) {
+                    AddBlockSummary(nffile, (blockSummary_t *)data, dataSize / sizeof(blockSummary_t));
+                } else {
+                    LogError("Error processing appendix block summary record");
+                }
+                break;
+            case TYPE_BLOCKBITMAP:
+                dbg_printf("Read block bitmap from appendix block\n");
+                if ((dataSize % sizeof(blockBitmap_t)) == 0) {
+                    AddBlockBitmap(nffile, (blockBitmap_t *)data, dataSize / sizeof(blockBitmap_t));
+                } else {
+                    LogError("Error processing appendix block bitmap record");
+                }
+                break;
+            case TYPE_IPBLOOM:
+                dbg_printf("Read IP bloom filter from appendix block\n");
+                if (!ReadIPBloom(nffile, data, dataSize)) {
+                    LogError("Error processing appendix IP bloom filter record");
+                }
+                break;
+            case TYPE_ZSTDDICT:
+                dbg_printf("Read zstd dictionary from appendix block\n");
+                if (nffile->zstdDict) FreeZstdDict(nffile->zstdDict);
+                nffile->zstdDict = NewZstdDict(data, dataSize);
+                if (!nffile->zstdDict) {
+                    LogError("Error processing appendix zstd dictionary record");
+                }
+                break;
+            case TYPE_PAYLOAD:
+                dbg_printf("Read payload from appendix block\n");
+                if (*payloadError) break;
+                if (nffile->payloadDict == NULL) nffile->payloadDict = NewPayloadDict();
+                if (!nffile->payloadDict || !PayloadDictLoad(nffile->payloadDict, data, dataSize)) {
+                    // records can not be resolved without all payloads
+                    LogError("Error processing appendix payload record");
+                    FreePayloadDict(nffile->payloadDict);
+                    nffile->payloadDict = NULL;
+                    *payloadError = 1;
+                }
+                break;
+            case TYPE_INTERVALTOC: {
+                dbg_printf("Read interval toc from appendix block\n");
+                intervalToc_t *intervalToc = (intervalToc_t *)data;
+                if (dataSize == (sizeof(intervalToc_t) + sizeof(stat_record_t)) && strnlen(intervalToc->name, TOCNAMELEN) < TOCNAMELEN) {
+                    AddArchiveInterval(nffile, intervalToc->name, intervalToc->firstBlock, intervalToc->numBlocks,
+                                       (stat_record_t *)(data + sizeof(intervalToc_t)));
+                } else {
+                    LogError("Error processing appendix interval toc record");
+                }
+            } break;
+            default:
+                LogError("Error process appendix record type: %u", record_header->type);
+        }
+        processed += record_header->size;
+        buff_ptr += record_header->size;
+        if (processed > block_header->size) {
+            LogError("Error processing appendix records: processed %u > block size %u", processed, block_header->size);
+            FreeDataBlock(block_header);
+            return 0;
+        }
+    }
+    return 1;
+
+}  // End of ReadAppendixBlock
+
+static int ReadAppendix(nffile_t *nffile) {
+    dbg_printf("Process appendix ..\n");
+    off_t currentPos = lseek(nffile->fd, 0, SEEK_CUR);
+    if (currentPos < 0) {
+        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    // seek to Appendix
+    if (lseek(nffile->fd, nffile->file_header->offAppendix, SEEK_SET) < 0) {
+        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    dbg_printf("Num of appendix records: %u\n", nffile->file_header->appendixBlocks);
+    int payloadError = 0;
+    for (int i = 0; i < nffile->file_header->appendixBlocks; i++) {
+        dataBlock_t *block_header = nfread(nffile);
+        if (!block_header) {
+            LogError("Unable to read appendix block of file: %s", nffile->fileName);
+            lseek(nffile->fd, currentPos, SEEK_SET);
+            return 0;
+        }
+        int ok = ReadAppendixBlock(nffile, block_header, 0, &payloadError);
+        FreeDataBlock(block_header);
+        if (!ok) return 0;
+    }
+
+    // use the bloom filter only, if all records were read
+    if (nffile->ipBloom && nffile->ipBloom->loaded != nffile->ipBloom->numBits / 8) {
+        LogError("Incomplete IP bloom filter in file: %s", nffile->fileName);
+        FreeIPBloom(nffile->ipBloom);
+        nffile->ipBloom = NULL;
+    }
+
+    // seek back to currentPos
+    off_t backPosition = lseek(nffile->fd, currentPos, SEEK_SET);
+    dbg_printf("Reset position to %lld -> %lld\n", currentPos, backPosition);
+    if (backPosition < 0) {
+        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    return 1;
+
+}  // End of ReadAppendix
+
+// write the payload dictionary as TYPE_PAYLOAD records into additional appendix blocks
+static void WritePayloadDict(nffile_t *nffile) {
+    payloadDict_t *payloadDict = nffile->payloadDict;
+    dataBlock_t *block_header = NULL;
+    for (uint32_t i = 0; i < payloadDict->numEntries; i++) {
+        payloadEntry_t *entry = &(payloadDict->entries[i]);
+        uint32_t recordSize = sizeof(recordHeader_t) + sizeof(payloadRecord_t) + entry->size;
+        if (block_header && !IsAvailable(block_header, recordSize)) {
+            nfwrite(nffile, block_header, nffile->blockSeq++);
+            nffile->file_header->appendixBlocks++;
+            block_header = NULL;
+        }
+        if (!block_header) {
+            block_header = NewDataBlock();
+            block_header->flags |= FLAG_BLOCK_APPENDIX;
+        }
+
+        recordHeader_t *recordHeader = (recordHeader_t *)GetCurrentCursor(block_header);
+        payloadRecord_t *payloadRecord = (payloadRecord_t *)((void *)recordHeader + sizeof(recordHeader_t));
+        recordHeader->type = TYPE_PAYLOAD;
+        recordHeader->size = recordSize;
+        payloadRecord->payloadID = i + 1;
+        payloadRecord->size = entry->size;
+        memcpy((void *)payloadRecord + sizeof(payloadRecord_t), payloadDict->data + entry->offset, entry->size);
+
+        block_header->NumRecords++;
+        block_header->size += recordSize;
+    }
+    if (block_header) {
+        nfwrite(nffile, block_header, nffile->blockSeq++);
+        nffile->file_header->appendixBlocks++;
+    }
+
+}  // End of WritePayloadDict
+
+// write the interval table of contents of an archive as TYPE_INTERVALTOC records into
+// additional appendix blocks
+static void WriteIntervalToc(nffile_t *nffile) {
+    uint32_t recordSize = sizeof(recordHeader_t) + sizeof(intervalToc_t) + sizeof(stat_record_t);
+    dataBlock_t *block_header = NULL;
+    for (uint32_t i = 0; i < nffile->numInterval; i++) {
+        if (block_header && !IsAvailable(block_header, recordSize)) {
+            nfwrite(nffile, block_header, nffile->blockSeq++);
+            nffile->file_header->appendixBlocks++;
+            block_header = NULL;
+        }
+        if (!block_header) {
+            block_header = NewDataBlock();
+            block_header->flags |= FLAG_BLOCK_APPENDIX;
+        }
+
+        recordHeader_t *recordHeader = (recordHeader_t *)GetCurrentCursor(block_header);
+        void *data = (void *)recordHeader + sizeof(recordHeader_t);
+        recordHeader->type = TYPE_INTERVALTOC;
+        recordHeader->size = recordSize;
+        memcpy(data, (void *)&(nffile->interval[i].toc), sizeof(intervalToc_t));
+        memcpy(data + sizeof(intervalToc_t), (void *)&(nffile->interval[i].stat_record), sizeof(stat_record_t));
+
+        block_header->NumRecords++;
+        block_header->size += recordSize;
+    }
+    if (block_header) {
+        nfwrite(nffile, block_header, nffile->blockSeq++);
+        nffile->file_header->appendixBlocks++;
+    }
+
+}  // End of WriteIntervalToc
+
+// Write appendix - assume current file pos is end of data blocks
+static int WriteAppendix(nffile_t *nffile) {
+    dbg_printf("Write Appendix\n");
+    // add appendix to end of data - a stream keeps the appendix inline
+    off_t currentPos = nffile->stream ? STREAM_APPENDIX : lseek(nffile->fd, 0, SEEK_CUR);
+    if (currentPos < 0 && !nffile->stream) {
+        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    // set appendx info
+    nffile->file_header->offAppendix = currentPos;
+    nffile->file_header->appendixBlocks = 1;
+
+    // make sure ident is set
+    if (nffile->ident == NULL) nffile->ident = strdup("none");
+
+    dataBlock_t *block_header = NewDataBlock();
+    block_header->flags |= FLAG_BLOCK_APPENDIX;
+    void *buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
+
+    // write ident
+    recordHeader_t *recordHeader = (recordHeader_t *)buff_ptr;
+    void *data = (void *)recordHeader + sizeof(recordHeader_t);
+
+    recordHeader->type = TYPE_IDENT;
+    recordHeader->size = sizeof(recordHeader_t) + strlen(nffile->ident) + 1;
     strcpy(data, nffile->ident);
 
     block_header->NumRecords++;
@@ -649,13 +2037,182 @@ static int WriteAppendix(nffile_t *nffile) {
     block_header->size += recordHeader->size;
     buff_ptr += recordHeader->size;
 
-    nfwrite(nffile, block_header);
-    FreeDataBlock(block_header);
+    // write aggregation of partial aggregate files
+    if (nffile->aggregation) {
+        recordHeader = (recordHeader_t *)buff_ptr;
+        data = (void *)recordHeader + sizeof(recordHeader_t);
+
+        recordHeader->type = TYPE_AGGREGATION;
+        recordHeader->size = sizeof(recordHeader_t) + strlen(nffile->aggregation) + 1;
+        strcpy(data, nffile->aggregation);
+
+        block_header->NumRecords++;
+        block_header->size += recordHeader->size;
+        buff_ptr += recordHeader->size;
+    }
+
+    // write zstd dictionary - a stream has it ahead of the data blocks
+    if (nffile->zstdDict && !nffile->stream) {
+        recordHeader = (recordHeader_t *)buff_ptr;
+        data = (void *)recordHeader + sizeof(recordHeader_t);
+
+        recordHeader->type = TYPE_ZSTDDICT;
+        recordHeader->size = sizeof(recordHeader_t) + nffile->zstdDict->size;
+        memcpy(data, nffile->zstdDict->dict, nffile->zstdDict->size);
+
+        block_header->NumRecords++;
+        block_header->size += recordHeader->size;
+        buff_ptr += recordHeader->size;
+    }
+
+    // write block index, if it covers all data blocks and fits into the appendix block
+    // the index is split into records of max MaxIndexEntries elements
+#define MaxIndexEntries ((0xFFFF - sizeof(recordHeader_t)) / sizeof(blockIndex_t))
+    // a stream is read sequentially - it has no use for the block index, summaries, bitmaps and bloom filter
+    uint32_t numIndex = nffile->stream ? 0 : nffile->numIndex;
+    size_t indexSize = numIndex * sizeof(blockIndex_t) + (numIndex / MaxIndexEntries + 1) * sizeof(recordHeader_t);
+    if (numIndex && numIndex == nffile->file_header->NumBlocks && (block_header->size + indexSize) < (BUFFSIZE - sizeof(dataBlock_t))) {
+        blockIndex_t *blockIndex = nffile->blockIndex;
+        while (numIndex) {
+            uint32_t numEntries = numIndex > MaxIndexEntries ? MaxIndexEntries : numIndex;
+            recordHeader = (recordHeader_t *)buff_ptr;
+            data = (void *)recordHeader + sizeof(recordHeader_t);
+
+            recordHeader->type = TYPE_BLOCKINDEX;
+            recordHeader->size = sizeof(recordHeader_t) + numEntries * sizeof(blockIndex_t);
+            memcpy(data, (void *)blockIndex, numEntries * sizeof(blockIndex_t));
+
+            block_header->NumRecords++;
+            block_header->size += recordHeader->size;
+            buff_ptr += recordHeader->size;
+
+            blockIndex += numEntries;
+            numIndex -= numEntries;
+        }
+    }
+
+    // the summaries are split into records of max MaxSummaryEntries elements
+#define MaxSummaryEntries ((0xFFFF - sizeof(recordHeader_t)) / sizeof(blockSummary_t))
+    uint32_t numSummary = nffile->stream ? 0 : nffile->numSummary;
+    size_t summarySize = numSummary * sizeof(blockSummary_t) + (numSummary / MaxSummaryEntries + 1) * sizeof(recordHeader_t);
+    if (numSummary && numSummary == nffile->file_header->NumBlocks && nffile->numIndex == numSummary &&
+        (block_header->size + summarySize) < (BUFFSIZE - sizeof(dataBlock_t))) {
+        blockSummary_t *blockSummary = nffile->blockSummary;
+        while (numSummary) {
+            uint32_t numEntries = numSummary > MaxSummaryEntries ? MaxSummaryEntries : numSummary;
+            recordHeader = (recordHeader_t *)buff_ptr;
+            data = (void *)recordHeader + sizeof(recordHeader_t);
+
+            recordHeader->type = TYPE_BLOCKSUMMARY;
+            recordHeader->size = sizeof(recordHeader_t) + numEntries * sizeof(blockSummary_t);
+            memcpy(data, (void *)blockSummary, numEntries * sizeof(blockSummary_t));
+
+            block_header->NumRecords++;
+            block_header->size += recordHeader->size;
+            buff_ptr += recordHeader->size;
+
+            blockSummary += numEntries;
+            numSummary -= numEntries;
+        }
+    }
+
+    // the bitmaps are written only with the summaries and split into records of max MaxBitmapEntries elements
+#define MaxBitmapEntries ((0xFFFF - sizeof(recordHeader_t)) / sizeof(blockBitmap_t))
+    uint32_t numBitmap = nffile->stream ? 0 : nffile->numBitmap;
+    size_t bitmapSize = numBitmap * sizeof(blockBitmap_t) + (numBitmap / MaxBitmapEntries + 1) * sizeof(recordHeader_t);
+    if (numBitmap && numBitmap == nffile->file_header->NumBlocks && numSummary == 0 && nffile->numSummary == numBitmap &&
+        (block_header->size + bitmapSize) < (BUFFSIZE - sizeof(dataBlock_t))) {
+        blockBitmap_t *blockBitmap = nffile->blockBitmap;
+        while (numBitmap) {
+            uint32_t numEntries = numBitmap > MaxBitmapEntries ? MaxBitmapEntries : numBitmap;
+            recordHeader = (recordHeader_t *)buff_ptr;
+            data = (void *)recordHeader + sizeof(recordHeader_t);
+
+            recordHeader->type = TYPE_BLOCKBITMAP;
+            recordHeader->size = sizeof(recordHeader_t) + numEntries * sizeof(blockBitmap_t);
+            memcpy(data, (void *)blockBitmap, numEntries * sizeof(blockBitmap_t));
+
+            block_header->NumRecords++;
+            block_header->size += recordHeader->size;
+            buff_ptr += recordHeader->size;
+
+            blockBitmap += numEntries;
+            numBitmap -= numEntries;
+        }
+    }
+
+    // write the IP bloom filter, if it covers all flows, and is not too full to skip files
+    // the filter is split into records of IPBLOOMCHUNK bytes
+#define IPBLOOMCHUNK 32768
+    ipBloom_t *ipBloom = nffile->ipBloom;
+    if (ipBloom && atomic_load(&ipBloom->invalid) == 0 && IPBloomFold(ipBloom)) {
+        uint32_t bloomSize = ipBloom->numBits / 8;
+        size_t recordsSize = bloomSize + (bloomSize / IPBLOOMCHUNK + 1) * (sizeof(recordHeader_t) + sizeof(ipBloomRecord_t));
+        if ((block_header->size + recordsSize) < (BUFFSIZE - sizeof(dataBlock_t))) {
+            for (uint32_t offset = 0; offset < bloomSize; offset += IPBLOOMCHUNK) {
+                uint32_t size = (bloomSize - offset) > IPBLOOMCHUNK ? IPBLOOMCHUNK : bloomSize - offset;
+                recordHeader = (recordHeader_t *)buff_ptr;
+                ipBloomRecord_t *ipBloomRecord = (ipBloomRecord_t *)((void *)recordHeader + sizeof(recordHeader_t));
+
+                recordHeader->type = TYPE_IPBLOOM;
+                recordHeader->size = sizeof(recordHeader_t) + sizeof(ipBloomRecord_t) + size;
+                *ipBloomRecord = (ipBloomRecord_t){
+                    .numBits = ipBloom->numBits,
+                    .numHashes = ipBloom->numHashes,
+                    .offset = offset,
+                    .size = size,
+                };
+                memcpy((void *)ipBloomRecord + sizeof(ipBloomRecord_t), (void *)ipBloom->bits + offset, size);
+
+                block_header->NumRecords++;
+                block_header->size += recordHeader->size;
+                buff_ptr += recordHeader->size;
+            }
+        }
+    }
+
+    // all writers are gone - the appendix is the last block
+    // and is compressed without dictionary, as it carries the dictionary
+    zstdDict_t *zstdDict = nffile->zstdDict;
+    nffile->zstdDict = NULL;
+    nfwrite(nffile, block_header, nffile->blockSeq++);
+
+    // the interval table of contents and the payload dictionary follow in additional appendix blocks
+    if (nffile->numInterval && !nffile->stream) WriteIntervalToc(nffile);
+    if (nffile->payloadDict) WritePayloadDict(nffile);
+    nffile->zstdDict = zstdDict;
 
     return 1;
 
 }  // End of WriteAppendix
 
+// read size bytes. A pipe returns short reads. Returns the number of bytes read or -1 on error
+static ssize_t readAll(int fd, void *buff, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t ret = read(fd, buff + done, size - done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return -1;
+        if (ret == 0) break;
+        done += ret;
+    }
+    return done;
+
+}  // End of readAll
+
+// write size bytes. A pipe accepts short writes. Returns size or -1 on error
+static ssize_t writeAll(int fd, void *buff, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t ret = write(fd, buff + done, size - done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return -1;
+        done += ret;
+    }
+    return done;
+
+}  // End of writeAll
+
 nffile_t *NewFile(nffile_t *nffile) {
     int compression = 0;
     int encryption = 0;
@@ -684,11 +2241,20 @@ nffile_t *NewFile(nffile_t *nffile) {
         nffile->buff_size = BUFFSIZE;
 
         //
-        nffile->processQueue = queue_init(QueueSize);
+        // the reader adapts the depth of the queues - see nfreader()
+        nffile->processQueue = queue_init(QUEUEDEPTHMAX);
         if (!nffile->processQueue) {
             return NULL;
         }
+        queue_limit(nffile->processQueue, QueueSize);
         queue_close(nffile->processQueue);
+
+        nffile->decodeQueue = queue_init(QUEUEDEPTHMAX);
+        if (!nffile->decodeQueue) {
+            return NULL;
+        }
+        queue_limit(nffile->decodeQueue, QueueSize);
+        queue_close(nffile->decodeQueue);
     } else {
         compression = nffile->file_header->compression;
         encryption = nffile->file_header->encryption;
@@ -702,6 +2268,7 @@ nffile_t *NewFile(nffile_t *nffile) {
 
     nffile->fd = 0;
     nffile->compat16 = 0;
+    nffile->stream = 0;
 
     if (nffile->fileName) {
         free(nffile->fileName);
@@ -711,22 +2278,116 @@ nffile_t *NewFile(nffile_t *nffile) {
         free(nffile->ident);
         nffile->ident = NULL;
     }
+    if (nffile->aggregation) {
+        free(nffile->aggregation);
+        nffile->aggregation = NULL;
+    }
     memset((void *)nffile->stat_record, 0, sizeof(stat_record_t));
     nffile->stat_record->firstseen = 0x7fffffffffffffff;
 
+    if (nffile->zstdDict) {
+        FreeZstdDict(nffile->zstdDict);
+        nffile->zstdDict = NULL;
+    }
+
+    if (nffile->payloadDict) {
+        FreePayloadDict(nffile->payloadDict);
+        nffile->payloadDict = NULL;
+    }
+
+    // reset block index - keep allocated memory
+    nffile->numIndex = 0;
+    nffile->twinFirst = 0;
+    nffile->twinLast = 0;
+    nffile->skippedBlocks = 0;
+    nffile->sampleLimit = 0;
+    nffile->numSummary = 0;
+    nffile->numBitmap = 0;
+    nffile->summaryFilter = NULL;
+    nffile->summaryEngine = NULL;
+    nffile->numInterval = 0;
+    nffile->firstBlock = 0;
+    nffile->lastBlock = 0;
+
+    if (nffile->ipBloom) {
+        FreeIPBloom(nffile->ipBloom);
+        nffile->ipBloom = NULL;
+    }
+    nffile->bloomMiss = 0;
+    if (nffile->rollup) {
+        RollupFree(nffile->rollup);
+        nffile->rollup = NULL;
+    }
+    nffile->blockTap = NULL;
+    nffile->tapArg = NULL;
+
     for (int i = 0; i < MAXWORKERS; i++) nffile->worker[i] = 0;
     atomic_store(&nffile->terminate, 0);
     pthread_mutex_init(&nffile->wlock, NULL);
+    pthread_cond_init(&nffile->wcond, NULL);
+    pthread_mutex_init(&nffile->qlock, NULL);
+    nffile->blockSeq = 0;
+    nffile->writeSeq = 0;
+    nffile->pooled = 0;
+    nffile->pending = 0;
+    nffile->smallFlushed = 0;
     return nffile;
 
 }  // End of NewFile
 
+// split an archive selection path#firstBlock-lastBlock into the path of the archive
+// file and its block range. Returns 0, if filename is not an archive selection
+static int ArchiveSelection(char *filename, char *path, size_t len, uint32_t *firstBlock, uint32_t *lastBlock) {
+    char *sep = strrchr(filename, '#');
+    if (!sep || sep == filename || (size_t)(sep - filename) >= len) return 0;
+
+    char c;
+    if (sscanf(sep + 1, "%u-%u%c", firstBlock, lastBlock, &c) != 2 || *firstBlock >= *lastBlock) return 0;
+    memcpy(path, filename, sep - filename);
+    path[sep - filename] = '\0';
+    return 1;
+
+}  // End of ArchiveSelection
+
+// read only the data blocks firstBlock .. lastBlock - 1 of an archive file. The stat
+// record becomes the sum of the intervals in the selected blocks
+static void SelectArchiveBlocks(nffile_t *nffile, uint32_t firstBlock, uint32_t lastBlock) {
+    if (lastBlock > nffile->file_header->NumBlocks) lastBlock = nffile->file_header->NumBlocks;
+    if (firstBlock > lastBlock) firstBlock = lastBlock;
+    nffile->firstBlock = firstBlock;
+    nffile->lastBlock = lastBlock;
+    if (nffile->numInterval == 0) return;
+
+    memset((void *)nffile->stat_record, 0, sizeof(stat_record_t));
+    nffile->stat_record->firstseen = 0x7fffffffffffffff;
+    for (uint32_t i = 0; i < nffile->numInterval; i++) {
+        intervalToc_t *toc = &(nffile->interval[i].toc);
+        if (toc->numBlocks && toc->firstBlock >= firstBlock && (toc->firstBlock + toc->numBlocks) <= lastBlock)
+            SumStatRecords(nffile->stat_record, &(nffile->interval[i].stat_record));
+    }
+
+}  // End of SelectArchiveBlocks
+
 static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile) {
-    struct stat stat_buf;
+    struct stat stat_buf = {0};
     int fd = 0;
+    int isPipe = 0;
+
+    // an archive file with a selection of its data blocks
+    char archivePath[MAXPATHLEN];
+    uint32_t firstBlock = 0, lastBlock = 0;
+    if (filename && ArchiveSelection(filename, archivePath, sizeof(archivePath), &firstBlock, &lastBlock)) filename = archivePath;
 
     if (filename == NULL) {
         return NULL;
+    } else if (StreamPath(filename)) {
+        // stdin or a pipe - stdin is duplicated, as fd 0 marks a closed file
+        isPipe = 1;
+        fd = strcmp(filename, "-") == 0 ? dup(STDIN_FILENO) : open(filename, O_RDONLY);
+        if (fd < 0) {
+            LogError("Error open file: %s", strerror(errno));
+            return NULL;
+        }
     } else {
         // regular file
         if (stat(filename, &stat_buf)) {
@@ -752,11 +2413,12 @@ static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile) {
         return NULL;
     }
     nffile->fd = fd;
+    nffile->stream = isPipe;
     if (nffile->fileName) free(nffile->fileName);
     nffile->fileName = strdup(filename);
 
     // assume file layout V2
-    ssize_t ret = read(nffile->fd, (void *)nffile->file_header, sizeof(fileHeaderV2_t));
+    ssize_t ret = readAll(nffile->fd, (void *)nffile->file_header, sizeof(fileHeaderV2_t));
     if (ret < 1) {
         LogError("read() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         CloseFile(nffile);
@@ -778,6 +2440,11 @@ static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile) {
     if (nffile->file_header->version != LAYOUT_VERSION_2) {
         if (nffile->file_header->version == LAYOUT_VERSION_1) {
             dbg_printf("Found layout type 1 => convert\n");
+            if (nffile->stream) {
+                LogError("Open file %s: layout 1 can not be read from a pipe", filename);
+                CloseFile(nffile);
+                return NULL;
+            }
             // transparent read old v1 layout
             // convert old layout
             fileHeaderV1_t fileHeaderV1;
@@ -842,14 +2509,14 @@ static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile) {
     }
     nffile->compat16 = 0;
 
-    if (FILE_ENCRYPTION(nffile)) {
-        LogError("Open file %s: Can not handle encrypted files", filename);
+    if (FILE_ENCRYPTION(nffile) && (FILE_ENCRYPTION(nffile) != AES256GCM_ENCRYPTED || !CryptEnabled())) {
+        LogError("Open file %s: Can not handle encrypted files. Set encryption.keyfile", filename);
         CloseFile(nffile);
         return NULL;
     }
 
 #ifndef HAVE_ZSTD
-    if (nffile->file_header->compression == ZSTD_COMPRESSED) {
+    if (nffile->file_header->compression == ZSTD_COMPRESSED || nffile->file_header->compression == ZSTDDICT_COMPRESSED) {
         LogError("ZSTD compression not compiled in. Skip file: %s", filename);
         CloseFile(nffile);
         return NULL;
@@ -864,7 +2531,16 @@ static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile) {
     }
 #endif
 
-    if (nffile->file_header->appendixBlocks) {
+    // the appendix blocks of a stream are inline. A file in a pipe has its appendix after the data blocks
+    if (nffile->file_header->offAppendix == STREAM_APPENDIX) {
+        nffile->stream = 1;
+    } else if (nffile->stream && nffile->file_header->compression == ZSTDDICT_COMPRESSED) {
+        LogError("Open file %s: zstd dictionary compressed files can not be read from a pipe", filename);
+        CloseFile(nffile);
+        return NULL;
+    } else if (nffile->stream) {
+        dbg_printf("Read appendix of %s after the data blocks\n", filename);
+    } else if (nffile->file_header->appendixBlocks) {
         if (nffile->file_header->offAppendix < stat_buf.st_size) {
             ReadAppendix(nffile);
         } else {
@@ -874,21 +2550,19 @@ static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile) {
         }
     }
 
+    if (lastBlock && !nffile->stream) SelectArchiveBlocks(nffile, firstBlock, lastBlock);
+
     return nffile;
 
 }  // End of OpenFileStatic
 
-nffile_t *OpenFile(char *filename, nffile_t *nffile) {
-    nffile = OpenFileStatic(filename, nffile);  // Open the file
-    if (!nffile) {
-        return NULL;
-    }
-
+static nffile_t *StartReader(nffile_t *nffile) {
     // kick off nfreader
     // there is only 1 reader thread -> slot 0
     pthread_t tid;
     atomic_store(&nffile->terminate, 0);
     queue_open(nffile->processQueue);
+    if (!nffile->stream && !CachedFile(nffile) && useMapping) MapFile(nffile);
     int err = pthread_create(&tid, NULL, nfreader, (void *)nffile);
     if (err) {
         nffile->worker[0] = 0;
@@ -898,6 +2572,18 @@ nffile_t *OpenFile(char *filename, nffile_t *nffile) {
     nffile->worker[0] = tid;
     return nffile;
 
+}  // End of StartReader
+
+nffile_t *OpenFile(char *filename, nffile_t *nffile) {
+    if (LiveSource(filename)) return OpenLiveFile(filename, nffile);
+
+    nffile = OpenFileStatic(filename, nffile);  // Open the file
+    if (!nffile) {
+        return NULL;
+    }
+
+    return StartReader(nffile);
+
 }  // End of OpenFile
 
 // Create a new nffile
@@ -910,7 +2596,7 @@ nffile_t *OpenNewFile(char *filename, nffile_t *nffile, int creator, int compres
     int fd;
 
 #ifndef HAVE_ZSTD
-    if ((compress & 0xFFFF) == ZSTD_COMPRESSED) {
+    if ((compress & 0xFFFF) == ZSTD_COMPRESSED || (compress & 0xFFFF) == ZSTDDICT_COMPRESSED) {
         LogError("Open file %s: ZSTD compression not compiled in");
         CloseFile(nffile);
         return NULL;
@@ -925,7 +2611,13 @@ nffile_t *OpenNewFile(char *filename, nffile_t *nffile, int creator, int compres
     }
 #endif
 
-    fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    // stdout or a pipe is written as a stream - stdout is duplicated, as fd 0 marks a closed file
+    int stream = StreamPath(filename);
+    if (stream) {
+        fd = strcmp(filename, "-") == 0 ? dup(STDOUT_FILENO) : open(filename, O_WRONLY);
+    } else {
+        fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
     if (fd < 0) {
         LogError("Failed to open file %s: '%s'", filename, strerror(errno));
         return NULL;
@@ -937,34 +2629,76 @@ nffile_t *OpenNewFile(char *filename, nffile_t *nffile, int creator, int compres
         return NULL;
     }
     nffile->fd = fd;
+    nffile->stream = stream;
     nffile->fileName = strdup(filename);
+    // collect the IP addresses of all flows - written to the appendix
+    // a stream is read sequentially and does not profit from the bloom filter
+    if (!stream) nffile->ipBloom = NewIPBloom(IPBLOOMBITS, IPBLOOMHASHES);
 
     nffile->file_header->magic = MAGIC;
     nffile->file_header->version = LAYOUT_VERSION_2;
     nffile->file_header->nfdversion = NFDVERSION;
     nffile->file_header->creator = creator;
     nffile->file_header->created = time(NULL);
+    // the header of a stream is not updated on close
+    if (stream) nffile->file_header->offAppendix = STREAM_APPENDIX;
     if (compress != INHERIT) {
         nffile->file_header->compression = COMPRESSION_TYPE(compress);
-        nffile->compression_level = COMPRESSION_LEVEL(compress);
+        nffile->compression_level = COMPRESSION_LEVEL(compress) & ~COMPRESSION_AUTO;
+        nffile->autoLevel = (COMPRESSION_LEVEL(compress) & COMPRESSION_AUTO) != 0 &&
+                            (nffile->file_header->compression == LZ4_COMPRESSED || nffile->file_header->compression == ZSTD_COMPRESSED);
     }
     if (encryption != INHERIT) {
         nffile->file_header->encryption = encryption;
     }
+    // with a configured key, all files are written encrypted
+    if (nffile->file_header->encryption == NOT_ENCRYPTED && CryptEnabled()) nffile->file_header->encryption = AES256GCM_ENCRYPTED;
+    if (nffile->file_header->encryption != NOT_ENCRYPTED && (nffile->file_header->encryption != AES256GCM_ENCRYPTED || !CryptEnabled())) {
+        LogError("Open file %s: encryption %u not available", filename, nffile->file_header->encryption);
+        CloseFile(nffile);
+        return NULL;
+    }
 
     dbg_printf("OpenNewFile compression: %d, level: %d\n", nffile->file_header->compression, nffile->compression_level);
 
-    if (write(nffile->fd, (void *)nffile->file_header, sizeof(fileHeaderV2_t)) < sizeof(fileHeaderV2_t)) {
+    if (nffile->file_header->compression == ZSTDDICT_COMPRESSED) {
+        if (!writeDict) {
+            LogError("Open file %s: no zstd dictionary configured - set zstd.dict", filename);
+            close(nffile->fd);
+            nffile->fd = 0;
+            return NULL;
+        }
+        nffile->zstdDict = NewZstdDict(writeDict->dict, writeDict->size);
+        if (!nffile->zstdDict || !PrepareZstdDict(nffile->zstdDict, nffile->compression_level)) {
+            LogError("Open file %s: failed to prepare zstd dictionary", filename);
+            close(nffile->fd);
+            nffile->fd = 0;
+            return NULL;
+        }
+    }
+
+    if (writeAll(nffile->fd, (void *)nffile->file_header, sizeof(fileHeaderV2_t)) < 0) {
         LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         close(nffile->fd);
         nffile->fd = 0;
         return NULL;
     }
 
+#ifdef HAVE_LIBURING
+    if (!stream) UringOpen(nffile);
+#endif
+
     // kick off nfwriter
     atomic_store(&nffile->terminate, 0);
+    nffile->blockSeq = 0;
+    nffile->writeSeq = 0;
     queue_open(nffile->processQueue);
 
+    // blocks are written by the shared writer pool
+    nffile->pending = 0;
+    nffile->pooled = writerPool.numThreads > 0;
+    if (nffile->pooled) return nffile;
+
     // if file is not compressed, 2 workers are fine.
     unsigned NumThreads = nffile->file_header->compression == 0 ? 2 : NumWorkers;
     for (unsigned i = 0; i < NumThreads; i++) {
@@ -987,8 +2721,13 @@ nffile_t *AppendFile(char *filename) {
     // try to open the existing file
     nffile = OpenFileStatic(filename, NULL);
     if (!nffile) return NULL;
-
-    // file is valid - re-open the file mode RDWR
+    if (nffile->stream) {
+        LogError("Can not append to stream file: %s", filename);
+        DisposeFile(nffile);
+        return NULL;
+    }
+
+    // file is valid - re-open the file mode RDWR
     close(nffile->fd);
     nffile->fd = open(filename, O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     if (nffile->fd < 0) {
@@ -1020,10 +2759,29 @@ nffile_t *AppendFile(char *filename) {
         }
     }
 
+    // appended blocks are compressed with the dictionary of the file
+    if (nffile->file_header->compression == ZSTDDICT_COMPRESSED &&
+        (!nffile->zstdDict || !PrepareZstdDict(nffile->zstdDict, nffile->compression_level))) {
+        LogError("Append file %s: zstd dictionary not available", filename);
+        DisposeFile(nffile);
+        return NULL;
+    }
+
+#ifdef HAVE_LIBURING
+    UringOpen(nffile);
+#endif
+
     // kick off NumWorkers nfwriter threads
     atomic_store(&nffile->terminate, 0);
+    nffile->blockSeq = 0;
+    nffile->writeSeq = 0;
     queue_open(nffile->processQueue);
 
+    // blocks are written by the shared writer pool
+    nffile->pending = 0;
+    nffile->pooled = writerPool.numThreads > 0;
+    if (nffile->pooled) return nffile;
+
     unsigned NumThreads = nffile->file_header->compression == 0 ? 1 : NumWorkers;
     for (unsigned i = 0; i < NumThreads; i++) {
         pthread_t tid;
@@ -1058,7 +2816,7 @@ int RenameAppend(char *oldName, char *newName) {
                 dataBlock_t *block_header = queue_pop(nffile_r->processQueue);
                 if (block_header == QUEUE_CLOSED)  // EOF
                     break;
-                queue_push(nffile_w->processQueue, block_header);
+                QueueWriteBlock(nffile_w, block_header);
             }
             CloseFile(nffile_r);
 
@@ -1086,6 +2844,20 @@ int RenameAppend(char *oldName, char *newName) {
 
 // let writers flush pending blocks to disk
 static void FlushFile(nffile_t *nffile) {
+    if (nffile->pooled) {
+        // wait for the pool writers to write all blocks of this file
+        pthread_mutex_lock(&nffile->wlock);
+        while (nffile->pending) pthread_cond_wait(&nffile->wcond, &nffile->wlock);
+        pthread_mutex_unlock(&nffile->wlock);
+        queue_close(nffile->processQueue);
+        nffile->pooled = 0;
+#ifdef HAVE_LIBURING
+        if (nffile->uring) UringClose(nffile);
+#endif
+        fsync(nffile->fd);
+        return;
+    }
+
     // done - close queue
     queue_close(nffile->processQueue);
     // wait for queue to be empty
@@ -1102,6 +2874,9 @@ static void FlushFile(nffile_t *nffile) {
             nffile->worker[i] = 0;
         }
     }
+#ifdef HAVE_LIBURING
+    if (nffile->uring) UringClose(nffile);
+#endif
     fsync(nffile->fd);
 
 }  // End of FlushFile
@@ -1117,9 +2892,18 @@ void CloseFile(nffile_t *nffile) {
         }
     }
 
+#ifdef HAVE_LIBURING
+    if (nffile->uring) UringClose(nffile);
+#endif
+
     close(nffile->fd);
     nffile->fd = 0;
 
+    if (nffile->fileMap) {
+        ReleaseMap(nffile->fileMap);
+        nffile->fileMap = NULL;
+    }
+
     if (nffile->fileName) {
         free(nffile->fileName);
         nffile->fileName = NULL;
@@ -1130,6 +2914,11 @@ void CloseFile(nffile_t *nffile) {
         nffile->ident = NULL;
     }
 
+    if (nffile->aggregation) {
+        free(nffile->aggregation);
+        nffile->aggregation = NULL;
+    }
+
     // clean queue
     queue_close(nffile->processQueue);
     while (queue_length(nffile->processQueue)) {
@@ -1148,6 +2937,12 @@ int CloseUpdateFile(nffile_t *nffile) {
         LogError("Failed to write appendix");
     }
 
+    // the header of a stream was written once on open
+    if (nffile->stream) {
+        CloseFile(nffile);
+        return 1;
+    }
+
     if (lseek(nffile->fd, 0, SEEK_SET) < 0) {
         LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         close(nffile->fd);
@@ -1182,7 +2977,16 @@ void DisposeFile(nffile_t *nffile) {
     if (nffile->file_header) free(nffile->file_header);
     if (nffile->stat_record) free(nffile->stat_record);
     if (nffile->ident) free(nffile->ident);
+    if (nffile->aggregation) free(nffile->aggregation);
     if (nffile->fileName) free(nffile->fileName);
+    if (nffile->blockIndex) free(nffile->blockIndex);
+    if (nffile->blockSummary) free(nffile->blockSummary);
+    if (nffile->blockBitmap) free(nffile->blockBitmap);
+    if (nffile->interval) free(nffile->interval);
+    if (nffile->zstdDict) FreeZstdDict(nffile->zstdDict);
+    if (nffile->payloadDict) FreePayloadDict(nffile->payloadDict);
+    if (nffile->ipBloom) FreeIPBloom(nffile->ipBloom);
+    if (nffile->rollup) RollupFree(nffile->rollup);
 
     queue_close(nffile->processQueue);
     for (size_t queueLen = queue_length(nffile->processQueue); queueLen > 0; queueLen--) {
@@ -1191,10 +2995,50 @@ void DisposeFile(nffile_t *nffile) {
     }
 
     queue_free(nffile->processQueue);
+    queue_free(nffile->decodeQueue);
     free(nffile);
 
 }  // End of DisposeFile
 
+// let the kernel read ahead the header, the first blocks and the appendix of a file
+static void PrefetchFile(char *fileName) {
+#ifdef HAVE_POSIX_FADVISE
+    // a pipe must not be opened twice
+    if (StreamPath(fileName)) return;
+    char archivePath[MAXPATHLEN];
+    uint32_t firstBlock, lastBlock;
+    if (ArchiveSelection(fileName, archivePath, sizeof(archivePath), &firstBlock, &lastBlock)) fileName = archivePath;
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) return;
+
+    fileHeaderV2_t fileHeader;
+    ssize_t ret = pread(fd, (void *)&fileHeader, sizeof(fileHeaderV2_t), 0);
+    posix_fadvise(fd, 0, PREFETCHSIZE, POSIX_FADV_WILLNEED);
+    if (ret == sizeof(fileHeaderV2_t) && fileHeader.magic == MAGIC && fileHeader.version == LAYOUT_VERSION_2 &&
+        fileHeader.offAppendix > PREFETCHSIZE) {
+        posix_fadvise(fd, fileHeader.offAppendix, 0, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+#endif
+}  // End of PrefetchFile
+
+// pass the files of the file list to the prefetch queue. As the queue is bounded,
+// the thread prefetches up to PREFETCHFILES files ahead of the reader
+__attribute__((noreturn)) static void *prefetchThread(void *arg) {
+    queue_t *fileList = (queue_t *)arg;
+
+    char *fileName;
+    while ((fileName = queue_pop(fileList)) != QUEUE_CLOSED) {
+        PrefetchFile(fileName);
+        queue_push(prefetchQueue, fileName);
+    }
+    queue_close(prefetchQueue);
+
+    dbg_printf("prefetchThread done\n");
+    pthread_exit(NULL);
+
+}  // End of prefetchThread
+
 nffile_t *GetNextFile(nffile_t *nffile) {
     // close current file before open the next one
     if (nffile) {
@@ -1208,6 +3052,9 @@ nffile_t *GetNextFile(nffile_t *nffile) {
         return NULL;
     }
 
+    // all files are read as a single file of the merged sources
+    if (mergeWindow) return OpenMergedFile(fileQueue, nffile, mergeWindow);
+
     while (1) {
         char *nextFile = queue_pop(fileQueue);
         if (nextFile == QUEUE_CLOSED) {
@@ -1216,15 +3063,296 @@ nffile_t *GetNextFile(nffile_t *nffile) {
         }
 
         dbg_printf("Process: '%s'\n", nextFile);
-        nffile = OpenFile(nextFile, nffile);  // Open the file
+        if (LiveSource(nextFile)) {
+            nffile = OpenLiveFile(nextFile, nffile);
+            free(nextFile);
+            return nffile;
+        }
+        if (followFile) {
+            nffile = OpenFollowFile(nextFile, nffile);
+            free(nextFile);
+            return nffile;
+        }
+        nffile = OpenFileStatic(nextFile, nffile);  // Open the file
         free(nextFile);
-        return nffile;
+        if (!nffile) return NULL;
+
+        // let the reader skip blocks outside the time window
+        nffile->twinFirst = blockTwinFirst;
+        nffile->twinLast = blockTwinLast;
+        // and all flow blocks, if none of the filter's IP addresses is in the file
+        if (blockNumIPKeys && nffile->ipBloom) nffile->bloomMiss = !IPBloomCheckKeys(nffile->ipBloom, blockIPKeys, blockNumIPKeys);
+        // and blocks not in the sample
+        nffile->sampleLimit = blockSampleLimit;
+        // and blocks, which can not match the filter
+        if (!nffile->stream && nffile->numSummary == nffile->file_header->NumBlocks) {
+            nffile->summaryFilter = blockSummaryFilter;
+            nffile->summaryEngine = blockSummaryEngine;
+        }
+        return StartReader(nffile);
     }
 
     /* NOTREACHED */
 
 }  // End of GetNextFile
 
+// set time window for files opened by GetNextFile(). nfreader skips all blocks
+// with no flows inside msecFirst, msecLast, if the file has a block index
+void SetBlockTimeWindow(uint64_t msecFirst, uint64_t msecLast) {
+    blockTwinFirst = msecFirst;
+    blockTwinLast = msecLast;
+}  // End of SetBlockTimeWindow
+
+// set the IP addresses for files opened by GetNextFile(). A flow can only match, if any
+// of the IP addresses is in the flow. nfreader skips all flow blocks of a file, if its
+// IP bloom filter contains none of them. The keys are owned by the caller
+void SetBlockIPFilter(ipKey_t *keys, uint32_t numKeys) {
+    blockIPKeys = keys;
+    blockNumIPKeys = keys ? numKeys : 0;
+}  // End of SetBlockIPFilter
+
+// set the filter function for files opened by GetNextFile(). nfreader skips all flow
+// blocks, of which summaryFilter() returns 0 for the block summary
+void SetBlockSummaryFilter(summaryFilter_t summaryFilter, const void *engine) {
+    blockSummaryFilter = summaryFilter;
+    blockSummaryEngine = engine;
+}  // End of SetBlockSummaryFilter
+
+// explain the next file of the file queue for the query plan. The file is opened
+// without reader and its blocks are selected the same way nfreader() skips blocks
+// with the time window, IP and summary filters of GetNextFile().
+// Returns 1 for an explained file, 0 if no more files are available
+int ExplainNextFile(fileExplain_t *explain) {
+    if (!fileQueue) return 0;
+
+    nffile_t *nffile = NULL;
+    while (nffile == NULL) {
+        char *nextFile = queue_pop(fileQueue);
+        if (nextFile == QUEUE_CLOSED) return 0;
+
+        if (LiveSource(nextFile) || StreamPath(nextFile)) {
+            LogError("Can not explain live source or stream %s", nextFile);
+            free(nextFile);
+            continue;
+        }
+        nffile = OpenFileStatic(nextFile, NULL);
+        if (!nffile) {
+            free(nextFile);
+            continue;
+        }
+
+        memset((void *)explain, 0, sizeof(fileExplain_t));
+        explain->fileName = nextFile;
+    }
+
+    struct stat stat_buf;
+    if (fstat(nffile->fd, &stat_buf) == 0) explain->size = stat_buf.st_size;
+    explain->msecFirst = nffile->stat_record->firstseen;
+    explain->msecLast = nffile->stat_record->lastseen;
+    explain->numFlows = nffile->stat_record->numflows;
+    explain->numBlocks = nffile->lastBlock ? nffile->lastBlock - nffile->firstBlock : nffile->file_header->NumBlocks;
+    explain->compression = nffile->file_header->compression;
+    explain->hasIndex = nffile->numIndex == nffile->file_header->NumBlocks;
+    explain->hasSummary = explain->hasIndex && nffile->numSummary == nffile->file_header->NumBlocks;
+    explain->hasBloom = nffile->ipBloom != NULL;
+    if (blockNumIPKeys && nffile->ipBloom) explain->bloomMiss = !IPBloomCheckKeys(nffile->ipBloom, blockIPKeys, blockNumIPKeys);
+    if (blockTwinLast && explain->numFlows)
+        explain->outsideWindow = explain->msecLast <= blockTwinFirst || explain->msecFirst >= blockTwinLast;
+
+    // same block selection as nfreader()
+    int useIndex = (blockTwinLast || explain->bloomMiss || explain->hasSummary) && explain->hasIndex;
+    uint32_t lastBlock = nffile->lastBlock ? nffile->lastBlock : nffile->numIndex;
+    if (useIndex) {
+        for (uint32_t i = nffile->firstBlock; i < lastBlock; i++) {
+            blockIndex_t *blockIndex = &(nffile->blockIndex[i]);
+            int noFlows = explain->bloomMiss ||
+                          (blockTwinLast && (blockIndex->msecLast <= blockTwinFirst || blockIndex->msecFirst >= blockTwinLast));
+            if (!noFlows && explain->hasSummary && blockSummaryFilter)
+                noFlows = blockSummaryFilter(blockSummaryEngine, &(nffile->blockSummary[i]),
+                                             nffile->numBitmap == nffile->numSummary ? &(nffile->blockBitmap[i]) : NULL) == 0;
+            if (noFlows && (blockIndex->flags & FLAG_INDEX_NOSKIP) == 0) continue;
+            explain->selectedBlocks++;
+            explain->selectedRecords += blockIndex->NumRecords;
+        }
+    } else {
+        explain->selectedBlocks = explain->numBlocks;
+        explain->selectedRecords = explain->hasIndex ? 0 : explain->numFlows;
+        for (uint32_t i = nffile->firstBlock; explain->hasIndex && i < lastBlock; i++) explain->selectedRecords += nffile->blockIndex[i].NumRecords;
+    }
+    if (blockSampleLimit) {
+        explain->selectedBlocks = ((uint64_t)explain->selectedBlocks * blockSampleLimit) >> 32;
+        explain->selectedRecords = (explain->selectedRecords * blockSampleLimit) >> 32;
+    }
+
+    DisposeFile(nffile);
+    return 1;
+
+}  // End of ExplainNextFile
+
+// read only a deterministic sample of fraction (0.0 .. 1.0) of the data blocks
+// of files opened by GetNextFile(). 0 or 1.0: read all blocks
+void SetBlockSample(double fraction) {
+    blockSampleLimit = (fraction > 0.0 && fraction < 1.0) ? (uint64_t)(fraction * 4294967296.0) : 0;
+}  // End of SetBlockSample
+
+// tap all blocks written to nffile, before they get compressed. blockTap is called
+// by the writer threads in parallel
+void SetBlockTap(nffile_t *nffile, blockTap_t blockTap, void *arg) {
+    nffile->tapArg = arg;
+    nffile->blockTap = blockTap;
+}  // End of SetBlockTap
+
+// returns true, if path is the live socket of a collector
+int LiveSource(char *path) {
+    struct stat stat_buf;
+    return path && stat(path, &stat_buf) == 0 && S_ISSOCK(stat_buf.st_mode);
+}  // End of LiveSource
+
+// returns true, if path is read or written sequentially: - for stdin/stdout or a named pipe
+int StreamPath(char *path) {
+    struct stat stat_buf;
+    return path && (strcmp(path, "-") == 0 || (stat(path, &stat_buf) == 0 && S_ISFIFO(stat_buf.st_mode)));
+}  // End of StreamPath
+
+// set the time window in seconds, live sockets are read by GetNextFile(). 0: until closed
+void SetLiveWindow(uint32_t seconds) {
+    //
+    liveWindow = seconds;
+}  // End of SetLiveWindow
+
+// read files opened by GetNextFile() as they grow, like tail -f, until terminated
+void SetFollowFile(int enable) {
+    //
+    followFile = enable;
+}  // End of SetFollowFile
+
+// merge the files of all sources in time order, with records out of order by less than seconds
+void SetMergeWindow(uint32_t seconds) {
+    //
+    mergeWindow = seconds;
+}  // End of SetMergeWindow
+
+static inline uint64_t msecNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}  // End of msecNow
+
+// read len bytes from the live socket until the deadline in msec
+static int LiveRead(nffile_t *nffile, void *buff, size_t len, uint64_t deadline) {
+    size_t done = 0;
+    while (done < len) {
+        if (atomic_load(&nffile->terminate) || (deadline && msecNow() >= deadline)) return 0;
+        struct pollfd pfd = {.fd = nffile->fd, .events = POLLIN};
+        int ret = poll(&pfd, 1, 100);
+        if (ret < 0 && errno != EINTR) {
+            LogError("poll() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        if (ret <= 0) continue;
+
+        ssize_t n = read(nffile->fd, buff + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        done += n;
+    }
+    return 1;
+
+}  // End of LiveRead
+
+// read the uncompressed blocks, published by the collector, until the live window ends
+__attribute__((noreturn)) static void *liveReader(void *arg) {
+    nffile_t *nffile = (nffile_t *)arg;
+
+    /* Signal handling */
+    sigset_t set = {0};
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    uint64_t deadline = liveWindow ? nffile->stat_record->lastseen : 0;
+    uint32_t blockCount = 0;
+    while (1) {
+        dataBlock_t *block_header = NewDataBlock();
+        if (!LiveRead(nffile, block_header, sizeof(dataBlock_t), deadline)) {
+            FreeDataBlock(block_header);
+            break;
+        }
+        if (block_header->size > (BUFFSIZE - sizeof(dataBlock_t))) {
+            LogError("Live socket %s: corrupt block size: %u", nffile->fileName, block_header->size);
+            FreeDataBlock(block_header);
+            break;
+        }
+        if (!LiveRead(nffile, GetCursor(block_header), block_header->size, deadline) ||
+            queue_push(nffile->processQueue, (void *)block_header) == QUEUE_CLOSED) {
+            FreeDataBlock(block_header);
+            break;
+        }
+        blockCount++;
+    }
+
+    queue_close(nffile->processQueue);
+    dbg_printf("liveReader done - read %u blocks\n", blockCount);
+
+    atomic_store(&nffile->terminate, 2);
+    pthread_exit(NULL);
+
+}  // End of liveReader
+
+// subscribe to the live socket of a collector. The blocks are read by liveReader
+static nffile_t *OpenLiveFile(char *filename, nffile_t *nffile) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(filename) >= sizeof(addr.sun_path)) {
+        LogError("Live socket path too long: %s", filename);
+        return NULL;
+    }
+    strcpy(addr.sun_path, filename);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LogError("connect() to live socket %s failed: %s", filename, strerror(errno));
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    nffile = NewFile(nffile);
+    if (!nffile) {
+        close(fd);
+        return NULL;
+    }
+    nffile->fd = fd;
+    nffile->fileName = strdup(filename);
+    nffile->ident = strdup("live");
+    uint64_t now = msecNow();
+    nffile->stat_record->firstseen = now;
+    nffile->stat_record->lastseen = now + 1000LL * liveWindow;
+
+    atomic_store(&nffile->terminate, 0);
+    queue_open(nffile->processQueue);
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, liveReader, (void *)nffile);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        CloseFile(nffile);
+        return NULL;
+    }
+    nffile->worker[0] = tid;
+
+    return nffile;
+
+}  // End of OpenLiveFile
+
+// enable or disable mmap read mode for files opened afterwards
+void SetFileMapping(int enable) {
+    //
+    useMapping = enable;
+}  // End of SetFileMapping
+
+// sort the flow records of each written block before compression - see SortBlock()
+void SetBlockSort(int enable) {
+    //
+    sortBlocks = enable;
+}  // End of SetBlockSort
+
 dataBlock_t *ReadBlock(nffile_t *nffile, dataBlock_t *dataBlock) {
     if (dataBlock) FreeDataBlock(dataBlock);
     dataBlock = queue_pop(nffile->processQueue);
@@ -1238,10 +3366,114 @@ dataBlock_t *ReadBlock(nffile_t *nffile, dataBlock_t *dataBlock) {
 
 }  // End of ReadBlock
 
-// generic read und uncompress a data block from current position
-static dataBlock_t *nfread(nffile_t *nffile) {
+// returns the codec of a data block as stored in the file. Blocks of older
+// versions carry no codec and are compressed with the file compression
+static inline int BlockCodec(nffile_t *nffile, dataBlock_t *block) {
+    if (block->flags & FLAG_BLOCK_CODEC) return BLOCK_CODEC(block->flags);
+    if (block->flags & FLAG_BLOCK_UNCOMPRESSED) return NOT_COMPRESSED;
+    return nffile->file_header->compression;
+}  // End of BlockCodec
+
+// verify the CRC32C of a data block and strip it from the block. Returns 0 on mismatch
+static int CheckBlockCRC(dataBlock_t *block) {
+    if ((block->flags & FLAG_BLOCK_CRC) == 0) return 1;
+
+    if (block->size <= sizeof(uint32_t)) {
+        LogError("Corrupt data file: Block size %u too small for checksum", block->size);
+        return 0;
+    }
+    uint32_t size = block->size - sizeof(uint32_t);
+    uint32_t crc;
+    memcpy((void *)&crc, GetCursor(block) + size, sizeof(uint32_t));
+    if (CRC32C(GetCursor(block), size) != crc) {
+        LogError("Corrupt data file: Block checksum mismatch");
+        return 0;
+    }
+    block->size = size;
+    block->flags &= ~FLAG_BLOCK_CRC;
+    return 1;
+
+}  // End of CheckBlockCRC
+
+// returns true, if a data block is stored encrypted
+static inline int BlockEncrypted(nffile_t *nffile, dataBlock_t *block) {
+    return nffile->file_header->encryption != NOT_ENCRYPTED && (block->flags & FLAG_BLOCK_UNENCRYPTED) == 0;
+}  // End of BlockEncrypted
+
+// decrypt and uncompress a data block into a new data block
+static dataBlock_t *UncompressBlock(nffile_t *nffile, dataBlock_t *in) {
+    // encrypted blocks are decrypted first
+    dataBlock_t *plain = NULL;
+    if (BlockEncrypted(nffile, in)) {
+        plain = NewDataBlock();
+        if (Decrypt_Block(in, plain) < 0) {
+            FreeDataBlock(plain);
+            return NULL;
+        }
+        plain->flags &= ~FLAG_BLOCK_MAPPED;
+        if (BlockCodec(nffile, plain) == NOT_COMPRESSED) return plain;
+        in = plain;
+    }
+
+    int compression = BlockCodec(nffile, in);
+    dataBlock_t *block_header = NewDataBlock();
+    int failed = 0;
+    uint64_t t0 = codecNsec();
+    switch (compression) {
+        case NOT_COMPRESSED:
+            memcpy((void *)block_header, (void *)in, sizeof(dataBlock_t) + in->size);
+            break;
+        case LZO_COMPRESSED:
+            if (Uncompress_Block_LZO(in, block_header, nffile->buff_size) < 0) failed = 1;
+            break;
+        case LZ4_COMPRESSED:
+            if (Uncompress_Block_LZ4(in, block_header, nffile->buff_size) < 0) failed = 1;
+            break;
+        case BZ2_COMPRESSED:
+            if (Uncompress_Block_BZ2(in, block_header, nffile->buff_size) < 0) failed = 1;
+            break;
+        case ZSTD_COMPRESSED:
+        case ZSTDDICT_COMPRESSED:
+            if (Uncompress_Block_ZSTD(in, block_header, nffile->buff_size, nffile->zstdDict) < 0) failed = 1;
+            break;
+        default:
+            LogError("Unknown compression %d of data block", compression);
+            failed = 1;
+    }
+
+    if (failed) {
+        FreeDataBlock(block_header);
+        FreeDataBlock(plain);
+        return NULL;
+    }
+    UpdateCodecStat(compression, in->size, block_header->size, codecNsec() - t0);
+    FreeDataBlock(plain);
+
+    block_header->flags &= ~FLAG_BLOCK_MAPPED;
+    return block_header;
+
+}  // End of UncompressBlock
+
+// resolve the payload references of a data block with the payload dictionary of the file
+static dataBlock_t *ResolvePayloads(nffile_t *nffile, dataBlock_t *dataBlock) {
+    if (!nffile->payloadDict || !dataBlock || dataBlock->type != DATA_BLOCK_TYPE_3) return dataBlock;
+
+    dataBlock_t *outBlock = NewDataBlock();
+    int ret = ExpandPayloadBlock(nffile->payloadDict, dataBlock, outBlock);
+    if (ret <= 0) {
+        if (ret < 0) LogError("Failed to resolve payloads of data block in file: %s", nffile->fileName);
+        FreeDataBlock(outBlock);
+        return dataBlock;
+    }
+    FreeDataBlock(dataBlock);
+    return outBlock;
+
+}  // End of ResolvePayloads
+
+// read a data block as stored in the file from current position
+static dataBlock_t *nfreadRaw(nffile_t *nffile) {
     dataBlock_t *buff = NewDataBlock();
-    ssize_t ret = read(nffile->fd, buff, sizeof(dataBlock_t));
+    ssize_t ret = readAll(nffile->fd, buff, sizeof(dataBlock_t));
     if (ret == 0) {  // EOF
         FreeDataBlock(buff);
         return NULL;
@@ -1270,48 +3502,14 @@ static dataBlock_t *nfread(nffile_t *nffile) {
         return NULL;
     }
 
-    int compression = nffile->file_header->compression;
-
     void *p = (void *)((void *)buff + sizeof(dataBlock_t));
     dbg_printf("ReadBlock - read: %u\n", buff->size);
-    ret = read(nffile->fd, p, buff->size);
+    ret = readAll(nffile->fd, p, buff->size);
     if (ret == buff->size) {
-        dataBlock_t *block_header = NULL;
-        int failed = 0;
         // we have the whole record and are done for now
-        switch (compression) {
-            case NOT_COMPRESSED:
-                block_header = buff;
-                break;
-            case LZO_COMPRESSED:
-                block_header = NewDataBlock();
-                if (Uncompress_Block_LZO(buff, block_header, nffile->buff_size) < 0) failed = 1;
-                FreeDataBlock(buff);
-                break;
-            case LZ4_COMPRESSED:
-                block_header = NewDataBlock();
-                if (Uncompress_Block_LZ4(buff, block_header, nffile->buff_size) < 0) failed = 1;
-                FreeDataBlock(buff);
-                break;
-            case BZ2_COMPRESSED:
-                block_header = NewDataBlock();
-                if (Uncompress_Block_BZ2(buff, block_header, nffile->buff_size) < 0) failed = 1;
-                FreeDataBlock(buff);
-                break;
-            case ZSTD_COMPRESSED:
-                block_header = NewDataBlock();
-                if (Uncompress_Block_ZSTD(buff, block_header, nffile->buff_size) < 0) failed = 1;
-                FreeDataBlock(buff);
-                break;
-        }
-
-        if (failed) {
-            FreeDataBlock(block_header);
-            return NULL;
-        }
-        // success - done
-        return block_header;
-
+        if (CheckBlockCRC(buff)) return buff;
+        FreeDataBlock(buff);
+        return NULL;
     } else if (ret == 0) {
         LogError("ReadBlock() Corrupt data file: Unexpected EOF while reading data block");
     } else if (ret == -1) {  // ERROR
@@ -1323,8 +3521,244 @@ static dataBlock_t *nfread(nffile_t *nffile) {
     FreeDataBlock(buff);
     return NULL;
 
+}  // End of nfreadRaw
+
+// uncompress a data block read by nfreadRaw()
+static dataBlock_t *nfdecode(nffile_t *nffile, dataBlock_t *buff) {
+    if (BlockCodec(nffile, buff) == NOT_COMPRESSED && !BlockEncrypted(nffile, buff)) {
+        UpdateCodecStat(NOT_COMPRESSED, buff->size, buff->size, 0);
+        buff->flags &= ~FLAG_BLOCK_MAPPED;
+        return buff;
+    }
+
+    dataBlock_t *block_header = UncompressBlock(nffile, buff);
+    FreeDataBlock(buff);
+    return block_header;
+
+}  // End of nfdecode
+
+// generic read und uncompress a data block from current position
+static dataBlock_t *nfread(nffile_t *nffile) {
+    if (nffile->fileMap) return nfreadMapped(nffile);
+
+    dataBlock_t *buff = nfreadRaw(nffile);
+    if (!buff) return NULL;
+
+    return nfdecode(nffile, buff);
+
 }  // End of nfread
 
+// read the next data block of a stream as stored. The inline appendix blocks are processed
+// on the way. A file in a pipe has its appendix blocks after NumBlocks data blocks
+static dataBlock_t *nfreadStream(nffile_t *nffile, uint32_t blockCount) {
+    int inlineAppendix = nffile->file_header->offAppendix == STREAM_APPENDIX;
+    while (1) {
+        dataBlock_t *rawBlock = nfreadRaw(nffile);
+        if (!rawBlock) return NULL;
+        if ((rawBlock->flags & FLAG_BLOCK_APPENDIX) == 0 && (inlineAppendix || blockCount < nffile->file_header->NumBlocks)) return rawBlock;
+
+        int payloadError = 0;
+        dataBlock_t *block_header = nfdecode(nffile, rawBlock);
+        int ok = block_header && ReadAppendixBlock(nffile, block_header, blockCount > 0, &payloadError);
+        FreeDataBlock(block_header);
+        if (!ok) {
+            LogError("Unable to read appendix block of file: %s", nffile->fileName);
+            return NULL;
+        }
+    }
+
+    /* NOTREACHED */
+
+}  // End of nfreadStream
+
+// return the data block at the current mapping offset and advance the offset
+static dataBlock_t *nfmapBlock(nffile_t *nffile, size_t *blockOffset) {
+    fileMap_t *fileMap = nffile->fileMap;
+    size_t offset = nffile->mapOffset;
+
+    if (offset == fileMap->size) {  // EOF
+        return NULL;
+    }
+
+    if ((offset + sizeof(dataBlock_t)) > fileMap->size) {
+        LogError("Corrupt data file: Read %i bytes, requested %u", fileMap->size - offset, sizeof(dataBlock_t));
+        return NULL;
+    }
+
+    dataBlock_t *mapBlock = (dataBlock_t *)(fileMap->addr + offset);
+    dbg_printf("ReadBlock - type: %u, size: %u, numRecords: %u, flags: %u\n", mapBlock->type, mapBlock->size, mapBlock->NumRecords,
+               mapBlock->flags);
+
+    if (mapBlock->size > (BUFFSIZE - sizeof(dataBlock_t)) || mapBlock->size == 0 || mapBlock->NumRecords == 0) {
+        // this is most likely a corrupt file
+        LogError("Corrupt data file: Error buffer size %u", mapBlock->size);
+        return NULL;
+    }
+
+    if ((offset + sizeof(dataBlock_t) + mapBlock->size) > fileMap->size) {
+        LogError("ReadBlock() Corrupt data file: Unexpected EOF while reading data block");
+        return NULL;
+    }
+    nffile->mapOffset += sizeof(dataBlock_t) + mapBlock->size;
+    if (fileMap->cached) nffile->mapOffset = Align8(nffile->mapOffset);
+
+    // the mapping is private - the checksum is stripped in place
+    if (!CheckBlockCRC(mapBlock)) return NULL;
+
+    if (blockOffset) *blockOffset = offset;
+    return mapBlock;
+
+}  // End of nfmapBlock
+
+// read a data block from the file mapping. Uncompressed blocks are not copied,
+// compressed blocks are uncompressed directly from the mapping
+static dataBlock_t *nfreadMapped(nffile_t *nffile) {
+    fileMap_t *fileMap = nffile->fileMap;
+    size_t offset = 0;
+    dataBlock_t *mapBlock = nfmapBlock(nffile, &offset);
+    if (!mapBlock) return NULL;
+
+    // blocks of a cached image are uncompressed
+    if (fileMap->cached || (BlockCodec(nffile, mapBlock) == NOT_COMPRESSED && !BlockEncrypted(nffile, mapBlock))) {
+        UpdateCodecStat(NOT_COMPRESSED, mapBlock->size, mapBlock->size, 0);
+        // keep the record alignment of a malloced block, otherwise copy
+        if ((offset & 0x7) == 0) {
+            atomic_fetch_add(&fileMap->refCnt, 1);
+            atomic_fetch_add(&blocksInUse, 1);
+            mapBlock->flags |= FLAG_BLOCK_MAPPED;
+            return mapBlock;
+        }
+        dataBlock_t *block_header = NewDataBlock();
+        memcpy((void *)block_header, (void *)mapBlock, sizeof(dataBlock_t) + mapBlock->size);
+        block_header->flags &= ~FLAG_BLOCK_MAPPED;
+        return block_header;
+    }
+
+    return UncompressBlock(nffile, mapBlock);
+
+}  // End of nfreadMapped
+
+// skip data block at current position without reading the data
+static int nfskip(nffile_t *nffile) {
+    if (nffile->fileMap) {
+        fileMap_t *fileMap = nffile->fileMap;
+        if ((nffile->mapOffset + sizeof(dataBlock_t)) > fileMap->size) return 0;
+        dataBlock_t *mapBlock = (dataBlock_t *)(fileMap->addr + nffile->mapOffset);
+        nffile->mapOffset += sizeof(dataBlock_t) + mapBlock->size;
+        if (fileMap->cached) nffile->mapOffset = Align8(nffile->mapOffset);
+        return nffile->mapOffset <= fileMap->size;
+    }
+
+    dataBlock_t dataBlock = {0};
+    ssize_t ret = read(nffile->fd, (void *)&dataBlock, sizeof(dataBlock_t));
+    if (ret != sizeof(dataBlock_t)) {
+        if (ret < 0) LogError("read() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    if (lseek(nffile->fd, dataBlock.size, SEEK_CUR) < 0) {
+        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    return 1;
+
+}  // End of nfskip
+
+// uncompress blocks of the decodeQueue in parallel and push them in read
+// sequence order to the processQueue
+__attribute__((noreturn)) static void *nfdecoder(void *arg) {
+    nffile_t *nffile = (nffile_t *)arg;
+
+    /* Signal handling */
+    sigset_t set = {0};
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    PinNode();
+
+    while (1) {
+        // pop the next raw block and take its sequence number
+        pthread_mutex_lock(&nffile->qlock);
+        dataBlock_t *rawBlock = queue_pop(nffile->decodeQueue);
+        uint64_t seq = rawBlock == QUEUE_CLOSED ? 0 : nffile->blockSeq++;
+        pthread_mutex_unlock(&nffile->qlock);
+        if (rawBlock == QUEUE_CLOSED) break;
+
+        // after an error or a terminate request, remaining blocks are dropped
+        dataBlock_t *block_header = NULL;
+        if (atomic_load(&nffile->terminate) == 0) {
+            // uncompressed blocks read into a data block are passed as is
+            if (!nffile->fileMap && BlockCodec(nffile, rawBlock) == NOT_COMPRESSED && !BlockEncrypted(nffile, rawBlock)) {
+                UpdateCodecStat(NOT_COMPRESSED, rawBlock->size, rawBlock->size, 0);
+                block_header = rawBlock;
+            } else {
+                block_header = UncompressBlock(nffile, rawBlock);
+            }
+        }
+        // raw blocks of a file mapping are not owned
+        if (!nffile->fileMap && block_header != rawBlock) FreeDataBlock(rawBlock);
+        block_header = ResolvePayloads(nffile, block_header);
+
+        pthread_mutex_lock(&nffile->wlock);
+        while (nffile->writeSeq != seq) pthread_cond_wait(&nffile->wcond, &nffile->wlock);
+        if (block_header == NULL || atomic_load(&nffile->terminate)) {
+            // a failed block ends processing - drop all following blocks
+            FreeDataBlock(block_header);
+            atomic_store(&nffile->terminate, 1);
+        } else if (queue_push(nffile->processQueue, (void *)block_header) == QUEUE_CLOSED) {
+            FreeDataBlock(block_header);
+            atomic_store(&nffile->terminate, 1);
+        }
+        nffile->writeSeq++;
+        pthread_cond_broadcast(&nffile->wcond);
+        pthread_mutex_unlock(&nffile->wlock);
+    }
+
+    dbg_printf("nfdecoder exit\n");
+    pthread_exit(NULL);
+
+}  // End of nfdecoder
+
+// start the decoder threads of a compressed file. Returns the number of threads started
+static unsigned StartDecoders(nffile_t *nffile, pthread_t *decoder) {
+    if (NumWorkers < 2 || (nffile->file_header->compression == NOT_COMPRESSED && nffile->file_header->encryption == NOT_ENCRYPTED) ||
+        (nffile->fileMap && nffile->fileMap->cached))
+        return 0;
+
+    nffile->blockSeq = 0;
+    nffile->writeSeq = 0;
+    queue_open(nffile->decodeQueue);
+
+    // the reader itself counts as one worker
+    unsigned numDecoders = 0;
+    for (unsigned i = 1; i < NumWorkers; i++) {
+        int err = pthread_create(&decoder[numDecoders], NULL, nfdecoder, (void *)nffile);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            break;
+        }
+        numDecoders++;
+    }
+
+    if (numDecoders == 0) queue_close(nffile->decodeQueue);
+    dbg_printf("nfreader - started %u decoders\n", numDecoders);
+    return numDecoders;
+
+}  // End of StartDecoders
+
+// returns true, if block blockNum of nffile is in the sample. The selection depends only
+// on the file and the block number, so repeated queries read the same blocks
+static inline int SampledBlock(nffile_t *nffile, uint32_t blockNum) {
+    uint64_t x = nffile->stat_record->firstseen ^ nffile->stat_record->numflows ^ ((uint64_t)blockNum << 40);
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (x >> 32) < nffile->sampleLimit;
+}  // End of SampledBlock
+
 __attribute__((noreturn)) void *nfreader(void *arg) {
     nffile_t *nffile = (nffile_t *)arg;
 
@@ -1333,23 +3767,89 @@ __attribute__((noreturn)) void *nfreader(void *arg) {
     sigfillset(&set);
     pthread_sigmask(SIG_SETMASK, &set, NULL);
 
+    // read blocks on the home node
+    PinNode();
+
     int terminate = atomic_load(&nffile->terminate);
     int blockCount = 0;
+    // use block index only, if it matches the data blocks
+    int useIndex = !nffile->stream && (nffile->twinLast || nffile->bloomMiss || nffile->summaryFilter) &&
+                   nffile->numIndex == nffile->file_header->NumBlocks;
+    // an archive selection reads the data blocks firstBlock .. lastBlock - 1 only
+    uint32_t lastBlock = nffile->lastBlock ? nffile->lastBlock : nffile->file_header->NumBlocks;
+    if (nffile->firstBlock && !nffile->fileMap && nffile->firstBlock < nffile->numIndex &&
+        nffile->numIndex == nffile->file_header->NumBlocks) {
+        // seek to the first selected block
+        if (lseek(nffile->fd, nffile->blockIndex[nffile->firstBlock].offset, SEEK_SET) >= 0) blockCount = nffile->firstBlock;
+    }
+    // compressed blocks are uncompressed in parallel by the decoders
+    pthread_t decoder[MAXWORKERS];
+    unsigned numDecoders = StartDecoders(nffile, decoder);
+    queue_t *outQueue = numDecoders ? nffile->decodeQueue : nffile->processQueue;
     dataBlock_t *block_header = NULL;
-    while (!terminate && blockCount < nffile->file_header->NumBlocks) {
-        block_header = nfread(nffile);
+    while (!terminate && (nffile->stream || blockCount < lastBlock)) {
+        if (blockCount < nffile->firstBlock) {
+            // block before the selected intervals of an archive
+            if (!nfskip(nffile)) break;
+            blockCount++;
+            continue;
+        }
+        if (!nffile->stream && nffile->sampleLimit && !SampledBlock(nffile, blockCount)) {
+            if (!nfskip(nffile)) break;
+            blockCount++;
+            nffile->skippedBlocks++;
+            terminate = atomic_load(&nffile->terminate);
+            continue;
+        }
+        if (useIndex) {
+            blockIndex_t *blockIndex = &(nffile->blockIndex[blockCount]);
+            int noFlows = nffile->bloomMiss || (nffile->twinLast &&
+                          (blockIndex->msecLast <= nffile->twinFirst || blockIndex->msecFirst >= nffile->twinLast));
+            if (!noFlows && nffile->summaryFilter)
+                noFlows = nffile->summaryFilter(nffile->summaryEngine, &(nffile->blockSummary[blockCount]),
+                                                nffile->numBitmap == nffile->numSummary ? &(nffile->blockBitmap[blockCount]) : NULL) == 0;
+            if (noFlows && (blockIndex->flags & FLAG_INDEX_NOSKIP) == 0) {
+                // no flow of this block can match the time window or filter
+                if (!nfskip(nffile)) break;
+                blockCount++;
+                nffile->skippedBlocks++;
+                terminate = atomic_load(&nffile->terminate);
+                continue;
+            }
+        }
+        if (nffile->stream) {
+            // a stream can not seek - its blocks are read until EOF
+            block_header = nfreadStream(nffile, blockCount);
+            if (block_header && nffile->sampleLimit && !SampledBlock(nffile, blockCount)) {
+                FreeDataBlock(block_header);
+                blockCount++;
+                nffile->skippedBlocks++;
+                terminate = atomic_load(&nffile->terminate);
+                continue;
+            }
+            if (block_header && !numDecoders) block_header = ResolvePayloads(nffile, nfdecode(nffile, block_header));
+        } else if (numDecoders) {
+            block_header = nffile->fileMap ? nfmapBlock(nffile, NULL) : nfreadRaw(nffile);
+        } else {
+            block_header = ResolvePayloads(nffile, nfread(nffile));
+        }
         if (!block_header) {
             dbg_printf("block_header == NULL\n");
             break;
         }
 
-        if (queue_push(nffile->processQueue, (void *)block_header) == QUEUE_CLOSED) {
-            FreeDataBlock(block_header);
+        if (queue_push(outQueue, (void *)block_header) == QUEUE_CLOSED) {
+            if (!numDecoders || !nffile->fileMap) FreeDataBlock(block_header);
             dbg_printf("nfreader - processQueue closed\n");
             terminate = 1;
         } else {
             blockCount++;
             terminate = atomic_load(&nffile->terminate);
+            if ((blockCount % ADAPTBLOCKS) == 0) {
+                unsigned depthMax = QueueDepthMax();
+                queue_adapt(outQueue, 2, depthMax);
+                if (numDecoders) queue_adapt(nffile->processQueue, 2, depthMax);
+            }
             dbg_printf("ReadBlock - expanded: %u\n", block_header->size);
             dbg_printf("Blocks: %u\n", blockCount);
         }
@@ -1361,6 +3861,17 @@ __attribute__((noreturn)) void *nfreader(void *arg) {
 #endif
     }
 
+    // let the decoders finish the queued blocks
+    if (numDecoders) {
+        queue_close(nffile->decodeQueue);
+        for (unsigned i = 0; i < numDecoders; i++) {
+            int err = pthread_join(decoder[i], NULL);
+            if (err) {
+                LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            }
+        }
+    }
+
     // eof or error ends processing
     queue_close(nffile->processQueue);
 
@@ -1370,19 +3881,196 @@ __attribute__((noreturn)) void *nfreader(void *arg) {
     atomic_store(&nffile->terminate, 2);
     pthread_exit(NULL);
 
-}  // End of nfreader
+}  // End of nfreader
+
+// poll interval in usec of a followed file, waiting for new blocks
+#define FOLLOWPOLL 100000
+
+// read the file header of a followed file. Returns 0, if the file is not yet
+// complete, or can not be followed
+static int FollowHeader(int fd, fileHeaderV2_t *fileHeader) {
+    if (pread(fd, (void *)fileHeader, sizeof(fileHeaderV2_t), 0) != sizeof(fileHeaderV2_t)) return 0;
+    if (fileHeader->magic != MAGIC || fileHeader->version != LAYOUT_VERSION_2) return 0;
+    return 1;
+}  // End of FollowHeader
+
+// read the data block at offset of a followed file, if it is completely written
+// returns 1 for a block, 0 if no new block is available yet and -1 on errors
+static int FollowBlock(nffile_t *nffile, off_t *offset, dataBlock_t **dataBlock) {
+    dataBlock_t blockHeader;
+    if (pread(nffile->fd, (void *)&blockHeader, sizeof(dataBlock_t), *offset) != sizeof(dataBlock_t)) return 0;
+    // asynchronous writers may leave a hole until the block is written
+    if (blockHeader.size == 0) return 0;
+    if (blockHeader.size > (BUFFSIZE - sizeof(dataBlock_t)) || blockHeader.NumRecords == 0) {
+        LogError("Corrupt data file %s: Error buffer size %u", nffile->fileName, blockHeader.size);
+        return -1;
+    }
+
+    dataBlock_t *rawBlock = NewDataBlock();
+    ssize_t size = sizeof(dataBlock_t) + blockHeader.size;
+    if (pread(nffile->fd, (void *)rawBlock, size, *offset) != size) {
+        // block not yet completely written
+        FreeDataBlock(rawBlock);
+        return 0;
+    }
+    *offset += size;
+
+    if (!CheckBlockCRC(rawBlock)) {
+        FreeDataBlock(rawBlock);
+        return -1;
+    }
+
+    if (BlockCodec(nffile, rawBlock) == NOT_COMPRESSED && !BlockEncrypted(nffile, rawBlock)) {
+        UpdateCodecStat(NOT_COMPRESSED, rawBlock->size, rawBlock->size, 0);
+        rawBlock->flags &= ~FLAG_BLOCK_MAPPED;
+        *dataBlock = rawBlock;
+    } else {
+        *dataBlock = UncompressBlock(nffile, rawBlock);
+        FreeDataBlock(rawBlock);
+        if (*dataBlock == NULL) return -1;
+    }
+    return 1;
+
+}  // End of FollowBlock
+
+// the collector renamed the followed file, and opened a new one with the same name
+static int FollowRotated(nffile_t *nffile) {
+    struct stat fileStat, pathStat;
+    if (fstat(nffile->fd, &fileStat) < 0 || stat(nffile->fileName, &pathStat) < 0) return 0;
+    return fileStat.st_ino != pathStat.st_ino || fileStat.st_dev != pathStat.st_dev;
+}  // End of FollowRotated
+
+// open the new file of the collector. Returns 0, if it is not yet ready
+static int FollowReopen(nffile_t *nffile) {
+    int fd = open(nffile->fileName, O_RDONLY);
+    if (fd < 0) return 0;
+
+    fileHeaderV2_t fileHeader;
+    if (!FollowHeader(fd, &fileHeader)) {
+        close(fd);
+        return 0;
+    }
+
+    close(nffile->fd);
+    nffile->fd = fd;
+    memcpy((void *)nffile->file_header, (void *)&fileHeader, sizeof(fileHeaderV2_t));
+    return 1;
+
+}  // End of FollowReopen
+
+// read the blocks of a growing file as they are written by the collector. The
+// appendix block, written when the file is closed, ends a file and the reader
+// continues with the new file of the same name, until terminated.
+__attribute__((noreturn)) static void *followReader(void *arg) {
+    nffile_t *nffile = (nffile_t *)arg;
+
+    /* Signal handling */
+    sigset_t set = {0};
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    off_t offset = sizeof(fileHeaderV2_t);
+    int appendix = 0;
+    uint32_t blockCount = 0;
+    while (atomic_load(&nffile->terminate) == 0) {
+        dataBlock_t *dataBlock = NULL;
+        int ret = 0;
+        while (!appendix && (ret = FollowBlock(nffile, &offset, &dataBlock)) > 0) {
+            // the appendix starts with the ident record
+            recordHeader_t *recordHeader = (recordHeader_t *)GetCursor(dataBlock);
+            if (dataBlock->type == DATA_BLOCK_TYPE_3 && recordHeader->type == TYPE_IDENT) {
+                FreeDataBlock(dataBlock);
+                appendix = 1;
+                break;
+            }
+            if (queue_push(nffile->processQueue, (void *)dataBlock) == QUEUE_CLOSED) {
+                FreeDataBlock(dataBlock);
+                ret = -1;
+                break;
+            }
+            blockCount++;
+        }
+        if (ret < 0) break;
+
+        // the collector renames the file first and closes it afterwards. Continue
+        // with the new file, once the old one is completely read
+        if (appendix && FollowRotated(nffile) && FollowReopen(nffile)) {
+            offset = sizeof(fileHeaderV2_t);
+            appendix = 0;
+            dbg_printf("followReader - file rotated after %u blocks\n", blockCount);
+            continue;
+        }
+        xsleep(FOLLOWPOLL);
+    }
+
+    queue_close(nffile->processQueue);
+    dbg_printf("followReader done - read %u blocks\n", blockCount);
+
+    atomic_store(&nffile->terminate, 2);
+    pthread_exit(NULL);
+
+}  // End of followReader
+
+// follow a file of a collector such as nfcapd.current. The blocks are read by followReader
+static nffile_t *OpenFollowFile(char *filename, nffile_t *nffile) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        LogError("Error open file %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    nffile = NewFile(nffile);
+    if (!nffile) {
+        close(fd);
+        return NULL;
+    }
+    nffile->fd = fd;
+    if (nffile->fileName) free(nffile->fileName);
+    nffile->fileName = strdup(filename);
+    nffile->ident = strdup("follow");
+
+    if (!FollowHeader(fd, nffile->file_header)) {
+        LogError("Open file %s: not a nfdump file or unsupported layout", filename);
+        CloseFile(nffile);
+        return NULL;
+    }
+    // the dictionary is only stored in the appendix at the end of the file
+    if (nffile->file_header->compression == ZSTDDICT_COMPRESSED) {
+        LogError("Open file %s: zstd dictionary compressed files can not be followed", filename);
+        CloseFile(nffile);
+        return NULL;
+    }
+
+    atomic_store(&nffile->terminate, 0);
+    queue_open(nffile->processQueue);
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, followReader, (void *)nffile);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        CloseFile(nffile);
+        return NULL;
+    }
+    nffile->worker[0] = tid;
+
+    return nffile;
+
+}  // End of OpenFollowFile
 
 dataBlock_t *WriteBlock(nffile_t *nffile, dataBlock_t *dataBlock) {
     if (dataBlock == NULL) {
-        dataBlock = NewDataBlock();
+        dataBlock = NewWriteBlock(nffile);
     } else if (dataBlock->size != 0) {
         // empty blocks need not to be written
         dbg_printf("WriteBlock - push block with size: %u\n", dataBlock->size);
-        queue_push(nffile->processQueue, dataBlock);
-        dataBlock = NewDataBlock();
+        // small blocks flushed by age do not count as busy
+        if ((dataBlock->flags & FLAG_BLOCK_SMALL) && dataBlock->size >= (smallBlockSize >> 1)) nffile->smallFlushed++;
+        QueueWriteBlock(nffile, dataBlock);
+        dataBlock = NewWriteBlock(nffile);
     } else {
         // re-init empty block
+        uint16_t small = dataBlock->flags & FLAG_BLOCK_SMALL;
         InitDataBlock(dataBlock);
+        dataBlock->flags = small;
     }
     return dataBlock;
 
@@ -1391,28 +4079,80 @@ dataBlock_t *WriteBlock(nffile_t *nffile, dataBlock_t *dataBlock) {
 void FlushBlock(nffile_t *nffile, dataBlock_t *dataBlock) {
     if (dataBlock != NULL) {
         if (dataBlock->size != 0) {
-            queue_push(nffile->processQueue, dataBlock);
+            QueueWriteBlock(nffile, dataBlock);
         } else {
             FreeDataBlock(dataBlock);
         }
     }
 }  // End of FlushBlock
 
-static int nfwrite(nffile_t *nffile, dataBlock_t *block_header) {
-    if (block_header->size == 0) {
-        return 1;
+// add a record of type with data of size bytes to an appendix block
+static void AddAppendixRecord(dataBlock_t *block_header, uint16_t type, void *data, size_t size) {
+    recordHeader_t *recordHeader = (recordHeader_t *)GetCurrentCursor(block_header);
+    recordHeader->type = type;
+    recordHeader->size = sizeof(recordHeader_t) + size;
+    memcpy((void *)recordHeader + sizeof(recordHeader_t), data, size);
+
+    block_header->NumRecords++;
+    block_header->size += recordHeader->size;
+
+}  // End of AddAppendixRecord
+
+// write the head of a stream ahead of its first block. The reader needs the ident,
+// the aggregation and the zstd dictionary before the data blocks. Called in write sequence
+static ssize_t WriteStreamHead(nffile_t *nffile) {
+    dataBlock_t *block_header = NewDataBlock();
+    char *ident = nffile->ident ? nffile->ident : "none";
+    AddAppendixRecord(block_header, TYPE_IDENT, ident, strlen(ident) + 1);
+    if (nffile->aggregation) AddAppendixRecord(block_header, TYPE_AGGREGATION, nffile->aggregation, strlen(nffile->aggregation) + 1);
+    if (nffile->zstdDict) AddAppendixRecord(block_header, TYPE_ZSTDDICT, nffile->zstdDict->dict, nffile->zstdDict->size);
+
+    // the head is small and stored uncompressed
+    dataBlock_t *wptr = block_header;
+    dataBlock_t *cryptBuff = NULL;
+    if (nffile->file_header->encryption != NOT_ENCRYPTED) {
+        cryptBuff = NewDataBlock();
+        if (Encrypt_Block(block_header, cryptBuff, nffile->buff_size) < 0) {
+            FreeDataBlock(cryptBuff);
+            FreeDataBlock(block_header);
+            return -1;
+        }
+        wptr = cryptBuff;
     }
+    wptr->flags = FLAG_BLOCK_APPENDIX | FLAG_BLOCK_UNCOMPRESSED | BLOCK_CODEC_FLAGS(NOT_COMPRESSED);
+
+    ssize_t ret = writeAll(nffile->fd, (void *)wptr, sizeof(dataBlock_t) + wptr->size);
+    FreeDataBlock(cryptBuff);
+    FreeDataBlock(block_header);
+    return ret;
+
+}  // End of WriteStreamHead
+
+// compress a block and write it to disk in sequence order. Blocks are compressed
+// in parallel by the writers, but each writer waits for its turn to write.
+// nfwrite takes the ownership of block_header
+static int nfwrite(nffile_t *nffile, dataBlock_t *block_header, uint64_t seq) {
 
     dbg_printf("nfwrite - write: %u\n", block_header->size);
 
+    blockIndex_t blockIndex;
+    blockSummary_t blockSummary;
+    blockBitmap_t blockBitmap;
+    if (sortBlocks && (block_header->flags & FLAG_BLOCK_MAPPED) == 0) SortBlock(block_header);
+    IndexBlock(block_header, &blockIndex, &blockSummary, &blockBitmap, nffile->ipBloom);
+    if (nffile->rollup) RollupBlock(nffile->rollup, block_header);
+    if (nffile->blockTap) nffile->blockTap(nffile->tapArg, block_header);
+
     dataBlock_t *buff = NULL;
     dataBlock_t *wptr = NULL;
+    dataBlock_t *inFlight = NULL;  // block handed to the asynchronous writer
     int failed = 0;
     // compress according file compression
     int compression = nffile->file_header->compression;
-    int level = nffile->compression_level;
+    int level = nffile->autoLevel ? AutoLevel(nffile) : nffile->compression_level;
     dbg_printf("nfwrite - compression: %u\n", compression);
-    switch (compression) {
+    uint64_t compressStart = compression != NOT_COMPRESSED ? codecNsec() : 0;
+    if (block_header->size) switch (compression) {
         case NOT_COMPRESSED:
             wptr = block_header;
             break;
@@ -1432,35 +4172,251 @@ static int nfwrite(nffile_t *nffile, dataBlock_t *block_header) {
             wptr = buff;
             break;
         case ZSTD_COMPRESSED:
+        case ZSTDDICT_COMPRESSED:
             buff = NewDataBlock();
-            if (Compress_Block_ZSTD(block_header, buff, nffile->buff_size, level) < 0) failed = 1;
+            if (Compress_Block_ZSTD(block_header, buff, nffile->buff_size, level, nffile->zstdDict) < 0) failed = 1;
             wptr = buff;
             break;
     }
+    if (compressStart && !failed && wptr) {
+        uint64_t compressNsec = codecNsec() - compressStart;
+        UpdateCompressStat(compression, block_header->size, wptr->size, compressNsec);
+        if (nffile->autoLevel) AdaptLevel(nffile, level, compressNsec);
+        // incompressible blocks are stored uncompressed, if enabled
+        if (storeUncompressed && wptr->size >= block_header->size) {
+            wptr = block_header;
+            compression = NOT_COMPRESSED;
+        }
+    }
 
-    if (failed) {  // error
-        FreeDataBlock(buff);
-        return 0;
+    // the compressed copy is a full size block
+    if (buff) buff->flags &= ~FLAG_BLOCK_SMALL;
+
+    // encrypt the compressed block
+    dataBlock_t *cryptBuff = NULL;
+    if (nffile->file_header->encryption != NOT_ENCRYPTED && !failed && wptr && wptr->size) {
+        cryptBuff = NewDataBlock();
+        if (Encrypt_Block(wptr, cryptBuff, nffile->buff_size) < 0) failed = 1;
+        cryptBuff->flags &= ~FLAG_BLOCK_SMALL;
+        wptr = cryptBuff;
     }
 
-    dbg_printf("WriteBlock - type: %u, size: %u, compressed: %u, numRecords: %u, flags: %u\n", wptr->type, block_header->size, compression,
-               wptr->NumRecords, wptr->flags);
+    // append the checksum, if the block has room for it
+    uint16_t crcFlag = 0;
+    if (writeCRC && !failed && wptr && wptr->size && (wptr->flags & FLAG_BLOCK_MAPPED) == 0 &&
+        (sizeof(dataBlock_t) + wptr->size + sizeof(uint32_t)) <= nffile->buff_size) {
+        uint32_t crc = CRC32C(GetCursor(wptr), wptr->size);
+        memcpy(GetCursor(wptr) + wptr->size, (void *)&crc, sizeof(uint32_t));
+        wptr->size += sizeof(uint32_t);
+        crcFlag = FLAG_BLOCK_CRC;
+    }
 
     pthread_mutex_lock(&nffile->wlock);
-    ssize_t ret = write(nffile->fd, (void *)wptr, sizeof(dataBlock_t) + wptr->size);
-    FreeDataBlock(buff);
+    while (nffile->writeSeq != seq) pthread_cond_wait(&nffile->wcond, &nffile->wlock);
+
+    ssize_t ret = 0;
+    // the head of a stream precedes its first block
+    if (nffile->stream && seq == 0) ret = WriteStreamHead(nffile);
+    if (ret >= 0 && !failed && wptr && wptr->size) {
+        // the mapped and small flags are internal - never write them to disk
+        // each block records its codec
+        uint16_t flags = wptr->flags;
+        wptr->flags &= ~(FLAG_BLOCK_MAPPED | FLAG_BLOCK_SMALL | FLAG_BLOCK_UNCOMPRESSED | FLAG_BLOCK_UNENCRYPTED | FLAG_BLOCK_CODEC | BLOCK_CODEC_MASK | FLAG_BLOCK_CRC);
+        wptr->flags |= BLOCK_CODEC_FLAGS(compression) | crcFlag;
+        if (compression == NOT_COMPRESSED) wptr->flags |= FLAG_BLOCK_UNCOMPRESSED;
+
+        dbg_printf("WriteBlock - type: %u, size: %u, compressed: %u, numRecords: %u, flags: %u\n", wptr->type, block_header->size,
+                   compression, wptr->NumRecords, wptr->flags);
+
+        off_t offset;
+#ifdef HAVE_LIBURING
+        if (nffile->uring) {
+            // the block is released, after it is written
+            ret = UringWrite(nffile, wptr, flags, sizeof(dataBlock_t) + wptr->size, &offset) ? 0 : -1;
+            if (ret == 0) inFlight = wptr;
+        } else
+#endif
+        {
+            offset = nffile->stream ? 0 : lseek(nffile->fd, 0, SEEK_CUR);
+            ret = writeAll(nffile->fd, (void *)wptr, sizeof(dataBlock_t) + wptr->size);
+            wptr->flags = flags;
+        }
+        if (ret >= 0) {
+            // index entries are in file order
+            blockIndex.offset = offset;
+            if (nffile->numIndex == nffile->file_header->NumBlocks) AddBlockIndex(nffile, &blockIndex, 1);
+            if (nffile->numSummary == nffile->file_header->NumBlocks) AddBlockSummary(nffile, &blockSummary, 1);
+            if (nffile->numBitmap == nffile->file_header->NumBlocks) AddBlockBitmap(nffile, &blockBitmap, 1);
+            nffile->file_header->NumBlocks++;
+        }
+    }
+
+    // next block's turn - even if this one failed
+    nffile->writeSeq++;
+    pthread_cond_broadcast(&nffile->wcond);
+    pthread_mutex_unlock(&nffile->wlock);
+    if (buff != inFlight) FreeDataBlock(buff);
+    if (cryptBuff != inFlight) FreeDataBlock(cryptBuff);
+    if (block_header != inFlight) FreeDataBlock(block_header);
+
+    if (failed) return 0;
     if (ret < 0) {
-        pthread_mutex_unlock(&nffile->wlock);
         LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return 0;
     }
-
-    nffile->file_header->NumBlocks++;
-    pthread_mutex_unlock(&nffile->wlock);
     return 1;
 
 }  // End of nfwrite
 
+#ifdef HAVE_LIBURING
+// set up asynchronous writes at the current file offset. Falls back to write(), if io_uring is not available
+static void UringOpen(nffile_t *nffile) {
+    nfUring_t *uring = calloc(1, sizeof(nfUring_t));
+    if (!uring) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    int ret = io_uring_queue_init(URINGDEPTH, &uring->ring, 0);
+    if (ret < 0) {
+        LogVerbose("io_uring_queue_init() failed: %s - continue with write()", strerror(-ret));
+        free(uring);
+        return;
+    }
+
+    uring->offset = lseek(nffile->fd, 0, SEEK_CUR);
+    if (uring->offset < 0) {
+        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        io_uring_queue_exit(&uring->ring);
+        free(uring);
+        return;
+    }
+
+    for (int i = 0; i < URINGDEPTH; i++) uring->freeSlot[i] = &uring->slot[i];
+    uring->numFree = URINGDEPTH;
+    nffile->uring = uring;
+
+}  // End of UringOpen
+
+// write the remaining bytes synchronously
+static int pwriteAll(int fd, void *buff, size_t size, off_t offset) {
+    while (size) {
+        ssize_t ret = pwrite(fd, buff, size, offset);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buff += ret;
+        offset += ret;
+        size -= ret;
+    }
+    return 1;
+
+}  // End of pwriteAll
+
+// process completed writes and release their blocks. If wait is set, wait for at least one.
+// returns 0, if a write failed
+static int UringReap(nffile_t *nffile, int wait) {
+    nfUring_t *uring = nffile->uring;
+
+    int ok = 1;
+    struct io_uring_cqe *cqe;
+    while (uring->numFree < URINGDEPTH) {
+        int ret = wait ? io_uring_wait_cqe(&uring->ring, &cqe) : io_uring_peek_cqe(&uring->ring, &cqe);
+        if (ret == -EINTR) continue;
+        if (ret < 0) break;
+        wait = 0;
+
+        uringSlot_t *slot = (uringSlot_t *)io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        io_uring_cqe_seen(&uring->ring, cqe);
+
+        if (res < 0) {
+            LogError("io_uring write() error in %s line %d: %s", __FILE__, __LINE__, strerror(-res));
+            ok = 0;
+        } else if ((size_t)res < slot->size) {
+            // short write - write the rest
+            if (!pwriteAll(nffile->fd, (void *)slot->block + res, slot->size - res, slot->offset + res)) {
+                LogError("pwrite() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                ok = 0;
+            }
+        }
+
+        slot->block->flags = slot->flags;
+        FreeDataBlock(slot->block);
+        slot->block = NULL;
+        uring->freeSlot[uring->numFree++] = slot;
+    }
+
+    return ok;
+
+}  // End of UringReap
+
+// queue the block for writing. The block is released, after it is written.
+// Called in write sequence order with wlock held. returns 0 on error
+static int UringWrite(nffile_t *nffile, dataBlock_t *block, uint16_t flags, size_t size, off_t *offset) {
+    nfUring_t *uring = nffile->uring;
+
+    // reap finished writes, wait for a free slot, if all are in flight
+    UringReap(nffile, uring->numFree == 0);
+
+    *offset = uring->offset;
+    uring->offset += size;
+
+    struct io_uring_sqe *sqe = uring->numFree ? io_uring_get_sqe(&uring->ring) : NULL;
+    if (sqe == NULL) {
+        // no submission slot - write synchronously
+        int ok = pwriteAll(nffile->fd, (void *)block, size, *offset);
+        block->flags = flags;
+        if (ok) FreeDataBlock(block);
+        return ok;
+    }
+
+    uringSlot_t *slot = uring->freeSlot[--uring->numFree];
+    slot->block = block;
+    slot->offset = *offset;
+    slot->size = size;
+    slot->flags = flags;
+
+    io_uring_prep_write(sqe, nffile->fd, (void *)block, size, *offset);
+    io_uring_sqe_set_data(sqe, slot);
+    int ret = io_uring_submit(&uring->ring);
+    if (ret < 0) {
+        // submission failed - write synchronously
+        uring->freeSlot[uring->numFree++] = slot;
+        slot->block = NULL;
+        errno = -ret;
+        int ok = pwriteAll(nffile->fd, (void *)block, size, *offset);
+        block->flags = flags;
+        if (ok) FreeDataBlock(block);
+        return ok;
+    }
+
+    return 1;
+
+}  // End of UringWrite
+
+// wait for all writes and continue with write() at the end of the written data
+static void UringClose(nffile_t *nffile) {
+    nfUring_t *uring = nffile->uring;
+
+    while (uring->numFree < URINGDEPTH) {
+        uint32_t numFree = uring->numFree;
+        UringReap(nffile, 1);
+        // no progress - give up on the remaining writes
+        if (numFree == uring->numFree) break;
+    }
+    if (lseek(nffile->fd, uring->offset, SEEK_SET) < 0) {
+        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+    }
+
+    io_uring_queue_exit(&uring->ring);
+    free(uring);
+    nffile->uring = NULL;
+
+}  // End of UringClose
+#endif
+
 __attribute__((noreturn)) void *nfwriter(void *arg) {
     nffile_t *nffile = (nffile_t *)arg;
 
@@ -1470,18 +4426,21 @@ __attribute__((noreturn)) void *nfwriter(void *arg) {
     sigfillset(&set);
     pthread_sigmask(SIG_SETMASK, &set, NULL);
 
+    PinNode();
+
     dataBlock_t *block_header;
     while (1) {
+        // pop block and take its write sequence
+        pthread_mutex_lock(&nffile->qlock);
         block_header = queue_pop(nffile->processQueue);
+        uint64_t seq = block_header == QUEUE_CLOSED ? 0 : nffile->blockSeq++;
+        pthread_mutex_unlock(&nffile->qlock);
         if (block_header == QUEUE_CLOSED) break;
+        atomic_fetch_sub_explicit(&writerBacklog, 1, memory_order_relaxed);
 
-        int ok = 1;
-        if (block_header->size) {
-            // block with data
-            dbg_printf("nfwriter write\n");
-            ok = nfwrite(nffile, block_header);
-        }
-        FreeDataBlock(block_header);
+        // empty blocks pass their turn in nfwrite
+        dbg_printf("nfwriter write\n");
+        int ok = nfwrite(nffile, block_header, seq);
 
         if (!ok) break;
     }
@@ -1493,6 +4452,75 @@ __attribute__((noreturn)) void *nfwriter(void *arg) {
 
 }  // End of nfwriter
 
+// writer of the shared writer pool - writes blocks of all pooled files
+__attribute__((noreturn)) static void *poolWriter(void *arg) {
+    dbg_printf("poolWriter enter\n");
+    /* disable signal handling */
+    sigset_t set = {0};
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    PinNode();
+
+    while (1) {
+        nffile_t *nffile = queue_pop(writerPool.queue);
+        if (nffile == QUEUE_CLOSED) break;
+
+        // the entry is queued after the block, so the block is in the queue
+        pthread_mutex_lock(&nffile->qlock);
+        dataBlock_t *block_header = queue_pop(nffile->processQueue);
+        uint64_t seq = nffile->blockSeq++;
+        pthread_mutex_unlock(&nffile->qlock);
+        atomic_fetch_sub_explicit(&writerBacklog, 1, memory_order_relaxed);
+
+        // a failed block is reported by nfwrite - continue with the next one
+        nfwrite(nffile, block_header, seq);
+
+        pthread_mutex_lock(&nffile->wlock);
+        nffile->pending--;
+        pthread_cond_broadcast(&nffile->wcond);
+        pthread_mutex_unlock(&nffile->wlock);
+    }
+
+    dbg_printf("poolWriter exit\n");
+    pthread_exit(NULL);
+
+    /* UNREACHED */
+
+}  // End of poolWriter
+
+// start a pool of numThreads writers shared by all files opened for writing hereafter,
+// instead of NumWorkers writers per file. 0 selects the default number of workers.
+// Useful for processes, which write many files in parallel
+int StartWriterPool(unsigned numThreads) {
+    if (writerPool.numThreads) return 1;
+
+    if (numThreads == 0) numThreads = GetNumWorkers(0);
+    writerPool.queue = queue_init(WRITERPOOLQUEUE);
+    if (!writerPool.queue) return 0;
+
+    unsigned started = 0;
+    for (; started < numThreads; started++) {
+        pthread_t tid;
+        int err = pthread_create(&tid, NULL, poolWriter, NULL);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            break;
+        }
+        pthread_detach(tid);
+    }
+    if (started == 0) {
+        queue_free(writerPool.queue);
+        writerPool.queue = NULL;
+        return 0;
+    }
+
+    writerPool.numThreads = started;
+    LogVerbose("Writer pool started with %u writers", started);
+    return 1;
+
+}  // End of StartWriterPool
+
 static int SignalTerminate(nffile_t *nffile) {
     // set terminate
     atomic_store(&nffile->terminate, 1);
@@ -1522,11 +4550,32 @@ void SetIdent(nffile_t *nffile, char *Ident) {
 
 }  // End of SetIdent
 
+// store identical payloads of the written records only once in the payload dictionary of the file
+int EnablePayloadDict(nffile_t *nffile) {
+    // a stream can not defer the payloads to the appendix - they stay inline
+    if (nffile->stream) return 0;
+    if (nffile->payloadDict) return 1;
+    nffile->payloadDict = NewPayloadDict();
+    return nffile->payloadDict != NULL;
+
+}  // End of EnablePayloadDict
+
+void SetAggregation(nffile_t *nffile, char *aggregation) {
+    if (nffile->aggregation) free(nffile->aggregation);
+    nffile->aggregation = aggregation && strlen(aggregation) > 0 ? strdup(aggregation) : NULL;
+
+}  // End of SetAggregation
+
 int ChangeIdent(char *filename, char *Ident) {
     nffile_t *nffile = OpenFileStatic(filename, NULL);
     if (!nffile) {
         return 0;
     }
+    if (nffile->stream) {
+        LogError("Can not change the ident of stream file: %s", filename);
+        DisposeFile(nffile);
+        return 0;
+    }
 
     // file is valid - re-open the file mode RDWR
     close(nffile->fd);
@@ -1577,7 +4626,127 @@ int ChangeIdent(char *filename, char *Ident) {
 
 }  // End of ChangeIdent
 
+// recompress a file. The data blocks are passed unchanged from the reader to the
+// writer, which compresses them with the new method. The new file is written to
+// <file>-tmp and renamed over the original file. Returns 1 if the file was changed,
+// 0 if skipped and -1 on error
+static int RecompressFile(nffile_t *nffile_r, int compress) {
+    if (nffile_r->stream) {
+        printf("File %s is a stream. Skipped\n", nffile_r->fileName);
+        return 0;
+    }
+    if (nffile_r->lastBlock) {
+        printf("File %s is an archive selection. Skipped\n", nffile_r->fileName);
+        return 0;
+    }
+
+    // the level is not stored in the file. Recompress same method only, if a level is given
+    if (nffile_r->file_header->compression == COMPRESSION_TYPE(compress) && COMPRESSION_LEVEL(compress) == 0) {
+        printf("File %s is already same compression method\n", nffile_r->fileName);
+        return 0;
+    }
+
+    // tmp filename for new output file
+    char outfile[MAXPATHLEN];
+    snprintf(outfile, MAXPATHLEN, "%s-tmp", nffile_r->fileName);
+    outfile[MAXPATHLEN - 1] = '\0';
+
+    // allocate output file
+    nffile_t *nffile_w = OpenNewFile(outfile, NULL, FILE_CREATOR(nffile_r), compress, NOT_ENCRYPTED);
+    if (!nffile_w) return -1;
+
+    // keep the appendix
+    SetIdent(nffile_w, nffile_r->ident);
+    SetAggregation(nffile_w, nffile_r->aggregation);
+
+    // swap stat records :)
+    stat_record_t *_s = nffile_r->stat_record;
+    nffile_r->stat_record = nffile_w->stat_record;
+    nffile_w->stat_record = _s;
+
+    // push blocks to new file
+    while (1) {
+        dataBlock_t *block_header = queue_pop(nffile_r->processQueue);
+        if (block_header == QUEUE_CLOSED)  // EOF
+            break;
+        QueueWriteBlock(nffile_w, block_header);
+    }
+
+    int ret = 1;
+    if (!CloseUpdateFile(nffile_w)) {
+        unlink(outfile);
+        LogError("Failed to close file: '%s'", strerror(errno));
+        ret = -1;
+    } else if (rename(outfile, nffile_r->fileName)) {
+        // rename() replaces the original file atomically
+        LogError("rename() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        unlink(outfile);
+        ret = -1;
+    } else {
+        printf("File %s compression changed\n", nffile_r->fileName);
+    }
+
+    DisposeFile(nffile_w);
+    return ret;
+
+}  // End of RecompressFile
+
+typedef struct recompressParam_s {
+    int compress;
+    _Atomic uint32_t changed;
+    _Atomic uint32_t skipped;
+    _Atomic uint32_t failed;
+} recompressParam_t;
+
+__attribute__((noreturn)) static void *recompressThread(void *arg) {
+    recompressParam_t *param = (recompressParam_t *)arg;
+
+    nffile_t *nffile_r = NULL;
+    while ((nffile_r = GetNextFile(nffile_r)) != NULL) {
+        switch (RecompressFile(nffile_r, param->compress)) {
+            case 1:
+                atomic_fetch_add(&param->changed, 1);
+                break;
+            case 0:
+                atomic_fetch_add(&param->skipped, 1);
+                break;
+            default:
+                atomic_fetch_add(&param->failed, 1);
+        }
+    }
+
+    pthread_exit(NULL);
+
+}  // End of recompressThread
+
+// recompress all files of the file queue. NumWorkers files are processed in parallel,
+// each with its own reader and compression workers
 void ModifyCompressFile(int compress) {
+    recompressParam_t param = {.compress = compress};
+
+    pthread_t tid[MAXWORKERS];
+    unsigned numThreads = NumWorkers;
+    for (unsigned i = 0; i < numThreads; i++) {
+        int err = pthread_create(&tid[i], NULL, recompressThread, (void *)&param);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            numThreads = i;
+            break;
+        }
+    }
+    for (unsigned i = 0; i < numThreads; i++) {
+        pthread_join(tid[i], NULL);
+    }
+
+    printf("Recompressed %u files, %u skipped, %u failed\n", atomic_load(&param.changed), atomic_load(&param.skipped),
+           atomic_load(&param.failed));
+
+}  // End of ModifyCompressFile
+
+// convert the data blocks of all files to the columnar layout if columnar is set,
+// otherwise back to the row layout. columnar 3 encodes the generic flow column compact.
+// The compression of the files is kept
+void ModifyLayoutFile(int columnar) {
     nffile_t *nffile_r, *nffile_w;
     stat_record_t *_s;
     char outfile[MAXPATHLEN];
@@ -1589,8 +4758,12 @@ void ModifyCompressFile(int compress) {
         // last file
         if (nffile_r == NULL) break;
 
-        if (nffile_r->file_header->compression == COMPRESSION_TYPE(compress)) {
-            printf("File %s is already same compression method\n", nffile_r->fileName);
+        if (nffile_r->stream) {
+            printf("File %s is a stream. Skipped\n", nffile_r->fileName);
+            continue;
+        }
+        if (nffile_r->lastBlock) {
+            printf("File %s is an archive selection. Skipped\n", nffile_r->fileName);
             continue;
         }
 
@@ -1604,7 +4777,7 @@ void ModifyCompressFile(int compress) {
             NumWorkers = 1;
         }
         // allocate output file
-        nffile_w = OpenNewFile(outfile, NULL, FILE_CREATOR(nffile_r), compress, NOT_ENCRYPTED);
+        nffile_w = OpenNewFile(outfile, NULL, FILE_CREATOR(nffile_r), FILE_COMPRESSION(nffile_r), NOT_ENCRYPTED);
         if (!nffile_w) {
             DisposeFile(nffile_r);
             break;
@@ -1617,15 +4790,37 @@ void ModifyCompressFile(int compress) {
         nffile_r->stat_record = nffile_w->stat_record;
         nffile_w->stat_record = _s;
 
-        // push blocks to new file
+        // convert blocks and push them to the new file
+        uint32_t numConverted = 0;
         while (1) {
             dataBlock_t *block_header = queue_pop(nffile_r->processQueue);
             if (block_header == QUEUE_CLOSED)  // EOF
                 break;
-            queue_push(nffile_w->processQueue, block_header);
+
+            // blocks, which can not be converted, are copied unchanged
+            dataBlock_t *newBlock = NewDataBlock();
+            int converted = 0;
+            if (columnar && block_header->type == DATA_BLOCK_TYPE_5) {
+                // re-encode columnar blocks in the requested column layout
+                dataBlock_t *v3Block = NewDataBlock();
+                converted = ExpandColumnarBlock(block_header, v3Block, ALLEXTENSIONS) && ColumnarBlock(v3Block, newBlock, columnar == 3);
+                FreeDataBlock(v3Block);
+            } else if (columnar)
+                converted = ColumnarBlock(block_header, newBlock, columnar == 3);
+            else if (block_header->type == DATA_BLOCK_TYPE_5)
+                converted = ExpandColumnarBlock(block_header, newBlock, ALLEXTENSIONS);
+
+            if (converted) {
+                FreeDataBlock(block_header);
+                block_header = newBlock;
+                numConverted++;
+            } else {
+                FreeDataBlock(newBlock);
+            }
+            QueueWriteBlock(nffile_w, block_header);
         }
 
-        printf("File %s compression changed\n", nffile_r->fileName);
+        printf("File %s: %u blocks converted to %s layout\n", nffile_r->fileName, numConverted, columnar == 3 ? "compact" : columnar ? "column" : "row");
         if (!CloseUpdateFile(nffile_w)) {
             unlink(outfile);
             LogError("Failed to close file: '%s'", strerror(errno));
@@ -1640,18 +4835,99 @@ void ModifyCompressFile(int compress) {
         DisposeFile(nffile_w);
     }
 
-}  // End of ModifyCompressFile
+}  // End of ModifyLayoutFile
+
+// train a zstd dictionary from the flow records of all files in the file queue
+// and save it to dictFile. Each record is a sample for the trainer
+int TrainZstdDictionary(char *dictFile) {
+#ifdef HAVE_ZSTD
+#define MAXSAMPLEDATA (128 * 1024 * 1024)
+#define MAXSAMPLES (1024 * 1024)
+    void *samples = malloc(MAXSAMPLEDATA);
+    size_t *sampleSizes = malloc(MAXSAMPLES * sizeof(size_t));
+    void *dict = malloc(MAXDICTSIZE);
+    if (!samples || !sampleSizes || !dict) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    unsigned numSamples = 0;
+    size_t sampleData = 0;
+    int full = 0;
+    nffile_t *nffile = GetNextFile(NULL);
+    while (nffile && !full) {
+        dataBlock_t *dataBlock = NULL;
+        while (!full && (dataBlock = ReadBlock(nffile, dataBlock)) != NULL) {
+            if (dataBlock->type != DATA_BLOCK_TYPE_3) continue;
+
+            record_header_t *record_header = GetCursor(dataBlock);
+            for (int i = 0; i < dataBlock->NumRecords; i++) {
+                if (record_header->size == 0) break;
+                if ((sampleData + record_header->size) > MAXSAMPLEDATA || numSamples == MAXSAMPLES) {
+                    full = 1;
+                    break;
+                }
+                memcpy(samples + sampleData, (void *)record_header, record_header->size);
+                sampleSizes[numSamples++] = record_header->size;
+                sampleData += record_header->size;
+                record_header = (record_header_t *)((void *)record_header + record_header->size);
+            }
+        }
+        FreeDataBlock(dataBlock);
+        nffile = GetNextFile(nffile);
+    }
+    DisposeFile(nffile);
+
+    int ok = 0;
+    if (numSamples < 1000) {
+        LogError("Not enough flow records to train a dictionary: %u", numSamples);
+        goto END;
+    }
+
+    size_t dictSize = ZDICT_trainFromBuffer(dict, MAXDICTSIZE, samples, sampleSizes, numSamples);
+    if (ZDICT_isError(dictSize)) {
+        LogError("ZDICT_trainFromBuffer() failed: %s", ZDICT_getErrorName(dictSize));
+        goto END;
+    }
+
+    int fd = open(dictFile, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        LogError("Failed to open file %s: '%s'", dictFile, strerror(errno));
+        goto END;
+    }
+    if (write(fd, dict, dictSize) != dictSize) {
+        LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        close(fd);
+        goto END;
+    }
+    close(fd);
+
+    printf("Dictionary %s - ID: %u, size: %zu, trained from %u records\n", dictFile, ZDICT_getDictID(dict, dictSize), dictSize, numSamples);
+    ok = 1;
+
+END:
+    free(samples);
+    free(sampleSizes);
+    free(dict);
+    return ok;
+#else
+    LogError("ZSTD compression not compiled in");
+    return 0;
+#endif
+
+}  // End of TrainZstdDictionary
 
 int QueryFile(char *filename, int verbose) {
     int fd;
-    uint32_t totalRecords, numBlocks, type1, type2, type3, type4;
+    uint32_t totalRecords, numBlocks, type1, type2, type3, type4, type5;
+    uint32_t crcBlocks = 0, badCRC = 0;
     struct stat stat_buf;
     ssize_t ret;
 
     dbg_printf("Query mode verbose: %d\n", verbose);
     if (!Init_nffile(1, NULL)) return 0;
 
-    type1 = type2 = type3 = type4 = 0;
+    type1 = type2 = type3 = type4 = type5 = 0;
     totalRecords = numBlocks = 0;
 
     if (stat(filename, &stat_buf)) {
@@ -1699,7 +4975,7 @@ int QueryFile(char *filename, int verbose) {
             return 0;
         }
 
-        if (fileHeader.compression > ZSTD_COMPRESSED) {
+        if (fileHeader.compression > ZSTDDICT_COMPRESSED) {
             LogError("Unknown compression: %u", fileHeader.compression);
             close(fd);
             return 0;
@@ -1708,12 +4984,13 @@ int QueryFile(char *filename, int verbose) {
         printf("Version    : %u - %s\n", fileHeader.version,
                fileHeader.compression == LZO_COMPRESSED    ? "lzo compressed"
                : fileHeader.compression == LZ4_COMPRESSED  ? "lz4 compressed"
-               : fileHeader.compression == ZSTD_COMPRESSED ? "zstd compressed"
-               : fileHeader.compression == BZ2_COMPRESSED  ? "bz2 compressed"
-                                                           : "not compressed");
+               : fileHeader.compression == ZSTD_COMPRESSED     ? "zstd compressed"
+               : fileHeader.compression == ZSTDDICT_COMPRESSED ? "zstd dictionary compressed"
+               : fileHeader.compression == BZ2_COMPRESSED      ? "bz2 compressed"
+                                                               : "not compressed");
 
-        if (fileHeader.encryption != NOT_ENCRYPTED) {
-            LogError("Unknown encryption: %u", fileHeader.encryption);
+        if (fileHeader.encryption != NOT_ENCRYPTED && (fileHeader.encryption != AES256GCM_ENCRYPTED || !CryptEnabled())) {
+            LogError("Unknown encryption or no key: %u", fileHeader.encryption);
             close(fd);
             return 0;
         }
@@ -1729,7 +5006,7 @@ int QueryFile(char *filename, int verbose) {
         printf("Created    : %s\n", t1);
         printf("Created by : %s\n", nf_creator[fileHeader.creator]);
         printf("nfdump     : %x\n", fileHeader.nfdversion);
-        printf("encryption : %s\n", fileHeader.encryption ? "yes" : "no");
+        printf("encryption : %s\n", fileHeader.encryption == AES256GCM_ENCRYPTED ? "aes-256-gcm" : fileHeader.encryption ? "yes" : "no");
         printf("Appdx blks : %u\n", fileHeader.appendixBlocks);
         printf("Data blks  : %u\n", fileHeader.NumBlocks);
 
@@ -1746,7 +5023,7 @@ int QueryFile(char *filename, int verbose) {
     }
 
 #ifndef HAVE_ZSTD
-    if (fileHeader.compression == ZSTD_COMPRESSED) {
+    if (fileHeader.compression == ZSTD_COMPRESSED || fileHeader.compression == ZSTDDICT_COMPRESSED) {
         LogError("ZSTD compression not compiled in. Skip checking.");
         close(fd);
         return 0;
@@ -1770,6 +5047,9 @@ int QueryFile(char *filename, int verbose) {
     nffile->fileName = strdup(filename);
     memcpy(nffile->file_header, &fileHeader, sizeof(fileHeader));
 
+    // dictionary compressed blocks need the dictionary from the appendix
+    if (fileHeader.compression == ZSTDDICT_COMPRESSED && fileHeader.appendixBlocks) ReadAppendix(nffile);
+
     // read buffer
     dataBlock_t *readBlock = NewDataBlock();
     // tmp uncompress buffer
@@ -1823,6 +5103,9 @@ int QueryFile(char *filename, int verbose) {
             case DATA_BLOCK_TYPE_4:
                 type4++;
                 break;
+            case DATA_BLOCK_TYPE_5:
+                type5++;
+                break;
             default:
                 printf("block %i has unknown type %u\n", numBlocks, readBlock->type);
                 close(fd);
@@ -1845,10 +5128,7 @@ int QueryFile(char *filename, int verbose) {
             printf("Checking block %i, offset: %lld, type: %u, size: %u, flags: 0x%x, records: %u\n", numBlocks, (long long)fpos, readBlock->type,
                    readBlock->size, readBlock->flags, readBlock->NumRecords);
         }
-        int compression = nffile->file_header->compression;
-        if (TestFlag(readBlock->flags, FLAG_BLOCK_UNCOMPRESSED)) {
-            compression = NOT_COMPRESSED;
-        }
+        int compression = BlockCodec(nffile, readBlock);
 
         void *read_ptr = GetCursor(readBlock);
         ret = read(nffile->fd, read_ptr, readBlock->size);
@@ -1869,6 +5149,25 @@ int QueryFile(char *filename, int verbose) {
             return 0;
         }
 
+        if (readBlock->flags & FLAG_BLOCK_CRC) {
+            if (!CheckBlockCRC(readBlock)) {
+                LogError("Checksum error in block %i", numBlocks);
+                badCRC++;
+                continue;
+            }
+            crcBlocks++;
+        }
+
+        if (BlockEncrypted(nffile, readBlock)) {
+            dataBlock_t *b = readBlock;
+            readBlock = buff;
+            buff = b;
+            if (Decrypt_Block(buff, readBlock) < 0) {
+                LogError("Decryption of block %i failed", numBlocks);
+                continue;
+            }
+        }
+
         int failed = 0;
         switch (compression) {
             case NOT_COMPRESSED:
@@ -1900,11 +5199,12 @@ int QueryFile(char *filename, int verbose) {
                     failed = 1;
                 }
             } break;
-            case ZSTD_COMPRESSED: {
+            case ZSTD_COMPRESSED:
+            case ZSTDDICT_COMPRESSED: {
                 dataBlock_t *b = readBlock;
                 readBlock = buff;
                 buff = b;
-                if (Uncompress_Block_ZSTD(buff, readBlock, nffile->buff_size) < 0) {
+                if (Uncompress_Block_ZSTD(buff, readBlock, nffile->buff_size, nffile->zstdDict) < 0) {
                     LogError("Zstd decompress failed");
                     failed = 1;
                 }
@@ -1938,6 +5238,17 @@ int QueryFile(char *filename, int verbose) {
                 close(fd);
                 return 0;
             }
+        } else if (readBlock->type == DATA_BLOCK_TYPE_5) {  // columnar block
+            dataBlock_t *v3Block = NewDataBlock();
+            int ok = ExpandColumnarBlock(readBlock, v3Block, ALLEXTENSIONS);
+            FreeDataBlock(v3Block);
+            if (!ok) {
+                LogError("Error in block: %u, corrupt columnar block", numBlocks);
+                close(fd);
+                return 0;
+            }
+            numRecords = readBlock->NumRecords;
+            blockSize = readBlock->size;
         } else {
             while (blockSize < readBlock->size) {
                 recordHeader_t *recordHeader = (recordHeader_t *)read_ptr;
@@ -1968,6 +5279,24 @@ int QueryFile(char *filename, int verbose) {
                             printf("  Ident: %s", ident);
                         }
                     }
+                    if (recordHeader->type == TYPE_AGGREGATION) {
+                        printf("  Aggregation: %s", (char *)recordHeader + sizeof(recordHeader_t));
+                    }
+                    if (recordHeader->type == TYPE_BLOCKINDEX) {
+                        printf("  Block index: %zu entries", (recordHeader->size - sizeof(recordHeader_t)) / sizeof(blockIndex_t));
+                    }
+                    if (recordHeader->type == TYPE_BLOCKSUMMARY) {
+                        printf("  Block summary: %zu entries", (recordHeader->size - sizeof(recordHeader_t)) / sizeof(blockSummary_t));
+                    }
+                    if (recordHeader->type == TYPE_IPBLOOM && recordHeader->size >= (sizeof(recordHeader_t) + sizeof(ipBloomRecord_t))) {
+                        ipBloomRecord_t *ipBloomRecord = (ipBloomRecord_t *)((void *)recordHeader + sizeof(recordHeader_t));
+                        printf("  IP bloom filter: %u bits, offset: %u, size: %u", ipBloomRecord->numBits, ipBloomRecord->offset, ipBloomRecord->size);
+                    }
+                    if (recordHeader->type == TYPE_INTERVALTOC && recordHeader->size >= (sizeof(recordHeader_t) + sizeof(intervalToc_t))) {
+                        intervalToc_t *intervalToc = (intervalToc_t *)((void *)recordHeader + sizeof(recordHeader_t));
+                        printf("  Interval: %.*s, blocks: %u - %u", TOCNAMELEN, intervalToc->name, intervalToc->firstBlock,
+                               intervalToc->firstBlock + intervalToc->numBlocks);
+                    }
                     printf("\n");
                 }
                 blockSize += recordHeader->size;
@@ -2018,11 +5347,13 @@ int QueryFile(char *filename, int verbose) {
     if (type2) printf("Type 2 blocks : %u\n", type2);
     if (type3) printf("Type 3 blocks : %u\n", type3);
     if (type4) printf("Type 4 blocks : %u\n", type4);
+    if (type5) printf("Type 5 blocks : %u\n", type5);
     printf("Records       : %u\n", totalRecords);
+    if (crcBlocks || badCRC) printf("Checksums     : %u ok, %u failed\n", crcBlocks, badCRC);
 
     DisposeFile(nffile);
 
-    return 1;
+    return badCRC == 0;
 
 }  // End of QueryFile
 
@@ -2113,7 +5444,10 @@ static void UpdateStat(stat_record_t *s, stat_recordV1_t *sv1) {
 }  // End of UpdateStat
 
 // simple interface to get a stat record
+// the stat record of cataloged files is taken from the catalog without opening the file
 int GetStatRecord(char *filename, stat_record_t *stat_record) {
+    if (CatalogStatRecord(filename, stat_record)) return 1;
+
     nffile_t *nffile = OpenFileStatic(filename, NULL);
     if (!nffile) {
         return 0;
@@ -2126,6 +5460,61 @@ int GetStatRecord(char *filename, stat_record_t *stat_record) {
 
 }  // End of GetStatRecord
 
+// simple interface to get the ident of a file. Returns an allocated string or NULL
+char *GetFileIdent(char *filename) {
+    nffile_t *nffile = OpenFileStatic(filename, NULL);
+    if (!nffile) {
+        return NULL;
+    }
+
+    char *ident = nffile->ident ? strdup(nffile->ident) : NULL;
+    DisposeFile(nffile);
+
+    return ident;
+
+}  // End of GetFileIdent
+
+// simple interface to get the interval table of contents of an archive file. Returns the
+// number of intervals in an allocated array, 0 for a file without intervals or -1 on errors
+int GetArchiveIntervals(char *filename, archiveInterval_t **interval) {
+    *interval = NULL;
+    nffile_t *nffile = OpenFileStatic(filename, NULL);
+    if (!nffile) {
+        return -1;
+    }
+
+    int numInterval = nffile->numInterval;
+    if (numInterval) {
+        *interval = malloc(numInterval * sizeof(archiveInterval_t));
+        if (*interval) {
+            memcpy((void *)*interval, (void *)nffile->interval, numInterval * sizeof(archiveInterval_t));
+        } else {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            numInterval = -1;
+        }
+    }
+    DisposeFile(nffile);
+
+    return numInterval;
+
+}  // End of GetArchiveIntervals
+
+// fill the file properties of a catalog entry
+int CatalogEntry(char *filename, struct catalogEntry_s *entry) {
+    nffile_t *nffile = OpenFileStatic(filename, NULL);
+    if (!nffile) {
+        return 0;
+    }
+
+    memcpy((void *)&entry->statRecord, nffile->stat_record, sizeof(stat_record_t));
+    entry->compression = nffile->file_header->compression;
+    entry->numBlocks = nffile->file_header->NumBlocks;
+    DisposeFile(nffile);
+
+    return 1;
+
+}  // End of CatalogEntry
+
 void PrintStat(stat_record_t *s, char *ident) {
     if (s == NULL) return;
 
@@ -45,6 +45,12 @@
 
 #define NF_DUMPFILE "nfcapd.current"
 
+// hourly or daily archive of interval files - see nfcompact
+#define NF_ARCHIVEFILE "nfarchive."
+// an archive file, of which only the data blocks of some intervals are read,
+// is queued as path#firstBlock-lastBlock - see OpenFileStatic()
+#define ARCHIVESELECT "%s#%u-%u"
+
 /*
  * output buffer max size, before writing data to the file
  * used to cache flows before writing to disk. size: tradeoff between
@@ -172,6 +178,22 @@ typedef struct data_block_header_s {
                           // 2 - block compressed
 } data_block_headerV1_t;
 
+struct ipKey_s;
+struct EXgenericFlow_s;
+
+// returns 0, if no flow of a block with this summary can match the filter engine
+// blockBitmap is NULL, if the file has no block bitmaps
+typedef int (*summaryFilter_t)(const void *engine, const blockSummary_t *blockSummary, const blockBitmap_t *blockBitmap);
+
+// called by the writers with each uncompressed block written to a file
+typedef void (*blockTap_t)(void *arg, const dataBlock_t *dataBlock);
+
+// interval file merged into an archive file - see TYPE_INTERVALTOC
+typedef struct archiveInterval_s {
+    intervalToc_t toc;
+    stat_record_t stat_record;
+} archiveInterval_t;
+
 /*
  * Generic file handle for reading/writing files
  * if a file is read only writeto and block_header are NULL
@@ -180,27 +202,80 @@ typedef struct nffile_s {
     fileHeaderV2_t *file_header;   // file header
     int fd;                        // associated file descriptor
     int compat16;                  // underlying file is compat16
+    int stream;                    // file is read or written sequentially - stdin, stdout, pipe or stream framing
     pthread_t worker[MAXWORKERS];  // nfread/nfwrite worker thread;
     _Atomic int terminate;         // signal to terminate
-    pthread_mutex_t wlock;         // writer lock
+    pthread_mutex_t wlock;         // writer/decoder lock
+    pthread_cond_t wcond;          // writer/decoder waits for its write sequence
+    pthread_mutex_t qlock;         // writer/decoder lock to pop blocks in sequence
+    uint64_t blockSeq;             // sequence of the next block popped by a writer/decoder
+    uint64_t writeSeq;             // sequence of the next block written to disk or processQueue
+    int pooled;                    // blocks are written by the shared writer pool
+    uint32_t pending;              // pooled blocks queued, but not yet written - guarded by wlock
+    uint32_t smallFlushed;         // full small blocks written - promotes to full size blocks
 #define FILE_IS_COMPAT16(n) (n->compat16)
 #define NUM_BUFFS 2
     size_t buff_size;
     // void			*buff_pool[NUM_BUFFS];	// buffer space for read/write/compression
 
     queue_t *processQueue;  // blocks ready to be processed. Connects consumer/producer threads
+    queue_t *decodeQueue;   // compressed blocks read, but not yet uncompressed by the decoders
 
     stat_record_t *stat_record;  // flow stat record
     char *ident;                 // source identifier
+    char *aggregation;           // aggregation of partial aggregate files, NULL otherwise
     char *fileName;              // file name
     uint16_t compression_level;  // compression level, if available.
+    int autoLevel;               // adapt the compression level to the writer load - level is the upper limit
+
+    blockIndex_t *blockIndex;  // block index, read from or written to appendix
+    uint32_t numIndex;         // number of valid index entries
+    uint32_t maxIndex;         // number of allocated index entries
+    uint64_t twinFirst;        // skip blocks outside this time window in msec
+    uint64_t twinLast;         // twinLast == 0: no block skipping
+    uint32_t skippedBlocks;    // number of blocks skipped by reader
+    uint64_t sampleLimit;      // read only sampled blocks, selected by hash < sampleLimit. 0: read all blocks
+
+    struct ipBloom_s *ipBloom;  // bloom filter of the IP addresses, read from or written to appendix
+    int bloomMiss;              // no flow can match the IP addresses of the filter - skip all flow blocks
+
+    struct rollup_s *rollup;  // aggregation of the written flows for a rollup file, NULL otherwise
+    blockTap_t blockTap;      // tap of the written blocks, NULL otherwise
+    void *tapArg;
+
+    blockSummary_t *blockSummary;   // block summaries, parallel to the block index
+    uint32_t numSummary;            // number of valid summary entries
+    uint32_t maxSummary;            // number of allocated summary entries
+    blockBitmap_t *blockBitmap;     // block bitmaps, parallel to the block summaries
+    uint32_t numBitmap;             // number of valid bitmap entries
+    uint32_t maxBitmap;             // number of allocated bitmap entries
+    summaryFilter_t summaryFilter;  // skip blocks, rejected by the summary filter
+    const void *summaryEngine;
+
+    struct fileMap_s *fileMap;  // mmap read mode - file mapping
+    off_t mapOffset;            // mmap read mode - offset of next block
+
+    struct zstdDict_s *zstdDict;  // zstd dictionary of ZSTDDICT_COMPRESSED files
+
+    struct payloadDict_s *payloadDict;  // payload dictionary, read from or written to appendix
+
+    struct nfUring_s *uring;  // asynchronous block writer, NULL if blocks are written with write()
+
+    archiveInterval_t *interval;  // interval table of contents of an archive file
+    uint32_t numInterval;         // number of intervals
+    uint32_t maxInterval;         // number of allocated intervals
+    uint32_t firstBlock;          // read only the data blocks firstBlock .. lastBlock - 1
+    uint32_t lastBlock;           // lastBlock == 0: read all data blocks
 } nffile_t;
 
 #define GetCursor(block) ((void *)(block) + sizeof(dataBlock_t))
 #define GetCurrentCursor(block) ((void *)(block) + (block)->size + sizeof(dataBlock_t))
 #define BlockSize(block) (block)->size)
-#define BlockAvailable(block) (WRITE_BUFFSIZE - (block)->size)
-#define IsAvailable(block, required) (((block)->size + required) < WRITE_BUFFSIZE)
+// low rate sources write small blocks - see blocksize.small. 0: full size blocks only
+extern uint32_t smallBlockSize;
+#define BlockCapacity(block) (((block)->flags & FLAG_BLOCK_SMALL) ? smallBlockSize : WRITE_BUFFSIZE)
+#define BlockAvailable(block) (BlockCapacity(block) - (block)->size)
+#define IsAvailable(block, required) (((block)->size + required) < BlockCapacity(block))
 
 #define FILE_IDENT(n) ((n)->ident)
 
@@ -236,10 +311,39 @@ typedef struct record_header_s {
 
 int Init_nffile(int workers, queue_t *fileList);
 
+// queues of data blocks are allocated with QUEUEDEPTHMAX slots. Their depth adapts
+// within the pipeline memory budget - see PipelineQueues() and QueueDepthMax()
+#define QUEUEDEPTHMAX 64
+
+void PipelineQueues(unsigned numQueues);
+
+unsigned QueueDepthMax(void);
+
+int StartWriterPool(unsigned numThreads);
+
 int ParseCompression(char *arg);
 
+int TrainZstdDictionary(char *dictFile);
+
 unsigned ReportBlocks(void);
 
+// decompression statistics of all blocks read, indexed by compression
+#define NUMCODECS 6
+typedef struct codecStat_s {
+    uint64_t blocks;
+    uint64_t inBytes;   // compressed bytes
+    uint64_t outBytes;  // uncompressed bytes
+    uint64_t nsec;      // time spent decompressing
+} codecStat_t;
+
+void GetCodecStat(codecStat_t *codecStat);
+
+// compression statistics of all blocks written. inBytes are the uncompressed bytes
+void GetCompressStat(codecStat_t *codecStat);
+
+// number of blocks queued for the nfwriter threads of all files
+uint64_t WriterBacklog(void);
+
 void SumStatRecords(stat_record_t *s1, stat_record_t *s2);
 
 nffile_t *OpenFile(char *filename, nffile_t *nffile);
@@ -259,6 +363,15 @@ int QueryFile(char *filename, int verbose);
 
 int GetStatRecord(char *filename, stat_record_t *stat_record);
 
+char *GetFileIdent(char *filename);
+
+int GetArchiveIntervals(char *filename, archiveInterval_t **interval);
+
+int AddArchiveInterval(nffile_t *nffile, char *name, uint32_t firstBlock, uint32_t numBlocks, stat_record_t *stat_record);
+
+struct catalogEntry_s;
+int CatalogEntry(char *filename, struct catalogEntry_s *entry);
+
 nffile_t *NewFile(nffile_t *nffile);
 
 void DisposeFile(nffile_t *nffile);
@@ -271,6 +384,62 @@ int RenameAppend(char *oldName, char *newName);
 
 nffile_t *GetNextFile(nffile_t *nffile);
 
+void SetBlockTimeWindow(uint64_t msecFirst, uint64_t msecLast);
+
+void SetBlockIPFilter(struct ipKey_s *keys, uint32_t numKeys);
+
+void SetBlockSummaryFilter(summaryFilter_t summaryFilter, const void *engine);
+
+// block selection of a file for the query plan - see ExplainNextFile()
+typedef struct fileExplain_s {
+    char *fileName;
+    uint64_t size;            // file size in bytes
+    uint64_t msecFirst;       // time window of the flows in the file
+    uint64_t msecLast;
+    uint64_t numFlows;
+    uint32_t numBlocks;
+    uint32_t selectedBlocks;  // blocks left to be read after pruning
+    uint64_t selectedRecords; // records of the selected blocks, if the file has a block index
+    uint16_t compression;
+    uint16_t hasIndex;        // file has a block index
+    uint16_t hasSummary;      // file has block summaries
+    uint16_t hasBloom;        // file has an IP bloom filter
+    uint16_t bloomMiss;       // no flow can match the IP addresses of the filter
+    uint16_t outsideWindow;   // all flows are outside the time window
+} fileExplain_t;
+
+int ExplainNextFile(fileExplain_t *explain);
+
+void SetBlockSample(double fraction);
+
+void BlockSummaryInit(blockSummary_t *blockSummary);
+
+void BlockSummaryAdd(blockSummary_t *blockSummary, const struct EXgenericFlow_s *genericFlow);
+
+void BlockBitmapAddExporter(blockBitmap_t *blockBitmap, uint16_t exporterID);
+
+void BlockBitmapAddRouter(blockBitmap_t *blockBitmap, uint64_t key);
+
+void SetFileMapping(int enable);
+
+void SetBlockSort(int enable);
+
+void SetBlockTap(nffile_t *nffile, blockTap_t blockTap, void *arg);
+
+int LiveSource(char *path);
+
+int StreamPath(char *path);
+
+void SetLiveWindow(uint32_t seconds);
+
+void SetFollowFile(int enable);
+
+void SetMergeWindow(uint32_t seconds);
+
+void SetBlockCache(size_t maxSize);
+
+int CacheFile(char *fileName);
+
 dataBlock_t *NewDataBlock(void);
 
 dataBlock_t *ReadBlock(nffile_t *nffile, dataBlock_t *dataBlock);
@@ -283,8 +452,14 @@ void FreeDataBlock(dataBlock_t *dataBlock);
 
 void SetIdent(nffile_t *nffile, char *Ident);
 
+int EnablePayloadDict(nffile_t *nffile);
+
+void SetAggregation(nffile_t *nffile, char *aggregation);
+
 void ModifyCompressFile(int compress);
 
+void ModifyLayoutFile(int columnar);
+
 void *nfreader(void *arg);
 
 void *nfwriter(void *arg);
@@ -51,6 +51,11 @@
  *   +-----------+-------------+-------------+-------------+-----+-------------+
  *   |Fileheader | datablock 0 | datablock 1 | datablock 2 | ... | datablock n |
  *   +-----------+-------------+-------------+-------------+-----+-------------+
+ *
+ * A file written to stdout or a pipe can not be rewritten. Its header is written once
+ * with offAppendix STREAM_APPENDIX and NumBlocks 0. The appendix blocks, flagged with
+ * FLAG_BLOCK_APPENDIX, are inline: the zstd dictionary precedes the data blocks,
+ * ident, stat and aggregation follow them. Such a file is read sequentially until EOF.
  */
 
 typedef struct fileHeaderV2_s {
@@ -72,9 +77,11 @@ typedef struct fileHeaderV2_s {
 #define BZ2_COMPRESSED 2
 #define LZ4_COMPRESSED 3
 #define ZSTD_COMPRESSED 4
+#define ZSTDDICT_COMPRESSED 5  // ZSTD with dictionary - see TYPE_ZSTDDICT
 
     uint8_t encryption;
 #define NOT_ENCRYPTED 0
+#define AES256GCM_ENCRYPTED 1  // data blocks are AES-256-GCM encrypted - see nfcrypt.h
     uint16_t appendixBlocks;  // number of blocks to read from appendix
                               // on open file for internal data structs
     uint32_t creator;         // program created this file
@@ -88,8 +95,10 @@ typedef struct fileHeaderV2_s {
 #define CREATOR_LOOKUP 7
 #define CREATOR_FT2NFDUMP 8
 #define CREATOR_TORLOOKUP 9
-#define MAX_CREATOR 10
+#define CREATOR_NFCOMPACT 10
+#define MAX_CREATOR 11
     off_t offAppendix;  // offset in file for appendix blocks with additional data
+#define STREAM_APPENDIX ((off_t)-1)  // appendix blocks are inline - stream framing
 
     uint32_t BlockSize;  // max block size of data blocks
     uint32_t NumBlocks;  // number of data blocks in file
@@ -123,6 +132,13 @@ typedef struct fileHeaderV2_s {
  * array elements without any header. The number of array elements is
  * NumRecords in the block header
  *
+ * datablock type 5 is a columnar block of V3 records - see nfcolumn.h
+ *   +------------+----------------+----------+----------+-----+----------+
+ *   |Blockheader | header column  | column 1 | column 2 | ... | column n |
+ *   +------------+----------------+----------+----------+-----+----------+
+ * the header column holds the V3 record headers of all records. Each further
+ * column holds one extension of all records, which contain this extension
+ *
  */
 typedef struct dataBlock_s {
     uint32_t NumRecords;  // size of this block in bytes without this header
@@ -130,12 +146,27 @@ typedef struct dataBlock_s {
     uint16_t type;        // Block type
 #define DATA_BLOCK_TYPE_3 3
 #define DATA_BLOCK_TYPE_4 4
+#define DATA_BLOCK_TYPE_5 5
     uint16_t flags;  // Bit 0: 0: file block compression, 1: block uncompressed
                      // Bit 1: 0: file block encryption, 1: block unencrypted
                      // Bit 2: 0: no autoread, 1: autoread - internal structure
+                     // Bit 4: 0: file block compression, 1: block codec in bits 8..11
+                     // Bit 5: 0: no checksum, 1: data is followed by its CRC32C, included in size
+                     // Bit 6: 0: data block, 1: appendix block
 #define FLAG_BLOCK_UNCOMPRESSED 0x1
 #define FLAG_BLOCK_UNENCRYPTED 0x2
 #define FLAG_BLOCK_AUTOREAD 0x4
+#define FLAG_BLOCK_CODEC 0x10
+#define FLAG_BLOCK_CRC 0x20
+#define FLAG_BLOCK_APPENDIX 0x40
+#define BLOCK_CODEC_MASK 0x0F00
+#define BLOCK_CODEC(flags) (((flags) & BLOCK_CODEC_MASK) >> 8)
+#define BLOCK_CODEC_FLAGS(codec) (FLAG_BLOCK_CODEC | (((codec) << 8) & BLOCK_CODEC_MASK))
+// internal flag - never written to disk:
+// block points into a file mapping and must not be freed
+#define FLAG_BLOCK_MAPPED 0x8000
+// block is allocated with the small write block size
+#define FLAG_BLOCK_SMALL 0x4000
 } dataBlock_t;
 
 /*
@@ -155,5 +186,120 @@ typedef struct recordHeader_s {
 
 #define TYPE_IDENT 0x8001
 #define TYPE_STAT 0x8002
+#define TYPE_BLOCKINDEX 0x8003
+#define TYPE_ZSTDDICT 0x8004
+#define TYPE_AGGREGATION 0x8005
+#define TYPE_IPBLOOM 0x8006
+#define TYPE_BLOCKSUMMARY 0x8007
+#define TYPE_PAYLOAD 0x8008
+#define TYPE_BLOCKBITMAP 0x8009
+#define TYPE_INTERVALTOC 0x800A
+
+/*
+ * Block index appendix record
+ * An array of blockIndex_t elements, one for each data block in the file in
+ * file order. The array may be split into several consecutive TYPE_BLOCKINDEX records.
+ */
+typedef struct blockIndex_s {
+    uint64_t offset;      // file offset of data block
+    uint32_t NumRecords;  // number of records in block
+    uint16_t type;        // block type
+    uint16_t flags;       // Bit 0: block contains records other than flows
+                          // - such as exporter/sampler records. Never skip
+#define FLAG_INDEX_NOSKIP 0x1
+    uint64_t msecFirst;  // min msecFirst of all flows in block
+    uint64_t msecLast;   // max msecLast of all flows in block
+} blockIndex_t;
+
+/*
+ * Zstd dictionary appendix record
+ * The raw zstd dictionary used to compress the data blocks of a ZSTDDICT_COMPRESSED file.
+ * The dictionary is referenced by its zstd dictionary ID in each compressed block.
+ * The appendix block itself is compressed without dictionary.
+ */
+
+/*
+ * Aggregation appendix record
+ * A '\0' terminated string with the aggregation of the flows in this file, such as
+ * "srcip,dstport" or "bidir". Files with an aggregation record contain partial aggregates:
+ * the flow, packet and byte counters of each record are sums of the original flows.
+ * Such files may be merged exactly by nfdump, using the same or a coarser aggregation.
+ */
+
+/*
+ * IP bloom filter appendix record
+ * A bloom filter of all src/dst IP addresses of the flows in this file - see ipbloom.h
+ * The filter bits are split into several consecutive TYPE_IPBLOOM records. Each record
+ * starts with an ipBloomRecord_t, followed by size bytes of the filter at byte offset.
+ */
+typedef struct ipBloomRecord_s {
+    uint32_t numBits;    // number of bits of the filter - power of 2
+    uint16_t numHashes;  // number of hash functions
+    uint16_t fill;       // unused
+    uint32_t offset;     // byte offset of the bits in this record
+    uint32_t size;       // number of bytes in this record
+} ipBloomRecord_t;
+
+/*
+ * Block summary appendix record
+ * An array of blockSummary_t elements, one for each data block in the file in
+ * file order, parallel to the block index. The summary holds the protocols, ports and
+ * counter ranges of all flows in the block, so a reader may skip blocks, which can not
+ * match a filter. The array may be split into several consecutive TYPE_BLOCKSUMMARY records.
+ */
+#define SUMMARYPORTBITS 1024
+typedef struct blockSummary_s {
+    uint64_t protoMap[4];                     // bit n: a flow with protocol n
+    uint64_t portMap[SUMMARYPORTBITS / 64];  // bit (port % SUMMARYPORTBITS): a flow with src or dst port
+    uint64_t minBytes;                        // min/max in bytes of all flows
+    uint64_t maxBytes;
+    uint64_t minPackets;  // min/max in packets of all flows
+    uint64_t maxPackets;
+    uint32_t flags;  // Bit 0: all records of the block have an EXgenericFlow extension
+#define FLAG_SUMMARY_ALLFLOWS 0x1
+    uint32_t fill;
+} blockSummary_t;
+
+/*
+ * Block bitmap appendix record
+ * An array of blockBitmap_t elements, one for each data block in the file in file
+ * order, parallel to the block summary. The bitmaps hold the exporter sysIDs and the
+ * hashed router IPs of all records in the block, so a reader may skip blocks of other
+ * exporters. Files without bitmaps are read as if any exporter is in a block.
+ * The array may be split into several consecutive TYPE_BLOCKBITMAP records.
+ */
+#define BITMAPEXPORTERBITS 256
+#define BITMAPROUTERBITS 256
+// bit of an IPv4 router address or of each 64bit half of an IPv6 router address
+#define BITMAPROUTERBIT(key) ((uint32_t)(((uint64_t)(key) * 0x9E3779B97F4A7C15ULL) >> 56))
+typedef struct blockBitmap_s {
+    uint64_t exporterMap[BITMAPEXPORTERBITS / 64];  // bit (sysID % BITMAPEXPORTERBITS): a record of exporter sysID
+    uint64_t routerMap[BITMAPROUTERBITS / 64];      // bit BITMAPROUTERBIT(ip): a flow received from router ip
+} blockBitmap_t;
+
+/*
+ * Payload dictionary appendix record
+ * One payload of the payload dictionary - see payload.h. The record starts with a
+ * payloadRecord_t, followed by size bytes of the payload. The records follow the first
+ * appendix block in additional appendix blocks in ascending payloadID order.
+ */
+typedef struct payloadRecord_s {
+    uint32_t payloadID;  // ID of the payload, referenced by EXpayloadRef
+    uint32_t size;       // size of the payload - 4 byte aligned
+} payloadRecord_t;
+
+/*
+ * Interval table of contents appendix record
+ * One interval file merged into an archive file by nfcompact. The record starts with an
+ * intervalToc_t, followed by the stat_record_t of the interval file. The data blocks of
+ * an interval are consecutive, and no block holds records of two intervals. The records
+ * follow the first appendix block in additional appendix blocks in ascending name order.
+ */
+#define TOCNAMELEN 32
+typedef struct intervalToc_s {
+    char name[TOCNAMELEN];  // '\0' terminated name of the interval file, such as nfcapd.202401011200
+    uint32_t firstBlock;    // number of the first data block of the interval
+    uint32_t numBlocks;     // number of data blocks of the interval
+} intervalToc_t;
 
 #endif  //_NFFILEV2_H
@@ -0,0 +1,459 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "nfmerge.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flist.h"
+#include "nfcolumn.h"
+#include "nfdump.h"
+#include "nffileV2.h"
+#include "nfxV3.h"
+#include "util.h"
+
+// record waiting in the reorder heap
+typedef struct mergeRecord_s {
+    uint64_t msecFirst;
+    uint64_t sequence;  // keeps the source order of records with the same start time
+    record_header_t *record;
+} mergeRecord_t;
+
+// cursor over the files of a source
+typedef struct mergeSource_s {
+    stringlist_t files;
+    uint32_t nextFile;
+    nffile_t *nffile;
+    dataBlock_t *dataBlock;
+    record_header_t *cursor;  // record at the cursor
+    uint32_t numRecords;      // records left in the block
+    uint32_t left;            // bytes left in the block
+    uint64_t msecHead;        // start time of the record at the cursor
+} mergeSource_t;
+
+typedef struct merge_s {
+    nffile_t *nffile;  // merged file
+    uint64_t window;   // merge window in msec
+
+    mergeSource_t *sources;
+    uint32_t numSources;
+    // heap of the sources by msecHead
+    mergeSource_t **sourceHeap;
+    uint32_t heapSize;
+
+    // reorder heap of the records by msecFirst
+    mergeRecord_t *records;
+    uint32_t numRecords;
+    uint32_t maxRecords;
+    uint64_t sequence;
+
+    dataBlock_t *dataBlock;  // merged block in progress
+    uint64_t lastEmitted;
+    uint64_t lateRecords;
+} merge_t;
+
+/* function prototypes */
+static uint64_t RecordTime(record_header_t *record);
+
+static int NextBlock(mergeSource_t *source);
+
+static int NextRecord(mergeSource_t *source);
+
+static void SiftSource(merge_t *merge, uint32_t i);
+
+static int QueueRecord(merge_t *merge, record_header_t *record, uint64_t msecFirst);
+
+static record_header_t *DequeueRecord(merge_t *merge);
+
+static int AppendRecord(merge_t *merge, record_header_t *record);
+
+static void FreeMerge(merge_t *merge);
+
+__attribute__((noreturn)) static void *mergeThread(void *arg);
+
+// start time of a V3 record, 0 for all others
+static uint64_t RecordTime(record_header_t *record) {
+    if (record->type != V3Record) return 0;
+
+    recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)record;
+    void *recordEnd = (void *)recordHeaderV3 + recordHeaderV3->size;
+    elementHeader_t *elementHeader = (elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+    for (int i = 0; i < recordHeaderV3->numElements; i++) {
+        if (((void *)elementHeader + sizeof(elementHeader_t)) > recordEnd || elementHeader->length == 0) break;
+        if ((void *)elementHeader + elementHeader->length > recordEnd) break;
+        if (elementHeader->type == EXgenericFlowID) {
+            EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)((void *)elementHeader + sizeof(elementHeader_t));
+            return genericFlow->msecFirst;
+        }
+        elementHeader = (elementHeader_t *)((void *)elementHeader + elementHeader->length);
+    }
+    return 0;
+
+}  // End of RecordTime
+
+// load the next block of a source. Opens the next file, if the current one is done
+// returns 0, if all files of the source are read
+static int NextBlock(mergeSource_t *source) {
+    if (source->dataBlock) {
+        FreeDataBlock(source->dataBlock);
+        source->dataBlock = NULL;
+    }
+
+    while (1) {
+        if (source->nffile) {
+            dataBlock_t *dataBlock = ReadBlock(source->nffile, NULL);
+            if (dataBlock) {
+                if (dataBlock->type == DATA_BLOCK_TYPE_5) {
+                    dataBlock_t *v3Block = NewDataBlock();
+                    int ok = ExpandColumnarBlock(dataBlock, v3Block, ALLEXTENSIONS);
+                    FreeDataBlock(dataBlock);
+                    if (!ok) {
+                        LogError("Corrupt columnar block in file %s. Skip block", source->nffile->fileName);
+                        FreeDataBlock(v3Block);
+                        continue;
+                    }
+                    dataBlock = v3Block;
+                }
+                if (dataBlock->type != DATA_BLOCK_TYPE_3) {
+                    if (dataBlock->type != DATA_BLOCK_TYPE_4)
+                        LogError("Merge of block type %u not supported in file %s. Skip block", dataBlock->type, source->nffile->fileName);
+                    FreeDataBlock(dataBlock);
+                    continue;
+                }
+                source->dataBlock = dataBlock;
+                source->cursor = GetCursor(dataBlock);
+                source->numRecords = dataBlock->NumRecords;
+                source->left = dataBlock->size;
+                return 1;
+            }
+            CloseFile(source->nffile);
+            DisposeFile(source->nffile);
+            source->nffile = NULL;
+        }
+
+        if (source->nextFile == source->files.num_strings) return 0;
+        source->nffile = OpenFile(source->files.list[source->nextFile++], NULL);
+    }
+
+    /* NOTREACHED */
+
+}  // End of NextBlock
+
+// move the cursor of a source to its next record. returns 0, if the source is done
+static int NextRecord(mergeSource_t *source) {
+    if (source->numRecords) {
+        source->left -= source->cursor->size;
+        source->cursor = (record_header_t *)((void *)source->cursor + source->cursor->size);
+        source->numRecords--;
+    }
+
+    while (1) {
+        if (source->numRecords) {
+            record_header_t *record = source->cursor;
+            if (source->left >= sizeof(record_header_t) && record->size >= sizeof(record_header_t) && record->size <= source->left) break;
+            LogError("Corrupt record in file %s. Skip remaining block", source->nffile ? source->nffile->fileName : "");
+        }
+        if (!NextBlock(source)) return 0;
+    }
+
+    source->msecHead = RecordTime(source->cursor);
+    return 1;
+
+}  // End of NextRecord
+
+// restore the heap order of the sources downwards from i
+static void SiftSource(merge_t *merge, uint32_t i) {
+    mergeSource_t **heap = merge->sourceHeap;
+    while (1) {
+        uint32_t min = i;
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        if (left < merge->heapSize && heap[left]->msecHead < heap[min]->msecHead) min = left;
+        if (right < merge->heapSize && heap[right]->msecHead < heap[min]->msecHead) min = right;
+        if (min == i) return;
+        mergeSource_t *tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+
+}  // End of SiftSource
+
+static inline int RecordLess(mergeRecord_t *r1, mergeRecord_t *r2) {
+    return r1->msecFirst < r2->msecFirst || (r1->msecFirst == r2->msecFirst && r1->sequence < r2->sequence);
+}  // End of RecordLess
+
+// copy the record into the reorder heap
+static int QueueRecord(merge_t *merge, record_header_t *record, uint64_t msecFirst) {
+    if (merge->numRecords == merge->maxRecords) {
+        uint32_t maxRecords = merge->maxRecords ? 2 * merge->maxRecords : 4096;
+        mergeRecord_t *records = realloc(merge->records, maxRecords * sizeof(mergeRecord_t));
+        if (!records) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        merge->records = records;
+        merge->maxRecords = maxRecords;
+    }
+
+    record_header_t *copy = malloc(record->size);
+    if (!copy) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    memcpy((void *)copy, (void *)record, record->size);
+
+    mergeRecord_t *records = merge->records;
+    mergeRecord_t mergeRecord = {.msecFirst = msecFirst, .sequence = merge->sequence++, .record = copy};
+    uint32_t i = merge->numRecords++;
+    while (i) {
+        uint32_t parent = (i - 1) / 2;
+        if (!RecordLess(&mergeRecord, &records[parent])) break;
+        records[i] = records[parent];
+        i = parent;
+    }
+    records[i] = mergeRecord;
+    return 1;
+
+}  // End of QueueRecord
+
+// remove the oldest record from the reorder heap
+static record_header_t *DequeueRecord(merge_t *merge) {
+    mergeRecord_t *records = merge->records;
+    record_header_t *record = records[0].record;
+    if (records[0].msecFirst < merge->lastEmitted) {
+        merge->lateRecords++;
+    } else {
+        merge->lastEmitted = records[0].msecFirst;
+    }
+
+    mergeRecord_t last = records[--merge->numRecords];
+    uint32_t i = 0;
+    while (1) {
+        uint32_t min = 2 * i + 1;
+        if (min >= merge->numRecords) break;
+        if ((min + 1) < merge->numRecords && RecordLess(&records[min + 1], &records[min])) min++;
+        if (!RecordLess(&records[min], &last)) break;
+        records[i] = records[min];
+        i = min;
+    }
+    records[i] = last;
+    return record;
+
+}  // End of DequeueRecord
+
+// append a record to the merged block. Full blocks are handed to the reader
+// returns 0, if the merged file is closed
+static int AppendRecord(merge_t *merge, record_header_t *record) {
+    dataBlock_t *dataBlock = merge->dataBlock;
+    if (!IsAvailable(dataBlock, record->size)) {
+        if (queue_push(merge->nffile->processQueue, (void *)dataBlock) == QUEUE_CLOSED) return 0;
+        dataBlock = NewDataBlock();
+        if (!dataBlock) return 0;
+        merge->dataBlock = dataBlock;
+    }
+
+    memcpy(GetCurrentCursor(dataBlock), (void *)record, record->size);
+    dataBlock->size += record->size;
+    dataBlock->NumRecords++;
+    return 1;
+
+}  // End of AppendRecord
+
+static void FreeMerge(merge_t *merge) {
+    for (uint32_t i = 0; i < merge->numSources; i++) {
+        mergeSource_t *source = &merge->sources[i];
+        if (source->dataBlock) FreeDataBlock(source->dataBlock);
+        if (source->nffile) {
+            CloseFile(source->nffile);
+            DisposeFile(source->nffile);
+        }
+        for (uint32_t j = 0; j < source->files.num_strings; j++) free(source->files.list[j]);
+        free(source->files.list);
+    }
+    for (uint32_t i = 0; i < merge->numRecords; i++) free(merge->records[i].record);
+    if (merge->dataBlock) FreeDataBlock(merge->dataBlock);
+    free(merge->records);
+    free(merge->sourceHeap);
+    free(merge->sources);
+    free(merge);
+
+}  // End of FreeMerge
+
+// k-way merge of all sources. A record leaves the reorder heap, as soon as the
+// merge has advanced by more than the window beyond its start time
+__attribute__((noreturn)) static void *mergeThread(void *arg) {
+    merge_t *merge = (merge_t *)arg;
+    nffile_t *nffile = merge->nffile;
+
+    /* Signal handling */
+    sigset_t set = {0};
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    for (uint32_t i = 0; i < merge->numSources; i++) {
+        mergeSource_t *source = &merge->sources[i];
+        if (NextRecord(source)) merge->sourceHeap[merge->heapSize++] = source;
+    }
+    for (int i = (int)merge->heapSize / 2 - 1; i >= 0; i--) SiftSource(merge, i);
+
+    int ok = 1;
+    while (ok && merge->heapSize) {
+        if (atomic_load(&nffile->terminate) != 0) {
+            ok = 0;
+            break;
+        }
+        mergeSource_t *source = merge->sourceHeap[0];
+        record_header_t *record = source->cursor;
+        if (record->type == V3Record) {
+            uint64_t msecFirst = source->msecHead;
+            ok = QueueRecord(merge, record, msecFirst);
+            while (ok && merge->numRecords && (merge->records[0].msecFirst + merge->window) <= msecFirst) {
+                record_header_t *next = DequeueRecord(merge);
+                ok = AppendRecord(merge, next);
+                free(next);
+            }
+        } else {
+            // exporter, sampler and other meta records precede the flows, which reference them
+            ok = AppendRecord(merge, record);
+        }
+
+        if (!NextRecord(source)) merge->sourceHeap[0] = merge->sourceHeap[--merge->heapSize];
+        SiftSource(merge, 0);
+    }
+
+    while (ok && merge->numRecords) {
+        record_header_t *next = DequeueRecord(merge);
+        ok = AppendRecord(merge, next);
+        free(next);
+    }
+    if (ok && merge->dataBlock->NumRecords) {
+        if (queue_push(nffile->processQueue, (void *)merge->dataBlock) != QUEUE_CLOSED) merge->dataBlock = NULL;
+    }
+
+    if (merge->lateRecords)
+        LogError("Warning: %llu flows were out of time order by more than the merge window of %llu s", (unsigned long long)merge->lateRecords,
+                 (unsigned long long)merge->window / 1000LL);
+
+    queue_close(nffile->processQueue);
+    FreeMerge(merge);
+
+    atomic_store(&nffile->terminate, 2);
+    pthread_exit(NULL);
+
+}  // End of mergeThread
+
+// read the files of all sources -M as a single file of time ordered records
+// returns NULL, if there are no more files
+nffile_t *OpenMergedFile(queue_t *fileQueue, nffile_t *nffile, uint32_t window) {
+    merge_t *merge = calloc(1, sizeof(merge_t));
+    if (!merge) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    merge->window = 1000LL * window;
+
+    stat_record_t stat_record = {0};
+    stat_record.firstseen = 0x7fffffffffffffffLL;
+    uint32_t numFiles = 0;
+    char *fileName;
+    while ((fileName = queue_pop(fileQueue)) != QUEUE_CLOSED) {
+        // sources are listed after each other, so the file queue must be drained first
+        int index = FileSource(fileName);
+        if (index < 0) index = 0;
+        if ((uint32_t)index >= merge->numSources) {
+            mergeSource_t *sources = realloc(merge->sources, (index + 1) * sizeof(mergeSource_t));
+            if (!sources) {
+                LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                free(fileName);
+                FreeMerge(merge);
+                return NULL;
+            }
+            memset((void *)&sources[merge->numSources], 0, (index + 1 - merge->numSources) * sizeof(mergeSource_t));
+            for (uint32_t i = merge->numSources; i <= (uint32_t)index; i++) InitStringlist(&sources[i].files, 256);
+            merge->sources = sources;
+            merge->numSources = index + 1;
+        }
+
+        stat_record_t fileStat;
+        if (GetStatRecord(fileName, &fileStat)) {
+            SumStatRecords(&stat_record, &fileStat);
+            InsertString(&merge->sources[index].files, fileName);
+            numFiles++;
+        }
+        free(fileName);
+    }
+
+    if (numFiles == 0) {
+        FreeMerge(merge);
+        return NULL;
+    }
+
+    merge->sourceHeap = calloc(merge->numSources, sizeof(mergeSource_t *));
+    merge->dataBlock = NewDataBlock();
+    if (!merge->sourceHeap || !merge->dataBlock) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        FreeMerge(merge);
+        return NULL;
+    }
+
+    nffile = NewFile(nffile);
+    if (!nffile) {
+        FreeMerge(merge);
+        return NULL;
+    }
+    // no file descriptor - the merged records are produced by mergeThread
+    nffile->fd = -1;
+    nffile->fileName = strdup("merged sources");
+    *nffile->stat_record = stat_record;
+    merge->nffile = nffile;
+
+    atomic_store(&nffile->terminate, 0);
+    queue_open(nffile->processQueue);
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, mergeThread, (void *)merge);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        FreeMerge(merge);
+        CloseFile(nffile);
+        return NULL;
+    }
+    nffile->worker[0] = tid;
+
+    return nffile;
+
+}  // End of OpenMergedFile
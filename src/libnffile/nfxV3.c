@@ -75,9 +75,136 @@ static void CompactSequencer(sequencer_t *sequencer) {
 
 }  // End of CompactSequencer
 
+
+/*
+ * Merge adjacent copy and byte swap operations of a compiled sequencer. Fields which
+ * are contiguous in the input record and in the output elements are transferred by
+ * a single operation - one memcpy() for byte copies or one swap loop for a run of
+ * numbers of the same size, which the compiler is free to vectorize.
+ */
+static void MergeSequenceOps(compiledSequencer_t *compiled) {
+    if (compiled->numOps < 2) return;
+
+    uint32_t j = 0;
+    for (uint32_t i = 1; i < compiled->numOps; i++) {
+        sequenceOp_t *prev = &(compiled->op[j]);
+        sequenceOp_t *op = &(compiled->op[i]);
+        int mergeable = prev->op == op->op && op->op != SEQ_OP_NUMBER && prev->outLength && op->outLength &&
+                        prev->inLength == prev->outLength && op->inLength == op->outLength &&
+                        (prev->inOffset + prev->inLength) == op->inOffset && (prev->outOffset + prev->outLength) == op->outOffset;
+        if (mergeable) {
+            prev->inLength += op->inLength;
+            prev->outLength += op->outLength;
+        } else {
+            j++;
+            compiled->op[j] = *op;
+        }
+    }
+    dbg_printf("MergeSequenceOps() ops: %u -> %u\n", compiled->numOps, j + 1);
+    compiled->numOps = j + 1;
+
+}  // End of MergeSequenceOps
+
+/*
+ * Templates with fixed length fields only are compiled into a decoder: the output
+ * elements are pre-built with their headers, and all input fields are reduced to a list
+ * of copy and byte swap operations at fixed input and output offsets.
+ */
+static compiledSequencer_t *CompileSequencer(sequencer_t *sequencer) {
+    if (sequencer->inLength == 0 || sequencer->outLength == 0 || sequencer->inLength > 0xFFFF || sequencer->outLength > 0xFFFF) return NULL;
+
+    compiledSequencer_t *compiled = calloc(1, sizeof(compiledSequencer_t) + sequencer->numSequences * sizeof(sequenceOp_t));
+    void *outTemplate = calloc(1, sequencer->outLength);
+    if (!compiled || !outTemplate) {
+        LogError("SetupSequencer: malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        free(compiled);
+        free(outTemplate);
+        return NULL;
+    }
+    compiled->outTemplate = outTemplate;
+
+    // output elements are created in the order of their first sequence
+    uint16_t outOffset[MAXEXTENSIONS] = {0};
+    uint32_t outLength = 0;
+    uint32_t inOffset = 0;
+    for (int i = 0; i < sequencer->numSequences; i++) {
+        sequence_t *sequence = &(sequencer->sequenceTable[i]);
+        uint32_t ExtID = sequence->extensionID;
+        uint16_t inLength = sequence->inputLength;
+        uint16_t outLen = sequence->outputLength;
+
+        if (ExtID == EXnull && sequence->stackID == 0) {
+            // skip sequence - sub templates need the generic sequencer
+            if (sequence->inputType == subTemplateListType || sequence->inputType == subTemplateMultiListType) {
+                free(outTemplate);
+                free(compiled);
+                return NULL;
+            }
+            inOffset += inLength;
+            continue;
+        }
+
+        if (ExtID != EXnull && outOffset[ExtID] == 0) {
+            elementHeader_t *elementHeader = (elementHeader_t *)(outTemplate + outLength);
+            elementHeader->type = extensionTable[ExtID].id;
+            elementHeader->length = sequencer->ExtSize[ExtID];
+            outOffset[ExtID] = outLength + sizeof(elementHeader_t);
+            compiled->extensionID[compiled->numExtensions] = ExtID;
+            compiled->extensionOffset[compiled->numExtensions] = outOffset[ExtID];
+            compiled->numExtensions++;
+            outLength += sequencer->ExtSize[ExtID];
+        }
+
+        if (inLength == 0) continue;
+        if (ExtID == EXnull && outLen != 0) {
+            // value without output element
+            free(outTemplate);
+            free(compiled);
+            return NULL;
+        }
+
+        sequenceOp_t *op = &(compiled->op[compiled->numOps++]);
+        *op = (sequenceOp_t){.stackID = sequence->stackID,
+                             .inOffset = inOffset,
+                             .inLength = inLength,
+                             .outOffset = ExtID == EXnull ? 0 : outOffset[ExtID] + sequence->offsetRel,
+                             .outLength = outLen};
+        if (sequence->copyMode == ByteCopy || inLength > 16) {
+            op->op = SEQ_OP_COPY;
+            op->inLength = inLength < outLen ? inLength : outLen;
+        } else if (op->stackID == 0 && inLength == outLen && inLength == 2) {
+            op->op = SEQ_OP_NUM16;
+        } else if (op->stackID == 0 && inLength == outLen && inLength == 4) {
+            op->op = SEQ_OP_NUM32;
+        } else if (op->stackID == 0 && inLength == outLen && inLength == 8) {
+            op->op = SEQ_OP_NUM64;
+        } else {
+            op->op = SEQ_OP_NUMBER;
+        }
+        inOffset += inLength;
+    }
+
+    if (outLength != sequencer->outLength || inOffset != sequencer->inLength) {
+        dbg_printf("CompileSequencer() length mismatch - in: %u/%zu, out: %u/%zu\n", inOffset, sequencer->inLength, outLength, sequencer->outLength);
+        free(outTemplate);
+        free(compiled);
+        return NULL;
+    }
+    MergeSequenceOps(compiled);
+    compiled->inLength = sequencer->inLength;
+    compiled->outLength = sequencer->outLength;
+    memset((void *)sequencer->offsetCache, 0, MAXEXTENSIONS * sizeof(void *));
+
+    return compiled;
+
+}  // End of CompileSequencer
+
 uint16_t *SetupSequencer(sequencer_t *sequencer, sequence_t *sequenceTable, uint32_t numSequences) {
     memset((void *)sequencer->ExtSize, 0, sizeof(sequencer->ExtSize));
 
+    memset((void *)sequencer->subSequencer, 0, sizeof(sequencer->subSequencer));
+    sequencer->compiled = NULL;
+
     sequencer->sequenceTable = sequenceTable;
     sequencer->numSequences = numSequences;
     sequencer->inLength = 0;
@@ -85,6 +212,21 @@ uint16_t *SetupSequencer(sequencer_t *sequencer, sequence_t *sequenceTable, uint
 
     CompactSequencer(sequencer);
 
+    // the input size of a run of fixed length fields is checked once at its first field
+    sequence_t *runStart = NULL;
+    for (int i = 0; i < sequencer->numSequences; i++) {
+        sequence_t *sequence = &(sequencer->sequenceTable[i]);
+        sequence->fixedRun = 0;
+        if (sequence->inputLength == VARLENGTH) {
+            runStart = NULL;
+        } else if (runStart) {
+            runStart->fixedRun += sequence->inputLength;
+        } else {
+            runStart = sequence;
+            sequence->fixedRun = sequence->inputLength;
+        }
+    }
+
     int hasVarInLength = 0;
     int hasVarOutLength = 0;
     for (int i = 0; i < sequencer->numSequences; i++) {
@@ -129,6 +271,7 @@ uint16_t *SetupSequencer(sequencer_t *sequencer, sequence_t *sequenceTable, uint
     if (!hasVarInLength && !hasVarOutLength) {
         dbg_printf("SetupSequencer() Fixed length fields, found %u elements in %u sequences\n", sequencer->numElements, sequencer->numSequences);
         dbg_printf("SetupSequencer() Calculated input length: %lu, output length: %lu\n", sequencer->inLength, sequencer->outLength);
+        sequencer->compiled = CompileSequencer(sequencer);
     }
 
     // dynamically create extension list
@@ -152,6 +295,10 @@ uint16_t *SetupSequencer(sequencer_t *sequencer, sequence_t *sequenceTable, uint
 
 void ClearSequencer(sequencer_t *sequencer) {
     if (sequencer->sequenceTable) free(sequencer->sequenceTable);
+    if (sequencer->compiled) {
+        free(sequencer->compiled->outTemplate);
+        free(sequencer->compiled);
+    }
 
     memset((void *)sequencer, 0, sizeof(sequencer_t));
 
@@ -171,20 +318,37 @@ size_t CalcOutRecordSize(sequencer_t *sequencer, void *in, size_t inSize) {
 
 }  // End of OutRecordSize
 
+// calculate the output size of all records of a data flowset with inSize bytes
+// addSize is added per record for the record header and extra elements
+// returns 0, if the record sizes are not known in advance
+size_t CalcOutFlowsetSize(sequencer_t *sequencer, size_t inSize, size_t addSize) {
+    if (sequencer->compiled == NULL) return 0;
+
+    size_t numRecords = inSize / sequencer->compiled->inLength;
+    return numRecords * (sequencer->compiled->outLength + addSize);
+
+}  // End of CalcOutFlowsetSize
+
 static sequencer_t *GetSubTemplateSequencer(sequencer_t *sequencer, uint16_t templateID) {
+    uint32_t slot = templateID & (SUBSEQUENCERS - 1);
+    sequencer_t *subSequencer = sequencer->subSequencer[slot];
+    if (subSequencer && subSequencer->templateID == templateID) return subSequencer;
+
     sequencer_t *self = sequencer;
-    while (sequencer->next != self && sequencer->templateID != templateID) {
-        sequencer = sequencer->next;
+    subSequencer = sequencer;
+    while (subSequencer->next && subSequencer->next != self && subSequencer->templateID != templateID) {
+        subSequencer = subSequencer->next;
     }
 
-    if (sequencer->templateID == templateID) {
-        dbg_printf("Sub template sequencer found for id: %u %u\n", templateID, sequencer->templateID);
-        return sequencer;
+    if (subSequencer->templateID == templateID) {
+        dbg_printf("Sub template sequencer found for id: %u %u\n", templateID, subSequencer->templateID);
+        sequencer->subSequencer[slot] = subSequencer;
+        return subSequencer;
     } else {
         dbg_printf("No sub template sequencer found for id: %u\n", templateID);
         return NULL;
     }
-}
+}  // End of GetSubTemplateSequencer
 
 static int ProcessSubTemplate(sequencer_t *sequencer, uint16_t type, const void *inBuff, uint16_t inLength, void *outBuff, size_t outSize,
                               uint64_t *stack) {
@@ -242,6 +406,124 @@ static int ProcessSubTemplate(sequencer_t *sequencer, uint16_t type, const void
 
 }  // End of ProcessSubTemplate
 
+// run the compiled decoder of a fixed length template
+static int RunCompiledSequencer(sequencer_t *sequencer, const void *inBuff, size_t inSize, void *outBuff, size_t outSize, uint64_t *stack) {
+    const compiledSequencer_t *compiled = sequencer->compiled;
+    recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)outBuff;
+
+    if (compiled->inLength > inSize) {
+        LogError("SequencerRun() ERROR - Attempt to read beyond input stream size");
+        dbg_printf("Attempt to read beyond input stream size: inLength: %zu, inSize: %zu\n", compiled->inLength, inSize);
+        return SEQ_ERROR;
+    }
+    if ((recordHeaderV3->size + compiled->outLength) > outSize) {
+        dbg_printf("Size error add output elements: header size: %u, elements size: %zu, output size: %zu\n", recordHeaderV3->size,
+                   compiled->outLength, outSize);
+        return SEQ_MEM_ERR;
+    }
+
+    void *out = outBuff + recordHeaderV3->size;
+    memcpy(out, compiled->outTemplate, compiled->outLength);
+    for (int i = 0; i < compiled->numExtensions; i++) {
+        sequencer->offsetCache[compiled->extensionID[i]] = out + compiled->extensionOffset[i];
+    }
+
+    for (int i = 0; i < compiled->numOps; i++) {
+        const sequenceOp_t *op = &(compiled->op[i]);
+        const void *in = inBuff + op->inOffset;
+        void *dst = out + op->outOffset;
+        switch (op->op) {
+            case SEQ_OP_NUM16: {
+                const uint16_t *src = (const uint16_t *)in;
+                uint16_t *val = (uint16_t *)dst;
+                for (int k = 0; k < (op->inLength >> 1); k++) val[k] = ntohs(src[k]);
+            } break;
+            case SEQ_OP_NUM32: {
+                const uint32_t *src = (const uint32_t *)in;
+                uint32_t *val = (uint32_t *)dst;
+                for (int k = 0; k < (op->inLength >> 2); k++) val[k] = ntohl(src[k]);
+            } break;
+            case SEQ_OP_NUM64: {
+                const uint64_t *src = (const uint64_t *)in;
+                uint64_t *val = (uint64_t *)dst;
+                for (int k = 0; k < (op->inLength >> 3); k++) val[k] = ntohll(src[k]);
+            } break;
+            case SEQ_OP_COPY:
+                memcpy(dst, in, op->inLength);
+                break;
+            case SEQ_OP_NUMBER: {
+                uint64_t valBuff[2] = {0, 0};
+                switch (op->inLength) {
+                    case 1:
+                        valBuff[0] = ((uint8_t *)in)[0];
+                        break;
+                    case 2:
+                        valBuff[0] = Get_val16(in);
+                        break;
+                    case 3:
+                        valBuff[0] = Get_val24(in);
+                        break;
+                    case 4:
+                        valBuff[0] = Get_val32(in);
+                        break;
+                    case 5:
+                        valBuff[0] = Get_val40(in);
+                        break;
+                    case 6:
+                        valBuff[0] = Get_val48(in);
+                        break;
+                    case 7:
+                        valBuff[0] = Get_val56(in);
+                        break;
+                    case 8:
+                        valBuff[0] = Get_val64(in);
+                        break;
+                    case 16:
+                        valBuff[0] = Get_val64(in);
+                        valBuff[1] = Get_val64(in + 8);
+                        break;
+                    default:
+                        // for length 9, 10, 11 and 12
+                        memcpy(valBuff, in, op->inLength);
+                        break;
+                }
+                if (op->stackID && stack) stack[op->stackID] = valBuff[0];
+                switch (op->outLength) {
+                    case 0:
+                        break;
+                    case 1:
+                        *((uint8_t *)dst) = valBuff[0];
+                        break;
+                    case 2:
+                        *((uint16_t *)dst) = valBuff[0];
+                        break;
+                    case 4:
+                        *((uint32_t *)dst) = valBuff[0];
+                        break;
+                    case 8:
+                        *((uint64_t *)dst) = valBuff[0];
+                        break;
+                    case 16:
+                        memcpy(dst, valBuff, 16);
+                        break;
+                    default: {
+                        uint32_t copyLen = op->inLength < op->outLength ? op->inLength : op->outLength;
+                        memcpy(dst, valBuff, copyLen);
+                    }
+                }
+            } break;
+        }
+    }
+
+    recordHeaderV3->size += compiled->outLength;
+    recordHeaderV3->numElements += compiled->numExtensions;
+    sequencer->inLength = compiled->inLength;
+    sequencer->outLength = compiled->outLength;
+
+    return SEQ_OK;
+
+}  // End of RunCompiledSequencer
+
 // SequencerRun requires calling CalcOutRecordSize first
 int SequencerRun(sequencer_t *sequencer, const void *inBuff, size_t inSize, void *outBuff, size_t outSize, uint64_t *stack) {
     static int nestLevel = 0;
@@ -255,6 +537,11 @@ int SequencerRun(sequencer_t *sequencer, const void *inBuff, size_t inSize, void
         return SEQ_OK;
     }
 
+    if (sequencer->compiled) {
+        nestLevel--;
+        return RunCompiledSequencer(sequencer, inBuff, inSize, outBuff, outSize, stack);
+    }
+
     if (nestLevel > 16) {
         LogError("SequencerRun() sub template run nested too deeply");
         nestLevel--;
@@ -277,6 +564,13 @@ int SequencerRun(sequencer_t *sequencer, const void *inBuff, size_t inSize, void
         uint16_t inLength = sequencer->sequenceTable[i].inputLength;
         uint16_t outLength = sequencer->sequenceTable[i].outputLength;
         bool varLength = sequencer->sequenceTable[i].inputLength == VARLENGTH;
+        uint32_t fixedRun = sequencer->sequenceTable[i].fixedRun;
+        if (fixedRun && (totalInLength + fixedRun) > inSize) {
+            LogError("SequencerRun() ERROR - Attempt to read beyond input stream size");
+            dbg_printf("Attempt to read beyond input stream size: total: %u, fixed run: %u, inSize: %zu\n", totalInLength, fixedRun, inSize);
+            nestLevel--;
+            return SEQ_ERROR;
+        }
         if (varLength) {  // dyn length
             uint16_t len = ((uint8_t *)inBuff)[0];
             if (len < 255) {
@@ -289,13 +583,14 @@ int SequencerRun(sequencer_t *sequencer, const void *inBuff, size_t inSize, void
                 totalInLength += 3;
             }
             dbg_printf("Sequencer process var length field %u: true length: %u\n", sequencer->sequenceTable[i].inputType, inLength);
-        }
 
-        if ((totalInLength + inLength) > inSize) {
-            LogError("SequencerRun() ERROR - Attempt to read beyond input stream size");
-            dbg_printf("Attempt to read beyond input stream size: total: %u, inLength: %u, inSize: %zu\n", totalInLength, inLength, inSize);
-            nestLevel--;
-            return SEQ_ERROR;
+            // fixed length fields are checked with their run
+            if ((totalInLength + inLength) > inSize) {
+                LogError("SequencerRun() ERROR - Attempt to read beyond input stream size");
+                dbg_printf("Attempt to read beyond input stream size: total: %u, inLength: %u, inSize: %zu\n", totalInLength, inLength, inSize);
+                nestLevel--;
+                return SEQ_ERROR;
+            }
         }
 
         // check output extension
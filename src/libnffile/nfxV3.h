@@ -697,8 +697,22 @@ typedef struct EXipInfo_s {
 } EXipInfo_t;
 #define EXipInfoSize (sizeof(EXipInfo_t) + sizeof(elementHeader_t))
 
+// payloads stored in the payload dictionary of the file - see payload.h
+// resolved into EXinPayload/EXoutPayload, when the file is read
+typedef struct EXpayloadRef_s {
+#define EXpayloadRefID 43
+    uint32_t inPayload;   // dictionary ID of the in payload, 0: none
+    uint32_t outPayload;  // dictionary ID of the out payload, 0: none
+} EXpayloadRef_t;
+#define EXpayloadRefSize (sizeof(EXpayloadRef_t) + sizeof(elementHeader_t))
+
 // max possible elements
-#define MAXEXTENSIONS 43
+#define MAXEXTENSIONS 44
+
+// bit of an extension ID in an extension mask
+#define ExtensionBit(id) (1ULL << (id))
+#define ALLEXTENSIONS 0xFFFFFFFFFFFFFFFFULL
+_Static_assert(MAXEXTENSIONS <= 64, "Extension mask needs MAXEXTENSIONS bits");
 
 // push a fixed length extension to the v3 record
 // h v3 record header
@@ -768,7 +782,8 @@ static const struct extensionTable_s {
                       EXTENSION(EXlabel),        EXTENSION(EXinPayload),      EXTENSION(EXoutPayload),   EXTENSION(EXtunIPv4),
                       EXTENSION(EXtunIPv6),      EXTENSION(EXobservation),    EXTENSION(EXinmonMeta),    EXTENSION(EXinmonFrame),
                       EXTENSION(EXvrf),          EXTENSION(EXpfinfo),         EXTENSION(EXlayer2),       EXTENSION(EXflowId),
-                      EXTENSION(EXnokiaNat),     EXTENSION(EXnokiaNatString), EXTENSION(EXipInfo)};
+                      EXTENSION(EXnokiaNat),     EXTENSION(EXnokiaNatString), EXTENSION(EXipInfo),
+                      EXTENSION(EXpayloadRef)};
 
 typedef struct record_map_s {
     recordHeaderV3_t *recordHeader;
@@ -785,12 +800,46 @@ typedef struct sequence_s {
     unsigned long offsetRel;
     uint16_t outputLength;
     uint16_t stackID;
+    uint32_t fixedRun;  // set by SetupSequencer: input length of the fixed length fields from this one
+                        // to the next var length field, if this field starts such a run, 0 otherwise
 } sequence_t;
 
+// transfer of one or more adjacent input fields of a compiled sequencer
+typedef struct sequenceOp_s {
+    uint16_t op;
+#define SEQ_OP_COPY 1
+#define SEQ_OP_NUM16 2  // NUM16/32/64 swap inLength/size numbers
+#define SEQ_OP_NUM32 3
+#define SEQ_OP_NUM64 4
+#define SEQ_OP_NUMBER 5
+    uint16_t stackID;
+    uint16_t inOffset;   // offset in input record
+    uint16_t inLength;
+    uint16_t outOffset;  // offset in output elements
+    uint16_t outLength;
+} sequenceOp_t;
+
+// decoder for templates with fixed length fields only
+typedef struct compiledSequencer_s {
+    size_t inLength;
+    size_t outLength;
+    void *outTemplate;  // pre-built output elements
+    uint32_t numExtensions;
+    uint16_t extensionID[MAXEXTENSIONS];
+    uint16_t extensionOffset[MAXEXTENSIONS];  // offset of extension data in output elements
+    uint32_t numOps;
+    sequenceOp_t op[];
+} compiledSequencer_t;
+
+#define SUBSEQUENCERS 8
 typedef struct sequencer_s {
     struct sequencer_s *next;
+    // sub template sequencers found in the next list, indexed by templateID & (SUBSEQUENCERS - 1)
+    // must be cleared, if the next list changes
+    struct sequencer_s *subSequencer[SUBSEQUENCERS];
     void *offsetCache[MAXEXTENSIONS];
     sequence_t *sequenceTable;
+    compiledSequencer_t *compiled;  // fixed length decoder, NULL if not available
     uint16_t templateID;
     uint16_t ExtSize[MAXEXTENSIONS];
     uint32_t numSequences;
@@ -809,6 +858,8 @@ void ClearSequencer(sequencer_t *sequencer);
 
 size_t CalcOutRecordSize(sequencer_t *sequencer, void *in, size_t inSize);
 
+size_t CalcOutFlowsetSize(sequencer_t *sequencer, size_t inSize, size_t addSize);
+
 int SequencerRun(sequencer_t *sequencer, const void *inBuff, size_t inSize, void *outBuff, size_t outSize, uint64_t *stack);
 
 void PrintSequencer(sequencer_t *sequencer);
@@ -0,0 +1,288 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "payload.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "id.h"
+#include "nffile.h"
+#include "nfxV3.h"
+#include "util.h"
+
+#define INITENTRIES 1024
+#define INITDATA (1024 * 1024)
+
+// payloads are stored 4 byte aligned
+#define PayloadAlign(size) (((size) + 3) & ~3U)
+
+// FNV-1a of the aligned payload - the padding bytes are 0
+static uint32_t PayloadHash(const uint8_t *payload, uint32_t size) {
+    uint32_t hash = 2166136261U;
+    for (uint32_t i = 0; i < size; i++) {
+        hash ^= payload[i];
+        hash *= 16777619U;
+    }
+    for (uint32_t i = size; i < PayloadAlign(size); i++) hash *= 16777619U;
+    return hash;
+}  // End of PayloadHash
+
+payloadDict_t *NewPayloadDict(void) {
+    payloadDict_t *payloadDict = calloc(1, sizeof(payloadDict_t));
+    if (!payloadDict) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    payloadDict->entries = malloc(INITENTRIES * sizeof(payloadEntry_t));
+    payloadDict->data = malloc(INITDATA);
+    payloadDict->hashTable = calloc(2 * INITENTRIES, sizeof(uint32_t));
+    if (!payloadDict->entries || !payloadDict->data || !payloadDict->hashTable) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        FreePayloadDict(payloadDict);
+        return NULL;
+    }
+    payloadDict->maxEntries = INITENTRIES;
+    payloadDict->maxData = INITDATA;
+    payloadDict->hashSize = 2 * INITENTRIES;
+    return payloadDict;
+
+}  // End of NewPayloadDict
+
+void FreePayloadDict(payloadDict_t *payloadDict) {
+    if (!payloadDict) return;
+    free(payloadDict->entries);
+    free(payloadDict->data);
+    free(payloadDict->hashTable);
+    free(payloadDict);
+
+}  // End of FreePayloadDict
+
+// append a payload of aligned size to the dictionary. Returns the entry index or -1 on error
+static int64_t AppendPayload(payloadDict_t *payloadDict, const void *payload, uint32_t size, uint32_t alignedSize, uint32_t hash) {
+    if (payloadDict->numEntries == payloadDict->maxEntries) {
+        payloadEntry_t *entries = realloc(payloadDict->entries, 2 * payloadDict->maxEntries * sizeof(payloadEntry_t));
+        if (!entries) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return -1;
+        }
+        payloadDict->entries = entries;
+        payloadDict->maxEntries *= 2;
+    }
+    if ((payloadDict->dataSize + alignedSize) > payloadDict->maxData) {
+        size_t maxData = 2 * payloadDict->maxData;
+        while ((payloadDict->dataSize + alignedSize) > maxData) maxData *= 2;
+        uint8_t *data = realloc(payloadDict->data, maxData);
+        if (!data) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return -1;
+        }
+        payloadDict->data = data;
+        payloadDict->maxData = maxData;
+    }
+
+    uint8_t *data = payloadDict->data + payloadDict->dataSize;
+    memcpy(data, payload, size);
+    memset(data + size, 0, alignedSize - size);
+    payloadDict->entries[payloadDict->numEntries] = (payloadEntry_t){
+        .offset = payloadDict->dataSize,
+        .size = alignedSize,
+        .hash = hash,
+    };
+    payloadDict->dataSize += alignedSize;
+    return payloadDict->numEntries++;
+
+}  // End of AppendPayload
+
+// double the hash table and insert all entries again
+static int GrowHashTable(payloadDict_t *payloadDict) {
+    uint32_t hashSize = 2 * payloadDict->hashSize;
+    uint32_t *hashTable = calloc(hashSize, sizeof(uint32_t));
+    if (!hashTable) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    for (uint32_t i = 0; i < payloadDict->numEntries; i++) {
+        uint32_t slot = payloadDict->entries[i].hash & (hashSize - 1);
+        while (hashTable[slot]) slot = (slot + 1) & (hashSize - 1);
+        hashTable[slot] = i + 1;
+    }
+    free(payloadDict->hashTable);
+    payloadDict->hashTable = hashTable;
+    payloadDict->hashSize = hashSize;
+    return 1;
+
+}  // End of GrowHashTable
+
+// add a payload to the dictionary and return its ID. Identical payloads return the same ID.
+// Returns 0, if the payload can not be stored in the dictionary and needs to be stored inline
+uint32_t PayloadDictAdd(payloadDict_t *payloadDict, const void *payload, uint32_t size) {
+    uint32_t alignedSize = PayloadAlign(size);
+    if (size == 0 || alignedSize > PAYLOADMAXSIZE) return 0;
+
+    uint32_t hash = PayloadHash(payload, size);
+    uint32_t mask = payloadDict->hashSize - 1;
+    uint32_t slot = hash & mask;
+    while (payloadDict->hashTable[slot]) {
+        payloadEntry_t *entry = &(payloadDict->entries[payloadDict->hashTable[slot] - 1]);
+        if (entry->hash == hash && entry->size == alignedSize) {
+            uint8_t *data = payloadDict->data + entry->offset;
+            int equal = memcmp(data, payload, size) == 0;
+            for (uint32_t i = size; equal && i < alignedSize; i++) equal = data[i] == 0;
+            if (equal) return payloadDict->hashTable[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    // new payload - the dictionary is full
+    if ((payloadDict->dataSize + alignedSize) > PAYLOADDICTMAX) return 0;
+
+    int64_t index = AppendPayload(payloadDict, payload, size, alignedSize, hash);
+    if (index < 0) return 0;
+    payloadDict->hashTable[slot] = index + 1;
+
+    // keep the hash table at most half full
+    if (2 * payloadDict->numEntries > payloadDict->hashSize && !GrowHashTable(payloadDict)) {
+        payloadDict->hashTable[slot] = 0;
+        payloadDict->numEntries--;
+        payloadDict->dataSize -= alignedSize;
+        return 0;
+    }
+
+    return index + 1;
+
+}  // End of PayloadDictAdd
+
+// load a TYPE_PAYLOAD appendix record into the dictionary. Records are loaded in ID order
+int PayloadDictLoad(payloadDict_t *payloadDict, const void *data, size_t dataSize) {
+    if (dataSize < sizeof(payloadRecord_t)) return 0;
+    const payloadRecord_t *payloadRecord = (const payloadRecord_t *)data;
+    if (payloadRecord->payloadID != (payloadDict->numEntries + 1) || payloadRecord->size != (dataSize - sizeof(payloadRecord_t)) ||
+        payloadRecord->size == 0 || (payloadRecord->size & 0x3) != 0 || payloadRecord->size > PAYLOADMAXSIZE)
+        return 0;
+
+    return AppendPayload(payloadDict, data + sizeof(payloadRecord_t), payloadRecord->size, payloadRecord->size, 0) >= 0;
+
+}  // End of PayloadDictLoad
+
+// returns 1, if a V3 record carries an EXpayloadRef extension
+static int HasPayloadRef(const recordHeaderV3_t *recordHeader) {
+    const void *recordEnd = (const void *)recordHeader + recordHeader->size;
+    const elementHeader_t *elementHeader = (const elementHeader_t *)((const void *)recordHeader + sizeof(recordHeaderV3_t));
+    for (int i = 0; i < recordHeader->numElements; i++) {
+        if ((const void *)elementHeader + sizeof(elementHeader_t) > recordEnd || elementHeader->length == 0) return 0;
+        if (elementHeader->type == EXpayloadRefID) return 1;
+        elementHeader = (const elementHeader_t *)((const void *)elementHeader + elementHeader->length);
+    }
+    return 0;
+
+}  // End of HasPayloadRef
+
+// resolve the payload references of the V3 records of inBlock into outBlock.
+// Returns 1, if references were resolved, 0, if inBlock has no references, -1 on error
+int ExpandPayloadBlock(const payloadDict_t *payloadDict, const dataBlock_t *inBlock, dataBlock_t *outBlock) {
+    // most blocks have no references - check first
+    const void *inPtr = GetCursor(inBlock);
+    const void *inEnd = inPtr + inBlock->size;
+    int hasRef = 0;
+    for (uint32_t i = 0; i < inBlock->NumRecords && !hasRef; i++) {
+        const recordHeaderV3_t *recordHeader = (const recordHeaderV3_t *)inPtr;
+        if ((inPtr + sizeof(record_header_t)) > inEnd || recordHeader->size == 0 || (inPtr + recordHeader->size) > inEnd) return -1;
+        if (recordHeader->type == V3Record) hasRef = HasPayloadRef(recordHeader);
+        inPtr += recordHeader->size;
+    }
+    if (!hasRef) return 0;
+
+    *outBlock = *inBlock;
+    outBlock->size = 0;
+    outBlock->flags &= ~FLAG_BLOCK_MAPPED;
+    void *outPtr = GetCursor(outBlock);
+    const void *outEnd = outPtr + (BUFFSIZE - sizeof(dataBlock_t));
+
+    inPtr = GetCursor(inBlock);
+    for (uint32_t i = 0; i < inBlock->NumRecords; i++) {
+        const recordHeaderV3_t *recordHeader = (const recordHeaderV3_t *)inPtr;
+        if ((inPtr + sizeof(record_header_t)) > inEnd || recordHeader->size == 0 || (inPtr + recordHeader->size) > inEnd) return -1;
+        if (recordHeader->type != V3Record || !HasPayloadRef(recordHeader)) {
+            if ((outPtr + recordHeader->size) > outEnd) return -1;
+            memcpy(outPtr, inPtr, recordHeader->size);
+            outPtr += recordHeader->size;
+            inPtr += recordHeader->size;
+            continue;
+        }
+
+        // copy the record and replace the reference by the payloads
+        if ((outPtr + sizeof(recordHeaderV3_t)) > outEnd) return -1;
+        recordHeaderV3_t *outRecord = (recordHeaderV3_t *)outPtr;
+        memcpy(outRecord, recordHeader, sizeof(recordHeaderV3_t));
+        outRecord->numElements = 0;
+        uint32_t recordSize = sizeof(recordHeaderV3_t);
+
+        const void *recordEnd = inPtr + recordHeader->size;
+        const elementHeader_t *elementHeader = (const elementHeader_t *)(inPtr + sizeof(recordHeaderV3_t));
+        for (int j = 0; j < recordHeader->numElements; j++) {
+            if (((const void *)elementHeader + sizeof(elementHeader_t)) > recordEnd || elementHeader->length < sizeof(elementHeader_t) ||
+                ((const void *)elementHeader + elementHeader->length) > recordEnd)
+                return -1;
+            if (elementHeader->type != EXpayloadRefID) {
+                if ((outPtr + recordSize + elementHeader->length) > outEnd) return -1;
+                memcpy(outPtr + recordSize, elementHeader, elementHeader->length);
+                recordSize += elementHeader->length;
+                outRecord->numElements++;
+            } else if (elementHeader->length == EXpayloadRefSize) {
+                const EXpayloadRef_t *payloadRef = (const EXpayloadRef_t *)((const void *)elementHeader + sizeof(elementHeader_t));
+                uint32_t payloadID[2] = {payloadRef->inPayload, payloadRef->outPayload};
+                uint16_t extensionID[2] = {EXinPayloadID, EXoutPayloadID};
+                for (int k = 0; k < 2; k++) {
+                    if (payloadID[k] == 0 || payloadID[k] > payloadDict->numEntries) continue;
+                    const payloadEntry_t *entry = &(payloadDict->entries[payloadID[k] - 1]);
+                    if ((outPtr + recordSize + sizeof(elementHeader_t) + entry->size) > outEnd) return -1;
+                    elementHeader_t *payloadHeader = (elementHeader_t *)(outPtr + recordSize);
+                    payloadHeader->type = extensionID[k];
+                    payloadHeader->length = sizeof(elementHeader_t) + entry->size;
+                    memcpy((void *)payloadHeader + sizeof(elementHeader_t), payloadDict->data + entry->offset, entry->size);
+                    recordSize += payloadHeader->length;
+                    outRecord->numElements++;
+                }
+            }
+            elementHeader = (const elementHeader_t *)((const void *)elementHeader + elementHeader->length);
+        }
+        if (recordSize > 0xFFFF) return -1;
+        outRecord->size = recordSize;
+
+        outPtr += recordSize;
+        inPtr += recordHeader->size;
+    }
+    outBlock->size = outPtr - GetCursor(outBlock);
+    return 1;
+
+}  // End of ExpandPayloadBlock
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _PAYLOAD_H
+#define _PAYLOAD_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nffileV2.h"
+
+/*
+ * Payload dictionary of a file.
+ * Identical payloads, such as TLS client hellos of the same client stacks or DNS
+ * queries, are stored only once per file in TYPE_PAYLOAD appendix records. The
+ * flow records carry an EXpayloadRef extension with the dictionary IDs instead of
+ * the EXinPayload/EXoutPayload bytes. When the file is read, the references are
+ * resolved back into the payload extensions, so readers see the records unchanged.
+ *
+ * IDs start with 1 in the order the payloads were added. Payloads are stored
+ * 4 byte aligned, as the payload extensions.
+ */
+
+// payloads of a dictionary in bytes. Further payloads are stored inline
+#define PAYLOADDICTMAX (64 * 1024 * 1024)
+// max size of a single payload in a dictionary
+#define PAYLOADMAXSIZE (0xFFFF - sizeof(recordHeader_t) - sizeof(payloadRecord_t))
+
+typedef struct payloadEntry_s {
+    uint64_t offset;  // offset of payload in data
+    uint32_t size;    // aligned size of payload
+    uint32_t hash;
+} payloadEntry_t;
+
+typedef struct payloadDict_s {
+    uint32_t numEntries;  // number of payloads
+    uint32_t maxEntries;  // number of allocated entries
+    payloadEntry_t *entries;
+    uint8_t *data;  // all payloads
+    size_t dataSize;
+    size_t maxData;
+    uint32_t *hashTable;  // entry index + 1, 0: empty slot
+    uint32_t hashSize;    // power of 2
+} payloadDict_t;
+
+payloadDict_t *NewPayloadDict(void);
+
+void FreePayloadDict(payloadDict_t *payloadDict);
+
+uint32_t PayloadDictAdd(payloadDict_t *payloadDict, const void *payload, uint32_t size);
+
+int PayloadDictLoad(payloadDict_t *payloadDict, const void *data, size_t dataSize);
+
+int ExpandPayloadBlock(const payloadDict_t *payloadDict, const dataBlock_t *inBlock, dataBlock_t *outBlock);
+
+#endif  // _PAYLOAD_H
@@ -33,6 +33,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdatomic.h>
@@ -40,11 +41,114 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
 #include "util.h"
 
+// number of sched_yield() calls on a full or empty queue, before a thread blocks
+#define QUEUE_SPIN 16
+
+// number of elements in the queue - approximate, while threads push or pop
+static inline size_t ring_used(queue_t *queue) {
+    size_t next_avail = atomic_load_explicit(&queue->next_avail, memory_order_relaxed);
+    size_t next_free = atomic_load_explicit(&queue->next_free, memory_order_relaxed);
+    return next_free > next_avail ? next_free - next_avail : 0;
+}  // End of ring_used
+
+// try to claim the next free slot. returns 1 on success, 0 if the queue is full
+static inline int ring_push(queue_t *queue, void *data) {
+    // soft capacity - concurrent producers may overshoot by a few elements
+    if (ring_used(queue) >= atomic_load_explicit(&queue->limit, memory_order_relaxed)) return 0;
+
+    size_t pos = atomic_load_explicit(&queue->next_free, memory_order_relaxed);
+    while (1) {
+        element_t *element = &queue->element[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&element->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            // slot is free - claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->next_free, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                element->data = data;
+                atomic_store_explicit(&element->sequence, pos + 1, memory_order_release);
+                return 1;
+            }
+            // another producer was faster - pos got reloaded by CAS
+        } else if (diff < 0) {
+            // slot not yet consumed - queue full
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&queue->next_free, memory_order_relaxed);
+        }
+    }
+
+    /*NOTREACHED*/
+
+}  // End of ring_push
+
+// try to get the next element. returns QUEUE_EMPTY, if the queue is empty
+static inline void *ring_pop(queue_t *queue) {
+    size_t pos = atomic_load_explicit(&queue->next_avail, memory_order_relaxed);
+    while (1) {
+        element_t *element = &queue->element[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&element->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            // slot is filled - claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->next_avail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                void *data = element->data;
+                // release slot for the next round
+                atomic_store_explicit(&element->sequence, pos + queue->mask + 1, memory_order_release);
+                return data;
+            }
+            // another consumer was faster - pos got reloaded by CAS
+        } else if (diff < 0) {
+            // slot not yet filled - queue empty
+            return QUEUE_EMPTY;
+        } else {
+            pos = atomic_load_explicit(&queue->next_avail, memory_order_relaxed);
+        }
+    }
+
+    /*NOTREACHED*/
+
+}  // End of ring_pop
+
+static inline int ring_full(queue_t *queue) {
+    if (ring_used(queue) >= atomic_load(&queue->limit)) return 1;
+    size_t pos = atomic_load(&queue->next_free);
+    size_t sequence = atomic_load(&queue->element[pos & queue->mask].sequence);
+    return ((intptr_t)sequence - (intptr_t)pos) < 0;
+}  // End of ring_full
+
+static inline int ring_empty(queue_t *queue) {
+    size_t pos = atomic_load(&queue->next_avail);
+    size_t sequence = atomic_load(&queue->element[pos & queue->mask].sequence);
+    return ((intptr_t)sequence - (intptr_t)(pos + 1)) < 0;
+}  // End of ring_empty
+
+static inline uint64_t queue_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}  // End of queue_nsec
+
+// wake up all threads blocked in queue_push or queue_pop
+static inline void queue_wakeup(queue_t *queue) {
+    pthread_mutex_lock(&(queue->mutex));
+    pthread_cond_broadcast(&(queue->cond));
+    pthread_cond_broadcast(&(queue->pcond));
+    pthread_mutex_unlock(&(queue->mutex));
+}  // End of queue_wakeup
+
+// wake up one thread blocked on cond
+static inline void queue_signal(queue_t *queue, pthread_cond_t *cond) {
+    pthread_mutex_lock(&(queue->mutex));
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(&(queue->mutex));
+}  // End of queue_signal
+
 queue_t *queue_init(size_t length) {
     queue_t *queue;
 
@@ -62,16 +166,26 @@ queue_t *queue_init(size_t length) {
         LogError("pthread_mutex_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return NULL;
     }
-    if (pthread_cond_init(&queue->cond, NULL) != 0) {
+    if (pthread_cond_init(&queue->cond, NULL) != 0 || pthread_cond_init(&queue->pcond, NULL) != 0) {
         LogError("pthread_cond_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return NULL;
     }
 
-    queue->producers = 1;
+    atomic_init(&queue->producers, 1);
+    atomic_init(&queue->closed, 0);
     queue->length = length;
     queue->mask = length - 1;
+    atomic_init(&queue->limit, length);
     atomic_init(&queue->c_wait, 0);
     atomic_init(&queue->p_wait, 0);
+    memset((void *)&queue->wait, 0, sizeof(queueWait_t));
+    memset((void *)&queue->adapted, 0, sizeof(queueWait_t));
+    atomic_init(&queue->next_free, 0);
+    atomic_init(&queue->next_avail, 0);
+    atomic_init(&queue->maxUsed, 0);
+    for (size_t i = 0; i < length; i++) {
+        atomic_init(&queue->element[i].sequence, i);
+    }
 
     return queue;
 
@@ -79,7 +193,7 @@ queue_t *queue_init(size_t length) {
 
 void queue_producers(queue_t *queue, unsigned producers) {
     //
-    queue->producers = producers;
+    atomic_store(&queue->producers, producers);
 }  // End of queue_producers
 
 void queue_free(queue_t *queue) {
@@ -89,47 +203,78 @@ void queue_free(queue_t *queue) {
 }  // End of Queue_free
 
 void queue_open(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
-    queue->closed = 0;
-    pthread_mutex_unlock(&(queue->mutex));
+    atomic_store(&queue->closed, 0);
 
 }  // End of queue_open
 
 void queue_close(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
-    queue->producers--;
-    if (queue->producers <= 0) queue->closed = 1;
-    if (queue->c_wait) {
-        pthread_cond_broadcast(&(queue->cond));
-    }
-    pthread_mutex_unlock(&(queue->mutex));
+    if (atomic_fetch_sub(&queue->producers, 1) <= 1) atomic_store(&queue->closed, 1);
+    queue_wakeup(queue);
 
 }  // End of queue_close
 
 size_t queue_length(queue_t *queue) {
+    //
+    return ring_used(queue);
+
+}  // End of queue_length
+
+// set the soft capacity of the queue to limit elements, 1 <= limit <= length.
+// The ring is allocated with length elements, so the limit may grow and shrink
+// at run time. Returns the new limit
+size_t queue_limit(queue_t *queue, size_t limit) {
+    if (limit < 1) limit = 1;
+    if (limit > queue->length) limit = queue->length;
+    size_t old = atomic_exchange(&queue->limit, limit);
+    // release producers blocked on the old limit
+    if (limit > old && atomic_load(&queue->p_wait)) queue_wakeup(queue);
+    return limit;
+}  // End of queue_limit
+
+/*
+ * adapt the soft capacity of the queue to the blocking since the last call.
+ * Blocked producers and idle consumers within the same interval indicate bursts,
+ * which a deeper queue smoothes - double the limit up to maxLimit. Blocked
+ * producers only mean a slow consumer: queued elements just hold memory without
+ * adding throughput - halve the limit down to minLimit. Returns the new limit
+ */
+size_t queue_adapt(queue_t *queue, size_t minLimit, size_t maxLimit) {
     pthread_mutex_lock(&(queue->mutex));
-    size_t length = queue->num_elements;
+    uint64_t producerBlocked = queue->wait.producerBlocked - queue->adapted.producerBlocked;
+    uint64_t consumerBlocked = queue->wait.consumerBlocked - queue->adapted.consumerBlocked;
+    queue->adapted = queue->wait;
     pthread_mutex_unlock(&(queue->mutex));
 
-    return length;
+    size_t limit = atomic_load(&queue->limit);
+    if (producerBlocked && consumerBlocked) {
+        limit <<= 1;
+    } else if (producerBlocked) {
+        limit >>= 1;
+    }
+    if (limit < minLimit) limit = minLimit;
+    if (limit > maxLimit) limit = maxLimit;
 
-}  // End of queue_length
+    return queue_limit(queue, limit);
+}  // End of queue_adapt
 
 queueStat_t queue_stat(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
-    queueStat_t stat = queue->stat;
-    stat.length = queue->num_elements;
-    queue->stat.maxUsed = 0;
-    pthread_mutex_unlock(&(queue->mutex));
+    queueStat_t stat = {
+        .maxUsed = atomic_exchange(&queue->maxUsed, 0),
+        .length = ring_used(queue),
+    };
     return stat;
 }  // End of queue_stat
 
-uint32_t queue_done(queue_t *queue) {
+queueWait_t queue_wait(queue_t *queue) {
     pthread_mutex_lock(&(queue->mutex));
-    uint32_t done = queue->num_elements == 0 && queue->closed;
+    queueWait_t wait = queue->wait;
     pthread_mutex_unlock(&(queue->mutex));
+    return wait;
+}  // End of queue_wait
 
-    return done;
+uint32_t queue_done(queue_t *queue) {
+    //
+    return atomic_load(&queue->closed) && ring_empty(queue);
 
 }  // End of queue_length
 
@@ -150,39 +295,49 @@ void queue_sync(queue_t *queue) {
     while (atomic_load(&queue->c_wait) || atomic_load(&queue->p_wait)) {
         struct timeval tv = {0};
         tv.tv_usec = 1;
-        pthread_mutex_lock(&(queue->mutex));
-        pthread_cond_broadcast(&(queue->cond));
-        pthread_mutex_unlock(&(queue->mutex));
+        queue_wakeup(queue);
         select(0, NULL, NULL, NULL, &tv);
     }
 
 }  // end of queue_sync
 
 void *queue_push(queue_t *queue, void *data) {
-    pthread_mutex_lock(&(queue->mutex));
+    unsigned spin = 0;
     while (1) {
-        if (queue->closed) {
-            pthread_mutex_unlock(&(queue->mutex));
+        if (atomic_load(&queue->closed)) {
             return QUEUE_CLOSED;
         }
-        if (queue->num_elements < queue->length) {
-            unsigned index = queue->next_free;
-            queue->element[index] = data;
-            queue->num_elements++;
-            queue->next_free = (queue->next_free + 1) & queue->mask;
 
-            if (queue->stat.maxUsed < queue->num_elements) queue->stat.maxUsed = queue->num_elements;
+        if (ring_push(queue, data)) {
+            size_t used = ring_used(queue);
+            size_t maxUsed = atomic_load_explicit(&queue->maxUsed, memory_order_relaxed);
+            while (maxUsed < used &&
+                   !atomic_compare_exchange_weak_explicit(&queue->maxUsed, &maxUsed, used, memory_order_relaxed, memory_order_relaxed))
+                ;
 
-            if (atomic_load(&queue->c_wait)) {
-                pthread_cond_signal(&(queue->cond));
-            }
-            pthread_mutex_unlock(&(queue->mutex));
+            // publish element before checking for waiting consumers
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_load(&queue->c_wait)) queue_signal(queue, &(queue->cond));
             return NULL;
-        } else {
-            queue->p_wait++;
-            pthread_cond_wait(&(queue->cond), &(queue->mutex));
-            queue->p_wait--;
         }
+
+        // queue full - yield a few times, before blocking on the condition
+        if (spin++ < QUEUE_SPIN) {
+            sched_yield();
+            continue;
+        }
+
+        // block until a consumer releases a slot
+        pthread_mutex_lock(&(queue->mutex));
+        atomic_fetch_add(&queue->p_wait, 1);
+        if (!atomic_load(&queue->closed) && ring_full(queue)) {
+            uint64_t t0 = queue_nsec();
+            pthread_cond_wait(&(queue->pcond), &(queue->mutex));
+            queue->wait.producerBlocked++;
+            queue->wait.producerNsec += queue_nsec() - t0;
+        }
+        atomic_fetch_sub(&queue->p_wait, 1);
+        pthread_mutex_unlock(&(queue->mutex));
     }
 
     /*NOTREACHED*/
@@ -190,32 +345,38 @@ void *queue_push(queue_t *queue, void *data) {
 }  // End of queue_push
 
 void *queue_pop(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
+    unsigned spin = 0;
     while (1) {
-        if (queue->closed && queue->num_elements == 0) {
-            pthread_mutex_unlock(&(queue->mutex));
+        void *data = ring_pop(queue);
+        if (data != QUEUE_EMPTY) {
+            // release slot before checking for waiting producers
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_load(&queue->p_wait)) queue_signal(queue, &(queue->pcond));
+            return data;
+        }
+
+        // all producers closed the queue and all elements are consumed
+        if (atomic_load(&queue->closed) && ring_empty(queue)) {
             return QUEUE_CLOSED;
         }
 
-        if (queue->num_elements > 0) {
-            unsigned index = queue->next_avail;
-            void *data = queue->element[index];
-            queue->num_elements--;
-            queue->next_avail = (queue->next_avail + 1) & queue->mask;
+        // queue empty - yield a few times, before blocking on the condition
+        if (spin++ < QUEUE_SPIN) {
+            sched_yield();
+            continue;
+        }
 
-            if (queue->p_wait) {
-                pthread_cond_broadcast(&(queue->cond));
-            }
-            if (queue->closed && queue->c_wait) {
-                pthread_cond_broadcast(&(queue->cond));
-            }
-            pthread_mutex_unlock(&(queue->mutex));
-            return data;
-        } else {
-            atomic_fetch_add(&queue->c_wait, 1);
+        // block until a producer pushes an element
+        pthread_mutex_lock(&(queue->mutex));
+        atomic_fetch_add(&queue->c_wait, 1);
+        if (!atomic_load(&queue->closed) && ring_empty(queue)) {
+            uint64_t t0 = queue_nsec();
             pthread_cond_wait(&(queue->cond), &(queue->mutex));
-            atomic_fetch_sub(&queue->c_wait, 1);
+            queue->wait.consumerBlocked++;
+            queue->wait.consumerNsec += queue_nsec() - t0;
         }
+        atomic_fetch_sub(&queue->c_wait, 1);
+        pthread_mutex_unlock(&(queue->mutex));
     }
 
     /*NOTREACHED*/
@@ -40,6 +40,7 @@
 #define QUEUE_CLOSED (void *)-3
 
 typedef struct element_s {
+    _Atomic size_t sequence;
     void *data;
 } element_t;
 
@@ -48,22 +49,46 @@ typedef struct queueStat_s {
     size_t length;
 } queueStat_t;
 
+// time threads were blocked on a full or empty queue
+typedef struct queueWait_s {
+    uint64_t producerBlocked;  // number of blocking pushes
+    uint64_t producerNsec;
+    uint64_t consumerBlocked;  // number of blocking pops
+    uint64_t consumerNsec;
+} queueWait_t;
+
+/*
+ * bounded lock-free MPMC ring buffer. Producers and consumers claim slots by CAS on
+ * the head/tail counters. The mutex and condition variable are only used, if a
+ * thread needs to block on a full or empty queue.
+ */
 typedef struct queue_s {
+    // blocking slow path
     pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    uint32_t closed;
-
-    size_t length;
-    size_t mask;
-    unsigned next_free;
-    unsigned next_avail;
-    int producers;
+    pthread_cond_t cond;   // consumers wait for elements
+    pthread_cond_t pcond;  // producers wait for free slots
     _Atomic unsigned c_wait;
     _Atomic unsigned p_wait;
-    size_t num_elements;
+    queueWait_t wait;  // protected by mutex
 
-    queueStat_t stat;
-    void *element[1];
+    _Atomic uint32_t closed;
+    _Atomic int producers;
+
+    size_t length;
+    size_t mask;
+    _Atomic size_t limit;  // soft capacity <= length, see queue_limit()
+    queueWait_t adapted;   // wait counters at the last queue_adapt(), protected by mutex
+
+    // keep producer and consumer counters on different cache lines
+    char pad0[64];
+    _Atomic size_t next_free;
+    char pad1[64];
+    _Atomic size_t next_avail;
+    char pad2[64];
+    _Atomic size_t maxUsed;
+    char pad3[64];
+
+    element_t element[];
 } queue_t;
 
 queue_t *queue_init(size_t length);
@@ -84,8 +109,14 @@ void queue_sync(queue_t *queue);
 
 queueStat_t queue_stat(queue_t *queue);
 
+queueWait_t queue_wait(queue_t *queue);
+
 size_t queue_length(queue_t *queue);
 
+size_t queue_limit(queue_t *queue, size_t limit);
+
+size_t queue_adapt(queue_t *queue, size_t minLimit, size_t maxLimit);
+
 uint32_t queue_done(queue_t *queue);
 
 #endif  // _QUEUE_H
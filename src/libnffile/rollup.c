@@ -0,0 +1,342 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "rollup.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "nfcolumn.h"
+#include "nffile.h"
+#include "nfxV3.h"
+#include "util.h"
+
+// initial hash table size
+#define ROLLUPINITBITS 16
+
+static const struct rollupField_s {
+    char *name;
+    uint32_t field;
+} rollupFields[] = {{"proto", ROLLUP_PROTO},     {"srcip", ROLLUP_SRCIP}, {"dstip", ROLLUP_DSTIP}, {"srcport", ROLLUP_SRCPORT},
+                    {"dstport", ROLLUP_DSTPORT}, {"srcas", ROLLUP_SRCAS}, {"dstas", ROLLUP_DSTAS}, {NULL, 0}};
+
+static uint32_t ParseFields(char *aggregation);
+
+static int GrowTable(rollup_t *rollup);
+
+static void RollupRecord(rollup_t *rollup, recordHeaderV3_t *recordHeaderV3);
+
+static uint32_t ParseFields(char *aggregation) {
+    char *list = strdup(aggregation);
+    if (!list) {
+        LogError("strdup() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    uint32_t fields = 0;
+    char *saveptr = NULL;
+    for (char *s = strtok_r(list, ",", &saveptr); s != NULL; s = strtok_r(NULL, ",", &saveptr)) {
+        int i = 0;
+        while (rollupFields[i].name && strcmp(s, rollupFields[i].name) != 0) i++;
+        if (rollupFields[i].name == NULL) {
+            LogError("Unknown rollup element '%s'. Known elements: proto, srcip, dstip, srcport, dstport, srcas, dstas", s);
+            fields = 0;
+            break;
+        }
+        fields |= rollupFields[i].field;
+    }
+    free(list);
+
+    return fields;
+
+}  // End of ParseFields
+
+// returns true, if aggregation is a valid rollup aggregation
+int RollupCheck(char *aggregation) { return ParseFields(aggregation) != 0; }  // End of RollupCheck
+
+rollup_t *RollupNew(char *aggregation) {
+    uint32_t fields = ParseFields(aggregation);
+    if (!fields) return NULL;
+
+    rollup_t *rollup = calloc(1, sizeof(rollup_t));
+    if (!rollup) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    rollup->aggregation = strdup(aggregation);
+    rollup->fields = fields;
+    rollup->mask = (1 << ROLLUPINITBITS) - 1;
+    rollup->table = calloc(rollup->mask + 1, sizeof(uint32_t));
+    rollup->records = malloc(((rollup->mask + 1) / 2) * sizeof(rollupRecord_t));
+    if (!rollup->aggregation || !rollup->table || !rollup->records) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        RollupFree(rollup);
+        return NULL;
+    }
+    pthread_mutex_init(&rollup->lock, NULL);
+
+    return rollup;
+
+}  // End of RollupNew
+
+void RollupFree(rollup_t *rollup) {
+    if (!rollup) return;
+    pthread_mutex_destroy(&rollup->lock);
+    free(rollup->aggregation);
+    free(rollup->table);
+    free(rollup->records);
+    free(rollup);
+
+}  // End of RollupFree
+
+static inline uint32_t HashRollupKey(const rollupKey_t *key) {
+    const uint64_t *k = (const uint64_t *)key;
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < (int)(sizeof(rollupKey_t) / sizeof(uint64_t)); i++) {
+        h ^= k[i];
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+    }
+    return (uint32_t)h;
+}  // End of HashRollupKey
+
+// double the hash table, the table is kept at max 50% load
+static int GrowTable(rollup_t *rollup) {
+    uint32_t size = 2 * (rollup->mask + 1);
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    rollupRecord_t *records = realloc(rollup->records, (size / 2) * sizeof(rollupRecord_t));
+    if (!table || !records) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(table);
+        if (records) rollup->records = records;
+        return 0;
+    }
+    rollup->records = records;
+    rollup->mask = size - 1;
+    for (uint32_t i = 0; i < rollup->count; i++) {
+        uint32_t slot = HashRollupKey(&records[i].key) & rollup->mask;
+        while (table[slot]) slot = (slot + 1) & rollup->mask;
+        table[slot] = i + 1;
+    }
+    free(rollup->table);
+    rollup->table = table;
+
+    return 1;
+
+}  // End of GrowTable
+
+static void RollupRecord(rollup_t *rollup, recordHeaderV3_t *recordHeaderV3) {
+    EXgenericFlow_t *genericFlow = NULL;
+    EXipv4Flow_t *ipv4Flow = NULL;
+    EXipv6Flow_t *ipv6Flow = NULL;
+    EXasRouting_t *asRouting = NULL;
+    EXcntFlow_t *cntFlow = NULL;
+
+    void *recordEnd = (void *)recordHeaderV3 + recordHeaderV3->size;
+    elementHeader_t *elementHeader = (elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+    for (int i = 0; i < recordHeaderV3->numElements; i++) {
+        if (((void *)elementHeader + sizeof(elementHeader_t)) > recordEnd || elementHeader->length == 0) break;
+        void *element = (void *)elementHeader + sizeof(elementHeader_t);
+        if ((void *)elementHeader + elementHeader->length > recordEnd) break;
+        switch (elementHeader->type) {
+            case EXgenericFlowID:
+                genericFlow = (EXgenericFlow_t *)element;
+                break;
+            case EXipv4FlowID:
+                ipv4Flow = (EXipv4Flow_t *)element;
+                break;
+            case EXipv6FlowID:
+                ipv6Flow = (EXipv6Flow_t *)element;
+                break;
+            case EXasRoutingID:
+                asRouting = (EXasRouting_t *)element;
+                break;
+            case EXcntFlowID:
+                cntFlow = (EXcntFlow_t *)element;
+                break;
+        }
+        elementHeader = (elementHeader_t *)((void *)elementHeader + elementHeader->length);
+    }
+    if (!genericFlow) return;
+
+    rollupKey_t key = {0};
+    uint32_t fields = rollup->fields;
+    if (fields & ROLLUP_PROTO) key.proto = genericFlow->proto;
+    if (fields & ROLLUP_SRCPORT) key.srcPort = genericFlow->srcPort;
+    if (fields & ROLLUP_DSTPORT) key.dstPort = genericFlow->dstPort;
+    if (asRouting) {
+        if (fields & ROLLUP_SRCAS) key.srcAS = asRouting->srcAS;
+        if (fields & ROLLUP_DSTAS) key.dstAS = asRouting->dstAS;
+    }
+    if (fields & (ROLLUP_SRCIP | ROLLUP_DSTIP)) {
+        if (ipv4Flow) {
+            key.family = AF_INET;
+            if (fields & ROLLUP_SRCIP) key.srcAddr[1] = ipv4Flow->srcAddr;
+            if (fields & ROLLUP_DSTIP) key.dstAddr[1] = ipv4Flow->dstAddr;
+        } else if (ipv6Flow) {
+            key.family = AF_INET6;
+            if (fields & ROLLUP_SRCIP) memcpy(key.srcAddr, ipv6Flow->srcAddr, sizeof(key.srcAddr));
+            if (fields & ROLLUP_DSTIP) memcpy(key.dstAddr, ipv6Flow->dstAddr, sizeof(key.dstAddr));
+        }
+    }
+
+    uint32_t slot = HashRollupKey(&key) & rollup->mask;
+    while (rollup->table[slot] && memcmp(&rollup->records[rollup->table[slot] - 1].key, &key, sizeof(rollupKey_t)) != 0)
+        slot = (slot + 1) & rollup->mask;
+
+    rollupRecord_t *record;
+    if (rollup->table[slot]) {
+        record = &rollup->records[rollup->table[slot] - 1];
+        if (genericFlow->msecFirst < record->msecFirst) record->msecFirst = genericFlow->msecFirst;
+        if (genericFlow->msecLast > record->msecLast) record->msecLast = genericFlow->msecLast;
+    } else {
+        if (rollup->count == MAXROLLUP) {
+            rollup->overflow = 1;
+            return;
+        }
+        record = &rollup->records[rollup->count];
+        memset(record, 0, sizeof(rollupRecord_t));
+        record->key = key;
+        record->msecFirst = genericFlow->msecFirst;
+        record->msecLast = genericFlow->msecLast;
+        rollup->table[slot] = ++rollup->count;
+        if (2 * rollup->count > rollup->mask && !GrowTable(rollup)) rollup->overflow = 1;
+        // GrowTable moved the records
+        record = &rollup->records[rollup->count - 1];
+    }
+    record->packets += genericFlow->inPackets;
+    record->bytes += genericFlow->inBytes;
+    if (cntFlow) {
+        record->flows += cntFlow->flows ? cntFlow->flows : 1;
+        record->outPackets += cntFlow->outPackets;
+        record->outBytes += cntFlow->outBytes;
+    } else {
+        record->flows++;
+    }
+
+}  // End of RollupRecord
+
+// aggregate the flow records of a block
+void RollupBlock(rollup_t *rollup, dataBlock_t *dataBlock) {
+    dataBlock_t *v3Block = NULL;
+    if (dataBlock->type == DATA_BLOCK_TYPE_5) {
+        v3Block = NewDataBlock();
+        if (!ExpandColumnarBlock(dataBlock, v3Block, ALLEXTENSIONS)) {
+            FreeDataBlock(v3Block);
+            pthread_mutex_lock(&rollup->lock);
+            rollup->overflow = 1;
+            pthread_mutex_unlock(&rollup->lock);
+            return;
+        }
+        dataBlock = v3Block;
+    }
+    if (dataBlock->type != DATA_BLOCK_TYPE_3) return;
+
+    pthread_mutex_lock(&rollup->lock);
+    record_header_t *record_ptr = GetCursor(dataBlock);
+    uint32_t sumSize = 0;
+    for (int i = 0; i < dataBlock->NumRecords && !rollup->overflow; i++) {
+        if (record_ptr->size < sizeof(record_header_t) || (sumSize + record_ptr->size) > dataBlock->size) break;
+        sumSize += record_ptr->size;
+        if (record_ptr->type == V3Record) RollupRecord(rollup, (recordHeaderV3_t *)record_ptr);
+        record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+    }
+    pthread_mutex_unlock(&rollup->lock);
+
+    if (v3Block) FreeDataBlock(v3Block);
+
+}  // End of RollupBlock
+
+// write the aggregated flows as partial aggregate file
+int RollupWrite(rollup_t *rollup, char *filename, char *ident, int compress, stat_record_t *stat_record) {
+    if (rollup->overflow) {
+        LogError("Rollup incomplete - more than %u aggregated flows. Skip rollup file %s", MAXROLLUP, filename);
+        return 0;
+    }
+
+    nffile_t *nffile = OpenNewFile(filename, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
+    if (!nffile) return 0;
+    if (ident) SetIdent(nffile, ident);
+    SetAggregation(nffile, rollup->aggregation);
+    if (stat_record) *nffile->stat_record = *stat_record;
+
+    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
+    uint32_t fields = rollup->fields;
+    for (uint32_t i = 0; i < rollup->count; i++) {
+        rollupRecord_t *record = &rollup->records[i];
+        size_t required = sizeof(recordHeaderV3_t) + EXgenericFlowSize + EXipv6FlowSize + EXasRoutingSize + EXcntFlowSize;
+        if (!IsAvailable(dataBlock, required)) dataBlock = WriteBlock(nffile, dataBlock);
+
+        void *p = GetCurrentCursor(dataBlock);
+        AddV3Header(p, recordHeader);
+        PushExtension(recordHeader, EXgenericFlow, genericFlow);
+        genericFlow->msecFirst = record->msecFirst;
+        genericFlow->msecLast = record->msecLast;
+        genericFlow->proto = record->key.proto;
+        genericFlow->srcPort = record->key.srcPort;
+        genericFlow->dstPort = record->key.dstPort;
+        genericFlow->inPackets = record->packets;
+        genericFlow->inBytes = record->bytes;
+        if (record->key.family == AF_INET) {
+            PushExtension(recordHeader, EXipv4Flow, ipv4Flow);
+            ipv4Flow->srcAddr = record->key.srcAddr[1];
+            ipv4Flow->dstAddr = record->key.dstAddr[1];
+        } else if (record->key.family == AF_INET6) {
+            PushExtension(recordHeader, EXipv6Flow, ipv6Flow);
+            memcpy(ipv6Flow->srcAddr, record->key.srcAddr, sizeof(ipv6Flow->srcAddr));
+            memcpy(ipv6Flow->dstAddr, record->key.dstAddr, sizeof(ipv6Flow->dstAddr));
+        }
+        if (fields & (ROLLUP_SRCAS | ROLLUP_DSTAS)) {
+            PushExtension(recordHeader, EXasRouting, asRouting);
+            asRouting->srcAS = record->key.srcAS;
+            asRouting->dstAS = record->key.dstAS;
+        }
+        PushExtension(recordHeader, EXcntFlow, cntFlow);
+        cntFlow->flows = record->flows;
+        cntFlow->outPackets = record->outPackets;
+        cntFlow->outBytes = record->outBytes;
+
+        dataBlock->NumRecords++;
+        dataBlock->size += recordHeader->size;
+    }
+    FlushBlock(nffile, dataBlock);
+
+    int ok = CloseUpdateFile(nffile);
+    DisposeFile(nffile);
+    if (!ok) unlink(filename);
+
+    return ok;
+
+}  // End of RollupWrite
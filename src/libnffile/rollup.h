@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _ROLLUP_H
+#define _ROLLUP_H 1
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "nfdump.h"
+#include "nffileV2.h"
+
+/*
+ * Rollup - in memory aggregation of the flows written to a file.
+ * The flows of each block are aggregated by the writers, before the block gets
+ * compressed. At rotation the aggregated flows are written into a rollup file,
+ * which is a partial aggregate file with the aggregation of the rollup. nfdump
+ * merges rollup files exactly with the same or a coarser aggregation.
+ */
+
+// default rollup aggregation
+#define ROLLUPDEFAULT "proto,srcip,dstip,dstport,srcas,dstas"
+
+// max number of aggregated flows of a rollup
+#define MAXROLLUP (1 << 24)
+
+typedef struct rollupKey_s {
+    uint64_t srcAddr[2];
+    uint64_t dstAddr[2];
+    uint32_t srcAS;
+    uint32_t dstAS;
+    uint16_t srcPort;
+    uint16_t dstPort;
+    uint8_t proto;
+    uint8_t family;
+    uint8_t fill[2];
+} rollupKey_t;
+
+typedef struct rollupRecord_s {
+    rollupKey_t key;
+    uint64_t msecFirst;
+    uint64_t msecLast;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t flows;
+    uint64_t outPackets;
+    uint64_t outBytes;
+} rollupRecord_t;
+
+typedef struct rollup_s {
+    pthread_mutex_t lock;
+    char *aggregation;  // aggregation string of the rollup file
+    uint32_t fields;    // aggregated fields
+#define ROLLUP_PROTO 0x01
+#define ROLLUP_SRCIP 0x02
+#define ROLLUP_DSTIP 0x04
+#define ROLLUP_SRCPORT 0x08
+#define ROLLUP_DSTPORT 0x10
+#define ROLLUP_SRCAS 0x20
+#define ROLLUP_DSTAS 0x40
+    uint32_t overflow;  // more than MAXROLLUP flows - rollup is incomplete
+    uint32_t mask;      // hash table size - 1
+    uint32_t count;     // number of records
+    uint32_t *table;    // record index + 1, 0 = free slot
+    rollupRecord_t *records;
+} rollup_t;
+
+int RollupCheck(char *aggregation);
+
+rollup_t *RollupNew(char *aggregation);
+
+void RollupFree(rollup_t *rollup);
+
+void RollupBlock(rollup_t *rollup, dataBlock_t *dataBlock);
+
+int RollupWrite(rollup_t *rollup, char *filename, char *ident, int compress, stat_record_t *stat_record);
+
+#endif  // _ROLLUP_H
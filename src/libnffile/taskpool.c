@@ -0,0 +1,271 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "taskpool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "util.h"
+
+#define MAXTASKWORKERS 64
+#define DEQUESIZE 256
+
+typedef struct task_s {
+    taskFunc_t func;
+    void *arg;
+    taskGroup_t *group;
+} task_t;
+
+// top and bottom run freely, the number of tasks is bottom - top
+typedef struct taskDeque_s {
+    pthread_mutex_t mutex;
+    task_t *task;
+    uint32_t size;  // power of 2
+    uint32_t top;
+    uint32_t bottom;
+} taskDeque_t;
+
+static struct {
+    uint32_t numWorkers;
+    // numWorkers worker deques + inject deque for external threads
+    taskDeque_t *deque;
+    _Atomic uint32_t numQueued;
+    _Atomic uint32_t numIdle;
+    pthread_mutex_t idleMutex;
+    pthread_cond_t idleCond;
+} pool = {.idleMutex = PTHREAD_MUTEX_INITIALIZER, .idleCond = PTHREAD_COND_INITIALIZER};
+
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static uint32_t requestedWorkers = 0;
+
+// deque index of a pool worker, -1 for all other threads
+static _Thread_local int workerID = -1;
+static _Thread_local uint32_t stealSeed = 0;
+
+static int PushTask(taskDeque_t *deque, task_t *task) {
+    pthread_mutex_lock(&deque->mutex);
+    if ((deque->bottom - deque->top) == deque->size) {
+        // grow deque and keep tasks in order
+        uint32_t size = deque->size << 1;
+        task_t *tasks = malloc(size * sizeof(task_t));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->mutex);
+            return 0;
+        }
+        for (uint32_t i = deque->top; i != deque->bottom; i++) tasks[i & (size - 1)] = deque->task[i & (deque->size - 1)];
+        free(deque->task);
+        deque->task = tasks;
+        deque->size = size;
+    }
+    deque->task[deque->bottom & (deque->size - 1)] = *task;
+    deque->bottom++;
+    atomic_fetch_add(&pool.numQueued, 1);
+    pthread_mutex_unlock(&deque->mutex);
+    return 1;
+
+}  // End of PushTask
+
+// owner end - newest task first
+static int PopTask(taskDeque_t *deque, task_t *task) {
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->bottom == deque->top) {
+        pthread_mutex_unlock(&deque->mutex);
+        return 0;
+    }
+    deque->bottom--;
+    *task = deque->task[deque->bottom & (deque->size - 1)];
+    atomic_fetch_sub(&pool.numQueued, 1);
+    pthread_mutex_unlock(&deque->mutex);
+    return 1;
+
+}  // End of PopTask
+
+// thief end - oldest, usually largest task first
+static int StealTask(taskDeque_t *deque, task_t *task) {
+    if (pthread_mutex_trylock(&deque->mutex) != 0) return 0;
+    if (deque->bottom == deque->top) {
+        pthread_mutex_unlock(&deque->mutex);
+        return 0;
+    }
+    *task = deque->task[deque->top & (deque->size - 1)];
+    deque->top++;
+    atomic_fetch_sub(&pool.numQueued, 1);
+    pthread_mutex_unlock(&deque->mutex);
+    return 1;
+
+}  // End of StealTask
+
+static int FindTask(task_t *task) {
+    if (workerID >= 0 && PopTask(&pool.deque[workerID], task)) return 1;
+    if (atomic_load(&pool.numQueued) == 0) return 0;
+
+    // inject deque first, then the other workers, starting at a random victim
+    if (StealTask(&pool.deque[pool.numWorkers], task)) return 1;
+    stealSeed = stealSeed * 1103515245 + 12345;
+    uint32_t victim = (stealSeed >> 16) % pool.numWorkers;
+    for (uint32_t i = 0; i < pool.numWorkers; i++) {
+        if ((int)victim != workerID && StealTask(&pool.deque[victim], task)) return 1;
+        if (++victim == pool.numWorkers) victim = 0;
+    }
+    return 0;
+
+}  // End of FindTask
+
+static void RunTask(task_t *task) {
+    task->func(task->arg);
+    atomic_fetch_sub(&task->group->pending, 1);
+}  // End of RunTask
+
+static void *TaskWorker(void *arg) {
+    workerID = (int)(uintptr_t)arg;
+    stealSeed = workerID + 1;
+
+    while (1) {
+        task_t task;
+        if (FindTask(&task)) {
+            RunTask(&task);
+            continue;
+        }
+
+        // numIdle is raised before numQueued is checked, and TaskSubmit() raises
+        // numQueued before numIdle is checked, so no wakeup gets lost
+        pthread_mutex_lock(&pool.idleMutex);
+        atomic_fetch_add(&pool.numIdle, 1);
+        while (atomic_load(&pool.numQueued) == 0) pthread_cond_wait(&pool.idleCond, &pool.idleMutex);
+        atomic_fetch_sub(&pool.numIdle, 1);
+        pthread_mutex_unlock(&pool.idleMutex);
+    }
+
+    return NULL;
+
+}  // End of TaskWorker
+
+static void StartPool(void) {
+    uint32_t numWorkers = requestedWorkers;
+    if (numWorkers == 0) {
+        long CoresOnline = sysconf(_SC_NPROCESSORS_ONLN);
+        numWorkers = CoresOnline > 0 ? CoresOnline : 1;
+    }
+    if (numWorkers > MAXTASKWORKERS) numWorkers = MAXTASKWORKERS;
+
+    pool.deque = calloc(numWorkers + 1, sizeof(taskDeque_t));
+    if (!pool.deque) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+    for (uint32_t i = 0; i <= numWorkers; i++) {
+        pthread_mutex_init(&pool.deque[i].mutex, NULL);
+        pool.deque[i].size = DEQUESIZE;
+        pool.deque[i].task = malloc(DEQUESIZE * sizeof(task_t));
+        if (!pool.deque[i].task) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return;
+        }
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // the deques of all workers must exist before the first one steals
+    pool.numWorkers = numWorkers;
+    uint32_t started = 0;
+    for (; started < numWorkers; started++) {
+        pthread_t tid;
+        int err = pthread_create(&tid, &attr, TaskWorker, (void *)(uintptr_t)started);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    // the deques of workers, which did not start, are only stolen from - and stay empty
+    if (started == 0) pool.numWorkers = 0;
+    dbg_printf("Task pool started %u workers\n", started);
+
+}  // End of StartPool
+
+int TaskPoolInit(uint32_t numWorkers) {
+    requestedWorkers = numWorkers;
+    pthread_once(&poolOnce, StartPool);
+    return pool.numWorkers > 0;
+
+}  // End of TaskPoolInit
+
+uint32_t TaskPoolWorkers(void) {
+    pthread_once(&poolOnce, StartPool);
+    return pool.numWorkers;
+
+}  // End of TaskPoolWorkers
+
+void TaskSubmit(taskGroup_t *group, taskFunc_t func, void *arg) {
+    pthread_once(&poolOnce, StartPool);
+
+    task_t task = {.func = func, .arg = arg, .group = group};
+    atomic_fetch_add(&group->pending, 1);
+    int deque = workerID >= 0 ? workerID : (int)pool.numWorkers;
+    if (pool.numWorkers == 0 || !PushTask(&pool.deque[deque], &task)) {
+        RunTask(&task);
+        return;
+    }
+
+    if (atomic_load(&pool.numIdle) > 0) {
+        pthread_mutex_lock(&pool.idleMutex);
+        pthread_cond_signal(&pool.idleCond);
+        pthread_mutex_unlock(&pool.idleMutex);
+    }
+
+}  // End of TaskSubmit
+
+void TaskWait(taskGroup_t *group) {
+    // help running queued tasks, until all tasks of the group are done
+    uint32_t spin = 0;
+    while (atomic_load(&group->pending) > 0) {
+        task_t task;
+        if (pool.numWorkers && FindTask(&task)) {
+            RunTask(&task);
+            spin = 0;
+        } else if (++spin < 64) {
+            sched_yield();
+        } else {
+            usleep(50);
+        }
+    }
+
+}  // End of TaskWait
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _TASKPOOL_H
+#define _TASKPOOL_H 1
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Process wide work stealing task pool
+ * ====================================
+ * Short lived, fork/join style work such as sort partitions or radix passes is
+ * submitted as tasks to a pool of worker threads, instead of creating a thread
+ * per piece of work. Every worker owns a deque: it pushes and pops its own tasks
+ * at the bottom (LIFO), idle workers steal from the top of other deques (FIFO).
+ * Tasks submitted from threads outside the pool go into a shared inject deque.
+ *
+ * Tasks are collected in task groups. TaskWait() does not block while tasks of
+ * the group are pending, but runs queued tasks itself, therefore tasks may submit
+ * and wait for nested tasks without exhausting the pool.
+ *
+ * The pool is started on first use with one worker per cpu online, unless
+ * TaskPoolInit() is called before with a different number of workers. If no
+ * worker can be started, tasks are run inline by TaskSubmit().
+ */
+
+typedef void (*taskFunc_t)(void *arg);
+
+typedef struct taskGroup_s {
+    _Atomic uint32_t pending;
+} taskGroup_t;
+
+#define TASKGROUP_INITIALIZER {0}
+
+int TaskPoolInit(uint32_t numWorkers);
+
+uint32_t TaskPoolWorkers(void);
+
+void TaskSubmit(taskGroup_t *group, taskFunc_t func, void *arg);
+
+void TaskWait(taskGroup_t *group);
+
+#endif  // _TASKPOOL_H
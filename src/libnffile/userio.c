@@ -318,7 +318,7 @@ int ProtoNum(char *protoString) {
 }  // End of ProtoNum
 
 char *ProtoString(uint8_t protoNum, uint32_t plainNumbers) {
-    static char s[16];
+    static _Thread_local char s[16];
 
     if (protoNum >= NUMPROTOS || plainNumbers) {
         snprintf(s, 15, "%-5i", protoNum);
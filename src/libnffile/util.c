@@ -605,7 +605,7 @@ long getTick(void) {
 }
 
 char *DurationString(double duration) {
-    static char s[128];
+    static _Thread_local char s[128];
     if (duration == 0.0) {
         strncpy(s, "    00:00:00.000", 128);
     } else {
@@ -33,16 +33,46 @@
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "barrier.h"
 #include "maxmind/mmhash.h"
 #include "mmcreate.h"
 #include "util.h"
 
+// longest accepted csv line
+#define MAXLINELEN 4096
+
+// files smaller than this are parsed by a single worker
+#define MINCHUNKSIZE (1024 * 1024)
+
+// parse one csv line into node - returns 1 on success, 0 on error
+typedef int (*lineParser_t)(char *line, void *node);
+
+// load parsed nodes into the geo DB
+typedef void (*nodeLoader_t)(void *nodes, uint32_t numNodes);
+
+// each worker parses a chunk of complete lines of the mapped csv file
+typedef struct csvWorker_s {
+    pthread_t tid;
+    char *start;
+    char *end;
+    lineParser_t parser;
+    size_t nodeSize;
+    void *nodes;
+    uint32_t numNodes;
+    uint32_t maxNodes;
+    uint32_t errors;
+} csvWorker_t;
+
 static char *asFieldNames[] = {"network", "autonomous_system_number", "autonomous_system_organization", NULL};
 
 // field names of GeoLite2-City-Locations-en
@@ -81,6 +111,26 @@ static void stripLine(char *line) {
     if (eol) *eol = '\0';
 }  // End of stripLine
 
+// parse and check the csv header line
+static int checkHeader(char *fileName, char *line, char **fieldNames) {
+    stripLine(line);
+    int i = 0;
+    char *field = NULL;
+    char *l = line;
+    while ((field = strsep(&l, ",")) != NULL) {
+        if (fieldNames[i] == NULL) {
+            LogError("Field check for %s: Found extra field '%s'", fileName, field);
+        } else if (strcmp(field, fieldNames[i]) != 0) {
+            LogError("Field check failed in %s at index: %d, expected: '%s', found: '%s'", fileName, i, fieldNames[i], field);
+            return 0;
+        }
+        if (fieldNames[i]) i++;
+    }
+
+    return 1;
+
+}  // End of checkHeader
+
 static FILE *checkFile(char *fileName, char **fieldNames) {
     FILE *fp = fopen(fileName, "r");
     if (!fp) {
@@ -96,22 +146,13 @@ static FILE *checkFile(char *fileName, char **fieldNames) {
     lineLen = getline(&line, &linecap, fp);
     if (lineLen < 0) {
         LogError("getline() error: %s", strerror(errno));
+        fclose(fp);
         return NULL;
     }
-    stripLine(line);
-    // parse and check header line
-    int i = 0;
-    char *field = NULL;
-    char *l = line;
-    while ((field = strsep(&l, ",")) != NULL) {
-        if (fieldNames[i] == NULL) {
-            LogError("Field check for %s: Found extra field '%s'", fileName, field);
-        } else if (strcmp(field, fieldNames[i]) != 0) {
-            LogError("Field check failed in %s at index: %d, expected: '%s', found: '%s'", fileName, i, fieldNames[i], field);
-            fclose(fp);
-            return NULL;
-        }
-        i++;
+    if (!checkHeader(fileName, line, fieldNames)) {
+        free(line);
+        fclose(fp);
+        return NULL;
     }
 
     free(line);
@@ -119,6 +160,146 @@ static FILE *checkFile(char *fileName, char **fieldNames) {
 
 }  // End of checkFile
 
+static void *csvWorker(void *arg) {
+    csvWorker_t *worker = (csvWorker_t *)arg;
+    char line[MAXLINELEN];
+
+    char *p = worker->start;
+    while (p < worker->end) {
+        char *eol = memchr(p, '\n', worker->end - p);
+        size_t len = eol ? (size_t)(eol - p) : (size_t)(worker->end - p);
+        char *next = p + len + 1;
+        if (len >= MAXLINELEN) {
+            worker->errors++;
+            p = next;
+            continue;
+        }
+        memcpy(line, p, len);
+        line[len] = '\0';
+        p = next;
+
+        stripLine(line);
+        if (line[0] == '\0') continue;
+
+        if (worker->numNodes == worker->maxNodes) {
+            uint32_t maxNodes = worker->maxNodes ? 2 * worker->maxNodes : 65536;
+            void *nodes = realloc(worker->nodes, (size_t)maxNodes * worker->nodeSize);
+            if (!nodes) {
+                LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                worker->errors++;
+                break;
+            }
+            worker->nodes = nodes;
+            worker->maxNodes = maxNodes;
+        }
+
+        void *node = worker->nodes + (size_t)worker->numNodes * worker->nodeSize;
+        memset(node, 0, worker->nodeSize);
+        if (worker->parser(line, node))
+            worker->numNodes++;
+        else
+            worker->errors++;
+    }
+
+    return NULL;
+
+}  // End of csvWorker
+
+// map a csv file and parse all lines in parallel. The nodes of all workers
+// are loaded in file order. Returns the number of loaded nodes or -1 on error
+static int64_t parseCSVFile(char *fileName, char **fieldNames, lineParser_t parser, size_t nodeSize, nodeLoader_t loader) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        LogError("open(%s) error in %s line %d: %s", fileName, __FILE__, __LINE__, strerror(errno));
+        return -1;
+    }
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0 || stat_buf.st_size == 0) {
+        LogError("Empty or unreadable file %s", fileName);
+        close(fd);
+        return -1;
+    }
+    size_t size = stat_buf.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LogError("mmap() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return -1;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    // check header line
+    char *eod = data + size;
+    char *eol = memchr(data, '\n', size);
+    size_t headerLen = eol ? (size_t)(eol - data) : size;
+    char header[MAXLINELEN];
+    if (headerLen >= MAXLINELEN) {
+        LogError("Header line too long in %s", fileName);
+        munmap(data, size);
+        return -1;
+    }
+    memcpy(header, data, headerLen);
+    header[headerLen] = '\0';
+    if (!checkHeader(fileName, header, fieldNames)) {
+        munmap(data, size);
+        return -1;
+    }
+    char *body = eol ? eol + 1 : eod;
+    size_t bodySize = eod - body;
+
+    uint32_t numWorkers = bodySize < MINCHUNKSIZE ? 1 : GetNumWorkers(0);
+    csvWorker_t *workers = calloc(numWorkers, sizeof(csvWorker_t));
+    if (!workers) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        munmap(data, size);
+        return -1;
+    }
+
+    // split body into chunks at line boundaries
+    char *start = body;
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        char *end = i == (numWorkers - 1) ? eod : body + (bodySize / numWorkers) * (i + 1);
+        if (end < start) end = start;
+        if (end < eod) {
+            char *nl = memchr(end, '\n', eod - end);
+            end = nl ? nl + 1 : eod;
+        }
+        workers[i].start = start;
+        workers[i].end = end;
+        workers[i].parser = parser;
+        workers[i].nodeSize = nodeSize;
+        start = end;
+    }
+
+    uint32_t numStarted = 0;
+    for (; numStarted < numWorkers; numStarted++) {
+        int err = pthread_create(&workers[numStarted].tid, NULL, csvWorker, (void *)&workers[numStarted]);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            break;
+        }
+    }
+    int64_t numNodes = 0;
+    uint32_t errors = 0;
+    for (uint32_t i = 0; i < numStarted; i++) {
+        pthread_join(workers[i].tid, NULL);
+        // load nodes in file order
+        loader(workers[i].nodes, workers[i].numNodes);
+        numNodes += workers[i].numNodes;
+        errors += workers[i].errors;
+        free(workers[i].nodes);
+    }
+    if (numStarted != numWorkers) numNodes = -1;
+
+    if (errors) LogError("Skipped %u invalid lines in %s", errors, fileName);
+
+    free(workers);
+    munmap(data, size);
+
+    return numNodes;
+
+}  // End of parseCSVFile
+
 static void strCopyReplace(char *dst, char *src) {
     int i = 0;
     for (i = 0; src[i] != 0; i++) {
@@ -211,300 +392,232 @@ static int loadLocalMap(char *fileName) {
 
 }  // End of loadLocalMap
 
-static int loadIPV4tree(char *fileName) {
-    FILE *fp = checkFile(fileName, ipFieldNames);
-    if (!fp) {
-        LogError("loadIPV4tree(%s) failed", fileName);
-        return 0;
-    }
+// parse the network of a csv field. Returns 1 on success
+static int parseV4Network(char *field, uint32_t *network, uint32_t *netmask) {
+    char *cidr = strchr(field, '/');
+    if (!cidr) return 0;
+    *cidr++ = '\0';
 
-    uint32_t cnt = 0;
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t lineLen;
-    while ((lineLen = getline(&line, &linecap, fp)) > 0) {
-        stripLine(line);
-        // printf("%s\n", line);
-        ipV4Node_t ipV4Node;
-        char *l = line;
-        char *field = NULL;
-        int i = 0;
-        while ((field = strsep(&l, ",")) != NULL) {
-            // printf("field: %s\n", field);
-            switch (i) {
-                case (0): {
-                    char *cidr = strchr(field, '/');
-                    *cidr = '\0';
-                    uint32_t net, netBits, mask;
-                    int ret = inet_pton(PF_INET, field, &net);
-                    if (ret != 1) {
-                        LogError("Not an IPv4 network: %s\n", field);
-                        continue;
-                    }
-                    netBits = atoi(++cidr);
-                    mask = 0xffffffff << (32 - netBits);
-                    ipV4Node.network = ntohl(net);
-                    ipV4Node.netmask = mask;
-                } break;
-                case 1:  // geoname_id
-                    ipV4Node.info.localID = atoi(field);
-                    break;
-                case 4:  // is_proxy
-                    ipV4Node.info.proxy = strcmp(field, "1") == 0 ? 1 : 0;
-                    break;
-                case 5:  // is_sat
-                    ipV4Node.info.sat = strcmp(field, "1") == 0 ? 1 : 0;
-                    break;
-                case 7:  // longitude
-                    ipV4Node.info.longitude = atof(field);
-                    break;
-                case 8:  // latitude
-                    ipV4Node.info.latitude = atof(field);
-                    break;
-                case 9:  // accuracy
-                    ipV4Node.info.accuracy = atoi(field);
-                    break;
-            }
-            i++;
-        }
-        PutIPv4Node(&ipV4Node);
-        cnt++;
-    }
-    printf("Loaded %u entries into IPV4 tree\n", cnt);
+    uint32_t net;
+    if (inet_pton(PF_INET, field, &net) != 1) return 0;
+    uint32_t netBits = atoi(cidr);
+    if (netBits > 32) return 0;
 
-    fclose(fp);
+    *network = ntohl(net);
+    *netmask = netBits ? 0xffffffff << (32 - netBits) : 0;
     return 1;
 
-}  // End of loadIPV4tree
+}  // End of parseV4Network
 
-static int loadIPV6tree(char *fileName) {
-    FILE *fp = checkFile(fileName, ipFieldNames);
-    if (!fp) {
-        LogError("loadIPV6tree(%s) failed", fileName);
-        return 0;
+static int parseV6Network(char *field, uint64_t network[2], uint64_t netmask[2]) {
+    char *cidr = strchr(field, '/');
+    if (!cidr) return 0;
+    *cidr++ = '\0';
+
+    uint64_t net[2];
+    if (inet_pton(PF_INET6, field, net) != 1) return 0;
+    uint32_t netBits = atoi(cidr);
+    if (netBits > 128) return 0;
+
+    if (netBits > 64) {
+        netmask[0] = 0xffffffffffffffffLL;
+        netmask[1] = 0xffffffffffffffffLL << (128 - netBits);
+    } else {
+        netmask[0] = netBits ? 0xffffffffffffffffLL << (64 - netBits) : 0;
+        netmask[1] = 0;
     }
+    network[0] = ntohll(net[0]);
+    network[1] = ntohll(net[1]);
+    return 1;
 
-    uint32_t cnt = 0;
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t lineLen;
-    while ((lineLen = getline(&line, &linecap, fp)) > 0) {
-        stripLine(line);
-        // printf("%s\n", line);
-        ipV6Node_t ipV6Node;
-        char *l = line;
-        char *field = NULL;
-        int i = 0;
-        while ((field = strsep(&l, ",")) != NULL) {
-            // printf("field: %s\n", field);
-            switch (i) {
-                case (0): {
-                    char *cidr = strchr(field, '/');
-                    *cidr = '\0';
-                    uint32_t netBits;
-                    uint64_t net[2], mask[2];
-                    int ret = inet_pton(PF_INET6, field, net);
-                    if (ret != 1) {
+}  // End of parseV6Network
+
+// parse the location info fields of a City-Blocks line
+static int parseIPinfo(char *line, int ipv6, void *network, void *netmask, ipLocationInfo_t *info) {
+    char *l = line;
+    char *field = NULL;
+    int i = 0;
+    while ((field = strsep(&l, ",")) != NULL) {
+        switch (i) {
+            case 0:
+                if (ipv6) {
+                    if (!parseV6Network(field, (uint64_t *)network, (uint64_t *)netmask)) {
                         LogError("Not an IPv6 network: %s\n", field);
-                        continue;
+                        return 0;
                     }
-                    netBits = atoi(++cidr);
-
-                    if (netBits > 64) {
-                        mask[0] = 0xffffffffffffffffLL;
-                        mask[1] = 0xffffffffffffffffLL << (64 - netBits);
-                    } else {
-                        mask[0] = 0xffffffffffffffffLL << (64 - netBits);
-                        mask[1] = 0;
+                } else {
+                    if (!parseV4Network(field, (uint32_t *)network, (uint32_t *)netmask)) {
+                        LogError("Not an IPv4 network: %s\n", field);
+                        return 0;
                     }
-
-                    // printf("ip: 0x%x, bits: %u, mask: 0x%x\n", net, netBits, mask);
-                    ipV6Node.network[0] = ntohll(net[0]);
-                    ipV6Node.network[1] = ntohll(net[1]);
-                    ipV6Node.netmask[0] = mask[0];
-                    ipV6Node.netmask[1] = mask[1];
-                } break;
-                case 1:  // geoname_id
-                    ipV6Node.info.localID = atoi(field);
-                    break;
-                case 4:  // is_proxy
-                    ipV6Node.info.proxy = strcmp(field, "1") == 0 ? 1 : 0;
-                    break;
-                case 5:  // is_sat
-                    ipV6Node.info.sat = strcmp(field, "1") == 0 ? 1 : 0;
-                    break;
-                case 7:  // longitude
-                    ipV6Node.info.longitude = atof(field);
-                    break;
-                case 8:  // latitude
-                    ipV6Node.info.latitude = atof(field);
-                    break;
-                case 9:  // accuracy
-                    ipV6Node.info.accuracy = atoi(field);
-                    break;
-            }
-            i++;
+                }
+                break;
+            case 1:  // geoname_id
+                info->localID = atoi(field);
+                break;
+            case 4:  // is_proxy
+                info->proxy = strcmp(field, "1") == 0 ? 1 : 0;
+                break;
+            case 5:  // is_sat
+                info->sat = strcmp(field, "1") == 0 ? 1 : 0;
+                break;
+            case 7:  // longitude
+                info->longitude = atof(field);
+                break;
+            case 8:  // latitude
+                info->latitude = atof(field);
+                break;
+            case 9:  // accuracy
+                info->accuracy = atoi(field);
+                break;
         }
+        i++;
+    }
 
-        PutIPv6Node(&ipV6Node);
-        cnt++;
+    return i > 0;
+
+}  // End of parseIPinfo
+
+static int parseIPV4Line(char *line, void *node) {
+    ipV4Node_t *ipV4Node = (ipV4Node_t *)node;
+    return parseIPinfo(line, 0, &ipV4Node->network, &ipV4Node->netmask, &ipV4Node->info);
+}  // End of parseIPV4Line
+
+static int parseIPV6Line(char *line, void *node) {
+    ipV6Node_t *ipV6Node = (ipV6Node_t *)node;
+    return parseIPinfo(line, 1, ipV6Node->network, ipV6Node->netmask, &ipV6Node->info);
+}  // End of parseIPV6Line
+
+// split an ASN-Blocks line into network, AS and org name
+static int parseASfields(char *line, char **network, uint32_t *as, char *orgName) {
+    char *field = line;
+
+    // extract cidr
+    char *sep = strchr(field, ',');
+    if (!sep) return 0;
+    *sep++ = '\0';
+    *network = field;
+    field = sep;
+
+    // extract AS
+    sep = strchr(field, ',');
+    if (!sep) return 0;
+    *sep++ = '\0';
+    *as = atoi(field);
+    field = sep;
+
+    size_t fieldLen = strlen(field);
+    if (fieldLen > 2) {
+        if (field[fieldLen - 1] == '"') field[fieldLen - 1] = '\0';
+        if (field[0] == '"') field++;
     }
-    printf("Loaded %u entries into IPV6 tree\n", cnt);
 
-    fclose(fp);
+    // extract org name
+    if (strlen(field) > (orgNameLength - 1)) field[orgNameLength - 1] = '\0';
+    strCopyReplace(orgName, field);
+
     return 1;
 
-}  // End of loadIPV6tree
+}  // End of parseASfields
 
-static int loadASV4tree(char *fileName) {
-    FILE *fp = checkFile(fileName, asFieldNames);
-    if (!fp) {
-        LogError("loadASV4tree(%s) failed", fileName);
+static int parseASV4Line(char *line, void *node) {
+    asV4Node_t *asV4Node = (asV4Node_t *)node;
+    char *network = NULL;
+    if (!parseASfields(line, &network, &asV4Node->as, asV4Node->orgName)) {
+        LogError("Parse line in ASv4 file failed");
+        return 0;
+    }
+    if (!parseV4Network(network, &asV4Node->network, &asV4Node->netmask)) {
+        LogError("Not an IPv4 network: %s\n", network);
         return 0;
     }
+    return 1;
 
-    uint32_t cnt = 0;
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t lineLen;
-    while ((lineLen = getline(&line, &linecap, fp)) > 0) {
-        stripLine(line);
-        // printf("%s\n", line);
-        char *field = line;
-        char *sep = NULL;
-
-        // extract cidr
-        sep = strchr(field, ',');
-        if (!sep) {
-            LogError("Parse cidr in ASv4 file: %s: failed", fileName);
-            return 0;
-        }
-        *sep++ = '\0';
-
-        // cidr
-        char *cidr = strchr(field, '/');
-        *cidr = '\0';
-        uint32_t net, netBits, mask;
-        int ret = inet_pton(PF_INET, field, &net);
-        if (ret != 1) {
-            LogError("Not an IPv4 network: %s\n", field);
-            continue;
-        }
-        netBits = atoi(++cidr);
-        mask = 0xffffffff << (32 - netBits);
-        // printf("ip: 0x%x, bits: %u, mask: 0x%x\n", net, netBits, mask);
-        asV4Node_t asV4Node = {.network = ntohl(net), .netmask = mask};
-        field = sep;
-
-        // extract AS
-        sep = strchr(field, ',');
-        if (!sep) {
-            LogError("Parse AS in ASv4 file: %s: failed", fileName);
-            return 0;
-        }
-        *sep++ = '\0';
-        asV4Node.as = atoi(field);
-        asOrgNode_t asOrgNode = {.as = asV4Node.as};
-        field = sep;
-
-        size_t fieldLen = strlen(field);
-        if (fieldLen > 2) {
-            if (field[fieldLen - 1] == '"') field[fieldLen - 1] = '\0';
-            if (field[0] == '"') field++;
-        }
+}  // End of parseASV4Line
+
+static int parseASV6Line(char *line, void *node) {
+    asV6Node_t *asV6Node = (asV6Node_t *)node;
+    char *network = NULL;
+    if (!parseASfields(line, &network, &asV6Node->as, asV6Node->orgName)) {
+        LogError("Parse line in ASv6 file failed");
+        return 0;
+    }
+    if (!parseV6Network(network, asV6Node->network, asV6Node->netmask)) {
+        LogError("Not an IPv6 network: %s\n", network);
+        return 0;
+    }
+    return 1;
 
-        // extract org name
-        strCopyReplace(asV4Node.orgName, field);
-        asV4Node.orgName[orgNameLength - 1] = '\0';
-        strCopyReplace(asOrgNode.orgName, field);
-        asOrgNode.orgName[orgNameLength - 1] = '\0';
+}  // End of parseASV6Line
 
-        // insert node
-        PutasV4Node(&asV4Node);
-        PutASorgNode(&asOrgNode);
+static void loadIPV4Nodes(void *nodes, uint32_t numNodes) {
+    LoadIPv4Tree((ipV4Node_t *)nodes, numNodes);
+}  // End of loadIPV4Nodes
 
-        cnt++;
+static void loadIPV6Nodes(void *nodes, uint32_t numNodes) {
+    LoadIPv6Tree((ipV6Node_t *)nodes, numNodes);
+}  // End of loadIPV6Nodes
+
+static void loadASV4Nodes(void *nodes, uint32_t numNodes) {
+    asV4Node_t *asV4Node = (asV4Node_t *)nodes;
+    LoadASV4Tree(asV4Node, numNodes);
+    for (uint32_t i = 0; i < numNodes; i++) {
+        asOrgNode_t asOrgNode = {.as = asV4Node[i].as};
+        memcpy(asOrgNode.orgName, asV4Node[i].orgName, orgNameLength);
+        PutASorgNode(&asOrgNode);
+    }
+}  // End of loadASV4Nodes
+
+static void loadASV6Nodes(void *nodes, uint32_t numNodes) {
+    asV6Node_t *asV6Node = (asV6Node_t *)nodes;
+    LoadASV6Tree(asV6Node, numNodes);
+    for (uint32_t i = 0; i < numNodes; i++) {
+        asOrgNode_t asOrgNode = {.as = asV6Node[i].as};
+        memcpy(asOrgNode.orgName, asV6Node[i].orgName, orgNameLength);
+        PutASorgNode(&asOrgNode);
     }
-    printf("Loaded %u entries into ASV4 tree\n", cnt);
+}  // End of loadASV6Nodes
 
-    fclose(fp);
+static int loadIPV4tree(char *fileName) {
+    int64_t cnt = parseCSVFile(fileName, ipFieldNames, parseIPV4Line, sizeof(ipV4Node_t), loadIPV4Nodes);
+    if (cnt < 0) {
+        LogError("loadIPV4tree(%s) failed", fileName);
+        return 0;
+    }
+    printf("Loaded %lld entries into IPV4 tree\n", (long long)cnt);
     return 1;
 
-}  // End of loadASV4tree
+}  // End of loadIPV4tree
 
-static int loadASV6tree(char *fileName) {
-    FILE *fp = checkFile(fileName, asFieldNames);
-    if (!fp) {
-        LogError("loadASV6tree(%s) failed", fileName);
+static int loadIPV6tree(char *fileName) {
+    int64_t cnt = parseCSVFile(fileName, ipFieldNames, parseIPV6Line, sizeof(ipV6Node_t), loadIPV6Nodes);
+    if (cnt < 0) {
+        LogError("loadIPV6tree(%s) failed", fileName);
         return 0;
     }
+    printf("Loaded %lld entries into IPV6 tree\n", (long long)cnt);
+    return 1;
 
-    uint32_t cnt = 0;
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t lineLen;
-    while ((lineLen = getline(&line, &linecap, fp)) > 0) {
-        stripLine(line);
-        // printf("%s\n", line);
-        char *field = line;
-        char *sep = NULL;
-
-        // extract cidr
-        sep = strchr(field, ',');
-        if (!sep) {
-            LogError("Parse cidr in ASv6 file: %s: failed", fileName);
-            return 0;
-        }
-        *sep++ = '\0';
-
-        // cidr
-        char *cidr = strchr(field, '/');
-        *cidr = '\0';
-        uint32_t netBits;
-        uint64_t net[2], mask[2];
-        int ret = inet_pton(PF_INET6, field, net);
-        if (ret != 1) {
-            LogError("Not an IPv6 network: %s\n", field);
-            continue;
-        }
-        netBits = atoi(++cidr);
-
-        if (netBits > 64) {
-            mask[0] = 0xffffffffffffffffLL;
-            mask[1] = 0xffffffffffffffffLL << (64 - netBits);
-        } else {
-            mask[0] = 0xffffffffffffffffLL << (64 - netBits);
-            mask[1] = 0;
-        }
-
-        // printf("ip: 0x%x, bits: %u, mask: 0x%x\n", net, netBits, mask);
-        asV6Node_t asV6Node = {.network[0] = ntohll(net[0]), .network[1] = ntohll(net[1]), .netmask[0] = mask[0], .netmask[1] = mask[1]};
-        field = sep;
+}  // End of loadIPV6tree
 
-        // extract AS
-        sep = strchr(field, ',');
-        if (!sep) {
-            LogError("Parse AS in ASv4 file: %s: failed", fileName);
-            return 0;
-        }
-        *sep++ = '\0';
-        asV6Node.as = atoi(field);
-        asOrgNode_t asOrgNode = {.as = asV6Node.as};
-        field = sep;
-
-        // extract org name
-        strCopyReplace(asV6Node.orgName, field);
-        asV6Node.orgName[orgNameLength - 1] = '\0';
-        strCopyReplace(asOrgNode.orgName, field);
-        asOrgNode.orgName[orgNameLength - 1] = '\0';
-
-        PutasV6Node(&asV6Node);
-        PutASorgNode(&asOrgNode);
-        cnt++;
+static int loadASV4tree(char *fileName) {
+    int64_t cnt = parseCSVFile(fileName, asFieldNames, parseASV4Line, sizeof(asV4Node_t), loadASV4Nodes);
+    if (cnt < 0) {
+        LogError("loadASV4tree(%s) failed", fileName);
+        return 0;
     }
-    printf("Loaded %u entries into ASV6 tree\n", cnt);
+    printf("Loaded %lld entries into ASV4 tree\n", (long long)cnt);
+    return 1;
 
-    fclose(fp);
+}  // End of loadASV4tree
+
+static int loadASV6tree(char *fileName) {
+    int64_t cnt = parseCSVFile(fileName, asFieldNames, parseASV6Line, sizeof(asV6Node_t), loadASV6Nodes);
+    if (cnt < 0) {
+        LogError("loadASV6tree(%s) failed", fileName);
+        return 0;
+    }
+    printf("Loaded %lld entries into ASV6 tree\n", (long long)cnt);
     return 1;
 
 }  // End of loadASV6tree
@@ -36,9 +36,15 @@
 #include "config.h"
 #include "nfxV3.h"
 
+// template lookup table of an exporter domain
+#define TEMPLATE_HASHSIZE 256
+#define TEMPLATE_HASH(id) ((id) & (TEMPLATE_HASHSIZE - 1))
+
 typedef struct templateList_s {
     // linked list
     struct templateList_s *next;
+    // next template in the same lookup table slot
+    struct templateList_s *hashNext;
 
     // template information
     time_t updated;  // last update/refresh of template
@@ -52,6 +58,10 @@ typedef struct templateList_s {
 #define SYSUPTIME_TEMPLATE 32
     uint32_t type;  // template type
     void *data;     // template data
+
+    // template in wire format for the template cache - see tplcache.h
+    void *raw;
+    uint32_t rawSize;
 } templateList_t;
 
 typedef struct dataTemplate_s {
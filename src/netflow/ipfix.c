@@ -47,6 +47,7 @@
 #include "config.h"
 #include "exporter.h"
 #include "fnf.h"
+#include "ingest.h"
 #include "metric.h"
 #include "nbar.h"
 #include "nfdump.h"
@@ -54,6 +55,8 @@
 #include "nfnet.h"
 #include "nfxV3.h"
 #include "output_short.h"
+#include "pending.h"
+#include "tplcache.h"
 #include "util.h"
 
 // define stack slots
@@ -117,8 +120,29 @@ typedef struct exporterDomain_s {
     // list of all templates of this exporter
     templateList_t *template;
 
+    // template lookup table by template ID
+    templateList_t *templateHash[TEMPLATE_HASHSIZE];
+
+    // data flowsets waiting for their template
+    pendingList_t pending;
+
+    // per exporter metric - NULL if not enabled
+    exporter_metric_t *metric;
+
+    // exporter lookup table
+    FlowSource_t *fs;
+    struct exporterDomain_s *hashNext;
+
 } exporterDomain_t;
 
+/*
+ * exporter domains of all flow sources are hashed by flow source, exporter IP and
+ * domain ID. The exporter list of the flow source is kept for the collector.
+ */
+#define EXPORTER_HASHSIZE 4096
+static exporterDomain_t *exporterHash[EXPORTER_HASHSIZE];
+static exporterDomain_t *lastExporter = NULL;
+
 static int ExtensionsEnabled[MAXEXTENSIONS];
 
 static const struct ipfixTranslationMap_s {
@@ -297,6 +321,10 @@ static void Process_ipfix_data(exporterDomain_t *exporter, uint32_t ExportTime,
 
 static int LookupElement(uint16_t type, uint32_t EnterpriseNumber);
 
+static void RestoreTemplates(exporterDomain_t *exporter, FlowSource_t *fs);
+
+static void ProcessPending(exporterDomain_t *exporter, FlowSource_t *fs);
+
 #include "inline.c"
 #include "nffile_inline.c"
 
@@ -444,16 +472,33 @@ static int LookupElement(uint16_t type, uint32_t EnterpriseNumber) {
 
 }  // End of LookupElement
 
-static exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t ObservationDomain) {
-    exporterDomain_t **e = (exporterDomain_t **)&(fs->exporter_data);
+static inline uint32_t ExporterHash(FlowSource_t *fs, uint32_t ObservationDomain) {
+    uint64_t hash = (uint64_t)(uintptr_t)fs ^ fs->ip.V6[0] ^ fs->ip.V6[1] ^ ((uint64_t)ObservationDomain * 0x9E3779B97F4A7C15ULL);
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 32;
+    return (uint32_t)hash & (EXPORTER_HASHSIZE - 1);
 
-    while (*e) {
-        if ((*e)->info.id == ObservationDomain && (*e)->info.version == 10 && (*e)->info.ip.V6[0] == fs->ip.V6[0] &&
-            (*e)->info.ip.V6[1] == fs->ip.V6[1])
-            return *e;
-        e = &((*e)->next);
+}  // End of ExporterHash
+
+static exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t ObservationDomain) {
+    exporterDomain_t *exporter = lastExporter;
+    if (exporter && exporter->fs == fs && exporter->info.id == ObservationDomain && exporter->info.ip.V6[0] == fs->ip.V6[0] &&
+        exporter->info.ip.V6[1] == fs->ip.V6[1])
+        return exporter;
+
+    uint32_t hash = ExporterHash(fs, ObservationDomain);
+    for (exporter = exporterHash[hash]; exporter; exporter = exporter->hashNext) {
+        if (exporter->fs == fs && exporter->info.id == ObservationDomain && exporter->info.ip.V6[0] == fs->ip.V6[0] &&
+            exporter->info.ip.V6[1] == fs->ip.V6[1]) {
+            lastExporter = exporter;
+            return exporter;
+        }
     }
 
+    exporterDomain_t **e = (exporterDomain_t **)&(fs->exporter_data);
+    while (*e) e = &((*e)->next);
+
     char *ipstr = GetExporterIP(fs);
 
     // nothing found
@@ -476,7 +521,13 @@ static exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t ObservationDomai
     (*e)->next = NULL;
     (*e)->sampler = NULL;
 
+    (*e)->fs = fs;
+    (*e)->hashNext = exporterHash[hash];
+    exporterHash[hash] = *e;
+    lastExporter = *e;
+
     FlushInfoExporter(fs, &((*e)->info));
+    (*e)->metric = GetExporterMetric(fs, &((*e)->info));
 
     if (defaultSampling < 0) {
         // map hard overwrite sampling into a static sampler
@@ -501,6 +552,7 @@ static exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t ObservationDomai
     dbg_printf("[%u] New ipfix exporter: SysID: %u, Observation domain %u from: %s:%u\n", ObservationDomain, (*e)->info.sysid, ObservationDomain,
                ipstr, fs->port);
     LogInfo("Process_ipfix: New ipfix exporter: SysID: %u, Observation domain %u from: %s", (*e)->info.sysid, ObservationDomain, ipstr);
+    RestoreTemplates(*e, fs);
 
     return (*e);
 
@@ -603,14 +655,14 @@ static templateList_t *getTemplate(exporterDomain_t *exporter, uint16_t id) {
 
     if (exporter->currentTemplate && (exporter->currentTemplate->id == id)) return exporter->currentTemplate;
 
-    template = exporter->template;
+    template = exporter->templateHash[TEMPLATE_HASH(id)];
     while (template) {
         if (template->id == id) {
             exporter->currentTemplate = template;
             dbg_printf("[%u] Get template - found %u\n", exporter->info.id, id);
             return template;
         }
-        template = template->next;
+        template = template->hashNext;
     }
 
     dbg_printf("[%u] Get template - not found %u\n", exporter->info.id, id);
@@ -634,6 +686,8 @@ static templateList_t *newTemplate(exporterDomain_t *exporter, uint16_t id) {
     template->data = NULL;
 
     exporter->template = template;
+    template->hashNext = exporter->templateHash[TEMPLATE_HASH(id)];
+    exporter->templateHash[TEMPLATE_HASH(id)] = template;
     dbg_printf("[%u] Add new template ID %u\n", exporter->info.id, id);
 
     return template;
@@ -668,12 +722,17 @@ static void removeTemplate(exporterDomain_t *exporter, uint16_t id) {
         exporter->template = template->next;
     }
 
+    templateList_t **slot = &(exporter->templateHash[TEMPLATE_HASH(id)]);
+    while (*slot != template) slot = &((*slot)->hashNext);
+    *slot = template->hashNext;
+
     if (template->type == DATA_TEMPLATE) {
         dataTemplate_t *dataTemplate = (dataTemplate_t *)template->data;
         ClearSequencer(&(dataTemplate->sequencer));
         if (dataTemplate->extensionList) free(dataTemplate->extensionList);
     }
     free(template->data);
+    free(template->raw);
     free(template);
 
 }  // End of removeTemplate
@@ -696,10 +755,14 @@ static void removeAllTemplates(exporterDomain_t *exporter) {
             if (dataTemplate->extensionList) free(dataTemplate->extensionList);
         }
         free(template->data);
+        free(template->raw);
         free(template);
 
         template = next;
     }
+    exporter->template = NULL;
+    exporter->currentTemplate = NULL;
+    memset((void *)exporter->templateHash, 0, sizeof(exporter->templateHash));
 
 }  // End of removeAllTemplates
 
@@ -715,6 +778,8 @@ static void relinkSequencerList(exporterDomain_t *exporter) {
     sequencer_t *sequencer = &(dataTemplate->sequencer);
     sequencer_t *loop = sequencer;
     dbg_printf("Chain seqencer list\n");
+    // cached sub template sequencers may be gone
+    memset((void *)sequencer->subSequencer, 0, sizeof(sequencer->subSequencer));
 
     do {
         template = template->next;
@@ -725,6 +790,7 @@ static void relinkSequencerList(exporterDomain_t *exporter) {
         dataTemplate_t *dataTemplate = (dataTemplate_t *)template->data;
         sequencer->next = &(dataTemplate->sequencer);
         sequencer = sequencer->next;
+        memset((void *)sequencer->subSequencer, 0, sizeof(sequencer->subSequencer));
     } while (1);
 
     sequencer->next = loop;
@@ -908,6 +974,7 @@ static void Process_ipfix_template_add(exporterDomain_t *exporter, void *DataPtr
         dataTemplate->sequencer.templateID = id;
 
         SetFlag(template->type, DATA_TEMPLATE);
+        KeepTemplate(template, IPFIX_TEMPLATE_FLOWSET_ID, ipfix_template_record, size_required + 4);
 
         relinkSequencerList(exporter);
 #ifdef DEVEL
@@ -1009,6 +1076,8 @@ static void Process_ipfix_option_templates(exporterDomain_t *exporter, void *opt
     }
 
     removeTemplate(exporter, tableID);
+    // a replaced data template must leave the sequencer list
+    relinkSequencerList(exporter);
     optionTemplate_t *optionTemplate = (optionTemplate_t *)calloc(1, sizeof(optionTemplate_t));
     if (!optionTemplate) {
         LogError("Error calloc(): %s in %s:%d", strerror(errno), __FILE__, __LINE__);
@@ -1178,6 +1247,7 @@ static void Process_ipfix_option_templates(exporterDomain_t *exporter, void *opt
             return;
         }
         template->data = optionTemplate;
+        KeepTemplate(template, IPFIX_OPTIONS_FLOWSET_ID, option_template_flowset + 4, GET_FLOWSET_LENGTH(option_template_flowset) - 4);
 
         if ((optionTemplate->flags & SAMPLERFLAGS) == SAMPLERFLAGS) {
             dbg_printf("[%u] New Sampler information found\n", exporter->info.id);
@@ -1311,7 +1381,7 @@ static void Process_ipfix_data(exporterDomain_t *exporter, uint32_t ExportTime,
                 return;
                 break;
             case SEQ_MEM_ERR:
-                if (buffAvail == WRITE_BUFFSIZE) {
+                if (buffAvail == (int)BlockCapacity(fs->dataBlock)) {
                     LogError("Process ipfix: Sequencer run error. buffer size too small");
                     return;
                 }
@@ -1502,7 +1572,7 @@ static void Process_ipfix_data(exporterDomain_t *exporter, uint32_t ExportTime,
             fs->nffile->stat_record->numbytes += genericFlow->inBytes;
 
             uint32_t exporterIdent = MetricExpporterID(recordHeaderV3);
-            UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
+            UpdateMetric(fs, exporterIdent, genericFlow);
         }
 
         EXcntFlow_t *cntFlow = sequencer->offsetCache[EXcntFlowID];
@@ -1533,15 +1603,21 @@ static void Process_ipfix_data(exporterDomain_t *exporter, uint32_t ExportTime,
             flow_record_short(stdout, recordHeaderV3);
         }
 
+        if (!IngestRecord(fs, recordHeaderV3, fs->nffile->stat_record)) {
+            // dropped by the ingest filter
+            if (genericFlow) exporter->flows--;
+            continue;
+        }
+
         fs->dataBlock->size += recordHeaderV3->size;
         fs->dataBlock->NumRecords++;
 
         // buffer size sanity check
-        if (fs->dataBlock->size > WRITE_BUFFSIZE) {
+        if (fs->dataBlock->size > BlockCapacity(fs->dataBlock)) {
             // should never happen
             LogError("### Software error ###: %s line %d", __FILE__, __LINE__);
             LogError("Process ipfix: Output buffer overflow! Flush buffer and skip records.");
-            LogError("Buffer size: %u > %u", fs->dataBlock->size, WRITE_BUFFSIZE);
+            LogError("Buffer size: %u > %u", fs->dataBlock->size, BlockCapacity(fs->dataBlock));
 
             // reset buffer
             fs->dataBlock->size = 0;
@@ -1910,6 +1986,75 @@ static void ProcessOptionFlowset(exporterDomain_t *exporter, FlowSource_t *fs, t
 
 }  // End of ProcessOptionFlowset
 
+// decode the pending data flowsets, whose template arrived meanwhile
+static void ProcessPending(exporterDomain_t *exporter, FlowSource_t *fs) {
+    // decode in the context of the packet of the flowset
+    struct timeval received = fs->received;
+
+    uint32_t count = exporter->pending.count;
+    for (uint32_t i = 0; i < count; i++) {
+        pendingFlowset_t *pending = PopPending(&exporter->pending);
+        templateList_t *template = getTemplate(exporter, pending->templateID);
+        if (!template) {
+            RequeuePending(&exporter->pending, pending);
+            continue;
+        }
+        fs->received = pending->received;
+        if (TestFlag(template->type, DATA_TEMPLATE)) {
+            Process_ipfix_data(exporter, (uint32_t)pending->context, pending->data, fs, (dataTemplate_t *)template->data);
+            exporter->DataRecords++;
+        } else {
+            ProcessOptionFlowset(exporter, fs, template, pending->data);
+        }
+        free(pending);
+    }
+
+    fs->received = received;
+
+}  // End of ProcessPending
+
+// replay the templates of the observation domain, saved by a previous run
+static void RestoreTemplates(exporterDomain_t *exporter, FlowSource_t *fs) {
+    uint32_t size = 0;
+    void *flowsets = CachedTemplates(fs, &(exporter->info), &size);
+    if (!flowsets) return;
+
+    uint32_t numTemplates = 0;
+    void *flowset = flowsets;
+    while (size >= 4) {
+        uint16_t length = GET_FLOWSET_LENGTH(flowset);
+        if (length <= 4 || length > size) break;
+        switch (GET_FLOWSET_ID(flowset)) {
+            case IPFIX_TEMPLATE_FLOWSET_ID:
+                Process_ipfix_templates(exporter, flowset, length, fs);
+                break;
+            case IPFIX_OPTIONS_FLOWSET_ID:
+                Process_ipfix_option_templates(exporter, flowset, fs);
+                break;
+        }
+        numTemplates++;
+        flowset += length;
+        size -= length;
+    }
+    free(flowsets);
+
+    LogInfo("Process_ipfix: [%u] restored %u templates from template cache", exporter->info.id, numTemplates);
+
+}  // End of RestoreTemplates
+
+// write the templates of all IPFIX exporters of this flow source to the template cache
+int SaveTemplates_IPFIX(FlowSource_t *fs, FILE *cacheFile) {
+    int numExporters = 0;
+    for (exporterDomain_t *exporter = (exporterDomain_t *)fs->exporter_data; exporter; exporter = exporter->next) {
+        if (exporter->info.version != 10) continue;
+        int ret = WriteCachedTemplates(cacheFile, &(exporter->info), exporter->template);
+        if (ret < 0) return -1;
+        numExporters += ret;
+    }
+    return numExporters;
+
+}  // End of SaveTemplates_IPFIX
+
 void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
     exporterDomain_t *exporter;
     ssize_t size_left;
@@ -1940,6 +2085,15 @@ void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
     }
     exporter->packets++;
 
+    exporter_metric_t *metric = exporter->metric;
+    uint64_t decodeStart = 0;
+    uint64_t flows = exporter->flows;
+    if (metric) {
+        decodeStart = MetricNsec();
+        ExporterCounter(metric, EXPORTER_PACKETS, 1);
+        ExporterCounter(metric, EXPORTER_BYTES, in_buff_cnt);
+    }
+
     // exporter->PacketSequence = Sequence;
     flowset_header = (void *)ipfix_header + IPFIX_HEADER_LENGTH;
     size_left -= IPFIX_HEADER_LENGTH;
@@ -1955,6 +2109,7 @@ void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
             // sync sequence on first data record without error report
             fs->nffile->stat_record->sequence_failure++;
             exporter->sequence_failure++;
+            ExporterCounter(metric, EXPORTER_SEQFAILURE, 1);
             dbg_printf("[%u] Sequence check failed: last seq: %u, seq %u\n", exporter->info.id, Sequence, exporter->PacketSequence);
         } else {
             dbg_printf("[%u] Sync Sequence: %u\n", exporter->info.id, Sequence);
@@ -1969,7 +2124,7 @@ void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
     while (size_left) {
         uint16_t flowset_id;
         if (size_left < 4) {
-            return;
+            goto END_FUNC;
         }
 
         // grab flowset header
@@ -1987,17 +2142,19 @@ void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
              */
             LogError("Process_ipfix: flowset zero length error.");
             dbg_printf("Process_ipfix: flowset zero length error.\n");
-            return;
+            ExporterCounter(metric, EXPORTER_DECODEERROR, 1);
+            goto END_FUNC;
         }
 
         // possible padding
         if (flowset_length <= 4) {
-            return;
+            goto END_FUNC;
         }
 
         if (flowset_length > size_left) {
             LogError("Process_ipfix: flowset length error. Expected bytes: %u > buffersize: %lli", flowset_length, (long long)size_left);
-            return;
+            ExporterCounter(metric, EXPORTER_DECODEERROR, 1);
+            goto END_FUNC;
         }
 
         switch (flowset_id) {
@@ -2005,17 +2162,20 @@ void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
                 exporter->TemplateRecords++;
                 dbg_printf("Process template flowset, length: %u\n", flowset_length);
                 Process_ipfix_templates(exporter, flowset_header, flowset_length, fs);
+                if (exporter->pending.count) ProcessPending(exporter, fs);
                 break;
             case IPFIX_OPTIONS_FLOWSET_ID:
                 // option_flowset = (option_template_flowset_t *)flowset_header;
                 exporter->TemplateRecords++;
                 dbg_printf("Process option template flowset, length: %u\n", flowset_length);
                 Process_ipfix_option_templates(exporter, flowset_header, fs);
+                if (exporter->pending.count) ProcessPending(exporter, fs);
                 break;
             default: {
                 if (flowset_id < IPFIX_MIN_RECORD_FLOWSET_ID) {
                     dbg_printf("Invalid flowset id: %u. Skip flowset\n", flowset_id);
                     LogError("Process_ipfix: Invalid flowset id: %u. Skip flowset", flowset_id);
+                    ExporterCounter(metric, EXPORTER_DECODEERROR, 1);
                 } else {
                     dbg_printf("Process data flowset, length: %u\n", flowset_length);
                     templateList_t *template = getTemplate(exporter, flowset_id);
@@ -2030,6 +2190,9 @@ void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
                         }
                     } else {
                         dbg_printf("No template with id: %u, Skip length: %u\n", flowset_id, flowset_length);
+                        ExporterCounter(metric, EXPORTER_TEMPLATEMISS, 1);
+                        // keep the flowset until its template arrives
+                        PushPending(&exporter->pending, flowset_header, flowset_length, flowset_id, ExportTime, &fs->received);
                     }
                 }
             }
@@ -2040,4 +2203,10 @@ void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
 
     }  // End of while
 
+END_FUNC:
+    if (metric) {
+        ExporterCounter(metric, EXPORTER_FLOWS, exporter->flows - flows);
+        ExporterDecodeTime(metric, MetricNsec() - decodeStart);
+    }
+
 }  // End of Process_IPFIX
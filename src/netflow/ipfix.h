@@ -31,6 +31,7 @@
 #ifndef _IPFIX_H
 #define _IPFIX_H 1
 
+#include <stdio.h>
 #include <sys/types.h>
 
 #include "config.h"
@@ -381,4 +382,6 @@ int Init_IPFIX(int verbose, int32_t sampling, char *extensionList);
 
 void Process_IPFIX(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs);
 
+int SaveTemplates_IPFIX(FlowSource_t *fs, FILE *cacheFile);
+
 #endif  //_IPFIX_H 1
@@ -43,6 +43,7 @@
 #include <unistd.h>
 
 #include "collector.h"
+#include "ingest.h"
 #include "metric.h"
 #include "nfdump.h"
 #include "nffile.h"
@@ -212,6 +213,7 @@ void Process_v1(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
 
         /* loop over each records associated with this header */
         uint32_t outSize = 0;
+        uint32_t dropped = 0;
         for (int i = 0; i < count; i++) {
             // header data gets initialized by macro
             AddV3Header(outBuff, recordHeader);
@@ -316,15 +318,21 @@ void Process_v1(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
             fs->nffile->stat_record->numbytes += genericFlow->inBytes;
 
             uint32_t exporterIdent = MetricExpporterID(recordHeader);
-            UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
+            UpdateMetric(fs, exporterIdent, genericFlow);
 
             if (printRecord) {
                 flow_record_short(stdout, recordHeader);
             }
 
-            // advance output buffer
-            outBuff += recordHeader->size;
-            outSize += recordHeader->size;
+            if (IngestRecord(fs, recordHeader, fs->nffile->stat_record)) {
+                // advance output buffer
+                outBuff += recordHeader->size;
+                outSize += recordHeader->size;
+            } else {
+                // dropped by the ingest filter - reuse output buffer
+                exporter->flows--;
+                dropped++;
+            }
             // advance input buffer to next flow record
             v1_record = (netflow_v1_record_t *)((void *)v1_record + NETFLOW_V1_RECORD_LENGTH);
 
@@ -336,7 +344,7 @@ void Process_v1(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
         }  // End of foreach v1 record
 
         // update file record size ( -> output buffer size )
-        fs->dataBlock->NumRecords += count;
+        fs->dataBlock->NumRecords += count - dropped;
         fs->dataBlock->size += outSize;
 
         // still to go for this many input bytes
@@ -43,9 +43,19 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define V5SWAP_X86 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define V5SWAP_NEON 1
+#endif
+
 #include "bookkeeper.h"
 #include "collector.h"
+#include "cpufeature.h"
 #include "exporter.h"
+#include "ingest.h"
 #include "metric.h"
 #include "nfdump.h"
 #include "nffile.h"
@@ -168,6 +178,100 @@ static exporter_v5_t *getExporter(FlowSource_t *fs, netflow_v5_header_t *header)
 
 #include "nffile_inline.c"
 
+/*
+ * v5 records have a fixed layout. The records of a packet are converted into
+ * host byte order in one pass, before the V3 records are built. The SIMD versions
+ * swap the three 16 byte lanes of a record with one shuffle each. v7 records
+ * share the first 48 bytes with v5 records - stride is the raw record size.
+ */
+static void SwapV5Records(const uint8_t *in, netflow_v5_record_t *out, int numRecords, int stride) {
+    for (int i = 0; i < numRecords; i++) {
+        netflow_v5_record_t *v5_record = (netflow_v5_record_t *)in;
+        out[i] = *v5_record;
+        out[i].srcaddr = ntohl(v5_record->srcaddr);
+        out[i].dstaddr = ntohl(v5_record->dstaddr);
+        out[i].nexthop = ntohl(v5_record->nexthop);
+        out[i].input = ntohs(v5_record->input);
+        out[i].output = ntohs(v5_record->output);
+        out[i].dPkts = ntohl(v5_record->dPkts);
+        out[i].dOctets = ntohl(v5_record->dOctets);
+        out[i].First = ntohl(v5_record->First);
+        out[i].Last = ntohl(v5_record->Last);
+        out[i].srcPort = ntohs(v5_record->srcPort);
+        out[i].dstPort = ntohs(v5_record->dstPort);
+        out[i].src_as = ntohs(v5_record->src_as);
+        out[i].dst_as = ntohs(v5_record->dst_as);
+        in += stride;
+    }
+
+}  // End of SwapV5Records
+
+// byte order shuffle of the three 16 byte lanes of a v5 record
+static const uint8_t v5Shuffle[3][16] = {{3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 13, 12, 15, 14},
+                                         {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+                                         {1, 0, 3, 2, 4, 5, 6, 7, 9, 8, 11, 10, 12, 13, 14, 15}};
+
+#ifdef V5SWAP_X86
+
+__attribute__((target("ssse3"))) static void SwapV5RecordsSIMD(const uint8_t *in, netflow_v5_record_t *out, int numRecords, int stride) {
+    __m128i shuffle0 = _mm_loadu_si128((const __m128i *)v5Shuffle[0]);
+    __m128i shuffle1 = _mm_loadu_si128((const __m128i *)v5Shuffle[1]);
+    __m128i shuffle2 = _mm_loadu_si128((const __m128i *)v5Shuffle[2]);
+    for (int i = 0; i < numRecords; i++) {
+        __m128i *o = (__m128i *)&out[i];
+        _mm_storeu_si128(o, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), shuffle0));
+        _mm_storeu_si128(o + 1, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16)), shuffle1));
+        _mm_storeu_si128(o + 2, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 32)), shuffle2));
+        in += stride;
+    }
+
+}  // End of SwapV5RecordsSIMD
+
+#endif
+
+#ifdef V5SWAP_NEON
+
+static void SwapV5RecordsSIMD(const uint8_t *in, netflow_v5_record_t *out, int numRecords, int stride) {
+    uint8x16_t shuffle0 = vld1q_u8(v5Shuffle[0]);
+    uint8x16_t shuffle1 = vld1q_u8(v5Shuffle[1]);
+    uint8x16_t shuffle2 = vld1q_u8(v5Shuffle[2]);
+    for (int i = 0; i < numRecords; i++) {
+        uint8_t *o = (uint8_t *)&out[i];
+        vst1q_u8(o, vqtbl1q_u8(vld1q_u8(in), shuffle0));
+        vst1q_u8(o + 16, vqtbl1q_u8(vld1q_u8(in + 16), shuffle1));
+        vst1q_u8(o + 32, vqtbl1q_u8(vld1q_u8(in + 32), shuffle2));
+        in += stride;
+    }
+
+}  // End of SwapV5RecordsSIMD
+
+#endif
+
+static void (*swapV5Records)(const uint8_t *, netflow_v5_record_t *, int, int) = SwapV5Records;
+
+/*
+ * Calculate msecFirst and msecLast of host ordered v5 records. The sysUptime
+ * wrap checks are branch free, so the compiler may vectorize the loop.
+ */
+static void V5FlowTimes(const netflow_v5_record_t *v5_record, int numRecords, uint64_t msecBoot, uint32_t sysUptime, uint64_t *msecFirst,
+                        uint64_t *msecLast) {
+    for (int i = 0; i < numRecords; i++) {
+        uint64_t First = v5_record[i].First;
+        uint64_t Last = v5_record[i].Last;
+
+        // First in msec, in case of msec overflow, between start and end
+        uint64_t startWrap = (uint64_t)(First > Last) << 32;
+        // if overflow happened after flow ended but before got exported
+        // the additional check > 100000 is required due to a CISCO IOS bug
+        // CSCei12353 - thanks to Bojan
+        uint64_t exportWrap = (uint64_t)(Last > sysUptime && (Last - sysUptime) > 100000) << 32;
+
+        msecFirst[i] = msecBoot + First - startWrap - exportWrap;
+        msecLast[i] = msecBoot + Last - exportWrap;
+    }
+
+}  // End of V5FlowTimes
+
 int Init_v5_v7(int verbose, int32_t sampling) {
     assert(sizeof(netflow_v5_header_t) == NETFLOW_V5_HEADER_LENGTH);
     assert(sizeof(netflow_v5_record_t) == NETFLOW_V5_RECORD_LENGTH);
@@ -181,6 +285,11 @@ int Init_v5_v7(int verbose, int32_t sampling) {
         LogInfo("Init v5/v7: Default sampling: %d", defaultSampling);
     }
 
+    swapV5Records = SwapV5Records;
+#if defined(V5SWAP_X86) || defined(V5SWAP_NEON)
+    if (CPUKernel(KERNEL_V5SWAP)) swapV5Records = SwapV5RecordsSIMD;
+#endif
+
     baseRecordSize = sizeof(recordHeaderV3_t) + EXgenericFlowSize + EXipv4FlowSize + EXflowMiscSize + EXasRoutingSize + EXipNextHopV4Size;
 
     return 1;
@@ -354,15 +463,30 @@ void Process_v5_v7(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
             ((uint64_t)(v5_header->unix_secs) * 1000 + ((uint64_t)(v5_header->unix_nsecs) / 1000000)) - (uint64_t)(v5_header->SysUptime);
 
         // process all records
-        netflow_v5_record_t *v5_record = (netflow_v5_record_t *)((void *)v5_header + NETFLOW_V5_HEADER_LENGTH);
+        uint8_t *rawRecord = (uint8_t *)v5_header + NETFLOW_V5_HEADER_LENGTH;
 
         uint16_t engine_tag = ntohs(v5_header->engine_tag);
         uint8_t engineType = (engine_tag >> 8) & 0xFF;
         uint8_t engineID = (engine_tag & 0xFF);
 
+        netflow_v5_record_t hostRecords[NETFLOW_V5_MAX_RECORDS];
+        uint64_t msecFirst[NETFLOW_V5_MAX_RECORDS];
+        uint64_t msecLast[NETFLOW_V5_MAX_RECORDS];
+
         /* loop over each records associated with this header */
         uint32_t outSize = 0;
+        uint32_t dropped = 0;
         for (int i = 0; i < count; i++) {
+            int slot = i % NETFLOW_V5_MAX_RECORDS;
+            if (slot == 0) {
+                // convert the next batch of records into host byte order and calculate the flow times
+                int numRecords = (count - i) < NETFLOW_V5_MAX_RECORDS ? (count - i) : NETFLOW_V5_MAX_RECORDS;
+                swapV5Records(rawRecord, hostRecords, numRecords, rawRecordSize);
+                V5FlowTimes(hostRecords, numRecords, msecBoot, v5_header->SysUptime, msecFirst, msecLast);
+                rawRecord += numRecords * rawRecordSize;
+            }
+            netflow_v5_record_t *v5_record = &hostRecords[slot];
+
             // header data gets initialized by macro
             AddV3Header(outBuff, recordHeader);
 
@@ -375,65 +499,41 @@ void Process_v5_v7(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
             // Add v5 specific data
             PushExtension(recordHeader, EXgenericFlow, genericFlow);
             genericFlow->msecReceived = msecReceived;
-            genericFlow->inPackets = ntohl(v5_record->dPkts);
-            genericFlow->inBytes = ntohl(v5_record->dOctets);
-            genericFlow->srcPort = ntohs(v5_record->srcPort);
-            genericFlow->dstPort = ntohs(v5_record->dstPort);
+            genericFlow->inPackets = v5_record->dPkts;
+            genericFlow->inBytes = v5_record->dOctets;
+            genericFlow->srcPort = v5_record->srcPort;
+            genericFlow->dstPort = v5_record->dstPort;
             genericFlow->proto = v5_record->prot;
             genericFlow->srcTos = v5_record->tos;
             genericFlow->tcpFlags = v5_record->tcp_flags;
 
             PushExtension(recordHeader, EXipv4Flow, ipv4Flow);
-            ipv4Flow->srcAddr = ntohl(v5_record->srcaddr);
-            ipv4Flow->dstAddr = ntohl(v5_record->dstaddr);
+            ipv4Flow->srcAddr = v5_record->srcaddr;
+            ipv4Flow->dstAddr = v5_record->dstaddr;
 
             // add these extensions only if they have non zero values
             if (v5_record->input || v5_record->output) {
                 PushExtension(recordHeader, EXflowMisc, flowMisc);
-                flowMisc->input = ntohs(v5_record->input);
-                flowMisc->output = ntohs(v5_record->output);
+                flowMisc->input = v5_record->input;
+                flowMisc->output = v5_record->output;
             }
 
             if (v5_record->src_as || v5_record->dst_as) {
                 PushExtension(recordHeader, EXasRouting, asRouting);
-                asRouting->srcAS = ntohs(v5_record->src_as);
-                asRouting->dstAS = ntohs(v5_record->dst_as);
+                asRouting->srcAS = v5_record->src_as;
+                asRouting->dstAS = v5_record->dst_as;
             }
 
             if (v5_record->nexthop) {
                 PushExtension(recordHeader, EXipNextHopV4, ipNextHopV4);
-                ipNextHopV4->ip = ntohl(v5_record->nexthop);
+                ipNextHopV4->ip = v5_record->nexthop;
             }
 
             // post process required data
+            genericFlow->msecFirst = msecFirst[slot];
+            genericFlow->msecLast = msecLast[slot];
 
-            // calculate msec values first/last
-            uint64_t First = ntohl(v5_record->First);
-            uint64_t Last = ntohl(v5_record->Last);
-            uint64_t msecStart, msecEnd;
-
-            if (First > Last) {
-                /* First in msec, in case of msec overflow, between start and end */
-                msecStart = msecBoot - 0x100000000LL + First;
-            } else {
-                msecStart = msecBoot + First;
-            }
-
-            /* end time in msecs */
-            msecEnd = Last + msecBoot;
-
-            // if overflow happened after flow ended but before got exported
-            // the additional check > 100000 is required due to a CISCO IOS bug
-            // CSCei12353 - thanks to Bojan
-            if (Last > v5_header->SysUptime && ((Last - v5_header->SysUptime) > 100000)) {
-                msecStart -= 0x100000000LL;
-                msecEnd -= 0x100000000LL;
-            }
-
-            genericFlow->msecFirst = msecStart;
-            genericFlow->msecLast = msecEnd;
-
-            UpdateFirstLast(fs, msecStart, msecEnd);
+            UpdateFirstLast(fs, msecFirst[slot], msecLast[slot]);
 
             // add router IP
             if (fs->sa_family == PF_INET6) {
@@ -488,16 +588,21 @@ void Process_v5_v7(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
             fs->nffile->stat_record->numbytes += genericFlow->inBytes;
 
             uint32_t exporterIdent = MetricExpporterID(recordHeader);
-            UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
+            UpdateMetric(fs, exporterIdent, genericFlow);
 
             if (printRecord) {
                 flow_record_short(stdout, recordHeader);
             }
 
             // advance to next input flow record
-            outBuff += recordHeader->size;
-            outSize += recordHeader->size;
-            v5_record = (netflow_v5_record_t *)((void *)v5_record + rawRecordSize);
+            if (IngestRecord(fs, recordHeader, fs->nffile->stat_record)) {
+                outBuff += recordHeader->size;
+                outSize += recordHeader->size;
+            } else {
+                // dropped by the ingest filter - reuse output buffer
+                exporter->flows--;
+                dropped++;
+            }
 
             if (recordHeader->size > exporter->outRecordSize) {
                 LogError("Process_v5: Record size check failed! Expected: %u, counted: %u\n", exporter->outRecordSize, recordHeader->size);
@@ -507,14 +612,14 @@ void Process_v5_v7(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
         }  // End of foreach v5 record
 
         // update file record size ( -> output buffer size )
-        fs->dataBlock->NumRecords += count;
+        fs->dataBlock->NumRecords += count - dropped;
         fs->dataBlock->size += outSize;
 
         // still to go for this many input bytes
         size_left -= NETFLOW_V5_HEADER_LENGTH + count * rawRecordSize;
 
         // next header
-        v5_header = (netflow_v5_header_t *)v5_record;
+        v5_header = (netflow_v5_header_t *)rawRecord;
 
         // should never be < 0
         done = size_left <= 0;
@@ -48,6 +48,7 @@
 #include "config.h"
 #include "exporter.h"
 #include "fnf.h"
+#include "ingest.h"
 #include "metric.h"
 #include "nbar.h"
 #include "nfdump.h"
@@ -55,6 +56,8 @@
 #include "nfnet.h"
 #include "nfxV3.h"
 #include "output_short.h"
+#include "pending.h"
+#include "tplcache.h"
 #include "util.h"
 
 // Get_valxx, a  macros
@@ -120,8 +123,29 @@ typedef struct exporterDomain_s {
     // list of all templates of this exporter
     templateList_t *template;
 
+    // template lookup table by template ID
+    templateList_t *templateHash[TEMPLATE_HASHSIZE];
+
+    // data flowsets waiting for their template
+    pendingList_t pending;
+
+    // per exporter metric - NULL if not enabled
+    exporter_metric_t *metric;
+
+    // exporter lookup table
+    FlowSource_t *fs;
+    struct exporterDomain_s *hashNext;
+
 } exporterDomain_t;
 
+/*
+ * exporter domains of all flow sources are hashed by flow source, exporter IP and
+ * domain ID. The exporter list of the flow source is kept for the collector.
+ */
+#define EXPORTER_HASHSIZE 4096
+static exporterDomain_t *exporterHash[EXPORTER_HASHSIZE];
+static exporterDomain_t *lastExporter = NULL;
+
 static int ExtensionsEnabled[MAXEXTENSIONS];
 
 static const struct v9TranslationMap_s {
@@ -299,6 +323,10 @@ static void Process_v9_SysUpTime_option_data(exporterDomain_t *exporter, templat
 
 static inline exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t exporter_id);
 
+static void RestoreTemplates(exporterDomain_t *exporter, FlowSource_t *fs);
+
+static void ProcessPending(exporterDomain_t *exporter, FlowSource_t *fs);
+
 /* functions */
 
 #include "nffile_inline.c"
@@ -391,15 +419,33 @@ static int LookupElement(uint16_t type, int EnterpriseNumber) {
 
 }  // End of LookupElement
 
-static inline exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t exporter_id) {
-    exporterDomain_t **e = (exporterDomain_t **)&(fs->exporter_data);
+static inline uint32_t ExporterHash(FlowSource_t *fs, uint32_t exporter_id) {
+    uint64_t hash = (uint64_t)(uintptr_t)fs ^ fs->ip.V6[0] ^ fs->ip.V6[1] ^ ((uint64_t)exporter_id * 0x9E3779B97F4A7C15ULL);
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 32;
+    return (uint32_t)hash & (EXPORTER_HASHSIZE - 1);
+
+}  // End of ExporterHash
 
-    while (*e) {
-        if ((*e)->info.id == exporter_id && (*e)->info.version == 9 && (*e)->info.ip.V6[0] == fs->ip.V6[0] && (*e)->info.ip.V6[1] == fs->ip.V6[1])
-            return *e;
-        e = &((*e)->next);
+static inline exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t exporter_id) {
+    exporterDomain_t *exporter = lastExporter;
+    if (exporter && exporter->fs == fs && exporter->info.id == exporter_id && exporter->info.ip.V6[0] == fs->ip.V6[0] &&
+        exporter->info.ip.V6[1] == fs->ip.V6[1])
+        return exporter;
+
+    uint32_t hash = ExporterHash(fs, exporter_id);
+    for (exporter = exporterHash[hash]; exporter; exporter = exporter->hashNext) {
+        if (exporter->fs == fs && exporter->info.id == exporter_id && exporter->info.ip.V6[0] == fs->ip.V6[0] &&
+            exporter->info.ip.V6[1] == fs->ip.V6[1]) {
+            lastExporter = exporter;
+            return exporter;
+        }
     }
 
+    exporterDomain_t **e = (exporterDomain_t **)&(fs->exporter_data);
+    while (*e) e = &((*e)->next);
+
     char *ipstr = GetExporterIP(fs);
 
     // nothing found
@@ -423,7 +469,13 @@ static inline exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t exporter_
     (*e)->sampler = NULL;
     (*e)->next = NULL;
 
+    (*e)->fs = fs;
+    (*e)->hashNext = exporterHash[hash];
+    exporterHash[hash] = *e;
+    lastExporter = *e;
+
     FlushInfoExporter(fs, &((*e)->info));
+    (*e)->metric = GetExporterMetric(fs, &((*e)->info));
 
     if (defaultSampling < 0) {
         // map hard overwrite sampling into a static sampler
@@ -446,6 +498,7 @@ static inline exporterDomain_t *getExporter(FlowSource_t *fs, uint32_t exporter_
     }
 
     LogInfo("Process_v9: New v9 exporter: SysID: %u, Domain: %u, IP: %s", (*e)->info.sysid, exporter_id, ipstr);
+    RestoreTemplates(*e, fs);
 
     return (*e);
 
@@ -540,14 +593,14 @@ static templateList_t *getTemplate(exporterDomain_t *exporter, uint16_t id) {
 
     if (exporter->currentTemplate && (exporter->currentTemplate->id == id)) return exporter->currentTemplate;
 
-    template = exporter->template;
+    template = exporter->templateHash[TEMPLATE_HASH(id)];
     while (template) {
         if (template->id == id) {
             exporter->currentTemplate = template;
             dbg_printf("[%u] Get template - found %u\n", exporter->info.id, id);
             return template;
         }
-        template = template->next;
+        template = template->hashNext;
     }
 
     dbg_printf("[%u] Get template %u: not found\n", exporter->info.id, id);
@@ -571,6 +624,8 @@ static templateList_t *newTemplate(exporterDomain_t *exporter, uint16_t id) {
     template->data = NULL;
 
     exporter->template = template;
+    template->hashNext = exporter->templateHash[TEMPLATE_HASH(id)];
+    exporter->templateHash[TEMPLATE_HASH(id)] = template;
     dbg_printf("[%u] Add new template ID %u\n", exporter->info.id, id);
 
     return template;
@@ -605,12 +660,17 @@ static void removeTemplate(exporterDomain_t *exporter, uint16_t id) {
         exporter->template = template->next;
     }
 
+    templateList_t **slot = &(exporter->templateHash[TEMPLATE_HASH(id)]);
+    while (*slot != template) slot = &((*slot)->hashNext);
+    *slot = template->hashNext;
+
     if (TestFlag(template->type, DATA_TEMPLATE)) {
         dataTemplate_t *dataTemplate = (dataTemplate_t *)template->data;
         ClearSequencer(&(dataTemplate->sequencer));
         if (dataTemplate->extensionList) free(dataTemplate->extensionList);
     }
     free(template->data);
+    free(template->raw);
     free(template);
 
 }  // End of removeTemplate
@@ -639,6 +699,7 @@ static inline void Process_v9_templates(exporterDomain_t *exporter, void *DataPt
         id = GET_TEMPLATE_ID(template);
         count = GET_TEMPLATE_COUNT(template);
         size_required = 4 + 4 * count;  // id + count = 4 bytes, and 2 x 2 bytes for each entry
+        void *templateRecord = template;
 
         dbg_printf("\n[%u] Template ID: %u, field count: %u\n", exporter->info.id, id, count);
         dbg_printf("template size: %u buffersize: %u\n", size_required, size_left);
@@ -728,6 +789,7 @@ static inline void Process_v9_templates(exporterDomain_t *exporter, void *DataPt
         dataTemplate->extensionList = SetupSequencer(&(dataTemplate->sequencer), sequenceTable, numSequences);
         dataTemplate->sequencer.templateID = id;
         SetFlag(template->type, DATA_TEMPLATE);
+        KeepTemplate(template, NF9_TEMPLATE_FLOWSET_ID, templateRecord, size_required);
 
 #ifdef DEVEL
         printf("Added/Updated Sequencer to template\n");
@@ -930,6 +992,7 @@ static inline void Process_v9_option_templates(exporterDomain_t *exporter, void
             return;
         }
         template->data = optionTemplate;
+        KeepTemplate(template, NF9_OPTIONS_FLOWSET_ID, option_template_flowset + 4, GET_FLOWSET_LENGTH(option_template_flowset) - 4);
 
         if ((optionTemplate->flags & SAMPLERFLAGS) == SAMPLERFLAGS) {
             dbg_printf("[%u] New Sampler information found\n", exporter->info.id);
@@ -991,6 +1054,27 @@ static inline void Process_v9_option_templates(exporterDomain_t *exporter, void
 
 }  // End of Process_v9_option_templates
 
+// flow stat and metric counters of a data flowset
+typedef struct flowsetStat_s {
+    stat_record_t stat;
+    metric_record_t metric;
+    uint32_t metricFlows;
+} flowsetStat_t;
+
+static inline void CommitFlowsetMetric(FlowSource_t *fs, flowsetStat_t *flowsetStat) {
+    UpdateMetricRecord(fs, flowsetStat->metric.exporterID, &(flowsetStat->metric));
+    memset((void *)&(flowsetStat->metric), 0, sizeof(metric_record_t));
+    flowsetStat->metricFlows = 0;
+
+}  // End of CommitFlowsetMetric
+
+static inline void CommitFlowsetStat(FlowSource_t *fs, exporterDomain_t *exporter, flowsetStat_t *flowsetStat) {
+    exporter->flows += flowsetStat->stat.numflows;
+    SumStatRecords(fs->nffile->stat_record, &(flowsetStat->stat));
+    if (flowsetStat->metricFlows) CommitFlowsetMetric(fs, flowsetStat);
+
+}  // End of CommitFlowsetStat
+
 static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowset, FlowSource_t *fs, dataTemplate_t *template) {
     int32_t size_left = GET_FLOWSET_LENGTH(data_flowset) - 4;  // -4 for data flowset header -> id and length
 
@@ -1008,6 +1092,24 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
     else
         receivedSize = ExtensionsEnabled[EXipReceivedV4ID] ? EXipReceivedV4Size : 0;
 
+    // for fixed length records, reserve space in output buffer for the entire flowset
+    size_t flowsetSize = CalcOutFlowsetSize(sequencer, size_left, sizeof(recordHeaderV3_t) + receivedSize);
+    if (flowsetSize && !IsAvailable(fs->dataBlock, flowsetSize)) {
+        // flush block - get an empty one
+        fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+    }
+    int reserved = flowsetSize && IsAvailable(fs->dataBlock, flowsetSize);
+
+    // flow stat and metric are accumulated and committed once per flowset
+    flowsetStat_t flowsetStat = {0};
+    flowsetStat.stat.firstseen = 0xFFFFFFFFFFFFFFFFLL;
+
+    // sampling of the last record processed
+    int64_t lastSamplerID = -1;
+    uint64_t packetInterval = 1;
+    uint64_t spaceInterval = 0;
+    int sampled = 0;
+
     while (size_left > 0) {
         if (size_left < 4) {  // rounding pads
             size_left = 0;
@@ -1015,10 +1117,12 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
         }
 
         // check for enough space in output buffer
-        uint32_t outRecordSize = CalcOutRecordSize(sequencer, inBuff, size_left);
-        if (!IsAvailable(fs->dataBlock, sizeof(recordHeaderV3_t) + outRecordSize + receivedSize)) {
-            // flush block - get an empty one
-            fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+        if (!reserved) {
+            uint32_t outRecordSize = CalcOutRecordSize(sequencer, inBuff, size_left);
+            if (!IsAvailable(fs->dataBlock, sizeof(recordHeaderV3_t) + outRecordSize + receivedSize)) {
+                // flush block - get an empty one
+                fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+            }
         }
 
         int buffAvail = BlockAvailable(fs->dataBlock);
@@ -1026,6 +1130,7 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
             // this should really never occur, because the buffer gets flushed earlier
             LogError("Process_v9: output buffer size error. Skip v9 record processing");
             dbg_printf("Process_v9: output buffer size error. Skip v9 record processing");
+            CommitFlowsetStat(fs, exporter, &flowsetStat);
             return;
         }
 
@@ -1055,11 +1160,13 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
                 break;
             case SEQ_ERROR:
                 LogError("Process v9: Sequencer run error. Skip record processing");
+                CommitFlowsetStat(fs, exporter, &flowsetStat);
                 return;
                 break;
             case SEQ_MEM_ERR:
-                if (buffAvail == WRITE_BUFFSIZE) {
+                if (buffAvail == (int)BlockCapacity(fs->dataBlock)) {
                     LogError("Process v9: Sequencer run error. buffer size too small");
+                    CommitFlowsetStat(fs, exporter, &flowsetStat);
                     return;
                 }
 
@@ -1067,6 +1174,7 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
                 // request new and empty buffer
                 fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
                 if (fs->dataBlock == NULL) {
+                    CommitFlowsetStat(fs, exporter, &flowsetStat);
                     return;
                 }
 
@@ -1075,6 +1183,7 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
                     // this should really never happen, because the buffer got flushed
                     LogError("Process_v9: output buffer size error. Skip v9 record processing");
                     dbg_printf("Process_v9: output buffer size error. Skip v9 record processing");
+                    CommitFlowsetStat(fs, exporter, &flowsetStat);
                     return;
                 }
                 goto REDO;
@@ -1116,57 +1225,61 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
         if (stack[STACK_ENGINE_ID]) recordHeaderV3->engineID = stack[STACK_ENGINE_ID];
 
         // handle sampling
-        uint64_t packetInterval = 1;
-        uint64_t spaceInterval = 0;
-        uint64_t intervalTotal = 0;
         // either 0 for no sampler or announced samplerID
         uint32_t sampler_id = stack[STACK_SAMPLER];
-        sampler_t *sampler = exporter->sampler;
-        sampler_t *overwriteSampler = NULL;
-        sampler_t *defaultSampler = NULL;
-        sampler_t *genericSampler = NULL;
-        while (sampler) {
-            if (sampler->record.id == sampler_id) break;
-            if (sampler->record.id == SAMPLER_OVERWRITE) overwriteSampler = sampler;
-            if (sampler->record.id == SAMPLER_DEFAULT) defaultSampler = sampler;
-            if (sampler->record.id == SAMPLER_GENERIC) genericSampler = sampler;
-            sampler = sampler->next;
+        if (sampler_id != lastSamplerID) {
+            // samplers do not change within a flowset - resolve the sampler only for a new sampler ID
+            lastSamplerID = sampler_id;
+            packetInterval = 1;
+            spaceInterval = 0;
+            sampled = 1;
+            sampler_t *sampler = exporter->sampler;
+            sampler_t *overwriteSampler = NULL;
+            sampler_t *defaultSampler = NULL;
+            sampler_t *genericSampler = NULL;
+            while (sampler) {
+                if (sampler->record.id == sampler_id) break;
+                if (sampler->record.id == SAMPLER_OVERWRITE) overwriteSampler = sampler;
+                if (sampler->record.id == SAMPLER_DEFAULT) defaultSampler = sampler;
+                if (sampler->record.id == SAMPLER_GENERIC) genericSampler = sampler;
+                sampler = sampler->next;
+            }
+
+            if (overwriteSampler) {
+                // hard overwrite sampling
+                packetInterval = overwriteSampler->record.packetInterval;
+                spaceInterval = overwriteSampler->record.spaceInterval;
+                dbg_printf("[%u] Overwrite sampling - packet interval: %llu, packet space: %llu\n", exporter->info.id, packetInterval, spaceInterval);
+            } else if (sampler) {
+                // individual assigned sampler ID
+                packetInterval = sampler->record.packetInterval;
+                spaceInterval = sampler->record.spaceInterval;
+                dbg_printf("[%u] Found assigned sampler ID %u - packet interval: %llu, packet space: %llu\n", exporter->info.id, sampler_id,
+                           packetInterval, spaceInterval);
+            } else if (genericSampler) {
+                // global sampler ID
+                packetInterval = genericSampler->record.packetInterval;
+                spaceInterval = genericSampler->record.spaceInterval;
+                dbg_printf("[%u] Found generic sampler - packet interval: %llu, packet space: %llu\n", exporter->info.id, packetInterval,
+                           spaceInterval);
+            } else if (defaultSampler) {
+                // static default sampler
+                packetInterval = defaultSampler->record.packetInterval;
+                spaceInterval = defaultSampler->record.spaceInterval;
+                dbg_printf("[%u] Found static default sampler - packet interval: %llu, packet space: %llu\n", exporter->info.id,
+                           packetInterval, spaceInterval);
+            } else {
+                sampled = 0;
+            }
         }
+        if (sampled) SetFlag(recordHeaderV3->flags, V3_FLAG_SAMPLED);
+        uint64_t intervalTotal = packetInterval + spaceInterval;
 
         EXsamplerInfo_t *samplerInfo = (EXsamplerInfo_t *)sequencer->offsetCache[EXsamplerInfoID];
         if (samplerInfo) {
             samplerInfo->exporter_sysid = exporter->info.sysid;
         }
 
-        if (overwriteSampler) {
-            // hard overwrite sampling
-            packetInterval = overwriteSampler->record.packetInterval;
-            spaceInterval = overwriteSampler->record.spaceInterval;
-            SetFlag(recordHeaderV3->flags, V3_FLAG_SAMPLED);
-            dbg_printf("[%u] Overwrite sampling - packet interval: %llu, packet space: %llu\n", exporter->info.id, packetInterval, spaceInterval);
-        } else if (sampler) {
-            // individual assigned sampler ID
-            packetInterval = sampler->record.packetInterval;
-            spaceInterval = sampler->record.spaceInterval;
-            SetFlag(recordHeaderV3->flags, V3_FLAG_SAMPLED);
-            dbg_printf("[%u] Found assigned sampler ID %u - packet interval: %llu, packet space: %llu\n", exporter->info.id, sampler_id,
-                       packetInterval, spaceInterval);
-        } else if (genericSampler) {
-            // global sampler ID
-            packetInterval = genericSampler->record.packetInterval;
-            spaceInterval = genericSampler->record.spaceInterval;
-            SetFlag(recordHeaderV3->flags, V3_FLAG_SAMPLED);
-            dbg_printf("[%u] Found generic sampler - packet interval: %llu, packet space: %llu\n", exporter->info.id, packetInterval, spaceInterval);
-        } else if (defaultSampler) {
-            // static default sampler
-            packetInterval = defaultSampler->record.packetInterval;
-            spaceInterval = defaultSampler->record.spaceInterval;
-            SetFlag(recordHeaderV3->flags, V3_FLAG_SAMPLED);
-            dbg_printf("[%u] Found static default sampler - packet interval: %llu, packet space: %llu\n", exporter->info.id, packetInterval,
-                       spaceInterval);
-        }
-        intervalTotal = packetInterval + spaceInterval;
-
         // add time received
         EXgenericFlow_t *genericFlow = sequencer->offsetCache[EXgenericFlowID];
         if (genericFlow) {
@@ -1203,9 +1316,12 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
             switch (genericFlow->proto) {
                 case IPPROTO_ICMPV6:
                 case IPPROTO_ICMP:
-                    fs->nffile->stat_record->numflows_icmp++;
-                    fs->nffile->stat_record->numpackets_icmp += genericFlow->inPackets;
-                    fs->nffile->stat_record->numbytes_icmp += genericFlow->inBytes;
+                    flowsetStat.stat.numflows_icmp++;
+                    flowsetStat.stat.numpackets_icmp += genericFlow->inPackets;
+                    flowsetStat.stat.numbytes_icmp += genericFlow->inBytes;
+                    flowsetStat.metric.numflows_icmp++;
+                    flowsetStat.metric.numpackets_icmp += genericFlow->inPackets;
+                    flowsetStat.metric.numbytes_icmp += genericFlow->inBytes;
                     // fix odd CISCO behaviour for ICMP port/type in src port
                     if (genericFlow->srcPort != 0) {
                         uint8_t *s1 = (uint8_t *)&(genericFlow->srcPort);
@@ -1224,28 +1340,38 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
                     }
                     break;
                 case IPPROTO_TCP:
-                    fs->nffile->stat_record->numflows_tcp++;
-                    fs->nffile->stat_record->numpackets_tcp += genericFlow->inPackets;
-                    fs->nffile->stat_record->numbytes_tcp += genericFlow->inBytes;
+                    flowsetStat.stat.numflows_tcp++;
+                    flowsetStat.stat.numpackets_tcp += genericFlow->inPackets;
+                    flowsetStat.stat.numbytes_tcp += genericFlow->inBytes;
+                    flowsetStat.metric.numflows_tcp++;
+                    flowsetStat.metric.numpackets_tcp += genericFlow->inPackets;
+                    flowsetStat.metric.numbytes_tcp += genericFlow->inBytes;
                     break;
                 case IPPROTO_UDP:
-                    fs->nffile->stat_record->numflows_udp++;
-                    fs->nffile->stat_record->numpackets_udp += genericFlow->inPackets;
-                    fs->nffile->stat_record->numbytes_udp += genericFlow->inBytes;
+                    flowsetStat.stat.numflows_udp++;
+                    flowsetStat.stat.numpackets_udp += genericFlow->inPackets;
+                    flowsetStat.stat.numbytes_udp += genericFlow->inBytes;
+                    flowsetStat.metric.numflows_udp++;
+                    flowsetStat.metric.numpackets_udp += genericFlow->inPackets;
+                    flowsetStat.metric.numbytes_udp += genericFlow->inBytes;
                     break;
                 default:
-                    fs->nffile->stat_record->numflows_other++;
-                    fs->nffile->stat_record->numpackets_other += genericFlow->inPackets;
-                    fs->nffile->stat_record->numbytes_other += genericFlow->inBytes;
+                    flowsetStat.stat.numflows_other++;
+                    flowsetStat.stat.numpackets_other += genericFlow->inPackets;
+                    flowsetStat.stat.numbytes_other += genericFlow->inBytes;
+                    flowsetStat.metric.numflows_other++;
+                    flowsetStat.metric.numpackets_other += genericFlow->inPackets;
+                    flowsetStat.metric.numbytes_other += genericFlow->inBytes;
             }
 
-            exporter->flows++;
-            fs->nffile->stat_record->numflows++;
-            fs->nffile->stat_record->numpackets += genericFlow->inPackets;
-            fs->nffile->stat_record->numbytes += genericFlow->inBytes;
+            flowsetStat.stat.numflows++;
+            flowsetStat.stat.numpackets += genericFlow->inPackets;
+            flowsetStat.stat.numbytes += genericFlow->inBytes;
 
             uint32_t exporterIdent = MetricExpporterID(recordHeaderV3);
-            UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
+            if (flowsetStat.metricFlows && exporterIdent != flowsetStat.metric.exporterID) CommitFlowsetMetric(fs, &flowsetStat);
+            flowsetStat.metric.exporterID = exporterIdent;
+            flowsetStat.metricFlows++;
         }
 
         EXcntFlow_t *cntFlow = sequencer->offsetCache[EXcntFlowID];
@@ -1255,8 +1381,8 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
                 cntFlow->outBytes = cntFlow->outBytes * intervalTotal / (uint64_t)packetInterval;
             }
             if (cntFlow->flows == 0) cntFlow->flows++;
-            fs->nffile->stat_record->numpackets += cntFlow->outPackets;
-            fs->nffile->stat_record->numbytes += cntFlow->outBytes;
+            flowsetStat.stat.numpackets += cntFlow->outPackets;
+            flowsetStat.stat.numbytes += cntFlow->outBytes;
         }
 
         // handle event time for NSEL/ASA and NAT
@@ -1291,22 +1417,25 @@ static inline void Process_v9_data(exporterDomain_t *exporter, void *data_flowse
             flow_record_short(stdout, recordHeaderV3);
         }
 
-        fs->dataBlock->size += recordHeaderV3->size;
-        fs->dataBlock->NumRecords++;
-
-        // buffer size sanity check
-        if (fs->dataBlock->size > WRITE_BUFFSIZE) {
-            // should never happen
-            LogError("### Software error ###: %s line %d", __FILE__, __LINE__);
-            LogError("Process v9: Output buffer overflow! Flush buffer and skip records.");
-            LogError("Buffer size: %u > %u", fs->dataBlock->size, WRITE_BUFFSIZE);
-
-            // reset buffer
-            fs->dataBlock->size = 0;
-            fs->dataBlock->NumRecords = 0;
-            return;
+        // records dropped by the ingest filter are not committed
+        if (IngestRecord(fs, recordHeaderV3, &flowsetStat.stat)) {
+            fs->dataBlock->size += recordHeaderV3->size;
+            fs->dataBlock->NumRecords++;
         }
     }
+    CommitFlowsetStat(fs, exporter, &flowsetStat);
+
+    // buffer size sanity check
+    if (fs->dataBlock->size > BlockCapacity(fs->dataBlock)) {
+        // should never happen
+        LogError("### Software error ###: %s line %d", __FILE__, __LINE__);
+        LogError("Process v9: Output buffer overflow! Flush buffer and skip records.");
+        LogError("Buffer size: %u > %u", fs->dataBlock->size, BlockCapacity(fs->dataBlock));
+
+        // reset buffer
+        fs->dataBlock->size = 0;
+        fs->dataBlock->NumRecords = 0;
+    }
 
 }  // End of Process_v9_data
 
@@ -1669,6 +1798,78 @@ static void ProcessOptionFlowset(exporterDomain_t *exporter, FlowSource_t *fs, t
     }
 }  // End of ProcessOptionFlowset
 
+// decode the pending data flowsets, whose template arrived meanwhile
+static void ProcessPending(exporterDomain_t *exporter, FlowSource_t *fs) {
+    // decode in the context of the packet of the flowset
+    struct timeval received = fs->received;
+    uint64_t boot_time = exporter->boot_time;
+
+    uint32_t count = exporter->pending.count;
+    for (uint32_t i = 0; i < count; i++) {
+        pendingFlowset_t *pending = PopPending(&exporter->pending);
+        templateList_t *template = getTemplate(exporter, pending->templateID);
+        if (!template) {
+            RequeuePending(&exporter->pending, pending);
+            continue;
+        }
+        fs->received = pending->received;
+        exporter->boot_time = pending->context;
+        if (TestFlag(template->type, DATA_TEMPLATE)) {
+            Process_v9_data(exporter, pending->data, fs, (dataTemplate_t *)template->data);
+            exporter->DataRecords++;
+        } else {
+            ProcessOptionFlowset(exporter, fs, template, pending->data);
+        }
+        free(pending);
+    }
+
+    fs->received = received;
+    exporter->boot_time = boot_time;
+
+}  // End of ProcessPending
+
+// replay the templates of the exporter domain, saved by a previous run
+static void RestoreTemplates(exporterDomain_t *exporter, FlowSource_t *fs) {
+    uint32_t size = 0;
+    void *flowsets = CachedTemplates(fs, &(exporter->info), &size);
+    if (!flowsets) return;
+
+    uint32_t numTemplates = 0;
+    void *flowset = flowsets;
+    while (size >= 4) {
+        uint16_t length = GET_FLOWSET_LENGTH(flowset);
+        if (length <= 4 || length > size) break;
+        switch (GET_FLOWSET_ID(flowset)) {
+            case NF9_TEMPLATE_FLOWSET_ID:
+                Process_v9_templates(exporter, flowset, fs);
+                break;
+            case NF9_OPTIONS_FLOWSET_ID:
+                Process_v9_option_templates(exporter, flowset, fs);
+                break;
+        }
+        numTemplates++;
+        flowset += length;
+        size -= length;
+    }
+    free(flowsets);
+
+    LogInfo("Process_v9: [%u] restored %u templates from template cache", exporter->info.id, numTemplates);
+
+}  // End of RestoreTemplates
+
+// write the templates of all v9 exporters of this flow source to the template cache
+int SaveTemplates_v9(FlowSource_t *fs, FILE *cacheFile) {
+    int numExporters = 0;
+    for (exporterDomain_t *exporter = (exporterDomain_t *)fs->exporter_data; exporter; exporter = exporter->next) {
+        if (exporter->info.version != 9) continue;
+        int ret = WriteCachedTemplates(cacheFile, &(exporter->info), exporter->template);
+        if (ret < 0) return -1;
+        numExporters += ret;
+    }
+    return numExporters;
+
+}  // End of SaveTemplates_v9
+
 void Process_v9(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
     exporterDomain_t *exporter;
     void *flowset_header;
@@ -1699,6 +1900,15 @@ void Process_v9(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
     }
     exporter->packets++;
 
+    exporter_metric_t *metric = exporter->metric;
+    uint64_t decodeStart = 0;
+    uint64_t flows = exporter->flows;
+    if (metric) {
+        decodeStart = MetricNsec();
+        ExporterCounter(metric, EXPORTER_PACKETS, 1);
+        ExporterCounter(metric, EXPORTER_BYTES, in_buff_cnt);
+    }
+
     /* calculate boot time in msec */
     v9_header->SysUptime = ntohl(v9_header->SysUptime);
     v9_header->unix_secs = ntohl(v9_header->unix_secs);
@@ -1729,6 +1939,7 @@ void Process_v9(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
         if (distance != 1) {
             exporter->sequence_failure++;
             fs->nffile->stat_record->sequence_failure++;
+            ExporterCounter(metric, EXPORTER_SEQFAILURE, 1);
             dbg_printf("[%u] Sequence error: last seq: %lli, seq %lli dist %lli\n", exporter->info.id, (long long)exporter->last_sequence,
                        (long long)exporter->sequence, (long long)distance);
         }
@@ -1742,7 +1953,7 @@ void Process_v9(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
     while (size_left) {
         uint16_t flowset_id;
         if (size_left < 4) {
-            return;
+            goto END_FUNC;
         }
 
         flowset_header = flowset_header + flowset_length;
@@ -1759,33 +1970,38 @@ void Process_v9(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
              */
             LogError("Process_v9: flowset zero length error.");
             dbg_printf("Process_v9: flowset zero length error.\n");
-            return;
+            ExporterCounter(metric, EXPORTER_DECODEERROR, 1);
+            goto END_FUNC;
         }
 
         // possible padding
         if (flowset_length <= 4) {
-            return;
+            goto END_FUNC;
         }
 
         if (flowset_length > size_left) {
             LogError("Process_v9: flowset length error. Expected bytes: %u > buffersize: %lli", flowset_length, (long long)size_left);
-            return;
+            ExporterCounter(metric, EXPORTER_DECODEERROR, 1);
+            goto END_FUNC;
         }
 
         switch (flowset_id) {
             case NF9_TEMPLATE_FLOWSET_ID:
                 exporter->TemplateRecords++;
                 Process_v9_templates(exporter, flowset_header, fs);
+                if (exporter->pending.count) ProcessPending(exporter, fs);
                 break;
             case NF9_OPTIONS_FLOWSET_ID: {
                 exporter->TemplateRecords++;
                 dbg_printf("Process option template flowset, length: %u\n", flowset_length);
                 Process_v9_option_templates(exporter, flowset_header, fs);
+                if (exporter->pending.count) ProcessPending(exporter, fs);
             } break;
             default: {
                 if (flowset_id < NF9_MIN_RECORD_FLOWSET_ID) {
                     dbg_printf("Invalid flowset id: %u\n", flowset_id);
                     LogError("Process_v9: Invalid flowset id: %u", flowset_id);
+                    ExporterCounter(metric, EXPORTER_DECODEERROR, 1);
                 } else {
                     dbg_printf("[%u] ID %u Data flowset\n", exporter->info.id, flowset_id);
                     templateList_t *template = getTemplate(exporter, flowset_id);
@@ -1796,6 +2012,10 @@ void Process_v9(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
                         } else {
                             ProcessOptionFlowset(exporter, fs, template, flowset_header);
                         }
+                    } else {
+                        ExporterCounter(metric, EXPORTER_TEMPLATEMISS, 1);
+                        // keep the flowset until its template arrives
+                        PushPending(&exporter->pending, flowset_header, flowset_length, flowset_id, exporter->boot_time, &fs->received);
                     }
                 }
             }
@@ -1806,6 +2026,10 @@ void Process_v9(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
 
     }  // End of while
 
-    return;
+END_FUNC:
+    if (metric) {
+        ExporterCounter(metric, EXPORTER_FLOWS, exporter->flows - flows);
+        ExporterDecodeTime(metric, MetricNsec() - decodeStart);
+    }
 
 } /* End of Process_v9 */
@@ -66,6 +66,7 @@
 #define _NETFLOW_V9_H 1
 
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/types.h>
 
 #include "collector.h"
@@ -310,4 +311,6 @@ int Init_v9(int verbose, int32_t sampling, char *extensionList);
 
 void Process_v9(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs);
 
+int SaveTemplates_v9(FlowSource_t *fs, FILE *cacheFile);
+
 #endif  //_NETFLOW_V9_H 1
@@ -43,6 +43,7 @@
 
 #include "bookkeeper.h"
 #include "collector.h"
+#include "ingest.h"
 #include "metric.h"
 #include "nfdump.h"
 #include "nffile.h"
@@ -51,6 +52,12 @@
 #include "output_short.h"
 #include "util.h"
 
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#else
+#include "lz4.h"
+#endif
+
 typedef struct exporter_nfd_s {
     // struct exporter_s
     struct exporter_nfd_s *next;
@@ -66,6 +73,11 @@ typedef struct exporter_nfd_s {
     sampler_t *sampler;  // list of samplers associated with this exporter
                          // end of struct exporter_s
 
+    // sequence check
+    uint32_t lastSequence;
+    // decompressed records of a batch
+    void *batchBuffer;
+
 } exporter_nfd_t;
 
 /* module limited globals */
@@ -153,17 +165,8 @@ static void *GetExtension(recordHeaderV3_t *recordHeader, int extensionID) {
 
 }  // End of GetExtension
 
-void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
-    // map pacpd data structure to input buffer
-    nfd_header_t *pcapd_header = (nfd_header_t *)in_buff;
-
-    exporter_nfd_t *exporter = getExporter(fs, pcapd_header);
-    if (!exporter) {
-        LogError("Process_nfd: NULL Exporter: Skip pcapd record processing");
-        return;
-    }
-    exporter->packets++;
-
+// process count V3 records of size bytes
+static void ProcessRecords(FlowSource_t *fs, exporter_nfd_t *exporter, void *records, ssize_t size, uint32_t count) {
     // reserve space in output stream for EXipReceivedVx
     uint32_t receivedSize = 0;
     if (fs->sa_family == PF_INET6)
@@ -172,23 +175,19 @@ void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
         receivedSize = EXipReceivedV4Size;
 
     // this many data to process
-    ssize_t size_left = in_buff_cnt;
+    ssize_t size_left = size;
 
     // time received for this packet
     uint64_t msecReceived = ((uint64_t)fs->received.tv_sec * 1000LL) + (uint64_t)((uint64_t)fs->received.tv_usec / 1000LL);
 
-    uint16_t count = ntohl(pcapd_header->numRecord);
     uint32_t numRecords = 0;
-    dbg_printf("Process nfd packet: %llu, size: %zd, recordCnt: %u\n", exporter->packets, in_buff_cnt, count);
-
-    if ((sizeof(nfd_header_t) + sizeof(recordHeaderV3_t)) > size_left) {
+    if (sizeof(recordHeaderV3_t) > size_left) {
         LogError("Process_nfd: Not enough data.");
         return;
     }
 
     // 1st record
-    recordHeaderV3_t *recordHeaderV3 = in_buff + sizeof(nfd_header_t);
-    size_left -= sizeof(nfd_header_t);
+    recordHeaderV3_t *recordHeaderV3 = records;
     do {
         // output buffer size check
         dbg_printf("Next record - type: %u, size: %u\n", recordHeaderV3->type, recordHeaderV3->size);
@@ -275,11 +274,10 @@ void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
             fs->nffile->stat_record->numbytes += genericFlow->inBytes;
 
             uint32_t exporterIdent = MetricExpporterID(recordHeaderV3);
-            UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
+            UpdateMetric(fs, exporterIdent, genericFlow);
         }
 
         numRecords++;
-        exporter->flows++;
 
         if (printRecord) {
             flow_record_short(stdout, copiedV3);
@@ -288,9 +286,12 @@ void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
         // update size_left
         size_left -= recordHeaderV3->size;
 
-        // update record block
-        fs->dataBlock->size += copiedV3->size;
-        fs->dataBlock->NumRecords++;
+        // update record block, unless dropped by the ingest filter
+        if (IngestRecord(fs, copiedV3, fs->nffile->stat_record)) {
+            exporter->flows++;
+            fs->dataBlock->size += copiedV3->size;
+            fs->dataBlock->NumRecords++;
+        }
 
         // advance input buffer to next flow record
         recordHeaderV3 = (recordHeaderV3_t *)((void *)recordHeaderV3 + recordHeaderV3->size);
@@ -300,6 +301,67 @@ void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
 
     if (numRecords != count) LogInfo("Process_nfd(): expected %u records, processd: %u", count, numRecords);
 
-    return;
+}  // End of ProcessRecords
+
+void Process_nfd(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs) {
+    // map pacpd data structure to input buffer
+    nfd_header_t *pcapd_header = (nfd_header_t *)in_buff;
+
+    exporter_nfd_t *exporter = getExporter(fs, pcapd_header);
+    if (!exporter) {
+        LogError("Process_nfd: NULL Exporter: Skip pcapd record processing");
+        return;
+    }
+    exporter->packets++;
+
+    if (in_buff_cnt < (ssize_t)sizeof(nfd_header_t)) {
+        LogError("Process_nfd: Not enough data.");
+        return;
+    }
+
+    // sequence check - packets and batches are counted per sender
+    uint32_t sequence = ntohl(pcapd_header->lastSequence);
+    if (exporter->packets > 1 && sequence != (exporter->lastSequence + 1)) {
+        fs->nffile->stat_record->sequence_failure++;
+        exporter->sequence_failure++;
+    }
+    exporter->lastSequence = sequence;
+
+    uint32_t count = ntohl(pcapd_header->numRecord);
+    dbg_printf("Process nfd packet: %llu, size: %zd, recordCnt: %u\n", exporter->packets, in_buff_cnt, count);
+
+    if (ntohs(pcapd_header->version) == NFD_PROTOCOL) {
+        ProcessRecords(fs, exporter, in_buff + sizeof(nfd_header_t), in_buff_cnt - sizeof(nfd_header_t), count);
+        return;
+    }
+
+    // LZ4 compressed batch
+    nfd_batch_header_t *batch_header = (nfd_batch_header_t *)in_buff;
+    if (in_buff_cnt <= (ssize_t)sizeof(nfd_batch_header_t)) {
+        LogError("Process_nfd: Not enough data for batch.");
+        return;
+    }
+    uint32_t rawLength = ntohl(batch_header->rawLength);
+    if (rawLength > NFD_MAXBATCH) {
+        LogError("Process_nfd: batch size error: %u", rawLength);
+        return;
+    }
+
+    if (exporter->batchBuffer == NULL) {
+        exporter->batchBuffer = malloc(NFD_MAXBATCH);
+        if (!exporter->batchBuffer) {
+            LogError("Process_nfd: malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return;
+        }
+    }
+
+    int compressedSize = in_buff_cnt - sizeof(nfd_batch_header_t);
+    int ret = LZ4_decompress_safe(in_buff + sizeof(nfd_batch_header_t), exporter->batchBuffer, compressedSize, NFD_MAXBATCH);
+    if (ret < 0 || (uint32_t)ret != rawLength) {
+        LogError("Process_nfd: LZ4 decompression of batch failed: %d", ret);
+        return;
+    }
+
+    ProcessRecords(fs, exporter, exporter->batchBuffer, rawLength, count);
 
 } /* End of Process_nfd */
@@ -37,6 +37,11 @@
 #include "collector.h"
 
 #define NFD_PROTOCOL 250
+// LZ4 compressed batch of records
+#define NFD_PROTOCOL_LZ4 251
+
+// max uncompressed size of the records of a batch
+#define NFD_MAXBATCH (256 * 1024)
 
 typedef struct nfd_header {
     uint16_t version;       // set to 250 for pcapd
@@ -46,6 +51,19 @@ typedef struct nfd_header {
     uint32_t numRecord;     // number of pcapd records in this packet
 } nfd_header_t;
 
+/*
+ * Batch of V3 records sent over a stream connection. The records of
+ * rawLength bytes are LZ4 compressed and follow the header.
+ */
+typedef struct nfd_batch_header {
+    uint16_t version;       // set to 251 for LZ4 batches
+    uint16_t length;        // Total length incl. this header. up to 65535 bytes
+    uint32_t exportTime;    // UNIX epoch export Time of flow.
+    uint32_t lastSequence;  // Incremental sequence counter modulo 2^32 of all batches
+    uint32_t numRecord;     // number of records in this batch
+    uint32_t rawLength;     // uncompressed size of the records
+} nfd_batch_header_t;
+
 /* prototypes */
 int Init_pcapd(int verbose);
 
@@ -0,0 +1,97 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "pending.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+static inline void Append(pendingList_t *list, pendingFlowset_t *pending) {
+    if (list->tail == NULL) list->tail = &(list->head);
+    pending->next = NULL;
+    *(list->tail) = pending;
+    list->tail = &(pending->next);
+    list->count++;
+    list->bytes += pending->size;
+}  // End of Append
+
+// queue a data flowset without template. Returns 0, if the flowset was dropped
+int PushPending(pendingList_t *list, const void *flowset, uint32_t size, uint16_t templateID, uint64_t context, const struct timeval *received) {
+    // drop expired flowsets
+    while (list->head && (received->tv_sec - list->head->received.tv_sec) > PENDING_MAXAGE) {
+        free(PopPending(list));
+        list->dropped++;
+    }
+
+    if ((list->bytes + size) > PENDING_MAXBYTES) {
+        list->dropped++;
+        return 0;
+    }
+
+    pendingFlowset_t *pending = malloc(sizeof(pendingFlowset_t) + size);
+    if (!pending) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    pending->received = *received;
+    pending->context = context;
+    pending->size = size;
+    pending->templateID = templateID;
+    pending->fill = 0;
+    memcpy(pending->data, flowset, size);
+    Append(list, pending);
+
+    return 1;
+
+}  // End of PushPending
+
+// returns the oldest pending flowset or NULL. The caller owns the flowset
+pendingFlowset_t *PopPending(pendingList_t *list) {
+    pendingFlowset_t *pending = list->head;
+    if (!pending) return NULL;
+
+    list->head = pending->next;
+    if (list->head == NULL) list->tail = &(list->head);
+    list->count--;
+    list->bytes -= pending->size;
+    pending->next = NULL;
+
+    return pending;
+
+}  // End of PopPending
+
+// queue a popped flowset again, which still has no template
+void RequeuePending(pendingList_t *list, pendingFlowset_t *pending) {
+    Append(list, pending);
+}  // End of RequeuePending
@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _PENDING_H
+#define _PENDING_H 1
+
+#include <stdint.h>
+#include <sys/time.h>
+
+/*
+ * Data flowsets, which arrive before their template, are kept per exporter
+ * domain and decoded, when the template arrives. The queue is bounded in age
+ * and size. Flowsets are kept in order of arrival.
+ */
+#define PENDING_MAXAGE 300            // max age of a pending flowset in seconds
+#define PENDING_MAXBYTES (512 * 1024)  // max bytes of pending flowsets per exporter domain
+
+typedef struct pendingFlowset_s {
+    struct pendingFlowset_s *next;
+    struct timeval received;  // receive time of the packet
+    uint64_t context;         // packet context - boot time (v9), export time (IPFIX)
+    uint32_t size;            // size of the flowset
+    uint16_t templateID;
+    uint16_t fill;
+    uint8_t data[];  // the flowset
+} pendingFlowset_t;
+
+typedef struct pendingList_s {
+    pendingFlowset_t *head;
+    pendingFlowset_t **tail;
+    uint32_t count;
+    uint32_t bytes;
+    uint64_t dropped;  // flowsets dropped due to age or size limit
+} pendingList_t;
+
+int PushPending(pendingList_t *list, const void *flowset, uint32_t size, uint16_t templateID, uint64_t context, const struct timeval *received);
+
+pendingFlowset_t *PopPending(pendingList_t *list);
+
+void RequeuePending(pendingList_t *list, pendingFlowset_t *pending);
+
+#endif  // _PENDING_H
@@ -0,0 +1,310 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "tplcache.h"
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "conf/nfconf.h"
+#include "ipfix.h"
+#include "netflow_v9.h"
+#include "util.h"
+
+#define TPLCACHE_PREFIX ".tplcache."
+
+// templates of the previous run, not yet claimed by an exporter
+typedef struct cachedExporter_s {
+    struct cachedExporter_s *next;
+    char *ident;
+    ip_addr_t ip;
+    uint32_t version;
+    uint32_t id;
+    uint32_t size;
+    void *flowsets;
+} cachedExporter_t;
+
+// flow sources, whose cache files are loaded
+typedef struct loadedSource_s {
+    struct loadedSource_s *next;
+    char *ident;
+} loadedSource_t;
+
+static int cacheEnabled = 0;
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static cachedExporter_t *cachedExporters = NULL;
+static loadedSource_t *loadedSources = NULL;
+
+// keep the template in wire format as a single template flowset
+void KeepTemplate(templateList_t *template, uint16_t flowsetID, const void *record, uint32_t size) {
+    if (template->raw) free(template->raw);
+    template->raw = NULL;
+    template->rawSize = 0;
+
+    // flowset length is 16 bit
+    if ((size + 4) > 0xFFFF) return;
+
+    uint8_t *raw = malloc(size + 4);
+    if (!raw) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+    uint16_t *header = (uint16_t *)raw;
+    header[0] = htons(flowsetID);
+    header[1] = htons((uint16_t)(size + 4));
+    memcpy(raw + 4, record, size);
+
+    template->raw = raw;
+    template->rawSize = size + 4;
+
+}  // End of KeepTemplate
+
+static void LoadCacheFile(char *ident, char *fileName) {
+    struct stat fstat;
+    if (stat(fileName, &fstat) < 0 || fstat.st_size < (off_t)sizeof(tplCacheHeader_t)) return;
+    if ((time(NULL) - fstat.st_mtime) > TPLCACHE_MAXAGE) {
+        LogInfo("Template cache '%s' too old - ignored", fileName);
+        return;
+    }
+
+    FILE *cacheFile = fopen(fileName, "r");
+    if (!cacheFile) {
+        LogError("fopen() '%s' failed: %s", fileName, strerror(errno));
+        return;
+    }
+
+    uint8_t *buff = malloc(fstat.st_size);
+    if (!buff) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        fclose(cacheFile);
+        return;
+    }
+    size_t size = fread(buff, 1, fstat.st_size, cacheFile);
+    fclose(cacheFile);
+
+    tplCacheHeader_t *header = (tplCacheHeader_t *)buff;
+    if (size != (size_t)fstat.st_size || header->magic != TPLCACHE_MAGIC || header->layout != TPLCACHE_LAYOUT) {
+        LogError("Template cache '%s' corrupt or wrong layout - ignored", fileName);
+        free(buff);
+        return;
+    }
+
+    uint32_t numRecords = 0;
+    size_t offset = sizeof(tplCacheHeader_t);
+    for (uint32_t i = 0; i < header->numRecords; i++) {
+        tplCacheRecord_t *record = (tplCacheRecord_t *)(buff + offset);
+        if ((offset + sizeof(tplCacheRecord_t)) > size || record->size <= sizeof(tplCacheRecord_t) || (offset + record->size) > size) {
+            LogError("Template cache '%s' truncated record %u", fileName, i);
+            break;
+        }
+        offset += record->size;
+
+        cachedExporter_t *exporter = calloc(1, sizeof(cachedExporter_t));
+        if (!exporter) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            break;
+        }
+        exporter->size = record->size - sizeof(tplCacheRecord_t);
+        exporter->flowsets = malloc(exporter->size);
+        if (!exporter->flowsets) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            free(exporter);
+            break;
+        }
+        memcpy(exporter->flowsets, (void *)record + sizeof(tplCacheRecord_t), exporter->size);
+        exporter->ident = ident;
+        exporter->ip = record->ip;
+        exporter->version = record->version;
+        exporter->id = record->id;
+        exporter->next = cachedExporters;
+        cachedExporters = exporter;
+        numRecords++;
+    }
+    free(buff);
+
+    LogInfo("Loaded templates of %u exporters from template cache '%s'", numRecords, fileName);
+
+}  // End of LoadCacheFile
+
+// load the cache files of all receive workers of a previous run
+static void LoadCache(FlowSource_t *fs) {
+    for (loadedSource_t *source = loadedSources; source; source = source->next) {
+        if (strcmp(source->ident, fs->Ident) == 0) return;
+    }
+
+    loadedSource_t *source = calloc(1, sizeof(loadedSource_t));
+    if (!source) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+    source->ident = strdup(fs->Ident);
+    source->next = loadedSources;
+    loadedSources = source;
+
+    DIR *dir = opendir(fs->datadir);
+    if (!dir) return;
+
+    char prefix[MAXPATHLEN];
+    snprintf(prefix, MAXPATHLEN, "%s%s.", TPLCACHE_PREFIX, fs->Ident);
+    size_t prefixLen = strlen(prefix);
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, prefix, prefixLen) != 0) continue;
+        // skip unfinished files
+        if (strstr(entry->d_name + prefixLen, ".tmp")) continue;
+
+        char fileName[MAXPATHLEN];
+        if (snprintf(fileName, MAXPATHLEN, "%s/%s", fs->datadir, entry->d_name) >= MAXPATHLEN) continue;
+        LoadCacheFile(source->ident, fileName);
+    }
+    closedir(dir);
+
+}  // End of LoadCache
+
+// the template cache is opt-in: templates.cache = 1 in the config file
+void InitTemplateCache(void) {
+    cacheEnabled = ConfGetValue("templates.cache") > 0;
+    if (cacheEnabled) LogInfo("Template cache enabled");
+
+}  // End of InitTemplateCache
+
+// returns the cached template flowsets of a new exporter domain or NULL
+// the caller owns the returned buffer
+void *CachedTemplates(FlowSource_t *fs, const exporter_info_record_t *info, uint32_t *size) {
+    void *flowsets = NULL;
+    if (!cacheEnabled) return NULL;
+
+    pthread_mutex_lock(&cacheMutex);
+    LoadCache(fs);
+
+    cachedExporter_t **exporter = &cachedExporters;
+    while (*exporter) {
+        cachedExporter_t *e = *exporter;
+        if (e->version == info->version && e->id == info->id && e->ip.V6[0] == info->ip.V6[0] && e->ip.V6[1] == info->ip.V6[1] &&
+            strcmp(e->ident, fs->Ident) == 0) {
+            // each exporter claims its templates once
+            *exporter = e->next;
+            flowsets = e->flowsets;
+            *size = e->size;
+            free(e);
+            break;
+        }
+        exporter = &(e->next);
+    }
+    pthread_mutex_unlock(&cacheMutex);
+
+    return flowsets;
+
+}  // End of CachedTemplates
+
+// write the templates of an exporter domain. Returns 1 if written, 0 if no templates, -1 on error
+int WriteCachedTemplates(FILE *cacheFile, const exporter_info_record_t *info, const templateList_t *templateList) {
+    uint32_t size = 0;
+    for (const templateList_t *template = templateList; template; template = template->next) size += template->rawSize;
+    if (size == 0) return 0;
+
+    tplCacheRecord_t record = {
+        .size = sizeof(tplCacheRecord_t) + size,
+        .version = info->version,
+        .sa_family = info->sa_family,
+        .id = info->id,
+        .ip = info->ip,
+    };
+    if (fwrite(&record, sizeof(record), 1, cacheFile) != 1) return -1;
+    for (const templateList_t *template = templateList; template; template = template->next) {
+        if (template->rawSize && fwrite(template->raw, template->rawSize, 1, cacheFile) != 1) return -1;
+    }
+
+    return 1;
+
+}  // End of WriteCachedTemplates
+
+// save the templates of all v9 and IPFIX exporters of all flow sources
+int SaveTemplateCache(FlowSource_t *sourceList, uint32_t worker) {
+    int ok = 1;
+    if (!cacheEnabled) return ok;
+
+    for (FlowSource_t *fs = sourceList; fs; fs = fs->next) {
+        if (!fs->exporter_data) continue;
+
+        char fileName[MAXPATHLEN], tmpName[MAXPATHLEN];
+        if (snprintf(fileName, MAXPATHLEN, "%s/%s%s.%u", fs->datadir, TPLCACHE_PREFIX, fs->Ident, worker) >= MAXPATHLEN ||
+            snprintf(tmpName, MAXPATHLEN, "%s.tmp", fileName) >= MAXPATHLEN) {
+            LogError("Template cache path too long: %s", fs->datadir);
+            ok = 0;
+            continue;
+        }
+
+        FILE *cacheFile = fopen(tmpName, "w");
+        if (!cacheFile) {
+            LogError("fopen() '%s' failed: %s", tmpName, strerror(errno));
+            ok = 0;
+            continue;
+        }
+
+        // header is updated with the number of records at the end
+        tplCacheHeader_t header = {.magic = TPLCACHE_MAGIC, .layout = TPLCACHE_LAYOUT};
+        int err = fwrite(&header, sizeof(header), 1, cacheFile) != 1;
+        int v9 = err ? 0 : SaveTemplates_v9(fs, cacheFile);
+        int ipfix = err ? 0 : SaveTemplates_IPFIX(fs, cacheFile);
+        if (v9 < 0 || ipfix < 0) err = 1;
+        header.numRecords = err ? 0 : v9 + ipfix;
+        if (!err && (fseek(cacheFile, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, cacheFile) != 1)) err = 1;
+        if (fclose(cacheFile) != 0) err = 1;
+
+        if (err) {
+            LogError("Failed to write template cache '%s': %s", tmpName, strerror(errno));
+            unlink(tmpName);
+            ok = 0;
+        } else if (header.numRecords == 0) {
+            // no templates - no cache
+            unlink(tmpName);
+            unlink(fileName);
+        } else if (rename(tmpName, fileName) < 0) {
+            LogError("rename() '%s' failed: %s", tmpName, strerror(errno));
+            unlink(tmpName);
+            ok = 0;
+        }
+    }
+
+    return ok;
+
+}  // End of SaveTemplateCache
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _TPLCACHE_H
+#define _TPLCACHE_H 1
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "collector.h"
+#include "exporter.h"
+#include "fnf.h"
+
+/*
+ * Template cache
+ * If enabled with templates.cache = 1 in the [nfcapd] section of the config file,
+ * the templates of all v9 and IPFIX exporters of a flow source are saved with
+ * each file rotation in the data directory of the flow source. After a restart,
+ * a new exporter domain gets its templates of the previous run replayed, so data
+ * flowsets are decoded, before the exporter resends its templates.
+ * Templates are stored in wire format as received, one flowset per template.
+ *
+ * File: <datadir>/.tplcache.<ident>.<worker>
+ *   tplCacheHeader_t
+ *   tplCacheRecord_t + template flowsets, for each exporter domain
+ */
+#define TPLCACHE_MAGIC 0x43545046
+#define TPLCACHE_LAYOUT 1
+
+// cache files older than this are ignored - templates may have changed meanwhile
+#define TPLCACHE_MAXAGE 3600
+
+typedef struct tplCacheHeader_s {
+    uint32_t magic;
+    uint16_t layout;
+    uint16_t fill;
+    uint32_t numRecords;
+    uint32_t fill2;
+} tplCacheHeader_t;
+
+typedef struct tplCacheRecord_s {
+    uint32_t size;       // size of the record incl. all flowsets
+    uint16_t version;    // 9 or 10
+    uint16_t sa_family;  // exporter address family
+    uint32_t id;         // source ID/observation domain
+    uint32_t fill;
+    ip_addr_t ip;  // exporter IP
+    // template flowsets follow
+} tplCacheRecord_t;
+
+void InitTemplateCache(void);
+
+void KeepTemplate(templateList_t *template, uint16_t flowsetID, const void *record, uint32_t size);
+
+void *CachedTemplates(FlowSource_t *fs, const exporter_info_record_t *info, uint32_t *size);
+
+int WriteCachedTemplates(FILE *cacheFile, const exporter_info_record_t *info, const templateList_t *templateList);
+
+int SaveTemplateCache(FlowSource_t *sourceList, uint32_t worker);
+
+#endif  // _TPLCACHE_H
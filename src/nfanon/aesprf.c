@@ -0,0 +1,168 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "aesprf.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AESNI 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_neon.h>
+#define ARMAES 1
+#endif
+
+#include "cpufeature.h"
+
+// blocks encrypted interleaved - hides the latency of the aes instructions
+#define INTERLEAVE 8
+
+#define ROUNDS 10
+
+// expanded AES-128 key - ROUNDS + 1 round keys in FIPS-197 byte order
+static uint8_t roundKey[ROUNDS + 1][16];
+static int hwAES = 0;
+
+static inline uint8_t rotl8(uint8_t x, int shift) { return (uint8_t)((x << shift) | (x >> (8 - shift))); }
+
+// generate the AES sbox
+static void SBox(uint8_t *sbox) {
+    uint8_t p = 1, q = 1;
+    do {
+        // multiply p by 3
+        p = p ^ (uint8_t)(p << 1) ^ (p & 0x80 ? 0x1B : 0);
+
+        // divide q by 3
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80) q ^= 0x09;
+
+        // affine transformation
+        sbox[p] = q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4) ^ 0x63;
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+}  // End of SBox
+
+// FIPS-197 AES-128 key expansion
+static void KeyExpansion(const uint8_t *key) {
+    uint8_t sbox[256];
+    SBox(sbox);
+
+    uint8_t *w = (uint8_t *)roundKey;
+    memcpy(w, key, 16);
+    uint8_t rcon = 1;
+    for (int i = 4; i < 4 * (ROUNDS + 1); i++) {
+        uint8_t t[4];
+        memcpy(t, w + 4 * (i - 1), 4);
+        if ((i & 3) == 0) {
+            uint8_t t0 = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[t0];
+            rcon = (uint8_t)(rcon << 1) ^ (rcon & 0x80 ? 0x1B : 0);
+        }
+        for (int j = 0; j < 4; j++) w[4 * i + j] = w[4 * (i - 4) + j] ^ t[j];
+    }
+
+}  // End of KeyExpansion
+
+#ifdef AESNI
+
+__attribute__((target("aes,sse2"))) static void EncryptAESNI(const uint8_t *input, uint8_t *output, int numBlocks) {
+    __m128i rk[ROUNDS + 1];
+    for (int r = 0; r <= ROUNDS; r++) rk[r] = _mm_loadu_si128((const __m128i *)roundKey[r]);
+
+    int i = 0;
+    for (; (i + INTERLEAVE) <= numBlocks; i += INTERLEAVE) {
+        __m128i b[INTERLEAVE];
+        for (int j = 0; j < INTERLEAVE; j++) b[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(input + 16 * (i + j))), rk[0]);
+        for (int r = 1; r < ROUNDS; r++)
+            for (int j = 0; j < INTERLEAVE; j++) b[j] = _mm_aesenc_si128(b[j], rk[r]);
+        for (int j = 0; j < INTERLEAVE; j++) _mm_storeu_si128((__m128i *)(output + 16 * (i + j)), _mm_aesenclast_si128(b[j], rk[ROUNDS]));
+    }
+    for (; i < numBlocks; i++) {
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(input + 16 * i)), rk[0]);
+        for (int r = 1; r < ROUNDS; r++) b = _mm_aesenc_si128(b, rk[r]);
+        _mm_storeu_si128((__m128i *)(output + 16 * i), _mm_aesenclast_si128(b, rk[ROUNDS]));
+    }
+
+}  // End of EncryptAESNI
+
+#endif
+
+#ifdef ARMAES
+
+// vaeseq_u8 adds the round key before SubBytes/ShiftRows - the last key is xored
+__attribute__((target("+crypto"))) static void EncryptARM(const uint8_t *input, uint8_t *output, int numBlocks) {
+    uint8x16_t rk[ROUNDS + 1];
+    for (int r = 0; r <= ROUNDS; r++) rk[r] = vld1q_u8(roundKey[r]);
+
+    int i = 0;
+    for (; (i + INTERLEAVE) <= numBlocks; i += INTERLEAVE) {
+        uint8x16_t b[INTERLEAVE];
+        for (int j = 0; j < INTERLEAVE; j++) b[j] = vld1q_u8(input + 16 * (i + j));
+        for (int r = 0; r < ROUNDS - 1; r++)
+            for (int j = 0; j < INTERLEAVE; j++) b[j] = vaesmcq_u8(vaeseq_u8(b[j], rk[r]));
+        for (int j = 0; j < INTERLEAVE; j++) vst1q_u8(output + 16 * (i + j), veorq_u8(vaeseq_u8(b[j], rk[ROUNDS - 1]), rk[ROUNDS]));
+    }
+    for (; i < numBlocks; i++) {
+        uint8x16_t b = vld1q_u8(input + 16 * i);
+        for (int r = 0; r < ROUNDS - 1; r++) b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+        vst1q_u8(output + 16 * i, veorq_u8(vaeseq_u8(b, rk[ROUNDS - 1]), rk[ROUNDS]));
+    }
+
+}  // End of EncryptARM
+
+#endif
+
+int AESPRF_Init(const uint8_t *key) {
+    hwAES = 0;
+#if defined(AESNI) || defined(ARMAES)
+    hwAES = CPUKernel(KERNEL_AESPRF);
+#endif
+    if (hwAES) KeyExpansion(key);
+    return hwAES;
+
+}  // End of AESPRF_Init
+
+void AESPRF_Encrypt(const uint8_t *input, uint8_t *output, int numBlocks) {
+#ifdef AESNI
+    EncryptAESNI(input, output, numBlocks);
+#endif
+#ifdef ARMAES
+    EncryptARM(input, output, numBlocks);
+#endif
+
+}  // End of AESPRF_Encrypt
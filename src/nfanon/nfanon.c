@@ -55,17 +55,25 @@
 #include "nffile.h"
 #include "nfxV3.h"
 #include "panonymizer.h"
+#include "queue.h"
 #include "util.h"
 
 #define MAXANONWORKERS 8
 
+// blocks in flight per worker
+#define BLOCKSPERWORKER 2
+
+// block in flight - seq is the position in the output file
+typedef struct anonBlock_s {
+    dataBlock_t *dataBlock;
+    uint64_t seq;
+    int done;
+} anonBlock_t;
+
 typedef struct worker_param_s {
     int self;
-    int numWorkers;
-    dataBlock_t **dataBlock;
-
-    // sync barrier
-    pthread_control_barrier_t *barrier;
+    queue_t *workQueue;  // blocks to anonymize - shared by all workers
+    queue_t *doneQueue;  // anonymized blocks - in any order
 } worker_param_t;
 
 /* Function Prototypes */
@@ -73,7 +81,7 @@ static void usage(char *name);
 
 static inline void AnonRecord(recordHeaderV3_t *v3Record);
 
-static void process_data(char *wfile, int verbose, worker_param_t **workerList, int numWorkers, pthread_control_barrier_t *barrier);
+static void process_data(char *wfile, int verbose, queue_t *workQueue, queue_t *doneQueue, int numWorkers);
 
 /* Functions */
 
@@ -215,39 +223,96 @@ static inline void AnonRecord(recordHeaderV3_t *v3Record) {
 
 }  // End of AnonRecord
 
-static void process_data(char *wfile, int verbose, worker_param_t **workerList, int numWorkers, pthread_control_barrier_t *barrier) {
+// anonymize all records of a block
+static void AnonBlock(dataBlock_t *dataBlock) {
+    if (dataBlock->type != DATA_BLOCK_TYPE_2 && dataBlock->type != DATA_BLOCK_TYPE_3) return;
+
+    uint32_t recordCount = 0;
+    record_header_t *record_ptr = GetCursor(dataBlock);
+    uint32_t sumSize = 0;
+    for (int i = 0; i < dataBlock->NumRecords; i++) {
+        if ((sumSize + record_ptr->size) > dataBlock->size || (record_ptr->size < sizeof(record_header_t))) {
+            LogError("Corrupt data file. Inconsistent block size in %s line %d\n", __FILE__, __LINE__);
+            return;
+        }
+        sumSize += record_ptr->size;
+        recordCount++;
+
+        switch (record_ptr->type) {
+            case V3Record:
+                AnonRecord((recordHeaderV3_t *)record_ptr);
+                break;
+            case ExporterInfoRecordType:
+            case ExporterStatRecordType:
+            case SamplerRecordType:
+            case NbarRecordType:
+                // Silently skip exporter/sampler records
+                break;
+
+            default: {
+                LogError("Skip unknown record: %u type %i", recordCount, record_ptr->type);
+            }
+        }
+        // Advance pointer by number of bytes for netflow record
+        record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+
+    }  // for all records
+
+}  // End of AnonBlock
+
+// collect the next anonymized block and write all blocks, which are ready, in sequence order
+static void WriteAnonBlocks(nffile_t *nffile_w, queue_t *doneQueue, anonBlock_t *window, uint32_t windowSize, uint64_t *nextWrite) {
+    anonBlock_t *anonBlock = queue_pop(doneQueue);
+    if (anonBlock == QUEUE_CLOSED) return;
+    anonBlock->done = 1;
+
+    anonBlock = &window[*nextWrite % windowSize];
+    while (anonBlock->done && anonBlock->seq == *nextWrite) {
+        FlushBlock(nffile_w, anonBlock->dataBlock);
+        anonBlock->dataBlock = NULL;
+        anonBlock->done = 0;
+        (*nextWrite)++;
+        anonBlock = &window[*nextWrite % windowSize];
+    }
+
+}  // End of WriteAnonBlocks
+
+static void process_data(char *wfile, int verbose, queue_t *workQueue, queue_t *doneQueue, int numWorkers) {
     const char spinner[4] = {'|', '/', '-', '\\'};
-    char *outFile = NULL;
-    char *cfile = NULL;
+    char outFile[MAXPATHLEN];
+    char cfile[MAXPATHLEN];
 
     int cnt = 1;
     nffile_t *nffile_r = NewFile(NULL);
     nffile_t *nffile_w = NULL;
 
-    dataBlock_t *nextBlock = NULL;
-    dataBlock_t *dataBlock = NULL;
-    // map datablock for workers - all workers
-    // process thesame block but different records
-    for (int i = 0; i < numWorkers; i++) {
-        // set new datablock for all workers
-        workerList[i]->dataBlock = &dataBlock;
+    // blocks are anonymized by any worker in any order. The window holds the
+    // blocks in flight, and they are written back in the order they were read
+    uint32_t windowSize = BLOCKSPERWORKER * numWorkers;
+    anonBlock_t *window = calloc(windowSize, sizeof(anonBlock_t));
+    if (!window) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        DisposeFile(nffile_r);
+        return;
     }
+    uint64_t seq = 0;
+    uint64_t nextWrite = 0;
 
-    // wait for workers ready to start
-    pthread_controller_wait(barrier);
-
+    dataBlock_t *dataBlock = NULL;
     int blk_count = 0;
     int done = 0;
     while (!done) {
-        // get next data block
-        dataBlock = nextBlock;
         if (dataBlock == NULL) {
             // nffile_w is NULL for 1st entry in while loop
             if (nffile_w) {
+                // write all blocks in flight of this file
+                while (nextWrite < seq) WriteAnonBlocks(nffile_w, doneQueue, window, windowSize, &nextWrite);
                 CloseUpdateFile(nffile_w);
+                DisposeFile(nffile_w);
+                nffile_w = NULL;
                 if (wfile == NULL && rename(outFile, cfile) < 0) {
                     LogError("rename() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-                    return;
+                    break;
                 }
             }
 
@@ -257,38 +322,40 @@ static void process_data(char *wfile, int verbose, worker_param_t **workerList,
                 continue;
             }
 
-            char *cfile = nffile_r->fileName;
-            if (!cfile) {
+            if (!nffile_r->fileName) {
                 LogError("(NULL) input file name error in %s line %d\n", __FILE__, __LINE__);
                 CloseFile(nffile_r);
-                DisposeFile(nffile_r);
-                return;
+                break;
             }
+            strncpy(cfile, nffile_r->fileName, MAXPATHLEN - 1);
+            cfile[MAXPATHLEN - 1] = '\0';
             if (verbose) printf(" %i Processing %s\r", cnt++, cfile);
 
-            char pathBuff[MAXPATHLEN];
             if (wfile == NULL) {
                 // prepare output file
-                snprintf(pathBuff, MAXPATHLEN - 1, "%s-tmp", cfile);
-                pathBuff[MAXPATHLEN - 1] = '\0';
-                outFile = pathBuff;
+                int len = snprintf(outFile, MAXPATHLEN, "%s-tmp", cfile);
+                if (len < 0 || len >= MAXPATHLEN) {
+                    // skip this file - a truncated name could be renamed over another file
+                    LogError("File name too long. Skip file: %s", cfile);
+                    continue;
+                }
             } else {
-                outFile = wfile;
+                strncpy(outFile, wfile, MAXPATHLEN - 1);
             }
+            outFile[MAXPATHLEN - 1] = '\0';
 
             nffile_w = OpenNewFile(outFile, NULL, CREATOR_NFANON, FILE_COMPRESSION(nffile_r), NOT_ENCRYPTED);
             if (!nffile_w) {
                 // can not create output file
                 CloseFile(nffile_r);
-                DisposeFile(nffile_r);
-                return;
+                break;
             }
 
             SetIdent(nffile_w, FILE_IDENT(nffile_r));
             memcpy((void *)nffile_w->stat_record, (void *)nffile_r->stat_record, sizeof(stat_record_t));
 
             // read first block from next file
-            nextBlock = ReadBlock(nffile_r, NULL);
+            dataBlock = ReadBlock(nffile_r, NULL);
             continue;
         }
 
@@ -299,33 +366,33 @@ static void process_data(char *wfile, int verbose, worker_param_t **workerList,
 
         if (dataBlock->type != DATA_BLOCK_TYPE_2 && dataBlock->type != DATA_BLOCK_TYPE_3) {
             LogError("Can't process block type %u. Write block unmodified", dataBlock->type);
-            dataBlock = WriteBlock(nffile_w, dataBlock);
-            nextBlock = ReadBlock(nffile_r, NULL);
-            continue;
         }
 
-        dbg_printf("Next block: %d, Records: %u\n", blk_count, dataBlock->NumRecords);
-        // release workers from barrier
-        pthread_control_barrier_release(barrier);
-
-        // prefetch next block
-        nextBlock = ReadBlock(nffile_r, NULL);
+        // wait for a free slot in the window
+        while ((seq - nextWrite) >= windowSize) WriteAnonBlocks(nffile_w, doneQueue, window, windowSize, &nextWrite);
 
-        // wait for all workers, work done on previous block
-        pthread_controller_wait(barrier);
+        dbg_printf("Next block: %d, Records: %u\n", blk_count, dataBlock->NumRecords);
+        anonBlock_t *anonBlock = &window[seq % windowSize];
+        anonBlock->dataBlock = dataBlock;
+        anonBlock->seq = seq++;
+        anonBlock->done = 0;
+        queue_push(workQueue, anonBlock);
 
-        // write modified block
-        FlushBlock(nffile_w, dataBlock);
+        // read next block, while workers anonymize
+        dataBlock = ReadBlock(nffile_r, NULL);
 
     }  // while
 
-    // done! - signal all workers to terminate
-    dataBlock = NULL;
-    pthread_control_barrier_release(barrier);
+    // done! - write remaining blocks and signal all workers to terminate
+    if (nffile_w) {
+        while (nextWrite < seq) WriteAnonBlocks(nffile_w, doneQueue, window, windowSize, &nextWrite);
+        CloseUpdateFile(nffile_w);
+        DisposeFile(nffile_w);
+    }
+    queue_close(workQueue);
 
-    FreeDataBlock(dataBlock);
+    free(window);
     DisposeFile(nffile_r);
-    DisposeFile(nffile_w);
 
     if (verbose) LogError("Processed %i files", --cnt);
 
@@ -333,68 +400,22 @@ static void process_data(char *wfile, int verbose, worker_param_t **workerList,
 
 __attribute__((noreturn)) static void *worker(void *arg) {
     worker_param_t *worker_param = (worker_param_t *)arg;
-
-    uint32_t self = worker_param->self;
-    uint32_t numWorkers = worker_param->numWorkers;
-
-    // wait in barrier after launch
-    pthread_control_barrier_wait(worker_param->barrier);
-
-    while (*(worker_param->dataBlock)) {
-        dataBlock_t *dataBlock = *(worker_param->dataBlock);
-        dbg_printf("Worker %i working on %p\n", self, dataBlock);
-
-        uint32_t recordCount = 0;
-
-        record_header_t *record_ptr = GetCursor(dataBlock);
-        uint32_t sumSize = 0;
-        for (int i = 0; i < dataBlock->NumRecords; i++) {
-            if ((sumSize + record_ptr->size) > dataBlock->size || (record_ptr->size < sizeof(record_header_t))) {
-                LogError("Corrupt data file. Inconsistent block size in %s line %d\n", __FILE__, __LINE__);
-                goto SKIP;
-            }
-            sumSize += record_ptr->size;
-
-            // check, if this is our record
-            if ((i % numWorkers) == self) {
-                // our record - work on it
-                recordCount++;
-
-                // work on our record
-                switch (record_ptr->type) {
-                    case V3Record:
-                        AnonRecord((recordHeaderV3_t *)record_ptr);
-                        break;
-                    case ExporterInfoRecordType:
-                    case ExporterStatRecordType:
-                    case SamplerRecordType:
-                    case NbarRecordType:
-                        // Silently skip exporter/sampler records
-                        break;
-
-                    default: {
-                        LogError("Skip unknown record: %u type %i", recordCount, record_ptr->type);
-                    }
-                }
-            }
-            // Advance pointer by number of bytes for netflow record
-            record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
-
-        }  // for all records
-
-        dbg_printf("Worker %i: datablock completed. Records processed: %u\n", self, recordCount);
-
-    SKIP:
-        // Done
-        // wait in barrier for next data record
-        pthread_control_barrier_wait(worker_param->barrier);
+    PinWorker();
+
+    // anonymize whole blocks independently of the other workers
+    anonBlock_t *anonBlock;
+    while ((anonBlock = queue_pop(worker_param->workQueue)) != QUEUE_CLOSED) {
+        dbg_printf("Worker %i working on %p\n", worker_param->self, anonBlock->dataBlock);
+        AnonBlock(anonBlock->dataBlock);
+        queue_push(worker_param->doneQueue, anonBlock);
     }
 
+    PAnonymizer_FreeCache();
     dbg_printf("Worker %d done.\n", worker_param->self);
     pthread_exit(NULL);
 }  // End of worker
 
-static worker_param_t **LauchWorkers(pthread_t *tid, int numWorkers, pthread_control_barrier_t *barrier) {
+static worker_param_t **LauchWorkers(pthread_t *tid, int numWorkers, queue_t *workQueue, queue_t *doneQueue) {
     if (numWorkers > MAXWORKERS) {
         LogError("LaunchWorkers: number of worker: %u > max workers: %u", numWorkers, MAXWORKERS);
         return NULL;
@@ -407,10 +428,9 @@ static worker_param_t **LauchWorkers(pthread_t *tid, int numWorkers, pthread_con
         worker_param_t *worker_param = calloc(1, sizeof(worker_param_t));
         if (!worker_param) NULL;
 
-        worker_param->barrier = barrier;
         worker_param->self = i;
-        worker_param->dataBlock = NULL;
-        worker_param->numWorkers = numWorkers;
+        worker_param->workQueue = workQueue;
+        worker_param->doneQueue = doneQueue;
         workerList[i] = worker_param;
 
         int err = pthread_create(&(tid[i]), NULL, worker, (void *)worker_param);
@@ -502,12 +522,16 @@ int main(int argc, char **argv) {
     // check numWorkers depending on cores online
     numWorkers = GetNumWorkers(numWorkers);
 
-    pthread_control_barrier_t *barrier = pthread_control_barrier_init(numWorkers);
-    if (!barrier) exit(255);
+    // queues hold all blocks in flight
+    size_t queueSize = 1;
+    while (queueSize < (BLOCKSPERWORKER * numWorkers)) queueSize <<= 1;
+    queue_t *workQueue = queue_init(queueSize);
+    queue_t *doneQueue = queue_init(queueSize);
+    if (!workQueue || !doneQueue) exit(255);
 
     pthread_t tid[MAXWORKERS] = {0};
     dbg_printf("Launch Workers\n");
-    worker_param_t **workerList = LauchWorkers(tid, numWorkers, barrier);
+    worker_param_t **workerList = LauchWorkers(tid, numWorkers, workQueue, doneQueue);
     if (!workerList) {
         LogError("Failed to launch workers");
         exit(255);
@@ -515,10 +539,13 @@ int main(int argc, char **argv) {
 
     // make stdout unbuffered for progress pointer
     setvbuf(stdout, (char *)NULL, _IONBF, 0);
-    process_data(wfile, verbose, workerList, numWorkers, barrier);
+    process_data(wfile, verbose, workQueue, doneQueue, numWorkers);
 
     WaitWorkersDone(tid, numWorkers);
-    pthread_control_barrier_destroy(barrier);
+    // all workers are gone - no more anonymized blocks
+    queue_close(doneQueue);
+    queue_free(workQueue);
+    queue_free(doneQueue);
 
     return 0;
 }
@@ -85,9 +85,54 @@
 
 #include "panonymizer.h"
 
+#include "aesprf.h"
+
 static uint8_t m_key[16];  // 128 bit secret key
 static uint8_t m_pad[16];  // 128 bit secret pad
 
+/*
+ * Prefix preserving caches
+ * The pad bit at position pos depends only on the first pos bits of the address.
+ * The pad bits of a /16 and /24 IPv4 resp. /48 and /64 IPv6 prefix are therefore
+ * cached, and only the remaining bits need to be encrypted. A direct mapped
+ * cache of full addresses skips the encryption of recurring addresses.
+ * Each worker thread has its own caches - no locking required.
+ */
+#define V4FULLBITS 16
+#define V4PREFIXBITS 16
+#define V6FULLBITS 14
+#define V6PREFIXBITS 14
+
+typedef struct v4Entry_s {
+    uint32_t key;  // address or prefix
+    uint32_t value;
+    uint32_t valid;
+} v4Entry_t;
+
+typedef struct v6Entry_s {
+    uint64_t key[2];  // address or prefix
+    uint64_t value[2];
+    uint64_t valid;
+} v6Entry_t;
+
+typedef struct anonCache_s {
+    // IPv4
+    uint32_t prefix16[1 << 16];  // pad bits 0..15, bit 0 = valid
+    v4Entry_t prefix24[1 << V4PREFIXBITS];
+    v4Entry_t v4Full[1 << V4FULLBITS];
+    // IPv6
+    v6Entry_t prefix48[1 << V6PREFIXBITS];
+    v6Entry_t prefix64[1 << V6PREFIXBITS];
+    v6Entry_t v6Full[1 << V6FULLBITS];
+} anonCache_t;
+
+static _Thread_local anonCache_t *anonCache = NULL;
+
+// AES hardware support for the pseudorandom function
+static int hwPRF = 0;
+
+static inline uint32_t cacheHash(uint64_t key, int bits) { return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits)); }
+
 // Init
 void PAnonymizer_Init(uint8_t *key) {
     // initialize the 128-bit secret key.
@@ -96,8 +141,18 @@ void PAnonymizer_Init(uint8_t *key) {
     Rijndael_init(ECB, Encrypt, key, Key16Bytes, NULL);
     // initialize the 128-bit secret pad. The pad is encrypted before being used for padding.
     Rijndael_blockEncrypt(key + 16, 128, m_pad);
+    // use AES instructions of the CPU, if available
+    hwPRF = AESPRF_Init(key);
 }
 
+// encrypt numBlocks independent blocks - the hardware path encrypts them interleaved
+static inline void PRFEncrypt(const uint8_t *input, uint8_t *output, int numBlocks) {
+    if (hwPRF)
+        AESPRF_Encrypt(input, output, numBlocks);
+    else
+        Rijndael_blockEncrypt(input, 128 * numBlocks, output);
+}  // End of PRFEncrypt
+
 int ParseCryptoPAnKey(char *s, char *key) {
     int i, j;
     char numstr[3];
@@ -135,22 +190,34 @@ int ParseCryptoPAnKey(char *s, char *key) {
 
 }  // End of ParseCryptoPAnKey
 
-// Anonymization function
-uint32_t anonymize(const uint32_t orig_addr) {
-    uint8_t rin_output[16];
-    uint8_t rin_input[16];
+// lazy allocate the caches of this thread. NULL, if no memory - anonymize uncached
+static anonCache_t *GetAnonCache(void) {
+    if (anonCache == NULL) anonCache = calloc(1, sizeof(anonCache_t));
+    return anonCache;
+
+}  // End of GetAnonCache
+
+void PAnonymizer_FreeCache(void) {
+    free(anonCache);
+    anonCache = NULL;
+
+}  // End of PAnonymizer_FreeCache
+
+// compute the pad bits from position from up to position to - 1 of orig_addr
+static uint32_t anonymizePad(const uint32_t orig_addr, int from, int to) {
+    uint8_t rin_output[32][16];
+    uint8_t rin_input[32][16];
 
     uint32_t result = 0;
     uint32_t first4bytes_pad, first4bytes_input;
     int pos;
 
-    memcpy(rin_input, m_pad, 16);
     first4bytes_pad = (((uint32_t)m_pad[0]) << 24) + (((uint32_t)m_pad[1]) << 16) + (((uint32_t)m_pad[2]) << 8) + (uint32_t)m_pad[3];
 
     // For each prefixes with length from 0 to 31, generate a bit using the Rijndael cipher,
     // which is used as a pseudorandom function here. The bits generated in every rounds
     // are combineed into a pseudorandom one-time-pad.
-    for (pos = 0; pos <= 31; pos++) {
+    for (pos = from; pos < to; pos++) {
         // Padding: The most significant pos bits are taken from orig_addr. The other 128-pos
         // bits are taken from m_pad. The variables first4bytes_pad and first4bytes_input are used
         // to handle the annoying byte order problem.
@@ -159,59 +226,153 @@ uint32_t anonymize(const uint32_t orig_addr) {
         } else {
             first4bytes_input = ((orig_addr >> (32 - pos)) << (32 - pos)) | ((first4bytes_pad << pos) >> pos);
         }
-        rin_input[0] = (uint8_t)(first4bytes_input >> 24);
-        rin_input[1] = (uint8_t)((first4bytes_input << 8) >> 24);
-        rin_input[2] = (uint8_t)((first4bytes_input << 16) >> 24);
-        rin_input[3] = (uint8_t)((first4bytes_input << 24) >> 24);
+        uint8_t *input = rin_input[pos - from];
+        memcpy(input, m_pad, 16);
+        input[0] = (uint8_t)(first4bytes_input >> 24);
+        input[1] = (uint8_t)((first4bytes_input << 8) >> 24);
+        input[2] = (uint8_t)((first4bytes_input << 16) >> 24);
+        input[3] = (uint8_t)((first4bytes_input << 24) >> 24);
+    }
+
+    // Encryption: The Rijndael cipher is used as pseudorandom function. The inputs of all
+    // rounds are independent and encrypted at once. Only the first bit of rin_output is used.
+    PRFEncrypt((uint8_t *)rin_input, (uint8_t *)rin_output, to - from);
+
+    // Combination: the bits are combined into a pseudorandom one-time-pad
+    for (pos = from; pos < to; pos++) result |= (rin_output[pos - from][0] >> 7) << (31 - pos);
+    return result;
+
+}  // End of anonymizePad
 
-        // Encryption: The Rijndael cipher is used as pseudorandom function. During each
-        // round, only the first bit of rin_output is used.
-        Rijndael_blockEncrypt(rin_input, 128, rin_output);
+// Anonymization function
+uint32_t anonymize(const uint32_t orig_addr) {
+    anonCache_t *cache = GetAnonCache();
+    if (cache == NULL) return anonymizePad(orig_addr, 0, 32) ^ orig_addr;
 
-        // Combination: the bits are combined into a pseudorandom one-time-pad
-        result |= (rin_output[0] >> 7) << (31 - pos);
+    v4Entry_t *full = &cache->v4Full[cacheHash(orig_addr, V4FULLBITS)];
+    if (full->valid && full->key == orig_addr) return full->value;
+
+    // pad bits 0..15 of the /16 prefix
+    uint32_t pad = cache->prefix16[orig_addr >> 16];
+    if (pad & 1) {
+        pad &= 0xFFFF0000;
+    } else {
+        pad = anonymizePad(orig_addr, 0, 16);
+        cache->prefix16[orig_addr >> 16] = pad | 1;
     }
+
+    // pad bits 16..23 of the /24 prefix
+    uint32_t prefix = orig_addr & 0xFFFFFF00;
+    v4Entry_t *entry = &cache->prefix24[cacheHash(prefix, V4PREFIXBITS)];
+    if (entry->valid == 0 || entry->key != prefix) {
+        entry->key = prefix;
+        entry->value = anonymizePad(orig_addr, 16, 24);
+        entry->valid = 1;
+    }
+    pad |= entry->value;
+
+    // host bits
+    pad |= anonymizePad(orig_addr, 24, 32);
+
     // XOR the original address with the pseudorandom one-time-pad
-    return result ^ orig_addr;
-}
+    full->key = orig_addr;
+    full->value = pad ^ orig_addr;
+    full->valid = 1;
+    return full->value;
 
-/* little endian CPU's are boring! - but give it a try
- * orig_addr is a ptr to memory, return by inet_pton for IPv6
- * anon_addr return the result in the same order
- */
-void anonymize_v6(const uint64_t orig_addr[2], uint64_t *anon_addr) {
-    uint8_t rin_output[16], *orig_bytes, *result;
-    uint8_t rin_input[16];
+}  // End of anonymize
 
-    int pos, i, bit_num, left_byte;
+// compute the pad bits from position from up to position to - 1 of orig_bytes into result
+static void anonymizePad_v6(const uint8_t *orig_bytes, int from, int to, uint8_t *result) {
+    uint8_t rin_output[128][16];
+    uint8_t rin_input[128][16];
 
-    anon_addr[0] = anon_addr[1] = 0;
-    result = (uint8_t *)anon_addr;
-    orig_bytes = (uint8_t *)orig_addr;
+    int pos, i, bit_num, left_byte;
 
     // For each prefixes with length from 0 to 127, generate a bit using the Rijndael cipher,
     // which is used as a pseudorandom function here. The bits generated in every rounds
     // are combineed into a pseudorandom one-time-pad.
-    for (pos = 0; pos <= 127; pos++) {
+    for (pos = from; pos < to; pos++) {
         bit_num = pos & 0x7;
         left_byte = (pos >> 3);
 
+        uint8_t *input = rin_input[pos - from];
         for (i = 0; i < left_byte; i++) {
-            rin_input[i] = orig_bytes[i];
+            input[i] = orig_bytes[i];
         }
-        rin_input[left_byte] = orig_bytes[left_byte] >> (7 - bit_num) << (7 - bit_num) | (m_pad[left_byte] << bit_num) >> bit_num;
+        input[left_byte] = orig_bytes[left_byte] >> (7 - bit_num) << (7 - bit_num) | (m_pad[left_byte] << bit_num) >> bit_num;
         for (i = left_byte + 1; i < 16; i++) {
-            rin_input[i] = m_pad[i];
+            input[i] = m_pad[i];
         }
+    }
+
+    // Encryption: The Rijndael cipher is used as pseudorandom function. The inputs of all
+    // rounds are independent and encrypted at once. Only the first bit of rin_output is used.
+    PRFEncrypt((uint8_t *)rin_input, (uint8_t *)rin_output, to - from);
+
+    // Combination: the bits are combined into a pseudorandom one-time-pad
+    for (pos = from; pos < to; pos++) result[pos >> 3] |= (rin_output[pos - from][0] >> 7) << (pos & 0x7);
+
+}  // End of anonymizePad_v6
+
+/* little endian CPU's are boring! - but give it a try
+ * orig_addr is a ptr to memory, return by inet_pton for IPv6
+ * anon_addr return the result in the same order
+ */
+void anonymize_v6(const uint64_t orig_addr[2], uint64_t *anon_addr) {
+    uint64_t pad[2] = {0, 0};
+    uint8_t *result = (uint8_t *)pad;
+    const uint8_t *orig_bytes = (const uint8_t *)orig_addr;
+
+    anonCache_t *cache = GetAnonCache();
+    if (cache == NULL) {
+        anonymizePad_v6(orig_bytes, 0, 128, result);
+        anon_addr[0] = pad[0] ^ orig_addr[0];
+        anon_addr[1] = pad[1] ^ orig_addr[1];
+        return;
+    }
+
+    v6Entry_t *full = &cache->v6Full[cacheHash(orig_addr[0] ^ (orig_addr[1] * 0xC2B2AE3D27D4EB4FULL), V6FULLBITS)];
+    if (full->valid && full->key[0] == orig_addr[0] && full->key[1] == orig_addr[1]) {
+        anon_addr[0] = full->value[0];
+        anon_addr[1] = full->value[1];
+        return;
+    }
 
-        // Encryption: The Rijndael cipher is used as pseudorandom function. During each
-        // round, only the first bit of rin_output is used.
-        Rijndael_blockEncrypt(rin_input, 128, rin_output);
+    // pad bytes 0..5 of the /48 prefix
+    uint64_t prefix = 0;
+    memcpy((void *)&prefix, orig_bytes, 6);
+    v6Entry_t *entry = &cache->prefix48[cacheHash(prefix, V6PREFIXBITS)];
+    if (entry->valid == 0 || entry->key[0] != prefix) {
+        entry->key[0] = prefix;
+        entry->value[0] = 0;
+        anonymizePad_v6(orig_bytes, 0, 48, (uint8_t *)entry->value);
+        entry->valid = 1;
+    }
+    pad[0] = entry->value[0];
 
-        // Combination: the bits are combined into a pseudorandom one-time-pad
-        result[left_byte] |= (rin_output[0] >> 7) << bit_num;
+    // pad bytes 6..7 of the /64 prefix
+    prefix = orig_addr[0];
+    entry = &cache->prefix64[cacheHash(prefix, V6PREFIXBITS)];
+    if (entry->valid == 0 || entry->key[0] != prefix) {
+        entry->key[0] = prefix;
+        entry->value[0] = 0;
+        anonymizePad_v6(orig_bytes, 48, 64, (uint8_t *)entry->value);
+        entry->valid = 1;
     }
+    pad[0] |= entry->value[0];
+
+    // interface identifier
+    anonymizePad_v6(orig_bytes, 64, 128, result);
+
     // XOR the original address with the pseudorandom one-time-pad
-    anon_addr[0] ^= orig_addr[0];
-    anon_addr[1] ^= orig_addr[1];
-}
+    anon_addr[0] = pad[0] ^ orig_addr[0];
+    anon_addr[1] = pad[1] ^ orig_addr[1];
+
+    full->key[0] = orig_addr[0];
+    full->key[1] = orig_addr[1];
+    full->value[0] = anon_addr[0];
+    full->value[1] = anon_addr[1];
+    full->valid = 1;
+
+}  // End of anonymize_v6
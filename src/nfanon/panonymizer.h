@@ -93,4 +93,7 @@ uint32_t anonymize(const uint32_t orig_addr);
 
 void anonymize_v6(const uint64_t orig_addr[2], uint64_t *anon_addr);
 
+// free the prefix caches of the calling thread
+void PAnonymizer_FreeCache(void);
+
 #endif  //_PANONYMIZER_H_
@@ -35,8 +35,11 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -49,6 +52,7 @@
 #include <sys/uio.h>
 #include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "config.h"
 
@@ -56,11 +60,14 @@
 #include "pcap_reader.h"
 #endif
 
+#include "barrier.h"
 #include "bookkeeper.h"
 #include "collector.h"
 #include "conf/nfconf.h"
+#include "cpufeature.h"
 #include "daemon.h"
 #include "flist.h"
+#include "ingest.h"
 #include "ipfix.h"
 #include "launch.h"
 #include "metric.h"
@@ -75,7 +82,14 @@
 #include "nfxV3.h"
 #include "pidfile.h"
 #include "privsep.h"
+#include "profiler.h"
+#include "publish.h"
+#include "queue.h"
 #include "repeater.h"
+#include "rollup.h"
+#include "shmring.h"
+#include "streamrecv.h"
+#include "tplcache.h"
 #include "util.h"
 #include "version.h"
 
@@ -99,6 +113,81 @@ static int verbose = 0;
 // Define a generic type to get data from socket or pcap file
 typedef ssize_t (*packet_function_t)(int, void *, size_t, int, struct sockaddr *, socklen_t *);
 
+// receive worker on its own SO_REUSEPORT socket
+typedef struct worker_s {
+    pthread_t tid;
+    uint32_t id;
+    int socket;
+    int final;                  // worker did its last rotation
+    FlowSource_t *FlowSource;  // private clones of all flow sources
+
+    // run() parameters
+    int rfd;
+    time_t twin;
+    time_t t_begin;
+    char *time_extension;
+    int compress;
+} worker_t;
+
+#ifndef PCAP
+// number of datagrams buffered between the packet thread and the decoder
+#define PACKET_QUEUE_SIZE 16384
+
+// datagram or sync marker queued by the packet thread
+typedef struct packet_s {
+    ssize_t size;  // 0 for a sync marker, -1 for a flush tick
+    int final;     // sync marker of the last time slot
+    uint32_t drops;  // sync marker: datagrams dropped by the kernel in this time slot
+    struct timeval received;
+    socklen_t senderSize;
+    struct sockaddr_storage sender;
+    uint8_t data[];
+} packet_t;
+
+// packet thread receiving datagrams of a socket
+typedef struct packetParam_s {
+    pthread_t tid;
+    int socket;
+    queue_t *packetQueue;
+    time_t twin;
+    time_t t_start;
+    int dropWarn;   // warn, if this percentage of datagrams is dropped
+    int maxBuffer;  // grow the receive buffer up to maxBuffer bytes on drops
+    int flushTick;  // queue a flush tick for each receive timeout
+    _Atomic int stop;
+    // IPFIX streams over TCP or SCTP - the messages are queued with the datagrams
+    streamReceiver_t *streamReceiver;
+    pthread_t streamTid;
+} packetParam_t;
+
+// listening sockets of IPFIX streams
+#define STREAM_TCP 1
+#define STREAM_SCTP 2
+static int streamSockets[MAXSTREAMSOCKETS];
+static uint32_t numStreamSockets = 0;
+#endif
+
+#ifdef PCAP
+// datagram of a pcap file, loaded into memory for the benchmark
+typedef struct benchPacket_s {
+    struct sockaddr_storage sender;
+    socklen_t senderSize;
+    uint32_t exporter;  // index in the benchStat list
+    ssize_t size;
+    uint8_t data[];
+} benchPacket_t;
+
+// decode cost of an exporter in benchmark mode
+typedef struct benchStat_s {
+    char exporter[INET6_ADDRSTRLEN];
+    FlowSource_t *fs;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t records;
+    uint64_t nsec;
+} benchStat_t;
+#endif
+
 /* module limited globals */
 static FlowSource_t *FlowSource;
 
@@ -106,6 +195,15 @@ static int done = 0;
 static int periodic_trigger;
 static int gotSIGCHLD = 0;
 
+// synchronise file rotation of all receive workers
+static pthread_control_barrier_t *rotateBarrier = NULL;
+static pthread_mutex_t rotateMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t repeaterMutex = PTHREAD_MUTEX_INITIALIZER;
+// datagrams to the repeater
+static shmRing_t *repeaterRing = NULL;
+static uint64_t repeaterDropped = 0;
+static _Atomic int stopWorkers = 0;
+
 /* Local function Prototypes */
 static void usage(char *name);
 
@@ -113,9 +211,10 @@ static void signalPrivsepChild(pid_t child_pid, int pfd);
 
 static void IntHandler(int signal);
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss);
+static inline FlowSource_t *GetFlowSource(FlowSource_t *FlowSource, struct sockaddr_storage *ss);
 
-static void run(packet_function_t receive_packet, int socket, int pfd, int rfd, time_t twin, time_t t_begin, char *time_extension, int compress);
+static void run(packet_function_t receive_packet, int socket, FlowSource_t **sourceList, worker_t *worker, int pfd, int rfd, time_t twin,
+                time_t t_begin, char *time_extension, int compress);
 
 /* Functions */
 static void usage(char *name) {
@@ -128,10 +227,16 @@ static void usage(char *name) {
         "-b host\t\tbind socket to host/IP addr\n"
         "-J mcastgroup\tJoin multicast group <mcastgroup>\n"
         "-p portnum\tlisten on port portnum\n"
+#ifndef PCAP
+        "-O tcp,sctp\tAccept IPFIX streams over TCP and/or SCTP on the listen port.\n"
+#endif
 #ifdef PCAP
         "-f pcapfile\tRead network data from pcap file.\n"
         "-d device\tRead network data from device (interface).\n"
+        "-K loops[:null]\tBenchmark: decode the pcap file -f loops times at max speed.\n"
+        "\t\tWith :null the flows are written to /dev/null.\n"
 #endif
+        "-r file\t\tImport the export messages of an IPFIX file or a raw v9/v5 message dump and exit.\n"
         "-w flowdir \tset the output directory to store the flows.\n"
         "-C <file>\tRead optional config file.\n"
         "-S subdir\tSub directory format. see nfcapd(1) for format\n"
@@ -145,11 +250,17 @@ static void usage(char *name) {
         "-A\t\tEnable source address spoofing for packet repeater -R.\n"
         "-s rate\tset default sampling rate (default 1)\n"
         "-x process\tlaunch process after a new file becomes available\n"
+        "-L socket\tPublish the flow blocks on a unix socket for live queries: nfdump -r socket.\n"
+        "-G dir\t\tWrite a rollup file of the aggregated flows of each file into dir.\n"
+        "-a <aggr>\tRollup aggregation. Default " ROLLUPDEFAULT "\n"
         "-W workers\toptionally set the number of workers to compress flows\n"
+        "-N num\t\tReceive flows with num workers on the same port.\n"
         "-z=lzo\t\tLZO compress flows in output file.\n"
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
+        "-z=zstd:auto\tAdapt the compression level to the load. Also lz4:auto.\n"
+        "-k\t\tSort the flows of each block by exporter, proto and dst address for better compression.\n"
         "-B bufflen\tSet socket buffer to bufflen bytes\n"
         "-e\t\tExpire data at each cycle.\n"
         "-D\t\tFork to background\n"
@@ -158,6 +269,7 @@ static void usage(char *name) {
         "-4\t\tListen on IPv4 (default).\n"
         "-6\t\tListen on IPv6.\n"
         "-X <extlist>\t',' separated list of extensions (numbers). Default all extensions.\n"
+        "-F filter\tStore only flows matching the nfdump filter.\n"
         "-V\t\tPrint version and exit.\n"
         "-Z\t\tAdd timezone offset to filename.\n",
         name);
@@ -237,6 +349,23 @@ static void ChildDied(void) {
 
 static int SendRepeaterMessage(int fd, void *in_buff, size_t cnt, struct sockaddr_storage *sender, socklen_t sender_size) {
     message_t message;
+
+    if (repeaterRing) {
+        int ret = ShmRingPush(repeaterRing, in_buff, cnt, sender, sender_size);
+        if (ret == SHMRING_FULL) {
+            // never block the collector - drop the datagram
+            if ((repeaterDropped++ & 0xFFFF) == 0) LogError("Repeater ring full - dropped %llu datagrams", (unsigned long long)repeaterDropped);
+        } else if (ret == SHMRING_WAKEUP) {
+            message.type = PRIVMSG_RING;
+            message.length = sizeof(message_t);
+            if (write(fd, &message, sizeof(message_t)) < 0) {
+                LogError("Failed to send repeater message: %s", strerror(errno));
+                return errno;
+            }
+        }
+        return 0;
+    }
+
     message.type = PRIVMSG_REPEAT;
     message.length = cnt + sizeof(message_t);
 
@@ -270,20 +399,291 @@ static int SendRepeaterMessage(int fd, void *in_buff, size_t cnt, struct sockadd
     return 0;
 }  // End of SendRepeaterMessage
 
-static void run(packet_function_t receive_packet, int socket, int pfd, int rfd, time_t twin, time_t t_begin, char *time_extension, int compress) {
+#ifndef PCAP
+// queue a sync marker, to rotate the files of the time slot
+static int PushSyncMarker(queue_t *packetQueue, int final, uint32_t drops) {
+    packet_t *packet = calloc(1, sizeof(packet_t));
+    if (!packet) {
+        LogError("calloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    packet->final = final;
+    packet->drops = drops;
+    gettimeofday(&packet->received, NULL);
+    queue_push(packetQueue, packet);
+    return 1;
+
+}  // End of PushSyncMarker
+
+// queue a flush tick, so the decoder flushes aged data blocks of an idle socket
+static void PushFlushTick(queue_t *packetQueue) {
+    packet_t *packet = calloc(1, sizeof(packet_t));
+    if (!packet) {
+        LogError("calloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+    packet->size = -1;
+    gettimeofday(&packet->received, NULL);
+    queue_push(packetQueue, packet);
+
+}  // End of PushFlushTick
+
+// warn about the datagrams dropped by the kernel in a time slot and grow the receive buffer
+static void CheckDrops(packetParam_t *packetParam, uint32_t drops, uint64_t packets) {
+    double rate = 100.0 * (double)drops / (double)(drops + packets);
+    if (rate >= packetParam->dropWarn) {
+        LogError("Socket %d: %u datagrams dropped by the kernel in this time slot (%.2f%%)", packetParam->socket, drops, rate);
+    }
+
+    if (packetParam->maxBuffer == 0) return;
+    int size = GrowReceiveBuffer(packetParam->socket, packetParam->maxBuffer);
+    if (size) {
+        LogInfo("Socket %d: receive buffer increased to %d bytes", packetParam->socket, size);
+    } else {
+        // warn only once
+        LogError("Socket %d: receive buffer can not grow any further. Check -B, receive.maxbuffer and the system limit",
+                 packetParam->socket);
+        packetParam->maxBuffer = 0;
+    }
+
+}  // End of CheckDrops
+
+/*
+ * The packet thread only receives the datagrams and queues them for the decoder.
+ * At the end of each time slot a sync marker is queued, so the decoder rotates the
+ * files in its own thread, while the packet thread keeps receiving.
+ */
+static void *packetThread(void *arg) {
+    packetParam_t *packetParam = (packetParam_t *)arg;
+    queue_t *packetQueue = packetParam->packetQueue;
+    time_t t_start = packetParam->t_start;
+
+    recvBatch_t *recvBatch = NewRecvBatch(packetParam->socket, NETWORK_INPUT_BUFF_SIZE);
+    if (!recvBatch) {
+        PushSyncMarker(packetQueue, 1, 0);
+        queue_close(packetQueue);
+        pthread_exit(NULL);
+    }
+
+    // wake up at least once a second, to check the time slot
+    struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+    if (setsockopt(packetParam->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
+        LogError("setsockopt(SO_RCVTIMEO) error: %s", strerror(errno));
+    }
+
+    // kernel drops and datagrams received in the current time slot
+    uint32_t lastDrops = 0;
+    uint64_t slotPackets = 0;
+    while (!packetParam->stop) {
+        void *in_buff = NULL;
+        struct sockaddr_storage nf_sender;
+        socklen_t nf_sender_size = sizeof(nf_sender);
+        ssize_t cnt = RecvBatchPacket(recvBatch, &in_buff, &nf_sender, &nf_sender_size);
+
+        gettimeofday(&tv, NULL);
+        if (cnt >= 0) {
+            packet_t *packet = malloc(sizeof(packet_t) + cnt);
+            if (!packet) {
+                LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                exit(255);
+            }
+            packet->size = cnt;
+            packet->final = 0;
+            packet->received = tv;
+            packet->senderSize = nf_sender_size;
+            memcpy((void *)&packet->sender, (void *)&nf_sender, nf_sender_size);
+            memcpy(packet->data, in_buff, cnt);
+            queue_push(packetQueue, packet);
+            slotPackets++;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            LogError("recvfrom() error in '%s', line '%d', cnt: %d:, %s", __FILE__, __LINE__, cnt, strerror(errno));
+        } else if (packetParam->flushTick && errno != EINTR) {
+            PushFlushTick(packetQueue);
+        }
+
+        // end of time slot, or we are done
+        int final = done;
+        if (((tv.tv_sec - t_start) >= packetParam->twin) || final) {
+            uint32_t drops = RecvBatchDrops(recvBatch) - lastDrops;
+            lastDrops += drops;
+            if (drops) CheckDrops(packetParam, drops, slotPackets);
+            slotPackets = 0;
+            if (!PushSyncMarker(packetQueue, final, drops)) final = 1;
+            if (final) break;
+            t_start += packetParam->twin;
+        }
+    }
+
+    FreeRecvBatch(recvBatch);
+    queue_close(packetQueue);
+    pthread_exit(NULL);
+
+}  // End of packetThread
+
+// queue an IPFIX message of a stream connection - the message buffer becomes the packet
+static void QueueStreamMessage(void *buff, size_t size, struct sockaddr_storage *sender, socklen_t senderSize, void *arg) {
+    packetParam_t *packetParam = (packetParam_t *)arg;
+    packet_t *packet = (packet_t *)buff;
+    packet->size = size;
+    packet->final = 0;
+    packet->drops = 0;
+    gettimeofday(&packet->received, NULL);
+    packet->senderSize = senderSize;
+    memcpy((void *)&packet->sender, (void *)sender, senderSize);
+    queue_push(packetParam->packetQueue, packet);
+}  // End of QueueStreamMessage
+
+static void *streamThread(void *arg) {
+    packetParam_t *packetParam = (packetParam_t *)arg;
+
+    RunStreamReceiver(packetParam->streamReceiver, &packetParam->stop);
+    queue_close(packetParam->packetQueue);
+    pthread_exit(NULL);
+
+}  // End of streamThread
+
+static packetParam_t *StartPacketThread(int socket, time_t twin, time_t t_start, int withStreams) {
+    packetParam_t *packetParam = calloc(1, sizeof(packetParam_t));
+    queue_t *packetQueue = queue_init(PACKET_QUEUE_SIZE);
+    if (!packetParam || !packetQueue) {
+        LogError("calloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(packetParam);
+        return NULL;
+    }
+
+    packetParam->socket = socket;
+    packetParam->packetQueue = packetQueue;
+    packetParam->twin = twin;
+    packetParam->t_start = t_start;
+    packetParam->dropWarn = ConfGetValue("receive.dropwarn");
+    packetParam->maxBuffer = ConfGetValue("receive.maxbuffer");
+    packetParam->flushTick = ConfGetValue("maxblockage") > 0;
+    atomic_init(&packetParam->stop, 0);
+
+    // the message buffers of the streams are queued as packets
+    if (withStreams && numStreamSockets) {
+        packetParam->streamReceiver =
+            NewStreamReceiver(streamSockets, numStreamSockets, offsetof(packet_t, data), QueueStreamMessage, (void *)packetParam);
+        if (!packetParam->streamReceiver) {
+            queue_free(packetQueue);
+            free(packetParam);
+            return NULL;
+        }
+        // the queue is closed, when the packet thread and the stream thread are done
+        queue_producers(packetQueue, 2);
+    }
+
+    int err = pthread_create(&packetParam->tid, NULL, packetThread, (void *)packetParam);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        FreeStreamReceiver(packetParam->streamReceiver);
+        queue_free(packetQueue);
+        free(packetParam);
+        return NULL;
+    }
+    if (packetParam->streamReceiver) {
+        err = pthread_create(&packetParam->streamTid, NULL, streamThread, (void *)packetParam);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            // continue without streams
+            FreeStreamReceiver(packetParam->streamReceiver);
+            packetParam->streamReceiver = NULL;
+            queue_close(packetQueue);
+        }
+    }
+    char queueName[32];
+    snprintf(queueName, sizeof(queueName), "packet-%d", socket);
+    MetricQueue(queueName, packetQueue);
+
+    return packetParam;
+
+}  // End of StartPacketThread
+
+static void StopPacketThread(packetParam_t *packetParam) {
+    atomic_store(&packetParam->stop, 1);
+
+    // discard all datagrams not yet decoded, until the packet thread closes the queue
+    void *packet;
+    while ((packet = queue_pop(packetParam->packetQueue)) != QUEUE_CLOSED) free(packet);
+
+    pthread_join(packetParam->tid, NULL);
+    if (packetParam->streamReceiver) {
+        pthread_join(packetParam->streamTid, NULL);
+        FreeStreamReceiver(packetParam->streamReceiver);
+    }
+    MetricUnregisterQueue(packetParam->packetQueue);
+    queue_free(packetParam->packetQueue);
+    free(packetParam);
+
+}  // End of StopPacketThread
+#endif
+
+// decode one datagram of flow source fs
+static void ProcessPacket(void *in_buff, ssize_t cnt, FlowSource_t *fs) {
+    /* check for too little data - cnt must be > 0 at this point */
+    if (cnt < (ssize_t)sizeof(common_flow_header_t)) {
+        LogError("Ident: %s, Data size error: not enough data for netflow header - cnt: %i", fs->Ident, (int)cnt);
+        fs->bad_packets++;
+        return;
+    }
+
+    /* Process data - have a look at the common header */
+    common_flow_header_t *nf_header = (common_flow_header_t *)in_buff;
+    uint16_t version = ntohs(nf_header->version);
+    switch (version) {
+        case 1:
+            Process_v1(in_buff, cnt, fs);
+            break;
+        case 5:  // fall through
+        case 7:
+            Process_v5_v7(in_buff, cnt, fs);
+            break;
+        case 9:
+            Process_v9(in_buff, cnt, fs);
+            break;
+        case 10:
+            Process_IPFIX(in_buff, cnt, fs);
+            break;
+        case NFD_PROTOCOL:
+        case NFD_PROTOCOL_LZ4:
+            Process_nfd(in_buff, cnt, fs);
+            break;
+        default:
+            // data error, while reading data from socket
+            LogError("Ident: %s, Error reading netflow header: Unexpected netflow version %i", fs->Ident, version);
+            fs->bad_packets++;
+    }
+    // each Process_xx function has to process the entire input buffer, therefore it's empty now.
+
+}  // End of ProcessPacket
+
+// write the partially filled data blocks of all sources to their files
+static void FlushDataBlocks(FlowSource_t *fs) {
+    while (fs) {
+        if (fs->nffile && fs->dataBlock && fs->dataBlock->NumRecords) fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+        fs = fs->next;
+    }
+}  // End of FlushDataBlocks
+
+static void run(packet_function_t receive_packet, int socket, FlowSource_t **sourceList, worker_t *worker, int pfd, int rfd, time_t twin,
+                time_t t_begin, char *time_extension, int compress) {
     struct sockaddr_storage nf_sender;
     socklen_t nf_sender_size = sizeof(nf_sender);
 
+#ifdef PCAP
     void *in_buff = malloc(NETWORK_INPUT_BUFF_SIZE);
     if (!in_buff) {
         LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return;
     }
-
-    common_flow_header_t *nf_header = (common_flow_header_t *)in_buff;
+#else
+    // datagrams are received by the packet thread
+    void *in_buff = NULL;
+    packet_t *packet = NULL;
+#endif
 
     // Init each netflow source output data buffer
-    FlowSource_t *fs = FlowSource;
+    FlowSource_t *fs = *sourceList;
     while (fs) {
         // prepare file
         fs->nffile = OpenNewFile(fs->current, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
@@ -291,6 +691,7 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
             return;
         }
         SetIdent(fs->nffile, fs->Ident);
+        PrepareNewFile(fs->nffile);
 
         // init flow source
         fs->dataBlock = WriteBlock(fs->nffile, NULL);
@@ -307,10 +708,29 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
     periodic_trigger = 0;
     ssize_t cnt = 0;
     uint32_t ignored_packets = 0;
+    uint32_t dropped_packets = 0;
     uint64_t packets = 0;
+    int failed = 0;
+
+    // max age in seconds of a partially filled data block, until it is flushed to the file
+    // so readers following the file see the flows in time. 0: blocks are flushed when full
+    time_t maxBlockAge = ConfGetValue("maxblockage");
+    time_t lastFlush = t_start;
+
+#ifndef PCAP
+    // IPFIX streams are received by the first worker
+    packetParam_t *packetParam = StartPacketThread(socket, twin, t_begin, worker == NULL || worker->id == 0);
+    if (!packetParam) return;
+
+    // shed load, if the datagrams queued for the decoder exceed overload.backlog percent of the queue
+    int overloadBacklog = ConfGetValue("overload.backlog");
+    size_t overloadHigh = overloadBacklog > 0 && overloadBacklog <= 100 ? (size_t)overloadBacklog * PACKET_QUEUE_SIZE / 100 : 0;
+    int overloaded = 0;
+#endif
 
     // wake up at least at next time slot (twin) + 1s
-    alarm(t_start + twin + 1 - time(NULL));
+    // receive workers wake up by the socket receive timeout
+    if (!worker) alarm(t_start + twin + 1 - time(NULL));
     /*
      * Main processing loop:
      * this loop, continues until  = 1, set by the signal handler
@@ -319,10 +739,11 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
      */
     while (1) {
         struct timeval tv;
+        int rotate = 0;
 
+#ifdef PCAP
         /* read next bunch of data into begin of input buffer */
         if (!done) {
-#ifdef PCAP
             // Debug code to read from pcap file, or from socket
             cnt = receive_packet(socket, in_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&nf_sender, &nf_sender_size);
 
@@ -333,12 +754,9 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
                 packets++;
                 continue;
             }
-#else
-            cnt = recvfrom(socket, in_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&nf_sender, &nf_sender_size);
-#endif
 
             if (cnt == -1) {
-                if (errno != EINTR) {
+                if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
                     LogError("recvfrom() error in '%s', line '%d', cnt: %d:, %s", __FILE__, __LINE__, cnt, strerror(errno));
                     continue;
                 }
@@ -349,27 +767,108 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
 
         /* Periodic file renaming, if time limit reached or if we are done.  */
         gettimeofday(&tv, NULL);
+        rotate = ((tv.tv_sec - t_start) >= twin) || done;
+#else
+        // next datagram or sync marker of the packet thread
+        free(packet);
+        packet = queue_pop(packetParam->packetQueue);
+        if (packet == QUEUE_CLOSED || packet->size == 0) {
+            if (packet != QUEUE_CLOSED) dropped_packets += packet->drops;
+            // periodic file renaming
+            if (packet == QUEUE_CLOSED || packet->final) done = 1;
+            if (packet == QUEUE_CLOSED) packet = NULL;
+            gettimeofday(&tv, NULL);
+            rotate = 1;
+            cnt = -1;
+        } else if (packet->size < 0) {
+            // flush tick of an idle socket
+            tv = packet->received;
+            cnt = -1;
+        } else {
+            cnt = packet->size;
+            in_buff = packet->data;
+            memcpy((void *)&nf_sender, (void *)&packet->sender, packet->senderSize);
+            nf_sender_size = packet->senderSize;
+            tv = packet->received;
+            packets++;
+
+            // check the decoder backlog every 64 datagrams
+            if (overloadHigh && (packets & 0x3F) == 0) {
+                size_t backlog = queue_length(packetParam->packetQueue);
+                if (!overloaded && backlog >= overloadHigh) {
+                    overloaded = 1;
+                    SetOverload(1);
+                    LogError("Decoder backlog: %zu datagrams - start load shedding", backlog);
+                } else if (overloaded && backlog <= (overloadHigh >> 2)) {
+                    overloaded = 0;
+                    SetOverload(0);
+                    LogInfo("Decoder backlog: %zu datagrams - stop load shedding", backlog);
+                }
+            }
+        }
+#endif
         time_t t_now = tv.tv_sec;
 
-        if (((t_now - t_start) >= twin) || done) {
+        if (rotate) {
             // rotate cycle
-            alarm(0);
+            int final = done;
+            if (worker) {
+                // workers append to the same files
+                pthread_mutex_lock(&rotateMutex);
+                int ok = RotateFlowFiles(t_start, time_extension, *sourceList, final);
+                pthread_mutex_unlock(&rotateMutex);
+                if (ok == 0) {
+                    // terminate all workers
+                    done = 1;
+                    final = 1;
+                }
+            } else {
+                alarm(0);
 
-            if (RotateFlowFiles(t_start, time_extension, FlowSource, done) == 0) {
-                return;
-            }
+                if (RotateFlowFiles(t_start, time_extension, *sourceList, done) == 0) {
+                    failed = 1;
+                    break;
+                }
 
-            if (pfd && TriggerLauncher(t_start, time_extension, pfd, FlowSource) == 0) {
-                LogError("Disable launcher due to errors");
-                close(pfd);
-                pfd = 0;
+                if (pfd && TriggerLauncher(t_start, time_extension, pfd, *sourceList) == 0) {
+                    LogError("Disable launcher due to errors");
+                    close(pfd);
+                    pfd = 0;
+                }
             }
 
-            LogInfo("Total packets received: %llu avg: %3.2f ignored packets: %u", packets, (double)packets / (double)twin, ignored_packets);
+            // persist the templates of all v9/IPFIX exporters for a restart
+            SaveTemplateCache(*sourceList, worker ? worker->id : 0);
+
+            if (worker) {
+                LogInfo("Worker %u: Total packets received: %llu avg: %3.2f ignored packets: %u dropped packets: %u", worker->id, packets,
+                        (double)packets / (double)twin, ignored_packets, dropped_packets);
+            } else {
+                LogInfo("Total packets received: %llu avg: %3.2f ignored packets: %u dropped packets: %u", packets, (double)packets / (double)twin,
+                        ignored_packets, dropped_packets);
+            }
+            uint64_t shedRecords = OverloadShedRecords();
+            if (shedRecords) LogError("Load shedding dropped %llu records in this time slot", (unsigned long long)shedRecords);
             ignored_packets = 0;
+            dropped_packets = 0;
             periodic_trigger = 0;
 
-            if (done) break;
+            if (worker) {
+                // wait for all workers to finish this time slot
+                worker->final = final;
+                pthread_control_barrier_wait(rotateBarrier);
+                if (final) break;
+                if (stopWorkers) {
+                    // other workers terminated - close the files of the next slot
+                    t_start += twin;
+                    pthread_mutex_lock(&rotateMutex);
+                    RotateFlowFiles(t_start, time_extension, *sourceList, 1);
+                    pthread_mutex_unlock(&rotateMutex);
+                    break;
+                }
+            } else if (done) {
+                break;
+            }
 
             /*
              * update alarm for next cycle
@@ -379,7 +878,13 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
              * - t_now = difference value to now
              */
             t_start += twin;
-            alarm(t_start + twin + 1 - t_now);
+            if (!worker) alarm(t_start + twin + 1 - t_now);
+        }
+
+        // flush partially filled data blocks, which are older than maxBlockAge
+        if (maxBlockAge && (t_now - lastFlush) >= maxBlockAge) {
+            FlushDataBlocks(*sourceList);
+            lastFlush = t_now;
         }
 
         /* check for EINTR and continue */
@@ -391,17 +896,21 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
 
         // repeat this packet
         if (rfd) {
-            if (SendRepeaterMessage(rfd, in_buff, cnt, &nf_sender, nf_sender_size) != 0) {
+            if (worker) pthread_mutex_lock(&repeaterMutex);
+            int err = SendRepeaterMessage(rfd, in_buff, cnt, &nf_sender, nf_sender_size);
+            if (worker) pthread_mutex_unlock(&repeaterMutex);
+            if (err != 0) {
                 LogError("Disable packet repeater due to errors");
-                close(rfd);
+                // the pipe is shared by all workers
+                if (!worker) close(rfd);
                 rfd = 0;
             }
         }
 
         // get flow source record for current packet, identified by sender IP address
-        fs = GetFlowSource(&nf_sender);
+        fs = GetFlowSource(*sourceList, &nf_sender);
         if (fs == NULL) {
-            fs = AddDynamicSource(&FlowSource, &nf_sender);
+            fs = AddDynamicSource(sourceList, &nf_sender);
             if (fs == NULL) {
                 LogError("Skip UDP packet. Ignored packets so far %u packets", ignored_packets);
                 ignored_packets++;
@@ -410,84 +919,541 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
             if (InitBookkeeper(&fs->bookkeeper, fs->datadir, getpid()) != BOOKKEEPER_OK) {
                 LogError("Failed to initialise bookkeeper for new source");
                 // fatal error
-                return;
+                failed = 1;
+                break;
             }
             fs->nffile = OpenNewFile(fs->current, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
             if (!fs->nffile) {
                 LogError("Failed to open new collector file");
-                return;
+                failed = 1;
+                break;
             }
             fs->dataBlock = WriteBlock(fs->nffile, NULL);
             SetIdent(fs->nffile, fs->Ident);
+            PrepareNewFile(fs->nffile);
         }
 
-        /* check for too little data - cnt must be > 0 at this point */
-        if (cnt < (ssize_t)sizeof(common_flow_header_t)) {
-            LogError("Ident: %s, Data size error: not enough data for netflow header - cnt: %i", fs->Ident, (int)cnt);
-            fs->bad_packets++;
-            continue;
+        fs->received = tv;
+        ProcessPacket(in_buff, cnt, fs);
+    }
+
+#ifdef PCAP
+    free(in_buff);
+#else
+    free(packet);
+    StopPacketThread(packetParam);
+#endif
+    if (failed) return;
+
+    fs = *sourceList;
+    while (fs) {
+        FreeDataBlock(fs->dataBlock);
+        DisposeFile(fs->nffile);
+        fs->nffile = NULL;
+        fs = fs->next;
+    }
+
+} /* End of run */
+
+#ifdef PCAP
+static FlowSource_t *BenchSource(FlowSource_t **sourceList, struct sockaddr_storage *sender, int discard, int compress) {
+    FlowSource_t *fs = GetFlowSource(*sourceList, sender);
+    if (fs) return fs;
+
+    fs = AddDynamicSource(sourceList, sender);
+    if (fs == NULL) return NULL;
+
+    if (InitBookkeeper(&fs->bookkeeper, fs->datadir, getpid()) != BOOKKEEPER_OK) {
+        LogError("Failed to initialise bookkeeper for new source");
+        return NULL;
+    }
+    fs->nffile = OpenNewFile(discard ? "/dev/null" : fs->current, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
+    if (!fs->nffile) {
+        LogError("Failed to open new collector file");
+        return NULL;
+    }
+    fs->dataBlock = WriteBlock(fs->nffile, NULL);
+    SetIdent(fs->nffile, fs->Ident);
+    return fs;
+
+}  // End of BenchSource
+
+/*
+ * benchmark mode: load all datagrams of the pcap file into memory and decode them
+ * loops times as fast as possible. Reports the decode throughput in total and
+ * for each flow source. With discard, the flows are written to /dev/null.
+ */
+static void benchmark(FlowSource_t **sourceList, int loops, int discard, time_t t_start, char *time_extension, int compress) {
+    // load pcap file
+    uint32_t numPackets = 0, maxPackets = 1024;
+    benchPacket_t **packetList = malloc(maxPackets * sizeof(benchPacket_t *));
+    void *in_buff = malloc(NETWORK_INPUT_BUFF_SIZE);
+    if (!packetList || !in_buff) {
+        LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    uint32_t numStats = 0, maxStats = 16;
+    benchStat_t *benchStat = calloc(maxStats, sizeof(benchStat_t));
+    if (!benchStat) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    uint64_t bytes = 0;
+    while (1) {
+        struct sockaddr_storage sender = {0};
+        socklen_t senderSize = sizeof(sender);
+        ssize_t cnt = NextPacket(0, in_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&sender, &senderSize);
+        if (cnt == -2) break;
+        if (cnt <= 0) continue;
+
+        if (numPackets == maxPackets) {
+            maxPackets *= 2;
+            benchPacket_t **list = realloc(packetList, maxPackets * sizeof(benchPacket_t *));
+            if (!list) {
+                LogError("realloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                return;
+            }
+            packetList = list;
+        }
+        benchPacket_t *packet = malloc(sizeof(benchPacket_t) + cnt);
+        if (!packet) {
+            LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return;
+        }
+        // exporters are identified by the sender address
+        char exporter[INET6_ADDRSTRLEN];
+        if (sender.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&sender)->sin6_addr, exporter, sizeof(exporter));
+        else
+            inet_ntop(AF_INET, &((struct sockaddr_in *)&sender)->sin_addr, exporter, sizeof(exporter));
+        uint32_t index = 0;
+        while (index < numStats && strcmp(benchStat[index].exporter, exporter) != 0) index++;
+        if (index == numStats) {
+            if (numStats == maxStats) {
+                maxStats *= 2;
+                benchStat_t *stat = realloc(benchStat, maxStats * sizeof(benchStat_t));
+                if (!stat) {
+                    LogError("realloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                    return;
+                }
+                benchStat = stat;
+            }
+            benchStat[numStats] = (benchStat_t){0};
+            strcpy(benchStat[numStats].exporter, exporter);
+            numStats++;
         }
 
-        fs->received = tv;
-        /* Process data - have a look at the common header */
-        uint16_t version = ntohs(nf_header->version);
-        switch (version) {
-            case 1:
-                Process_v1(in_buff, cnt, fs);
-                break;
-            case 5:  // fall through
-            case 7:
-                Process_v5_v7(in_buff, cnt, fs);
-                break;
-            case 9:
-                Process_v9(in_buff, cnt, fs);
-                break;
-            case 10:
-                Process_IPFIX(in_buff, cnt, fs);
-                break;
-            case NFD_PROTOCOL:
-                Process_nfd(in_buff, cnt, fs);
-                break;
-            default:
-                // data error, while reading data from socket
-                LogError("Ident: %s, Error reading netflow header: Unexpected netflow version %i", fs->Ident, version);
-                fs->bad_packets++;
+        packet->sender = sender;
+        packet->senderSize = senderSize;
+        packet->exporter = index;
+        packet->size = cnt;
+        memcpy(packet->data, in_buff, cnt);
+        packetList[numPackets++] = packet;
+        bytes += cnt;
+    }
+    free(in_buff);
+    printf("Benchmark: %u packets, %llu bytes loaded, %d loops\n", numPackets, (unsigned long long)bytes, loops);
+
+    // Init each netflow source output data buffer
+    FlowSource_t *fs = *sourceList;
+    while (fs) {
+        fs->nffile = OpenNewFile(discard ? "/dev/null" : fs->current, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
+        if (!fs->nffile) return;
+        SetIdent(fs->nffile, fs->Ident);
+        fs->dataBlock = WriteBlock(fs->nffile, NULL);
+        fs->bad_packets = 0;
+        fs->msecFirst = 0xffffffffffffLL;
+        fs->msecLast = 0;
+        fs = fs->next;
+    }
+
+    uint64_t ignored = 0;
+    uint64_t start = MetricNsec();
+    for (int loop = 0; loop < loops && !done; loop++) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        for (uint32_t i = 0; i < numPackets; i++) {
+            benchPacket_t *packet = packetList[i];
+            fs = BenchSource(sourceList, &packet->sender, discard, compress);
+            if (fs == NULL) {
+                ignored++;
                 continue;
+            }
 
-                // not reached
-                break;
+            benchStat_t *stat = &benchStat[packet->exporter];
+            stat->fs = fs;
+
+            fs->received = tv;
+            uint64_t numflows = fs->nffile->stat_record->numflows;
+            uint64_t nsec = MetricNsec();
+            ProcessPacket(packet->data, packet->size, fs);
+            stat->nsec += MetricNsec() - nsec;
+            stat->records += fs->nffile->stat_record->numflows - numflows;
+            stat->packets++;
+            stat->bytes += packet->size;
         }
-        // each Process_xx function has to process the entire input buffer, therefore it's empty
-        // now.
     }
+    uint64_t decodeNsec = MetricNsec() - start;
+
+    // flush and close all files - includes compression and write
+    if (discard) {
+        fs = *sourceList;
+        while (fs) {
+            fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+            CloseUpdateFile(fs->nffile);
+            fs = fs->next;
+        }
+    } else {
+        RotateFlowFiles(t_start, time_extension, *sourceList, 1);
+        FlushFinalizer();
+    }
+    uint64_t totalNsec = MetricNsec() - start;
+
+    uint64_t packets = 0, records = 0;
+    bytes = 0;
+    printf("%-24s %-16s %12s %12s %10s %10s %10s\n", "Exporter", "Ident", "Packets", "Records", "ns/packet", "ns/record", "MB/s");
+    for (uint32_t i = 0; i < numStats; i++) {
+        benchStat_t *stat = &benchStat[i];
+        if (stat->packets == 0) continue;
+        uint64_t nsec = stat->nsec ? stat->nsec : 1;
+        printf("%-24s %-16s %12llu %12llu %10.1f %10.1f %10.1f\n", stat->exporter, stat->fs->Ident, (unsigned long long)stat->packets,
+               (unsigned long long)stat->records, (double)nsec / (double)stat->packets, stat->records ? (double)nsec / (double)stat->records : 0.0,
+               ((double)stat->bytes * 1000.0) / (double)nsec);
+        packets += stat->packets;
+        records += stat->records;
+        bytes += stat->bytes;
+    }
+
+    double decodeSec = (double)decodeNsec / 1.0e9;
+    double totalSec = (double)totalNsec / 1.0e9;
+    printf("Decode: %.3fs, %.0f packets/s, %.0f records/s, %.1f MB/s\n", decodeSec, (double)packets / decodeSec, (double)records / decodeSec,
+           (double)bytes / decodeSec / 1.0e6);
+    printf("Total : %.3fs incl. file write, %.0f records/s, ignored packets: %llu\n", totalSec, (double)records / totalSec,
+           (unsigned long long)ignored);
+
+    fs = *sourceList;
+    while (fs) {
+        FreeDataBlock(fs->dataBlock);
+        DisposeFile(fs->nffile);
+        fs->dataBlock = NULL;
+        fs->nffile = NULL;
+        fs = fs->next;
+    }
+    for (uint32_t i = 0; i < numPackets; i++) free(packetList[i]);
+    free(packetList);
+    free(benchStat);
+
+}  // End of benchmark
+#endif
+
+// read buffer of the message file import -r
+#define IMPORTBUFFSIZE (16 * 1024 * 1024)
+
+/*
+ * length of the export message at data, if complete within size bytes. Messages of
+ * an IPFIX file (RFC 5655) carry their length. v1/v5/v7 messages have a fixed record
+ * size and v9 messages end with the last flowset, before the next message header.
+ * Returns 0, if more data is required and -1 for unknown or corrupt data
+ */
+static ssize_t MessageLength(const uint8_t *data, size_t size, int eof) {
+    if (size < sizeof(common_flow_header_t)) return eof && size ? -1 : 0;
+
+    uint16_t version = ntohs(((common_flow_header_t *)data)->version);
+    uint16_t count = ntohs(((common_flow_header_t *)data)->count);
+    size_t length = 0;
+    switch (version) {
+        case 1:
+            length = 16 + (size_t)count * 48;
+            break;
+        case 5:
+            length = 24 + (size_t)count * 48;
+            break;
+        case 7:
+            length = 24 + (size_t)count * 52;
+            break;
+        case 10:
+            // count is the message length
+            length = count;
+            if (length < 16) return -1;
+            break;
+        case 9: {
+            // flowsets follow until the next message header. Flowset IDs 2..255 are
+            // reserved, so a version number at a flowset boundary starts the next message
+            size_t offset = 20;
+            while (offset + 4 <= size) {
+                uint16_t flowsetID = ntohs(*((uint16_t *)(data + offset)));
+                uint16_t flowsetLength = ntohs(*((uint16_t *)(data + offset + 2)));
+                if (flowsetID > 1 && flowsetID < 256) return offset;
+                if (flowsetLength < 4) return -1;
+                offset += flowsetLength;
+            }
+            if (!eof) return 0;
+            return offset == size ? (ssize_t)size : -1;
+        } break;
+        default:
+            return -1;
+    }
+
+    if (length > size) return eof ? -1 : 0;
+    return length;
+
+}  // End of MessageLength
+
+/*
+ * import mode -r: decode the export messages of an IPFIX file or a raw v9/v5 message
+ * dump with the collector decoders at disk speed. The file is read sequentially in
+ * large chunks, the files are rotated by the export time of the messages and the
+ * data blocks are compressed by the writer workers. Reports the decode throughput.
+ */
+static int ImportFile(char *fileName, FlowSource_t **sourceList, int pfd, time_t twin, char *time_extension, int compress) {
+    int fd = strcmp(fileName, "-") == 0 ? STDIN_FILENO : open(fileName, O_RDONLY);
+    if (fd < 0) {
+        LogError("open() %s failed: %s", fileName, strerror(errno));
+        return 0;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    uint8_t *buff = malloc(IMPORTBUFFSIZE);
+    void *in_buff = malloc(NETWORK_INPUT_BUFF_SIZE);
+    if (!buff || !in_buff) {
+        LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        if (fd != STDIN_FILENO) close(fd);
+        return 0;
+    }
+
+    // all messages are from the same exporter - the observation domain or source ID
+    // distinguishes multiple exporters in the file
+    struct sockaddr_storage sender = {0};
+    struct sockaddr_in *sender_in = (struct sockaddr_in *)&sender;
+    sender_in->sin_family = AF_INET;
+    sender_in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+#ifdef HAVE_STRUCT_SOCKADDR_STORAGE_SS_LEN
+    sender.ss_len = sizeof(struct sockaddr_in);
+#endif
+    FlowSource_t *fs = GetFlowSource(*sourceList, &sender);
+    if (fs == NULL) {
+        LogError("No flow source for the import. Use -w flowdir");
+        if (fd != STDIN_FILENO) close(fd);
+        return 0;
+    }
+
+    // the files of all sources are rotated together
+    for (FlowSource_t *source = *sourceList; source; source = source->next) {
+        source->nffile = OpenNewFile(source->current, NULL, CREATOR_NFCAPD, compress, NOT_ENCRYPTED);
+        if (!source->nffile) {
+            if (fd != STDIN_FILENO) close(fd);
+            return 0;
+        }
+        SetIdent(source->nffile, source->Ident);
+        PrepareNewFile(source->nffile);
+        source->dataBlock = WriteBlock(source->nffile, NULL);
+        source->bad_packets = 0;
+        source->msecFirst = 0xffffffffffffLL;
+        source->msecLast = 0;
+    }
+
+    time_t t_start = 0;
+    uint64_t messages = 0, bytes = 0, numFiles = 0;
+    uint64_t decodeNsec = 0;
+    uint64_t start = MetricNsec();
+    size_t fill = 0;
+    int eof = 0, failed = 0;
+    while (!done && !failed && (!eof || fill)) {
+        // refill the buffer with the next chunk of the file
+        if (!eof && fill < IMPORTBUFFSIZE) {
+            ssize_t ret = read(fd, buff + fill, IMPORTBUFFSIZE - fill);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                LogError("read() %s failed: %s", fileName, strerror(errno));
+                break;
+            }
+            if (ret == 0) eof = 1;
+            fill += ret;
+        }
 
+        size_t offset = 0;
+        while (offset < fill && !done) {
+            ssize_t length = MessageLength(buff + offset, fill - offset, eof);
+            if (length == 0) break;
+            if (length < 0 || length > NETWORK_INPUT_BUFF_SIZE) {
+                LogError("Corrupt or unknown export message at file offset %llu - stop import", (unsigned long long)(bytes + offset));
+                failed = 1;
+                break;
+            }
+
+            // the header of all versions carries the export time in unix seconds
+            const uint8_t *msg = buff + offset;
+            uint16_t version = ntohs(((common_flow_header_t *)msg)->version);
+            uint32_t exportTime = 0;
+            if (version == 10) {
+                exportTime = ntohl(*((uint32_t *)(msg + 4)));
+            } else if (length >= 12) {
+                exportTime = ntohl(*((uint32_t *)(msg + 8)));
+            }
+            if (t_start == 0) t_start = exportTime - (exportTime % twin);
+            if (exportTime >= t_start + twin) {
+                if (RotateFlowFiles(t_start, time_extension, *sourceList, 0) == 0) {
+                    failed = 1;
+                    break;
+                }
+                if (pfd && TriggerLauncher(t_start, time_extension, pfd, *sourceList) == 0) {
+                    LogError("Disable launcher due to errors");
+                    close(pfd);
+                    pfd = 0;
+                }
+                numFiles++;
+                t_start = exportTime - (exportTime % twin);
+            }
+
+            // the decoders expect an aligned datagram
+            memcpy(in_buff, msg, length);
+            fs->received = (struct timeval){.tv_sec = exportTime, .tv_usec = 0};
+            uint64_t nsec = MetricNsec();
+            ProcessPacket(in_buff, length, fs);
+            decodeNsec += MetricNsec() - nsec;
+            messages++;
+            offset += length;
+        }
+
+        // keep the incomplete message for the next chunk
+        bytes += offset;
+        if (offset && offset < fill) memmove(buff, buff + offset, fill - offset);
+        fill -= offset;
+        if (!failed && fill == IMPORTBUFFSIZE) {
+            LogError("Export message larger than the import buffer - stop import");
+            failed = 1;
+        }
+    }
+    if (fd != STDIN_FILENO) close(fd);
+    free(buff);
     free(in_buff);
 
-    fs = FlowSource;
+    // close the last file - includes compression and write
+    if (t_start == 0) t_start = time(NULL) - (time(NULL) % twin);
+    if (RotateFlowFiles(t_start, time_extension, *sourceList, 1)) {
+        numFiles++;
+        if (pfd) TriggerLauncher(t_start, time_extension, pfd, *sourceList);
+    }
+    FlushFinalizer();
+    uint64_t totalNsec = MetricNsec() - start;
+
+    double decodeSec = decodeNsec ? (double)decodeNsec / 1.0e9 : 1.0e-9;
+    double totalSec = totalNsec ? (double)totalNsec / 1.0e9 : 1.0e-9;
+    LogInfo("Import %s: %llu messages, %llu bytes, %llu files, bad packets: %llu", fileName, (unsigned long long)messages,
+            (unsigned long long)bytes, (unsigned long long)numFiles, (unsigned long long)fs->bad_packets);
+    LogInfo("Decode: %.3fs, %.0f messages/s, %.1f MB/s. Total: %.3fs incl. file write, %.1f MB/s", decodeSec, (double)messages / decodeSec,
+            (double)bytes / decodeSec / 1.0e6, totalSec, (double)bytes / totalSec / 1.0e6);
+
+    fs = *sourceList;
     while (fs) {
         FreeDataBlock(fs->dataBlock);
         DisposeFile(fs->nffile);
+        fs->dataBlock = NULL;
         fs->nffile = NULL;
         fs = fs->next;
     }
 
-} /* End of run */
+    return !failed;
+
+}  // End of ImportFile
+
+__attribute__((noreturn)) static void *receiveWorker(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+
+    dbg_printf("receiveWorker %u started\n", worker->id);
+    PinWorker();
+    run(recvfrom, worker->socket, &worker->FlowSource, worker, 0, worker->rfd, worker->twin, worker->t_begin, worker->time_extension,
+        worker->compress);
+
+    if (!worker->final) {
+        // run() failed - let the other workers terminate
+        LogError("Worker %u terminated due to errors", worker->id);
+        done = 1;
+        worker->final = 1;
+        pthread_control_barrier_wait(rotateBarrier);
+    }
+
+    dbg_printf("receiveWorker %u exit\n", worker->id);
+    pthread_exit(NULL);
+
+}  // End of receiveWorker
+
+// launch the receive workers and trigger the launcher, after all workers rotated their files
+static void runWorkers(worker_t *workers, uint32_t numWorkers, int pfd, time_t twin, time_t t_begin, char *time_extension) {
+    rotateBarrier = pthread_control_barrier_init(numWorkers);
+    if (!rotateBarrier) {
+        LogError("pthread_control_barrier_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        int err = pthread_create(&(workers[i].tid), NULL, receiveWorker, (void *)&workers[i]);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+
+    time_t t_start = t_begin;
+    int allFinal = 0;
+    while (!allFinal) {
+        pthread_controller_wait(rotateBarrier);
+
+        int anyFinal = 0;
+        allFinal = 1;
+        for (uint32_t i = 0; i < numWorkers; i++) {
+            anyFinal |= workers[i].final;
+            allFinal &= workers[i].final;
+        }
+
+        // all workers wrote their files of this slot
+        if (pfd && TriggerLauncher(t_start, time_extension, pfd, workers[0].FlowSource) == 0) {
+            LogError("Disable launcher due to errors");
+            close(pfd);
+            pfd = 0;
+        }
+
+        stopWorkers = anyFinal;
+        pthread_control_barrier_release(rotateBarrier);
+        if (anyFinal) break;
+
+        t_start += twin;
+    }
+
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        if (pthread_join(workers[i].tid, NULL)) {
+            LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        }
+    }
+
+    // not all workers terminated with the last slot, so they wrote the next slot
+    if (!allFinal && pfd) TriggerLauncher(t_start + twin, time_extension, pfd, workers[0].FlowSource);
+
+    pthread_control_barrier_destroy(rotateBarrier);
+
+}  // End of runWorkers
 
 int main(int argc, char **argv) {
     char *bindhost, *datadir, *launch_process;
     char *userid, *groupid, *listenport, *mcastgroup;
     char *Ident, *dynFlowDir, *time_extension, *pidfile, *configFile, *metricSocket;
-    char *extensionList;
+    char *extensionList, *rollupDir, *rollupAggr, *liveSocket, *ingestFilter, *importFile;
     packet_function_t receive_packet;
     repeater_t repeater[MAX_REPEATERS];
     FlowSource_t *fs;
     int family, bufflen, metricInterval;
     time_t twin;
-    int sock, do_daemonize, expire, spec_time_extension, workers;
+    int sock, do_daemonize, expire, spec_time_extension, workers, receivers;
     int subdir_index, sampling_rate, compress, srcSpoofing;
 #ifdef PCAP
     char *pcap_file = NULL;
     char *pcap_device = NULL;
+    int benchLoops = 0;
+    int benchDiscard = 0;
 #endif
 
     receive_packet = recvfrom;
@@ -517,10 +1483,15 @@ int main(int argc, char **argv) {
     metricSocket = NULL;
     metricInterval = 60;
     extensionList = NULL;
+    rollupDir = rollupAggr = liveSocket = ingestFilter = importFile = NULL;
     workers = 0;
+    receivers = 1;
+#ifndef PCAP
+    int streamProto = 0;
+#endif
 
     int c;
-    while ((c = getopt(argc, argv, "46AB:b:C:d:DeEf:g:hI:i:jJ:l:m:M:n:p:P:R:s:S:t:T:u:vVW:w:x:X:yz::Z")) != EOF) {
+    while ((c = getopt(argc, argv, "46a:AB:b:C:d:DeEf:F:G:g:hI:i:jJ:kK:L:l:m:M:n:N:O:p:P:r:R:s:S:t:T:u:vVW:w:x:X:yz::Z")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -544,6 +1515,11 @@ int main(int argc, char **argv) {
             case 'e':
                 expire = 1;
                 break;
+            case 'r':
+                CheckArgLen(optarg, MAXPATHLEN);
+                if (strcmp(optarg, "-") != 0 && !CheckPath(optarg, S_IFREG)) exit(EXIT_FAILURE);
+                importFile = optarg;
+                break;
 #ifdef PCAP
             case 'f': {
                 struct stat fstat;
@@ -558,9 +1534,23 @@ int main(int argc, char **argv) {
                 CheckArgLen(optarg, 32);
                 pcap_device = strdup(optarg);
                 break;
+            case 'K': {
+                char *s = NULL;
+                benchLoops = strtol(optarg, &s, 10);
+                if (s && strcmp(s, ":null") == 0) {
+                    benchDiscard = 1;
+                } else if (s && *s) {
+                    benchLoops = 0;
+                }
+                if (benchLoops <= 0) {
+                    LogError("Invalid benchmark loops: %s. Expect -K <loops>[:null]", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            } break;
 #else
             case 'f':
             case 'd':
+            case 'K':
                 LogError("Reading data from pcap file/device not compiled in!");
                 exit(255);
                 break;
@@ -573,6 +1563,7 @@ int main(int argc, char **argv) {
                 break;
             case 'V':
                 printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
                 exit(EXIT_SUCCESS);
                 break;
             case 'D':
@@ -631,6 +1622,31 @@ int main(int argc, char **argv) {
             case 'p':
                 listenport = optarg;
                 break;
+            case 'O': {
+#ifdef PCAP
+                LogError("IPFIX streams not supported with pcap input");
+                exit(EXIT_FAILURE);
+#else
+                CheckArgLen(optarg, 16);
+                char *proto = strtok(optarg, ",");
+                while (proto) {
+                    if (strcasecmp(proto, "tcp") == 0) {
+                        streamProto |= STREAM_TCP;
+                    } else if (strcasecmp(proto, "sctp") == 0) {
+#ifdef IPPROTO_SCTP
+                        streamProto |= STREAM_SCTP;
+#else
+                        LogError("SCTP not supported on this system");
+                        exit(EXIT_FAILURE);
+#endif
+                    } else {
+                        LogError("Unknown stream protocol: %s", proto);
+                        exit(EXIT_FAILURE);
+                    }
+                    proto = strtok(NULL, ",");
+                }
+#endif
+            } break;
             case 'P':
                 pidfile = verify_pid(optarg);
                 if (!pidfile) {
@@ -705,10 +1721,27 @@ int main(int argc, char **argv) {
                 CheckArgLen(optarg, 256);
                 launch_process = optarg;
                 break;
+            case 'G':
+                CheckArgLen(optarg, MAXPATHLEN);
+                if (!CheckPath(optarg, S_IFDIR)) exit(EXIT_FAILURE);
+                rollupDir = optarg;
+                break;
+            case 'a':
+                CheckArgLen(optarg, 128);
+                rollupAggr = optarg;
+                break;
+            case 'L':
+                CheckArgLen(optarg, MAXPATHLEN);
+                liveSocket = optarg;
+                break;
             case 'X':
                 CheckArgLen(optarg, 128);
                 extensionList = strdup(optarg);
                 break;
+            case 'F':
+                CheckArgLen(optarg, 4096);
+                ingestFilter = optarg;
+                break;
             case 'W':
                 CheckArgLen(optarg, 16);
                 workers = atoi(optarg);
@@ -717,6 +1750,14 @@ int main(int argc, char **argv) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'N':
+                CheckArgLen(optarg, 16);
+                receivers = atoi(optarg);
+                if (receivers < 1 || receivers > MAXWORKERS) {
+                    LogError("Number of receive workers out of range 1..%d", MAXWORKERS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'j':
                 if (compress) {
                     LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression");
@@ -724,6 +1765,9 @@ int main(int argc, char **argv) {
                 }
                 compress = BZ2_COMPRESSED;
                 break;
+            case 'k':
+                SetBlockSort(1);
+                break;
             case 'y':
                 if (compress) {
                     LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression");
@@ -785,6 +1829,8 @@ int main(int argc, char **argv) {
         if (strcmp(argv[optind], "privsep") == 0) {
             if (strcmp(argv[optind + 1], "launcher") == 0) {
                 dbg_printf("nfcapd privsep launched\n");
+                // launcher limits are read from the config file
+                if (ConfOpen(configFile, "nfcapd") < 0) exit(EXIT_FAILURE);
                 int ret = StartupLauncher(launch_process, expire);
                 exit(ret);
             } else if (strcmp(argv[optind + 1], "repeater") == 0) {
@@ -803,6 +1849,12 @@ int main(int argc, char **argv) {
 
     if (ConfOpen(configFile, "nfcapd") < 0) exit(EXIT_FAILURE);
 
+    if (rollupAggr && !rollupDir) {
+        LogError("Rollup aggregation -a requires a rollup directory -G");
+        exit(EXIT_FAILURE);
+    }
+    if (rollupDir && !SetRollup(rollupDir, rollupAggr)) exit(EXIT_FAILURE);
+
     if (datadir && !AddFlowSource(&FlowSource, Ident, ANYIP, datadir)) {
         LogError("Failed to add default data collector directory");
         exit(EXIT_FAILURE);
@@ -818,11 +1870,48 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (!SetupIngest(FlowSource, ingestFilter)) exit(EXIT_FAILURE);
+
+    if (!SetupProfiler(compress)) exit(EXIT_FAILURE);
+
     if (bindhost && mcastgroup) {
         LogError("ERROR, -b and -j are mutually exclusive!!");
         exit(EXIT_FAILURE);
     }
 
+    if (receivers > 1) {
+        if (mcastgroup || dynFlowDir) {
+            LogError("ERROR, -N is not compatible with -J or -M");
+            exit(EXIT_FAILURE);
+        }
+#ifdef PCAP
+        if (pcap_file || pcap_device) {
+            LogError("ERROR, -N is not compatible with -f or -d");
+            exit(EXIT_FAILURE);
+        }
+#endif
+    }
+
+#ifdef PCAP
+    if (benchLoops && pcap_file == NULL) {
+        LogError("ERROR, benchmark -K requires a pcap file -f");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    if (importFile && (receivers > 1 || mcastgroup || do_daemonize)) {
+        LogError("ERROR, import -r is not compatible with -N, -J or -D");
+        exit(EXIT_FAILURE);
+    }
+#ifdef PCAP
+    if (importFile && (pcap_file || pcap_device)) {
+        LogError("ERROR, import -r is not compatible with -f or -d");
+        exit(EXIT_FAILURE);
+    }
+#else
+    if (importFile) streamProto = 0;
+#endif
+
     if (!Init_nffile(workers, NULL)) exit(254);
 
     if (expire && spec_time_extension) {
@@ -849,20 +1938,69 @@ int main(int argc, char **argv) {
         receive_packet = NextPacket;
     } else
 #endif
-        if (mcastgroup)
+        if (importFile)
+        // flows are imported from a file - no socket
+        sock = 0;
+    else if (mcastgroup)
         sock = Multicast_receive_socket(mcastgroup, listenport, family, bufflen);
     else
-        sock = Unicast_receive_socket(bindhost, listenport, family, bufflen);
+        sock = Unicast_receive_socket(bindhost, listenport, family, bufflen, receivers > 1);
 
     if (sock == -1) {
         LogError("Terminated due to errors");
         exit(EXIT_FAILURE);
     }
 
+#ifndef PCAP
+    // IPFIX streams on the same port as the datagrams
+    if (streamProto & STREAM_TCP) {
+        int streamSock = Stream_receive_socket(bindhost, listenport, family, IPPROTO_TCP);
+        if (streamSock == -1) {
+            LogError("Terminated due to errors");
+            exit(EXIT_FAILURE);
+        }
+        streamSockets[numStreamSockets++] = streamSock;
+    }
+#ifdef IPPROTO_SCTP
+    if (streamProto & STREAM_SCTP) {
+        int streamSock = Stream_receive_socket(bindhost, listenport, family, IPPROTO_SCTP);
+        if (streamSock == -1) {
+            LogError("Terminated due to errors");
+            exit(EXIT_FAILURE);
+        }
+        streamSockets[numStreamSockets++] = streamSock;
+    }
+#endif
+#endif
+
+    // each receive worker gets its own socket on the same port. The kernel distributes
+    // the datagrams by the sender address and port, so an exporter sticks to one worker
+    worker_t *workerList = NULL;
+    if (receivers > 1) {
+        workerList = (worker_t *)calloc(receivers, sizeof(worker_t));
+        if (!workerList) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+        workerList[0].socket = sock;
+        for (int i = 1; i < receivers; i++) {
+            workerList[i].socket = Unicast_receive_socket(bindhost, listenport, family, bufflen, 1);
+            if (workerList[i].socket == -1) {
+                LogError("Terminated due to errors");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
     pid_t repeater_pid = 0;
     int rfd = 0;
     if (repeater[0].hostname) {
-        rfd = PrivsepFork(argc, argv, &repeater_pid, "repeater");
+        // datagrams are passed on in shared memory, the pipe carries the wakeups
+        repeaterRing = NewShmRing(SHMRINGSIZE);
+        if (repeaterRing)
+            rfd = PrivsepForkShared(argc, argv, &repeater_pid, "repeater", ShmRingFD(repeaterRing), SHMRINGFD);
+        else
+            rfd = PrivsepFork(argc, argv, &repeater_pid, "repeater");
     }
 
     SetPriv(userid, groupid);
@@ -871,6 +2009,7 @@ int main(int argc, char **argv) {
         !Init_IPFIX(verbose, sampling_rate, extensionList)) {
         exit(EXIT_FAILURE);
     }
+    InitTemplateCache();
 
     if (subdir_index && !InitHierPath(subdir_index)) {
         close(sock);
@@ -893,6 +2032,12 @@ int main(int argc, char **argv) {
         close(sock);
         exit(EXIT_FAILURE);
     }
+    if (!OpenMetricHTTP()) {
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
+    MetricSocket(sock);
+    for (int i = 1; i < receivers && workerList; i++) MetricSocket(workerList[i].socket);
 
     int launcher_pid = 0;
     int pfd = 0;
@@ -934,13 +2079,74 @@ int main(int argc, char **argv) {
     sigaction(SIGCHLD, &act, NULL);
     sigaction(SIGPIPE, &act, NULL);
 
-    LogInfo("Startup nfcapd.");
-    run(receive_packet, sock, pfd, rfd, twin, t_start, time_extension, compress);
+    if (liveSocket && !SetLivePublisher(liveSocket)) {
+        close(sock);
+        signalPrivsepChild(launcher_pid, pfd);
+        signalPrivsepChild(repeater_pid, rfd);
+        if (pidfile) remove_pid(pidfile);
+        exit(EXIT_FAILURE);
+    }
+
+    // many sources write their files through one pool of writers
+    if (((FlowSource && FlowSource->next) || dynFlowDir) && !StartWriterPool(0)) {
+        LogError("Failed to start writer pool - continue with writers per source");
+    }
+
+    LogVerbose("%s", CPUDispatchInfo());
+    int importFailed = 0;
+    if (importFile) {
+        LogInfo("Startup nfcapd import of %s.", importFile);
+        importFailed = !ImportFile(importFile, &FlowSource, pfd, twin, time_extension, compress);
+    } else
+#ifdef PCAP
+        if (benchLoops) {
+        LogInfo("Startup nfcapd benchmark.");
+        benchmark(&FlowSource, benchLoops, benchDiscard, t_start, time_extension, compress);
+    } else
+#endif
+        if (receivers > 1) {
+        for (int i = 0; i < receivers; i++) {
+            worker_t *worker = &workerList[i];
+            worker->id = i;
+            worker->FlowSource = CloneFlowSources(FlowSource, i);
+            if (!worker->FlowSource) exit(255);
+            worker->rfd = rfd;
+            worker->twin = twin;
+            worker->t_begin = t_start;
+            worker->time_extension = time_extension;
+            worker->compress = compress;
+
+            // wake up the worker at least once a second, to check the time slot
+            struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+            if (setsockopt(worker->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
+                LogError("setsockopt(SO_RCVTIMEO) error: %s", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        LogInfo("Startup nfcapd with %d receive workers.", receivers);
+        runWorkers(workerList, receivers, pfd, twin, t_start, time_extension);
+
+        for (int i = 0; i < receivers; i++) {
+            if (i > 0) close(workerList[i].socket);
+            FreeFlowSourceClones(workerList[i].FlowSource);
+        }
+        free(workerList);
+    } else {
+        LogInfo("Startup nfcapd.");
+        run(receive_packet, sock, &FlowSource, NULL, pfd, rfd, twin, t_start, time_extension, compress);
+    }
 
     // shutdown
     close(sock);
+    // all rotated files are in place and the launcher got all messages
+    FlushFinalizer();
+    StopPublisher();
+    StopIngest();
     signalPrivsepChild(launcher_pid, pfd);
     signalPrivsepChild(repeater_pid, rfd);
+    if (repeaterDropped) LogInfo("Repeater ring full - dropped %llu datagrams in total", (unsigned long long)repeaterDropped);
+    FreeShmRing(repeaterRing);
     CloseMetric();
 
     fs = FlowSource;
@@ -961,6 +2167,6 @@ int main(int argc, char **argv) {
     if (pidfile) remove_pid(pidfile);
 
     EndLog();
-    return 0;
+    return importFailed ? EXIT_FAILURE : 0;
 
 } /* End of main */
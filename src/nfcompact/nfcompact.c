@@ -0,0 +1,431 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_FTS_H
+#include <fts.h>
+#else
+#include "fts_compat.h"
+#define fts_children fts_children_compat
+#define fts_close fts_close_compat
+#define fts_open fts_open_compat
+#define fts_read fts_read_compat
+#define fts_set fts_set_compat
+#endif
+
+#include "conf/nfconf.h"
+#include "nfcolumn.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfxV3.h"
+#include "util.h"
+
+/*
+ * nfcompact merges the interval files of a collector into hourly or daily archive files.
+ * The records of an interval are repacked into full size data blocks. The archive holds
+ * the block index of all its blocks, and a table of contents, which maps the name of
+ * each interval file to its data blocks. flist resolves file ranges -R and time windows
+ * of interval files against the table of contents.
+ */
+
+// interval files of one archive
+typedef struct archiveGroup_s {
+    char dir[MAXPATHLEN];  // directory of the interval files
+    char period[16];       // time string of the archive
+    stringlist_t files;    // interval files in name order
+} archiveGroup_t;
+
+typedef struct compactParam_s {
+    int daily;     // daily archives, hourly otherwise
+    int compress;  // compression of the archives, -1: compression of the interval files
+    int keep;      // keep the interval files
+    int dryRun;    // list the archives only
+} compactParam_t;
+
+static void usage(char *name);
+
+static int compare(const FTSENT **f1, const FTSENT **f2);
+
+static int IntervalFile(char *name);
+
+static time_t PeriodEnd(char *period);
+
+static void WriteArchiveBlock(nffile_t *nffile, dataBlock_t *dataBlock, uint32_t *numBlocks);
+
+static int CompactGroup(archiveGroup_t *group, compactParam_t *param);
+
+static int CompactDir(char *datadir, compactParam_t *param);
+
+static void usage(char *name) {
+    printf(
+        "usage %s [options] \n"
+        "-h\t\tThis text\n"
+        "-l datadir\tCompact the interval files in datadir and its sub directories\n"
+        "-D\t\tCompact into daily archives. Default: hourly archives\n"
+        "-k\t\tKeep the interval files. Default: remove them after compaction\n"
+        "-n\t\tDry run: list the archives to be written only\n"
+        "-s\t\tSort the flows of each block by exporter, proto and dst address for better compression\n"
+        "-z=<comp>\tCompress archives: lzo, lz4, bz2 or zstd[:level]. Default: compression of the interval files\n",
+        name);
+
+}  // End of usage
+
+static int compare(const FTSENT **f1, const FTSENT **f2) { return strcmp((*f1)->fts_name, (*f2)->fts_name); }  // End of compare
+
+// nfcapd.200604301200 or nfcapd.20190430120010
+static int IntervalFile(char *name) {
+    if (strncmp(name, "nfcapd.", 7) != 0) return 0;
+
+    char *p = name + 7;
+    while (isdigit((int)*p)) p++;
+    return *p == '\0' && ((p - name) == 19 || (p - name) == 21);
+
+}  // End of IntervalFile
+
+// returns the end of the hourly or daily period of an archive time string
+static time_t PeriodEnd(char *period) {
+    struct tm t_tm = {0};
+    t_tm.tm_isdst = -1;
+    if (strlen(period) == 10) {
+        if (sscanf(period, "%4d%2d%2d%2d", &t_tm.tm_year, &t_tm.tm_mon, &t_tm.tm_mday, &t_tm.tm_hour) != 4) return -1;
+        t_tm.tm_hour++;
+    } else {
+        if (sscanf(period, "%4d%2d%2d", &t_tm.tm_year, &t_tm.tm_mon, &t_tm.tm_mday) != 3) return -1;
+        t_tm.tm_mday++;
+    }
+    t_tm.tm_year -= 1900;
+    t_tm.tm_mon--;
+    return mktime(&t_tm);
+
+}  // End of PeriodEnd
+
+// write a data block to the archive and count it
+static void WriteArchiveBlock(nffile_t *nffile, dataBlock_t *dataBlock, uint32_t *numBlocks) {
+    if (dataBlock->size) (*numBlocks)++;
+    FlushBlock(nffile, dataBlock);
+
+}  // End of WriteArchiveBlock
+
+// merge the interval files of a group into its archive file
+static int CompactGroup(archiveGroup_t *group, compactParam_t *param) {
+    char archive[MAXPATHLEN];
+    int len = snprintf(archive, sizeof(archive), "%s/%s%s", group->dir, NF_ARCHIVEFILE, group->period);
+    if (len < 0 || (size_t)len >= sizeof(archive)) {
+        LogError("Path too long: %s. Skip %d interval files", group->dir, group->files.num_strings);
+        return 0;
+    }
+    if (TestPath(archive, S_IFREG) != PATH_NOTEXISTS) {
+        LogError("Archive %s exists. Skip %d interval files", archive, group->files.num_strings);
+        return 0;
+    }
+    if (param->dryRun) {
+        printf("Archive %s: %d interval files\n", archive, group->files.num_strings);
+        return 1;
+    }
+
+    // the archive is written under the name of an unfinished collector file, which is not listed
+    char tmpFile[MAXPATHLEN];
+    len = snprintf(tmpFile, sizeof(tmpFile), "%s/%s.nfcompact.%d", group->dir, NF_DUMPFILE, (int)getpid());
+    if (len < 0 || (size_t)len >= sizeof(tmpFile)) {
+        LogError("Path too long: %s. Skip %d interval files", group->dir, group->files.num_strings);
+        return 0;
+    }
+
+    nffile_t *nffile_w = NULL;
+    dataBlock_t *outBlock = NULL;
+    uint32_t numBlocks = 0;
+    int ok = 1;
+    for (int i = 0; ok && i < group->files.num_strings; i++) {
+        char *path = group->files.list[i];
+        char *name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+
+        nffile_t *nffile_r = OpenFile(path, NULL);
+        if (!nffile_r) {
+            ok = 0;
+            break;
+        }
+        if (nffile_r->aggregation) {
+            LogError("File %s holds partial aggregates. Skip archive %s", path, archive);
+            DisposeFile(nffile_r);
+            ok = 0;
+            break;
+        }
+
+        if (!nffile_w) {
+            // the dictionary of the interval files is not carried over
+            int compress = param->compress;
+            if (compress < 0)
+                compress = FILE_COMPRESSION(nffile_r) == ZSTDDICT_COMPRESSED ? ZSTD_COMPRESSED : FILE_COMPRESSION(nffile_r);
+            nffile_w = OpenNewFile(tmpFile, NULL, CREATOR_NFCOMPACT, compress, FILE_ENCRYPTION(nffile_r));
+            if (!nffile_w) {
+                DisposeFile(nffile_r);
+                ok = 0;
+                break;
+            }
+            SetIdent(nffile_w, nffile_r->ident);
+            outBlock = NewDataBlock();
+        }
+
+        // an interval starts with a new block, so its blocks hold no records of other intervals
+        uint32_t firstBlock = numBlocks;
+        dataBlock_t *dataBlock = NULL;
+        while ((dataBlock = ReadBlock(nffile_r, dataBlock)) != NULL) {
+            if (dataBlock->type == DATA_BLOCK_TYPE_5) {
+                dataBlock_t *v3Block = NewDataBlock();
+                if (!ExpandColumnarBlock(dataBlock, v3Block, ALLEXTENSIONS)) {
+                    LogError("Failed to expand columnar block of file %s", path);
+                    FreeDataBlock(v3Block);
+                    ok = 0;
+                    break;
+                }
+                FreeDataBlock(dataBlock);
+                dataBlock = v3Block;
+            }
+
+            if (dataBlock->type != DATA_BLOCK_TYPE_3) {
+                // blocks of other types are copied unchanged
+                if (outBlock->NumRecords) {
+                    WriteArchiveBlock(nffile_w, outBlock, &numBlocks);
+                    outBlock = NewDataBlock();
+                }
+                WriteArchiveBlock(nffile_w, dataBlock, &numBlocks);
+                dataBlock = NULL;
+                continue;
+            }
+
+            // repack the records into full size blocks
+            record_header_t *record = (record_header_t *)GetCursor(dataBlock);
+            for (uint32_t j = 0; j < dataBlock->NumRecords; j++) {
+                if (record->size < sizeof(record_header_t)) {
+                    LogError("Corrupt record in file %s", path);
+                    ok = 0;
+                    break;
+                }
+                if (!IsAvailable(outBlock, record->size)) {
+                    WriteArchiveBlock(nffile_w, outBlock, &numBlocks);
+                    outBlock = NewDataBlock();
+                }
+                memcpy(GetCurrentCursor(outBlock), (void *)record, record->size);
+                outBlock->NumRecords++;
+                outBlock->size += record->size;
+                record = (record_header_t *)((void *)record + record->size);
+            }
+            if (!ok) break;
+        }
+        FreeDataBlock(dataBlock);
+
+        if (outBlock->NumRecords) {
+            WriteArchiveBlock(nffile_w, outBlock, &numBlocks);
+            outBlock = NewDataBlock();
+        }
+        if (ok && AddArchiveInterval(nffile_w, name, firstBlock, numBlocks - firstBlock, nffile_r->stat_record)) {
+            SumStatRecords(nffile_w->stat_record, nffile_r->stat_record);
+        } else {
+            ok = 0;
+        }
+        DisposeFile(nffile_r);
+    }
+    if (outBlock) FreeDataBlock(outBlock);
+    if (!nffile_w) return 0;
+
+    if (!CloseUpdateFile(nffile_w)) {
+        LogError("Failed to close file: '%s'", strerror(errno));
+        ok = 0;
+    }
+    DisposeFile(nffile_w);
+
+    // verify the archive before the interval files are removed
+    if (ok) {
+        nffile_t *nffile_r = OpenFile(tmpFile, NULL);
+        if (!nffile_r) {
+            ok = 0;
+        } else {
+            if (nffile_r->file_header->NumBlocks != numBlocks || nffile_r->numInterval != (uint32_t)group->files.num_strings) {
+                LogError("Archive %s: %u blocks, %u intervals written, expected %u, %d", archive, nffile_r->file_header->NumBlocks,
+                         nffile_r->numInterval, numBlocks, group->files.num_strings);
+                ok = 0;
+            }
+            CloseFile(nffile_r);
+            DisposeFile(nffile_r);
+        }
+    }
+
+    if (!ok) {
+        unlink(tmpFile);
+        LogError("Failed to compact archive %s", archive);
+        return 0;
+    }
+    if (rename(tmpFile, archive) < 0) {
+        LogError("rename() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        unlink(tmpFile);
+        return 0;
+    }
+
+    if (!param->keep) {
+        for (int i = 0; i < group->files.num_strings; i++) {
+            if (unlink(group->files.list[i]) < 0) LogError("unlink() error '%s': %s", group->files.list[i], strerror(errno));
+        }
+    }
+    printf("Archive %s: %d interval files, %u blocks\n", archive, group->files.num_strings, numBlocks);
+
+    return 1;
+
+}  // End of CompactGroup
+
+// compact the interval files of all completed periods in datadir and its sub directories
+static int CompactDir(char *datadir, compactParam_t *param) {
+    char *const roots[2] = {datadir, NULL};
+    FTS *fts = fts_open(roots, FTS_LOGICAL, compare);
+    if (!fts) {
+        LogError("fts_open() error '%s': %s", datadir, strerror(errno));
+        return 0;
+    }
+
+    archiveGroup_t group = {0};
+    InitStringlist(&group.files, 256);
+    size_t periodLen = param->daily ? 8 : 10;
+    time_t now = time(NULL);
+    int numArchives = 0;
+    int numFailed = 0;
+
+    FTSENT *ftsent;
+    while ((ftsent = fts_read(fts)) != NULL) {
+        if (ftsent->fts_info != FTS_F || !IntervalFile(ftsent->fts_name)) continue;
+
+        char *timeString = ftsent->fts_name + 7;
+        size_t dirLen = ftsent->fts_pathlen - ftsent->fts_namelen - 1;
+        if (dirLen >= sizeof(group.dir)) continue;
+
+        // the files of a directory are visited in name order - a new directory or period ends the group
+        if (group.files.num_strings &&
+            (strlen(group.dir) != dirLen || strncmp(group.dir, ftsent->fts_path, dirLen) != 0 || strncmp(group.period, timeString, periodLen) != 0)) {
+            // the collector may still write files of the current period
+            if (PeriodEnd(group.period) <= now) {
+                if (CompactGroup(&group, param))
+                    numArchives++;
+                else
+                    numFailed++;
+            }
+            for (int i = 0; i < group.files.num_strings; i++) free(group.files.list[i]);
+            group.files.num_strings = 0;
+        }
+        if (group.files.num_strings == 0) {
+            memcpy(group.dir, ftsent->fts_path, dirLen);
+            group.dir[dirLen] = '\0';
+            memcpy(group.period, timeString, periodLen);
+            group.period[periodLen] = '\0';
+        }
+        InsertString(&group.files, ftsent->fts_path);
+    }
+    fts_close(fts);
+
+    if (group.files.num_strings && PeriodEnd(group.period) <= now) {
+        if (CompactGroup(&group, param))
+            numArchives++;
+        else
+            numFailed++;
+    }
+    for (int i = 0; i < group.files.num_strings; i++) free(group.files.list[i]);
+    free(group.files.list);
+
+    printf("Compacted %d archives, %d failed\n", numArchives, numFailed);
+    return numFailed == 0;
+
+}  // End of CompactDir
+
+int main(int argc, char **argv) {
+    char *datadir = NULL;
+    compactParam_t param = {.compress = -1};
+
+    int c;
+    while ((c = getopt(argc, argv, "Dhkl:nsz:")) != EOF) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'D':
+                param.daily = 1;
+                break;
+            case 'k':
+                param.keep = 1;
+                break;
+            case 'l':
+                CheckArgLen(optarg, MAXPATHLEN);
+                datadir = optarg;
+                break;
+            case 'n':
+                param.dryRun = 1;
+                break;
+            case 's':
+                SetBlockSort(1);
+                break;
+            case 'z':
+                param.compress = ParseCompression(optarg);
+                if (param.compress < 0) {
+                    LogError("Usage for option -z: set -z=lzo, -z=lz4, -z=bz2 or -z=zstd");
+                    exit(250);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(250);
+        }
+    }
+
+    if (!datadir) {
+        LogError("Expect -l <datadir>");
+        usage(argv[0]);
+        exit(250);
+    }
+    if (TestPath(datadir, S_IFDIR) != PATH_OK) {
+        LogError("No such directory: %s", datadir);
+        exit(250);
+    }
+
+    if (ConfOpen(NULL, "nfcompact") < 0 || !Init_nffile(0, NULL)) exit(250);
+
+    return CompactDir(datadir, &param) ? 0 : 250;
+
+}  // End of main
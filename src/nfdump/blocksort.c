@@ -30,15 +30,19 @@
 #include "blocksort.h"
 
 #include <fcntl.h>
-#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "taskpool.h"
+
 void blocksort(SortElement_t *data, int len);
 
+void blockselect(SortElement_t *data, int len, int topN, int ascending);
+
 #define swap(a, b)              \
     {                           \
         SortElement_t _h = (a); \
@@ -75,20 +79,15 @@ void blocksort(SortElement_t *data, int len);
         }                                \
     }
 
-static int max_threads;
-static int n_threads;
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
-
 // static void init(SortElement_t *data, int len);
 
-static void qusort(SortElement_t *left, SortElement_t *right);
+static void qusort(SortElement_t *left, SortElement_t *right, taskGroup_t *group);
 
 static void insert_sort(SortElement_t *left, SortElement_t *right);
 
 static void partition(SortElement_t *left0, SortElement_t *right0, SortElement_t **l1, SortElement_t **r1, SortElement_t **l2, SortElement_t **r2);
 
-static void *sort_thr(void *arg);
+static void sort_task(void *arg);
 
 void insert_sort(SortElement_t *left, SortElement_t *right) {
     // put minimum to left position, so we can save
@@ -143,53 +142,154 @@ static void partition(SortElement_t *left0, SortElement_t *right0, SortElement_t
     }
 }
 
-static void *sort_thr(void *arg) {
-    SortElement_t **par = (SortElement_t **)arg;
-    qusort(par[0], par[1]);
+typedef struct sortParam_s {
+    SortElement_t *left;
+    SortElement_t *right;
+    taskGroup_t *group;
+} sortParam_t;
+
+static void sort_task(void *arg) {
+    sortParam_t *param = (sortParam_t *)arg;
+    qusort(param->left, param->right, param->group);
     free(arg);
-    pthread_mutex_lock(&mutex);
-    n_threads--;
-    if (n_threads <= 0) {
-        pthread_cond_signal(&cond);
-    }
-    pthread_mutex_unlock(&mutex);
-    return NULL;
 }
 
 static void qusort_single(SortElement_t *left, SortElement_t *right) {
     SortElement_t *l, *r;
     while (right - left >= 50) {
         partition(left, right, &l, &r, &left, &right);
-        qusort(l, r);
+        qusort(l, r, NULL);
     }
     insert_sort(left, right);
 }
 
-static void qusort(SortElement_t *left, SortElement_t *right) {
+// large partitions are submitted as tasks to the group, if any. The pool
+// worker, which runs out of work, steals them
+static void qusort(SortElement_t *left, SortElement_t *right, taskGroup_t *group) {
     while (right - left >= 50) {
         SortElement_t *l, *r;
         partition(left, right, &l, &r, &left, &right);
 
-        if (right - left > 100000 && n_threads < max_threads) {
-            // start a new thread - max_threads is a soft limit
-            pthread_t thread;
-            SortElement_t **param = (SortElement_t **)malloc(2 * sizeof(SortElement_t *));
+        if (group && right - left > 100000) {
+            sortParam_t *param = (sortParam_t *)malloc(sizeof(sortParam_t));
             if (!param) abort();
-            param[0] = left;
-            param[1] = right;
-            pthread_mutex_lock(&mutex);
-            n_threads++;
-            pthread_mutex_unlock(&mutex);
-            pthread_create(&thread, NULL, sort_thr, param);
+            param->left = left;
+            param->right = right;
+            param->group = group;
+            TaskSubmit(group, sort_task, param);
             left = l;
             right = r;
         } else {
-            qusort(l, r);
+            qusort(l, r, group);
         }
     }
     insert_sort(left, right);
 }
 
+// LSD radix sort for large arrays. The array is split into one range per thread.
+// For each 8 bit digit, every thread counts the digits of its range, then scatters
+// its range stable into the second buffer. Digits, which are equal for all elements,
+// such as the upper bytes of msec timestamps, are skipped.
+#define RADIXTHRESHOLD 100000
+#define MAXRADIXTHREADS 16
+
+typedef struct radixParam_s {
+    SortElement_t *src;
+    SortElement_t *dst;
+    int start;
+    int end;
+    int shift;
+    uint32_t count[256];  // digit histogram, scatter offsets
+} radixParam_t;
+
+static void radix_count_task(void *arg) {
+    radixParam_t *param = (radixParam_t *)arg;
+    uint32_t *count = param->count;
+    SortElement_t *src = param->src;
+    int shift = param->shift;
+
+    memset(count, 0, 256 * sizeof(uint32_t));
+    for (int i = param->start; i < param->end; i++) count[(src[i].count >> shift) & 0xFF]++;
+
+}  // End of radix_count_task
+
+static void radix_scatter_task(void *arg) {
+    radixParam_t *param = (radixParam_t *)arg;
+    uint32_t *offset = param->count;
+    SortElement_t *src = param->src;
+    SortElement_t *dst = param->dst;
+    int shift = param->shift;
+
+    for (int i = param->start; i < param->end; i++) dst[offset[(src[i].count >> shift) & 0xFF]++] = src[i];
+
+}  // End of radix_scatter_task
+
+static void radix_run(radixParam_t *param, int numThreads, taskFunc_t func) {
+    taskGroup_t group = TASKGROUP_INITIALIZER;
+    for (int t = 1; t < numThreads; t++) TaskSubmit(&group, func, &param[t]);
+    func(&param[0]);
+    TaskWait(&group);
+
+}  // End of radix_run
+
+static int radixsort(SortElement_t *data, int len) {
+    // nothing to do for presorted arrays
+    int i = 1;
+    while (i < len && data[i - 1].count <= data[i].count) i++;
+    if (i == len) return 1;
+
+    SortElement_t *buff = malloc(len * sizeof(SortElement_t));
+    if (!buff) return 0;
+
+    int numThreads = TaskPoolWorkers();
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > MAXRADIXTHREADS) numThreads = MAXRADIXTHREADS;
+    if (numThreads > len / (RADIXTHRESHOLD / 4)) numThreads = len / (RADIXTHRESHOLD / 4);
+
+    radixParam_t param[MAXRADIXTHREADS];
+    int range = len / numThreads;
+    for (int t = 0; t < numThreads; t++) {
+        param[t].start = t * range;
+        param[t].end = t == (numThreads - 1) ? len : (t + 1) * range;
+    }
+
+    SortElement_t *src = data;
+    SortElement_t *dst = buff;
+    for (int shift = 0; shift < 64; shift += 8) {
+        for (int t = 0; t < numThreads; t++) {
+            param[t].src = src;
+            param[t].dst = dst;
+            param[t].shift = shift;
+        }
+        radix_run(param, numThreads, radix_count_task);
+
+        // convert the histograms into scatter offsets: by digit, then by thread
+        uint32_t offset = 0;
+        int trivial = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            uint32_t total = 0;
+            for (int t = 0; t < numThreads; t++) {
+                uint32_t cnt = param[t].count[digit];
+                param[t].count[digit] = offset + total;
+                total += cnt;
+            }
+            if (total == (uint32_t)len) trivial = 1;
+            offset += total;
+        }
+        if (trivial) continue;
+
+        radix_run(param, numThreads, radix_scatter_task);
+        SortElement_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != data) memcpy((void *)data, (void *)src, len * sizeof(SortElement_t));
+    free(buff);
+    return 1;
+
+}  // End of radixsort
+
 void blocksort(SortElement_t *data, int len) {
     // shortcut for few entries
     if (len < 50) {
@@ -199,22 +299,122 @@ void blocksort(SortElement_t *data, int len) {
         return;
     }
 
-    int n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
-    if (n_cpus > 0)
-        max_threads = n_cpus * 2;
-    else
-        max_threads = 8;
-
-    pthread_t thread;
-    SortElement_t **param = (SortElement_t **)malloc(2 * sizeof(SortElement_t *));
-    if (!param) abort();
-    param[0] = data;
-    param[1] = data + len - 1;
-    pthread_create(&thread, NULL, sort_thr, param);
-
-    pthread_mutex_lock(&mutex);
-    n_threads++;
-    while (n_threads > 0) pthread_cond_wait(&cond, &mutex);
-    pthread_mutex_unlock(&mutex);
-
-}  // End of blocksort
\ No newline at end of file
+    if (len >= RADIXTHRESHOLD && radixsort(data, len)) return;
+
+    // this thread sorts the first partitions and helps with the rest
+    taskGroup_t group = TASKGROUP_INITIALIZER;
+    qusort(data, data + len - 1, &group);
+    TaskWait(&group);
+
+}  // End of blocksort
+
+// arrange [left, right] such that *nth holds the element, which would be at this
+// position in a sorted array. All elements left of nth are <= and all elements
+// right of nth are >= nth. Falls back to a full sort of the remaining range, if
+// the partitioning degenerates
+static void nth_element(SortElement_t *left, SortElement_t *right, SortElement_t *nth) {
+    int depth = 0;
+    for (long n = right - left; n > 1; n >>= 1) depth += 2;
+
+    while (right - left >= 50) {
+        if (depth-- == 0) {
+            qusort_single(left, right);
+            return;
+        }
+        SortElement_t *mid = left + (right - left) / 2;
+        sort3fast(*left, *mid, *right);
+        uint64_t piv = mid->count;
+
+        SortElement_t *l = left;
+        SortElement_t *r = right;
+        while (l <= r) {
+            while (l->count < piv) l++;
+            while (r->count > piv) r--;
+            if (l <= r) {
+                swap(*l, *r);
+                l++;
+                r--;
+            }
+        }
+        if (nth <= r)
+            right = r;
+        else if (nth >= l)
+            left = l;
+        else
+            return;
+    }
+    insert_sort(left, right);
+
+}  // End of nth_element
+
+typedef struct selectParam_s {
+    SortElement_t *left;
+    SortElement_t *right;
+    SortElement_t *nth;
+} selectParam_t;
+
+static void select_task(void *arg) {
+    selectParam_t *param = (selectParam_t *)arg;
+    nth_element(param->left, param->right, param->nth);
+}  // End of select_task
+
+// partial sort for top N lists: the topN smallest elements are sorted at the beginning
+// of the array for ascending, the topN largest elements are sorted at the end of the array
+// for descending order. The rest of the array is left unsorted. Large arrays are split into
+// chunks, preselected in parallel and the candidates merged before the final selection.
+void blockselect(SortElement_t *data, int len, int topN, int ascending) {
+    // full sort required or not worth the effort
+    if (topN <= 0 || len < 50 || topN > (len >> 2)) {
+        blocksort(data, len);
+        return;
+    }
+
+    int numChunks = TaskPoolWorkers();
+    if (numChunks < 1) numChunks = 1;
+    if (numChunks > 16) numChunks = 16;
+    int chunkSize = len / numChunks;
+    if (len < 100000) numChunks = 1;
+    while (numChunks > 1 && chunkSize < numChunks * topN) {
+        numChunks >>= 1;
+        chunkSize = len / numChunks;
+    }
+
+    if (numChunks > 1) {
+        // preselect topN candidates in every chunk
+        taskGroup_t group = TASKGROUP_INITIALIZER;
+        selectParam_t param[16];
+        for (int i = 0; i < numChunks; i++) {
+            SortElement_t *left = data + i * chunkSize;
+            SortElement_t *right = i == (numChunks - 1) ? data + len - 1 : left + chunkSize - 1;
+            param[i].left = left;
+            param[i].right = right;
+            param[i].nth = ascending ? left + topN - 1 : right - topN + 1;
+            TaskSubmit(&group, select_task, &param[i]);
+        }
+        TaskWait(&group);
+
+        // move candidates next to each other into the first, respectively last chunk
+        for (int i = 0; i < numChunks; i++) {
+            SortElement_t *src = ascending ? param[i].left : param[i].right - topN + 1;
+            SortElement_t *dst = ascending ? data + i * topN : data + len - (numChunks - i) * topN;
+            if (src == dst) continue;
+            for (int j = 0; j < topN; j++) swap(src[j], dst[j]);
+        }
+
+        // final selection over all candidates
+        int numCandidates = numChunks * topN;
+        if (ascending)
+            nth_element(data, data + numCandidates - 1, data + topN - 1);
+        else
+            nth_element(data + len - numCandidates, data + len - 1, data + len - topN);
+    } else {
+        if (ascending)
+            nth_element(data, data + len - 1, data + topN - 1);
+        else
+            nth_element(data, data + len - 1, data + len - topN);
+    }
+
+    // sort the topN elements
+    blocksort(ascending ? data : data + len - topN, topN);
+
+}  // End of blockselect
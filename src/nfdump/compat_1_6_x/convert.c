@@ -29,6 +29,7 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,17 +40,147 @@
 #include "nfx.h"
 #include "util.h"
 
-static extension_map_list_t *extension_map_list = NULL;
+/*
+ * The extension maps of a v2 block are valid for all following records of the
+ * same reader. PrepareBlockType2() processes the blocks of a reader in file order,
+ * inserts the extension maps into the list of the reader and binds each record
+ * to its map in a block local map table. The record's ext_map is replaced by the
+ * index into this table. ConvertBlockType2() then only needs the block and its
+ * map table, so blocks can be converted in any order by any worker.
+ * Extension infos are never freed, while the reader's map list exists.
+ */
+struct compat16_s {
+    extension_map_list_t *extension_map_list;
+};
+
+struct compatMaps_s {
+    uint32_t numMaps;
+    uint32_t maxMaps;
+    extension_info_t **info;
+};
+
+// ext_map of a record without a valid extension map
+#define NOMAP 0xFFFF
+
+static inline int ConvertRecordV2(common_record_t *commonRecord, extension_info_t *extension_info, dataBlock_t *dataBlock);
+
+compat16_t *NewCompat16(void) {
+    compat16_t *compat16 = calloc(1, sizeof(compat16_t));
+    if (!compat16) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    compat16->extension_map_list = InitExtensionMaps(NEEDS_EXTENSION_LIST);
+    if (!compat16->extension_map_list) {
+        free(compat16);
+        return NULL;
+    }
+    return compat16;
+
+}  // End of NewCompat16
+
+void DisposeCompat16(compat16_t *compat16) {
+    if (!compat16) return;
+    FreeExtensionMaps(compat16->extension_map_list);
+    free(compat16);
+
+}  // End of DisposeCompat16
+
+void FreeCompatMaps(compatMaps_t *compatMaps) {
+    if (!compatMaps) return;
+    free(compatMaps->info);
+    free(compatMaps);
+
+}  // End of FreeCompatMaps
+
+// returns the index of extension_info in the block map table
+static uint32_t BindMap(compatMaps_t *compatMaps, extension_info_t *extension_info) {
+    for (uint32_t i = 0; i < compatMaps->numMaps; i++) {
+        if (compatMaps->info[i] == extension_info) return i;
+    }
+    if (compatMaps->numMaps == compatMaps->maxMaps) {
+        compatMaps->maxMaps += 8;
+        compatMaps->info = realloc(compatMaps->info, compatMaps->maxMaps * sizeof(extension_info_t *));
+        if (!compatMaps->info) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+    compatMaps->info[compatMaps->numMaps] = extension_info;
+    return compatMaps->numMaps++;
+
+}  // End of BindMap
+
+/*
+ * Sequential part of the v2 block conversion. Must be called for all v2 blocks of
+ * a reader in file order. Returns the map table of the block in *compatMaps and the
+ * number of records of the converted block.
+ */
+uint32_t PrepareBlockType2(compat16_t *compat16, dataBlock_t *v2DataBlock, compatMaps_t **compatMaps) {
+    extension_map_list_t *extension_map_list = compat16->extension_map_list;
+    compatMaps_t *maps = calloc(1, sizeof(compatMaps_t));
+    if (!maps) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    *compatMaps = maps;
+
+    uint32_t numRecords = 0;
+    uint32_t lastMapID = NOMAP;
+    uint32_t lastIndex = NOMAP;
+    record_header_t *v2record_ptr = GetCursor(v2DataBlock);
+    uint32_t sumSize = 0;
+    for (int i = 0; i < v2DataBlock->NumRecords; i++) {
+        if ((sumSize + v2record_ptr->size) > v2DataBlock->size || (v2record_ptr->size < sizeof(record_header_t))) {
+            // reported by ConvertBlockType2
+            break;
+        }
+        sumSize += v2record_ptr->size;
+
+        switch (v2record_ptr->type) {
+            case CommonRecordType: {
+                common_record_t *commonRecord = (common_record_t *)v2record_ptr;
+                uint32_t map_id = commonRecord->ext_map;
+                if (map_id == lastMapID) {
+                    // most records use the same map as the previous one
+                    commonRecord->ext_map = lastIndex;
+                } else if (map_id >= MAX_EXTENSION_MAPS) {
+                    LogError("Corrupt data file. Extension map id %u too big.\n", map_id);
+                    commonRecord->ext_map = NOMAP;
+                } else if (extension_map_list->slot[map_id] == NULL) {
+                    LogError("Corrupt data file. Missing extension map %u. Skip record.\n", map_id);
+                    commonRecord->ext_map = NOMAP;
+                } else {
+                    lastMapID = map_id;
+                    lastIndex = BindMap(maps, extension_map_list->slot[map_id]);
+                    commonRecord->ext_map = lastIndex;
+                }
+                if (commonRecord->ext_map != NOMAP) numRecords++;
+            } break;
+            case ExtensionMapType: {
+                extension_map_t *map = (extension_map_t *)v2record_ptr;
+                if (Insert_Extension_Map(extension_map_list, map) < 0) {
+                    LogError("Corrupt data file. Unable to decode at %s line %d\n", __FILE__, __LINE__);
+                    exit(EXIT_FAILURE);
+                }
+                // the map may replace the map of the same id
+                lastMapID = NOMAP;
+            } break;
+            case ExporterInfoRecordType:
+            case ExporterStatRecordType:
+            case SamplerLegacyRecordType:
+                numRecords++;
+                break;
+        }
 
-static inline int ConvertRecordV2(common_record_t *commonRecord, dataBlock_t *dataBlock);
+        v2record_ptr = (record_header_t *)((void *)v2record_ptr + v2record_ptr->size);
+    }
 
-static void InitCompat16(void) {
-    if (extension_map_list) return;
+    return numRecords;
 
-    extension_map_list = InitExtensionMaps(NEEDS_EXTENSION_LIST);
-}  // End of InitCompat16
+}  // End of PrepareBlockType2
 
-static inline int ConvertRecordV2(common_record_t *commonRecord, dataBlock_t *dataBlock) {
+static inline int ConvertRecordV2(common_record_t *commonRecord, extension_info_t *extension_info, dataBlock_t *dataBlock) {
     /*
      * v2 blocks are max 1MB. v3 blocks have 2MB.
      * each v2 block can be stored in a v3 block
@@ -62,20 +193,10 @@ static inline int ConvertRecordV2(common_record_t *commonRecord, dataBlock_t *da
     void *p = commonRecord->data;
 
     // valid flow_record converted if needed
-    uint32_t map_id = commonRecord->ext_map;
-    if (map_id >= MAX_EXTENSION_MAPS) {
-        LogError("Corrupt data file. Extension map id %u too big.\n", commonRecord->ext_map);
-        return 0;
-    }
-    if (extension_map_list->slot[map_id] == NULL) {
-        LogError("Corrupt data file. Missing extension map %u. Skip record.\n", commonRecord->ext_map);
-        return 0;
-    }
     if (commonRecord->size > 2048) {
         LogError("Corrupt data file. record size %u. Skip record.\n", commonRecord->size);
         return 0;
     }
-    extension_info_t *extension_info = extension_map_list->slot[map_id];
     extension_map_t *extension_map = extension_info->map;
 
     AddV3Header(v3record_ptr, recordHeader);
@@ -442,7 +563,8 @@ static inline int ConvertRecordV2(common_record_t *commonRecord, dataBlock_t *da
 
 }  // End of ConvertRecordV2
 
-void ConvertBlockType2(dataBlock_t *v2DataBlock, dataBlock_t *v3DataBlock) {
+// convert a v2 block, prepared by PrepareBlockType2(), into a v3 block
+void ConvertBlockType2(dataBlock_t *v2DataBlock, compatMaps_t *compatMaps, dataBlock_t *v3DataBlock) {
     record_header_t *v2record_ptr = GetCursor(v2DataBlock);
     uint32_t sumSize = 0;
     for (int i = 0; i < v2DataBlock->NumRecords; i++) {
@@ -451,19 +573,18 @@ void ConvertBlockType2(dataBlock_t *v2DataBlock, dataBlock_t *v3DataBlock) {
             sumSize = 0;
             break;
         }
+        sumSize += v2record_ptr->size;
 
         switch (v2record_ptr->type) {
             case CommonRecordType: {
-                ConvertRecordV2((common_record_t *)v2record_ptr, v3DataBlock);
-            } break;
-            case ExtensionMapType: {
-                InitCompat16();
-                extension_map_t *map = (extension_map_t *)v2record_ptr;
-                if (Insert_Extension_Map(extension_map_list, map) < 0) {
-                    LogError("Corrupt data file. Unable to decode at %s line %d\n", __FILE__, __LINE__);
-                    exit(EXIT_FAILURE);
-                }
+                common_record_t *commonRecord = (common_record_t *)v2record_ptr;
+                // records without a valid map were reported by PrepareBlockType2
+                if (commonRecord->ext_map < compatMaps->numMaps)
+                    ConvertRecordV2(commonRecord, compatMaps->info[commonRecord->ext_map], v3DataBlock);
             } break;
+            case ExtensionMapType:
+                // inserted by PrepareBlockType2
+                break;
             // other records just copy
             case ExporterInfoRecordType:
             case ExporterStatRecordType:
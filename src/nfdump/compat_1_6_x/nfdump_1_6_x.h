@@ -37,6 +37,20 @@
 #include "nffileV2.h"
 #include "nfxV3.h"
 
-void ConvertBlockType2(dataBlock_t *v2DataBlock, dataBlock_t *v3DataBlock);
+// extension maps of a reader of 1.6.x files
+typedef struct compat16_s compat16_t;
+
+// extension maps of the records of a v2 block
+typedef struct compatMaps_s compatMaps_t;
+
+compat16_t *NewCompat16(void);
+
+void DisposeCompat16(compat16_t *compat16);
+
+uint32_t PrepareBlockType2(compat16_t *compat16, dataBlock_t *v2DataBlock, compatMaps_t **compatMaps);
+
+void ConvertBlockType2(dataBlock_t *v2DataBlock, compatMaps_t *compatMaps, dataBlock_t *v3DataBlock);
+
+void FreeCompatMaps(compatMaps_t *compatMaps);
 
 #endif  //_NFDUMP_H
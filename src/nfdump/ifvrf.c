@@ -32,6 +32,7 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -40,9 +41,13 @@
 
 typedef struct nameNode_s {
     uint32_t ingress;
-    char *name;
+    char *name;  // formatted output name " <name>"
 } nameNode_t;
 
+// names of interfaces and vrfs with an index below NAMEARRAYSIZE are additionally
+// stored in a dense array, so the per record lookup is a direct array index
+#define NAMEARRAYSIZE 65536
+
 static inline int nodeCMP(nameNode_t a, nameNode_t b) {
     if (a.ingress == b.ingress) return 0;
     return a.ingress > b.ingress ? 1 : -1;
@@ -54,10 +59,34 @@ KBTREE_INIT(vrfTree, nameNode_t, nodeCMP)
 static kbtree_t(ifTree) *ifTree = NULL;
 static kbtree_t(vrfTree) *vrfTree = NULL;
 
+static char **ifArray = NULL;
+static char **vrfArray = NULL;
+
+static char *FormatName(char *name) {
+    size_t len = strlen(name) + 2;
+    char *s = malloc(len);
+    if (!s) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    snprintf(s, len, " %s", name);
+    return s;
+
+}  // End of FormatName
+
+// copy a formatted name into the output buffer
+static inline char *CopyName(char *formatted, char *name, size_t len) {
+    strncpy(name, formatted, len);
+    name[len - 1] = '\0';
+    return name;
+
+}  // End of CopyName
+
 int AddIfNameRecord(arrayRecordHeader_t *arrayRecordHeader) {
     if (ifTree == NULL) {
         ifTree = kb_init(ifTree, KB_DEFAULT_SIZE);
-        if (!ifTree) {
+        ifArray = calloc(NAMEARRAYSIZE, sizeof(char *));
+        if (!ifTree || !ifArray) {
             LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
             return 0;
         }
@@ -74,11 +103,13 @@ int AddIfNameRecord(arrayRecordHeader_t *arrayRecordHeader) {
         nameNode_t *node = kb_getp(ifTree, ifTree, &nameNode);
         if (node) {
             free(node->name);
-            node->name = strdup(name);
+            node->name = FormatName(name);
         } else {
-            nameNode.name = strdup(name);
+            nameNode.name = FormatName(name);
             kb_putp(ifTree, ifTree, &nameNode);
+            node = &nameNode;
         }
+        if (*ingress && *ingress < NAMEARRAYSIZE) ifArray[*ingress] = node->name;
 
         p += arrayRecordHeader->elementSize;
     }
@@ -90,7 +121,8 @@ int AddIfNameRecord(arrayRecordHeader_t *arrayRecordHeader) {
 int AddVrfNameRecord(arrayRecordHeader_t *arrayRecordHeader) {
     if (vrfTree == NULL) {
         vrfTree = kb_init(vrfTree, KB_DEFAULT_SIZE);
-        if (!vrfTree) {
+        vrfArray = calloc(NAMEARRAYSIZE, sizeof(char *));
+        if (!vrfTree || !vrfArray) {
             LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
             return 0;
         }
@@ -107,11 +139,13 @@ int AddVrfNameRecord(arrayRecordHeader_t *arrayRecordHeader) {
         nameNode_t *node = kb_getp(vrfTree, vrfTree, &nameNode);
         if (node) {
             free(node->name);
-            node->name = strdup(name);
+            node->name = FormatName(name);
         } else {
-            nameNode.name = strdup(name);
+            nameNode.name = FormatName(name);
             kb_putp(vrfTree, vrfTree, &nameNode);
+            node = &nameNode;
         }
+        if (*ingress && *ingress < NAMEARRAYSIZE) vrfArray[*ingress] = node->name;
 
         p += arrayRecordHeader->elementSize;
     }
@@ -123,11 +157,14 @@ int AddVrfNameRecord(arrayRecordHeader_t *arrayRecordHeader) {
 char *GetIfName(uint32_t ingress, char *name, size_t len) {
     name[0] = '\0';
     if (ifTree) {
+        if (ingress < NAMEARRAYSIZE && ifArray[ingress]) {
+            return CopyName(ifArray[ingress], name, len);
+        }
         if (ingress != 0) {
             nameNode_t nameNode = {.ingress = ingress, .name = NULL};
             nameNode_t *node = kb_getp(ifTree, ifTree, &nameNode);
             if (node) {
-                snprintf(name, len, " %s", node->name);
+                CopyName(node->name, name, len);
             } else {
                 strncpy(name, " <ingress not found>", len);
             }
@@ -143,11 +180,14 @@ char *GetIfName(uint32_t ingress, char *name, size_t len) {
 char *GetVrfName(uint32_t ingress, char *name, size_t len) {
     name[0] = '\0';
     if (vrfTree) {
-        if (vrfTree && ingress != 0) {
+        if (ingress < NAMEARRAYSIZE && vrfArray[ingress]) {
+            return CopyName(vrfArray[ingress], name, len);
+        }
+        if (ingress != 0) {
             nameNode_t nameNode = {.ingress = ingress, .name = NULL};
             nameNode_t *node = kb_getp(vrfTree, vrfTree, &nameNode);
             if (node) {
-                snprintf(name, len, " %s", node->name);
+                CopyName(node->name, name, len);
             } else {
                 strncpy(name, " <ingress not found>", len);
             }
@@ -34,6 +34,9 @@
 #define ALIGN_MASK 0xFFFFFFFC
 #endif
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "spin_lock.h"
 
 #define GetLock(a) spin_lock(((a)->lock))
@@ -51,15 +54,22 @@
 // Each pre-allocated memory block is 10M
 #define DefaultMemBlockSize 10 * 1024 * 1024
 
+// memory blocks and large arrays may be backed by 2M transparent huge pages
+#define HUGEPAGESIZE (2 * 1024 * 1024)
+
+/*
+ * Each thread allocates from its own memory block, so the threads neither
+ * contend for the lock nor share cache lines. The lock protects only the list
+ * of all memory blocks, when a thread needs a new block.
+ */
 typedef struct MemHandler_s {
     size_t BlockSize; /* max size of each pre-allocated memblock */
+    int hugePages;    /* memblocks are backed by huge pages */
 
     /* memory blocks - containing the flow records and keys */
-    void **memblock;      /* array holding all NumBlocks allocated memory blocks */
-    uint32_t MaxBlocks;   /* Size of memblock array */
-    uint32_t NumBlocks;   /* number of allocated flow blocks in memblock array */
-    int32_t CurrentBlock; /* Index of current memblock to allocate memory from */
-    uint32_t Allocted;    /* Number of bytes already allocated in memblock */
+    void **memblock;    /* array holding all NumBlocks allocated memory blocks */
+    uint32_t MaxBlocks; /* Size of memblock array */
+    uint32_t NumBlocks; /* number of allocated flow blocks in memblock array */
 
     atomic_int lock;
 
@@ -67,6 +77,12 @@ typedef struct MemHandler_s {
 
 static MemHandler_t *MemHandler = NULL;
 
+// the current memblock of a thread is valid for the generation of the MemHandler
+static _Atomic uint32_t memGeneration = 0;
+static __thread void *threadBlock = NULL;
+static __thread size_t threadAllocated = 0;
+static __thread uint32_t threadGeneration = 0;
+
 #define MaxMemBlocks 256
 
 static int nfalloc_Init(uint32_t memBlockSize) {
@@ -84,13 +100,18 @@ static int nfalloc_Init(uint32_t memBlockSize) {
 
     if (memBlockSize == 0) memBlockSize = DefaultMemBlockSize;
 
+    MemHandler->hugePages = ConfGetValue("hugepages") > 0;
+    // huge page backed memblocks are a multiple of the huge page size
+    if (MemHandler->hugePages) memBlockSize = (memBlockSize + HUGEPAGESIZE - 1) & ~(HUGEPAGESIZE - 1);
+
     MemHandler->BlockSize = memBlockSize;  // size of each memory block
     MemHandler->MaxBlocks = MaxMemBlocks;  // number of max blocks
     MemHandler->NumBlocks = 0;             // total allocated block
-    MemHandler->CurrentBlock = -1;         // index of current active block
-    MemHandler->Allocted = memBlockSize;   // init state - force new allocation with next nfmalloc
     MemHandler->lock = 0;
 
+    // force a new memblock for all threads with the next nfmalloc
+    atomic_fetch_add(&memGeneration, 1);
+
     return 1;
 
 }  // End of nfalloc_Init
@@ -98,12 +119,13 @@ static int nfalloc_Init(uint32_t memBlockSize) {
 static void nfalloc_free(void) {
     if (!MemHandler) return;
 
+    // all memblocks of the threads become invalid
+    atomic_fetch_add(&memGeneration, 1);
+
     for (int i = 0; i < MemHandler->NumBlocks; i++) {
         free(MemHandler->memblock[i]);
     }
     MemHandler->NumBlocks = 0;
-    MemHandler->CurrentBlock = -1;
-    MemHandler->Allocted = MemHandler->BlockSize;
 
     free((void *)MemHandler->memblock);
     MemHandler->memblock = NULL;
@@ -113,24 +135,50 @@ static void nfalloc_free(void) {
     MemHandler = NULL;
 }  // End of nfalloc_free
 
-static inline void *nfmalloc(size_t size) {
-    // make sure size of memory is aligned
-    size_t aligned_size = (((size) + ALIGN_BYTES) & ~ALIGN_BYTES);
+// madvise the whole pages within a range. madvise needs a page aligned range
+static inline void nfpageadvise(void *p, size_t size, int advice) {
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)p + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t end = ((uintptr_t)p + size) & ~(pageSize - 1);
+    if (end > start) madvise((void *)start, end - start, advice);
+}  // End of nfpageadvise
+
+// advise the kernel to back a large array with transparent huge pages
+static inline void nfhugeadvise(void *p, size_t size) {
+#ifdef MADV_HUGEPAGE
+    if (!MemHandler || !MemHandler->hugePages || size < HUGEPAGESIZE) return;
+    nfpageadvise(p, size, MADV_HUGEPAGE);
+#endif
+}  // End of nfhugeadvise
 
-    GetLock(MemHandler);
-    if ((MemHandler->Allocted + aligned_size) <= MemHandler->BlockSize) {
-        // enough space available in current memblock
-        void *p = MemHandler->memblock[MemHandler->CurrentBlock] + MemHandler->Allocted;
-        MemHandler->Allocted += aligned_size;
-        dbg_printf("Mem Handle: Requested: %zu, aligned: %zu, ptr: %lx\n", size, aligned_size, (long unsigned)p);
-        ReleaseLock(MemHandler);
-        return p;
+// return the pages of a no longer used range of a large array to the kernel
+// the range reads as zero afterwards. The array itself is freed later as usual
+static inline void nfreleaseadvise(void *p, size_t size) {
+#ifdef MADV_DONTNEED
+    nfpageadvise(p, size, MADV_DONTNEED);
+#endif
+}  // End of nfreleaseadvise
+
+// allocate a new memblock for the calling thread
+static void *nfalloc_block(void) {
+    void *p = NULL;
+#ifdef MADV_HUGEPAGE
+    if (MemHandler->hugePages) {
+        if (posix_memalign(&p, HUGEPAGESIZE, MemHandler->BlockSize) == 0) {
+            madvise(p, MemHandler->BlockSize, MADV_HUGEPAGE);
+        } else {
+            p = NULL;
+        }
+    } else
+#endif
+        p = malloc(MemHandler->BlockSize);
+    if (!p) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
     }
 
-    // not enough space - allocate a new memblock
-
-    MemHandler->CurrentBlock++;
-    if (MemHandler->CurrentBlock >= MemHandler->MaxBlocks) {
+    GetLock(MemHandler);
+    if (MemHandler->NumBlocks >= MemHandler->MaxBlocks) {
         // we run out in memblock array - re-allocate memblock array
         MemHandler->MaxBlocks += MaxMemBlocks;
         MemHandler->memblock = (void **)realloc(MemHandler->memblock, MemHandler->MaxBlocks * sizeof(void *));
@@ -139,17 +187,31 @@ static inline void *nfmalloc(size_t size) {
             exit(255);
         }
     }
+    MemHandler->memblock[MemHandler->NumBlocks++] = p;
+    ReleaseLock(MemHandler);
 
-    // allocate new memblock
-    void *p = malloc(MemHandler->BlockSize);
-    if (!p) {
-        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        exit(255);
+    return p;
+
+}  // End of nfalloc_block
+
+static inline void *nfmalloc(size_t size) {
+    // make sure size of memory is aligned
+    size_t aligned_size = (((size) + ALIGN_BYTES) & ~ALIGN_BYTES);
+
+    uint32_t generation = atomic_load_explicit(&memGeneration, memory_order_relaxed);
+    if (threadGeneration == generation && (threadAllocated + aligned_size) <= MemHandler->BlockSize) {
+        // enough space available in the memblock of this thread
+        void *p = threadBlock + threadAllocated;
+        threadAllocated += aligned_size;
+        dbg_printf("Mem Handle: Requested: %zu, aligned: %zu, ptr: %lx\n", size, aligned_size, (long unsigned)p);
+        return p;
     }
-    MemHandler->memblock[MemHandler->CurrentBlock] = p;
-    MemHandler->Allocted = aligned_size;
-    MemHandler->NumBlocks++;
-    ReleaseLock(MemHandler);
+
+    // not enough space - allocate a new memblock
+    void *p = nfalloc_block();
+    threadBlock = p;
+    threadAllocated = aligned_size;
+    threadGeneration = generation;
     dbg_printf("Mem Handle: Requested: %zu, aligned: %zu, ptr: %lu\n", size, aligned_size, (long unsigned)p);
     return p;
 
@@ -41,4 +41,8 @@ static inline void *nfcalloc(size_t count, size_t size);
 
 static inline void nffree(void *p);
 
+static inline void nfhugeadvise(void *p, size_t size);
+
+static inline void nfreleaseadvise(void *p, size_t size);
+
 #endif  //_MEMHANDLE_H
@@ -77,9 +77,30 @@ static kh_inline khint_t __HashFunc(const AppInfoHash_t record) {
 }  // End of __HashFunc
 
 // insert FlowHash definitions/code
-KHASH_INIT(NbarAppInfoHash, AppInfoHash_t, char, 0, __HashFunc, __HashEqual)
+// the value is the formatted app name, resolved when the nbar record is loaded
+KHASH_INIT(NbarAppInfoHash, AppInfoHash_t, char *, 1, __HashFunc, __HashEqual)
 static khash_t(NbarAppInfoHash) *NbarAppInfoHash = NULL;
 
+// format the app name as "name/description" once
+static char *FormatAppName(AppInfoHash_t *appInfo) {
+    char name[255];
+
+    name[0] = '\0';
+    if ((appInfo->app_name_length + appInfo->app_desc_length) > 253) {
+        LogError("Error nbar lookup in %s line %d: string length error\n", __FILE__, __LINE__);
+        return strdup("");
+    }
+    if (appInfo->app_name_length) {
+        snprintf(name, 255, "%s", appInfo->data + appInfo->app_id_length);
+    }
+    if (appInfo->app_desc_length) {
+        snprintf(name + strlen(name), 255 - strlen(name), "/%s", appInfo->data + appInfo->app_id_length + appInfo->app_name_length);
+    }
+    name[254] = '\0';
+    return strdup(name);
+
+}  // End of FormatAppName
+
 static void InsertNbarAppInfo(NbarAppInfo_t *nbarAppInfo, uint8_t *nbarData) {
     size_t dataSize = nbarAppInfo->app_id_length + nbarAppInfo->app_name_length + nbarAppInfo->app_desc_length;
     if (dataSize == 0 || dataSize > 4096) {
@@ -97,9 +118,11 @@ static void InsertNbarAppInfo(NbarAppInfo_t *nbarAppInfo, uint8_t *nbarData) {
     if (ret == 0) {  // existing entry
         dbg_printf("KHASH existing entry: %u %d\n", k, ret);
         if (kh_key(NbarAppInfoHash, k).data) free(kh_key(NbarAppInfoHash, k).data);
+        free(kh_value(NbarAppInfoHash, k));
     } else {
         dbg_printf("KHASH new entry: %u\n", k);
     }
+    kh_value(NbarAppInfoHash, k) = NULL;
     uint8_t *data = malloc(dataSize);
     if (!data) {
         LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
@@ -109,6 +132,7 @@ static void InsertNbarAppInfo(NbarAppInfo_t *nbarAppInfo, uint8_t *nbarData) {
     kh_key(NbarAppInfoHash, k).app_name_length = nbarAppInfo->app_name_length;
     kh_key(NbarAppInfoHash, k).app_desc_length = nbarAppInfo->app_desc_length;
     kh_key(NbarAppInfoHash, k).data = data;
+    kh_value(NbarAppInfoHash, k) = FormatAppName(&kh_key(NbarAppInfoHash, k));
 
 }  // end of InsertNbarAppInfo
 
@@ -158,8 +182,6 @@ int AddNbarRecord(arrayRecordHeader_t *nbarRecord) {
 }  // End of AddNbarRecord
 
 char *GetNbarInfo(uint8_t *id, size_t size) {
-    static char name[255];
-
     AppInfoHash_t AppInfoHash;
     memset((void *)&AppInfoHash, 0, sizeof(AppInfoHash_t));
     AppInfoHash.app_id_length = size;
@@ -176,20 +198,7 @@ char *GetNbarInfo(uint8_t *id, size_t size) {
         return 0;
     }
 
-    name[0] = '\0';
-    if ((kh_key(NbarAppInfoHash, k).app_name_length + kh_key(NbarAppInfoHash, k).app_desc_length) > 253) {
-        LogError("Error nbar lookup in %s line %d: string length error\n", __FILE__, __LINE__);
-        return "";
-    }
-    if (kh_key(NbarAppInfoHash, k).app_name_length) {
-        snprintf(name, 255, "%s", kh_key(NbarAppInfoHash, k).data + kh_key(NbarAppInfoHash, k).app_id_length);
-    }
-    if (kh_key(NbarAppInfoHash, k).app_desc_length) {
-        snprintf(name + strlen(name), 255 - strlen(name), "/%s",
-                 kh_key(NbarAppInfoHash, k).data + kh_key(NbarAppInfoHash, k).app_id_length + kh_key(NbarAppInfoHash, k).app_name_length);
-    }
-    name[254] = '\0';
-    return name;
+    return kh_value(NbarAppInfoHash, k);
 
 }  // End of GetNbarInfo
 
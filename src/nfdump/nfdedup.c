@@ -0,0 +1,182 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Drop flows, which are exported by more than one exporter
+ * A flow crossing several routers is exported by each of them. Two records are
+ * observations of the same flow, if they have the same 5-tuple, their start times
+ * differ by no more than the dedup window and they come from different exporters.
+ * The first observation is kept, all later ones are dropped.
+ *
+ * The table keeps a 64bit fingerprint of the 5-tuple of each kept flow. Entries received
+ * more than DEDUPMAXAGE before the latest flow are purged, when the table fills up.
+ */
+
+#include "nfdedup.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrohash.c"
+#include "nfxV3.h"
+#include "util.h"
+
+// max time between the export of two observations of the same flow
+#define DEDUPMAXAGE (300 * 1000LL)
+#define DEDUPINITBITS 16
+
+typedef struct dedupEntry_s {
+    uint64_t fingerprint;   // hash of the 5-tuple, 0: unused entry
+    uint64_t msecFirst;     // start of the flow
+    uint64_t msecReceived;  // time the flow was received
+    uint16_t exporterID;    // sysID of the exporter
+    uint16_t fill[3];
+} dedupEntry_t;
+
+static struct dedup_s {
+    dedupEntry_t *table;
+    uint32_t capacity;
+    uint32_t mask;
+    uint32_t count;
+    uint64_t window;       // max start time difference of observations in msec
+    uint64_t maxReceived;  // latest received time
+    uint64_t duplicates;   // number of dropped records
+} dedup = {0};
+
+int Init_Dedup(uint32_t window) {
+    dedup.capacity = 1 << DEDUPINITBITS;
+    dedup.mask = dedup.capacity - 1;
+    dedup.count = 0;
+    dedup.window = window;
+    dedup.maxReceived = 0;
+    dedup.duplicates = 0;
+    dedup.table = calloc(dedup.capacity, sizeof(dedupEntry_t));
+    if (!dedup.table) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    return 1;
+
+}  // End of Init_Dedup
+
+static inline void InsertEntry(dedupEntry_t *table, uint32_t mask, dedupEntry_t *entry) {
+    uint32_t slot = entry->fingerprint & mask;
+    while (table[slot].fingerprint) slot = (slot + 1) & mask;
+    table[slot] = *entry;
+}  // End of InsertEntry
+
+// purge expired entries and grow the table, if still more than a quarter is in use
+static void RebuildTable(void) {
+    uint64_t expired = dedup.maxReceived > DEDUPMAXAGE ? dedup.maxReceived - DEDUPMAXAGE : 0;
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < dedup.capacity; i++) {
+        if (dedup.table[i].fingerprint && dedup.table[i].msecReceived >= expired) count++;
+    }
+    uint32_t capacity = dedup.capacity;
+    if (count > (capacity >> 2)) capacity <<= 1;
+
+    dedupEntry_t *table = calloc(capacity, sizeof(dedupEntry_t));
+    if (!table) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    for (uint32_t i = 0; i < dedup.capacity; i++) {
+        if (dedup.table[i].fingerprint && dedup.table[i].msecReceived >= expired) InsertEntry(table, capacity - 1, &dedup.table[i]);
+    }
+    free(dedup.table);
+    dedup.table = table;
+    dedup.capacity = capacity;
+    dedup.mask = capacity - 1;
+    dedup.count = count;
+
+}  // End of RebuildTable
+
+// returns 1, if the record is a later observation of an already seen flow
+int IsDuplicate(recordHandle_t *recordHandle) {
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
+    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
+    if (!genericFlow || (!ipv4Flow && !ipv6Flow)) return 0;
+
+    // 5-tuple key
+    uint64_t key[5] = {0};
+    if (ipv4Flow) {
+        key[0] = ipv4Flow->srcAddr;
+        key[1] = ipv4Flow->dstAddr;
+    } else {
+        key[0] = ipv6Flow->srcAddr[0];
+        key[1] = ipv6Flow->srcAddr[1];
+        key[2] = ipv6Flow->dstAddr[0];
+        key[3] = ipv6Flow->dstAddr[1];
+    }
+    key[4] = ((uint64_t)genericFlow->srcPort << 32) | ((uint64_t)genericFlow->dstPort << 16) | genericFlow->proto;
+    uint64_t fingerprint = metrohash64_1((const uint8_t *)key, sizeof(key), 0);
+    if (fingerprint == 0) fingerprint = 1;
+
+    uint64_t msecFirst = genericFlow->msecFirst;
+    uint64_t msecReceived = genericFlow->msecReceived ? genericFlow->msecReceived : genericFlow->msecLast;
+    uint16_t exporterID = recordHandle->recordHeaderV3->exporterID;
+    if (msecReceived > dedup.maxReceived) dedup.maxReceived = msecReceived;
+
+    uint32_t slot = fingerprint & dedup.mask;
+    while (dedup.table[slot].fingerprint) {
+        dedupEntry_t *entry = &(dedup.table[slot]);
+        if (entry->fingerprint == fingerprint && entry->exporterID != exporterID) {
+            uint64_t diff = entry->msecFirst > msecFirst ? entry->msecFirst - msecFirst : msecFirst - entry->msecFirst;
+            if (diff <= dedup.window) {
+                dedup.duplicates++;
+                return 1;
+            }
+        }
+        slot = (slot + 1) & dedup.mask;
+    }
+
+    dedup.table[slot] = (dedupEntry_t){
+        .fingerprint = fingerprint, .msecFirst = msecFirst, .msecReceived = msecReceived, .exporterID = exporterID};
+    dedup.count++;
+    if (dedup.count > (dedup.capacity >> 1)) RebuildTable();
+
+    return 0;
+
+}  // End of IsDuplicate
+
+uint64_t DedupCount(void) {
+    //
+    return dedup.duplicates;
+}  // End of DedupCount
+
+void Dispose_Dedup(void) {
+    free(dedup.table);
+    dedup = (struct dedup_s){0};
+}  // End of Dispose_Dedup
@@ -36,6 +36,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <math.h>
 #include <netinet/in.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -48,29 +49,38 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "barrier.h"
 #include "conf/nfconf.h"
 #include "config.h"
+#include "cpufeature.h"
 #include "exporter.h"
 #include "filter/filter.h"
 #include "flist.h"
 #include "ifvrf.h"
+#include "label/label.h"
 #include "maxmind/maxmind.h"
 #include "nbar.h"
+#include "nfcolumn.h"
 #include "netflow_v5_v7.h"
 #include "netflow_v9.h"
+#include "nfdedup.h"
 #include "nfdump_1_6_x.h"
+#include "nfdumpd.h"
 #include "nffile.h"
 #include "nflowcache.h"
+#include "nfmerge.h"
 #include "nfnet.h"
 #include "nfprof.h"
 #include "nfstat.h"
 #include "nfx.h"
 #include "nfxV3.h"
 #include "output.h"
+#include "output_compress.h"
+#include "scatter.h"
 #include "tor/tor.h"
 #include "util.h"
 #include "version.h"
@@ -79,16 +89,40 @@ extern char *FilterFilename;
 
 #define MAXANONWORKERS 8
 
+// number of files read in parallel for unordered processing
+#define DEFAULTREADERS 4
+#define MAXREADERS 16
+
+// record of a block selected by the filter workers
+typedef struct recordSelect_s {
+    uint32_t index;   // record index in the block
+    uint32_t offset;  // record offset from the block cursor
+} recordSelect_t;
+
 typedef struct dataHandle_s {
     dataBlock_t *dataBlock;
     char *ident;
     uint64_t recordCnt;
+    uint64_t blockNum;  // sequential block number
+    char *text;         // records rendered by the filter workers
+    size_t textLen;
+    compatMaps_t *compatMaps;  // extension maps of a 1.6.x block, converted by the filter workers
+    // passed V3 records and all other records of the block - the main thread processes only those
+    recordSelect_t *selection;
+    uint32_t numSelected;
 } dataHandle_t;
 
 typedef struct prepareArgs_s {
     queue_t *prepareQueue;
+    pthread_mutex_t mutex;  // protects stat vars of multiple readers
+    _Atomic uint64_t recordCnt;
+    _Atomic uint64_t blockCnt;
     uint32_t processedBlocks;
     uint32_t skippedBlocks;
+    int checkAggregation;  // verify the aggregation of partial aggregate input files
+    // extension maps of 1.6.x files - referenced by the blocks until all workers are done
+    compat16_t *compat16[MAXREADERS];
+    uint32_t numCompat16;
 } prepareArgs_t;
 
 typedef struct filterArgs_s {
@@ -97,12 +131,35 @@ typedef struct filterArgs_s {
     void *engine;
     timeWindow_t *timeWindow;
     int hasGeoDB;
+    int shardMode;    // processMode if aggregation is done in the workers, 0 otherwise
+    uint64_t extMask;  // extensions expanded from columnar blocks
+    uint64_t mapMask;  // extensions mapped by the workers
     queue_t *prepareQueue;
     queue_t *processQueue;
     _Atomic uint64_t processedRecords;
     _Atomic uint64_t passedRecords;
+    _Atomic uint64_t sampleSquares;  // sum of the squared passed records per block of a sampled query
+    // passed records are written by the workers into their own blocks, if the order does not matter
+    nffile_t *writeFile;
+    _Atomic uint64_t passedBytes;  // bytes of the blocks written as a whole by the workers
+    // summary statistics of the passed records, summed up by the workers
+    int workerStat;
+    pthread_mutex_t statMutex;
+    stat_record_t statRecord;
+    // records are rendered by the workers and written in block order by the main thread
+    RecordPrinter_t renderRecord;  // NULL, if records are printed by the main thread
+    RecordPrefetch_t prefetchRecord;  // requests output data of passed records ahead of printing
+    int doTag;
+    pthread_mutex_t renderMutex;
+    pthread_cond_t renderCond;
+    uint64_t countedBlocks;   // blocks with known record counter
+    uint64_t countedRecords;  // rendered records of all counted blocks
+    uint64_t writtenBlocks;   // blocks written by the main thread
 } filterArgs_t;
 
+// max number of rendered blocks waiting to be written
+#define RENDERWINDOW 64
+
 typedef struct filterStat_s {
     uint32_t processedRecords;
     uint32_t passedRecords;
@@ -112,8 +169,16 @@ static uint64_t total_bytes = 0;
 static uint64_t totalRecords = 0;
 static uint64_t totalPassed = 0;
 static uint32_t skippedBlocks = 0;
+
+// fraction of the data blocks read with -S and the sum of the squared passed records per block
+static double sampleFraction = 0;
+static uint64_t sampleSquares = 0;
 static uint64_t t_first_flow = 0, t_last_flow = 0;
 static _Atomic uint32_t abortProcessing = 0;
+// the sources -M are merged in time order, the blocks must be processed in sequence
+static int mergeSources = 0;
+// drop flows seen by more than one exporter within dedupWindow msec
+static uint32_t dedupWindow = 0;
 
 enum processType { FLOWSTAT = 1, ELEMENTSTAT, ELEMENTFLOWSTAT, SORTRECORDS, WRITEFILE, PRINTRECORD };
 
@@ -126,8 +191,10 @@ static int SetStat(char *str, int *element_stat, int *flow_stat);
 
 static void PrintSummary(stat_record_t *stat_record, outputParams_t *outputParams);
 
-static stat_record_t process_data(void *engine, int processMode, char *wfile, RecordPrinter_t print_record, timeWindow_t *timeWindow,
-                                  uint64_t limitRecords, outputParams_t *outputParams, int compress);
+static void RepeatLiveQuery(void);
+
+static stat_record_t process_data(void *engine, int processMode, int sharded, char *wfile, RecordPrinter_t print_record,
+                                  timeWindow_t *timeWindow, uint64_t limitRecords, outputParams_t *outputParams, int compress);
 
 /* Functions */
 
@@ -145,28 +212,40 @@ static void usage(char *name) {
         "-b\t\tAggregate netflow records as bidirectional flows.\n"
         "-B\t\tAggregate netflow records as bidirectional flows - Guess direction.\n"
         "-C <file>\tRead optional config file.\n"
-        "-r <file>\tread input from file\n"
-        "-w <file>\twrite output to file\n"
+        "-r <file>\tread input from file. A collector live socket is read until it closes.\n"
+        "-e <sec>\tReport the live socket -r in rolling windows of sec seconds.\n"
+        "-u\t\tFollow the file -r as the collector writes it, across file rotations.\n"
+        "-S <percent>\tRead a deterministic sample of <percent> of the data blocks. Scale the totals.\n"
+        "-w <file>\twrite output to file. '-' writes the binary stream to stdout.\n"
+        "-K <dir>\tCache the partial results of each file in dir and reuse them in repeated queries.\n"
+        "-F <agents>\tScatter query: ',' separated list of nfdumpd sockets. Merge their partial results.\n"
         "-f\t\tread netflow filter from file\n"
         "-n\t\tDefine number of top N for stat or sorted output.\n"
         "-c\t\tLimit number of matching records\n"
+        "-d <msec>\tDrop flows seen by more than one exporter with start times within <msec>.\n"
         "-D <dns>\tUse nameserver <dns> for host lookup.\n"
         "-G <geoDB>\tUse this nfdump geoDB to lookup country/location.\n"
         "-H <torDB>\tUse nfdump torDB to lookup tor info.\n"
+        "-l <labelDB>\tUse this prefix label table or nflabel DB to label src/dst IPs.\n"
         "-N\t\tPrint plain numbers\n"
         "-s <expr>[/<order>]\tGenerate statistics for <expr> any valid record element.\n"
         "\t\tand ordered by <order>: packets, bytes, flows, bps pps and bpp.\n"
+        "-k <num>\tApproximate top N for -A or -s record with bounded memory of <num> counters.\n"
+        "-U <mem>\tExternal aggregation for -A or -s record with a memory budget of <mem> MB or <mem>G.\n"
         "-q\t\tQuiet: Do not print the header and bottom stat lines.\n"
         "-i <ident>\tChange Ident to <ident> in file given by -r.\n"
         "-J <num>\tModify file compression: 0: uncompressed - 1: LZO - 2: BZ2 - 3: LZ4 - 4: ZSTD"
         "compressed.\n"
+        "-L <layout>\tModify file block layout: column: columnar blocks - row: flow record blocks.\n"
+        "\t\tcompact: columnar blocks with delta timestamps and varint counters.\n"
+        "\t\tv3: convert nfdump 1.6.x files to V3 records.\n"
         "-z=lzo\t\tLZO compress flows in output file.\n"
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
-        "-l <expr>\tSet limit on packets for line and packed output format.\n"
-        "\t\tkey: 32 character string or 64 digit hex string starting with 0x.\n"
-        "-L <expr>\tSet limit on bytes for line and packed output format.\n"
+        "-z=zdict[:level]\tZSTD compress flows with the dictionary set by zstd.dict in the config file.\n"
+        "\t\tWithout -w, -z=lz4 or -z=zstd compresses the printed output.\n"
+        "-Y <dictfile>\tTrain a zstd dictionary from the flows of -r/-R and save it to dictfile.\n"
         "-I \t\tPrint netflow summary statistics info from file or range of files (-r, -R).\n"
         "-g \t\tPrint gnuplot stat line for each nfcapd file (-r, -R).\n"
         "-M <expr>\tRead input from multiple directories.\n"
@@ -182,20 +261,27 @@ static void usage(char *name) {
         "\t\t/dir/file1:file2: Read all files from 'file1' to file2.\n"
         "-o <mode>\tUse <mode> to print out netflow records:\n"
         "\t\t raw      Raw record dump.\n"
+        "\t\t raw:<ext,..> Raw record dump of the selected extensions only.\n"
+        "\t\t kv[:<ext,..>] Raw record as key=value pairs, one line per record.\n"
         "\t\t line     Standard output line format.\n"
         "\t\t long     Standard output line format with additional fields.\n"
         "\t\t extended Even more information.\n"
         "\t\t csv      ',' separated, machine parseable output format.\n"
         "\t\t json     json output format.\n"
         "\t\t ndjson   ndjson log output format (one json object per line).\n"
+        "\t\t ndjson:<socket> ndjson output to a UNIX socket.\n"
+        "\t\t arrow    Apache Arrow IPC stream of the basic flow columns.\n"
         "\t\t null     no flow records, only statistics output.\n"
         "\t\t\tmode may be extended by '6' for full IPv6 listing. e.g.long6, extended6.\n"
         "-E <file>\tPrint exporter and sampling info for collected flows.\n"
-        "-v <file>\tverify netflow data file. Print version and blocks.\n"
+        "-Q[=json]\tPrint time, blocks and records of each processing stage, queue waits,\n"
+        "\t\tdecompression speed and hash probes to stderr.\n"
+        "-v <file>\tverify netflow data file. Print version and blocks. Verify all files of a directory.\n"
         "-W <num>\tOptionally set the number of workers to compress flows\n"
         "-x <file>\tverify extension records in netflow data file.\n"
         "-X\t\tDump Filtertable and exit (debug option).\n"
         "-Z\t\tCheck filter syntax and exit.\n"
+        "-p\t\tPrint the query plan: selected files and blocks, filter costs and execution. No flows processed.\n"
         "-t <time>\ttime window for filtering packets\n"
         "\t\tyyyy/MM/dd.hh:mm:ss[-yyyy/MM/dd.hh:mm:ss]\n",
         name);
@@ -233,10 +319,28 @@ static void PrintSummary(stat_record_t *stat_record, outputParams_t *outputParam
             "Summary: total flows: %llu, total bytes: %s, total packets: %s, avg bps: %s, avg pps: "
             "%s, avg bpp: %s\n",
             (unsigned long long)stat_record->numflows, byte_str, packet_str, bps_str, pps_str, bpp_str);
+        if (sampleFraction) {
+            // the flows of each block are in the sample with probability sampleFraction
+            double p = sampleFraction;
+            double interval = 1.96 * sqrt((1.0 - p) / (p * p) * (double)sampleSquares);
+            double relative = stat_record->numflows ? 100.0 * interval / (double)stat_record->numflows : 0;
+            printf("Sampled %.4g%% of the blocks. Totals are estimates - flows 95%% confidence interval: +/- %.0f (%.1f%%)\n", 100.0 * p,
+                   interval, relative);
+        }
     }
 
 }  // End of PrintSummary
 
+// scale the counters of a sampled query to the estimated totals
+static void ScaleStatRecord(stat_record_t *stat_record, double scale) {
+    uint64_t *counter[] = {&stat_record->numflows,        &stat_record->numbytes,       &stat_record->numpackets,
+                           &stat_record->numflows_tcp,    &stat_record->numflows_udp,   &stat_record->numflows_icmp,
+                           &stat_record->numflows_other,  &stat_record->numbytes_tcp,   &stat_record->numbytes_udp,
+                           &stat_record->numbytes_icmp,   &stat_record->numbytes_other, &stat_record->numpackets_tcp,
+                           &stat_record->numpackets_udp,  &stat_record->numpackets_icmp, &stat_record->numpackets_other};
+    for (int i = 0; i < (int)(sizeof(counter) / sizeof(counter[0])); i++) *counter[i] = (uint64_t)(*counter[i] * scale + 0.5);
+}  // End of ScaleStatRecord
+
 static int SetStat(char *str, int *element_stat, int *flow_stat) {
     char *statType = strdup(str);
     char *optOrder = strchr(statType, '/');
@@ -267,10 +371,33 @@ static int SetStat(char *str, int *element_stat, int *flow_stat) {
 
 }  // End of SetStat
 
+// a live query repeats for every window. Each window runs in a fresh child, which
+// continues the query with empty tables, while the parent waits for the next window
+static void RepeatLiveQuery(void) {
+    while (1) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            LogError("fork() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) return;
+
+        int status;
+        if (waitpid(pid, &status, 0) < 0) {
+            LogError("waitpid() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+    }
+
+}  // End of RepeatLiveQuery
+
 __attribute__((noreturn)) static void *prepareThread(void *arg) {
     prepareArgs_t *prepareArgs = (prepareArgs_t *)arg;
 
     dbg_printf("prepareThread started\n");
+    PinWorker();
 
     // dispatch args
     queue_t *prepareQueue = prepareArgs->prepareQueue;
@@ -280,48 +407,69 @@ __attribute__((noreturn)) static void *prepareThread(void *arg) {
         dbg_printf("prepareThread exit\n");
         pthread_exit(NULL);
     }
-    t_first_flow = nffile->stat_record->firstseen;
-    t_last_flow = nffile->stat_record->lastseen;
+    if (prepareArgs->checkAggregation) CheckAggregation(nffile);
+    FlowCacheExpect(nffile->stat_record->numflows);
+
+    // time window of all files of this reader
+    uint64_t tFirst = nffile->stat_record->firstseen;
+    uint64_t tLast = nffile->stat_record->lastseen;
 
     dataHandle_t *dataHandle = NULL;
-    uint64_t recordCnt = 0;
-    int processedBlocks = 0;
-    int skippedBlocks = 0;
+    uint32_t processedBlocks = 0;
+    uint32_t skippedBlocks = 0;
+    uint64_t processedRecords = 0;
+    uint64_t readNsec = 0;
+    uint64_t prepareNsec = 0;
+    compat16_t *compat16 = NULL;
 
     int done = nffile == NULL;
     while (!done) {
         if (dataHandle == NULL) {
             dataHandle = calloc(1, sizeof(dataHandle_t));
-            dataHandle->ident = nffile->ident;
         }
+        uint64_t t0 = nfprof_nsec();
         dataHandle->dataBlock = ReadBlock(nffile, NULL);
+        dataHandle->ident = nffile->ident;
+        uint64_t t1 = nfprof_nsec();
+        readNsec += t1 - t0;
 
         // get next data block from file
         if (dataHandle->dataBlock == NULL) {
+            // blocks skipped by the reader due to the block index
+            skippedBlocks += nffile->skippedBlocks;
+            // a stream delivers its stat record after the data blocks
+            if (nffile->stream) {
+                if (nffile->stat_record->firstseen < tFirst) tFirst = nffile->stat_record->firstseen;
+                if (nffile->stat_record->lastseen > tLast) tLast = nffile->stat_record->lastseen;
+            }
             // continue with next file
             if (GetNextFile(nffile) == NULL) {
                 done = 1;
             } else {
-                if (nffile->stat_record->firstseen < t_first_flow) t_first_flow = nffile->stat_record->firstseen;
-                if (nffile->stat_record->lastseen > t_last_flow) t_last_flow = nffile->stat_record->lastseen;
+                if (prepareArgs->checkAggregation) CheckAggregation(nffile);
+                FlowCacheExpect(nffile->stat_record->numflows);
+                if (nffile->stat_record->firstseen < tFirst) tFirst = nffile->stat_record->firstseen;
+                if (nffile->stat_record->lastseen > tLast) tLast = nffile->stat_record->lastseen;
             }
             continue;
         }
 
         processedBlocks++;
+        processedRecords += dataHandle->dataBlock->NumRecords;
+        uint32_t numV3Records = dataHandle->dataBlock->NumRecords;
         switch (dataHandle->dataBlock->type) {
             case DATA_BLOCK_TYPE_1:
                 LogError("nfdump 1.5.x block type 1 no longer supported. Skip block");
                 goto SKIP;
                 break;
-            case DATA_BLOCK_TYPE_2: {
-                dataBlock_t *v3DataBlock = NewDataBlock();
-                ConvertBlockType2(dataHandle->dataBlock, v3DataBlock);
-                FreeDataBlock(dataHandle->dataBlock);
-                dataHandle->dataBlock = v3DataBlock;
-            } break;
+            case DATA_BLOCK_TYPE_2:
+                // extension maps must be processed in file order - the records are converted by the workers
+                if (compat16 == NULL && (compat16 = NewCompat16()) == NULL) exit(255);
+                numV3Records = PrepareBlockType2(compat16, dataHandle->dataBlock, &dataHandle->compatMaps);
+                break;
             case DATA_BLOCK_TYPE_3:
-                // processed blocks
+            case DATA_BLOCK_TYPE_5:
+                // processed blocks - columnar blocks are expanded by the workers
                 break;
             case DATA_BLOCK_TYPE_4:
                 // silently skipped
@@ -334,8 +482,11 @@ __attribute__((noreturn)) static void *prepareThread(void *arg) {
                 continue;
         }
 
-        dataHandle->recordCnt = recordCnt;
-        recordCnt += (uint64_t)dataHandle->dataBlock->NumRecords;
+        prepareNsec += nfprof_nsec() - t1;
+
+        // with multiple readers, record counters are unique but not sequential in file order
+        dataHandle->recordCnt = atomic_fetch_add(&prepareArgs->recordCnt, (uint64_t)numV3Records);
+        dataHandle->blockNum = atomic_fetch_add(&prepareArgs->blockCnt, 1);
         queue_push(prepareQueue, (void *)dataHandle);
         dataHandle = NULL;
         done = abortProcessing;
@@ -345,22 +496,128 @@ __attribute__((noreturn)) static void *prepareThread(void *arg) {
     }  // while(!done)
 
     dbg_printf("prepareThread done. blocks processed: %u, skipped: %u\n", processedBlocks, skippedBlocks);
+    nfprof_stage(STAGE_READ, readNsec, processedBlocks, processedRecords);
+    nfprof_stage(STAGE_PREPARE, prepareNsec, processedBlocks, processedRecords);
     queue_close(prepareQueue);
     CloseFile(nffile);
 
-    prepareArgs->processedBlocks = processedBlocks;
-    prepareArgs->skippedBlocks = skippedBlocks;
+    pthread_mutex_lock(&prepareArgs->mutex);
+    if (t_last_flow == 0) {
+        t_first_flow = tFirst;
+        t_last_flow = tLast;
+    } else {
+        if (tFirst < t_first_flow) t_first_flow = tFirst;
+        if (tLast > t_last_flow) t_last_flow = tLast;
+    }
+    prepareArgs->processedBlocks += processedBlocks;
+    prepareArgs->skippedBlocks += skippedBlocks;
+    if (compat16) prepareArgs->compat16[prepareArgs->numCompat16++] = compat16;
+    pthread_mutex_unlock(&prepareArgs->mutex);
+
     dbg_printf("prepareThread exit\n");
     pthread_exit(NULL);
 
 }  // End of prepareThread
 
+/*
+ * collect all V3 records of a data block for block filtering
+ * inconsistent blocks are reported later by the record loop of the filter thread
+ */
+static uint32_t CollectV3Records(dataBlock_t *dataBlock, recordHeaderV3_t ***records, uint32_t *maxRecords) {
+    if (dataBlock->NumRecords > *maxRecords) {
+        *maxRecords = dataBlock->NumRecords;
+        *records = realloc(*records, *maxRecords * sizeof(recordHeaderV3_t *));
+        if (*records == NULL) {
+            LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+
+    uint32_t numRecords = 0;
+    record_header_t *record_ptr = GetCursor(dataBlock);
+    uint32_t sumSize = 0;
+    for (int i = 0; i < dataBlock->NumRecords; i++) {
+        if ((sumSize + record_ptr->size) > dataBlock->size || (record_ptr->size < sizeof(record_header_t))) break;
+        sumSize += record_ptr->size;
+        if (record_ptr->type == V3Record) (*records)[numRecords++] = (recordHeaderV3_t *)record_ptr;
+        record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+    }
+    return numRecords;
+
+}  // End of CollectV3Records
+
+/*
+ * check, if all records of a data block pass without filtering. This is the case for
+ * blocks of V3 records only, with all flows inside the time window. The statistics of
+ * all records are summed up in blockStat
+ */
+static int PassBlock(dataBlock_t *dataBlock, recordHandle_t *recordHandle, uint64_t recordCnt, timeWindow_t *timeWindow,
+                     uint64_t twin_msecFirst, uint64_t twin_msecLast, stat_record_t *blockStat) {
+    uint64_t mapMask = ExtensionBit(EXgenericFlowID) | ExtensionBit(EXcntFlowID);
+    record_header_t *record_ptr = GetCursor(dataBlock);
+    uint32_t sumSize = 0;
+    for (int i = 0; i < dataBlock->NumRecords; i++) {
+        if ((sumSize + record_ptr->size) > dataBlock->size || (record_ptr->size < sizeof(record_header_t))) return 0;
+        if (record_ptr->type != V3Record) return 0;
+        sumSize += record_ptr->size;
+
+        MapRecordExtensions(recordHandle, (recordHeaderV3_t *)record_ptr, recordCnt + i + 1, mapMask);
+        if (timeWindow) {
+            EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+            if (genericFlow == NULL || genericFlow->msecFirst <= twin_msecFirst || genericFlow->msecLast >= twin_msecLast) return 0;
+        }
+        UpdateStatRecord(blockStat, recordHandle);
+        record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+    }
+    // trailing garbage is reported by the record loop
+    return sumSize == dataBlock->size;
+
+}  // End of PassBlock
+
+// render the passed records of a block into the block text
+// the record counter of a block is known, after all previous blocks are counted
+static void RenderBlock(filterArgs_t *filterArgs, dataHandle_t *dataHandle, recordHandle_t *recordHandle, uint64_t passedRecords) {
+    pthread_mutex_lock(&filterArgs->renderMutex);
+    while (dataHandle->blockNum != filterArgs->countedBlocks || dataHandle->blockNum >= (filterArgs->writtenBlocks + RENDERWINDOW))
+        pthread_cond_wait(&filterArgs->renderCond, &filterArgs->renderMutex);
+    uint64_t recordCount = filterArgs->countedRecords;
+    filterArgs->countedRecords += passedRecords;
+    filterArgs->countedBlocks++;
+    pthread_cond_broadcast(&filterArgs->renderCond);
+    pthread_mutex_unlock(&filterArgs->renderMutex);
+
+    dataHandle->text = NULL;
+    dataHandle->textLen = 0;
+    if (passedRecords == 0) return;
+
+    FILE *stream = open_memstream(&dataHandle->text, &dataHandle->textLen);
+    if (stream == NULL) {
+        LogError("open_memstream() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    SetPrintCounter(recordCount);
+
+    void *cursor = GetCursor(dataHandle->dataBlock);
+    for (uint32_t i = 0; i < dataHandle->numSelected; i++) {
+        recordSelect_t *select = &(dataHandle->selection[i]);
+        recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)(cursor + select->offset);
+        if (recordHeaderV3->type == V3Record) {
+            MapRecordHandle(recordHandle, recordHeaderV3, dataHandle->recordCnt + select->index + 1);
+            filterArgs->renderRecord(stream, recordHandle, filterArgs->doTag);
+        }
+    }
+    fclose(stream);
+
+}  // End of RenderBlock
+
 __attribute__((noreturn)) static void *filterThread(void *arg) {
     filterArgs_t *filterArgs = (filterArgs_t *)arg;
 
+    // worker number - selects the aggregation shard
+    uint32_t self = ++filterArgs->self;
+    PinWorker();
 #ifdef DEVEL
     uint32_t numBlocks = 0;
-    uint32_t self = ++filterArgs->self;
     printf("Filter thread %i started\n", self);
 #endif
 
@@ -369,6 +626,15 @@ __attribute__((noreturn)) static void *filterThread(void *arg) {
     queue_t *processQueue = filterArgs->processQueue;
     void *engine = FilterCloneEngine(filterArgs->engine);
     int hasGeoDB = filterArgs->hasGeoDB;
+    int shardMode = filterArgs->shardMode;
+    int workerStat = filterArgs->workerStat;
+    nffile_t *writeFile = filterArgs->writeFile;
+    dataBlock_t *writeBlock = writeFile ? WriteBlock(writeFile, NULL) : NULL;
+    uint64_t extMask = filterArgs->extMask;
+    uint64_t mapMask = filterArgs->mapMask;
+    RecordPrinter_t renderRecord = filterArgs->renderRecord;
+    RecordPrefetch_t prefetchRecord = filterArgs->prefetchRecord;
+    uint32_t shard = self - 1;
 
     timeWindow_t *timeWindow = filterArgs->timeWindow;
 
@@ -389,14 +655,30 @@ __attribute__((noreturn)) static void *filterThread(void *arg) {
         exit(255);
     }
 
+    // with the 'any' filter, blocks written by the workers need no record level work
+    int passBlocks = writeFile && FilterMatchAll(engine);
+
+    // simple filters are evaluated for all records of a block at once
+    int blockFilter = FilterBlockCapable(engine);
+    recordHeaderV3_t **blockRecords = NULL;
+    uint8_t *blockMatch = NULL;
+    uint32_t maxRecords = 0;
+
     // counters for this thread
+    stat_record_t statRecord = {0};
+    statRecord.firstseen = 0x7fffffffffffffffLL;
     uint64_t processedRecords = 0;
     uint64_t passedRecords = 0;
+    uint64_t squaredRecords = 0;
+    uint64_t filterNsec = 0;
+    uint64_t filterBlocks = 0;
     while (1) {
         // append data blocks
         dataHandle_t *dataHandle = queue_pop(prepareQueue);
         if (dataHandle == QUEUE_CLOSED)  // no more blocks
             break;
+        uint64_t t0 = nfprof_nsec();
+        filterBlocks++;
 
         // sequential record counter from input
         // set with new block
@@ -404,13 +686,76 @@ __attribute__((noreturn)) static void *filterThread(void *arg) {
 
         FilterSetParam(engine, dataHandle->ident, hasGeoDB);
 
+        // expand the required columns of a columnar block
+        if (dataHandle->dataBlock->type == DATA_BLOCK_TYPE_5) {
+            dataBlock_t *v3DataBlock = NewDataBlock();
+            if (!ExpandColumnarBlock(dataHandle->dataBlock, v3DataBlock, extMask)) {
+                LogError("Corrupt columnar data block. Skip block");
+                v3DataBlock->type = DATA_BLOCK_TYPE_3;
+                v3DataBlock->NumRecords = 0;
+                v3DataBlock->size = 0;
+            }
+            FreeDataBlock(dataHandle->dataBlock);
+            dataHandle->dataBlock = v3DataBlock;
+        } else if (dataHandle->dataBlock->type == DATA_BLOCK_TYPE_2) {
+            // convert a 1.6.x block, prepared by the reader
+            dataBlock_t *v3DataBlock = NewDataBlock();
+            ConvertBlockType2(dataHandle->dataBlock, dataHandle->compatMaps, v3DataBlock);
+            FreeCompatMaps(dataHandle->compatMaps);
+            dataHandle->compatMaps = NULL;
+            FreeDataBlock(dataHandle->dataBlock);
+            dataHandle->dataBlock = v3DataBlock;
+        }
+
         dataBlock_t *dataBlock = dataHandle->dataBlock;
 
+        // a block, which passes as a whole, is handed to the writer as it is
+        // the writer only compresses it again - no record is copied
+        if (passBlocks) {
+            stat_record_t blockStat = {0};
+            blockStat.firstseen = 0x7fffffffffffffffLL;
+            if (PassBlock(dataBlock, recordHandle, recordCounter, timeWindow, twin_msecFirst, twin_msecLast, &blockStat)) {
+                uint32_t numRecords = dataBlock->NumRecords;
+                processedRecords += numRecords;
+                passedRecords += numRecords;
+                squaredRecords += (uint64_t)numRecords * numRecords;
+                if (workerStat) SumStatRecords(&statRecord, &blockStat);
+                filterArgs->passedBytes += dataBlock->size;
+                FlushBlock(writeFile, dataBlock);
+                free(dataHandle);
+                filterNsec += nfprof_nsec() - t0;
+                continue;
+            }
+        }
+
+        dataHandle->numSelected = 0;
+        dataHandle->selection = malloc((dataBlock->NumRecords + 1) * sizeof(recordSelect_t));
+        if (dataHandle->selection == NULL) {
+            LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+
 #ifdef DEVEL
         numBlocks++;
         printf("Filter thread %i working on next Block: %u, records: %u\n", self, numBlocks, dataBlock->NumRecords);
 #endif
 
+        uint64_t blockPassed = passedRecords;
+        uint32_t numV3 = 0;
+        int useBlock = 0;
+        if (blockFilter) {
+            uint32_t size = maxRecords;
+            uint32_t numRecords = CollectV3Records(dataBlock, &blockRecords, &maxRecords);
+            if (maxRecords != size) {
+                blockMatch = realloc(blockMatch, maxRecords);
+                if (blockMatch == NULL) {
+                    LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+                    exit(255);
+                }
+            }
+            useBlock = FilterRecordBlock(engine, blockRecords, numRecords, blockMatch);
+        }
+
         record_header_t *record_ptr = GetCursor(dataBlock);
         uint32_t sumSize = 0;
         for (int i = 0; i < dataBlock->NumRecords; i++) {
@@ -426,10 +771,14 @@ __attribute__((noreturn)) static void *filterThread(void *arg) {
                 sumSize = 0;
                 break;
             }
+            uint32_t offset = sumSize;
             sumSize += record_ptr->size;
             processedRecords++;
             recordCounter++;
 
+            // all records other than V3 records are processed by the main thread
+            if (record_ptr->type != V3Record) dataHandle->selection[dataHandle->numSelected++] = (recordSelect_t){.index = i, .offset = offset};
+
             // work on our record
             switch (record_ptr->type) {
                 case CommonRecordType:
@@ -438,7 +787,9 @@ __attribute__((noreturn)) static void *filterThread(void *arg) {
                     break;
                 case V3Record: {
                     recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)record_ptr;
-                    int match = MapRecordHandle(recordHandle, recordHeaderV3, recordCounter);
+                    // records rejected by the block filter need not be mapped
+                    int match = useBlock ? blockMatch[numV3++] : 1;
+                    if (match) match = MapRecordExtensions(recordHandle, recordHeaderV3, recordCounter, mapMask);
                     // Time based filter
                     // if no time filter is given, the result is always true
                     if (timeWindow && match) {
@@ -450,15 +801,33 @@ __attribute__((noreturn)) static void *filterThread(void *arg) {
                         }
                     }
 
-                    if (match) {
+                    if (match && !useBlock) {
                         // filter netflow record with user supplied filter
                         match = FilterRecord(engine, recordHandle);
                     }
                     if (match) {  // record passed all filters
-                        SetFlag(recordHeaderV3->flags, V3_FLAG_PASSED);
                         passedRecords++;
-                    } else {
-                        ClearFlag(recordHeaderV3->flags, V3_FLAG_PASSED);
+                        if (workerStat) UpdateStatRecord(&statRecord, recordHandle);
+                        if (writeFile) {
+                            // written by this worker - nothing left for the main thread
+                            writeBlock = AppendToBuffer(writeFile, writeBlock, (void *)record_ptr, record_ptr->size);
+                            break;
+                        }
+                        dataHandle->selection[dataHandle->numSelected++] = (recordSelect_t){.index = i, .offset = offset};
+                        if (prefetchRecord) prefetchRecord(recordHandle);
+                        // aggregate record in private shard
+                        switch (shardMode) {
+                            case FLOWSTAT:
+                                AddFlowCacheShard(shard, recordHandle);
+                                break;
+                            case ELEMENTSTAT:
+                                AddElementStatShard(shard, recordHandle);
+                                break;
+                            case ELEMENTFLOWSTAT:
+                                AddFlowCacheShard(shard, recordHandle);
+                                AddElementStatShard(shard, recordHandle);
+                                break;
+                        }
                     }
 
                 } break;
@@ -481,52 +850,276 @@ __attribute__((noreturn)) static void *filterThread(void *arg) {
             record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
         }
         dbg_printf("Filter thread %i push next block: %u\n", self, numBlocks);
-        if (sumSize) queue_push(processQueue, dataHandle);
+        squaredRecords += (passedRecords - blockPassed) * (passedRecords - blockPassed);
+        if (renderRecord) {
+            // the main thread needs all blocks to write them in order
+            if (sumSize == 0) {
+                dataBlock->NumRecords = 0;
+                dataHandle->numSelected = 0;
+            }
+            RenderBlock(filterArgs, dataHandle, recordHandle, sumSize ? passedRecords - blockPassed : 0);
+            filterNsec += nfprof_nsec() - t0;
+            queue_push(processQueue, dataHandle);
+        } else {
+            filterNsec += nfprof_nsec() - t0;
+            if (sumSize) {
+                queue_push(processQueue, dataHandle);
+            } else {
+                FreeDataBlock(dataBlock);
+                free(dataHandle->selection);
+                free(dataHandle);
+            }
+        }
     }
 
+    nfprof_stage(STAGE_FILTER, filterNsec, filterBlocks, processedRecords);
+    // flush and sum up before closing the queue - the main thread closes the file and
+    // uses the sum, once all workers closed the queue
+    if (writeFile) FlushBlock(writeFile, writeBlock);
+    if (workerStat) {
+        pthread_mutex_lock(&filterArgs->statMutex);
+        SumStatRecords(&filterArgs->statRecord, &statRecord);
+        pthread_mutex_unlock(&filterArgs->statMutex);
+    }
     queue_close(processQueue);
     dbg_printf("FilterThread %d done. blocks: %u records: %" PRIu64 " \n", self, numBlocks, recordCounter);
 
     free(recordHandle);
+    free(blockRecords);
+    free(blockMatch);
     filterArgs->processedRecords += processedRecords;
     filterArgs->passedRecords += passedRecords;
+    filterArgs->sampleSquares += squaredRecords;
     pthread_exit(NULL);
 }  // End of filterThread
 
-static stat_record_t process_data(void *engine, int processMode, char *wfile, RecordPrinter_t print_record, timeWindow_t *timeWindow,
-                                  uint64_t limitRecords, outputParams_t *outputParams, int compress) {
+// let the file reader skip blocks and files, which can not match the time window or the filter
+static void SetBlockFilters(void *engine, timeWindow_t *timeWindow) {
+    // blocks outside the time window
+    if (timeWindow) {
+        SetBlockTimeWindow(timeWindow->first * 1000LL, timeWindow->last ? timeWindow->last * 1000LL : 0x7FFFFFFFFFFFFFFFLL);
+    }
+
+    // and files without any IP address of the filter
+    ipKey_t *ipKeys = NULL;
+    uint32_t numIPKeys = FilterIPKeys(engine, &ipKeys);
+    if (numIPKeys) SetBlockIPFilter(ipKeys, numIPKeys);
+    // and blocks, which can not match the filter by their block summary
+    if (FilterSummaryCapable(engine)) SetBlockSummaryFilter(FilterBlockSummary, engine);
+
+}  // End of SetBlockFilters
+
+// multiple files are read in parallel, if the block order does not matter
+static uint32_t NumReaders(int processMode, int sharded, uint64_t limitRecords) {
+    uint32_t numReaders = 1;
+    if (sharded || (processMode == WRITEFILE && limitRecords == 0 && !mergeSources)) {
+        numReaders = ConfGetValue("maxreaders");
+        if (numReaders == 0) numReaders = DEFAULTREADERS;
+        if (numReaders > MAXREADERS) numReaders = MAXREADERS;
+    }
+    return numReaders;
+
+}  // End of NumReaders
+
+// check numWorkers depending on cores online
+// merged sources keep their order only, if the records are rendered in sequence
+static uint32_t NumFilterWorkers(int processMode, uint64_t limitRecords) {
+    uint32_t numWorkers = GetNumWorkers(0);
+    if (mergeSources && !(processMode == PRINTRECORD && limitRecords == 0 && ParallelPrinter())) numWorkers = 1;
+    return numWorkers;
+
+}  // End of NumFilterWorkers
+
+// print the query plan -p: the selected files and blocks, the optimized filter and
+// the execution strategy, without processing any flows
+static void ExplainQuery(void *engine, int processMode, int sharded, timeWindow_t *timeWindow, uint64_t limitRecords, char *wfile) {
+    static const char *compressName[] = {"none", "lzo", "bz2", "lz4", "zstd", "zdict"};
+
+    SetBlockFilters(engine, timeWindow);
+
+    printf("Files:\n");
+    uint32_t numFiles = 0, prunedFiles = 0;
+    uint64_t numBlocks = 0, selectedBlocks = 0, numFlows = 0, selectedRecords = 0, totalSize = 0;
+    fileExplain_t explain;
+    while (ExplainNextFile(&explain)) {
+        numFiles++;
+        numBlocks += explain.numBlocks;
+        selectedBlocks += explain.selectedBlocks;
+        numFlows += explain.numFlows;
+        selectedRecords += explain.selectedRecords;
+        totalSize += explain.size;
+        if (explain.selectedBlocks == 0 && explain.numBlocks) prunedFiles++;
+
+        printf("  %s: %" PRIu64 " bytes, %s, %" PRIu64 " flows, blocks %u/%u", explain.fileName, explain.size,
+               explain.compression < 6 ? compressName[explain.compression] : "unknown", explain.numFlows, explain.selectedBlocks,
+               explain.numBlocks);
+        printf(", index: %s, summary: %s, bloom: %s", explain.hasIndex ? "yes" : "no", explain.hasSummary ? "yes" : "no",
+               explain.hasBloom ? "yes" : "no");
+        if (explain.bloomMiss) printf(" - no filter IP in file");
+        if (explain.outsideWindow) printf(" - outside time window");
+        printf("\n");
+        free(explain.fileName);
+    }
+    printf("Files           : %u selected, %u pruned completely, %" PRIu64 " MB\n", numFiles, prunedFiles, totalSize / ONEMB);
+    printf("Blocks          : %" PRIu64 " of %" PRIu64 " read\n", selectedBlocks, numBlocks);
+    printf("Records         : ~%" PRIu64 " of %" PRIu64 " flows read\n", selectedRecords, numFlows);
+    if (timeWindow) {
+        printf("Time window     : %s\n", TimeString(timeWindow->first, timeWindow->last));
+    }
+
+    printf("\nFilter:\n");
+    ExplainEngine(engine);
+
+    printf("\nExecution:\n");
+    const char *modeName = "print records";
+    switch (processMode) {
+        case FLOWSTAT:
+            modeName = "aggregate flows";
+            break;
+        case ELEMENTSTAT:
+            modeName = "element statistics";
+            break;
+        case ELEMENTFLOWSTAT:
+            modeName = "aggregate flows and element statistics";
+            break;
+        case SORTRECORDS:
+            modeName = "sort records";
+            break;
+        case WRITEFILE:
+            modeName = "write file";
+            break;
+    }
+    uint32_t numReaders = NumReaders(processMode, sharded, limitRecords);
+    uint32_t numWorkers = NumFilterWorkers(processMode, limitRecords);
+    printf("Process mode    : %s%s\n", modeName, wfile ? ", write output file" : "");
+    printf("File readers    : %u%s\n", numReaders, mergeSources ? ", sources merged in time order" : "");
+    printf("Filter workers  : %u\n", numWorkers);
+    const char *strategy = "main thread processes the passed records";
+    if (sharded) {
+        strategy = "sharded aggregation in the filter workers";
+    } else if (processMode == PRINTRECORD && limitRecords == 0 && dedupWindow == 0 && ParallelPrinter()) {
+        strategy = "records rendered in the filter workers";
+    } else if (processMode == WRITEFILE && limitRecords == 0 && !mergeSources && dedupWindow == 0) {
+        strategy = "records written by the filter workers";
+    }
+    printf("Strategy        : %s\n", strategy);
+    if (limitRecords) printf("Record limit    : %" PRIu64 "\n", limitRecords);
+    if (dedupWindow) printf("Deduplication   : %u msec window\n", dedupWindow);
+    printf("Queue depth     : max %u blocks per queue\n", QueueDepthMax());
+    if (processMode == FLOWSTAT || processMode == ELEMENTFLOWSTAT) ExplainAggregation();
+
+}  // End of ExplainQuery
+
+static stat_record_t process_data(void *engine, int processMode, int sharded, char *wfile, RecordPrinter_t print_record,
+                                  timeWindow_t *timeWindow, uint64_t limitRecords, outputParams_t *outputParams, int compress) {
     stat_record_t stat_record = {0};
     stat_record.firstseen = 0x7fffffffffffffffLL;
 
-    // launch prepareThread
-    prepareArgs_t prepareArgs = {.prepareQueue = queue_init(8)};
-    pthread_t tidPrepare;
-    int err = pthread_create(&tidPrepare, NULL, prepareThread, (void *)&prepareArgs);
-    if (err) {
-        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        exit(255);
+    SetBlockFilters(engine, timeWindow);
+
+    // map input files - uncompressed blocks are processed in place
+    SetFileMapping(1);
+
+    uint32_t numReaders = NumReaders(processMode, sharded, limitRecords);
+
+    // the file queues of the readers, the prepare and the process queue share the
+    // pipeline memory budget. The main thread adapts the depth of the two queues
+    PipelineQueues(numReaders + 2);
+
+    // launch prepareThreads
+    prepareArgs_t prepareArgs = {.prepareQueue = queue_init(QUEUEDEPTHMAX),
+                                 .checkAggregation = processMode == FLOWSTAT || processMode == ELEMENTFLOWSTAT};
+    pthread_mutex_init(&prepareArgs.mutex, NULL);
+    atomic_init(&prepareArgs.recordCnt, 0);
+    atomic_init(&prepareArgs.blockCnt, 0);
+    queue_limit(prepareArgs.prepareQueue, 8);
+    queue_producers(prepareArgs.prepareQueue, numReaders);
+
+    pthread_t tidPrepare[MAXREADERS];
+    for (int i = 0; i < numReaders; i++) {
+        int err = pthread_create(&(tidPrepare[i]), NULL, prepareThread, (void *)&prepareArgs);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
     }
 
     // check numWorkers depending on cores online
-    uint32_t numWorkers = GetNumWorkers(0);
+    // merged sources keep their order only, if the records are rendered in sequence
+    uint32_t numWorkers = NumFilterWorkers(processMode, limitRecords);
     filterArgs_t filterArgs = {
         .engine = engine,
         .numWorkers = numWorkers,
         .prepareQueue = prepareArgs.prepareQueue,
-        .processQueue = queue_init(8),
+        .processQueue = queue_init(QUEUEDEPTHMAX),
         .timeWindow = timeWindow,
         .hasGeoDB = outputParams->hasGeoDB,
+        .extMask = ALLEXTENSIONS,
+        .mapMask = ALLEXTENSIONS,
     };
-    queue_producers(filterArgs.processQueue, numWorkers);
 
-    pthread_t tidFilter[32];
-    for (int i = 0; i < numWorkers; i++) {
-        int err = pthread_create(&(tidFilter[i]), NULL, filterThread, (void *)&filterArgs);
-        if (err) {
-            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-            exit(255);
+    // element statistics need only the extensions of the filter and the stat elements
+    if (processMode == ELEMENTSTAT) filterArgs.extMask = FilterExtensions(engine) | ElementStatExtensions();
+
+    // sharded aggregation - each filter worker aggregates into its own hash shard
+    if (sharded) {
+        if (processMode == FLOWSTAT || processMode == ELEMENTFLOWSTAT) {
+            if (!Init_FlowCacheShards(numWorkers)) exit(250);
         }
+        if (processMode == ELEMENTSTAT || processMode == ELEMENTFLOWSTAT) {
+            if (!Init_StatTableShards(numWorkers)) exit(250);
+        }
+        filterArgs.shardMode = processMode;
+        // records are already aggregated
+        processMode = 0;
+    }
+
+    // render printed records in the filter workers, if the output format allows it
+    // with -c the main thread needs to stop printing after limitRecords
+    int renderBlocks = processMode == PRINTRECORD && limitRecords == 0 && dedupWindow == 0 && ParallelPrinter();
+    if (renderBlocks) {
+        filterArgs.renderRecord = print_record;
+        filterArgs.doTag = outputParams->doTag;
+        pthread_mutex_init(&filterArgs.renderMutex, NULL);
+        pthread_cond_init(&filterArgs.renderCond, NULL);
+        // records are already rendered
+        processMode = 0;
+    }
+
+    // the workers sum up the statistics of the passed records, unless the main thread
+    // stops processing after limitRecords or drops duplicate flows
+    if (limitRecords == 0 && dedupWindow == 0) {
+        filterArgs.workerStat = 1;
+        filterArgs.statRecord.firstseen = 0x7fffffffffffffffLL;
+        pthread_mutex_init(&filterArgs.statMutex, NULL);
+    }
+
+    // workers, which only filter, map the extensions of the filter. The main thread maps
+    // the passed records once again with all extensions it needs for processing them
+    uint64_t processMask = ALLEXTENSIONS;
+    if (filterArgs.shardMode == 0 && !renderBlocks) {
+        filterArgs.mapMask = FilterExtensions(engine);
+    } else if (filterArgs.shardMode == ELEMENTSTAT) {
+        filterArgs.mapMask = filterArgs.extMask;
     }
+    if (filterArgs.workerStat) filterArgs.mapMask |= ExtensionBit(EXgenericFlowID) | ExtensionBit(EXcntFlowID);
+    // the workers request the output data of printed records ahead of the main thread
+    if (processMode == PRINTRECORD && OutputPrefetcher()) {
+        filterArgs.prefetchRecord = OutputPrefetcher();
+        filterArgs.mapMask |= ExtensionBit(EXipv4FlowID) | ExtensionBit(EXipv6FlowID);
+    }
+    // aggregated, rendered or written records need only the extensions of the stat counters
+    if (processMode == 0 || processMode == WRITEFILE) {
+        processMask = filterArgs.workerStat ? ExtensionBit(EXnull) : ExtensionBit(EXnull) | ExtensionBit(EXgenericFlowID) | ExtensionBit(EXcntFlowID);
+    } else if (processMode == ELEMENTSTAT) {
+        processMask = ElementStatExtensions();
+    }
+    if (dedupWindow) processMask |= ExtensionBit(EXgenericFlowID) | ExtensionBit(EXipv4FlowID) | ExtensionBit(EXipv6FlowID);
+    // rendered blocks waiting for all previous blocks to be written
+    dataHandle_t *pendingBlocks[RENDERWINDOW] = {0};
+    uint64_t nextBlock = 0;
+    queue_limit(filterArgs.processQueue, 8);
+    queue_producers(filterArgs.processQueue, numWorkers);
 
     nffile_t *nffile_w = NULL;
     dataBlock_t *dataBlock_w = NULL;
@@ -541,10 +1134,26 @@ static stat_record_t process_data(void *engine, int processMode, char *wfile, Re
         dataBlock_w = WriteBlock(nffile_w, NULL);
     }
 
+    // the workers write the passed records, if the block order does not matter
+    int writeBlocks = processMode == WRITEFILE && limitRecords == 0 && !mergeSources && dedupWindow == 0;
+    if (writeBlocks) filterArgs.writeFile = nffile_w;
+
+    pthread_t tidFilter[32];
+    for (int i = 0; i < numWorkers; i++) {
+        int err = pthread_create(&(tidFilter[i]), NULL, filterThread, (void *)&filterArgs);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+
     recordHandle_t *recordHandle = calloc(1, sizeof(recordHandle_t));
 
     // number of flows passed the filter
     dbg(uint32_t numBlocks = 0);
+    uint64_t processNsec = 0;
+    uint64_t processBlocks = 0;
+    uint64_t processRecords = 0;
     int done = 0;
     while (!done) {
         dataHandle_t *dataHandle = queue_pop(filterArgs.processQueue);
@@ -552,35 +1161,38 @@ static stat_record_t process_data(void *engine, int processMode, char *wfile, Re
             done = 1;
             continue;
         }
+        uint64_t t0 = nfprof_nsec();
+        processBlocks++;
+        processRecords += dataHandle->dataBlock->NumRecords;
+        if ((processBlocks % 16) == 0) {
+            unsigned depthMax = QueueDepthMax();
+            queue_adapt(prepareArgs.prepareQueue, 2, depthMax);
+            queue_adapt(filterArgs.processQueue, 2, depthMax);
+        }
 
         dbg(numBlocks++);
         dataBlock_t *dataBlock = dataHandle->dataBlock;
-        record_header_t *record_ptr = GetCursor(dataBlock);
-
-        uint64_t recordCounter = dataHandle->recordCnt;
+        void *cursor = GetCursor(dataBlock);
 
         // successfully read block
         total_bytes += dataBlock->size;
 
         dbg_printf("processData() Next block: %d, Records: %u\n", numBlocks, dataBlock->NumRecords);
 
-        for (int i = 0; i < dataBlock->NumRecords && !abortProcessing; i++) {
-            recordCounter++;
-            // process records
+        // process the records selected by the filter workers
+        for (uint32_t i = 0; i < dataHandle->numSelected && !abortProcessing; i++) {
+            recordSelect_t *select = &(dataHandle->selection[i]);
+            record_header_t *record_ptr = (record_header_t *)(cursor + select->offset);
+            uint64_t recordCounter = dataHandle->recordCnt + select->index + 1;
             switch (record_ptr->type) {
                 case V3Record: {
-                    recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)record_ptr;
-                    // check if filter matched
-                    if (TestFlag(recordHeaderV3->flags, V3_FLAG_PASSED) == 0) goto NEXT;
-
-                    // clear filter flag after use
-                    ClearFlag(recordHeaderV3->flags, V3_FLAG_PASSED);
+                    MapRecordExtensions(recordHandle, (recordHeaderV3_t *)record_ptr, recordCounter, processMask);
+                    if (dedupWindow && IsDuplicate(recordHandle)) continue;
                     totalRecords++;
-                    MapRecordHandle(recordHandle, (recordHeaderV3_t *)record_ptr, recordCounter);
                     // check if we are done, if -c option was set
                     if (limitRecords) abortProcessing = totalRecords >= limitRecords;
 
-                    UpdateStatRecord(&stat_record, recordHandle);
+                    if (!filterArgs.workerStat) UpdateStatRecord(&stat_record, recordHandle);
 
                     switch (processMode) {
                         case FLOWSTAT:
@@ -656,18 +1268,44 @@ static stat_record_t process_data(void *engine, int processMode, char *wfile, Re
                     LogError("Skip unknown record type %i\n", record_ptr->type);
                 }
             }
-        NEXT:
-            // Advance pointer by number of bytes for netflow record
-            record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
-
-        }  // for all records
-
-        // free resources
-        FreeDataBlock(dataHandle->dataBlock);
+        }  // for all selected records
+        free(dataHandle->selection);
+        dataHandle->selection = NULL;
+
+        // free resources - sorted records may still reference the block
+        if (processMode != SORTRECORDS || RetainSortBlock(dataBlock) == 0) FreeDataBlock(dataBlock);
+
+        if (renderBlocks) {
+            // write all rendered blocks in sequence
+            pendingBlocks[dataHandle->blockNum % RENDERWINDOW] = dataHandle;
+            while (pendingBlocks[nextBlock % RENDERWINDOW]) {
+                dataHandle_t *nextHandle = pendingBlocks[nextBlock % RENDERWINDOW];
+                pendingBlocks[nextBlock % RENDERWINDOW] = NULL;
+                if (nextHandle->text) {
+                    if (!abortProcessing) fwrite(nextHandle->text, 1, nextHandle->textLen, stdout);
+                    free(nextHandle->text);
+                }
+                free(nextHandle);
+                nextBlock++;
+            }
+            pthread_mutex_lock(&filterArgs.renderMutex);
+            filterArgs.writtenBlocks = nextBlock;
+            pthread_cond_broadcast(&filterArgs.renderCond);
+            pthread_mutex_unlock(&filterArgs.renderMutex);
+        } else {
+            free(dataHandle);
+        }
+        processNsec += nfprof_nsec() - t0;
     }  // while
+    nfprof_stage(STAGE_PROCESS, processNsec, processBlocks, processRecords);
 
     dbg_printf("processData() done\n");
 
+    if (filterArgs.workerStat) {
+        SumStatRecords(&stat_record, &filterArgs.statRecord);
+        pthread_mutex_destroy(&filterArgs.statMutex);
+    }
+
     // flush output file
     if (nffile_w) {
         // flush current buffer to disc
@@ -679,9 +1317,11 @@ static stat_record_t process_data(void *engine, int processMode, char *wfile, Re
         DisposeFile(nffile_w);
     }
 
-    dbg_printf("processData() wait for prepare thread\n");
-    if (pthread_join(tidPrepare, NULL)) {
-        LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+    dbg_printf("processData() wait for prepare threads\n");
+    for (int i = 0; i < numReaders; i++) {
+        if (pthread_join(tidPrepare[i], NULL)) {
+            LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        }
     }
 
     dbg_printf("processData() wait for filter threads\n");
@@ -691,14 +1331,200 @@ static stat_record_t process_data(void *engine, int processMode, char *wfile, Re
         }
         dbg_printf("processData() filter thread: %d\n", i);
     }
+    for (int i = 0; i < prepareArgs.numCompat16; i++) DisposeCompat16(prepareArgs.compat16[i]);
+    // records written by the workers
+    if (writeBlocks) {
+        totalRecords += filterArgs.passedRecords;
+        total_bytes += filterArgs.passedBytes;
+    }
+
+    nfprof_queue("prepare", prepareArgs.prepareQueue);
+    nfprof_queue("process", filterArgs.processQueue);
+
+    uint64_t t0 = nfprof_nsec();
+    switch (filterArgs.shardMode) {
+        case FLOWSTAT:
+            MergeFlowCacheShards();
+            break;
+        case ELEMENTSTAT:
+            MergeStatTableShards();
+            break;
+        case ELEMENTFLOWSTAT:
+            MergeFlowCacheShards();
+            MergeStatTableShards();
+            break;
+    }
+    if (filterArgs.shardMode) nfprof_stage(STAGE_MERGE, nfprof_nsec() - t0, numWorkers, 0);
+
+    if (renderBlocks) {
+        pthread_mutex_destroy(&filterArgs.renderMutex);
+        pthread_cond_destroy(&filterArgs.renderCond);
+    }
 
     totalPassed = filterArgs.passedRecords;
+    sampleSquares = filterArgs.sampleSquares;
     skippedBlocks = prepareArgs.skippedBlocks;
     return stat_record;
 
 }  // End of process_data
 
+// rewrite 1.6.x files with V3 records. Each thread converts whole files
+static void *convertThread(void *arg) {
+    _Atomic uint32_t *numConverted = (_Atomic uint32_t *)arg;
+    PinWorker();
+
+    nffile_t *nffile_r = NULL;
+    while ((nffile_r = GetNextFile(nffile_r)) != NULL) {
+        if (!nffile_r->compat16) {
+            printf("File %s: no 1.6.x blocks. Skipped\n", nffile_r->fileName);
+            continue;
+        }
+
+        // tmp filename for new output file
+        char outfile[MAXPATHLEN];
+        snprintf(outfile, MAXPATHLEN, "%s-tmp", nffile_r->fileName);
+        outfile[MAXPATHLEN - 1] = '\0';
+
+        nffile_t *nffile_w = OpenNewFile(outfile, NULL, FILE_CREATOR(nffile_r), FILE_COMPRESSION(nffile_r), NOT_ENCRYPTED);
+        if (!nffile_w) break;
+        SetIdent(nffile_w, nffile_r->ident);
+
+        // swap stat records
+        stat_record_t *_s = nffile_r->stat_record;
+        nffile_r->stat_record = nffile_w->stat_record;
+        nffile_w->stat_record = _s;
+
+        compat16_t *compat16 = NewCompat16();
+        if (!compat16) exit(255);
+
+        uint32_t numBlocks = 0;
+        dataBlock_t *dataBlock;
+        while ((dataBlock = ReadBlock(nffile_r, NULL)) != NULL) {
+            switch (dataBlock->type) {
+                case DATA_BLOCK_TYPE_2: {
+                    compatMaps_t *compatMaps = NULL;
+                    PrepareBlockType2(compat16, dataBlock, &compatMaps);
+                    dataBlock_t *v3DataBlock = NewDataBlock();
+                    ConvertBlockType2(dataBlock, compatMaps, v3DataBlock);
+                    FreeCompatMaps(compatMaps);
+                    FreeDataBlock(dataBlock);
+                    FlushBlock(nffile_w, v3DataBlock);
+                    numBlocks++;
+                } break;
+                case DATA_BLOCK_TYPE_3:
+                case DATA_BLOCK_TYPE_4:
+                    FlushBlock(nffile_w, dataBlock);
+                    break;
+                default:
+                    LogError("File %s: block type %u not converted. Skip block", nffile_r->fileName, dataBlock->type);
+                    FreeDataBlock(dataBlock);
+            }
+        }
+
+        printf("File %s: %u blocks converted to V3 records\n", nffile_r->fileName, numBlocks);
+        if (!CloseUpdateFile(nffile_w)) {
+            unlink(outfile);
+            LogError("Failed to close file: '%s'", strerror(errno));
+        } else {
+            if (unlink(nffile_r->fileName)) {
+                LogError("unlink() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            } else if (rename(outfile, nffile_r->fileName)) {
+                LogError("rename() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            } else {
+                atomic_fetch_add(numConverted, 1);
+            }
+        }
+        DisposeFile(nffile_w);
+        DisposeCompat16(compat16);
+    }
+
+    pthread_exit(NULL);
+
+}  // End of convertThread
+
+// convert all 1.6.x files of the file list in parallel, to retire the compat path
+static void ConvertCompatFiles(void) {
+    uint32_t numThreads = GetNumWorkers(0);
+    if (numThreads > MAXREADERS) numThreads = MAXREADERS;
+
+    _Atomic uint32_t numConverted = 0;
+    pthread_t tid[MAXREADERS];
+    for (int i = 0; i < numThreads; i++) {
+        int err = pthread_create(&tid[i], NULL, convertThread, (void *)&numConverted);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            exit(255);
+        }
+    }
+    for (int i = 0; i < numThreads; i++) pthread_join(tid[i], NULL);
+
+    printf("%u files converted\n", (unsigned)numConverted);
+
+}  // End of ConvertCompatFiles
+
+static void *verifyThread(void *arg) {
+    _Atomic uint32_t *numBad = (_Atomic uint32_t *)arg;
+    PinWorker();
+
+    nffile_t *nffile = NULL;
+    while ((nffile = GetNextFile(nffile)) != NULL) {
+        // block checksums are verified and blocks are uncompressed by the reader
+        uint32_t numBlocks = 0;
+        uint64_t numRecords = 0;
+        int corrupt = 0;
+        dataBlock_t *dataBlock = NULL;
+        while ((dataBlock = ReadBlock(nffile, dataBlock)) != NULL) {
+            numBlocks++;
+            numRecords += dataBlock->NumRecords;
+            if (dataBlock->type != DATA_BLOCK_TYPE_3) continue;
+
+            recordHeader_t *recordHeader = (recordHeader_t *)GetCursor(dataBlock);
+            uint32_t sumSize = 0;
+            for (uint32_t i = 0; i < dataBlock->NumRecords; i++) {
+                if (recordHeader->size < sizeof(recordHeader_t) || (sumSize + recordHeader->size) > dataBlock->size) break;
+                sumSize += recordHeader->size;
+                recordHeader = (recordHeader_t *)((void *)recordHeader + recordHeader->size);
+            }
+            if (sumSize != dataBlock->size) corrupt = 1;
+        }
+        // a read, checksum or decompression error ends the blocks early
+        if ((numBlocks + nffile->skippedBlocks) != nffile->file_header->NumBlocks) corrupt = 1;
+
+        printf("File %s: %s - blocks: %u, records: %" PRIu64 "\n", nffile->fileName, corrupt ? "corrupt" : "ok", numBlocks, numRecords);
+        if (corrupt) atomic_fetch_add(numBad, 1);
+    }
+
+    pthread_exit(NULL);
+
+}  // End of verifyThread
+
+// verify all files of the file list in parallel. Returns 1, if all files are ok
+static int VerifyFiles(void) {
+    uint32_t numThreads = GetNumWorkers(0);
+    if (numThreads > MAXREADERS) numThreads = MAXREADERS;
+
+    _Atomic uint32_t numBad = 0;
+    pthread_t tid[MAXREADERS];
+    for (int i = 0; i < numThreads; i++) {
+        int err = pthread_create(&tid[i], NULL, verifyThread, (void *)&numBad);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            exit(255);
+        }
+    }
+    for (int i = 0; i < numThreads; i++) pthread_join(tid[i], NULL);
+
+    printf("%u corrupt files\n", (unsigned)numBad);
+    return numBad == 0;
+
+}  // End of VerifyFiles
+
+#ifdef NFDUMPD
+// nfdumpd runs each query in a forked process - see nfdumpd.c
+int NfdumpMain(int argc, char **argv) {
+#else
 int main(int argc, char **argv) {
+#endif
     struct stat stat_buff;
     stat_record_t sum_stat;
     outputParams_t *outputParams;
@@ -706,13 +1532,20 @@ int main(int argc, char **argv) {
     nfprof_t profile_data;
     char *wfile, *ffile, *filter, *tstring, *stat_type;
     char *print_format;
-    char *print_order, *query_file, *configFile, *nameserver, *aggr_fmt;
+    char *print_order, *query_file, *configFile, *nameserver, *aggr_fmt, *dictFile;
     int ffd, element_stat, fdump;
     int flow_stat, aggregate, aggregate_mask, bidir;
-    int print_stat, gnuplot_stat, syntax_only, compress, worker;
-    int GuessDir, ModifyCompress;
+    int print_stat, gnuplot_stat, syntax_only, explain, compress, worker;
+    int GuessDir, ModifyCompress, ModifyLayout, profileStages;
+    uint32_t topNCounters;
+    uint64_t spillBudget;
     uint32_t limitRecords;
     char Ident[IDENTLEN];
+    char *agentList = NULL;
+    char *cacheDir = NULL;
+    uint32_t liveWindow = 0;
+    int followFile = 0;
+    int partialStat = 1;
     flist_t flist = {0};
     void *postFilter = NULL;
 
@@ -725,6 +1558,7 @@ int main(int argc, char **argv) {
     aggregate_mask = 0;
     bidir = 0;
     syntax_only = 0;
+    explain = 0;
     flow_stat = 0;
     print_stat = 0;
     gnuplot_stat = 0;
@@ -733,6 +1567,7 @@ int main(int argc, char **argv) {
     skippedBlocks = 0;
     compress = NOT_COMPRESSED;
     worker = 0;
+    profileStages = 0;
     GuessDir = 0;
     nameserver = NULL;
 
@@ -740,12 +1575,17 @@ int main(int argc, char **argv) {
     print_record = NULL;
     print_order = NULL;
     query_file = NULL;
+    dictFile = NULL;
+    topNCounters = 0;
+    spillBudget = 0;
     ModifyCompress = -1;
+    ModifyLayout = -1;
     aggr_fmt = NULL;
 
     configFile = NULL;
     char *geo_file = getenv("NFGEODB");
     char *tor_file = getenv("NFTORDB");
+    char *label_file = getenv("NFLABELDB");
 
     outputParams = (outputParams_t *)calloc(1, sizeof(outputParams_t));
     if (!outputParams) {
@@ -756,7 +1596,7 @@ int main(int argc, char **argv) {
 
     Ident[0] = '\0';
     int c;
-    while ((c = getopt(argc, argv, "6aA:Bbc:C:D:E:G:s:gH:hn:i:jf:qyz::r:v:w:J:M:NImO:P:R:XZt:TVv:W:x:o:")) != EOF) {
+    while ((c = getopt(argc, argv, "6aA:Bbc:C:d:D:e:E:F:G:s:gH:hk:K:l:n:i:jf:pqQ::yz::r:v:w:J:L:M:NImO:P:R:XY:S:Zt:TuU:Vv:W:x:o:")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -828,12 +1668,24 @@ int main(int argc, char **argv) {
                 tor_file = strdup(optarg);
                 // outputParams->doTag = 1;
                 break;
+            case 'l':
+                CheckArgLen(optarg, MAXPATHLEN);
+                if (!CheckPath(optarg, S_IFREG)) exit(EXIT_FAILURE);
+                label_file = strdup(optarg);
+                break;
             case 'X':
                 fdump = 1;
                 break;
+            case 'Y':
+                CheckArgLen(optarg, MAXPATHLEN);
+                dictFile = strdup(optarg);
+                break;
             case 'Z':
                 syntax_only = 1;
                 break;
+            case 'p':
+                explain = 1;
+                break;
             case 'q':
                 outputParams->quiet = 1;
                 break;
@@ -881,9 +1733,11 @@ int main(int argc, char **argv) {
                     ListStatTypes();
                     exit(EXIT_FAILURE);
                 }
+                if (!PartialStatType(stat_type)) partialStat = 0;
                 break;
             case 'V': {
                 printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
                 exit(EXIT_SUCCESS);
             } break;
             case 'N':
@@ -913,6 +1767,18 @@ int main(int argc, char **argv) {
             case 'I':
                 print_stat++;
                 break;
+            case 'Q':
+                // pipeline stage profile - optional =json
+                profileStages = 1;
+                if (optarg) {
+                    char *arg = optarg[0] == '=' ? optarg + 1 : optarg;
+                    if (strcmp(arg, "json") != 0) {
+                        LogError("Unknown profile format: %s. Use -Q or -Q=json", arg);
+                        exit(EXIT_FAILURE);
+                    }
+                    profileStages = 2;
+                }
+                break;
             case 'o':  // output mode
                 CheckArgLen(optarg, 512);
                 print_format = optarg;
@@ -945,6 +1811,36 @@ int main(int argc, char **argv) {
                 CheckArgLen(optarg, MAXPATHLEN);
                 wfile = optarg;
                 break;
+            case 'F':
+                CheckArgLen(optarg, 4096);
+                agentList = optarg;
+                break;
+            case 'K':
+                CheckArgLen(optarg, MAXPATHLEN);
+                if (!CheckPath(optarg, S_IFDIR)) exit(EXIT_FAILURE);
+                cacheDir = optarg;
+                break;
+            case 'e':
+                CheckArgLen(optarg, 16);
+                liveWindow = atoi(optarg);
+                if (liveWindow == 0 || liveWindow > 86400) {
+                    LogError("Live window %s out of range 1..86400 seconds", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'u':
+                followFile = 1;
+                break;
+            case 'S': {
+                CheckArgLen(optarg, 16);
+                char *end = NULL;
+                double percent = strtod(optarg, &end);
+                if (*end != '\0' || percent <= 0.0 || percent > 100.0) {
+                    LogError("Sample rate %s out of range 0..100 percent", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                sampleFraction = percent < 100.0 ? percent / 100.0 : 0;
+            } break;
             case 'n':
                 CheckArgLen(optarg, 16);
                 outputParams->topN = atoi(optarg);
@@ -953,6 +1849,41 @@ int main(int argc, char **argv) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'd':
+                CheckArgLen(optarg, 16);
+                dedupWindow = atoi(optarg);
+                if (dedupWindow == 0 || dedupWindow > 60000) {
+                    LogError("Dedup window %s msec out of range 1..60000", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'k':
+                CheckArgLen(optarg, 16);
+                topNCounters = atoi(optarg);
+                if (topNCounters == 0) {
+                    LogError("Number of counters %s out of range", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'U': {
+                CheckArgLen(optarg, 16);
+                char *unit = NULL;
+                spillBudget = strtoull(optarg, &unit, 10);
+                switch (*unit) {
+                    case '\0':
+                    case 'm':
+                    case 'M':
+                        spillBudget <<= 20;
+                        break;
+                    case 'g':
+                    case 'G':
+                        spillBudget <<= 30;
+                        break;
+                    default:
+                        LogError("Invalid memory budget: %s", optarg);
+                        exit(EXIT_FAILURE);
+                }
+            } break;
             case 'T':
                 outputParams->doTag = 1;
                 break;
@@ -972,6 +1903,20 @@ int main(int argc, char **argv) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'L':
+                if (strcmp(optarg, "column") == 0) {
+                    ModifyLayout = 1;
+                } else if (strcmp(optarg, "row") == 0) {
+                    ModifyLayout = 0;
+                } else if (strcmp(optarg, "v3") == 0) {
+                    ModifyLayout = 2;
+                } else if (strcmp(optarg, "compact") == 0) {
+                    ModifyLayout = 3;
+                } else {
+                    LogError("Expected -L <layout>, column, compact, row or v3");
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'x': {
                 CheckArgLen(optarg, MAXPATHLEN);
                 InitExtensionMaps(NO_EXTENSION_LIST);
@@ -981,14 +1926,22 @@ int main(int argc, char **argv) {
                 DumpExMaps();
                 exit(EXIT_SUCCESS);
             } break;
-            case 'v':
+            case 'v': {
                 CheckArgLen(optarg, MAXPATHLEN);
                 query_file = optarg;
+                // verify all files of a directory in parallel
+                struct stat stat_buf;
+                if (stat(query_file, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode)) {
+                    flist.multiple_files = strdup(query_file);
+                    queue_t *fileList = SetupInputFileSequence(&flist);
+                    if (!fileList || !Init_nffile(0, fileList)) exit(EXIT_FAILURE);
+                    exit(VerifyFiles() ? EXIT_SUCCESS : EXIT_FAILURE);
+                }
                 if (!QueryFile(query_file, fdump))
                     exit(EXIT_FAILURE);
                 else
                     exit(EXIT_SUCCESS);
-                break;
+            } break;
             case 'W':
                 CheckArgLen(optarg, 16);
                 worker = atoi(optarg);
@@ -1053,6 +2006,91 @@ int main(int argc, char **argv) {
         FilterFilename = ffile;
     }
 
+    // scatter query - the agents filter and aggregate their own files, and return partial
+    // results. These are merged by processing them again with the same aggregation.
+    // cached query - the partial results of the files are taken from the cache
+    if (sampleFraction && (cacheDir || agentList || liveWindow || followFile)) {
+        LogError("Sampling -S can not be combined with -K, -F, -e or -u");
+        exit(EXIT_FAILURE);
+    }
+    if (cacheDir && !(aggregate || flow_stat || element_stat)) {
+        LogError("Result cache -K requires an aggregation or a statistic. Cache ignored");
+        cacheDir = NULL;
+    }
+    if (cacheDir && tstring && (tstring[0] == '+' || tstring[0] == '-')) {
+        LogError("Result cache -K does not cache relative time windows. Cache ignored");
+        cacheDir = NULL;
+    }
+    if (cacheDir && agentList) {
+        LogError("Result cache -K and scatter query -F are mutually exclusive. Cache ignored");
+        cacheDir = NULL;
+    }
+    char *scatterDir = NULL;
+    if (agentList || cacheDir) {
+        char *args[16];
+        int numArgs = 0;
+        if (agentList && flist.single_file) {
+            args[numArgs++] = "-r";
+            args[numArgs++] = flist.single_file;
+        }
+        if (agentList && flist.multiple_files) {
+            args[numArgs++] = "-R";
+            args[numArgs++] = flist.multiple_files;
+        }
+        if (agentList && flist.multiple_dirs) {
+            args[numArgs++] = "-M";
+            args[numArgs++] = flist.multiple_dirs;
+        }
+        if (agentList && numArgs == 0) {
+            LogError("Scatter query requires -r, -R or -M for the agents");
+            exit(EXIT_FAILURE);
+        }
+        if (tstring) {
+            args[numArgs++] = "-t";
+            args[numArgs++] = tstring;
+        }
+        if (cacheDir && label_file) {
+            args[numArgs++] = "-l";
+            args[numArgs++] = label_file;
+        }
+        // element stats of other than 5-tuple elements need the flow records
+        if (!element_stat || partialStat) {
+            if (bidir) args[numArgs++] = GuessDir ? "-B" : "-b";
+            if (aggregate_mask && (flow_stat || !element_stat)) {
+                args[numArgs++] = "-A";
+                args[numArgs++] = aggr_fmt;
+            } else if (!bidir && (aggregate || flow_stat || element_stat)) {
+                args[numArgs++] = "-a";
+            }
+        }
+        if (agentList) {
+            args[numArgs++] = "-w";
+            args[numArgs++] = "-";
+        }
+        if (filter && strlen(filter)) args[numArgs++] = filter;
+
+        if (agentList) {
+            scatterDir = ScatterQuery(agentList, numArgs, args);
+        } else {
+            queue_t *fileList = SetupInputFileSequence(&flist);
+            if (!fileList) exit(EXIT_FAILURE);
+            scatterDir = CacheQuery(cacheDir, argv[0], fileList, numArgs, args);
+        }
+        if (!scatterDir) exit(EXIT_FAILURE);
+
+        // the partial results are already filtered and within the time window
+        flist.single_file = flist.multiple_dirs = NULL;
+        flist.multiple_files = scatterDir;
+        tstring = NULL;
+        filter = NULL;
+    }
+
+    // the label DB is needed to compile label names in the filter
+    if (label_file && (!CheckPath(label_file, S_IFREG) || !LoadLabelDB(label_file))) {
+        LogError("Error reading label DB file %s", label_file);
+        exit(EXIT_FAILURE);
+    }
+
     // if no filter is given, set the default ip filter which passes through every flow
     if (!filter || strlen(filter) == 0) filter = "any";
 
@@ -1084,6 +2122,8 @@ int main(int argc, char **argv) {
             outputParams->topN = 0;
         }
     }
+    // -w - writes a stream to stdout
+    int stdoutStream = wfile && strcmp(wfile, "-") == 0;
     if (wfile) outputParams->quiet = 1;
 
     if ((element_stat && !flow_stat) && aggregate_mask) {
@@ -1105,8 +2145,30 @@ int main(int argc, char **argv) {
         exit(EXIT_SUCCESS);
     }
 
+    if (liveWindow) {
+        if (!flist.single_file || !LiveSource(flist.single_file)) {
+            LogError("Option -e requires a collector live socket -r");
+            exit(EXIT_FAILURE);
+        }
+        SetLiveWindow(liveWindow);
+        RepeatLiveQuery();
+    }
+
+    if (followFile) {
+        if (!flist.single_file || flist.multiple_dirs || !CheckPath(flist.single_file, S_IFREG)) {
+            LogError("Option -u requires a single file -r such as nfcapd.current");
+            exit(EXIT_FAILURE);
+        }
+        SetFollowFile(1);
+    }
+    if (sampleFraction) SetBlockSample(sampleFraction);
+
+    // the file lister owns flist from here on
+    int multipleSources = flist.multiple_dirs && strchr(flist.multiple_dirs, ':') != NULL;
     queue_t *fileList = SetupInputFileSequence(&flist);
-    if (!fileList || !Init_nffile(worker, fileList)) exit(EXIT_FAILURE);
+    // -I reads only the stat records - no file prefetching
+    int statOnly = print_stat && !dictFile && ModifyCompress < 0 && ModifyLayout < 0;
+    if (!fileList || !Init_nffile(worker, statOnly ? NULL : fileList)) exit(EXIT_FAILURE);
 
     // Modify compression
     if (ModifyCompress >= 0) {
@@ -1118,6 +2180,24 @@ int main(int argc, char **argv) {
         exit(EXIT_SUCCESS);
     }
 
+    // Modify block layout
+    if (ModifyLayout >= 0) {
+        if (!flist.single_file && !flist.multiple_files) {
+            LogError("Expected -r <file> or -R <dir> to change the block layout\n");
+            exit(EXIT_FAILURE);
+        }
+        if (ModifyLayout == 2)
+            ConvertCompatFiles();
+        else
+            ModifyLayoutFile(ModifyLayout);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Train zstd dictionary
+    if (dictFile) {
+        exit(TrainZstdDictionary(dictFile) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     // Change Ident only
     if (flist.single_file && strlen(Ident) > 0) {
         ChangeIdent(flist.single_file, Ident);
@@ -1125,7 +2205,6 @@ int main(int argc, char **argv) {
     }
 
     if (print_stat) {
-        nffile_t *nffile;
         if (!flist.single_file && !flist.multiple_files && !flist.multiple_dirs) {
             LogError("Expect data file(s).\n");
             exit(EXIT_FAILURE);
@@ -1133,18 +2212,22 @@ int main(int argc, char **argv) {
 
         memset((void *)&sum_stat, 0, sizeof(stat_record_t));
         sum_stat.firstseen = 0x7fffffffffffffff;
-        nffile = GetNextFile(NULL);
-        if (!nffile) {
-            LogError("Error open file: %s\n", strerror(errno));
+        // stat records of cataloged files are summed without opening the files
+        char *fileName = queue_pop(fileList);
+        if (fileName == QUEUE_CLOSED) {
+            LogError("No data file found\n");
             exit(250);
         }
-        char *ident = NULL;
-        if (nffile->ident) {
-            ident = strdup(nffile->ident);
-        }
-        while (nffile != NULL) {
-            SumStatRecords(&sum_stat, nffile->stat_record);
-            nffile = GetNextFile(nffile);
+        char *ident = GetFileIdent(fileName);
+        while (fileName != QUEUE_CLOSED) {
+            stat_record_t stat_record;
+            if (GetStatRecord(fileName, &stat_record)) {
+                SumStatRecords(&sum_stat, &stat_record);
+            } else {
+                LogError("Skip unreadable file: %s", fileName);
+            }
+            free(fileName);
+            fileName = queue_pop(fileList);
         }
         PrintStat(&sum_stat, ident);
         free(ident);
@@ -1189,14 +2272,38 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (topNCounters) {
+        if (!aggregate && !flow_stat) {
+            LogError("Approximate top N -k requires -A, -a or -s record");
+            exit(EXIT_FAILURE);
+        }
+        if (!SetTopNSketch(topNCounters)) exit(EXIT_FAILURE);
+    }
+
+    if (spillBudget) {
+        if (!aggregate && !flow_stat) {
+            LogError("External aggregation -U requires -A, -a or -s record");
+            exit(EXIT_FAILURE);
+        }
+        char *spillDir = ConfGetString("spill.dir");
+        if (spillDir == NULL) spillDir = getenv("TMPDIR");
+        if (spillDir == NULL) spillDir = "/tmp";
+        if (!SetSpillAggregation(spillBudget, spillDir)) exit(EXIT_FAILURE);
+    }
+
     if (aggr_fmt) {
-        // custom aggregation mask overwrites any output format
+        // custom aggregation mask overwrites any output format but an explicit fmt:
+        char *userFormat = print_format;
         print_format = ParseAggregateMask(print_format, aggr_fmt);
         if (!print_format) {
             exit(EXIT_FAILURE);
         }
+        // the generated format prints the aggregation elements only - no need to keep full records
+        if (wfile == NULL && !flow_stat && print_format != userFormat)
+            SlimFlowRecords(outputParams->postFilter ? FilterExtensions(outputParams->postFilter) : 0);
     }
     if (element_stat && !Init_StatTable(outputParams->hasGeoDB)) exit(250);
+    if (dedupWindow && !Init_Dedup(dedupWindow)) exit(250);
 
     if (gnuplot_stat) {
         nffile_t *nffile;
@@ -1231,10 +2338,13 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    if (!(flow_stat || element_stat)) {
-        PrintProlog(outputParams);
+    if (outputParams->mode == MODE_ARROW && (flow_stat || element_stat)) {
+        LogError("Statistics are not supported in arrow output format");
+        exit(EXIT_FAILURE);
     }
 
+    if ((aggregate || flow_stat) && !SetFlowHisto()) exit(EXIT_FAILURE);
+
     int processMode = PRINTRECORD;
     if (aggregate || flow_stat) {
         processMode = FLOWSTAT;
@@ -1243,18 +2353,59 @@ int main(int argc, char **argv) {
         processMode = ELEMENTSTAT;
     } else if (print_order != NULL) {
         processMode = SORTRECORDS;
+        // time ordered sources -M are merged while reading, instead of sorted at the end
+        if (TimeOrder() && multipleSources) {
+            int window = ConfGetValue("merge.window");
+            SetMergeWindow(window > 0 ? window : MERGEWINDOW);
+            mergeSources = 1;
+            processMode = wfile ? WRITEFILE : PRINTRECORD;
+            print_order = NULL;
+        }
     } else if (wfile) {
         processMode = WRITEFILE;
     }
 
+    // aggregate in parallel in the filter workers, if the result gets sorted anyway
+    // -c needs the sequential record order
+    // the approximate top N sketch is a single bounded table
+    int sharded = 0;
+    // dedup compares the records in sequence in the main thread
+    if (limitRecords == 0 && topNCounters == 0 && spillBudget == 0 && dedupWindow == 0) {
+        sharded = (processMode == FLOWSTAT && (flow_stat || print_order)) || processMode == ELEMENTSTAT || processMode == ELEMENTFLOWSTAT;
+    }
+
+    if (explain) {
+        ExplainQuery(engine, processMode, sharded, flist.timeWindow, limitRecords, wfile);
+        exit(EXIT_SUCCESS);
+    }
+
+    // -z without -w compresses the printed output
+    if (wfile == NULL && compress != NOT_COMPRESSED) {
+        if (!OpenCompressedOutput(compress)) exit(EXIT_FAILURE);
+    }
+
+    if (!(flow_stat || element_stat)) {
+        PrintProlog(outputParams);
+    }
+
     nfprof_start(&profile_data);
-    sum_stat = process_data(engine, processMode, wfile, print_record, flist.timeWindow, limitRecords, outputParams, compress);
+    // aggregated or sorted records are written after processing. A stream is written only once
+    char *processFile = (aggregate || print_order) ? NULL : wfile;
+    sum_stat = process_data(engine, processMode, sharded, processFile, print_record, flist.timeWindow, limitRecords, outputParams, compress);
     nfprof_end(&profile_data, totalRecords);
 
-    if (totalPassed == 0) {
+    // estimate the totals of a sampled query
+    if (sampleFraction) {
+        ScaleStatRecord(&sum_stat, 1.0 / sampleFraction);
+        outputParams->sampleScale = 1.0 / sampleFraction;
+    }
+
+    // do not corrupt the binary arrow or nfdump stream
+    if (totalPassed == 0 && outputParams->mode != MODE_ARROW && !stdoutStream) {
         printf("No matching flows\n");
     }
 
+    uint64_t tOutput = nfprof_nsec();
     if (aggregate || print_order) {
         if (wfile) {
             nffile_t *nffile = OpenNewFile(wfile, NULL, CREATOR_NFDUMP, compress, NOT_ENCRYPTED);
@@ -1282,10 +2433,14 @@ int main(int argc, char **argv) {
     if (!(flow_stat || element_stat)) {
         PrintEpilog(outputParams);
     }
+    nfprof_stage(STAGE_OUTPUT, nfprof_nsec() - tOutput, 0, 0);
+
+    if (scatterDir) ScatterCleanup(scatterDir);
 
     if (!outputParams->quiet) {
         switch (outputParams->mode) {
             case MODE_RAW:
+            case MODE_KV:
                 break;
             case MODE_NULL:
             case MODE_FMT:
@@ -1304,6 +2459,7 @@ int main(int argc, char **argv) {
                 }
                 printf("Total records processed: %" PRIu64 ", passed: %" PRIu64 ", Blocks skipped: %u, Bytes read: %llu\n", totalRecords, totalPassed,
                        skippedBlocks, (unsigned long long)total_bytes);
+                if (dedupWindow) printf("Duplicate flows dropped: %" PRIu64 "\n", DedupCount());
                 nfprof_print(&profile_data, stdout);
                 break;
             case MODE_CSV:
@@ -1311,17 +2467,26 @@ int main(int argc, char **argv) {
                 break;
             case MODE_JSON:
             case MODE_NDJSON:
+            case MODE_ARROW:
                 break;
         }
 
     }  // else - no output
 
+    if (profileStages) {
+        hashStat_t hashStat;
+        FlowHashStat(&hashStat);
+        ElementHashStat(&hashStat);
+        nfprof_stages(stderr, profileStages == 2, &hashStat);
+    }
+
 #ifdef DEVEL
     DumpNbarList();
 #endif
 
     Dispose_FlowTable();
     Dispose_StatTable();
+    Dispose_Dedup();
 
     return 0;
 }
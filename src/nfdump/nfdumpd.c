@@ -0,0 +1,538 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * nfdumpd - persistent nfdump query server
+ *
+ * nfdumpd keeps the geo and tor DBs and the config resident and caches the uncompressed
+ * blocks of the most recent flow files of a directory in memory. Queries are accepted
+ * on a unix socket as nfdump command lines. Each query is run by nfdump in a forked
+ * process, which inherits the warm DBs and block cache. The output of the query is
+ * streamed back on the connection.
+ *
+ * Request: the nfdump arguments as '\0' terminated strings, terminated by an empty string.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_FTS_H
+#include <fts.h>
+#else
+#include "fts_compat.h"
+#define fts_children fts_children_compat
+#define fts_close fts_close_compat
+#define fts_open fts_open_compat
+#define fts_read fts_read_compat
+#define fts_set fts_set_compat
+#endif
+
+#include "conf/nfconf.h"
+#include "cpufeature.h"
+#include "daemon.h"
+#include "maxmind/maxmind.h"
+#include "nfdump.h"
+#include "nfdumpd.h"
+#include "nffile.h"
+#include "pidfile.h"
+#include "tor/tor.h"
+#include "util.h"
+#include "version.h"
+
+#define SYSLOG_FACILITY "daemon"
+
+// max number of arguments and size of a request
+#define MAXARGS 256
+#define MAXREQUEST 65536
+// default max concurrent queries, block cache size in MB and cache refresh interval in s
+#define MAXQUERIES 8
+#define CACHESIZE 512
+#define CACHEINTERVAL 60
+
+static volatile sig_atomic_t done = 0;
+static volatile sig_atomic_t gotSIGCHLD = 0;
+
+typedef struct hotFile_s {
+    char *path;
+    time_t mtime;
+    off_t size;
+} hotFile_t;
+
+/* Local function Prototypes */
+static void usage(char *name);
+
+static void IntHandler(int signal);
+
+static int OpenSocket(char *socketPath);
+
+static int RunQuery(int fd, int numArgs, char **args);
+
+static int Query(char *socketPath, int argc, char **argv);
+
+static void CacheHotFiles(char *cacheDir, size_t cacheSize);
+
+/* Functions */
+
+static void usage(char *name) {
+    printf(
+        "usage %s [options] \n"
+        "-h\t\tthis text you see right here\n"
+        "-S socket\tunix socket to accept queries.\n"
+        "-C <file>\tRead optional config file.\n"
+        "-G <geoDB>\tUse this nfdump geoDB.\n"
+        "-H <torDB>\tUse this nfdump torDB.\n"
+        "-M <dir>\tCache the most recent flow files of this directory tree.\n"
+        "-m <MB>\t\tMax size of the block cache in MB. Default %d.\n"
+        "-i <sec>\tRescan the cache directory every sec seconds. Default %d.\n"
+        "-W <num>\tRun max num queries concurrently. Default %d.\n"
+        "-D\t\tDetach from terminal (daemonize).\n"
+        "-P pidfile\tset the PID file\n"
+        "-v\t\tverbose\n"
+        "-V\t\tPrint version and exit.\n"
+        "-q\t\tSend the nfdump arguments, following the options, as query to socket\n"
+        "\t\tand print the result.\n",
+        name, CACHESIZE, CACHEINTERVAL, MAXQUERIES);
+}  // End of usage
+
+static void IntHandler(int signal) {
+    switch (signal) {
+        case SIGHUP:
+        case SIGINT:
+        case SIGTERM:
+            done = 1;
+            break;
+        case SIGCHLD:
+            gotSIGCHLD++;
+            break;
+        default:
+            // ignore everything we don't know
+            break;
+    }
+
+} /* End of IntHandler */
+
+static int OpenSocket(char *socketPath) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        LogError("Socket path too long: %s", socketPath);
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LogError("socket() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return -1;
+    }
+
+    // remove a stale socket of a previous run
+    unlink(socketPath);
+    mode_t mask = umask(0077);
+    int ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (ret < 0 || listen(fd, 16) < 0) {
+        LogError("bind()/listen() error on %s: %s", socketPath, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+
+}  // End of OpenSocket
+
+// read a request and split it into arguments
+static int ReadRequest(int fd, char *request, char **args) {
+    size_t size = 0;
+    int numArgs = 0;
+    size_t argStart = 0;
+    while (size < MAXREQUEST) {
+        ssize_t ret = read(fd, request + size, MAXREQUEST - size);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return -1;
+        size_t end = size + ret;
+        for (; size < end; size++) {
+            if (request[size] != '\0') continue;
+            // an empty argument terminates the request
+            if (size == argStart) return numArgs;
+            if (numArgs == MAXARGS - 2) return -1;
+            args[numArgs++] = request + argStart;
+            argStart = size + 1;
+        }
+    }
+    return -1;
+
+}  // End of ReadRequest
+
+// run the query in a forked process with stdout and stderr on the connection
+// a binary stream query (-w -) keeps stderr, so messages do not corrupt the stream
+static int RunQuery(int fd, int numArgs, char **args) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        LogError("fork() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    if (pid > 0) return 1;
+
+    // child
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    char *argv[MAXARGS];
+    argv[0] = "nfdump";
+    for (int i = 0; i < numArgs; i++) argv[i + 1] = args[i];
+    argv[numArgs + 1] = NULL;
+
+    int binary = 0;
+    for (int i = 0; i < numArgs; i++) {
+        if (strcmp(args[i], "-w-") == 0 || (strcmp(args[i], "-w") == 0 && i + 1 < numArgs && strcmp(args[i + 1], "-") == 0)) binary = 1;
+    }
+
+    if (dup2(fd, STDOUT_FILENO) < 0 || (!binary && dup2(fd, STDERR_FILENO) < 0)) _exit(EXIT_FAILURE);
+    close(fd);
+
+    optind = 1;
+    int ret = NfdumpMain(numArgs + 1, argv);
+    fflush(stdout);
+    exit(ret);
+
+}  // End of RunQuery
+
+static int CompareHotFiles(const void *h1, const void *h2) {
+    const hotFile_t *f1 = (const hotFile_t *)h1;
+    const hotFile_t *f2 = (const hotFile_t *)h2;
+    if (f1->mtime == f2->mtime) return 0;
+    return f1->mtime < f2->mtime ? 1 : -1;
+}  // End of CompareHotFiles
+
+// load the most recent flow files of the directory tree into the block cache
+static void CacheHotFiles(char *cacheDir, size_t cacheSize) {
+    char *const roots[2] = {cacheDir, NULL};
+    FTS *fts = fts_open(roots, FTS_LOGICAL, NULL);
+    if (!fts) {
+        LogError("fts_open() error '%s': %s", cacheDir, strerror(errno));
+        return;
+    }
+
+    uint32_t numFiles = 0;
+    uint32_t maxFiles = 0;
+    hotFile_t *hotFiles = NULL;
+    FTSENT *ftsent;
+    while ((ftsent = fts_read(fts)) != NULL) {
+        // skip the file currently written by the collector
+        if (ftsent->fts_info != FTS_F || strncmp(ftsent->fts_name, "nfcapd.", 7) != 0 ||
+            strncmp(ftsent->fts_name, "nfcapd.current", 14) == 0)
+            continue;
+        if (numFiles == maxFiles) {
+            maxFiles = maxFiles ? 2 * maxFiles : 1024;
+            hotFile_t *p = realloc(hotFiles, maxFiles * sizeof(hotFile_t));
+            if (!p) {
+                LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                break;
+            }
+            hotFiles = p;
+        }
+        hotFiles[numFiles++] =
+            (hotFile_t){.path = strdup(ftsent->fts_path), .mtime = ftsent->fts_statp->st_mtime, .size = ftsent->fts_statp->st_size};
+    }
+    fts_close(fts);
+
+    // the most recent files, which fit into the cache
+    qsort(hotFiles, numFiles, sizeof(hotFile_t), CompareHotFiles);
+    uint32_t numHot = 0;
+    size_t sumSize = 0;
+    while (numHot < numFiles && (sumSize + hotFiles[numHot].size) <= cacheSize) sumSize += hotFiles[numHot++].size;
+
+    // cache the oldest first, so the least recently used files are the oldest
+    uint32_t numCached = 0;
+    for (int i = numHot - 1; i >= 0; i--) {
+        if (CacheFile(hotFiles[i].path)) numCached++;
+    }
+    LogVerbose("Block cache: %u of %u files cached", numCached, numFiles);
+
+    for (uint32_t i = 0; i < numFiles; i++) free(hotFiles[i].path);
+    free(hotFiles);
+
+}  // End of CacheHotFiles
+
+// client: send the query and copy the result to stdout
+static int Query(char *socketPath, int argc, char **argv) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        LogError("Socket path too long: %s", socketPath);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LogError("connect() to %s failed: %s", socketPath, strerror(errno));
+        if (fd >= 0) close(fd);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i <= argc; i++) {
+        char *arg = i < argc ? argv[i] : "";
+        size_t len = strlen(arg) + 1;
+        if (write(fd, arg, len) != (ssize_t)len) {
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+
+    char buff[65536];
+    ssize_t ret;
+    while ((ret = read(fd, buff, sizeof(buff))) > 0) {
+        if (fwrite(buff, 1, ret, stdout) != (size_t)ret) break;
+    }
+    close(fd);
+
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+}  // End of Query
+
+int main(int argc, char **argv) {
+    char *socketPath = NULL;
+    char *configFile = NULL;
+    char *geo_file = NULL;
+    char *tor_file = NULL;
+    char *cacheDir = NULL;
+    char *pidfile = NULL;
+    size_t cacheSize = CACHESIZE;
+    int cacheInterval = CACHEINTERVAL;
+    int maxQueries = MAXQUERIES;
+    int do_daemonize = 0;
+    int verbose = 0;
+    int query = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "hS:C:G:H:M:m:i:W:DP:vVq")) != EOF) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            case 'S':
+                socketPath = optarg;
+                break;
+            case 'C':
+                configFile = optarg;
+                break;
+            case 'G':
+                if (strcmp(optarg, "none") != 0 && !CheckPath(optarg, S_IFREG)) exit(EXIT_FAILURE);
+                geo_file = strdup(optarg);
+                break;
+            case 'H':
+                if (strcmp(optarg, "none") != 0 && !CheckPath(optarg, S_IFREG)) exit(EXIT_FAILURE);
+                tor_file = strdup(optarg);
+                break;
+            case 'M':
+                if (!CheckPath(optarg, S_IFDIR)) exit(EXIT_FAILURE);
+                cacheDir = optarg;
+                break;
+            case 'm':
+                cacheSize = strtoul(optarg, NULL, 10);
+                if (cacheSize == 0 || cacheSize > 1024 * 1024) {
+                    LogError("Block cache size out of range");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'i':
+                cacheInterval = atoi(optarg);
+                if (cacheInterval <= 0) {
+                    LogError("Cache interval out of range");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'W':
+                maxQueries = atoi(optarg);
+                if (maxQueries <= 0 || maxQueries > 1024) {
+                    LogError("Number of queries out of range");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'D':
+                do_daemonize = 1;
+                break;
+            case 'P':
+                pidfile = verify_pid(optarg);
+                if (!pidfile) exit(EXIT_FAILURE);
+                break;
+            case 'v':
+                verbose++;
+                break;
+            case 'V':
+                printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
+                exit(EXIT_SUCCESS);
+                break;
+            case 'q':
+                query = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!socketPath) {
+        LogError("Missing socket: -S socket");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (query) exit(Query(socketPath, argc - optind, argv + optind));
+
+    if (!InitLog(do_daemonize, argv[0], SYSLOG_FACILITY, verbose)) exit(EXIT_FAILURE);
+
+    // the resident DBs and config are inherited by the queries
+    if (ConfOpen(configFile, "nfdump") < 0) exit(EXIT_FAILURE);
+    if (geo_file == NULL) geo_file = ConfGetString("geodb.path");
+    if (geo_file && strcmp(geo_file, "none") != 0) {
+        if (!CheckPath(geo_file, S_IFREG) || !LoadMaxMind(geo_file)) {
+            LogError("Error reading geo location DB file %s", geo_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (tor_file == NULL) tor_file = ConfGetString("tordb.path");
+    if (tor_file && strcmp(tor_file, "none") != 0) {
+        if (!CheckPath(tor_file, S_IFREG) || !LoadTorTree(tor_file)) {
+            LogError("Error reading tor info DB file %s", tor_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!Init_nffile(0, NULL)) exit(EXIT_FAILURE);
+
+    int sock = OpenSocket(socketPath);
+    if (sock < 0) exit(EXIT_FAILURE);
+
+    if (do_daemonize) {
+        verbose = 0;
+        daemonize();
+    }
+
+    if (pidfile) {
+        if (check_pid(pidfile) != 0 || write_pid(pidfile) == 0) exit(EXIT_FAILURE);
+    }
+
+    /* Signal handling */
+    struct sigaction act;
+    memset((void *)&act, 0, sizeof(struct sigaction));
+    act.sa_handler = IntHandler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    sigaction(SIGTERM, &act, NULL);
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGHUP, &act, NULL);
+    sigaction(SIGCHLD, &act, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (cacheDir) {
+        SetBlockCache(cacheSize * 1024 * 1024);
+        CacheHotFiles(cacheDir, cacheSize * 1024 * 1024);
+    }
+    time_t lastCache = time(NULL);
+
+    LogInfo("nfdumpd listening on %s", socketPath);
+    int numQueries = 0;
+    char *request = malloc(MAXREQUEST);
+    if (!request) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    while (!done) {
+        // reap finished queries
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, numQueries >= maxQueries ? 0 : WNOHANG)) > 0) numQueries--;
+
+        // rescan the cache directory, while idle
+        if (cacheDir && numQueries == 0 && (time(NULL) - lastCache) >= cacheInterval) {
+            CacheHotFiles(cacheDir, cacheSize * 1024 * 1024);
+            lastCache = time(NULL);
+        }
+
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(sock, &readSet);
+        struct timeval timeout = {.tv_sec = cacheInterval, .tv_usec = 0};
+        int ret = select(sock + 1, &readSet, NULL, NULL, &timeout);
+        if (ret <= 0) {
+            if (ret < 0 && errno != EINTR) {
+                LogError("select() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                break;
+            }
+            continue;
+        }
+
+        int fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) LogError("accept() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            continue;
+        }
+
+        char *args[MAXARGS];
+        int numArgs = ReadRequest(fd, request, args);
+        if (numArgs < 0) {
+            LogError("Invalid query request");
+        } else {
+            LogVerbose("Query with %d arguments", numArgs);
+            if (RunQuery(fd, numArgs, args)) numQueries++;
+        }
+        close(fd);
+    }
+
+    LogInfo("nfdumpd terminating");
+    close(sock);
+    unlink(socketPath);
+    free(request);
+    while (waitpid(-1, NULL, 0) > 0);
+    if (pidfile) remove_pid(pidfile);
+
+    exit(EXIT_SUCCESS);
+
+}  // End of main
@@ -37,19 +37,27 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "blocksort.h"
+#include "conf/nfconf.h"
 #include "config.h"
 #include "exporter.h"
 #include "filter/filter.h"
+#include "label/label.h"
+#include "loghisto.h"
 #include "maxmind/maxmind.h"
 #include "memhandle.h"
 #include "nfdump.h"
@@ -58,7 +66,7 @@
 #include "output.h"
 #include "util.h"
 
-typedef enum { NOPREPROCESS = 0, SRC_GEO, DST_GEO, SRC_AS, DST_AS } preprocess_t;
+typedef enum { NOPREPROCESS = 0, SRC_GEO, DST_GEO, SRC_AS, DST_AS, SRC_LABEL, DST_LABEL } preprocess_t;
 
 typedef struct aggregate_param_s {
     uint32_t extID;   // extension ID
@@ -148,6 +156,8 @@ static struct aggregationElement_s {
                         {"opid", {EXobservationID, OFFpointID, SIZEpointID, 0}, 0, NOPREPROCESS, 0, 0, "%opid"},
                         {"srcgeo", {EXlocal, OFFgeoSrcIP, SizeGEOloc, 0}, 0, SRC_GEO, 0, 0, "%sc"},
                         {"dstgeo", {EXlocal, OFFgeoDstIP, SizeGEOloc, 0}, 0, DST_GEO, 0, 0, "%dc"},
+                        {"srclabel", {EXlocal, OFFsrcLabel, SIZElabel, 0}, 0, SRC_LABEL, 0, 0, "%slb"},
+                        {"dstlabel", {EXlocal, OFFdstLabel, SIZElabel, 0}, 0, DST_LABEL, 0, 0, "%dlb"},
                         {"ethertype", {EXlayer2ID, OFFetherType, SIZEetherType, 0}, 0, NOPREPROCESS, 0, 0, "%eth"},
                         {"ttl", {EXipInfoID, OFFipTTL, SIZEipTTL, 0}, 0, NOPREPROCESS, 0, 0, "%ttl"},
                         {NULL, {0, 0, 0}, 0, NOPREPROCESS, 0, 0, NULL}};
@@ -155,15 +165,14 @@ static struct aggregationElement_s {
 // FlowHash stat record, to aggregate flow counters in -A or -s stat/aggregate mode
 // original flow record attached for later printing the record
 // for -A -s hashkey points to the aggregation key in hash table
-// for -O <sort> next points to next record in list
+// for -O <sort> flowrecord points into the retained data block
 typedef struct FlowHashRecord {
     recordHeaderV3_t *flowrecord;  // orig flow record for printing
-    struct FlowHashRecord *next;   // record chain for flow list, unused otherwise
 
     uint8_t inFlags;   // tcp in flags
     uint8_t outFlags;  // tcp out flags XXX unused currently
     uint8_t swap;      // swap flow direction, when printed
-    uint8_t align;     // align 32bit
+    uint8_t reverse;   // bidir: flowrecord is the reverse direction of the canonical key
 
     // time info in msec
     uint64_t msecFirst;  // overall first seen timestamp
@@ -176,6 +185,8 @@ typedef struct FlowHashRecord {
     uint64_t outBytes;
     uint64_t flows;
 
+    logHisto_t *histo;  // quantile histograms, if requested by the output format
+
 } FlowHashRecord_t;
 
 // order functions prototype
@@ -276,7 +287,8 @@ typedef struct FlowKeyV4_s {
 static inline int New_HashKey(void *keymem, recordHandle_t *recordHandle, int swap_flow);
 
 // include hash function in same compiler unit
-#include "metrohash.c"
+#include "keyhash.c"
+#include "tagprobe.c"
 
 // cell index calculation from 32bit hash, depending of hash bit size 'shift'
 #define ___fib_hash(hash, shift) ((hash) * 2654435769U) >> (shift)
@@ -303,18 +315,31 @@ typedef struct hashValue_s {
         uint64_t val[2];  // 16 byte static hash value
         void *valPtr;     // value pointer if size > 16bytes
     };
-    uint32_t hash;     // calculated 32bit metrohash
-    uint32_t align;    // calculated 64bit metrohash
+    uint32_t hash;     // calculated 32bit key hash
+    uint32_t align;    // unused
     uint32_t ptrSize;  // if > 0, valPtr points to value
     uint32_t index;    // index into record array for statistics values
 } hashValue_t;
 
+// compare two var length keys
+// keys with a multiple of 8 bytes, such as IPv6 tuples, are compared as uint64_t words
+static inline int keyEqual(const void *key1, const void *key2, uint32_t size) {
+    if ((size & 0x7) == 0) {
+        const uint64_t *k1 = (const uint64_t *)key1;
+        const uint64_t *k2 = (const uint64_t *)key2;
+        for (uint32_t i = 0; i < (size >> 3); i++)
+            if (k1[i] != k2[i]) return 0;
+        return 1;
+    }
+    return memcmp(key1, key2, size) == 0;
+}  // End of keyEqual
+
 // compare two hash values
 // if size == 0 - directly compare the 16byte local value as two uint64_t
-// if size > 16 - compare calculated hash and memcmp the two valPtr
+// if size > 16 - compare calculated hash and the two valPtr keys
 #define valCompare(v1, v2)                                                          \
     ((v1).ptrSize == 0 ? ((v1).val[0] == (v2).val[0] && (v1).val[1] == (v2).val[1]) \
-                       : ((v1).hash == (v2).hash && (v1).ptrSize == (v2).ptrSize && memcmp((v1).valPtr, (v2).valPtr, (v1).ptrSize) == 0))
+                       : ((v1).hash == (v2).hash && (v1).ptrSize == (v2).ptrSize && keyEqual((v1).valPtr, (v2).valPtr, (v1).ptrSize)))
 
 // hash definition
 typedef struct flowHash_s {
@@ -329,14 +354,45 @@ typedef struct flowHash_s {
     uint32_t mask;              // mask for max index
     uint32_t load_factor;       // no more than load_factor until resize
     int shift;                  // 32 - shift = bit width of hash
+    hashStat_t stat;            // probe statistics
+    // incremental resize - the cells of the old table move a few at a time into the new table
+    uint8_t *oldFlags;          // flags of old table, NULL if no resize is in progress
+    hashValue_t *oldCells;      // cells of old table
+    uint32_t oldCapacity;       // cells of old table
+    uint32_t oldMask;           // mask for max index of old table
+    int oldShift;               // shift of old table
+    uint32_t migrateStart;      // first free cell of old table - cells are migrated from here on
+    uint32_t migrated;          // number of migrated cells
 } flowHash_t;
 
+// number of old cells migrated with each added value. Must be >= 2 to complete the migration,
+// before the new table reaches its load factor
+#define MIGRATECELLS 16
+// the pages of migrated old cells are released in chunks of cells
+#define MIGRATECHUNK (1 << 16)
+
 // FlowHash var
 static flowHash_t *flowHash = NULL;
 
+// probe statistics of already freed hash tables
+static hashStat_t freedHashStat = {0};
+
+// number of flows in the files opened so far - a resized hash grows towards the projected size
+static _Atomic uint64_t expectedFlows = 0;
+// number of hash tables, which share the expected flows
+static uint32_t numFlowHashes = 1;
+
+static void AddHashStat(hashStat_t *sum, hashStat_t *stat) {
+    sum->lookups += stat->lookups;
+    sum->probes += stat->probes;
+    sum->collisions += stat->collisions;
+    sum->resizes += stat->resizes;
+}  // End of AddHashStat
+
 static flowHash_t *flowHash_init(uint32_t bitSize) {
     flowHash_t *flowHash = calloc(1, sizeof(flowHash_t));
     if (!flowHash) return NULL;
+    KeyHashInit();
 
     flowHash->shift = bitSize;
     flowHash->capacity = 1 << (32 - bitSize);
@@ -347,59 +403,193 @@ static flowHash_t *flowHash_init(uint32_t bitSize) {
     flowHash->flags = calloc(flowHash->capacity, sizeof(uint8_t));
     flowHash->cells = calloc(flowHash->capacity, sizeof(hashValue_t));
     flowHash->records = calloc(flowHash->capacity, sizeof(FlowHashRecord_t));
-    return flowHash->cells != NULL && flowHash->flags != NULL ? flowHash : NULL;
+    if (flowHash->cells == NULL || flowHash->flags == NULL) return NULL;
+
+    nfhugeadvise(flowHash->cells, flowHash->capacity * sizeof(hashValue_t));
+    nfhugeadvise(flowHash->records, flowHash->capacity * sizeof(FlowHashRecord_t));
+    return flowHash;
 
 }  // End of flowHash_init
 
-static void flowHash_free(void) {
+static void flowHash_free(flowHash_t *flowHash) {
     if (!flowHash) return;
 
+    AddHashStat(&freedHashStat, &flowHash->stat);
+    free(flowHash->oldFlags);
+    free(flowHash->oldCells);
     free(flowHash->flags);
     free(flowHash->cells);
     free(flowHash->records);
     free(flowHash);
-    flowHash = NULL;
 
 }  // End of flowHash_free
 
+/*
+ * Migrate the next numCells cells of the old table into the new table.
+ * Cells are migrated in the order of the old table, starting at its first free cell. No probe
+ * sequence crosses a free cell, therefore an old probe sequence, which starts before the
+ * migration position, continues at the migration position. The migrated cells are no longer
+ * probed and their pages are released in chunks, which keeps the memory near the new table size.
+ */
+static void flowHash_migrate(flowHash_t *flowHash, uint32_t numCells) {
+    uint32_t end = flowHash->migrated + numCells;
+    if (end > flowHash->oldCapacity) end = flowHash->oldCapacity;
+
+    for (uint32_t rank = flowHash->migrated; rank < end; rank++) {
+        uint32_t i = (flowHash->migrateStart + rank) & flowHash->oldMask;
+        if (is_used(flowHash->oldFlags, i)) {
+            uint32_t cell = ___fib_hash(flowHash->oldCells[i].hash, flowHash->shift);
+            while (is_used(flowHash->flags, cell)) {
+                cell = (cell + 1) & flowHash->mask;
+            }
+            flowHash->cells[cell] = flowHash->oldCells[i];
+            flowHash->flags[cell] = flowHash->oldFlags[i];
+        }
+    }
+    flowHash->migrated = end;
+
+    if (end == flowHash->oldCapacity) {
+        free(flowHash->oldFlags);
+        free(flowHash->oldCells);
+        flowHash->oldFlags = NULL;
+        flowHash->oldCells = NULL;
+    } else if ((end & (MIGRATECHUNK - 1)) == 0) {
+        // release the last chunk - it may wrap around the end of the old table
+        uint32_t first = (flowHash->migrateStart + end - MIGRATECHUNK) & flowHash->oldMask;
+        uint32_t num = MIGRATECHUNK;
+        if (first + num > flowHash->oldCapacity) {
+            uint32_t tail = flowHash->oldCapacity - first;
+            nfreleaseadvise(flowHash->oldFlags, (num - tail) * sizeof(uint8_t));
+            nfreleaseadvise(flowHash->oldCells, (num - tail) * sizeof(hashValue_t));
+            num = tail;
+        }
+        nfreleaseadvise(flowHash->oldFlags + first, num * sizeof(uint8_t));
+        nfreleaseadvise(flowHash->oldCells + first, num * sizeof(hashValue_t));
+    }
+
+}  // End of flowHash_migrate
+
+// complete a resize in progress
+static inline void flowHash_finish(flowHash_t *flowHash) {
+    if (flowHash->oldFlags) flowHash_migrate(flowHash, flowHash->oldCapacity);
+}  // End of flowHash_finish
+
 /*
  * resize hash:
- * resize flags and cell array and rearrange entries
- * records remain in same place, but memory gets resized
+ * allocate new flags and cell arrays. The entries of the old arrays are migrated
+ * incrementally by flowHash_add(), therefore no single add stalls for a full rehash.
+ * records remain in same place, but memory gets resized. realloc() remaps large
+ * blocks without copying.
+ * The hash doubles, or grows up to 16 times, if the number of entries projected
+ * from the flows of the files opened so far is larger. This saves the rehashing
+ * of the intermediate sizes.
  */
 static inline void flowHash_resize(flowHash_t *flowHash) {
-    int oldCapacity = flowHash->load_factor = flowHash->capacity;
-    flowHash->capacity = 1u << (32 - (--flowHash->shift));
+    // a resize in progress must be completed first
+    flowHash_finish(flowHash);
+
+    uint32_t oldCapacity = flowHash->capacity;
+    int grow = 1;
+    uint64_t expected = atomic_load_explicit(&expectedFlows, memory_order_relaxed) / numFlowHashes;
+    uint64_t added = flowHash->stat.lookups;
+    if (added && expected > added) {
+        uint64_t projected = (uint64_t)flowHash->count * expected / added;
+        while (grow < 4 && (flowHash->shift - grow) > 2 && ((uint64_t)oldCapacity << grow) < 2 * projected) grow++;
+    }
+
+    flowHash->stat.resizes++;
+    flowHash->oldFlags = flowHash->flags;
+    flowHash->oldCells = flowHash->cells;
+    flowHash->oldCapacity = oldCapacity;
+    flowHash->oldMask = flowHash->mask;
+    flowHash->oldShift = flowHash->shift;
+    flowHash->migrated = 0;
+    // the old table is at most half full - a free cell exists
+    flowHash->migrateStart = 0;
+    while (is_used(flowHash->oldFlags, flowHash->migrateStart)) flowHash->migrateStart++;
+
+    flowHash->shift -= grow;
+    flowHash->capacity = 1u << (32 - flowHash->shift);
     flowHash->mask = flowHash->capacity - 1;
+    flowHash->load_factor = flowHash->capacity >> 1;
 
-    hashValue_t *oldCells = flowHash->cells;
     hashValue_t *newCells = calloc(flowHash->capacity, sizeof(hashValue_t));
-
-    uint8_t *oldFlags = flowHash->flags;
     uint8_t *newFlags = calloc(flowHash->capacity, sizeof(uint8_t));
-
     FlowHashRecord_t *newRecords = realloc(flowHash->records, flowHash->capacity * sizeof(FlowHashRecord_t));
     assert(newFlags && newCells && newRecords);
+    nfhugeadvise(newCells, flowHash->capacity * sizeof(hashValue_t));
+    nfhugeadvise(newRecords, flowHash->capacity * sizeof(FlowHashRecord_t));
 
-    // rearrange cells and flags, according to hash and new bit width of hash table
-    for (uint32_t i = 0; i < oldCapacity; i++) {
-        if (is_used(oldFlags, i)) {
-            uint32_t cell = ___fib_hash(oldCells[i].hash, flowHash->shift);
-            while (is_used(newFlags, cell)) {
-                cell = (cell + 1) & flowHash->mask;
-            }
-            newCells[cell] = oldCells[i];
-            newFlags[cell] = oldFlags[i];
-        }
-    }
     flowHash->cells = newCells;
     flowHash->flags = newFlags;
     flowHash->records = newRecords;
-    free(oldCells);
-    free(oldFlags);
 
 }  // End of flowHash_resize
 
+/*
+ * Searches the probe sequence of value.
+ * The flags are probed TAGGROUP cells at once. Near the end of the flags array
+ * the cells are probed one by one, until the probe sequence wraps around.
+ * returns:
+ *   index into the stat record array if found
+ *   -1 if value does not exists and freeCell is set to the first free cell
+ */
+static inline int flowHash_find(flowHash_t *flowHash, const hashValue_t *value, uint8_t flag, uint32_t *freeCell) {
+    uint32_t cell = ___fib_hash(value->hash, flowHash->shift);
+
+    flowHash->stat.lookups++;
+    do {
+        flowHash->stat.probes++;
+        if ((cell + TAGGROUP) <= flowHash->capacity) {
+            uint32_t empty;
+            uint32_t match = tagMatch(flowHash->flags + cell, flag, &empty);
+            // cells after the first free cell are not part of the probe sequence
+            match = tagBefore(match, empty);
+            while (match) {
+                uint32_t i = cell + tagFirst(match);
+                if (valCompare(flowHash->cells[i], *value)) return flowHash->cells[i].index;
+                // collision - flag matches but compare does not
+                flowHash->stat.collisions++;
+                match &= match - 1;
+            }
+            if (empty) {
+                *freeCell = cell + tagFirst(empty);
+                return -1;
+            }
+            cell = (cell + TAGGROUP) & flowHash->mask;
+        } else {
+            if (is_free(flowHash->flags, cell)) {
+                *freeCell = cell;
+                return -1;
+            }
+            if (flowHash->flags[cell] == flag && valCompare(flowHash->cells[cell], *value)) return flowHash->cells[cell].index;
+            cell = (cell + 1) & flowHash->mask;
+        }
+    } while (1);
+
+}  // End of flowHash_find
+
+/*
+ * Searches value in the not yet migrated cells of the old table, while a resize is in progress.
+ * returns:
+ *   index into the stat record array if found
+ *   -1 if value does not exists in the old table
+ */
+static inline int flowHash_findOld(flowHash_t *flowHash, const hashValue_t *value, uint8_t flag) {
+    uint32_t cell = ___fib_hash(value->hash, flowHash->oldShift);
+    // the probe sequence continues at the migration position, if it started in the migrated cells
+    if (((cell - flowHash->migrateStart) & flowHash->oldMask) < flowHash->migrated)
+        cell = (flowHash->migrateStart + flowHash->migrated) & flowHash->oldMask;
+
+    while (is_used(flowHash->oldFlags, cell)) {
+        flowHash->stat.probes++;
+        if (flowHash->oldFlags[cell] == flag && valCompare(flowHash->oldCells[cell], *value)) return flowHash->oldCells[cell].index;
+        cell = (cell + 1) & flowHash->oldMask;
+    }
+    return -1;
+
+}  // End of flowHash_findOld
+
 /*
  * Adds new value to the hash table.
  * insert is set to
@@ -408,48 +598,26 @@ static inline void flowHash_resize(flowHash_t *flowHash) {
  * returns the index into the stat record array of new or existing value
  */
 static inline int flowHash_add(flowHash_t *flowHash, const hashValue_t value, int *insert) {
+    if (flowHash->oldFlags) flowHash_migrate(flowHash, MIGRATECELLS);
     if (flowHash->count == flowHash->load_factor) flowHash_resize(flowHash);
 
-    uint32_t hash = value.hash;
-    // cell address
-    uint32_t cell = ___fib_hash(hash, flowHash->shift);
-
-    uint8_t flag = 0x80 | (hash & 0x7F);
-    // shortcut for likely unused cell - speed up
-    if (is_free(flowHash->flags, cell)) {
-        int index = flowHash->count++;
-        flowHash->flags[cell] = flag;
-        flowHash->cells[cell] = value;
-        flowHash->cells[cell].index = index;
-        *insert = 1;
+    uint8_t flag = 0x80 | (value.hash & 0x7F);
+    uint32_t cell = 0;
+    int index = flowHash_find(flowHash, &value, flag, &cell);
+    if (index < 0 && flowHash->oldFlags) index = flowHash_findOld(flowHash, &value, flag);
+    if (index >= 0) {
+        // existing value found
+        *insert = 0;
         return index;
     }
 
-    // loop until existing value or empty cell is found
-    do {
-        // find empty cell or cell with correct flags
-        while (is_used(flowHash->flags, cell) && (flowHash->flags[cell] != flag))
-            if (++cell == flowHash->capacity) cell = 0;
-
-        if (is_free(flowHash->flags, cell)) {
-            // free cell found
-            int index = flowHash->count++;
-            flowHash->flags[cell] = flag;
-            flowHash->cells[cell] = value;
-            flowHash->cells[cell].index = index;
-            *insert = 1;
-            return index;
-        } else {
-            // cell with matching flag
-            if (valCompare(flowHash->cells[cell], value)) {
-                // existing value found
-                *insert = 0;
-                return flowHash->cells[cell].index;
-            }
-        }
-        // hash collision - cell used by another value
-        if (++cell == flowHash->capacity) cell = 0;
-    } while (1);
+    // free cell found
+    index = flowHash->count++;
+    flowHash->flags[cell] = flag;
+    flowHash->cells[cell] = value;
+    flowHash->cells[cell].index = index;
+    *insert = 1;
+    return index;
 
 }  // End of flowHash_add
 
@@ -460,38 +628,363 @@ static inline int flowHash_add(flowHash_t *flowHash, const hashValue_t value, in
  *   -1 if value does not exists
  */
 static inline int flowHash_get(flowHash_t *flowHash, const hashValue_t value) {
-    uint32_t hash = value.hash;
-    // cell address
-    uint32_t cell = ___fib_hash(hash, flowHash->shift);
+    uint8_t flag = 0x80 | (value.hash & 0x7F);
+    uint32_t cell = 0;
+    int index = flowHash_find(flowHash, &value, flag, &cell);
+    if (index < 0 && flowHash->oldFlags) index = flowHash_findOld(flowHash, &value, flag);
+    return index;
+
+}  // End of flowHash_get
 
-    // shortcut to speed up if cell is empty
-    if (is_free(flowHash->flags, cell)) return -1;
+/*
+ * Space-Saving heavy hitter sketch for approximate top N aggregation -k
+ * The flow hash is limited to a fixed number of counters. If the hash is full,
+ * the record with the smallest count is evicted and the new flow inherits its count
+ * as error. The count of a monitored record is overestimated by at most its error.
+ * A min heap of record indices, ordered by count, finds the record to evict.
+ */
+typedef struct topNSketch_s {
+    uint32_t counters;  // max number of records in hash
+    uint32_t order;     // index into order_mode - counted value
+    uint32_t *heap;     // min heap of record indices
+    uint32_t *heapPos;  // record index -> heap position
+    uint32_t *cell;     // record index -> hash cell
+    uint64_t *count;    // record index -> counted value + error
+    uint64_t *error;    // record index -> max overestimation of count
+    uint64_t evicted;   // number of evicted records
+    void *freeKeys;     // list of key memory of evicted records for reuse
+} topNSketch_t;
+
+static topNSketch_t *topNSketch = NULL;
+
+static inline void sketch_swap(topNSketch_t *sketch, uint32_t i, uint32_t j) {
+    uint32_t tmp = sketch->heap[i];
+    sketch->heap[i] = sketch->heap[j];
+    sketch->heap[j] = tmp;
+    sketch->heapPos[sketch->heap[i]] = i;
+    sketch->heapPos[sketch->heap[j]] = j;
+}  // End of sketch_swap
+
+// restore heap order for record index, after its count changed
+static inline void sketch_heapify(topNSketch_t *sketch, uint32_t num, uint32_t index) {
+    uint32_t pos = sketch->heapPos[index];
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) >> 1;
+        if (sketch->count[sketch->heap[parent]] <= sketch->count[index]) break;
+        sketch_swap(sketch, pos, parent);
+        pos = parent;
+    }
+    while (1) {
+        uint32_t min = pos;
+        uint32_t left = 2 * pos + 1;
+        uint32_t right = left + 1;
+        if (left < num && sketch->count[sketch->heap[left]] < sketch->count[sketch->heap[min]]) min = left;
+        if (right < num && sketch->count[sketch->heap[right]] < sketch->count[sketch->heap[min]]) min = right;
+        if (min == pos) break;
+        sketch_swap(sketch, pos, min);
+        pos = min;
+    }
+}  // End of sketch_heapify
+
+// remove cell from hash - shift back following cells of the same probe sequence
+static inline void sketch_remove(flowHash_t *flowHash, topNSketch_t *sketch, uint32_t cell) {
+    uint32_t hole = cell;
+    uint32_t next = (cell + 1) & flowHash->mask;
+    while (is_used(flowHash->flags, next)) {
+        uint32_t home = ___fib_hash(flowHash->cells[next].hash, flowHash->shift);
+        // move cell, if its home is not cyclically in (hole, next]
+        int keep = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!keep) {
+            flowHash->flags[hole] = flowHash->flags[next];
+            flowHash->cells[hole] = flowHash->cells[next];
+            sketch->cell[flowHash->cells[hole].index] = hole;
+            hole = next;
+        }
+        next = (next + 1) & flowHash->mask;
+    }
+    flowHash->flags[hole] = 0;
+}  // End of sketch_remove
 
+/*
+ * Adds new value to the bounded hash table. Same semantics as flowHash_add
+ * but evicts the record with the smallest count, if all counters are in use.
+ */
+static inline int sketch_add(flowHash_t *flowHash, topNSketch_t *sketch, const hashValue_t value, int *insert) {
+    uint32_t hash = value.hash;
     uint8_t flag = 0x80 | (hash & 0x7F);
-    // cell used, check for correct value
-    do {
-        // search for matching flag
-        while (is_used(flowHash->flags, cell) && (flowHash->flags[cell] != flag))
-            if (++cell == flowHash->capacity) cell = 0;
 
-        if (is_free(flowHash->flags, cell)) return -1;
-        if (valCompare(flowHash->cells[cell], value)) return flowHash->cells[cell].index;
+    uint32_t cell = 0;
+    int found = flowHash_find(flowHash, &value, flag, &cell);
+    if (found >= 0) {
+        *insert = 0;
+        return found;
+    }
 
-        // collision - flag matches but compare does not - loop
-        if (++cell == flowHash->capacity) cell = 0;
-    } while (1);
-}
+    uint32_t index;
+    if (flowHash->count < sketch->counters) {
+        index = flowHash->count++;
+        sketch->heap[index] = index;
+        sketch->heapPos[index] = index;
+        sketch->error[index] = 0;
+    } else {
+        // evict record with smallest count - new record inherits its count
+        index = sketch->heap[0];
+        sketch->error[index] = sketch->count[index];
+        sketch->evicted++;
+
+        uint32_t evictCell = sketch->cell[index];
+        if (flowHash->cells[evictCell].ptrSize) {
+            void *keyMem = flowHash->cells[evictCell].valPtr;
+            *(void **)keyMem = sketch->freeKeys;
+            sketch->freeKeys = keyMem;
+        }
+        free(flowHash->records[index].flowrecord);
+        sketch_remove(flowHash, sketch, evictCell);
+
+        // removal may shift cells - find free cell again
+        cell = ___fib_hash(hash, flowHash->shift);
+        while (is_used(flowHash->flags, cell)) cell = (cell + 1) & flowHash->mask;
+    }
+
+    flowHash->flags[cell] = flag;
+    flowHash->cells[cell] = value;
+    flowHash->cells[cell].index = index;
+    sketch->cell[index] = cell;
+    *insert = 1;
+    return index;
+
+}  // End of sketch_add
+
+// update count of record index, after the record counters got updated
+static inline void sketch_update(flowHash_t *flowHash, topNSketch_t *sketch, uint32_t index) {
+    sketch->count[index] = order_mode[sketch->order].record_function(&(flowHash->records[index])) + sketch->error[index];
+    sketch_heapify(sketch, flowHash->count, index);
+}  // End of sketch_update
+
+// quantile histograms per aggregated flow, requested by the output format.
+// histoSlot maps a HISTO_* metric to its histogram in FlowHashRecord_t.histo, -1: not collected
+static uint32_t numHistoSlots = 0;
+static int histoSlot[NUMHISTOS] = {-1, -1, -1};
+
+// add the flow to the quantile histograms of the aggregated record
+static inline void UpdateFlowHisto(FlowHashRecord_t *flowRecord, recordHandle_t *recordHandle, EXgenericFlow_t *genericFlow) {
+    if (flowRecord->histo == NULL) {
+        flowRecord->histo = nfmalloc(numHistoSlots * sizeof(logHisto_t));
+        memset((void *)flowRecord->histo, 0, numHistoSlots * sizeof(logHisto_t));
+    }
+
+    if (histoSlot[HISTO_DURATION] >= 0) {
+        uint64_t duration = genericFlow->msecLast > genericFlow->msecFirst ? genericFlow->msecLast - genericFlow->msecFirst : 0;
+        LogHistoAdd(&flowRecord->histo[histoSlot[HISTO_DURATION]], duration);
+    }
+    if (histoSlot[HISTO_BPP] >= 0 && genericFlow->inPackets) {
+        LogHistoAdd(&flowRecord->histo[histoSlot[HISTO_BPP]], genericFlow->inBytes / genericFlow->inPackets);
+    }
+    if (histoSlot[HISTO_LATENCY] >= 0) {
+        EXlatency_t *latency = (EXlatency_t *)recordHandle->extensionList[EXlatencyID];
+        if (latency && latency->usecApplLatency) LogHistoAdd(&flowRecord->histo[histoSlot[HISTO_LATENCY]], latency->usecApplLatency);
+    }
+
+}  // End of UpdateFlowHisto
+
+// extensions of the first flow kept in an aggregated record. Reduced by SlimFlowRecords()
+static uint64_t keepMask = ~0ULL;
+
+// copy the first flow of an aggregated record with the extensions in keepMask only
+static inline void *CopyFlowRecord(recordHeaderV3_t *record, int useMalloc) {
+    uint32_t size = record->size;
+    if (keepMask != ~0ULL) {
+        size = sizeof(recordHeaderV3_t);
+        elementHeader_t *elementHeader = (elementHeader_t *)((void *)record + sizeof(recordHeaderV3_t));
+        for (int i = 0; i < record->numElements; i++) {
+            if (elementHeader->type < MAXEXTENSIONS && (keepMask & ExtensionBit(elementHeader->type))) size += elementHeader->length;
+            elementHeader = (elementHeader_t *)((void *)elementHeader + elementHeader->length);
+        }
+    }
+
+    void *p = useMalloc ? malloc(size) : nfmalloc(size);
+    if (!p) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    if (size == record->size) {
+        memcpy(p, (void *)record, size);
+        return p;
+    }
+
+    recordHeaderV3_t *copy = (recordHeaderV3_t *)p;
+    memcpy(p, (void *)record, sizeof(recordHeaderV3_t));
+    copy->size = size;
+    copy->numElements = 0;
+    void *dst = p + sizeof(recordHeaderV3_t);
+    elementHeader_t *elementHeader = (elementHeader_t *)((void *)record + sizeof(recordHeaderV3_t));
+    for (int i = 0; i < record->numElements; i++) {
+        if (elementHeader->type < MAXEXTENSIONS && (keepMask & ExtensionBit(elementHeader->type))) {
+            memcpy(dst, (void *)elementHeader, elementHeader->length);
+            dst += elementHeader->length;
+            copy->numElements++;
+        }
+        elementHeader = (elementHeader_t *)((void *)elementHeader + elementHeader->length);
+    }
+
+    return p;
 
-// linear FlowList for -O sorting
-static struct FlowList_s {
-    FlowHashRecord_t *head;
-    FlowHashRecord_t **tail;
+}  // End of CopyFlowRecord
+
+// linear sort buffer for -O sorting. The flow records are not copied, but point into
+// the retained data blocks. Records of sparsely used blocks are compacted into nfmalloc memory
+#define SortBufferChunk (1024 * 1024)
+static struct sortBuffer_s {
+    FlowHashRecord_t *records;  // contiguous array of listed flows
     size_t NumRecords;
-} FlowList = {0};
+    size_t maxRecords;
+    size_t blockStart;     // first record of the current data block
+    dataBlock_t **blocks;  // retained data blocks
+    uint32_t numBlocks;
+    uint32_t maxBlocks;
+} sortBuffer = {0};
 
 static size_t maxKeyLen = 0;
+
+// aggregation of the flows, stored in the appendix of -w aggregate files
+#define DefaultAggregation "proto,srcip,srcport,dstip,dstport"
+static char *aggregationSpec = NULL;
 static uint32_t bidir_flows = 0;
 
+// time bucket in msec of the aggregation -A bucket:<sec>. The bucket of msecFirst
+// is part of the key and the flows are printed grouped by bucket. 0: no buckets
+static uint64_t bucketInterval = 0;
+
+// specialized hash key builders for the most common aggregations
+// selected in ParseAggregateMask(). KEY_GENERIC walks the aggregation element list
+typedef enum { KEY_GENERIC = 0, KEY_5TUPLE, KEY_SRCIP, KEY_DSTIP, KEY_SRCDSTIP, KEY_DSTSRCIP } keyType_t;
+static keyType_t keyType = KEY_5TUPLE;
+
+/*
+ * IPv6 address dictionary for srcip/dstip pair aggregations
+ * Two IPv6 addresses do not fit into the 16 byte hash value. Each address is mapped
+ * to a dense 32bit id, so the pair of ids fits into the hash value and needs no key memory.
+ * The addresses are printed from the flow record, therefore the ids are never decoded.
+ * The ids must be the same in all hash tables, therefore not used with worker shards.
+ */
+#define AddrDictInitBits 16
+static struct addrDict_s {
+    uint64_t *addr;     // IPv6 address of each slot
+    uint32_t *id;       // id + 1 of each slot, 0: free slot
+    uint32_t capacity;  // number of slots - power of 2
+    uint32_t count;     // number of ids
+} addrDict = {0};
+
+static int AddrDict_init(uint32_t bits) {
+    addrDict.capacity = 1 << bits;
+    addrDict.count = 0;
+    addrDict.addr = malloc(2 * sizeof(uint64_t) * addrDict.capacity);
+    addrDict.id = calloc(addrDict.capacity, sizeof(uint32_t));
+    if (!addrDict.addr || !addrDict.id) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    return 1;
+}  // End of AddrDict_init
+
+static void AddrDict_free(void) {
+    free(addrDict.addr);
+    free(addrDict.id);
+    addrDict = (struct addrDict_s){0};
+}  // End of AddrDict_free
+
+static inline uint32_t AddrDict_slot(const uint64_t *addr, uint32_t mask) {
+    uint64_t h = (addr[0] ^ (addr[1] * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL;
+    return (uint32_t)(h >> 32) & mask;
+}  // End of AddrDict_slot
+
+static void AddrDict_resize(void) {
+    uint64_t *oldAddr = addrDict.addr;
+    uint32_t *oldID = addrDict.id;
+    uint32_t oldCapacity = addrDict.capacity;
+
+    addrDict.capacity <<= 1;
+    addrDict.addr = malloc(2 * sizeof(uint64_t) * addrDict.capacity);
+    addrDict.id = calloc(addrDict.capacity, sizeof(uint32_t));
+    if (!addrDict.addr || !addrDict.id) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    uint32_t mask = addrDict.capacity - 1;
+    for (uint32_t i = 0; i < oldCapacity; i++) {
+        if (oldID[i] == 0) continue;
+        uint32_t slot = AddrDict_slot(&oldAddr[2 * i], mask);
+        while (addrDict.id[slot]) slot = (slot + 1) & mask;
+        addrDict.addr[2 * slot] = oldAddr[2 * i];
+        addrDict.addr[2 * slot + 1] = oldAddr[2 * i + 1];
+        addrDict.id[slot] = oldID[i];
+    }
+    free(oldAddr);
+    free(oldID);
+}  // End of AddrDict_resize
+
+// return the id of the IPv6 address. Unknown addresses get the next id
+static inline uint32_t AddrDict_id(const uint64_t *addr) {
+    uint32_t mask = addrDict.capacity - 1;
+    uint32_t slot = AddrDict_slot(addr, mask);
+    while (addrDict.id[slot]) {
+        if (addrDict.addr[2 * slot] == addr[0] && addrDict.addr[2 * slot + 1] == addr[1]) return addrDict.id[slot];
+        slot = (slot + 1) & mask;
+    }
+
+    addrDict.addr[2 * slot] = addr[0];
+    addrDict.addr[2 * slot + 1] = addr[1];
+    addrDict.id[slot] = ++addrDict.count;
+    // keep load factor below 3/4
+    if (addrDict.count > (addrDict.capacity >> 1) + (addrDict.capacity >> 2)) AddrDict_resize();
+
+    return addrDict.count;
+}  // End of AddrDict_id
+
+// per worker hash shards for parallel aggregation
+// each shard is only accessed by its own worker and merged later into flowHash
+typedef struct flowShard_s {
+    flowHash_t *flowHash;
+    void *mem;  // unused key memory for next record
+} flowShard_t;
+
+static flowShard_t *flowShards = NULL;
+static uint32_t numFlowShards = 0;
+
+// unused key memory for next record of AddFlowCache()
+static void *flowKeyMem = NULL;
+
+/*
+ * external aggregation -U
+ * If the flow cache exceeds the memory budget, all aggregated records are spilled
+ * into NUMSPILL partition files, selected by hash bits of the aggregation key.
+ * The flow cache and the memory arena are reset and aggregation continues.
+ * All records of a key end up in the same partition, therefore each partition
+ * is finally aggregated on its own.
+ */
+#define SPILLBITS 4
+#define NUMSPILL (1 << SPILLBITS)
+// partition bits - independent of the lower 7 flag bits and the cell index
+#define SpillPartition(hash) (((hash) >> 7) & (NUMSPILL - 1))
+// min budget - nfmalloc allocates 10MB blocks
+#define MINSPILLBUDGET (64 * 1024 * 1024)
+
+static struct spill_s {
+    uint64_t budget;          // memory budget in bytes, 0 - disabled
+    char *dir;                // directory for partition files
+    uint32_t numSpills;       // number of spills so far
+    uint64_t spilledRecords;  // number of spilled aggregated records
+    int merged;               // partitions aggregated - flow records are malloc()ed
+    char *fileName[NUMSPILL];
+    nffile_t *nffile[NUMSPILL];
+    dataBlock_t *dataBlock[NUMSPILL];
+} spill = {0};
+
+static inline uint64_t FlowCacheMemory(void);
+
+static void SpillFlowCache(void);
+
 #include "memhandle.c"
 #include "nfdump_inline.c"
 #include "nffile_inline.c"
@@ -722,6 +1215,13 @@ static inline void PreProcess(void *inPtr, preprocess_t process, recordHandle_t
             if (HasGeoDB == 0 || *as) return;
             *as = ipv4Flow ? LookupV4AS(ipv4Flow->dstAddr) : (ipv6Flow ? LookupV6AS(ipv6Flow->dstAddr) : 0);
         } break;
+        case SRC_LABEL:
+            // inPtr points to the label in the record handle
+            GetRecordLabel(recordHandle, 0);
+            break;
+        case DST_LABEL:
+            GetRecordLabel(recordHandle, 1);
+            break;
     }
 }  // End of PreProcess
 
@@ -738,6 +1238,11 @@ static inline int New_HashKey(void *keymem, recordHandle_t *recordHandle, int sw
 
     if (aggregateInfo[0] >= 0) {
         // custom user aggregation
+        if (bucketInterval) {
+            *((uint64_t *)keymem) = genericFlow ? genericFlow->msecFirst / bucketInterval : 0;
+            keymem += sizeof(uint64_t);
+            keyLen += sizeof(uint64_t);
+        }
         for (int i = 0; aggregateInfo[i] >= 0; i++) {
             // apply src/dst mask bits if requested
             uint32_t tableIndex = aggregateInfo[i];
@@ -852,6 +1357,124 @@ static inline int New_HashKey(void *keymem, recordHandle_t *recordHandle, int sw
     return keyLen;
 }  // End of New_HashKey
 
+/*
+ * specialized hash key for keyType != KEY_GENERIC
+ * builds the same key as New_HashKey() without walking the aggregation element list
+ * IPv4 keys fit into the 16 byte hash value and are directly put into hashValue.
+ * IPv6 keys are put into key memory *mem, which is allocated if needed.
+ * returns the key - hashValue->val or *mem and sets keyLen, or NULL if the
+ * generic key builder is required for this record
+ */
+static inline void *Fast_HashKey(hashValue_t *hashValue, void **mem, recordHandle_t *recordHandle, int *keyLen) {
+    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
+    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+
+    if (ipv4Flow) {
+        uint32_t *key = (uint32_t *)hashValue->val;
+        switch (keyType) {
+            case KEY_5TUPLE: {
+                FlowKeyV4_t *keyptr = (FlowKeyV4_t *)hashValue->val;
+                keyptr->srcAddr = ipv4Flow->srcAddr;
+                keyptr->dstAddr = ipv4Flow->dstAddr;
+                keyptr->srcPort = genericFlow->srcPort;
+                keyptr->dstPort = genericFlow->dstPort;
+                keyptr->proto = genericFlow->proto;
+                keyptr->af = AF_INET;
+            } break;
+            case KEY_SRCIP:
+                key[0] = ipv4Flow->srcAddr;
+                break;
+            case KEY_DSTIP:
+                key[0] = ipv4Flow->dstAddr;
+                break;
+            case KEY_SRCDSTIP:
+                key[0] = ipv4Flow->srcAddr;
+                key[1] = ipv4Flow->dstAddr;
+                break;
+            case KEY_DSTSRCIP:
+                key[0] = ipv4Flow->dstAddr;
+                key[1] = ipv4Flow->srcAddr;
+                break;
+            default:
+                return NULL;
+        }
+        hashValue->ptrSize = 0;
+        *keyLen = 16;
+        return (void *)hashValue->val;
+    }
+
+    if (ipv6Flow == NULL) return NULL;
+
+    uint64_t *key = (uint64_t *)hashValue->val;
+    int len = 0;
+    switch (keyType) {
+        case KEY_5TUPLE:
+            len = sizeof(FlowKeyV6_t);
+            break;
+        case KEY_SRCIP:
+            key[0] = ipv6Flow->srcAddr[0];
+            key[1] = ipv6Flow->srcAddr[1];
+            break;
+        case KEY_DSTIP:
+            key[0] = ipv6Flow->dstAddr[0];
+            key[1] = ipv6Flow->dstAddr[1];
+            break;
+        case KEY_SRCDSTIP:
+        case KEY_DSTSRCIP:
+            if (addrDict.capacity) {
+                // pair of dictionary ids, AF_INET6 tag separates them from IPv4 address pairs
+                uint32_t *idKey = (uint32_t *)hashValue->val;
+                idKey[0] = AddrDict_id(keyType == KEY_SRCDSTIP ? ipv6Flow->srcAddr : ipv6Flow->dstAddr);
+                idKey[1] = AddrDict_id(keyType == KEY_SRCDSTIP ? ipv6Flow->dstAddr : ipv6Flow->srcAddr);
+                idKey[2] = 0;
+                idKey[3] = AF_INET6;
+            } else {
+                len = 32;
+            }
+            break;
+        default:
+            return NULL;
+    }
+    if (len == 0) {
+        // single IPv6 address or dictionary ids fit into the hash value
+        hashValue->ptrSize = 0;
+        *keyLen = 16;
+        return (void *)hashValue->val;
+    }
+
+    if (*mem == NULL && topNSketch && topNSketch->freeKeys) {
+        *mem = topNSketch->freeKeys;
+        topNSketch->freeKeys = *(void **)*mem;
+    }
+    if (*mem == NULL) *mem = nfmalloc(maxKeyLen);
+
+    if (keyType == KEY_5TUPLE) {
+        FlowKeyV6_t *keyptr = (FlowKeyV6_t *)*mem;
+        keyptr->srcAddr[0] = ipv6Flow->srcAddr[0];
+        keyptr->srcAddr[1] = ipv6Flow->srcAddr[1];
+        keyptr->dstAddr[0] = ipv6Flow->dstAddr[0];
+        keyptr->dstAddr[1] = ipv6Flow->dstAddr[1];
+        keyptr->srcPort = genericFlow->srcPort;
+        keyptr->dstPort = genericFlow->dstPort;
+        keyptr->proto = genericFlow->proto;
+        keyptr->af = AF_INET6;
+    } else {
+        uint64_t *keyptr = (uint64_t *)*mem;
+        uint64_t *first = keyType == KEY_SRCDSTIP ? ipv6Flow->srcAddr : ipv6Flow->dstAddr;
+        uint64_t *second = keyType == KEY_SRCDSTIP ? ipv6Flow->dstAddr : ipv6Flow->srcAddr;
+        keyptr[0] = first[0];
+        keyptr[1] = first[1];
+        keyptr[2] = second[0];
+        keyptr[3] = second[1];
+    }
+    hashValue->valPtr = *mem;
+    hashValue->ptrSize = len;
+    *keyLen = len;
+    return *mem;
+
+}  // End of Fast_HashKey
+
 static void ApplyAggregateMask(recordHandle_t *recordHandle, struct aggregationElement_s *aggregationElement) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
@@ -951,9 +1574,10 @@ int Init_FlowCache(int hasGeoDB) {
     if (!nfalloc_Init(0)) return 0;
 
     flowHash = flowHash_init(InitFlowHashBits);
-    FlowList = (struct FlowList_s){.head = NULL, .tail = &FlowList.head, .NumRecords = 0};
+    sortBuffer = (struct sortBuffer_s){0};
     // ipv4 fits into sizeof(FlowKeyV6_t)
     maxKeyLen = sizeof(FlowKeyV6_t);
+    keyType = KEY_5TUPLE;
 
     HasGeoDB = hasGeoDB;
     aggregateInfo[0] = -1;
@@ -962,7 +1586,37 @@ int Init_FlowCache(int hasGeoDB) {
 }  // End of Init_FlowCache
 
 void Dispose_FlowTable(void) {
-    flowHash_free();
+    if (aggregationSpec) {
+        free(aggregationSpec);
+        aggregationSpec = NULL;
+    }
+    if (topNSketch) {
+        for (uint32_t i = 0; i < flowHash->count; i++) free(flowHash->records[i].flowrecord);
+        free(topNSketch->heap);
+        free(topNSketch->heapPos);
+        free(topNSketch->cell);
+        free(topNSketch->count);
+        free(topNSketch->error);
+        free(topNSketch);
+        topNSketch = NULL;
+    }
+    if (spill.merged) {
+        for (uint32_t i = 0; i < flowHash->count; i++) free(flowHash->records[i].flowrecord);
+        spill.merged = 0;
+    }
+    flowHash_free(flowHash);
+    flowHash = NULL;
+    for (uint32_t i = 0; i < sortBuffer.numBlocks; i++) FreeDataBlock(sortBuffer.blocks[i]);
+    free(sortBuffer.blocks);
+    free(sortBuffer.records);
+    sortBuffer = (struct sortBuffer_s){0};
+    for (uint32_t i = 0; i < numFlowShards; i++) {
+        flowHash_free(flowShards[i].flowHash);
+    }
+    free(flowShards);
+    flowShards = NULL;
+    numFlowShards = 0;
+    AddrDict_free();
     nfalloc_free();
 }  // End of Dispose_FlowTable
 
@@ -1001,6 +1655,11 @@ int Parse_PrintOrder(char *order) {
 
 }  // End of Parse_PrintOrder
 
+// return 1, if the records are printed in ascending start time order -O tstart
+int TimeOrder(void) {
+    return PrintOrder && strcmp(order_mode[PrintOrder].string, "tstart") == 0 && PrintDirection == ASCENDING;
+}  // End of TimeOrder
+
 int SetRecordStat(char *statType, char *optOrder) {
     char *optProto = strchr(statType, ':');
     if (optProto) {
@@ -1057,6 +1716,32 @@ int SetRecordStat(char *statType, char *optOrder) {
     return 1;
 }  // End of SetRecordStat
 
+// check, if the custom aggregation has a specialized key builder
+// only plain srcip/dstip without any netmask qualify
+static keyType_t SelectKeyType(void) {
+    if (bucketInterval) return KEY_GENERIC;
+
+    char *element[2] = {NULL, NULL};
+    int numElements = 0;
+    for (int i = 0; aggregateInfo[i] >= 0; i++) {
+        struct aggregationElement_s *aggregationElement = &aggregationTable[aggregateInfo[i]];
+        if (aggregationElement->netmaskID || aggregationElement->preprocess != NOPREPROCESS) return KEY_GENERIC;
+        // v4/v6 alternatives of the same element
+        if (numElements && strcmp(element[numElements - 1], aggregationElement->aggrElement) == 0) continue;
+        if (numElements == 2) return KEY_GENERIC;
+        element[numElements++] = aggregationElement->aggrElement;
+    }
+
+    // element names have alternate v4/v6 entries in aggregationTable
+    int first = element[0] && strcmp(element[0], "srcip") == 0 ? 1 : element[0] && strcmp(element[0], "dstip") == 0 ? 2 : 0;
+    int second = element[1] == NULL ? 0 : strcmp(element[1], "srcip") == 0 ? 1 : strcmp(element[1], "dstip") == 0 ? 2 : 3;
+    if (first == 0 || second == 3 || first == second) return KEY_GENERIC;
+
+    if (second == 0) return first == 1 ? KEY_SRCIP : KEY_DSTIP;
+    return first == 1 ? KEY_SRCDSTIP : KEY_DSTSRCIP;
+
+}  // End of SelectKeyType
+
 char *ParseAggregateMask(char *print_format, char *arg) {
     dbg_printf("Enter %s\n", __func__);
     if (bidir_flows) {
@@ -1065,6 +1750,7 @@ char *ParseAggregateMask(char *print_format, char *arg) {
     }
 
     int modeCSV = 0;
+    int userFormat = 0;
     char *sep = " ";
     char *prepend = AggrPrependFmt;
     char *append = AggrAppendFmt;
@@ -1074,16 +1760,24 @@ char *ParseAggregateMask(char *print_format, char *arg) {
             sep = ",";
             prepend = AggrPrependCvs;
             append = AggrAppendCvs;
+        } else if (strncasecmp(print_format, "fmt:", 4) == 0) {
+            // explicit format - prints any fields of the aggregated flows such as %p95td
+            userFormat = 1;
         } else {
             printf("Can not use print format %s to aggregate flows\n", print_format);
             exit(EXIT_FAILURE);
         }
     }
 
+    if (aggregationSpec) free(aggregationSpec);
+    aggregationSpec = strdup(arg);
+    for (char *c = aggregationSpec; *c; c++) *c = tolower(*c);
+
     uint32_t elementCount = 0;
     aggregateInfo[0] = -1;
 
     maxKeyLen = 0;
+    bucketInterval = 0;
     memset((void *)&aggregateInfo, 0, sizeof(aggregateInfo));
 
     size_t fmt_len = 0;
@@ -1115,6 +1809,23 @@ char *ParseAggregateMask(char *print_format, char *arg) {
     // separate tokens
     char *p = strtok(arg, ",");
     while (p) {
+        // time bucket - not an element of the flow
+        if (strncasecmp(p, "bucket:", 7) == 0) {
+            uint32_t seconds = atoi(p + 7);
+            if (bucketInterval || seconds == 0 || seconds > 86400) {
+                LogError("Expected a single time bucket:<sec> of 1..86400 seconds: '%s'", p);
+                return NULL;
+            }
+            if (topNSketch) {
+                LogError("Time buckets can not be combined with approximate top N aggregation");
+                return NULL;
+            }
+            bucketInterval = 1000LL * seconds;
+            maxKeyLen += sizeof(uint64_t);
+            p = strtok(NULL, ",");
+            continue;
+        }
+
         uint32_t has_mask = 0;
         // check for subnet bits
         char *q = strchr(p, '/');
@@ -1217,6 +1928,8 @@ char *ParseAggregateMask(char *print_format, char *arg) {
         return NULL;
     }
     aggregateInfo[elementCount] = -1;
+    keyType = SelectKeyType();
+    if ((keyType == KEY_SRCDSTIP || keyType == KEY_DSTSRCIP) && addrDict.capacity == 0 && !AddrDict_init(AddrDictInitBits)) return NULL;
 
 #ifdef DEVEL
     printf("Aggregate key:  maxKeyLen: %zu bytes\n", maxKeyLen);
@@ -1238,6 +1951,11 @@ char *ParseAggregateMask(char *print_format, char *arg) {
     }
 
 #endif
+    if (userFormat) {
+        free(aggr_fmt);
+        return print_format;
+    }
+
     if (modeCSV == 0) {
         strncat(aggr_fmt, sep, fmt_len);
         fmt_len--;
@@ -1247,16 +1965,103 @@ char *ParseAggregateMask(char *print_format, char *arg) {
 
 }  // End of ParseAggregateMask
 
+// print the aggregation and the hash key layout of the flow cache for the query plan
+void ExplainAggregation(void) {
+    static const char *keyName[] = {"generic element list", "5-tuple", "srcip", "dstip", "srcip,dstip address ids",
+                                    "dstip,srcip address ids"};
+
+    printf("Aggregation     : %s\n", bidir_flows ? "bidir" : aggregationSpec ? aggregationSpec : DefaultAggregation);
+    if (bidir_flows) {
+        printf("Hash key        : bidirectional 5-tuple\n");
+    } else {
+        printf("Hash key        : %s", keyName[keyType]);
+        if (keyType == KEY_GENERIC) printf(", max %zu bytes", maxKeyLen);
+        if (bucketInterval) printf(", time buckets of %llu s", (unsigned long long)(bucketInterval / 1000));
+        printf("\n");
+    }
+    if (topNSketch) {
+        printf("Flow table      : approximate top N sketch of %u records\n", topNSketch->counters);
+    } else if (spill.budget) {
+        printf("Flow table      : hash table, spilled to %s above %llu MB\n", spill.dir, (unsigned long long)(spill.budget / (1024 * 1024)));
+    } else {
+        printf("Flow table      : hash table\n");
+    }
+
+}  // End of ExplainAggregation
+
+// check, if the requested aggregation of the flows is the same or coarser, than
+// the aggregation fileSpec of a partial aggregate file. Returns 1 if the merge is exact
+static int CheckAggregationSpec(char *fileSpec) {
+    char *requested = bidir_flows ? "bidir" : aggregationSpec ? aggregationSpec : DefaultAggregation;
+    if (strcmp(requested, fileSpec) == 0) return 1;
+    if (bidir_flows || strcmp(fileSpec, "bidir") == 0) return 0;
+
+    char *reqList = strdup(requested);
+    char *fileList = strdup(fileSpec);
+    if (!reqList || !fileList) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    // every requested element must exist in the file, with the same or a longer netmask
+    int exact = 1;
+    char *reqPtr;
+    char *req = strtok_r(reqList, ",", &reqPtr);
+    while (req && exact) {
+        char *q = strchr(req, '/');
+        uint32_t reqMask = q ? atoi(q + 1) : 0;
+        size_t reqLen = q ? (size_t)(q - req) : strlen(req);
+
+        exact = 0;
+        for (char *elem = fileList; elem && *elem;) {
+            char *next = strchr(elem, ',');
+            size_t len = next ? (size_t)(next - elem) : strlen(elem);
+            char *m = memchr(elem, '/', len);
+            size_t elemLen = m ? (size_t)(m - elem) : len;
+            uint32_t fileMask = m ? atoi(m + 1) : 0;
+            // srcip4 etc. is coarser than srcip
+            int family = elemLen + 1 == reqLen && (req[elemLen] == '4' || req[elemLen] == '6');
+            if ((elemLen == reqLen || family) && strncmp(elem, req, elemLen) == 0) {
+                exact = fileMask == 0 || (reqMask && reqMask <= fileMask);
+                break;
+            }
+            elem = next ? next + 1 : NULL;
+        }
+        req = strtok_r(NULL, ",", &reqPtr);
+    }
+
+    free(reqList);
+    free(fileList);
+    return exact;
+
+}  // End of CheckAggregationSpec
+
+int CheckAggregation(nffile_t *nffile) {
+    if (nffile->aggregation == NULL || CheckAggregationSpec(nffile->aggregation)) return 1;
+
+    LogError("Warning: file %s is aggregated by '%s' - the requested aggregation is finer, the result is not exact", nffile->fileName,
+             nffile->aggregation);
+    return 0;
+
+}  // End of CheckAggregation
+
 void InsertFlow(recordHandle_t *recordHandle) {
     dbg_printf("Enter %s\n", __func__);
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     if (!genericFlow) return;
 
-    recordHeaderV3_t *recordHeaderV3 = recordHandle->recordHeaderV3;
+    if (sortBuffer.NumRecords == sortBuffer.maxRecords) {
+        sortBuffer.maxRecords += SortBufferChunk;
+        sortBuffer.records = realloc(sortBuffer.records, sortBuffer.maxRecords * sizeof(FlowHashRecord_t));
+        if (!sortBuffer.records) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
 
-    FlowHashRecord_t *record = (FlowHashRecord_t *)nfmalloc(sizeof(FlowHashRecord_t));
-    record->flowrecord = (recordHeaderV3_t *)nfmalloc(recordHeaderV3->size);
-    memcpy((void *)record->flowrecord, (void *)recordHeaderV3, recordHeaderV3->size);
+    // the record stays in its data block - see RetainSortBlock()
+    FlowHashRecord_t *record = &(sortBuffer.records[sortBuffer.NumRecords]);
+    record->flowrecord = recordHandle->recordHeaderV3;
 
     record->msecFirst = genericFlow->msecFirst;
     record->msecLast = genericFlow->msecLast;
@@ -1276,15 +2081,66 @@ void InsertFlow(recordHandle_t *recordHandle) {
     }
     record->inFlags = genericFlow->tcpFlags;
     record->outFlags = 0;
-    FlowList.NumRecords++;
-
-    record->next = NULL;
-    *FlowList.tail = record;
-    FlowList.tail = &(record->next);
+    record->swap = 0;
+    record->histo = NULL;
+    sortBuffer.NumRecords++;
 
 }  // End of InsertFlow
 
-static void AddBidirFlow(recordHandle_t *recordHandle) {
+// called for each processed data block with InsertFlow() records. Keep the block, if most
+// of its records were inserted, otherwise copy the inserted records. Returns 1, if the
+// block is retained and must not be freed by the caller.
+int RetainSortBlock(dataBlock_t *dataBlock) {
+    size_t inserted = sortBuffer.NumRecords - sortBuffer.blockStart;
+    if (inserted == 0) return 0;
+
+    int retain = 2 * inserted >= dataBlock->NumRecords;
+    if (retain) {
+        if (sortBuffer.numBlocks == sortBuffer.maxBlocks) {
+            sortBuffer.maxBlocks += 64;
+            sortBuffer.blocks = realloc(sortBuffer.blocks, sortBuffer.maxBlocks * sizeof(dataBlock_t *));
+            if (!sortBuffer.blocks) {
+                LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                exit(255);
+            }
+        }
+        sortBuffer.blocks[sortBuffer.numBlocks++] = dataBlock;
+    } else {
+        for (size_t i = sortBuffer.blockStart; i < sortBuffer.NumRecords; i++) {
+            recordHeaderV3_t *recordHeaderV3 = sortBuffer.records[i].flowrecord;
+            void *copy = nfmalloc(recordHeaderV3->size);
+            memcpy(copy, (void *)recordHeaderV3, recordHeaderV3->size);
+            sortBuffer.records[i].flowrecord = (recordHeaderV3_t *)copy;
+        }
+    }
+    sortBuffer.blockStart = sortBuffer.NumRecords;
+
+    return retain;
+
+}  // End of RetainSortBlock
+
+// returns 1, if the canonical bidir key of a TCP/UDP flow is its reverse direction.
+// The canonical key starts with the lower endpoint, so both directions of a
+// connection build the same key. Other protocols are not matched bidirectional
+static inline int BidirReverse(recordHandle_t *recordHandle) {
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+    if (genericFlow->proto != IPPROTO_TCP && genericFlow->proto != IPPROTO_UDP) return 0;
+
+    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
+    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
+    if (ipv4Flow) {
+        if (ipv4Flow->srcAddr != ipv4Flow->dstAddr) return ipv4Flow->srcAddr > ipv4Flow->dstAddr;
+    } else if (ipv6Flow) {
+        if (ipv6Flow->srcAddr[0] != ipv6Flow->dstAddr[0]) return ipv6Flow->srcAddr[0] > ipv6Flow->dstAddr[0];
+        if (ipv6Flow->srcAddr[1] != ipv6Flow->dstAddr[1]) return ipv6Flow->srcAddr[1] > ipv6Flow->dstAddr[1];
+    }
+    return genericFlow->srcPort > genericFlow->dstPort;
+
+}  // End of BidirReverse
+
+// aggregate both directions of a flow with a single lookup of the canonical key.
+// Flows in the direction of the first flow count as in, the others as out
+static inline void AddBidirFlow(flowHash_t *flowHash, void **keyMem, recordHandle_t *recordHandle) {
     dbg_printf("Enter %s\n", __func__);
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
@@ -1296,13 +2152,14 @@ static void AddBidirFlow(recordHandle_t *recordHandle) {
     uint64_t aggrFlows = 1;
     if (cntFlow) {
         outPackets = cntFlow->outPackets;
-        outBytes = cntFlow->outPackets;
-        aggrFlows = cntFlow->flows;
+        outBytes = cntFlow->outBytes;
+        aggrFlows = cntFlow->flows ? cntFlow->flows : 1;
     }
 
     void *keymem = NULL;
-    static void *mem = NULL;
+    void *mem = *keyMem;
     recordHeaderV3_t *record = recordHandle->recordHeaderV3;
+    int reverse = BidirReverse(recordHandle);
 
     hashValue_t hashValue = {0};
     int keyLen = 0;
@@ -1319,7 +2176,7 @@ static void AddBidirFlow(recordHandle_t *recordHandle) {
         } else {
             dbg_printf("Recycle: %zu\n", maxKeyLen);
         }
-        keyLen = New_HashKey(mem, recordHandle, 0);
+        keyLen = New_HashKey(mem, recordHandle, reverse);
         if (keyLen <= 16) {
             dbg_printf("Copy to local: %u\n", keyLen);
             memcpy(hashValue.val, mem, keyLen);
@@ -1334,109 +2191,69 @@ static void AddBidirFlow(recordHandle_t *recordHandle) {
         }
     } else {
         dbg_printf("Use local val\n");
-        New_HashKey((void *)hashValue.val, recordHandle, 0);
+        New_HashKey((void *)hashValue.val, recordHandle, reverse);
         keyLen = 16;
         keymem = (void *)hashValue.val;
     }
 
-    hashValue.hash = metrohash64_1(keymem, keyLen, 0);
+    hashValue.hash = hashValue.ptrSize ? KeyHashBytes(keymem, keyLen) : KeyHash16(hashValue.val[0], hashValue.val[1]);
 
-    int index = flowHash_get(flowHash, hashValue);
-    if (index >= 0) {
-        // flow record found - update all fields
-        flowHash->records[index].inBytes += inBytes;
-        flowHash->records[index].inPackets += inPackets;
-        flowHash->records[index].outBytes += outBytes;
-        flowHash->records[index].outPackets += outPackets;
-        flowHash->records[index].inFlags |= genericFlow->tcpFlags;
+    int insert;
+    int index = flowHash_add(flowHash, hashValue, &insert);
+    FlowHashRecord_t *flowRecord = &(flowHash->records[index]);
+    if (insert == 0) {
+        if (reverse == flowRecord->reverse) {
+            // same direction as the first flow
+            flowRecord->inBytes += inBytes;
+            flowRecord->inPackets += inPackets;
+            flowRecord->outBytes += outBytes;
+            flowRecord->outPackets += outPackets;
+            flowRecord->inFlags |= genericFlow->tcpFlags;
+        } else {
+            // reverse direction - update all fields in reverse direction
+            flowRecord->outBytes += inBytes;
+            flowRecord->outPackets += inPackets;
+            flowRecord->inBytes += outBytes;
+            flowRecord->inPackets += outPackets;
+            flowRecord->outFlags |= genericFlow->tcpFlags;
+        }
 
-        if (genericFlow->msecFirst < flowHash->records[index].msecFirst) {
-            flowHash->records[index].msecFirst = genericFlow->msecFirst;
+        if (genericFlow->msecFirst < flowRecord->msecFirst) {
+            flowRecord->msecFirst = genericFlow->msecFirst;
         }
-        if (genericFlow->msecLast > flowHash->records[index].msecLast) {
-            flowHash->records[index].msecLast = genericFlow->msecLast;
+        if (genericFlow->msecLast > flowRecord->msecLast) {
+            flowRecord->msecLast = genericFlow->msecLast;
         }
 
-        flowHash->records[index].flows += aggrFlows;
-    } else if (genericFlow->proto != IPPROTO_TCP && genericFlow->proto != IPPROTO_UDP) {
-        // no flow record found and no TCP/UDP bidir flows. Insert flow record into hash
-        int insert;
-        index = flowHash_add(flowHash, hashValue, &insert);
-        flowHash->records[index].inBytes = inBytes;
-        flowHash->records[index].inPackets = inPackets;
-        flowHash->records[index].outBytes = outBytes;
-        flowHash->records[index].outPackets = outPackets;
-        flowHash->records[index].flows = aggrFlows;
-        flowHash->records[index].inFlags = genericFlow->tcpFlags;
-        flowHash->records[index].outFlags = 0;
-
-        flowHash->records[index].msecFirst = genericFlow->msecFirst;
-        flowHash->records[index].msecLast = genericFlow->msecLast;
-
-        void *p = nfmalloc(record->size);
-        memcpy((void *)p, record, record->size);
-        flowHash->records[index].flowrecord = p;
-        flowHash->records[index].swap = NeedSwap(keymem);
-
-        // keymen got part of the cache
-        mem = NULL;
+        flowRecord->flows += aggrFlows;
     } else {
-        // for bidir flows do
-
-        // generate reverse hash key to search for bidir flow
-        New_HashKey(keymem, recordHandle, 1);
-        hashValue.hash = metrohash64_1(keymem, keyLen, 0);
-
-        index = flowHash_get(flowHash, hashValue);
-        if (index >= 0) {
-            // we found a corresponding reverse flow - so update all fields in reverse direction
-            flowHash->records[index].outBytes += inBytes;
-            flowHash->records[index].outPackets += inPackets;
-            flowHash->records[index].inBytes += outBytes;
-            flowHash->records[index].inPackets += outPackets;
-            flowHash->records[index].outFlags |= genericFlow->tcpFlags;
-
-            if (genericFlow->msecFirst < flowHash->records[index].msecFirst) {
-                flowHash->records[index].msecFirst = genericFlow->msecFirst;
-            }
-            if (genericFlow->msecLast > flowHash->records[index].msecLast) {
-                flowHash->records[index].msecLast = genericFlow->msecLast;
-            }
-
-            flowHash->records[index].flows += aggrFlows;
-        } else {
-            // no bidir flow found
-            // insert original flow into the cache
-            New_HashKey(keymem, recordHandle, 0);
-            hashValue.hash = metrohash64_1(keymem, keyLen, 0);
-
-            int insert;
-            index = flowHash_add(flowHash, hashValue, &insert);
-            flowHash->records[index].inBytes = inBytes;
-            flowHash->records[index].inPackets = inPackets;
-            flowHash->records[index].outBytes = outBytes;
-            flowHash->records[index].outPackets = outPackets;
-            flowHash->records[index].flows = aggrFlows;
-            flowHash->records[index].inFlags = genericFlow->tcpFlags;
-            flowHash->records[index].outFlags = 0;
-
-            flowHash->records[index].msecFirst = genericFlow->msecFirst;
-            flowHash->records[index].msecLast = genericFlow->msecLast;
-
-            void *p = nfmalloc(record->size);
-            memcpy((void *)p, record, record->size);
-            flowHash->records[index].flowrecord = p;
-            flowHash->records[index].swap = NeedSwap(keymem);
-
-            // keymen got part of the cache
-            mem = NULL;
-        }
+        // first flow of this connection. Insert flow record into hash
+        flowRecord->inBytes = inBytes;
+        flowRecord->inPackets = inPackets;
+        flowRecord->outBytes = outBytes;
+        flowRecord->outPackets = outPackets;
+        flowRecord->flows = aggrFlows;
+        flowRecord->inFlags = genericFlow->tcpFlags;
+        flowRecord->outFlags = 0;
+        flowRecord->reverse = reverse;
+
+        flowRecord->msecFirst = genericFlow->msecFirst;
+        flowRecord->msecLast = genericFlow->msecLast;
+
+        flowRecord->flowrecord = CopyFlowRecord(record, 0);
+        // the direction is guessed from the first flow, not from the canonical key
+        flowRecord->swap = NeedSwapGeneric(GuessDirection, genericFlow);
+        flowRecord->histo = NULL;
+
+        // key memory is part of the cache now
+        if (hashValue.ptrSize) mem = NULL;
     }
+    if (numHistoSlots) UpdateFlowHisto(flowRecord, recordHandle, genericFlow);
+    *keyMem = mem;
 
 }  // End of AddBidirFlow
 
-void AddFlowCache(recordHandle_t *recordHandle) {
-    dbg_printf("\nEnter %s\n", __func__);
+static inline void AddFlowHash(flowHash_t *flowHash, void **keyMem, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     if (!genericFlow) return;
 
@@ -1448,14 +2265,12 @@ void AddFlowCache(recordHandle_t *recordHandle) {
     uint64_t aggrFlows = 1;
     if (cntFlow) {
         outPackets = cntFlow->outPackets;
-        outBytes = cntFlow->outPackets;
+        outBytes = cntFlow->outBytes;
         aggrFlows = cntFlow->flows ? cntFlow->flows : 1;
     }
 
-    if (bidir_flows) return AddBidirFlow(recordHandle);
-
     void *keymem = NULL;
-    static void *mem = NULL;
+    void *mem = *keyMem;
     recordHeaderV3_t *record = recordHandle->recordHeaderV3;
 
     hashValue_t hashValue = {0};
@@ -1465,8 +2280,17 @@ void AddFlowCache(recordHandle_t *recordHandle) {
      * returns actual length needed (different for ipv4/ipv6 elements)
      * up to 16bytes go directly into the hashKey. Faster lookup for CPU cache
      * otherwise use allocated nf-memory
+     * the most common aggregations use a specialized key builder
      */
-    if (maxKeyLen > 16) {
+    if (keyType != KEY_GENERIC) keymem = Fast_HashKey(&hashValue, &mem, recordHandle, &keyLen);
+
+    if (keymem) {
+        dbg_printf("Use fast key: %u\n", keyLen);
+    } else if (maxKeyLen > 16) {
+        if (mem == NULL && topNSketch && topNSketch->freeKeys) {
+            mem = topNSketch->freeKeys;
+            topNSketch->freeKeys = *(void **)mem;
+        }
         if (mem == NULL) {
             dbg_printf("Allocate: %zu\n", maxKeyLen);
             mem = nfmalloc(maxKeyLen);
@@ -1493,10 +2317,10 @@ void AddFlowCache(recordHandle_t *recordHandle) {
         keymem = (void *)hashValue.val;
     }
 
-    hashValue.hash = metrohash64_1(keymem, keyLen, 0);
+    hashValue.hash = hashValue.ptrSize ? KeyHashBytes(keymem, keyLen) : KeyHash16(hashValue.val[0], hashValue.val[1]);
 
     int insert;
-    int index = flowHash_add(flowHash, hashValue, &insert);
+    int index = topNSketch ? sketch_add(flowHash, topNSketch, hashValue, &insert) : flowHash_add(flowHash, hashValue, &insert);
     if (insert == 0) {
         // flow record found - update all fields
         flowHash->records[index].inBytes += inBytes;
@@ -1526,14 +2350,143 @@ void AddFlowCache(recordHandle_t *recordHandle) {
         flowHash->records[index].msecFirst = genericFlow->msecFirst;
         flowHash->records[index].msecLast = genericFlow->msecLast;
         flowHash->records[index].swap = NeedSwap(keymem);
-        void *p = nfmalloc(record->size);
-        memcpy((void *)p, record, record->size);
-        flowHash->records[index].flowrecord = p;
-        mem = NULL;
+        // evicted records free their flow record in approximate mode
+        flowHash->records[index].flowrecord = CopyFlowRecord(record, topNSketch != NULL);
+        flowHash->records[index].histo = NULL;
+        // key memory is part of the cache now
+        if (hashValue.ptrSize) mem = NULL;
     }
+    if (numHistoSlots) UpdateFlowHisto(&(flowHash->records[index]), recordHandle, genericFlow);
+    if (topNSketch) sketch_update(flowHash, topNSketch, index);
+    *keyMem = mem;
+
+}  // End of AddFlowHash
+
+void AddFlowCache(recordHandle_t *recordHandle) {
+    dbg_printf("\nEnter %s\n", __func__);
+    if (!recordHandle->extensionList[EXgenericFlowID]) return;
+
+    if (bidir_flows) return AddBidirFlow(flowHash, &flowKeyMem, recordHandle);
+
+    AddFlowHash(flowHash, &flowKeyMem, recordHandle);
+    if (spill.budget && FlowCacheMemory() > spill.budget) SpillFlowCache();
 
 }  // End of AddFlowCache
 
+int Init_FlowCacheShards(uint32_t numShards) {
+    dbg_printf("Enter %s\n", __func__);
+
+    flowShards = (flowShard_t *)calloc(numShards, sizeof(flowShard_t));
+    if (!flowShards) {
+        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < numShards; i++) {
+        flowShards[i].flowHash = flowHash_init(InitFlowHashBits);
+        if (!flowShards[i].flowHash) {
+            LogError("flowHash_init() failed for shard %u", i);
+            return 0;
+        }
+    }
+    numFlowShards = numShards;
+    numFlowHashes = numShards;
+    // dictionary ids would differ between shards
+    AddrDict_free();
+
+    return 1;
+
+}  // End of Init_FlowCacheShards
+
+// add the number of flows of a newly opened file to the expected number of flows
+void FlowCacheExpect(uint64_t numFlows) {
+    atomic_fetch_add_explicit(&expectedFlows, numFlows, memory_order_relaxed);
+}  // End of FlowCacheExpect
+
+// called by worker 'shard' - aggregate record in the worker's private shard
+void AddFlowCacheShard(uint32_t shard, recordHandle_t *recordHandle) {
+    dbg_printf("\nEnter %s\n", __func__);
+    if (!recordHandle->extensionList[EXgenericFlowID]) return;
+
+    if (bidir_flows)
+        AddBidirFlow(flowShards[shard].flowHash, &flowShards[shard].mem, recordHandle);
+    else
+        AddFlowHash(flowShards[shard].flowHash, &flowShards[shard].mem, recordHandle);
+
+}  // End of AddFlowCacheShard
+
+// merge all worker shards into the flow cache. Must be called, after all workers are done
+void MergeFlowCacheShards(void) {
+    dbg_printf("Enter %s\n", __func__);
+
+    for (uint32_t s = 0; s < numFlowShards; s++) {
+        flowHash_t *shardHash = flowShards[s].flowHash;
+        flowShards[s].flowHash = NULL;
+
+        if (flowHash->count == 0) {
+            // nothing to merge - adopt shard as flow cache
+            flowHash_free(flowHash);
+            flowHash = shardHash;
+            continue;
+        }
+
+        flowHash_finish(shardHash);
+        for (uint32_t i = 0; i < shardHash->capacity; i++) {
+            if (is_free(shardHash->flags, i)) continue;
+
+            FlowHashRecord_t *shardRecord = &(shardHash->records[shardHash->cells[i].index]);
+            int insert;
+            int index = flowHash_add(flowHash, shardHash->cells[i], &insert);
+            FlowHashRecord_t *record = &(flowHash->records[index]);
+            if (insert) {
+                *record = *shardRecord;
+            } else if (shardRecord->reverse != record->reverse) {
+                // bidir flow, first seen in the other direction by this shard
+                record->inBytes += shardRecord->outBytes;
+                record->inPackets += shardRecord->outPackets;
+                record->outBytes += shardRecord->inBytes;
+                record->outPackets += shardRecord->inPackets;
+                record->inFlags |= shardRecord->outFlags;
+                record->outFlags |= shardRecord->inFlags;
+                record->flows += shardRecord->flows;
+
+                if (shardRecord->msecFirst < record->msecFirst) record->msecFirst = shardRecord->msecFirst;
+                if (shardRecord->msecLast > record->msecLast) record->msecLast = shardRecord->msecLast;
+                for (uint32_t h = 0; h < numHistoSlots; h++) LogHistoMerge(&(record->histo[h]), &(shardRecord->histo[h]));
+            } else {
+                record->inBytes += shardRecord->inBytes;
+                record->inPackets += shardRecord->inPackets;
+                record->outBytes += shardRecord->outBytes;
+                record->outPackets += shardRecord->outPackets;
+                record->inFlags |= shardRecord->inFlags;
+                record->outFlags |= shardRecord->outFlags;
+                record->flows += shardRecord->flows;
+
+                if (shardRecord->msecFirst < record->msecFirst) record->msecFirst = shardRecord->msecFirst;
+                if (shardRecord->msecLast > record->msecLast) record->msecLast = shardRecord->msecLast;
+
+                for (uint32_t h = 0; h < numHistoSlots; h++) LogHistoMerge(&(record->histo[h]), &(shardRecord->histo[h]));
+            }
+        }
+        flowHash_free(shardHash);
+    }
+
+    free(flowShards);
+    flowShards = NULL;
+    numFlowShards = 0;
+    numFlowHashes = 1;
+
+}  // End of MergeFlowCacheShards
+
+// probe statistics of all aggregation hash tables
+void FlowHashStat(hashStat_t *hashStat) {
+    *hashStat = freedHashStat;
+    if (flowHash) AddHashStat(hashStat, &flowHash->stat);
+    for (uint32_t i = 0; i < numFlowShards; i++) {
+        if (flowShards[i].flowHash) AddHashStat(hashStat, &flowShards[i].flowHash->stat);
+    }
+}  // End of FlowHashStat
+
 // return a linear list of aggregated/listed flows for later sorting
 static SortElement_t *GetSortList(uint64_t *size) {
     dbg_printf("Enter %s\n", __func__);
@@ -1555,21 +2508,16 @@ static SortElement_t *GetSortList(uint64_t *size) {
         }
         *size = hashSize;
 
-    } else if (FlowList.NumRecords) {  // linear flow list
-        size_t listSize = FlowList.NumRecords;
-        if (!listSize) {
-            return NULL;
-        }
+    } else if (sortBuffer.NumRecords) {  // linear flow list
+        size_t listSize = sortBuffer.NumRecords;
         list = (SortElement_t *)calloc(listSize, sizeof(SortElement_t));
         if (!list) {
             LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
             return NULL;
         }
 
-        FlowHashRecord_t *flowRecord = FlowList.head;
-        for (int i = 0; i < listSize; i++) {
-            list[i].record = (void *)flowRecord;
-            flowRecord = flowRecord->next;
+        for (size_t i = 0; i < listSize; i++) {
+            list[i].record = (void *)&(sortBuffer.records[i]);
         }
         *size = listSize;
     }
@@ -1578,18 +2526,35 @@ static SortElement_t *GetSortList(uint64_t *size) {
 
 }  // End of GetSortList
 
-// print SortList - apply possible aggregation mask to zero out aggregated fields
-static inline void PrintSortList(SortElement_t *SortList, uint64_t maxindex, outputParams_t *outputParams, int GuessFlowDirection,
-                                 RecordPrinter_t print_record, int ascending) {
-    dbg_printf("Enter %s\n", __func__);
+// counters of a sampled query are scaled to the estimated totals
+#define SampleScale(v) (outputParams->sampleScale ? (uint64_t)((v) * outputParams->sampleScale + 0.5) : (v))
 
-    if (outputParams->postFilter) {
-        FilterSetParam(outputParams->postFilter, "out", outputParams->hasGeoDB);
-    }
+// records printed by PrintSortList - continues the record counter of the printer
+// over the partitions of PrintSpill, if the records are rendered in parallel
+static uint64_t sortListPrinted = 0;
 
-    int max = maxindex;
-    if (outputParams->topN && outputParams->topN < maxindex) max = outputParams->topN;
-    for (uint64_t i = 0; i < max; i++) {
+typedef struct sortListRender_s {
+    SortElement_t *SortList;
+    uint64_t maxindex;
+    outputParams_t *outputParams;
+    int GuessFlowDirection;
+    RecordPrinter_t print_record;
+    int ascending;
+} sortListRender_t;
+
+// print the records start .. end-1 of SortList into stream
+static void RenderSortList(FILE *stream, void *arg, uint64_t start, uint64_t end) {
+    sortListRender_t *render = (sortListRender_t *)arg;
+    SortElement_t *SortList = render->SortList;
+    uint64_t maxindex = render->maxindex;
+    outputParams_t *outputParams = render->outputParams;
+    int GuessFlowDirection = render->GuessFlowDirection;
+    RecordPrinter_t print_record = render->print_record;
+    int ascending = render->ascending;
+
+    // without post filter, every record is printed - the counter is known
+    if (!outputParams->postFilter) SetPrintCounter(sortListPrinted + start);
+    for (uint64_t i = start; i < end; i++) {
         uint64_t j = ascending ? i : maxindex - 1 - i;
 
         FlowHashRecord_t *flowRecord = (FlowHashRecord_t *)SortList[j].record;
@@ -1597,25 +2562,32 @@ static inline void PrintSortList(SortElement_t *SortList, uint64_t maxindex, out
 
         recordHandle_t recordHandle = {0};
         MapRecordHandle(&recordHandle, v3record, i + 1);
+        if (flowRecord->histo) {
+            for (int h = 0; h < NUMHISTOS; h++)
+                if (histoSlot[h] >= 0) recordHandle.histo[h] = &(flowRecord->histo[histoSlot[h]]);
+        }
         EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle.extensionList[EXgenericFlowID];
         EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle.extensionList[EXipv4FlowID];
         EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle.extensionList[EXipv6FlowID];
         EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle.extensionList[EXasRoutingID];
         EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle.extensionList[EXcntFlowID];
 
-        genericFlow->inPackets = flowRecord->inPackets;
-        genericFlow->inBytes = flowRecord->inBytes;
+        genericFlow->inPackets = SampleScale(flowRecord->inPackets);
+        genericFlow->inBytes = SampleScale(flowRecord->inBytes);
         genericFlow->msecFirst = flowRecord->msecFirst;
         genericFlow->msecLast = flowRecord->msecLast;
         genericFlow->tcpFlags = flowRecord->inFlags;
 
         EXcntFlow_t tmpCntFlow = {0};
-        if (cntFlow == NULL && (flowRecord->flows > 1 || flowRecord->outPackets)) {
+        if (cntFlow == NULL && (flowRecord->flows > 1 || flowRecord->outPackets || outputParams->sampleScale)) {
             recordHandle.extensionList[EXcntFlowID] = &tmpCntFlow;
             cntFlow = &tmpCntFlow;
-            cntFlow->outPackets = flowRecord->outPackets;
-            cntFlow->outBytes = flowRecord->outBytes;
-            cntFlow->flows = flowRecord->flows;
+        }
+        if (cntFlow) {
+            // aggregated input records carry their own counters - overwrite them
+            cntFlow->outPackets = SampleScale(flowRecord->outPackets);
+            cntFlow->outBytes = SampleScale(flowRecord->outBytes);
+            cntFlow->flows = SampleScale(flowRecord->flows);
         }
 
         if (unlikely(NeedSwapGeneric(GuessFlowDirection, genericFlow))) {
@@ -1624,14 +2596,112 @@ static inline void PrintSortList(SortElement_t *SortList, uint64_t maxindex, out
         }
 
         if (outputParams->postFilter) {
-            if (FilterRecord(outputParams->postFilter, &recordHandle)) print_record(stdout, &recordHandle, outputParams->doTag);
+            if (FilterRecord(outputParams->postFilter, &recordHandle)) print_record(stream, &recordHandle, outputParams->doTag);
         } else {
-            print_record(stdout, &recordHandle, outputParams->doTag);
+            print_record(stream, &recordHandle, outputParams->doTag);
         }
     }
 
+}  // End of RenderSortList
+
+// print SortList - apply possible aggregation mask to zero out aggregated fields
+static inline void PrintSortList(SortElement_t *SortList, uint64_t maxindex, outputParams_t *outputParams, int GuessFlowDirection,
+                                 RecordPrinter_t print_record, int ascending) {
+    dbg_printf("Enter %s\n", __func__);
+
+    uint64_t max = maxindex;
+    if (outputParams->topN && outputParams->topN < maxindex) max = outputParams->topN;
+
+    sortListRender_t render = {
+        .SortList = SortList,
+        .maxindex = maxindex,
+        .outputParams = outputParams,
+        .GuessFlowDirection = GuessFlowDirection,
+        .print_record = print_record,
+        .ascending = ascending,
+    };
+    if (outputParams->postFilter) {
+        // the record counter depends on the filtered records - print in sequence
+        FilterSetParam(outputParams->postFilter, "out", outputParams->hasGeoDB);
+        RenderSortList(stdout, &render, 0, max);
+        return;
+    }
+
+    // render the records in parallel, if the printer allows it
+    if (ParallelPrinter())
+        RenderLines(max, RenderSortList, &render);
+    else
+        RenderSortList(stdout, &render, 0, max);
+    sortListPrinted += max;
+    SetPrintCounter(sortListPrinted);
+
 }  // End of PrintSortList
 
+// export a single flow record with its aggregated counters into dataBlock
+static inline dataBlock_t *ExportFlowRecord(nffile_t *nffile, dataBlock_t *dataBlock, FlowHashRecord_t *flowRecord, int GuessFlowDirection,
+                                            uint64_t flowCount) {
+    recordHeaderV3_t *recordHeaderV3 = (flowRecord->flowrecord);
+
+    // check, if we need cntFlow extension
+    int exCntSize = 0;
+    if (flowRecord->outPackets || flowRecord->outBytes || flowRecord->flows > 1) {
+        exCntSize = EXcntFlowSize;
+    }
+
+    if (!IsAvailable(dataBlock, recordHeaderV3->size + exCntSize)) {
+        // flush block - get an empty one
+        dataBlock = WriteBlock(nffile, dataBlock);
+    }
+
+    // write record
+    void *buffPtr = GetCurrentCursor(dataBlock);
+    memcpy(buffPtr, (void *)recordHeaderV3, recordHeaderV3->size);
+
+    // remap header to written memory
+    recordHeaderV3 = (recordHeaderV3_t *)buffPtr;
+
+    recordHandle_t recordHandle = {0};
+    MapRecordHandle(&recordHandle, recordHeaderV3, flowCount);
+
+    // check if cntFlow already exists
+    EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle.extensionList[EXcntFlowID];
+
+    if (cntFlow == NULL && exCntSize) {
+        PushExtension(recordHeaderV3, EXcntFlow, extPtr);
+        cntFlow = extPtr;
+    }
+    dataBlock->size += recordHeaderV3->size;
+    dataBlock->NumRecords++;
+
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle.extensionList[EXgenericFlowID];
+    if (genericFlow) {
+        genericFlow->inPackets = flowRecord->inPackets;
+        genericFlow->inBytes = flowRecord->inBytes;
+        genericFlow->msecFirst = flowRecord->msecFirst;
+        genericFlow->msecLast = flowRecord->msecLast;
+        genericFlow->tcpFlags = flowRecord->inFlags;
+    }
+    if (cntFlow) {
+        cntFlow->outPackets = flowRecord->outPackets;
+        cntFlow->outBytes = flowRecord->outBytes;
+        cntFlow->flows = flowRecord->flows;
+    }
+
+    if (unlikely(NeedSwapGeneric(GuessFlowDirection, genericFlow))) {
+        EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle.extensionList[EXipv4FlowID];
+        EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle.extensionList[EXipv6FlowID];
+        EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle.extensionList[EXflowMiscID];
+        EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle.extensionList[EXasRoutingID];
+        SwapRawFlow(genericFlow, ipv4Flow, ipv6Flow, flowMisc, cntFlow, asRouting);
+    }
+
+    // Update statistics
+    UpdateRawStat(nffile->stat_record, genericFlow, cntFlow);
+
+    return dataBlock;
+
+}  // End of ExportFlowRecord
+
 // export SortList - apply possible aggregation mask to zero out aggregated fields
 static inline void ExportSortList(SortElement_t *SortList, uint64_t maxindex, nffile_t *nffile, int GuessFlowDirection, int ascending) {
     dbg_printf("Enter %s\n", __func__);
@@ -1643,68 +2713,318 @@ static inline void ExportSortList(SortElement_t *SortList, uint64_t maxindex, nf
         uint64_t j = ascending ? i : maxindex - 1 - i;
 
         FlowHashRecord_t *flowRecord = (FlowHashRecord_t *)SortList[j].record;
-        recordHeaderV3_t *recordHeaderV3 = (flowRecord->flowrecord);
+        dataBlock = ExportFlowRecord(nffile, dataBlock, flowRecord, GuessFlowDirection, i + 1);
+    }
+
+    FlushBlock(nffile, dataBlock);
+
+}  // End of ExportSortList
+
+static inline uint64_t FlowCacheMemory(void) {
+    uint64_t arena = MemHandler ? (uint64_t)MemHandler->NumBlocks * MemHandler->BlockSize : 0;
+    if (flowHash->oldFlags) arena += (uint64_t)(flowHash->oldCapacity - flowHash->migrated) * (sizeof(uint8_t) + sizeof(hashValue_t));
+    return arena + (uint64_t)flowHash->capacity * (sizeof(uint8_t) + sizeof(hashValue_t) + sizeof(FlowHashRecord_t));
+}  // End of FlowCacheMemory
+
+// drop all aggregated records and start with an empty flow cache
+static void ResetFlowCache(void) {
+    flowHash_free(flowHash);
+    nfalloc_free();
+    flowKeyMem = NULL;
+
+    flowHash = flowHash_init(InitFlowHashBits);
+    if (!flowHash || !nfalloc_Init(0)) {
+        LogError("Failed to reset flow cache");
+        exit(255);
+    }
+}  // End of ResetFlowCache
+
+// write all aggregated records into their partition files and reset the flow cache
+static void SpillFlowCache(void) {
+    dbg_printf("Enter %s\n", __func__);
 
-        // check, if we need cntFlow extension
-        int exCntSize = 0;
-        if (flowRecord->outPackets || flowRecord->outBytes || flowRecord->flows > 1) {
-            exCntSize = EXcntFlowSize;
+    flowHash_finish(flowHash);
+    for (uint32_t i = 0; i < flowHash->capacity; i++) {
+        if (is_free(flowHash->flags, i)) continue;
+
+        uint32_t partition = SpillPartition(flowHash->cells[i].hash);
+        if (spill.nffile[partition] == NULL) {
+            char fileName[MAXPATHLEN];
+            snprintf(fileName, MAXPATHLEN, "%s/nfdump.spill.%d.%u", spill.dir, (int)getpid(), partition);
+            spill.nffile[partition] = OpenNewFile(fileName, NULL, CREATOR_NFDUMP, LZ4_COMPRESSED, NOT_ENCRYPTED);
+            if (!spill.nffile[partition]) {
+                LogError("Failed to create spill file %s", fileName);
+                exit(EXIT_FAILURE);
+            }
+            spill.fileName[partition] = strdup(fileName);
+            spill.dataBlock[partition] = WriteBlock(spill.nffile[partition], NULL);
         }
+        FlowHashRecord_t *flowRecord = &(flowHash->records[flowHash->cells[i].index]);
+        spill.dataBlock[partition] = ExportFlowRecord(spill.nffile[partition], spill.dataBlock[partition], flowRecord, 0, 0);
+        spill.spilledRecords++;
+    }
+    spill.numSpills++;
+    dbg_printf("Spill %u: %llu records\n", spill.numSpills, (unsigned long long)spill.spilledRecords);
+
+    ResetFlowCache();
+
+}  // End of SpillFlowCache
+
+// spill the remaining records and close all partition files
+static void CloseSpill(void) {
+    if (flowHash->count) SpillFlowCache();
+
+    for (int i = 0; i < NUMSPILL; i++) {
+        if (spill.nffile[i] == NULL) continue;
+        FlushBlock(spill.nffile[i], spill.dataBlock[i]);
+        CloseUpdateFile(spill.nffile[i]);
+        DisposeFile(spill.nffile[i]);
+        spill.nffile[i] = NULL;
+        spill.dataBlock[i] = NULL;
+    }
+}  // End of CloseSpill
+
+// aggregate all records of a partition into an empty flow cache
+// returns number of aggregated records
+static uint32_t LoadSpill(uint32_t partition) {
+    ResetFlowCache();
+    if (spill.fileName[partition] == NULL) return 0;
+
+    nffile_t *nffile = OpenFile(spill.fileName[partition], NULL);
+    if (!nffile) {
+        LogError("Failed to open spill file %s", spill.fileName[partition]);
+        exit(EXIT_FAILURE);
+    }
 
-        if (!IsAvailable(dataBlock, recordHeaderV3->size + exCntSize)) {
-            // flush block - get an empty one
-            dataBlock = WriteBlock(nffile, dataBlock);
+    recordHandle_t recordHandle = {0};
+    dataBlock_t *dataBlock = NULL;
+    while ((dataBlock = ReadBlock(nffile, dataBlock)) != NULL) {
+        if (dataBlock->type != DATA_BLOCK_TYPE_3) continue;
+
+        record_header_t *record_ptr = GetCursor(dataBlock);
+        for (int i = 0; i < dataBlock->NumRecords; i++) {
+            if (record_ptr->type == V3Record) {
+                MapRecordHandle(&recordHandle, (recordHeaderV3_t *)record_ptr, i + 1);
+                AddFlowHash(flowHash, &flowKeyMem, &recordHandle);
+            }
+            record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
         }
+    }
+    FreeDataBlock(dataBlock);
+    CloseFile(nffile);
+    DisposeFile(nffile);
 
-        // write record
-        void *buffPtr = GetCurrentCursor(dataBlock);
-        memcpy(buffPtr, (void *)recordHeaderV3, recordHeaderV3->size);
+    unlink(spill.fileName[partition]);
+    free(spill.fileName[partition]);
+    spill.fileName[partition] = NULL;
 
-        // remap header to written memory
-        recordHeaderV3 = (recordHeaderV3_t *)buffPtr;
+    return flowHash->count;
 
-        recordHandle_t recordHandle = {0};
-        MapRecordHandle(&recordHandle, recordHeaderV3, i + 1);
+}  // End of LoadSpill
 
-        // check if cntFlow already exists
-        EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle.extensionList[EXcntFlowID];
+/*
+ * aggregate all partitions and collect the result in the flow cache
+ * if topN is set, only the topN records of each partition for any of the
+ * print orders are kept, as no other record can make it into the top N list.
+ */
+static void MergeSpill(int topN) {
+    dbg_printf("Enter %s\n", __func__);
 
-        if (cntFlow == NULL && exCntSize) {
-            PushExtension(recordHeaderV3, EXcntFlow, extPtr);
-            cntFlow = extPtr;
+    uint32_t orders = FlowStat_order;
+    if (PrintOrder) orders |= 1 << PrintOrder;
+
+    CloseSpill();
+
+    FlowHashRecord_t *result = NULL;
+    uint32_t numResult = 0;
+    uint32_t maxResult = 0;
+    for (uint32_t partition = 0; partition < NUMSPILL; partition++) {
+        uint32_t numRecords = LoadSpill(partition);
+        if (numRecords == 0) continue;
+
+        uint8_t *keep = NULL;
+        if (topN && orders && numRecords > topN) {
+            keep = calloc(numRecords, sizeof(uint8_t));
+            SortElement_t *SortList = calloc(numRecords, sizeof(SortElement_t));
+            if (!keep || !SortList) {
+                LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                exit(255);
+            }
+            for (int order_index = 0; order_mode[order_index].string != NULL; order_index++) {
+                if ((orders & (1 << order_index)) == 0) continue;
+                for (uint32_t i = 0; i < numRecords; i++) {
+                    SortList[i].record = (void *)&(flowHash->records[i]);
+                    SortList[i].count = order_mode[order_index].record_function(&(flowHash->records[i]));
+                }
+                blockselect(SortList, numRecords, topN, PrintDirection);
+                uint32_t start = PrintDirection ? 0 : numRecords - topN;
+                for (uint32_t i = start; i < (start + topN); i++) {
+                    keep[(FlowHashRecord_t *)SortList[i].record - flowHash->records] = 1;
+                }
+            }
+            free(SortList);
         }
-        dataBlock->size += recordHeaderV3->size;
-        dataBlock->NumRecords++;
 
-        EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle.extensionList[EXgenericFlowID];
-        if (genericFlow) {
-            genericFlow->inPackets = flowRecord->inPackets;
-            genericFlow->inBytes = flowRecord->inBytes;
-            genericFlow->msecFirst = flowRecord->msecFirst;
-            genericFlow->msecLast = flowRecord->msecLast;
-            genericFlow->tcpFlags = flowRecord->inFlags;
+        for (uint32_t i = 0; i < numRecords; i++) {
+            if (keep && keep[i] == 0) continue;
+            if (numResult == maxResult) {
+                maxResult = maxResult ? 2 * maxResult : 1024;
+                result = realloc(result, maxResult * sizeof(FlowHashRecord_t));
+                if (!result) {
+                    LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                    exit(255);
+                }
+            }
+            FlowHashRecord_t *flowRecord = &(flowHash->records[i]);
+            result[numResult] = *flowRecord;
+            result[numResult].flowrecord = malloc(flowRecord->flowrecord->size);
+            if (!result[numResult].flowrecord) {
+                LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                exit(255);
+            }
+            memcpy(result[numResult].flowrecord, flowRecord->flowrecord, flowRecord->flowrecord->size);
+            numResult++;
         }
-        if (cntFlow) {
-            cntFlow->outPackets = flowRecord->outPackets;
-            cntFlow->outBytes = flowRecord->outBytes;
-            cntFlow->flows = flowRecord->flows;
+        free(keep);
+    }
+    LogVerbose("External aggregation: %u spills, %llu spilled records, %u result records", spill.numSpills,
+               (unsigned long long)spill.spilledRecords, numResult);
+
+    // the result records replace the flow cache
+    flowHash_free(flowHash);
+    nfalloc_free();
+    flowKeyMem = NULL;
+    flowHash = calloc(1, sizeof(flowHash_t));
+    if (!flowHash) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    flowHash->records = result;
+    flowHash->count = numResult;
+    flowHash->capacity = numResult;
+    spill.merged = 1;
+    spill.numSpills = 0;
+
+}  // End of MergeSpill
+
+// print partitions one after the other for unsorted output
+static void PrintSpill(RecordPrinter_t print_record, outputParams_t *outputParams, int GuessDir) {
+    CloseSpill();
+
+    outputParams_t partitionParams = *outputParams;
+    int remaining = outputParams->topN;
+    for (uint32_t partition = 0; partition < NUMSPILL; partition++) {
+        uint32_t numRecords = LoadSpill(partition);
+        if (numRecords == 0) continue;
+        if (outputParams->topN) {
+            if (remaining == 0) continue;
+            partitionParams.topN = remaining;
+            remaining -= numRecords < remaining ? numRecords : remaining;
         }
+        uint64_t maxindex;
+        SortElement_t *SortList = GetSortList(&maxindex);
+        if (!SortList) continue;
+        PrintSortList(SortList, maxindex, &partitionParams, GuessDir, print_record, PrintDirection);
+        free(SortList);
+    }
+    spill.numSpills = 0;
 
-        if (unlikely(NeedSwapGeneric(GuessFlowDirection, genericFlow))) {
-            EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle.extensionList[EXipv4FlowID];
-            EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle.extensionList[EXipv6FlowID];
-            EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle.extensionList[EXflowMiscID];
-            EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle.extensionList[EXasRoutingID];
-            SwapRawFlow(genericFlow, ipv4Flow, ipv6Flow, flowMisc, cntFlow, asRouting);
+}  // End of PrintSpill
+
+int SetSpillAggregation(uint64_t budget, char *dir) {
+    if (bidir_flows || topNSketch) {
+        LogError("External aggregation -U can not be combined with bidir or approximate top N aggregation");
+        return 0;
+    }
+    if (budget < MINSPILLBUDGET) {
+        LogError("Memory budget for external aggregation must be at least %uMB", MINSPILLBUDGET / (1024 * 1024));
+        return 0;
+    }
+    if (!CheckPath(dir, S_IFDIR)) {
+        LogError("Spill directory %s does not exist", dir);
+        return 0;
+    }
+
+    spill.budget = budget;
+    spill.dir = dir;
+    return 1;
+
+}  // End of SetSpillAggregation
+
+
+// approximate top N aggregation with a bounded number of counters
+// requires exactly one print order, which counts flows, packets or bytes
+int SetTopNSketch(uint32_t counters) {
+    dbg_printf("Enter %s\n", __func__);
+
+    if (bidir_flows) {
+        LogError("Approximate top N does not support bidir aggregation");
+        return 0;
+    }
+
+    uint32_t order = PrintOrder;
+    if (FlowStat_order) {
+        if (FlowStat_order & (FlowStat_order - 1)) {
+            LogError("Approximate top N supports a single -s record order only");
+            return 0;
         }
+        order = __builtin_ctz(FlowStat_order);
+    }
+    // only additive counters
+    order_proc_record_t record_function = order_mode[order].record_function;
+    if (record_function != order_flows && record_function != order_packets_inout && record_function != order_packets_in &&
+        record_function != order_packets_out && record_function != order_bytes_inout && record_function != order_bytes_in &&
+        record_function != order_bytes_out) {
+        LogError("Approximate top N requires order flows, packets or bytes");
+        return 0;
+    }
 
-        // Update statistics
-        UpdateRawStat(nffile->stat_record, genericFlow, cntFlow);
+    if (counters < 16 || counters > (1 << 26)) {
+        LogError("Number of counters %u out of range 16..%u", counters, 1 << 26);
+        return 0;
     }
 
-    FlushBlock(nffile, dataBlock);
+    // hash table sized for all counters - never resized
+    int bits = 1;
+    while ((1u << bits) < 2 * counters) bits++;
+    flowHash_free(flowHash);
+    flowHash = flowHash_init(32 - bits);
+    if (!flowHash) {
+        LogError("flowHash_init() failed for %u counters", counters);
+        return 0;
+    }
 
-}  // End of ExportSortList
+    topNSketch = calloc(1, sizeof(topNSketch_t));
+    if (!topNSketch) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+    topNSketch->counters = counters;
+    topNSketch->order = order;
+    topNSketch->heap = calloc(counters, sizeof(uint32_t));
+    topNSketch->heapPos = calloc(counters, sizeof(uint32_t));
+    topNSketch->cell = calloc(counters, sizeof(uint32_t));
+    topNSketch->count = calloc(counters, sizeof(uint64_t));
+    topNSketch->error = calloc(counters, sizeof(uint64_t));
+    if (!topNSketch->heap || !topNSketch->heapPos || !topNSketch->cell || !topNSketch->count || !topNSketch->error) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    return 1;
+
+}  // End of SetTopNSketch
+
+// print the error bound of the approximate top N result
+static void PrintSketchInfo(outputParams_t *outputParams) {
+    if (!topNSketch || outputParams->quiet || outputParams->mode != MODE_FMT) return;
+
+    // any record not monitored has a count <= smallest count
+    uint64_t maxError = flowHash->count == topNSketch->counters ? topNSketch->count[topNSketch->heap[0]] : 0;
+    printf("Approximate top N: %u counters, %llu evictions, %s undercounted by at most %llu\n\n", topNSketch->counters,
+           (unsigned long long)topNSketch->evicted, order_mode[topNSketch->order].string, (unsigned long long)maxError);
+
+}  // End of PrintSketchInfo
 
 int SetBidirAggregation(void) {
     dbg_printf("Enter %s\n", __func__);
@@ -1719,12 +3039,92 @@ int SetBidirAggregation(void) {
 
 }  // End of SetBidirAggregation
 
+// aggregated records printed with the format of a custom aggregation mask keep only the
+// extensions of the aggregation elements and the counters of the first flow.
+// extMask adds the extensions needed by a post aggregation filter
+void SlimFlowRecords(uint64_t extMask) {
+    dbg_printf("Enter %s\n", __func__);
+
+    keepMask = extMask | ExtensionBit(EXgenericFlowID) | ExtensionBit(EXipv4FlowID) | ExtensionBit(EXipv6FlowID) |
+               ExtensionBit(EXflowMiscID) | ExtensionBit(EXcntFlowID) | ExtensionBit(EXasRoutingID);
+    for (int i = 0; aggregateInfo[i] >= 0; i++) {
+        uint32_t extID = aggregationTable[aggregateInfo[i]].param.extID;
+        if (extID < MAXEXTENSIONS) keepMask |= ExtensionBit(extID);
+    }
+
+}  // End of SlimFlowRecords
+
+// collect quantile histograms per aggregated flow for the metrics requested by the output format
+int SetFlowHisto(void) {
+    dbg_printf("Enter %s\n", __func__);
+
+    uint32_t requested = LogHistoRequested();
+    if (requested == 0) return 1;
+
+    if (topNSketch) {
+        LogError("Quantile output tokens can not be combined with approximate top N -k");
+        return 0;
+    }
+    if (spill.budget) {
+        LogError("Quantile output tokens can not be combined with external aggregation -U");
+        return 0;
+    }
+
+    numHistoSlots = 0;
+    for (int h = 0; h < NUMHISTOS; h++) {
+        histoSlot[h] = (requested & (1 << h)) ? (int)numHistoSlots++ : -1;
+    }
+
+    return 1;
+
+}  // End of SetFlowHisto
+
 // print -s record/xx statistics with as many print orders as required
+// print the sort list grouped by time bucket. Each bucket is ordered by its own
+// top N of record_function, if given
+static void PrintBucketList(SortElement_t *SortList, uint64_t maxindex, outputParams_t *outputParams, int GuessFlowDirection,
+                            RecordPrinter_t print_record, order_proc_record_t record_function) {
+    // all flows of an aggregated record are in the same bucket
+    for (uint64_t i = 0; i < maxindex; i++) {
+        SortList[i].count = ((FlowHashRecord_t *)SortList[i].record)->msecFirst / bucketInterval;
+    }
+    blocksort(SortList, maxindex);
+
+    uint64_t start = 0;
+    while (start < maxindex) {
+        uint64_t bucket = SortList[start].count;
+        uint64_t end = start + 1;
+        while (end < maxindex && SortList[end].count == bucket) end++;
+        uint64_t numRecords = end - start;
+
+        if (record_function) {
+            for (uint64_t i = start; i < end; i++) {
+                SortList[i].count = record_function((FlowHashRecord_t *)SortList[i].record);
+            }
+            blockselect(SortList + start, numRecords, outputParams->topN, PrintDirection);
+        }
+
+        if (!outputParams->quiet && outputParams->mode == MODE_FMT) {
+            time_t when = (bucket * bucketInterval) / 1000LL;
+            char datestr[64];
+            struct tm *ts = localtime(&when);
+            strftime(datestr, 63, "%Y-%m-%d %H:%M:%S", ts);
+            printf("Time bucket %s, %llu seconds:\n", datestr, (unsigned long long)(bucketInterval / 1000LL));
+        }
+        PrintSortList(SortList + start, numRecords, outputParams, GuessFlowDirection, print_record, PrintDirection);
+        start = end;
+    }
+
+}  // End of PrintBucketList
+
 void PrintFlowStat(RecordPrinter_t print_record, outputParams_t *outputParams) {
     dbg_printf("Enter %s\n", __func__);
 
     uint64_t maxindex;
 
+    // the top N of each time bucket needs all records
+    if (spill.numSpills) MergeSpill(bucketInterval ? 0 : outputParams->topN);
+
     // Get sort array
     SortElement_t *SortList = GetSortList(&maxindex);
     if (!SortList) {
@@ -1735,6 +3135,13 @@ void PrintFlowStat(RecordPrinter_t print_record, outputParams_t *outputParams) {
     for (int order_index = 0; order_mode[order_index].string != NULL; order_index++) {
         unsigned int order_bit = 1 << order_index;
         if (FlowStat_order & order_bit) {
+            if (bucketInterval) {
+                if (!outputParams->quiet && outputParams->mode == MODE_FMT)
+                    printf("Top %i flows per time bucket ordered by %s:\n", outputParams->topN, order_mode[order_index].string);
+                PrintProlog(outputParams);
+                PrintBucketList(SortList, maxindex, outputParams, 0, print_record, order_mode[order_index].record_function);
+                continue;
+            }
             for (int i = 0; i < maxindex; i++) {
                 FlowHashRecord_t *r = (FlowHashRecord_t *)SortList[i].record;
                 /* if we have some different sort orders, which are not directly available in the FlowHashRecord_t
@@ -1743,7 +3150,7 @@ void PrintFlowStat(RecordPrinter_t print_record, outputParams_t *outputParams) {
                 SortList[i].count = order_mode[order_index].record_function(r);
             }
 
-            blocksort(SortList, maxindex);
+            blockselect(SortList, maxindex, outputParams->topN, PrintDirection);
 
             if (!outputParams->quiet) {
                 if (outputParams->mode == MODE_FMT) {
@@ -1757,6 +3164,7 @@ void PrintFlowStat(RecordPrinter_t print_record, outputParams_t *outputParams) {
             PrintSortList(SortList, maxindex, outputParams, 0, print_record, PrintDirection);
         }
     }
+    PrintSketchInfo(outputParams);
 
     free(SortList);
 }  // End of PrintFlowStat
@@ -1766,24 +3174,37 @@ void PrintFlowTable(RecordPrinter_t print_record, outputParams_t *outputParams,
     dbg_printf("Enter %s\n", __func__);
 
     GuessDirection = GuessDir;
+    if (spill.numSpills) {
+        if (PrintOrder == 0 && bucketInterval == 0) {
+            PrintSpill(print_record, outputParams, GuessDir);
+            return;
+        }
+        // the top N of each time bucket needs all records
+        MergeSpill(bucketInterval ? 0 : outputParams->topN);
+    }
+
     uint64_t maxindex;
     SortElement_t *SortList = GetSortList(&maxindex);
     if (!SortList) return;
 
-    if (PrintOrder) {
+    if (bucketInterval) {
+        // group by time bucket, with the top N of -O print mode per bucket
+        PrintBucketList(SortList, maxindex, outputParams, GuessDir, print_record, PrintOrder ? order_mode[PrintOrder].record_function : NULL);
+    } else if (PrintOrder) {
         // for any -O print mode
         for (int i = 0; i < maxindex; i++) {
             FlowHashRecord_t *r = (FlowHashRecord_t *)SortList[i].record;
             SortList[i].count = order_mode[PrintOrder].record_function(r);
         }
 
-        blocksort(SortList, maxindex);
+        blockselect(SortList, maxindex, outputParams->topN, PrintDirection);
 
         PrintSortList(SortList, maxindex, outputParams, GuessDir, print_record, PrintDirection);
     } else {
         // for -a and no -O sorting required
         PrintSortList(SortList, maxindex, outputParams, GuessDir, print_record, PrintDirection);
     }
+    PrintSketchInfo(outputParams);
     free(SortList);
 
 }  // End of PrintFlowTable
@@ -1792,6 +3213,12 @@ int ExportFlowTable(nffile_t *nffile, int aggregate, int bidir, int GuessDir) {
     dbg_printf("Enter %s\n", __func__);
     GuessDirection = GuessDir;
 
+    // all records are exported
+    if (spill.numSpills) MergeSpill(0);
+
+    // mark the file as partial aggregate, so it may be merged exactly later
+    if (aggregate) SetAggregation(nffile, bidir ? "bidir" : aggregationSpec ? aggregationSpec : DefaultAggregation);
+
     uint64_t maxindex;
     SortElement_t *SortList = GetSortList(&maxindex);
     if (!SortList) return 0;
@@ -38,6 +38,7 @@
 #include "config.h"
 #include "nfdump.h"
 #include "nffile.h"
+#include "nfprof.h"
 #include "output.h"
 
 #define InitFlowHashBits 23
@@ -125,18 +126,44 @@ void Dispose_FlowTable(void);
 
 int Parse_PrintOrder(char *order);
 
+int TimeOrder(void);
+
 char *ParseAggregateMask(char *print_format, char *arg);
 
 void ListAggregationHelp(void);
 
 int SetBidirAggregation(void);
 
+void SlimFlowRecords(uint64_t extMask);
+
+int SetTopNSketch(uint32_t counters);
+
+int SetSpillAggregation(uint64_t budget, char *dir);
+
+int SetFlowHisto(void);
+
 int SetRecordStat(char *statType, char *optOrder);
 
+int CheckAggregation(nffile_t *nffile);
+
+void ExplainAggregation(void);
+
 void InsertFlow(recordHandle_t *recordHandle);
 
+int RetainSortBlock(dataBlock_t *dataBlock);
+
 void AddFlowCache(recordHandle_t *recordHandle);
 
+int Init_FlowCacheShards(uint32_t numShards);
+
+void FlowCacheExpect(uint64_t numFlows);
+
+void AddFlowCacheShard(uint32_t shard, recordHandle_t *recordHandle);
+
+void MergeFlowCacheShards(void);
+
+void FlowHashStat(hashStat_t *hashStat);
+
 void PrintFlowTable(RecordPrinter_t print_record, outputParams_t *outputParams, int GuessDir);
 
 void PrintFlowStat(RecordPrinter_t print_record, outputParams_t *outputParams);
@@ -31,6 +31,7 @@
 
 #include "nfprof.h"
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,10 +40,31 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "config.h"
+#include "nffile.h"
 #include "util.h"
 
+// time, blocks and records of each pipeline stage
+static struct {
+    _Atomic uint64_t nsec;
+    _Atomic uint64_t blocks;
+    _Atomic uint64_t records;
+} stageStat[NUMSTAGES];
+
+static const char *stageName[NUMSTAGES] = {"read", "prepare", "filter", "process", "merge", "output"};
+
+// queue wait times, collected before the queues are released
+#define MAXPROFQUEUES 4
+static struct {
+    char *name;
+    queueWait_t wait;
+} profQueue[MAXPROFQUEUES];
+static int numProfQueues = 0;
+
+static const char *codecName[NUMCODECS] = {"none", "lzo", "bz2", "lz4", "zstd", "zstd-dict"};
+
 /*
  * Initialize profiling.
  *
@@ -113,3 +135,93 @@ void nfprof_print(nfprof_t *profile_data, FILE *std) {
 #endif
 
 }  // End of nfprof_print
+
+uint64_t nfprof_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}  // End of nfprof_nsec
+
+void nfprof_stage(int stage, uint64_t nsec, uint64_t blocks, uint64_t records) {
+    if (stage < 0 || stage >= NUMSTAGES) return;
+    atomic_fetch_add_explicit(&stageStat[stage].nsec, nsec, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stageStat[stage].blocks, blocks, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stageStat[stage].records, records, memory_order_relaxed);
+}  // End of nfprof_stage
+
+void nfprof_queue(char *name, queue_t *queue) {
+    if (numProfQueues == MAXPROFQUEUES) return;
+    profQueue[numProfQueues].name = name;
+    profQueue[numProfQueues].wait = queue_wait(queue);
+    numProfQueues++;
+}  // End of nfprof_queue
+
+/*
+ * Print the pipeline stage profile as table or JSON object
+ */
+void nfprof_stages(FILE *std, int json, hashStat_t *hashStat) {
+    codecStat_t codecStat[NUMCODECS];
+    GetCodecStat(codecStat);
+
+    if (json) {
+        fprintf(std, "{\n  \"stages\": [");
+        for (int i = 0; i < NUMSTAGES; i++) {
+            fprintf(std, "%s\n    {\"stage\": \"%s\", \"sec\": %.6f, \"blocks\": %llu, \"records\": %llu}", i ? "," : "", stageName[i],
+                    (double)atomic_load(&stageStat[i].nsec) / 1e9, (unsigned long long)atomic_load(&stageStat[i].blocks),
+                    (unsigned long long)atomic_load(&stageStat[i].records));
+        }
+        fprintf(std, "\n  ],\n  \"queues\": [");
+        for (int i = 0; i < numProfQueues; i++) {
+            queueWait_t *wait = &profQueue[i].wait;
+            fprintf(std,
+                    "%s\n    {\"queue\": \"%s\", \"producerBlocked\": %llu, \"producerSec\": %.6f, \"consumerBlocked\": %llu, "
+                    "\"consumerSec\": %.6f}",
+                    i ? "," : "", profQueue[i].name, (unsigned long long)wait->producerBlocked, (double)wait->producerNsec / 1e9,
+                    (unsigned long long)wait->consumerBlocked, (double)wait->consumerNsec / 1e9);
+        }
+        fprintf(std, "\n  ],\n  \"codecs\": [");
+        int first = 1;
+        for (int i = 0; i < NUMCODECS; i++) {
+            if (codecStat[i].blocks == 0) continue;
+            fprintf(std, "%s\n    {\"codec\": \"%s\", \"blocks\": %llu, \"inBytes\": %llu, \"outBytes\": %llu, \"sec\": %.6f}", first ? "" : ",",
+                    codecName[i], (unsigned long long)codecStat[i].blocks, (unsigned long long)codecStat[i].inBytes,
+                    (unsigned long long)codecStat[i].outBytes, (double)codecStat[i].nsec / 1e9);
+            first = 0;
+        }
+        fprintf(std, "\n  ],\n  \"hash\": {\"lookups\": %llu, \"probes\": %llu, \"collisions\": %llu, \"resizes\": %llu}\n}\n",
+                (unsigned long long)hashStat->lookups, (unsigned long long)hashStat->probes, (unsigned long long)hashStat->collisions,
+                (unsigned long long)hashStat->resizes);
+        return;
+    }
+
+    fprintf(std, "%-10s %12s %10s %14s %14s\n", "Stage", "Time(s)", "Blocks", "Records", "Records/s");
+    for (int i = 0; i < NUMSTAGES; i++) {
+        double sec = (double)atomic_load(&stageStat[i].nsec) / 1e9;
+        uint64_t records = atomic_load(&stageStat[i].records);
+        fprintf(std, "%-10s %12.4f %10llu %14llu %14.1f\n", stageName[i], sec, (unsigned long long)atomic_load(&stageStat[i].blocks),
+                (unsigned long long)records, sec > 0 ? (double)records / sec : 0);
+    }
+
+    fprintf(std, "\n%-10s %14s %12s %14s %12s\n", "Queue", "Push blocked", "Time(s)", "Pop blocked", "Time(s)");
+    for (int i = 0; i < numProfQueues; i++) {
+        queueWait_t *wait = &profQueue[i].wait;
+        fprintf(std, "%-10s %14llu %12.4f %14llu %12.4f\n", profQueue[i].name, (unsigned long long)wait->producerBlocked,
+                (double)wait->producerNsec / 1e9, (unsigned long long)wait->consumerBlocked, (double)wait->consumerNsec / 1e9);
+    }
+
+    fprintf(std, "\n%-10s %10s %14s %14s %12s %10s\n", "Codec", "Blocks", "In(MB)", "Out(MB)", "Time(s)", "MB/s");
+    for (int i = 0; i < NUMCODECS; i++) {
+        if (codecStat[i].blocks == 0) continue;
+        double sec = (double)codecStat[i].nsec / 1e9;
+        double outMB = (double)codecStat[i].outBytes / (1024.0 * 1024.0);
+        fprintf(std, "%-10s %10llu %14.1f %14.1f %12.4f %10.1f\n", codecName[i], (unsigned long long)codecStat[i].blocks,
+                (double)codecStat[i].inBytes / (1024.0 * 1024.0), outMB, sec, sec > 0 ? outMB / sec : 0);
+    }
+
+    if (hashStat->lookups) {
+        fprintf(std, "\nHash lookups: %llu, probes/lookup: %.3f, collisions: %llu, resizes: %llu\n", (unsigned long long)hashStat->lookups,
+                (double)hashStat->probes / (double)hashStat->lookups, (unsigned long long)hashStat->collisions,
+                (unsigned long long)hashStat->resizes);
+    }
+
+}  // End of nfprof_stages
@@ -45,6 +45,8 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include "queue.h"
+
 typedef struct nfprof_s {
   struct timeval  	tstart;   /* start time */
   struct timeval  	tend;  	  /* end time */
@@ -52,6 +54,36 @@ typedef struct nfprof_s {
   uint64_t 			numflows; /* total # of flows processed */
 } nfprof_t;
 
+/*
+ * pipeline stages of nfdump. Each thread adds its time and the number of
+ * blocks and records it handled in a stage, when it is done.
+ */
+enum {
+  STAGE_READ = 0,   // prepareThread: read and decompress blocks
+  STAGE_PREPARE,    // prepareThread: convert blocks
+  STAGE_FILTER,     // filterThread: filter, aggregate shards and render records
+  STAGE_PROCESS,    // main thread: aggregate, sort, print or write records
+  STAGE_MERGE,      // main thread: merge aggregation shards
+  STAGE_OUTPUT,     // main thread: sort and print the aggregated records
+  NUMSTAGES
+};
+
+// probe statistics of the aggregation hash tables
+typedef struct hashStat_s {
+  uint64_t lookups;
+  uint64_t probes;      // probed cells or cell groups
+  uint64_t collisions;  // tag matches of different keys
+  uint64_t resizes;
+} hashStat_t;
+
+uint64_t nfprof_nsec(void);
+
+void nfprof_stage(int stage, uint64_t nsec, uint64_t blocks, uint64_t records);
+
+void nfprof_queue(char *name, queue_t *queue);
+
+void nfprof_stages(FILE *std, int json, hashStat_t *hashStat);
+
 int nfprof_start(nfprof_t *profile_data);
 
 int nfprof_end(nfprof_t *profile_data, uint64_t numflows);
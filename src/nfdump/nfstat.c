@@ -42,16 +42,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 
 #include "blocksort.h"
+#include "conf/nfconf.h"
 #include "config.h"
 #include "ja3/ja3.h"
 #include "ja4/ja4.h"
+#include "ssl/ssl.h"
+#include "label/label.h"
 #include "maxmind/maxmind.h"
+#include "memhandle.h"
 #include "nfdump.h"
 #include "nfxV3.h"
 #include "output_fmt.h"
@@ -74,7 +79,8 @@ typedef enum {
     IS_JA4,
     IS_JA4S,
     IS_GEO,
-    IS_ASORG
+    IS_ASORG,
+    IS_LABEL
 } elementType_t;
 
 typedef enum { DESCENDING = 0,
@@ -84,13 +90,15 @@ typedef enum { DESCENDING = 0,
  * pre-process functions:
  * Elements, to be ordered by, which are no available in the raw flow record
  * need be be calculated first from the raw record handle.
- * The same is true for values, which need a Maxmind lookup.
+ * The same is true for values, which need a Maxmind or a label DB lookup.
  */
 typedef void *(*func_preproc)(void *inPtr, recordHandle_t *);
 static void *SRC_GEO_PreProcess(void *inPtr, recordHandle_t *recordHandle);
 static void *DST_GEO_PreProcess(void *inPtr, recordHandle_t *recordHandle);
 static void *SRC_AS_PreProcess(void *inPtr, recordHandle_t *recordHandle);
 static void *DST_AS_PreProcess(void *inPtr, recordHandle_t *recordHandle);
+static void *SRC_LABEL_PreProcess(void *inPtr, recordHandle_t *recordHandle);
+static void *DST_LABEL_PreProcess(void *inPtr, recordHandle_t *recordHandle);
 static void *JA3_PreProcess(void *inPtr, recordHandle_t *recordHandle);
 static void *JA4_PreProcess(void *inPtr, recordHandle_t *recordHandle);
 #ifdef BUILDJA4
@@ -126,6 +134,10 @@ static struct StatParameter_s {
     {"dstgeo", "Dst Geo", {EXlocal, OFFgeoDstIP, SizeGEOloc, 0}, IS_GEO, DST_GEO_PreProcess},
     {"geo", " Geo", {EXlocal, OFFgeoSrcIP, SizeGEOloc, 0}, IS_GEO, SRC_GEO_PreProcess},
     {"geo", NULL, {EXlocal, OFFgeoDstIP, SizeGEOloc, 0}, IS_GEO, DST_GEO_PreProcess},
+    {"srclabel", "       Src Label", {EXlocal, OFFsrcLabel, SIZElabel, 0}, IS_LABEL, SRC_LABEL_PreProcess},
+    {"dstlabel", "       Dst Label", {EXlocal, OFFdstLabel, SIZElabel, 0}, IS_LABEL, DST_LABEL_PreProcess},
+    {"label", "           Label", {EXlocal, OFFsrcLabel, SIZElabel, 0}, IS_LABEL, SRC_LABEL_PreProcess},
+    {"label", NULL, {EXlocal, OFFdstLabel, SIZElabel, 0}, IS_LABEL, DST_LABEL_PreProcess},
     {"nhip", "Nexthop IP", {EXipNextHopV4ID, OFFNextHopV4IP, SIZENextHopV4IP, AF_INET}, IS_IPADDR, NULL},
     {"nhip", NULL, {EXipNextHopV6ID, OFFNextHopV6IP, SIZENextHopV6IP, AF_INET6}, IS_IPADDR, NULL},
     {"nhbip", "Nexthop BGP IP", {EXbgpNextHopV4ID, OFFbgp4NextIP, SIZEbgp4NextIP, AF_INET}, IS_IPADDR, NULL},
@@ -308,10 +320,12 @@ static struct StatRequest_s {
     uint32_t direction;   // bit field for sorting ascending/descending
     uint8_t StatType;     // index into StatParameters
     uint8_t order_proto;  // protocol separated statistics
+    uint8_t distinct;     // count distinct elements only -s count:<elem>
 } StatRequest[MaxStats];  // This number should do it for a single run
 
-// key.v1 is always set as 64bit value.
-#define key_hash_func(key) (int32_t)((key->v1) >> 33 ^ (key->v1) ^ (key->v1) << 11)
+// keys up to 16 bytes hash v0, v1 and proto, larger keys hash the ptr value
+#define key_hash_func(key) \
+    ((key)->ptrSize ? KeyHashBytes((key)->ptr, (key)->ptrSize) ^ (key)->proto : KeyHash16((key)->v0 ^ (key)->proto, (key)->v1))
 
 // up to 16 bytes (hashkey.v0, hashkey.v1) use faster compare.
 // if > 16 bytes ( ptrSize != 0 ) use memcmp for var length
@@ -328,23 +342,68 @@ typedef struct ElementHashCell {
 typedef struct {
     StatRecord_t *records;
     ElementHashKey_t *keys;
+    uint8_t *tags;  // 0 - cell not in use, 0x80 | lower 7 bits of hash - cell in use
     uint32_t count;
     uint32_t capacity;
     uint32_t mask;
     uint32_t load_factor;
     uint32_t shift;
+    hashStat_t stat;  // probe statistics
+    // incremental resize - the cells of the old table move a few at a time into the new table
+    StatRecord_t *oldRecords;
+    ElementHashKey_t *oldKeys;
+    uint8_t *oldTags;  // NULL if no resize is in progress
+    uint32_t oldCapacity;
+    uint32_t oldMask;
+    uint32_t oldShift;
+    uint32_t migrateStart;  // first free cell of old table - cells are migrated from here on
+    uint32_t migrated;      // number of migrated cells
 } ElementHash_t;
 
+// number of old cells migrated with each added key. Must be >= 2 to complete the migration,
+// before the new table reaches its load factor
+#define MIGRATECELLS 16
+// the pages of migrated old cells are released in chunks of cells
+#define MIGRATECHUNK (1 << 16)
+
 // cell index calculation from 32bit hash, depending of hash bit size 'shift'
 #define ___fib_hash(hash, shift) ((hash) * 2654435769U) >> (shift)
 
+// include tag probing in same compiler unit
+#include "keyhash.c"
+#include "tagprobe.c"
+#include "hyperloglog.c"
+
+// probe statistics of already freed element hash tables
+static hashStat_t freedElementStat = {0};
+
+static void AddElementHashStat(hashStat_t *sum, hashStat_t *stat) {
+    sum->lookups += stat->lookups;
+    sum->probes += stat->probes;
+    sum->collisions += stat->collisions;
+    sum->resizes += stat->resizes;
+}  // End of AddElementHashStat
+
 static ElementHash_t *ElementHashes[MaxStats] = {0};
 static uint32_t NumStats = 0;  // number of stats in StatRequest
+
+// per worker hash shards for parallel element stat
+// each shard is only accessed by its own worker and merged later into ElementHashes
+typedef ElementHash_t *elementShard_t[MaxStats];
+static elementShard_t *elementShards = NULL;
+static uint32_t numElementShards = 0;
+
+// distinct count sketches of -s count:<elem> stats
+static hllSketch_t *DistinctSketch[MaxStats] = {0};
+// per worker sketches of all stats. The merged sketch of an element stat pre-sizes its hash
+typedef hllSketch_t *hllShard_t[MaxStats];
+static hllShard_t *hllShards = NULL;
 static int HasGeoDB = 0;
 
 static ElementHash_t *elementHash_init(uint32_t bitSize) {
     ElementHash_t *elementHash = calloc(1, sizeof(ElementHash_t));
     if (elementHash == NULL) return NULL;
+    KeyHashInit();
 
     elementHash->count = 0;
     elementHash->shift = bitSize;
@@ -354,81 +413,223 @@ static ElementHash_t *elementHash_init(uint32_t bitSize) {
 
     elementHash->records = calloc(elementHash->capacity, sizeof(StatRecord_t));
     elementHash->keys = calloc(elementHash->capacity, sizeof(ElementHashKey_t));
-    if (elementHash->records == NULL) return NULL;
+    elementHash->tags = calloc(elementHash->capacity, sizeof(uint8_t));
+    if (elementHash->records == NULL || elementHash->keys == NULL || elementHash->tags == NULL) return NULL;
 
     return elementHash;
 }  // End of elementHash_init
 
 static inline void elementHash_free(ElementHash_t *elementHash) {
     if (elementHash) {
+        AddElementHashStat(&freedElementStat, &elementHash->stat);
+        free(elementHash->oldRecords);
+        free(elementHash->oldKeys);
+        free(elementHash->oldTags);
         free(elementHash->records);
         free(elementHash->keys);
+        free(elementHash->tags);
         free(elementHash);
     }
 }  // End of elementHash_free
 
-static void elementHash_resize(ElementHash_t *elementHash) {
-    int oldCapacity = elementHash->load_factor = elementHash->capacity;
-    elementHash->capacity = 1 << (32 - (--elementHash->shift));
-    elementHash->mask = elementHash->capacity - 1;
-
-    StatRecord_t *oldRecords = elementHash->records;
-    StatRecord_t *newRecords = calloc(elementHash->capacity, sizeof(StatRecord_t));
-
-    ElementHashKey_t *oldKeys = elementHash->keys;
-    ElementHashKey_t *newKeys = calloc(elementHash->capacity, sizeof(ElementHashKey_t));
-    assert(newRecords && newKeys);
+// release the pages of num migrated cells of the old table from cell first on
+static void elementHash_release(ElementHash_t *elementHash, uint32_t first, uint32_t num) {
+    nfreleaseadvise(elementHash->oldRecords + first, num * sizeof(StatRecord_t));
+    nfreleaseadvise(elementHash->oldKeys + first, num * sizeof(ElementHashKey_t));
+    nfreleaseadvise(elementHash->oldTags + first, num * sizeof(uint8_t));
+}  // End of elementHash_release
 
-    for (int i = 0; i < oldCapacity; i++) {
-        if (oldKeys[i].active) {
-            uint32_t cell = ___fib_hash(oldKeys[i].hash, elementHash->shift);
-            while (newKeys[cell].active) {
+/*
+ * Migrate the next numCells cells of the old table into the new table.
+ * Cells are migrated in the order of the old table, starting at its first free cell. No probe
+ * sequence crosses a free cell, therefore an old probe sequence, which starts before the
+ * migration position, continues at the migration position.
+ */
+static void elementHash_migrate(ElementHash_t *elementHash, uint32_t numCells) {
+    uint32_t end = elementHash->migrated + numCells;
+    if (end > elementHash->oldCapacity) end = elementHash->oldCapacity;
+
+    for (uint32_t rank = elementHash->migrated; rank < end; rank++) {
+        uint32_t i = (elementHash->migrateStart + rank) & elementHash->oldMask;
+        if (elementHash->oldTags[i]) {
+            uint32_t cell = ___fib_hash(elementHash->oldKeys[i].hash, elementHash->shift);
+            while (elementHash->tags[cell]) {
                 cell = (cell + 1) & elementHash->mask;
             }
-            newKeys[cell] = oldKeys[i];
-            newRecords[cell] = oldRecords[i];
+            elementHash->keys[cell] = elementHash->oldKeys[i];
+            elementHash->records[cell] = elementHash->oldRecords[i];
+            elementHash->tags[cell] = elementHash->oldTags[i];
         }
     }
-    elementHash->records = newRecords;
-    elementHash->keys = newKeys;
-    free(oldRecords);
-    free(oldKeys);
+    elementHash->migrated = end;
+
+    if (end == elementHash->oldCapacity) {
+        free(elementHash->oldRecords);
+        free(elementHash->oldKeys);
+        free(elementHash->oldTags);
+        elementHash->oldRecords = NULL;
+        elementHash->oldKeys = NULL;
+        elementHash->oldTags = NULL;
+    } else if ((end & (MIGRATECHUNK - 1)) == 0) {
+        // release the last chunk - it may wrap around the end of the old table
+        uint32_t first = (elementHash->migrateStart + end - MIGRATECHUNK) & elementHash->oldMask;
+        uint32_t num = MIGRATECHUNK;
+        if (first + num > elementHash->oldCapacity) {
+            uint32_t tail = elementHash->oldCapacity - first;
+            elementHash_release(elementHash, 0, num - tail);
+            num = tail;
+        }
+        elementHash_release(elementHash, first, num);
+    }
+
+}  // End of elementHash_migrate
+
+// complete a resize in progress
+static inline void elementHash_finish(ElementHash_t *elementHash) {
+    if (elementHash->oldTags) elementHash_migrate(elementHash, elementHash->oldCapacity);
+}  // End of elementHash_finish
+
+// returns the record of key in the not yet migrated cells of the old table or NULL
+static StatRecord_t *elementHash_findOld(ElementHash_t *elementHash, hashkey_t *key, uint32_t hash, uint8_t tag) {
+    uint32_t cell = ___fib_hash(hash, elementHash->oldShift);
+    // the probe sequence continues at the migration position, if it started in the migrated cells
+    if (((cell - elementHash->migrateStart) & elementHash->oldMask) < elementHash->migrated)
+        cell = (elementHash->migrateStart + elementHash->migrated) & elementHash->oldMask;
+
+    while (elementHash->oldTags[cell]) {
+        elementHash->stat.probes++;
+        if (elementHash->oldTags[cell] == tag && elementHash->oldKeys[cell].hash == hash && key_hash_equal(elementHash->oldKeys[cell].key, *key) == 1)
+            return &(elementHash->oldRecords[cell]);
+        cell = (cell + 1) & elementHash->oldMask;
+    }
+    return NULL;
+}  // End of elementHash_findOld
+
+// grow hash by 2^grow
+// the cells of the old table are migrated incrementally by elementHash_addHash()
+static void elementHash_resize(ElementHash_t *elementHash, int grow) {
+    // a resize in progress must be completed first
+    elementHash_finish(elementHash);
+
+    elementHash->stat.resizes++;
+    elementHash->oldRecords = elementHash->records;
+    elementHash->oldKeys = elementHash->keys;
+    elementHash->oldTags = elementHash->tags;
+    elementHash->oldCapacity = elementHash->capacity;
+    elementHash->oldMask = elementHash->mask;
+    elementHash->oldShift = elementHash->shift;
+    elementHash->migrated = 0;
+    // the old table is at most half full - a free cell exists
+    elementHash->migrateStart = 0;
+    while (elementHash->oldTags[elementHash->migrateStart]) elementHash->migrateStart++;
+
+    elementHash->shift -= grow;
+    elementHash->capacity = 1 << (32 - elementHash->shift);
+    elementHash->mask = elementHash->capacity - 1;
+    elementHash->load_factor = elementHash->capacity >> 1;
+
+    elementHash->records = calloc(elementHash->capacity, sizeof(StatRecord_t));
+    elementHash->keys = calloc(elementHash->capacity, sizeof(ElementHashKey_t));
+    elementHash->tags = calloc(elementHash->capacity, sizeof(uint8_t));
+    assert(elementHash->records && elementHash->keys && elementHash->tags);
 
 }  // End of elementHash_resize
 
-static StatRecord_t *elementHash_add(ElementHash_t *elementHash, hashkey_t *key, int *insert) {
-    if (elementHash->count == elementHash->load_factor) elementHash_resize(elementHash);
+// grow hash in one step to hold numKeys keys
+static void elementHash_reserve(ElementHash_t *elementHash, uint64_t numKeys) {
+    int grow = 0;
+    while (((uint64_t)elementHash->load_factor << grow) < numKeys && (elementHash->shift - grow) > 2) grow++;
+    if (grow) elementHash_resize(elementHash, grow);
+}  // End of elementHash_reserve
 
-    uint32_t hash = key_hash_func(key);
+// prefetch the probe start of hash, before the key is added
+static inline void elementHash_prefetch(ElementHash_t *elementHash, uint32_t hash) {
     uint32_t cell = ___fib_hash(hash, elementHash->shift);
+    __builtin_prefetch(elementHash->tags + cell);
+    __builtin_prefetch(elementHash->keys + cell);
+}  // End of elementHash_prefetch
+
+static StatRecord_t *elementHash_addHash(ElementHash_t *elementHash, hashkey_t *key, uint32_t hash, int *insert) {
+    if (elementHash->oldTags) elementHash_migrate(elementHash, MIGRATECELLS);
+    if (elementHash->count == elementHash->load_factor) elementHash_resize(elementHash, 1);
+
+    uint8_t tag = 0x80 | (hash & 0x7F);
+    uint32_t cell = ___fib_hash(hash, elementHash->shift);
+    elementHash->stat.lookups++;
     while (true) {
-        if (!elementHash->keys[cell].active) {
-            elementHash->keys[cell].active = 1;
-            elementHash->keys[cell].key = *key;
-            elementHash->keys[cell].hash = hash;
-            elementHash->count++;
-            *insert = 1;
-            return &(elementHash->records[cell]);
-        } else if (elementHash->keys[cell].hash == hash && key_hash_equal(elementHash->keys[cell].key, *key) == 1) {
-            *insert = 0;
-            return &(elementHash->records[cell]);
+        uint32_t freeCell;
+        elementHash->stat.probes++;
+        if ((cell + TAGGROUP) <= elementHash->capacity) {
+            // probe TAGGROUP cells at once
+            uint32_t empty;
+            uint32_t match = tagMatch(elementHash->tags + cell, tag, &empty);
+            match = tagBefore(match, empty);
+            while (match) {
+                uint32_t i = cell + tagFirst(match);
+                if (elementHash->keys[i].hash == hash && key_hash_equal(elementHash->keys[i].key, *key) == 1) {
+                    *insert = 0;
+                    return &(elementHash->records[i]);
+                }
+                // collision - tag matches but key does not
+                elementHash->stat.collisions++;
+                match &= match - 1;
+            }
+            if (empty == 0) {
+                cell = (cell + TAGGROUP) & elementHash->mask;
+                continue;
+            }
+            freeCell = cell + tagFirst(empty);
+        } else {
+            // probe single cells until wrap around
+            if (elementHash->tags[cell]) {
+                if (elementHash->tags[cell] == tag && elementHash->keys[cell].hash == hash && key_hash_equal(elementHash->keys[cell].key, *key) == 1) {
+                    *insert = 0;
+                    return &(elementHash->records[cell]);
+                }
+                cell = (cell + 1) & elementHash->mask;
+                continue;
+            }
+            freeCell = cell;
+        }
+
+        if (elementHash->oldTags) {
+            // not in the new table - the key may not be migrated yet
+            StatRecord_t *record = elementHash_findOld(elementHash, key, hash, tag);
+            if (record) {
+                *insert = 0;
+                return record;
+            }
         }
-        cell = (cell + 1) & elementHash->mask;
+
+        elementHash->tags[freeCell] = tag;
+        elementHash->keys[freeCell].active = 1;
+        elementHash->keys[freeCell].key = *key;
+        elementHash->keys[freeCell].hash = hash;
+        elementHash->count++;
+        *insert = 1;
+        return &(elementHash->records[freeCell]);
     }
 
     // unreached
     return NULL;
-}
+}  // End of elementHash_addHash
+
+static inline StatRecord_t *elementHash_add(ElementHash_t *elementHash, hashkey_t *key, int *insert) {
+    //
+    return elementHash_addHash(elementHash, key, key_hash_func(key), insert);
+}  // End of elementHash_add
 
 /* function prototypes */
 static int ParseListOrder(char *orderBy, struct StatRequest_s *request);
 
-static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, SortElement_t *element, int type, int order_proto, int inout);
+static void PrintStatLine(FILE *stream, stat_record_t *stat, outputParams_t *outputParams, SortElement_t *element, int type, int order_proto,
+                          int inout);
 
-static void PrintJsonStatLine(char *statName, stat_record_t *stat, outputParams_t *outputParams, SortElement_t *element, int type, int order_proto,
-                              int inout);
+static void PrintJsonStatLine(FILE *stream, char *statName, stat_record_t *stat, outputParams_t *outputParams, SortElement_t *element, int type,
+                              int order_proto, int inout);
 
-static void PrintCvsStatLine(stat_record_t *stat, int printPlain, SortElement_t *element, int type, int order_proto, int tag, int inout);
+static void PrintCvsStatLine(FILE *stream, stat_record_t *stat, int printPlain, SortElement_t *element, int type, int order_proto, int tag,
+                             int inout);
 
 static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int order, direction_t direction);
 
@@ -545,6 +746,11 @@ int Init_StatTable(int hasGeoDB) {
     if (!nfalloc_Init(8 * 1024 * 1024)) return 0;
 
     for (int i = 0; i < NumStats; i++) {
+        if (StatRequest[i].distinct) {
+            DistinctSketch[i] = hllNew();
+            if (!DistinctSketch[i]) return 0;
+            continue;
+        }
         ElementHashes[i] = elementHash_init(InitStatHashBits);
         if (!ElementHashes[i]) return 0;
     }
@@ -558,11 +764,32 @@ void Dispose_StatTable(void) {
     for (int i = 0; i < NumStats; i++) {
         elementHash_free(ElementHashes[i]);
         ElementHashes[i] = NULL;
+        free(DistinctSketch[i]);
+        DistinctSketch[i] = NULL;
+    }
+    for (uint32_t s = 0; s < numElementShards; s++) {
+        for (int i = 0; i < NumStats; i++) {
+            elementHash_free(elementShards[s][i]);
+            free(hllShards[s][i]);
+        }
     }
+    free(elementShards);
+    elementShards = NULL;
+    free(hllShards);
+    hllShards = NULL;
+    numElementShards = 0;
     nfalloc_free();
 
 }  // End of Dispose_Table
 
+// add the probe statistics of all element stat hash tables to hashStat
+void ElementHashStat(hashStat_t *hashStat) {
+    AddElementHashStat(hashStat, &freedElementStat);
+    for (int i = 0; i < NumStats; i++) {
+        if (ElementHashes[i]) AddElementHashStat(hashStat, &ElementHashes[i]->stat);
+    }
+}  // End of ElementHashStat
+
 static int ParseListOrder(char *orderBy, struct StatRequest_s *request) {
     request->orderBy = 0;
 
@@ -616,7 +843,8 @@ static int ParseListOrder(char *orderBy, struct StatRequest_s *request) {
 
 /*
  * an stat string -s <stat> looks like
- * -s <elem>[:p][/orderby[:<dir]]
+ * -s [count:]<elem>[:p][/orderby[:<dir]]
+ *  optional count: estimate the number of distinct elements only
  * elem: any statname string in StatParameters
  *  optional :p split statistic into protocols tcp/udp/icmp etc.
  *  optional orderBy: order statistic by string in orderByTable
@@ -630,6 +858,11 @@ int SetElementStat(char *elementStat, char *orderBy) {
 
     struct StatRequest_s *request = &StatRequest[NumStats++];
     request->order_proto = 0;
+    request->distinct = 0;
+    if (strncasecmp(elementStat, "count:", 6) == 0) {
+        request->distinct = 1;
+        elementStat += 6;
+    }
     char *optProto = strchr(elementStat, ':');
     if (optProto) {
         *optProto++ = 0;
@@ -731,52 +964,26 @@ static inline void *DST_AS_PreProcess(void *inPtr, recordHandle_t *recordHandle)
     return inPtr;
 }  // End of DST_AS_PreProcess
 
+static inline void *SRC_LABEL_PreProcess(void *inPtr, recordHandle_t *recordHandle) {
+    // inPtr is the record handle - the label is looked up into the handle
+    GetRecordLabel(recordHandle, 0);
+    return inPtr;
+}  // End of SRC_LABEL_PreProcess
+
+static inline void *DST_LABEL_PreProcess(void *inPtr, recordHandle_t *recordHandle) {
+    GetRecordLabel(recordHandle, 1);
+    return inPtr;
+}  // End of DST_LABEL_PreProcess
+
 static inline void *JA3_PreProcess(void *inPtr, recordHandle_t *recordHandle) {
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-    const uint8_t *payload = (const uint8_t *)recordHandle->extensionList[EXinPayloadID];
-    if (payload == NULL || genericFlow->proto != IPPROTO_TCP || inPtr) return inPtr;
-
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
-    if (ssl == NULL) {
-        uint32_t payloadLength = ExtensionLength(payload);
-        ssl = sslProcess(payload, payloadLength);
-        recordHandle->extensionList[SSLindex] = ssl;
-        if (ssl == NULL) {
-            return NULL;
-        }
-    }
-    // ssl is defined
-    char *ja3 = ja3Process(ssl, NULL);
-    recordHandle->extensionList[JA3index] = ja3;
-    return ja3;
+    if (inPtr) return inPtr;
+    return GetRecordJA3(recordHandle);
 
 }  // End of JA3_PreProcess
 
 static inline void *JA4_PreProcess(void *inPtr, recordHandle_t *recordHandle) {
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-
-    EXinPayload_t *payload = (EXinPayload_t *)recordHandle->extensionList[EXinPayloadID];
-    if (payload == NULL || genericFlow->proto != IPPROTO_TCP) return NULL;
-
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
-    if (ssl == NULL) {
-        uint32_t payloadLength = ExtensionLength(payload);
-        ssl = sslProcess(payload, payloadLength);
-        recordHandle->extensionList[SSLindex] = ssl;
-        if (ssl == NULL) {
-            return NULL;
-        }
-    }
-    // ssl is defined
-    ja4_t *ja4 = NULL;
-    if (ssl->type == CLIENTssl) {
-        ja4 = ja4Process(ssl, genericFlow->proto);
-    } else {
-        return NULL;
-    }
-
-    recordHandle->extensionList[JA4index] = ja4;
-    return ja4;
+    // client hellos only - server fingerprints are handled by JA4S_PreProcess
+    return GetRecordJA4(recordHandle);
 
 }  // End of JA4_PreProcess
 
@@ -784,40 +991,48 @@ static inline void *JA4_PreProcess(void *inPtr, recordHandle_t *recordHandle) {
 static inline void *JA4S_PreProcess(void *inPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
-    EXinPayload_t *payload = (EXinPayload_t *)recordHandle->extensionList[EXinPayloadID];
-    if (payload == NULL || genericFlow->proto != IPPROTO_TCP) return NULL;
+    ssl_t *ssl = GetRecordSSL(recordHandle);
+    if (ssl == NULL || ssl->type != SERVERssl) return NULL;
 
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
-    if (ssl == NULL) {
-        uint32_t payloadLength = ExtensionLength(payload);
-        ssl = sslProcess(payload, payloadLength);
-        recordHandle->extensionList[SSLindex] = ssl;
-        if (ssl == NULL) {
-            return NULL;
-        }
-    }
-    // ssl is defined
-    ja4_t *ja4 = NULL;
-    if (ssl->type == SERVERssl) {
-        ja4 = ja4sProcess(ssl, genericFlow->proto);
-    } else {
-        return NULL;
-    }
+    ja4_t *ja4 = recordHandle->extensionList[JA4index];
+    if (ja4) return ja4;
 
+    ja4 = ja4sProcess(ssl, genericFlow->proto);
     recordHandle->extensionList[JA4index] = ja4;
     return ja4;
 
 }  // End of JA4S_PreProcess
 #endif
 
-void AddElementStat(recordHandle_t *recordHandle) {
+// key of an element of a record, collected for all requested stats before the hash lookups
+typedef struct elementKey_s {
+    hashkey_t hashkey;
+    uint32_t hash;
+    uint32_t stat;
+} elementKey_t;
+// a stat has up to 4 elements
+#define MaxElementKeys (4 * MaxStats)
+
+static inline void AddElementHash(ElementHash_t **elementHashes, hllSketch_t **sketches, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     if (!genericFlow) return;
 
-    // for every requested -s stat do
+    EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
+    uint64_t outBytes = 0;
+    uint64_t outPackets = 0;
+    uint64_t numFlows = 1;
+    if (cntFlow) {
+        outBytes = cntFlow->outBytes;
+        outPackets = cntFlow->outPackets;
+        numFlows = cntFlow->flows ? cntFlow->flows : 1;
+    }
+
+    // collect the element keys of all requested stats in a single pass over the record.
+    // The preprocessed values are cached in the record handle for the following stats, and
+    // the cells of all keys are prefetched, so the hash lookups overlap their cache misses
+    elementKey_t elementKeys[MaxElementKeys];
+    uint32_t numKeys = 0;
     for (int i = 0; i < NumStats; i++) {
-        hashkey_t hashkey = {0};
-        hashkey.proto = StatRequest[i].order_proto ? genericFlow->proto : 0;
         int index = StatRequest[i].StatType;
         // for the number of elements in this stat type
         do {
@@ -835,75 +1050,218 @@ void AddElementStat(recordHandle_t *recordHandle) {
             }
             inPtr += offset;
 
+            hashkey_t *hashkey = &(elementKeys[numKeys].hashkey);
+            *hashkey = (hashkey_t){0};
+            hashkey->proto = StatRequest[i].order_proto ? genericFlow->proto : 0;
             uint32_t length = StatParameters[index].element.length;
             switch (length) {
                 case 0:
                     break;
                 case 1: {
-                    hashkey.v1 = *((uint8_t *)inPtr);
+                    hashkey->v1 = *((uint8_t *)inPtr);
                 } break;
                 case 2: {
-                    hashkey.v1 = *((uint16_t *)inPtr);
+                    hashkey->v1 = *((uint16_t *)inPtr);
                 } break;
                 case 4: {
-                    hashkey.v1 = *((uint32_t *)inPtr);
+                    hashkey->v1 = *((uint32_t *)inPtr);
                 } break;
                 case 8: {
-                    hashkey.v1 = *((uint64_t *)inPtr);
+                    hashkey->v1 = *((uint64_t *)inPtr);
                 } break;
                 case 16: {
-                    hashkey.v0 = ((uint64_t *)inPtr)[0];
-                    hashkey.v1 = ((uint64_t *)inPtr)[1];
+                    hashkey->v0 = ((uint64_t *)inPtr)[0];
+                    hashkey->v1 = ((uint64_t *)inPtr)[1];
                 } break;
                 default: {
-                    void *p = nfmalloc(length);
-                    hashkey.ptr = p;
-                    memcpy((void *)p, inPtr, length);
-                    hashkey.ptrSize = length;
+                    if (StatRequest[i].distinct) {
+                        // sketch only - no key memory needed
+                        hashkey->ptr = inPtr;
+                    } else {
+                        void *p = nfmalloc(length);
+                        hashkey->ptr = p;
+                        memcpy((void *)p, inPtr, length);
+                    }
+                    hashkey->ptrSize = length;
                 }
             }
 
-            EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
-            uint64_t outBytes = 0;
-            uint64_t outPackets = 0;
-            uint64_t numFlows = 1;
-            if (cntFlow) {
-                outBytes = cntFlow->outBytes;
-                outPackets = cntFlow->outPackets;
-                numFlows = cntFlow->flows ? cntFlow->flows : 1;
+            if (sketches && sketches[i]) {
+                uint64_t hash = hashkey->ptrSize ? hllMix(hllHashBytes(hashkey->ptr, hashkey->ptrSize) ^ hashkey->proto)
+                                                 : hllHash(hashkey->v0 ^ hashkey->proto, hashkey->v1);
+                hllAdd(sketches[i], hash);
+                if (StatRequest[i].distinct) {
+                    index++;
+                    continue;
+                }
             }
 
-            int insert;
-            StatRecord_t *record = elementHash_add(ElementHashes[i], &hashkey, &insert);
-            if (insert == 0) {
-                record->inBytes += genericFlow->inBytes;
-                record->inPackets += genericFlow->inPackets;
-                record->outBytes += outBytes;
-                record->outPackets += outPackets;
+            uint32_t hash = key_hash_func(hashkey);
+            elementHash_prefetch(elementHashes[i], hash);
+            elementKeys[numKeys].hash = hash;
+            elementKeys[numKeys].stat = i;
+            numKeys++;
+            index++;
+        } while (StatParameters[index].HeaderInfo == NULL);
+    }  // for every requested -s stat
 
-                if (genericFlow->msecFirst < record->msecFirst) {
-                    record->msecFirst = genericFlow->msecFirst;
-                }
-                if (genericFlow->msecLast > record->msecLast) {
-                    record->msecLast = genericFlow->msecLast;
-                }
-                record->flows += numFlows;
+    for (uint32_t k = 0; k < numKeys; k++) {
+        int insert;
+        StatRecord_t *record = elementHash_addHash(elementHashes[elementKeys[k].stat], &(elementKeys[k].hashkey), elementKeys[k].hash, &insert);
+        if (insert == 0) {
+            record->inBytes += genericFlow->inBytes;
+            record->inPackets += genericFlow->inPackets;
+            record->outBytes += outBytes;
+            record->outPackets += outPackets;
 
-            } else {
-                record->inBytes = genericFlow->inBytes;
-                record->inPackets = genericFlow->inPackets;
-                record->outBytes = outBytes;
-                record->outPackets = outPackets;
+            if (genericFlow->msecFirst < record->msecFirst) {
                 record->msecFirst = genericFlow->msecFirst;
+            }
+            if (genericFlow->msecLast > record->msecLast) {
                 record->msecLast = genericFlow->msecLast;
-                record->flows = numFlows;
             }
+            record->flows += numFlows;
+
+        } else {
+            record->inBytes = genericFlow->inBytes;
+            record->inPackets = genericFlow->inPackets;
+            record->outBytes = outBytes;
+            record->outPackets = outPackets;
+            record->msecFirst = genericFlow->msecFirst;
+            record->msecLast = genericFlow->msecLast;
+            record->flows = numFlows;
+        }
+    }
+}  // AddElementHash
+
+// extensions needed by the requested element stats and the stat counters
+uint64_t ElementStatExtensions(void) {
+    uint64_t extMask = ExtensionBit(EXnull) | ExtensionBit(EXgenericFlowID) | ExtensionBit(EXcntFlowID);
+    for (int i = 0; i < NumStats; i++) {
+        int index = StatRequest[i].StatType;
+        do {
+            uint32_t extID = StatParameters[index].element.extID;
+            // preprocessed values may need any other extension
+            if (extID >= MAXEXTENSIONS || StatParameters[index].preprocess) return ALLEXTENSIONS;
+            extMask |= ExtensionBit(extID);
             index++;
         } while (StatParameters[index].HeaderInfo == NULL);
-    }  // for every requested -s stat
+    }
+    return extMask;
+
+}  // End of ElementStatExtensions
+
+void AddElementStat(recordHandle_t *recordHandle) {
+    //
+    AddElementHash(ElementHashes, DistinctSketch, recordHandle);
 }  // AddElementStat
 
-static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, SortElement_t *element, int type, int order_proto, int inout) {
+int Init_StatTableShards(uint32_t numShards) {
+    elementShards = (elementShard_t *)calloc(numShards, sizeof(elementShard_t));
+    if (!elementShards) {
+        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    hllShards = (hllShard_t *)calloc(numShards, sizeof(hllShard_t));
+    if (!hllShards) {
+        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    for (uint32_t s = 0; s < numShards; s++) {
+        for (int i = 0; i < NumStats; i++) {
+            hllShards[s][i] = hllNew();
+            if (!hllShards[s][i]) {
+                LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+                return 0;
+            }
+            if (StatRequest[i].distinct) continue;
+            elementShards[s][i] = elementHash_init(InitStatHashBits);
+            if (!elementShards[s][i]) {
+                LogError("elementHash_init() failed for shard %u", s);
+                return 0;
+            }
+        }
+    }
+    numElementShards = numShards;
+
+    return 1;
+
+}  // End of Init_StatTableShards
+
+// called by worker 'shard' - add record to the worker's private shard
+void AddElementStatShard(uint32_t shard, recordHandle_t *recordHandle) {
+    //
+    AddElementHash(elementShards[shard], hllShards[shard], recordHandle);
+}  // End of AddElementStatShard
+
+// merge all worker shards into the element hashes. Must be called, after all workers are done
+void MergeStatTableShards(void) {
+    for (int i = 0; i < NumStats; i++) {
+        // union of the shard sketches
+        hllSketch_t *sketch = StatRequest[i].distinct ? DistinctSketch[i] : hllNew();
+        for (uint32_t s = 0; s < numElementShards; s++) {
+            if (sketch) hllMerge(sketch, hllShards[s][i]);
+            free(hllShards[s][i]);
+            hllShards[s][i] = NULL;
+        }
+        if (StatRequest[i].distinct) continue;
+
+        // estimated number of distinct keys of all shards
+        uint64_t numKeys = 0;
+        if (sketch) {
+            numKeys = hllEstimate(sketch);
+            free(sketch);
+        }
+
+        for (uint32_t s = 0; s < numElementShards; s++) {
+            ElementHash_t *shardHash = elementShards[s][i];
+            elementShards[s][i] = NULL;
+
+            if (ElementHashes[i]->count == 0) {
+                // nothing to merge - adopt shard
+                elementHash_free(ElementHashes[i]);
+                ElementHashes[i] = shardHash;
+                continue;
+            }
+
+            // grow once to the final size instead of doubling repeatedly
+            elementHash_reserve(ElementHashes[i], numKeys);
+            elementHash_finish(shardHash);
+            for (uint32_t cell = 0; cell < shardHash->capacity; cell++) {
+                if (!shardHash->keys[cell].active) continue;
+
+                StatRecord_t *shardRecord = &(shardHash->records[cell]);
+                int insert;
+                StatRecord_t *record = elementHash_add(ElementHashes[i], &(shardHash->keys[cell].key), &insert);
+                if (insert) {
+                    *record = *shardRecord;
+                } else {
+                    record->inBytes += shardRecord->inBytes;
+                    record->inPackets += shardRecord->inPackets;
+                    record->outBytes += shardRecord->outBytes;
+                    record->outPackets += shardRecord->outPackets;
+                    record->flows += shardRecord->flows;
+
+                    if (shardRecord->msecFirst < record->msecFirst) record->msecFirst = shardRecord->msecFirst;
+                    if (shardRecord->msecLast > record->msecLast) record->msecLast = shardRecord->msecLast;
+                }
+            }
+            elementHash_free(shardHash);
+        }
+    }
+
+    free(elementShards);
+    elementShards = NULL;
+    free(hllShards);
+    hllShards = NULL;
+    numElementShards = 0;
+
+}  // End of MergeStatTableShards
+
+static void PrintStatLine(FILE *stream, stat_record_t *stat, outputParams_t *outputParams, SortElement_t *element, int type, int order_proto,
+                          int inout) {
     char valstr[64];
     valstr[0] = '\0';
 
@@ -1009,11 +1367,15 @@ static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, Sor
         } break;
         case IS_GEO: {
             snprintf(valstr, 64, "%s", (char *)&(hashKey->v1));
-        }
+        } break;
         case IS_ASORG: {
             const char *org = LookupASorg(hashKey->v1);
             snprintf(valstr, 64, "%45s (%6" PRIi64 ")", org != NULL ? org : "unknown", hashKey->v1);
-        }
+        } break;
+        case IS_LABEL: {
+            const char *label = LabelName(hashKey->v1);
+            snprintf(valstr, 64, "%16s", label != NULL ? label : "-");
+        } break;
     }
     valstr[63] = 0;
 
@@ -1072,7 +1434,8 @@ static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, Sor
     format_number(bps, bps_str, outputParams->printPlain, FIXED_WIDTH);
 
     time_t first = statRecord->msecFirst / 1000LL;
-    struct tm *tbuff = localtime(&first);
+    struct tm tm;
+    struct tm *tbuff = localtime_r(&first, &tm);
     if (!tbuff) {
         LogError("localtime() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
         return;
@@ -1088,25 +1451,25 @@ static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, Sor
         snprintf(dStr, 64, "%s", DurationString(duration));
 
     if (Getv6Mode() && (type == IS_IPADDR)) {
-        printf("%s.%03u %9.3f %-5s %s%39s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr, (unsigned)(statRecord->msecFirst % 1000),
-               duration, protoStr, tag_string, valstr, flows_str, flows_percent, packets_str, packets_percent, byte_str, bytes_percent, pps_str,
-               bps_str, bpp);
+        fprintf(stream, "%s.%03u %9.3f %-5s %s%39s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr,
+                (unsigned)(statRecord->msecFirst % 1000), duration, protoStr, tag_string, valstr, flows_str, flows_percent, packets_str,
+                packets_percent, byte_str, bytes_percent, pps_str, bps_str, bpp);
     } else {
         if (outputParams->hasGeoDB) {
-            printf("%s.%03u %9s %-5s %s%21s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr, (unsigned)(statRecord->msecFirst % 1000), dStr,
-                   protoStr, tag_string, valstr, flows_str, flows_percent, packets_str, packets_percent, byte_str, bytes_percent, pps_str, bps_str,
-                   bpp);
+            fprintf(stream, "%s.%03u %9s %-5s %s%21s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr,
+                    (unsigned)(statRecord->msecFirst % 1000), dStr, protoStr, tag_string, valstr, flows_str, flows_percent, packets_str,
+                    packets_percent, byte_str, bytes_percent, pps_str, bps_str, bpp);
         } else {
-            printf("%s.%03u %9s %-5s %s%17s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr, (unsigned)(statRecord->msecFirst % 1000), dStr,
-                   protoStr, tag_string, valstr, flows_str, flows_percent, packets_str, packets_percent, byte_str, bytes_percent, pps_str, bps_str,
-                   bpp);
+            fprintf(stream, "%s.%03u %9s %-5s %s%17s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr,
+                    (unsigned)(statRecord->msecFirst % 1000), dStr, protoStr, tag_string, valstr, flows_str, flows_percent, packets_str,
+                    packets_percent, byte_str, bytes_percent, pps_str, bps_str, bpp);
         }
     }
 
 }  // End of PrintStatLine
 
-static void PrintJsonStatLine(char *statName, stat_record_t *stat, outputParams_t *outputParams, SortElement_t *element, int type, int order_proto,
-                              int inout) {
+static void PrintJsonStatLine(FILE *stream, char *statName, stat_record_t *stat, outputParams_t *outputParams, SortElement_t *element, int type,
+                              int order_proto, int inout) {
     char valstr[64];
     valstr[0] = '\0';
     char geo[4] = {0};
@@ -1196,7 +1559,11 @@ static void PrintJsonStatLine(char *statName, stat_record_t *stat, outputParams_
         } break;
         case IS_GEO: {
             snprintf(valstr, 64, "%s", (char *)&(hashKey->v1));
-        }
+        } break;
+        case IS_LABEL: {
+            const char *label = LabelName(hashKey->v1);
+            snprintf(valstr, 64, "%s", label != NULL ? label : "-");
+        } break;
     }
     valstr[63] = 0;
 
@@ -1233,24 +1600,27 @@ static void PrintJsonStatLine(char *statName, stat_record_t *stat, outputParams_
     }
 
     time_t when = statRecord->msecFirst / 1000LL;
-    struct tm *ts = localtime(&when);
+    struct tm tm;
+    struct tm *ts = localtime_r(&when, &tm);
     char datestrFirst[64];
     strftime(datestrFirst, 63, "%Y-%m-%dT%H:%M:%S", ts);
 
     when = statRecord->msecLast / 1000LL;
-    ts = localtime(&when);
+    ts = localtime_r(&when, &tm);
     char datestrLast[64];
     strftime(datestrLast, 63, "%Y-%m-%dT%H:%M:%S", ts);
 
     if (outputParams->hasGeoDB && type == IS_IPADDR) {
-        printf(
+        fprintf(
+            stream,
             "{ \"first\" : \"%s.%03u\", \"last\" : \"%s.%03u\", \"proto\" : %u, \"%s\" : \"%s\", \"geo\" : \"%s\","
             "\"flows\" : %" PRIu64 ", \"packets\" : %" PRIu64 ", \"bytes\" : %" PRIu64 ", \"pps\" : %" PRIu64 ", \"bps\" : %" PRIu64
             ", \"bpp\" : %u}\n",
             datestrFirst, (unsigned)(statRecord->msecFirst % 1000), datestrLast, (unsigned)(statRecord->msecLast % 1000), hashKey->proto, statName,
             valstr, geo, count_flows, count_packets, count_bytes, pps, bps, bpp);
     } else {
-        printf(
+        fprintf(
+            stream,
             "{ \"first\" : \"%s.%03u\", \"last\" : \"%s.%03u\", \"proto\" : %u, \"%s\" : \"%s\", "
             "\"flows\" : %" PRIu64 ", \"packets\" : %" PRIu64 ", \"bytes\" : %" PRIu64 ", \"pps\" : %" PRIu64 ", \"bps\" : %" PRIu64
             ", \"bpp\" : %u}\n",
@@ -1260,7 +1630,8 @@ static void PrintJsonStatLine(char *statName, stat_record_t *stat, outputParams_
 
 }  // End of PrintJsonStatLine
 
-static void PrintCvsStatLine(stat_record_t *stat, int printPlain, SortElement_t *element, int type, int order_proto, int tag, int inout) {
+static void PrintCvsStatLine(FILE *stream, stat_record_t *stat, int printPlain, SortElement_t *element, int type, int order_proto, int tag,
+                             int inout) {
     char valstr[40];
 
     StatRecord_t *statRecord = (StatRecord_t *)element->record;
@@ -1297,6 +1668,10 @@ static void PrintCvsStatLine(stat_record_t *stat, int printPlain, SortElement_t
             snprintf(valstr, 40, "%8llu-%1llu-%1llu", (unsigned long long)hashKey->v1 >> 4, ((unsigned long long)hashKey->v1 & 0xF) >> 1,
                      (unsigned long long)hashKey->v1 & 1);
         } break;
+        case IS_LABEL: {
+            const char *label = LabelName(hashKey->v1);
+            snprintf(valstr, 40, "%s", label != NULL ? label : "-");
+        } break;
     }
 
     valstr[39] = 0;
@@ -1340,7 +1715,8 @@ static void PrintCvsStatLine(stat_record_t *stat, int printPlain, SortElement_t
     }
 
     time_t when = statRecord->msecFirst / 1000;
-    struct tm *tbuff = localtime(&when);
+    struct tm tm;
+    struct tm *tbuff = localtime_r(&when, &tm);
     if (!tbuff) {
         perror("Error time convert");
         exit(250);
@@ -1349,7 +1725,7 @@ static void PrintCvsStatLine(stat_record_t *stat, int printPlain, SortElement_t
     strftime(datestr1, 63, "%Y-%m-%d %H:%M:%S", tbuff);
 
     when = statRecord->msecLast / 1000;
-    tbuff = localtime(&when);
+    tbuff = localtime_r(&when, &tm);
     if (!tbuff) {
         perror("Error time convert");
         exit(250);
@@ -1357,18 +1733,109 @@ static void PrintCvsStatLine(stat_record_t *stat, int printPlain, SortElement_t
     char datestr2[64];
     strftime(datestr2, 63, "%Y-%m-%d %H:%M:%S", tbuff);
 
-    printf("%s,%s,%.3f,%s,%s,%llu,%.1f,%llu,%.1f,%llu,%.1f,%llu,%llu,%u\n", datestr1, datestr2, duration,
-           order_proto ? ProtoString(hashKey->proto, printPlain) : "any", valstr, (long long unsigned)count_flows, flows_percent,
-           (long long unsigned)count_packets, packets_percent, (long long unsigned)count_bytes, bytes_percent, (long long unsigned)pps,
-           (long long unsigned)bps, bpp);
+    fprintf(stream, "%s,%s,%.3f,%s,%s,%llu,%.1f,%llu,%.1f,%llu,%.1f,%llu,%llu,%u\n", datestr1, datestr2, duration,
+            order_proto ? ProtoString(hashKey->proto, printPlain) : "any", valstr, (long long unsigned)count_flows, flows_percent,
+            (long long unsigned)count_packets, packets_percent, (long long unsigned)count_bytes, bytes_percent, (long long unsigned)pps,
+            (long long unsigned)bps, bpp);
 
 }  // End of PrintCvsStatLine
 
+typedef struct statLineRender_s {
+    char *statName;
+    stat_record_t *sum_stat;
+    outputParams_t *outputParams;
+    SortElement_t *elementList;
+    int type;
+    int order_proto;
+    int inout;
+    int startIndex;
+    int increment;
+} statLineRender_t;
+
+// print the stat lines start .. end-1 of a sorted element list into stream
+static void RenderStatLines(FILE *stream, void *arg, uint64_t start, uint64_t end) {
+    statLineRender_t *render = (statLineRender_t *)arg;
+    outputParams_t *outputParams = render->outputParams;
+
+    for (uint64_t i = start; i < end; i++) {
+        SortElement_t *element = &render->elementList[render->startIndex + (int)i * render->increment];
+        switch (outputParams->mode) {
+            case MODE_NULL:
+            case MODE_RAW:
+            case MODE_KV:
+            case MODE_CSV_FAST:
+            case MODE_ARROW:
+                break;
+            case MODE_FMT:
+                PrintStatLine(stream, render->sum_stat, outputParams, element, render->type, render->order_proto, render->inout);
+                break;
+            case MODE_CSV:
+                PrintCvsStatLine(stream, render->sum_stat, outputParams->printPlain, element, render->type, render->order_proto, outputParams->doTag,
+                                 render->inout);
+                break;
+            case MODE_JSON:
+            case MODE_NDJSON:
+                PrintJsonStatLine(stream, render->statName, render->sum_stat, outputParams, element, render->type, render->order_proto,
+                                  render->inout);
+                break;
+        }
+    }
+
+}  // End of RenderStatLines
+
+// print the estimated number of distinct elements of a -s count:<elem> stat
+static void PrintDistinctStat(outputParams_t *outputParams, int hash_num) {
+    char *statName = StatParameters[StatRequest[hash_num].StatType].statname;
+    uint64_t distinct = hllEstimate(DistinctSketch[hash_num]);
+
+    switch (outputParams->mode) {
+        case MODE_FMT:
+            if (StatRequest[hash_num].order_proto)
+                printf("Distinct %s per protocol: %" PRIu64 " (estimated)\n", statName, distinct);
+            else
+                printf("Distinct %s: %" PRIu64 " (estimated)\n", statName, distinct);
+            break;
+        case MODE_CSV:
+            printf("stat,distinct\n%s,%" PRIu64 "\n", statName, distinct);
+            break;
+        case MODE_JSON:
+        case MODE_NDJSON:
+            printf("{ \"stat\" : \"%s\", \"distinct\" : %" PRIu64 "}\n", statName, distinct);
+            break;
+        default:
+            break;
+    }
+
+}  // End of PrintDistinctStat
+
 void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, RecordPrinter_t print_record) {
     uint32_t numflows = 0;
 
+    // counters of a sampled query are scaled to the estimated totals
+    if (outputParams->sampleScale) {
+        double scale = outputParams->sampleScale;
+        for (int hash_num = 0; hash_num < NumStats; hash_num++) {
+            if (StatRequest[hash_num].distinct) continue;
+            ElementHash_t *elementHash = ElementHashes[hash_num];
+            elementHash_finish(elementHash);
+            for (uint32_t i = 0; i < elementHash->capacity; i++) {
+                if (!elementHash->keys[i].active) continue;
+                StatRecord_t *record = &(elementHash->records[i]);
+                record->inBytes = (uint64_t)(record->inBytes * scale + 0.5);
+                record->inPackets = (uint64_t)(record->inPackets * scale + 0.5);
+                record->outBytes = (uint64_t)(record->outBytes * scale + 0.5);
+                record->outPackets = (uint64_t)(record->outPackets * scale + 0.5);
+                record->flows = (uint64_t)(record->flows * scale + 0.5);
+            }
+        }
+    }
+
     // for every requested -s stat do
     for (int hash_num = 0; hash_num < NumStats; hash_num++) {
+        if (StatRequest[hash_num].distinct) {
+            PrintDistinctStat(outputParams, hash_num);
+            continue;
+        }
         int stat = StatRequest[hash_num].StatType;
         int order = StatRequest[hash_num].orderBy;
         int type = StatParameters[stat].type;
@@ -1433,29 +1900,19 @@ void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, Rec
                     increment = -1;
                 }
                 dbg_printf("Print stat table: start: %d, end: %d, incr: %d\n", startIndex, endIndex, increment);
-                int index = startIndex;
-                while (index != endIndex) {
-                    switch (outputParams->mode) {
-                        case MODE_NULL:
-                        case MODE_RAW:
-                        case MODE_CSV_FAST:
-                            break;
-                        case MODE_FMT:
-                            PrintStatLine(sum_stat, outputParams, &topN_element_list[index], type, StatRequest[hash_num].order_proto,
-                                          orderByTable[order_index].inout);
-                            break;
-                        case MODE_CSV:
-                            PrintCvsStatLine(sum_stat, outputParams->printPlain, &topN_element_list[index], type, StatRequest[hash_num].order_proto,
-                                             outputParams->doTag, orderByTable[order_index].inout);
-                            break;
-                        case MODE_JSON:
-                        case MODE_NDJSON:
-                            PrintJsonStatLine(StatParameters[stat].statname, sum_stat, outputParams, &topN_element_list[index], type,
-                                              StatRequest[hash_num].order_proto, orderByTable[order_index].inout);
-                            break;
-                    }
-                    index += increment;
-                }
+                statLineRender_t render = {
+                    .statName = StatParameters[stat].statname,
+                    .sum_stat = sum_stat,
+                    .outputParams = outputParams,
+                    .elementList = topN_element_list,
+                    .type = type,
+                    .order_proto = StatRequest[hash_num].order_proto,
+                    .inout = orderByTable[order_index].inout,
+                    .startIndex = startIndex,
+                    .increment = increment,
+                };
+                // the stat lines are rendered in parallel for long lists
+                RenderLines((endIndex - startIndex) * increment, RenderStatLines, &render);
                 free((void *)topN_element_list);
             }
         }  // for every requested order
@@ -1465,6 +1922,7 @@ void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, Rec
 
 static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int order, direction_t direction) {
     ElementHash_t *elemenHash = ElementHashes[hash_num];
+    elementHash_finish(elemenHash);
     uint32_t numCells = elemenHash->count;
     dbg_printf("StatTopN Hash: capacity: %u, numCells: %u\n", elemenHash->capacity, elemenHash->count);
 
@@ -1491,7 +1949,7 @@ static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int orde
     *count = numCells;
     dbg_printf("Sort %u flows\n", c);
 
-    if (c > 1) blocksort((SortElement_t *)topN_list, c);
+    if (c > 1) blockselect((SortElement_t *)topN_list, c, topN, direction == ASCENDING);
 
     return topN_list;
 
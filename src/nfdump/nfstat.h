@@ -37,6 +37,7 @@
 
 #include "config.h"
 #include "nfdump.h"
+#include "nfprof.h"
 #include "output.h"
 
 #define FLAG_STAT 0x1
@@ -52,8 +53,18 @@ void Dispose_StatTable(void);
 
 int SetElementStat(char *elementStat, char *orderBy);
 
+uint64_t ElementStatExtensions(void);
+
 void AddElementStat(recordHandle_t *recordHandle);
 
+int Init_StatTableShards(uint32_t numShards);
+
+void AddElementStatShard(uint32_t shard, recordHandle_t *recordHandle);
+
+void MergeStatTableShards(void);
+
+void ElementHashStat(hashStat_t *hashStat);
+
 void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, RecordPrinter_t print_record);
 
 void ListPrintOrder(void);
@@ -0,0 +1,443 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Scatter-gather queries across the nfdumpd agents of several collector nodes.
+ * Remote agents are reached by forwarding their unix socket, e.g. by ssh -L.
+ * The result cache keeps the partial results of single files.
+ */
+
+#include "scatter.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "queue.h"
+#include "util.h"
+#include "version.h"
+
+// max number of agents
+#define MAXAGENTS 256
+
+typedef struct agent_s {
+    pthread_t tid;
+    char *socketPath;
+    char outFile[MAXPATHLEN];
+    int numArgs;
+    char **args;
+    int ok;
+} agent_t;
+
+// max number of concurrent queries to fill the result cache
+#define CACHEJOBS 4
+// max number of query arguments of a cache job
+#define MAXCACHEARGS 24
+
+// partial result of a file, which is not yet cached
+typedef struct cacheEntry_s {
+    pid_t pid;
+    char *fileName;
+    char cacheFile[MAXPATHLEN];
+    char tmpFile[MAXPATHLEN];
+} cacheEntry_t;
+
+// element stats, which are exact from 5-tuple aggregated partial results
+static char *partialStats[] = {"record", "srcip", "dstip", "ip", "srcport", "dstport", "port", "proto", NULL};
+
+static void *AgentQuery_thr(void *arg);
+
+static int TempPath(char *path, size_t size, char *name);
+
+static int CacheKey(char *fileName, int numArgs, char **args, char *key, size_t size);
+
+static pid_t CacheJob(char *progName, char *fileName, char *outFile, int numArgs, char **args);
+
+static int CacheStore(cacheEntry_t *entry, int status);
+
+// send the query to one agent and save the returned stream
+static void *AgentQuery_thr(void *arg) {
+    agent_t *agent = (agent_t *)arg;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(agent->socketPath) >= sizeof(addr.sun_path)) {
+        LogError("Agent socket path too long: %s", agent->socketPath);
+        return NULL;
+    }
+    strcpy(addr.sun_path, agent->socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LogError("connect() to agent %s failed: %s", agent->socketPath, strerror(errno));
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    for (int i = 0; i <= agent->numArgs; i++) {
+        char *a = i < agent->numArgs ? agent->args[i] : "";
+        size_t len = strlen(a) + 1;
+        if (write(fd, a, len) != (ssize_t)len) {
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            close(fd);
+            return NULL;
+        }
+    }
+
+    int out = open(agent->outFile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (out < 0) {
+        LogError("open() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    char buff[65536];
+    ssize_t ret;
+    size_t size = 0;
+    while ((ret = read(fd, buff, sizeof(buff))) != 0) {
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (write(out, buff, ret) != ret) {
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            ret = -1;
+            break;
+        }
+        size += ret;
+    }
+    close(fd);
+    close(out);
+
+    if (ret < 0 || size == 0) {
+        LogError("Agent %s returned no result", agent->socketPath);
+        unlink(agent->outFile);
+        return NULL;
+    }
+    agent->ok = 1;
+
+    return NULL;
+
+}  // End of AgentQuery_thr
+
+// query all agents in parallel. Returns the directory with the partial results
+char *ScatterQuery(char *agentList, int numArgs, char **args) {
+    char tmpDir[MAXPATHLEN];
+    if (!TempPath(tmpDir, sizeof(tmpDir), "nfscatter") || mkdtemp(tmpDir) == NULL) {
+        LogError("mkdtemp() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    agent_t *agents = calloc(MAXAGENTS, sizeof(agent_t));
+    char *list = strdup(agentList);
+    if (!agents || !list) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    int numAgents = 0;
+    char *saveptr = NULL;
+    for (char *s = strtok_r(list, ",", &saveptr); s != NULL; s = strtok_r(NULL, ",", &saveptr)) {
+        if (numAgents == MAXAGENTS) {
+            LogError("Too many agents. Max %d agents allowed", MAXAGENTS);
+            break;
+        }
+        agent_t *agent = &agents[numAgents];
+        agent->socketPath = s;
+        agent->numArgs = numArgs;
+        agent->args = args;
+        if (snprintf(agent->outFile, sizeof(agent->outFile), "%s/agent.%03d", tmpDir, numAgents) >= (int)sizeof(agent->outFile)) {
+            LogError("Temp path too long: %s", tmpDir);
+            break;
+        }
+        int err = pthread_create(&agent->tid, NULL, AgentQuery_thr, (void *)agent);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            break;
+        }
+        numAgents++;
+    }
+
+    int numOK = 0;
+    for (int i = 0; i < numAgents; i++) {
+        pthread_join(agents[i].tid, NULL);
+        numOK += agents[i].ok;
+    }
+    dbg_printf("Scatter query: %d of %d agents answered\n", numOK, numAgents);
+
+    if (numOK < numAgents) LogError("Warning: %d of %d agents answered - result is incomplete", numOK, numAgents);
+    free(list);
+    free(agents);
+
+    if (numOK == 0) {
+        ScatterCleanup(tmpDir);
+        return NULL;
+    }
+
+    return strdup(tmpDir);
+
+}  // End of ScatterQuery
+
+// remove the partial results
+void ScatterCleanup(char *tmpDir) {
+    DIR *dir = opendir(tmpDir);
+    if (dir) {
+        struct dirent *entry;
+        char path[MAXPATHLEN];
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            snprintf(path, sizeof(path), "%s/%s", tmpDir, entry->d_name);
+            unlink(path);
+        }
+        closedir(dir);
+    }
+    rmdir(tmpDir);
+
+}  // End of ScatterCleanup
+
+// returns true, if the element stat can be merged from 5-tuple aggregated partial results
+int PartialStatType(char *statType) {
+    size_t len = strcspn(statType, "/:");
+    for (int i = 0; partialStats[i] != NULL; i++) {
+        if (strlen(partialStats[i]) == len && strncmp(statType, partialStats[i], len) == 0) return 1;
+    }
+    return 0;
+
+}  // End of PartialStatType
+
+static int TempPath(char *path, size_t size, char *name) {
+    char *tmp = getenv("TMPDIR");
+    if (!tmp || strlen(tmp) == 0) tmp = "/tmp";
+    return snprintf(path, size, "%s/%s.XXXXXX", tmp, name) < (int)size;
+
+}  // End of TempPath
+
+// 128 bit FNV-1a hash of the file identity and the query as hex string
+static int CacheKey(char *fileName, int numArgs, char **args, char *key, size_t size) {
+    struct stat stat_buf;
+    char path[MAXPATHLEN];
+    if (stat(fileName, &stat_buf) < 0 || realpath(fileName, path) == NULL) {
+        LogError("stat() error '%s': %s", fileName, strerror(errno));
+        return 0;
+    }
+
+    char identity[256];
+    snprintf(identity, sizeof(identity), "%s %llu %llu %llu %lld.%09ld", versionString(), (unsigned long long)stat_buf.st_dev,
+             (unsigned long long)stat_buf.st_ino, (unsigned long long)stat_buf.st_size, (long long)stat_buf.st_mtim.tv_sec,
+             (long)stat_buf.st_mtim.tv_nsec);
+
+    uint64_t h1 = 0xcbf29ce484222325ULL;
+    uint64_t h2 = 0x84222325cbf29ce4ULL;
+    char *parts[3] = {path, identity, NULL};
+    for (int i = -2; i < numArgs; i++) {
+        char *s = i < 0 ? parts[i + 2] : args[i];
+        // include the terminating '\0' as separator
+        for (size_t j = 0; j <= strlen(s); j++) {
+            h1 = (h1 ^ (uint8_t)s[j]) * 0x100000001b3ULL;
+            h2 = (h2 ^ (uint8_t)s[j]) * 0x100000001b3ULL;
+            h2 ^= h2 >> 29;
+        }
+    }
+    return snprintf(key, size, "%016llx%016llx", (unsigned long long)h1, (unsigned long long)h2) < (int)size;
+
+}  // End of CacheKey
+
+// run the query for one file in a child nfdump, which writes the partial result
+static pid_t CacheJob(char *progName, char *fileName, char *outFile, int numArgs, char **args) {
+    char *argv[MAXCACHEARGS + 8];
+    int argc = 0;
+    argv[argc++] = progName;
+    argv[argc++] = "-r";
+    argv[argc++] = fileName;
+    argv[argc++] = "-z=lz4";
+    argv[argc++] = "-w";
+    argv[argc++] = outFile;
+    for (int i = 0; i < numArgs && i < MAXCACHEARGS; i++) argv[argc++] = args[i];
+    argv[argc] = NULL;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LogError("fork() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return -1;
+    }
+    if (pid > 0) return pid;
+
+    // child - the partial result goes into the file, messages such as no matching flows are discarded
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+    execvp(progName, argv);
+    LogError("execvp() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+    _exit(255);
+
+}  // End of CacheJob
+
+// move the finished partial result of a job into the cache. A query without matching
+// flows writes no file - an empty file is cached instead
+static int CacheStore(cacheEntry_t *entry, int status) {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        LogError("Query of file %s failed", entry->fileName);
+        unlink(entry->tmpFile);
+        return 0;
+    }
+
+    if (access(entry->tmpFile, F_OK) < 0) {
+        nffile_t *nffile = OpenNewFile(entry->tmpFile, NULL, CREATOR_NFDUMP, LZ4_COMPRESSED, NOT_ENCRYPTED);
+        if (!nffile) return 0;
+        CloseUpdateFile(nffile);
+        DisposeFile(nffile);
+    }
+    if (rename(entry->tmpFile, entry->cacheFile) < 0) {
+        LogError("rename() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        unlink(entry->tmpFile);
+        return 0;
+    }
+    return 1;
+
+}  // End of CacheStore
+
+// look up the partial results of all files in the cache and run the query for
+// missing files. Returns a temporary directory with links to the partial results
+char *CacheQuery(char *cacheDir, char *progName, queue_t *fileList, int numArgs, char **args) {
+    char tmpDir[MAXPATHLEN];
+    if (!TempPath(tmpDir, sizeof(tmpDir), "nfcache") || mkdtemp(tmpDir) == NULL) {
+        LogError("mkdtemp() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    cacheEntry_t jobs[CACHEJOBS];
+    int numJobs = 0;
+    uint32_t numFiles = 0;
+    uint32_t numHits = 0;
+    int ok = 1;
+    char *fileName;
+    while ((fileName = queue_pop(fileList)) != QUEUE_CLOSED) {
+        if (!ok) {
+            free(fileName);
+            continue;
+        }
+
+        cacheEntry_t entry = {.fileName = fileName};
+        char key[40];
+        char subDir[MAXPATHLEN];
+        if (!CacheKey(fileName, numArgs, args, key, sizeof(key)) ||
+            snprintf(subDir, sizeof(subDir), "%s/%.2s", cacheDir, key) >= (int)sizeof(subDir) ||
+            snprintf(entry.cacheFile, sizeof(entry.cacheFile), "%s/%s", subDir, key) >= (int)sizeof(entry.cacheFile) ||
+            snprintf(entry.tmpFile, sizeof(entry.tmpFile), "%s.%d", entry.cacheFile, (int)getpid()) >= (int)sizeof(entry.tmpFile)) {
+            free(fileName);
+            ok = 0;
+            continue;
+        }
+        if (mkdir(subDir, 0755) < 0 && errno != EEXIST) {
+            LogError("mkdir() error '%s': %s", subDir, strerror(errno));
+            free(fileName);
+            ok = 0;
+            continue;
+        }
+
+        // the links keep the file order
+        char link[MAXPATHLEN];
+        if (snprintf(link, sizeof(link), "%s/cache.%06u", tmpDir, numFiles++) >= (int)sizeof(link)) {
+            LogError("Temp path too long: %s", tmpDir);
+            free(fileName);
+            ok = 0;
+            continue;
+        }
+        if (symlink(entry.cacheFile, link) < 0) {
+            LogError("symlink() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            free(fileName);
+            ok = 0;
+            continue;
+        }
+
+        if (access(entry.cacheFile, R_OK) == 0) {
+            numHits++;
+            free(fileName);
+            continue;
+        }
+
+        if (numJobs == CACHEJOBS) {
+            // wait for a free job slot
+            int status;
+            pid_t pid = wait(&status);
+            for (int i = 0; i < numJobs; i++) {
+                if (jobs[i].pid != pid) continue;
+                if (!CacheStore(&jobs[i], status)) ok = 0;
+                free(jobs[i].fileName);
+                jobs[i] = jobs[--numJobs];
+                break;
+            }
+        }
+        entry.pid = CacheJob(progName, fileName, entry.tmpFile, numArgs, args);
+        if (entry.pid < 0) {
+            free(fileName);
+            ok = 0;
+            continue;
+        }
+        jobs[numJobs++] = entry;
+    }
+
+    while (numJobs) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) break;
+        for (int i = 0; i < numJobs; i++) {
+            if (jobs[i].pid != pid) continue;
+            if (!CacheStore(&jobs[i], status)) ok = 0;
+            free(jobs[i].fileName);
+            jobs[i] = jobs[--numJobs];
+            break;
+        }
+    }
+
+    if (!ok) {
+        ScatterCleanup(tmpDir);
+        return NULL;
+    }
+    LogVerbose("Result cache: %u of %u files cached", numHits, numFiles);
+
+    return strdup(tmpDir);
+
+}  // End of CacheQuery
@@ -0,0 +1,57 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _SCATTER_H
+#define _SCATTER_H 1
+
+#include "queue.h"
+
+/*
+ * Scatter-gather queries. The coordinator sends the query to the nfdumpd
+ * agents of all collector nodes. Each agent answers with its partial result
+ * as nfdump binary stream (-w -). The coordinator collects the streams in a
+ * temporary directory and merges them by processing the directory again with
+ * the same aggregation.
+ *
+ * Result cache. Closed files never change, so the partial result of a query over
+ * a file is cached in the cache dir, keyed by the file identity and the query.
+ * Only files without cached result are queried, and all partial results are
+ * merged by processing them with the same aggregation.
+ */
+
+char *ScatterQuery(char *agentList, int numArgs, char **args);
+
+void ScatterCleanup(char *tmpDir);
+
+int PartialStatType(char *statType);
+
+char *CacheQuery(char *cacheDir, char *progName, queue_t *fileList, int numArgs, char **args);
+
+#endif  // _SCATTER_H
@@ -63,6 +63,7 @@
 
 #include "bookkeeper.h"
 #include "expire.h"
+#include "nfdump.h"
 #include "nfstatfile.h"
 #include "util.h"
 
@@ -83,6 +84,7 @@ static void usage(char *name) {
         "-s size\t\tmax size: scales b bytes, k kilo, m mega, g giga t tera\n"
         "-T runtime\tmaximum nfexpire run time: nfexpire terminates after this amount of seconds\n"
         "-t lifetime\tmaximum life time of data: scales: w week, d day, H hour, M minute\n"
+        "-W workers\tunlink expired files with this number of threads. Default: unlink in sequence\n"
         "-w watermark\tlow water mark in %% for expire.\n",
         name);
 
@@ -201,7 +203,7 @@ int main(int argc, char **argv) {
     nfsen_format = 0;
     runtime = 0;
 
-    while ((c = getopt(argc, argv, "e:hl:L:T:Ypr:s:t:u:w:")) != EOF) {
+    while ((c = getopt(argc, argv, "e:hl:L:T:Ypr:s:t:u:w:W:")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -262,6 +264,14 @@ int main(int argc, char **argv) {
                     exit(250);
                 }
                 break;
+            case 'W': {
+                uint32_t workers = strtoll(optarg, NULL, 10);
+                if (workers > MAXWORKERS) {
+                    LogError("Number of workers out of range 0..%d", MAXWORKERS);
+                    exit(250);
+                }
+                SetExpireWorkers(workers);
+            } break;
             case 'Y':
                 nfsen_format = 1;
                 break;
@@ -330,7 +340,7 @@ int main(int argc, char **argv) {
             for (i = 0; i < 3; i++) {
                 last_sequence = BookSequence(current_channel->books);
                 printf("Scanning files in %s .. ", current_channel->datadir);
-                RescanDir(current_channel->datadir, current_channel->dirstat);
+                RescanDir(current_channel->datadir, current_channel->dirstat, FileIndexExists(current_channel->datadir));
                 if (current_channel->dirstat->numfiles == 0) {  // nothing found
                     current_channel->status = NOFILES;
                 }
@@ -45,7 +45,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "barrier.h"
 #include "bookkeeper.h"
+#include "catalog.h"
 #include "collector.h"
 #include "config.h"
 #include "exporter.h"
@@ -54,8 +56,10 @@
 #include "nfdump.h"
 #include "nffile.h"
 #include "nfnet.h"
+#include "nfstatfile.h"
 #include "nfxV3.h"
 #include "output_short.h"
+#include "payload.h"
 #include "pflog.h"
 #include "queue.h"
 #include "util.h"
@@ -63,222 +67,286 @@
 static int printRecord = 0;
 #include "nffile_inline.c"
 
-#define UpdateRecordSize(s) \
-    recordSize += (s);      \
-    if (recordSize > availableSize) continue;
+static uint32_t PcapFlowSize(flowParam_t *flowParam, struct FlowNode *Node);
 
-static int StorePcapFlow(flowParam_t *flowParam, struct FlowNode *Node);
+static uint32_t EncodePcapFlow(flowParam_t *flowParam, struct FlowNode *Node, void *buffPtr, uint64_t msecReceived);
 
-static int StorePcapFlow(flowParam_t *flowParam, struct FlowNode *Node) {
+static struct FlowNode *StorePcapFlows(flowParam_t *flowParam, struct FlowNode *Node);
+
+// aligned length of the pflog interface name
+static inline size_t PflogIfnameLen(pflog_hdr_t *pflog) {
+    size_t ifnameLen = strnlen(pflog->ifname, IFNAMSIZ);
+    if (ifnameLen) {
+        ifnameLen++;  // add terminating '\0'
+    }
+    size_t align = ifnameLen & 0x3;
+    if (align) {
+        ifnameLen += 4 - align;
+    }
+    return ifnameLen;
+}  // End of PflogIfnameLen
+
+// aligned length of the payload
+static inline size_t PayloadLen(const struct flowNodeCold_s *cold) {
+    size_t payloadSize = cold->payloadSize;
+    size_t align = payloadSize & 0x3;
+    if (align) {
+        payloadSize += 4 - align;
+    }
+    return payloadSize;
+}  // End of PayloadLen
+
+// size of the V3 record, EncodePcapFlow() creates for this node. With a payload dictionary
+// the record may be smaller, but is expanded to this size, when the file is read
+static uint32_t PcapFlowSize(flowParam_t *flowParam, struct FlowNode *Node) {
+    const struct flowNodeCold_s *cold = ColdData(Node);
+    uint32_t recordSize = V3HeaderRecordSize + EXgenericFlowSize;
+    recordSize += Node->flowKey.version == AF_INET6 ? EXipv6FlowSize : EXipv4FlowSize;
+
+    if (flowParam->extendedFlow) {
+        recordSize += EXipInfoSize;
+        if (cold->vlanID) recordSize += EXvLanSize;
+        if (cold->srcMac) recordSize += EXmacAddrSize;
+        if (cold->mpls[0]) recordSize += EXmplsLabelSize;
+        if (Node->flowKey.proto == IPPROTO_TCP && cold->latency.application) recordSize += EXlatencySize;
+        if (cold->pflog) recordSize += EXpfinfoSize + PflogIfnameLen((pflog_hdr_t *)cold->pflog);
+    }
+
+    if (flowParam->addPayload && cold->payloadSize) recordSize += EXinPayloadSize + PayloadLen(cold);
+
+    if (cold->tun_ip_version == AF_INET)
+        recordSize += EXtunIPv4Size;
+    else if (cold->tun_ip_version == AF_INET6)
+        recordSize += EXtunIPv6Size;
+
+    return recordSize;
+
+}  // End of PcapFlowSize
+
+// encode the node into buffPtr. The caller guarantees, that PcapFlowSize() bytes are available
+static uint32_t EncodePcapFlow(flowParam_t *flowParam, struct FlowNode *Node, void *buffPtr, uint64_t msecReceived) {
+    const struct flowNodeCold_s *cold = ColdData(Node);
     FlowSource_t *fs = flowParam->fs;
 
     dbg_printf("Store Flow node\n");
 
-    // start with a min buffer of 1024. if it's too small, it gets extended
-    uint32_t recordSize = 1024;
-    do {
-        if (!IsAvailable(fs->dataBlock, recordSize)) {
-            // flush block - get an empty one
-            fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+    // map output record to memory buffer
+    AddV3Header(buffPtr, recordHeader);
+
+    // header data
+    recordHeader->nfversion = 0x41;
+    recordHeader->engineType = 0x11;
+    recordHeader->engineID = 1;
+    recordHeader->exporterID = 0;
+
+    // pack V3 record
+    PushExtension(recordHeader, EXgenericFlow, genericFlow);
+    genericFlow->msecFirst = (1000LL * (uint64_t)Node->t_first.tv_sec) + (uint64_t)Node->t_first.tv_usec / 1000LL;
+    genericFlow->msecLast = (1000LL * (uint64_t)Node->t_last.tv_sec) + (uint64_t)Node->t_last.tv_usec / 1000LL;
+    genericFlow->msecReceived = msecReceived;
+
+    genericFlow->inPackets = Node->packets;
+    genericFlow->inBytes = Node->bytes;
+
+    genericFlow->tcpFlags = Node->flags;
+    genericFlow->proto = Node->flowKey.proto;
+    genericFlow->srcPort = Node->flowKey.src_port;
+    genericFlow->dstPort = Node->flowKey.dst_port;
+
+    if (Node->flowKey.version == AF_INET6) {
+        PushExtension(recordHeader, EXipv6Flow, ipv6Flow);
+        ipv6Flow->srcAddr[0] = Node->flowKey.src_addr.v6[0];
+        ipv6Flow->srcAddr[1] = Node->flowKey.src_addr.v6[1];
+        ipv6Flow->dstAddr[0] = Node->flowKey.dst_addr.v6[0];
+        ipv6Flow->dstAddr[1] = Node->flowKey.dst_addr.v6[1];
+    } else {
+        PushExtension(recordHeader, EXipv4Flow, ipv4Flow);
+        ipv4Flow->srcAddr = Node->flowKey.src_addr.v4;
+        ipv4Flow->dstAddr = Node->flowKey.dst_addr.v4;
+    }
+
+    if (flowParam->extendedFlow) {
+        PushExtension(recordHeader, EXipInfo, ipInfo);
+        ipInfo->ttl = Node->ttl;
+        ipInfo->fragmentFlags = Node->fragmentFlags;
+
+        if (cold->vlanID) {
+            PushExtension(recordHeader, EXvLan, vlan);
+            vlan->srcVlan = cold->vlanID;
         }
 
-        int availableSize = BlockAvailable(fs->dataBlock);
-        if (availableSize == 0) {
-            // fishy! - should never happen. maybe disk full?
-            LogError("StorePcapFlow(): output buffer size error. Skip record");
-            return 0;
+        if (cold->srcMac) {
+            PushExtension(recordHeader, EXmacAddr, macAddr);
+            macAddr->inSrcMac = ntohll(cold->srcMac) >> 16;
+            macAddr->outDstMac = ntohll(cold->dstMac) >> 16;
+            macAddr->inDstMac = 0;
+            macAddr->outSrcMac = 0;
         }
-        recordSize = 0;
 
-        void *buffPtr = GetCurrentCursor(fs->dataBlock);
-        // map output record to memory buffer
-        UpdateRecordSize(V3HeaderRecordSize);
-        AddV3Header(buffPtr, recordHeader);
-
-        // header data
-        recordHeader->nfversion = 0x41;
-        recordHeader->engineType = 0x11;
-        recordHeader->engineID = 1;
-        recordHeader->exporterID = 0;
-
-        // pack V3 record
-        UpdateRecordSize(EXgenericFlowSize);
-        PushExtension(recordHeader, EXgenericFlow, genericFlow);
-        genericFlow->msecFirst = (1000LL * (uint64_t)Node->t_first.tv_sec) + (uint64_t)Node->t_first.tv_usec / 1000LL;
-        genericFlow->msecLast = (1000LL * (uint64_t)Node->t_last.tv_sec) + (uint64_t)Node->t_last.tv_usec / 1000LL;
-
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        genericFlow->msecReceived = (uint64_t)now.tv_sec * 1000LL + (uint64_t)now.tv_usec / 1000LL;
-
-        genericFlow->inPackets = Node->packets;
-        genericFlow->inBytes = Node->bytes;
-
-        genericFlow->tcpFlags = Node->flags;
-        genericFlow->proto = Node->flowKey.proto;
-        genericFlow->srcPort = Node->flowKey.src_port;
-        genericFlow->dstPort = Node->flowKey.dst_port;
-
-        if (Node->flowKey.version == AF_INET6) {
-            UpdateRecordSize(EXipv6FlowSize);
-            PushExtension(recordHeader, EXipv6Flow, ipv6Flow);
-            ipv6Flow->srcAddr[0] = Node->flowKey.src_addr.v6[0];
-            ipv6Flow->srcAddr[1] = Node->flowKey.src_addr.v6[1];
-            ipv6Flow->dstAddr[0] = Node->flowKey.dst_addr.v6[0];
-            ipv6Flow->dstAddr[1] = Node->flowKey.dst_addr.v6[1];
-        } else {
-            UpdateRecordSize(EXipv4FlowSize);
-            PushExtension(recordHeader, EXipv4Flow, ipv4Flow);
-            ipv4Flow->srcAddr = Node->flowKey.src_addr.v4;
-            ipv4Flow->dstAddr = Node->flowKey.dst_addr.v4;
+        if (cold->mpls[0]) {
+            PushExtension(recordHeader, EXmplsLabel, mplsLabel);
+            for (int i = 0; cold->mpls[i] != 0; i++) {
+                mplsLabel->mplsLabel[i] = ntohl(cold->mpls[i]) >> 8;
+            }
         }
 
-        if (flowParam->extendedFlow) {
-            UpdateRecordSize(EXipInfoSize);
-            PushExtension(recordHeader, EXipInfo, ipInfo);
-            ipInfo->ttl = Node->ttl;
-            ipInfo->fragmentFlags = Node->fragmentFlags;
+        if (Node->flowKey.proto == IPPROTO_TCP && cold->latency.application) {
+            PushExtension(recordHeader, EXlatency, latency);
+            latency->usecClientNwDelay = cold->latency.client;
+            latency->usecServerNwDelay = cold->latency.server;
+            latency->usecApplLatency = cold->latency.application;
+            dbg_printf("Node RTT: %u\n", cold->latency.rtt);
+        }
 
-            if (Node->vlanID) {
-                UpdateRecordSize(EXvLanSize);
-                PushExtension(recordHeader, EXvLan, vlan);
-                vlan->srcVlan = Node->vlanID;
-            }
+        if (cold->pflog) {
+            pflog_hdr_t *pflog = (pflog_hdr_t *)cold->pflog;
+            size_t ifnameLen = PflogIfnameLen(pflog);
+            PushVarLengthExtension(recordHeader, EXpfinfo, pfinfo, ifnameLen);
+            pfinfo->action = pflog->action;
+            pfinfo->reason = pflog->reason;
+            pfinfo->dir = pflog->dir;
+            pfinfo->rewritten = pflog->rewritten;
+            pfinfo->uid = ntohl(pflog->uid);
+            pfinfo->pid = ntohl(pflog->pid);
+            pfinfo->rulenr = ntohl(pflog->rulenr);
+            pfinfo->subrulenr = ntohl(pflog->subrulenr);
+            memcpy(pfinfo->ifname, pflog->ifname, ifnameLen);
+            SetFlag(recordHeader->flags, V3_FLAG_EVENT);
+        }
+    }
 
-            if (Node->srcMac) {
-                UpdateRecordSize(EXmacAddrSize);
-                PushExtension(recordHeader, EXmacAddr, macAddr);
-                macAddr->inSrcMac = ntohll(Node->srcMac) >> 16;
-                macAddr->outDstMac = ntohll(Node->dstMac) >> 16;
-                macAddr->inDstMac = 0;
-                macAddr->outSrcMac = 0;
+    if (flowParam->addPayload) {
+        if (cold->payloadSize) {
+            payloadDict_t *payloadDict = fs->nffile->payloadDict;
+            uint32_t payloadID = payloadDict ? PayloadDictAdd(payloadDict, cold->payload, cold->payloadSize) : 0;
+            if (payloadID) {
+                PushExtension(recordHeader, EXpayloadRef, payloadRef);
+                payloadRef->inPayload = payloadID;
+            } else {
+                size_t payloadSize = PayloadLen(cold);
+                PushVarLengthPointer(recordHeader, EXinPayload, inPayload, payloadSize);
+                memcpy(inPayload, cold->payload, cold->payloadSize);
             }
+        }
+    }
 
-            if (Node->mpls[0]) {
-                UpdateRecordSize(EXmplsLabelSize);
-                PushExtension(recordHeader, EXmplsLabel, mplsLabel);
-                for (int i = 0; Node->mpls[i] != 0; i++) {
-                    mplsLabel->mplsLabel[i] = ntohl(Node->mpls[i]) >> 8;
-                }
-            }
+    if (cold->tun_ip_version == AF_INET) {
+        PushExtension(recordHeader, EXtunIPv4, tunIPv4);
+        tunIPv4->tunSrcAddr = cold->tun_src_addr.v4;
+        tunIPv4->tunDstAddr = cold->tun_dst_addr.v4;
+        tunIPv4->tunProto = cold->tun_proto;
+    } else if (cold->tun_ip_version == AF_INET6) {
+        PushExtension(recordHeader, EXtunIPv6, tunIPv6);
+        tunIPv6->tunSrcAddr[0] = cold->tun_src_addr.v6[0];
+        tunIPv6->tunSrcAddr[1] = cold->tun_src_addr.v6[1];
+        tunIPv6->tunDstAddr[0] = cold->tun_dst_addr.v6[0];
+        tunIPv6->tunDstAddr[1] = cold->tun_dst_addr.v6[1];
+        tunIPv6->tunProto = cold->tun_proto;
+    }
 
-            if (Node->flowKey.proto == IPPROTO_TCP && Node->latency.application) {
-                UpdateRecordSize(EXlatencySize);
-                PushExtension(recordHeader, EXlatency, latency);
-                latency->usecClientNwDelay = Node->latency.client;
-                latency->usecServerNwDelay = Node->latency.server;
-                latency->usecApplLatency = Node->latency.application;
-                dbg_printf("Node RTT: %u\n", Node->latency.rtt);
-            }
+    // update first_seen, last_seen
+    if (genericFlow->msecFirst < fs->msecFirst) fs->msecFirst = genericFlow->msecFirst;
+    if (genericFlow->msecLast > fs->msecLast) fs->msecLast = genericFlow->msecLast;
+
+    // Update stats
+    stat_record_t *stat_record = fs->nffile->stat_record;
+    switch (genericFlow->proto) {
+        case IPPROTO_ICMP:
+            stat_record->numflows_icmp++;
+            stat_record->numpackets_icmp += genericFlow->inPackets;
+            stat_record->numbytes_icmp += genericFlow->inBytes;
+            break;
+        case IPPROTO_TCP:
+            stat_record->numflows_tcp++;
+            stat_record->numpackets_tcp += genericFlow->inPackets;
+            stat_record->numbytes_tcp += genericFlow->inBytes;
+            break;
+        case IPPROTO_UDP:
+            stat_record->numflows_udp++;
+            stat_record->numpackets_udp += genericFlow->inPackets;
+            stat_record->numbytes_udp += genericFlow->inBytes;
+            break;
+        default:
+            stat_record->numflows_other++;
+            stat_record->numpackets_other += genericFlow->inPackets;
+            stat_record->numbytes_other += genericFlow->inBytes;
+    }
+    stat_record->numflows++;
+    stat_record->numpackets += genericFlow->inPackets;
+    stat_record->numbytes += genericFlow->inBytes;
 
-            if (Node->pflog) {
-                pflog_hdr_t *pflog = (pflog_hdr_t *)Node->pflog;
-                size_t ifnameLen = strnlen(pflog->ifname, IFNAMSIZ);
-                if (ifnameLen) {
-                    ifnameLen++;  // add terminating '\0'
-                }
-                size_t align = ifnameLen & 0x3;
-                if (align) {
-                    ifnameLen += 4 - align;
-                }
+    uint32_t exporterIdent = MetricExpporterID(recordHeader);
+    UpdateMetric(fs, exporterIdent, genericFlow);
 
-                UpdateRecordSize(EXpfinfoSize + ifnameLen);
-                PushVarLengthExtension(recordHeader, EXpfinfo, pfinfo, ifnameLen);
-                pfinfo->action = pflog->action;
-                pfinfo->reason = pflog->reason;
-                pfinfo->dir = pflog->dir;
-                pfinfo->rewritten = pflog->rewritten;
-                pfinfo->uid = ntohl(pflog->uid);
-                pfinfo->pid = ntohl(pflog->pid);
-                pfinfo->rulenr = ntohl(pflog->rulenr);
-                pfinfo->subrulenr = ntohl(pflog->subrulenr);
-                memcpy(pfinfo->ifname, pflog->ifname, ifnameLen);
-                SetFlag(recordHeader->flags, V3_FLAG_EVENT);
-            }
-        }
+    if (printRecord) {
+        flow_record_short(stdout, recordHeader);
+    }
 
-        if (flowParam->addPayload) {
-            if (Node->payloadSize) {
-                size_t payloadSize = Node->payloadSize;
-                size_t align = payloadSize & 0x3;
-                if (align) {
-                    payloadSize += 4 - align;
-                }
+    dbg_printf("Record header size: %u\n", recordHeader->size);
 
-                UpdateRecordSize(EXinPayloadSize + payloadSize);
-                PushVarLengthPointer(recordHeader, EXinPayload, inPayload, payloadSize);
-                memcpy(inPayload, Node->payload, Node->payloadSize);
-            }
-        }
+    return recordHeader->size;
 
-        if (Node->tun_ip_version == AF_INET) {
-            UpdateRecordSize(EXtunIPv4Size);
-            PushExtension(recordHeader, EXtunIPv4, tunIPv4);
-            tunIPv4->tunSrcAddr = Node->tun_src_addr.v4;
-            tunIPv4->tunDstAddr = Node->tun_dst_addr.v4;
-            tunIPv4->tunProto = Node->tun_proto;
-        } else if (Node->tun_ip_version == AF_INET6) {
-            UpdateRecordSize(EXtunIPv6Size);
-            PushExtension(recordHeader, EXtunIPv6, tunIPv6);
-            tunIPv6->tunSrcAddr[0] = Node->tun_src_addr.v6[0];
-            tunIPv6->tunSrcAddr[1] = Node->tun_src_addr.v6[1];
-            tunIPv6->tunDstAddr[0] = Node->tun_dst_addr.v6[0];
-            tunIPv6->tunDstAddr[1] = Node->tun_dst_addr.v6[1];
-            tunIPv6->tunProto = Node->tun_proto;
-        }
+}  // End of EncodePcapFlow
 
-        // update first_seen, last_seen
-        if (genericFlow->msecFirst < fs->msecFirst) fs->msecFirst = genericFlow->msecFirst;
-        if (genericFlow->msecLast > fs->msecLast) fs->msecLast = genericFlow->msecLast;
-
-        // Update stats
-        stat_record_t *stat_record = fs->nffile->stat_record;
-        switch (genericFlow->proto) {
-            case IPPROTO_ICMP:
-                stat_record->numflows_icmp++;
-                stat_record->numpackets_icmp += genericFlow->inPackets;
-                stat_record->numbytes_icmp += genericFlow->inBytes;
-                break;
-            case IPPROTO_TCP:
-                stat_record->numflows_tcp++;
-                stat_record->numpackets_tcp += genericFlow->inPackets;
-                stat_record->numbytes_tcp += genericFlow->inBytes;
-                break;
-            case IPPROTO_UDP:
-                stat_record->numflows_udp++;
-                stat_record->numpackets_udp += genericFlow->inPackets;
-                stat_record->numbytes_udp += genericFlow->inBytes;
-                break;
-            default:
-                stat_record->numflows_other++;
-                stat_record->numpackets_other += genericFlow->inPackets;
-                stat_record->numbytes_other += genericFlow->inBytes;
+// store the run of flow nodes starting at Node into the data block and return the nodes.
+// Returns the first node, which is not a flow node, or NULL at the end of the list
+static struct FlowNode *StorePcapFlows(flowParam_t *flowParam, struct FlowNode *Node) {
+    FlowSource_t *fs = flowParam->fs;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t msecReceived = (uint64_t)now.tv_sec * 1000LL + (uint64_t)now.tv_usec / 1000LL;
+
+    while (Node && Node->nodeType == FLOW_NODE) {
+        // collect all records, which fit into the current block, when the payloads are resolved
+        if (fs->dataBlock->NumRecords == 0) flowParam->blockExpansion = 0;
+        uint32_t usedSize = fs->dataBlock->size + flowParam->blockExpansion;
+        uint32_t capacity = BlockCapacity(fs->dataBlock);
+        uint32_t availableSize = usedSize < capacity ? capacity - usedSize : 0;
+        uint32_t batchSize = 0;
+        uint32_t numRecords = 0;
+        struct FlowNode *last = Node;
+        while (last && last->nodeType == FLOW_NODE) {
+            uint32_t recordSize = PcapFlowSize(flowParam, last);
+            if ((batchSize + recordSize) >= availableSize) break;
+            batchSize += recordSize;
+            numRecords++;
+            last = last->right;
         }
-        stat_record->numflows++;
-        stat_record->numpackets += genericFlow->inPackets;
-        stat_record->numbytes += genericFlow->inBytes;
 
-        uint32_t exporterIdent = MetricExpporterID(recordHeader);
-        UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
+        if (numRecords == 0) {
+            if (fs->dataBlock->NumRecords == 0) {
+                // fishy! - should never happen. maybe disk full?
+                LogError("StorePcapFlows(): output buffer size error. Skip record");
+                struct FlowNode *next = Node->right;
+                Return_Node(Node);
+                Node = next;
+            } else {
+                // flush block - get an empty one
+                fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+            }
+            continue;
+        }
 
-        if (printRecord) {
-            flow_record_short(stdout, recordHeader);
+        void *buffPtr = GetCurrentCursor(fs->dataBlock);
+        while (Node != last) {
+            struct FlowNode *next = Node->right;
+            buffPtr += EncodePcapFlow(flowParam, Node, buffPtr, msecReceived);
+            Return_Node(Node);
+            Node = next;
         }
+        uint32_t encodedSize = buffPtr - GetCurrentCursor(fs->dataBlock);
+        assert(encodedSize <= batchSize);
+        flowParam->blockExpansion += batchSize - encodedSize;
 
         // update file record size ( -> output buffer size )
-        fs->dataBlock->NumRecords += 1;
-        fs->dataBlock->size += recordHeader->size;
-
-        dbg_printf("Record size: %u, header size: %u\n", recordSize, recordHeader->size);
-
-        assert(recordHeader->size == recordSize);
-        break;
-
-    } while (1);
+        fs->dataBlock->NumRecords += numRecords;
+        fs->dataBlock->size += encodedSize;
+    }
 
-    return 1;
+    return Node;
 
-} /* End of StorePcapFlow */
+}  // End of StorePcapFlows
 
 static inline int CloseFlowFile(flowParam_t *flowParam, time_t timestamp) {
     char FullName[MAXPATHLEN];
@@ -344,6 +412,8 @@ static inline int CloseFlowFile(flowParam_t *flowParam, time_t timestamp) {
         // Update books
         stat(FullName, &fstat);
         UpdateBooks(fs->bookkeeper, timestamp, 512 * fstat.st_blocks);
+        AppendFileIndex(fs->datadir, FullName, 512 * fstat.st_blocks);
+        AppendCatalog(fs->datadir, FullName);
     }
 
     LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu", fs->Ident, (unsigned long long)fs->nffile->stat_record->numflows,
@@ -367,6 +437,8 @@ __attribute__((noreturn)) void *flow_thread(void *thread_data) {
     FlowSource_t *fs = flowParam->fs;
 
     printRecord = flowParam->printRecord;
+    PinWorker();
+
     // prepare file
     fs->nffile = OpenNewFile(fs->current, NULL, CREATOR_NFPCAPD, compress, NOT_ENCRYPTED);
     if (!fs->nffile) {
@@ -374,44 +446,59 @@ __attribute__((noreturn)) void *flow_thread(void *thread_data) {
         pthread_exit((void *)flowParam);
     }
     SetIdent(fs->nffile, fs->Ident);
+    if (flowParam->payloadDict) EnablePayloadDict(fs->nffile);
 
     // init flow source
     fs->dataBlock = WriteBlock(fs->nffile, NULL);
     fs->bad_packets = 0;
     fs->msecFirst = 0xffffffffffffLL;
     fs->msecLast = 0;
-    while (1) {
-        struct FlowNode *Node = Pop_Node(flowParam->NodeList);
-        if (Node->signal == SIGNAL_SYNC) {
-            // Flush Exporter Stat to file
-            FlushExporterStats(fs);
-            // flush current block and close file
-            fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
-            CloseFlowFile(flowParam, Node->timestamp);
-            fs->nffile = OpenNewFile(fs->current, fs->nffile, CREATOR_NFPCAPD, compress, NOT_ENCRYPTED);
-            if (!fs->nffile) {
-                LogError("Fatal: OpenNewFile() failed for ident: %s", fs->Ident);
-                pthread_kill(flowParam->parent, SIGUSR1);
-                break;
+    int done = 0;
+    while (!done) {
+        struct FlowNode *Node = Pop_NodeList(flowParam->NodeList);
+        while (Node) {
+            if (Node->nodeType == FLOW_NODE && !done) {
+                Node = StorePcapFlows(flowParam, Node);
+                continue;
             }
-            SetIdent(fs->nffile, fs->Ident);
 
-            // Dump all exporters to the buffer for new file
-            FlushStdRecords(fs);
+            struct FlowNode *next = Node->right;
+            if (done) {
+                // skip this node
+            } else if (Node->signal == SIGNAL_SYNC) {
+                // Flush Exporter Stat to file
+                FlushExporterStats(fs);
+                // flush current block and close file
+                fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+                CloseFlowFile(flowParam, Node->timestamp);
+                fs->nffile = OpenNewFile(fs->current, fs->nffile, CREATOR_NFPCAPD, compress, NOT_ENCRYPTED);
+                if (!fs->nffile) {
+                    LogError("Fatal: OpenNewFile() failed for ident: %s", fs->Ident);
+                    pthread_kill(flowParam->parent, SIGUSR1);
+                    done = 1;
+                } else {
+                    SetIdent(fs->nffile, fs->Ident);
+                    if (flowParam->payloadDict) EnablePayloadDict(fs->nffile);
+
+                    // Dump all exporters to the buffer for new file
+                    FlushStdRecords(fs);
+                }
 
-        } else if (Node->signal == SIGNAL_DONE) {
-            // Flush Exporter Stat to file
-            FlushExporterStats(fs);
-            // flush current block and close file
-            FlushBlock(fs->nffile, fs->dataBlock);
-            CloseFlowFile(flowParam, Node->timestamp);
-            break;
-        } else if (Node->nodeType == FLOW_NODE) {
-            StorePcapFlow(flowParam, Node);
-        } else {
-            // skip this node
+            } else if (Node->signal == SIGNAL_DONE) {
+                // flows dropped while flushing the flow cache
+                LogNodeDrops(flowParam->NodeList);
+                // Flush Exporter Stat to file
+                FlushExporterStats(fs);
+                // flush current block and close file
+                FlushBlock(fs->nffile, fs->dataBlock);
+                CloseFlowFile(flowParam, Node->timestamp);
+                done = 1;
+            } else {
+                // skip this node
+            }
+            Return_Node(Node);
+            Node = next;
         }
-        Free_Node(Node);
     }
 
     DisposeFile(fs->nffile);
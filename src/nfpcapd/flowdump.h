@@ -57,11 +57,16 @@ typedef struct flowParam_s {
 
     // send flows
     repeater_t *sendHost;
+    int sendBatch;  // LZ4 compressed batches over TCP
 
     // options
     int printRecord;
     int extendedFlow;
     int addPayload;
+    int payloadDict;
+
+    // resolved payload references grow the current data block by this size
+    uint32_t blockExpansion;
 } flowParam_t;
 
 __attribute__((noreturn)) void *flow_thread(void *thread_data);
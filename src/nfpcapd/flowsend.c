@@ -60,17 +60,43 @@
 #include "queue.h"
 #include "util.h"
 
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#else
+#include "lz4.h"
+#endif
+
 static int printRecord = 0;
 #include "nffile_inline.c"
 
-#define UpdateRecordSize(s) \
-    recordSize += (s);      \
-    if (recordSize > availableSize) continue;
-
 static void *sendBuffer = NULL;
 static uint32_t sequence = 0;
 
-static int ProcessFlow(flowParam_t *flowParam, struct FlowNode *Node);
+// send the buffer, if it exceeds this size - prevent fragmentation
+#define SENDTHRESHOLD 1200
+
+/*
+ * Batch mode: the records are collected in a batch of up to NFD_MAXBATCH bytes
+ * and sent LZ4 compressed over a TCP connection. A batch is sent, if it exceeds
+ * BATCHTHRESHOLD bytes or is older than BATCHLATENCY msec. If the connection
+ * is lost, the batches are dropped until it is reestablished.
+ */
+#define BATCHTHRESHOLD (192 * 1024)
+#define BATCHLATENCY 1000
+#define RECONNECTWAIT 10
+
+static void *batchBuffer = NULL;
+static uint32_t batchSize = 0;
+static uint32_t batchRecords = 0;
+static uint64_t batchStart = 0;
+static time_t lastConnect = 0;
+static uint64_t droppedBatches = 0;
+
+static uint32_t SendFlowSize(flowParam_t *flowParam, struct FlowNode *Node);
+
+static uint32_t EncodeSendFlow(flowParam_t *flowParam, struct FlowNode *Node, void *buffPtr, uint64_t msecReceived);
+
+static struct FlowNode *ProcessFlows(flowParam_t *flowParam, struct FlowNode *Node);
 
 static int SendFlow(repeater_t *sendHost, nfd_header_t *pcapd_header) {
     dbg_printf("Sending %u records\n", pcapd_header->numRecord);
@@ -80,143 +106,296 @@ static int SendFlow(repeater_t *sendHost, nfd_header_t *pcapd_header) {
     pcapd_header->numRecord = htonl(pcapd_header->numRecord);
     // send buffer
     ssize_t len = sendto(sendHost->sockfd, pcapd_header, length, 0, (struct sockaddr *)&(sendHost->addr), sendHost->addrlen);
+
+    // init new header - the records of a failed send are dropped
+    pcapd_header->length = sizeof(nfd_header_t);
+    pcapd_header->numRecord = 0;
+
     if (len < 0) {
         LogError("ERROR: sendto() failed: %s", strerror(errno));
         return len;
     }
 
-    // init new header
-    pcapd_header->length = sizeof(nfd_header_t);
-    pcapd_header->numRecord = 0;
-
     return 0;
 
 }  // End of SendFlow
 
-static int ProcessFlow(flowParam_t *flowParam, struct FlowNode *Node) {
-    repeater_t *sendHost = flowParam->sendHost;
+// write the complete buffer to the stream connection
+static int StreamSend(repeater_t *sendHost, void *buff, size_t len) {
+    while (len) {
+        ssize_t ret = send(sendHost->sockfd, buff, len, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LogError("ERROR: send() to %s failed: %s", sendHost->hostname, strerror(errno));
+            close(sendHost->sockfd);
+            sendHost->sockfd = -1;
+            return -1;
+        }
+        buff += ret;
+        len -= ret;
+    }
+    return 0;
 
-    dbg_printf("Send Flow node\n");
+}  // End of StreamSend
+
+// compress and send numRecords records. If they do not fit into one message, split them up
+static int SendRecords(repeater_t *sendHost, void *records, uint32_t size, uint32_t numRecords) {
+    nfd_batch_header_t *batch_header = (nfd_batch_header_t *)sendBuffer;
+    int maxSize = 65535 - sizeof(nfd_batch_header_t);
+    int len = LZ4_compress_default(records, sendBuffer + sizeof(nfd_batch_header_t), size, maxSize);
+    if (len <= 0) {
+        if (numRecords == 1) {
+            LogError("SendRecords(): record size error. Skip record");
+            return 0;
+        }
+        // split the records into two halves
+        uint32_t splitSize = 0;
+        for (uint32_t i = 0; i < numRecords / 2; i++) splitSize += ((recordHeaderV3_t *)(records + splitSize))->size;
+        if (SendRecords(sendHost, records, splitSize, numRecords / 2) < 0) return -1;
+        return SendRecords(sendHost, records + splitSize, size - splitSize, numRecords - numRecords / 2);
+    }
 
-    nfd_header_t *pcapd_header = (nfd_header_t *)sendBuffer;
-    void *buffPtr = sendBuffer + pcapd_header->length;
-    uint32_t recordSize = 0;
-    do {
-        size_t availableSize = 65535 - pcapd_header->length;
-        if (recordSize > availableSize || availableSize < 150) {
-            if (SendFlow(sendHost, pcapd_header) < 0) return 0;
-            continue;
+    batch_header->version = htons(NFD_PROTOCOL_LZ4);
+    batch_header->length = htons(len + sizeof(nfd_batch_header_t));
+    batch_header->exportTime = htonl(time(NULL));
+    batch_header->lastSequence = htonl(sequence++);
+    batch_header->numRecord = htonl(numRecords);
+    batch_header->rawLength = htonl(size);
+    dbg_printf("Sending batch: %u records, size: %u, compressed: %d\n", numRecords, size, len);
+
+    return StreamSend(sendHost, sendBuffer, len + sizeof(nfd_batch_header_t));
+
+}  // End of SendRecords
+
+static void SendBatch(repeater_t *sendHost) {
+    if (batchRecords == 0) return;
+
+    if (sendHost->sockfd < 0) {
+        // connection lost - try to reconnect
+        time_t now = time(NULL);
+        if ((now - lastConnect) >= RECONNECTWAIT) {
+            lastConnect = now;
+            sendHost->sockfd = Stream_send_socket(sendHost->hostname, sendHost->port, AF_UNSPEC, 0);
+            if (sendHost->sockfd >= 0) LogInfo("Reconnected to %s port %s", sendHost->hostname, sendHost->port);
         }
-        recordSize = 0;
-
-        // map output record to memory buffer
-        UpdateRecordSize(V3HeaderRecordSize);
-        AddV3Header(buffPtr, recordHeader);
-
-        // header data
-        recordHeader->nfversion = 0x41;
-        recordHeader->engineType = 0x11;
-        recordHeader->engineID = 1;
-        recordHeader->exporterID = 0;
-
-        // pack V3 record
-        UpdateRecordSize(EXgenericFlowSize);
-        PushExtension(recordHeader, EXgenericFlow, genericFlow);
-        genericFlow->msecFirst = (1000 * Node->t_first.tv_sec) + Node->t_first.tv_usec / 1000;
-        genericFlow->msecLast = (1000 * Node->t_last.tv_sec) + Node->t_last.tv_usec / 1000;
-
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        genericFlow->msecReceived = now.tv_sec * 1000L + now.tv_usec / 1000;
-
-        genericFlow->inPackets = Node->packets;
-        genericFlow->inBytes = Node->bytes;
-
-        genericFlow->tcpFlags = Node->flags;
-        genericFlow->proto = Node->flowKey.proto;
-        genericFlow->srcPort = Node->flowKey.src_port;
-        genericFlow->dstPort = Node->flowKey.dst_port;
-
-        if (Node->flowKey.version == AF_INET6) {
-            UpdateRecordSize(EXipv6FlowSize);
-            PushExtension(recordHeader, EXipv6Flow, ipv6Flow);
-            ipv6Flow->srcAddr[0] = Node->flowKey.src_addr.v6[0];
-            ipv6Flow->srcAddr[1] = Node->flowKey.src_addr.v6[1];
-            ipv6Flow->dstAddr[0] = Node->flowKey.dst_addr.v6[0];
-            ipv6Flow->dstAddr[1] = Node->flowKey.dst_addr.v6[1];
-        } else {
-            UpdateRecordSize(EXipv4FlowSize);
-            PushExtension(recordHeader, EXipv4Flow, ipv4Flow);
-            ipv4Flow->srcAddr = Node->flowKey.src_addr.v4;
-            ipv4Flow->dstAddr = Node->flowKey.dst_addr.v4;
+    }
+
+    if (sendHost->sockfd < 0 || SendRecords(sendHost, batchBuffer, batchSize, batchRecords) < 0) {
+        // the sequence gap tells the collector about the lost records
+        sequence++;
+        if ((droppedBatches++ % 100) == 0) LogError("Connection to %s lost - dropped %llu batches", sendHost->hostname, (unsigned long long)droppedBatches);
+    }
+
+    batchSize = 0;
+    batchRecords = 0;
+
+}  // End of SendBatch
+
+// size of the V3 record, EncodeSendFlow() creates for this node
+static uint32_t SendFlowSize(flowParam_t *flowParam, struct FlowNode *Node) {
+    const struct flowNodeCold_s *cold = ColdData(Node);
+    uint32_t recordSize = V3HeaderRecordSize + EXgenericFlowSize;
+    recordSize += Node->flowKey.version == AF_INET6 ? EXipv6FlowSize : EXipv4FlowSize;
+
+    if (flowParam->extendedFlow) {
+        if (cold->vlanID) recordSize += EXvLanSize;
+        recordSize += EXmacAddrSize;
+        if (cold->mpls[0]) recordSize += EXmplsLabelSize;
+        if (Node->flowKey.proto == IPPROTO_TCP) recordSize += EXlatencySize;
+    }
+
+    if (flowParam->addPayload && cold->payloadSize) recordSize += EXinPayloadSize + cold->payloadSize;
+
+    return recordSize;
+
+}  // End of SendFlowSize
+
+// encode the node into buffPtr. The caller guarantees, that SendFlowSize() bytes are available
+static uint32_t EncodeSendFlow(flowParam_t *flowParam, struct FlowNode *Node, void *buffPtr, uint64_t msecReceived) {
+    const struct flowNodeCold_s *cold = ColdData(Node);
+    dbg_printf("Send Flow node\n");
+
+    // map output record to memory buffer
+    AddV3Header(buffPtr, recordHeader);
+
+    // header data
+    recordHeader->nfversion = 0x41;
+    recordHeader->engineType = 0x11;
+    recordHeader->engineID = 1;
+    recordHeader->exporterID = 0;
+
+    // pack V3 record
+    PushExtension(recordHeader, EXgenericFlow, genericFlow);
+    genericFlow->msecFirst = (1000 * Node->t_first.tv_sec) + Node->t_first.tv_usec / 1000;
+    genericFlow->msecLast = (1000 * Node->t_last.tv_sec) + Node->t_last.tv_usec / 1000;
+    genericFlow->msecReceived = msecReceived;
+
+    genericFlow->inPackets = Node->packets;
+    genericFlow->inBytes = Node->bytes;
+
+    genericFlow->tcpFlags = Node->flags;
+    genericFlow->proto = Node->flowKey.proto;
+    genericFlow->srcPort = Node->flowKey.src_port;
+    genericFlow->dstPort = Node->flowKey.dst_port;
+
+    if (Node->flowKey.version == AF_INET6) {
+        PushExtension(recordHeader, EXipv6Flow, ipv6Flow);
+        ipv6Flow->srcAddr[0] = Node->flowKey.src_addr.v6[0];
+        ipv6Flow->srcAddr[1] = Node->flowKey.src_addr.v6[1];
+        ipv6Flow->dstAddr[0] = Node->flowKey.dst_addr.v6[0];
+        ipv6Flow->dstAddr[1] = Node->flowKey.dst_addr.v6[1];
+    } else {
+        PushExtension(recordHeader, EXipv4Flow, ipv4Flow);
+        ipv4Flow->srcAddr = Node->flowKey.src_addr.v4;
+        ipv4Flow->dstAddr = Node->flowKey.dst_addr.v4;
+    }
+
+    if (flowParam->extendedFlow) {
+        if (cold->vlanID) {
+            PushExtension(recordHeader, EXvLan, vlan);
+            vlan->dstVlan = cold->vlanID;
         }
 
-        if (flowParam->extendedFlow) {
-            if (Node->vlanID) {
-                UpdateRecordSize(EXvLanSize);
-                PushExtension(recordHeader, EXvLan, vlan);
-                vlan->dstVlan = Node->vlanID;
-            }
+        PushExtension(recordHeader, EXmacAddr, macAddr);
+        macAddr->inSrcMac = ntohll(cold->srcMac) >> 16;
+        macAddr->outDstMac = ntohll(cold->dstMac) >> 16;
+        macAddr->inDstMac = 0;
+        macAddr->outSrcMac = 0;
 
-            UpdateRecordSize(EXmacAddrSize);
-            PushExtension(recordHeader, EXmacAddr, macAddr);
-            macAddr->inSrcMac = ntohll(Node->srcMac) >> 16;
-            macAddr->outDstMac = ntohll(Node->dstMac) >> 16;
-            macAddr->inDstMac = 0;
-            macAddr->outSrcMac = 0;
-
-            if (Node->mpls[0]) {
-                UpdateRecordSize(EXmplsLabelSize);
-                PushExtension(recordHeader, EXmplsLabel, mplsLabel);
-                for (int i = 0; Node->mpls[i] != 0; i++) {
-                    mplsLabel->mplsLabel[i] = ntohl(Node->mpls[i]) >> 8;
-                }
+        if (cold->mpls[0]) {
+            PushExtension(recordHeader, EXmplsLabel, mplsLabel);
+            for (int i = 0; cold->mpls[i] != 0; i++) {
+                mplsLabel->mplsLabel[i] = ntohl(cold->mpls[i]) >> 8;
             }
+        }
 
-            if (Node->flowKey.proto == IPPROTO_TCP) {
-                UpdateRecordSize(EXlatencySize);
-                PushExtension(recordHeader, EXlatency, latency);
-                latency->usecClientNwDelay = Node->latency.client;
-                latency->usecServerNwDelay = Node->latency.server;
-                latency->usecApplLatency = Node->latency.application;
-            }
+        if (Node->flowKey.proto == IPPROTO_TCP) {
+            PushExtension(recordHeader, EXlatency, latency);
+            latency->usecClientNwDelay = cold->latency.client;
+            latency->usecServerNwDelay = cold->latency.server;
+            latency->usecApplLatency = cold->latency.application;
+        }
+    }
+
+    if (flowParam->addPayload) {
+        if (cold->payloadSize) {
+            PushVarLengthPointer(recordHeader, EXinPayload, inPayload, cold->payloadSize);
+            memcpy(inPayload, cold->payload, cold->payloadSize);
+        }
+    }
+
+    if (printRecord) {
+        flow_record_short(stdout, recordHeader);
+    }
+
+    dbg_printf("Record header size: %u\n", recordHeader->size);
+
+    return recordHeader->size;
+
+}  // End of EncodeSendFlow
+
+// pack the run of flow nodes starting at Node into send buffers and return the nodes.
+// Returns the first signal node, or NULL at the end of the list
+static struct FlowNode *ProcessFlows(flowParam_t *flowParam, struct FlowNode *Node) {
+    repeater_t *sendHost = flowParam->sendHost;
+    nfd_header_t *pcapd_header = (nfd_header_t *)sendBuffer;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t msecReceived = (uint64_t)now.tv_sec * 1000LL + (uint64_t)now.tv_usec / 1000LL;
+
+    while (Node && Node->nodeType != SIGNAL_NODE) {
+        // collect the records for the next packet
+        uint32_t availableSize = 65535 - pcapd_header->length;
+        uint32_t batchSize = 0;
+        uint32_t numRecords = 0;
+        struct FlowNode *last = Node;
+        while (last && last->nodeType != SIGNAL_NODE) {
+            uint32_t recordSize = SendFlowSize(flowParam, last);
+            if ((batchSize + recordSize) > availableSize) break;
+            batchSize += recordSize;
+            numRecords++;
+            last = last->right;
+            if ((pcapd_header->length + batchSize) > SENDTHRESHOLD) break;
         }
 
-        if (flowParam->addPayload) {
-            if (Node->payloadSize) {
-                UpdateRecordSize(EXinPayloadSize + Node->payloadSize);
-                PushVarLengthPointer(recordHeader, EXinPayload, inPayload, Node->payloadSize);
-                memcpy(inPayload, Node->payload, Node->payloadSize);
+        if (numRecords == 0) {
+            if (pcapd_header->numRecord == 0) {
+                LogError("ProcessFlows(): record size error. Skip record");
+                struct FlowNode *next = Node->right;
+                Return_Node(Node);
+                Node = next;
+            } else {
+                SendFlow(sendHost, pcapd_header);
             }
+            continue;
         }
 
-        if (printRecord) {
-            flow_record_short(stdout, recordHeader);
+        void *buffPtr = sendBuffer + pcapd_header->length;
+        while (Node != last) {
+            struct FlowNode *next = Node->right;
+            buffPtr += EncodeSendFlow(flowParam, Node, buffPtr, msecReceived);
+            Return_Node(Node);
+            Node = next;
         }
+        assert(buffPtr == (sendBuffer + pcapd_header->length + batchSize));
+
+        // update packet size
+        pcapd_header->numRecord += numRecords;
+        pcapd_header->length += batchSize;
+
+        if (pcapd_header->length > SENDTHRESHOLD) {
+            // send buffer - prevent fragmentation for next packet
+            SendFlow(sendHost, pcapd_header);
+        }
+    }
 
-        // update file record size ( -> output buffer size )
-        pcapd_header->numRecord++;
-        pcapd_header->length += recordHeader->size;
+    return Node;
 
-        dbg_printf("Record size: %u, header size: %u\n", recordSize, recordHeader->size);
+}  // End of ProcessFlows
 
-        assert(recordHeader->size == recordSize);
-        break;
+// pack the run of flow nodes starting at Node into the batch and return the nodes.
+// Returns the first signal node, or NULL at the end of the list
+static struct FlowNode *ProcessBatch(flowParam_t *flowParam, struct FlowNode *Node) {
+    repeater_t *sendHost = flowParam->sendHost;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t msecReceived = (uint64_t)now.tv_sec * 1000LL + (uint64_t)now.tv_usec / 1000LL;
+
+    while (Node && Node->nodeType != SIGNAL_NODE) {
+        struct FlowNode *next = Node->right;
+        uint32_t recordSize = SendFlowSize(flowParam, Node);
+        if ((batchSize + recordSize) > NFD_MAXBATCH) SendBatch(sendHost);
 
-    } while (1);
+        if (recordSize <= NFD_MAXBATCH) {
+            if (batchRecords == 0) batchStart = msecReceived;
+            batchSize += EncodeSendFlow(flowParam, Node, batchBuffer + batchSize, msecReceived);
+            batchRecords++;
+        } else {
+            LogError("ProcessBatch(): record size error. Skip record");
+        }
+        Return_Node(Node);
+        Node = next;
 
-    if (pcapd_header->length > 1200) {
-        // send buffer - prevent fragmentation for next packet
-        if (SendFlow(sendHost, pcapd_header) < 0) return 0;
+        if (batchSize > BATCHTHRESHOLD) SendBatch(sendHost);
     }
 
-    return 1;
+    if (batchRecords && (msecReceived - batchStart) >= BATCHLATENCY) SendBatch(sendHost);
 
-} /* End of ProcessFlow */
+    return Node;
+
+}  // End of ProcessBatch
 
 static inline int CloseSender(flowParam_t *flowParam, time_t timestamp) {
     repeater_t *sendHost = flowParam->sendHost;
 
+    if (flowParam->sendBatch) {
+        SendBatch(sendHost);
+        if (droppedBatches) LogInfo("Dropped %llu batches in total", (unsigned long long)droppedBatches);
+        if (sendHost->sockfd < 0) return 0;
+    }
+
     return close(sendHost->sockfd);
 
 }  // end of CloseFlowFile
@@ -232,18 +411,40 @@ __attribute__((noreturn)) void *sendflow_thread(void *thread_data) {
     pcapd_header->length = sizeof(nfd_header_t);
     pcapd_header->lastSequence = 1;
 
+    if (flowParam->sendBatch) {
+        batchBuffer = malloc(NFD_MAXBATCH);
+        if (!batchBuffer) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        lastConnect = time(NULL);
+    }
+
     printRecord = flowParam->printRecord;
-    while (1) {
-        struct FlowNode *Node = Pop_Node(flowParam->NodeList);
-        if (Node->signal == SIGNAL_SYNC) {
-            // skip
-        } else if (Node->signal == SIGNAL_DONE) {
-            CloseSender(flowParam, Node->timestamp);
-            break;
-        } else {
-            ProcessFlow(flowParam, Node);
+    int done = 0;
+    while (!done) {
+        struct FlowNode *Node = Pop_NodeList(flowParam->NodeList);
+        while (Node) {
+            if (Node->nodeType != SIGNAL_NODE && !done) {
+                Node = flowParam->sendBatch ? ProcessBatch(flowParam, Node) : ProcessFlows(flowParam, Node);
+                continue;
+            }
+
+            struct FlowNode *next = Node->right;
+            if (done) {
+                // skip this node
+            } else if (Node->signal == SIGNAL_DONE) {
+                // flows dropped while flushing the flow cache
+                LogNodeDrops(flowParam->NodeList);
+                CloseSender(flowParam, Node->timestamp);
+                done = 1;
+            } else if (flowParam->sendBatch) {
+                // SIGNAL_SYNC - send the pending batch
+                SendBatch(flowParam->sendHost);
+            }
+            Return_Node(Node);
+            Node = next;
         }
-        Free_Node(Node);
     }
 
     LogInfo("Terminating flow sending");
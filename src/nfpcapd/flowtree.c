@@ -27,7 +27,6 @@
  *  POSSIBILITY OF SUCH DAMAGE.
  *
  */
-
 #include "flowtree.h"
 
 #include <assert.h>
@@ -48,75 +47,128 @@
 #include "nffile.h"
 #include "util.h"
 
-static int ExtendCache(void);
-
-static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2);
-
-static void DumpTreeStat(NodeList_t *NodeList);
-
-// Insert the IP RB tree code here
-RB_GENERATE(FlowTree, FlowNode, entry, FlowNodeCMP);
-
 // Flow Cache to store all nodes
-#define EXPIREINTERVALL 10
+#define EXPIREINTERVALL 1
 #define DefaultCacheSize (512 * 1024)
 #define ExtentSize 4096
 #define MaxSize (1024 * 1024 * 512)
-static uint32_t FlowCacheSize = 0;
-static time_t lastExpire = 0;
+static uint32_t InitCacheSize = DefaultCacheSize;
 static uint32_t expireActiveTimeout = 300;
 static uint32_t expireInactiveTimeout = 60;
-static struct FlowNode *FlowElementCache = NULL;
-
-// free list
-static struct FlowNode *FlowNode_FreeList = NULL;
-static pthread_mutex_t m_FreeList = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t c_FreeList = PTHREAD_COND_INITIALIZER;
-static uint32_t EmptyFreeList = 0;
-static uint32_t EmptyFreeListEvents = 0;
-static uint32_t Allocated = 0;
-
-// Flow tree
-static FlowTree_t *FlowTree = NULL;
-static int NumFlows = 0;
-static flowTreeStat_t flowTreeStat = {0};
-
-// Simple unprotected list
-typedef struct FlowNode_list_s {
-    struct FlowNode *list;
-    struct FlowNode *tail;
-    uint32_t size;
-} Linked_list_t;
 
-/* Free list handling functions */
-// Get next free node from free list
-struct FlowNode *New_Node(void) {
+_Static_assert(sizeof(struct FlowNode) == 128, "Hot part of the flow node must fit into two cache lines");
+
+const struct flowNodeCold_s flowNodeNoCold = {0};
+
+/*
+ * Flow table: open addressing hash table with linear probing, keyed by the flow key.
+ * Each slot holds the hash of the key, so probing compares the keys of matching
+ * hashes only. Nodes are removed by backward shifting, so no tombstones are needed.
+ */
+typedef struct flowSlot_s {
+    uint64_t hash;
     struct FlowNode *node;
+} flowSlot_t;
 
-    pthread_mutex_lock(&m_FreeList);
-    while (FlowNode_FreeList == NULL) {
-        EmptyFreeList = 1;
-        EmptyFreeListEvents++;
-        if (FlowCacheSize < MaxSize) {
+/*
+ * Expire timer wheel: one slot per second. Each node is linked into the slot of its
+ * earliest possible expire time. When the slot is due, the node is either expired or
+ * relinked into the slot of its updated expire time, as the flow got packets since.
+ * The wheel is hierarchical: the inner wheel holds the next WHEELSIZE seconds, the
+ * outer wheel one slot per WHEELSIZE seconds beyond. An outer slot is cascaded into
+ * the inner wheel, when its time range becomes due. Both wheels share one slot array,
+ * the outer slots follow the inner slots.
+ */
+#define WHEELBITS 8
+#define WHEELSIZE (1 << WHEELBITS)
+#define OUTERSIZE 64
+#define WHEELSLOTS (WHEELSIZE + OUTERSIZE)
+
+/*
+ * A flow tree is owned by one packet thread, which allocates and frees nodes from
+ * its local free list without locking. The flow thread returns the processed nodes
+ * in batches into the shared free list, which the packet thread takes over as a
+ * whole, once its local free list runs empty.
+ */
+#define RETURNBATCH 256
+struct flowTree_s {
+    struct flowTree_s *next;
+
+    // flow table
+    flowSlot_t *FlowTable;
+    uint32_t FlowTableMask;
+    int NumFlows;
+    flowTreeStat_t flowTreeStat;
+
+    // expire timer wheel
+    struct FlowNode *ExpireWheel[WHEELSLOTS];
+    time_t wheelTime;  // last second processed
+    time_t lastExpire;
+
+    // local free list - packet thread only
+    struct FlowNode *localFreeList;
+    uint32_t FlowCacheSize;
+    uint32_t EmptyFreeListEvents;
+    uint32_t Allocated;
+
+    // returned nodes - flow thread only
+    struct FlowNode *returnList;
+    struct FlowNode *returnTail;
+    uint32_t returnCount;
+
+    // shared free list
+    struct FlowNode *FlowNode_FreeList;
+    uint32_t FreeListSize;
+    pthread_mutex_t m_FreeList;
+    pthread_cond_t c_FreeList;
+    uint32_t EmptyFreeList;
+};
+
+// all flow trees. Built before the threads start
+static flowTree_t *flowTreeList = NULL;
+
+static int ExtendCache(flowTree_t *flowTree);
+
+static void DumpTreeStat(flowTree_t *flowTree, NodeList_t *NodeList);
+
+/* Free list handling functions */
+// take over all returned nodes of the shared free list or extend the cache
+static void RefillFreeList(flowTree_t *flowTree) {
+    pthread_mutex_lock(&flowTree->m_FreeList);
+    while (flowTree->FlowNode_FreeList == NULL) {
+        flowTree->EmptyFreeListEvents++;
+        if (flowTree->FlowCacheSize < MaxSize) {
+            pthread_mutex_unlock(&flowTree->m_FreeList);
             dbg_printf("Auto expand flow cache\n");
-            if (!ExtendCache()) abort();
-        } else {
-            LogError("Max cache size reached");
-            pthread_cond_wait(&c_FreeList, &m_FreeList);
+            if (!ExtendCache(flowTree)) abort();
+            return;
         }
+        LogError("Max cache size reached");
+        flowTree->EmptyFreeList = 1;
+        pthread_cond_wait(&flowTree->c_FreeList, &flowTree->m_FreeList);
     }
 
-    node = FlowNode_FreeList;
+    flowTree->localFreeList = flowTree->FlowNode_FreeList;
+    flowTree->Allocated -= flowTree->FreeListSize;
+    flowTree->FlowNode_FreeList = NULL;
+    flowTree->FreeListSize = 0;
+    pthread_mutex_unlock(&flowTree->m_FreeList);
+
+}  // End of RefillFreeList
+
+// Get next free node from free list
+struct FlowNode *New_Node(flowTree_t *flowTree) {
+    if (flowTree->localFreeList == NULL) RefillFreeList(flowTree);
+
+    struct FlowNode *node = flowTree->localFreeList;
     if (node->memflag != NODE_FREE) {
         LogError("New_Node() unexpected error in %s line %d: %s\n", __FILE__, __LINE__, "Tried to allocate a non free Node");
         abort();
     }
 
-    FlowNode_FreeList = node->right;
-    Allocated++;
-    pthread_mutex_unlock(&m_FreeList);
+    flowTree->localFreeList = node->right;
+    flowTree->Allocated++;
 
-    node->left = NULL;
     node->right = NULL;
     node->memflag = NODE_IN_USE;
 
@@ -124,8 +176,8 @@ struct FlowNode *New_Node(void) {
 
 }  // End of New_Node
 
-// return node into free list
-void Free_Node(struct FlowNode *node) {
+// clear a node in use. returns the owning flow tree
+static inline flowTree_t *ClearNode(struct FlowNode *node) {
     if (node->memflag == NODE_FREE) {
         LogError("Free_Node() Fatal: Tried to free an already freed Node");
         abort();
@@ -136,52 +188,108 @@ void Free_Node(struct FlowNode *node) {
         abort();
     }
 
-    if (node->payload) free(node->payload);
-    if (node->pflog) free(node->pflog);
+    struct flowNodeCold_s *cold = node->cold;
+    if (node->hasCold) {
+        if (cold->payload) free(cold->payload);
+        if (cold->pflog) free(cold->pflog);
+    }
 
-    dbg_assert(node->left == NULL);
     dbg_assert(node->right == NULL);
 
+    // clear the hot part only - the cold part is cleared, when used again
+    flowTree_t *flowTree = node->flowTree;
     memset((void *)node, 0, sizeof(struct FlowNode));
-
-    pthread_mutex_lock(&m_FreeList);
-    node->right = FlowNode_FreeList;
-    node->left = NULL;
+    node->flowTree = flowTree;
+    node->cold = cold;
     node->memflag = NODE_FREE;
-    FlowNode_FreeList = node;
-    Allocated--;
-    if (EmptyFreeList) {
-        EmptyFreeList = 0;
-        pthread_cond_signal(&c_FreeList);
+
+    return flowTree;
+
+}  // End of ClearNode
+
+// allocate or clear the cold part of a node on first use
+struct flowNodeCold_s *AllocCold(struct FlowNode *node) {
+    if (node->cold == NULL) {
+        node->cold = malloc(sizeof(struct flowNodeCold_s));
+        if (!node->cold) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            abort();
+        }
     }
-    pthread_mutex_unlock(&m_FreeList);
+    memset((void *)node->cold, 0, sizeof(struct flowNodeCold_s));
+    node->hasCold = 1;
+
+    return node->cold;
+
+}  // End of AllocCold
+
+// return node into the local free list. Packet thread only
+void Free_Node(struct FlowNode *node) {
+    flowTree_t *flowTree = ClearNode(node);
+
+    node->right = flowTree->localFreeList;
+    flowTree->localFreeList = node;
+    flowTree->Allocated--;
 
 }  // End of Free_Node
 
-static int ExtendCache(void) {
-    struct FlowNode *extent = calloc(ExtentSize, sizeof(struct FlowNode));
-    if (!extent) {
+// hand the returned nodes over to the shared free list
+static void FlushReturnList(flowTree_t *flowTree) {
+    if (flowTree->returnCount == 0) return;
+
+    pthread_mutex_lock(&flowTree->m_FreeList);
+    flowTree->returnTail->right = flowTree->FlowNode_FreeList;
+    flowTree->FlowNode_FreeList = flowTree->returnList;
+    flowTree->FreeListSize += flowTree->returnCount;
+    if (flowTree->EmptyFreeList) {
+        flowTree->EmptyFreeList = 0;
+        pthread_cond_signal(&flowTree->c_FreeList);
+    }
+    pthread_mutex_unlock(&flowTree->m_FreeList);
+
+    flowTree->returnList = NULL;
+    flowTree->returnTail = NULL;
+    flowTree->returnCount = 0;
+
+}  // End of FlushReturnList
+
+// return a processed node to its flow tree. Flow thread only
+void Return_Node(struct FlowNode *node) {
+    flowTree_t *flowTree = ClearNode(node);
+
+    if (flowTree->returnList == NULL) flowTree->returnTail = node;
+    node->right = flowTree->returnList;
+    flowTree->returnList = node;
+    flowTree->returnCount++;
+    if (flowTree->returnCount == RETURNBATCH) FlushReturnList(flowTree);
+
+}  // End of Return_Node
+
+static int ExtendCache(flowTree_t *flowTree) {
+    struct FlowNode *extent = NULL;
+    if (posix_memalign((void **)&extent, 64, ExtentSize * sizeof(struct FlowNode)) != 0) {
         LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return 0;
     }
 
-    struct FlowNode *current = FlowNode_FreeList;
-    FlowNode_FreeList = extent;
-    FlowNode_FreeList->left = NULL;
-    FlowNode_FreeList->right = &extent[1];
-    FlowNode_FreeList->memflag = NODE_FREE;
+    struct FlowNode *current = flowTree->localFreeList;
+    memset((void *)extent, 0, ExtentSize * sizeof(struct FlowNode));
+    flowTree->localFreeList = extent;
+    extent[0].right = &extent[1];
+    extent[0].memflag = NODE_FREE;
+    extent[0].flowTree = flowTree;
     int i;
     for (i = 1; i < (ExtentSize - 1); i++) {
         extent[i].memflag = NODE_FREE;
-        extent[i].left = &extent[i - 1];
+        extent[i].flowTree = flowTree;
         extent[i].right = &extent[i + 1];
     }
-    extent[i].left = &extent[i - 1];
     extent[i].right = current;
     extent[i].memflag = NODE_FREE;
+    extent[i].flowTree = flowTree;
 
-    dbg_printf("Extended cache: %u -> %u\n", FlowCacheSize, FlowCacheSize + ExtentSize);
-    FlowCacheSize += ExtentSize;
+    dbg_printf("Extended cache: %u -> %u\n", flowTree->FlowCacheSize, flowTree->FlowCacheSize + ExtentSize);
+    flowTree->FlowCacheSize += ExtentSize;
 
     return 1;
 
@@ -207,113 +315,255 @@ int Init_FlowTree(uint32_t CacheSize, int32_t expireActive, int32_t expireInacti
         LogInfo("Set inactive flow expire timeout to %us", expireInactiveTimeout);
     }
 
-    FlowTree = malloc(sizeof(FlowTree_t));
-    if (!FlowTree) {
+    InitCacheSize = CacheSize ? CacheSize : DefaultCacheSize;
+
+    return 1;
+}  // End of Init_FlowTree
+
+flowTree_t *New_FlowTree(void) {
+    flowTree_t *flowTree = calloc(1, sizeof(flowTree_t));
+    if (!flowTree) {
         LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return 0;
+        return NULL;
     }
-    RB_INIT(FlowTree);
 
-    if (CacheSize == 0) CacheSize = DefaultCacheSize;
-
-    while (FlowCacheSize < CacheSize)
-        if (!ExtendCache()) return 0;
+    // keep the load of the flow table below 1/2
+    uint32_t tableSize = 1024;
+    while (tableSize < (2 * InitCacheSize)) tableSize <<= 1;
+    flowTree->FlowTable = calloc(tableSize, sizeof(flowSlot_t));
+    if (!flowTree->FlowTable) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(flowTree);
+        return NULL;
+    }
+    flowTree->FlowTableMask = tableSize - 1;
+    pthread_mutex_init(&flowTree->m_FreeList, NULL);
+    pthread_cond_init(&flowTree->c_FreeList, NULL);
+
+    while (flowTree->FlowCacheSize < InitCacheSize) {
+        if (!ExtendCache(flowTree)) {
+            Dispose_FlowTree(flowTree);
+            return NULL;
+        }
+    }
 
-    EmptyFreeList = 0;
-    Allocated = 0;
-    NumFlows = 0;
+    flowTree->next = flowTreeList;
+    flowTreeList = flowTree;
 
-    return 1;
-}  // End of Init_FlowTree
+    return flowTree;
+}  // End of New_FlowTree
 
-void Dispose_FlowTree(void) {
-    struct FlowNode *node, *nxt;
+void Dispose_FlowTree(flowTree_t *flowTree) {
+    if (!flowTree) return;
 
-    // Dump all incomplete flows to the file
-    nxt = NULL;
-    for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-        nxt = RB_NEXT(FlowTree, FlowTree, node);
-        Remove_Node(node);
+    // remove all incomplete flows
+    for (int i = 0; i < WHEELSLOTS; i++) {
+        while (flowTree->ExpireWheel[i]) Remove_Node(flowTree, flowTree->ExpireWheel[i]);
     }
-    free(FlowElementCache);
-    FlowElementCache = NULL;
-    FlowNode_FreeList = NULL;
-    EmptyFreeList = 0;
+
+    flowTree_t **tree = &flowTreeList;
+    while (*tree && *tree != flowTree) tree = &((*tree)->next);
+    if (*tree) *tree = flowTree->next;
+
+    free(flowTree->FlowTable);
+    pthread_mutex_destroy(&flowTree->m_FreeList);
+    pthread_cond_destroy(&flowTree->c_FreeList);
+    free(flowTree);
 
 }  // End of Dispose_FlowTree
 
 /* safety check - this must never become 0 - otherwise the cache is too small */
-void CacheCheck(NodeList_t *NodeList, time_t when) {
+void CacheCheck(flowTree_t *flowTree, NodeList_t *NodeList, time_t when) {
     dbg_printf("Cache check: ");
-    if (lastExpire == 0) {
-        lastExpire = when;
+    if (flowTree->lastExpire == 0) {
+        flowTree->lastExpire = when;
         dbg_printf("Init\n");
         return;
     }
-    if ((when - lastExpire) > EXPIREINTERVALL) {
-        uint32_t num __attribute__((unused)) = Expire_FlowTree(NodeList, when);
+    if ((when - flowTree->lastExpire) > EXPIREINTERVALL) {
+        uint32_t num __attribute__((unused)) = Expire_FlowTree(flowTree, NodeList, when);
         dbg_printf("  Expire cache: %u\n", num);
-        lastExpire = when;
+        flowTree->lastExpire = when;
     }
 
 }  // End of CacheCheck
 
-static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2) {
-    int i = memcmp((void *)&e1->flowKey, (void *)&e2->flowKey, sizeof(e1->flowKey));
-    return i;
-}  // End of FlowNodeCMP
+static inline uint64_t FlowKeyHash(struct flowKey_s *flowKey) {
+    const uint64_t *k = (const uint64_t *)flowKey;
+    uint64_t hash = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < (int)(sizeof(struct flowKey_s) / sizeof(uint64_t)); i++) {
+        hash ^= k[i];
+        hash *= 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+    }
+    return hash;
 
-struct FlowNode *Lookup_Node(struct FlowNode *node) { return RB_FIND(FlowTree, FlowTree, node); }  // End of Lookup_FlowTree
+}  // End of FlowKeyHash
 
-struct FlowNode *Insert_Node(struct FlowNode *node) {
-    struct FlowNode *n;
+static inline int FlowKeyEqual(struct flowKey_s *k1, struct flowKey_s *k2) {
+    //
+    return memcmp((void *)k1, (void *)k2, sizeof(struct flowKey_s)) == 0;
+}  // End of FlowKeyEqual
 
-    dbg_assert(node->left == NULL);
-    dbg_assert(node->right == NULL);
+// earliest time, the node may expire
+static inline time_t NodeExpireTime(struct FlowNode *node) {
+    time_t inactive = node->t_last.tv_sec + expireInactiveTimeout;
+    time_t active = node->t_first.tv_sec + expireActiveTimeout;
+    return (inactive < active ? inactive : active) + 1;
 
-    // return RB_INSERT(FlowTree, FlowTree, node);
-    n = RB_INSERT(FlowTree, FlowTree, node);
-    if (n) {  // existing node
-        return n;
+}  // End of NodeExpireTime
+
+static inline void WheelLink(flowTree_t *flowTree, struct FlowNode *node, time_t expire) {
+    if (flowTree->wheelTime == 0) flowTree->wheelTime = node->t_last.tv_sec - 1;
+    time_t wheelTime = flowTree->wheelTime;
+    if (expire <= wheelTime) expire = wheelTime + 1;
+
+    struct FlowNode **slot;
+    if ((expire - wheelTime) < WHEELSIZE) {
+        slot = &flowTree->ExpireWheel[expire & (WHEELSIZE - 1)];
     } else {
-        flowTreeStat.activeNodes++;
-        if (node->nodeType == FLOW_NODE)
-            flowTreeStat.flowNodes++;
-        else if (node->nodeType == FRAG_NODE)
-            flowTreeStat.fragNodes++;
-        NumFlows++;
-        return NULL;
+        // keep the expire time within the outer wheel, relink later if needed
+        if ((expire - wheelTime) >= (WHEELSIZE * (OUTERSIZE - 1))) expire = wheelTime + WHEELSIZE * (OUTERSIZE - 1) - 1;
+        slot = &flowTree->ExpireWheel[WHEELSIZE + ((expire >> WHEELBITS) & (OUTERSIZE - 1))];
+    }
+    node->wheelPrev = slot;
+    node->wheelNext = *slot;
+    if (*slot) (*slot)->wheelPrev = &(node->wheelNext);
+    *slot = node;
+
+}  // End of WheelLink
+
+static inline void WheelUnlink(struct FlowNode *node) {
+    if (node->wheelPrev == NULL) return;
+
+    *(node->wheelPrev) = node->wheelNext;
+    if (node->wheelNext) node->wheelNext->wheelPrev = node->wheelPrev;
+    node->wheelNext = NULL;
+    node->wheelPrev = NULL;
+
+}  // End of WheelUnlink
+
+// double the size of the flow table and rehash all nodes
+static void GrowFlowTable(flowTree_t *flowTree) {
+    uint32_t tableSize = 2 * (flowTree->FlowTableMask + 1);
+    flowSlot_t *table = calloc(tableSize, sizeof(flowSlot_t));
+    if (!table) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    uint32_t mask = tableSize - 1;
+    for (uint32_t i = 0; i <= flowTree->FlowTableMask; i++) {
+        if (flowTree->FlowTable[i].node == NULL) continue;
+        uint32_t index = flowTree->FlowTable[i].hash & mask;
+        while (table[index].node) index = (index + 1) & mask;
+        table[index] = flowTree->FlowTable[i];
+    }
+    free(flowTree->FlowTable);
+    flowTree->FlowTable = table;
+    flowTree->FlowTableMask = mask;
+    dbg_printf("Flow table extended to %u slots\n", tableSize);
+
+}  // End of GrowFlowTable
+
+struct FlowNode *Lookup_Node(flowTree_t *flowTree, struct FlowNode *node) {
+    flowSlot_t *FlowTable = flowTree->FlowTable;
+    uint32_t FlowTableMask = flowTree->FlowTableMask;
+
+    uint64_t hash = FlowKeyHash(&node->flowKey);
+    uint32_t index = hash & FlowTableMask;
+    while (FlowTable[index].node) {
+        if (FlowTable[index].hash == hash && FlowKeyEqual(&FlowTable[index].node->flowKey, &node->flowKey)) return FlowTable[index].node;
+        index = (index + 1) & FlowTableMask;
     }
+    return NULL;
+
+}  // End of Lookup_Node
+
+struct FlowNode *Insert_Node(flowTree_t *flowTree, struct FlowNode *node) {
+    dbg_assert(node->right == NULL);
+
+    if ((uint32_t)(2 * (flowTree->NumFlows + 1)) > flowTree->FlowTableMask) GrowFlowTable(flowTree);
+
+    flowSlot_t *FlowTable = flowTree->FlowTable;
+    uint32_t FlowTableMask = flowTree->FlowTableMask;
+
+    uint64_t hash = FlowKeyHash(&node->flowKey);
+    uint32_t index = hash & FlowTableMask;
+    while (FlowTable[index].node) {
+        if (FlowTable[index].hash == hash && FlowKeyEqual(&FlowTable[index].node->flowKey, &node->flowKey)) {
+            // existing node
+            return FlowTable[index].node;
+        }
+        index = (index + 1) & FlowTableMask;
+    }
+
+    FlowTable[index].hash = hash;
+    FlowTable[index].node = node;
+    WheelLink(flowTree, node, NodeExpireTime(node));
+
+    flowTree->flowTreeStat.activeNodes++;
+    if (node->nodeType == FLOW_NODE) flowTree->flowTreeStat.flowNodes++;
+    flowTree->NumFlows++;
+    return NULL;
+
 }  // End of Insert_Node
 
-void Remove_Node(struct FlowNode *node) {
+void Remove_Node(flowTree_t *flowTree, struct FlowNode *node) {
     struct FlowNode *rev_node;
 
 #ifdef DEVEL
     assert(node->memflag == NODE_IN_USE);
-    if (NumFlows == 0) {
+    if (flowTree->NumFlows == 0) {
         LogError("Remove_Node() Fatal Tried to remove a Node from empty tree");
         return;
     }
 #endif
 
-    rev_node = node->rev_node;
+    rev_node = ColdData(node)->rev_node;
     if (rev_node) {
         // unlink rev node on both nodes
-        dbg_assert(rev_node->rev_node == node);
-        rev_node->rev_node = NULL;
-        node->rev_node = NULL;
+        dbg_assert(rev_node->cold->rev_node == node);
+        rev_node->cold->rev_node = NULL;
+        node->cold->rev_node = NULL;
+    }
+
+    flowSlot_t *FlowTable = flowTree->FlowTable;
+    uint32_t FlowTableMask = flowTree->FlowTableMask;
+
+    uint64_t hash = FlowKeyHash(&node->flowKey);
+    uint32_t index = hash & FlowTableMask;
+    while (FlowTable[index].node && FlowTable[index].node != node) index = (index + 1) & FlowTableMask;
+    if (FlowTable[index].node == NULL) {
+        LogError("Remove_Node() node not found in flow table");
+        return;
     }
-    RB_REMOVE(FlowTree, FlowTree, node);
-    NumFlows--;
+
+    // backward shift all following nodes, which may take the free slot
+    uint32_t hole = index;
+    uint32_t next = index;
+    while (1) {
+        next = (next + 1) & FlowTableMask;
+        if (FlowTable[next].node == NULL) break;
+        uint32_t ideal = FlowTable[next].hash & FlowTableMask;
+        if (((next - ideal) & FlowTableMask) >= ((next - hole) & FlowTableMask)) {
+            FlowTable[hole] = FlowTable[next];
+            hole = next;
+        }
+    }
+    FlowTable[hole].node = NULL;
+    FlowTable[hole].hash = 0;
+
+    WheelUnlink(node);
+    flowTree->NumFlows--;
 
 }  // End of Remove_Node
 
-int Link_RevNode(struct FlowNode *node) {
+int Link_RevNode(flowTree_t *flowTree, struct FlowNode *node) {
     struct FlowNode lookup_node, *rev_node;
 
     dbg_printf("Link node: ");
-    dbg_assert(node->rev_node == NULL);
+    dbg_assert(ColdData(node)->rev_node == NULL);
     lookup_node.flowKey._ALIGN = 0;
     lookup_node.flowKey.proto = node->flowKey.proto;
     lookup_node.flowKey.version = node->flowKey.version;
@@ -322,14 +572,14 @@ int Link_RevNode(struct FlowNode *node) {
     lookup_node.flowKey.dst_addr = node->flowKey.src_addr;
     lookup_node.flowKey.src_port = node->flowKey.dst_port;
     lookup_node.flowKey.dst_port = node->flowKey.src_port;
-    rev_node = Lookup_Node(&lookup_node);
+    rev_node = Lookup_Node(flowTree, &lookup_node);
     if (rev_node) {
         dbg_printf("Found revnode ");
         // rev node must not be linked already - otherwise there is an inconsistency
-        if (node->rev_node == NULL) {
+        if (ColdData(node)->rev_node == NULL) {
             // link both nodes
-            node->rev_node = rev_node;
-            rev_node->rev_node = node;
+            Cold_Node(node)->rev_node = rev_node;
+            Cold_Node(rev_node)->rev_node = node;
             dbg_printf(" - linked\n");
         } else {
             dbg_printf("Rev-node != NULL skip linking - inconsistency\n");
@@ -345,22 +595,18 @@ int Link_RevNode(struct FlowNode *node) {
 
 }  // End of Link_RevNode
 
-uint32_t Flush_FlowTree(NodeList_t *NodeList, time_t when) {
-    struct FlowNode *node, *nxt;
+uint32_t Flush_FlowTree(flowTree_t *flowTree, NodeList_t *NodeList, time_t when) {
+    struct FlowNode *node;
 
     // Dump all incomplete flows to the file
-    nxt = NULL;
-    for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-        nxt = RB_NEXT(FlowTree, FlowTree, node);
-        Remove_Node(node);
-        if (node->nodeType == FRAG_NODE) {
-            Free_Node(node);
-        } else {
+    for (int i = 0; i < WHEELSLOTS; i++) {
+        while ((node = flowTree->ExpireWheel[i]) != NULL) {
+            Remove_Node(flowTree, node);
             Push_Node(NodeList, node);
         }
     }
 
-    node = New_Node();
+    node = New_Node(flowTree);
     node->timestamp = when;
     node->nodeType = SIGNAL_NODE;
     node->signal = SIGNAL_DONE;
@@ -370,44 +616,84 @@ uint32_t Flush_FlowTree(NodeList_t *NodeList, time_t when) {
 
 }  // End of Flush_FlowTree
 
-uint32_t Expire_FlowTree(NodeList_t *NodeList, time_t when) {
+// expire a node, if due. returns 1 for expired flow nodes, 0 otherwise
+static inline int ExpireNode(flowTree_t *flowTree, NodeList_t *NodeList, struct FlowNode *node, time_t when) {
+    if ((node->nodeType == FLOW_NODE) &&
+        // inactive timeout
+        ((when - node->t_last.tv_sec) > expireInactiveTimeout ||
+         // active timeout
+         (when - node->t_first.tv_sec) > expireActiveTimeout || when == 0)) {
+        Remove_Node(flowTree, node);
+        Push_Node(NodeList, node);
+        flowTree->flowTreeStat.activeNodes--;
+        flowTree->flowTreeStat.flowNodes--;
+        return 1;
+    } else {
+        // flow got packets since - relink
+        WheelUnlink(node);
+        WheelLink(flowTree, node, NodeExpireTime(node));
+    }
+    return 0;
+
+}  // End of ExpireNode
+
+uint32_t Expire_FlowTree(flowTree_t *flowTree, NodeList_t *NodeList, time_t when) {
     struct FlowNode *node, *nxt;
 
-    if (NumFlows == 0) return 0;
+    if (flowTree->NumFlows == 0) return 0;
 
     uint32_t flowCnt = 0;
-    uint32_t fragCnt = 0;
-    // Dump all incomplete flows to the file
-    nxt = NULL;
-    for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-        nxt = RB_NEXT(FlowTree, FlowTree, node);
-        if ((node->nodeType == FLOW_NODE) &&
-            // inactive timeout
-            ((when - node->t_last.tv_sec) > expireInactiveTimeout ||
-             // active timeout
-             (when - node->t_first.tv_sec) > expireActiveTimeout || when == 0)) {
-            Remove_Node(node);
-            Push_Node(NodeList, node);
-            flowTreeStat.activeNodes--;
-            flowTreeStat.flowNodes--;
-            flowCnt++;
-        } else if ((node->nodeType == FRAG_NODE) && ((when - node->t_last.tv_sec) > 15 || when == 0)) {
-            Remove_Node(node);
-            Free_Node(node);
-            flowTreeStat.activeNodes--;
-            flowTreeStat.fragNodes--;
+    if (when == 0) {
+        // expire all nodes
+        for (int i = 0; i < WHEELSLOTS; i++) {
+            for (node = flowTree->ExpireWheel[i]; node != NULL; node = nxt) {
+                nxt = node->wheelNext;
+                flowCnt += ExpireNode(flowTree, NodeList, node, when);
+            }
+        }
+    } else if (when > flowTree->wheelTime) {
+        time_t first = flowTree->wheelTime + 1;
+        flowTree->wheelTime = when;
+
+        // cascade all outer slots, which time range started since the last run
+        time_t outer = (first + WHEELSIZE - 1) >> WHEELBITS;
+        time_t lastOuter = when >> WHEELBITS;
+        if ((lastOuter - outer) >= OUTERSIZE) outer = lastOuter - OUTERSIZE + 1;
+        for (; outer <= lastOuter; outer++) {
+            struct FlowNode **slot = &flowTree->ExpireWheel[WHEELSIZE + (outer & (OUTERSIZE - 1))];
+            struct FlowNode *list = *slot;
+            *slot = NULL;
+            for (node = list; node != NULL; node = nxt) {
+                nxt = node->wheelNext;
+                node->wheelNext = NULL;
+                node->wheelPrev = NULL;
+                flowCnt += ExpireNode(flowTree, NodeList, node, when);
+            }
         }
-    }
 
-    if (flowCnt || fragCnt)
-        LogVerbose("Expired flow nodes: %u, expired frag nodes: %u, active tree nodes: %u, allocated nodes %u", flowCnt, fragCnt,
-                   flowTreeStat.activeNodes, Allocated);
+        // process all inner wheel slots due since the last run
+        if ((when - first) >= WHEELSIZE) first = when - WHEELSIZE + 1;
+        for (time_t t = first; t <= when; t++) {
+            // detach the slot, as nodes not yet due get relinked
+            struct FlowNode *list = flowTree->ExpireWheel[t & (WHEELSIZE - 1)];
+            flowTree->ExpireWheel[t & (WHEELSIZE - 1)] = NULL;
+            for (node = list; node != NULL; node = nxt) {
+                nxt = node->wheelNext;
+                node->wheelNext = NULL;
+                node->wheelPrev = NULL;
+                flowCnt += ExpireNode(flowTree, NodeList, node, when);
+            }
+        }
+    }
+    if (flowCnt)
+        LogVerbose("Expired flow nodes: %u, active tree nodes: %u, allocated nodes %u", flowCnt, flowTree->flowTreeStat.activeNodes,
+                   flowTree->Allocated);
 
-    return flowCnt + fragCnt;
+    return flowCnt;
 }  // End of Expire_FlowTree
 
 /* Node list functions */
-NodeList_t *NewNodeList(void) {
+NodeList_t *NewNodeList(uint32_t producers, uint32_t maxLength) {
     NodeList_t *NodeList;
 
     NodeList = (NodeList_t *)malloc(sizeof(NodeList_t));
@@ -420,6 +706,11 @@ NodeList_t *NewNodeList(void) {
     NodeList->length = 0;
     NodeList->waiting = 0;
     NodeList->waits = 0;
+    NodeList->producers = producers ? producers : 1;
+    NodeList->syncSignals = 0;
+    NodeList->doneSignals = 0;
+    NodeList->maxLength = maxLength;
+    NodeList->dropped = 0;
     pthread_mutex_init(&NodeList->m_list, NULL);
     pthread_cond_init(&NodeList->c_list, NULL);
 
@@ -438,22 +729,40 @@ void DisposeNodeList(NodeList_t *NodeList) {
 
 }  // End of DisposeNodeList
 
-static void DumpTreeStat(NodeList_t *NodeList) {
-    LogInfo("Nodes: in use: %u, Flows: %u, Frag: %u, Nodes list length: %u, Waiting for freelist: %u", Allocated, flowTreeStat.activeNodes,
-            flowTreeStat.fragNodes, NodeList->length, EmptyFreeListEvents);
-    EmptyFreeListEvents = 0;
+// log and reset the number of flows dropped, as the nodes list was full
+void LogNodeDrops(NodeList_t *NodeList) {
+    pthread_mutex_lock(&NodeList->m_list);
+    uint64_t dropped = NodeList->dropped;
+    NodeList->dropped = 0;
+    pthread_mutex_unlock(&NodeList->m_list);
+    if (dropped) LogError("Nodes list full: dropped %llu flows, as the flow thread falls behind", (unsigned long long)dropped);
+}  // End of LogNodeDrops
+
+static void DumpTreeStat(flowTree_t *flowTree, NodeList_t *NodeList) {
+    LogNodeDrops(NodeList);
+
+    LogInfo("Nodes: in use: %u, Flows: %u, Nodes list length: %u, Waiting for freelist: %u", flowTree->Allocated,
+            flowTree->flowTreeStat.activeNodes, NodeList->length, flowTree->EmptyFreeListEvents);
+    flowTree->EmptyFreeListEvents = 0;
 }  // End of DumpTreeStat
 
+// queue a node for the flow thread. Packet thread only
 void Push_Node(NodeList_t *NodeList, struct FlowNode *node) {
     pthread_mutex_lock(&NodeList->m_list);
+    if (NodeList->maxLength && NodeList->length >= NodeList->maxLength && node->nodeType != SIGNAL_NODE) {
+        // the flow thread falls behind - drop the flow, but never a rotation or done signal
+        NodeList->dropped++;
+        pthread_mutex_unlock(&NodeList->m_list);
+        node->right = NULL;
+        Free_Node(node);
+        return;
+    }
     if (NodeList->length == 0) {
         // empty list
         NodeList->list = node;
-        node->left = NULL;
         node->right = NULL;
     } else {
         NodeList->last->right = node;
-        node->left = NodeList->last;
         node->right = NULL;
     }
     NodeList->last = node;
@@ -471,28 +780,46 @@ void Push_Node(NodeList_t *NodeList, struct FlowNode *node) {
 
 }  // End of Push_Node
 
+// merge the signal nodes of multiple producers. returns 0, if the node got merged
+static inline int MergeSignal(NodeList_t *NodeList, struct FlowNode *node) {
+    if (node->nodeType != SIGNAL_NODE || NodeList->producers == 1) return 1;
+
+    // pass the signal, once all producers sent it
+    uint32_t *signals = node->signal == SIGNAL_SYNC ? &NodeList->syncSignals : &NodeList->doneSignals;
+    (*signals)++;
+    if (*signals < NodeList->producers) {
+        Return_Node(node);
+        return 0;
+    }
+    *signals = 0;
+    return 1;
+
+}  // End of MergeSignal
+
 struct FlowNode *Pop_Node(NodeList_t *NodeList) {
     struct FlowNode *node;
 
     pthread_mutex_lock(&NodeList->m_list);
-    while (NodeList->length == 0) {
-        NodeList->waiting = 1;
-        pthread_cond_wait(&NodeList->c_list, &NodeList->m_list);
-        // wake up
-        NodeList->waiting = 0;
-    }
+    do {
+        if (NodeList->length == 0) {
+            // hand back all returned nodes, before going idle
+            for (flowTree_t *flowTree = flowTreeList; flowTree; flowTree = flowTree->next) FlushReturnList(flowTree);
+        }
+        while (NodeList->length == 0) {
+            NodeList->waiting = 1;
+            pthread_cond_wait(&NodeList->c_list, &NodeList->m_list);
+            // wake up
+            NodeList->waiting = 0;
+        }
 
-    node = NodeList->list;
-    NodeList->list = node->right;
-    if (NodeList->list)
-        NodeList->list->left = NULL;
-    else
-        NodeList->last = NULL;
+        node = NodeList->list;
+        NodeList->list = node->right;
+        if (NodeList->list == NULL) NodeList->last = NULL;
 
-    node->left = NULL;
-    node->right = NULL;
+        node->right = NULL;
 
-    NodeList->length--;
+        NodeList->length--;
+    } while (MergeSignal(NodeList, node) == 0);
     pthread_mutex_unlock(&NodeList->m_list);
 
     //	dbg_printf("popped node 0x%llx proto: %u, length: %u first: %llx, last: %llx\n",
@@ -502,12 +829,48 @@ struct FlowNode *Pop_Node(NodeList_t *NodeList) {
     return node;
 }  // End of Pop_Node
 
-void Push_SyncNode(NodeList_t *NodeList, time_t timestamp) {
-    struct FlowNode *Node = New_Node();
+// detach all queued nodes at once. Returns the nodes linked by ->right
+struct FlowNode *Pop_NodeList(NodeList_t *NodeList) {
+    pthread_mutex_lock(&NodeList->m_list);
+    if (NodeList->length == 0) {
+        // hand back all returned nodes, before going idle
+        for (flowTree_t *flowTree = flowTreeList; flowTree; flowTree = flowTree->next) FlushReturnList(flowTree);
+    }
+    while (NodeList->length == 0) {
+        NodeList->waiting = 1;
+        pthread_cond_wait(&NodeList->c_list, &NodeList->m_list);
+        // wake up
+        NodeList->waiting = 0;
+    }
+
+    struct FlowNode *list = NodeList->list;
+    NodeList->list = NULL;
+    NodeList->last = NULL;
+    NodeList->length = 0;
+    pthread_mutex_unlock(&NodeList->m_list);
+
+    // merge signal nodes outside the lock - the signal counters belong to the consumer
+    struct FlowNode **link = &list;
+    struct FlowNode *node = list;
+    while (node) {
+        struct FlowNode *next = node->right;
+        if (MergeSignal(NodeList, node)) {
+            *link = node;
+            link = &node->right;
+        }
+        node = next;
+    }
+    *link = NULL;
+
+    return list;
+}  // End of Pop_NodeList
+
+void Push_SyncNode(flowTree_t *flowTree, NodeList_t *NodeList, time_t timestamp) {
+    struct FlowNode *Node = New_Node(flowTree);
     Node->timestamp = timestamp;
     Node->nodeType = SIGNAL_NODE;
     Node->signal = SIGNAL_SYNC;
     Push_Node(NodeList, Node);
-    DumpTreeStat(NodeList);
+    DumpTreeStat(flowTree, NodeList);
 
 }  // End of Push_SyncNode
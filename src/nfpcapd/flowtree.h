@@ -42,7 +42,6 @@
 #include "config.h"
 #include "nfdump.h"
 #include "nfxV3.h"
-#include "rbtree.h"
 
 #define v4 ip_addr._v4
 #define v6 ip_addr._v6
@@ -50,18 +49,23 @@
 typedef struct flowTreeStat_s {
     size_t activeNodes;
     size_t flowNodes;
-    size_t fragNodes;
 } flowTreeStat_t;
 
-struct FlowNode {
-    // tree
-    RB_ENTRY(FlowNode) entry;
+// flow tree of one packet thread
+typedef struct flowTree_s flowTree_t;
 
-    // linked list
-    struct FlowNode *left;
-    struct FlowNode *right;
+/*
+ * A flow node is split into a hot and a cold part. The hot part holds all fields
+ * touched per packet and per expire run - flow key, counters, timestamps and the
+ * list links. It fills two cache lines and is allocated densely in the extents of
+ * its flow tree. The cold part holds the data of the full decoder - vlan, mac,
+ * mpls, tunnel, pflog, payload and latency data. It is allocated on first use and
+ * stays with the node, when the node gets recycled.
+ */
+struct flowNodeCold_s;
 
-    // flow key
+struct FlowNode {
+    // cache line 0 - flow key and per packet data
     struct flowKey_s {
         // IP addr
         ip_addr_t src_addr;
@@ -80,7 +84,6 @@ struct FlowNode {
     uint8_t memflag;  // internal housekeeping flag
 #define FLOW_NODE 1
 #define SIGNAL_NODE 2
-#define FRAG_NODE 3
     uint8_t nodeType;
     uint8_t flags;
 #define SIGNAL_FIN 1
@@ -90,6 +93,34 @@ struct FlowNode {
                      //  254: empty node - used to rotate file
                      //  255: empty node - used to terminate flow thread
 
+    uint32_t packets;  // summed up number of packets
+    uint32_t bytes;    // summed up number of bytes
+    uint8_t ttl;
+    uint8_t fragmentFlags;
+    uint8_t hasCold;  // cold part is in use
+    uint8_t align;
+
+    struct flowNodeCold_s *cold;  // cold part, if ever allocated
+
+    // cache line 1 - flow stat data and list links
+    union {
+        struct timeval t_first;  // used for file rotation
+        time_t timestamp;        // used for flow dumping
+    };
+    struct timeval t_last;
+
+    // expire timer wheel
+    struct FlowNode *wheelNext;
+    struct FlowNode **wheelPrev;  // address of the pointer to this node, NULL if not linked
+
+    // linked list
+    struct FlowNode *right;
+
+    // owning flow tree
+    flowTree_t *flowTree;
+} __attribute__((aligned(64)));
+
+struct flowNodeCold_s {
     // vlan label
     uint32_t vlanID;
 
@@ -104,22 +135,9 @@ struct FlowNode {
     uint8_t reason;
     uint32_t ruleNr;
 
-    // flow stat data
-    union {
-        struct timeval t_first;  // used for file rotation
-        time_t timestamp;        // used for flow dumping
-    };
-    struct timeval t_last;
-
-    uint32_t packets;  // summed up number of packets
-    uint32_t bytes;    // summed up number of bytes
-
     void *pflog;
     void *payload;         // payload
     uint32_t payloadSize;  // Size of payload
-    uint8_t ttl;
-    uint8_t fragmentFlags;
-    uint16_t align;
     uint32_t mpls[10];
     uint64_t srcMac;
     uint64_t dstMac;
@@ -136,6 +154,21 @@ struct FlowNode {
     } latency;
 };
 
+// all zero cold part of nodes without cold data
+extern const struct flowNodeCold_s flowNodeNoCold;
+
+// cold data of a node for reading
+static inline const struct flowNodeCold_s *ColdData(const struct FlowNode *node) {
+    return node->hasCold ? node->cold : &flowNodeNoCold;
+}  // End of ColdData
+
+struct flowNodeCold_s *AllocCold(struct FlowNode *node);
+
+// cold data of a node for writing. Allocates the cold part on first use
+static inline struct flowNodeCold_s *Cold_Node(struct FlowNode *node) {
+    return node->hasCold ? node->cold : AllocCold(node);
+}  // End of Cold_Node
+
 typedef struct NodeList_s {
     struct FlowNode *list;
     struct FlowNode *last;
@@ -144,40 +177,45 @@ typedef struct NodeList_s {
     uint32_t length;
     uint32_t waiting;
     uint64_t waits;
+    // number of threads pushing nodes. Their signal nodes are merged into one
+    uint32_t producers;
+    uint32_t syncSignals;
+    uint32_t doneSignals;
+    // max number of queued nodes, 0 for no limit. Signal nodes are always queued
+    uint32_t maxLength;
+    uint64_t dropped;  // flow nodes dropped, as the list was full
 } NodeList_t;
 
-/* flow tree type */
-typedef RB_HEAD(FlowTree, FlowNode) FlowTree_t;
-
-// Insert the RB prototypes here
-RB_PROTOTYPE(FlowTree, FlowNode, entry, FlowNodeCMP);
-
 int Init_FlowTree(uint32_t CacheSize, int32_t expireActive, int32_t expireInactive);
 
-void Dispose_FlowTree(void);
+flowTree_t *New_FlowTree(void);
+
+void Dispose_FlowTree(flowTree_t *flowTree);
 
-uint32_t Flush_FlowTree(NodeList_t *NodeList, time_t when);
+uint32_t Flush_FlowTree(flowTree_t *flowTree, NodeList_t *NodeList, time_t when);
 
-uint32_t Expire_FlowTree(NodeList_t *NodeList, time_t when);
+uint32_t Expire_FlowTree(flowTree_t *flowTree, NodeList_t *NodeList, time_t when);
 
-struct FlowNode *Lookup_Node(struct FlowNode *node);
+struct FlowNode *Lookup_Node(flowTree_t *flowTree, struct FlowNode *node);
 
-struct FlowNode *New_Node(void);
+struct FlowNode *New_Node(flowTree_t *flowTree);
 
 void Free_Node(struct FlowNode *node);
 
-void CacheCheck(NodeList_t *NodeList, time_t when);
+void Return_Node(struct FlowNode *node);
+
+void CacheCheck(flowTree_t *flowTree, NodeList_t *NodeList, time_t when);
 
 int AddNodeData(struct FlowNode *node, uint32_t seq, void *payload, uint32_t size);
 
-struct FlowNode *Insert_Node(struct FlowNode *node);
+struct FlowNode *Insert_Node(flowTree_t *flowTree, struct FlowNode *node);
 
-void Remove_Node(struct FlowNode *node);
+void Remove_Node(flowTree_t *flowTree, struct FlowNode *node);
 
-int Link_RevNode(struct FlowNode *node);
+int Link_RevNode(flowTree_t *flowTree, struct FlowNode *node);
 
 // Node list functions
-NodeList_t *NewNodeList(void);
+NodeList_t *NewNodeList(uint32_t producers, uint32_t maxLength);
 
 void DisposeNodeList(NodeList_t *NodeList);
 
@@ -185,7 +223,11 @@ void Push_Node(NodeList_t *NodeList, struct FlowNode *node);
 
 struct FlowNode *Pop_Node(NodeList_t *NodeList);
 
-void Push_SyncNode(NodeList_t *NodeList, time_t timestamp);
+struct FlowNode *Pop_NodeList(NodeList_t *NodeList);
+
+void Push_SyncNode(flowTree_t *flowTree, NodeList_t *NodeList, time_t timestamp);
+
+void LogNodeDrops(NodeList_t *NodeList);
 
 void DumpList(NodeList_t *NodeList);
 
@@ -0,0 +1,231 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "ipfrag.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "nfdump.h"
+#include "util.h"
+
+#define FRAGBUCKETS 256
+#define FRAGWAYS 4
+#define FRAGTIMEOUT 15
+// largest IPv4 datagram payload
+#define MAXDATAGRAM 65536
+// reassembly buffers grow in steps of
+#define FRAGCHUNK 4096
+
+typedef struct fragEntry_s {
+    // datagram key
+    uint32_t srcAddr;
+    uint32_t dstAddr;
+    uint16_t id;
+    uint8_t proto;
+    uint8_t inUse;
+
+    uint8_t lastSeen;    // last fragment received - totalSize is valid
+    uint32_t received;   // payload bytes received
+    uint32_t totalSize;  // payload size of the datagram
+    struct timeval t_first;
+
+    uint32_t bufferSize;
+    void *buffer;
+} fragEntry_t;
+
+struct fragTable_s {
+    fragEntry_t entry[FRAGBUCKETS][FRAGWAYS];
+    uint32_t inUse;
+
+    // statistics
+    uint64_t fragments;
+    uint64_t datagrams;
+    uint64_t evicted;
+    uint64_t expired;
+};
+
+fragTable_t *NewFragTable(void) {
+    fragTable_t *fragTable = calloc(1, sizeof(fragTable_t));
+    if (!fragTable) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    return fragTable;
+
+}  // End of NewFragTable
+
+static inline void ReleaseEntry(fragTable_t *fragTable, fragEntry_t *entry) {
+    free(entry->buffer);
+    memset((void *)entry, 0, sizeof(fragEntry_t));
+    fragTable->inUse--;
+}  // End of ReleaseEntry
+
+void DisposeFragTable(fragTable_t *fragTable) {
+    if (!fragTable) return;
+
+    for (int i = 0; i < FRAGBUCKETS; i++) {
+        for (int j = 0; j < FRAGWAYS; j++) {
+            if (fragTable->entry[i][j].inUse) ReleaseEntry(fragTable, &fragTable->entry[i][j]);
+        }
+    }
+    free(fragTable);
+
+}  // End of DisposeFragTable
+
+static inline uint32_t FragHash(uint32_t srcAddr, uint32_t dstAddr, uint16_t id, uint8_t proto) {
+    uint64_t hash = ((uint64_t)srcAddr << 32 | dstAddr) * 0x9E3779B97F4A7C15ULL;
+    hash ^= ((uint64_t)id << 8 | proto) * 0xBF58476D1CE4E5B9ULL;
+    return (uint32_t)(hash >> 32) & (FRAGBUCKETS - 1);
+}  // End of FragHash
+
+// find the entry of the datagram or claim a new one
+static fragEntry_t *GetEntry(fragTable_t *fragTable, uint32_t srcAddr, uint32_t dstAddr, uint16_t id, uint8_t proto,
+                             const struct timeval *ts) {
+    fragEntry_t *bucket = fragTable->entry[FragHash(srcAddr, dstAddr, id, proto)];
+
+    fragEntry_t *freeEntry = NULL;
+    fragEntry_t *oldest = NULL;
+    for (int i = 0; i < FRAGWAYS; i++) {
+        fragEntry_t *entry = &bucket[i];
+        if (entry->inUse && (ts->tv_sec - entry->t_first.tv_sec) > FRAGTIMEOUT) {
+            // expired datagram
+            ReleaseEntry(fragTable, entry);
+            fragTable->expired++;
+        }
+        if (!entry->inUse) {
+            if (!freeEntry) freeEntry = entry;
+            continue;
+        }
+        if (entry->srcAddr == srcAddr && entry->dstAddr == dstAddr && entry->id == id && entry->proto == proto) return entry;
+        if (!oldest || entry->t_first.tv_sec < oldest->t_first.tv_sec) oldest = entry;
+    }
+
+    if (!freeEntry) {
+        // bucket full - evict the oldest incomplete datagram
+        ReleaseEntry(fragTable, oldest);
+        fragTable->evicted++;
+        freeEntry = oldest;
+    }
+
+    freeEntry->srcAddr = srcAddr;
+    freeEntry->dstAddr = dstAddr;
+    freeEntry->id = id;
+    freeEntry->proto = proto;
+    freeEntry->inUse = 1;
+    freeEntry->t_first = *ts;
+    fragTable->inUse++;
+
+    return freeEntry;
+
+}  // End of GetEntry
+
+// add the fragment to its datagram. Returns the reassembled payload of the datagram, once complete,
+// which the caller must free(). Returns NULL otherwise
+void *AddFragment(fragTable_t *fragTable, const struct ip *ip, const void *eodata, const struct timeval *ts, struct timeval *t_first,
+                  uint32_t *size) {
+    uint16_t ip_off = ntohs(ip->ip_off);
+    uint32_t frag_offset = (ip_off & IP_OFFMASK) << 3;
+    const void *dataptr = (const void *)ip + (ip->ip_hl << 2);
+    ptrdiff_t len = eodata - dataptr;
+    fragTable->fragments++;
+
+    if (len < 0 || (frag_offset + len) > MAXDATAGRAM) {
+        LogError("IP fragment too large: %td", frag_offset + len);
+        return NULL;
+    }
+
+    fragEntry_t *entry = GetEntry(fragTable, ntohl(ip->ip_src.s_addr), ntohl(ip->ip_dst.s_addr), ntohs(ip->ip_id), ip->ip_p, ts);
+
+    uint32_t end = frag_offset + len;
+    if (end > entry->bufferSize) {
+        uint32_t bufferSize = (end + FRAGCHUNK - 1) & ~(FRAGCHUNK - 1);
+        void *buffer = realloc(entry->buffer, bufferSize);
+        if (!buffer) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            ReleaseEntry(fragTable, entry);
+            return NULL;
+        }
+        memset(buffer + entry->bufferSize, 0, bufferSize - entry->bufferSize);
+        entry->buffer = buffer;
+        entry->bufferSize = bufferSize;
+    }
+    memcpy(entry->buffer + frag_offset, dataptr, len);
+    entry->received += len;
+
+    if ((ip_off & IP_MF) == 0) {
+        // last fragment - the datagram size is known now
+        entry->lastSeen = 1;
+        entry->totalSize = end;
+    }
+    dbg_printf("IP frag: offset: %u, length: %td, received: %u\n", frag_offset, len, entry->received);
+
+    if (!entry->lastSeen || entry->received < entry->totalSize) return NULL;
+
+    // datagram complete - hand over the buffer
+    void *datagram = entry->buffer;
+    *size = entry->totalSize;
+    *t_first = entry->t_first;
+    entry->buffer = NULL;
+    ReleaseEntry(fragTable, entry);
+    fragTable->datagrams++;
+
+    return datagram;
+
+}  // End of AddFragment
+
+// release all incomplete datagrams older than FRAGTIMEOUT
+void ExpireFragTable(fragTable_t *fragTable, time_t when) {
+    if (fragTable->inUse == 0) return;
+
+    uint32_t expired = 0;
+    for (int i = 0; i < FRAGBUCKETS; i++) {
+        for (int j = 0; j < FRAGWAYS; j++) {
+            fragEntry_t *entry = &fragTable->entry[i][j];
+            if (entry->inUse && (when - entry->t_first.tv_sec) > FRAGTIMEOUT) {
+                ReleaseEntry(fragTable, entry);
+                expired++;
+            }
+        }
+    }
+    fragTable->expired += expired;
+
+    if (expired)
+        LogVerbose("Expired frag datagrams: %u, in use: %u, fragments: %llu, reassembled: %llu, evicted: %llu, expired: %llu", expired,
+                   fragTable->inUse, (long long unsigned)fragTable->fragments, (long long unsigned)fragTable->datagrams,
+                   (long long unsigned)fragTable->evicted, (long long unsigned)fragTable->expired);
+
+}  // End of ExpireFragTable
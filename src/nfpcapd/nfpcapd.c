@@ -66,6 +66,7 @@
 #include "bookkeeper.h"
 #include "conf/nfconf.h"
 #include "config.h"
+#include "cpufeature.h"
 #include "daemon.h"
 #include "expire.h"
 #include "exporter.h"
@@ -90,6 +91,7 @@
 #define TIMEOUT 500
 #define FILTER "ip"
 #define TO_MS 100
+#define MAXRINGS 64
 
 static int verbose = 0;
 static int done = 0;
@@ -103,7 +105,12 @@ static pthread_mutex_t m_done = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t terminate = PTHREAD_COND_INITIALIZER;
 
 static option_t nfpcapdOption[] = {
-    {.name = "fat", .valBool = 0, .flags = OPTDEFAULT}, {.name = "payload", .valBool = 0, .flags = OPTDEFAULT}, {.name = NULL}};
+    {.name = "fat", .valBool = 0, .flags = OPTDEFAULT},
+    {.name = "payload", .valBool = 0, .flags = OPTDEFAULT},
+    {.name = "payloaddict", .valBool = 0, .flags = OPTDEFAULT},
+    {.name = "hwts", .valBool = 0, .flags = OPTDEFAULT},
+    {.name = "batch", .valBool = 0, .flags = OPTDEFAULT},
+    {.name = NULL}};
 
 /*
  * Function prototypes
@@ -127,13 +134,16 @@ static void usage(char *name) {
         "-u userid\tChange user to username\n"
         "-g groupid\tChange group to groupname\n"
         "-i interface\tread packets from interface\n"
-        "-r pcapfile\tread packets from file\n"
+        "-Q rings\tset the number of packet rings and threads for the interface or the pcap file. (default 1)\n"
+        "-X\t\tread packets from interface with AF_XDP sockets\n"
+        "-x xdpprog\tload this XDP program for AF_XDP sockets\n"
+        "-r pcapfile\tread packets from file. Files ending in .gz, .bz2, .xz, .zst or .lz4 get decompressed\n"
         "-b num\tset socket buffer size in MB. (default 20MB)\n"
         "-B num\tset the node cache size. (default 524288)\n"
         "-d\t\tDe-duplicate packets with window size 8.\n"
         "-s snaplen\tset the snapshot length - default 1522\n"
         "-e active,inactive\tset the active,inactive flow expire time (s) - default 300,60\n"
-        "-o options \tAdd flow options, separated with ','. Available: 'fat', 'payload'\n"
+        "-o options \tAdd flow options, separated with ','. Available: 'fat', 'payload', 'payloaddict', 'hwts', 'batch'\n"
         "-w flowdir \tset the flow output directory. (no default) \n"
         "-C <file>\tRead optional config file.\n"
         "-H host[/port]\tSend flows to host or IP address/port. Default port 9995.\n"
@@ -170,9 +180,9 @@ static int setup_pcap_file(packetParam_t *param, char *pcap_file, char *filter,
     dbg_printf("Enter function: %s\n", __FUNCTION__);
 
     errbuf[0] = '\0';
-    handle = pcap_open_offline(pcap_file, errbuf);
+    handle = OpenPcapFile(pcap_file, errbuf);
     if (handle == NULL) {
-        LogError("pcap_open_offline() failed: %s", errbuf);
+        LogError("OpenPcapFile() failed: %s", errbuf);
         return -1;
     }
 
@@ -261,13 +271,14 @@ int main(int argc, char *argv[]) {
     struct sigaction sa;
     int c, snaplen, bufflen, err, do_daemonize, doDedup;
     int subdir_index, compress, expire, cache_size, buff_size;
-    int activeTimeout, inactiveTimeout, metricInterval, workers;
+    int activeTimeout, inactiveTimeout, metricInterval, workers, rings, useXDP;
     dirstat_t *dirstat;
     repeater_t *sendHost;
     time_t t_win;
     char *device, *pcapfile, *filter, *datadir, *pcap_datadir, *pidfile, *configFile, *options;
     char *Ident, *userid, *groupid, *metricsocket;
     char *time_extension;
+    char *xdpProgram __attribute__((unused));
 
     snaplen = 1522;
     bufflen = 0;
@@ -298,8 +309,11 @@ int main(int argc, char *argv[]) {
     activeTimeout = 0;
     inactiveTimeout = 0;
     workers = 0;
+    rings = 1;
+    useXDP = 0;
+    xdpProgram = NULL;
 
-    while ((c = getopt(argc, argv, "b:B:C:dDe:g:hH:I:i:j:l:m:o:p:P:r:s:S:T:t:u:vVw:W:yz::")) != EOF) {
+    while ((c = getopt(argc, argv, "b:B:C:dDe:g:hH:I:i:j:l:m:o:p:P:Q:r:s:S:T:t:u:vVw:W:x:Xyz::")) != EOF) {
         switch (c) {
             struct stat fstat;
             case 'h':
@@ -380,6 +394,23 @@ int main(int argc, char *argv[]) {
             case 'i':
                 device = optarg;
                 break;
+            case 'X':
+                useXDP = 1;
+                break;
+            case 'x':
+                CheckArgLen(optarg, MAXPATHLEN);
+                if (!CheckPath(optarg, S_IFREG)) exit(EXIT_FAILURE);
+                xdpProgram = optarg;
+                useXDP = 1;
+                break;
+            case 'Q':
+                CheckArgLen(optarg, 16);
+                rings = atoi(optarg);
+                if (rings < 1 || rings > MAXRINGS) {
+                    LogError("Number of packet rings out of range 1..%d", MAXRINGS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'l':
                 LogError("-l is a legacy option and may get removed in future. Please use -w to set output directory");
             case 'w':
@@ -511,6 +542,7 @@ int main(int argc, char *argv[]) {
                 break;
             case 'V':
                 printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
                 exit(EXIT_SUCCESS);
                 break;
             default:
@@ -548,18 +580,54 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (useXDP) {
+#ifndef USE_XDP
+        LogError("AF_XDP capture not compiled in. Configure with --enable-xdp");
+        exit(EXIT_FAILURE);
+#endif
+        if (pcapfile) {
+            LogError("AF_XDP capture requires an interface");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (rings > 1) {
+#ifndef USE_TPACKETV3
+        if (!useXDP && !pcapfile) {
+            LogError("Multiple packet rings require TPACKET_V3 or AF_XDP support");
+            exit(EXIT_FAILURE);
+        }
+#endif
+        if (pcap_datadir) {
+            LogError("Packet dumping is not supported with multiple packet rings");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     flushParam_t flushParam = {0};
-    packetParam_t packetParam = {0};
     flowParam_t flowParam = {0};
     flushParam.extensionFormat = time_extension;
     flowParam.extensionFormat = time_extension;
-    packetParam.doDedup = doDedup;
+
+    // one packet thread per ring
+    packetParam_t *packetParam = calloc(rings, sizeof(packetParam_t));
+    if (!packetParam) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < rings; i++) packetParam[i].doDedup = doDedup;
 
     if (scanOptions(nfpcapdOption, options) == 0) {
         exit(EXIT_FAILURE);
     }
     OptGetBool(nfpcapdOption, "fat", &flowParam.extendedFlow);
     OptGetBool(nfpcapdOption, "payload", &flowParam.addPayload);
+    OptGetBool(nfpcapdOption, "payloaddict", &flowParam.payloadDict);
+    if (flowParam.payloadDict) flowParam.addPayload = 1;
+    int hwTimestamp = 0;
+    OptGetBool(nfpcapdOption, "hwts", &hwTimestamp);
+    for (int i = 0; i < rings; i++) packetParam[i].hwTimestamp = hwTimestamp;
+    OptGetBool(nfpcapdOption, "batch", &flowParam.sendBatch);
 
     if ((datadir && sendHost) || (!datadir && !sendHost)) {
         LogError("Specify either a local directory or a remote host to dump flows.");
@@ -572,30 +640,58 @@ int main(int argc, char *argv[]) {
             LogError("ERROR: Port to send flows is not a regular port.");
             exit(EXIT_FAILURE);
         }
-        sendHost->sockfd = Unicast_send_socket(sendHost->hostname, sendHost->port, AF_UNSPEC, bufflen, &(sendHost->addr), &(sendHost->addrlen));
+        if (flowParam.sendBatch)
+            sendHost->sockfd = Stream_send_socket(sendHost->hostname, sendHost->port, AF_UNSPEC, bufflen);
+        else
+            sendHost->sockfd = Unicast_send_socket(sendHost->hostname, sendHost->port, AF_UNSPEC, bufflen, &(sendHost->addr), &(sendHost->addrlen));
         if (sendHost->sockfd <= 0) exit(EXIT_FAILURE);
         dbg_printf("Replay flows to host: %s port: %s\n", sendHost->hostname, sendHost->port);
         flowParam.sendHost = sendHost;
     }
 
     int buffsize = 64 * 1024;
-    int ret;
+    int ret = 0;
     void *(*packet_thread)(void *) = NULL;
+    // multiple threads for a pcap file get the packets distributed by flow hash from one reader
+    pcapReader_t pcapReader = {0};
     if (pcapfile) {
-        packetParam.live = 0;
-        ret = setup_pcap_file(&packetParam, pcapfile, filter, snaplen);
+        packetParam[0].live = 0;
+        ret = setup_pcap_file(&packetParam[0], pcapfile, filter, snaplen);
         packet_thread = pcap_packet_thread;
+        if (ret == 0 && rings > 1) {
+            for (int i = 0; i < rings; i++) packetParam[i].ringID = i;
+            ret = setup_pcap_reader(&pcapReader, packetParam, rings);
+            packet_thread = pcap_worker_thread;
+        }
+    } else if (useXDP) {
+#ifdef USE_XDP
+        // one AF_XDP socket per ring, bound to the interface queue of the same number
+        ret = 0;
+        for (int i = 0; i < rings && ret == 0; i++) {
+            packetParam[i].live = 1;
+            packetParam[i].ringID = i;
+            ret = setup_xdp_live(&packetParam[i], device, filter, snaplen, i, xdpProgram);
+        }
+        packet_thread = xdp_packet_thread;
+#endif
     } else {
-        packetParam.live = 1;
+        packetParam[0].live = 1;
 #ifdef USE_BPFSOCKET
-        packetParam.bpfBufferSize = buffsize;
-        ret = setup_bpf_live(&packetParam, device, filter, snaplen, buffsize, TO_MS);
+        packetParam[0].bpfBufferSize = buffsize;
+        ret = setup_bpf_live(&packetParam[0], device, filter, snaplen, buffsize, TO_MS);
         packet_thread = bpf_packet_thread;
 #elif USE_TPACKETV3
-        ret = setup_linux_live(&packetParam, device, filter, snaplen, buffsize, TO_MS);
+        // multiple rings join a fanout group, which distributes the flows among the rings
+        int fanout = rings > 1 ? (getpid() & 0xFFFF) : 0;
+        ret = 0;
+        for (int i = 0; i < rings && ret == 0; i++) {
+            packetParam[i].live = 1;
+            packetParam[i].ringID = i;
+            ret = setup_linux_live(&packetParam[i], device, filter, snaplen, buffsize, TO_MS, fanout);
+        }
         packet_thread = linux_packet_thread;
 #else
-        ret = setup_pcap_live(&packetParam, device, filter, snaplen, buffsize, TO_MS);
+        ret = setup_pcap_live(&packetParam[0], device, filter, snaplen, buffsize, TO_MS);
         packet_thread = pcap_packet_thread;
 #endif
     }
@@ -626,7 +722,7 @@ int main(int argc, char *argv[]) {
         if (!Init_nffile(workers, NULL)) exit(EXIT_FAILURE);
 
         if (subdir_index && !InitHierPath(subdir_index)) {
-            pcap_close(packetParam.pcap_dev);
+            pcap_close(packetParam[0].pcap_dev);
             exit(EXIT_FAILURE);
         }
 
@@ -636,13 +732,27 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (!Init_FlowTree(cache_size, activeTimeout, inactiveTimeout)) {
+    // the cache size is shared among all rings
+    if (!Init_FlowTree(cache_size / rings, activeTimeout, inactiveTimeout)) {
         LogError("Init_FlowTree() failed.");
         exit(EXIT_FAILURE);
     }
 
+    for (int i = 0; i < rings; i++) {
+        packetParam[i].flowTree = New_FlowTree();
+        if (!packetParam[i].flowTree) {
+            LogError("New_FlowTree() failed.");
+            exit(EXIT_FAILURE);
+        }
+        packetParam[i].fragTable = NewFragTable();
+        if (!packetParam[i].fragTable) {
+            LogError("NewFragTable() failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (!InitLog(do_daemonize, argv[0], SYSLOG_FACILITY, verbose)) {
-        pcap_close(packetParam.pcap_dev);
+        pcap_close(packetParam[0].pcap_dev);
         exit(EXIT_FAILURE);
     }
 
@@ -651,15 +761,19 @@ int main(int argc, char *argv[]) {
     }
 
     if (pidfile) {
-        if (check_pid(pidfile) != 0 || write_pid(pidfile) == 0) pcap_close(packetParam.pcap_dev);
+        if (check_pid(pidfile) != 0 || write_pid(pidfile) == 0) pcap_close(packetParam[0].pcap_dev);
         exit(EXIT_FAILURE);
     }
 
     if (metricsocket && !OpenMetric(metricsocket, metricInterval)) {
         exit(EXIT_FAILURE);
     }
+    if (!OpenMetricHTTP()) {
+        exit(EXIT_FAILURE);
+    }
 
     LogInfo("Startup nfpcapd.");
+    LogVerbose("%s", CPUDispatchInfo());
     // prepare signal mask for all threads
     // block signals, as they are handled by the main thread
     // mask is inherited by all threads
@@ -682,14 +796,15 @@ int main(int argc, char *argv[]) {
 
     // fire pcap dump flush thread
     if (pcap_datadir) {
-        flushParam.pcap_dev = packetParam.pcap_dev;
+        flushParam.pcap_dev = packetParam[0].pcap_dev;
         flushParam.archivedir = pcap_datadir;
         flushParam.subdir_index = subdir_index;
         if (InitBufferQueues(&flushParam) < 0) {
             exit(EXIT_FAILURE);
         }
-        packetParam.bufferQueue = flushParam.bufferQueue;
-        packetParam.flushQueue = flushParam.flushQueue;
+        packetParam[0].bufferQueue = flushParam.bufferQueue;
+        packetParam[0].flushQueue = flushParam.flushQueue;
+        MetricQueue("pcapdump", flushParam.flushQueue);
         flushParam.parent = pthread_self();
 
         int err = pthread_create(&flushParam.tid, NULL, flush_thread, (void *)&flushParam);
@@ -707,7 +822,9 @@ int main(int argc, char *argv[]) {
     flowParam.compress = compress;
     flowParam.subdir_index = subdir_index;
     flowParam.parent = pthread_self();
-    flowParam.NodeList = NewNodeList();
+    // reading a pcap file outruns the flow thread - limit the nodes list of live captures only
+    int maxQueue = pcapfile ? 0 : ConfGetValue("flowqueue.max");
+    flowParam.NodeList = NewNodeList(rings, maxQueue > 0 ? maxQueue : 0);
     flowParam.printRecord = (do_daemonize == 0) && (verbose > 2);
     if (sendHost) {
         err = pthread_create(&flowParam.tid, NULL, sendflow_thread, (void *)&flowParam);
@@ -720,26 +837,49 @@ int main(int argc, char *argv[]) {
     }
     dbg_printf("Started flow thread[%lu]", (long unsigned)flowParam.tid);
 
-    packetParam.parent = pthread_self();
-    packetParam.NodeList = flowParam.NodeList;
-    packetParam.extendedFlow = flowParam.extendedFlow;
-    packetParam.addPayload = flowParam.addPayload;
-    packetParam.t_win = t_win;
-    packetParam.done = &done;
-    err = pthread_create(&packetParam.tid, NULL, packet_thread, (void *)&packetParam);
-    if (err) {
-        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < rings; i++) {
+        packetParam[i].parent = pthread_self();
+        packetParam[i].NodeList = flowParam.NodeList;
+        packetParam[i].extendedFlow = flowParam.extendedFlow;
+        packetParam[i].addPayload = flowParam.addPayload;
+        packetParam[i].t_win = t_win;
+        packetParam[i].done = &done;
+        err = pthread_create(&packetParam[i].tid, NULL, packet_thread, (void *)&packetParam[i]);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        dbg_printf("Started packet thread[%lu]\n", (long unsigned)packetParam[i].tid);
+    }
+
+    if (pcapReader.numWorkers) {
+        pcapReader.parent = pthread_self();
+        pcapReader.t_win = t_win;
+        pcapReader.done = &done;
+        err = pthread_create(&pcapReader.tid, NULL, pcap_reader_thread, (void *)&pcapReader);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        dbg_printf("Started pcap reader thread[%lu]\n", (long unsigned)pcapReader.tid);
     }
-    dbg_printf("Started packet thread[%lu]\n", (long unsigned)packetParam.tid);
 
     // Wait till done
     WaitDone();
 
-    dbg_printf("Signal packet thread to terminate\n");
-    pthread_kill(packetParam.tid, SIGUSR2);
-    pthread_join(packetParam.tid, NULL);
-    dbg_printf("Packet thread joined\n");
+    // the reader closes the worker queues. The workers process all remaining packets
+    if (pcapReader.numWorkers) {
+        pthread_kill(pcapReader.tid, SIGUSR2);
+        pthread_join(pcapReader.tid, NULL);
+        dbg_printf("Pcap reader thread joined\n");
+    }
+
+    dbg_printf("Signal packet threads to terminate\n");
+    for (int i = 0; i < rings; i++) {
+        pthread_kill(packetParam[i].tid, SIGUSR2);
+        pthread_join(packetParam[i].tid, NULL);
+    }
+    dbg_printf("Packet threads joined\n");
 
     if (pcap_datadir) {
         pthread_join(flushParam.tid, NULL);
@@ -747,7 +887,10 @@ int main(int argc, char *argv[]) {
     }
 
     dbg_printf("Flush flow tree\n");
-    Flush_FlowTree(flowParam.NodeList, packetParam.t_win);
+    for (int i = 0; i < rings; i++) {
+        Flush_FlowTree(packetParam[i].flowTree, flowParam.NodeList, packetParam[i].t_win);
+        DisposeFragTable(packetParam[i].fragTable);
+    }
 
     // flow thread terminates on end of node queue
     pthread_join(flowParam.tid, NULL);
@@ -764,8 +907,16 @@ int main(int argc, char *argv[]) {
 
     CloseMetric();
 
-    LogInfo("Total: Processed: %u, skipped: %u, short caplen: %u, unknown: %u, duplicates: %llu\n", packetParam.proc_stat.packets,
-            packetParam.proc_stat.skipped, packetParam.proc_stat.short_snap, packetParam.proc_stat.unknown, packetParam.proc_stat.duplicates);
+    proc_stat_t proc_stat = {0};
+    for (int i = 0; i < rings; i++) {
+        proc_stat.packets += packetParam[i].proc_stat.packets;
+        proc_stat.skipped += packetParam[i].proc_stat.skipped;
+        proc_stat.short_snap += packetParam[i].proc_stat.short_snap;
+        proc_stat.unknown += packetParam[i].proc_stat.unknown;
+        proc_stat.duplicates += packetParam[i].proc_stat.duplicates;
+    }
+    LogInfo("Total: Processed: %u, skipped: %u, short caplen: %u, unknown: %u, duplicates: %llu\n", proc_stat.packets, proc_stat.skipped,
+            proc_stat.short_snap, proc_stat.unknown, proc_stat.duplicates);
 
     if (pidfile) remove_pid(pidfile);
 
@@ -53,6 +53,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "barrier.h"
 #include "packet_pcap.h"
 #include "pcaproc.h"
 #include "queue.h"
@@ -243,6 +244,7 @@ static inline void PcapDump(packetBuffer_t *packetBuffer, struct bpf_hdr *hdr, c
 
 void __attribute__((noreturn)) * bpf_packet_thread(void *args) {
     packetParam_t *packetParam = (packetParam_t *)args;
+    PinWorker();
 
     time_t t_win = packetParam->t_win;
     time_t now = time(NULL);
@@ -283,10 +285,10 @@ void __attribute__((noreturn)) * bpf_packet_thread(void *args) {
                 }
                 // Rotate flow file
                 ReportStat(packetParam);
-                Push_SyncNode(packetParam->NodeList, t_start);
+                Push_SyncNode(packetParam->flowTree, packetParam->NodeList, t_start);
                 t_start = t_packet - (t_packet % t_win);
             }
-            CacheCheck(packetParam->NodeList, t_start);
+            CacheCheck(packetParam->flowTree, packetParam->NodeList, t_start);
             continue;
         }
 
@@ -321,7 +323,7 @@ void __attribute__((noreturn)) * bpf_packet_thread(void *args) {
                 }
                 // Rotate flow file
                 ReportStat(packetParam);
-                Push_SyncNode(packetParam->NodeList, t_start);
+                Push_SyncNode(packetParam->flowTree, packetParam->NodeList, t_start);
                 t_start = t_packet - (t_packet % t_win);
             }
 
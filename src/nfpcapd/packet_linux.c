@@ -33,6 +33,8 @@
 #include <linux/filter.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 #include <net/if.h>
 #include <poll.h>
 #include <pthread.h>
@@ -51,11 +53,15 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "barrier.h"
 #include "packet_pcap.h"
 #include "pcaproc.h"
 #include "queue.h"
 #include "util.h"
 
+// block is processed, but its frames are still referenced by the flush thread
+#define TP_STATUS_DUMPING (1U << 31)
+
 struct block_desc {
     uint32_t version;
     uint32_t offset_to_priv;
@@ -68,10 +74,13 @@ static int setup_pcap_filter(packetParam_t *param, char *filter);
 
 static void ReportStat(packetParam_t *param);
 
+static int SetupHwTimestamp(packetParam_t *param, char *device);
+
+static void SetupMTU(packetParam_t *param, char *device);
+
 static inline void PcapDump(packetBuffer_t *packetBuffer, struct tpacket3_hdr *ppd);
 
-static struct tpacket_stats_v3 last_stat = {0};
-static proc_stat_t proc_stat = {0};
+static void ReleaseBlock(void *block);
 
 /*
  * Functions
@@ -88,7 +97,7 @@ static void CloseSocket(packetParam_t *param) {
 }
 
 // Initialize the socket rx ring buffer
-static int InitRing(packetParam_t *param, char *device) {
+static int InitRing(packetParam_t *param, char *device, int fanout) {
     unsigned int blocksiz = 1 << 22, framesiz = 1 << 11;
     unsigned int blocknum = 64;
 
@@ -140,12 +149,74 @@ static int InitRing(packetParam_t *param, char *device) {
         return -1;
     }
 
+    if (fanout) {
+        // join the fanout group. Packets are distributed by the symmetric flow hash,
+        // so both directions of a flow end up in the same ring. Fragments get
+        // reassembled before, so they hash to the ring of their flow.
+        int fanoutArg = (fanout & 0xFFFF) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        err = setsockopt(param->fd, SOL_PACKET, PACKET_FANOUT, &fanoutArg, sizeof(fanoutArg));
+        if (err < 0) {
+            LogError("setsockopt(PACKET_FANOUT) failed: %s", strerror(errno));
+            CloseSocket(param);
+            return -1;
+        }
+    }
+
     return 0;
 
 }  // End of InitRing
 
-// live device
-int setup_linux_live(packetParam_t *param, char *device, char *filter, int snaplen, int buffsize, int to_ms) {
+// enable hardware rx timestamps on the NIC and let the ring report them.
+// The NIC clock needs to be synchronized to the system time, e.g. by phc2sys
+static int SetupHwTimestamp(packetParam_t *param, char *device) {
+    struct hwtstamp_config hwconfig;
+    memset(&hwconfig, 0, sizeof(hwconfig));
+    hwconfig.tx_type = HWTSTAMP_TX_OFF;
+    hwconfig.rx_filter = HWTSTAMP_FILTER_ALL;
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, device, IFNAMSIZ - 1);
+    ifr.ifr_data = (void *)&hwconfig;
+
+    if (ioctl(param->fd, SIOCSHWTSTAMP, &ifr) < 0) {
+        LogError("ioctl(SIOCSHWTSTAMP) failed on %s: %s - use software timestamps", device, strerror(errno));
+        return 0;
+    }
+    if (hwconfig.rx_filter == HWTSTAMP_FILTER_NONE) {
+        LogError("Device %s does not timestamp all packets - use software timestamps", device);
+        return 0;
+    }
+
+    int req = SOF_TIMESTAMPING_RAW_HARDWARE;
+    if (setsockopt(param->fd, SOL_PACKET, PACKET_TIMESTAMP, &req, sizeof(req)) < 0) {
+        LogError("setsockopt(PACKET_TIMESTAMP) failed: %s - use software timestamps", strerror(errno));
+        return 0;
+    }
+
+    LogInfo("Hardware timestamps enabled on %s", device);
+    return 1;
+
+}  // End of SetupHwTimestamp
+
+// get the interface MTU. Frames larger than the MTU are GRO/LRO super frames
+static void SetupMTU(packetParam_t *param, char *device) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, device, IFNAMSIZ - 1);
+
+    param->mtu = 0;
+    if (ioctl(param->fd, SIOCGIFMTU, &ifr) < 0) {
+        LogError("ioctl(SIOCGIFMTU) failed on %s: %s", device, strerror(errno));
+        return;
+    }
+    param->mtu = ifr.ifr_mtu;
+    dbg_printf("Device %s MTU: %u\n", device, param->mtu);
+
+}  // End of SetupMTU
+
+// live device. if fanout is not 0, the socket joins the fanout group with this id
+int setup_linux_live(packetParam_t *param, char *device, char *filter, int snaplen, int buffsize, int to_ms, int fanout) {
     param->pcap_dev = NULL;
     param->fd = 0;
 
@@ -164,11 +235,14 @@ int setup_linux_live(packetParam_t *param, char *device, char *filter, int snapl
     }
 
     param->fd = fd;
-    if (InitRing(param, device) < 0) {
+    if (InitRing(param, device, fanout) < 0) {
         CloseSocket(param);
         return -1;
     }
 
+    if (param->hwTimestamp && !SetupHwTimestamp(param, device)) param->hwTimestamp = 0;
+    SetupMTU(param, device);
+
     // XXX fix data link type
     param->linktype = DLT_EN10MB;
 
@@ -215,40 +289,51 @@ static void ReportStat(packetParam_t *param) {
     if (err < 0) {
         LogError("getsockopt(PACKET_STATISTICS) failed: %s", strerror(errno));
     } else {
-        LogInfo("Stat: received: %u, dropped by OS/Buffer: %u, freeze_q_cnt: %u", pstat.tp_packets - last_stat.tp_packets,
-                pstat.tp_drops - last_stat.tp_drops, pstat.tp_freeze_q_cnt - last_stat.tp_freeze_q_cnt);
-        last_stat = pstat;
+        struct tpacket_stats_v3 *last_stat = &(param->last_stat);
+        LogInfo("Stat: ring: %u, received: %u, dropped by OS/Buffer: %u, freeze_q_cnt: %u", param->ringID,
+                pstat.tp_packets - last_stat->tp_packets, pstat.tp_drops - last_stat->tp_drops,
+                pstat.tp_freeze_q_cnt - last_stat->tp_freeze_q_cnt);
+        *last_stat = pstat;
     }
 
-    LogInfo("Processed: %u, skipped: %u, short caplen: %u, unknown: %u", param->proc_stat.packets - proc_stat.packets,
-            param->proc_stat.skipped - proc_stat.skipped, param->proc_stat.short_snap - proc_stat.short_snap,
-            param->proc_stat.unknown - proc_stat.unknown);
+    proc_stat_t *proc_stat = &(param->last_proc_stat);
+    LogInfo("Processed: %u, skipped: %u, short caplen: %u, unknown: %u", param->proc_stat.packets - proc_stat->packets,
+            param->proc_stat.skipped - proc_stat->skipped, param->proc_stat.short_snap - proc_stat->short_snap,
+            param->proc_stat.unknown - proc_stat->unknown);
 
-    proc_stat = param->proc_stat;
+    *proc_stat = param->proc_stat;
 
 }  // End of ReportStat
 
 static inline void PcapDump(packetBuffer_t *packetBuffer, struct tpacket3_hdr *ppd) {
-    // caller checks for enough space in buffer
-    struct pcap_sf_pkthdr sf_hdr;
-    sf_hdr.ts.tv_sec = ppd->tp_sec;
-    sf_hdr.ts.tv_usec = ppd->tp_nsec / 1000;
-    sf_hdr.caplen = ppd->tp_snaplen;
-    sf_hdr.len = ppd->tp_len;
-
-    void *p = packetBuffer->buffer + packetBuffer->bufferSize;
-    memcpy(p, (void *)&sf_hdr, sizeof(sf_hdr));
-    p += sizeof(struct pcap_sf_pkthdr);
-
-    void *sp = (void *)ppd + ppd->tp_mac;
-    memcpy(p, (void *)sp, ppd->tp_snaplen);
-    packetBuffer->bufferSize += (sizeof(struct pcap_sf_pkthdr) + ppd->tp_snaplen);
-    dbg_printf("Buffer size: %zu\n", packetBuffer->bufferSize);
+    // caller checks for enough iov elements in buffer
+    struct pcap_sf_pkthdr *sf_hdr = (struct pcap_sf_pkthdr *)(packetBuffer->buffer + packetBuffer->bufferSize);
+    sf_hdr->ts.tv_sec = ppd->tp_sec;
+    sf_hdr->ts.tv_usec = ppd->tp_nsec / 1000;
+    sf_hdr->caplen = ppd->tp_snaplen;
+    sf_hdr->len = ppd->tp_len;
+    packetBuffer->bufferSize += sizeof(struct pcap_sf_pkthdr);
+
+    // zero copy - reference the frame in the ring
+    struct iovec *iov = packetBuffer->iov + packetBuffer->iovCnt;
+    iov[0].iov_base = (void *)sf_hdr;
+    iov[0].iov_len = sizeof(struct pcap_sf_pkthdr);
+    iov[1].iov_base = (void *)ppd + ppd->tp_mac;
+    iov[1].iov_len = ppd->tp_snaplen;
+    packetBuffer->iovCnt += 2;
+    dbg_printf("Buffer iov: %u\n", packetBuffer->iovCnt);
 
 }  // End of PcapDump
 
+// called by the flush thread, after the frames of the block are written
+static void ReleaseBlock(void *block) {
+    struct block_desc *pbd = (struct block_desc *)block;
+    __atomic_store_n(&pbd->h1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+}  // End of ReleaseBlock
+
 void __attribute__((noreturn)) * linux_packet_thread(void *args) {
     packetParam_t *packetParam = (packetParam_t *)args;
+    PinWorker();
 
     time_t t_win = packetParam->t_win;
     time_t now = time(NULL);
@@ -271,6 +356,13 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
         struct block_desc *pbd;
         pbd = (struct block_desc *)packetParam->ring.rd[block_num].iov_base;
 
+        if (__atomic_load_n(&pbd->h1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_DUMPING) {
+            // wait for the flush thread to hand back the block
+            usleep(100);
+            done = *(packetParam->done);
+            continue;
+        }
+
         int ready;
         time_t t_packet = 0;
         if ((pbd->h1.block_status & TP_STATUS_USER) == 0) {
@@ -292,10 +384,10 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
                     }
                     // Rotate flow file
                     ReportStat(packetParam);
-                    Push_SyncNode(packetParam->NodeList, t_start);
+                    Push_SyncNode(packetParam->flowTree, packetParam->NodeList, t_start);
                     t_start = t_packet - (t_packet % t_win);
                 }
-                CacheCheck(packetParam->NodeList, t_start);
+                CacheCheck(packetParam->flowTree, packetParam->NodeList, t_start);
                 continue;
             }
         }
@@ -303,6 +395,7 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
         if (done) break;
 
         int num_pkts = pbd->h1.num_pkts;
+        int blockDumped = 0;
         dbg_printf("next block. packets: %u\n", num_pkts);
         struct tpacket3_hdr *ppd;
         ppd = (struct tpacket3_hdr *)((uint8_t *)pbd + pbd->h1.offset_to_first_pkt);
@@ -320,7 +413,7 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
                 }
                 // Rotate flow file
                 ReportStat(packetParam);
-                Push_SyncNode(packetParam->NodeList, t_start);
+                Push_SyncNode(packetParam->flowTree, packetParam->NodeList, t_start);
                 t_start = t_packet - (t_packet % t_win);
             }
 
@@ -332,22 +425,32 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
             void *data = (void *)ppd + ppd->tp_mac;
             int ok = ProcessPacket(packetParam, &phdr, data);
 
-            size_t size = sizeof(struct pcap_sf_pkthdr) + ppd->tp_len;
             if (DoPacketDump && ok) {
-                if ((packetBuffer->bufferSize + size) > BUFFSIZE) {
+                if ((packetBuffer->iovCnt + 2) > packetBuffer->iovSize) {
                     packetBuffer->timeStamp = 0;
                     dbg_printf("packet_thread() flush buffer - size %zu\n", packetBuffer->bufferSize);
                     queue_push(packetParam->flushQueue, packetBuffer);
                     packetBuffer = queue_pop(packetParam->bufferQueue);
                 }
                 PcapDump(packetBuffer, ppd);
+                blockDumped = 1;
             }
 
             ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
         }
         done = done || *(packetParam->done);
 
-        pbd->h1.block_status = TP_STATUS_KERNEL;
+        if (blockDumped) {
+            // frames of this block are referenced - the flush thread hands back the block after writing
+            pbd->h1.block_status = TP_STATUS_USER | TP_STATUS_DUMPING;
+            packetBuffer->timeStamp = 0;
+            packetBuffer->release = ReleaseBlock;
+            packetBuffer->block = (void *)pbd;
+            queue_push(packetParam->flushQueue, packetBuffer);
+            packetBuffer = queue_pop(packetParam->bufferQueue);
+        } else {
+            pbd->h1.block_status = TP_STATUS_KERNEL;
+        }
         block_num = (block_num + 1) % 64;
     }
 
@@ -360,7 +463,13 @@ void __attribute__((noreturn)) * linux_packet_thread(void *args) {
     }
 
     ReportStat(packetParam);
-    CloseSocket(packetParam);
+    if (DoPacketDump) {
+        // the flush thread may still write frames from the ring. Keep the ring mapped until exit
+        close(packetParam->fd);
+        packetParam->fd = 0;
+    } else {
+        CloseSocket(packetParam);
+    }
 
     // Tell parent we are gone
     pthread_kill(packetParam->parent, SIGUSR1);
@@ -45,6 +45,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "barrier.h"
 #include "pcaproc.h"
 #include "queue.h"
 #include "util.h"
@@ -57,6 +58,14 @@ static void ReportStat(packetParam_t *param);
 
 static inline void PcapDump(packetBuffer_t *packetBuffer, struct pcap_pkthdr *hdr, const u_char *sp);
 
+// read buffer of pcap files
+#define STREAMBUFFSIZE (4 * 1024 * 1024)
+
+// packet batches of the pcap reader. A packet is stored as pcap_pkthdr followed by the data
+#define PACKETBATCHSIZE (1024 * 1024)
+#define PACKETBATCHES 4
+#define BATCHRECORDSIZE(caplen) ((sizeof(struct pcap_pkthdr) + (caplen) + 7) & ~(size_t)7)
+
 static struct pcap_stat last_stat = {0};
 static proc_stat_t proc_stat = {0};
 
@@ -230,24 +239,16 @@ static inline void PcapDump(packetBuffer_t *packetBuffer, struct pcap_pkthdr *hd
 
 void __attribute__((noreturn)) * pcap_packet_thread(void *args) {
     packetParam_t *packetParam = (packetParam_t *)args;
+    PinWorker();
 
     time_t t_win = packetParam->t_win;
-    time_t now = 0;
+    // start time is now for live capture and the time of the 1st packet for file reading.
+    // A file may be a pipe from a decompressor, which can not be rewound
+    time_t t_start = 0;
     if (packetParam->live) {
-        // start time is now for live capture
-        now = time(NULL);
-    } else {
-        struct pcap_pkthdr *hdr;
-        const u_char *data;
-        // start time is time of 1st packet for file reading
-        long pos = ftell(pcap_file(packetParam->pcap_dev));
-        if (pcap_next_ex(packetParam->pcap_dev, &hdr, &data) == 1) {
-            now = hdr->ts.tv_sec;
-        }
-        // reset file to 1st packet
-        fseek(pcap_file(packetParam->pcap_dev), pos, SEEK_SET);
+        time_t now = time(NULL);
+        t_start = now - (now % t_win);
     }
-    time_t t_start = now - (now % t_win);
 
     int done = *(packetParam->done);
     int DoPacketDump = packetParam->bufferQueue != NULL;
@@ -266,6 +267,7 @@ void __attribute__((noreturn)) * pcap_packet_thread(void *args) {
                 // packet read ok
                 dbg_printf("pcap_next_ex() next packet\n");
                 t_packet = hdr->ts.tv_sec;
+                if (t_start == 0) t_start = t_packet - (t_packet % t_win);
                 if ((t_packet - t_start) >= t_win) {
                     if (DoPacketDump) {
                         // Rote dump file - close old - open new
@@ -276,7 +278,7 @@ void __attribute__((noreturn)) * pcap_packet_thread(void *args) {
                     }
                     // Rotate flow file
                     ReportStat(packetParam);
-                    Push_SyncNode(packetParam->NodeList, t_start);
+                    Push_SyncNode(packetParam->flowTree, packetParam->NodeList, t_start);
                     t_start = t_packet - (t_packet % t_win);
                 }
 
@@ -306,10 +308,10 @@ void __attribute__((noreturn)) * pcap_packet_thread(void *args) {
                         packetBuffer = queue_pop(packetParam->bufferQueue);
                     }
                     ReportStat(packetParam);
-                    Push_SyncNode(packetParam->NodeList, t_start);
+                    Push_SyncNode(packetParam->flowTree, packetParam->NodeList, t_start);
                     t_start = t_packet - (t_packet % t_win);
                 }
-                CacheCheck(packetParam->NodeList, t_start);
+                CacheCheck(packetParam->flowTree, packetParam->NodeList, t_start);
             } break;
             case -1:
                 // signal error reading the packet
@@ -347,3 +349,196 @@ void __attribute__((noreturn)) * pcap_packet_thread(void *args) {
     /* NOTREACHED */
 
 } /* End of packet_thread */
+
+// decompressors for compressed pcap files, selected by the file extension
+static struct decompressor_s {
+    char *extension;
+    char *command;
+} decompressor[] = {{".gz", "gzip"}, {".bz2", "bzip2"}, {".xz", "xz"}, {".zst", "zstd"}, {".lz4", "lz4"}, {NULL, NULL}};
+
+// open a pcap file for reading with large sequential reads. A compressed file is
+// decompressed by the external decompressor into a pipe
+pcap_t *OpenPcapFile(char *pcapFile, char *errbuf) {
+    char *command = NULL;
+    size_t len = strlen(pcapFile);
+    for (int i = 0; decompressor[i].extension; i++) {
+        size_t extLen = strlen(decompressor[i].extension);
+        if (len > extLen && strcmp(pcapFile + len - extLen, decompressor[i].extension) == 0) {
+            command = decompressor[i].command;
+            break;
+        }
+    }
+
+    FILE *fp = NULL;
+    if (command) {
+        int pfd[2];
+        if (pipe(pfd) < 0) {
+            snprintf(errbuf, PCAP_ERRBUF_SIZE, "pipe() failed: %s", strerror(errno));
+            return NULL;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            snprintf(errbuf, PCAP_ERRBUF_SIZE, "fork() failed: %s", strerror(errno));
+            close(pfd[0]);
+            close(pfd[1]);
+            return NULL;
+        }
+        if (pid == 0) {
+            // child - decompress the file into the pipe
+            close(pfd[0]);
+            if (dup2(pfd[1], STDOUT_FILENO) < 0) _exit(255);
+            close(pfd[1]);
+            execlp(command, command, "-dc", pcapFile, (char *)NULL);
+            fprintf(stderr, "execlp() %s failed: %s\n", command, strerror(errno));
+            _exit(255);
+        }
+        close(pfd[1]);
+        fp = fdopen(pfd[0], "rb");
+    } else {
+        fp = fopen(pcapFile, "rb");
+    }
+    if (!fp) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "open '%s' failed: %s", pcapFile, strerror(errno));
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, STREAMBUFFSIZE);
+
+    pcap_t *p = pcap_fopen_offline(fp, errbuf);
+    if (!p) fclose(fp);
+
+    return p;
+
+}  // End of OpenPcapFile
+
+int setup_pcap_reader(pcapReader_t *pcapReader, packetParam_t *packetParam, uint32_t numWorkers) {
+    // enough batches for all worker queues and the batches filled by the reader
+    uint32_t numBatches = 1;
+    while (numBatches < numWorkers * (PACKETBATCHES + 1)) numBatches <<= 1;
+
+    pcapReader->freeQueue = queue_init(numBatches);
+    if (!pcapReader->freeQueue) return -1;
+    for (uint32_t i = 0; i < numBatches; i++) {
+        packetBuffer_t *packetBuffer = calloc(1, sizeof(packetBuffer_t));
+        if (!packetBuffer || !(packetBuffer->buffer = malloc(PACKETBATCHSIZE))) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return -1;
+        }
+        queue_push(pcapReader->freeQueue, (void *)packetBuffer);
+    }
+
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        packetParam[i].packetQueue = queue_init(PACKETBATCHES);
+        if (!packetParam[i].packetQueue) return -1;
+        packetParam[i].freeQueue = pcapReader->freeQueue;
+        packetParam[i].snaplen = packetParam[0].snaplen;
+        packetParam[i].linktype = packetParam[0].linktype;
+    }
+
+    pcapReader->pcap_dev = packetParam[0].pcap_dev;
+    pcapReader->packetParam = packetParam;
+    pcapReader->numWorkers = numWorkers;
+
+    return 0;
+
+}  // End of setup_pcap_reader
+
+void __attribute__((noreturn)) * pcap_reader_thread(void *args) {
+    pcapReader_t *pcapReader = (pcapReader_t *)args;
+    packetParam_t *packetParam = pcapReader->packetParam;
+    uint32_t numWorkers = pcapReader->numWorkers;
+    uint32_t linktype = packetParam[0].linktype;
+
+    // the batch of each worker, currently filled
+    packetBuffer_t *packetBuffer[numWorkers];
+    for (uint32_t i = 0; i < numWorkers; i++) packetBuffer[i] = queue_pop(pcapReader->freeQueue);
+
+    time_t t_win = pcapReader->t_win;
+    time_t t_start = 0;
+    int done = *(pcapReader->done);
+    while (!done) {
+        struct pcap_pkthdr *hdr;
+        const u_char *data;
+
+        int ret = pcap_next_ex(pcapReader->pcap_dev, &hdr, &data);
+        switch (ret) {
+            case 1: {
+                time_t t_packet = hdr->ts.tv_sec;
+                if (t_start == 0) t_start = t_packet - (t_packet % t_win);
+                if ((t_packet - t_start) >= t_win) {
+                    // all workers close the time window after their current batch
+                    for (uint32_t i = 0; i < numWorkers; i++) {
+                        packetBuffer[i]->timeStamp = t_start;
+                        queue_push(packetParam[i].packetQueue, packetBuffer[i]);
+                        packetBuffer[i] = queue_pop(pcapReader->freeQueue);
+                    }
+                    t_start = t_packet - (t_packet % t_win);
+                }
+
+                uint32_t worker = PacketFlowHash(linktype, hdr, data) % numWorkers;
+                size_t size = BATCHRECORDSIZE(hdr->caplen);
+                if ((packetBuffer[worker]->bufferSize + size) > PACKETBATCHSIZE) {
+                    queue_push(packetParam[worker].packetQueue, packetBuffer[worker]);
+                    packetBuffer[worker] = queue_pop(pcapReader->freeQueue);
+                }
+                void *p = packetBuffer[worker]->buffer + packetBuffer[worker]->bufferSize;
+                memcpy(p, (void *)hdr, sizeof(struct pcap_pkthdr));
+                memcpy(p + sizeof(struct pcap_pkthdr), (void *)data, hdr->caplen);
+                packetBuffer[worker]->bufferSize += size;
+            } break;
+            case -1:
+                LogError("pcap_next_ex() read error: '%s'", pcap_geterr(pcapReader->pcap_dev));
+                done = 1;
+                break;
+            case -2:  // End of packet file
+                done = 1;
+                break;
+            default:
+                LogError("Unexpected pcap_next_ex() return value: %i", ret);
+                done = 1;
+        }
+        done = done || *(pcapReader->done);
+    }
+
+    dbg_printf("Done reading pcap file - close worker queues\n");
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        queue_push(packetParam[i].packetQueue, packetBuffer[i]);
+        queue_close(packetParam[i].packetQueue);
+        // flush the flow trees with the last time window
+        packetParam[i].t_win = t_start;
+    }
+    pcap_close(pcapReader->pcap_dev);
+
+    // Tell parent we are gone
+    pthread_kill(pcapReader->parent, SIGUSR1);
+    pthread_exit("leave pcap_reader_thread()");
+    /* NOTREACHED */
+
+}  // End of pcap_reader_thread
+
+void __attribute__((noreturn)) * pcap_worker_thread(void *args) {
+    packetParam_t *packetParam = (packetParam_t *)args;
+    PinWorker();
+
+    packetBuffer_t *packetBuffer;
+    while ((packetBuffer = queue_pop(packetParam->packetQueue)) != QUEUE_CLOSED) {
+        void *p = packetBuffer->buffer;
+        void *eob = packetBuffer->buffer + packetBuffer->bufferSize;
+        while (p < eob) {
+            struct pcap_pkthdr *hdr = (struct pcap_pkthdr *)p;
+            ProcessPacket(packetParam, hdr, (u_char *)(p + sizeof(struct pcap_pkthdr)));
+            p += BATCHRECORDSIZE(hdr->caplen);
+        }
+        if (packetBuffer->timeStamp) {
+            // rotate flow file
+            Push_SyncNode(packetParam->flowTree, packetParam->NodeList, packetBuffer->timeStamp);
+        }
+        packetBuffer->timeStamp = 0;
+        packetBuffer->bufferSize = 0;
+        queue_push(packetParam->freeQueue, packetBuffer);
+    }
+
+    dbg_printf("Worker %u done\n", packetParam->ringID);
+    pthread_exit("leave pcap_worker_thread()");
+    /* NOTREACHED */
+
+}  // End of pcap_worker_thread
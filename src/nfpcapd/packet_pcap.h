@@ -33,9 +33,11 @@
 
 #include <pcap.h>
 #include <pthread.h>
+#include <sys/uio.h>
 #include <time.h>
 
 #include "flowtree.h"
+#include "ipfrag.h"
 #include "queue.h"
 
 #define PROMISC 1
@@ -55,10 +57,21 @@ struct pcap_sf_pkthdr {
     uint32_t len;           /* length this packet (off wire) */
 };
 
+// number of iovec entries of a packet buffer - two per packet
+#define IOVSIZE 4096
+
 typedef struct packetBuffer_s {
     time_t timeStamp;
     size_t bufferSize;
     void *buffer;
+    // zero copy dumping: if iovCnt is not 0, iov references the pcap headers
+    // in buffer and the frames in the packet ring, instead of the data in buffer
+    struct iovec *iov;
+    uint32_t iovCnt;
+    uint32_t iovSize;
+    // hand back the ring block to the kernel, once the buffer is written
+    void (*release)(void *block);
+    void *block;
 } packetBuffer_t;
 
 typedef struct proc_stat_s {
@@ -69,6 +82,14 @@ typedef struct proc_stat_s {
     uint64_t duplicates;
 } proc_stat_t;
 
+// remember the last SlotSize packets with len and hash
+// for duplicate check
+#define SlotSize 8
+typedef struct packetStat_s {
+    uint32_t len;
+    uint64_t hash;
+} packetStat_t;
+
 #ifdef USE_TPACKETV3
 #include <linux/if_packet.h>
 
@@ -92,8 +113,16 @@ typedef struct packetParam_s {
 #ifdef USE_TPACKETV3
     int fd;
     struct ring ring;
+    struct tpacket_stats_v3 last_stat;
+#endif
+#ifdef USE_XDP
+    struct xdpSocket_s *xdpSocket;
 #endif
+    uint32_t ringID;
+    proc_stat_t last_proc_stat;
 
+    flowTree_t *flowTree;
+    fragTable_t *fragTable;
     NodeList_t *NodeList;
     pcap_t *pcap_dev;
     time_t t_win;
@@ -107,13 +136,45 @@ typedef struct packetParam_s {
     uint32_t fat;
     uint32_t extendedFlow;
     uint32_t addPayload;
+    uint32_t hwTimestamp;  // request NIC hardware timestamps
+    uint32_t mtu;          // interface MTU - split GRO/LRO super frames into segments. 0 if unknown
     proc_stat_t proc_stat;
+
+    // duplicate check
+    packetStat_t lastPacketStat[SlotSize];
+    uint32_t packetSlot;
+
+    time_t lastRun;  // remember last run to idle cache
+
+    // parallel pcap file processing
+    queue_t *packetQueue;  // packet batches from the reader
+    queue_t *freeQueue;    // processed batches back to the reader
 } packetParam_t;
 
+// the reader of a pcap file distributes the packets by flow hash among numWorkers packet threads
+typedef struct pcapReader_s {
+    pthread_t tid;
+    pthread_t parent;
+    pcap_t *pcap_dev;
+    packetParam_t *packetParam;
+    uint32_t numWorkers;
+    queue_t *freeQueue;
+    time_t t_win;
+    int *done;
+} pcapReader_t;
+
 int setup_pcap_live(packetParam_t *param, char *device, char *filter, int snaplen, int buffsize, int to_ms);
 
 void __attribute__((noreturn)) * pcap_packet_thread(void *args);
 
+pcap_t *OpenPcapFile(char *pcapFile, char *errbuf);
+
+int setup_pcap_reader(pcapReader_t *pcapReader, packetParam_t *packetParam, uint32_t numWorkers);
+
+void __attribute__((noreturn)) * pcap_reader_thread(void *args);
+
+void __attribute__((noreturn)) * pcap_worker_thread(void *args);
+
 #ifdef USE_BPFSOCKET
 int setup_bpf_live(packetParam_t *param, char *device, char *filter, int snaplen, int buffsize, int to_ms);
 
@@ -121,9 +182,15 @@ void __attribute__((noreturn)) * bpf_packet_thread(void *args);
 #endif
 
 #ifdef USE_TPACKETV3
-int setup_linux_live(packetParam_t *param, char *device, char *filter, int snaplen, int buffsize, int to_ms);
+int setup_linux_live(packetParam_t *param, char *device, char *filter, int snaplen, int buffsize, int to_ms, int fanout);
 
 void __attribute__((noreturn)) * linux_packet_thread(void *args);
 #endif
 
+#ifdef USE_XDP
+int setup_xdp_live(packetParam_t *param, char *device, char *filter, int snaplen, int queue, char *programFile);
+
+void __attribute__((noreturn)) * xdp_packet_thread(void *args);
+#endif
+
 #endif
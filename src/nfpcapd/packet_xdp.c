@@ -0,0 +1,431 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *	 this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *	 this list of conditions and the following disclaimer in the documentation
+ *	 and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *	 used to endorse or promote products derived from this software without
+ *	 specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <bpf/libbpf.h>
+#include <errno.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <xdp/libxdp.h>
+#include <xdp/xsk.h>
+
+#include "barrier.h"
+#include "packet_pcap.h"
+#include "pcaproc.h"
+#include "queue.h"
+#include "util.h"
+
+#define NUMFRAMES 4096
+#define FRAMESIZE XSK_UMEM__DEFAULT_FRAME_SIZE
+#define RXBATCH 64
+
+// name of the XSK map in a custom XDP program
+#define XSKMAP "xsks_map"
+
+struct xdpSocket_s {
+    struct xsk_socket *xsk;
+    struct xsk_umem *umem;
+    void *umemArea;
+    struct xsk_ring_prod fill;
+    struct xsk_ring_cons comp;
+    struct xsk_ring_cons rx;
+    struct xdp_statistics last_stat;
+    struct bpf_program filter_code;
+    int hasFilter;
+};
+
+static void CloseSocket(packetParam_t *param);
+
+static int FillRing(struct xdpSocket_s *xdpSocket);
+
+static void ReportStat(packetParam_t *param);
+
+static inline void PcapDump(packetBuffer_t *packetBuffer, struct pcap_pkthdr *hdr, const u_char *sp);
+
+// custom XDP program, shared by all sockets of the interface
+static pthread_mutex_t m_xdpProgram = PTHREAD_MUTEX_INITIALIZER;
+static struct xdp_program *xdpProgram = NULL;
+static int xdpIfIndex = 0;
+static int xdpRefCnt = 0;
+
+/*
+ * Functions
+ */
+
+static void CloseSocket(packetParam_t *param) {
+    struct xdpSocket_s *xdpSocket = param->xdpSocket;
+    if (!xdpSocket) return;
+
+    if (xdpSocket->xsk) xsk_socket__delete(xdpSocket->xsk);
+    if (xdpSocket->umem) xsk_umem__delete(xdpSocket->umem);
+    if (xdpSocket->umemArea) munmap(xdpSocket->umemArea, NUMFRAMES * FRAMESIZE);
+    if (xdpSocket->hasFilter) pcap_freecode(&xdpSocket->filter_code);
+    free(xdpSocket);
+    param->xdpSocket = NULL;
+
+    pthread_mutex_lock(&m_xdpProgram);
+    if (xdpProgram && --xdpRefCnt == 0) {
+        xdp_program__detach(xdpProgram, xdpIfIndex, XDP_MODE_UNSPEC, 0);
+        xdp_program__close(xdpProgram);
+        xdpProgram = NULL;
+    }
+    pthread_mutex_unlock(&m_xdpProgram);
+
+}  // End of CloseSocket
+
+// load and attach the custom XDP program once for all sockets
+static int LoadProgram(struct xdpSocket_s *xdpSocket, char *programFile, int ifIndex) {
+    pthread_mutex_lock(&m_xdpProgram);
+    if (xdpProgram == NULL) {
+        struct xdp_program *prog = xdp_program__open_file(programFile, NULL, NULL);
+        int err = libxdp_get_error(prog);
+        if (err) {
+            LogError("xdp_program__open_file() failed for %s: %s", programFile, strerror(-err));
+            pthread_mutex_unlock(&m_xdpProgram);
+            return 0;
+        }
+        err = xdp_program__attach(prog, ifIndex, XDP_MODE_NATIVE, 0);
+        if (err) {
+            LogError("xdp_program__attach() failed for %s: %s", programFile, strerror(-err));
+            xdp_program__close(prog);
+            pthread_mutex_unlock(&m_xdpProgram);
+            return 0;
+        }
+        xdpProgram = prog;
+        xdpIfIndex = ifIndex;
+        LogInfo("Attached XDP program %s", programFile);
+    }
+    xdpRefCnt++;
+
+    // register the socket in the program's XSK map
+    int mapFD = bpf_object__find_map_fd_by_name(xdp_program__bpf_obj(xdpProgram), XSKMAP);
+    pthread_mutex_unlock(&m_xdpProgram);
+    if (mapFD < 0) {
+        LogError("XDP program %s has no map '%s'", programFile, XSKMAP);
+        return 0;
+    }
+    int err = xsk_socket__update_xskmap(xdpSocket->xsk, mapFD);
+    if (err) {
+        LogError("xsk_socket__update_xskmap() failed: %s", strerror(-err));
+        return 0;
+    }
+
+    return 1;
+
+}  // End of LoadProgram
+
+// hand all umem frames to the kernel
+static int FillRing(struct xdpSocket_s *xdpSocket) {
+    uint32_t idx = 0;
+    if (xsk_ring_prod__reserve(&xdpSocket->fill, NUMFRAMES, &idx) != NUMFRAMES) {
+        LogError("xsk_ring_prod__reserve() failed to reserve %u frames", NUMFRAMES);
+        return 0;
+    }
+    for (int i = 0; i < NUMFRAMES; i++) *xsk_ring_prod__fill_addr(&xdpSocket->fill, idx++) = (uint64_t)i * FRAMESIZE;
+    xsk_ring_prod__submit(&xdpSocket->fill, NUMFRAMES);
+
+    return 1;
+
+}  // End of FillRing
+
+// live device. Bind an AF_XDP socket to the queue of the device
+int setup_xdp_live(packetParam_t *param, char *device, char *filter, int snaplen, int queue, char *programFile) {
+    param->pcap_dev = NULL;
+
+    int ifIndex = if_nametoindex(device);
+    if (ifIndex == 0) {
+        LogError("if_nametoindex() failed for %s: %s", device, strerror(errno));
+        return -1;
+    }
+
+    struct xdpSocket_s *xdpSocket = calloc(1, sizeof(struct xdpSocket_s));
+    if (!xdpSocket) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return -1;
+    }
+    param->xdpSocket = xdpSocket;
+
+    xdpSocket->umemArea = mmap(NULL, NUMFRAMES * FRAMESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xdpSocket->umemArea == MAP_FAILED) {
+        LogError("mmap() failed: %s", strerror(errno));
+        xdpSocket->umemArea = NULL;
+        CloseSocket(param);
+        return -1;
+    }
+
+    struct xsk_umem_config umemConfig = {.fill_size = NUMFRAMES,
+                                         .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+                                         .frame_size = FRAMESIZE,
+                                         .frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM,
+                                         .flags = 0};
+    int err = xsk_umem__create(&xdpSocket->umem, xdpSocket->umemArea, NUMFRAMES * FRAMESIZE, &xdpSocket->fill, &xdpSocket->comp, &umemConfig);
+    if (err) {
+        LogError("xsk_umem__create() failed: %s", strerror(-err));
+        xdpSocket->umem = NULL;
+        CloseSocket(param);
+        return -1;
+    }
+
+    // without a custom program, libxdp loads its default redirect program
+    struct xsk_socket_config socketConfig = {.rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+                                             .tx_size = 0,
+                                             .libxdp_flags = programFile ? XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD : 0,
+                                             .xdp_flags = 0,
+                                             .bind_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP};
+    err = xsk_socket__create(&xdpSocket->xsk, device, queue, xdpSocket->umem, &xdpSocket->rx, NULL, &socketConfig);
+    if (err) {
+        LogInfo("Zero copy mode not supported on %s queue %d - fall back to copy mode", device, queue);
+        socketConfig.bind_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        err = xsk_socket__create(&xdpSocket->xsk, device, queue, xdpSocket->umem, &xdpSocket->rx, NULL, &socketConfig);
+    }
+    if (err) {
+        LogError("xsk_socket__create() failed for %s queue %d: %s", device, queue, strerror(-err));
+        xdpSocket->xsk = NULL;
+        CloseSocket(param);
+        return -1;
+    }
+
+    if (programFile && !LoadProgram(xdpSocket, programFile, ifIndex)) {
+        CloseSocket(param);
+        return -1;
+    }
+
+    if (!FillRing(xdpSocket)) {
+        CloseSocket(param);
+        return -1;
+    }
+
+    param->linktype = DLT_EN10MB;
+    param->snaplen = snaplen;
+
+    // pcap handle for dumper and filter
+    param->pcap_dev = pcap_open_dead(DLT_EN10MB, snaplen);
+
+    // AF_XDP sockets do not support socket filters - filter in user space
+    if (filter) {
+        if (pcap_compile(param->pcap_dev, &xdpSocket->filter_code, filter, 1, PCAP_NETMASK_UNKNOWN)) {
+            LogError("pcap_compile() failed: %s", pcap_geterr(param->pcap_dev));
+            pcap_close(param->pcap_dev);
+            CloseSocket(param);
+            return -1;
+        }
+        xdpSocket->hasFilter = 1;
+    }
+
+    return 0;
+
+}  // End of setup_xdp_live
+
+static void ReportStat(packetParam_t *param) {
+    struct xdpSocket_s *xdpSocket = param->xdpSocket;
+    struct xdp_statistics xstat;
+
+    memset((void *)&xstat, 0, sizeof(struct xdp_statistics));
+    socklen_t len = sizeof(xstat);
+    int err = getsockopt(xsk_socket__fd(xdpSocket->xsk), SOL_XDP, XDP_STATISTICS, &xstat, &len);
+    if (err < 0) {
+        LogError("getsockopt(XDP_STATISTICS) failed: %s", strerror(errno));
+    } else {
+        struct xdp_statistics *last_stat = &(xdpSocket->last_stat);
+        LogInfo("Stat: ring: %u, dropped: %llu, rx ring full: %llu, fill ring empty: %llu", param->ringID,
+                (unsigned long long)(xstat.rx_dropped - last_stat->rx_dropped),
+                (unsigned long long)(xstat.rx_ring_full - last_stat->rx_ring_full),
+                (unsigned long long)(xstat.rx_fill_ring_empty_descs - last_stat->rx_fill_ring_empty_descs));
+        *last_stat = xstat;
+    }
+
+    proc_stat_t *proc_stat = &(param->last_proc_stat);
+    LogInfo("Processed: %u, skipped: %u, short caplen: %u, unknown: %u", param->proc_stat.packets - proc_stat->packets,
+            param->proc_stat.skipped - proc_stat->skipped, param->proc_stat.short_snap - proc_stat->short_snap,
+            param->proc_stat.unknown - proc_stat->unknown);
+
+    *proc_stat = param->proc_stat;
+
+}  // End of ReportStat
+
+static inline void PcapDump(packetBuffer_t *packetBuffer, struct pcap_pkthdr *hdr, const u_char *sp) {
+    // caller checks for enough space in buffer
+    struct pcap_sf_pkthdr sf_hdr;
+    sf_hdr.ts.tv_sec = hdr->ts.tv_sec;
+    sf_hdr.ts.tv_usec = hdr->ts.tv_usec;
+    sf_hdr.caplen = hdr->caplen;
+    sf_hdr.len = hdr->len;
+
+    void *p = packetBuffer->buffer + packetBuffer->bufferSize;
+    memcpy(p, (void *)&sf_hdr, sizeof(sf_hdr));
+    p += sizeof(struct pcap_sf_pkthdr);
+
+    memcpy(p, (void *)sp, hdr->caplen);
+    packetBuffer->bufferSize += (sizeof(struct pcap_sf_pkthdr) + hdr->caplen);
+    dbg_printf("Buffer size: %zu\n", packetBuffer->bufferSize);
+
+}  // End of PcapDump
+
+void __attribute__((noreturn)) * xdp_packet_thread(void *args) {
+    packetParam_t *packetParam = (packetParam_t *)args;
+    PinWorker();
+    struct xdpSocket_s *xdpSocket = packetParam->xdpSocket;
+
+    time_t t_win = packetParam->t_win;
+    time_t now = time(NULL);
+    time_t t_start = now - (now % t_win);
+
+    int done = *(packetParam->done);
+    int DoPacketDump = packetParam->bufferQueue != NULL;
+
+    packetBuffer_t *packetBuffer = NULL;
+    if (DoPacketDump) packetBuffer = queue_pop(packetParam->bufferQueue);
+
+    struct pollfd pfd;
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = xsk_socket__fd(xdpSocket->xsk);
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    while (!done) {
+        uint32_t idx_rx = 0;
+        uint32_t rcvd = xsk_ring_cons__peek(&xdpSocket->rx, RXBATCH, &idx_rx);
+        time_t t_packet = 0;
+        if (rcvd == 0) {
+            int ready = poll(&pfd, 1, 1000);
+            if (ready == -1) {
+                if (errno != EINTR) LogError("poll() on socket failed: %s", strerror(errno));
+                done = 1;
+            } else if (ready == 0) {
+                dbg_printf("poll() - timeout\n");
+                struct timeval tv;
+                gettimeofday(&tv, NULL);
+                t_packet = tv.tv_sec;
+                if ((t_packet - t_start) >= t_win) { /* rotate file */
+                    if (DoPacketDump) {
+                        // Rote dump file - close old - open new
+                        packetBuffer->timeStamp = t_start;
+                        queue_push(packetParam->flushQueue, packetBuffer);
+                        packetBuffer = queue_pop(packetParam->bufferQueue);
+                    }
+                    // Rotate flow file
+                    ReportStat(packetParam);
+                    Push_SyncNode(packetParam->flowTree, packetParam->NodeList, t_start);
+                    t_start = t_packet - (t_packet % t_win);
+                }
+                CacheCheck(packetParam->flowTree, packetParam->NodeList, t_start);
+            }
+            done = done || *(packetParam->done);
+            continue;
+        }
+
+        // AF_XDP does not timestamp packets - use the time of the batch
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        t_packet = tv.tv_sec;
+        if ((t_packet - t_start) >= t_win) {
+            // Rote dump file - close old - open new
+            if (DoPacketDump) {
+                dbg_printf("packet_thread() flush file - buffer: %zu\n", packetBuffer->bufferSize);
+                packetBuffer->timeStamp = t_start;
+                queue_push(packetParam->flushQueue, packetBuffer);
+                packetBuffer = queue_pop(packetParam->bufferQueue);
+            }
+            // Rotate flow file
+            ReportStat(packetParam);
+            Push_SyncNode(packetParam->flowTree, packetParam->NodeList, t_start);
+            t_start = t_packet - (t_packet % t_win);
+        }
+
+        // the frames go back into the fill ring after processing
+        uint32_t idx_fill = 0;
+        while (xsk_ring_prod__reserve(&xdpSocket->fill, rcvd, &idx_fill) != rcvd) {
+            // fill ring is full - wake up the kernel to consume it
+            if (xsk_ring_prod__needs_wakeup(&xdpSocket->fill)) recvfrom(pfd.fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        }
+
+        dbg_printf("next batch. packets: %u\n", rcvd);
+        for (uint32_t i = 0; i < rcvd; i++) {
+            const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&xdpSocket->rx, idx_rx + i);
+            void *data = xsk_umem__get_data(xdpSocket->umemArea, desc->addr);
+            *xsk_ring_prod__fill_addr(&xdpSocket->fill, idx_fill + i) = xsk_umem__extract_addr(desc->addr);
+
+            uint32_t caplen = desc->len > packetParam->snaplen ? packetParam->snaplen : desc->len;
+            struct pcap_pkthdr phdr = {//
+                                       .ts = tv,
+                                       .caplen = caplen,
+                                       .len = desc->len};
+            if (xdpSocket->hasFilter && !pcap_offline_filter(&xdpSocket->filter_code, &phdr, data)) continue;
+
+            int ok = ProcessPacket(packetParam, &phdr, data);
+
+            size_t size = sizeof(struct pcap_sf_pkthdr) + caplen;
+            if (DoPacketDump && ok) {
+                if ((packetBuffer->bufferSize + size) > BUFFSIZE) {
+                    packetBuffer->timeStamp = 0;
+                    dbg_printf("packet_thread() flush buffer - size %zu\n", packetBuffer->bufferSize);
+                    queue_push(packetParam->flushQueue, packetBuffer);
+                    packetBuffer = queue_pop(packetParam->bufferQueue);
+                }
+                PcapDump(packetBuffer, &phdr, data);
+            }
+        }
+        xsk_ring_prod__submit(&xdpSocket->fill, rcvd);
+        xsk_ring_cons__release(&xdpSocket->rx, rcvd);
+
+        done = done || *(packetParam->done);
+    }
+
+    // flush buffer
+    dbg_printf("Done capture loop - signal close\n");
+    if (DoPacketDump) {
+        packetBuffer->timeStamp = t_start;
+        queue_push(packetParam->flushQueue, packetBuffer);
+        queue_close(packetParam->flushQueue);
+    }
+
+    ReportStat(packetParam);
+    CloseSocket(packetParam);
+
+    // Tell parent we are gone
+    pthread_kill(packetParam->parent, SIGUSR1);
+    pthread_exit("End packet_thread()");
+    /* NOTREACHED */
+
+}  // End of xdp_packet_thread
@@ -32,6 +32,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -41,6 +42,7 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -53,6 +55,10 @@
 #define PCAP_TMP "pcap.current"
 #define MAXBUFFERS 8
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 static char pcap_dumpfile[MAXPATHLEN];
 
 /*
@@ -62,6 +68,8 @@ static int OpenDumpFile(flushParam_t *param);
 
 static int CloseDumpFile(flushParam_t *param, time_t t_start);
 
+static int WriteVector(int fd, struct iovec *iov, int iovCnt);
+
 /*
  * Functions
  */
@@ -208,6 +216,34 @@ static int CloseDumpFile(flushParam_t *param, time_t t_start) {
 
 }  // End of CloseDumpFile
 
+// write all iov elements. writev() accepts at most IOV_MAX elements and may write partially
+static int WriteVector(int fd, struct iovec *iov, int iovCnt) {
+    while (iovCnt) {
+        int cnt = iovCnt > IOV_MAX ? IOV_MAX : iovCnt;
+        ssize_t ret = writev(fd, iov, cnt);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        // skip written elements
+        size_t len = (size_t)ret;
+        while (iovCnt && len >= iov->iov_len) {
+            len -= iov->iov_len;
+            iov++;
+            iovCnt--;
+        }
+        if (len) {
+            // partially written element
+            iov->iov_base += len;
+            iov->iov_len -= len;
+        }
+    }
+
+    return 0;
+
+}  // End of WriteVector
+
 int InitBufferQueues(flushParam_t *flushParam) {
     flushParam->bufferQueue = queue_init(MAXBUFFERS);
     flushParam->flushQueue = queue_init(MAXBUFFERS);
@@ -222,10 +258,12 @@ int InitBufferQueues(flushParam_t *flushParam) {
             return -1;
         }
         packetBuffer->buffer = malloc(BUFFSIZE);
-        if (!packetBuffer->buffer) {
+        packetBuffer->iov = malloc(IOVSIZE * sizeof(struct iovec));
+        if (!packetBuffer->buffer || !packetBuffer->iov) {
             LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
             return -1;
         }
+        packetBuffer->iovSize = IOVSIZE;
         queue_push(flushParam->bufferQueue, (void *)packetBuffer);
     }
 
@@ -254,14 +292,25 @@ void __attribute__((noreturn)) * flush_thread(void *args) {
                 /* NOTREACHED */
             }
             dbg_printf("flush_thread() flush buffer\n");
-            if (write(flushParam->pfd, packetBuffer->buffer, packetBuffer->bufferSize) <= 0) {
+            int ret;
+            if (packetBuffer->iovCnt) {
+                // zero copy - write pcap headers and the frames from the packet ring
+                ret = WriteVector(flushParam->pfd, packetBuffer->iov, packetBuffer->iovCnt);
+            } else {
+                ret = write(flushParam->pfd, packetBuffer->buffer, packetBuffer->bufferSize) <= 0 ? -1 : 0;
+            }
+            if (ret < 0) {
                 LogError("write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
             }
+        }
 
-            // return buffer
-            packetBuffer->bufferSize = 0;
-            queue_push(flushParam->bufferQueue, packetBuffer);
+        if (packetBuffer->release) {
+            // the referenced frames are written - hand back the ring block
+            packetBuffer->release(packetBuffer->block);
+            packetBuffer->release = NULL;
+            packetBuffer->block = NULL;
         }
+
         if (timeStamp) {
             // rotate file
             dbg_printf("flush_thread() CloseDumpFile\n");
@@ -273,6 +322,11 @@ void __attribute__((noreturn)) * flush_thread(void *args) {
             }
             packetBuffer->timeStamp = 0;
         }
+
+        // return buffer - also empty buffers, which only rotated the file
+        packetBuffer->bufferSize = 0;
+        packetBuffer->iovCnt = 0;
+        queue_push(flushParam->bufferQueue, packetBuffer);
     }
 
     pthread_exit("ok");
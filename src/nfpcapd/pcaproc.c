@@ -64,6 +64,7 @@
 #include "bookkeeper.h"
 #include "collector.h"
 #include "flowtree.h"
+#include "ipfrag.h"
 #include "nfdump.h"
 #include "nffile.h"
 #include "nflog.h"
@@ -93,16 +94,6 @@ typedef struct vlan_hdr_s {
     uint16_t type;
 } vlan_hdr_t;
 
-// remember the last SlotSize packets with len and hash
-// for duplicate check
-#define SlotSize 8
-static struct {
-    uint32_t len;
-    uint64_t hash;
-} lastPacketStat[SlotSize] = {0};
-static uint32_t packetSlot = 0;
-
-static time_t lastRun = 0;  // remember last run to idle cache
 
 static inline void SetServer_latency(struct FlowNode *node);
 
@@ -118,19 +109,24 @@ static inline void ProcessICMPFlow(packetParam_t *packetParam, struct FlowNode *
 
 static inline void ProcessOtherFlow(packetParam_t *packetParam, struct FlowNode *NewNode, void *payload, size_t payloadSize);
 
+static inline void CountSegments(packetParam_t *packetParam, struct FlowNode *Node, uint32_t hdrSize);
+
+static inline int ProcessFastPath(packetParam_t *packetParam, const struct pcap_pkthdr *hdr, const u_char *data);
+
 #include "metrohash.c"
 
-static int is_duplicate(const uint8_t *data_ptr, const uint32_t len) {
+static int is_duplicate(packetParam_t *packetParam, const uint8_t *data_ptr, const uint32_t len) {
     uint64_t hash = metrohash64_1(data_ptr, len, 0);
 
     for (int i = 0; i < SlotSize; i++) {
-        if (lastPacketStat[i].len == len && lastPacketStat[i].hash == hash) return 1;
+        if (packetParam->lastPacketStat[i].len == len && packetParam->lastPacketStat[i].hash == hash) return 1;
     }
 
     // not found - add to next slot round robin
-    lastPacketStat[packetSlot].len = len;
-    lastPacketStat[packetSlot].hash = hash;
-    packetSlot = (packetSlot + 1) & (SlotSize - 1);
+    uint32_t packetSlot = packetParam->packetSlot;
+    packetParam->lastPacketStat[packetSlot].len = len;
+    packetParam->lastPacketStat[packetSlot].hash = hash;
+    packetParam->packetSlot = (packetSlot + 1) & (SlotSize - 1);
     return 0;
 }  // End of is_duplicate
 
@@ -232,142 +228,65 @@ void RotateFile(pcapfile_t *pcapfile, time_t t_CloseRename, int live) {
 
 // Server latency = t(SYN ACK Server) - t(SYN CLient)
 static inline void SetServer_latency(struct FlowNode *node) {
-    struct FlowNode *Client_node = node->rev_node;
+    // linked nodes have their cold part allocated
+    struct FlowNode *Client_node = ColdData(node)->rev_node;
     if (!Client_node) return;
 
     uint64_t latency = ((uint64_t)node->t_first.tv_sec * (uint64_t)1000000 + (uint64_t)node->t_first.tv_usec) -
                        ((uint64_t)Client_node->t_first.tv_sec * (uint64_t)1000000 + (uint64_t)Client_node->t_first.tv_usec);
 
-    node->latency.server = latency;
-    Client_node->latency.server = latency;
+    node->cold->latency.server = latency;
+    Client_node->cold->latency.server = latency;
     // set flag, to calc app latency with nex packet from server
-    node->latency.flag = 2;
+    node->cold->latency.flag = 2;
     // set flag, to calc client latency with nex packet from client
-    Client_node->latency.flag = 1;
+    Client_node->cold->latency.flag = 1;
     dbg_printf("Server latency: %llu\n", (long long unsigned)latency);
 
 }  // End of SetServerClient_latency
 
 // Client latency = t(ACK CLient) - t(SYN ACK Server)
 static inline void SetClient_latency(struct FlowNode *node, struct timeval *t_packet) {
-    struct FlowNode *serverNode = node->rev_node;
+    struct FlowNode *serverNode = ColdData(node)->rev_node;
     if (!serverNode) return;
 
     uint64_t latency = ((uint64_t)t_packet->tv_sec * (uint64_t)1000000 + (uint64_t)t_packet->tv_usec) -
                        ((uint64_t)serverNode->t_last.tv_sec * (uint64_t)1000000 + (uint64_t)serverNode->t_last.tv_usec);
 
-    node->latency.client = latency;
-    serverNode->latency.client = latency;
+    node->cold->latency.client = latency;
+    serverNode->cold->latency.client = latency;
     // reset flag
-    node->latency.flag = 0;
+    node->cold->latency.flag = 0;
     dbg_printf("Client latency: %llu\n", (long long unsigned)latency);
 
 }  // End of SetClient_latency
 
 // Application latency = t(ACK Server) - t(ACK CLient)
 void SetApplication_latency(struct FlowNode *node, struct timeval *t_packet) {
-    struct FlowNode *clientNode = node->rev_node;
+    struct FlowNode *clientNode = ColdData(node)->rev_node;
     if (!clientNode) return;
 
     uint64_t latency = ((uint64_t)t_packet->tv_sec * (uint64_t)1000000 + (uint64_t)t_packet->tv_usec) -
                        ((uint64_t)clientNode->t_last.tv_sec * (uint64_t)1000000 + (uint64_t)clientNode->t_last.tv_usec);
 
-    node->latency.application = latency;
-    clientNode->latency.application = latency;
+    node->cold->latency.application = latency;
+    clientNode->cold->latency.application = latency;
     // reset flag
-    node->latency.flag = 0;
+    node->cold->latency.flag = 0;
     // set flag, to calc application latency with nex packet from server
-    clientNode->latency.flag = 0;
+    clientNode->cold->latency.flag = 0;
     dbg_printf("Application latency: %llu\n", (long long unsigned)latency);
 
 }  // End of SetApplication_latency
 
-static inline struct FlowNode *ProcessIPfrag(packetParam_t *packetParam, const struct pcap_pkthdr *hdr, struct ip *ip, void *eodata) {
-    uint16_t ip_off = ntohs(ip->ip_off);
-    uint32_t frag_offset = (ip_off & IP_OFFMASK) << 3;
-    int size_ip = (ip->ip_hl << 2);
-
-    struct FlowNode *Node = NULL;
-    if (frag_offset == 0) {
-        // first fragment in sequence
-        dbg_printf("Fragmented packet: first segment: ip_off: %u, frag_offset: %u\n", ip_off, frag_offset);
-        Node = New_Node();
-        Node->t_first.tv_sec = hdr->ts.tv_sec;
-        Node->t_first.tv_usec = hdr->ts.tv_usec;
-        Node->t_last.tv_sec = hdr->ts.tv_sec;
-        Node->t_last.tv_usec = hdr->ts.tv_usec;
-        Node->flowKey.version = AF_INET;
-        Node->flowKey.proto = ip->ip_p;
-        Node->flowKey.src_addr.v4 = ntohl(ip->ip_src.s_addr);
-        Node->flowKey.dst_addr.v4 = ntohl(ip->ip_dst.s_addr);
-        Node->flowKey.src_port = ntohs(ip->ip_id);
-        Node->flowKey.dst_port = 0;
-        Node->nodeType = FRAG_NODE;
-
-        if (Insert_Node(Node) != NULL) {
-            dbg_printf("IP fragment: initial node already exists! Skip!\n");
-            Free_Node(Node);
-            return NULL;
-        }
-
-        // allocate enough memory for udp packet
-        Node->payload = calloc(1, 65536);
-        if (!Node->payload) {
-            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-            Remove_Node(Node);
-            Free_Node(Node);
-            return NULL;
-        }
-    } else {
-        struct FlowNode FindNode = {0};
-        FindNode.flowKey.version = AF_INET;
-        FindNode.flowKey.proto = ip->ip_p;
-        FindNode.flowKey.src_addr.v4 = ntohl(ip->ip_src.s_addr);
-        FindNode.flowKey.dst_addr.v4 = ntohl(ip->ip_dst.s_addr);
-        FindNode.flowKey.src_port = ntohs(ip->ip_id);
-        FindNode.flowKey.dst_port = 0;
-
-        Node = Lookup_Node(&FindNode);
-        if (!Node || Node->nodeType != FRAG_NODE) {
-            dbg_printf("IP fragment: initial node missing! Skip!\n");
-            packetParam->proc_stat.skipped++;
-            return NULL;
-        }
-
-        if ((ip_off & IP_MF) && frag_offset) dbg_printf("Fragmented packet: middle segment: ip_off: %u, frag_offset: %u\n", ip_off, frag_offset);
-    }
-
-    void *dataptr = (void *)ip + size_ip;
-    ptrdiff_t len = eodata - dataptr;
-    dbg_printf("IP frag: Insert fragment at offset: %u, length: %td\n", frag_offset, len);
-    if ((frag_offset + len) > 65536) {
-        LogError("IP fragmen too large: %.", frag_offset + len);
-        Remove_Node(Node);
-        Free_Node(Node);
-        return NULL;
-    }
-
-    memcpy(Node->payload + frag_offset, dataptr, len);
-
-    if ((ip_off & IP_MF) == 0) {
-        // last fragment - export node
-        Node->payloadSize = frag_offset + len;
-        Node->bytes = size_ip + Node->payloadSize;
-        dbg_printf("Fragmented packet: last segment: ip_off: %u, frag_offset: %u, total len: %u\n", ip_off, frag_offset, Node->payloadSize);
-        Remove_Node(Node);
-        return Node;
-    }
-
-    return NULL;
-}  // End of ProcessIPfrag
-
 static inline void AddPayload(struct FlowNode *Node, void *payload, size_t payloadSize) {
-    Node->payload = malloc(payloadSize);
-    if (!Node->payload) {
+    struct flowNodeCold_s *cold = Cold_Node(Node);
+    cold->payload = malloc(payloadSize);
+    if (!cold->payload) {
         LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
     } else {
-        memcpy(Node->payload, payload, payloadSize);
-        Node->payloadSize = payloadSize;
+        memcpy(cold->payload, payload, payloadSize);
+        cold->payloadSize = payloadSize;
     }
 }
 
@@ -375,7 +294,7 @@ static inline void ProcessTCPFlow(packetParam_t *packetParam, struct FlowNode *N
     struct FlowNode *Node;
 
     assert(NewNode->memflag == NODE_IN_USE);
-    Node = Insert_Node(NewNode);
+    Node = Insert_Node(packetParam->flowTree, NewNode);
     // Return existing Node if flow exists already, otherwise insert es new
     if (Node == NULL) {
         // Insert as new
@@ -389,7 +308,7 @@ static inline void ProcessTCPFlow(packetParam_t *packetParam, struct FlowNode *N
         // in case it's a FIN/RST only packet - immediately flush it
         if (NewNode->signal == SIGNAL_FIN) {
             // flush node to flow thread
-            Remove_Node(NewNode);
+            Remove_Node(packetParam->flowTree, NewNode);
             Push_Node(packetParam->NodeList, NewNode);
             return;
         }
@@ -402,7 +321,7 @@ static inline void ProcessTCPFlow(packetParam_t *packetParam, struct FlowNode *N
             printf("SYN ACK Node\n");
         }
 #endif
-        if (packetParam->extendedFlow && Link_RevNode(NewNode)) {
+        if (packetParam->extendedFlow && Link_RevNode(packetParam->flowTree, NewNode)) {
             // if we could link this new node, it is the server answer
             // -> calculate server latency
             SetServer_latency(NewNode);
@@ -413,33 +332,34 @@ static inline void ProcessTCPFlow(packetParam_t *packetParam, struct FlowNode *N
     assert(Node->memflag == NODE_IN_USE);
 
     // check for latency flag
-    if (Node->latency.flag == 1) {
+    uint32_t latencyFlag = ColdData(Node)->latency.flag;
+    if (latencyFlag == 1) {
         SetClient_latency(Node, &(NewNode->t_first));
-    } else if (Node->latency.flag == 2) {
-        dbg_printf("Set App lat slot: %u -> %u diff: %u\n", Node->latency.tsVal, NewNode->latency.tsVal,
-                   NewNode->latency.tsVal - Node->latency.tsVal);
+    } else if (latencyFlag == 2) {
+        dbg_printf("Set App lat slot: %u -> %u diff: %u\n", ColdData(Node)->latency.tsVal, ColdData(NewNode)->latency.tsVal,
+                   ColdData(NewNode)->latency.tsVal - ColdData(Node)->latency.tsVal);
         SetApplication_latency(Node, &(NewNode->t_first));
     }
     // update existing flow
     Node->flags |= NewNode->flags;
-    Node->packets++;
+    Node->packets += NewNode->packets;
     Node->bytes += NewNode->bytes;
     Node->t_last = NewNode->t_last;
 
     // DEVEL RTT - disabled for now
 #if 0
-    if (NewNode->signal != SIGNAL_FIN && Node->latency.ack && ((NewNode->latency.ack - Node->latency.ack) > 0)) {
-        uint32_t rtt = NewNode->latency.tsVal - Node->latency.tsVal;
-        printf("Node old RTT: %u ", Node->latency.rtt);
-        if (rtt) Node->latency.rtt = Node->latency.rtt ? (Node->latency.rtt + rtt) >> 1 : rtt;
-        dbg_printf("Node rtt: %u, new RTT: %u\n", rtt, Node->latency.rtt);
+    if (NewNode->signal != SIGNAL_FIN && Node->cold->latency.ack && ((NewNode->cold->latency.ack - Node->cold->latency.ack) > 0)) {
+        uint32_t rtt = NewNode->cold->latency.tsVal - Node->cold->latency.tsVal;
+        printf("Node old RTT: %u ", Node->cold->latency.rtt);
+        if (rtt) Node->cold->latency.rtt = Node->cold->latency.rtt ? (Node->cold->latency.rtt + rtt) >> 1 : rtt;
+        dbg_printf("Node rtt: %u, new RTT: %u\n", rtt, Node->cold->latency.rtt);
     }
-    Node->latency.tsVal = NewNode->latency.tsVal;
-    Node->latency.ack = NewNode->latency.ack;
+    Node->cold->latency.tsVal = NewNode->cold->latency.tsVal;
+    Node->cold->latency.ack = NewNode->cold->latency.ack;
     dbg_printf("Existing TCP flow: Packets: %u, Bytes: %u\n", Node->packets, Node->bytes);
 #endif
 
-    if (Node->payloadSize == 0 && payloadSize > 0 && packetParam->addPayload) {
+    if (ColdData(Node)->payloadSize == 0 && payloadSize > 0 && packetParam->addPayload) {
         dbg_printf("Existing TCP flow: Set payload of size: %zu\n", payloadSize);
         AddPayload(Node, payload, payloadSize);
     }
@@ -448,7 +368,7 @@ static inline void ProcessTCPFlow(packetParam_t *packetParam, struct FlowNode *N
         // flush node
         Node->signal = SIGNAL_FIN;
         // flush node to flow thread
-        Remove_Node(Node);
+        Remove_Node(packetParam->flowTree, Node);
         Push_Node(packetParam->NodeList, Node);
     }
 
@@ -472,7 +392,7 @@ static inline void ProcessUDPFlow(packetParam_t *packetParam, struct FlowNode *N
     }
 
     // insert other UDP traffic
-    Node = Insert_Node(NewNode);
+    Node = Insert_Node(packetParam->flowTree, NewNode);
     if (Node == NULL) {
         dbg_printf("New UDP flow: Packets: %u, Bytes: %u\n", NewNode->packets, NewNode->bytes);
         if (payloadSize && packetParam->addPayload) {
@@ -484,13 +404,13 @@ static inline void ProcessUDPFlow(packetParam_t *packetParam, struct FlowNode *N
     assert(Node->memflag == NODE_IN_USE);
 
     // update existing flow
-    Node->packets++;
+    Node->packets += NewNode->packets;
     Node->bytes += NewNode->bytes;
     Node->t_last = NewNode->t_last;
     dbg_printf("Existing UDP flow: Packets: %u, Bytes: %u\n", Node->packets, Node->bytes);
 
-    if (Node->payloadSize == 0 && payloadSize > 0 && packetParam->addPayload) {
-        dbg_printf("Existing UDP flow: Set payload of size: %u\n", NewNode->payloadSize);
+    if (ColdData(Node)->payloadSize == 0 && payloadSize > 0 && packetParam->addPayload) {
+        dbg_printf("Existing UDP flow: Set payload of size: %zu\n", payloadSize);
         AddPayload(Node, payload, payloadSize);
     }
 
@@ -513,7 +433,7 @@ static inline void ProcessOtherFlow(packetParam_t *packetParam, struct FlowNode
     assert(NewNode->memflag == NODE_IN_USE);
 
     // insert other traffic
-    struct FlowNode *Node = Insert_Node(NewNode);
+    struct FlowNode *Node = Insert_Node(packetParam->flowTree, NewNode);
     // if insert fails, the existing node is returned -> flow exists already
     if (Node == NULL) {
         dbg_printf("New flow IP proto: %u. Packets: %u, Bytes: %u\n", NewNode->flowKey.proto, NewNode->packets, NewNode->bytes);
@@ -526,13 +446,13 @@ static inline void ProcessOtherFlow(packetParam_t *packetParam, struct FlowNode
     assert(Node->memflag == NODE_IN_USE);
 
     // update existing flow
-    Node->packets++;
+    Node->packets += NewNode->packets;
     Node->bytes += NewNode->bytes;
     Node->t_last = NewNode->t_last;
     dbg_printf("Existing flow IP proto: %u Packets: %u, Bytes: %u\n", NewNode->flowKey.proto, Node->packets, Node->bytes);
 
-    if (Node->payloadSize == 0 && payloadSize > 0 && packetParam->addPayload) {
-        dbg_printf("Existing UDP flow: Set payload of size: %u\n", NewNode->payloadSize);
+    if (ColdData(Node)->payloadSize == 0 && payloadSize > 0 && packetParam->addPayload) {
+        dbg_printf("Existing UDP flow: Set payload of size: %zu\n", payloadSize);
         AddPayload(Node, payload, payloadSize);
     }
 
@@ -540,15 +460,180 @@ static inline void ProcessOtherFlow(packetParam_t *packetParam, struct FlowNode
 
 }  // End of ProcessOtherFlow
 
+// TCP frames larger than the MTU are GRO/LRO coalesced super frames.
+// Count the MTU sized segments and their headers, as seen on the wire
+static inline void CountSegments(packetParam_t *packetParam, struct FlowNode *Node, uint32_t hdrSize) {
+    uint32_t mtu = packetParam->mtu;
+    if (likely(mtu == 0 || Node->bytes <= mtu || hdrSize >= mtu)) return;
+
+    uint32_t mss = mtu - hdrSize;
+    uint32_t dataSize = Node->bytes - hdrSize;
+    uint32_t segments = (dataSize + mss - 1) / mss;
+    Node->packets = segments;
+    Node->bytes = dataSize + segments * hdrSize;
+    dbg_printf("GRO frame: %u segments, bytes: %u\n", segments, Node->bytes);
+
+}  // End of CountSegments
+
+// fast path for plain ethernet IPv4/IPv6 TCP and UDP packets. Only the flow key and counters are
+// decoded - no payload, latency or de-duplication. Returns 0, if the packet needs the full decoder
+static inline int ProcessFastPath(packetParam_t *packetParam, const struct pcap_pkthdr *hdr, const u_char *data) {
+    uint8_t *dataptr = (uint8_t *)data;
+    uint8_t *eodata = (uint8_t *)data + hdr->caplen;
+
+    if ((dataptr + 14) > eodata) return 0;
+    uint16_t protocol = dataptr[12] << 0x08 | dataptr[13];
+    dataptr += 14;
+
+    uint8_t *ipHdr = dataptr;
+    uint32_t ipHdrSize;
+    uint8_t IPproto;
+    if (protocol == ETHERTYPE_IP) {
+        struct ip *ip = (struct ip *)dataptr;
+        if ((dataptr + sizeof(struct ip)) > eodata || ip->ip_v != 4 || ip->ip_hl < 5) return 0;
+        // fragments need the defragmentation
+        if (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) return 0;
+        ipHdrSize = ip->ip_hl << 2;
+        IPproto = ip->ip_p;
+    } else if (protocol == ETHERTYPE_IPV6) {
+        struct ip6_hdr *ip6 = (struct ip6_hdr *)dataptr;
+        if ((dataptr + sizeof(struct ip6_hdr)) > eodata) return 0;
+        ipHdrSize = sizeof(struct ip6_hdr);
+        IPproto = ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt;
+    } else {
+        return 0;
+    }
+    dataptr += ipHdrSize;
+
+    // check the transport header, before a node is allocated
+    uint32_t l4HdrSize;
+    if (IPproto == IPPROTO_TCP) {
+        struct tcphdr *tcp = (struct tcphdr *)dataptr;
+        if ((dataptr + sizeof(struct tcphdr)) > eodata) return 0;
+        l4HdrSize = tcp->th_off << 2;
+    } else if (IPproto == IPPROTO_UDP) {
+        struct udphdr *udp = (struct udphdr *)dataptr;
+        l4HdrSize = sizeof(struct udphdr);
+        if ((dataptr + l4HdrSize) > eodata || ntohs(udp->uh_ulen) < 8) return 0;
+    } else {
+        return 0;
+    }
+    if ((dataptr + l4HdrSize) > eodata) return 0;
+
+    struct FlowNode *Node = New_Node(packetParam->flowTree);
+    if (protocol == ETHERTYPE_IP) {
+        struct ip *ip = (struct ip *)ipHdr;
+        Node->flowKey.version = AF_INET;
+        Node->flowKey.src_addr.v4 = ntohl(ip->ip_src.s_addr);
+        Node->flowKey.dst_addr.v4 = ntohl(ip->ip_dst.s_addr);
+        Node->bytes = ntohs(ip->ip_len);
+        if (ntohs(ip->ip_off) & IP_DF) Node->fragmentFlags |= flagDF;
+        Node->ttl = ip->ip_ttl;
+    } else {
+        struct ip6_hdr *ip6 = (struct ip6_hdr *)ipHdr;
+        Node->flowKey.version = AF_INET6;
+        // keep compiler happy - gets optimized out anyway
+        void *p = (void *)&ip6->ip6_src;
+        uint64_t *addr = (uint64_t *)p;
+        Node->flowKey.src_addr.v6[0] = ntohll(addr[0]);
+        Node->flowKey.src_addr.v6[1] = ntohll(addr[1]);
+
+        p = (void *)&ip6->ip6_dst;
+        addr = (uint64_t *)p;
+        Node->flowKey.dst_addr.v6[0] = ntohll(addr[0]);
+        Node->flowKey.dst_addr.v6[1] = ntohll(addr[1]);
+        Node->bytes = ntohs(ip6->ip6_plen) + ipHdrSize;
+        Node->ttl = ip6->ip6_ctlun.ip6_un1.ip6_un1_hlim;
+    }
+    Node->t_first.tv_sec = hdr->ts.tv_sec;
+    Node->t_last.tv_sec = hdr->ts.tv_sec;
+    Node->t_first.tv_usec = hdr->ts.tv_usec;
+    Node->t_last.tv_usec = hdr->ts.tv_usec;
+    Node->packets = 1;
+    Node->flowKey.proto = IPproto;
+    Node->nodeType = FLOW_NODE;
+
+    if (IPproto == IPPROTO_TCP) {
+        struct tcphdr *tcp = (struct tcphdr *)dataptr;
+        Node->signal = tcp->th_flags & TH_FIN || tcp->th_flags & TH_RST;
+        Node->flags = tcp->th_flags;
+        Node->flowKey.src_port = ntohs(tcp->th_sport);
+        Node->flowKey.dst_port = ntohs(tcp->th_dport);
+        CountSegments(packetParam, Node, ipHdrSize + l4HdrSize);
+        ProcessTCPFlow(packetParam, Node, NULL, 0);
+    } else {
+        struct udphdr *udp = (struct udphdr *)dataptr;
+        Node->flags = 0;
+        Node->flowKey.src_port = ntohs(udp->uh_sport);
+        Node->flowKey.dst_port = ntohs(udp->uh_dport);
+        ProcessUDPFlow(packetParam, Node, NULL, 0);
+    }
+
+    return 1;
+
+}  // End of ProcessFastPath
+
+// hash the IP addresses of a packet to distribute the packets of a pcap file among the workers.
+// Ports are not hashed, so all fragments of a packet end up at the same worker.
+// Packets, which can not be decoded, return 0
+uint32_t PacketFlowHash(uint32_t linktype, const struct pcap_pkthdr *hdr, const u_char *data) {
+    const uint8_t *dataptr = (const uint8_t *)data;
+    const uint8_t *eodata = (const uint8_t *)data + hdr->caplen;
+
+    uint16_t protocol = 0;
+    switch (linktype) {
+        case DLT_EN10MB:
+            if ((dataptr + 14) > eodata) return 0;
+            protocol = dataptr[12] << 0x08 | dataptr[13];
+            dataptr += 14;
+            // skip stacked VLAN tags
+            while ((protocol == ETHERTYPE_VLAN || protocol == 0x88a8) && (dataptr + 4) <= eodata) {
+                protocol = dataptr[2] << 0x08 | dataptr[3];
+                dataptr += 4;
+            }
+            break;
+        case DLT_LINUX_SLL:
+            if ((dataptr + 16) > eodata) return 0;
+            protocol = dataptr[14] << 0x08 | dataptr[15];
+            dataptr += 16;
+            break;
+        case DLT_NULL:
+            dataptr += 4;
+            // fall through
+        case DLT_RAW:
+            if (dataptr >= eodata) return 0;
+            protocol = (dataptr[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IP;
+            break;
+        default:
+            return 0;
+    }
+
+    if (protocol == ETHERTYPE_IP) {
+        if ((dataptr + 20) > eodata) return 0;
+        uint32_t addr[2];
+        memcpy(addr, dataptr + 12, 8);
+        uint32_t hash = (addr[0] ^ addr[1]) * 0x9E3779B1;
+        return hash ^ (hash >> 16);
+    } else if (protocol == ETHERTYPE_IPV6) {
+        if ((dataptr + 40) > eodata) return 0;
+        uint64_t addr[4];
+        memcpy(addr, dataptr + 8, 32);
+        uint64_t hash = (addr[0] ^ addr[1] ^ addr[2] ^ addr[3]) * 0x9E3779B97F4A7C15ULL;
+        return hash >> 32;
+    }
+
+    return 0;
+
+}  // End of PacketFlowHash
+
 int ProcessPacket(packetParam_t *packetParam, const struct pcap_pkthdr *hdr, const u_char *data) {
     struct FlowNode *Node = NULL;
     uint16_t version, IPproto;
     char s1[64];
     char s2[64];
-    static unsigned pkg_cnt = 0;
 
-    pkg_cnt++;
     packetParam->proc_stat.packets++;
+    uint32_t pkg_cnt = packetParam->proc_stat.packets;
     dbg_printf("\nNext Packet: %u, cap len:%u, len: %u\n", pkg_cnt, hdr->caplen, hdr->len);
 
     // snaplen is minimum 54 bytes
@@ -563,6 +648,13 @@ int ProcessPacket(packetParam_t *packetParam, const struct pcap_pkthdr *hdr, con
     uint32_t numMPLS = 0;
     uint32_t *mplsLabel = NULL;
     pflog_hdr_t *pflog = NULL;
+    uint32_t ipHdrSize = 0;
+
+    // flow key and counters only - try the fast path
+    if (packetParam->linktype == DLT_EN10MB && !(packetParam->addPayload || packetParam->extendedFlow || packetParam->doDedup) &&
+        ProcessFastPath(packetParam, hdr, data)) {
+        goto END_FUNC;
+    }
 
     // link layer processing
     uint16_t protocol = 0;
@@ -824,6 +916,7 @@ REDO_IPPROTO:
     if (version == 6) {
         struct ip6_hdr *ip6 = (struct ip6_hdr *)dataptr;
         size_t size_ip = sizeof(struct ip6_hdr);
+        ipHdrSize = size_ip;
 
         dataptr += size_ip;
         if (dataptr >= eodata) {
@@ -840,7 +933,7 @@ REDO_IPPROTO:
             uint32_t hopLimit = ip6->ip6_ctlun.ip6_un1.ip6_un1_hlim;
             ip6->ip6_ctlun.ip6_un1.ip6_un1_hlim = 0;
             uint16_t len = ntohs(ip6->ip6_ctlun.ip6_un1.ip6_un1_plen);
-            if (is_duplicate((const uint8_t *)ip, len + 40)) {
+            if (is_duplicate(packetParam, (const uint8_t *)ip, len + 40)) {
                 packetParam->proc_stat.duplicates++;
                 return 0;
             }
@@ -854,7 +947,7 @@ REDO_IPPROTO:
         dbg_printf("Packet IPv6, SRC %s, DST %s\n", inet_ntop(AF_INET6, &ip6->ip6_src, s1, sizeof(s1)),
                    inet_ntop(AF_INET6, &ip6->ip6_dst, s2, sizeof(s2)));
 
-        if (!Node) Node = New_Node();
+        if (!Node) Node = New_Node(packetParam->flowTree);
         Node->flowKey.version = AF_INET6;
         Node->t_first.tv_sec = hdr->ts.tv_sec;
         Node->t_last.tv_sec = hdr->ts.tv_sec;
@@ -879,6 +972,7 @@ REDO_IPPROTO:
         uint16_t ip_off = ntohs(ip->ip_off);
         uint32_t frag_offset = (ip_off & IP_OFFMASK) << 3;
         int size_ip = (ip->ip_hl << 2);
+        ipHdrSize = size_ip;
 
         dataptr += size_ip;
         if (dataptr > eodata) {
@@ -896,7 +990,7 @@ REDO_IPPROTO:
             uint32_t sum = ip->ip_sum;
             ip->ip_ttl = 0;
             ip->ip_sum = 0;
-            if (is_duplicate((const uint8_t *)ip, ntohs(ip->ip_len))) {
+            if (is_duplicate(packetParam, (const uint8_t *)ip, ntohs(ip->ip_len))) {
                 packetParam->proc_stat.duplicates++;
                 return 0;
             }
@@ -912,22 +1006,31 @@ REDO_IPPROTO:
         // IPv4 defragmentation
         if ((ip_off & IP_MF) || frag_offset) {
             // fragmented packet
-            Node = ProcessIPfrag(packetParam, hdr, ip, eodata);
-            if (Node == NULL) {
+            struct timeval t_first;
+            uint32_t datagramSize = 0;
+            defragmented = AddFragment(packetParam->fragTable, ip, eodata, &hdr->ts, &t_first, &datagramSize);
+            if (defragmented == NULL) {
                 // not yet complete
                 dbg_printf("Fragmentation not yet completed. Size %td bytes\n", eodata - dataptr);
                 goto END_FUNC;
             }
-            dbg_printf("Fragmentation complete: %u bytes\n", Node->bytes);
+            dbg_printf("Fragmentation complete: %u bytes\n", datagramSize);
             // packet defragmented - set payload to defragmented data
-            defragmented = Node->payload;
-            dataptr = Node->payload;
-            eodata = dataptr + Node->payloadSize;
-            Node->payload = NULL;
-            Node->payloadSize = 0;
+            dataptr = defragmented;
+            eodata = dataptr + datagramSize;
+
+            if (!Node) Node = New_Node(packetParam->flowTree);
+            Node->flowKey.version = AF_INET;
+            Node->t_first = t_first;
+            Node->t_last.tv_sec = hdr->ts.tv_sec;
+            Node->t_last.tv_usec = hdr->ts.tv_usec;
+            Node->bytes = size_ip + datagramSize;
             Node->fragmentFlags |= flagMF;
+
+            Node->flowKey.src_addr.v4 = ntohl(ip->ip_src.s_addr);
+            Node->flowKey.dst_addr.v4 = ntohl(ip->ip_dst.s_addr);
         } else {
-            if (!Node) Node = New_Node();
+            if (!Node) Node = New_Node(packetParam->flowTree);
             Node->flowKey.version = AF_INET;
             Node->t_first.tv_sec = hdr->ts.tv_sec;
             Node->t_last.tv_sec = hdr->ts.tv_sec;
@@ -947,25 +1050,29 @@ REDO_IPPROTO:
     }
 
     // fill ipv4/ipv6 node with extracted data
-    Node->vlanID = vlanID;
-    Node->srcMac = srcMac;
-    Node->dstMac = dstMac;
     Node->packets = 1;
     Node->flowKey.proto = IPproto;
     Node->nodeType = FLOW_NODE;
-    Node->pflog = pflog;
+    // the cold part is only needed for link layer data
+    if (vlanID || srcMac || dstMac || pflog || numMPLS) {
+        struct flowNodeCold_s *cold = Cold_Node(Node);
+        cold->vlanID = vlanID;
+        cold->srcMac = srcMac;
+        cold->dstMac = dstMac;
+        cold->pflog = pflog;
+
+        if (numMPLS) {
+            if (numMPLS > 10) numMPLS = 10;
+            for (int i = 0; i < numMPLS; i++) {
+                cold->mpls[i] = *mplsLabel;
+                mplsLabel++;
+            }
+        }
+    }
 
     // bytes = number of bytes on wire - data link data
     dbg_printf("Payload: %td bytes, Full packet: %u bytes\n", eodata - dataptr, Node->bytes);
 
-    if (numMPLS) {
-        if (numMPLS > 10) numMPLS = 10;
-        for (int i = 0; i < numMPLS; i++) {
-            Node->mpls[i] = *mplsLabel;
-            mplsLabel++;
-        }
-    }
-
     // transport protocol processing
     switch (IPproto) {
         case IPPROTO_UDP: {
@@ -1050,12 +1157,12 @@ REDO_IPPROTO:
                                 LogError("TCP option TS len error: %u", optLen);
                             } else {
                                 uint32_t tsVal = ntohl(*(uint32_t *)optData);
-                                Node->latency.tsVal = tsVal;
+                                if (packetParam->extendedFlow) Cold_Node(Node)->latency.tsVal = tsVal;
                                 optData += 4;
                                 uint32_t tsEcr = ntohl(*(uint32_t *)optData);
                                 optData += 4;
                                 dbg_printf("TS tcp option: %u, optLen: %u, tsVal: %u, tsEcr: %u\n", opt, optLen, tsVal, tsEcr);
-                                Node->latency.ack = ntohl(tcp->th_ack);
+                                if (packetParam->extendedFlow) Cold_Node(Node)->latency.ack = ntohl(tcp->th_ack);
                                 continue;
                             }
                             break;
@@ -1072,6 +1179,7 @@ REDO_IPPROTO:
             Node->flags = tcp->th_flags;
             Node->flowKey.src_port = ntohs(tcp->th_sport);
             Node->flowKey.dst_port = ntohs(tcp->th_dport);
+            if (!defragmented) CountSegments(packetParam, Node, ipHdrSize + size_tcp);
             ProcessTCPFlow(packetParam, Node, payload, payloadSize);
 
         } break;
@@ -1124,10 +1232,11 @@ REDO_IPPROTO:
             }
 
             // move IP to tun IP
-            Node->tun_src_addr = Node->flowKey.src_addr;
-            Node->tun_dst_addr = Node->flowKey.dst_addr;
-            Node->tun_proto = IPPROTO_IPIP;
-            Node->tun_ip_version = Node->flowKey.version;
+            struct flowNodeCold_s *cold = Cold_Node(Node);
+            cold->tun_src_addr = Node->flowKey.src_addr;
+            cold->tun_dst_addr = Node->flowKey.dst_addr;
+            cold->tun_proto = IPPROTO_IPIP;
+            cold->tun_ip_version = Node->flowKey.version;
 
             dbg_printf("  IPIPv6 tunnel - inner IPv6:\n");
 
@@ -1146,10 +1255,11 @@ REDO_IPPROTO:
             }
 
             // move IP to tun IP
-            Node->tun_src_addr = Node->flowKey.src_addr;
-            Node->tun_dst_addr = Node->flowKey.dst_addr;
-            Node->tun_proto = IPPROTO_IPIP;
-            Node->tun_ip_version = Node->flowKey.version;
+            struct flowNodeCold_s *cold = Cold_Node(Node);
+            cold->tun_src_addr = Node->flowKey.src_addr;
+            cold->tun_dst_addr = Node->flowKey.dst_addr;
+            cold->tun_proto = IPPROTO_IPIP;
+            cold->tun_ip_version = Node->flowKey.version;
 
             dbg_printf("  IPIP tunnel - inner IP:\n");
 
@@ -1227,10 +1337,11 @@ REDO_IPPROTO:
                 goto END_FUNC;
             }
             // move IP to tun IP
-            Node->tun_src_addr = Node->flowKey.src_addr;
-            Node->tun_dst_addr = Node->flowKey.dst_addr;
-            Node->tun_proto = IPPROTO_GRE;
-            Node->tun_ip_version = Node->flowKey.version;
+            struct flowNodeCold_s *cold = Cold_Node(Node);
+            cold->tun_src_addr = Node->flowKey.src_addr;
+            cold->tun_dst_addr = Node->flowKey.dst_addr;
+            cold->tun_proto = IPPROTO_GRE;
+            cold->tun_ip_version = Node->flowKey.version;
             // redo IP proto evaluation
             goto REDO_LINK_PROTO;
 
@@ -1255,9 +1366,10 @@ END_FUNC:
         dbg_printf("Defragmented buffer freed for proto %u\n", IPproto);
     }
 
-    if ((hdr->ts.tv_sec - lastRun) > 1) {
-        CacheCheck(packetParam->NodeList, hdr->ts.tv_sec);
-        lastRun = hdr->ts.tv_sec;
+    if ((hdr->ts.tv_sec - packetParam->lastRun) > 1) {
+        CacheCheck(packetParam->flowTree, packetParam->NodeList, hdr->ts.tv_sec);
+        ExpireFragTable(packetParam->fragTable, hdr->ts.tv_sec);
+        packetParam->lastRun = hdr->ts.tv_sec;
     }
 
     return 1;
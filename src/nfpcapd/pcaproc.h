@@ -117,4 +117,6 @@ void ProcessFlowNode(FlowSource_t *fs, struct FlowNode *node);
 
 int ProcessPacket(packetParam_t *packetParam, const struct pcap_pkthdr *hdr, const u_char *data);
 
+uint32_t PacketFlowHash(uint32_t linktype, const struct pcap_pkthdr *hdr, const u_char *data);
+
 #endif  // _PCAPROC_H
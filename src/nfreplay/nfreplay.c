@@ -35,7 +35,9 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,12 +50,14 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "barrier.h"
 #include "config.h"
 
 #ifdef HAVE_STDIO_EXT_H
 #include <stdio_ext.h>
 #endif
 
+#include "cpufeature.h"
 #include "filter/filter.h"
 #include "flist.h"
 #include "nbar.h"
@@ -64,12 +68,18 @@
 #include "send_net.h"
 #include "send_v5.h"
 #include "send_v9.h"
+#include "queue.h"
 #include "util.h"
 #include "version.h"
 
 #define DEFAULTCISCOPORT "9995"
 #define DEFAULTHOSTNAME "127.0.0.1"
 
+// emulated exporters - v9 packets are encoded by workers and sent by one sender
+#define MAXEXPORTERS 4096
+#define BLOCKQUEUESIZE 16
+#define PACKETPOOLSIZE 1024
+
 #undef FPURGE
 #ifdef HAVE___FPURGE
 #define FPURGE __fpurge
@@ -80,6 +90,55 @@
 #endif
 #endif
 
+// replay pacing
+typedef struct pacing_s {
+    unsigned int delay;  // delay in usec between packets, if no rate or timing is given
+    double rate;         // packets or flows per second. 0 = no rate limit
+    int flowRate;        // rate counts flows instead of packets
+    double speed;        // replay original timing with speed factor. 0 = off
+} pacing_t;
+
+// token bucket for the rate limit
+typedef struct tokenBucket_s {
+    double rate;    // tokens per second
+    double burst;   // max tokens
+    double tokens;  // may become negative - the sender waits for the deficit
+    uint64_t last;  // last refill in nsec
+} tokenBucket_t;
+
+// encoded packet - passed from the workers to the sender
+typedef struct replayPacket_s {
+    size_t size;
+    uint8_t data[UDP_PACKET_SIZE];
+} replayPacket_t;
+
+// block to encode with the ident of its file
+typedef struct replayBlock_s {
+    dataBlock_t *dataBlock;
+    const char *ident;
+} replayBlock_t;
+
+typedef struct replayWorker_s {
+    int self;
+    uint32_t numExporters;
+    send_peer_t *exporters;  // exporters of this worker - own templates and sequence
+    void *engine;            // filter engine of this worker
+    uint64_t twin_msecFirst;
+    uint64_t twin_msecLast;
+    uint64_t limitRecords;
+    _Atomic uint64_t *numflows;  // flows sent by all workers
+    queue_t *blockQueue;         // blocks to encode - shared by all workers
+    queue_t *packetPool;         // free packets
+    queue_t *sendQueue;          // packets to send
+} replayWorker_t;
+
+typedef struct replaySender_s {
+    queue_t *packetPool;
+    queue_t *sendQueue;
+    uint64_t numPackets;
+    uint64_t errors;
+} replaySender_t;
+
 /* Local Variables */
 static int verbose = 0;
 
@@ -87,10 +146,17 @@ static send_peer_t peer;
 static uint32_t recordCnt = 0;
 static uint32_t sequence = 0;
 
+// packets are batched, if no per packet delay or confirmation is required
+static sendBatch_t *sendBatch = NULL;
+static tokenBucket_t tokenBucket = {0};
+static int packetRate = 0;
+
 /* Function Prototypes */
 static void usage(char *name);
 
-static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t count, unsigned int delay, int confirm, int netflow_version, int distribution);
+static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t count, pacing_t *pacing, int confirm, int netflow_version, int distribution);
+
+static void send_exporters(void *engine, timeWindow_t *timeWindow, uint64_t limitRecords, uint32_t numExporters, uint32_t numWorkers);
 
 static int FlushBuffer(int confirm);
 
@@ -116,7 +182,11 @@ static void usage(char *name) {
         "-L <log>\tLog to syslog facility <log>\n"
         "-p <port>\tTarget port default 9995\n"
         "-S <ip>\tSource IP address for sending flows\n"
-        "-d <usec>\tDelay in usec between packets. default 10\n"
+        "-d <usec>\tDelay in usec between packets. default 1. 0 sends batched at max rate\n"
+        "-R <rate>[f]\tSend <rate> packets/s or with suffix 'f' flows/s. Packets are batched.\n"
+        "-T <speed>\tReplay the original flow timing, speed up by factor <speed>. Packets are batched.\n"
+        "-X <num>\tEmulate <num> v9 exporters with different source IDs, encoded in parallel.\n"
+        "-W <num>\tNumber of encoding workers for -X. Max depends on cores online\n"
         "-c <cnt>\tPacket count. default send all packets\n"
         "-b <bsize>\tSend buffer size.\n"
         "-r <input>\tread from file. default: stdin\n"
@@ -182,6 +252,66 @@ int Add_nfd_output_record(record_header_t *record_header, send_peer_t *peer) {
 
 }  // End of Add_nfd_output_record
 
+static uint64_t monotonicNsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + (uint64_t)ts.tv_nsec;
+}  // End of monotonicNsec
+
+// wait until deadline in nsec. Queued packets are sent first, as they are due.
+// Sleep for the bulk of the time and spin for the rest to stay accurate
+static void WaitUntil(uint64_t deadline) {
+    if (sendBatch && FlushSendBatch(sendBatch) < 0) LogError("sendmmsg() error: %s", strerror(errno));
+
+    uint64_t now = monotonicNsec();
+    if (deadline > (now + 100000)) {
+        uint64_t nsec = deadline - now - 50000;
+        struct timespec ts = {.tv_sec = nsec / 1000000000LL, .tv_nsec = nsec % 1000000000LL};
+        nanosleep(&ts, NULL);
+    }
+    while (monotonicNsec() < deadline)
+        ;
+
+}  // End of WaitUntil
+
+static void InitTokenBucket(tokenBucket_t *bucket, double rate) {
+    bucket->rate = rate;
+    // allow bursts of 1ms
+    bucket->burst = rate / 1000.0 > 1.0 ? rate / 1000.0 : 1.0;
+    bucket->tokens = bucket->burst;
+    bucket->last = monotonicNsec();
+}  // End of InitTokenBucket
+
+// take units from the token bucket and wait, until the deficit is refilled
+static void TokenBucketTake(tokenBucket_t *bucket, double units) {
+    uint64_t now = monotonicNsec();
+    bucket->tokens += (double)(now - bucket->last) * bucket->rate / 1e9;
+    if (bucket->tokens > bucket->burst) bucket->tokens = bucket->burst;
+    bucket->last = now;
+
+    bucket->tokens -= units;
+    if (bucket->tokens < 0) WaitUntil(now + (uint64_t)(-bucket->tokens * 1e9 / bucket->rate));
+
+}  // End of TokenBucketTake
+
+// wait for the original receive time of a flow, scaled by speed
+static void ReplayTiming(uint64_t msecReceived, double speed) {
+    static uint64_t firstMsec = 0;
+    static uint64_t startNsec = 0;
+
+    if (msecReceived == 0) return;
+    if (firstMsec == 0) {
+        firstMsec = msecReceived;
+        startNsec = monotonicNsec();
+        return;
+    }
+    if (msecReceived <= firstMsec) return;
+
+    uint64_t deadline = startNsec + (uint64_t)((double)(msecReceived - firstMsec) * 1e6 / speed);
+    if (deadline > monotonicNsec()) WaitUntil(deadline);
+
+}  // End of ReplayTiming
+
 static int FlushBuffer(int confirm) {
     static unsigned long cnt = 1;
 
@@ -196,10 +326,14 @@ static int FlushBuffer(int confirm) {
         fflush(stdout);
         fgetc(stdin);
     }
+    if (sendBatch) {
+        if (packetRate) TokenBucketTake(&tokenBucket, 1);
+        return SendBatchPacket(sendBatch, peer.send_buffer, len);
+    }
     return sendto(peer.sockfd, peer.send_buffer, len, 0, (struct sockaddr *)&(peer.dstaddr), peer.addrlen);
 }  // End of FlushBuffer
 
-static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t limitRecords, unsigned int delay, int confirm, int netflow_version,
+static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t limitRecords, pacing_t *pacing, int confirm, int netflow_version,
                       int distribution) {
     nffile_t *nffile;
     uint64_t twin_msecFirst, twin_msecLast;
@@ -258,6 +392,18 @@ static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t limitReco
         return;
     }
 
+    // batch packets, unless each packet is delayed or confirmed
+    if (!confirm && (pacing->rate > 0 || pacing->speed > 0 || pacing->delay == 0)) {
+        sendBatch = NewSendBatch(peer.sockfd, &peer.dstaddr, peer.addrlen);
+        if (!sendBatch) return;
+    }
+    int flowRate = 0;
+    if (pacing->rate > 0) {
+        InitTokenBucket(&tokenBucket, pacing->rate);
+        flowRate = pacing->flowRate;
+        packetRate = !pacing->flowRate;
+    }
+
     dataBlock_t *dataBlock = NULL;
     uint64_t numflows = 0;
     uint64_t processed = 0;
@@ -318,6 +464,12 @@ static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t limitReco
                     }
                     // Records passed filter -> continue record processing
 
+                    if (pacing->speed > 0) {
+                        EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+                        if (genericFlow) ReplayTiming(genericFlow->msecReceived ? genericFlow->msecReceived : genericFlow->msecLast, pacing->speed);
+                    }
+                    if (flowRate) TokenBucketTake(&tokenBucket, 1);
+
                     int again = 0;
                     switch (netflow_version) {
                         case 5:
@@ -343,9 +495,9 @@ static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t limitReco
                             return;
                         }
 
-                        if (delay) {
+                        if (pacing->delay && !sendBatch) {
                             // sleep as specified
-                            usleep(delay);
+                            usleep(pacing->delay);
                         }
                     }
 
@@ -421,9 +573,12 @@ static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t limitReco
             break;
     }
     int ret = FlushBuffer(confirm);
+    if (ret >= 0 && sendBatch) ret = FlushSendBatch(sendBatch);
     if (ret < 0) {
         LogError("Error flushing send buffer");
     }
+    FreeSendBatch(sendBatch);
+    sendBatch = NULL;
 
     if (nffile) {
         CloseFile(nffile);
@@ -436,11 +591,248 @@ static void send_data(void *engine, timeWindow_t *timeWindow, uint64_t limitReco
 
 }  // End of send_data
 
+// hand the packet of the exporter to the sender
+static void QueuePacket(replayWorker_t *worker, send_peer_t *exporter) {
+    size_t len = (pointer_addr_t)exporter->buff_ptr - (pointer_addr_t)exporter->send_buffer;
+    exporter->flush = 0;
+    exporter->buff_ptr = exporter->send_buffer;
+    if (len == 0) return;
+
+    replayPacket_t *packet = queue_pop(worker->packetPool);
+    if (packet == QUEUE_CLOSED) return;
+    memcpy(packet->data, exporter->send_buffer, len);
+    packet->size = len;
+    queue_push(worker->sendQueue, packet);
+
+}  // End of QueuePacket
+
+// encode the records of the blocks into v9 packets. Records are distributed
+// round robin over the exporters of this worker
+static void *replayWorker(void *arg) {
+    replayWorker_t *worker = (replayWorker_t *)arg;
+
+    recordHandle_t *recordHandle = calloc(1, sizeof(recordHandle_t));
+    if (!recordHandle) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    const char *ident = NULL;
+    FilterSetParam(worker->engine, ident, NOGEODB);
+    uint32_t nextExporter = 0;
+    uint64_t processed = 0;
+    replayBlock_t *replayBlock;
+    while ((replayBlock = queue_pop(worker->blockQueue)) != QUEUE_CLOSED) {
+        dataBlock_t *dataBlock = replayBlock->dataBlock;
+        if (replayBlock->ident != ident) {
+            ident = replayBlock->ident;
+            FilterSetParam(worker->engine, ident, NOGEODB);
+        }
+        free(replayBlock);
+
+        record_header_t *record_ptr = GetCursor(dataBlock);
+        uint32_t sumSize = 0;
+        for (int i = 0; i < dataBlock->NumRecords; i++) {
+            if ((sumSize + record_ptr->size) > dataBlock->size || (record_ptr->size < sizeof(record_header_t))) {
+                LogError("Corrupt data file. Inconsistent block size in %s line %d\n", __FILE__, __LINE__);
+                exit(255);
+            }
+            sumSize += record_ptr->size;
+
+            if (record_ptr->type == V3Record) {
+                processed++;
+                MapRecordHandle(recordHandle, (recordHeaderV3_t *)record_ptr, processed);
+
+                int match = 1;
+                if (worker->twin_msecFirst) {
+                    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+                    match = (genericFlow->msecFirst < worker->twin_msecFirst || genericFlow->msecLast > worker->twin_msecLast) ? 0 : 1;
+                }
+                if (match) match = FilterRecord(worker->engine, recordHandle);
+                if (match && worker->limitRecords) match = atomic_fetch_add(worker->numflows, 1) < worker->limitRecords;
+
+                if (match) {
+                    send_peer_t *exporter = &worker->exporters[nextExporter];
+                    nextExporter = (nextExporter + 1) % worker->numExporters;
+
+                    int again = Add_v9_output_record(recordHandle, exporter);
+                    if (exporter->flush) QueuePacket(worker, exporter);
+                    if (again) {
+                        Add_v9_output_record(recordHandle, exporter);
+                        if (exporter->flush) QueuePacket(worker, exporter);
+                    }
+                }
+            }
+
+            // Advance pointer by number of bytes for netflow record
+            record_ptr = (record_header_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+        }
+        FreeDataBlock(dataBlock);
+    }
+
+    // flush remaining records of all exporters
+    for (int i = 0; i < worker->numExporters; i++) {
+        send_peer_t *exporter = &worker->exporters[i];
+        Close_v9_output(exporter);
+        QueuePacket(worker, exporter);
+        Free_v9_output(exporter);
+        free(exporter->send_buffer);
+    }
+    free(recordHandle);
+
+    pthread_exit(NULL);
+
+}  // End of replayWorker
+
+// send the packets of all workers - paced by the packet rate
+static void *replaySender(void *arg) {
+    replaySender_t *sender = (replaySender_t *)arg;
+
+    replayPacket_t *packet;
+    while ((packet = queue_pop(sender->sendQueue)) != QUEUE_CLOSED) {
+        if (packetRate) TokenBucketTake(&tokenBucket, 1);
+        if (SendBatchPacket(sendBatch, packet->data, packet->size) < 0) sender->errors++;
+        sender->numPackets++;
+        queue_push(sender->packetPool, packet);
+    }
+    if (FlushSendBatch(sendBatch) < 0) sender->errors++;
+
+    pthread_exit(NULL);
+
+}  // End of replaySender
+
+static void send_exporters(void *engine, timeWindow_t *timeWindow, uint64_t limitRecords, uint32_t numExporters, uint32_t numWorkers) {
+    if (numWorkers > numExporters) numWorkers = numExporters;
+
+    sendBatch = NewSendBatch(peer.sockfd, &peer.dstaddr, peer.addrlen);
+    queue_t *blockQueue = queue_init(BLOCKQUEUESIZE);
+    queue_t *packetPool = queue_init(PACKETPOOLSIZE);
+    queue_t *sendQueue = queue_init(PACKETPOOLSIZE);
+    if (!sendBatch || !blockQueue || !packetPool || !sendQueue) return;
+
+    for (int i = 0; i < PACKETPOOLSIZE; i++) {
+        replayPacket_t *packet = malloc(sizeof(replayPacket_t));
+        if (!packet) {
+            LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            return;
+        }
+        queue_push(packetPool, packet);
+    }
+
+    _Atomic uint64_t numflows = 0;
+    pthread_t tid[MAXWORKERS] = {0};
+    replayWorker_t *workers = calloc(numWorkers, sizeof(replayWorker_t));
+    if (!workers) {
+        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    // exporter e is owned by worker e % numWorkers and sends with source id e + 1
+    for (int w = 0; w < numWorkers; w++) {
+        replayWorker_t *worker = &workers[w];
+        worker->self = w;
+        worker->numExporters = (numExporters - w + numWorkers - 1) / numWorkers;
+        worker->exporters = calloc(worker->numExporters, sizeof(send_peer_t));
+        worker->engine = FilterCloneEngine(engine);
+        if (!worker->exporters || !worker->engine) exit(255);
+        if (timeWindow) {
+            worker->twin_msecFirst = timeWindow->first * 1000LL;
+            worker->twin_msecLast = timeWindow->last ? timeWindow->last * 1000LL : 0x7FFFFFFFFFFFFFFFLL;
+        }
+        worker->limitRecords = limitRecords;
+        worker->numflows = &numflows;
+        worker->blockQueue = blockQueue;
+        worker->packetPool = packetPool;
+        worker->sendQueue = sendQueue;
+
+        for (int i = 0; i < worker->numExporters; i++) {
+            send_peer_t *exporter = &worker->exporters[i];
+            exporter->sourceID = w + i * numWorkers + 1;
+            exporter->send_buffer = malloc(UDP_PACKET_SIZE);
+            if (!exporter->send_buffer) {
+                LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+                exit(255);
+            }
+            exporter->buff_ptr = exporter->send_buffer;
+            exporter->endp = (void *)((pointer_addr_t)exporter->send_buffer + UDP_PACKET_SIZE - 1);
+            if (!Init_v9_output(exporter)) exit(255);
+        }
+
+        int err = pthread_create(&tid[w], NULL, replayWorker, (void *)worker);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            exit(255);
+        }
+    }
+
+    replaySender_t sender = {.packetPool = packetPool, .sendQueue = sendQueue};
+    pthread_t senderTid;
+    int err = pthread_create(&senderTid, NULL, replaySender, (void *)&sender);
+    if (err) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+        exit(255);
+    }
+
+    // read all blocks and hand them to the workers
+    // idents of all files - the engines refer to them until the workers are done
+    uint32_t numIdents = 0;
+    char *identList[1024];
+    char *ident = NULL;
+    nffile_t *nffile = GetNextFile(NULL);
+    while (nffile) {
+        ident = NULL;
+        if (numIdents < 1024 && nffile->ident) {
+            ident = strdup(nffile->ident);
+            identList[numIdents++] = ident;
+        }
+        dataBlock_t *dataBlock;
+        while ((dataBlock = ReadBlock(nffile, NULL)) != NULL) {
+            if (dataBlock->type != DATA_BLOCK_TYPE_2 && dataBlock->type != DATA_BLOCK_TYPE_3) {
+                LogError("Can't process block type %u. Skip block.\n", dataBlock->type);
+                FreeDataBlock(dataBlock);
+                continue;
+            }
+            replayBlock_t *replayBlock = malloc(sizeof(replayBlock_t));
+            if (!replayBlock) {
+                LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+                exit(255);
+            }
+            replayBlock->dataBlock = dataBlock;
+            replayBlock->ident = ident;
+            queue_push(blockQueue, replayBlock);
+        }
+        nffile = GetNextFile(nffile);
+    }
+
+    // workers flush their exporters, then the sender sends the remaining packets
+    queue_close(blockQueue);
+    for (int w = 0; w < numWorkers; w++) pthread_join(tid[w], NULL);
+    queue_close(sendQueue);
+    pthread_join(senderTid, NULL);
+
+    if (sender.errors) LogError("Error sending data: %llu errors", (unsigned long long)sender.errors);
+    if (verbose) LogInfo("Sent %llu packets of %u exporters", (unsigned long long)sender.numPackets, numExporters);
+
+    replayPacket_t *packet;
+    queue_close(packetPool);
+    while ((packet = queue_pop(packetPool)) != QUEUE_CLOSED) free(packet);
+    for (int w = 0; w < numWorkers; w++) free(workers[w].exporters);
+    free(workers);
+    for (int i = 0; i < numIdents; i++) free(identList[i]);
+    queue_free(blockQueue);
+    queue_free(packetPool);
+    queue_free(sendQueue);
+    FreeSendBatch(sendBatch);
+    sendBatch = NULL;
+    close(peer.sockfd);
+
+}  // End of send_exporters
+
 int main(int argc, char **argv) {
     struct stat stat_buff;
     char *ffile, *filter, *tstring;
     int c, confirm, ffd, ret, netflow_version, distribution;
-    unsigned int delay, sockbuff_size;
+    unsigned int sockbuff_size;
     timeWindow_t *timeWindow;
     flist_t flist;
 
@@ -455,14 +847,16 @@ int main(int argc, char **argv) {
     peer.family = AF_UNSPEC;
     peer.sockfd = 0;
 
-    delay = 1;
+    pacing_t pacing = {.delay = 1};
     sockbuff_size = 0;
     netflow_version = 9;
     verbose = 0;
     confirm = 0;
     distribution = 0;
     uint64_t count = 0;
-    while ((c = getopt(argc, argv, "46EhH:i:K:L:p:S:d:c:b:j:r:f:t:v:z:VY")) != EOF) {
+    uint32_t numExporters = 0;
+    uint32_t numWorkers = 0;
+    while ((c = getopt(argc, argv, "46EhH:i:K:L:p:S:d:c:b:j:r:f:t:v:z:R:T:W:X:VY")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -473,6 +867,7 @@ int main(int argc, char **argv) {
                 break;
             case 'V':
                 printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
                 exit(0);
                 break;
             case 'Y':
@@ -506,7 +901,40 @@ int main(int argc, char **argv) {
                 peer.shostname = strdup(optarg);
                 break;
             case 'd':
-                delay = atoi(optarg);
+                pacing.delay = atoi(optarg);
+                break;
+            case 'R': {
+                char *eptr = NULL;
+                pacing.rate = strtod(optarg, &eptr);
+                if (eptr && (*eptr == 'f' || *eptr == 'F')) {
+                    pacing.flowRate = 1;
+                    eptr++;
+                } else if (eptr && (*eptr == 'p' || *eptr == 'P')) {
+                    eptr++;
+                }
+                if (pacing.rate <= 0 || (eptr && *eptr != '\0')) {
+                    LogError("Invalid rate: %s. Expect <packets/s> or <flows/s>f", optarg);
+                    exit(255);
+                }
+            } break;
+            case 'W':
+                CheckArgLen(optarg, 4);
+                numWorkers = atoi(optarg);
+                break;
+            case 'X':
+                CheckArgLen(optarg, 8);
+                numExporters = atoi(optarg);
+                if (numExporters == 0 || numExporters > MAXEXPORTERS) {
+                    LogError("Number of exporters: %s out of range 1..%d", optarg, MAXEXPORTERS);
+                    exit(255);
+                }
+                break;
+            case 'T':
+                pacing.speed = atof(optarg);
+                if (pacing.speed <= 0) {
+                    LogError("Invalid speed factor: %s", optarg);
+                    exit(255);
+                }
                 break;
             case 'v':
                 netflow_version = atoi(optarg);
@@ -591,6 +1019,13 @@ int main(int argc, char **argv) {
 
     if (!filter) filter = "any";
 
+    if (numExporters) {
+        if (netflow_version != 9 || pacing.speed > 0 || pacing.flowRate || confirm || distribution) {
+            LogError("Emulated exporters -X send v9 only and do not support -T, -R <flows>f, -Y or -z");
+            exit(255);
+        }
+    }
+
     void *engine = CompileFilter(filter);
     if (!engine) exit(254);
 
@@ -612,7 +1047,15 @@ int main(int argc, char **argv) {
     queue_t *fileList = SetupInputFileSequence(&flist);
     if (!Init_nffile(1, fileList)) exit(254);
 
-    send_data(engine, timeWindow, count, delay, confirm, netflow_version, distribution);
+    if (numExporters) {
+        if (pacing.rate > 0) {
+            InitTokenBucket(&tokenBucket, pacing.rate);
+            packetRate = 1;
+        }
+        send_exporters(engine, timeWindow, count, numExporters, GetNumWorkers(numWorkers));
+    } else {
+        send_data(engine, timeWindow, count, &pacing, confirm, netflow_version, distribution);
+    }
 
     return 0;
 }
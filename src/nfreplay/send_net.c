@@ -29,6 +29,9 @@
  *
  */
 
+// sendmmsg() needs _GNU_SOURCE on Linux
+#define _GNU_SOURCE
+
 #include "send_net.h"
 
 #include <errno.h>
@@ -40,11 +43,33 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "config.h"
 #include "util.h"
 
+// number of datagrams sent with one sendmmsg() call
+#ifdef HAVE_SENDMMSG
+#define SEND_BATCHSIZE 64
+#else
+#define SEND_BATCHSIZE 1
+#endif
+
+struct sendBatch_s {
+    int socket;
+    struct sockaddr_storage *dstaddr;
+    socklen_t addrlen;
+    uint32_t numPackets;  // datagrams queued
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[SEND_BATCHSIZE];
+    struct iovec iovecs[SEND_BATCHSIZE];
+#endif
+    size_t size[SEND_BATCHSIZE];
+    void *buff[SEND_BATCHSIZE];
+};
+
 /* local function prototypes */
 static int isMulticast(struct sockaddr_storage *addr);
 
@@ -297,3 +322,95 @@ static int isMulticast(struct sockaddr_storage *addr) {
 
     return ret;
 } /* End of isMulticast */
+
+sendBatch_t *NewSendBatch(int socket, struct sockaddr_storage *dstaddr, socklen_t addrlen) {
+    sendBatch_t *sendBatch = calloc(1, sizeof(sendBatch_t));
+    if (!sendBatch) {
+        LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    sendBatch->socket = socket;
+    sendBatch->dstaddr = dstaddr;
+    sendBatch->addrlen = addrlen;
+    for (int i = 0; i < SEND_BATCHSIZE; i++) {
+        sendBatch->buff[i] = malloc(UDP_PACKET_SIZE);
+        if (!sendBatch->buff[i]) {
+            LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            FreeSendBatch(sendBatch);
+            return NULL;
+        }
+#ifdef HAVE_SENDMMSG
+        sendBatch->iovecs[i].iov_base = sendBatch->buff[i];
+        sendBatch->msgs[i].msg_hdr.msg_iov = &sendBatch->iovecs[i];
+        sendBatch->msgs[i].msg_hdr.msg_iovlen = 1;
+        sendBatch->msgs[i].msg_hdr.msg_name = dstaddr;
+        sendBatch->msgs[i].msg_hdr.msg_namelen = addrlen;
+#endif
+    }
+
+    return sendBatch;
+
+}  // End of NewSendBatch
+
+void FreeSendBatch(sendBatch_t *sendBatch) {
+    if (!sendBatch) return;
+
+    for (int i = 0; i < SEND_BATCHSIZE; i++) {
+        if (sendBatch->buff[i]) free(sendBatch->buff[i]);
+    }
+    free(sendBatch);
+
+}  // End of FreeSendBatch
+
+/*
+ * sends all queued datagrams. With sendmmsg() the batch is sent with as few
+ * calls as possible. returns 0 on success or -1 on error with errno set
+ */
+int FlushSendBatch(sendBatch_t *sendBatch) {
+    uint32_t sent = 0;
+    while (sent < sendBatch->numPackets) {
+#ifdef HAVE_SENDMMSG
+        int ret = sendmmsg(sendBatch->socket, &sendBatch->msgs[sent], sendBatch->numPackets - sent, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            sendBatch->numPackets = 0;
+            return -1;
+        }
+        sent += ret;
+#else
+        ssize_t ret = sendto(sendBatch->socket, sendBatch->buff[sent], sendBatch->size[sent], 0, (struct sockaddr *)sendBatch->dstaddr, sendBatch->addrlen);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            sendBatch->numPackets = 0;
+            return -1;
+        }
+        sent++;
+#endif
+    }
+    sendBatch->numPackets = 0;
+    return 0;
+
+}  // End of FlushSendBatch
+
+/*
+ * queues a copy of the datagram in buff. The batch is sent, if it is full.
+ * returns 0 on success or -1 on error with errno set
+ */
+int SendBatchPacket(sendBatch_t *sendBatch, void *buff, size_t size) {
+    if (size > UDP_PACKET_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    uint32_t i = sendBatch->numPackets++;
+    memcpy(sendBatch->buff[i], buff, size);
+    sendBatch->size[i] = size;
+#ifdef HAVE_SENDMMSG
+    sendBatch->iovecs[i].iov_len = size;
+#endif
+
+    if (sendBatch->numPackets == SEND_BATCHSIZE) return FlushSendBatch(sendBatch);
+    return 0;
+
+}  // End of SendBatchPacket
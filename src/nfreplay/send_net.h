@@ -31,6 +31,7 @@
 #ifndef _NFNET_H
 #define _NFNET_H 1
 
+#include <stdint.h>
 #include <sys/socket.h>
 
 /* Definitions */
@@ -51,8 +52,13 @@ typedef struct send_peer_s {
     void *send_buffer;
     void *buff_ptr;
     void *endp;
+    uint32_t sourceID;  // v9 source id of the exporter. 0 = default
+    void *exporter;     // exporter state of the protocol encoder
 } send_peer_t;
 
+// batch of datagrams sent with one call, if supported by the system
+typedef struct sendBatch_s sendBatch_t;
+
 /* Function prototypes */
 int Unicast_send_socket(const char *shostname, const char *dhostname, const char *listenport, int family, unsigned int wmem_size,
                         struct sockaddr_storage *saddr, struct sockaddr_storage *daddr, int *addrlen);
@@ -60,4 +66,12 @@ int Unicast_send_socket(const char *shostname, const char *dhostname, const char
 int Multicast_send_socket(const char *shostname, const char *dhostname, const char *listenport, int family, unsigned int wmem_size,
                           struct sockaddr_storage *saddr, struct sockaddr_storage *daddr, int *addrlen);
 
+sendBatch_t *NewSendBatch(int socket, struct sockaddr_storage *dstaddr, socklen_t addrlen);
+
+void FreeSendBatch(sendBatch_t *sendBatch);
+
+int SendBatchPacket(sendBatch_t *sendBatch, void *buff, size_t size);
+
+int FlushSendBatch(sendBatch_t *sendBatch);
+
 #endif  //_NFNET_H
@@ -93,7 +93,10 @@ typedef struct outTemplates_s {
     template_flowset_t *template_flowset;  // full template in network byte order for sending
 } outTemplate_t;
 
+// state of one emulated exporter - templates, sequence and the packet in progress
 typedef struct sender_data_s {
+    outTemplate_t *outTemplates;  // templates of this exporter
+
     struct header_s {
         v9Header_t *v9_header;    // start of v9 packet
         uint32_t record_count;    // number of records in send buffer
@@ -108,8 +111,6 @@ typedef struct sender_data_s {
 
 #define MAX_LIFETIME 60
 
-static outTemplate_t *outTemplates = NULL;
-static sender_data_t *sender_data = NULL;
 
 // Get_valxx, a  macros
 #include "inline.c"
@@ -118,7 +119,7 @@ static sender_data_t *sender_data = NULL;
  * functions for sending netflow v9 records
  */
 
-static outTemplate_t *GetOutputTemplate(recordHandle_t *recordHandle);
+static outTemplate_t *GetOutputTemplate(sender_data_t *sender_data, recordHandle_t *recordHandle);
 
 static void Append_Record(send_peer_t *peer, recordHandle_t *recordHandle);
 
@@ -129,11 +130,12 @@ static void CloseDataFlowset(send_peer_t *peer);
 static int CheckSendBufferSpace(size_t size, send_peer_t *peer);
 
 int Init_v9_output(send_peer_t *peer) {
-    sender_data = calloc(1, sizeof(sender_data_t));
+    sender_data_t *sender_data = calloc(1, sizeof(sender_data_t));
     if (!sender_data) {
         LogError("calloc() %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return 0;
     }
+    peer->exporter = (void *)sender_data;
     sender_data->header.v9_header = (v9Header_t *)peer->send_buffer;
     peer->buff_ptr = (void *)((void *)sender_data->header.v9_header + sizeof(v9Header_t));
 
@@ -141,7 +143,7 @@ int Init_v9_output(send_peer_t *peer) {
     sender_data->header.v9_header->SysUptime = 0;
     sender_data->header.v9_header->unix_secs = 0;
     sender_data->header.v9_header->count = 0;
-    sender_data->header.v9_header->source_id = htonl(1);
+    sender_data->header.v9_header->source_id = htonl(peer->sourceID ? peer->sourceID : 1);
     sender_data->header.record_count = 0;
     sender_data->header.template_count = 0;
     sender_data->header.sequence = 0;
@@ -154,6 +156,7 @@ int Init_v9_output(send_peer_t *peer) {
 }  // End of Init_v9_output
 
 int Close_v9_output(send_peer_t *peer) {
+    sender_data_t *sender_data = (sender_data_t *)peer->exporter;
     if ((sender_data->header.record_count + sender_data->header.template_count) > 0) {
         dbg_printf("Close v9 output\n");
         peer->flush = 1;
@@ -172,15 +175,31 @@ int Close_v9_output(send_peer_t *peer) {
 
 }  // End of Close_v9_output
 
-static outTemplate_t *GetOutputTemplate(recordHandle_t *recordHandle) {
+void Free_v9_output(send_peer_t *peer) {
+    sender_data_t *sender_data = (sender_data_t *)peer->exporter;
+    if (!sender_data) return;
+
+    outTemplate_t *template = sender_data->outTemplates;
+    while (template) {
+        outTemplate_t *next = template->next;
+        free(template->template_flowset);
+        free(template);
+        template = next;
+    }
+    free(sender_data);
+    peer->exporter = NULL;
+
+}  // End of Free_v9_output
+
+static outTemplate_t *GetOutputTemplate(sender_data_t *sender_data, recordHandle_t *recordHandle) {
     uint32_t template_id = 0;
 
     uint64_t elementBits = 0;
     for (int i = 0; i < MAXEXTENSIONS; i++) {
-        if (recordHandle->extensionList[i]) elementBits |= 1 << i;
+        if (recordHandle->extensionList[i]) elementBits |= 1ULL << i;
     }
 
-    outTemplate_t **t = &outTemplates;
+    outTemplate_t **t = &sender_data->outTemplates;
     // search for the template, which corresponds to our flags and extension map
     while (*t) {
         if (((*t)->elementBits == elementBits) && ((*t)->numExtensions == recordHandle->numElements)) {
@@ -493,6 +512,7 @@ static outTemplate_t *GetOutputTemplate(recordHandle_t *recordHandle) {
 }  // End of GetOutputTemplate
 
 static void Append_Record(send_peer_t *peer, recordHandle_t *recordHandle) {
+    sender_data_t *sender_data = (sender_data_t *)peer->exporter;
     uint8_t *p = (uint8_t *)peer->buff_ptr;
     *p++ = recordHandle->recordHeaderV3->engineType;
     *p++ = recordHandle->recordHeaderV3->engineID;
@@ -669,6 +689,7 @@ static void Append_Record(send_peer_t *peer, recordHandle_t *recordHandle) {
 }  // End of Append_Record
 
 static int Add_template_flowset(outTemplate_t *outTemplate, send_peer_t *peer) {
+    sender_data_t *sender_data = (sender_data_t *)peer->exporter;
     dbg_printf("Add template %u, bytes: %u\n", outTemplate->template_id, outTemplate->flowset_length);
     memcpy(peer->buff_ptr, (void *)outTemplate->template_flowset, outTemplate->flowset_length);
     peer->buff_ptr = (void *)((pointer_addr_t)peer->buff_ptr + outTemplate->flowset_length);
@@ -679,6 +700,7 @@ static int Add_template_flowset(outTemplate_t *outTemplate, send_peer_t *peer) {
 }  // End of Add_template_flowset
 
 static void CloseDataFlowset(send_peer_t *peer) {
+    sender_data_t *sender_data = (sender_data_t *)peer->exporter;
     if (sender_data->data_flowset) {
         uint32_t length = (void *)peer->buff_ptr - (void *)sender_data->data_flowset;
         uint32_t align = length & 0x3;
@@ -698,6 +720,7 @@ static void CloseDataFlowset(send_peer_t *peer) {
 }  // End of CloseDataFlowset
 
 static int CheckSendBufferSpace(size_t size, send_peer_t *peer) {
+    sender_data_t *sender_data = (sender_data_t *)peer->exporter;
     dbg_printf("CheckSendBufferSpace for %lu bytes: ", size);
     if ((peer->buff_ptr + size) > peer->endp) {
         // request buffer flush
@@ -720,6 +743,7 @@ static int CheckSendBufferSpace(size_t size, send_peer_t *peer) {
 }  // End of CheckBufferSpace
 
 int Add_v9_output_record(recordHandle_t *recordHandle, send_peer_t *peer) {
+    sender_data_t *sender_data = (sender_data_t *)peer->exporter;
     dbg_printf("\nNext packet\n");
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     if (recordHandle->numElements == 0 || !genericFlow) {
@@ -742,7 +766,7 @@ int Add_v9_output_record(recordHandle_t *recordHandle, send_peer_t *peer) {
     }
 
     time_t now = time(NULL);
-    outTemplate_t *template = GetOutputTemplate(recordHandle);
+    outTemplate_t *template = GetOutputTemplate(sender_data, recordHandle);
     if ((sender_data->data_flowset_id != template->template_id) || template->needs_refresh) {
         // Different flowset ID - End data flowset and open new data flowset
         CloseDataFlowset(peer);
@@ -110,6 +110,8 @@ int Init_v9_output(send_peer_t *peer);
 
 int Close_v9_output(send_peer_t *peer);
 
+void Free_v9_output(send_peer_t *peer);
+
 int Add_v9_output_record(recordHandle_t *recordHandle, send_peer_t *peer);
 
 #endif  // _SEND_V9_H
\ No newline at end of file
@@ -34,6 +34,7 @@
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,6 +47,7 @@
 
 #include "barrier.h"
 #include "conf/nfconf.h"
+#include "cpufeature.h"
 #include "filter/filter.h"
 #include "flist.h"
 #include "maxmind.h"
@@ -55,6 +57,7 @@
 #include "nfstatfile.h"
 #include "nfxV3.h"
 #include "profile.h"
+#include "queue.h"
 #include "tor.h"
 #include "util.h"
 #include "version.h"
@@ -67,15 +70,26 @@ char influxdb_url[1024] = "";
 #define PROFILEWRITERS 2
 #define MAXPROFILERS 8
 
+// max number of blocks queued for a worker
+#define WORKERQUEUESIZE 16
+
+// data block shared by all workers - the last worker frees the block
+typedef struct profileBlock_s {
+    dataBlock_t *dataBlock;
+    const char *ident;  // ident of the file of this block
+    _Atomic uint32_t refCnt;
+} profileBlock_t;
+
 typedef struct worker_param_s {
     int self;
     uint32_t numWorkers;
     uint32_t numChannels;
     profile_channel_info_t *channels;
-    dataBlock_t **dataBlock;
+    void *filterSet;  // filters of the channels of this worker
+    int hasGeoDB;
 
-    // sync barrier
-    pthread_control_barrier_t *barrier;
+    // blocks to process - each worker processes its channels at its own pace
+    queue_t *blockQueue;
 } worker_param_t;
 
 /* Function Prototypes */
@@ -83,8 +97,9 @@ static void usage(char *name);
 
 static profile_param_info_t *ParseParams(char *profile_datadir);
 
-static void process_data(profile_channel_info_t *channels, unsigned int numChannels, time_t tslot, worker_param_t **workerList, int numWorkers,
-                         pthread_control_barrier_t *barrier, int hasGeoDB);
+static void process_data(profile_channel_info_t *channels, unsigned int numChannels, worker_param_t **workerList, pthread_t *tid, int numWorkers);
+
+static void WaitWorkersDone(pthread_t *tid, int numWorkers);
 
 /* Functions */
 
@@ -123,19 +138,26 @@ __attribute__((noreturn)) static void *worker(void *arg) {
     uint32_t numWorkers = worker_param->numWorkers;
     uint32_t numChannels = worker_param->numChannels;
     profile_channel_info_t *channels = worker_param->channels;
+    const char *ident = NULL;
 
     recordHandle_t *recordHandle = calloc(1, sizeof(recordHandle_t));
-    if (!recordHandle) {
+    // match bitmap of the channel filters of this worker
+    uint64_t *channelMatch = calloc((numChannels / numWorkers + 64) >> 6, sizeof(uint64_t));
+    if (!recordHandle || !channelMatch) {
         LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
         pthread_exit(NULL);
     }
 
-    // wait in barrier after launch
-    pthread_control_barrier_wait(worker_param->barrier);
-
-    while (*(worker_param->dataBlock)) {
-        dataBlock_t *dataBlock = *(worker_param->dataBlock);
+    profileBlock_t *profileBlock;
+    while ((profileBlock = queue_pop(worker_param->blockQueue)) != QUEUE_CLOSED) {
+        dataBlock_t *dataBlock = profileBlock->dataBlock;
         dbg_printf("Worker %i working on %p\n", self, dataBlock);
+
+        // new file - set ident to the engines of this worker
+        if (profileBlock->ident != ident) {
+            ident = profileBlock->ident;
+            for (int j = self; j < numChannels; j += numWorkers) FilterSetParam(channels[j].engine, ident, worker_param->hasGeoDB);
+        }
         uint32_t recordCount = 0;
 
         record_header_t *record_ptr = GetCursor(dataBlock);
@@ -152,15 +174,12 @@ __attribute__((noreturn)) static void *worker(void *arg) {
                 case V3Record:
                     MapRecordHandle(recordHandle, (recordHeaderV3_t *)record_ptr, recordCount);
 
-                    for (int j = self; j < numChannels; j += numWorkers) {
-                        int match;
-
-                        // apply profile filter
-                        void *engine = channels[j].engine;
-                        match = FilterRecord(engine, recordHandle);
+                    // apply all profile filters at once
+                    FilterRecordSet(worker_param->filterSet, recordHandle, channelMatch);
 
+                    for (int j = self, k = 0; j < numChannels; j += numWorkers, k++) {
                         // if profile filter failed -> next profile
-                        if (!match) continue;
+                        if ((channelMatch[k >> 6] & (1ULL << (k & 0x3F))) == 0) continue;
 
                         // filter was successful -> continue record processing
 
@@ -218,9 +237,11 @@ __attribute__((noreturn)) static void *worker(void *arg) {
 
         }  // End of for all umRecords
 
-        // Done
-        // wait in barrier for next data record
-        pthread_control_barrier_wait(worker_param->barrier);
+        // Done - the last worker frees the block
+        if (atomic_fetch_sub(&profileBlock->refCnt, 1) == 1) {
+            FreeDataBlock(dataBlock);
+            free(profileBlock);
+        }
     }
 
     dbg_printf("Worker %d done.\n", worker_param->self);
@@ -229,8 +250,7 @@ __attribute__((noreturn)) static void *worker(void *arg) {
     // unreached
 }  // End of worker
 
-static worker_param_t **LauchWorkers(pthread_t *tid, int numWorkers, pthread_control_barrier_t *barrier, profile_channel_info_t *channels,
-                                     uint32_t numChannels) {
+static worker_param_t **LauchWorkers(pthread_t *tid, int numWorkers, profile_channel_info_t *channels, uint32_t numChannels, int hasGeoDB) {
     if (numWorkers > MAXWORKERS) {
         LogError("LaunchWorkers: number of worker: %u > max workers: %u", numWorkers, MAXWORKERS);
         return NULL;
@@ -243,12 +263,24 @@ static worker_param_t **LauchWorkers(pthread_t *tid, int numWorkers, pthread_con
         worker_param_t *worker_param = calloc(1, sizeof(worker_param_t));
         if (!worker_param) NULL;
 
-        worker_param->barrier = barrier;
         worker_param->self = i;
-        worker_param->dataBlock = NULL;
         worker_param->numWorkers = numWorkers;
         worker_param->channels = channels;
         worker_param->numChannels = numChannels;
+        worker_param->hasGeoDB = hasGeoDB;
+        worker_param->blockQueue = queue_init(WORKERQUEUESIZE);
+        if (!worker_param->blockQueue) return NULL;
+
+        // merge the filters of all channels of this worker
+        uint32_t numFilters = 0;
+        void **engines = malloc((numChannels / numWorkers + 1) * sizeof(void *));
+        if (!engines) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return NULL;
+        }
+        for (int j = i; j < numChannels; j += numWorkers) engines[numFilters++] = channels[j].engine;
+        worker_param->filterSet = CompileFilterSet(engines, numFilters);
+        free(engines);
         workerList[i] = worker_param;
 
         int err = pthread_create(&(tid[i]), NULL, worker, (void *)worker_param);
@@ -261,66 +293,70 @@ static worker_param_t **LauchWorkers(pthread_t *tid, int numWorkers, pthread_con
 
 }  // End of LaunchWorkers
 
-static void process_data(profile_channel_info_t *channels, unsigned int numChannels, time_t tslot, worker_param_t **workerList, int numWorkers,
-                         pthread_control_barrier_t *barrier, int hasGeoDB) {
-    dataBlock_t *nextBlock = NULL;
-    dataBlock_t *dataBlock = NULL;
-    // map datablock for workers - all workers
-    // process the same block but different channels
-    for (int i = 0; i < numWorkers; i++) {
-        // set new datablock for all workers
-        workerList[i]->dataBlock = &dataBlock;
-    }
+static void process_data(profile_channel_info_t *channels, unsigned int numChannels, worker_param_t **workerList, pthread_t *tid, int numWorkers) {
+    // idents of all files - the engines refer to them until the workers are done
+    uint32_t numIdents = 0;
+    uint32_t maxIdents = 0;
+    char **identList = NULL;
+    char *ident = NULL;
 
     nffile_t *nffile = NewFile(NULL);
 
-    // wait for workers ready to start
-    pthread_controller_wait(barrier);
-
+    // the reader hands each block to all workers. Each worker filters its
+    // channels independently, and is only stalled, if its queue is empty
     int done = 0;
+    dataBlock_t *dataBlock = NULL;
     while (!done) {
         // get next data block from file
-        dataBlock = nextBlock;
         if (dataBlock == NULL) {
             if (GetNextFile(nffile) == NULL) {
                 done = 1;
                 continue;
             }
-            for (int j = 0; j < numChannels; j++) {
-                // set ident to file engines
-                void *engine = channels[j].engine;
-                FilterSetParam(engine, nffile->ident, hasGeoDB);
+            if (numIdents == maxIdents) {
+                maxIdents += 64;
+                identList = realloc(identList, maxIdents * sizeof(char *));
+                if (!identList) {
+                    LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                    exit(255);
+                }
             }
-            // read first block and continue
-            nextBlock = ReadBlock(nffile, NULL);
+            ident = nffile->ident ? strdup(nffile->ident) : NULL;
+            identList[numIdents++] = ident;
+            dataBlock = ReadBlock(nffile, NULL);
             continue;
         }
 
         if (dataBlock->type != DATA_BLOCK_TYPE_2 && dataBlock->type != DATA_BLOCK_TYPE_3) {
             LogError("Can't process block type %u. Skip block", dataBlock->type);
-            nextBlock = ReadBlock(nffile, NULL);
+            FreeDataBlock(dataBlock);
+            dataBlock = ReadBlock(nffile, NULL);
             continue;
         }
 
         dbg_printf("Next block: Records: %u\n", dataBlock->NumRecords);
-        // release workers from barrier
-        pthread_control_barrier_release(barrier);
-
-        // get next block while worker are processing the previous one
-        nextBlock = ReadBlock(nffile, NULL);
+        profileBlock_t *profileBlock = malloc(sizeof(profileBlock_t));
+        if (!profileBlock) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+        profileBlock->dataBlock = dataBlock;
+        profileBlock->ident = ident;
+        atomic_init(&profileBlock->refCnt, numWorkers);
+        for (int i = 0; i < numWorkers; i++) queue_push(workerList[i]->blockQueue, profileBlock);
 
-        // wait for all workers, work done on this block
-        pthread_controller_wait(barrier);
-        // free processed block
-        FreeDataBlock(dataBlock);
+        // get next block while workers are processing the previous ones
+        dataBlock = ReadBlock(nffile, NULL);
 
     }  // End of while !done
 
     // done! - signal all workers to terminate
-    dataBlock = NULL;
-    pthread_control_barrier_release(barrier);
+    for (int i = 0; i < numWorkers; i++) queue_close(workerList[i]->blockQueue);
+    WaitWorkersDone(tid, numWorkers);
 
     DisposeFile(nffile);
+    for (int i = 0; i < numIdents; i++) free(identList[i]);
+    free(identList);
 
     // do we need to write data to new file - shadow profiles do not have files.
     // write all used blocks first, then close the files
@@ -570,6 +606,7 @@ int main(int argc, char **argv) {
                 break;
             case 'V':
                 printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
                 exit(0);
                 break;
             case 'f':
@@ -723,6 +760,9 @@ int main(int argc, char **argv) {
     queue_t *fileList = SetupInputFileSequence(&flist);
     if (!fileList || !Init_nffile(PROFILEWRITERS, fileList)) exit(254);
 
+    // all channel files share one pool of writers
+    if (!StartWriterPool(0)) LogError("Failed to start writer pool - continue with writers per channel");
+
     numChannels = InitChannels(profile_datadir, profile_statdir, profile_list, ffile, filename, subdir_index, syntax_only, compress);
 
     // nothing to do
@@ -739,23 +779,20 @@ int main(int argc, char **argv) {
     // check numWorkers depending on cores online
     numWorkers = GetNumWorkers(numWorkers);
 
-    pthread_control_barrier_t *barrier = pthread_control_barrier_init(numWorkers);
-    if (!barrier) exit(255);
+    // no worker without channels
+    if (numWorkers > numChannels) numWorkers = numChannels;
 
     profile_channel_info_t *channels = GetChannelInfoList();
 
     pthread_t tid[MAXWORKERS] = {0};
     dbg_printf("Launch Workers\n");
-    worker_param_t **workerList = LauchWorkers(tid, numWorkers, barrier, channels, numChannels);
+    worker_param_t **workerList = LauchWorkers(tid, numWorkers, channels, numChannels, hasGeoDB);
     if (!workerList) {
         LogError("Failed to launch workers");
         exit(255);
     }
 
-    process_data(channels, numChannels, tslot, workerList, numWorkers, barrier, hasGeoDB);
-
-    WaitWorkersDone(tid, numWorkers);
-    pthread_control_barrier_destroy(barrier);
+    process_data(channels, numChannels, workerList, tid, numWorkers);
 
     UpdateChannels(tslot);
 #if 0
@@ -47,6 +47,7 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "cpufeature.h"
 #include "exporter.h"
 #include "filter/filter.h"
 #include "flist.h"
@@ -333,6 +334,7 @@ int main(int argc, char **argv) {
                 break;
             case 'V':
                 printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
                 exit(0);
                 break;
             default:
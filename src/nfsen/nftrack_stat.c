@@ -36,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -53,32 +54,46 @@
 // 288 slots per day
 #define MAX_SLOTS 288
 
+/*
+ * The stat file has a fixed layout: the stat header followed by NUMPORTS data rows.
+ * It is mapped into memory and updated in place. Only the pages of the changed
+ * rows are synced back, when the stat is closed.
+ */
 typedef struct stat_header_s {
     uint16_t version;
     int av_num;
     time_t last;
 } stat_header_t;
 
+#define STATFILESIZE (sizeof(stat_header_t) + NUMPORTS * sizeof(data_row))
+
 typedef struct topN_vector_s {
     uint16_t port;
     uint64_t count;
 } topN_vector_t;
 
-static stat_header_t stat_header;
+// header used, while no stat file is mapped
+static stat_header_t noStat = {0};
+static stat_header_t *stat_header = &noStat;
 static data_row *stat_record;
+static void *statMap;
 static char statfile[MAXPATHLEN];
 static char dbpath[MAXPATHLEN];
+
+// dirty page bitmap of the mapped stat file
+static uint8_t *dirtyPages;
+static size_t pageSize;
 static int dirty;
 
 /* prototypes */
 static void ReadStat(void);
-static void heapSort(topN_vector_t *vector, int array_size, int topN);
-static void siftDown(topN_vector_t *vector, int root, int bottom);
+static void SelectTopN(topN_vector_t *vector, int array_size, int topN);
 
 int InitStat(char *path) {
     int len;
-    stat_header.version = 0;
+    stat_header = &noStat;
     stat_record = NULL;
+    statMap = NULL;
 
     len = snprintf(statfile, MAXPATHLEN, "%s/%s", path, STATFILE);
     if (len >= MAXPATHLEN) {
@@ -94,36 +109,19 @@ int InitStat(char *path) {
 }  // End of InitStat
 
 int InitStatFile(void) {
-    ssize_t num;
-    int fd;
-
     if (statfile[0] == 0) return 0;
 
-    stat_record = (data_row *)calloc(NUMPORTS, sizeof(data_row));
-    if (!stat_record) {
-        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return 0;
-    }
-
-    fd = open(statfile, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    int fd = open(statfile, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     if (fd < 0) {
         LogError("open() error for %s in %s line %d: %s", statfile, __FILE__, __LINE__, strerror(errno));
-        free(stat_record);
-        stat_record = NULL;
         return 0;
     }
 
-    stat_header.version = 1;
-    stat_header.av_num = 0;
-    stat_header.last = 0;
-
-    num = write(fd, &stat_header, sizeof(stat_header));
-    num = write(fd, stat_record, NUMPORTS * sizeof(data_row));
-    if (num < 0) {
+    stat_header_t header = {.version = 1, .av_num = 0, .last = 0};
+    ssize_t num = write(fd, &header, sizeof(header));
+    // zero filled data rows
+    if (num < 0 || ftruncate(fd, STATFILESIZE) < 0) {
         LogError("write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
-        stat_header.version = 0;
-        free(stat_record);
-        stat_record = NULL;
         close(fd);
         return 0;
     }
@@ -141,107 +139,119 @@ data_row *GetStat(void) {
 
 }  // End of GetStat
 
-int CloseStat(void) {
-    int fd;
-    ssize_t num;
-
-    if (statfile[0] == 0 || !dirty) return 1;
-
-    fd = open(statfile, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fd < 0) {
-        LogError("open() error for %s in %s line %d: %s", statfile, __FILE__, __LINE__, strerror(errno));
-        return 0;
-    }
-
-    num = write(fd, (void *)&stat_header, sizeof(stat_header));
-    if (num < 0) {
-        LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        close(fd);
-        return 0;
-    }
+// mark the pages of the memory range dirty
+static inline void SetDirty(void *ptr, size_t size) {
+    size_t first = ((char *)ptr - (char *)statMap) / pageSize;
+    size_t last = ((char *)ptr - (char *)statMap + size - 1) / pageSize;
+    for (size_t page = first; page <= last; page++) dirtyPages[page] = 1;
+    dirty = 1;
+}  // End of SetDirty
 
-    num = write(fd, stat_record, NUMPORTS * sizeof(data_row));
-    if (num < 0) {
-        LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return 0;
+int CloseStat(void) {
+    if (!statMap) return 1;
+
+    int ret = 1;
+    if (dirty) {
+        // sync all runs of dirty pages
+        size_t numPages = (STATFILESIZE + pageSize - 1) / pageSize;
+        size_t page = 0;
+        while (page < numPages) {
+            if (!dirtyPages[page]) {
+                page++;
+                continue;
+            }
+            size_t first = page;
+            while (page < numPages && dirtyPages[page]) page++;
+            size_t length = (page - first) * pageSize;
+            if ((first * pageSize + length) > STATFILESIZE) length = STATFILESIZE - first * pageSize;
+            if (msync((char *)statMap + first * pageSize, length, MS_ASYNC) < 0) {
+                LogError("msync() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                ret = 0;
+            }
+        }
     }
 
-    free(stat_record);
+    munmap(statMap, STATFILESIZE);
+    free(dirtyPages);
+    statMap = NULL;
+    dirtyPages = NULL;
     stat_record = NULL;
-    stat_header.version = 0;
-    close(fd);
+    stat_header = &noStat;
+    dirty = 0;
 
-    return 1;
+    return ret;
 
 }  // End of CloseStat
 
 static void ReadStat(void) {
-    int fd;
-    ssize_t num;
-
     if (statfile[0] == 0) return;
 
-    stat_record = (data_row *)calloc(NUMPORTS, sizeof(data_row));
-    if (!stat_record) {
-        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return;
-    }
-
-    fd = open(statfile, O_RDONLY);
+    int fd = open(statfile, O_RDWR);
     if (fd < 0) {
         // allow to delete the stat file to restart stat from scratch
         if (errno == ENOENT) {
             LogError("Missing stat file - re-initialise");
             if (InitStatFile()) {
-                fd = open(statfile, O_RDONLY);
+                fd = open(statfile, O_RDWR);
                 if (fd < 0) {
                     LogError("open() error for %s in %s line %d: %s", statfile, __FILE__, __LINE__, strerror(errno));
-                    free(stat_record);
-                    stat_record = NULL;
                     return;
                 }
+            } else {
+                return;
             }
         } else {
             LogError("open() error for %s in %s line %d: %s", statfile, __FILE__, __LINE__, strerror(errno));
-            free(stat_record);
-            stat_record = NULL;
             return;
         }
     }
 
-    num = read(fd, (void *)&stat_header, sizeof(stat_header));
-    if (num < 0) {
-        LogError("read() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        free(stat_record);
-        stat_record = NULL;
+    struct stat fstat_buf;
+    if (fstat(fd, &fstat_buf) < 0) {
+        LogError("fstat() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         close(fd);
         return;
     }
-
-    if (stat_header.version != 1) {
-        LogError("Version error stat file. Found version: %d expected: 1", stat_header.version);
-        free(stat_record);
-        stat_record = NULL;
-        stat_header.version = 0;
+    if (fstat_buf.st_size != (off_t)STATFILESIZE) {
+        LogError("Size error stat file. Found size: %lld expected: %zu", (long long)fstat_buf.st_size, STATFILESIZE);
         close(fd);
         return;
     }
 
-    num = read(fd, stat_record, NUMPORTS * sizeof(data_row));
-    if (num < 0) {
-        LogError("read() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        free(stat_record);
-        stat_record = NULL;
-        stat_header.version = 0;
-        close(fd);
+    void *map = mmap(NULL, STATFILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LogError("mmap() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    stat_header_t *header = (stat_header_t *)map;
+    if (header->version != 1) {
+        LogError("Version error stat file. Found version: %d expected: 1", header->version);
+        munmap(map, STATFILESIZE);
+        return;
     }
 
+    pageSize = sysconf(_SC_PAGESIZE);
+    dirtyPages = calloc((STATFILESIZE + pageSize - 1) / pageSize, sizeof(uint8_t));
+    if (!dirtyPages) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        munmap(map, STATFILESIZE);
+        return;
+    }
+
+    statMap = map;
+    stat_header = header;
+    stat_record = (data_row *)((char *)map + sizeof(stat_header_t));
+    dirty = 0;
+
 }  // End of ReadStat
 
 void ClearStat(void) {
     memset((void *)stat_record, 0, NUMPORTS * sizeof(data_row));
-    stat_header.av_num = 0;
-    stat_header.last = 0;
+    stat_header->av_num = 0;
+    stat_header->last = 0;
+    SetDirty(statMap, STATFILESIZE);
 }  // End of ClearStat
 
 int UpdateStat(data_row *row, time_t when) {
@@ -253,46 +263,46 @@ int UpdateStat(data_row *row, time_t when) {
         if (!stat_record) return 0;
     }
 
-    if (stat_header.av_num > MAX_SLOTS) {
-        LogError("Too many slots aggregated: %i. Expected max. %i", stat_header.av_num, MAX_SLOTS);
-        LogError("Stat: Num : %i", stat_header.av_num);
-        LogError("Stat: last: %s", ctime(&stat_header.last));
+    if (stat_header->av_num > MAX_SLOTS) {
+        LogError("Too many slots aggregated: %i. Expected max. %i", stat_header->av_num, MAX_SLOTS);
+        LogError("Stat: Num : %i", stat_header->av_num);
+        LogError("Stat: last: %s", ctime(&stat_header->last));
         // should not happen - anyway consider stat record to be corrupt - > clear
         ClearStat();
     }
 
     last_rrd = RRD_LastUpdate(dbpath);
-    if (stat_header.last && (last_rrd != stat_header.last)) {
-        LogError("RRD and stat record out of sync. %i != %i", last_rrd, stat_header.last);
-        LogError("Stat: Num : %i", stat_header.av_num);
-        LogError("Stat: last: %s", ctime(&stat_header.last));
+    if (stat_header->last && (last_rrd != stat_header->last)) {
+        LogError("RRD and stat record out of sync. %i != %i", last_rrd, stat_header->last);
+        LogError("Stat: Num : %i", stat_header->av_num);
+        LogError("Stat: last: %s", ctime(&stat_header->last));
         LogError("RRD : last: %s", ctime(&last_rrd));
         // should not happen - anyway consider stat record to be corrupt - > clear
         ClearStat();
     }
 
-    if (stat_header.last && ((when - (300 * MAX_SLOTS)) > stat_header.last)) {
+    if (stat_header->last && ((when - (300 * MAX_SLOTS)) > stat_header->last)) {
         LogError("Last stat update too far in the past -> clear stat record");
-        LogError("Stat: Num : %i", stat_header.av_num);
-        LogError("Stat: last: %s", ctime(&stat_header.last));
+        LogError("Stat: Num : %i", stat_header->av_num);
+        LogError("Stat: last: %s", ctime(&stat_header->last));
         // last update too far in the past -> clear stat record
         ClearStat();
     }
-    if (stat_header.last && (when - stat_header.last) > 1800) {
+    if (stat_header->last && (when - stat_header->last) > 1800) {
         LogError("Last stat update too far in the past -> clear stat record");
-        LogError("Stat: Num : %i", stat_header.av_num);
-        LogError("Stat: last: %s", ctime(&stat_header.last));
+        LogError("Stat: Num : %i", stat_header->av_num);
+        LogError("Stat: last: %s", ctime(&stat_header->last));
         // last update too far in the past -> clear stat record
         ClearStat();
     }
 
-    if (stat_header.av_num) {
-        first_stat = stat_header.last - (stat_header.av_num - 1) * 300;
+    if (stat_header->av_num) {
+        first_stat = stat_header->last - (stat_header->av_num - 1) * 300;
     } else {
         first_stat = 0;
     }
 
-    if (stat_header.av_num == MAX_SLOTS) {
+    if (stat_header->av_num == MAX_SLOTS) {
         time_t tslot;
         data_row *oldrow;
         for (tslot = first_stat; tslot < when - ((MAX_SLOTS - 1) * 300); tslot += 300) {
@@ -303,30 +313,41 @@ int UpdateStat(data_row *row, time_t when) {
             }
             LogInfo("Remove stat line %s\n", ctime(&tslot));
             for (pnum = 0; pnum < NUMPORTS; pnum++) {
+                int changed = 0;
                 for (p = 0; p < 2; p++) {
                     for (t = 0; t < 3; t++) {
                         stat_record[pnum].proto[p].type[t] -= oldrow[pnum].proto[p].type[t];
+                        changed |= oldrow[pnum].proto[p].type[t] != 0;
                     }
                 }
+                if (changed) SetDirty(&stat_record[pnum], sizeof(data_row));
             }
-            stat_header.av_num--;
+            stat_header->av_num--;
         }
     }
 
-    // Add new slot
+    // Add new slot - update the rows of active ports only
     for (pnum = 0; pnum < NUMPORTS; pnum++) {
+        int changed = 0;
+        for (p = 0; p < 2; p++) {
+            for (t = 0; t < 3; t++) {
+                changed |= row[pnum].proto[p].type[t] != 0;
+            }
+        }
+        if (!changed) continue;
         for (p = 0; p < 2; p++) {
             for (t = 0; t < 3; t++) {
                 stat_record[pnum].proto[p].type[t] += row[pnum].proto[p].type[t];
             }
         }
+        SetDirty(&stat_record[pnum], sizeof(data_row));
     }
-    stat_header.av_num++;
-    stat_header.last = when;
-    dirty = 1;
+    stat_header->av_num++;
+    stat_header->last = when;
+    SetDirty(stat_header, sizeof(stat_header_t));
 
-    LogInfo("UpdateStat: Num : %i\n", stat_header.av_num);
-    LogInfo("UpdateStat: last: %s\n", ctime(&stat_header.last));
+    LogInfo("UpdateStat: Num : %i\n", stat_header->av_num);
+    LogInfo("UpdateStat: last: %s\n", ctime(&stat_header->last));
 
     return 1;
 
@@ -355,78 +376,77 @@ void Generate_TopN(data_row *row, int n, int scale, time_t when, int output_mode
     }
 
     // Add new slot
-    if (when == 0) when = stat_header.last;
+    if (n > NUMPORTS) n = NUMPORTS;
+    if (when == 0) when = stat_header->last;
     if (output_mode != 0) fprintf(wfd, "%i\n", (int)when);
     for (p = 0; p < 2; p++) {
         for (t = 0; t < 3; t++) {
             for (pnum = 0; pnum < NUMPORTS; pnum++) {
                 topN_vector[pnum].port = pnum;
                 topN_vector[pnum].count = row[pnum].proto[p].type[t];
-                if (scale && stat_header.av_num) {
-                    topN_vector[pnum].count /= stat_header.av_num;
+                if (scale && stat_header->av_num) {
+                    topN_vector[pnum].count /= stat_header->av_num;
                 }
             }
-            heapSort(topN_vector, NUMPORTS, n);
+            SelectTopN(topN_vector, NUMPORTS, n);
             if (output_mode == 0) {
                 fprintf(wfd, "Top %i %s Proto %s\n", n, type[t], proto[p]);
-                for (i = NUMPORTS - 1; i > (NUMPORTS - n - 1); i--)
-                    fprintf(wfd, "%u %llu\n", topN_vector[i].port, (long long unsigned)topN_vector[i].count);
+                for (i = 0; i < n; i++) fprintf(wfd, "%u %llu\n", topN_vector[i].port, (long long unsigned)topN_vector[i].count);
                 fprintf(wfd, "\n");
             } else {
                 fprintf(wfd, "%i %i %i\n", n, t, p);
-                for (i = NUMPORTS - 1; i > (NUMPORTS - n - 1); i--) fprintf(wfd, "%u ", topN_vector[i].port);
+                for (i = 0; i < n; i++) fprintf(wfd, "%u ", topN_vector[i].port);
                 fprintf(wfd, "\n");
-                for (i = NUMPORTS - 1; i > (NUMPORTS - n - 1); i--) fprintf(wfd, "%llu ", (long long unsigned)topN_vector[i].count);
+                for (i = 0; i < n; i++) fprintf(wfd, "%llu ", (long long unsigned)topN_vector[i].count);
                 fprintf(wfd, "\n");
             }
         }
     }
 
+    free(topN_vector);
     if (wfile) fclose(wfd);
 
 }  // End of TopN
 
-static void heapSort(topN_vector_t *vector, int array_size, int topN) {
-    topN_vector_t temp;
-    int32_t i, top_count;
-
-    for (i = (array_size / 2) - 1; i >= 0; i--) siftDown(vector, i, array_size);
-
-    top_count = 1;
-
-    for (i = array_size - 1; i >= 1; i--) {
-        temp = vector[0];
-        vector[0] = vector[i];
-        vector[i] = temp;
-        siftDown(vector, 0, i - 1);
-        if (top_count == topN) return;
-        top_count++;
+// sift down the root of the min heap of size elements
+static inline void siftDownMin(topN_vector_t *heap, int root, int size) {
+    topN_vector_t temp = heap[root];
+    while (2 * root + 1 < size) {
+        int child = 2 * root + 1;
+        if (child + 1 < size && heap[child + 1].count < heap[child].count) child++;
+        if (heap[child].count >= temp.count) break;
+        heap[root] = heap[child];
+        root = child;
+    }
+    heap[root] = temp;
+}  // End of siftDownMin
+
+// move the topN largest elements in descending order to the front of the vector.
+// The front of the vector is kept as a min heap of the topN largest elements seen,
+// so each remaining element costs one compare, unless it enters the heap
+static void SelectTopN(topN_vector_t *vector, int array_size, int topN) {
+    if (topN <= 0) return;
+    if (topN > array_size) topN = array_size;
+
+    for (int i = (topN / 2) - 1; i >= 0; i--) siftDownMin(vector, i, topN);
+    for (int i = topN; i < array_size; i++) {
+        if (vector[i].count > vector[0].count) {
+            topN_vector_t temp = vector[0];
+            vector[0] = vector[i];
+            vector[i] = temp;
+            siftDownMin(vector, 0, topN);
+        }
     }
 
-}  // End of heapSort
-
-static void siftDown(topN_vector_t *vector, int root, int bottom) {
-    uint32_t done, maxChild;
-    topN_vector_t temp;
-
-    done = 0;
-    while ((root * 2 <= bottom) && (!done)) {
-        if (root * 2 == bottom)
-            maxChild = root * 2;
-        else if (vector[root * 2].count > vector[root * 2 + 1].count)
-            maxChild = root * 2;
-        else
-            maxChild = root * 2 + 1;
-
-        if (vector[root].count < vector[maxChild].count) {
-            temp = vector[root];
-            vector[root] = vector[maxChild];
-            vector[maxChild] = temp;
-            root = maxChild;
-        } else
-            done = 1;
+    // sort the heap descending
+    for (int size = topN - 1; size > 0; size--) {
+        topN_vector_t temp = vector[0];
+        vector[0] = vector[size];
+        vector[size] = temp;
+        siftDownMin(vector, 0, size);
     }
-}  // End of siftDown
+
+}  // End of SelectTopN
 
 int Lister(data_row *row) {
     int pnum, p, t;
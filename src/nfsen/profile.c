@@ -35,6 +35,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <rrd.h>
+#ifdef HAVE_RRD_CLIENT_H
+#include <rrd_client.h>
+#endif
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -57,6 +60,16 @@
 #include <curl/curl.h>
 extern char influxdb_url[1024];
 static char influxdb_measurement[] = "nfsen_stats";
+
+// line protocol records of all channels are posted in one request
+#define INFLUXBATCHSIZE (1024 * 1024)
+static char *influxBatch = NULL;
+static size_t influxBatchLen = 0;
+// curl handle is reused - keeps the connection alive between posts
+static CURL *influxHandle = NULL;
+
+static void influxdb_client_post(char *body, size_t len);
+static void FlushInfluxDB(void);
 #endif
 
 #if HAVE_RRDVERSION > 8
@@ -71,8 +84,18 @@ extern char yyerror_buff[256];
 static profile_channel_info_t *profile_channels;
 static unsigned int num_channels;
 
+static char rrdTemplate[] =
+    "flows:flows_tcp:flows_udp:flows_icmp:flows_other:packets:packets_tcp:packets_udp:packets_icmp:packets_other:traffic:traffic_tcp:traffic_udp:"
+    "traffic_icmp:traffic_other";
+
 static int AppendString(char *stack, char *string, size_t *buff_size);
 
+static int RRDValues(char *buff, size_t buffsize, time_t tslot, stat_record_t *stat_record);
+
+#ifdef HAVE_RRD_CLIENT_H
+static void UpdateRRDcached(time_t tslot, profile_channel_info_t *channel);
+#endif
+
 static void SetupProfileChannels(char *profile_datadir, char *profile_statdir, profile_param_info_t *profile_param, int subdir_index,
                                  char *filterfile, char *filename, int verify_only, int compress);
 
@@ -338,6 +361,21 @@ static void SetupProfileChannels(char *profile_datadir, char *profile_statdir, p
 }  // End of SetupProfileChannels
 
 void UpdateChannels(time_t tslot) {
+    // with a running rrdcached all channels are updated through one connection,
+    // the daemon batches the updates and writes the rrd files asynchronously
+#ifdef HAVE_RRD_CLIENT_H
+    int rrdcached = 0;
+    char *rrdcachedAddress = getenv("RRDCACHED_ADDRESS");
+    if (tslot > 0 && rrdcachedAddress && strlen(rrdcachedAddress) > 0) {
+        if (rrdc_connect(rrdcachedAddress) == 0) {
+            rrdcached = 1;
+        } else {
+            LogError("RRD: Failed to connect to rrdcached %s: %s\n", rrdcachedAddress, rrd_get_error());
+            rrd_clear_error();
+        }
+    }
+#endif
+
     for (unsigned num = 0; num < num_channels; num++) {
         if (profile_channels[num].ofile) {
             struct stat fstat;
@@ -358,13 +396,25 @@ void UpdateChannels(time_t tslot) {
             }
         }
         if (((profile_channels[num].type & 0x8) == 0) && tslot > 0) {
-            UpdateRRD(tslot, &profile_channels[num]);
+#ifdef HAVE_RRD_CLIENT_H
+            if (rrdcached)
+                UpdateRRDcached(tslot, &profile_channels[num]);
+            else
+#endif
+                UpdateRRD(tslot, &profile_channels[num]);
 #ifdef HAVE_INFLUXDB
             if (strlen(influxdb_url) > 0) UpdateInfluxDB(tslot, &profile_channels[num]);
 #endif
         }
     }
 
+#ifdef HAVE_RRD_CLIENT_H
+    if (rrdcached) rrdc_disconnect();
+#endif
+#ifdef HAVE_INFLUXDB
+    FlushInfluxDB();
+#endif
+
 }  // End of UpdateChannels
 
 void VerifyFiles(void) {
@@ -377,77 +427,32 @@ void VerifyFiles(void) {
 
 }  // End of VerifyFiles
 
+// format the rrd update values in the order of rrdTemplate
+static int RRDValues(char *buff, size_t buffsize, time_t tslot, stat_record_t *stat_record) {
+    int len = snprintf(buff, buffsize, "%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu:%llu", (long long unsigned)tslot,
+                       (long long unsigned)stat_record->numflows, (long long unsigned)stat_record->numflows_tcp,
+                       (long long unsigned)stat_record->numflows_udp, (long long unsigned)stat_record->numflows_icmp,
+                       (long long unsigned)stat_record->numflows_other, (long long unsigned)stat_record->numpackets,
+                       (long long unsigned)stat_record->numpackets_tcp, (long long unsigned)stat_record->numpackets_udp,
+                       (long long unsigned)stat_record->numpackets_icmp, (long long unsigned)stat_record->numpackets_other,
+                       (long long unsigned)stat_record->numbytes, (long long unsigned)stat_record->numbytes_tcp,
+                       (long long unsigned)stat_record->numbytes_udp, (long long unsigned)stat_record->numbytes_icmp,
+                       (long long unsigned)stat_record->numbytes_other);
+    return len;
+
+}  // End of RRDValues
+
 void UpdateRRD(time_t tslot, profile_channel_info_t *channel) {
-    stat_record_t stat_record = channel->stat_record;
-
-    char *template =
-        "flows:flows_tcp:flows_udp:flows_icmp:flows_other:packets:packets_tcp:packets_udp:packets_icmp:packets_other:traffic:traffic_tcp:traffic_udp:"
-        "traffic_icmp:traffic_other";
-
-#define MAXBUFF 1024
-    int buffsize = MAXBUFF;
-    char buff[MAXBUFF];
-    char *s = buff;
-    *s = '\0';
-    int len = snprintf(s, buffsize, "%llu:", (long long unsigned)tslot);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numflows);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numflows_tcp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numflows_udp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numflows_icmp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numflows_other);
-    buffsize -= len;
-    s += len;
-
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numpackets);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numpackets_tcp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numpackets_udp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numpackets_icmp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numpackets_other);
-    buffsize -= len;
-    s += len;
-
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numbytes);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numbytes_tcp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numbytes_udp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu:", (long long unsigned)stat_record.numbytes_icmp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "%llu", (long long unsigned)stat_record.numbytes_other);
-    buffsize -= len;
-    s += len;
-
-    buff[MAXBUFF - 1] = '\0';
+    char buff[1024];
+    RRDValues(buff, sizeof(buff), tslot, &channel->stat_record);
+
     // Create arg vector
     int argc = 0;
     char *rrd_arg[10];
     rrd_arg[argc++] = "update";
     rrd_arg[argc++] = channel->rrdfile;
     rrd_arg[argc++] = "--template";
-    rrd_arg[argc++] = strdup(template);
+    rrd_arg[argc++] = rrdTemplate;
     rrd_arg[argc++] = buff;
     rrd_arg[argc] = NULL;
 
@@ -461,23 +466,48 @@ void UpdateRRD(time_t tslot, profile_channel_info_t *channel) {
 
 }  // End of UpdateRRD
 
+#ifdef HAVE_RRD_CLIENT_H
+// rrdcached does not support templates. The values are passed in the order
+// of the data sources, which NfSen creates in the order of rrdTemplate
+static void UpdateRRDcached(time_t tslot, profile_channel_info_t *channel) {
+    char buff[1024];
+    RRDValues(buff, sizeof(buff), tslot, &channel->stat_record);
+
+    const char *values[1] = {buff};
+    rrd_clear_error();
+    int i = 0;
+    if ((i = rrdc_update(channel->rrdfile, 1, values)) != 0) {
+        LogError("RRD: %s rrdcached Insert Error: %d %s\n", channel->rrdfile, i, rrd_get_error());
+    }
+
+}  // End of UpdateRRDcached
+#endif
+
 #ifdef HAVE_INFLUXDB
-static void influxdb_client_post(char *body) {
+static void influxdb_client_post(char *body, size_t len) {
     CURLcode c;
-    CURL *handle = curl_easy_init();
     // curl -i -XPOST 'http://nbox-demo:8086/write?db=lucatest' --data-binary 'test,host=server01,region=us-west valueA=0.64 valueB=0.64
     // 1434055562000000000'
 
-    curl_easy_setopt(handle, CURLOPT_URL, influxdb_url);
-    curl_easy_setopt(handle, CURLOPT_TIMEOUT, 5L);
-    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, 3L);
-    curl_easy_setopt(handle, CURLOPT_POSTFIELDS, body);
+    if (influxHandle == NULL) {
+        influxHandle = curl_easy_init();
+        if (influxHandle == NULL) {
+            LogError("INFLUXDB: curl_easy_init() failed\n");
+            return;
+        }
+        curl_easy_setopt(influxHandle, CURLOPT_URL, influxdb_url);
+        curl_easy_setopt(influxHandle, CURLOPT_TIMEOUT, 5L);
+        curl_easy_setopt(influxHandle, CURLOPT_CONNECTTIMEOUT, 3L);
+        curl_easy_setopt(influxHandle, CURLOPT_TCP_KEEPALIVE, 1L);
+    }
+    curl_easy_setopt(influxHandle, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(influxHandle, CURLOPT_POSTFIELDSIZE, (long)len);
 
-    c = curl_easy_perform(handle);
+    c = curl_easy_perform(influxHandle);
 
     if (c == CURLE_OK) {
         long status_code = 0;
-        if (curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status_code) == CURLE_OK) {
+        if (curl_easy_getinfo(influxHandle, CURLINFO_RESPONSE_CODE, &status_code) == CURLE_OK) {
             c = status_code;
 
             if (status_code != 204) {
@@ -488,76 +518,64 @@ static void influxdb_client_post(char *body) {
         LogError("INFLUXDB: %s Curl Error: %s\n", influxdb_url, curl_easy_strerror(c));
     }
 
-    curl_easy_cleanup(handle);
-}
+}  // End of influxdb_client_post
+
+// post the collected records of all channels and close the connection
+static void FlushInfluxDB(void) {
+    if (influxBatchLen) influxdb_client_post(influxBatch, influxBatchLen);
+    influxBatchLen = 0;
+
+    if (influxHandle) curl_easy_cleanup(influxHandle);
+    influxHandle = NULL;
+    free(influxBatch);
+    influxBatch = NULL;
 
+}  // End of FlushInfluxDB
+
+// append the channel record to the batch. The batch is posted, if full
 void UpdateInfluxDB(time_t tslot, profile_channel_info_t *channel) {
-    char buff[2048], *s;
-    int len, buffsize;
-    stat_record_t stat_record = channel->stat_record;
+    char buff[2048];
+    stat_record_t *stat_record = &channel->stat_record;
+
+    if (influxBatch == NULL) {
+        influxBatch = malloc(INFLUXBATCHSIZE);
+        if (!influxBatch) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return;
+        }
+        influxBatchLen = 0;
+    }
 
     char *groupname = strcmp(channel->group, ".") == 0 ? "ROOT" : channel->group;
 
-    buffsize = sizeof(buff);
-    s = buff;
-    len = snprintf(s, buffsize, "%s,channel=%s,profilegroup=%s,profile=%s ", influxdb_measurement, channel->channel, groupname, channel->profile);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, "flows=%llu", (long long unsigned)stat_record.numflows);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",flows_tcp=%llu", (long long unsigned)stat_record.numflows_tcp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",flows_udp=%llu", (long long unsigned)stat_record.numflows_udp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",flows_icmp=%llu", (long long unsigned)stat_record.numflows_icmp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",flows_other=%llu", (long long unsigned)stat_record.numflows_other);
-    buffsize -= len;
-    s += len;
-
-    len = snprintf(s, buffsize, ",packets=%llu", (long long unsigned)stat_record.numpackets);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",packets_tcp=%llu", (long long unsigned)stat_record.numpackets_tcp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",packets_udp=%llu", (long long unsigned)stat_record.numpackets_udp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",packets_icmp=%llu", (long long unsigned)stat_record.numpackets_icmp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",packets_other=%llu", (long long unsigned)stat_record.numpackets_other);
-    buffsize -= len;
-    s += len;
-
-    len = snprintf(s, buffsize, ",traffic=%llu", (long long unsigned)stat_record.numbytes);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",traffic_tcp=%llu", (long long unsigned)stat_record.numbytes_tcp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",traffic_udp=%llu", (long long unsigned)stat_record.numbytes_udp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",traffic_icmp=%llu", (long long unsigned)stat_record.numbytes_icmp);
-    buffsize -= len;
-    s += len;
-    len = snprintf(s, buffsize, ",traffic_other=%llu", (long long unsigned)stat_record.numbytes_other);
-    buffsize -= len;
-    s += len;
+    // DATA: test,host=server01,region=us-west valueA=0.64,valueB=0.64 1434055562000000000'
     // timestamp in nanoseconds
-    len = snprintf(s, buffsize, " %llu000000000", (long long unsigned)tslot);
-    buffsize -= len;
-    s += len;
+    int len = snprintf(buff, sizeof(buff),
+                       "%s,channel=%s,profilegroup=%s,profile=%s "
+                       "flows=%llu,flows_tcp=%llu,flows_udp=%llu,flows_icmp=%llu,flows_other=%llu,"
+                       "packets=%llu,packets_tcp=%llu,packets_udp=%llu,packets_icmp=%llu,packets_other=%llu,"
+                       "traffic=%llu,traffic_tcp=%llu,traffic_udp=%llu,traffic_icmp=%llu,traffic_other=%llu %llu000000000\n",
+                       influxdb_measurement, channel->channel, groupname, channel->profile, (long long unsigned)stat_record->numflows,
+                       (long long unsigned)stat_record->numflows_tcp, (long long unsigned)stat_record->numflows_udp,
+                       (long long unsigned)stat_record->numflows_icmp, (long long unsigned)stat_record->numflows_other,
+                       (long long unsigned)stat_record->numpackets, (long long unsigned)stat_record->numpackets_tcp,
+                       (long long unsigned)stat_record->numpackets_udp, (long long unsigned)stat_record->numpackets_icmp,
+                       (long long unsigned)stat_record->numpackets_other, (long long unsigned)stat_record->numbytes,
+                       (long long unsigned)stat_record->numbytes_tcp, (long long unsigned)stat_record->numbytes_udp,
+                       (long long unsigned)stat_record->numbytes_icmp, (long long unsigned)stat_record->numbytes_other,
+                       (long long unsigned)tslot);
+    if (len < 0 || len >= (int)sizeof(buff)) {
+        LogError("INFLUXDB: record of channel %s too long", channel->channel);
+        return;
+    }
 
-    influxdb_client_post(buff);
+    if ((influxBatchLen + len) > INFLUXBATCHSIZE) {
+        influxdb_client_post(influxBatch, influxBatchLen);
+        influxBatchLen = 0;
+    }
+    memcpy(influxBatch + influxBatchLen, buff, len);
+    influxBatchLen += len;
 
-    // DATA: test,host=server01,region=us-west valueA=0.64,valueB=0.64 1434055562000000000'
 }  // End of UpdateInfluxDB
 
 #endif /* HAVE_INFLUXDB */
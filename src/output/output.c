@@ -40,15 +40,20 @@
 
 #include "conf/nfconf.h"
 #include "nfdump.h"
+#include "output_arrow.h"
 #include "output_csv.h"
 #include "output_fmt.h"
 #include "output_json.h"
 #include "output_ndjson.h"
 #include "output_raw.h"
+#include "taskpool.h"
 #include "util.h"
 
 // compare at most 16 chars
 #define MAXMODELEN 16
+
+// number of lines rendered by one task of RenderLines()
+#define RENDERCHUNK 4096
 #define MAXFORMATS 64
 
 #define FORMAT_line "%ts %td %pr %sap -> %dap %pkt %byt %fl"
@@ -107,6 +112,8 @@ static struct printmap_s {
                           {"ndjson", MODE_NDJSON, NULL, "ndjson output formart"},
                           {"csv", MODE_CSV, FORMAT_CSV, "csv predefined"},
                           {"csv-fast", MODE_CSV_FAST, NULL, "csv fast predefined"},
+                          {"arrow", MODE_ARROW, NULL, "Apache Arrow IPC stream"},
+                          {"kv", MODE_KV, NULL, "Raw format - key=value, one line per record"},
                           {"null", MODE_NULL, NULL, "do not print any output"},
 
                           // This is always the last line
@@ -114,19 +121,26 @@ static struct printmap_s {
 
 // table with appropriate printer function for given format
 static struct printerFunc_s {
-    RecordPrinter_t func_record;  // prints the record
-    PrologPrinter_t func_prolog;  // prints the output prolog
-    PrologPrinter_t func_epilog;  // prints the output epilog
-} printFuncMap[] = {[MODE_NULL] = {null_record, null_prolog, null_epilog},
-                    [MODE_FMT] = {fmt_record, fmt_prolog, fmt_epilog},
-                    [MODE_RAW] = {raw_record, raw_prolog, raw_epilog},
-                    [MODE_CSV] = {csv_record, csv_prolog, csv_epilog},
-                    [MODE_CSV_FAST] = {csv_record_fast, csv_prolog_fast, csv_epilog_fast},
-                    [MODE_JSON] = {flow_record_to_json, json_prolog, json_epilog},
-                    [MODE_NDJSON] = {flow_record_to_ndjson, ndjson_prolog, ndjson_epilog}};
-
-static PrologPrinter_t print_prolog;  // prints the output prolog
-static PrologPrinter_t print_epilog;  // prints the output epilog
+    RecordPrinter_t func_record;   // prints the record
+    PrologPrinter_t func_prolog;   // prints the output prolog
+    PrologPrinter_t func_epilog;   // prints the output epilog
+    RecordCounter_t func_counter;  // sets the record counter of the calling thread
+    bool parallel;                 // records may be rendered by multiple threads
+} printFuncMap[] = {[MODE_NULL] = {null_record, null_prolog, null_epilog, NULL, false},
+                    [MODE_FMT] = {fmt_record, fmt_prolog, fmt_epilog, NULL, false},
+                    [MODE_RAW] = {raw_record, raw_prolog, raw_epilog, NULL, false},
+                    [MODE_CSV] = {csv_record, csv_prolog, csv_epilog, NULL, true},
+                    [MODE_CSV_FAST] = {csv_record_fast, csv_prolog_fast, csv_epilog_fast, csv_count_fast, true},
+                    [MODE_JSON] = {flow_record_to_json, json_prolog, json_epilog, json_count, true},
+                    [MODE_NDJSON] = {flow_record_to_ndjson, ndjson_prolog, ndjson_epilog, ndjson_count, true},
+                    [MODE_ARROW] = {arrow_record, arrow_prolog, arrow_epilog, NULL, false},
+                    [MODE_KV] = {kv_record, kv_prolog, kv_epilog, NULL, false}};
+
+static PrologPrinter_t print_prolog;     // prints the output prolog
+static PrologPrinter_t print_epilog;     // prints the output epilog
+static RecordCounter_t print_counter;    // sets the record counter
+static bool print_parallel;              // records may be rendered by multiple threads
+static RecordPrefetch_t print_prefetch;  // requests data of a record ahead of printing
 
 static void UpdateFormatList(void);
 
@@ -234,6 +248,19 @@ RecordPrinter_t SetupOutputMode(char *print_format, outputParams_t *outputParams
 
     if (print_format == NULL) print_format = outputParams->hasGeoDB ? DefaultGeoMode : DefaultMode;
 
+    // 'ndjson:<socket>' - ndjson output to a UNIX socket
+    if (strncasecmp(print_format, "ndjson:", 7) == 0) {
+        SetNDJSONSocket(strdup(&print_format[7]));
+        print_format[6] = '\0';
+    }
+
+    // 'raw:<extensions>' or 'kv:<extensions>' - print selected extensions only
+    if (strncasecmp(print_format, "raw:", 4) == 0 || strncasecmp(print_format, "kv:", 3) == 0) {
+        char *sep = strchr(print_format, ':');
+        if (!RawSelectExtensions(sep + 1)) exit(EXIT_FAILURE);
+        *sep = '\0';
+    }
+
     int fmtFormat = strncasecmp(print_format, "fmt:", 4) == 0;
     int csvFormat = strncasecmp(print_format, "csv:", 4) == 0;
     char *format = NULL;
@@ -277,6 +304,8 @@ RecordPrinter_t SetupOutputMode(char *print_format, outputParams_t *outputParams
                     print_record = printFuncMap[outputParams->mode].func_record;
                     print_prolog = printFuncMap[outputParams->mode].func_prolog;
                     print_epilog = printFuncMap[outputParams->mode].func_epilog;
+                    print_counter = printFuncMap[outputParams->mode].func_counter;
+                    print_parallel = printFuncMap[outputParams->mode].parallel;
                 }
 
                 break;
@@ -293,6 +322,7 @@ RecordPrinter_t SetupOutputMode(char *print_format, outputParams_t *outputParams
         print_record = fmt_record;
         print_prolog = fmt_prolog;
         print_epilog = fmt_epilog;
+        if (FMTPrefetch()) print_prefetch = fmt_prefetch;
         outputParams->mode = MODE_FMT;
     }
 
@@ -301,6 +331,7 @@ RecordPrinter_t SetupOutputMode(char *print_format, outputParams_t *outputParams
         print_record = csv_record;
         print_prolog = csv_prolog;
         print_epilog = csv_epilog;
+        print_parallel = CSVParallelFormat();
         outputParams->mode = MODE_CSV;
     }
 
@@ -316,6 +347,82 @@ void PrintEpilog(outputParams_t *outputParams) {
     print_epilog(outputParams);
 }  // End of PrintEpilog
 
+bool ParallelPrinter(void) {
+    return print_parallel;
+}  // End of ParallelPrinter
+
+RecordPrefetch_t OutputPrefetcher(void) {
+    return print_prefetch;
+}  // End of OutputPrefetcher
+
+void SetPrintCounter(uint32_t count) {
+    if (print_counter) print_counter(count);
+}  // End of SetPrintCounter
+
+typedef struct renderChunk_s {
+    LineRenderer_t render;
+    void *arg;
+    uint64_t start;
+    uint64_t end;
+    char *text;
+    size_t textLen;
+} renderChunk_t;
+
+static void renderTask(void *arg) {
+    renderChunk_t *chunk = (renderChunk_t *)arg;
+    FILE *stream = open_memstream(&chunk->text, &chunk->textLen);
+    if (stream == NULL) {
+        LogError("open_memstream() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    chunk->render(stream, chunk->arg, chunk->start, chunk->end);
+    fclose(stream);
+
+}  // End of renderTask
+
+// render lines 0 .. numLines-1 to stdout. Chunks of lines are rendered in parallel
+// by the task pool into memory and written in order. At most 2 chunks per worker
+// are held in memory. render must be thread safe
+void RenderLines(uint64_t numLines, LineRenderer_t render, void *arg) {
+    uint32_t numWorkers = TaskPoolWorkers();
+    if (numWorkers < 2 || numLines < 2 * RENDERCHUNK) {
+        render(stdout, arg, 0, numLines);
+        return;
+    }
+
+    uint32_t window = 2 * numWorkers;
+    renderChunk_t *chunk = calloc(window, sizeof(renderChunk_t));
+    if (!chunk) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        render(stdout, arg, 0, numLines);
+        return;
+    }
+
+    uint64_t next = 0;
+    while (next < numLines) {
+        taskGroup_t group = TASKGROUP_INITIALIZER;
+        uint32_t numChunks = 0;
+        for (; numChunks < window && next < numLines; numChunks++) {
+            chunk[numChunks].render = render;
+            chunk[numChunks].arg = arg;
+            chunk[numChunks].start = next;
+            next += RENDERCHUNK;
+            if (next > numLines) next = numLines;
+            chunk[numChunks].end = next;
+            TaskSubmit(&group, renderTask, &chunk[numChunks]);
+        }
+        TaskWait(&group);
+
+        for (uint32_t i = 0; i < numChunks; i++) {
+            if (chunk[i].textLen) fwrite(chunk[i].text, 1, chunk[i].textLen, stdout);
+            free(chunk[i].text);
+            chunk[i].text = NULL;
+        }
+    }
+    free(chunk);
+
+}  // End of RenderLines
+
 void PrintOutputHelp(void) {
     printf("Available output formats:\n");
 
@@ -42,7 +42,9 @@ typedef enum { MODE_NULL = 0,
                MODE_CSV,
                MODE_CSV_FAST,
                MODE_JSON,
-               MODE_NDJSON } outputMode_t;
+               MODE_NDJSON,
+               MODE_ARROW,
+               MODE_KV } outputMode_t;
 
 typedef struct outputParams_s {
     bool printPlain;
@@ -53,11 +55,15 @@ typedef struct outputParams_s {
     outputMode_t mode;
     int topN;
     void *postFilter;
+    double sampleScale;  // scale of the counters of a sampled query, 0: not sampled
 } outputParams_t;
 
 typedef void (*RecordPrinter_t)(FILE *, recordHandle_t *, int);
 typedef void (*PrologPrinter_t)(outputParams_t *);
 typedef void (*EpilogPrinter_t)(outputParams_t *);
+typedef void (*RecordCounter_t)(uint32_t);
+typedef void (*RecordPrefetch_t)(recordHandle_t *);
+typedef void (*LineRenderer_t)(FILE *, void *, uint64_t, uint64_t);
 
 RecordPrinter_t SetupOutputMode(char *print_format, outputParams_t *outputParams);
 
@@ -65,6 +71,14 @@ void PrintProlog(outputParams_t *outputParams);
 
 void PrintEpilog(outputParams_t *outputParams);
 
+bool ParallelPrinter(void);
+
+RecordPrefetch_t OutputPrefetcher(void);
+
+void SetPrintCounter(uint32_t count);
+
+void RenderLines(uint64_t numLines, LineRenderer_t render, void *arg);
+
 void PrintOutputHelp(void);
 
 #endif
\ No newline at end of file
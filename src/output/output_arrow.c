@@ -0,0 +1,608 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Apache Arrow IPC stream output.
+ *
+ * The records are collected column wise and written as record batches of
+ * ARROWBATCHSIZE rows. The stream starts with the schema message and ends
+ * with the end-of-stream marker. The low cardinality columns proto, tcpFlags
+ * and exporterID are dictionary encoded. New dictionary values are sent as
+ * delta dictionary batches ahead of the record batch, which uses them.
+ *
+ * The flatbuffer metadata is built by a small builder, so no arrow or
+ * flatbuffer library is required. The stream can be read by any arrow
+ * implementation, e.g. pyarrow.ipc.open_stream().
+ */
+
+#include "output_arrow.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "nfdump.h"
+#include "nfxV3.h"
+#include "util.h"
+
+#include "itoa.c"
+#include "textfmt.c"
+
+// number of rows of a record batch
+#define ARROWBATCHSIZE 65536
+
+// max length of an IP address string incl. '\0'
+#define IP_STRING_LEN 46
+
+// the schema is the largest metadata message
+#define FBBUFFSIZE 16384
+#define MAXSLOTS 8
+
+// arrow flatbuffer enums - see arrow format/Schema.fbs and Message.fbs
+#define ARROW_V5 4
+#define ARROW_LITTLE 0
+#define ARROW_BIG 1
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_TIMESTAMP 10
+#define ARROW_MILLISECOND 1
+#define ARROW_MSG_SCHEMA 1
+#define ARROW_MSG_DICTIONARY 2
+#define ARROW_MSG_RECORDBATCH 3
+
+// flatbuffer builder. Flatbuffers are built back to front
+typedef struct fbBuilder_s {
+    uint32_t head;      // first used byte in buff
+    uint32_t minAlign;  // largest alignment used
+    uint32_t numSlots;
+    uint32_t objectStart;
+    uint32_t slot[MAXSLOTS];  // offsets of the fields of the current table
+    uint8_t buff[FBBUFFSIZE];
+} fbBuilder_t;
+
+#define fbUsed(b) (FBBUFFSIZE - (b)->head)
+
+typedef struct dictionary_s {
+    uint32_t width;       // width of the values
+    uint32_t numValues;   // number of values in dictionary
+    uint32_t sentValues;  // number of values already sent
+    int32_t *index;       // index of value, -1 if value not yet in dictionary
+    void *values;         // dictionary values
+} dictionary_t;
+
+typedef struct arrowColumn_s {
+    char *name;
+    uint32_t type;       // arrow type
+    uint32_t width;      // width of fixed size values
+    uint32_t dictWidth;  // width of the dictionary index, 0 if not dictionary encoded
+    void *values;        // values or dictionary indices
+    uint32_t *offsets;   // utf8 string offsets
+    char *data;          // utf8 string data
+    dictionary_t *dict;
+} arrowColumn_t;
+
+enum {
+    COLfirst = 0,
+    COLlast,
+    COLproto,
+    COLsrcAddr,
+    COLsrcPort,
+    COLdstAddr,
+    COLdstPort,
+    COLtcpFlags,
+    COLsrcTos,
+    COLpackets,
+    COLbytes,
+    COLsrcAS,
+    COLdstAS,
+    COLinput,
+    COLoutput,
+    COLexporterID,
+    NUMCOLUMNS
+};
+
+static arrowColumn_t columns[NUMCOLUMNS] = {
+    [COLfirst] = {"firstSeen", ARROW_TYPE_TIMESTAMP, 8, 0},   [COLlast] = {"lastSeen", ARROW_TYPE_TIMESTAMP, 8, 0},
+    [COLproto] = {"proto", ARROW_TYPE_INT, 1, 2},             [COLsrcAddr] = {"srcAddr", ARROW_TYPE_UTF8, 0, 0},
+    [COLsrcPort] = {"srcPort", ARROW_TYPE_INT, 2, 0},         [COLdstAddr] = {"dstAddr", ARROW_TYPE_UTF8, 0, 0},
+    [COLdstPort] = {"dstPort", ARROW_TYPE_INT, 2, 0},         [COLtcpFlags] = {"tcpFlags", ARROW_TYPE_INT, 1, 2},
+    [COLsrcTos] = {"srcTos", ARROW_TYPE_INT, 1, 0},           [COLpackets] = {"packets", ARROW_TYPE_INT, 8, 0},
+    [COLbytes] = {"bytes", ARROW_TYPE_INT, 8, 0},             [COLsrcAS] = {"srcAS", ARROW_TYPE_INT, 4, 0},
+    [COLdstAS] = {"dstAS", ARROW_TYPE_INT, 4, 0},             [COLinput] = {"input", ARROW_TYPE_INT, 4, 0},
+    [COLoutput] = {"output", ARROW_TYPE_INT, 4, 0},           [COLexporterID] = {"exporterID", ARROW_TYPE_INT, 2, 4},
+};
+
+static fbBuilder_t *builder = NULL;
+static FILE *arrowStream = NULL;
+static uint32_t numRows = 0;
+
+static void fbReset(fbBuilder_t *b) {
+    b->head = FBBUFFSIZE;
+    b->minAlign = 1;
+}  // End of fbReset
+
+static void fbPad(fbBuilder_t *b, uint32_t n) {
+    while (n--) b->buff[--b->head] = 0;
+}  // End of fbPad
+
+// align, such that a value of size is aligned after additional bytes
+static void fbPrep(fbBuilder_t *b, uint32_t size, uint32_t additional) {
+    if (size > b->minAlign) b->minAlign = size;
+    fbPad(b, (~(fbUsed(b) + additional) + 1) & (size - 1));
+}  // End of fbPrep
+
+// flatbuffers are little endian
+static void fbPlace(fbBuilder_t *b, uint64_t val, uint32_t size) {
+    b->head -= size;
+    for (uint32_t i = 0; i < size; i++) {
+        b->buff[b->head + i] = val & 0xFF;
+        val >>= 8;
+    }
+}  // End of fbPlace
+
+static void fbScalar(fbBuilder_t *b, uint64_t val, uint32_t size) {
+    fbPrep(b, size, 0);
+    fbPlace(b, val, size);
+}  // End of fbScalar
+
+static void fbUOffset(fbBuilder_t *b, uint32_t ref) {
+    fbPrep(b, 4, 0);
+    fbPlace(b, fbUsed(b) - ref + 4, 4);
+}  // End of fbUOffset
+
+static uint32_t fbString(fbBuilder_t *b, const char *s) {
+    uint32_t len = strlen(s);
+    fbPrep(b, 4, len + 1);
+    fbPlace(b, 0, 1);
+    b->head -= len;
+    memcpy(b->buff + b->head, s, len);
+    fbPlace(b, len, 4);
+    return fbUsed(b);
+}  // End of fbString
+
+// vector of the arrow structs FieldNode or Buffer - 2 x int64 each
+static uint32_t fbStructVector(fbBuilder_t *b, const int64_t *pairs, uint32_t num) {
+    fbPrep(b, 4, 16 * num);
+    fbPrep(b, 8, 16 * num);
+    for (int i = num - 1; i >= 0; i--) {
+        fbPlace(b, pairs[2 * i + 1], 8);
+        fbPlace(b, pairs[2 * i], 8);
+    }
+    fbPlace(b, num, 4);
+    return fbUsed(b);
+}  // End of fbStructVector
+
+static uint32_t fbOffsetVector(fbBuilder_t *b, const uint32_t *refs, uint32_t num) {
+    fbPrep(b, 4, 4 * num);
+    for (int i = num - 1; i >= 0; i--) fbUOffset(b, refs[i]);
+    fbPlace(b, num, 4);
+    return fbUsed(b);
+}  // End of fbOffsetVector
+
+static void fbStartTable(fbBuilder_t *b, uint32_t numSlots) {
+    memset(b->slot, 0, sizeof(b->slot));
+    b->numSlots = numSlots;
+    b->objectStart = fbUsed(b);
+}  // End of fbStartTable
+
+static void fbAddScalar(fbBuilder_t *b, uint32_t slot, uint64_t val, uint32_t size) {
+    fbScalar(b, val, size);
+    b->slot[slot] = fbUsed(b);
+}  // End of fbAddScalar
+
+static void fbAddOffset(fbBuilder_t *b, uint32_t slot, uint32_t ref) {
+    fbUOffset(b, ref);
+    b->slot[slot] = fbUsed(b);
+}  // End of fbAddOffset
+
+static uint32_t fbEndTable(fbBuilder_t *b) {
+    // placeholder for the vtable offset
+    fbScalar(b, 0, 4);
+    uint32_t object = fbUsed(b);
+
+    // vtable: vtable size, object size, field offsets
+    for (int i = b->numSlots - 1; i >= 0; i--) fbPlace(b, b->slot[i] ? object - b->slot[i] : 0, 2);
+    fbPlace(b, object - b->objectStart, 2);
+    fbPlace(b, (b->numSlots + 2) * 2, 2);
+    uint32_t vtable = fbUsed(b);
+
+    uint8_t *soffset = b->buff + FBBUFFSIZE - object;
+    uint32_t val = vtable - object;
+    for (int i = 0; i < 4; i++) {
+        soffset[i] = val & 0xFF;
+        val >>= 8;
+    }
+    return object;
+}  // End of fbEndTable
+
+static void fbFinish(fbBuilder_t *b, uint32_t root) {
+    fbPrep(b, b->minAlign, 4);
+    fbUOffset(b, root);
+}  // End of fbFinish
+
+static void WriteU32(uint32_t val) {
+    uint8_t buff[4];
+    for (int i = 0; i < 4; i++) {
+        buff[i] = val & 0xFF;
+        val >>= 8;
+    }
+    fwrite(buff, 1, 4, arrowStream);
+}  // End of WriteU32
+
+static void WritePadded(const void *data, size_t len) {
+    static const uint8_t zero[8] = {0};
+    if (len) fwrite(data, 1, len, arrowStream);
+    if (len & 7) fwrite(zero, 1, 8 - (len & 7), arrowStream);
+}  // End of WritePadded
+
+// wrap header into a message and write the encapsulated message
+static void WriteMessage(uint32_t header, uint8_t headerType, int64_t bodyLength) {
+    fbStartTable(builder, 4);
+    fbAddScalar(builder, 3, bodyLength, 8);
+    fbAddOffset(builder, 2, header);
+    fbAddScalar(builder, 0, ARROW_V5, 2);
+    fbAddScalar(builder, 1, headerType, 1);
+    uint32_t message = fbEndTable(builder);
+    fbFinish(builder, message);
+
+    // continuation marker, metadata size, metadata padded to 8 bytes
+    uint32_t len = fbUsed(builder);
+    WriteU32(0xFFFFFFFF);
+    WriteU32(((len + 7) & ~7));
+    WritePadded(builder->buff + builder->head, len);
+}  // End of WriteMessage
+
+static uint32_t IntType(uint32_t bitWidth, int isSigned) {
+    fbStartTable(builder, 2);
+    fbAddScalar(builder, 0, bitWidth, 4);
+    fbAddScalar(builder, 1, isSigned, 1);
+    return fbEndTable(builder);
+}  // End of IntType
+
+static void WriteSchema(void) {
+    uint32_t fields[NUMCOLUMNS];
+
+    fbReset(builder);
+    for (int i = 0; i < NUMCOLUMNS; i++) {
+        arrowColumn_t *col = &columns[i];
+        uint32_t name = fbString(builder, col->name);
+
+        uint32_t type = 0;
+        switch (col->type) {
+            case ARROW_TYPE_INT:
+                type = IntType(col->width * 8, 0);
+                break;
+            case ARROW_TYPE_UTF8:
+                fbStartTable(builder, 0);
+                type = fbEndTable(builder);
+                break;
+            case ARROW_TYPE_TIMESTAMP: {
+                uint32_t timezone = fbString(builder, "UTC");
+                fbStartTable(builder, 2);
+                fbAddOffset(builder, 1, timezone);
+                fbAddScalar(builder, 0, ARROW_MILLISECOND, 2);
+                type = fbEndTable(builder);
+            } break;
+        }
+
+        uint32_t dictionary = 0;
+        if (col->dictWidth) {
+            uint32_t indexType = IntType(col->dictWidth * 8, 1);
+            fbStartTable(builder, 3);
+            fbAddScalar(builder, 0, i, 8);
+            fbAddOffset(builder, 1, indexType);
+            fbAddScalar(builder, 2, 0, 1);
+            dictionary = fbEndTable(builder);
+        }
+
+        uint32_t children = fbOffsetVector(builder, NULL, 0);
+
+        fbStartTable(builder, 6);
+        fbAddOffset(builder, 0, name);
+        fbAddOffset(builder, 3, type);
+        if (dictionary) fbAddOffset(builder, 4, dictionary);
+        fbAddOffset(builder, 5, children);
+        fbAddScalar(builder, 1, 0, 1);
+        fbAddScalar(builder, 2, col->type, 1);
+        fields[i] = fbEndTable(builder);
+    }
+    uint32_t fieldVector = fbOffsetVector(builder, fields, NUMCOLUMNS);
+
+    fbStartTable(builder, 2);
+    fbAddOffset(builder, 1, fieldVector);
+#ifdef WORDS_BIGENDIAN
+    fbAddScalar(builder, 0, ARROW_BIG, 2);
+#else
+    fbAddScalar(builder, 0, ARROW_LITTLE, 2);
+#endif
+    uint32_t schema = fbEndTable(builder);
+
+    WriteMessage(schema, ARROW_MSG_SCHEMA, 0);
+}  // End of WriteSchema
+
+// build a RecordBatch table. The buffers are laid out back to back in the message
+// body, each padded to 8 bytes. The buffer offsets and the body length are set
+static uint32_t RecordBatch(uint32_t length, int64_t *nodes, uint32_t numNodes, int64_t *buffers, uint32_t numBuffers, int64_t *bodyLength) {
+    int64_t offset = 0;
+    for (int i = 0; i < numBuffers; i++) {
+        int64_t len = buffers[2 * i + 1];
+        buffers[2 * i] = offset;
+        offset += (len + 7) & ~7;
+    }
+    *bodyLength = offset;
+
+    uint32_t bufferVector = fbStructVector(builder, buffers, numBuffers);
+    uint32_t nodeVector = fbStructVector(builder, nodes, numNodes);
+    fbStartTable(builder, 3);
+    fbAddScalar(builder, 0, length, 8);
+    fbAddOffset(builder, 1, nodeVector);
+    fbAddOffset(builder, 2, bufferVector);
+    return fbEndTable(builder);
+}  // End of RecordBatch
+
+static void WriteDictionary(int id, dictionary_t *dict) {
+    uint32_t num = dict->numValues - dict->sentValues;
+    uint8_t *values = (uint8_t *)dict->values + dict->sentValues * dict->width;
+
+    int64_t nodes[2] = {num, 0};
+    // validity, values
+    int64_t buffers[4] = {0, 0, 0, (int64_t)num * dict->width};
+    int64_t bodyLength;
+
+    fbReset(builder);
+    uint32_t data = RecordBatch(num, nodes, 1, buffers, 2, &bodyLength);
+    fbStartTable(builder, 3);
+    fbAddScalar(builder, 0, id, 8);
+    fbAddOffset(builder, 1, data);
+    fbAddScalar(builder, 2, dict->sentValues > 0, 1);
+    uint32_t dictBatch = fbEndTable(builder);
+
+    WriteMessage(dictBatch, ARROW_MSG_DICTIONARY, bodyLength);
+    WritePadded(values, num * dict->width);
+
+    dict->sentValues = dict->numValues;
+}  // End of WriteDictionary
+
+static void FlushBatch(void) {
+    if (numRows == 0) return;
+
+    for (int i = 0; i < NUMCOLUMNS; i++) {
+        dictionary_t *dict = columns[i].dict;
+        if (dict && dict->numValues > dict->sentValues) WriteDictionary(i, dict);
+    }
+
+    // one node per column, 2 buffers per column, 3 for utf8 columns
+    int64_t nodes[2 * NUMCOLUMNS];
+    int64_t buffers[2 * 3 * NUMCOLUMNS];
+    const void *data[3 * NUMCOLUMNS];
+    uint32_t numBuffers = 0;
+    for (int i = 0; i < NUMCOLUMNS; i++) {
+        arrowColumn_t *col = &columns[i];
+        nodes[2 * i] = numRows;
+        nodes[2 * i + 1] = 0;
+
+        // no validity buffer - no null values
+        data[numBuffers] = NULL;
+        buffers[2 * numBuffers + 1] = 0;
+        numBuffers++;
+        if (col->type == ARROW_TYPE_UTF8) {
+            data[numBuffers] = col->offsets;
+            buffers[2 * numBuffers + 1] = (int64_t)(numRows + 1) * sizeof(uint32_t);
+            numBuffers++;
+            data[numBuffers] = col->data;
+            buffers[2 * numBuffers + 1] = col->offsets[numRows];
+            numBuffers++;
+        } else {
+            data[numBuffers] = col->values;
+            buffers[2 * numBuffers + 1] = (int64_t)numRows * (col->dictWidth ? col->dictWidth : col->width);
+            numBuffers++;
+        }
+    }
+
+    int64_t bodyLength;
+    fbReset(builder);
+    uint32_t recordBatch = RecordBatch(numRows, nodes, NUMCOLUMNS, buffers, numBuffers, &bodyLength);
+    WriteMessage(recordBatch, ARROW_MSG_RECORDBATCH, bodyLength);
+    for (int i = 0; i < numBuffers; i++) WritePadded(data[i], buffers[2 * i + 1]);
+
+    numRows = 0;
+}  // End of FlushBatch
+
+static inline void PutValue(void *values, uint32_t width, uint32_t row, uint64_t val) {
+    switch (width) {
+        case 1:
+            ((uint8_t *)values)[row] = val;
+            break;
+        case 2:
+            ((uint16_t *)values)[row] = val;
+            break;
+        case 4:
+            ((uint32_t *)values)[row] = val;
+            break;
+        case 8:
+            ((uint64_t *)values)[row] = val;
+            break;
+    }
+}  // End of PutValue
+
+static inline void AddValue(int colIndex, uint64_t val) {
+    arrowColumn_t *col = &columns[colIndex];
+    dictionary_t *dict = col->dict;
+    if (dict == NULL) {
+        PutValue(col->values, col->width, numRows, val);
+        return;
+    }
+
+    int32_t index = dict->index[val];
+    if (index < 0) {
+        index = dict->numValues++;
+        dict->index[val] = index;
+        PutValue(dict->values, dict->width, index, val);
+    }
+    PutValue(col->values, col->dictWidth, numRows, index);
+}  // End of AddValue
+
+static inline void AddAddr(int colIndex, void *ipv4, void *ipv6) {
+    arrowColumn_t *col = &columns[colIndex];
+    char *start = col->data + col->offsets[numRows];
+    char *end = start;
+    if (ipv4)
+        end = ip4_ntoa(*(uint32_t *)ipv4, start);
+    else if (ipv6)
+        end = ip6_ntoa((uint64_t *)ipv6, start);
+    col->offsets[numRows + 1] = col->offsets[numRows] + (end - start);
+}  // End of AddAddr
+
+void arrow_prolog(outputParams_t *outputParam) {
+    builder = malloc(sizeof(fbBuilder_t));
+    if (!builder) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < NUMCOLUMNS; i++) {
+        arrowColumn_t *col = &columns[i];
+        int ok = 1;
+        if (col->type == ARROW_TYPE_UTF8) {
+            col->offsets = calloc(ARROWBATCHSIZE + 1, sizeof(uint32_t));
+            col->data = malloc((size_t)ARROWBATCHSIZE * IP_STRING_LEN);
+            ok = col->offsets && col->data;
+        } else {
+            col->values = malloc((size_t)ARROWBATCHSIZE * (col->dictWidth ? col->dictWidth : col->width));
+            ok = col->values != NULL;
+        }
+        if (ok && col->dictWidth) {
+            col->dict = calloc(1, sizeof(dictionary_t));
+            if (col->dict) {
+                size_t numValues = 1 << (8 * col->width);
+                col->dict->width = col->width;
+                col->dict->index = malloc(numValues * sizeof(int32_t));
+                col->dict->values = malloc(numValues * col->width);
+                ok = col->dict->index && col->dict->values;
+                if (ok) memset(col->dict->index, 0xFF, numValues * sizeof(int32_t));
+            } else {
+                ok = 0;
+            }
+        }
+        if (!ok) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    arrowStream = stdout;
+    numRows = 0;
+    WriteSchema();
+}  // End of arrow_prolog
+
+void arrow_epilog(outputParams_t *outputParam) {
+    FlushBatch();
+
+    // end of stream
+    WriteU32(0xFFFFFFFF);
+    WriteU32(0);
+    fflush(arrowStream);
+
+    for (int i = 0; i < NUMCOLUMNS; i++) {
+        arrowColumn_t *col = &columns[i];
+        free(col->values);
+        free(col->offsets);
+        free(col->data);
+        col->values = NULL;
+        col->offsets = NULL;
+        col->data = NULL;
+        if (col->dict) {
+            free(col->dict->index);
+            free(col->dict->values);
+            free(col->dict);
+            col->dict = NULL;
+        }
+    }
+    free(builder);
+    builder = NULL;
+}  // End of arrow_epilog
+
+void arrow_record(FILE *stream, recordHandle_t *recordHandle, int tag) {
+    recordHeaderV3_t *recordHeaderV3 = recordHandle->recordHeaderV3;
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
+    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
+    EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
+    EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle->extensionList[EXasRoutingID];
+
+    arrowStream = stream;
+
+    if (genericFlow) {
+        AddValue(COLfirst, genericFlow->msecFirst);
+        AddValue(COLlast, genericFlow->msecLast);
+        AddValue(COLproto, genericFlow->proto);
+        AddValue(COLsrcPort, genericFlow->srcPort);
+        AddValue(COLdstPort, genericFlow->dstPort);
+        AddValue(COLtcpFlags, genericFlow->tcpFlags);
+        AddValue(COLsrcTos, genericFlow->srcTos);
+        AddValue(COLpackets, genericFlow->inPackets);
+        AddValue(COLbytes, genericFlow->inBytes);
+    } else {
+        AddValue(COLfirst, 0);
+        AddValue(COLlast, 0);
+        AddValue(COLproto, 0);
+        AddValue(COLsrcPort, 0);
+        AddValue(COLdstPort, 0);
+        AddValue(COLtcpFlags, 0);
+        AddValue(COLsrcTos, 0);
+        AddValue(COLpackets, 0);
+        AddValue(COLbytes, 0);
+    }
+
+    if (ipv4Flow) {
+        AddAddr(COLsrcAddr, &ipv4Flow->srcAddr, NULL);
+        AddAddr(COLdstAddr, &ipv4Flow->dstAddr, NULL);
+    } else if (ipv6Flow) {
+        AddAddr(COLsrcAddr, NULL, ipv6Flow->srcAddr);
+        AddAddr(COLdstAddr, NULL, ipv6Flow->dstAddr);
+    } else {
+        AddAddr(COLsrcAddr, NULL, NULL);
+        AddAddr(COLdstAddr, NULL, NULL);
+    }
+
+    AddValue(COLsrcAS, asRouting ? asRouting->srcAS : 0);
+    AddValue(COLdstAS, asRouting ? asRouting->dstAS : 0);
+    AddValue(COLinput, flowMisc ? flowMisc->input : 0);
+    AddValue(COLoutput, flowMisc ? flowMisc->output : 0);
+    AddValue(COLexporterID, recordHeaderV3->exporterID);
+
+    numRows++;
+    if (numRows == ARROWBATCHSIZE) FlushBatch();
+
+}  // End of arrow_record
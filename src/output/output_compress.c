@@ -0,0 +1,362 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// fopencookie() needs _GNU_SOURCE on Linux
+#define _GNU_SOURCE
+
+#include "output_compress.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#else
+#include "lz4.h"
+#include "lz4hc.h"
+#endif
+
+#include "nffileV2.h"
+#include "queue.h"
+#include "util.h"
+
+#define COMPRESSION_TYPE(c) ((c) & 0xFFFF)
+#define COMPRESSION_LEVEL(c) (((c) >> 16) & 0xFFFF)
+
+// size of an output buffer - also the max block size of the lz4 frame
+#define OUTBUFFSIZE (1024 * 1024)
+#define LZ4FRAME_MAGIC 0x184D2204
+// version 01, independent blocks, 1MB max block size
+#define LZ4FRAME_FLG 0x60
+#define LZ4FRAME_BD 0x60
+
+// number of filled buffers waiting for the compression thread
+#define QUEUEDBUFFERS 4
+
+typedef struct outBuffer_s {
+    size_t length;
+    char data[OUTBUFFSIZE];
+} outBuffer_t;
+
+static struct compressStream_s {
+    int compression;
+    int level;
+    FILE *stream;         // replaces stdout
+    FILE *orgStdout;      // stdout before the replacement
+    outBuffer_t *buffer;  // buffer currently filled
+    queue_t *queue;       // filled buffers for the compression thread
+    pthread_t tid;
+    int running;          // compression thread is running
+    _Atomic int failed;
+} compressStream = {0};
+
+static inline void Put32(uint8_t *p, uint32_t val) {
+    p[0] = val & 0xFF;
+    p[1] = (val >> 8) & 0xFF;
+    p[2] = (val >> 16) & 0xFF;
+    p[3] = (val >> 24) & 0xFF;
+}  // End of Put32
+
+// xxHash32 of less than 16 bytes - used for the lz4 frame header checksum
+static uint32_t XXH32small(const uint8_t *p, size_t len, uint32_t seed) {
+    const uint32_t prime1 = 0x9E3779B1U, prime2 = 0x85EBCA77U, prime3 = 0xC2B2AE3DU;
+    const uint32_t prime4 = 0x27D4EB2FU, prime5 = 0x165667B1U;
+#define ROTL32(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+    uint32_t h32 = seed + prime5 + (uint32_t)len;
+    const uint8_t *end = p + len;
+    while ((p + 4) <= end) {
+        h32 += (uint32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)) * prime3;
+        h32 = ROTL32(h32, 17) * prime4;
+        p += 4;
+    }
+    while (p < end) {
+        h32 += (*p++) * prime5;
+        h32 = ROTL32(h32, 11) * prime1;
+    }
+    h32 ^= h32 >> 15;
+    h32 *= prime2;
+    h32 ^= h32 >> 13;
+    h32 *= prime3;
+    h32 ^= h32 >> 16;
+#undef ROTL32
+    return h32;
+}  // End of XXH32small
+
+// write all data to stdout. A write error is reported once and
+// further data is dropped
+static void WriteOut(const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len && !compressStream.failed) {
+        ssize_t ret = write(STDOUT_FILENO, p, len);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            compressStream.failed = 1;
+            return;
+        }
+        p += ret;
+        len -= ret;
+    }
+}  // End of WriteOut
+
+static void *compressThread(void *arg) {
+    int level = compressStream.level;
+    queue_t *queue = compressStream.queue;
+
+    size_t outSize = 0;
+    char *out = NULL;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *cctx = NULL;
+#endif
+
+    if (compressStream.compression == LZ4_COMPRESSED) {
+        outSize = OUTBUFFSIZE;
+        uint8_t header[7];
+        Put32(header, LZ4FRAME_MAGIC);
+        header[4] = LZ4FRAME_FLG;
+        header[5] = LZ4FRAME_BD;
+        header[6] = (XXH32small(header + 4, 2, 0) >> 8) & 0xFF;
+        WriteOut(header, sizeof(header));
+    } else {
+#ifdef HAVE_ZSTD
+        outSize = ZSTD_CStreamOutSize();
+        cctx = ZSTD_createCCtx();
+        if (cctx == NULL) {
+            LogError("ZSTD_createCCtx() error in %s line %d", __FILE__, __LINE__);
+            compressStream.failed = 1;
+        } else if (level) {
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+        }
+#endif
+    }
+    out = malloc(outSize + 4);
+    if (out == NULL) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        compressStream.failed = 1;
+    }
+
+    outBuffer_t *buffer;
+    while ((buffer = queue_pop(queue)) != QUEUE_CLOSED) {
+        if (compressStream.failed) {
+            // drain the queue
+            free(buffer);
+            continue;
+        }
+        if (compressStream.compression == LZ4_COMPRESSED) {
+            // incompressible blocks are stored uncompressed
+            int len;
+            if (level)
+                len = LZ4_compress_HC(buffer->data, out + 4, buffer->length, buffer->length - 1, level);
+            else
+                len = LZ4_compress_default(buffer->data, out + 4, buffer->length, buffer->length - 1);
+            if (len > 0) {
+                Put32((uint8_t *)out, len);
+                WriteOut(out, len + 4);
+            } else {
+                Put32((uint8_t *)out, buffer->length | 0x80000000U);
+                WriteOut(out, 4);
+                WriteOut(buffer->data, buffer->length);
+            }
+        } else {
+#ifdef HAVE_ZSTD
+            ZSTD_inBuffer input = {buffer->data, buffer->length, 0};
+            while (input.pos < input.size && !compressStream.failed) {
+                ZSTD_outBuffer output = {out, outSize, 0};
+                size_t ret = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_continue);
+                if (ZSTD_isError(ret)) {
+                    LogError("ZSTD_compressStream2() error: %s", ZSTD_getErrorName(ret));
+                    compressStream.failed = 1;
+                    break;
+                }
+                WriteOut(out, output.pos);
+            }
+#endif
+        }
+        free(buffer);
+    }
+
+    // end of frame
+    if (!compressStream.failed) {
+        if (compressStream.compression == LZ4_COMPRESSED) {
+            uint8_t endMark[4] = {0};
+            WriteOut(endMark, sizeof(endMark));
+        } else {
+#ifdef HAVE_ZSTD
+            ZSTD_inBuffer input = {NULL, 0, 0};
+            size_t remaining;
+            do {
+                ZSTD_outBuffer output = {out, outSize, 0};
+                remaining = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_end);
+                if (ZSTD_isError(remaining)) {
+                    LogError("ZSTD_compressStream2() error: %s", ZSTD_getErrorName(remaining));
+                    compressStream.failed = 1;
+                    break;
+                }
+                WriteOut(out, output.pos);
+            } while (remaining && !compressStream.failed);
+#endif
+        }
+    }
+
+#ifdef HAVE_ZSTD
+    if (cctx) ZSTD_freeCCtx(cctx);
+#endif
+    free(out);
+
+    pthread_exit(NULL);
+}  // End of compressThread
+
+// stream write function - collects the output in buffers for the compression thread
+static ssize_t streamWrite(void *cookie, const char *buf, size_t size) {
+    size_t left = size;
+    while (left) {
+        if (compressStream.buffer == NULL) {
+            compressStream.buffer = malloc(sizeof(outBuffer_t));
+            if (compressStream.buffer == NULL) {
+                LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                return -1;
+            }
+            compressStream.buffer->length = 0;
+        }
+        outBuffer_t *buffer = compressStream.buffer;
+        size_t len = OUTBUFFSIZE - buffer->length;
+        if (len > left) len = left;
+        memcpy(buffer->data + buffer->length, buf, len);
+        buffer->length += len;
+        buf += len;
+        left -= len;
+        if (buffer->length == OUTBUFFSIZE) {
+            queue_push(compressStream.queue, buffer);
+            compressStream.buffer = NULL;
+        }
+    }
+    return size;
+}  // End of streamWrite
+
+// stream close function - hand over the last buffer and end the compression thread
+static int streamClose(void *cookie) {
+    if (compressStream.buffer) {
+        if (compressStream.buffer->length)
+            queue_push(compressStream.queue, compressStream.buffer);
+        else
+            free(compressStream.buffer);
+        compressStream.buffer = NULL;
+    }
+    queue_close(compressStream.queue);
+    if (compressStream.running) pthread_join(compressStream.tid, NULL);
+    compressStream.running = 0;
+    return compressStream.failed ? EOF : 0;
+}  // End of streamClose
+
+#if !defined(HAVE_FOPENCOOKIE) && defined(HAVE_FUNOPEN)
+static int funopenWrite(void *cookie, const char *buf, int size) {
+    return (int)streamWrite(cookie, buf, size);
+}  // End of funopenWrite
+#endif
+
+// replace stdout by a stream, which is compressed by a dedicated thread
+int OpenCompressedOutput(int compress) {
+    int compression = COMPRESSION_TYPE(compress);
+    if (compression != LZ4_COMPRESSED && compression != ZSTD_COMPRESSED) {
+        LogError("Compressed output supports lz4 or zstd only");
+        return 0;
+    }
+#ifndef HAVE_ZSTD
+    if (compression == ZSTD_COMPRESSED) {
+        LogError("ZSTD compression not compiled in");
+        return 0;
+    }
+#endif
+    if (isatty(STDOUT_FILENO)) {
+        LogError("Refuse to write compressed output to a terminal");
+        return 0;
+    }
+
+    compressStream.compression = compression;
+    compressStream.level = COMPRESSION_LEVEL(compress);
+    compressStream.queue = queue_init(QUEUEDBUFFERS);
+    if (compressStream.queue == NULL) return 0;
+
+#if defined(HAVE_FOPENCOOKIE)
+    cookie_io_functions_t functions = {.read = NULL, .write = streamWrite, .seek = NULL, .close = streamClose};
+    FILE *stream = fopencookie(&compressStream, "w", functions);
+#elif defined(HAVE_FUNOPEN)
+    FILE *stream = funopen(&compressStream, NULL, funopenWrite, NULL, streamClose);
+#else
+    FILE *stream = NULL;
+    LogError("Compressed output not supported on this platform");
+    return 0;
+#endif
+    if (stream == NULL) {
+        LogError("Failed to open output stream: %s", strerror(errno));
+        return 0;
+    }
+
+    if (pthread_create(&compressStream.tid, NULL, compressThread, NULL)) {
+        LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        fclose(stream);
+        return 0;
+    }
+    compressStream.running = 1;
+
+    fflush(stdout);
+    compressStream.orgStdout = stdout;
+    compressStream.stream = stream;
+    stdout = stream;
+    atexit(CloseCompressedOutput);
+
+    return 1;
+}  // End of OpenCompressedOutput
+
+// flush and close the compressed stream - called at exit at the latest
+void CloseCompressedOutput(void) {
+    if (compressStream.stream == NULL) return;
+
+    FILE *stream = compressStream.stream;
+    compressStream.stream = NULL;
+    stdout = compressStream.orgStdout;
+    fclose(stream);
+    queue_free(compressStream.queue);
+    compressStream.queue = NULL;
+}  // End of CloseCompressedOutput
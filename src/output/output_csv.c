@@ -49,6 +49,7 @@
 #include "ifvrf.h"
 #include "ja3/ja3.h"
 #include "ja4/ja4.h"
+#include "label/label.h"
 #include "maxmind/maxmind.h"
 #include "nbar.h"
 #include "nfdump.h"
@@ -63,6 +64,7 @@
 typedef char *(*string_function_t)(char *, recordHandle_t *);
 
 #include "itoa.c"
+#include "textfmt.c"
 
 #define AddString(s)               \
     do {                           \
@@ -87,7 +89,8 @@ typedef char *(*string_function_t)(char *, recordHandle_t *);
 #define STREAMLEN(ptr)                                \
     ((ptrdiff_t)STREAMBUFFSIZE - (ptr - streamBuff)); \
     assert((ptr - streamBuff) < STREAMBUFFSIZE)
-static char *streamBuff = NULL;
+// per thread buffer - records may be rendered by multiple threads
+static _Thread_local char streamBuff[STREAMBUFFSIZE];
 
 static struct token_list_s {
     string_function_t string_function;  // function printing result to stream
@@ -100,7 +103,10 @@ static int token_index = 0;
 
 static int max_format_index = 0;
 
-static double duration = 0;
+static _Thread_local double duration = 0;
+
+// set, if the format prints names of nbar, interface or vrf records of the data stream
+static int streamNames = 0;
 
 #define IP_STRING_LEN (INET6_ADDRSTRLEN)
 
@@ -110,10 +116,6 @@ static char header_string[STRINGSIZE] = {'\0'};
 /* prototypes */
 static char *ICMP_Port_decode(EXgenericFlow_t *genericFlow);
 
-static inline uint32_t ApplyV4NetMaskBits(uint32_t ip, uint32_t maskBits);
-
-static inline uint64_t *ApplyV6NetMaskBits(uint64_t *ip, uint32_t maskBits);
-
 static void InitFormatParser(void);
 
 static void AddToken(int index);
@@ -286,6 +288,10 @@ static char *String_SrcTor(char *streamPtr, recordHandle_t *recordHandle);
 
 static char *String_DstTor(char *streamPtr, recordHandle_t *recordHandle);
 
+static char *String_SrcLabel(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_DstLabel(char *streamPtr, recordHandle_t *recordHandle);
+
 static char *String_nbarID(char *streamPtr, recordHandle_t *recordHandle);
 
 static char *String_nbarName(char *streamPtr, recordHandle_t *recordHandle);
@@ -559,6 +565,8 @@ static struct format_entry_s {
     {"%dasn", 0, "dstOrg", String_DstASorganisation},  // dst IP AS organisation string
     {"%stor", 0, "srcTor", String_SrcTor},             // src IP 2 letter tor node info
     {"%dtor", 0, "dstTor", String_DstTor},             // dst IP 2 letter tor node info
+    {"%slb", 0, "srcLabel", String_SrcLabel},          // src IP prefix label
+    {"%dlb", 0, "dstLabel", String_DstLabel},          // dst IP prefix label
     {"%lbl", 0, "label", String_Label},                // Flow Label
 
     // EXipInfo
@@ -650,20 +658,12 @@ void csv_record(FILE *stream, recordHandle_t *recordHandle, int tag) {
 }  // End of csv_record
 
 void csv_prolog(outputParams_t *outputParam) {
-    streamBuff = malloc(STREAMBUFFSIZE);
-    if (!streamBuff) {
-        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-    streamBuff[0] = '\0';
-
     // header
     printf("%s\n", header_string);
 }  // End of csv_prolog
 
 void csv_epilog(outputParams_t *outputParam) {
-    free(streamBuff);
-    streamBuff = NULL;
+    // empty epilog
 }  // End of csv_epilog
 
 static void InitFormatParser(void) {
@@ -676,27 +676,6 @@ static void InitFormatParser(void) {
 
 }  // End of InitFormatParser
 
-static inline uint32_t ApplyV4NetMaskBits(uint32_t ip, uint32_t maskBits) {
-    uint32_t srcMask = 0xffffffff << (32 - maskBits);
-    return (ip &= srcMask);
-}  // End of ApplyV4NetMaskBits
-
-static inline uint64_t *ApplyV6NetMaskBits(uint64_t *ip, uint32_t maskBits) {
-    static uint64_t net[2];
-    uint64_t mask;
-    if (maskBits > 64) {
-        mask = 0xffffffffffffffffLL << (128 - maskBits);
-        net[0] = ip[0];
-        net[1] = ip[1] & mask;
-    } else {
-        mask = 0xffffffffffffffffLL << (64 - maskBits);
-        net[0] = ip[0] & mask;
-        net[1] = 0;
-    }
-    return net;
-
-}  // End of ApplyV6NetMaskBits
-
 static void AddToken(int index) {
     if (token_index >= max_token_index) {  // no slot available - expand table
         max_token_index += BLOCK_SIZE;
@@ -707,11 +686,21 @@ static void AddToken(int index) {
         }
     }
 
-    token_list[token_index].string_function = formatTable[index].string_function;
+    string_function_t string_function = formatTable[index].string_function;
+    if (string_function == String_InputName || string_function == String_OutputName || string_function == String_nbarName ||
+        string_function == String_ivrfName || string_function == String_evrfName)
+        streamNames = 1;
+
+    token_list[token_index].string_function = string_function;
     token_index++;
 
 }  // End of AddToken
 
+int CSVParallelFormat(void) {
+    // names are resolved from records earlier in the data stream
+    return streamNames == 0;
+}  // End of CSVParallelFormat
+
 int ParseCSVOutputFormat(char *format) {
     char *s = strdup(format);
     if (!s) {
@@ -783,7 +772,7 @@ int ParseCSVOutputFormat(char *format) {
 
 static char *ICMP_Port_decode(EXgenericFlow_t *genericFlow) {
 #define ICMPSTRLEN 16
-    static char icmpString[ICMPSTRLEN];
+    static _Thread_local char icmpString[ICMPSTRLEN];
     icmpString[0] = '\0';
 
     if (genericFlow == NULL) return "0";
@@ -842,15 +831,7 @@ static char *String_FirstSeen(char *streamPtr, recordHandle_t *recordHandle) {
     uint64_t msecFirst = genericFlow ? genericFlow->msecFirst : 0;
 
     if (msecFirst) {
-        time_t tt = msecFirst / 1000LL;
-        struct tm ts;
-        localtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        ptrdiff_t lenStream = STREAMLEN(streamPtr);
-        size_t len = snprintf(streamPtr, lenStream, "%s.%03u", s, (unsigned)(msecFirst % 1000LL));
-        streamPtr += len;
+        streamPtr = msec_ntoa(msecFirst, 0, ' ', streamPtr);
     } else {
         AddString("0000-00-00 00:00:00.000");
     }
@@ -864,15 +845,7 @@ static char *String_LastSeen(char *streamPtr, recordHandle_t *recordHandle) {
     uint64_t msecLast = genericFlow ? genericFlow->msecLast : 0;
 
     if (msecLast) {
-        time_t tt = msecLast / 1000LL;
-        struct tm ts;
-        localtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        ptrdiff_t lenStream = STREAMLEN(streamPtr);
-        size_t len = snprintf(streamPtr, lenStream, "%s.%03u", s, (unsigned)(msecLast % 1000LL));
-        streamPtr += len;
+        streamPtr = msec_ntoa(msecLast, 0, ' ', streamPtr);
     } else {
         AddString("0000-00-00 00:00:00.000");
     }
@@ -886,15 +859,7 @@ static char *String_Received(char *streamPtr, recordHandle_t *recordHandle) {
     uint64_t msecReceived = genericFlow ? genericFlow->msecReceived : 0;
 
     if (msecReceived) {
-        time_t tt = msecReceived / 1000LL;
-        struct tm ts;
-        localtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        ptrdiff_t lenStream = STREAMLEN(streamPtr);
-        size_t len = snprintf(streamPtr, lenStream, "%s.%03llu", s, msecReceived % 1000LL);
-        streamPtr += len;
+        streamPtr = msec_ntoa(msecReceived, 0, ' ', streamPtr);
     } else {
         AddString("0000-00-00 00:00:00.000");
     }
@@ -941,15 +906,7 @@ static char *String_FirstSeenGMT(char *streamPtr, recordHandle_t *recordHandle)
     uint64_t msecFirst = genericFlow ? genericFlow->msecFirst : 0;
 
     if (msecFirst) {
-        time_t tt = msecFirst / 1000LL;
-        struct tm ts;
-        gmtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        ptrdiff_t lenStream = STREAMLEN(streamPtr);
-        size_t len = snprintf(streamPtr, lenStream, "%s.%03u", s, (unsigned)(msecFirst % 1000LL));
-        streamPtr += len;
+        streamPtr = msec_ntoa(msecFirst, 1, ' ', streamPtr);
     } else {
         AddString("0000-00-00 00:00:00.000");
     }
@@ -963,15 +920,7 @@ static char *String_LastSeenGMT(char *streamPtr, recordHandle_t *recordHandle) {
     uint64_t msecLast = genericFlow ? genericFlow->msecLast : 0;
 
     if (msecLast) {
-        time_t tt = msecLast / 1000LL;
-        struct tm ts;
-        gmtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        ptrdiff_t lenStream = STREAMLEN(streamPtr);
-        size_t len = snprintf(streamPtr, lenStream, "%s.%03u", s, (unsigned)(msecLast % 1000LL));
-        streamPtr += len;
+        streamPtr = msec_ntoa(msecLast, 1, ' ', streamPtr);
     } else {
         AddString("0000-00-00 00:00:00.000");
     }
@@ -985,15 +934,7 @@ static char *String_ReceivedGMT(char *streamPtr, recordHandle_t *recordHandle) {
     uint64_t msecReceived = genericFlow ? genericFlow->msecReceived : 0;
 
     if (msecReceived) {
-        time_t tt = msecReceived / 1000LL;
-        struct tm ts;
-        gmtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        ptrdiff_t lenStream = STREAMLEN(streamPtr);
-        size_t len = snprintf(streamPtr, lenStream, "%s.%03llu", s, msecReceived % 1000LL);
-        streamPtr += len;
+        streamPtr = msec_ntoa(msecReceived, 1, ' ', streamPtr);
     } else {
         AddString("0000-00-00 00:00:00.000");
     }
@@ -1074,20 +1015,11 @@ static char *String_ja3(char *streamPtr, recordHandle_t *recordHandle) {
         return streamPtr;
     }
 
-    char *ja3 = recordHandle->extensionList[JA3index];
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
-    if (ja3 == NULL) {
-        if (ssl == NULL) {
-            uint32_t payloadLength = ExtensionLength(payload);
-            ssl = sslProcess(payload, payloadLength);
-            recordHandle->extensionList[SSLindex] = ssl;
-        }
-        ja3 = ja3Process(ssl, NULL);
-        recordHandle->extensionList[JA3index] = ja3;
-        if (ssl == NULL || ja3 == NULL) {
-            AddString("no-ja3");
-            return streamPtr;
-        }
+    char *ja3 = GetRecordJA3(recordHandle);
+    ssl_t *ssl = GetRecordSSL(recordHandle);
+    if (ssl == NULL || ja3 == NULL) {
+        AddString("no-ja3");
+        return streamPtr;
     }
 
     if (ssl->type == CLIENTssl)
@@ -1106,20 +1038,10 @@ static char *String_ja4(char *streamPtr, recordHandle_t *recordHandle) {
         return streamPtr;
     }
 
-    ja4_t *ja4 = recordHandle->extensionList[JA4index];
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
+    ja4_t *ja4 = GetRecordJA4(recordHandle);
     if (ja4 == NULL) {
-        if (ssl == NULL) {
-            uint32_t payloadLength = ExtensionLength(payload);
-            ssl = sslProcess(payload, payloadLength);
-            recordHandle->extensionList[SSLindex] = ssl;
-        }
-        ja4 = ja4Process(ssl, genericFlow->proto);
-        recordHandle->extensionList[JA4index] = ja4;
-        if (ssl == NULL || ja4 == NULL) {
-            AddString("no-ja4");
-            return streamPtr;
-        }
+        AddString("no-ja4");
+        return streamPtr;
     }
 
     // ja4 is defined
@@ -1141,15 +1063,10 @@ static char *String_tlsVersion(char *streamPtr, recordHandle_t *recordHandle) {
         return streamPtr;
     }
 
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
+    ssl_t *ssl = GetRecordSSL(recordHandle);
     if (ssl == NULL) {
-        uint32_t payloadLength = ExtensionLength(payload);
-        ssl = sslProcess(payload, payloadLength);
-        recordHandle->extensionList[SSLindex] = ssl;
-        if (ssl == NULL) {
-            AddChar('0');
-            return streamPtr;
-        }
+        AddChar('0');
+        return streamPtr;
     }
 
     /*
@@ -1194,15 +1111,10 @@ static char *String_sniName(char *streamPtr, recordHandle_t *recordHandle) {
         return streamPtr;
     }
 
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
+    ssl_t *ssl = GetRecordSSL(recordHandle);
     if (ssl == NULL) {
-        uint32_t payloadLength = ExtensionLength(payload);
-        ssl = sslProcess(payload, payloadLength);
-        recordHandle->extensionList[SSLindex] = ssl;
-        if (ssl == NULL) {
-            AddChar('0');
-            return streamPtr;
-        }
+        AddChar('0');
+        return streamPtr;
     }
 
     // ssl is defined
@@ -1248,14 +1160,7 @@ static char *String_EventTime(char *streamPtr, recordHandle_t *recordHandle) {
         msecEvent = natCommon->msecEvent;
 
     if (msecEvent) {
-        time_t tt = msecEvent / 1000LL;
-        struct tm *ts = localtime(&tt);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", ts);
-        s[127] = '\0';
-        ptrdiff_t lenStream = STREAMLEN(streamPtr);
-        size_t len = snprintf(streamPtr, lenStream, "%s.%03llu", s, msecEvent % 1000LL);
-        streamPtr += len;
+        streamPtr = msec_ntoa(msecEvent, 0, ' ', streamPtr);
     } else {
         AddString("0000-00-00 00:00:00.000");
     }
@@ -1294,13 +1199,9 @@ static char *String_SrcAddr(char *streamPtr, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->srcAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->srcAddr, tmp_str);
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->srcAddr[0]);
-        ip[1] = htonll(ipv6Flow->srcAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->srcAddr, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
@@ -1318,13 +1219,9 @@ static char *String_DstAddr(char *streamPtr, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->dstAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->dstAddr, tmp_str);
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->dstAddr[0]);
-        ip[1] = htonll(ipv6Flow->dstAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->dstAddr, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
@@ -1344,14 +1241,11 @@ static char *String_SrcNet(char *streamPtr, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = ApplyV4NetMaskBits(ipv4Flow->srcAddr, srcMask);
-        ip = htonl(ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(MaskV4(ipv4Flow->srcAddr, srcMask), tmp_str);
     } else if (ipv6Flow) {
-        uint64_t *ip = ApplyV6NetMaskBits(ipv6Flow->srcAddr, srcMask);
-        ip[0] = htonll(ip[0]);
-        ip[1] = htonll(ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        uint64_t net[2];
+        MaskV6(ipv6Flow->srcAddr, srcMask, net);
+        ip6_ntoa(net, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
@@ -1373,14 +1267,11 @@ static char *String_DstNet(char *streamPtr, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = ApplyV4NetMaskBits(ipv4Flow->dstAddr, dstMask);
-        ip = htonl(ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(MaskV4(ipv4Flow->dstAddr, dstMask), tmp_str);
     } else if (ipv6Flow) {
-        uint64_t *ip = ApplyV6NetMaskBits(ipv6Flow->dstAddr, dstMask);
-        ip[0] = htonll(ip[0]);
-        ip[1] = htonll(ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        uint64_t net[2];
+        MaskV6(ipv6Flow->dstAddr, dstMask, net);
+        ip6_ntoa(net, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
@@ -1564,14 +1455,9 @@ static char *String_NextHop(char *streamPtr, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipNextHopV4) {
-        uint32_t ip = htonl(ipNextHopV4->ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipNextHopV4->ip, tmp_str);
     } else if (ipNextHopV6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(ipNextHopV6->ip[0]);
-        ip[1] = htonll(ipNextHopV6->ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipNextHopV6->ip, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
@@ -1589,14 +1475,9 @@ static char *String_BGPNextHop(char *streamPtr, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (bgpNextHopV4) {
-        uint32_t ip = htonl(bgpNextHopV4->ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(bgpNextHopV4->ip, tmp_str);
     } else if (bgpNextHopV6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(bgpNextHopV6->ip[0]);
-        ip[1] = htonll(bgpNextHopV6->ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(bgpNextHopV6->ip, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
@@ -1614,14 +1495,9 @@ static char *String_RouterIP(char *streamPtr, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipReceivedV4) {
-        uint32_t ip = htonl(ipReceivedV4->ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipReceivedV4->ip, tmp_str);
     } else if (ipReceivedV6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(ipReceivedV6->ip[0]);
-        ip[1] = htonll(ipReceivedV6->ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipReceivedV6->ip, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
@@ -2106,36 +1982,35 @@ static char *String_DstASorganisation(char *streamPtr, recordHandle_t *recordHan
 }  // End of String_DstASorganisation
 
 static char *String_SrcTor(char *streamPtr, recordHandle_t *recordHandle) {
-    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
-    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-    char torInfo[4];
-    if (ipv4Flow) {
-        LookupV4Tor(ipv4Flow->srcAddr, genericFlow->msecFirst, genericFlow->msecLast, torInfo);
-    } else {
-        LookupV6Tor(ipv6Flow->srcAddr, genericFlow->msecFirst, genericFlow->msecLast, torInfo);
-    }
+    char *torInfo;
+    GetRecordTor(recordHandle, 0, &torInfo);
     AddString(torInfo);
 
     return streamPtr;
 }  // End of String_SrcTor
 
 static char *String_DstTor(char *streamPtr, recordHandle_t *recordHandle) {
-    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
-    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-
-    char torInfo[4];
-    if (ipv4Flow) {
-        LookupV4Tor(ipv4Flow->dstAddr, genericFlow->msecFirst, genericFlow->msecLast, torInfo);
-    } else {
-        LookupV6Tor(ipv6Flow->dstAddr, genericFlow->msecFirst, genericFlow->msecLast, torInfo);
-    }
+    char *torInfo;
+    GetRecordTor(recordHandle, 1, &torInfo);
     AddString(torInfo);
 
     return streamPtr;
 }  // End of String_DstTor
 
+static char *String_SrcLabel(char *streamPtr, recordHandle_t *recordHandle) {
+    const char *name = LabelName(GetRecordLabel(recordHandle, 0));
+    AddString(name ? name : "-");
+
+    return streamPtr;
+}  // End of String_SrcLabel
+
+static char *String_DstLabel(char *streamPtr, recordHandle_t *recordHandle) {
+    const char *name = LabelName(GetRecordLabel(recordHandle, 1));
+    AddString(name ? name : "-");
+
+    return streamPtr;
+}  // End of String_DstLabel
+
 static char *String_ivrf(char *streamPtr, recordHandle_t *recordHandle) {
     EXvrf_t *vrf = (EXvrf_t *)recordHandle->extensionList[EXvrfID];
     uint32_t ingress = vrf ? vrf->ingressVrf : 0;
@@ -2308,14 +2183,9 @@ static char *String_xlateSrcAddr(char *streamPtr, recordHandle_t *recordHandle)
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (natXlateIPv4) {
-        uint32_t ip = htonl(natXlateIPv4->xlateSrcAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(natXlateIPv4->xlateSrcAddr, tmp_str);
     } else if (natXlateIPv6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(natXlateIPv6->xlateSrcAddr[0]);
-        ip[1] = htonll(natXlateIPv6->xlateSrcAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(natXlateIPv6->xlateSrcAddr, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
@@ -2333,14 +2203,9 @@ static char *String_xlateDstAddr(char *streamPtr, recordHandle_t *recordHandle)
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (natXlateIPv4) {
-        uint32_t ip = htonl(natXlateIPv4->xlateDstAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(natXlateIPv4->xlateDstAddr, tmp_str);
     } else if (natXlateIPv6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(natXlateIPv6->xlateDstAddr[0]);
-        ip[1] = htonll(natXlateIPv6->xlateDstAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(natXlateIPv6->xlateDstAddr, tmp_str);
     } else {
         strcpy(tmp_str, "0.0.0.0");
     }
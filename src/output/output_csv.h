@@ -38,6 +38,8 @@
 
 int ParseCSVOutputFormat(char *format);
 
+int CSVParallelFormat(void);
+
 void csv_prolog(outputParams_t *outputParam);
 
 void csv_epilog(outputParams_t *outputParam);
@@ -50,4 +52,6 @@ void csv_epilog_fast(outputParams_t *outputParam);
 
 void csv_record_fast(FILE *stream, recordHandle_t *recordHandle, int tag);
 
+void csv_count_fast(uint32_t count);
+
 #endif  // _OUTPUT_CSV_H
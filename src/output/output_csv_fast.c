@@ -48,10 +48,11 @@
 
 #define IP_STRING_LEN (INET6_ADDRSTRLEN)
 
-// record counter
-static uint32_t recordCount;
+// record counter - per thread, if records are rendered by multiple threads
+static _Thread_local uint32_t recordCount;
 
 #include "itoa.c"
+#include "textfmt.c"
 
 #define AddString(s)               \
     do {                           \
@@ -74,26 +75,22 @@ static uint32_t recordCount;
     } while (0)
 
 #define STREAMBUFFSIZE 1014
-static char *streamBuff = NULL;
+static _Thread_local char streamBuff[STREAMBUFFSIZE];
 
 void csv_prolog_fast(outputParams_t *outputParam) {
     // empty prolog
     recordCount = 0;
-    streamBuff = malloc(STREAMBUFFSIZE);
-    if (!streamBuff) {
-        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-    streamBuff[0] = '\0';
     printf("cnt,af,firstSeen,lastSeen,proto,srcAddr,srcPort,dstAddr,dstPort,srcAS,dstAS,input,output,flags,srcTos,packets,bytes\n");
 }  // End of csv_prolog_fast
 
 void csv_epilog_fast(outputParams_t *outputParam) {
     // empty epilog
-    free(streamBuff);
-    streamBuff = NULL;
 }  // End of csv_epilog_fast
 
+void csv_count_fast(uint32_t count) {
+    recordCount = count;
+}  // End of csv_count_fast
+
 void csv_record_fast(FILE *stream, recordHandle_t *recordHandle, int tag) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
@@ -117,23 +114,14 @@ void csv_record_fast(FILE *stream, recordHandle_t *recordHandle, int tag) {
     char sa[IP_STRING_LEN], da[IP_STRING_LEN];
     if (ipv4Flow) {
         af = PF_INET;
-        uint32_t src = htonl(ipv4Flow->srcAddr);
-        uint32_t dst = htonl(ipv4Flow->dstAddr);
-
-        inet_ntop(AF_INET, &src, sa, sizeof(sa));
-        inet_ntop(AF_INET, &dst, da, sizeof(da));
+        ip4_ntoa(ipv4Flow->srcAddr, sa);
+        ip4_ntoa(ipv4Flow->dstAddr, da);
     }
 
     if (ipv6Flow) {
         af = PF_INET6;
-        uint64_t src[2], dst[2];
-        src[0] = htonll(ipv6Flow->srcAddr[0]);
-        src[1] = htonll(ipv6Flow->srcAddr[1]);
-        dst[0] = htonll(ipv6Flow->dstAddr[0]);
-        dst[1] = htonll(ipv6Flow->dstAddr[1]);
-
-        inet_ntop(AF_INET6, &src, sa, sizeof(sa));
-        inet_ntop(AF_INET6, &dst, da, sizeof(da));
+        ip6_ntoa(ipv6Flow->srcAddr, sa);
+        ip6_ntoa(ipv6Flow->dstAddr, da);
     }
 
     AddU32(++recordCount);
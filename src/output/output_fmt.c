@@ -32,6 +32,7 @@
 #include "output_fmt.h"
 
 #include <arpa/inet.h>
+#include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -45,25 +46,75 @@
 #include <sys/types.h>
 #include <time.h>
 
+#include "conf/nfconf.h"
 #include "dns/dns.h"
 #include "ifvrf.h"
 #include "ja3/ja3.h"
 #include "ja4/ja4.h"
+#include "label/label.h"
+#include "loghisto.h"
 #include "maxmind/maxmind.h"
 #include "nbar.h"
 #include "nfdump.h"
 #include "nffile.h"
 #include "nfxV3.h"
 #include "output_util.h"
+#include "rdns/rdns.h"
 #include "tor/tor.h"
 #include "userio.h"
 #include "util.h"
 
-typedef void (*string_function_t)(FILE *, recordHandle_t *);
+typedef char *(*string_function_t)(char *, recordHandle_t *);
+
+#include "itoa.c"
+#include "textfmt.c"
+
+#define AddString(s)                 \
+    do {                             \
+        const char *_s = (s);        \
+        size_t len = strlen(_s);     \
+        memcpy(streamPtr, _s, len);  \
+        streamPtr += len;            \
+    } while (0)
+
+#define AddChar(c) *streamPtr++ = (c)
+
+// right aligned number in a field of width chars, left aligned for a negative width
+#define AddU64Width(u64, width) streamPtr = AddNumber(streamPtr, (uint64_t)(u64), (width))
+
+// right aligned string in a field of width chars, left aligned for a negative width
+#define AddStringWidth(s, width) streamPtr = AddPadded(streamPtr, (s), (width))
+
+// 3 digit msec fraction
+#define AddMsec(msec)                                         \
+    do {                                                      \
+        uint32_t _msec = (uint32_t)(msec);                    \
+        *streamPtr++ = '0' + _msec / 100;                     \
+        memcpy(streamPtr, &char_table[(_msec % 100) * 2], 2); \
+        streamPtr += 2;                                       \
+    } while (0)
+
+#define AddFormat(...)                                                      \
+    do {                                                                    \
+        ptrdiff_t lenStream = STREAMLEN(streamPtr);                         \
+        size_t len = snprintf(streamPtr, lenStream, __VA_ARGS__);           \
+        streamPtr += len < (size_t)lenStream ? len : (size_t)lenStream - 1; \
+    } while (0)
+
+// records are formatted into the stream buffer and written with one fwrite() each
+#define STREAMBUFFSIZE 65536
+// free space required in the buffer, before a token is formatted
+#define STREAMRESERVE 4096
+#define STREAMLEN(ptr)                                \
+    ((ptrdiff_t)STREAMBUFFSIZE - (ptr - streamBuff)); \
+    assert((ptr - streamBuff) < STREAMBUFFSIZE)
+static char *streamBuff = NULL;
+static FILE *outStream = NULL;
 
 static struct token_list_s {
     string_function_t string_function;  // function printing result to stream
     char *string_buffer;                // buffer for static output string
+    size_t string_length;               // length of static output string
 } *token_list = NULL;
 
 static int max_token_index = 0;
@@ -75,6 +126,7 @@ static int max_format_index = 0;
 
 static int do_tag = 0;
 static int long_v6 = 0;
+static int rdnsTokens = 0;
 static int printPlain = 0;
 static double duration = 0;
 
@@ -89,277 +141,305 @@ static char tag_string[2] = {'\0'};
 /* prototypes */
 static char *ICMP_Port_decode(EXgenericFlow_t *genericFlow);
 
-static inline uint32_t ApplyV4NetMaskBits(uint32_t ip, uint32_t maskBits);
-
-static inline uint64_t *ApplyV6NetMaskBits(uint64_t *ip, uint32_t maskBits);
-
 static void InitFormatParser(void);
 
 static void AddToken(int index, char *s);
 
-static void String_Version(FILE *stream, recordHandle_t *recordHandle);
+static char *FlushStream(char *streamPtr);
+
+static inline char *AddNumber(char *streamPtr, uint64_t num, int width);
+
+static inline char *AddPadded(char *streamPtr, const char *s, int width);
+
+static char *String_Version(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_FlowCount(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_FirstSeen(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_LastSeen(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_Received(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_FirstSeenRaw(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_LastSeenRaw(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_FirstSeenGMT(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_LastSeenGMT(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_FlowCount(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ReceivedRaw(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_FirstSeen(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ReceivedGMT(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_LastSeen(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Duration(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Received(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Duration_Seconds(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_FirstSeenRaw(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Protocol(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_LastSeenRaw(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcAddr(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_FirstSeenGMT(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstAddr(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_LastSeenGMT(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcGeoAddr(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ReceivedRaw(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstGeoAddr(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ReceivedGMT(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcHost(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Duration(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstHost(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Duration_Seconds(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcAddrPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Protocol(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstAddrPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcAddr(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcAddrGeoPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstAddr(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstAddrGeoPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcGeoAddr(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcNet(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstGeoAddr(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstNet(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcAddrPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_NextHop(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstAddrPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_BGPNextHop(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcAddrGeoPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_RouterIP(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstAddrGeoPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcNet(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstNet(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ICMP_code(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_NextHop(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ICMP_type(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_BGPNextHop(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcAS(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_RouterIP(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstAS(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_NextAS(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_PrevAS(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ICMP_code(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Input(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ICMP_type(FILE *stream, recordHandle_t *recordHandle);
+static char *String_InputName(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcAS(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Output(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstAS(FILE *stream, recordHandle_t *recordHandle);
+static char *String_OutputName(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_NextAS(FILE *stream, recordHandle_t *recordHandle);
+static char *String_InPackets(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_PrevAS(FILE *stream, recordHandle_t *recordHandle);
+static char *String_OutPackets(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Input(FILE *stream, recordHandle_t *recordHandle);
+static char *String_InBytes(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_InputName(FILE *stream, recordHandle_t *recordHandle);
+static char *String_OutBytes(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Output(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Flows(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_OutputName(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Tos(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_InPackets(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Dir(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_OutPackets(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcTos(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_InBytes(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstTos(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_OutBytes(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcMask(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Flows(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstMask(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Tos(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcVlan(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Dir(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstVlan(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcTos(FILE *stream, recordHandle_t *recordHandle);
+static char *String_FwdStatus(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstTos(FILE *stream, recordHandle_t *recordHandle);
+static char *String_BiFlowDir(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcMask(FILE *stream, recordHandle_t *recordHandle);
+static char *String_FlowEndReason(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstMask(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ipTTL(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcVlan(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ipFrag(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstVlan(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Flags(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_FwdStatus(FILE *stream, recordHandle_t *recordHandle);
+static char *String_InSrcMac(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_BiFlowDir(FILE *stream, recordHandle_t *recordHandle);
+static char *String_OutDstMac(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_FlowEndReason(FILE *stream, recordHandle_t *recordHandle);
+static char *String_InDstMac(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ipTTL(FILE *stream, recordHandle_t *recordHandle);
+static char *String_OutSrcMac(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ipFrag(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_1(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Flags(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_2(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_InSrcMac(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_3(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_OutDstMac(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_4(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_InDstMac(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_5(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_OutSrcMac(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_6(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_1(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_7(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_2(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_8(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_3(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_9(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_4(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLS_10(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_5(FILE *stream, recordHandle_t *recordHandle);
+static char *String_MPLSs(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_6(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Engine(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_7(FILE *stream, recordHandle_t *recordHandle);
+static char *String_Label(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_8(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ClientLatency(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_9(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ServerLatency(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLS_10(FILE *stream, recordHandle_t *recordHandle);
+static char *String_AppLatency(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_MPLSs(FILE *stream, recordHandle_t *recordHandle);
+static char *String_bps(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Engine(FILE *stream, recordHandle_t *recordHandle);
+static char *String_pps(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_Label(FILE *stream, recordHandle_t *recordHandle);
+static char *String_bpp(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ClientLatency(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P50Duration(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ServerLatency(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P95Duration(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_AppLatency(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P99Duration(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_bps(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P50Bpp(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_pps(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P95Bpp(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_bpp(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P99Bpp(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ExpSysID(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P50Latency(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcCountry(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P95Latency(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstCountry(FILE *stream, recordHandle_t *recordHandle);
+static char *String_P99Latency(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcLocation(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ExpSysID(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstLocation(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcCountry(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcASorganisation(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstCountry(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstASorganisation(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcLocation(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_SrcTor(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstLocation(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_DstTor(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcASorganisation(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_inPayload(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstASorganisation(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_outPayload(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcTor(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_nbarID(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstTor(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_nbarName(FILE *stream, recordHandle_t *recordHandle);
+static char *String_SrcLabel(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ja3(FILE *stream, recordHandle_t *recordHandle);
+static char *String_DstLabel(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ja4(FILE *stream, recordHandle_t *recordHandle);
+static char *String_inPayload(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_sniName(FILE *stream, recordHandle_t *recordHandle);
+static char *String_outPayload(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_tlsVersion(FILE *stream, recordHandle_t *recordHandle);
+static char *String_nbarID(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_observationDomainID(FILE *stream, recordHandle_t *recordHandle);
+static char *String_nbarName(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_observationPointID(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ja3(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ivrf(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ja4(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_ivrfName(FILE *stream, recordHandle_t *recordHandle);
+static char *String_sniName(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_evrf(FILE *stream, recordHandle_t *recordHandle);
+static char *String_tlsVersion(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_evrfName(FILE *stream, recordHandle_t *recordHandle);
+static char *String_observationDomainID(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_NewLine(FILE *stream, recordHandle_t *recordHandle);
+static char *String_observationPointID(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_pfIfName(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ivrf(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_pfAction(FILE *stream, recordHandle_t *recordHandle);
+static char *String_ivrfName(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_pfReason(FILE *stream, recordHandle_t *recordHandle);
+static char *String_evrf(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_pfdir(FILE *stream, recordHandle_t *recordHandle);
+static char *String_evrfName(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_pfrule(FILE *stream, recordHandle_t *recordHandle);
+static char *String_NewLine(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_EventTime(FILE *stream, recordHandle_t *recordHandle);
+static char *String_pfIfName(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_nfc(FILE *stream, recordHandle_t *recordHandle);
+static char *String_pfAction(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_evt(FILE *stream, recordHandle_t *recordHandle);
+static char *String_pfReason(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_xevt(FILE *stream, recordHandle_t *recordHandle);
+static char *String_pfdir(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_msecEvent(FILE *stream, recordHandle_t *recordHandle);
+static char *String_pfrule(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_iacl(FILE *stream, recordHandle_t *recordHandle);
+static char *String_EventTime(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_eacl(FILE *stream, recordHandle_t *recordHandle);
+static char *String_nfc(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_xlateSrcAddr(FILE *stream, recordHandle_t *recordHandle);
+static char *String_evt(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_xlateDstAddr(FILE *stream, recordHandle_t *recordHandle);
+static char *String_xevt(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_xlateSrcPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_msecEvent(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_xlateDstPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_iacl(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_xlateSrcAddrPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_eacl(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_xlateDstAddrPort(FILE *stream, recordHandle_t *recordHandle);
+static char *String_xlateSrcAddr(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_userName(FILE *stream, recordHandle_t *recordHandle);
+static char *String_xlateDstAddr(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_PortBlockStart(FILE *stream, recordHandle_t *recordHandle);
+static char *String_xlateSrcPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_PortBlockEnd(FILE *stream, recordHandle_t *recordHandle);
+static char *String_xlateDstPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_PortBlockStep(FILE *stream, recordHandle_t *recordHandle);
+static char *String_xlateSrcAddrPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_PortBlockSize(FILE *stream, recordHandle_t *recordHandle);
+static char *String_xlateDstAddrPort(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_flowId(FILE *stream, recordHandle_t *recordHandle);
+static char *String_userName(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_inServiceID(FILE *stream, recordHandle_t *recordHandle);
+static char *String_PortBlockStart(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_outServiceID(FILE *stream, recordHandle_t *recordHandle);
+static char *String_PortBlockEnd(char *streamPtr, recordHandle_t *recordHandle);
 
-static void String_natString(FILE *stream, recordHandle_t *recordHandle);
+static char *String_PortBlockStep(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_PortBlockSize(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_flowId(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_inServiceID(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_outServiceID(char *streamPtr, recordHandle_t *recordHandle);
+
+static char *String_natString(char *streamPtr, recordHandle_t *recordHandle);
 
 static struct format_entry_s {
     char *token;                        // token
@@ -386,7 +466,7 @@ static struct format_entry_s {
     {"%trg", 0, "Date flow received GMT ", String_ReceivedGMT},   // Received Time GMT
     {"%td", 0, "Duration        ", String_Duration},              // Duration
     {"%tds", 0, "Duration        ", String_Duration_Seconds},     // Duration always in seconds
-    {"%pkt", 0, " Packets", String_InPackets},                    // Packets - default input - compat
+    {"%pkt", 0, " Packets", String_InPackets},            // Packets - default input - compat
     {"%ipkt", 0, "  In Pkt", String_InPackets},                   // In Packets
     {"%byt", 0, "   Bytes", String_InBytes},                      // Bytes - default input - compat
     {"%ibyt", 0, " In Byte", String_InBytes},                     // In Bytes
@@ -394,15 +474,26 @@ static struct format_entry_s {
     {"%dp", 0, "Dst Pt", String_DstPort},                         // Destination Port
     {"%it", 0, "ICMP-T", String_ICMP_type},                       // ICMP type
     {"%ic", 0, "ICMP-C", String_ICMP_code},                       // ICMP code
-    {"%pr", 0, "Proto", String_Protocol},                         // Protocol
+    {"%pr", 0, "Proto", String_Protocol},                 // Protocol
     {"%flg", 0, "   Flags", String_Flags},                        // TCP Flags
     {"%fwd", 0, "Fwd", String_FwdStatus},                         // Forwarding Status
     {"%tos", 0, " Tos", String_Tos},                              // Tos - compat
     {"%stos", 0, "STos", String_SrcTos},                          // Tos - Src tos
     {"%bps", 0, "     bps", String_bps},                          // bps - bits per second
-    {"%pps", 0, "     pps", String_pps},                          // pps - packets per second
+    {"%pps", 0, "     pps", String_pps},                  // pps - packets per second
     {"%bpp", 0, "   Bpp", String_bpp},                            // bpp - Bytes per package
 
+    // quantiles of aggregated flows
+    {"%p50td", 0, "  p50 Duration", String_P50Duration},  // p50 of flow durations
+    {"%p95td", 0, "  p95 Duration", String_P95Duration},  // p95 of flow durations
+    {"%p99td", 0, "  p99 Duration", String_P99Duration},  // p99 of flow durations
+    {"%p50bpp", 0, "p50 Bpp", String_P50Bpp},             // p50 of flow Bytes per package
+    {"%p95bpp", 0, "p95 Bpp", String_P95Bpp},             // p95 of flow Bytes per package
+    {"%p99bpp", 0, "p99 Bpp", String_P99Bpp},             // p99 of flow Bytes per package
+    {"%p50lat", 0, "p50 Latency", String_P50Latency},     // p50 of flow application latency
+    {"%p95lat", 0, "p95 Latency", String_P95Latency},     // p95 of flow application latency
+    {"%p99lat", 0, "p99 Latency", String_P99Latency},     // p99 of flow application latency
+
     // EXipv4FlowID EXipv6FlowID
     {"%sa", 1, "     Src IP Addr", String_SrcAddr},             // Source Address
     {"%da", 1, "     Dst IP Addr", String_DstAddr},             // Destination Address
@@ -413,6 +504,8 @@ static struct format_entry_s {
     {"%gdap", 1, "     Dst IP Addr(..):Port ", String_DstAddrGeoPort},  // Destination Address(geo):Port
     {"%gsa", 1, "     Src IP Addr(..)", String_SrcGeoAddr},             // Source Address
     {"%gda", 1, "     Dst IP Addr(..)", String_DstGeoAddr},             // Destination Address
+    {"%shn", 0, "                        Src Host", String_SrcHost},  // Source host name
+    {"%dhn", 0, "                        Dst Host", String_DstHost},  // Destination host name
 
     // EXflowMiscID
     {"%in", 0, " Input", String_Input},        // Input Interface num
@@ -475,7 +568,7 @@ static struct format_entry_s {
 
     // EXasAdjacentID
     {"%nas", 0, "Next AS", String_NextAS},  // Next AS
-    {"%pas", 0, "Prev AS", String_PrevAS},  // Previous AS
+    {"%pas", 0, "Prev AS", String_PrevAS},                // Previous AS
 
     // EXlatencyID - latency extension for nfpcapd and nprobe
     {"%cl", 0, "C Latency", String_ClientLatency},  // client latency
@@ -521,10 +614,10 @@ static struct format_entry_s {
     {"%uname", 0, "UserName", String_userName},  // NSEL user name
 
     // EXnatPortBlockID - Port block allocation
-    {"%pbstart", 0, "Pb-Start", String_PortBlockStart},  // Port block start
-    {"%pbend", 0, "Pb-End", String_PortBlockEnd},        // Port block end
-    {"%pbstep", 0, "Pb-Step", String_PortBlockStep},     // Port block step
-    {"%pbsize", 0, "Pb-Size", String_PortBlockSize},     // Port block size
+    {"%pbstart", 0, "Pb-Start", String_PortBlockStart},   // Port block start
+    {"%pbend", 0, "Pb-End", String_PortBlockEnd},         // Port block end
+    {"%pbstep", 0, "Pb-Step", String_PortBlockStep},      // Port block step
+    {"%pbsize", 0, "Pb-Size", String_PortBlockSize},      // Port block size
 
     // EXnbarAppID
     {"%nbid", 0, "nbar ID", String_nbarID},       // nbar ID
@@ -552,11 +645,11 @@ static struct format_entry_s {
     {"%evrfnam", 0, "  E-VRF-Name", String_evrfName},  // egress vrf name
 
     // EXpfinfoID
-    {"%pfifn", 0, "interface", String_pfIfName},  // pflog ifname
-    {"%pfact", 0, "action", String_pfAction},     // pflog action
-    {"%pfrea", 0, "reason", String_pfReason},     // pflog reason
-    {"%pfdir", 0, "dir", String_pfdir},           // pflog direction
-    {"%pfrule", 0, "rule", String_pfrule},        // pflog rule
+    {"%pfifn", 0, "interface", String_pfIfName},          // pflog ifname
+    {"%pfact", 0, "action", String_pfAction},             // pflog action
+    {"%pfrea", 0, "reason", String_pfReason},             // pflog reason
+    {"%pfdir", 0, "dir", String_pfdir},                   // pflog direction
+    {"%pfrule", 0, "rule", String_pfrule},                // pflog rule
 
     // EXflowIdID
     {"%flid", 0, "               flowID", String_flowId},  // flowID
@@ -581,6 +674,8 @@ static struct format_entry_s {
     {"%dasn", 0, "Dst AS organisation", String_DstASorganisation},      // dst IP AS organisation string
     {"%stor", 0, "STor", String_SrcTor},                                // src IP 2 letter tor node info
     {"%dtor", 0, "DTor", String_DstTor},                                // dst IP 2 letter tor node info
+    {"%slb", 0, "       Src Label", String_SrcLabel},                   // src IP prefix label
+    {"%dlb", 0, "       Dst Label", String_DstLabel},                   // dst IP prefix label
     {"%lbl", 0, "           label", String_Label},                      // Flow Label
 
     // EXipInfo
@@ -660,15 +755,36 @@ void fmt_record(FILE *stream, recordHandle_t *recordHandle, int tag) {
         }
     }
 
+    if (unlikely(streamBuff == NULL)) {
+        streamBuff = malloc(STREAMBUFFSIZE);
+        if (!streamBuff) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    outStream = stream;
+    char *streamPtr = streamBuff;
+
     for (int i = 0; i < token_index; i++) {
+        if (unlikely((streamBuff + STREAMBUFFSIZE - streamPtr) < STREAMRESERVE)) {
+            streamPtr = FlushStream(streamPtr);
+        }
         if (token_list[i].string_function) {
-            token_list[i].string_function(stream, recordHandle);
+            streamPtr = token_list[i].string_function(streamPtr, recordHandle);
         }
         if (token_list[i].string_buffer) {
-            fprintf(stream, "%s", token_list[i].string_buffer);
+            size_t len = token_list[i].string_length;
+            if (unlikely(len >= (size_t)(streamBuff + STREAMBUFFSIZE - streamPtr))) {
+                streamPtr = FlushStream(streamPtr);
+                fwrite(token_list[i].string_buffer, 1, len, stream);
+            } else {
+                memcpy(streamPtr, token_list[i].string_buffer, len);
+                streamPtr += len;
+            }
         }
     }
-    fprintf(stream, "\n");
+    AddChar('\n');
+    fwrite(streamBuff, 1, streamPtr - streamBuff, stream);
 
 }  // End of fmt_record
 
@@ -678,9 +794,57 @@ void fmt_prolog(outputParams_t *outputParam) {
 }  // End of fmt_prolog
 
 void fmt_epilog(outputParams_t *outputParam) {
-    // empty
+    free(streamBuff);
+    streamBuff = NULL;
+    if (rdnsTokens) Dispose_RDNS();
 }  // End of fmt_epilog
 
+int FMTPrefetch(void) {
+    return rdnsTokens;
+}  // End of FMTPrefetch
+
+// request the host names of a record ahead of printing
+void fmt_prefetch(recordHandle_t *recordHandle) {
+    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
+    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
+    if (ipv4Flow) {
+        RDNSPrefetchV4(ipv4Flow->srcAddr);
+        RDNSPrefetchV4(ipv4Flow->dstAddr);
+    } else if (ipv6Flow) {
+        RDNSPrefetchV6(ipv6Flow->srcAddr);
+        RDNSPrefetchV6(ipv6Flow->dstAddr);
+    }
+}  // End of fmt_prefetch
+
+// write the formatted output so far to the stream and restart at the beginning of the buffer
+static char *FlushStream(char *streamPtr) {
+    fwrite(streamBuff, 1, streamPtr - streamBuff, outStream);
+    return streamBuff;
+}  // End of FlushStream
+
+static inline char *AddNumber(char *streamPtr, uint64_t num, int width) {
+    char numStr[24];
+    int len = itoa_u64(num, numStr) - numStr;
+    int pad = (width < 0 ? -width : width) - len;
+    if (width > 0)
+        for (; pad > 0; pad--) *streamPtr++ = ' ';
+    memcpy(streamPtr, numStr, len);
+    streamPtr += len;
+    for (; pad > 0; pad--) *streamPtr++ = ' ';
+    return streamPtr;
+}  // End of AddNumber
+
+static inline char *AddPadded(char *streamPtr, const char *s, int width) {
+    int len = strlen(s);
+    int pad = (width < 0 ? -width : width) - len;
+    if (width > 0)
+        for (; pad > 0; pad--) *streamPtr++ = ' ';
+    memcpy(streamPtr, s, len);
+    streamPtr += len;
+    for (; pad > 0; pad--) *streamPtr++ = ' ';
+    return streamPtr;
+}  // End of AddPadded
+
 static void InitFormatParser(void) {
     max_format_index = max_token_index = BLOCK_SIZE;
     token_list = (struct token_list_s *)calloc(1, max_token_index * sizeof(struct token_list_s));
@@ -710,27 +874,6 @@ void CondenseV6(char *s) {
 
 }  // End of CondenseV6
 
-static inline uint32_t ApplyV4NetMaskBits(uint32_t ip, uint32_t maskBits) {
-    uint32_t srcMask = 0xffffffff << (32 - maskBits);
-    return (ip &= srcMask);
-}  // End of ApplyV4NetMaskBits
-
-static inline uint64_t *ApplyV6NetMaskBits(uint64_t *ip, uint32_t maskBits) {
-    static uint64_t net[2];
-    uint64_t mask;
-    if (maskBits > 64) {
-        mask = 0xffffffffffffffffLL << (128 - maskBits);
-        net[0] = ip[0];
-        net[1] = ip[1] & mask;
-    } else {
-        mask = 0xffffffffffffffffLL << (64 - maskBits);
-        net[0] = ip[0] & mask;
-        net[1] = 0;
-    }
-    return net;
-
-}  // End of ApplyV6NetMaskBits
-
 static void AddToken(int index, char *s) {
     if (token_index >= max_token_index) {  // no slot available - expand table
         max_token_index += BLOCK_SIZE;
@@ -747,11 +890,26 @@ static void AddToken(int index, char *s) {
     } else {
         token_list[token_index].string_function = NULL;
         token_list[token_index].string_buffer = s;
+        token_list[token_index].string_length = strlen(s);
     }
     token_index++;
 
 }  // End of AddToken
 
+// quantile tokens %p<nn><metric> request the histogram of their metric from the aggregation
+static void RequestHisto(char *token) {
+    if (token[1] != 'p' || !isdigit((int)token[2])) return;
+
+    char *metric = token + 4;
+    if (strcmp(metric, "td") == 0)
+        LogHistoRequest(HISTO_DURATION);
+    else if (strcmp(metric, "bpp") == 0)
+        LogHistoRequest(HISTO_BPP);
+    else if (strcmp(metric, "lat") == 0)
+        LogHistoRequest(HISTO_LATENCY);
+
+}  // End of RequestHisto
+
 int ParseFMTOutputFormat(char *format, int plain_numbers) {
     printPlain = plain_numbers;
 
@@ -779,6 +937,9 @@ int ParseFMTOutputFormat(char *format, int plain_numbers) {
                     c[len] = '\0';
                     if (strncmp(formatTable[i].token, c, len) == 0) {  // token found
                         AddToken(i, NULL);
+                        RequestHisto(formatTable[i].token);
+                        if (formatTable[i].string_function == String_SrcHost || formatTable[i].string_function == String_DstHost)
+                            rdnsTokens = 1;
                         if (long_v6 && formatTable[i].is_address)
                             snprintf(h, STRINGSIZE - 1 - strlen(header_string), "%23s%s", "", formatTable[i].fmtHeader);
                         else
@@ -826,6 +987,10 @@ int ParseFMTOutputFormat(char *format, int plain_numbers) {
     }
 
     free(s);
+
+    // host names are resolved by the resolver threads
+    if (rdnsTokens && !Init_RDNS(ConfGetValue("rdns.resolvers"), ConfGetValue("rdns.cachesize"))) return 0;
+
     return 1;
 
 }  // End of ParseOutputFormat
@@ -849,14 +1014,14 @@ static char *ICMP_Port_decode(EXgenericFlow_t *genericFlow) {
 }  // End of ICMP_Port_decode
 
 /* functions, which create the individual strings for the output line */
-static void String_Version(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Version(char *streamPtr, recordHandle_t *recordHandle) {
     recordHeaderV3_t *recordHeaderV3 = recordHandle->recordHeaderV3;
 
     char *type = "UNKN";
     uint8_t nfversion = recordHeaderV3->nfversion;
     if (TestFlag(recordHeaderV3->flags, V3_FLAG_EVENT)) {
         type = "EVT";
-        fprintf(stream, "%s%u", type, nfversion);
+        AddFormat("%s%u", type, nfversion);
     } else {
         if (nfversion != 0) {
             if (nfversion & 0x80) {
@@ -866,171 +1031,155 @@ static void String_Version(FILE *stream, recordHandle_t *recordHandle) {
             } else {
                 type = "Nv";
             }
-            fprintf(stream, "%s%u", type, nfversion & 0x0F);
+            AddFormat("%s%u", type, nfversion & 0x0F);
         } else {
             // compat with previous versions
             type = "FLO";
-            fprintf(stream, "%s", type);
+            AddString(type);
         }
     }
 
+    return streamPtr;
 }  // End of String_Version
 
-static void String_FlowCount(FILE *stream, recordHandle_t *recordHandle) {
-    fprintf(stream, "%5" PRIu64, recordHandle->flowCount);
+static char *String_FlowCount(char *streamPtr, recordHandle_t *recordHandle) {
+    AddU64Width(recordHandle->flowCount, 5);
+
+    return streamPtr;
 }  // End of String_FlowCount
 
-static void String_FirstSeen(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_FirstSeen(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecFirst = genericFlow ? genericFlow->msecFirst : 0;
 
     if (msecFirst) {
-        time_t tt = msecFirst / 1000LL;
-        struct tm ts;
-        localtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        fprintf(stream, "%s.%03u", s, (unsigned)(msecFirst % 1000LL));
+        streamPtr = msec_ntoa(msecFirst, 0, ' ', streamPtr);
     } else {
-        fprintf(stream, "%s", "0000-00-00 00:00:00.000");
+        AddString("0000-00-00 00:00:00.000");
     }
 
+    return streamPtr;
 }  // End of String_FirstSeen
 
-static void String_LastSeen(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_LastSeen(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecLast = genericFlow ? genericFlow->msecLast : 0;
 
     if (msecLast) {
-        time_t tt = msecLast / 1000LL;
-        struct tm ts;
-        localtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        fprintf(stream, "%s.%03u", s, (unsigned)(msecLast % 1000LL));
+        streamPtr = msec_ntoa(msecLast, 0, ' ', streamPtr);
     } else {
-        fprintf(stream, "%s", "0000-00-00 00:00:00.000");
+        AddString("0000-00-00 00:00:00.000");
     }
 
+    return streamPtr;
 }  // End of String_LastSeen
 
-static void String_Received(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Received(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecReceived = genericFlow ? genericFlow->msecReceived : 0;
 
     if (msecReceived) {
-        time_t tt = msecReceived / 1000LL;
-        struct tm ts;
-        localtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        fprintf(stream, "%s.%03llu", s, msecReceived % 1000LL);
+        streamPtr = msec_ntoa(msecReceived, 0, ' ', streamPtr);
     } else {
-        fprintf(stream, "%s", "0000-00-00 00:00:00.000");
+        AddString("0000-00-00 00:00:00.000");
     }
 
+    return streamPtr;
 }  // End of String_Received
 
-static void String_ReceivedGMT(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ReceivedGMT(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecReceived = genericFlow ? genericFlow->msecReceived : 0;
 
     if (msecReceived) {
-        time_t tt = msecReceived / 1000LL;
-        struct tm ts;
-        gmtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        fprintf(stream, "%s.%03llu", s, msecReceived % 1000LL);
+        streamPtr = msec_ntoa(msecReceived, 1, ' ', streamPtr);
     } else {
-        fprintf(stream, "%s", "0000-00-00 00:00:00.000");
+        AddString("0000-00-00 00:00:00.000");
     }
 
+    return streamPtr;
 }  // End of String_ReceivedGMT
 
-static void String_ReceivedRaw(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ReceivedRaw(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecReceived = genericFlow ? genericFlow->msecReceived : 0;
-    fprintf(stream, "%10llu.%03llu", msecReceived / 1000LL, msecReceived % 1000LL);
+    AddU64Width(msecReceived / 1000LL, 10);
+    AddChar('.');
+    AddMsec(msecReceived % 1000LL);
 
+    return streamPtr;
 }  // End of String_ReceivedRaw
 
-static void String_FirstSeenRaw(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_FirstSeenRaw(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecFirst = genericFlow ? genericFlow->msecFirst : 0;
-    fprintf(stream, "%10llu.%03llu", msecFirst / 1000LL, msecFirst % 1000LL);
+    AddU64Width(msecFirst / 1000LL, 10);
+    AddChar('.');
+    AddMsec(msecFirst % 1000LL);
 
+    return streamPtr;
 }  // End of String_FirstSeenRaw
 
-static void String_LastSeenRaw(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_LastSeenRaw(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecLast = genericFlow ? genericFlow->msecLast : 0;
-    fprintf(stream, "%10llu.%03llu", msecLast / 1000LL, msecLast % 1000LL);
+    AddU64Width(msecLast / 1000LL, 10);
+    AddChar('.');
+    AddMsec(msecLast % 1000LL);
 
+    return streamPtr;
 }  // End of String_LastSeenRaw
 
-static void String_FirstSeenGMT(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_FirstSeenGMT(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecFirst = genericFlow ? genericFlow->msecFirst : 0;
 
     if (msecFirst) {
-        time_t tt = msecFirst / 1000LL;
-        struct tm ts;
-        gmtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        fprintf(stream, "%s.%03u", s, (unsigned)(msecFirst % 1000LL));
+        streamPtr = msec_ntoa(msecFirst, 1, ' ', streamPtr);
     } else {
-        fprintf(stream, "%s", "0000-00-00 00:00:00.000");
+        AddString("0000-00-00 00:00:00.000");
     }
 
+    return streamPtr;
 }  // End of String_FirstSeenGMT
 
-static void String_LastSeenGMT(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_LastSeenGMT(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
 
     uint64_t msecLast = genericFlow ? genericFlow->msecLast : 0;
 
     if (msecLast) {
-        time_t tt = msecLast / 1000LL;
-        struct tm ts;
-        gmtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        fprintf(stream, "%s.%03u", s, (unsigned)(msecLast % 1000LL));
+        streamPtr = msec_ntoa(msecLast, 1, ' ', streamPtr);
     } else {
-        fprintf(stream, "%s", "0000-00-00 00:00:00.000");
+        AddString("0000-00-00 00:00:00.000");
     }
 
+    return streamPtr;
 }  // End of String_LastSeenGMT
 
-static void String_Payload(FILE *stream, uint8_t *payload, EXgenericFlow_t *genericFlow) {
+static char *String_Payload(char *streamPtr, uint8_t *payload, EXgenericFlow_t *genericFlow) {
     uint32_t payloadLength = 0;
     if (payload) {
         elementHeader_t *elementHeader = (elementHeader_t *)(payload - sizeof(elementHeader_t));
         payloadLength = elementHeader->length - sizeof(elementHeader_t);
     } else {
-        fprintf(stream, "<no payload>");
-        return;
+        AddString("<no payload>");
+        return streamPtr;
     }
 
     int max = payloadLength > 256 ? 256 : payloadLength;
     if (genericFlow && (genericFlow->srcPort == 53 || genericFlow->dstPort == 53)) {
-        content_decode_dns(stream, genericFlow->proto, payload, payloadLength);
+        // the dns decoder prints to the stream
+        streamPtr = FlushStream(streamPtr);
+        content_decode_dns(outStream, genericFlow->proto, payload, payloadLength);
     }
 
     int ascii = 1;
@@ -1041,26 +1190,32 @@ static void String_Payload(FILE *stream, uint8_t *payload, EXgenericFlow_t *gene
         }
     }
     if (ascii) {
-        fprintf(stream, "%.*s\n", max, payload);
+        AddFormat("%.*s\n", max, payload);
     } else {
-        DumpHex(stream, payload, max);
+        streamPtr = FlushStream(streamPtr);
+        DumpHex(outStream, payload, max);
     }
 
+    return streamPtr;
 }  // End of String_Payload
 
-static void String_inPayload(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_inPayload(char *streamPtr, recordHandle_t *recordHandle) {
     uint8_t *inPayload = (uint8_t *)recordHandle->extensionList[EXinPayloadID];
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-    String_Payload(stream, inPayload, genericFlow);
+    streamPtr = String_Payload(streamPtr, inPayload, genericFlow);
+
+    return streamPtr;
 }  // End of String_inPayload
 
-static void String_outPayload(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_outPayload(char *streamPtr, recordHandle_t *recordHandle) {
     uint8_t *outPayload = (uint8_t *)recordHandle->extensionList[EXoutPayloadID];
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-    String_Payload(stream, outPayload, genericFlow);
+    streamPtr = String_Payload(streamPtr, outPayload, genericFlow);
+
+    return streamPtr;
 }  // End of String_outPayload
 
-static void String_nbarID(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_nbarID(char *streamPtr, recordHandle_t *recordHandle) {
     uint8_t *nbar = (uint8_t *)recordHandle->extensionList[EXnbarAppID];
 
     union {
@@ -1069,8 +1224,8 @@ static void String_nbarID(FILE *stream, recordHandle_t *recordHandle) {
     } pen;
 
     if (nbar == NULL) {
-        fprintf(stream, "0..0..0");
-        return;
+        AddString("0..0..0");
+        return streamPtr;
     }
 
     uint32_t nbarAppIDlen = ExtensionLength(nbar);
@@ -1086,7 +1241,7 @@ static void String_nbarID(FILE *stream, recordHandle_t *recordHandle) {
             selector = (selector << 8) | nbar[index];
             index++;
         }
-        fprintf(stream, "%2u..%u..%u", nbar[0], pen.val32, selector);
+        AddFormat("%2u..%u..%u", nbar[0], pen.val32, selector);
     } else {
         int selector = 0;
         int index = 1;
@@ -1094,17 +1249,18 @@ static void String_nbarID(FILE *stream, recordHandle_t *recordHandle) {
             selector = (selector << 8) | nbar[index];
             index++;
         }
-        fprintf(stream, "%2u..%u", nbar[0], selector);
+        AddFormat("%2u..%u", nbar[0], selector);
     }
 
+    return streamPtr;
 }  // End of String_nbarID
 
-static void String_nbarName(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_nbarName(char *streamPtr, recordHandle_t *recordHandle) {
     uint8_t *nbar = (uint8_t *)recordHandle->extensionList[EXnbarAppID];
 
     if (nbar == NULL) {
-        fprintf(stream, "<no nbar>");
-        return;
+        AddString("<no nbar>");
+        return streamPtr;
     }
 
     uint32_t nbarAppIDlen = ExtensionLength(nbar);
@@ -1112,92 +1268,71 @@ static void String_nbarName(FILE *stream, recordHandle_t *recordHandle) {
     if (name == NULL) {
         name = "<no info>";
     }
-    fprintf(stream, "%s", name);
+    AddString(name);
 
+    return streamPtr;
 }  // End of String_nbarName
 
-static void String_ja3(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ja3(char *streamPtr, recordHandle_t *recordHandle) {
     const uint8_t *payload = (uint8_t *)(recordHandle->extensionList[EXinPayloadID]);
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)(recordHandle->extensionList[EXgenericFlowID]);
     if (payload == NULL || genericFlow->proto != IPPROTO_TCP) {
-        fprintf(stream, "%38s", "no ja3");
-        return;
+        AddStringWidth("no ja3", 38);
+        return streamPtr;
     }
 
-    char *ja3 = recordHandle->extensionList[JA3index];
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
-    if (ja3 == NULL) {
-        if (ssl == NULL) {
-            uint32_t payloadLength = ExtensionLength(payload);
-            ssl = sslProcess(payload, payloadLength);
-            recordHandle->extensionList[SSLindex] = ssl;
-        }
-        ja3 = ja3Process(ssl, NULL);
-        recordHandle->extensionList[JA3index] = ja3;
-        if (ssl == NULL || ja3 == NULL) {
-            fprintf(stream, "%38s", "no ja3");
-            return;
-        }
+    char *ja3 = GetRecordJA3(recordHandle);
+    ssl_t *ssl = GetRecordSSL(recordHandle);
+    if (ssl == NULL || ja3 == NULL) {
+        AddStringWidth("no ja3", 38);
+        return streamPtr;
     }
 
     if (ssl->type == CLIENTssl)
-        fprintf(stream, "ja3 : %32s", ja3);
+        AddFormat("ja3 : %32s", ja3);
     else
-        fprintf(stream, "ja3s: %32s", ja3);
+        AddFormat("ja3s: %32s", ja3);
 
+    return streamPtr;
 }  // End of String_ja3
 
-static void String_ja4(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ja4(char *streamPtr, recordHandle_t *recordHandle) {
     const uint8_t *payload = (const uint8_t *)recordHandle->extensionList[EXinPayloadID];
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     if (payload == NULL || genericFlow->proto != IPPROTO_TCP) {
-        fprintf(stream, "%38s", "no ja4");
-        return;
+        AddStringWidth("no ja4", 38);
+        return streamPtr;
     }
 
-    ja4_t *ja4 = recordHandle->extensionList[JA4index];
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
+    ja4_t *ja4 = GetRecordJA4(recordHandle);
     if (ja4 == NULL) {
-        if (ssl == NULL) {
-            uint32_t payloadLength = ExtensionLength(payload);
-            ssl = sslProcess(payload, payloadLength);
-            recordHandle->extensionList[SSLindex] = ssl;
-        }
-        ja4 = ja4Process(ssl, genericFlow->proto);
-        recordHandle->extensionList[JA4index] = ja4;
-        if (ssl == NULL || ja4 == NULL) {
-            fprintf(stream, "%38s", "no ja4");
-            return;
-        }
+        AddStringWidth("no ja4", 38);
+        return streamPtr;
     }
 
     // ja4 is defined
     if (ja4->type == TYPE_JA4) {
-        fprintf(stream, "ja4 : %32s", ja4->string);
+        AddFormat("ja4 : %32s", ja4->string);
     } else {
-        fprintf(stream, "ja4s: %32s", ja4->string);
+        AddFormat("ja4s: %32s", ja4->string);
     }
 
+    return streamPtr;
 }  // End of String_ja4
 
-static void String_tlsVersion(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_tlsVersion(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     const uint8_t *payload = (const uint8_t *)recordHandle->extensionList[EXinPayloadID];
 
     if (payload == NULL || genericFlow->proto != IPPROTO_TCP) {
-        fprintf(stream, "   0");
-        return;
+        AddString("   0");
+        return streamPtr;
     }
 
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
+    ssl_t *ssl = GetRecordSSL(recordHandle);
     if (ssl == NULL) {
-        uint32_t payloadLength = ExtensionLength(payload);
-        ssl = sslProcess(payload, payloadLength);
-        recordHandle->extensionList[SSLindex] = ssl;
-        if (ssl == NULL) {
-            fprintf(stream, "   0");
-            return;
-        }
+        AddString("   0");
+        return streamPtr;
     }
 
     /*
@@ -1213,65 +1348,69 @@ static void String_tlsVersion(FILE *stream, recordHandle_t *recordHandle) {
     // ssl is defined
     switch (ssl->tlsCharVersion[0]) {
         case 0:
-            fprintf(stream, "     0");
+            AddString("     0");
             break;
         case 's':
-            fprintf(stream, "SSL %c  ", ssl->tlsCharVersion[1]);
+            AddFormat("SSL %c  ", ssl->tlsCharVersion[1]);
             break;
         case '1':
-            fprintf(stream, "TLS 1.%c", ssl->tlsCharVersion[1]);
+            AddFormat("TLS 1.%c", ssl->tlsCharVersion[1]);
             break;
         default:
-            fprintf(stream, "0x%4x", ssl->tlsVersion);
+            AddFormat("0x%4x", ssl->tlsVersion);
             break;
     }
 
+    return streamPtr;
 }  // End of String_tlsVersion
 
-static void String_sniName(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_sniName(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     const uint8_t *payload = (const uint8_t *)recordHandle->extensionList[EXinPayloadID];
 
     if (payload == NULL || genericFlow->proto != IPPROTO_TCP) {
-        fprintf(stream, "   0");
-        return;
+        AddString("   0");
+        return streamPtr;
     }
 
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
+    ssl_t *ssl = GetRecordSSL(recordHandle);
     if (ssl == NULL) {
-        uint32_t payloadLength = ExtensionLength(payload);
-        ssl = sslProcess(payload, payloadLength);
-        recordHandle->extensionList[SSLindex] = ssl;
-        if (ssl == NULL) {
-            fprintf(stream, "   0");
-            return;
-        }
+        AddString("   0");
+        return streamPtr;
     }
 
     // ssl is defined
-    fprintf(stream, "%6s", ssl != NULL ? ssl->sniName : "");
+    AddStringWidth(ssl != NULL ? ssl->sniName : "", 6);
 
+    return streamPtr;
 }  // End of String_sniName
 
-static void String_observationDomainID(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_observationDomainID(char *streamPtr, recordHandle_t *recordHandle) {
     EXobservation_t *observation = (EXobservation_t *)recordHandle->extensionList[EXobservationID];
     if (observation)
-        fprintf(stream, "0x%09x", observation->domainID);
+        AddFormat("0x%09x", observation->domainID);
     else
-        fprintf(stream, "0x00");
+        AddString("0x00");
+
+    return streamPtr;
 }  // End of String_observationDomainID
 
-static void String_observationPointID(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_observationPointID(char *streamPtr, recordHandle_t *recordHandle) {
     EXobservation_t *observation = (EXobservation_t *)recordHandle->extensionList[EXobservationID];
     if (observation)
-        fprintf(stream, "0x%010llx", (long long unsigned)observation->pointID);
+        AddFormat("0x%010llx", (long long unsigned)observation->pointID);
     else
-        fprintf(stream, "0x00");
+        AddString("0x00");
+
+    return streamPtr;
 }  // End of String_observationPointID
 
-static void String_NewLine(FILE *stream, recordHandle_t *recordHandle) { fprintf(stream, "\n"); }  // End of String_NewLine
+static char *String_NewLine(char *streamPtr, recordHandle_t *recordHandle) {
+    AddChar('\n');
+    return streamPtr;
+}  // End of String_NewLine
 
-static void String_EventTime(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_EventTime(char *streamPtr, recordHandle_t *recordHandle) {
     EXnselCommon_t *nselCommon = (EXnselCommon_t *)recordHandle->extensionList[EXnselCommonID];
     EXnatCommon_t *natCommon = (EXnatCommon_t *)recordHandle->extensionList[EXnatCommonID];
 
@@ -1282,52 +1421,49 @@ static void String_EventTime(FILE *stream, recordHandle_t *recordHandle) {
         msecEvent = natCommon->msecEvent;
 
     if (msecEvent) {
-        time_t tt = msecEvent / 1000LL;
-        struct tm ts;
-        localtime_r(&tt, &ts);
-        char s[128];
-        strftime(s, 128, "%Y-%m-%d %H:%M:%S", &ts);
-        s[127] = '\0';
-        fprintf(stream, "%s.%03llu", s, msecEvent % 1000LL);
+        streamPtr = msec_ntoa(msecEvent, 0, ' ', streamPtr);
     } else {
-        fprintf(stream, "%s", "0000-00-00 00:00:00.000");
+        AddString("0000-00-00 00:00:00.000");
     }
 
+    return streamPtr;
 }  // End of String_EventTime
 
-static void String_Duration(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Duration(char *streamPtr, recordHandle_t *recordHandle) {
     if (printPlain) {
-        fprintf(stream, "%16.3f", duration);
+        AddFormat("%16.3f", duration);
     } else {
         char *s = DurationString(duration);
-        fprintf(stream, "%s", s);
+        AddString(s);
     }
+
+    return streamPtr;
 }  // End of String_Duration
 
-static void String_Duration_Seconds(FILE *stream, recordHandle_t *recordHandle) {
-    fprintf(stream, "%16.3f", duration);
+static char *String_Duration_Seconds(char *streamPtr, recordHandle_t *recordHandle) {
+    AddFormat("%16.3f", duration);
+
+    return streamPtr;
 }  // End of String_Duration_Seconds
 
-static void String_Protocol(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Protocol(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint8_t proto = genericFlow ? genericFlow->proto : 0;
-    fprintf(stream, "%-5s", ProtoString(proto, printPlain));
+    AddStringWidth(ProtoString(proto, printPlain), -5);
+
+    return streamPtr;
 }  // End of String_Protocol
 
-static void String_SrcAddr(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcAddr(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->srcAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->srcAddr, tmp_str);
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->srcAddr[0]);
-        ip[1] = htonll(ipv6Flow->srcAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->srcAddr, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1336,28 +1472,23 @@ static void String_SrcAddr(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%*s", tag_string, 39, tmp_str);
-    else
-        fprintf(stream, "%s%*s", tag_string, 16, tmp_str);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
 
+    return streamPtr;
 }  // End of String_SrcAddr
 
-static void String_SrcGeoAddr(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcGeoAddr(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->srcAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->srcAddr, tmp_str);
         if (recordHandle->geo[0] == '\0') LookupV4Country(ipv4Flow->srcAddr, recordHandle->geo);
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->srcAddr[0]);
-        ip[1] = htonll(ipv6Flow->srcAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->srcAddr, tmp_str);
         if (recordHandle->geo[0] == '\0') LookupV6Country(ipv6Flow->srcAddr, recordHandle->geo);
         if (!long_v6) {
             CondenseV6(tmp_str);
@@ -1370,13 +1501,14 @@ static void String_SrcGeoAddr(FILE *stream, recordHandle_t *recordHandle) {
     tmp_str[IP_STRING_LEN - 1] = 0;
 
     if (long_v6)
-        fprintf(stream, "%s%39s(%c%c)", tag_string, tmp_str, recordHandle->geo[0], recordHandle->geo[1]);
+        AddFormat("%s%39s(%c%c)", tag_string, tmp_str, recordHandle->geo[0], recordHandle->geo[1]);
     else
-        fprintf(stream, "%s%16s(%c%c)", tag_string, tmp_str, recordHandle->geo[0], recordHandle->geo[1]);
+        AddFormat("%s%16s(%c%c)", tag_string, tmp_str, recordHandle->geo[0], recordHandle->geo[1]);
 
+    return streamPtr;
 }  // End of String_SrcGeoAddr
 
-static void String_SrcAddrPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcAddrPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
@@ -1386,14 +1518,10 @@ static void String_SrcAddrPort(FILE *stream, recordHandle_t *recordHandle) {
     char portChar;
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->srcAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->srcAddr, tmp_str);
         portChar = ':';
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->srcAddr[0]);
-        ip[1] = htonll(ipv6Flow->srcAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->srcAddr, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1404,14 +1532,15 @@ static void String_SrcAddrPort(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s%c%-5i", tag_string, tmp_str, portChar, port);
-    else
-        fprintf(stream, "%s%16s%c%-5i", tag_string, tmp_str, portChar, port);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
+    AddChar(portChar);
+    AddU64Width(port, -5);
 
+    return streamPtr;
 }  // End of String_SrcAddrPort
 
-static void String_SrcAddrGeoPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcAddrGeoPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
@@ -1421,15 +1550,11 @@ static void String_SrcAddrGeoPort(FILE *stream, recordHandle_t *recordHandle) {
     char portChar;
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->srcAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->srcAddr, tmp_str);
         if (recordHandle->geo[0] == '\0') LookupV4Country(ipv4Flow->srcAddr, recordHandle->geo);
         portChar = ':';
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->srcAddr[0]);
-        ip[1] = htonll(ipv6Flow->srcAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->srcAddr, tmp_str);
         if (recordHandle->geo[0] == '\0') LookupV6Country(ipv6Flow->srcAddr, recordHandle->geo);
         if (!long_v6) {
             CondenseV6(tmp_str);
@@ -1444,26 +1569,23 @@ static void String_SrcAddrGeoPort(FILE *stream, recordHandle_t *recordHandle) {
     tmp_str[IP_STRING_LEN - 1] = 0;
 
     if (long_v6)
-        fprintf(stream, "%s%39s(%c%c)%c%-5i", tag_string, tmp_str, recordHandle->geo[0], recordHandle->geo[1], portChar, port);
+        AddFormat("%s%39s(%c%c)%c%-5i", tag_string, tmp_str, recordHandle->geo[0], recordHandle->geo[1], portChar, port);
     else
-        fprintf(stream, "%s%16s(%c%c)%c%-5i", tag_string, tmp_str, recordHandle->geo[0], recordHandle->geo[1], portChar, port);
+        AddFormat("%s%16s(%c%c)%c%-5i", tag_string, tmp_str, recordHandle->geo[0], recordHandle->geo[1], portChar, port);
 
+    return streamPtr;
 }  // End of String_SrcAddrGeoPort
 
-static void String_DstAddr(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstAddr(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->dstAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->dstAddr, tmp_str);
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->dstAddr[0]);
-        ip[1] = htonll(ipv6Flow->dstAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->dstAddr, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1472,28 +1594,23 @@ static void String_DstAddr(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s", tag_string, tmp_str);
-    else
-        fprintf(stream, "%s%16s", tag_string, tmp_str);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
 
+    return streamPtr;
 }  // End of String_DstAddr
 
-static void String_DstGeoAddr(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstGeoAddr(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->dstAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->dstAddr, tmp_str);
         if (recordHandle->geo[2] == '\0') LookupV4Country(ipv4Flow->dstAddr, &recordHandle->geo[2]);
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->dstAddr[0]);
-        ip[1] = htonll(ipv6Flow->dstAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->dstAddr, tmp_str);
         if (recordHandle->geo[2] == '\0') LookupV6Country(ipv6Flow->dstAddr, &recordHandle->geo[2]);
         if (!long_v6) {
             CondenseV6(tmp_str);
@@ -1506,13 +1623,14 @@ static void String_DstGeoAddr(FILE *stream, recordHandle_t *recordHandle) {
     tmp_str[IP_STRING_LEN - 1] = 0;
 
     if (long_v6)
-        fprintf(stream, "%s%39s(%c%c)", tag_string, tmp_str, recordHandle->geo[2], recordHandle->geo[3]);
+        AddFormat("%s%39s(%c%c)", tag_string, tmp_str, recordHandle->geo[2], recordHandle->geo[3]);
     else
-        fprintf(stream, "%s%16s(%c%c)", tag_string, tmp_str, recordHandle->geo[2], recordHandle->geo[3]);
+        AddFormat("%s%16s(%c%c)", tag_string, tmp_str, recordHandle->geo[2], recordHandle->geo[3]);
 
+    return streamPtr;
 }  // End of String_DstGeoAddr
 
-static void String_DstAddrPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstAddrPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
@@ -1521,14 +1639,10 @@ static void String_DstAddrPort(FILE *stream, recordHandle_t *recordHandle) {
     char portChar;
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->dstAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->dstAddr, tmp_str);
         portChar = ':';
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->dstAddr[0]);
-        ip[1] = htonll(ipv6Flow->dstAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->dstAddr, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1539,14 +1653,15 @@ static void String_DstAddrPort(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s%c%-5s", tag_string, tmp_str, portChar, ICMP_Port_decode(genericFlow));
-    else
-        fprintf(stream, "%s%16s%c%-5s", tag_string, tmp_str, portChar, ICMP_Port_decode(genericFlow));
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
+    AddChar(portChar);
+    AddStringWidth(ICMP_Port_decode(genericFlow), -5);
 
+    return streamPtr;
 }  // End of String_DstAddrPort
 
-static void String_DstAddrGeoPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstAddrGeoPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
@@ -1555,15 +1670,11 @@ static void String_DstAddrGeoPort(FILE *stream, recordHandle_t *recordHandle) {
     char portChar;
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = htonl(ipv4Flow->dstAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipv4Flow->dstAddr, tmp_str);
         if (recordHandle->geo[2] == '\0') LookupV4Country(ipv4Flow->dstAddr, &recordHandle->geo[2]);
         portChar = ':';
     } else if (ipv6Flow) {
-        uint64_t ip[2];
-        ip[0] = htonll(ipv6Flow->dstAddr[0]);
-        ip[1] = htonll(ipv6Flow->dstAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipv6Flow->dstAddr, tmp_str);
         if (recordHandle->geo[2] == '\0') LookupV6Country(ipv6Flow->dstAddr, &recordHandle->geo[2]);
         if (!long_v6) {
             CondenseV6(tmp_str);
@@ -1577,16 +1688,57 @@ static void String_DstAddrGeoPort(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s(%c%c)%c%-5s", tag_string, tmp_str, recordHandle->geo[2], recordHandle->geo[3], portChar,
-                ICMP_Port_decode(genericFlow));
-    else
-        fprintf(stream, "%s%16s(%c%c)%c%-5s", tag_string, tmp_str, recordHandle->geo[2], recordHandle->geo[3], portChar,
-                ICMP_Port_decode(genericFlow));
+    if (long_v6) {
+        AddFormat("%s%39s(%c%c)%c%-5s", tag_string, tmp_str, recordHandle->geo[2], recordHandle->geo[3], portChar,
+                  ICMP_Port_decode(genericFlow));
+    } else {
+        AddFormat("%s%16s(%c%c)%c%-5s", tag_string, tmp_str, recordHandle->geo[2], recordHandle->geo[3], portChar,
+                  ICMP_Port_decode(genericFlow));
+    }
 
+    return streamPtr;
 }  // End of String_DstAddrGeoPort
 
-static void String_SrcNet(FILE *stream, recordHandle_t *recordHandle) {
+// host name of an address - the address, if it has no name
+static char *HostString(char *streamPtr, EXipv4Flow_t *ipv4Flow, EXipv6Flow_t *ipv6Flow, int dst) {
+    char name[256];
+    int found = 0;
+    if (ipv4Flow) {
+        uint32_t ip = dst ? ipv4Flow->dstAddr : ipv4Flow->srcAddr;
+        found = RDNSLookupV4(ip, name, sizeof(name));
+        if (!found) ip4_ntoa(ip, name);
+    } else if (ipv6Flow) {
+        uint64_t *ip = dst ? ipv6Flow->dstAddr : ipv6Flow->srcAddr;
+        found = RDNSLookupV6(ip, name, sizeof(name));
+        if (!found) {
+            ip6_ntoa(ip, name);
+            if (!long_v6) CondenseV6(name);
+        }
+    } else {
+        strcpy(name, "0.0.0.0");
+    }
+
+    AddString(tag_string);
+    AddStringWidth(name, 32);
+
+    return streamPtr;
+}  // End of HostString
+
+static char *String_SrcHost(char *streamPtr, recordHandle_t *recordHandle) {
+    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
+    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
+
+    return HostString(streamPtr, ipv4Flow, ipv6Flow, 0);
+}  // End of String_SrcHost
+
+static char *String_DstHost(char *streamPtr, recordHandle_t *recordHandle) {
+    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
+    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
+
+    return HostString(streamPtr, ipv4Flow, ipv6Flow, 1);
+}  // End of String_DstHost
+
+static char *String_SrcNet(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
@@ -1595,14 +1747,11 @@ static void String_SrcNet(FILE *stream, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = ApplyV4NetMaskBits(ipv4Flow->srcAddr, srcMask);
-        ip = htonl(ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(MaskV4(ipv4Flow->srcAddr, srcMask), tmp_str);
     } else if (ipv6Flow) {
-        uint64_t *ip = ApplyV6NetMaskBits(ipv6Flow->srcAddr, srcMask);
-        ip[0] = htonll(ip[0]);
-        ip[1] = htonll(ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        uint64_t net[2];
+        MaskV6(ipv6Flow->srcAddr, srcMask, net);
+        ip6_ntoa(net, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1611,14 +1760,15 @@ static void String_SrcNet(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s/%-2u", tag_string, tmp_str, srcMask);
-    else
-        fprintf(stream, "%s%16s/%-2u", tag_string, tmp_str, srcMask);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
+    AddChar('/');
+    AddU64Width(srcMask, -2);
 
+    return streamPtr;
 }  // End of String_SrcNet
 
-static void String_DstNet(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstNet(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
@@ -1627,14 +1777,11 @@ static void String_DstNet(FILE *stream, recordHandle_t *recordHandle) {
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipv4Flow) {
-        uint32_t ip = ApplyV4NetMaskBits(ipv4Flow->dstAddr, dstMask);
-        ip = htonl(ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(MaskV4(ipv4Flow->dstAddr, dstMask), tmp_str);
     } else if (ipv6Flow) {
-        uint64_t *ip = ApplyV6NetMaskBits(ipv6Flow->dstAddr, dstMask);
-        ip[0] = htonll(ip[0]);
-        ip[1] = htonll(ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        uint64_t net[2];
+        MaskV6(ipv6Flow->dstAddr, dstMask, net);
+        ip6_ntoa(net, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1643,39 +1790,48 @@ static void String_DstNet(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s/%-2u", tag_string, tmp_str, dstMask);
-    else
-        fprintf(stream, "%s%16s/%-2u", tag_string, tmp_str, dstMask);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
+    AddChar('/');
+    AddU64Width(dstMask, -2);
 
+    return streamPtr;
 }  // End of String_DstNet
 
-static void String_SrcPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint16_t port = genericFlow ? genericFlow->srcPort : 0;
-    fprintf(stream, "%6u", port);
+    AddU64Width(port, 6);
+
+    return streamPtr;
 }  // End of String_SrcPort
 
-static void String_DstPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-    fprintf(stream, "%6s", ICMP_Port_decode(genericFlow));
+    AddStringWidth(ICMP_Port_decode(genericFlow), 6);
+
+    return streamPtr;
 }  // End of String_DstPort
 
-static void String_ICMP_type(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ICMP_type(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint16_t type = genericFlow ? genericFlow->icmpType : 0;
     // Force printing type regardless of protocol
-    fprintf(stream, "%6u", type);
+    AddU64Width(type, 6);
+
+    return streamPtr;
 }  // End of String_ICMP_type
 
-static void String_ICMP_code(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ICMP_code(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint16_t code = genericFlow ? genericFlow->icmpCode : 0;
     // Force printing code regardless of protocol
-    fprintf(stream, "%6u", code);
+    AddU64Width(code, 6);
+
+    return streamPtr;
 }  // End of String_ICMP_code
 
-static void String_SrcAS(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcAS(char *streamPtr, recordHandle_t *recordHandle) {
     EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle->extensionList[EXasRoutingID];
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
@@ -1688,10 +1844,12 @@ static void String_SrcAS(FILE *stream, recordHandle_t *recordHandle) {
         srcAS = LookupV6AS(ipv6Flow->srcAddr);
     }
 
-    fprintf(stream, "%6u", srcAS);
+    AddU64Width(srcAS, 6);
+
+    return streamPtr;
 }  // End of String_SrcAS
 
-static void String_DstAS(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstAS(char *streamPtr, recordHandle_t *recordHandle) {
     EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle->extensionList[EXasRoutingID];
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
@@ -1704,111 +1862,126 @@ static void String_DstAS(FILE *stream, recordHandle_t *recordHandle) {
         dstAS = LookupV6AS(ipv6Flow->dstAddr);
     }
 
-    fprintf(stream, "%6u", dstAS);
+    AddU64Width(dstAS, 6);
 
+    return streamPtr;
 }  // End of String_DstAS
 
-static void String_NextAS(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_NextAS(char *streamPtr, recordHandle_t *recordHandle) {
     EXasAdjacent_t *asAdjacent = (EXasAdjacent_t *)recordHandle->extensionList[EXasAdjacentID];
     uint32_t nextAS = asAdjacent ? asAdjacent->nextAdjacentAS : 0;
-    fprintf(stream, " %6u", nextAS);
+    AddChar(' ');
+    AddU64Width(nextAS, 6);
+
+    return streamPtr;
 }  // End of String_NextAS
 
-static void String_PrevAS(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_PrevAS(char *streamPtr, recordHandle_t *recordHandle) {
     EXasAdjacent_t *asAdjacent = (EXasAdjacent_t *)recordHandle->extensionList[EXasAdjacentID];
     uint32_t prevAS = asAdjacent ? asAdjacent->prevAdjacentAS : 0;
-    fprintf(stream, " %6u", prevAS);
+    AddChar(' ');
+    AddU64Width(prevAS, 6);
+
+    return streamPtr;
 }  // End of String_PrevAS
 
-static void String_Input(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Input(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t input = flowMisc ? flowMisc->input : 0;
-    fprintf(stream, "%6u", input);
+    AddU64Width(input, 6);
+
+    return streamPtr;
 }  // End of String_Input
 
-static void String_InputName(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_InputName(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t input = flowMisc ? flowMisc->input : 0;
     char ifName[128];
-    fprintf(stream, "%s", GetIfName(input, ifName, sizeof(ifName)));
+    AddString(GetIfName(input, ifName, sizeof(ifName)));
+
+    return streamPtr;
 }  // End of String_InputName
 
-static void String_Output(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Output(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t output = flowMisc ? flowMisc->output : 0;
-    fprintf(stream, "%6u", output);
+    AddU64Width(output, 6);
+
+    return streamPtr;
 }  // End of String_Output
 
-static void String_OutputName(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_OutputName(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t output = flowMisc ? flowMisc->output : 0;
     char ifName[128];
-    fprintf(stream, "%s", GetIfName(output, ifName, sizeof(ifName)));
+    AddString(GetIfName(output, ifName, sizeof(ifName)));
+
+    return streamPtr;
 }  // End of String_OutputName
 
-static void String_InPackets(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_InPackets(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint64_t packets = genericFlow ? genericFlow->inPackets : 0;
 
     numStr packetString;
     format_number(packets, packetString, printPlain, FIXED_WIDTH);
-    fprintf(stream, "%8s", packetString);
+    AddStringWidth(packetString, 8);
 
+    return streamPtr;
 }  // End of String_InPackets
 
-static void String_OutPackets(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_OutPackets(char *streamPtr, recordHandle_t *recordHandle) {
     EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
     uint64_t packets = cntFlow ? cntFlow->outPackets : 0;
 
     numStr packetString;
     format_number(packets, packetString, printPlain, FIXED_WIDTH);
-    fprintf(stream, "%8s", packetString);
+    AddStringWidth(packetString, 8);
 
+    return streamPtr;
 }  // End of String_OutPackets
 
-static void String_InBytes(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_InBytes(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint64_t bytes = genericFlow ? genericFlow->inBytes : 0;
 
     numStr byteString;
     format_number(bytes, byteString, printPlain, FIXED_WIDTH);
-    fprintf(stream, "%8s", byteString);
+    AddStringWidth(byteString, 8);
 
+    return streamPtr;
 }  // End of String_InBytes
 
-static void String_OutBytes(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_OutBytes(char *streamPtr, recordHandle_t *recordHandle) {
     EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
     uint64_t bytes = cntFlow ? cntFlow->outBytes : 0;
 
     numStr byteString;
     format_number(bytes, byteString, printPlain, FIXED_WIDTH);
-    fprintf(stream, "%8s", byteString);
+    AddStringWidth(byteString, 8);
 
+    return streamPtr;
 }  // End of String_OutBytes
 
-static void String_Flows(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Flows(char *streamPtr, recordHandle_t *recordHandle) {
     EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
     uint64_t flows = cntFlow ? cntFlow->flows : 1;
 
-    fprintf(stream, "%5llu", (unsigned long long)flows);
+    AddU64Width(flows, 5);
 
+    return streamPtr;
 }  // End of String_Flows
 
-static void String_NextHop(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_NextHop(char *streamPtr, recordHandle_t *recordHandle) {
     EXipNextHopV4_t *ipNextHopV4 = (EXipNextHopV4_t *)recordHandle->extensionList[EXipNextHopV4ID];
     EXipNextHopV6_t *ipNextHopV6 = (EXipNextHopV6_t *)recordHandle->extensionList[EXipNextHopV6ID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipNextHopV4) {
-        uint32_t ip = htonl(ipNextHopV4->ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipNextHopV4->ip, tmp_str);
     } else if (ipNextHopV6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(ipNextHopV6->ip[0]);
-        ip[1] = htonll(ipNextHopV6->ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipNextHopV6->ip, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1817,28 +1990,22 @@ static void String_NextHop(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s", tag_string, tmp_str);
-    else
-        fprintf(stream, "%s%16s", tag_string, tmp_str);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
 
+    return streamPtr;
 }  // End of String_NextHop
 
-static void String_BGPNextHop(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_BGPNextHop(char *streamPtr, recordHandle_t *recordHandle) {
     EXbgpNextHopV4_t *bgpNextHopV4 = (EXbgpNextHopV4_t *)recordHandle->extensionList[EXbgpNextHopV4ID];
     EXbgpNextHopV6_t *bgpNextHopV6 = (EXbgpNextHopV6_t *)recordHandle->extensionList[EXbgpNextHopV6ID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (bgpNextHopV4) {
-        uint32_t ip = htonl(bgpNextHopV4->ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(bgpNextHopV4->ip, tmp_str);
     } else if (bgpNextHopV6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(bgpNextHopV6->ip[0]);
-        ip[1] = htonll(bgpNextHopV6->ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(bgpNextHopV6->ip, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1847,28 +2014,22 @@ static void String_BGPNextHop(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s", tag_string, tmp_str);
-    else
-        fprintf(stream, "%s%16s", tag_string, tmp_str);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
 
+    return streamPtr;
 }  // End of String_BGPNextHop
 
-static void String_RouterIP(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_RouterIP(char *streamPtr, recordHandle_t *recordHandle) {
     EXipReceivedV4_t *ipReceivedV4 = (EXipReceivedV4_t *)recordHandle->extensionList[EXipReceivedV4ID];
     EXipReceivedV6_t *ipReceivedV6 = (EXipReceivedV6_t *)recordHandle->extensionList[EXipReceivedV6ID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (ipReceivedV4) {
-        uint32_t ip = htonl(ipReceivedV4->ip);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(ipReceivedV4->ip, tmp_str);
     } else if (ipReceivedV6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(ipReceivedV6->ip[0]);
-        ip[1] = htonll(ipReceivedV6->ip[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(ipReceivedV6->ip, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -1877,279 +2038,332 @@ static void String_RouterIP(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s", tag_string, tmp_str);
-    else
-        fprintf(stream, "%s%16s", tag_string, tmp_str);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
 
+    return streamPtr;
 }  // End of String_RouterIP
 
-static void String_Tos(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Tos(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint32_t srcTos = genericFlow ? genericFlow->srcTos : 0;
 
-    fprintf(stream, "%4u", srcTos);
+    AddU64Width(srcTos, 4);
+
+    return streamPtr;
 }  // End of String_Tos
 
-static void String_SrcTos(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcTos(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint32_t srcTos = genericFlow ? genericFlow->srcTos : 0;
 
-    fprintf(stream, "%4u", srcTos);
+    AddU64Width(srcTos, 4);
+
+    return streamPtr;
 }  // End of String_SrcTos
 
-static void String_DstTos(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstTos(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t dstTos = flowMisc ? flowMisc->dstTos : 0;
 
-    fprintf(stream, "%4u", dstTos);
+    AddU64Width(dstTos, 4);
+
+    return streamPtr;
 }  // End of String_DstTos
 
-static void String_SrcMask(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcMask(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t srcMask = flowMisc ? flowMisc->srcMask : 0;
 
-    fprintf(stream, "%5u", srcMask);
+    AddU64Width(srcMask, 5);
+
+    return streamPtr;
 }  // End of String_SrcMask
 
-static void String_DstMask(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstMask(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t dstMask = flowMisc ? flowMisc->dstMask : 0;
 
-    fprintf(stream, "%5u", dstMask);
+    AddU64Width(dstMask, 5);
+
+    return streamPtr;
 }  // End of String_DstMask
 
-static void String_SrcVlan(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcVlan(char *streamPtr, recordHandle_t *recordHandle) {
     EXvLan_t *vLan = (EXvLan_t *)recordHandle->extensionList[EXvLanID];
     uint32_t srcVlan = vLan ? vLan->srcVlan : 0;
 
-    fprintf(stream, "%5u", srcVlan);
+    AddU64Width(srcVlan, 5);
+
+    return streamPtr;
 }  // End of String_SrcVlan
 
-static void String_DstVlan(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstVlan(char *streamPtr, recordHandle_t *recordHandle) {
     EXvLan_t *vLan = (EXvLan_t *)recordHandle->extensionList[EXvLanID];
     uint32_t dstVlan = vLan ? vLan->dstVlan : 0;
 
-    fprintf(stream, "%5u", dstVlan);
+    AddU64Width(dstVlan, 5);
+
+    return streamPtr;
 }  // End of String_DstVlan
 
-static void String_Dir(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Dir(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t dir = flowMisc ? flowMisc->dir : 0;
 
-    fprintf(stream, "%3c", dir ? 'E' : 'I');
+    AddFormat("%3c", dir ? 'E' : 'I');
+
+    return streamPtr;
 }  // End of String_Dir
 
-static void String_FwdStatus(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_FwdStatus(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint32_t fwdStatus = genericFlow ? genericFlow->fwdStatus : 0;
 
-    fprintf(stream, "%3u", fwdStatus);
+    AddU64Width(fwdStatus, 3);
+
+    return streamPtr;
 }  // End of String_FwdStatus
 
-static void String_BiFlowDir(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_BiFlowDir(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t biFlowDir = flowMisc ? flowMisc->biFlowDir : 0;
 
-    fprintf(stream, "%3u", biFlowDir);
+    AddU64Width(biFlowDir, 3);
+
+    return streamPtr;
 }  // End of String_BiFlowDir
 
-static void String_FlowEndReason(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_FlowEndReason(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle->extensionList[EXflowMiscID];
     uint32_t flowEndReason = flowMisc ? flowMisc->flowEndReason : 0;
 
-    fprintf(stream, "%3u", flowEndReason);
+    AddU64Width(flowEndReason, 3);
+
+    return streamPtr;
 }  // End of String_FlowEndReason
 
-static void String_ipTTL(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ipTTL(char *streamPtr, recordHandle_t *recordHandle) {
     EXipInfo_t *ipInfo = (EXipInfo_t *)recordHandle->extensionList[EXipInfoID];
     uint8_t ttl = ipInfo ? ipInfo->ttl : 0;
 
-    fprintf(stream, "%3u", ttl);
+    AddU64Width(ttl, 3);
+
+    return streamPtr;
 }  // End of String_ipTTL
 
-static void String_ipFrag(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ipFrag(char *streamPtr, recordHandle_t *recordHandle) {
     EXipInfo_t *ipInfo = (EXipInfo_t *)recordHandle->extensionList[EXipInfoID];
     EXipInfo_t localIpInfo = {0};
     if (ipInfo == NULL) ipInfo = &localIpInfo;
 
     char *DF = ipInfo->fragmentFlags & flagDF ? "DF" : "--";
     char *MF = ipInfo->fragmentFlags & flagMF ? "MF" : "--";
-    fprintf(stream, "%s%s", DF, MF);
+    AddFormat("%s%s", DF, MF);
+
+    return streamPtr;
 }  // End of String_ipFrag
 
-static void String_Flags(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_Flags(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint32_t flags = genericFlow && genericFlow->proto == IPPROTO_TCP ? genericFlow->tcpFlags : 0;
 
-    fprintf(stream, "%8s", FlagsString(flags));
+    AddStringWidth(FlagsString(flags), 8);
 
+    return streamPtr;
 }  // End of String_Flags
 
-static void printMacAddr(FILE *stream, uint64_t macAddr) {
+static char *printMacAddr(char *streamPtr, uint64_t macAddr) {
     uint8_t mac[6];
     for (int i = 0; i < 6; i++) {
         mac[i] = (macAddr >> (i * 8)) & 0xFF;
     }
-    fprintf(stream, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x", mac[5], mac[4], mac[3], mac[2], mac[1], mac[0]);
+    AddFormat("%.2x:%.2x:%.2x:%.2x:%.2x:%.2x", mac[5], mac[4], mac[3], mac[2], mac[1], mac[0]);
 
+    return streamPtr;
 }  // End of printMacAddr
 
-static void String_InSrcMac(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_InSrcMac(char *streamPtr, recordHandle_t *recordHandle) {
     EXmacAddr_t *macAddr = (EXmacAddr_t *)recordHandle->extensionList[EXmacAddrID];
     uint64_t mac = macAddr ? macAddr->inSrcMac : 0;
 
-    printMacAddr(stream, mac);
+    streamPtr = printMacAddr(streamPtr, mac);
+
+    return streamPtr;
 }  // End of String_InSrcMac
 
-static void String_OutDstMac(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_OutDstMac(char *streamPtr, recordHandle_t *recordHandle) {
     EXmacAddr_t *macAddr = (EXmacAddr_t *)recordHandle->extensionList[EXmacAddrID];
     uint64_t mac = macAddr ? macAddr->outDstMac : 0;
 
-    printMacAddr(stream, mac);
+    streamPtr = printMacAddr(streamPtr, mac);
+
+    return streamPtr;
 }  // End of String_OutDstMac
 
-static void String_InDstMac(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_InDstMac(char *streamPtr, recordHandle_t *recordHandle) {
     EXmacAddr_t *macAddr = (EXmacAddr_t *)recordHandle->extensionList[EXmacAddrID];
     uint64_t mac = macAddr ? macAddr->inDstMac : 0;
 
-    printMacAddr(stream, mac);
+    streamPtr = printMacAddr(streamPtr, mac);
+
+    return streamPtr;
 }  // End of String_InDstMac
 
-static void String_OutSrcMac(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_OutSrcMac(char *streamPtr, recordHandle_t *recordHandle) {
     EXmacAddr_t *macAddr = (EXmacAddr_t *)recordHandle->extensionList[EXmacAddrID];
     uint64_t mac = macAddr ? macAddr->outSrcMac : 0;
 
-    printMacAddr(stream, mac);
+    streamPtr = printMacAddr(streamPtr, mac);
+
+    return streamPtr;
 }  // End of String_OutSrcMac
 
-static void String_MPLS_1(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_1(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[0] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_2(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_2(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[1] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_3(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_3(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[2] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_4(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_4(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[3] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_5(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_5(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[4] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_6(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_6(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[5] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_7(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_7(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[6] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_8(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_8(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[7] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_9(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_9(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[8] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLS_10(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLS_10(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label = mplsLabel ? mplsLabel->mplsLabel[9] : 0;
 
-    fprintf(stream, "%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
+    AddFormat("%8u-%1u-%1u", label >> 4, (label & 0xF) >> 1, label & 1);
 
+    return streamPtr;
 }  // End of String_MPLS
 
-static void String_MPLSs(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_MPLSs(char *streamPtr, recordHandle_t *recordHandle) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)recordHandle->extensionList[EXmplsLabelID];
     uint32_t label[10] = {0};
     if (mplsLabel) memcpy((void *)label, (void *)mplsLabel->mplsLabel, sizeof(label));
 
-    fprintf(stream,
-            "%8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u "
-            "%8u-%1u-%1u %8u-%1u-%1u ",
-            label[0] >> 4, (label[0] & 0xF) >> 1, label[0] & 1, label[1] >> 4, (label[1] & 0xF) >> 1, label[1] & 1, label[2] >> 4,
-            (label[2] & 0xF) >> 1, label[2] & 1, label[3] >> 4, (label[3] & 0xF) >> 1, label[3] & 1, label[4] >> 4, (label[4] & 0xF) >> 1,
-            label[4] & 1, label[5] >> 4, (label[5] & 0xF) >> 1, label[5] & 1, label[6] >> 4, (label[6] & 0xF) >> 1, label[6] & 1, label[7] >> 4,
-            (label[7] & 0xF) >> 1, label[7] & 1, label[8] >> 4, (label[8] & 0xF) >> 1, label[8] & 1, label[9] >> 4, (label[9] & 0xF) >> 1,
-            label[9] & 1);
+    AddFormat("%8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u %8u-%1u-%1u "
+              "%8u-%1u-%1u %8u-%1u-%1u ",
+              label[0] >> 4, (label[0] & 0xF) >> 1, label[0] & 1, label[1] >> 4, (label[1] & 0xF) >> 1, label[1] & 1, label[2] >> 4,
+              (label[2] & 0xF) >> 1, label[2] & 1, label[3] >> 4, (label[3] & 0xF) >> 1, label[3] & 1, label[4] >> 4, (label[4] & 0xF) >> 1,
+              label[4] & 1, label[5] >> 4, (label[5] & 0xF) >> 1, label[5] & 1, label[6] >> 4, (label[6] & 0xF) >> 1, label[6] & 1, label[7] >> 4,
+              (label[7] & 0xF) >> 1, label[7] & 1, label[8] >> 4, (label[8] & 0xF) >> 1, label[8] & 1, label[9] >> 4, (label[9] & 0xF) >> 1,
+              label[9] & 1);
 
+    return streamPtr;
 }  // End of String_MPLSs
 
-static void String_Engine(FILE *stream, recordHandle_t *recordHandle) {
-    fprintf(stream, "%3u/%-3u", recordHandle->recordHeaderV3->engineType, recordHandle->recordHeaderV3->engineID);
+static char *String_Engine(char *streamPtr, recordHandle_t *recordHandle) {
+    AddFormat("%3u/%-3u", recordHandle->recordHeaderV3->engineType, recordHandle->recordHeaderV3->engineID);
+
+    return streamPtr;
 }  // End of String_Engine
 
-static void String_Label(FILE *stream, recordHandle_t *recordHandle) { fprintf(stream, "%16s", "<none>"); }  // End of String_Label
+static char *String_Label(char *streamPtr, recordHandle_t *recordHandle) {
+    AddStringWidth("<none>", 16);
+    return streamPtr;
+}  // End of String_Label
 
-static void String_ClientLatency(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ClientLatency(char *streamPtr, recordHandle_t *recordHandle) {
     EXlatency_t *latency = (EXlatency_t *)recordHandle->extensionList[EXlatencyID];
     double msecLatency = latency ? (double)latency->usecClientNwDelay / 1000.0 : 0.0;
 
-    fprintf(stream, "%9.3f", msecLatency);
+    AddFormat("%9.3f", msecLatency);
 
+    return streamPtr;
 }  // End of String_ClientLatency
 
-static void String_ServerLatency(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ServerLatency(char *streamPtr, recordHandle_t *recordHandle) {
     EXlatency_t *latency = (EXlatency_t *)recordHandle->extensionList[EXlatencyID];
     double msecLatency = latency ? (double)latency->usecServerNwDelay / 1000.0 : 0.0;
 
-    fprintf(stream, "%9.3f", msecLatency);
+    AddFormat("%9.3f", msecLatency);
 
+    return streamPtr;
 }  // End of String_ServerLatency
 
-static void String_AppLatency(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_AppLatency(char *streamPtr, recordHandle_t *recordHandle) {
     EXlatency_t *latency = (EXlatency_t *)recordHandle->extensionList[EXlatencyID];
     double msecLatency = latency ? (double)latency->usecApplLatency / 1000.0 : 0.0;
 
-    fprintf(stream, "%9.3f", msecLatency);
+    AddFormat("%9.3f", msecLatency);
 
+    return streamPtr;
 }  // End of String_AppLatency
 
-static void String_bps(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_bps(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint64_t inBytes = genericFlow ? genericFlow->inBytes : 0;
 
@@ -2160,11 +2374,12 @@ static void String_bps(FILE *stream, recordHandle_t *recordHandle) {
 
     numStr bpsString;
     format_number(bps, bpsString, printPlain, FIXED_WIDTH);
-    fprintf(stream, "%8s", bpsString);
+    AddStringWidth(bpsString, 8);
 
+    return streamPtr;
 }  // End of String_bps
 
-static void String_pps(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_pps(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint64_t inPackets = genericFlow ? genericFlow->inPackets : 0;
 
@@ -2175,11 +2390,12 @@ static void String_pps(FILE *stream, recordHandle_t *recordHandle) {
 
     numStr ppsString;
     format_number(pps, ppsString, printPlain, FIXED_WIDTH);
-    fprintf(stream, "%8s", ppsString);
+    AddStringWidth(ppsString, 8);
 
+    return streamPtr;
 }  // End of String_Duration
 
-static void String_bpp(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_bpp(char *streamPtr, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     uint64_t inPackets = genericFlow ? genericFlow->inPackets : 0;
     uint64_t inBytes = genericFlow ? genericFlow->inBytes : 0;
@@ -2187,15 +2403,65 @@ static void String_bpp(FILE *stream, recordHandle_t *recordHandle) {
     uint32_t Bpp = 0;
     if (inPackets) Bpp = inBytes / inPackets;  // Bytes per Packet
 
-    fprintf(stream, "%6u", Bpp);
+    AddU64Width(Bpp, 6);
 
+    return streamPtr;
 }  // End of String_bpp
 
-static void String_ExpSysID(FILE *stream, recordHandle_t *recordHandle) {
-    fprintf(stream, "%6u", recordHandle->recordHeaderV3->exporterID);
+static char *String_Quantile(char *streamPtr, recordHandle_t *recordHandle, int metric, double q) {
+    uint64_t value = LogHistoQuantile(recordHandle->histo[metric], q);
+    if (metric == HISTO_DURATION) {
+        AddFormat("%14.3f", (double)value / 1000.0);
+    } else {
+        AddU64Width(value, metric == HISTO_BPP ? 7 : 11);
+    }
+
+    return streamPtr;
+}  // End of String_Quantile
+
+static char *String_P50Duration(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_DURATION, 0.50);
+}  // End of String_P50Duration
+
+static char *String_P95Duration(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_DURATION, 0.95);
+}  // End of String_P95Duration
+
+static char *String_P99Duration(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_DURATION, 0.99);
+}  // End of String_P99Duration
+
+static char *String_P50Bpp(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_BPP, 0.50);
+}  // End of String_P50Bpp
+
+static char *String_P95Bpp(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_BPP, 0.95);
+}  // End of String_P95Bpp
+
+static char *String_P99Bpp(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_BPP, 0.99);
+}  // End of String_P99Bpp
+
+static char *String_P50Latency(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_LATENCY, 0.50);
+}  // End of String_P50Latency
+
+static char *String_P95Latency(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_LATENCY, 0.95);
+}  // End of String_P95Latency
+
+static char *String_P99Latency(char *streamPtr, recordHandle_t *recordHandle) {
+    return String_Quantile(streamPtr, recordHandle, HISTO_LATENCY, 0.99);
+}  // End of String_P99Latency
+
+static char *String_ExpSysID(char *streamPtr, recordHandle_t *recordHandle) {
+    AddU64Width(recordHandle->recordHeaderV3->exporterID, 6);
+
+    return streamPtr;
 }  // End of String_ExpSysID
 
-static void String_SrcCountry(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcCountry(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
@@ -2205,14 +2471,17 @@ static void String_SrcCountry(FILE *stream, recordHandle_t *recordHandle) {
         if (recordHandle->geo[0] == '\0') LookupV6Country(ipv6Flow->srcAddr, recordHandle->geo);
     }
 
-    if (recordHandle->geo[0])
-        fprintf(stream, "%c%c", recordHandle->geo[0], recordHandle->geo[1]);
-    else
-        fprintf(stream, "..");
+    if (recordHandle->geo[0]) {
+        AddChar(recordHandle->geo[0]);
+        AddChar(recordHandle->geo[1]);
+    } else {
+        AddString("..");
+    }
 
+    return streamPtr;
 }  // End of String_SrcCountry
 
-static void String_DstCountry(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstCountry(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
@@ -2222,14 +2491,17 @@ static void String_DstCountry(FILE *stream, recordHandle_t *recordHandle) {
         if (recordHandle->geo[2] == '\0') LookupV6Country(ipv6Flow->dstAddr, &recordHandle->geo[2]);
     }
 
-    if (recordHandle->geo[2])
-        fprintf(stream, "%c%c", recordHandle->geo[2], recordHandle->geo[3]);
-    else
-        fprintf(stream, "..");
+    if (recordHandle->geo[2]) {
+        AddChar(recordHandle->geo[2]);
+        AddChar(recordHandle->geo[3]);
+    } else {
+        AddString("..");
+    }
 
+    return streamPtr;
 }  // End of String_DstCountry
 
-static void String_SrcLocation(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcLocation(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
@@ -2242,13 +2514,14 @@ static void String_SrcLocation(FILE *stream, recordHandle_t *recordHandle) {
     }
 
     if (location[0])
-        fprintf(stream, "%s", location);
+        AddString(location);
     else
-        fprintf(stream, "<no location info>");
+        AddString("<no location info>");
 
+    return streamPtr;
 }  // End of String_SrcLocation
 
-static void String_DstLocation(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstLocation(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
@@ -2261,150 +2534,174 @@ static void String_DstLocation(FILE *stream, recordHandle_t *recordHandle) {
     }
 
     if (location[0])
-        fprintf(stream, "%s", location);
+        AddString(location);
     else
-        fprintf(stream, "<no location info>");
+        AddString("<no location info>");
 
+    return streamPtr;
 }  // End of String_DstLocation
 
-static void String_SrcASorganisation(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcASorganisation(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
     if (ipv4Flow) {
-        fprintf(stream, "%s", LookupV4ASorg(ipv4Flow->srcAddr));
+        AddString(LookupV4ASorg(ipv4Flow->srcAddr));
     } else if (ipv6Flow) {
-        fprintf(stream, "%s", LookupV6ASorg(ipv6Flow->srcAddr));
+        AddString(LookupV6ASorg(ipv6Flow->srcAddr));
     } else {
-        fprintf(stream, "%s", "none");
+        AddString("none");
     }
 
+    return streamPtr;
 }  // End of String_SrcASorganisation
 
-static void String_DstASorganisation(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_DstASorganisation(char *streamPtr, recordHandle_t *recordHandle) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
 
     if (ipv4Flow) {
-        fprintf(stream, "%s", LookupV4ASorg(ipv4Flow->dstAddr));
+        AddString(LookupV4ASorg(ipv4Flow->dstAddr));
     } else if (ipv6Flow) {
-        fprintf(stream, "%s", LookupV6ASorg(ipv6Flow->dstAddr));
+        AddString(LookupV6ASorg(ipv6Flow->dstAddr));
     } else {
-        fprintf(stream, "%s", "none");
+        AddString("none");
     }
 
+    return streamPtr;
 }  // End of String_DstASorganisation
 
-static void String_SrcTor(FILE *stream, recordHandle_t *recordHandle) {
-    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
-    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-    char torInfo[4];
-    if (ipv4Flow) {
-        LookupV4Tor(ipv4Flow->srcAddr, genericFlow->msecFirst, genericFlow->msecLast, torInfo);
-    } else {
-        LookupV6Tor(ipv6Flow->srcAddr, genericFlow->msecFirst, genericFlow->msecLast, torInfo);
-    }
-    fprintf(stream, "%4s", torInfo);
+static char *String_SrcTor(char *streamPtr, recordHandle_t *recordHandle) {
+    char *torInfo;
+    GetRecordTor(recordHandle, 0, &torInfo);
+    AddStringWidth(torInfo, 4);
 
+    return streamPtr;
 }  // End of String_SrcTor
 
-static void String_DstTor(FILE *stream, recordHandle_t *recordHandle) {
-    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
-    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-
-    char torInfo[4];
-    if (ipv4Flow) {
-        LookupV4Tor(ipv4Flow->dstAddr, genericFlow->msecFirst, genericFlow->msecLast, torInfo);
-    } else {
-        LookupV6Tor(ipv6Flow->dstAddr, genericFlow->msecFirst, genericFlow->msecLast, torInfo);
-    }
-    fprintf(stream, "%4s", torInfo);
+static char *String_DstTor(char *streamPtr, recordHandle_t *recordHandle) {
+    char *torInfo;
+    GetRecordTor(recordHandle, 1, &torInfo);
+    AddStringWidth(torInfo, 4);
 
+    return streamPtr;
 }  // End of String_DstTor
 
-static void String_ivrf(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_SrcLabel(char *streamPtr, recordHandle_t *recordHandle) {
+    const char *name = LabelName(GetRecordLabel(recordHandle, 0));
+    AddStringWidth(name ? name : "-", 16);
+
+    return streamPtr;
+}  // End of String_SrcLabel
+
+static char *String_DstLabel(char *streamPtr, recordHandle_t *recordHandle) {
+    const char *name = LabelName(GetRecordLabel(recordHandle, 1));
+    AddStringWidth(name ? name : "-", 16);
+
+    return streamPtr;
+}  // End of String_DstLabel
+
+static char *String_ivrf(char *streamPtr, recordHandle_t *recordHandle) {
     EXvrf_t *vrf = (EXvrf_t *)recordHandle->extensionList[EXvrfID];
     uint32_t ingress = vrf ? vrf->ingressVrf : 0;
 
-    fprintf(stream, "%10u", ingress);
+    AddU64Width(ingress, 10);
+
+    return streamPtr;
 }  // End of String_ivrf
 
-static void String_evrf(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_evrf(char *streamPtr, recordHandle_t *recordHandle) {
     EXvrf_t *vrf = (EXvrf_t *)recordHandle->extensionList[EXvrfID];
     uint32_t egress = vrf ? vrf->egressVrf : 0;
 
-    fprintf(stream, "%10u", egress);
+    AddU64Width(egress, 10);
+
+    return streamPtr;
 }  // End of String_evrf
 
-static void String_ivrfName(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_ivrfName(char *streamPtr, recordHandle_t *recordHandle) {
     EXvrf_t *vrf = (EXvrf_t *)recordHandle->extensionList[EXvrfID];
     uint32_t ingress = vrf ? vrf->ingressVrf : 0;
 
     char vrfName[128];
-    fprintf(stream, "%s", GetVrfName(ingress, vrfName, sizeof(vrfName)));
+    AddString(GetVrfName(ingress, vrfName, sizeof(vrfName)));
+
+    return streamPtr;
 }  // End of String_ivrfName
 
-static void String_evrfName(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_evrfName(char *streamPtr, recordHandle_t *recordHandle) {
     EXvrf_t *vrf = (EXvrf_t *)recordHandle->extensionList[EXvrfID];
     uint32_t egress = vrf ? vrf->egressVrf : 0;
 
     char vrfName[128];
-    fprintf(stream, "%s", GetVrfName(egress, vrfName, sizeof(vrfName)));
+    AddString(GetVrfName(egress, vrfName, sizeof(vrfName)));
+
+    return streamPtr;
 }  // End of String_evrfName
 
-static void String_pfIfName(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_pfIfName(char *streamPtr, recordHandle_t *recordHandle) {
     EXpfinfo_t *pfinfo = (EXpfinfo_t *)recordHandle->extensionList[EXpfinfoID];
 
-    fprintf(stream, "%9s", pfinfo ? pfinfo->ifname : "<no-pf>");
+    AddStringWidth(pfinfo ? pfinfo->ifname : "<no-pf>", 9);
+
+    return streamPtr;
 }  // End of String_pfIfName
 
-static void String_pfAction(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_pfAction(char *streamPtr, recordHandle_t *recordHandle) {
     EXpfinfo_t *pfinfo = (EXpfinfo_t *)recordHandle->extensionList[EXpfinfoID];
 
     if (pfinfo) {
-        fprintf(stream, "%6s", pfAction(pfinfo->action));
+        AddStringWidth(pfAction(pfinfo->action), 6);
     } else {
-        fprintf(stream, "<no-pf>");
+        AddString("<no-pf>");
     }
+
+    return streamPtr;
 }  // End of String_pfAction
 
-static void String_pfReason(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_pfReason(char *streamPtr, recordHandle_t *recordHandle) {
     EXpfinfo_t *pfinfo = (EXpfinfo_t *)recordHandle->extensionList[EXpfinfoID];
 
     if (pfinfo) {
-        fprintf(stream, "%6s", pfReason(pfinfo->reason));
+        AddStringWidth(pfReason(pfinfo->reason), 6);
     } else {
-        fprintf(stream, "<no-pf>");
+        AddString("<no-pf>");
     }
+
+    return streamPtr;
 }  // End of String_pfReason
 
-static void String_pfdir(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_pfdir(char *streamPtr, recordHandle_t *recordHandle) {
     EXpfinfo_t *pfinfo = (EXpfinfo_t *)recordHandle->extensionList[EXpfinfoID];
 
     if (pfinfo) {
-        fprintf(stream, "%3s", pfinfo->dir ? "in" : "out");
+        AddStringWidth(pfinfo->dir ? "in" : "out", 3);
     } else {
-        fprintf(stream, "<no pfinfo>");
+        AddString("<no pfinfo>");
     }
+
+    return streamPtr;
 }  // End of String_pfdir
 
-static void String_pfrule(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_pfrule(char *streamPtr, recordHandle_t *recordHandle) {
     EXpfinfo_t *pfinfo = (EXpfinfo_t *)recordHandle->extensionList[EXpfinfoID];
     uint32_t rulenr = pfinfo ? pfinfo->rulenr : 0;
 
-    fprintf(stream, "%4u", rulenr);
+    AddU64Width(rulenr, 4);
+
+    return streamPtr;
 }  // End of String_pfrule
 
-static void String_nfc(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_nfc(char *streamPtr, recordHandle_t *recordHandle) {
     EXnselCommon_t *nselCommon = (EXnselCommon_t *)recordHandle->extensionList[EXnselCommonID];
     uint32_t connID = nselCommon ? nselCommon->connID : 0;
 
-    fprintf(stream, "%10u", connID);
+    AddU64Width(connID, 10);
+
+    return streamPtr;
 }  // End of String_nfc
 
-static void String_evt(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_evt(char *streamPtr, recordHandle_t *recordHandle) {
     EXnselCommon_t *nselCommon = (EXnselCommon_t *)recordHandle->extensionList[EXnselCommonID];
     EXnatCommon_t *natCommon = (EXnatCommon_t *)recordHandle->extensionList[EXnatCommonID];
 
@@ -2415,7 +2712,7 @@ static void String_evt(FILE *stream, recordHandle_t *recordHandle) {
         } else if (natCommon) {
             evtNum = natCommon->natEvent;
         }
-        fprintf(stream, "%u", evtNum);
+        AddU64Width(evtNum, 0);
     } else {
         char *evtString = "<no-evt>";
         if (nselCommon) {
@@ -2423,66 +2720,66 @@ static void String_evt(FILE *stream, recordHandle_t *recordHandle) {
         } else if (natCommon) {
             evtString = natEventString(natCommon->natEvent, SHORTNAME);
         }
-        fprintf(stream, "%8s", evtString);
+        AddStringWidth(evtString, 8);
     }
 
+    return streamPtr;
 }  // End of String_evt
 
-static void String_xevt(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_xevt(char *streamPtr, recordHandle_t *recordHandle) {
     EXnselCommon_t *nselCommon = (EXnselCommon_t *)recordHandle->extensionList[EXnselCommonID];
 
     if (nselCommon) {
-        fprintf(stream, "%7s", fwXEventString(nselCommon->fwXevent));
+        AddStringWidth(fwXEventString(nselCommon->fwXevent), 7);
     } else {
-        fprintf(stream, "%7s", "<no-evt>");
+        AddStringWidth("<no-evt>", 7);
     }
 
+    return streamPtr;
 }  // End of String_xevt
 
-static void String_msecEvent(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_msecEvent(char *streamPtr, recordHandle_t *recordHandle) {
     EXnselCommon_t *nselCommon = (EXnselCommon_t *)recordHandle->extensionList[EXnselCommonID];
     EXnatCommon_t *natCommon = (EXnatCommon_t *)recordHandle->extensionList[EXnatCommonID];
     uint64_t msecEvent = nselCommon ? nselCommon->msecEvent : (natCommon ? natCommon->msecEvent : 0);
 
-    fprintf(stream, "%13llu", (long long unsigned)msecEvent);
+    AddU64Width(msecEvent, 13);
 
+    return streamPtr;
 }  // End of String_msecEvent
 
-static void String_iacl(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_iacl(char *streamPtr, recordHandle_t *recordHandle) {
     EXnselAcl_t *nselAcl = (EXnselAcl_t *)recordHandle->extensionList[EXnselAclID];
 
     if (nselAcl)
-        fprintf(stream, "0x%-8x 0x%-8x 0x%-8x", nselAcl->ingressAcl[0], nselAcl->ingressAcl[1], nselAcl->ingressAcl[2]);
+        AddFormat("0x%-8x 0x%-8x 0x%-8x", nselAcl->ingressAcl[0], nselAcl->ingressAcl[1], nselAcl->ingressAcl[2]);
     else
-        fprintf(stream, "0x%-8x 0x%-8x 0x%-8x", 0, 0, 0);
+        AddFormat("0x%-8x 0x%-8x 0x%-8x", 0, 0, 0);
 
+    return streamPtr;
 }  // End of String_iacl
 
-static void String_eacl(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_eacl(char *streamPtr, recordHandle_t *recordHandle) {
     EXnselAcl_t *nselAcl = (EXnselAcl_t *)recordHandle->extensionList[EXnselAclID];
 
     if (nselAcl)
-        fprintf(stream, "%10u %10u %10u", nselAcl->egressAcl[0], nselAcl->egressAcl[1], nselAcl->egressAcl[2]);
+        AddFormat("%10u %10u %10u", nselAcl->egressAcl[0], nselAcl->egressAcl[1], nselAcl->egressAcl[2]);
     else
-        fprintf(stream, "%10u %10u %10u", 0, 0, 0);
+        AddFormat("%10u %10u %10u", 0, 0, 0);
 
+    return streamPtr;
 }  // End of String_eacl
 
-static void String_xlateSrcAddr(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_xlateSrcAddr(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatXlateIPv4_t *natXlateIPv4 = (EXnatXlateIPv4_t *)recordHandle->extensionList[EXnatXlateIPv4ID];
     EXnatXlateIPv6_t *natXlateIPv6 = (EXnatXlateIPv6_t *)recordHandle->extensionList[EXnatXlateIPv6ID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (natXlateIPv4) {
-        uint32_t ip = htonl(natXlateIPv4->xlateSrcAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(natXlateIPv4->xlateSrcAddr, tmp_str);
     } else if (natXlateIPv6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(natXlateIPv6->xlateSrcAddr[0]);
-        ip[1] = htonll(natXlateIPv6->xlateSrcAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(natXlateIPv6->xlateSrcAddr, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -2491,28 +2788,22 @@ static void String_xlateSrcAddr(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s", tag_string, tmp_str);
-    else
-        fprintf(stream, "%s%16s", tag_string, tmp_str);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
 
+    return streamPtr;
 }  // End of String_xlateSrcAddr
 
-static void String_xlateDstAddr(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_xlateDstAddr(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatXlateIPv4_t *natXlateIPv4 = (EXnatXlateIPv4_t *)recordHandle->extensionList[EXnatXlateIPv4ID];
     EXnatXlateIPv6_t *natXlateIPv6 = (EXnatXlateIPv6_t *)recordHandle->extensionList[EXnatXlateIPv6ID];
 
     char tmp_str[IP_STRING_LEN];
     tmp_str[0] = 0;
     if (natXlateIPv4) {
-        uint32_t ip = htonl(natXlateIPv4->xlateDstAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(natXlateIPv4->xlateDstAddr, tmp_str);
     } else if (natXlateIPv6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(natXlateIPv6->xlateDstAddr[0]);
-        ip[1] = htonll(natXlateIPv6->xlateDstAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(natXlateIPv6->xlateDstAddr, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -2521,27 +2812,29 @@ static void String_xlateDstAddr(FILE *stream, recordHandle_t *recordHandle) {
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s", tag_string, tmp_str);
-    else
-        fprintf(stream, "%s%16s", tag_string, tmp_str);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
 
+    return streamPtr;
 }  // End of String_xlateDstAddr
 
-static void String_xlateSrcPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_xlateSrcPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatXlatePort_t *natXlatePort = (EXnatXlatePort_t *)recordHandle->extensionList[EXnatXlatePortID];
     uint16_t port = natXlatePort ? natXlatePort->xlateSrcPort : 0;
-    fprintf(stream, "%6u", port);
+    AddU64Width(port, 6);
+
+    return streamPtr;
 }  // End of String_xlateSrcPort
 
-static void String_xlateDstPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_xlateDstPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatXlatePort_t *natXlatePort = (EXnatXlatePort_t *)recordHandle->extensionList[EXnatXlatePortID];
     uint16_t port = natXlatePort ? natXlatePort->xlateDstPort : 0;
-    fprintf(stream, "%6u", port);
+    AddU64Width(port, 6);
 
+    return streamPtr;
 }  // End of String_xlateDstPort
 
-static void String_xlateSrcAddrPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_xlateSrcAddrPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatXlateIPv4_t *natXlateIPv4 = (EXnatXlateIPv4_t *)recordHandle->extensionList[EXnatXlateIPv4ID];
     EXnatXlateIPv6_t *natXlateIPv6 = (EXnatXlateIPv6_t *)recordHandle->extensionList[EXnatXlateIPv6ID];
     EXnatXlatePort_t *natXlatePort = (EXnatXlatePort_t *)recordHandle->extensionList[EXnatXlatePortID];
@@ -2551,15 +2844,10 @@ static void String_xlateSrcAddrPort(FILE *stream, recordHandle_t *recordHandle)
     char portChar;
     tmp_str[0] = 0;
     if (natXlateIPv4) {
-        uint32_t ip = htonl(natXlateIPv4->xlateSrcAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(natXlateIPv4->xlateSrcAddr, tmp_str);
         portChar = ':';
     } else if (natXlateIPv6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(natXlateIPv6->xlateSrcAddr[0]);
-        ip[1] = htonll(natXlateIPv6->xlateSrcAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(natXlateIPv6->xlateSrcAddr, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -2570,14 +2858,15 @@ static void String_xlateSrcAddrPort(FILE *stream, recordHandle_t *recordHandle)
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s%c%-5i", tag_string, tmp_str, portChar, port);
-    else
-        fprintf(stream, "%s%16s%c%-5i", tag_string, tmp_str, portChar, port);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
+    AddChar(portChar);
+    AddU64Width(port, -5);
 
+    return streamPtr;
 }  // End of String_xlateSrcAddrPort
 
-static void String_xlateDstAddrPort(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_xlateDstAddrPort(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatXlateIPv4_t *natXlateIPv4 = (EXnatXlateIPv4_t *)recordHandle->extensionList[EXnatXlateIPv4ID];
     EXnatXlateIPv6_t *natXlateIPv6 = (EXnatXlateIPv6_t *)recordHandle->extensionList[EXnatXlateIPv6ID];
     EXnatXlatePort_t *natXlatePort = (EXnatXlatePort_t *)recordHandle->extensionList[EXnatXlatePortID];
@@ -2587,15 +2876,10 @@ static void String_xlateDstAddrPort(FILE *stream, recordHandle_t *recordHandle)
     char portChar;
     tmp_str[0] = 0;
     if (natXlateIPv4) {
-        uint32_t ip = htonl(natXlateIPv4->xlateDstAddr);
-        inet_ntop(AF_INET, &ip, tmp_str, sizeof(tmp_str));
+        ip4_ntoa(natXlateIPv4->xlateDstAddr, tmp_str);
         portChar = ':';
     } else if (natXlateIPv6) {
-        uint64_t ip[2];
-
-        ip[0] = htonll(natXlateIPv6->xlateDstAddr[0]);
-        ip[1] = htonll(natXlateIPv6->xlateDstAddr[1]);
-        inet_ntop(AF_INET6, ip, tmp_str, sizeof(tmp_str));
+        ip6_ntoa(natXlateIPv6->xlateDstAddr, tmp_str);
         if (!long_v6) {
             CondenseV6(tmp_str);
         }
@@ -2606,60 +2890,78 @@ static void String_xlateDstAddrPort(FILE *stream, recordHandle_t *recordHandle)
     }
     tmp_str[IP_STRING_LEN - 1] = 0;
 
-    if (long_v6)
-        fprintf(stream, "%s%39s%c%-5i", tag_string, tmp_str, portChar, port);
-    else
-        fprintf(stream, "%s%16s%c%-5i", tag_string, tmp_str, portChar, port);
+    AddString(tag_string);
+    AddStringWidth(tmp_str, long_v6 ? 39 : 16);
+    AddChar(portChar);
+    AddU64Width(port, -5);
 
+    return streamPtr;
 }  // End of String_xlateDstAddrPort
 
-static void String_userName(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_userName(char *streamPtr, recordHandle_t *recordHandle) {
     EXnselUser_t *nselUser = (EXnselUser_t *)recordHandle->extensionList[EXnselUserID];
 
-    fprintf(stream, "%s", nselUser ? nselUser->username : "<empty>");
+    AddString(nselUser ? nselUser->username : "<empty>");
 
+    return streamPtr;
 }  // End of String_userName
 
-static void String_PortBlockStart(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_PortBlockStart(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatPortBlock_t *natPortBlock = (EXnatPortBlock_t *)recordHandle->extensionList[EXnatPortBlockID];
 
-    fprintf(stream, "%7u", natPortBlock ? natPortBlock->blockStart : 0);
+    AddU64Width(natPortBlock ? natPortBlock->blockStart : 0, 7);
+
+    return streamPtr;
 }  // End of String_PortBlockStart
 
-static void String_PortBlockEnd(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_PortBlockEnd(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatPortBlock_t *natPortBlock = (EXnatPortBlock_t *)recordHandle->extensionList[EXnatPortBlockID];
-    fprintf(stream, "%7u", natPortBlock ? natPortBlock->blockEnd : 0);
+    AddU64Width(natPortBlock ? natPortBlock->blockEnd : 0, 7);
+
+    return streamPtr;
 }  // End of String_PortBlockEnd
 
-static void String_PortBlockStep(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_PortBlockStep(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatPortBlock_t *natPortBlock = (EXnatPortBlock_t *)recordHandle->extensionList[EXnatPortBlockID];
-    fprintf(stream, "%7u", natPortBlock ? natPortBlock->blockStep : 0);
+    AddU64Width(natPortBlock ? natPortBlock->blockStep : 0, 7);
+
+    return streamPtr;
 }  // End of String_PortBlockStep
 
-static void String_PortBlockSize(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_PortBlockSize(char *streamPtr, recordHandle_t *recordHandle) {
     EXnatPortBlock_t *natPortBlock = (EXnatPortBlock_t *)recordHandle->extensionList[EXnatPortBlockID];
-    fprintf(stream, "%7u", natPortBlock ? natPortBlock->blockSize : 0);
+    AddU64Width(natPortBlock ? natPortBlock->blockSize : 0, 7);
+
+    return streamPtr;
 }  // End of String_PortBlockSize
 
-static void String_flowId(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_flowId(char *streamPtr, recordHandle_t *recordHandle) {
     EXflowId_t *flowId = (EXflowId_t *)recordHandle->extensionList[EXflowIdID];
-    fprintf(stream, "0x%13" PRIu64, flowId ? flowId->flowId : 0);
+    AddFormat("0x%13" PRIu64, flowId ? flowId->flowId : 0);
+
+    return streamPtr;
 }  // End of String_flowId
 
-static void String_inServiceID(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_inServiceID(char *streamPtr, recordHandle_t *recordHandle) {
     EXnokiaNat_t *nokiaNat = (EXnokiaNat_t *)recordHandle->extensionList[EXnokiaNatID];
 
-    fprintf(stream, "%8u", nokiaNat ? nokiaNat->inServiceID : 0);
+    AddU64Width(nokiaNat ? nokiaNat->inServiceID : 0, 8);
+
+    return streamPtr;
 }  // End of String_inServiceID
 
-static void String_outServiceID(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_outServiceID(char *streamPtr, recordHandle_t *recordHandle) {
     EXnokiaNat_t *nokiaNat = (EXnokiaNat_t *)recordHandle->extensionList[EXnokiaNatID];
 
-    fprintf(stream, "%8u", nokiaNat ? nokiaNat->outServiceID : 0);
+    AddU64Width(nokiaNat ? nokiaNat->outServiceID : 0, 8);
+
+    return streamPtr;
 }  // End of String_outServiceID
 
-static void String_natString(FILE *stream, recordHandle_t *recordHandle) {
+static char *String_natString(char *streamPtr, recordHandle_t *recordHandle) {
     char *natString = (char *)recordHandle->extensionList[EXnokiaNatStringID];
 
-    fprintf(stream, "%s", natString ? natString : "<unknown>");
+    AddString(natString ? natString : "<unknown>");
+
+    return streamPtr;
 }  // End of String_natString
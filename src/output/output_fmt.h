@@ -57,6 +57,10 @@ int ParseFMTOutputFormat(char *format, int printPlain);
 
 void fmt_record(FILE *stream, recordHandle_t *recordHandle, int tag);
 
+int FMTPrefetch(void);
+
+void fmt_prefetch(recordHandle_t *recordHandle);
+
 #define TAG_CHAR ''
 
 #endif  //_OUTPUT_FMT_H
@@ -57,42 +57,46 @@
 
 #define IP_STRING_LEN (INET6_ADDRSTRLEN)
 
-// record counter
-static uint32_t recordCount = 0;
+// record counter - per thread, if records are rendered by multiple threads
+static _Thread_local uint32_t recordCount = 0;
 
 #include "itoa.c"
+#include "textfmt.c"
 
-#define AddElementString(e, s)       \
-    do {                             \
-        *streamPtr++ = ' ';          \
-        *streamPtr++ = ' ';          \
-        *streamPtr++ = '"';          \
-        size_t len = strlen(e);      \
-        memcpy(streamPtr, e, len);   \
-        streamPtr += len;            \
-        const char *sep = "\" : \""; \
-        memcpy(streamPtr, sep, 5);   \
-        streamPtr += 5;              \
-        len = strlen(s);             \
-        memcpy(streamPtr, s, len);   \
-        streamPtr += len;            \
-        const char *eoe = "\",";     \
-        memcpy(streamPtr, eoe, 2);   \
-        streamPtr += 2;              \
-        *streamPtr++ = '\n';         \
+// keys are string literals - "  "key" : " is copied with its compile time length
+#define AddKey(e)                                                          \
+    do {                                                                   \
+        memcpy(streamPtr, "  \"" e "\" : ", sizeof("  \"" e "\" : ") - 1); \
+        streamPtr += sizeof("  \"" e "\" : ") - 1;                         \
+    } while (0)
+
+// s is a string generated by nfdump, which needs no escaping
+#define AddElementString(e, s)     \
+    do {                           \
+        AddKey(e);                 \
+        *streamPtr++ = '"';        \
+        size_t len = strlen(s);    \
+        memcpy(streamPtr, s, len); \
+        streamPtr += len;          \
+        *streamPtr++ = '"';        \
+        *streamPtr++ = ',';        \
+        *streamPtr++ = '\n';       \
+    } while (0)
+
+// s is a string from the flow record - escape and limit it to the available buffer
+#define AddElementText(e, s)                                                                  \
+    do {                                                                                      \
+        AddKey(e);                                                                            \
+        *streamPtr++ = '"';                                                                   \
+        streamPtr = json_escape(s, streamPtr, streamBuff + STREAMBUFFSIZE - 512 - streamPtr); \
+        *streamPtr++ = '"';                                                                   \
+        *streamPtr++ = ',';                                                                   \
+        *streamPtr++ = '\n';                                                                  \
     } while (0)
 
 #define AddElementU64(e, u64)                             \
     do {                                                  \
-        *streamPtr++ = ' ';                               \
-        *streamPtr++ = ' ';                               \
-        *streamPtr++ = '"';                               \
-        size_t len = strlen(e);                           \
-        memcpy(streamPtr, e, len);                        \
-        streamPtr += len;                                 \
-        const char *sep = "\" : ";                        \
-        memcpy(streamPtr, sep, 4);                        \
-        streamPtr += 4;                                   \
+        AddKey(e);                                        \
         streamPtr = itoa_u64((uint64_t)(u64), streamPtr); \
         *streamPtr++ = ',';                               \
         *streamPtr++ = '\n';                              \
@@ -100,53 +104,34 @@ static uint32_t recordCount = 0;
 
 #define AddElementU32(e, u32)                             \
     do {                                                  \
-        *streamPtr++ = ' ';                               \
-        *streamPtr++ = ' ';                               \
-        *streamPtr++ = '"';                               \
-        size_t len = strlen(e);                           \
-        memcpy(streamPtr, e, len);                        \
-        streamPtr += len;                                 \
-        const char *sep = "\" : ";                        \
-        memcpy(streamPtr, sep, 4);                        \
-        streamPtr += 4;                                   \
+        AddKey(e);                                        \
         streamPtr = itoa_u32((uint32_t)(u32), streamPtr); \
         *streamPtr++ = ',';                               \
         *streamPtr++ = '\n';                              \
     } while (0)
 
+#define AddElementMsec(e, msec)                                     \
+    do {                                                            \
+        AddKey(e);                                                  \
+        *streamPtr++ = '"';                                         \
+        streamPtr = msec_ntoa((uint64_t)(msec), 0, 'T', streamPtr); \
+        *streamPtr++ = '"';                                         \
+        *streamPtr++ = ',';                                         \
+        *streamPtr++ = '\n';                                        \
+    } while (0)
+
 #define STREAMBUFFSIZE 4096
 #define STREAMLEN(ptr)                                \
     ((ptrdiff_t)STREAMBUFFSIZE - (ptr - streamBuff)); \
     assert((ptr - streamBuff) < STREAMBUFFSIZE)
-static char *streamBuff = NULL;
+static _Thread_local char streamBuff[STREAMBUFFSIZE];
 
 static char *stringEXgenericFlow(char *streamPtr, void *extensionRecord) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)extensionRecord;
 
-    time_t when = (genericFlow->msecFirst / 1000LL);
-    struct tm ts = {0};
-    localtime_r(&when, &ts);
-    char dateBuff1[64];
-    strftime(dateBuff1, 63, "%Y-%m-%dT%H:%M:%S", &ts);
-
-    when = (genericFlow->msecLast / 1000LL);
-    localtime_r(&when, &ts);
-    char dateBuff2[64];
-    strftime(dateBuff2, 63, "%Y-%m-%dT%H:%M:%S", &ts);
-
-    when = (genericFlow->msecReceived / 1000LL);
-    localtime_r(&when, &ts);
-    char dateBuff3[64];
-    strftime(dateBuff3, 63, "%Y-%m-%dT%H:%M:%S", &ts);
-
-    ptrdiff_t lenStream = STREAMLEN(streamPtr);
-    int len = snprintf(streamPtr, lenStream,
-                       "  \"first\" : \"%s.%03u\",\n"
-                       "  \"last\" : \"%s.%03u\",\n"
-                       "  \"received\" : \"%s.%03u\",\n",
-                       dateBuff1, (unsigned)(genericFlow->msecFirst % 1000LL), dateBuff2, (unsigned)(genericFlow->msecLast % 1000LL), dateBuff3,
-                       (unsigned)(genericFlow->msecReceived % 1000LL));
-    streamPtr += len;
+    AddElementMsec("first", genericFlow->msecFirst);
+    AddElementMsec("last", genericFlow->msecLast);
+    AddElementMsec("received", genericFlow->msecReceived);
 
     AddElementU64("in_packets", genericFlow->inPackets);
     AddElementU64("in_bytes", genericFlow->inPackets);
@@ -172,11 +157,9 @@ static char *stringEXgenericFlow(char *streamPtr, void *extensionRecord) {
 static char *stringEXipv4Flow(char *streamPtr, void *extensionRecord) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)extensionRecord;
 
-    uint32_t src = htonl(ipv4Flow->srcAddr);
-    uint32_t dst = htonl(ipv4Flow->dstAddr);
     char sa[IP_STRING_LEN], da[IP_STRING_LEN];
-    inet_ntop(AF_INET, &src, sa, sizeof(sa));
-    inet_ntop(AF_INET, &dst, da, sizeof(da));
+    ip4_ntoa(ipv4Flow->srcAddr, sa);
+    ip4_ntoa(ipv4Flow->dstAddr, da);
 
     char sloc[128], dloc[128];
     LookupV4Location(ipv4Flow->srcAddr, sloc, 128);
@@ -193,14 +176,9 @@ static char *stringEXipv4Flow(char *streamPtr, void *extensionRecord) {
 static char *stringEXipv6Flow(char *streamPtr, void *extensionRecord) {
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)extensionRecord;
 
-    uint64_t src[2], dst[2];
-    src[0] = htonll(ipv6Flow->srcAddr[0]);
-    src[1] = htonll(ipv6Flow->srcAddr[1]);
-    dst[0] = htonll(ipv6Flow->dstAddr[0]);
-    dst[1] = htonll(ipv6Flow->dstAddr[1]);
     char sa[IP_STRING_LEN], da[IP_STRING_LEN];
-    inet_ntop(AF_INET6, &src, sa, sizeof(sa));
-    inet_ntop(AF_INET6, &dst, da, sizeof(da));
+    ip6_ntoa(ipv6Flow->srcAddr, sa);
+    ip6_ntoa(ipv6Flow->dstAddr, da);
 
     char sloc[128], dloc[128];
     LookupV6Location(ipv6Flow->srcAddr, sloc, 128);
@@ -224,29 +202,11 @@ static char *stringEXflowMisc(char *streamPtr, recordHandle_t *recordHandle, voi
     if (ipv6Flow) {
         // IPv6
         if (flowMisc->srcMask || flowMisc->dstMask) {
-            uint64_t src[2];
-            uint64_t dst[2];
-            if (flowMisc->srcMask >= 64) {
-                src[0] = ipv6Flow->srcAddr[0] & (0xffffffffffffffffLL << (flowMisc->srcMask - 64));
-                src[1] = 0;
-            } else {
-                src[0] = ipv6Flow->srcAddr[0];
-                src[1] = ipv6Flow->srcAddr[1] & (0xffffffffffffffffLL << flowMisc->srcMask);
-            }
-            src[0] = htonll(src[0]);
-            src[1] = htonll(src[1]);
-            inet_ntop(AF_INET6, &src, snet, sizeof(snet));
-
-            if (flowMisc->dstMask >= 64) {
-                dst[0] = ipv6Flow->dstAddr[0] & (0xffffffffffffffffLL << (flowMisc->dstMask - 64));
-                dst[1] = 0;
-            } else {
-                dst[0] = ipv6Flow->dstAddr[0];
-                dst[1] = ipv6Flow->dstAddr[1] & (0xffffffffffffffffLL << flowMisc->dstMask);
-            }
-            dst[0] = htonll(dst[0]);
-            dst[1] = htonll(dst[1]);
-            inet_ntop(AF_INET6, &dst, dnet, sizeof(dnet));
+            uint64_t net[2];
+            MaskV6(ipv6Flow->srcAddr, flowMisc->srcMask, net);
+            ip6_ntoa(net, snet);
+            MaskV6(ipv6Flow->dstAddr, flowMisc->dstMask, net);
+            ip6_ntoa(net, dnet);
 
         } else {
             snet[0] = '\0';
@@ -256,13 +216,8 @@ static char *stringEXflowMisc(char *streamPtr, recordHandle_t *recordHandle, voi
     } else {
         // IPv4
         if (flowMisc->srcMask || flowMisc->dstMask) {
-            uint32_t src = ipv4Flow->srcAddr & (0xffffffffL << (32 - flowMisc->srcMask));
-            src = htonl(src);
-            inet_ntop(AF_INET, &src, snet, sizeof(snet));
-
-            uint32_t dst = ipv4Flow->dstAddr & (0xffffffffL << (32 - flowMisc->dstMask));
-            dst = htonl(dst);
-            inet_ntop(AF_INET, &dst, dnet, sizeof(dnet));
+            ip4_ntoa(MaskV4(ipv4Flow->srcAddr, flowMisc->srcMask), snet);
+            ip4_ntoa(MaskV4(ipv4Flow->dstAddr, flowMisc->dstMask), dnet);
         } else {
             snet[0] = '\0';
             dnet[0] = '\0';
@@ -337,11 +292,8 @@ static char *stringEXasRouting(char *streamPtr, recordHandle_t *recordHandle, vo
 static char *stringEXbgpNextHopV4(char *streamPtr, void *extensionRecord) {
     EXbgpNextHopV4_t *bgpNextHopV4 = (EXbgpNextHopV4_t *)extensionRecord;
 
-    uint32_t i = htonl(bgpNextHopV4->ip);
     char ip[IP_STRING_LEN];
-    ip[0] = 0;
-    inet_ntop(AF_INET, &i, ip, sizeof(ip));
-    ip[IP_STRING_LEN - 1] = 0;
+    ip4_ntoa(bgpNextHopV4->ip, ip);
 
     AddElementString("bgp4_next_hop", ip);
 
@@ -351,14 +303,8 @@ static char *stringEXbgpNextHopV4(char *streamPtr, void *extensionRecord) {
 static char *stringEXbgpNextHopV6(char *streamPtr, void *extensionRecord) {
     EXbgpNextHopV6_t *bgpNextHopV6 = (EXbgpNextHopV6_t *)extensionRecord;
 
-    uint64_t i[2];
-    i[0] = htonll(bgpNextHopV6->ip[0]);
-    i[1] = htonll(bgpNextHopV6->ip[1]);
-
     char ip[IP_STRING_LEN];
-    ip[0] = 0;
-    inet_ntop(AF_INET6, i, ip, sizeof(ip));
-    ip[IP_STRING_LEN - 1] = 0;
+    ip6_ntoa(bgpNextHopV6->ip, ip);
 
     AddElementString("bgp6_next_hop", ip);
 
@@ -368,11 +314,8 @@ static char *stringEXbgpNextHopV6(char *streamPtr, void *extensionRecord) {
 static char *stringEXipNextHopV4(char *streamPtr, void *extensionRecord) {
     EXipNextHopV4_t *ipNextHopV4 = (EXipNextHopV4_t *)extensionRecord;
 
-    uint32_t i = htonl(ipNextHopV4->ip);
     char ip[IP_STRING_LEN];
-    ip[0] = 0;
-    inet_ntop(AF_INET, &i, ip, sizeof(ip));
-    ip[IP_STRING_LEN - 1] = 0;
+    ip4_ntoa(ipNextHopV4->ip, ip);
 
     AddElementString("ip4_next_hop", ip);
 
@@ -382,14 +325,8 @@ static char *stringEXipNextHopV4(char *streamPtr, void *extensionRecord) {
 static char *stringEXipNextHopV6(char *streamPtr, void *extensionRecord) {
     EXipNextHopV6_t *ipNextHopV6 = (EXipNextHopV6_t *)extensionRecord;
 
-    uint64_t i[2];
-    i[0] = htonll(ipNextHopV6->ip[0]);
-    i[1] = htonll(ipNextHopV6->ip[1]);
-
     char ip[IP_STRING_LEN];
-    ip[0] = 0;
-    inet_ntop(AF_INET6, i, ip, sizeof(ip));
-    ip[IP_STRING_LEN - 1] = 0;
+    ip6_ntoa(ipNextHopV6->ip, ip);
 
     AddElementString("ip6_next_hop", ip);
 
@@ -399,11 +336,8 @@ static char *stringEXipNextHopV6(char *streamPtr, void *extensionRecord) {
 static char *stringEXipReceivedV4(char *streamPtr, void *extensionRecord) {
     EXipReceivedV4_t *ipReceivedV4 = (EXipReceivedV4_t *)extensionRecord;
 
-    uint32_t i = htonl(ipReceivedV4->ip);
     char ip[IP_STRING_LEN];
-    ip[0] = 0;
-    inet_ntop(AF_INET, &i, ip, sizeof(ip));
-    ip[IP_STRING_LEN - 1] = 0;
+    ip4_ntoa(ipReceivedV4->ip, ip);
 
     AddElementString("ip4_router", ip);
 
@@ -413,13 +347,8 @@ static char *stringEXipReceivedV4(char *streamPtr, void *extensionRecord) {
 static char *stringEXipReceivedV6(char *streamPtr, void *extensionRecord) {
     EXipReceivedV6_t *ipReceivedV6 = (EXipReceivedV6_t *)extensionRecord;
 
-    uint64_t i[2];
-    i[0] = htonll(ipReceivedV6->ip[0]);
-    i[1] = htonll(ipReceivedV6->ip[1]);
     char ip[IP_STRING_LEN];
-    ip[0] = 0;
-    inet_ntop(AF_INET6, i, ip, sizeof(ip));
-    ip[IP_STRING_LEN - 1] = 0;
+    ip6_ntoa(ipReceivedV6->ip, ip);
 
     AddElementString("ip6_router", ip);
 
@@ -429,10 +358,18 @@ static char *stringEXipReceivedV6(char *streamPtr, void *extensionRecord) {
 static char *stringEXmplsLabel(char *streamPtr, void *extensionRecord) {
     EXmplsLabel_t *mplsLabel = (EXmplsLabel_t *)extensionRecord;
     for (int i = 0; i < 10; i++) {
-        ptrdiff_t lenStream = STREAMLEN(streamPtr);
-        int len = snprintf(streamPtr, lenStream, "  \"mpls_%u\" : \"%u-%u-%u\",\n", i + 1, mplsLabel->mplsLabel[i] >> 4,
-                           (mplsLabel->mplsLabel[i] & 0xF) >> 1, mplsLabel->mplsLabel[i] & 1);
-        streamPtr += len;
+        memcpy(streamPtr, "  \"mpls_", 8);
+        streamPtr = itoa_u32(i + 1, streamPtr + 8);
+        memcpy(streamPtr, "\" : \"", 5);
+        streamPtr += 5;
+        streamPtr = itoa_u32(mplsLabel->mplsLabel[i] >> 4, streamPtr);
+        *streamPtr++ = '-';
+        streamPtr = itoa_u32((mplsLabel->mplsLabel[i] & 0xF) >> 1, streamPtr);
+        *streamPtr++ = '-';
+        streamPtr = itoa_u32(mplsLabel->mplsLabel[i] & 1, streamPtr);
+        *streamPtr++ = '"';
+        *streamPtr++ = ',';
+        *streamPtr++ = '\n';
     }
 
     return streamPtr;
@@ -441,23 +378,15 @@ static char *stringEXmplsLabel(char *streamPtr, void *extensionRecord) {
 static char *stringEXmacAddr(char *streamPtr, void *extensionRecord) {
     EXmacAddr_t *macAddr = (EXmacAddr_t *)extensionRecord;
 
-    uint8_t mac1[6], mac2[6], mac3[6], mac4[6];
-    for (int i = 0; i < 6; i++) {
-        mac1[i] = (macAddr->inSrcMac >> (i * 8)) & 0xFF;
-        mac2[i] = (macAddr->outDstMac >> (i * 8)) & 0xFF;
-        mac3[i] = (macAddr->inDstMac >> (i * 8)) & 0xFF;
-        mac4[i] = (macAddr->outSrcMac >> (i * 8)) & 0xFF;
-    }
-
-    ptrdiff_t lenStream = STREAMLEN(streamPtr);
-    int len = snprintf(streamPtr, lenStream,
-                       "  \"in_src_mac\" : \"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x\"\n"
-                       "  \"out_dst_mac\" : \"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x\"\n"
-                       "  \"in_dst_mac\" : \"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x\"\n"
-                       "  \"out_src_mac\" : \"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x\"\n",
-                       mac1[5], mac1[4], mac1[3], mac1[2], mac1[1], mac1[0], mac2[5], mac2[4], mac2[3], mac2[2], mac2[1], mac2[0], mac3[5], mac3[4],
-                       mac3[3], mac3[2], mac3[1], mac3[0], mac4[5], mac4[4], mac4[3], mac4[2], mac4[1], mac4[0]);
-    streamPtr += len;
+    char mac[20];
+    mac_ntoa(macAddr->inSrcMac, mac);
+    AddElementString("in_src_mac", mac);
+    mac_ntoa(macAddr->outDstMac, mac);
+    AddElementString("out_dst_mac", mac);
+    mac_ntoa(macAddr->inDstMac, mac);
+    AddElementString("in_dst_mac", mac);
+    mac_ntoa(macAddr->outSrcMac, mac);
+    AddElementString("out_src_mac", mac);
 
     return streamPtr;
 }  // End of stringEXmacAddr
@@ -474,18 +403,18 @@ static char *stringEXasAdjacent(char *streamPtr, void *extensionRecord) {
 static char *stringEXlatency(char *streamPtr, void *extensionRecord) {
     EXlatency_t *latency = (EXlatency_t *)extensionRecord;
 
-    double f1, f2, f3;
-    f1 = (double)latency->usecClientNwDelay / 1000.0;
-    f2 = (double)latency->usecServerNwDelay / 1000.0;
-    f3 = (double)latency->usecApplLatency / 1000.0;
-
-    ptrdiff_t lenStream = STREAMLEN(streamPtr);
-    int len = snprintf(streamPtr, lenStream,
-                       "  \"cli_latency\" : %f,\n"
-                       "  \"srv_latency\" : %f,\n"
-                       "  \"app_latency\" : %f,\n",
-                       f1, f2, f3);
-    streamPtr += len;
+    AddKey("cli_latency");
+    streamPtr = usec_ntoa(latency->usecClientNwDelay, streamPtr);
+    *streamPtr++ = ',';
+    *streamPtr++ = '\n';
+    AddKey("srv_latency");
+    streamPtr = usec_ntoa(latency->usecServerNwDelay, streamPtr);
+    *streamPtr++ = ',';
+    *streamPtr++ = '\n';
+    AddKey("app_latency");
+    streamPtr = usec_ntoa(latency->usecApplLatency, streamPtr);
+    *streamPtr++ = ',';
+    *streamPtr++ = '\n';
 
     return streamPtr;
 }  // End of stringEXlatency
@@ -501,14 +430,9 @@ static char *string_payload(char *streamPtr, recordHandle_t *recordHandle, void
         return streamPtr;
     }
 
-    ssl_t *ssl = recordHandle->extensionList[SSLindex];
+    ssl_t *ssl = GetRecordSSL(recordHandle);
     if (ssl == NULL) {
-        uint32_t payloadLength = ExtensionLength(payload);
-        ssl = sslProcess(payload, payloadLength);
-        recordHandle->extensionList[SSLindex] = ssl;
-        if (ssl == NULL) {
-            return streamPtr;
-        }
+        return streamPtr;
     }
 
     // ssl is defined
@@ -530,26 +454,18 @@ static char *string_payload(char *streamPtr, recordHandle_t *recordHandle, void
         streamPtr += len;
 
         if (ssl->sniName[0]) {
-            AddElementString("sni", ssl->sniName);
+            AddElementText("sni", ssl->sniName);
         }
     }
 
-    char *ja3 = recordHandle->extensionList[JA3index];
-    if (ja3 == NULL) {
-        ja3 = ja3Process(ssl, NULL);
-        recordHandle->extensionList[JA3index] = ja3;
-    }
+    char *ja3 = GetRecordJA3(recordHandle);
     if (ja3) {
         AddElementString("ja3 hash", ja3);
     }
 
-    ja4_t *ja4 = recordHandle->extensionList[JA4index];
-    if (ja4 == NULL) {
-        if (ssl->type == CLIENTssl) {
-            ja4 = ja4Process(ssl, genericFlow->proto);
-        } else {
-            ja4 = ja4sProcess(ssl, genericFlow->proto);
-        }
+    ja4_t *ja4 = GetRecordJA4(recordHandle);
+    if (ja4 == NULL && ssl->type != CLIENTssl) {
+        ja4 = ja4sProcess(ssl, genericFlow->proto);
         recordHandle->extensionList[JA4index] = ja4;
     }
     if (ja4 == NULL) return streamPtr;
@@ -566,11 +482,9 @@ static char *string_payload(char *streamPtr, recordHandle_t *recordHandle, void
 static char *stringEXtunIPv4(char *streamPtr, void *extensionRecord) {
     EXtunIPv4_t *tunIPv4 = (EXtunIPv4_t *)extensionRecord;
 
-    uint32_t src = htonl(tunIPv4->tunSrcAddr);
-    uint32_t dst = htonl(tunIPv4->tunDstAddr);
     char as[IP_STRING_LEN], ds[IP_STRING_LEN];
-    inet_ntop(AF_INET, &src, as, sizeof(as));
-    inet_ntop(AF_INET, &dst, ds, sizeof(ds));
+    ip4_ntoa(tunIPv4->tunSrcAddr, as);
+    ip4_ntoa(tunIPv4->tunDstAddr, ds);
 
     AddElementU32("tun_proto", tunIPv4->tunProto);
     AddElementString("src4_tun_ip", as);
@@ -582,15 +496,9 @@ static char *stringEXtunIPv4(char *streamPtr, void *extensionRecord) {
 static char *stringEXtunIPv6(char *streamPtr, void *extensionRecord) {
     EXtunIPv6_t *tunIPv6 = (EXtunIPv6_t *)extensionRecord;
 
-    uint64_t src[2];
-    uint64_t dst[2];
-    src[0] = htonll(tunIPv6->tunSrcAddr[0]);
-    src[1] = htonll(tunIPv6->tunSrcAddr[1]);
-    dst[0] = htonll(tunIPv6->tunDstAddr[0]);
-    dst[1] = htonll(tunIPv6->tunDstAddr[1]);
     char as[IP_STRING_LEN], ds[IP_STRING_LEN];
-    inet_ntop(AF_INET6, &src, as, sizeof(as));
-    inet_ntop(AF_INET6, &dst, ds, sizeof(ds));
+    ip6_ntoa(tunIPv6->tunSrcAddr, as);
+    ip6_ntoa(tunIPv6->tunDstAddr, ds);
 
     AddElementU32("tun_proto", tunIPv6->tunProto);
     AddElementString("src6_tun_ip", as);
@@ -632,26 +540,35 @@ static char *stringEXlayer2(char *streamPtr, void *extensionRecord) {
     return streamPtr;
 }  // End of stringEXlayer2
 
-static char *stringEXnselCommon(char *streamPtr, void *extensionRecord) {
-    EXnselCommon_t *nselCommon = (EXnselCommon_t *)extensionRecord;
-
-    char datestr[64];
-    time_t when = nselCommon->msecEvent / 1000LL;
+// event time stamp - msec are printed without leading zeros
+static char *stringEventTime(char *streamPtr, uint64_t msecEvent) {
+    AddKey("t_event");
+    *streamPtr++ = '"';
+    time_t when = msecEvent / 1000LL;
     if (when == 0) {
-        strncpy(datestr, "<unknown>", 63);
+        memcpy(streamPtr, "<unknown>", 9);
+        streamPtr += 9;
     } else {
-        struct tm *ts = localtime(&when);
-        strftime(datestr, 63, "%Y-%m-%dT%H:%M:%S", ts);
+        streamPtr = date_ntoa(when, 0, 'T', streamPtr);
     }
+    *streamPtr++ = '.';
+    streamPtr = itoa_u32((uint32_t)(msecEvent % 1000LL), streamPtr);
+    *streamPtr++ = '"';
+    *streamPtr++ = ',';
+    *streamPtr++ = '\n';
+
+    return streamPtr;
+}  // End of stringEventTime
+
+static char *stringEXnselCommon(char *streamPtr, void *extensionRecord) {
+    EXnselCommon_t *nselCommon = (EXnselCommon_t *)extensionRecord;
 
     AddElementU32("connect_id", nselCommon->connID);
     AddElementU32("event_id", nselCommon->fwEvent);
     AddElementString("event", fwEventString(nselCommon->fwEvent));
     AddElementU32("xevent_id", nselCommon->fwXevent);
 
-    ptrdiff_t lenStream = STREAMLEN(streamPtr);
-    int len = snprintf(streamPtr, lenStream, "  \"t_event\" : \"%s.%llu\",\n", datestr, nselCommon->msecEvent % 1000LL);
-    streamPtr += len;
+    streamPtr = stringEventTime(streamPtr, nselCommon->msecEvent);
 
     return streamPtr;
 }  // End of stringEXnselCommon
@@ -659,11 +576,9 @@ static char *stringEXnselCommon(char *streamPtr, void *extensionRecord) {
 static char *stringEXnatXlateIPv4(char *streamPtr, void *extensionRecord) {
     EXnatXlateIPv4_t *natXlateIPv4 = (EXnatXlateIPv4_t *)extensionRecord;
 
-    uint32_t src = htonl(natXlateIPv4->xlateSrcAddr);
-    uint32_t dst = htonl(natXlateIPv4->xlateDstAddr);
     char as[IP_STRING_LEN], ds[IP_STRING_LEN];
-    inet_ntop(AF_INET, &src, as, sizeof(as));
-    inet_ntop(AF_INET, &dst, ds, sizeof(ds));
+    ip4_ntoa(natXlateIPv4->xlateSrcAddr, as);
+    ip4_ntoa(natXlateIPv4->xlateDstAddr, ds);
 
     AddElementString("src4_xlt_ip", as);
     AddElementString("dst4_xlt_ip", ds);
@@ -674,15 +589,9 @@ static char *stringEXnatXlateIPv4(char *streamPtr, void *extensionRecord) {
 static char *stringEXnatXlateIPv6(char *streamPtr, void *extensionRecord) {
     EXnatXlateIPv6_t *natXlateIPv6 = (EXnatXlateIPv6_t *)extensionRecord;
 
-    uint64_t src[2];
-    uint64_t dst[2];
-    src[0] = htonll(natXlateIPv6->xlateSrcAddr[0]);
-    src[1] = htonll(natXlateIPv6->xlateSrcAddr[1]);
-    dst[0] = htonll(natXlateIPv6->xlateDstAddr[0]);
-    dst[1] = htonll(natXlateIPv6->xlateDstAddr[1]);
     char as[IP_STRING_LEN], ds[IP_STRING_LEN];
-    inet_ntop(AF_INET6, &src, as, sizeof(as));
-    inet_ntop(AF_INET6, &dst, ds, sizeof(ds));
+    ip6_ntoa(natXlateIPv6->xlateSrcAddr, as);
+    ip6_ntoa(natXlateIPv6->xlateDstAddr, ds);
 
     AddElementString("src6_xlt_ip", as);
     AddElementString("dst6_xlt_ip", ds);
@@ -699,15 +608,29 @@ static char *stringEXnatXlatePort(char *streamPtr, void *extensionRecord) {
     return streamPtr;
 }  // End of stringEXnatXlatePort
 
+// acl triple as "0x%x/0x%x/0x%x" string value
+static char *stringAcl(char *streamPtr, const uint32_t acl[3]) {
+    *streamPtr++ = '"';
+    for (int i = 0; i < 3; i++) {
+        *streamPtr++ = '0';
+        *streamPtr++ = 'x';
+        streamPtr = hex32_ntoa(acl[i], streamPtr);
+        *streamPtr++ = '/';
+    }
+    streamPtr[-1] = '"';
+    *streamPtr++ = ',';
+    *streamPtr++ = '\n';
+
+    return streamPtr;
+}  // End of stringAcl
+
 static char *stringEXnselAcl(char *streamPtr, void *extensionRecord) {
     EXnselAcl_t *nselAcl = (EXnselAcl_t *)extensionRecord;
-    ptrdiff_t lenStream = STREAMLEN(streamPtr);
-    int len = snprintf(streamPtr, lenStream,
-                       "  \"ingress_acl\" : \"0x%x/0x%x/0x%x\",\n"
-                       "  \"egress_acl\" : \"0x%x/0x%x/0x%x\",\n",
-                       nselAcl->ingressAcl[0], nselAcl->ingressAcl[1], nselAcl->ingressAcl[2], nselAcl->egressAcl[0], nselAcl->egressAcl[1],
-                       nselAcl->egressAcl[2]);
-    streamPtr += len;
+
+    AddKey("ingress_acl");
+    streamPtr = stringAcl(streamPtr, nselAcl->ingressAcl);
+    AddKey("egress_acl");
+    streamPtr = stringAcl(streamPtr, nselAcl->egressAcl);
 
     return streamPtr;
 }  // End of stringEXnselAcl
@@ -716,7 +639,7 @@ static char *stringEXnselUserID(char *streamPtr, void *extensionRecord) {
     EXnselUser_t *nselUser = (EXnselUser_t *)extensionRecord;
 
     char *name = nselUser->username[0] ? nselUser->username : "<empty>";
-    AddElementString("user_name", name);
+    AddElementText("user_name", name);
 
     return streamPtr;
 }  // End of stringEXnselUserID
@@ -724,23 +647,11 @@ static char *stringEXnselUserID(char *streamPtr, void *extensionRecord) {
 static char *stringEXnatCommon(char *streamPtr, void *extensionRecord) {
     EXnatCommon_t *natCommon = (EXnatCommon_t *)extensionRecord;
 
-    time_t when = natCommon->msecEvent / 1000LL;
-    char datestr[64];
-    if (when == 0) {
-        strncpy(datestr, "<unknown>", 63);
-    } else {
-        struct tm *ts = localtime(&when);
-        strftime(datestr, 63, "%Y-%m-%dT%H:%M:%S", ts);
-    }
-
     AddElementU32("nat_event_id", natCommon->natEvent);
     AddElementString("nat_event", natEventString(natCommon->natEvent, LONGNAME));
     AddElementU32("nat_pool_id", natCommon->natPoolID);
 
-    ptrdiff_t lenStream = STREAMLEN(streamPtr);
-    int len = snprintf(streamPtr, lenStream, "  \"t_event\" : \"%s.%llu\",\n", datestr, natCommon->msecEvent % 1000LL);
-
-    streamPtr += len;
+    streamPtr = stringEventTime(streamPtr, natCommon->msecEvent);
 
     return streamPtr;
 }  // End of stringEXnatCommon
@@ -776,19 +687,12 @@ static char *stringEXnokiaNat(char *streamPtr, void *extensionRecord) {
 static char *stringEXnokiaNatString(char *streamPtr, void *extensionRecord) {
     char *natString = (char *)extensionRecord;
 
-    AddElementString("natString", natString);
+    AddElementText("natString", natString);
 
     return streamPtr;
 }  // End of String_natString
 
 void json_prolog(outputParams_t *outputParam) {
-    streamBuff = malloc(STREAMBUFFSIZE);
-    if (!streamBuff) {
-        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-    streamBuff[0] = '\0';
-
     // open json array
     printf("[\n");
 }  // End of json_prolog
@@ -796,10 +700,12 @@ void json_prolog(outputParams_t *outputParam) {
 void json_epilog(outputParams_t *outputParam) {
     // close json array
     printf("\n]\n");
-    free(streamBuff);
-    streamBuff = NULL;
 }  // End of json_epilog
 
+void json_count(uint32_t count) {
+    recordCount = count;
+}  // End of json_count
+
 void flow_record_to_json(FILE *stream, recordHandle_t *recordHandle, int tag) {
     // ws is whitespace after object opening and before object closing {WS  WS}
     // ' ' is printed before each record for clarity if needed
@@ -808,7 +714,6 @@ void flow_record_to_json(FILE *stream, recordHandle_t *recordHandle, int tag) {
 
     recordHeaderV3_t *recordHeaderV3 = recordHandle->recordHeaderV3;
 
-    streamBuff[0] = '\0';
     char *streamPtr = streamBuff;
 
     if (recordCount != 0) {
@@ -955,13 +860,12 @@ void flow_record_to_json(FILE *stream, recordHandle_t *recordHandle, int tag) {
     *streamPtr++ = '\n';
     *streamPtr++ = ' ';
     *streamPtr++ = '}';
-    *streamPtr++ = '\0';
 
     if (unlikely((streamBuff + STREAMBUFFSIZE - streamPtr) < 512)) {
         LogError("json_record() error in %s line %d: %s", __FILE__, __LINE__, "buffer error");
         exit(EXIT_FAILURE);
     }
 
-    fputs(streamBuff, stream);
+    fwrite(streamBuff, 1, streamPtr - streamBuff, stream);
 
 }  // End of flow_record_to_json
\ No newline at end of file
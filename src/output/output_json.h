@@ -40,4 +40,6 @@ void json_epilog(outputParams_t *outputParam);
 
 void flow_record_to_json(FILE *stream, recordHandle_t *recordHandle, int tag);
 
+void json_count(uint32_t count);
+
 #endif  // _OUTPUT_JSON_H
@@ -40,4 +40,8 @@ void ndjson_epilog(outputParams_t *outputParam);
 
 void flow_record_to_ndjson(FILE *stream, recordHandle_t *recordHandle, int tag);
 
+void ndjson_count(uint32_t count);
+
+void SetNDJSONSocket(char *path);
+
 #endif  // _OUTPUT_NDJSON_H
@@ -32,12 +32,15 @@
 
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
@@ -64,6 +67,15 @@
 // record counter
 static uint32_t recordCount;
 
+// extensions to print - all or the extensions selected by RawSelectExtensions()
+static uint32_t extensionIDs[MAXEXTENSIONS];
+static uint32_t numExtensionIDs = 0;
+
+// kv mode renders the raw record into this stream and converts it to key=value
+static FILE *kvStream = NULL;
+static char *kvBuff = NULL;
+static size_t kvBuffSize = 0;
+
 static void stringEXgenericFlow(FILE *stream, recordHandle_t *recordHandle, void *extensionRecord) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)extensionRecord;
 
@@ -214,10 +226,9 @@ static void stringsEXipv4Flow(FILE *stream, recordHandle_t *recordHandle, void *
 
     char sloc[128], dloc[128], stor[4], dtor[4];
     stor[0] = dtor[0] = '\0';
-    if (genericFlow) {
-        if (LookupV4Tor(ipv4Flow->srcAddr, genericFlow->msecFirst, genericFlow->msecLast, stor + 1)) stor[0] = ' ';
-        if (LookupV4Tor(ipv4Flow->dstAddr, genericFlow->msecFirst, genericFlow->msecLast, dtor + 1)) dtor[0] = ' ';
-    }
+    char *torInfo;
+    if (GetRecordTor(recordHandle, 0, &torInfo)) snprintf(stor, sizeof(stor), " %s", torInfo);
+    if (GetRecordTor(recordHandle, 1, &torInfo)) snprintf(dtor, sizeof(dtor), " %s", torInfo);
     LookupV4Location(ipv4Flow->srcAddr, sloc, 128);
     LookupV4Location(ipv4Flow->dstAddr, dloc, 128);
     fprintf(stream,
@@ -250,10 +261,9 @@ static void stringsEXipv6Flow(FILE *stream, recordHandle_t *recordHandle, void *
 
     char sloc[128], dloc[128], stor[4], dtor[4];
     stor[0] = dtor[0] = '\0';
-    if (genericFlow) {
-        if (LookupV6Tor(ipv6Flow->srcAddr, genericFlow->msecFirst, genericFlow->msecLast, stor + 1)) stor[0] = ' ';
-        if (LookupV6Tor(ipv6Flow->dstAddr, genericFlow->msecFirst, genericFlow->msecLast, dtor + 1)) dtor[0] = ' ';
-    }
+    char *torInfo;
+    if (GetRecordTor(recordHandle, 0, &torInfo)) snprintf(stor, sizeof(stor), " %s", torInfo);
+    if (GetRecordTor(recordHandle, 1, &torInfo)) snprintf(dtor, sizeof(dtor), " %s", torInfo);
     LookupV6Location(ipv6Flow->srcAddr, sloc, 128);
     LookupV6Location(ipv6Flow->dstAddr, dloc, 128);
     fprintf(stream,
@@ -739,14 +749,12 @@ static void inoutPayload(FILE *stream, recordHandle_t *recordHandle, uint8_t *pa
     if (ascii) {
         fprintf(stream, "%.*s\n", max, payload);
     } else if (genericFlow->proto == IPPROTO_TCP) {
-        ssl_t *ssl = recordHandle->extensionList[SSLindex];
+        // derived values are cached in the record handle for the in payload only
+        int inPayload = payload == recordHandle->extensionList[EXinPayloadID];
+        ssl_t *ssl = inPayload ? GetRecordSSL(recordHandle) : sslProcess(payload, length);
         if (ssl == NULL) {
-            ssl = sslProcess(payload, length);
-            recordHandle->extensionList[SSLindex] = ssl;
-            if (ssl == NULL) {
-                DumpHex(stream, payload, max);
-                return;
-            }
+            DumpHex(stream, payload, max);
+            return;
         }
 
         // ssl is defined
@@ -764,11 +772,7 @@ static void inoutPayload(FILE *stream, recordHandle_t *recordHandle, uint8_t *pa
 
         if (ssl->sniName[0]) fprintf(stream, "  sni name     =  %s\n", ssl->sniName);
 
-        char *ja3 = recordHandle->extensionList[JA3index];
-        if (ja3 == NULL) {
-            ja3 = ja3Process(ssl, NULL);
-            recordHandle->extensionList[JA3index] = ja3;
-        }
+        char *ja3 = inPayload ? GetRecordJA3(recordHandle) : ja3Process(ssl, NULL);
         if (ja3) {
             if (ssl->type == CLIENTssl) {
                 fprintf(stream, "  ja3 hash     =  %s\n", ja3);
@@ -777,14 +781,11 @@ static void inoutPayload(FILE *stream, recordHandle_t *recordHandle, uint8_t *pa
             }
         }
 
-        ja4_t *ja4 = recordHandle->extensionList[JA4index];
-        if (ja4 == NULL) {
-            if (ssl->type == CLIENTssl) {
-                ja4 = ja4Process(ssl, genericFlow->proto);
-            } else {
-                ja4 = ja4sProcess(ssl, genericFlow->proto);
-            }
-            recordHandle->extensionList[JA4index] = ja4;
+        ja4_t *ja4 = NULL;
+        if (ssl->type == CLIENTssl) {
+            ja4 = inPayload ? GetRecordJA4(recordHandle) : ja4Process(ssl, genericFlow->proto);
+        } else {
+            ja4 = ja4sProcess(ssl, genericFlow->proto);
         }
 
         if (ja4) {
@@ -793,6 +794,12 @@ static void inoutPayload(FILE *stream, recordHandle_t *recordHandle, uint8_t *pa
             else
                 fprintf(stream, "  ja4s hash    =  %s\n", ja4->string);
         }
+
+        if (ja4 && (!inPayload || ssl->type != CLIENTssl)) free(ja4);
+        if (!inPayload) {
+            free(ja3);
+            sslFree(ssl);
+        }
     }
 
     DumpHex(stream, payload, max);
@@ -838,6 +845,43 @@ static void stringsEXnokiaNatString(FILE *stream, void *extensionRecord) {
     fprintf(stream, "  nat String   = %-19s\n", natString);
 }  // End of stringsEXnokiaNatString
 
+// select the extensions to print from a comma separated list of extension names.
+// The names are the extension names with or without leading 'EX', case insensitive
+int RawSelectExtensions(char *list) {
+    int selected[MAXEXTENSIONS] = {0};
+    char *names = strdup(list);
+    char *saveptr = NULL;
+    for (char *name = strtok_r(names, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+        int found = 0;
+        for (int i = 1; i < MAXEXTENSIONS; i++) {
+            char *extName = extensionTable[i].name;
+            if (strcasecmp(name, extName) == 0 || strcasecmp(name, extName + 2) == 0) {
+                selected[i] = 1;
+                found = 1;
+                break;
+            }
+        }
+        if (!found) {
+            LogError("Unknown extension '%s'. Known extensions:", name);
+            for (int i = 1; i < MAXEXTENSIONS; i++) LogError("  %s", extensionTable[i].name + 2);
+            free(names);
+            return 0;
+        }
+    }
+    free(names);
+
+    numExtensionIDs = 0;
+    for (int i = 1; i < MAXEXTENSIONS; i++) {
+        if (selected[i]) extensionIDs[numExtensionIDs++] = i;
+    }
+    if (numExtensionIDs == 0) {
+        LogError("No extension selected");
+        return 0;
+    }
+    return 1;
+
+}  // End of RawSelectExtensions
+
 void raw_prolog(outputParams_t *outputParam) {
     // empty prolog
     recordCount = 0;
@@ -903,17 +947,18 @@ void raw_record(FILE *stream, recordHandle_t *recordHandle, int tag) {
         }
     */
 
-    int processed = 0;
+    // no selection - print all extensions
+    if (numExtensionIDs == 0) {
+        for (int i = 1; i < MAXEXTENSIONS; i++) extensionIDs[numExtensionIDs++] = i;
+    }
+
     int doInputPayload = 0;
     int doOutputPayload = 0;
-    for (int i = 0; i < MAXEXTENSIONS; i++) {
-        if (processed == recordHeaderV3->numElements) break;
-        if (recordHandle->extensionList[i] == NULL) continue;
+    for (int j = 0; j < numExtensionIDs; j++) {
+        uint32_t i = extensionIDs[j];
         void *ptr = recordHandle->extensionList[i];
+        if (ptr == NULL) continue;
         switch (i) {
-            case EXnull:
-                if (ptr != recordHeaderV3) fprintf(stderr, "Found unexpected NULL extension \n");
-                break;
             case EXgenericFlowID:
                 stringEXgenericFlow(stream, recordHandle, ptr);
                 break;
@@ -1040,3 +1085,71 @@ void raw_record(FILE *stream, recordHandle_t *recordHandle, int tag) {
     if (doOutputPayload) stringsEXoutPayload(stream, recordHandle, NULL);
 
 }  // raw_record
+
+void kv_prolog(outputParams_t *outputParam) {
+    raw_prolog(outputParam);
+}  // End of kv_prolog
+
+void kv_epilog(outputParams_t *outputParam) {
+    if (kvStream) fclose(kvStream);
+    free(kvBuff);
+    kvStream = NULL;
+    kvBuff = NULL;
+}  // End of kv_epilog
+
+// print the record as one line of space separated key=value pairs (logfmt).
+// Each 'key = value' line of the raw record is a pair. Blanks in keys are replaced by '_',
+// values with blanks or quotes are quoted. Lines without '=', such as payload dumps, are skipped
+void kv_record(FILE *stream, recordHandle_t *recordHandle, int tag) {
+    if (kvStream == NULL) {
+        kvStream = open_memstream(&kvBuff, &kvBuffSize);
+        if (kvStream == NULL) {
+            LogError("open_memstream() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    rewind(kvStream);
+    raw_record(kvStream, recordHandle, tag);
+    fflush(kvStream);
+    size_t len = ftell(kvStream);
+
+    char *line = kvBuff;
+    char *end = kvBuff + len;
+    int first = 1;
+    while (line < end) {
+        char *eol = memchr(line, '\n', end - line);
+        if (eol == NULL) eol = end;
+        char *eq = memchr(line, '=', eol - line);
+        if (eq) {
+            char *key = line;
+            char *keyEnd = eq;
+            while (key < keyEnd && *key == ' ') key++;
+            while (keyEnd > key && keyEnd[-1] == ' ') keyEnd--;
+            char *value = eq + 1;
+            char *valueEnd = eol;
+            while (value < valueEnd && *value == ' ') value++;
+            while (valueEnd > value && valueEnd[-1] == ' ') valueEnd--;
+
+            if (key < keyEnd) {
+                if (!first) fputc(' ', stream);
+                first = 0;
+                for (char *c = key; c < keyEnd; c++) fputc(*c == ' ' ? '_' : *c, stream);
+                fputc('=', stream);
+                size_t valueLen = valueEnd - value;
+                if (valueLen && memchr(value, ' ', valueLen) == NULL && memchr(value, '"', valueLen) == NULL) {
+                    fwrite(value, 1, valueLen, stream);
+                } else {
+                    fputc('"', stream);
+                    for (char *c = value; c < valueEnd; c++) {
+                        if (*c == '"' || *c == '\\') fputc('\\', stream);
+                        fputc(*c, stream);
+                    }
+                    fputc('"', stream);
+                }
+            }
+        }
+        line = eol + 1;
+    }
+    fputc('\n', stream);
+
+}  // End of kv_record
@@ -42,4 +42,12 @@ void raw_epilog(outputParams_t *outputParam);
 
 void raw_record(FILE *stream, recordHandle_t *recordHandle, int tag);
 
+int RawSelectExtensions(char *list);
+
+void kv_prolog(outputParams_t *outputParam);
+
+void kv_epilog(outputParams_t *outputParam);
+
+void kv_record(FILE *stream, recordHandle_t *recordHandle, int tag);
+
 #endif  // _OUTPUT_RAW_H
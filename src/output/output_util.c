@@ -41,7 +41,7 @@
 #include "nffile.h"
 
 char *FlagsString(uint16_t flags) {
-    static char string[16];
+    static _Thread_local char string[16];
 
     string[0] = flags & 128 ? 'C' : '.';  // Congestion window reduced -  CWR
     string[1] = flags & 64 ? 'E' : '.';   // ECN-Echo
@@ -0,0 +1,295 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Text formatting of IP addresses, time stamps and other values for the
+ * output modules. Included after itoa.c, as it uses its char_table.
+ *
+ * The IP functions replace inet_ntop() and produce the same text. Addresses
+ * are passed in host byte order, as stored in the records.
+ * The time functions cache the date and time of the last minute per thread,
+ * so localtime_r()/gmtime_r() is only called, if the minute changes.
+ *
+ * All functions write a null-terminated string and return a pointer to the
+ * terminating '\0'.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// length of "YYYY-MM-DD HH:MM:SS" without '\0'
+#define DATESTRINGLEN 19
+
+static const char hex_table[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+// mask IPv4 address with maskBits network bits
+static inline uint32_t MaskV4(uint32_t ip, uint32_t maskBits) {
+    if (maskBits == 0) return 0;
+    if (maskBits >= 32) return ip;
+    return ip & (0xffffffffU << (32 - maskBits));
+}  // End of MaskV4
+
+// mask IPv6 address with maskBits network bits into net
+static inline void MaskV6(const uint64_t ip[2], uint32_t maskBits, uint64_t net[2]) {
+    if (maskBits == 0) {
+        net[0] = net[1] = 0;
+    } else if (maskBits <= 64) {
+        net[0] = maskBits == 64 ? ip[0] : ip[0] & (0xffffffffffffffffULL << (64 - maskBits));
+        net[1] = 0;
+    } else {
+        net[0] = ip[0];
+        net[1] = maskBits >= 128 ? ip[1] : ip[1] & (0xffffffffffffffffULL << (128 - maskBits));
+    }
+}  // End of MaskV6
+
+static inline char *octet_ntoa(uint32_t octet, char *buf) {
+    if (octet >= 100) {
+        *buf++ = octet >= 200 ? '2' : '1';
+        octet %= 100;
+        *buf++ = char_table[octet * 2];
+        *buf++ = char_table[octet * 2 + 1];
+    } else if (octet >= 10) {
+        *buf++ = char_table[octet * 2];
+        *buf++ = char_table[octet * 2 + 1];
+    } else {
+        *buf++ = '0' + octet;
+    }
+    return buf;
+}  // End of octet_ntoa
+
+static inline char *ip4_ntoa(uint32_t ip, char *buf) {
+    buf = octet_ntoa(ip >> 24, buf);
+    *buf++ = '.';
+    buf = octet_ntoa((ip >> 16) & 0xff, buf);
+    *buf++ = '.';
+    buf = octet_ntoa((ip >> 8) & 0xff, buf);
+    *buf++ = '.';
+    buf = octet_ntoa(ip & 0xff, buf);
+    *buf = '\0';
+    return buf;
+}  // End of ip4_ntoa
+
+static inline char *hex16_ntoa(uint32_t word, char *buf) {
+    // no leading zeros
+    if (word >= 0x1000) *buf++ = hex_table[word >> 12];
+    if (word >= 0x100) *buf++ = hex_table[(word >> 8) & 0xf];
+    if (word >= 0x10) *buf++ = hex_table[(word >> 4) & 0xf];
+    *buf++ = hex_table[word & 0xf];
+    return buf;
+}  // End of hex16_ntoa
+
+// RFC 5952 text - the longest run of at least two zero words is compressed,
+// IPv4 compatible and mapped addresses end with the dotted IPv4 address
+static inline char *ip6_ntoa(const uint64_t ip[2], char *buf) {
+    uint32_t words[8];
+    for (int i = 0; i < 4; i++) {
+        words[i] = (ip[0] >> (48 - 16 * i)) & 0xffff;
+        words[i + 4] = (ip[1] >> (48 - 16 * i)) & 0xffff;
+    }
+
+    // find the first longest run of zero words
+    int bestBase = -1, bestLen = 0;
+    int curBase = -1, curLen = 0;
+    for (int i = 0; i < 8; i++) {
+        if (words[i] == 0) {
+            if (curBase < 0) curBase = i;
+            curLen++;
+            if (curLen > bestLen) {
+                bestBase = curBase;
+                bestLen = curLen;
+            }
+        } else {
+            curBase = -1;
+            curLen = 0;
+        }
+    }
+    if (bestLen < 2) bestBase = -1;
+
+    for (int i = 0; i < 8; i++) {
+        if (i == bestBase) {
+            *buf++ = ':';
+            i += bestLen - 1;
+            if (i == 7) *buf++ = ':';
+            continue;
+        }
+        if (i) *buf++ = ':';
+        // embedded IPv4 address
+        if (i == 6 && bestBase == 0 && (bestLen == 6 || (bestLen == 5 && words[5] == 0xffff))) {
+            return ip4_ntoa((uint32_t)(ip[1] & 0xffffffff), buf);
+        }
+        buf = hex16_ntoa(words[i], buf);
+    }
+    *buf = '\0';
+    return buf;
+}  // End of ip6_ntoa
+
+typedef struct timeCache_s {
+    int valid;
+    time_t minute;                   // first second of the cached minute
+    char string[DATESTRINGLEN + 1];  // "YYYY-MM-DD HH:MM:" of the cached minute
+} timeCache_t;
+
+static _Thread_local timeCache_t localCache;
+static _Thread_local timeCache_t utcCache;
+
+// format 'when' as "%Y-%m-%d %H:%M:%S" - sep separates date and time
+static inline char *date_ntoa(time_t when, int utc, char sep, char *buf) {
+    timeCache_t *cache = utc ? &utcCache : &localCache;
+    if (!cache->valid || when < cache->minute || when >= (cache->minute + 60)) {
+        struct tm ts;
+        if (utc)
+            gmtime_r(&when, &ts);
+        else
+            localtime_r(&when, &ts);
+        uint32_t year = ts.tm_year + 1900;
+        if (year > 9999) year = 9999;
+        char *s = cache->string;
+        *s++ = char_table[(year / 100) * 2];
+        *s++ = char_table[(year / 100) * 2 + 1];
+        *s++ = char_table[(year % 100) * 2];
+        *s++ = char_table[(year % 100) * 2 + 1];
+        *s++ = '-';
+        *s++ = char_table[(ts.tm_mon + 1) * 2];
+        *s++ = char_table[(ts.tm_mon + 1) * 2 + 1];
+        *s++ = '-';
+        *s++ = char_table[ts.tm_mday * 2];
+        *s++ = char_table[ts.tm_mday * 2 + 1];
+        *s++ = ' ';
+        *s++ = char_table[ts.tm_hour * 2];
+        *s++ = char_table[ts.tm_hour * 2 + 1];
+        *s++ = ':';
+        *s++ = char_table[ts.tm_min * 2];
+        *s++ = char_table[ts.tm_min * 2 + 1];
+        *s++ = ':';
+        *s = '\0';
+        cache->minute = when - ts.tm_sec;
+        cache->valid = 1;
+    }
+
+    memcpy(buf, cache->string, DATESTRINGLEN - 2);
+    buf[10] = sep;
+    uint32_t sec = when - cache->minute;
+    buf[DATESTRINGLEN - 2] = char_table[sec * 2];
+    buf[DATESTRINGLEN - 1] = char_table[sec * 2 + 1];
+    buf[DATESTRINGLEN] = '\0';
+    return buf + DATESTRINGLEN;
+}  // End of date_ntoa
+
+// format msec time stamp as "%Y-%m-%d %H:%M:%S.msec"
+static inline char *msec_ntoa(uint64_t msec, int utc, char sep, char *buf) {
+    buf = date_ntoa((time_t)(msec / 1000LL), utc, sep, buf);
+    uint32_t ms = msec % 1000LL;
+    *buf++ = '.';
+    *buf++ = '0' + ms / 100;
+    *buf++ = char_table[(ms % 100) * 2];
+    *buf++ = char_table[(ms % 100) * 2 + 1];
+    *buf = '\0';
+    return buf;
+}  // End of msec_ntoa
+
+// hex value without leading zeros - same as "%x"
+static inline char *hex32_ntoa(uint32_t word, char *buf) {
+    int shift = 28;
+    while (shift && ((word >> shift) & 0xf) == 0) shift -= 4;
+    for (; shift >= 0; shift -= 4) *buf++ = hex_table[(word >> shift) & 0xf];
+    *buf = '\0';
+    return buf;
+}  // End of hex32_ntoa
+
+// mac address stored in the lower 48 bits - same as "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x"
+static inline char *mac_ntoa(uint64_t mac, char *buf) {
+    for (int i = 5; i >= 0; i--) {
+        uint32_t octet = (mac >> (i * 8)) & 0xFF;
+        *buf++ = hex_table[octet >> 4];
+        *buf++ = hex_table[octet & 0xf];
+        *buf++ = ':';
+    }
+    *--buf = '\0';
+    return buf;
+}  // End of mac_ntoa
+
+// usec value in msec with 6 decimals - same as "%f" of usec / 1000.0
+static inline char *usec_ntoa(uint64_t usec, char *buf) {
+    buf = itoa_u64(usec / 1000LL, buf);
+    uint32_t frac = usec % 1000LL;
+    *buf++ = '.';
+    *buf++ = '0' + frac / 100;
+    *buf++ = char_table[(frac % 100) * 2];
+    *buf++ = char_table[(frac % 100) * 2 + 1];
+    memcpy(buf, "000", 4);
+    return buf + 3;
+}  // End of usec_ntoa
+
+// 8 bytes with the byte value b in each byte
+#define BYTEMASK(b) (0x0101010101010101ULL * (b))
+// high bit set in each byte of x, which is < n (n <= 128)
+#define HASLESS(x, n) (((x) - BYTEMASK(n)) & ~(x) & BYTEMASK(0x80))
+// high bit set in each byte of x, which is zero
+#define HASZERO(x) (((x) - BYTEMASK(1)) & ~(x) & BYTEMASK(0x80))
+
+// copy string s as JSON string content into buf - escape '"', '\\' and control chars.
+// Clean 8 byte chunks are copied without per char checks. At most maxLen bytes are
+// written, a string longer than that is truncated
+static inline char *json_escape(const char *s, char *buf, size_t maxLen) {
+    size_t len = strlen(s);
+    char *end = buf + maxLen;
+    size_t i = 0;
+    while (i < len) {
+        while ((i + 8) <= len && (buf + 8) <= end) {
+            uint64_t chunk;
+            memcpy(&chunk, s + i, 8);
+            if (HASLESS(chunk, 0x20) | HASZERO(chunk ^ BYTEMASK('"')) | HASZERO(chunk ^ BYTEMASK('\\'))) break;
+            memcpy(buf, &chunk, 8);
+            buf += 8;
+            i += 8;
+        }
+        if (i == len) break;
+
+        uint8_t c = s[i++];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            if (buf == end) break;
+            *buf++ = c;
+        } else if (c == '"' || c == '\\') {
+            if ((buf + 2) > end) break;
+            *buf++ = '\\';
+            *buf++ = c;
+        } else {
+            if ((buf + 6) > end) break;
+            memcpy(buf, "\\u00", 4);
+            buf[4] = hex_table[c >> 4];
+            buf[5] = hex_table[c & 0xf];
+            buf += 6;
+        }
+    }
+    *buf = '\0';
+    return buf;
+}  // End of json_escape
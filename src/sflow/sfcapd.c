@@ -35,6 +35,7 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -56,11 +57,14 @@
 #include "pcap_reader.h"
 #endif
 
+#include "barrier.h"
 #include "bookkeeper.h"
 #include "collector.h"
 #include "conf/nfconf.h"
+#include "cpufeature.h"
 #include "daemon.h"
 #include "flist.h"
+#include "ingest.h"
 #include "launch.h"
 #include "metric.h"
 #include "nfdump.h"
@@ -95,6 +99,23 @@ static int verbose = 0;
 // Define a generic type to get data from socket or pcap file
 typedef ssize_t (*packet_function_t)(int, void *, size_t, int, struct sockaddr *, socklen_t *);
 
+// receive worker on its own SO_REUSEPORT socket
+typedef struct worker_s {
+    pthread_t tid;
+    uint32_t id;
+    int socket;
+    int final;                 // worker did its last rotation
+    FlowSource_t *FlowSource;  // private clones of all flow sources
+
+    // run() parameters
+    int rfd;
+    time_t twin;
+    time_t t_begin;
+    char *time_extension;
+    int compress;
+    int parse_gre;
+} worker_t;
+
 static option_t sfcapdConfig[] = {
     {.name = "gre", .valBool = 0, .flags = OPTDEFAULT}, {.name = "maxworkers", .valUint64 = 2, .flags = OPTDEFAULT}, {.name = NULL}};
 
@@ -105,6 +126,12 @@ static int done = 0;
 static int periodic_trigger;
 static int gotSIGCHLD = 0;
 
+// synchronise file rotation of all receive workers
+static pthread_control_barrier_t *rotateBarrier = NULL;
+static pthread_mutex_t rotateMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t repeaterMutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic int stopWorkers = 0;
+
 /* Local function Prototypes */
 static void usage(char *name);
 
@@ -112,10 +139,10 @@ static void signalPrivsepChild(pid_t child_pid, int pfd);
 
 static void IntHandler(int signal);
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss);
+static inline FlowSource_t *GetFlowSource(FlowSource_t *FlowSource, struct sockaddr_storage *ss);
 
-static void run(packet_function_t receive_packet, int socket, int pfd, int rfd, time_t twin, time_t t_begin, char *time_extension, int compress,
-                int parse_gre);
+static void run(packet_function_t receive_packet, int socket, FlowSource_t **sourceList, worker_t *worker, int pfd, int rfd, time_t twin,
+                time_t t_begin, char *time_extension, int compress, int parse_gre);
 
 /* Functions */
 static void usage(char *name) {
@@ -128,6 +155,7 @@ static void usage(char *name) {
         "-b host\t\tbind socket to host/IP addr\n"
         "-J mcastgroup\tJoin multicast group <mcastgroup>\n"
         "-p portnum\tlisten on port portnum\n"
+        "-N num\t\tReceive with num workers on SO_REUSEPORT sockets.\n"
 #ifdef PCAP
         "-f pcapfile\tRead network data from pcap file.\n"
         "-d device\tRead network data from device (interface).\n"
@@ -144,12 +172,14 @@ static void usage(char *name) {
         "-P pidfile\tset the PID file\n"
         "-R IP[/port]\tRepeat incoming packets to IP address/port. Max 8 repeaters.\n"
         "-A\t\tEnable source address spoofing for packet repeater -R.\n"
+        "-a timeout\tAggregate samples of the same flow for timeout seconds.\n"
         "-x process\tlaunch process after a new file becomes available\n"
         "-W workers\toptionally set the number of workers to compress flows\n"
         "-z=lzo\t\tLZO compress flows in output file.\n"
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
+        "-z=zstd:auto\tAdapt the compression level to the load. Also lz4:auto.\n"
         "-B bufflen\tSet socket buffer to bufflen bytes\n"
         "-e\t\tExpire data at each cycle.\n"
         "-D\t\tFork to background\n"
@@ -158,6 +188,7 @@ static void usage(char *name) {
         "-4\t\tListen on IPv4 (default).\n"
         "-6\t\tListen on IPv6.\n"
         "-X <extlist>\t',' separated list of extensions (numbers). Default all extensions.\n"
+        "-F filter\tStore only flows matching the nfdump filter.\n"
         "-V\t\tPrint version and exit.\n"
         "-Z\t\tAdd timezone offset to filename.\n",
         name);
@@ -271,19 +302,26 @@ static int SendRepeaterMessage(int fd, void *in_buff, size_t cnt, struct sockadd
     return 0;
 }  // End of SendRepeaterMessage
 
-static void run(packet_function_t receive_packet, int socket, int pfd, int rfd, time_t twin, time_t t_begin, char *time_extension, int compress,
-                int parse_gre) {
+static void run(packet_function_t receive_packet, int socket, FlowSource_t **sourceList, worker_t *worker, int pfd, int rfd, time_t twin,
+                time_t t_begin, char *time_extension, int compress, int parse_gre) {
     struct sockaddr_storage sf_sender;
     socklen_t sf_sender_size = sizeof(sf_sender);
 
+#ifdef PCAP
     void *in_buff = malloc(NETWORK_INPUT_BUFF_SIZE);
     if (!in_buff) {
         LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return;
     }
+#else
+    // datagrams are received in batches and dispatched one by one
+    void *in_buff = NULL;
+    recvBatch_t *recvBatch = NewRecvBatch(socket, NETWORK_INPUT_BUFF_SIZE);
+    if (!recvBatch) return;
+#endif
 
     // Init each sflow source output data buffer
-    FlowSource_t *fs = FlowSource;
+    FlowSource_t *fs = *sourceList;
     while (fs) {
         // prepare file
         fs->nffile = OpenNewFile(fs->current, NULL, CREATOR_SFCAPD, compress, NOT_ENCRYPTED);
@@ -310,7 +348,8 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
     uint64_t packets = 0;
 
     // wake up at least at next time slot (twin) + 1s
-    alarm(t_start + twin + 1 - time(NULL));
+    // receive workers wake up by the socket receive timeout
+    if (!worker) alarm(t_start + twin + 1 - time(NULL));
     /*
      * Main processing loop:
      * this loop, continues until  = 1, set by the signal handler
@@ -334,10 +373,11 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
                 continue;
             }
 #else
-            cnt = recvfrom(socket, in_buff, NETWORK_INPUT_BUFF_SIZE, 0, (struct sockaddr *)&sf_sender, &sf_sender_size);
+            cnt = RecvBatchPacket(recvBatch, &in_buff, &sf_sender, &sf_sender_size);
 #endif
             if (cnt == -1) {
-                if (errno != EINTR) {
+                // receive timeout of a worker socket - check the time slot
+                if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
                     LogError("recvfrom() error in '%s', line '%d', cnt: %d:, %s", __FILE__, __LINE__, cnt, strerror(errno));
                     continue;
                 }
@@ -353,23 +393,57 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
 
         if (((t_now - t_start) >= twin) || done) {
             // rotate cycle
-            alarm(0);
+            int final = done;
+
+            // write aggregated samples into the current files
+            FlushSflowCache(*sourceList);
+
+            if (worker) {
+                // workers append to the same files
+                pthread_mutex_lock(&rotateMutex);
+                int ok = RotateFlowFiles(t_start, time_extension, *sourceList, final);
+                pthread_mutex_unlock(&rotateMutex);
+                if (ok == 0) {
+                    // terminate all workers
+                    done = 1;
+                    final = 1;
+                }
+                LogInfo("Worker %u: Total packets received: %llu avg: %3.2f ignored packets: %u", worker->id, packets,
+                        (double)packets / (double)twin, ignored_packets);
+            } else {
+                alarm(0);
 
-            if (RotateFlowFiles(t_start, time_extension, FlowSource, done) == 0) {
-                return;
-            }
+                if (RotateFlowFiles(t_start, time_extension, *sourceList, done) == 0) {
+                    return;
+                }
 
-            if (pfd && TriggerLauncher(t_start, time_extension, pfd, FlowSource) == 0) {
-                LogError("Disable launcher due to errors");
-                close(pfd);
-                pfd = 0;
+                if (pfd && TriggerLauncher(t_start, time_extension, pfd, *sourceList) == 0) {
+                    LogError("Disable launcher due to errors");
+                    close(pfd);
+                    pfd = 0;
+                }
+                LogInfo("Total packets received: %llu avg: %3.2f ignored packets: %u", packets, (double)packets / (double)twin, ignored_packets);
             }
-
-            LogInfo("Total packets received: %llu avg: %3.2f ignored packets: %u", packets, (double)packets / (double)twin, ignored_packets);
             ignored_packets = 0;
             periodic_trigger = 0;
 
-            if (done) break;
+            if (worker) {
+                // wait for all workers to finish this time slot
+                worker->final = final;
+                pthread_control_barrier_wait(rotateBarrier);
+                if (final) break;
+                if (stopWorkers) {
+                    // other workers terminated - close the files of the next slot
+                    t_start += twin;
+                    FlushSflowCache(*sourceList);
+                    pthread_mutex_lock(&rotateMutex);
+                    RotateFlowFiles(t_start, time_extension, *sourceList, 1);
+                    pthread_mutex_unlock(&rotateMutex);
+                    break;
+                }
+            } else if (done) {
+                break;
+            }
 
             /*
              * update alarm for next cycle
@@ -379,7 +453,7 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
              * - t_now = difference value to now
              */
             t_start += twin;
-            alarm(t_start + twin + 1 - t_now);
+            if (!worker) alarm(t_start + twin + 1 - t_now);
         }
 
         /* check for EINTR and continue */
@@ -391,17 +465,21 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
 
         // repeat this packet
         if (rfd) {
-            if (SendRepeaterMessage(rfd, in_buff, cnt, &sf_sender, sf_sender_size) != 0) {
+            if (worker) pthread_mutex_lock(&repeaterMutex);
+            int err = SendRepeaterMessage(rfd, in_buff, cnt, &sf_sender, sf_sender_size);
+            if (worker) pthread_mutex_unlock(&repeaterMutex);
+            if (err != 0) {
                 LogError("Disable packet repeater due to errors");
-                close(rfd);
+                // the pipe is shared by all workers
+                if (!worker) close(rfd);
                 rfd = 0;
             }
         }
 
         // get flow source record for current packet, identified by sender IP address
-        fs = GetFlowSource(&sf_sender);
+        fs = GetFlowSource(*sourceList, &sf_sender);
         if (fs == NULL) {
-            fs = AddDynamicSource(&FlowSource, &sf_sender);
+            fs = AddDynamicSource(sourceList, &sf_sender);
             if (fs == NULL) {
                 LogError("Skip UDP packet. Ignored packets so far %u packets", ignored_packets);
                 ignored_packets++;
@@ -436,9 +514,13 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
         // now.
     }
 
+#ifdef PCAP
     free(in_buff);
+#else
+    FreeRecvBatch(recvBatch);
+#endif
 
-    fs = FlowSource;
+    fs = *sourceList;
     while (fs) {
         FreeDataBlock(fs->dataBlock);
         DisposeFile(fs->nffile);
@@ -448,18 +530,94 @@ static void run(packet_function_t receive_packet, int socket, int pfd, int rfd,
 
 } /* End of run */
 
+__attribute__((noreturn)) static void *receiveWorker(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+
+    dbg_printf("receiveWorker %u started\n", worker->id);
+    PinWorker();
+    run(recvfrom, worker->socket, &worker->FlowSource, worker, 0, worker->rfd, worker->twin, worker->t_begin, worker->time_extension,
+        worker->compress, worker->parse_gre);
+
+    if (!worker->final) {
+        // run() failed - let the other workers terminate
+        LogError("Worker %u terminated due to errors", worker->id);
+        done = 1;
+        worker->final = 1;
+        pthread_control_barrier_wait(rotateBarrier);
+    }
+
+    dbg_printf("receiveWorker %u exit\n", worker->id);
+    pthread_exit(NULL);
+
+}  // End of receiveWorker
+
+// launch the receive workers and trigger the launcher, after all workers rotated their files
+static void runWorkers(worker_t *workers, uint32_t numWorkers, int pfd, time_t twin, time_t t_begin, char *time_extension) {
+    rotateBarrier = pthread_control_barrier_init(numWorkers);
+    if (!rotateBarrier) {
+        LogError("pthread_control_barrier_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        int err = pthread_create(&(workers[i].tid), NULL, receiveWorker, (void *)&workers[i]);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+
+    time_t t_start = t_begin;
+    int allFinal = 0;
+    while (!allFinal) {
+        pthread_controller_wait(rotateBarrier);
+
+        int anyFinal = 0;
+        allFinal = 1;
+        for (uint32_t i = 0; i < numWorkers; i++) {
+            anyFinal |= workers[i].final;
+            allFinal &= workers[i].final;
+        }
+
+        // all workers wrote their files of this slot
+        if (pfd && TriggerLauncher(t_start, time_extension, pfd, workers[0].FlowSource) == 0) {
+            LogError("Disable launcher due to errors");
+            close(pfd);
+            pfd = 0;
+        }
+
+        stopWorkers = anyFinal;
+        pthread_control_barrier_release(rotateBarrier);
+        if (anyFinal) break;
+
+        t_start += twin;
+    }
+
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        if (pthread_join(workers[i].tid, NULL)) {
+            LogError("pthread_join() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        }
+    }
+
+    // not all workers terminated with the last slot, so they wrote the next slot
+    if (!allFinal && pfd) TriggerLauncher(t_start + twin, time_extension, pfd, workers[0].FlowSource);
+
+    pthread_control_barrier_destroy(rotateBarrier);
+
+}  // End of runWorkers
+
 int main(int argc, char **argv) {
     char *bindhost, *datadir, *launch_process;
     char *userid, *groupid, *listenport, *mcastgroup;
     char *Ident, *dynFlowDir, *time_extension, *pidfile, *configFile, *metricSocket;
-    char *extensionList, *options;
+    char *extensionList, *options, *ingestFilter;
     packet_function_t receive_packet;
     repeater_t repeater[MAX_REPEATERS];
     FlowSource_t *fs;
     int family, bufflen, metricInterval;
     time_t twin;
     int sock, do_daemonize, expire, spec_time_extension, parse_gre;
-    int subdir_index, compress, srcSpoofing;
+    int subdir_index, compress, srcSpoofing, aggregate, receivers;
     uint64_t workers;
 #ifdef PCAP
     char *pcap_file = NULL;
@@ -492,12 +650,15 @@ int main(int argc, char **argv) {
     metricSocket = NULL;
     metricInterval = 60;
     extensionList = NULL;
+    ingestFilter = NULL;
     options = NULL;
     workers = 0;
     parse_gre = 0;
+    aggregate = 0;
+    receivers = 1;
 
     int c;
-    while ((c = getopt(argc, argv, "46AB:b:C:d:DeEf:g:hI:i:jJ:l:m:M:n:o:p:P:R:S:T:t:u:vVW:w:x:X:yz::Z:")) != EOF) {
+    while ((c = getopt(argc, argv, "46a:AB:b:C:d:DeEf:F:g:hI:i:jJ:l:m:M:n:N:o:p:P:R:S:T:t:u:vVW:w:x:X:yz::Z:")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -549,6 +710,7 @@ int main(int argc, char **argv) {
                 break;
             case 'V':
                 printf("%s: %s\n", argv[0], versionString());
+                printf("%s\n", CPUDispatchInfo());
                 exit(EXIT_SUCCESS);
                 break;
             case 'D':
@@ -640,6 +802,14 @@ int main(int argc, char **argv) {
 
                 break;
             }
+            case 'a':
+                CheckArgLen(optarg, 16);
+                aggregate = atoi(optarg);
+                if (aggregate < 1 || aggregate > 3600) {
+                    LogError("Aggregation timeout out of range 1..3600s");
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'A':
                 srcSpoofing = 1;
                 if (RunAsRoot() == 0) {
@@ -684,6 +854,10 @@ int main(int argc, char **argv) {
                 CheckArgLen(optarg, 128);
                 extensionList = strdup(optarg);
                 break;
+            case 'F':
+                CheckArgLen(optarg, 4096);
+                ingestFilter = optarg;
+                break;
             case 'W':
                 CheckArgLen(optarg, 16);
                 workers = (uint64_t)atoi(optarg);
@@ -696,6 +870,14 @@ int main(int argc, char **argv) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'N':
+                CheckArgLen(optarg, 16);
+                receivers = atoi(optarg);
+                if (receivers < 1 || receivers > MAXWORKERS) {
+                    LogError("Number of receive workers out of range 1..%d", MAXWORKERS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'j':
                 if (compress) {
                     LogError("Use one compression: -z for LZO, -j for BZ2 or -y for LZ4 compression");
@@ -764,6 +946,8 @@ int main(int argc, char **argv) {
         if (strcmp(argv[optind], "privsep") == 0) {
             if (strcmp(argv[optind + 1], "launcher") == 0) {
                 dbg_printf("sfcapd privsep launched\n");
+                // launcher limits are read from the config file
+                if (ConfOpen(configFile, "sfcapd") < 0) exit(EXIT_FAILURE);
                 int ret = StartupLauncher(launch_process, expire);
                 exit(ret);
             } else if (strcmp(argv[optind + 1], "repeater") == 0) {
@@ -802,11 +986,26 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (!SetupIngest(FlowSource, ingestFilter)) exit(EXIT_FAILURE);
+
     if (bindhost && mcastgroup) {
         LogError("ERROR, -b and -j are mutually exclusive!!");
         exit(EXIT_FAILURE);
     }
 
+    if (receivers > 1) {
+        if (mcastgroup || dynFlowDir) {
+            LogError("ERROR, -N is not compatible with -J or -M");
+            exit(EXIT_FAILURE);
+        }
+#ifdef PCAP
+        if (pcap_file || pcap_device) {
+            LogError("ERROR, -N is not compatible with -f or -d");
+            exit(EXIT_FAILURE);
+        }
+#endif
+    }
+
     ConfGetUint64(sfcapdConfig, "maxworkers", &workers);
     if (!Init_nffile(workers, NULL)) exit(254);
 
@@ -837,13 +1036,32 @@ int main(int argc, char **argv) {
         if (mcastgroup)
         sock = Multicast_receive_socket(mcastgroup, listenport, family, bufflen);
     else
-        sock = Unicast_receive_socket(bindhost, listenport, family, bufflen);
+        sock = Unicast_receive_socket(bindhost, listenport, family, bufflen, receivers > 1);
 
     if (sock == -1) {
         LogError("Terminated due to errors");
         exit(EXIT_FAILURE);
     }
 
+    // each receive worker gets its own socket on the same port. The kernel distributes
+    // the datagrams by the sender address and port, so an agent sticks to one worker
+    worker_t *workerList = NULL;
+    if (receivers > 1) {
+        workerList = (worker_t *)calloc(receivers, sizeof(worker_t));
+        if (!workerList) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+        workerList[0].socket = sock;
+        for (int i = 1; i < receivers; i++) {
+            workerList[i].socket = Unicast_receive_socket(bindhost, listenport, family, bufflen, 1);
+            if (workerList[i].socket == -1) {
+                LogError("Terminated due to errors");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
     pid_t repeater_pid = 0;
     int rfd = 0;
     if (repeater[0].hostname) {
@@ -852,7 +1070,7 @@ int main(int argc, char **argv) {
 
     SetPriv(userid, groupid);
 
-    if (!Init_sflow(verbose, extensionList)) {
+    if (!Init_sflow(verbose, extensionList, aggregate)) {
         LogError("Init_sflow() failed");
         exit(EXIT_FAILURE);
     }
@@ -878,6 +1096,12 @@ int main(int argc, char **argv) {
         close(sock);
         exit(EXIT_FAILURE);
     }
+    if (!OpenMetricHTTP()) {
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
+    MetricSocket(sock);
+    for (int i = 1; i < receivers && workerList; i++) MetricSocket(workerList[i].socket);
 
     int launcher_pid = 0;
     int pfd = 0;
@@ -919,11 +1143,51 @@ int main(int argc, char **argv) {
     sigaction(SIGCHLD, &act, NULL);
     sigaction(SIGPIPE, &act, NULL);
 
-    LogInfo("Startup sfcapd.");
-    run(receive_packet, sock, pfd, rfd, twin, t_start, time_extension, compress, parse_gre);
+    // many sources write their files through one pool of writers
+    if (((FlowSource && FlowSource->next) || dynFlowDir) && !StartWriterPool(0)) {
+        LogError("Failed to start writer pool - continue with writers per source");
+    }
+
+    LogVerbose("%s", CPUDispatchInfo());
+    if (receivers > 1) {
+        for (int i = 0; i < receivers; i++) {
+            worker_t *worker = &workerList[i];
+            worker->id = i;
+            worker->FlowSource = CloneFlowSources(FlowSource, i);
+            if (!worker->FlowSource) exit(255);
+            worker->rfd = rfd;
+            worker->twin = twin;
+            worker->t_begin = t_start;
+            worker->time_extension = time_extension;
+            worker->compress = compress;
+            worker->parse_gre = parse_gre;
+
+            // wake up the worker at least once a second, to check the time slot
+            struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+            if (setsockopt(worker->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
+                LogError("setsockopt(SO_RCVTIMEO) error: %s", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        LogInfo("Startup sfcapd with %d receive workers.", receivers);
+        runWorkers(workerList, receivers, pfd, twin, t_start, time_extension);
+
+        for (int i = 0; i < receivers; i++) {
+            if (i > 0) close(workerList[i].socket);
+            FreeFlowSourceClones(workerList[i].FlowSource);
+        }
+        free(workerList);
+    } else {
+        LogInfo("Startup sfcapd.");
+        run(receive_packet, sock, &FlowSource, NULL, pfd, rfd, twin, t_start, time_extension, compress, parse_gre);
+    }
 
     // shutdown
     close(sock);
+    // all rotated files are in place and the launcher got all messages
+    FlushFinalizer();
+    StopIngest();
     signalPrivsepChild(launcher_pid, pfd);
     signalPrivsepChild(repeater_pid, rfd);
     CloseMetric();
@@ -54,6 +54,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "ingest.h"
 #include "metric.h"
 #include "nfdump.h"
 #include "nfxV3.h"
@@ -78,20 +79,84 @@ typedef struct exporter_sflow_s {
 
     sampler_t *sampler;
 
+    struct aggrCache_s *aggrCache;  // sample aggregation cache, if enabled
+
 } exporter_sflow_t;
 
+/*
+ * Sample aggregation
+ * Each sample is stored as a flow record with the packet and byte counters
+ * scaled by the sampling rate. If aggregation is enabled, the records of an
+ * exporter, which differ only in time stamps, counters and tcp flags, are
+ * merged in a flow cache. The cache is flushed into the data block at least
+ * every aggrTimeout seconds, if it is full and before the file is rotated.
+ * The flush order is the order in which the flows have been seen.
+ */
+
+// max size of a sflow V3 record
+#define MAXSFLOWRECORDSIZE 1024
+
+// memory chunk size for cache entries
+#define AGGRCHUNKSIZE (1024 * 1024)
+
+// initial hash size 2^(32 - AGGRHASHSHIFT) cells
+#define AGGRHASHSHIFT 16
+
+// flush the cache, if it holds more than AGGRMAXENTRIES flows
+#define AGGRMAXENTRIES (1024 * 1024)
+
+// cell index calculation from 32bit hash, depending of hash bit size 'shift'
+#define ___fib_hash(hash, shift) ((hash) * 2654435769U) >> (shift)
+
+typedef struct aggrEntry_s {
+    uint32_t hash;
+    uint16_t size;  // size of the record
+    uint8_t tcpFlags;
+    uint8_t fill;
+    uint64_t msecFirst;
+    uint64_t msecLast;
+    uint64_t msecReceived;
+    uint64_t inPackets;
+    uint64_t inBytes;
+    // V3 record with cleared genericFlow time stamps, counters and tcp flags
+    uint8_t record[];
+} aggrEntry_t;
+
+typedef struct aggrCache_s {
+    uint8_t *flags;       // 0 - free cell, 0x80 | lower 7 bits of hash - used cell
+    aggrEntry_t **cells;  // hash cells
+    uint32_t count;       // number of flows in cache
+    uint32_t capacity;    // number of cells
+    uint32_t mask;        // mask for max index
+    uint32_t loadFactor;  // no more than loadFactor until resize
+    int shift;            // 32 - shift = bit width of hash
+    uint64_t msecFlush;   // time of next flush
+
+    // entry memory chunks - reused after each flush
+    void **chunks;
+    uint32_t *chunkUsed;  // used bytes per chunk
+    uint32_t numChunks;
+    uint32_t currentChunk;
+} aggrCache_t;
+
 static int PrintRecord = 0;
 
+// aggregation timeout in msec - 0 if disabled
+static uint64_t aggrTimeout = 0;
+
 static int ExtensionsEnabled[MAXEXTENSIONS];
 uint32_t BaseRecordSize = EXgenericFlowSize;
 
 static exporter_sflow_t *GetExporter(FlowSource_t *fs, uint32_t agentSubId, uint32_t meanSkipCount);
 
 #include "inline.c"
+#include "metrohash.c"
 #include "nffile_inline.c"
 
-int Init_sflow(int verbose, char *extensionList) {
+int Init_sflow(int verbose, char *extensionList, int aggregate) {
     PrintRecord = verbose;
+    aggrTimeout = 1000LL * aggregate;
+    if (aggregate) LogInfo("SFLOW: Aggregate samples for %d seconds", aggregate);
 
     if (extensionList) {
         // Disable all extensions
@@ -209,6 +274,7 @@ static exporter_sflow_t *GetExporter(FlowSource_t *fs, uint32_t agentSubId, uint
         .sequence_failure = 0,
         .packets = 0,
         .flows = 0,
+        .aggrCache = NULL,
     };
 
     sampler_t *sampler = (sampler_t *)malloc(sizeof(sampler_t));
@@ -236,25 +302,8 @@ static exporter_sflow_t *GetExporter(FlowSource_t *fs, uint32_t agentSubId, uint
 
 }  // End of GetExporter
 
-// store sflow in nfdump format
-void StoreSflowRecord(SFSample *sample, FlowSource_t *fs) {
-    dbg_printf("StoreSflowRecord\n");
-
-    struct timeval now;
-    gettimeofday(&now, NULL);
-
-    exporter_sflow_t *exporter = GetExporter(fs, sample->agentSubId, sample->meanSkipCount);
-    if (!exporter) {
-        LogError("SFLOW: Exporter NULL: Abort sflow record processing");
-        return;
-    }
-    exporter->packets++;
-
-    if (sample->ip_fragmentOffset > 0) {
-        sample->dcd_sport = 0;
-        sample->dcd_dport = 0;
-    }
-
+// calculate the size of the V3 record of a sample
+static uint32_t SflowRecordSize(SFSample *sample, FlowSource_t *fs) {
     uint32_t recordSize = BaseRecordSize;
 
     int isV4 = sample->ipsrc.type == SFLADDRESSTYPE_IP_V4;
@@ -266,7 +315,6 @@ void StoreSflowRecord(SFSample *sample, FlowSource_t *fs) {
     if (isV6 && ExtensionsEnabled[EXipv6FlowID]) {
         recordSize += EXipv6FlowSize;
     }
-    dbg_printf("IPv4: %u, IPv6: %u\n", isV4, isV6);
 
     if (sample->nextHop.type == SFLADDRESSTYPE_IP_V4 && ExtensionsEnabled[EXipNextHopV4ID]) {
         recordSize += EXipNextHopV4Size;
@@ -301,13 +349,16 @@ void StoreSflowRecord(SFSample *sample, FlowSource_t *fs) {
         recordSize += EXipReceivedV6Size;
     }
 
-    recordSize += sizeof(recordHeaderV3_t);
-    if (!IsAvailable(fs->dataBlock, recordSize)) {
-        // flush block - get an empty one
-        fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
-    }
+    return recordSize + sizeof(recordHeaderV3_t);
+
+}  // End of SflowRecordSize
+
+// fill the V3 record of a sample into buffPtr
+static recordHeaderV3_t *FillSflowRecord(void *buffPtr, SFSample *sample, FlowSource_t *fs, exporter_sflow_t *exporter, uint64_t msec) {
+    int isV4 = sample->ipsrc.type == SFLADDRESSTYPE_IP_V4;
+    int isV6 = sample->ipsrc.type == SFLADDRESSTYPE_IP_V6;
+    dbg_printf("IPv4: %u, IPv6: %u\n", isV4, isV6);
 
-    void *buffPtr = GetCurrentCursor(fs->dataBlock);
     dbg_printf("Fill Record\n");
     AddV3Header(buffPtr, recordHeader);
 
@@ -317,7 +368,6 @@ void StoreSflowRecord(SFSample *sample, FlowSource_t *fs) {
 
     // pack V3 record
     PushExtension(recordHeader, EXgenericFlow, genericFlow);
-    uint64_t msec = now.tv_sec * 1000L + now.tv_usec / 1000;
     *genericFlow = (EXgenericFlow_t){
         .msecFirst = msec,
         .msecLast = msec,
@@ -458,10 +508,21 @@ void StoreSflowRecord(SFSample *sample, FlowSource_t *fs) {
         dbg_printf("Add IPv6 route IP extension\n");
     }
 
+    return recordHeader;
+
+}  // End of FillSflowRecord
+
+// account the record at the cursor of the data block and advance the cursor
+static void CommitSflowRecord(FlowSource_t *fs, exporter_sflow_t *exporter, recordHeaderV3_t *recordHeader) {
+    // dropped by the ingest filter - the cursor is not advanced
+    if (!IngestRecord(fs, recordHeader, NULL)) return;
+
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)((void *)recordHeader + sizeof(recordHeaderV3_t) + sizeof(elementHeader_t));
+
     // update first_seen, last_seen
     if (genericFlow->msecFirst < fs->msecFirst)  // the very first time stamp need to be set
         fs->msecFirst = genericFlow->msecFirst;
-    fs->msecLast = genericFlow->msecFirst;
+    if (genericFlow->msecLast > fs->msecLast) fs->msecLast = genericFlow->msecLast;
 
     // Update stats
     stat_record_t *stat_record = fs->nffile->stat_record;
@@ -492,11 +553,258 @@ void StoreSflowRecord(SFSample *sample, FlowSource_t *fs) {
     stat_record->numbytes += genericFlow->inBytes;
 
     uint32_t exporterIdent = MetricExpporterID(recordHeader);
-    UpdateMetric(fs->nffile->ident, exporterIdent, genericFlow);
+    UpdateMetric(fs, exporterIdent, genericFlow);
 
     if (PrintRecord) {
         flow_record_short(stdout, recordHeader);
     }
+    // update file record size ( -> output buffer size )
+    fs->dataBlock->NumRecords++;
+    fs->dataBlock->size += recordHeader->size;
+
+}  // End of CommitSflowRecord
+
+static aggrCache_t *NewAggrCache(uint64_t msec) {
+    aggrCache_t *cache = (aggrCache_t *)calloc(1, sizeof(aggrCache_t));
+    if (!cache) {
+        LogError("SFLOW: calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    cache->shift = AGGRHASHSHIFT;
+    cache->capacity = 1 << (32 - AGGRHASHSHIFT);
+    cache->mask = cache->capacity - 1;
+    cache->loadFactor = cache->capacity >> 1;
+    cache->flags = (uint8_t *)calloc(cache->capacity, sizeof(uint8_t));
+    cache->cells = (aggrEntry_t **)calloc(cache->capacity, sizeof(aggrEntry_t *));
+    if (!cache->flags || !cache->cells) {
+        LogError("SFLOW: calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(cache->flags);
+        free(cache->cells);
+        free(cache);
+        return NULL;
+    }
+    cache->msecFlush = msec + aggrTimeout;
+
+    return cache;
+
+}  // End of NewAggrCache
+
+// double the hash size and rearrange the cells
+static int ResizeAggrCache(aggrCache_t *cache) {
+    uint32_t capacity = 1u << (32 - (cache->shift - 1));
+    uint8_t *flags = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+    aggrEntry_t **cells = (aggrEntry_t **)calloc(capacity, sizeof(aggrEntry_t *));
+    if (!flags || !cells) {
+        LogError("SFLOW: calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(flags);
+        free(cells);
+        return 0;
+    }
+
+    cache->shift--;
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        if (cache->flags[i] == 0) continue;
+        uint32_t cell = ___fib_hash(cache->cells[i]->hash, cache->shift);
+        while (flags[cell]) cell = (cell + 1) & mask;
+        flags[cell] = cache->flags[i];
+        cells[cell] = cache->cells[i];
+    }
+    free(cache->flags);
+    free(cache->cells);
+    cache->flags = flags;
+    cache->cells = cells;
+    cache->capacity = capacity;
+    cache->mask = mask;
+    cache->loadFactor = capacity >> 1;
+
+    return 1;
+
+}  // End of ResizeAggrCache
+
+// get memory for a new cache entry from the current chunk
+static aggrEntry_t *NewAggrEntry(aggrCache_t *cache, uint32_t size) {
+    size = (size + 7) & ~7;
+    if (cache->numChunks && (cache->chunkUsed[cache->currentChunk] + size) > AGGRCHUNKSIZE) cache->currentChunk++;
+
+    if (cache->currentChunk == cache->numChunks) {
+        void **chunks = realloc(cache->chunks, (cache->numChunks + 1) * sizeof(void *));
+        uint32_t *chunkUsed = realloc(cache->chunkUsed, (cache->numChunks + 1) * sizeof(uint32_t));
+        if (chunks) cache->chunks = chunks;
+        if (chunkUsed) cache->chunkUsed = chunkUsed;
+        void *chunk = chunks && chunkUsed ? malloc(AGGRCHUNKSIZE) : NULL;
+        if (!chunk) {
+            LogError("SFLOW: malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            if (cache->numChunks) cache->currentChunk--;
+            return NULL;
+        }
+        cache->chunks[cache->numChunks] = chunk;
+        cache->chunkUsed[cache->numChunks] = 0;
+        cache->numChunks++;
+    }
+
+    aggrEntry_t *entry = (aggrEntry_t *)(cache->chunks[cache->currentChunk] + cache->chunkUsed[cache->currentChunk]);
+    cache->chunkUsed[cache->currentChunk] += size;
+    return entry;
+
+}  // End of NewAggrEntry
+
+// write all flows of the cache into the data block and clear the cache
+static void FlushAggrCache(FlowSource_t *fs, exporter_sflow_t *exporter, uint64_t msec) {
+    aggrCache_t *cache = exporter->aggrCache;
+    dbg_printf("SFLOW: Flush %u aggregated flows\n", cache->count);
+
+    // chunks hold the entries in the order of insertion
+    for (uint32_t i = 0; i < cache->numChunks && i <= cache->currentChunk; i++) {
+        uint32_t offset = 0;
+        while (offset < cache->chunkUsed[i]) {
+            aggrEntry_t *entry = (aggrEntry_t *)(cache->chunks[i] + offset);
+            offset += (sizeof(aggrEntry_t) + entry->size + 7) & ~7;
+
+            if (!IsAvailable(fs->dataBlock, entry->size)) {
+                // flush block - get an empty one
+                fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+            }
+            void *buffPtr = GetCurrentCursor(fs->dataBlock);
+            memcpy(buffPtr, entry->record, entry->size);
+
+            recordHeaderV3_t *recordHeader = (recordHeaderV3_t *)buffPtr;
+            EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)(buffPtr + sizeof(recordHeaderV3_t) + sizeof(elementHeader_t));
+            genericFlow->msecFirst = entry->msecFirst;
+            genericFlow->msecLast = entry->msecLast;
+            genericFlow->msecReceived = entry->msecReceived;
+            genericFlow->inPackets = entry->inPackets;
+            genericFlow->inBytes = entry->inBytes;
+            genericFlow->tcpFlags = entry->tcpFlags;
+
+            CommitSflowRecord(fs, exporter, recordHeader);
+        }
+        cache->chunkUsed[i] = 0;
+    }
+
+    memset(cache->flags, 0, cache->capacity * sizeof(uint8_t));
+    cache->count = 0;
+    cache->currentChunk = 0;
+    cache->msecFlush = msec + aggrTimeout;
+
+}  // End of FlushAggrCache
+
+// merge the record into the aggregation cache of the exporter
+static void AggregateSflowRecord(FlowSource_t *fs, exporter_sflow_t *exporter, recordHeaderV3_t *recordHeader, uint64_t msec) {
+    aggrCache_t *cache = exporter->aggrCache;
+    if (!cache) {
+        cache = exporter->aggrCache = NewAggrCache(msec);
+        if (!cache) return;
+    }
+    if (msec >= cache->msecFlush || cache->count >= AGGRMAXENTRIES) FlushAggrCache(fs, exporter, msec);
+    if (cache->count == cache->loadFactor && !ResizeAggrCache(cache)) return;
+
+    // move the aggregated values out of the record
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)((void *)recordHeader + sizeof(recordHeaderV3_t) + sizeof(elementHeader_t));
+    uint64_t msecReceived = genericFlow->msecReceived;
+    uint64_t inPackets = genericFlow->inPackets;
+    uint64_t inBytes = genericFlow->inBytes;
+    uint8_t tcpFlags = genericFlow->tcpFlags;
+    genericFlow->msecFirst = 0;
+    genericFlow->msecLast = 0;
+    genericFlow->msecReceived = 0;
+    genericFlow->inPackets = 0;
+    genericFlow->inBytes = 0;
+    genericFlow->tcpFlags = 0;
+
+    uint32_t size = recordHeader->size;
+    uint32_t hash = (uint32_t)metrohash64_1((const uint8_t *)recordHeader, size, 0);
+    uint8_t flag = 0x80 | (hash & 0x7F);
+
+    uint32_t cell = ___fib_hash(hash, cache->shift);
+    while (cache->flags[cell]) {
+        aggrEntry_t *entry = cache->cells[cell];
+        if (cache->flags[cell] == flag && entry->hash == hash && entry->size == size && memcmp(entry->record, recordHeader, size) == 0) {
+            if (msec < entry->msecFirst) entry->msecFirst = msec;
+            if (msec > entry->msecLast) entry->msecLast = msec;
+            entry->msecReceived = msecReceived;
+            entry->inPackets += inPackets;
+            entry->inBytes += inBytes;
+            entry->tcpFlags |= tcpFlags;
+            return;
+        }
+        cell = (cell + 1) & cache->mask;
+    }
+
+    // new flow
+    aggrEntry_t *entry = NewAggrEntry(cache, sizeof(aggrEntry_t) + size);
+    if (!entry) return;
+    *entry = (aggrEntry_t){
+        .hash = hash,
+        .size = size,
+        .tcpFlags = tcpFlags,
+        .msecFirst = msec,
+        .msecLast = msec,
+        .msecReceived = msecReceived,
+        .inPackets = inPackets,
+        .inBytes = inBytes,
+    };
+    memcpy(entry->record, recordHeader, size);
+    cache->flags[cell] = flag;
+    cache->cells[cell] = entry;
+    cache->count++;
+
+}  // End of AggregateSflowRecord
+
+// flush the aggregation caches of all exporters of all flow sources
+void FlushSflowCache(FlowSource_t *fs) {
+    if (aggrTimeout == 0) return;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t msec = now.tv_sec * 1000L + now.tv_usec / 1000;
+
+    for (; fs; fs = fs->next) {
+        if (!fs->nffile) continue;
+        for (exporter_sflow_t *exporter = (exporter_sflow_t *)fs->exporter_data; exporter; exporter = exporter->next) {
+            if (exporter->aggrCache && exporter->aggrCache->count) FlushAggrCache(fs, exporter, msec);
+        }
+    }
+
+}  // End of FlushSflowCache
+
+// store sflow in nfdump format
+void StoreSflowRecord(SFSample *sample, FlowSource_t *fs) {
+    dbg_printf("StoreSflowRecord\n");
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t msec = now.tv_sec * 1000L + now.tv_usec / 1000;
+
+    exporter_sflow_t *exporter = GetExporter(fs, sample->agentSubId, sample->meanSkipCount);
+    if (!exporter) {
+        LogError("SFLOW: Exporter NULL: Abort sflow record processing");
+        return;
+    }
+    exporter->packets++;
+
+    if (sample->ip_fragmentOffset > 0) {
+        sample->dcd_sport = 0;
+        sample->dcd_dport = 0;
+    }
+
+    uint32_t recordSize = SflowRecordSize(sample, fs);
+    recordHeaderV3_t *recordHeader;
+    if (aggrTimeout) {
+        uint64_t record[MAXSFLOWRECORDSIZE / sizeof(uint64_t)];
+        dbg_assert(recordSize <= MAXSFLOWRECORDSIZE);
+        recordHeader = FillSflowRecord((void *)record, sample, fs, exporter, msec);
+        AggregateSflowRecord(fs, exporter, recordHeader, msec);
+    } else {
+        if (!IsAvailable(fs->dataBlock, recordSize)) {
+            // flush block - get an empty one
+            fs->dataBlock = WriteBlock(fs->nffile, fs->dataBlock);
+        }
+        recordHeader = FillSflowRecord(GetCurrentCursor(fs->dataBlock), sample, fs, exporter, msec);
+        CommitSflowRecord(fs, exporter, recordHeader);
+    }
+
 #ifdef DEVEL
     printf("OffsetToPayload %d\n", sample->offsetToPayload);
     void *p = (void *)sample->header + sample->offsetToPayload;
@@ -507,10 +815,6 @@ void StoreSflowRecord(SFSample *sample, FlowSource_t *fs) {
         DumpHex(stdout, p, len);
     }
 #endif
-    // update file record size ( -> output buffer size )
-    fs->dataBlock->NumRecords++;
-    fs->dataBlock->size += recordHeader->size;
-
     dbg_printf("Record size: Header: %u, calc: %u\n", recordHeader->size, recordSize);
     dbg_assert(recordHeader->size <= recordSize);
 
@@ -37,12 +37,14 @@
 #include "collector.h"
 #include "sflow_process.h"
 
-int Init_sflow(int verbose, char *extensionList);
+int Init_sflow(int verbose, char *extensionList, int aggregate);
 
 void Process_sflow(void *in_buff, ssize_t in_buff_cnt, FlowSource_t *fs, int parse_gre);
 
 void StoreSflowRecord(SFSample *sample, FlowSource_t *fs);
 
+void FlushSflowCache(FlowSource_t *fs);
+
 /*
  * Extension map for sflow ( compatibility for now )
  *
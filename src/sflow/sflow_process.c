@@ -3635,6 +3635,208 @@ static void readFlowSample(SFSample *sample, int expanded, FlowSource_t *fs, int
 
 }  // End of readFlowSample
 
+/*_________________---------------------------__________________
+  _________________    fast flow sample       __________________
+  -----------------___________________________------------------
+  Fast path for the common sFlow v5 flow sample: a sampled Ethernet, IPv4 or
+  IPv6 header with optional switch and router elements. The sample length is
+  verified once against the datagram and the sample is decoded in place.
+  Only the sample fields used by StoreSflowRecord() are set, which avoids the
+  reset of the full sample struct. Any other sample returns 0 without moving
+  the decode cursor and is decoded by readFlowSample().
+*/
+
+// decode layer 4 of a sampled header in place
+static int fastDecodeLayer4(SFSample *sample, uint8_t *ptr, uint8_t *end) {
+    if ((end - ptr) < 8) return 1;
+
+    switch (sample->dcd_ipProtocol) {
+        case IPPROTO_ICMP:
+            sample->dcd_sport = ptr[0];
+            sample->dcd_dport = ptr[1];
+            break;
+        case IPPROTO_TCP:
+            if ((end - ptr) < 14) return 0;
+            sample->dcd_sport = (ptr[0] << 8) + ptr[1];
+            sample->dcd_dport = (ptr[2] << 8) + ptr[3];
+            sample->dcd_tcpFlags = ptr[13];
+            break;
+        case IPPROTO_UDP:
+            sample->dcd_sport = (ptr[0] << 8) + ptr[1];
+            sample->dcd_dport = (ptr[2] << 8) + ptr[3];
+            break;
+        case IPPROTO_GRE:
+            if (sample->parse_gre) return 0;
+            break;
+    }
+    return 1;
+
+}  // End of fastDecodeLayer4
+
+// decode a sampled Ethernet, IPv4 or IPv6 header in place
+static int fastDecodeHeader(SFSample *sample, uint8_t *ptr, uint32_t headerLen) {
+    uint8_t *end = ptr + headerLen;
+    uint16_t type_len;
+
+    switch (sample->headerProtocol) {
+        case SFLHEADER_ETHERNET_ISO8023:
+            if ((end - ptr) < NFT_ETHHDR_SIZ) return 0;
+            memcpy(sample->eth_dst, ptr, 6);
+            memcpy(sample->eth_src, ptr + 6, 6);
+            type_len = (ptr[12] << 8) + ptr[13];
+            ptr += NFT_ETHHDR_SIZ;
+            while (type_len == 0x8100 || type_len == 0x88A8 || type_len == 0x9100 || type_len == 0x9200 || type_len == 0x9300) {
+                if ((end - ptr) < 4) return 0;
+                sample->in_vlan = ((ptr[0] << 8) + ptr[1]) & 0x0fff;
+                type_len = (ptr[2] << 8) + ptr[3];
+                ptr += 4;
+            }
+            break;
+        case SFLHEADER_IPv4:
+            type_len = 0x0800;
+            break;
+        case SFLHEADER_IPv6:
+            type_len = 0x86DD;
+            break;
+        default:
+            return 0;
+    }
+
+    if (type_len == 0x0800) {
+        if ((end - ptr) < (ssize_t)sizeof(struct myiphdr) || (*ptr >> 4) != 4 || (*ptr & 15) < 5) return 0;
+        struct myiphdr ip;
+        memcpy(&ip, ptr, sizeof(ip));
+        sample->ipsrc.type = SFLADDRESSTYPE_IP_V4;
+        sample->ipsrc.address.ip_v4.addr = ip.saddr;
+        sample->ipdst.type = SFLADDRESSTYPE_IP_V4;
+        sample->ipdst.address.ip_v4.addr = ip.daddr;
+        sample->dcd_ipProtocol = ip.protocol;
+        sample->dcd_ipTos = ip.tos;
+        sample->ip_fragmentOffset = ntohs(ip.frag_off) & 0x1FFF;
+        if (sample->ip_fragmentOffset > 0) return 1;
+
+        uint32_t headerBytes = (ip.version_and_headerLen & 0x0f) * 4;
+        if ((end - ptr) < headerBytes) return 1;
+        return fastDecodeLayer4(sample, ptr + headerBytes, end);
+    }
+
+    if (type_len == 0x86DD) {
+        if ((end - ptr) < (ssize_t)sizeof(struct myip6hdr) || (*ptr >> 4) != 6) return 0;
+        uint8_t nextHeader = ptr[6];
+        // IPv6 extension headers
+        if (nextHeader == 0 || nextHeader == 43 || nextHeader == 44 || nextHeader == 51 || nextHeader == 60) return 0;
+        sample->dcd_ipTos = ((ptr[0] & 15) << 4) + (ptr[1] >> 4);
+        sample->ipsrc.type = SFLADDRESSTYPE_IP_V6;
+        memcpy(&sample->ipsrc.address, ptr + 8, 16);
+        sample->ipdst.type = SFLADDRESSTYPE_IP_V6;
+        memcpy(&sample->ipdst.address, ptr + 24, 16);
+        sample->dcd_ipProtocol = nextHeader;
+        return fastDecodeLayer4(sample, ptr + sizeof(struct myip6hdr), end);
+    }
+
+    // non IP, 802.3 and MPLS frames
+    return 0;
+
+}  // End of fastDecodeHeader
+
+static int readFastFlowSample(SFSample *sample, int expanded, FlowSource_t *fs) {
+    uint32_t *p = sample->datap;
+    uint8_t *end = sample->endp;
+
+    if ((end - (uint8_t *)p) < 4) return 0;
+    uint32_t sampleLength = ntohl(p[0]);
+    p++;
+    uint32_t sampleWords = expanded ? 11 : 8;
+    if ((sampleLength & 3) || sampleLength < (4 * sampleWords) || sampleLength > (end - (uint8_t *)p)) return 0;
+    // the sample is completely inside the datagram - no more checks against the datagram end
+    uint32_t *sampleEnd = p + (sampleLength >> 2);
+
+    sample->meanSkipCount = ntohl(p[expanded ? 3 : 2]);
+    if (expanded) {
+        sample->inputPort = ntohl(p[7]);
+        sample->outputPort = ntohl(p[9]);
+    } else {
+        sample->inputPort = ntohl(p[5]) & 0x3fffffff;
+        sample->outputPort = ntohl(p[6]) & 0x3fffffff;
+    }
+    uint32_t numElements = ntohl(p[sampleWords - 1]);
+    p += sampleWords;
+
+    // reset the fields of the previous sample used by StoreSflowRecord()
+    sample->headerProtocol = 0;
+    sample->sampledPacketSize = 0;
+    sample->ipsrc.type = SFLADDRESSTYPE_UNDEFINED;
+    sample->ipdst.type = SFLADDRESSTYPE_UNDEFINED;
+    sample->nextHop.type = SFLADDRESSTYPE_UNDEFINED;
+    sample->bgp_nextHop.type = SFLADDRESSTYPE_UNDEFINED;
+    sample->dcd_ipProtocol = 0;
+    sample->dcd_ipTos = 0;
+    sample->dcd_sport = 0;
+    sample->dcd_dport = 0;
+    sample->dcd_tcpFlags = 0;
+    sample->ip_fragmentOffset = 0;
+    sample->extended_data_tag = 0;
+    sample->srcMask = 0;
+    sample->dstMask = 0;
+    sample->in_vlan = 0;
+    sample->out_vlan = 0;
+    sample->src_as = 0;
+    sample->dst_as = 0;
+    sample->mpls_num_labels = 0;
+    memset(sample->eth_src, 0, sizeof(sample->eth_src));
+    memset(sample->eth_dst, 0, sizeof(sample->eth_dst));
+
+    for (uint32_t el = 0; el < numElements; el++) {
+        if ((sampleEnd - p) < 2) return 0;
+        uint32_t tag = ntohl(p[0]);
+        uint32_t length = ntohl(p[1]);
+        p += 2;
+        if ((length & 3) || length > 4 * (sampleEnd - p)) return 0;
+        uint32_t *elementEnd = p + (length >> 2);
+
+        switch (tag) {
+            case SFLFLOW_HEADER: {
+                if (sample->headerProtocol || length < 16) return 0;
+                sample->headerProtocol = ntohl(p[0]);
+                sample->sampledPacketSize = ntohl(p[1]);
+                uint32_t headerLen = ntohl(p[3]);
+                if (((headerLen + 3) & ~3) != (length - 16)) return 0;
+                if (!fastDecodeHeader(sample, (uint8_t *)(p + 4), headerLen)) return 0;
+            } break;
+            case SFLFLOW_EX_SWITCH:
+                if (length != 16) return 0;
+                sample->in_vlan = ntohl(p[0]);
+                sample->out_vlan = ntohl(p[2]);
+                sample->extended_data_tag |= SASAMPLE_EXTENDED_DATA_SWITCH;
+                break;
+            case SFLFLOW_EX_ROUTER: {
+                uint32_t *ptr = p + 1;
+                if (length == 16 && ntohl(p[0]) == SFLADDRESSTYPE_IP_V4) {
+                    sample->nextHop.address.ip_v4.addr = *ptr++;
+                } else if (length == 28 && ntohl(p[0]) == SFLADDRESSTYPE_IP_V6) {
+                    memcpy(&sample->nextHop.address.ip_v6.addr, ptr, 16);
+                    ptr += 4;
+                } else {
+                    return 0;
+                }
+                sample->nextHop.type = ntohl(p[0]);
+                sample->srcMask = ntohl(ptr[0]);
+                sample->dstMask = ntohl(ptr[1]);
+                sample->extended_data_tag |= SASAMPLE_EXTENDED_DATA_ROUTER;
+            } break;
+            default:
+                return 0;
+        }
+        p = elementEnd;
+    }
+    if (p != sampleEnd || sample->headerProtocol == 0) return 0;
+
+    sample->datap = sampleEnd;
+    StoreSflowRecord(sample, fs);
+    return 1;
+
+}  // End of readFastFlowSample
+
 // process sflow datagram
 void readSFlowDatagram(SFSample *sample, FlowSource_t *fs, int verbose) {
     uint32_t samplesInPacket, samp;
@@ -3677,17 +3879,23 @@ void readSFlowDatagram(SFSample *sample, FlowSource_t *fs, int verbose) {
     /* now iterate and pull out the flows and counters samples */
     void *sampleData = (void *)sample + sampleDataOffset;
     for (samp = 0; samp < samplesInPacket; samp++) {
-        // fix bug sflowtool */
-        memset(sampleData, 0, sizeof(SFSample) - sampleDataOffset);
-        sample->parse_gre = parse_gre;
-
         if ((uint8_t *)sample->datap >= sample->endp) {
             LogError("SFLOW: readSFlowDatagram() unexpected end of datagram after sample %d of %d\n", samp, samplesInPacket);
             return;
         }
         /* just read the tag, then call the appropriate decode fn */
+        uint32_t sampleType = getData32(sample);
+
+        // common flow samples are decoded without resetting the sample
+        if (!verbose && sample->datagramVersion >= 5 && (sampleType == SFLFLOW_SAMPLE || sampleType == SFLFLOW_SAMPLE_EXPANDED) &&
+            readFastFlowSample(sample, sampleType == SFLFLOW_SAMPLE_EXPANDED, fs))
+            continue;
+
+        // fix bug sflowtool */
+        memset(sampleData, 0, sizeof(SFSample) - sampleDataOffset);
+        sample->parse_gre = parse_gre;
         sample->elementType = 0;
-        sample->sampleType = getData32(sample);
+        sample->sampleType = sampleType;
         dbg_printf("startSample ----------------------\n");
         dbg_printf("sampleType_tag %s\n", printTag(sample->sampleType, buf, 50));
 
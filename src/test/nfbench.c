@@ -0,0 +1,521 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * micro benchmarks of the hot kernels of the nfdump tools
+ * reports ns/record and MB/s of each kernel on synthetic V3 records
+ * usage: nfbench [-n num records] [-k kernel] - default 1000000 records, all kernels
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blocksort.h"
+#include "config.h"
+#include "filter/filter.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nflowcache.h"
+#include "nfstat.h"
+#include "nfxV3.h"
+#include "output.h"
+#include "util.h"
+
+#include "inline.c"
+#include "nffile_inline.c"
+
+// synthetic records
+typedef struct benchData_s {
+    uint8_t *records;
+    uint32_t recordSize;
+    uint32_t numRecords;
+} benchData_t;
+
+// ipfix element IDs of the sequencer template
+#define IPFIX_inBytes 1
+#define IPFIX_inPackets 2
+#define IPFIX_protocol 4
+#define IPFIX_tos 5
+#define IPFIX_tcpFlags 6
+#define IPFIX_srcPort 7
+#define IPFIX_src4Addr 8
+#define IPFIX_input 10
+#define IPFIX_dstPort 11
+#define IPFIX_dst4Addr 12
+#define IPFIX_output 14
+#define IPFIX_srcAS 16
+#define IPFIX_dstAS 17
+#define IPFIX_interfaceName 82
+
+// typical v9/IPFIX ipv4 template
+static sequence_t v4Template[] = {
+    {IPFIX_src4Addr, 4, NumberCopy, EXipv4FlowID, OFFsrc4Addr, SIZEsrc4Addr, 0},
+    {IPFIX_dst4Addr, 4, NumberCopy, EXipv4FlowID, OFFdst4Addr, SIZEdst4Addr, 0},
+    {IPFIX_srcPort, 2, NumberCopy, EXgenericFlowID, OFFsrcPort, SIZEsrcPort, 0},
+    {IPFIX_dstPort, 2, NumberCopy, EXgenericFlowID, OFFdstPort, SIZEdstPort, 0},
+    {IPFIX_protocol, 1, NumberCopy, EXgenericFlowID, OFFproto, SIZEproto, 0},
+    {IPFIX_tos, 1, NumberCopy, EXgenericFlowID, OFFsrcTos, SIZEsrcTos, 0},
+    {IPFIX_tcpFlags, 1, NumberCopy, EXgenericFlowID, OFFtcpFlags, SIZEtcpFlags, 0},
+    {IPFIX_inBytes, 4, NumberCopy, EXgenericFlowID, OFFinBytes, SIZEinBytes, 0},
+    {IPFIX_inPackets, 4, NumberCopy, EXgenericFlowID, OFFinPackets, SIZEinPackets, 0},
+    {IPFIX_input, 2, NumberCopy, EXflowMiscID, OFFinput, SIZEinput, 0},
+    {IPFIX_output, 2, NumberCopy, EXflowMiscID, OFFoutput, SIZEoutput, 0},
+    {IPFIX_srcAS, 2, NumberCopy, EXasRoutingID, OFFsrcAS, SIZEsrcAS, 0},
+    {IPFIX_dstAS, 2, NumberCopy, EXasRoutingID, OFFdstAS, SIZEdstAS, 0},
+    // var length field - skipped, disables the compiled sequencer
+    {IPFIX_interfaceName, VARLENGTH, 0, EXnull, 0, 0, 0}};
+#define V4TEMPLATESIZE 31
+#define V4TEMPLATEFIELDS (sizeof(v4Template) / sizeof(sequence_t))
+
+static const char *kernel = NULL;
+
+static uint64_t rnd_state = 0x9E3779B97F4A7C15LL;
+
+static inline uint64_t rnd(void) {
+    // xorshift64
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}  // End of rnd
+
+static inline uint64_t nsecNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}  // End of nsecNow
+
+static int RunKernel(const char *name) {
+    return kernel == NULL || strncmp(name, kernel, strlen(kernel)) == 0;
+}  // End of RunKernel
+
+static void Report(const char *name, uint64_t records, uint64_t bytes, uint64_t nsec) {
+    if (nsec == 0) nsec = 1;
+    printf("%-28s %10llu records %10.1f ns/record %10.1f MB/s\n", name, (unsigned long long)records, (double)nsec / (double)records,
+           ((double)bytes * 1000.0) / (double)nsec);
+}  // End of Report
+
+// generate numRecords V3 records with a typical set of extensions
+// addresses are drawn from a pool of 64k hosts, to get repeated flow keys
+static int GenRecords(benchData_t *benchData, uint32_t numRecords) {
+    uint8_t proto[] = {6, 6, 6, 17, 17, 1};
+    uint16_t port[] = {80, 443, 53, 22, 25, 8080, 123, 3389};
+
+    uint8_t record[1024];
+    AddV3Header(record, v3Record);
+    PushExtension(v3Record, EXgenericFlow, genericFlow);
+    PushExtension(v3Record, EXipv4Flow, ipv4Flow);
+    PushExtension(v3Record, EXflowMisc, flowMisc);
+    PushExtension(v3Record, EXcntFlow, cntFlow);
+    PushExtension(v3Record, EXasRouting, asRouting);
+    v3Record->nfversion = 10;
+    v3Record->exporterID = 1;
+
+    benchData->recordSize = v3Record->size;
+    benchData->numRecords = numRecords;
+    benchData->records = malloc((size_t)numRecords * v3Record->size);
+    if (!benchData->records) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    uint64_t msec = 1704067200000LL;
+    for (uint32_t i = 0; i < numRecords; i++) {
+        uint64_t r = rnd();
+        genericFlow->msecFirst = msec + (r % 300000);
+        genericFlow->msecLast = genericFlow->msecFirst + (r >> 20) % 60000;
+        genericFlow->proto = proto[(r >> 8) % sizeof(proto)];
+        genericFlow->srcPort = 1024 + (r >> 16) % 64512;
+        genericFlow->dstPort = port[(r >> 32) % (sizeof(port) / sizeof(uint16_t))];
+        genericFlow->tcpFlags = genericFlow->proto == 6 ? 0x1b : 0;
+        genericFlow->inPackets = 1 + (r >> 40) % 1000;
+        genericFlow->inBytes = genericFlow->inPackets * (40 + (r >> 24) % 1460);
+
+        r = rnd();
+        ipv4Flow->srcAddr = 0x0a000000 | (r & 0xFFFF);
+        ipv4Flow->dstAddr = 0xc0a80000 | ((r >> 16) & 0xFFFF);
+        flowMisc->input = (r >> 32) % 16;
+        flowMisc->output = (r >> 36) % 16;
+        cntFlow->flows = 1;
+        asRouting->srcAS = (r >> 40) % 65536;
+        asRouting->dstAS = (r >> 48) % 65536;
+
+        memcpy(benchData->records + (size_t)i * v3Record->size, record, v3Record->size);
+    }
+
+    return 1;
+}  // End of GenRecords
+
+// write all records into a file with the given compression and read it back
+static void BenchCodec(benchData_t *benchData, char *name, int compress) {
+    char fileName[64], label[32];
+    snprintf(fileName, sizeof(fileName), "nfbench.%s.nf", name);
+
+    uint64_t bytes = (uint64_t)benchData->numRecords * benchData->recordSize;
+    uint64_t nsec = nsecNow();
+    nffile_t *nffile = OpenNewFile(fileName, NULL, CREATOR_UNKNOWN, compress, NOT_ENCRYPTED);
+    if (!nffile) return;
+
+    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
+    for (uint32_t i = 0; i < benchData->numRecords; i++) {
+        if (!IsAvailable(dataBlock, benchData->recordSize)) dataBlock = WriteBlock(nffile, dataBlock);
+        memcpy(GetCurrentCursor(dataBlock), benchData->records + (size_t)i * benchData->recordSize, benchData->recordSize);
+        dataBlock->NumRecords++;
+        dataBlock->size += benchData->recordSize;
+    }
+    FlushBlock(nffile, dataBlock);
+    CloseUpdateFile(nffile);
+    DisposeFile(nffile);
+    nsec = nsecNow() - nsec;
+    snprintf(label, sizeof(label), "write %s", name);
+    Report(label, benchData->numRecords, bytes, nsec);
+
+    codecStat_t codecStat[NUMCODECS];
+    GetCodecStat(codecStat);
+    uint64_t codecNsec = codecStat[compress & 0xFFFF].nsec;
+
+    uint64_t numRecords = 0;
+    nsec = nsecNow();
+    nffile = OpenFile(fileName, NULL);
+    if (!nffile) return;
+    dataBlock = NULL;
+    while ((dataBlock = ReadBlock(nffile, dataBlock)) != NULL) numRecords += dataBlock->NumRecords;
+    CloseFile(nffile);
+    DisposeFile(nffile);
+    nsec = nsecNow() - nsec;
+    snprintf(label, sizeof(label), "read %s", name);
+    Report(label, numRecords, bytes, nsec);
+
+    if ((compress & 0xFFFF) != NOT_COMPRESSED) {
+        GetCodecStat(codecStat);
+        snprintf(label, sizeof(label), "decompress %s", name);
+        Report(label, numRecords, bytes, codecStat[compress & 0xFFFF].nsec - codecNsec);
+    }
+
+    unlink(fileName);
+
+}  // End of BenchCodec
+
+static void BenchCodecs(benchData_t *benchData) {
+    BenchCodec(benchData, "none", NOT_COMPRESSED);
+    BenchCodec(benchData, "lzo", LZO_COMPRESSED);
+    BenchCodec(benchData, "lz4", LZ4_COMPRESSED);
+#ifdef HAVE_BZIP2
+    BenchCodec(benchData, "bz2", BZ2_COMPRESSED);
+#endif
+#ifdef HAVE_ZSTD
+    BenchCodec(benchData, "zstd", ZSTD_COMPRESSED);
+#endif
+}  // End of BenchCodecs
+
+// decode the records as v9/IPFIX data records of the v4Template
+static void BenchSequencer(benchData_t *benchData, uint32_t numFields, char *label) {
+    uint32_t numRecords = benchData->numRecords;
+    uint32_t inLength = V4TEMPLATESIZE + (numFields == V4TEMPLATEFIELDS ? 1 : 0);
+
+    // pack the records into a network byte order flowset
+    uint8_t *inBuff = malloc((size_t)numRecords * inLength);
+    if (!inBuff) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+    uint8_t *p = inBuff;
+    recordHandle_t recordHandle = {0};
+    for (uint32_t i = 0; i < numRecords; i++) {
+        recordHeaderV3_t *v3Record = (recordHeaderV3_t *)(benchData->records + (size_t)i * benchData->recordSize);
+        MapRecordHandle(&recordHandle, v3Record, i);
+        EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle.extensionList[EXgenericFlowID];
+        EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle.extensionList[EXipv4FlowID];
+        EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle.extensionList[EXflowMiscID];
+        EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle.extensionList[EXasRoutingID];
+        Put_val32(htonl(ipv4Flow->srcAddr), p);
+        Put_val32(htonl(ipv4Flow->dstAddr), p + 4);
+        Put_val16(htons(genericFlow->srcPort), p + 8);
+        Put_val16(htons(genericFlow->dstPort), p + 10);
+        p[12] = genericFlow->proto;
+        p[13] = genericFlow->srcTos;
+        p[14] = genericFlow->tcpFlags;
+        Put_val32(htonl((uint32_t)genericFlow->inBytes), p + 15);
+        Put_val32(htonl((uint32_t)genericFlow->inPackets), p + 19);
+        Put_val16(htons((uint16_t)flowMisc->input), p + 23);
+        Put_val16(htons((uint16_t)flowMisc->output), p + 25);
+        Put_val16(htons((uint16_t)asRouting->srcAS), p + 27);
+        Put_val16(htons((uint16_t)asRouting->dstAS), p + 29);
+        if (numFields == V4TEMPLATEFIELDS) p[31] = 0;  // empty var length field
+        p += inLength;
+    }
+
+    // the sequencer owns the sequence table
+    sequence_t *sequenceTable = malloc(sizeof(v4Template));
+    if (!sequenceTable) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        free(inBuff);
+        return;
+    }
+    memcpy(sequenceTable, v4Template, sizeof(v4Template));
+
+    sequencer_t sequencer = {0};
+    if (!SetupSequencer(&sequencer, sequenceTable, numFields)) {
+        LogError("SetupSequencer() failed");
+        ClearSequencer(&sequencer);
+        free(inBuff);
+        return;
+    }
+
+    size_t outSize = sizeof(recordHeaderV3_t) + sequencer.outLength;
+    uint8_t *outBuff = malloc(outSize);
+    if (!outBuff) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        ClearSequencer(&sequencer);
+        free(inBuff);
+        return;
+    }
+
+    uint64_t stack[16];
+    uint64_t nsec = nsecNow();
+    p = inBuff;
+    for (uint32_t i = 0; i < numRecords; i++) {
+        AddV3Header(outBuff, v3Record);
+        v3Record->nfversion = 10;
+        if (SequencerRun(&sequencer, p, inLength, outBuff, outSize, stack) != SEQ_OK) {
+            LogError("SequencerRun() failed");
+            break;
+        }
+        p += inLength;
+    }
+    nsec = nsecNow() - nsec;
+    Report(label, numRecords, (uint64_t)numRecords * inLength, nsec);
+
+    ClearSequencer(&sequencer);
+    free(outBuff);
+    free(inBuff);
+
+}  // End of BenchSequencer
+
+static void BenchFilter(benchData_t *benchData, char *filter) {
+    void *engine = CompileFilter(filter);
+    if (!engine) {
+        LogError("Failed to compile filter: %s", filter);
+        return;
+    }
+
+    uint32_t matched = 0;
+    recordHandle_t recordHandle = {0};
+    uint64_t nsec = nsecNow();
+    for (uint32_t i = 0; i < benchData->numRecords; i++) {
+        recordHeaderV3_t *v3Record = (recordHeaderV3_t *)(benchData->records + (size_t)i * benchData->recordSize);
+        MapRecordHandle(&recordHandle, v3Record, i);
+        matched += FilterRecord(engine, &recordHandle);
+    }
+    nsec = nsecNow() - nsec;
+
+    char label[32];
+    snprintf(label, sizeof(label), "filter %.21s", filter);
+    Report(label, benchData->numRecords, (uint64_t)benchData->numRecords * benchData->recordSize, nsec);
+    printf("%-28s %10u matched\n", "", matched);
+    DisposeFilter(engine);
+
+}  // End of BenchFilter
+
+static void BenchFlowCache(benchData_t *benchData) {
+    if (!Init_FlowCache(0)) return;
+
+    recordHandle_t recordHandle = {0};
+    uint64_t nsec = nsecNow();
+    for (uint32_t i = 0; i < benchData->numRecords; i++) {
+        recordHeaderV3_t *v3Record = (recordHeaderV3_t *)(benchData->records + (size_t)i * benchData->recordSize);
+        MapRecordHandle(&recordHandle, v3Record, i);
+        AddFlowCache(&recordHandle);
+    }
+    nsec = nsecNow() - nsec;
+    Report("flow cache add", benchData->numRecords, (uint64_t)benchData->numRecords * benchData->recordSize, nsec);
+
+    hashStat_t hashStat = {0};
+    FlowHashStat(&hashStat);
+    printf("%-28s %10llu probes %10llu collisions %6llu resizes\n", "", (unsigned long long)hashStat.probes,
+           (unsigned long long)hashStat.collisions, (unsigned long long)hashStat.resizes);
+    Dispose_FlowTable();
+
+}  // End of BenchFlowCache
+
+static void BenchElementStat(benchData_t *benchData) {
+    // element stats can be set up only once - run all of them in one pass
+    if (!SetElementStat("srcip", NULL) || !SetElementStat("dstport", NULL) || !Init_StatTable(0)) return;
+
+    recordHandle_t recordHandle = {0};
+    uint64_t nsec = nsecNow();
+    for (uint32_t i = 0; i < benchData->numRecords; i++) {
+        recordHeaderV3_t *v3Record = (recordHeaderV3_t *)(benchData->records + (size_t)i * benchData->recordSize);
+        MapRecordHandle(&recordHandle, v3Record, i);
+        AddElementStat(&recordHandle);
+    }
+    nsec = nsecNow() - nsec;
+    Report("element stat srcip,dstport", benchData->numRecords, (uint64_t)benchData->numRecords * benchData->recordSize, nsec);
+    Dispose_StatTable();
+
+}  // End of BenchElementStat
+
+static void BenchSort(benchData_t *benchData) {
+    uint32_t numRecords = benchData->numRecords;
+    SortElement_t *sortList = malloc(numRecords * sizeof(SortElement_t));
+    if (!sortList) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    // sort by msecFirst - the default time sort order
+    for (uint32_t i = 0; i < numRecords; i++) {
+        recordHeaderV3_t *v3Record = (recordHeaderV3_t *)(benchData->records + (size_t)i * benchData->recordSize);
+        // genericFlow is the first extension of the generated records
+        EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)((void *)v3Record + sizeof(recordHeaderV3_t) + sizeof(elementHeader_t));
+        sortList[i].record = (void *)v3Record;
+        sortList[i].count = genericFlow->msecFirst;
+    }
+
+    uint64_t nsec = nsecNow();
+    blocksort(sortList, numRecords);
+    nsec = nsecNow() - nsec;
+    Report("blocksort msecFirst", numRecords, (uint64_t)numRecords * sizeof(SortElement_t), nsec);
+    free(sortList);
+
+}  // End of BenchSort
+
+static void BenchOutput(benchData_t *benchData, char *format) {
+    FILE *devNull = fopen("/dev/null", "w");
+    if (!devNull) {
+        LogError("fopen() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return;
+    }
+
+    outputParams_t outputParams = {0};
+    outputParams.quiet = true;
+    char *printFormat = strdup(format);
+    RecordPrinter_t printRecord = SetupOutputMode(printFormat, &outputParams);
+    if (!printRecord) {
+        LogError("Failed to setup output mode: %s", format);
+        fclose(devNull);
+        return;
+    }
+
+    recordHandle_t recordHandle = {0};
+    uint64_t nsec = nsecNow();
+    for (uint32_t i = 0; i < benchData->numRecords; i++) {
+        recordHeaderV3_t *v3Record = (recordHeaderV3_t *)(benchData->records + (size_t)i * benchData->recordSize);
+        MapRecordHandle(&recordHandle, v3Record, i);
+        printRecord(devNull, &recordHandle, 0);
+    }
+    fflush(devNull);
+    nsec = nsecNow() - nsec;
+
+    char label[32];
+    snprintf(label, sizeof(label), "output %s", format);
+    Report(label, benchData->numRecords, (uint64_t)benchData->numRecords * benchData->recordSize, nsec);
+    fclose(devNull);
+    free(printFormat);
+
+}  // End of BenchOutput
+
+static void usage(char *name) {
+    printf(
+        "usage %s [options] \n"
+        "-h\t\tthis text you see right here.\n"
+        "-n <num>\tNumber of records. Default 1000000.\n"
+        "-k <kernel>\tRun only kernels with this name prefix:\n"
+        "\t\twrite, read, decompress, sequencer, filter, flow, element, blocksort, output\n",
+        name);
+}  // End of usage
+
+int main(int argc, char **argv) {
+    uint32_t numRecords = 1000000;
+
+    int c;
+    while ((c = getopt(argc, argv, "hn:k:")) != EOF) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'n':
+                numRecords = atoi(optarg);
+                if (numRecords == 0) {
+                    LogError("Invalid number of records: %s", optarg);
+                    exit(255);
+                }
+                break;
+            case 'k':
+                kernel = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(255);
+        }
+    }
+
+    if (!Init_nffile(1, NULL)) exit(254);
+
+    benchData_t benchData;
+    if (!GenRecords(&benchData, numRecords)) exit(255);
+    printf("%u records of %u bytes\n", numRecords, benchData.recordSize);
+
+    if (RunKernel("write") || RunKernel("read") || RunKernel("decompress")) BenchCodecs(&benchData);
+
+    if (RunKernel("sequencer")) {
+        BenchSequencer(&benchData, V4TEMPLATEFIELDS - 1, "sequencer fixed");
+        BenchSequencer(&benchData, V4TEMPLATEFIELDS, "sequencer varlength");
+    }
+
+    if (RunKernel("filter")) {
+        BenchFilter(&benchData, "proto tcp");
+        BenchFilter(&benchData, "proto tcp and dst port 443");
+        BenchFilter(&benchData, "src net 10.0.0.0/24 or bytes > 100000");
+    }
+
+    if (RunKernel("flow")) BenchFlowCache(&benchData);
+
+    if (RunKernel("element")) BenchElementStat(&benchData);
+
+    if (RunKernel("blocksort")) BenchSort(&benchData);
+
+    if (RunKernel("output")) {
+        BenchOutput(&benchData, "line");
+        BenchOutput(&benchData, "long");
+        BenchOutput(&benchData, "csv");
+        BenchOutput(&benchData, "json");
+    }
+
+    free(benchData.records);
+    return 0;
+}
@@ -0,0 +1,578 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * nfsynth - synthetic workload generator
+ * creates large nffiles with a realistic traffic mix for collector and query
+ * benchmarks. Hosts and service ports are drawn from a Zipf distribution,
+ * flow arrivals follow a Poisson process, optionally modulated with a diurnal
+ * profile. The files may be replayed with nfreplay to feed nfcapd with a
+ * v9/IPFIX stream of the same workload.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfxV3.h"
+#include "util.h"
+
+#include "nffile_inline.c"
+
+// Zipf distribution of ranks 0..size-1
+typedef struct zipf_s {
+    double *cdf;
+    uint32_t size;
+} zipf_t;
+
+typedef struct workload_s {
+    uint64_t numRecords;
+    time_t start;
+    uint32_t duration;  // seconds
+    uint32_t diurnal;   // amplitude of the diurnal profile in percent, 0 for constant rate
+    uint32_t hosts;     // number of distinct hosts
+    uint32_t ports;     // number of distinct service ports
+    double alpha;       // Zipf exponent
+    uint32_t exporters;
+    // record mix in percent
+    uint32_t ipv6;
+    uint32_t nat;
+    uint32_t mpls;
+    uint32_t vlan;
+    uint32_t payload;
+} workload_t;
+
+#define MAXHOSTS (1 << 24)
+#define MAXPORTS 65535
+#define MAXPAYLOAD 128
+
+// most used service ports first - higher ranks get a scattered port > 1024
+static const uint16_t servicePorts[] = {443, 80, 53, 123, 22, 25, 993, 8080, 3389, 445, 587, 8443, 143, 110, 161, 5060};
+#define NUMSERVICEPORTS (sizeof(servicePorts) / sizeof(uint16_t))
+
+static uint64_t rnd_state = 0x9E3779B97F4A7C15LL;
+
+static inline uint64_t rnd(void) {
+    // xorshift64
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}  // End of rnd
+
+// uniform double in [0, 1)
+static inline double rndDouble(void) {
+    return (rnd() >> 11) * 0x1.0p-53;
+}  // End of rndDouble
+
+// true with a probability of percent %
+static inline int rndPercent(uint32_t percent) {
+    return (rnd() % 100) < percent;
+}  // End of rndPercent
+
+// exponential distribution with the given mean
+static inline double rndExp(double mean) {
+    return -log(1.0 - rndDouble()) * mean;
+}  // End of rndExp
+
+static int InitZipf(zipf_t *zipf, uint32_t size, double alpha) {
+    zipf->size = size;
+    zipf->cdf = malloc(size * sizeof(double));
+    if (!zipf->cdf) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    double sum = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        sum += 1.0 / pow((double)(i + 1), alpha);
+        zipf->cdf[i] = sum;
+    }
+    for (uint32_t i = 0; i < size; i++) zipf->cdf[i] /= sum;
+
+    return 1;
+}  // End of InitZipf
+
+static uint32_t Zipf(zipf_t *zipf) {
+    double u = rndDouble();
+    uint32_t lo = 0, hi = zipf->size - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (zipf->cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}  // End of Zipf
+
+// scatter ranks over the address space - odd multiplier is a bijection mod 2^24
+static inline uint32_t Scatter(uint32_t rank) {
+    return (rank * 2654435761U) & (MAXHOSTS - 1);
+}  // End of Scatter
+
+static inline uint16_t ServicePort(uint32_t rank) {
+    if (rank < NUMSERVICEPORTS) return servicePorts[rank];
+    return 1024 + (rank * 40503U) % 64512;
+}  // End of ServicePort
+
+// relative flow rate at time t - peak at noon, low at midnight
+static inline double Diurnal(workload_t *workload, double t) {
+    double day = fmod(t, 86400.0) / 86400.0;
+    return 1.0 - (workload->diurnal / 100.0) * cos(2.0 * M_PI * day);
+}  // End of Diurnal
+
+// parse the record mix: nat=<n>,mpls=<n>,vlan=<n>,payload=<n>,ipv6=<n> in percent
+static int ParseMix(workload_t *workload, char *arg) {
+    char *s = strdup(arg);
+    char *saveptr = NULL;
+    char *token = strtok_r(s, ",", &saveptr);
+    while (token) {
+        char *eq = strchr(token, '=');
+        int value = eq ? atoi(eq + 1) : -1;
+        if (!eq || value < 0 || value > 100) {
+            LogError("Invalid record mix: %s", token);
+            free(s);
+            return 0;
+        }
+        *eq = '\0';
+        if (strcasecmp(token, "nat") == 0) {
+            workload->nat = value;
+        } else if (strcasecmp(token, "mpls") == 0) {
+            workload->mpls = value;
+        } else if (strcasecmp(token, "vlan") == 0) {
+            workload->vlan = value;
+        } else if (strcasecmp(token, "payload") == 0) {
+            workload->payload = value;
+        } else if (strcasecmp(token, "ipv6") == 0) {
+            workload->ipv6 = value;
+        } else {
+            LogError("Unknown record mix element: %s", token);
+            free(s);
+            return 0;
+        }
+        token = strtok_r(NULL, ",", &saveptr);
+    }
+    free(s);
+    return 1;
+}  // End of ParseMix
+
+// create one V3 record of the workload at time msec
+static void GenRecord(workload_t *workload, zipf_t *hostZipf, zipf_t *portZipf, recordHeaderV3_t *record, uint64_t msec) {
+    AddV3Header(record, v3Record);
+    uint32_t exporter = 1 + rnd() % workload->exporters;
+    v3Record->nfversion = 10;
+    v3Record->exporterID = exporter;
+    v3Record->engineType = (exporter >> 8) & 0xFF;
+    v3Record->engineID = exporter & 0xFF;
+
+    uint32_t srcRank = Zipf(hostZipf);
+    uint32_t dstRank = Zipf(hostZipf);
+    uint32_t portRank = Zipf(portZipf);
+    int ipv6 = rndPercent(workload->ipv6);
+
+    PushExtension(v3Record, EXgenericFlow, genericFlow);
+    uint32_t r = rnd() % 100;
+    genericFlow->proto = r < 80 ? IPPROTO_TCP : (r < 97 ? IPPROTO_UDP : (ipv6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP));
+    if (genericFlow->proto == IPPROTO_TCP || genericFlow->proto == IPPROTO_UDP) {
+        genericFlow->srcPort = 32768 + rnd() % 28232;
+        genericFlow->dstPort = genericFlow->proto == IPPROTO_UDP && portRank > 3 ? ServicePort(portRank % 4) : ServicePort(portRank);
+    } else {
+        genericFlow->icmpType = ipv6 ? 128 : 8;
+    }
+    if (genericFlow->proto == IPPROTO_TCP) {
+        r = rnd() % 100;
+        // mostly complete sessions, some scans and resets
+        genericFlow->tcpFlags = r < 90 ? 0x1b : (r < 97 ? 0x02 : 0x14);
+    }
+
+    // heavy tailed packet counts - pareto with shape 1.2
+    uint64_t packets = (uint64_t)(1.0 / pow(1.0 - rndDouble(), 1.0 / 1.2));
+    if (packets > 1000000) packets = 1000000;
+    uint64_t packetSize = genericFlow->proto == IPPROTO_TCP ? 64 + rnd() % 1437 : (genericFlow->proto == IPPROTO_UDP ? 64 + rnd() % 512 : 84);
+    genericFlow->inPackets = packets;
+    genericFlow->inBytes = packets * packetSize;
+    uint64_t flowDuration = packets > 1 ? (uint64_t)rndExp(5000.0) : 0;
+    if (flowDuration > 300000) flowDuration = 300000;
+    genericFlow->msecLast = msec;
+    genericFlow->msecFirst = msec - flowDuration;
+    genericFlow->msecReceived = msec + rnd() % 1000;
+    genericFlow->srcTos = rndPercent(10) ? 0x28 : 0;
+
+    uint32_t dst4Addr = 0x40000000 | Scatter(dstRank);
+    if (ipv6) {
+        PushExtension(v3Record, EXipv6Flow, ipv6Flow);
+        ipv6Flow->srcAddr[0] = 0x20010db800000000LL | (Scatter(srcRank) >> 8);
+        ipv6Flow->srcAddr[1] = ((uint64_t)Scatter(srcRank) << 32) | 1;
+        ipv6Flow->dstAddr[0] = 0x20010db880000000LL | (Scatter(dstRank) >> 8);
+        ipv6Flow->dstAddr[1] = ((uint64_t)Scatter(dstRank) << 32) | 1;
+    } else {
+        PushExtension(v3Record, EXipv4Flow, ipv4Flow);
+        ipv4Flow->srcAddr = 0x0a000000 | Scatter(srcRank);
+        ipv4Flow->dstAddr = dst4Addr;
+    }
+
+    PushExtension(v3Record, EXflowMisc, flowMisc);
+    flowMisc->input = 1 + srcRank % 8;
+    flowMisc->output = 9 + dstRank % 8;
+    flowMisc->srcMask = ipv6 ? 64 : 24;
+    flowMisc->dstMask = ipv6 ? 64 : 24;
+
+    PushExtension(v3Record, EXcntFlow, cntFlow);
+    cntFlow->flows = 1;
+    if (genericFlow->proto == IPPROTO_TCP && genericFlow->tcpFlags == 0x1b) {
+        cntFlow->outPackets = packets;
+        cntFlow->outBytes = packets * (64 + rnd() % 1437);
+    }
+
+    PushExtension(v3Record, EXasRouting, asRouting);
+    asRouting->srcAS = 64512 + srcRank % 1000;
+    asRouting->dstAS = 1 + (dstRank * 7919U) % 65000;
+
+    if (ipv6) {
+        PushExtension(v3Record, EXipNextHopV6, ipNextHopV6);
+        ipNextHopV6->ip[0] = 0x20010db8ffff0000LL;
+        ipNextHopV6->ip[1] = flowMisc->output;
+        PushExtension(v3Record, EXipReceivedV6, ipReceivedV6);
+        ipReceivedV6->ip[0] = 0x20010db8fffe0000LL;
+        ipReceivedV6->ip[1] = exporter;
+    } else {
+        PushExtension(v3Record, EXipNextHopV4, ipNextHopV4);
+        ipNextHopV4->ip = 0xc0a80000 | flowMisc->output;
+        PushExtension(v3Record, EXipReceivedV4, ipReceivedV4);
+        ipReceivedV4->ip = 0xac100000 | exporter;
+    }
+
+    if (rndPercent(workload->vlan)) {
+        PushExtension(v3Record, EXvLan, vLan);
+        vLan->srcVlan = 100 + flowMisc->input;
+        vLan->dstVlan = 100 + flowMisc->output;
+    }
+
+    if (rndPercent(workload->mpls)) {
+        PushExtension(v3Record, EXmplsLabel, mplsLabel);
+        int numLabels = 1 + rnd() % 3;
+        for (int i = 0; i < numLabels; i++) {
+            mplsLabel->mplsLabel[i] = (16 + rnd() % 1048560) << 4;
+        }
+        // bottom of stack
+        mplsLabel->mplsLabel[numLabels - 1] |= 1;
+    }
+
+    if (!ipv6 && rndPercent(workload->nat)) {
+        PushExtension(v3Record, EXnatXlateIPv4, natXlateIPv4);
+        natXlateIPv4->xlateSrcAddr = 0xc6336400 | (srcRank & 0xFF);  // 198.51.100.0/24 pool
+        natXlateIPv4->xlateDstAddr = dst4Addr;
+        PushExtension(v3Record, EXnatXlatePort, natXlatePort);
+        natXlatePort->xlateSrcPort = 1024 + rnd() % 64512;
+        natXlatePort->xlateDstPort = genericFlow->dstPort;
+        PushExtension(v3Record, EXnatCommon, natCommon);
+        natCommon->msecEvent = genericFlow->msecFirst;
+        natCommon->natEvent = 1;  // create
+        natCommon->natPoolID = 1;
+    }
+
+    if (genericFlow->proto == IPPROTO_TCP && rndPercent(workload->payload)) {
+        char payload[MAXPAYLOAD];
+        size_t payloadSize;
+        if (genericFlow->dstPort == 80) {
+            payloadSize = snprintf(payload, sizeof(payload), "GET /index%u.html HTTP/1.1\r\nHost: www%u.example.com\r\n\r\n", portRank, dstRank);
+        } else {
+            payloadSize = 16 + rnd() % (MAXPAYLOAD - 16);
+            for (size_t i = 0; i < payloadSize; i++) payload[i] = rnd() & 0xFF;
+        }
+        // var length extensions are 4 byte aligned
+        size_t alignedSize = (payloadSize + 3) & ~3;
+        PushVarLengthPointer(v3Record, EXinPayload, inPayload, alignedSize);
+        memcpy(inPayload, payload, payloadSize);
+    }
+
+}  // End of GenRecord
+
+static void UpdateStat(stat_record_t *stat_record, recordHeaderV3_t *record) {
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)((void *)record + sizeof(recordHeaderV3_t) + sizeof(elementHeader_t));
+
+    stat_record->numflows++;
+    stat_record->numpackets += genericFlow->inPackets;
+    stat_record->numbytes += genericFlow->inBytes;
+    switch (genericFlow->proto) {
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            stat_record->numflows_icmp++;
+            stat_record->numpackets_icmp += genericFlow->inPackets;
+            stat_record->numbytes_icmp += genericFlow->inBytes;
+            break;
+        case IPPROTO_TCP:
+            stat_record->numflows_tcp++;
+            stat_record->numpackets_tcp += genericFlow->inPackets;
+            stat_record->numbytes_tcp += genericFlow->inBytes;
+            break;
+        case IPPROTO_UDP:
+            stat_record->numflows_udp++;
+            stat_record->numpackets_udp += genericFlow->inPackets;
+            stat_record->numbytes_udp += genericFlow->inBytes;
+            break;
+        default:
+            stat_record->numflows_other++;
+            stat_record->numpackets_other += genericFlow->inPackets;
+            stat_record->numbytes_other += genericFlow->inBytes;
+    }
+    if (stat_record->firstseen == 0 || genericFlow->msecFirst < stat_record->firstseen) stat_record->firstseen = genericFlow->msecFirst;
+    if (genericFlow->msecLast > stat_record->lastseen) stat_record->lastseen = genericFlow->msecLast;
+
+}  // End of UpdateStat
+
+static nffile_t *NextFile(char *wfile, char *dir, time_t t, int compress) {
+    char fileName[MAXPATHLEN];
+    if (dir) {
+        char timeString[16];
+        struct tm *now = localtime(&t);
+        strftime(timeString, sizeof(timeString), "%Y%m%d%H%M", now);
+        snprintf(fileName, sizeof(fileName), "%s/nfcapd.%s", dir, timeString);
+    } else {
+        snprintf(fileName, sizeof(fileName), "%s", wfile);
+    }
+
+    nffile_t *nffile = OpenNewFile(fileName, NULL, CREATOR_UNKNOWN, compress, NOT_ENCRYPTED);
+    if (!nffile) {
+        LogError("Failed to open file %s", fileName);
+        return NULL;
+    }
+    SetIdent(nffile, "nfsynth");
+    return nffile;
+
+}  // End of NextFile
+
+static void usage(char *name) {
+    printf(
+        "usage %s [options] \n"
+        "-h\t\tthis text you see right here.\n"
+        "-w <file>\tWrite all records into this file.\n"
+        "-l <dir>\tWrite nfcapd.yyyymmddhhmm files into this directory, rotated by -t.\n"
+        "-t <seconds>\tFile rotation interval. Default 300.\n"
+        "-n <num>\tNumber of records. Default 1000000.\n"
+        "-b <time>\tStart time yyyymmddhhmm. Default now.\n"
+        "-d <seconds>\tDuration of the workload at the average rate. Default 3600.\n"
+        "-D <percent>\tAmplitude of the diurnal profile, peak at 12:00 UTC. Default 0 - constant rate.\n"
+        "-H <num>\tNumber of distinct hosts. Default 100000.\n"
+        "-P <num>\tNumber of distinct service ports. Default 1000.\n"
+        "-a <alpha>\tZipf exponent of host and port popularity. Default 1.0.\n"
+        "-e <num>\tNumber of exporters. Default 1.\n"
+        "-m <mix>\tRecord mix in percent: ipv6=<n>,nat=<n>,mpls=<n>,vlan=<n>,payload=<n>.\n"
+        "\t\tDefault ipv6=10,nat=0,mpls=0,vlan=0,payload=0.\n"
+        "-s <seed>\tRandom seed. Default fixed seed for repeatable workloads.\n"
+        "-z=<comp>\tCompress files: lzo, lz4, bz2 or zstd.\n",
+        name);
+}  // End of usage
+
+int main(int argc, char **argv) {
+    workload_t workload = {
+        .numRecords = 1000000,
+        .start = time(NULL),
+        .duration = 3600,
+        .hosts = 100000,
+        .ports = 1000,
+        .alpha = 1.0,
+        .exporters = 1,
+        .ipv6 = 10,
+    };
+    char *wfile = NULL;
+    char *dir = NULL;
+    uint32_t interval = 300;
+    int compress = NOT_COMPRESSED;
+
+    int c;
+    while ((c = getopt(argc, argv, "a:b:d:D:e:hH:l:m:n:P:s:t:w:z::")) != EOF) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+                break;
+            case 'a':
+                workload.alpha = atof(optarg);
+                if (workload.alpha <= 0 || workload.alpha > 5) {
+                    LogError("Zipf exponent out of range: %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                workload.start = ISO2UNIX(optarg);
+                if (workload.start == 0) exit(EXIT_FAILURE);
+                break;
+            case 'd':
+                workload.duration = atoi(optarg);
+                if (workload.duration == 0) {
+                    LogError("Invalid duration: %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'D':
+                workload.diurnal = atoi(optarg);
+                if (workload.diurnal > 100) {
+                    LogError("Diurnal amplitude out of range: %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'e':
+                workload.exporters = atoi(optarg);
+                if (workload.exporters == 0 || workload.exporters > 65535) {
+                    LogError("Number of exporters out of range: %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'H':
+                workload.hosts = atoi(optarg);
+                if (workload.hosts == 0 || workload.hosts > MAXHOSTS) {
+                    LogError("Number of hosts out of range 1..%u: %s", MAXHOSTS, optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'l':
+                dir = optarg;
+                break;
+            case 'm':
+                if (!ParseMix(&workload, optarg)) exit(EXIT_FAILURE);
+                break;
+            case 'n':
+                workload.numRecords = strtoull(optarg, NULL, 10);
+                if (workload.numRecords == 0) {
+                    LogError("Invalid number of records: %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'P':
+                workload.ports = atoi(optarg);
+                if (workload.ports == 0 || workload.ports > MAXPORTS) {
+                    LogError("Number of ports out of range 1..%u: %s", MAXPORTS, optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                rnd_state = strtoull(optarg, NULL, 0);
+                if (rnd_state == 0) rnd_state = 0x9E3779B97F4A7C15LL;
+                break;
+            case 't':
+                interval = atoi(optarg);
+                if (interval < 60) {
+                    LogError("Rotation interval must be at least 60s: %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                wfile = optarg;
+                break;
+            case 'z':
+                compress = optarg ? ParseCompression(optarg) : LZO_COMPRESSED;
+                if (compress == -1) {
+                    LogError("Usage for option -z: set -z=lzo, -z=lz4, -z=bz2 or z=zstd for valid compression formats");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((wfile == NULL) == (dir == NULL)) {
+        LogError("Specify either -w <file> or -l <dir>");
+        exit(EXIT_FAILURE);
+    }
+    if (dir && !CheckPath(dir, S_IFDIR)) exit(EXIT_FAILURE);
+
+    if (!Init_nffile(1, NULL)) exit(EXIT_FAILURE);
+
+    zipf_t hostZipf, portZipf;
+    if (!InitZipf(&hostZipf, workload.hosts, workload.alpha) || !InitZipf(&portZipf, workload.ports, workload.alpha)) exit(EXIT_FAILURE);
+
+    // Poisson arrivals - thinning with the peak rate for the diurnal profile
+    double peak = 1.0 + workload.diurnal / 100.0;
+    double meanGap = (double)workload.duration / (double)workload.numRecords / peak;
+    double t = (double)workload.start;
+
+    // align files to the rotation interval
+    time_t fileStart = dir ? workload.start - (workload.start % interval) : workload.start;
+    nffile_t *nffile = NextFile(wfile, dir, fileStart, compress);
+    if (!nffile) exit(EXIT_FAILURE);
+    dataBlock_t *dataBlock = WriteBlock(nffile, NULL);
+
+    uint32_t numFiles = 1;
+    uint8_t *record = malloc(4096);
+    if (!record) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint64_t i = 0; i < workload.numRecords; i++) {
+        do {
+            t += rndExp(meanGap);
+        } while (workload.diurnal && rndDouble() * peak > Diurnal(&workload, t));
+
+        if (dir && t >= (double)(fileStart + interval)) {
+            FlushBlock(nffile, dataBlock);
+            CloseUpdateFile(nffile);
+            DisposeFile(nffile);
+            while (t >= (double)(fileStart + interval)) fileStart += interval;
+            nffile = NextFile(wfile, dir, fileStart, compress);
+            if (!nffile) exit(EXIT_FAILURE);
+            dataBlock = WriteBlock(nffile, NULL);
+            numFiles++;
+        }
+
+        recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)record;
+        GenRecord(&workload, &hostZipf, &portZipf, recordHeaderV3, (uint64_t)(t * 1000.0));
+        UpdateStat(nffile->stat_record, recordHeaderV3);
+        dataBlock = AppendToBuffer(nffile, dataBlock, record, recordHeaderV3->size);
+    }
+
+    FlushBlock(nffile, dataBlock);
+    CloseUpdateFile(nffile);
+    DisposeFile(nffile);
+
+    printf("%llu records in %u file(s), %s - ", (unsigned long long)workload.numRecords, numFiles, UNIX2ISO(workload.start));
+    printf("%s\n", UNIX2ISO((time_t)t));
+
+    free(record);
+    free(hostZipf.cdf);
+    free(portZipf.cdf);
+    return 0;
+}
@@ -121,9 +121,43 @@ static void CheckFilter(char *filter, recordHandle_t *recordHandle, int expect)
         DumpRecord(recordHandle);
         exit(255);
     }
+    // the block filter must agree with the record filter
+    if (FilterBlockCapable(engine)) {
+        uint8_t match = 0;
+        FilterRecordBlock(engine, &(recordHandle->recordHeaderV3), 1, &match);
+        if (match != ret) {
+            printf("*** Block filter failed for %s\n", filter);
+            printf("*** Expected %d, result: %d\n", ret, match);
+            DumpEngine(engine);
+            exit(255);
+        }
+    }
     DisposeFilter(engine);
 }
 
+// evaluate filters with shared nodes as one set and compare with each single filter result
+static void CheckFilterSet(char **filters, uint32_t numFilters, recordHandle_t *recordHandle, uint64_t expect) {
+    void *engines[64];
+    for (uint32_t i = 0; i < numFilters; i++) {
+        engines[i] = CompileFilter(filters[i]);
+        if (!engines[i]) {
+            printf("*** Compile %s failed\n", filters[i]);
+            exit(255);
+        }
+    }
+    void *filterSet = CompileFilterSet(engines, numFilters);
+    uint64_t match = 0;
+    FilterRecordSet(filterSet, recordHandle, &match);
+    if (match != expect) {
+        printf("*** Filter set failed\n");
+        printf("*** Expected %llx, result: %llx\n", (unsigned long long)expect, (unsigned long long)match);
+        exit(255);
+    }
+    printf("Filter set ok: %u filters\n", numFilters);
+    DisposeFilterSet(filterSet);
+    for (uint32_t i = 0; i < numFilters; i++) DisposeFilter(engines[i]);
+}
+
 static void runTest(void) {
     void *p = malloc(4192);
     AddV3Header(p, recordHeaderV3);
@@ -198,6 +232,10 @@ static void runTest(void) {
     CheckFilter("dst port 81 or mpls label2 32", recordHandle, 0);
     CheckFilter("dst port 80 and mpls label2 32", recordHandle, 0);
 
+    char *filterSet[] = {"proto udp and dst port 80", "proto udp and dst port 81", "not proto tcp", "dst port 80 or mpls label2 32",
+                         "proto 17 and src port 1234", "proto udp and dst port 80", "src port 1235"};
+    CheckFilterSet(filterSet, 7, recordHandle, 0x3D);
+
     genericFlow->proto = 1;
     CheckFilter("icmp-type 3", recordHandle, 0);
     genericFlow->icmpType = 3;
@@ -481,6 +519,14 @@ static void runTest(void) {
     CheckFilter("dst ip 172.16.17.18", recordHandle, 1);
     CheckFilter("dst ip in [8.8.8.8 2.2.2.2 192.168.169.170]", recordHandle, 0);
     CheckFilter("dst ip in [8.8.8.8 2.2.2.2 192.168.169.171 172.16.17.18]", recordHandle, 1);
+    // overlapping prefixes - the covering prefix is kept
+    CheckFilter("src ip in [192.168.169.171 192.168.169.168/30]", recordHandle, 1);
+    CheckFilter("src ip in [192.168.169.168/30 192.168.169.171]", recordHandle, 1);
+    CheckFilter("src ip in [192.168.169.128/25 192.168.169.0/24 192.168.169.171]", recordHandle, 1);
+    CheckFilter("src ip in [192.168.169.171 192.168.169.172/30]", recordHandle, 0);
+    CheckFilter("src ip in [192.168.169.172/30 192.168.169.160/29]", recordHandle, 0);
+    CheckFilter("dst ip in [172.16.17.19 172.16.0.0/16]", recordHandle, 1);
+    CheckFilter("dst ip in [172.16.0.0/16 172.16.17.0/24 192.168.0.0/16]", recordHandle, 1);
 
     inet_pton(PF_INET6, "fe80::2110:abcd:1234:5678", v6);
     ipv6->srcAddr[0] = ntohll(v6[0]);
@@ -503,6 +549,12 @@ static void runTest(void) {
     CheckFilter("ip in [8.8.8.8 2.2.2.2 192.168.169.171 fe80::2110:abcd:1234:5678]", recordHandle, 1);
     CheckFilter("dst ip in [8.8.8.8 2.2.2.2 192.168.169.171 fe80::2110:abcd:1234:5678]", recordHandle, 0);
     CheckFilter("dst ip in [8.8.8.8 2.2.2.2 192.168.169.171 fe80::2110:abcd:1234:5678 2001:620:0:ff::5c]", recordHandle, 1);
+    // overlapping IPv6 prefixes
+    CheckFilter("src ip in [fe80::2110:abcd:1234:5679 fe80::2110:abcd:1234:0/112]", recordHandle, 1);
+    CheckFilter("src ip in [fe80::2110:abcd:0:0/96 fe80::/16]", recordHandle, 1);
+    CheckFilter("src ip in [fe80::2110:abcd:1234:5679 fe80::2110:abcd:1234:5670/125]", recordHandle, 0);
+    CheckFilter("dst ip in [2001:620:0:ff::5d 2001:620::/32]", recordHandle, 1);
+    CheckFilter("dst ip in [2001:620::/32 2001:620:0:ff::5d 192.168.0.0/16]", recordHandle, 1);
 
     // port lists
     genericFlow->srcPort = 44331;
@@ -742,6 +794,8 @@ static void runTest(void) {
     strcpy(nselUser->username, "The nsel user");
     CheckFilter("asa user invalid", recordHandle, 0);
     CheckFilter("asa user 'The nsel user'", recordHandle, 1);
+    CheckFilter("asa user a or asa user b or asa user 'The nsel user' or asa user c", recordHandle, 1);
+    CheckFilter("asa user a or asa user b or asa user 'The nsel' or asa user c", recordHandle, 0);
 
     // EXnatCommonID
     PushExtension(recordHeaderV3, EXnatCommon, natCommon);
@@ -798,6 +852,9 @@ static void runTest(void) {
     CheckFilter("payload content 'GET /index'", recordHandle, 1);
     CheckFilter("payload content index", recordHandle, 1);
     CheckFilter("payload content 'POST'", recordHandle, 0);
+    CheckFilter("payload content POST or payload content PUT or payload content HEAD or payload content 'x.html'", recordHandle, 1);
+    CheckFilter("payload content POST or payload content PUT or payload content HEAD or payload content 'TTP/2'", recordHandle, 0);
+    CheckFilter("payload content GET and payload content HTTP and payload content index and not payload content POST", recordHandle, 1);
 
     CheckFilter("payload regex 'GET'", recordHandle, 1);
     CheckFilter("payload regex '(GET|POST)'", recordHandle, 1);
@@ -864,6 +921,8 @@ static void runTest(void) {
     CheckFilter("payload tls version 1.3", recordHandle, 0);
     CheckFilter("payload ssl sni example", recordHandle, 1);
     CheckFilter("payload ssl sni nonexist", recordHandle, 0);
+    CheckFilter("payload ssl sni foo or payload ssl sni bar or payload ssl sni nonexist or payload ssl sni ample", recordHandle, 1);
+    CheckFilter("payload ssl sni foo or payload ssl sni bar or payload ssl sni nonexist or payload ssl sni examples", recordHandle, 0);
     recordHandle->extensionList[SSLindex] = NULL;
     CheckFilter("payload ssl sni example", recordHandle, 0);
 
@@ -65,9 +65,91 @@ $NFDUMP -v test.5.flows.nf >/dev/null
 $NFDUMP -r test.5.flows.nf -q -o raw >test.5-2.out
 diff -u test.5.out test.5-2.out
 
+# test columnar block layout round trip
+cp dummy_flows.nf test.column.nf
+$NFDUMP -r test.column.nf -L column
+$NFDUMP -v test.column.nf >/dev/null
+$NFDUMP -r dummy_flows.nf -q -o extended -6 >test.column-1.out
+$NFDUMP -r test.column.nf -q -o extended -6 >test.column-2.out
+diff -u test.column-1.out test.column-2.out
+$NFDUMP -r dummy_flows.nf -q -n 0 -s dstport/bytes 'proto tcp' >test.column-1.out
+$NFDUMP -r test.column.nf -q -n 0 -s dstport/bytes 'proto tcp' >test.column-2.out
+diff -u test.column-1.out test.column-2.out
+$NFDUMP -r test.column.nf -L row
+$NFDUMP -r test.column.nf -q -o extended -6 >test.column-2.out
+$NFDUMP -r dummy_flows.nf -q -o extended -6 >test.column-1.out
+diff -u test.column-1.out test.column-2.out
+rm -f test.column.nf test.column-1.out test.column-2.out
+
+# test compact columnar block layout round trip
+cp dummy_flows.nf test.compact.nf
+$NFDUMP -r test.compact.nf -L compact
+$NFDUMP -v test.compact.nf >/dev/null
+$NFDUMP -r dummy_flows.nf -q -o extended -6 >test.compact-1.out
+$NFDUMP -r test.compact.nf -q -o extended -6 >test.compact-2.out
+diff -u test.compact-1.out test.compact-2.out
+$NFDUMP -r dummy_flows.nf -q -n 0 -s dstport/bytes 'proto tcp' >test.compact-1.out
+$NFDUMP -r test.compact.nf -q -n 0 -s dstport/bytes 'proto tcp' >test.compact-2.out
+diff -u test.compact-1.out test.compact-2.out
+$NFDUMP -r test.compact.nf -L row
+$NFDUMP -r test.compact.nf -q -o extended -6 >test.compact-2.out
+$NFDUMP -r dummy_flows.nf -q -o extended -6 >test.compact-1.out
+diff -u test.compact-1.out test.compact-2.out
+rm -f test.compact.nf test.compact-1.out test.compact-2.out
+
+# test data blocks with checksums
+printf '[nfdump]\nblockcrc = 1\n' >test.crc.conf
+$NFDUMP -C test.crc.conf -r dummy_flows.nf -z=lz4 -w test.crc.flows.nf
+$NFDUMP -v test.crc.flows.nf >/dev/null
+$NFDUMP -r test.crc.flows.nf -q -o raw >test.crc.out
+diff -u test.crc.out nftest.1.out
+rm -f test.crc.conf test.crc.flows.nf test.crc.out
+
+# test encrypted data blocks, if built with encryption
+echo 000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f >test.crypt.key
+printf '[nfdump]\nencryption.keyfile = "test.crypt.key"\n' >test.crypt.conf
+if $NFDUMP -C test.crypt.conf -r dummy_flows.nf -z=lz4 -w test.crypt.flows.nf 2>/dev/null; then
+	$NFDUMP -C test.crypt.conf -r test.crypt.flows.nf -q -o raw >test.crypt.out
+	diff -u test.crypt.out nftest.1.out
+	# no flows without the key
+	$NFDUMP -C none -r test.crypt.flows.nf -q -o raw >test.crypt.out 2>/dev/null || true
+	if grep -q RecordCount test.crypt.out; then
+		echo encrypted flows read without key
+		exit 1
+	fi
+fi
+rm -f test.crypt.key test.crypt.conf test.crypt.flows.nf test.crypt.out
+
+# test streaming flows through a pipe
+$NFDUMP -r dummy_flows.nf -z=lz4 -w - | $NFDUMP -r - -q -o raw >test.stream.out
+diff -u test.stream.out nftest.1.out
+rm -f test.stream.out
+
+# test compacting interval files into an archive
+if [ -d testcompact ]; then
+	rm -f testcompact/*
+	rmdir testcompact
+fi
+mkdir testcompact
+$NFDUMP -r dummy_flows.nf -z=lz4 -w testcompact/nfcapd.201907111030 'proto tcp'
+$NFDUMP -r dummy_flows.nf -z=lz4 -w testcompact/nfcapd.201907111035 'not proto tcp'
+for i in 1 2; do
+	$NFDUMP -r testcompact/nfcapd.201907111030 -q -o raw >test.archive-$i.out
+	$NFDUMP -r testcompact/nfcapd.201907111035 -q -o raw >>test.archive-$i.out
+	$NFDUMP -R testcompact -t 2019/07/11.10:30:00-2019/07/11.10:30:10 -q -o raw >>test.archive-$i.out
+	if [ $i -eq 1 ]; then
+		../nfcompact/nfcompact -l testcompact
+		test ! -f testcompact/nfcapd.201907111030
+		$NFDUMP -v testcompact/nfarchive.2019071110 >/dev/null
+	fi
+done
+diff -u test.archive-1.out test.archive-2.out
+rm -f testcompact/* test.archive-1.out test.archive-2.out
+rmdir testcompact
+
 # create testdir dir for flow replay
 if [ -d testdir ]; then
-	rm -f testdir/*
+	rm -f testdir/* testdir/.nfcatalog testdir/.tplcache.*
 	rmdir testdir
 fi
 mkdir testdir
@@ -98,6 +180,8 @@ $NFDUMP -r dummy_flows.nf -q -o extended -6 'packets > 0' >test.6-1.out
 $NFDUMP -r testdir/nfcapd.* -q -o extended -6 >test.6-2.out
 
 diff test.6-1.out test.6-2.out
+$NFDUMP -R testdir -q -o extended -6 >test.6-3.out
+diff test.6-1.out test.6-3.out
 
 # Test propper AppendRename
 # Start nfcapd on localhost and replay flows
@@ -151,12 +235,13 @@ export MallocCorruptionAbort=1
 $NFDUMP -r dummy_flows.nf 'host 172.16.2.66'
 $NFDUMP -r dummy_flows.nf -s ip 'host 172.16.2.66'
 $NFDUMP -r dummy_flows.nf -s record 'host 172.16.2.66'
+$NFDUMP -r dummy_flows.nf -A dstport -o 'fmt:%dp %fl %p50td %p95td %p99bpp'
 $NFDUMP -r dummy_flows.nf -w test.7.flows.nf 'host 172.16.2.66'
 $NFDUMP -r dummy_flows.nf -O tstart -w test.8.flows.nf 'host 172.16.2.66'
 ../nfanon/nfanon -K abcdefghijklmnopqrstuvwxyz012345 -r dummy_flows.nf -w test.9.flows.nf
 $NFDUMP -q -r test.9.flows.nf -o raw >test.9.out
 $NFDUMP -r testdir/nfcapd.* -i NewIdent
-rm -f testdir/nfcapd.* test*.out test*.flows.nf dummy_flows.nf
+rm -f testdir/nfcapd.* testdir/.nfcatalog testdir/.tplcache.* test*.out test*.flows.nf dummy_flows.nf
 [ -d testdir ] && rmdir testdir
 [ -d memck.$$ ] && rm -rf memck.$$
 
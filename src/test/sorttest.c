@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *	 this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *	 this list of conditions and the following disclaimer in the documentation
+ *	 and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *	 used to endorse or promote products derived from this software without
+ *	 specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * micro benchmark and correctness check for blocksort()/blockselect()
+ * usage: sorttest [num elements] - default 2000000
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "blocksort.h"
+
+static uint64_t rnd_state = 0x9E3779B97F4A7C15LL;
+
+static inline uint64_t rnd(void) {
+    // xorshift64
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}  // End of rnd
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}  // End of now
+
+// keys of different distributions
+static void fill(SortElement_t *data, int len, int mode) {
+    uint64_t msec = 1704067200000LL;
+    for (int i = 0; i < len; i++) {
+        data[i].record = (void *)(uintptr_t)i;
+        switch (mode) {
+            case 0:  // random 64bit counters
+                data[i].count = rnd();
+                break;
+            case 1:  // msec timestamps within an hour
+                data[i].count = msec + rnd() % 3600000;
+                break;
+            case 2:  // byte counters, many duplicates
+                data[i].count = rnd() % 1500;
+                break;
+            case 3:  // presorted
+                data[i].count = i;
+                break;
+        }
+    }
+}  // End of fill
+
+// check order and that the array is still a permutation of the records
+static int verify(SortElement_t *data, int len, int first, int last) {
+    uint8_t *seen = calloc(len, 1);
+    if (!seen) {
+        perror("calloc() failed");
+        exit(255);
+    }
+    for (int i = 0; i < len; i++) {
+        uintptr_t rec = (uintptr_t)data[i].record;
+        if (rec >= (uintptr_t)len || seen[rec]) {
+            printf("Record %d lost or duplicated\n", i);
+            free(seen);
+            return 0;
+        }
+        seen[rec] = 1;
+    }
+    free(seen);
+    for (int i = first + 1; i < last; i++) {
+        if (data[i - 1].count > data[i].count) {
+            printf("Sort order error at %d: %llu > %llu\n", i, (unsigned long long)data[i - 1].count, (unsigned long long)data[i].count);
+            return 0;
+        }
+    }
+    return 1;
+}  // End of verify
+
+int main(int argc, char **argv) {
+    int len = argc > 1 ? atoi(argv[1]) : 2000000;
+    if (len < 1) {
+        printf("usage: %s [num elements]\n", argv[0]);
+        exit(255);
+    }
+
+    SortElement_t *data = malloc(len * sizeof(SortElement_t));
+    if (!data) {
+        perror("malloc() failed");
+        exit(255);
+    }
+
+    char *modeName[] = {"random", "timestamp", "duplicates", "sorted"};
+    for (int mode = 0; mode < 4; mode++) {
+        fill(data, len, mode);
+        double t = now();
+        blocksort(data, len);
+        t = now() - t;
+        if (!verify(data, len, 0, len)) exit(255);
+        printf("blocksort   %-10s %10d elements: %8.3f s\n", modeName[mode], len, t);
+
+        int topN = len > 1000 ? 100 : 1;
+        fill(data, len, mode);
+        t = now();
+        blockselect(data, len, topN, 0);
+        t = now() - t;
+        if (!verify(data, len, len - topN, len)) exit(255);
+        printf("blockselect %-10s %10d elements: %8.3f s, top %d\n", modeName[mode], len, t, topN);
+    }
+
+    free(data);
+    printf("Sort test successful\n");
+    return 0;
+}